@@ -273,6 +273,7 @@ void copyWhiteToRDRAM(FrameBuffer * _pBuffer)
 			for (u32 x = 0; x < VI.width; ++x)
 				ptr_dst[x + y*VI.width] = 0xFFFFFFFF;
 		}
+		plugin_notify_dram_write(_pBuffer->m_startAddress, VI.width * VI.height * 4);
 	} else {
 		u16 *ptr_dst = (u16*)(RDRAM + _pBuffer->m_startAddress);
 
@@ -281,6 +282,7 @@ void copyWhiteToRDRAM(FrameBuffer * _pBuffer)
 				ptr_dst[(x + y*VI.width) ^ 1] = 0xFFFF;
 			}
 		}
+		plugin_notify_dram_write(_pBuffer->m_startAddress, VI.width * VI.height * 2);
 	}
 	_pBuffer->m_copiedToRdram = true;
 	_pBuffer->copyRdram();
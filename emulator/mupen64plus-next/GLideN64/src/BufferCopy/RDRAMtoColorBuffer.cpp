@@ -236,6 +236,7 @@ void RDRAMtoColorBuffer::_copyFromRDRAM(u32 _height, bool _fullAlpha)
 			if (address + totalBytes > RDRAMSize + 1)
 				totalBytes = RDRAMSize + 1 - address;
 			memset(RDRAM + address, 0, totalBytes);
+			plugin_notify_dram_write(address, totalBytes);
 		}
 	}
 
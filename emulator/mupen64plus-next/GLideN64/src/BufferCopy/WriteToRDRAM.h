@@ -3,6 +3,7 @@
 
 
 #include "../Types.h"
+#include "../N64.h"
 
 template <typename T, T testValue>
 bool valueTester(T _c)
@@ -29,10 +30,12 @@ void writeToRdram(TSrc* _src, TDst* _dst,
 	u32 _bufferSize)
 {
 	u32 chunkStart = ((_startAddress - _bufferAddress) >> (_bufferSize - 1)) % _width;
+	u32 firstAddress = _startAddress;
 	if (chunkStart % 2 != 0) {
 		--chunkStart;
 		--_dst;
 		++_numPixels;
+		firstAddress -= sizeof(TDst);
 	}
 
 	u32 numStored = 0;
@@ -59,6 +62,9 @@ void writeToRdram(TSrc* _src, TDst* _dst,
 		}
 		++dsty;
 	}
+
+	// _xor swaps pixels within a word, so round out to whole words
+	plugin_notify_dram_write(firstAddress & ~3, numStored * sizeof(TDst) + 4);
 }
 
 #endif // WriteToRDRAM_H
@@ -63,6 +63,11 @@ EXPORT void CALL gln64FBWrite(unsigned int addr, unsigned int size)
 	api().FBWrite(addr, size);
 }
 
+EXPORT void CALL gln64FBWriteRange(unsigned int begin, unsigned int end)
+{
+	api().FBWriteRange(begin, end);
+}
+
 EXPORT void CALL gln64FBRead(unsigned int addr)
 {
 	api().FBRead(addr);
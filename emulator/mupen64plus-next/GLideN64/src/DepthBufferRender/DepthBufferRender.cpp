@@ -209,6 +209,12 @@ void Rasterize(vertexi * vtx, int vertices, int dzdx)
 	const u16 * const zLUT = depthBufferList().getZLUT();
 	const s32 depthBufferWidth = static_cast<s32>(depthBufferList().getCurrent()->m_width);
 
+	// lines the triangle can write, within the scissor
+	const int firstLine = std::max(y1, (int)gDP.scissor.uly);
+	if (firstLine < (int)gDP.scissor.lry)
+		plugin_notify_dram_write(gDP.depthImageAddress + firstLine * depthBufferWidth * 2,
+			((int)gDP.scissor.lry - firstLine) * depthBufferWidth * 2);
+
 	for (;;) {
 		int x1 = iceil(left_x);
 		if (x1 < (int)gDP.scissor.ulx)
@@ -238,6 +238,7 @@ void FrameBuffer::copyRdram()
 			else
 				pData[start++] = 0;
 		}
+		plugin_notify_dram_write(m_startAddress, twoPercent * 4);
 		m_fingerprint = true;
 		return;
 	}
@@ -1717,6 +1718,8 @@ void FrameBufferList::fillRDRAM(s32 ulx, s32 uly, s32 lrx, s32 lry)
 		}
 		dst += ci_width_in_dwords;
 	}
+	if (uly < lry)
+		plugin_notify_dram_write(gDP.colorImage.address + static_cast<u32>(uly) * stride, static_cast<u32>(lry - uly) * stride);
 
 	m_pCurrent->setBufferClearParams(gDP.fillColor.color, ulx, uly, lrx, lry);
 }
@@ -48,6 +48,26 @@ namespace FBInfo {
 		FrameBuffer_AddAddress(address, size);
 	}
 
+	void FBInfo::WriteRange(u32 begin, u32 end)
+	{
+		const u32 address = RSP_SegmentToPhysical(begin);
+		const u32 length = end - begin + 1;
+		const FrameBuffer* writeBuffer = frameBufferList().findBuffer(address);
+		if (writeBuffer == nullptr)
+			return;
+		const auto findRes = _findBuffer(m_writeBuffers, writeBuffer);
+		if (!findRes.first)
+			m_writeBuffers[findRes.second] = writeBuffer;
+
+		u32 size = 1;
+		if (length % 4 == 0)
+			size = 4;
+		else if (length % 2 == 0)
+			size = 2;
+		for (u32 i = 0; i < length; i += size)
+			FrameBuffer_AddAddress(address + i, size);
+	}
+
 	void FBInfo::WriteList(FrameBufferModifyEntry *plist, u32 size)
 	{
 		LOG(LOG_WARNING, "FBWList size=%u", size);
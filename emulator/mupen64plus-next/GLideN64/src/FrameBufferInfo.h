@@ -32,6 +32,8 @@ namespace FBInfo {
 
 		void Write(u32 addr, u32 size);
 
+		void WriteRange(u32 begin, u32 end);
+
 		void WriteList(FrameBufferModifyEntry *plist, u32 size);
 
 		void Read(u32 addr);
@@ -23,6 +23,17 @@ extern "C" {
 *******************************************************************/
 EXPORT void CALL FBWrite(unsigned int addr, unsigned int size);
 
+/******************************************************************
+  Function: FrameBufferWriteRange
+  Purpose:  This function is called to notify the dll that the
+            frame buffer has been modified by a DMA between the
+            given addresses. It replaces one FBWrite call per word.
+  input:    begin		first modified rdram address
+			end			last modified rdram address (inclusive)
+  output:   none
+*******************************************************************/
+EXPORT void CALL FBWriteRange(unsigned int begin, unsigned int end);
+
 struct FrameBufferModifyEntry;
 
 /******************************************************************
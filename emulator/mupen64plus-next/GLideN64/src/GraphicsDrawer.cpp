@@ -1231,6 +1231,7 @@ bool texturedRectDepthBufferCopy(const GraphicsDrawer::TexturedRectParams & _par
 		u16 *pDst = reinterpret_cast<u16*>(RDRAM + gDP.colorImage.address);
 		for (u32 x = 0; x < width; ++x)
 			pDst[(ulx + x) ^ 1] = swapword(pSrc[x]);
+		plugin_notify_dram_write(gDP.colorImage.address + (ulx & ~1) * 2, width * 2 + 4);
 
 		return true;
 	}
@@ -1270,6 +1271,9 @@ bool texturedRectBGCopy(const GraphicsDrawer::TexturedRectParams & _params)
 		u8 *dst = fbaddr + y * gDP.colorImage.width;
 		memcpy(dst, src, width);
 	}
+	if (uly < lry)
+		plugin_notify_dram_write(gDP.colorImage.address + static_cast<u32>(_params.ulx) + uly * gDP.colorImage.width,
+			(lry - uly - 1) * gDP.colorImage.width + width);
 	frameBufferList().removeBuffer(gDP.colorImage.address);
 	return true;
 }
@@ -1284,6 +1288,7 @@ bool texturedRectPaletteMod(const GraphicsDrawer::TexturedRectParams & _params)
 
 		if (gDP.colorImage.address == 0x400 && gDP.colorImage.width == 64) {
 			memcpy(RDRAM + 0x400, RDRAM + 0x14d500, 4096);
+			plugin_notify_dram_write(0x400, 4096);
 			return true;
 		}
 
@@ -1312,6 +1317,7 @@ bool texturedRectPaletteMod(const GraphicsDrawer::TexturedRectParams & _params)
 	u16 * dst = reinterpret_cast<u16*>(RDRAM + gDP.colorImage.address);
 	for (u32 i = 0; i < 16; ++i)
 		dst[i ^ 1] = (src[i << 2] & 0x100) ? prim16 : env16;
+	plugin_notify_dram_write(gDP.colorImage.address, 32);
 	return true;
 }
 
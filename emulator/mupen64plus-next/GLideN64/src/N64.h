@@ -43,6 +43,9 @@ extern "C" {
 	// See comment in N64.cpp
 	extern u8 *DMEM;
 	extern u8 *IMEM;
+
+	// Tells the core which RDRAM the plugin wrote, see mupen64plus-next_common.h
+	void plugin_notify_dram_write(u32 address, u32 length);
 }
 
 extern u8 *RDRAM;
@@ -68,6 +68,7 @@ public:
 
 	// FrameBufferInfo extension
 	void FBWrite(unsigned int addr, unsigned int size);
+	void FBWriteRange(unsigned int begin, unsigned int end);
 	void FBWList(FrameBufferModifyEntry *plist, unsigned int size);
 	void FBRead(unsigned int addr);
 	void FBGetFrameBufferInfo(void *pinfo);
@@ -92,6 +93,7 @@ public:
 
 	// FrameBufferInfo extension
 	void FBWrite(unsigned int addr, unsigned int size);
+	void FBWriteRange(unsigned int begin, unsigned int end);
 	void FBRead(unsigned int addr);
 	void FBGetFrameBufferInfo(void *pinfo);
 #endif
@@ -284,6 +284,11 @@ void PluginAPI::FBWrite(unsigned int _addr, unsigned int _size)
 	FBInfo::fbInfo.Write(_addr, _size);
 }
 
+void PluginAPI::FBWriteRange(unsigned int _begin, unsigned int _end)
+{
+	FBInfo::fbInfo.WriteRange(_begin, _end);
+}
+
 void PluginAPI::FBRead(unsigned int _addr)
 {
 #ifdef RSPTHREAD
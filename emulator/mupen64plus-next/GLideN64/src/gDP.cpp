@@ -384,6 +384,8 @@ bool CheckForFrameBufferTexture(u32 _address, u32 _width, u32 _bytes)
 				memcpy(RDRAM + gDP.depthImageAddress,
 					RDRAM + pBuffer->m_startAddress,
 					(pBuffer->m_width*pBuffer->m_height) << pBuffer->m_size >> 1);
+				plugin_notify_dram_write(gDP.depthImageAddress,
+					(pBuffer->m_width*pBuffer->m_height) << pBuffer->m_size >> 1);
 				pBuffer->m_copiedToRdram = false;
 				fbList.getCurrent()->m_isPauseScreen = true;
 			}
@@ -973,10 +973,13 @@ void F5INDI_GenParticlesVertices()
 	}
 
 	memcpy(RDRAM + _SHIFTR(params[2], 0, 24), DMEM + 0x170, 256);
+	plugin_notify_dram_write(_SHIFTR(params[2], 0, 24), 256);
 
 	if ((M & 0x04) == 0) {
 		*CAST_RDRAM(u32*, _SHIFTR(params[3], 0, 24)) = L & (~Q);
 		memcpy(RDRAM + _SHIFTR(params[1], 8, 24), DMEM + 0xB00, count * 8);
+		plugin_notify_dram_write(_SHIFTR(params[3], 0, 24), 4);
+		plugin_notify_dram_write(_SHIFTR(params[1], 8, 24), count * 8);
 	}
 }
 
@@ -608,6 +608,7 @@ void _drawYUVImageToFrameBuffer(const ObjCoordinates & _objCoords)
 		}
 		dst += ci_width - 16;
 	}
+	plugin_notify_dram_write(gDP.colorImage.address + (ulx + uly * ci_width) * 2, ((height - 1) * ci_width + width) * 2);
 	FrameBuffer *pBuffer = frameBufferList().getCurrent();
 	if (pBuffer != nullptr)
 		pBuffer->m_isOBScreen = true;
@@ -438,6 +438,7 @@ void ZSort_MoveMem( u32 _w0, u32 _w1 )
 		} else {
 			int dmem_addr = (idx<<3) + ofs;
 			memcpy(RDRAM + addr, DMEM + dmem_addr, len);
+			plugin_notify_dram_write(addr, len);
 		}
 	break;
 
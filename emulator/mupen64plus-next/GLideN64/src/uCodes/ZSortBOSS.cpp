@@ -220,6 +220,7 @@ void ZSortBOSS_MoveMem( u32 _w0, u32 _w1 )
 		memcpy((DMEM + (_w0 & 0xfff)), (RDRAM + addr), len);
 	} else {
 		memcpy((RDRAM + addr), (DMEM + (_w0 & 0xfff)), len);
+		plugin_notify_dram_write(addr, len);
 	}
 }
 
@@ -629,6 +630,7 @@ void ZSortBOSS_Audio1( u32 _w0, u32 _w1 )
 	u32 val = ((u32*)DMEM)[(_w0 & 0xfff) >> 2];
 	((u32*)DMEM)[0] = val;
 	memcpy(RDRAM+addr, DMEM, 0x8);
+	plugin_notify_dram_write(addr, 0x8);
 	LOG(LOG_VERBOSE, "ZSortBOSS_Audio1 (0x%08x, 0x%08x)", _w0, _w1);
 }
 
@@ -0,0 +1,3889 @@
+/* Generated by generate-romdb-header.py from mupen64plus-core/data/mupen64plus.ini, do not edit. */
+
+#ifndef __ROMDB_H__
+#define __ROMDB_H__
+
+static const romdatabase_entry romdb_entries[3279] = {
+    { "007 - Goldfinger", { 0xA5, 0x6B, 0x15, 0xFA, 0xF2, 0x43, 0x89, 0xDD, 0x37, 0x5E, 0x7A, 0xFB, 0x03, 0xA7, 0xD3, 0xC1 }, NULL, NULL, 0xB2242748, 0xFFBD61DA, 1, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x37 },
+    { "007 - The World is Not Enough (E) (M3) [!]", { 0x34, 0xAB, 0x1D, 0xEA, 0x31, 0x11, 0xA2, 0x33, 0xA8, 0xB5, 0xC5, 0x67, 0x9D, 0xE2, 0x2E, 0x83 }, NULL, NULL, 0x3B941695, 0xF90A5EEB, 1, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "007 - The World is Not Enough (E) [T+Spa1.0.1_IlDucci]", { 0x55, 0x13, 0x24, 0xF5, 0xFD, 0x0A, 0x2B, 0x0B, 0xC2, 0xB1, 0xBF, 0xBB, 0x0F, 0xE2, 0x9C, 0x08 }, NULL, NULL, 0xD8C74049, 0x29CDD8C4, 1, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "007 - The World is Not Enough (U) [!]", { 0x9D, 0x58, 0x99, 0x6A, 0x8A, 0xA9, 0x12, 0x63, 0xB5, 0xCD, 0x45, 0xC3, 0x85, 0xF4, 0x5F, 0xE4 }, NULL, NULL, 0x033F4C13, 0x319EE7A7, 1, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "007 - The World is Not Enough (U) (Beta) [!]", { 0x12, 0xBD, 0x3F, 0xAF, 0xB4, 0xE0, 0x64, 0xB6, 0xB0, 0xC0, 0x7B, 0x7E, 0xE1, 0x56, 0x24, 0x3B }, NULL, NULL, 0xA92E0966, 0x341C3912, 1, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "007 - The World is Not Enough (U) [t1]", { 0x08, 0x46, 0xFF, 0xFD, 0xA3, 0x08, 0x18, 0x21, 0xEA, 0x0D, 0xCB, 0xB7, 0xD4, 0xDE, 0xAA, 0xA3 }, NULL, NULL, 0x5B6AC01B, 0x8D1A562A, 1, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "007 - The World is Not Enough (U) [t1][f1] (PAL-NTSC)", { 0x1D, 0x86, 0xAE, 0x43, 0xFF, 0x88, 0xE4, 0x58, 0x3C, 0x81, 0x61, 0x81, 0x55, 0x77, 0xF1, 0xCD }, NULL, NULL, 0x5B6AC01B, 0x8D1A562A, 1, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "1080 Snowboarding (E) (M4) [!]", { 0x63, 0x2C, 0x98, 0xCF, 0x28, 0x1C, 0xDA, 0x77, 0x6E, 0x66, 0x68, 0x5B, 0x27, 0x8A, 0x4F, 0xA6 }, NULL, NULL, 0x58FD3F25, 0xD92EAA8D, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (E) (M4) [b1]", { 0x4E, 0x08, 0xD2, 0x9B, 0x09, 0x4C, 0x13, 0xC0, 0x30, 0xAC, 0x73, 0xA1, 0xDA, 0x2F, 0x8C, 0xD2 }, NULL, NULL, 0x6BB11645, 0x2C6F637E, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (E) (M4) [b1][f2] (NTSC)", { 0x4F, 0xCA, 0x13, 0x2D, 0x6C, 0x96, 0x13, 0x03, 0x71, 0xF4, 0x18, 0x6A, 0x3D, 0xF8, 0x50, 0x77 }, NULL, NULL, 0x58FD3F25, 0xD92EAA8D, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (E) (M4) [f1]", { 0xEC, 0x9D, 0xB3, 0x26, 0x24, 0xB6, 0xC1, 0x63, 0x76, 0x42, 0x9D, 0x06, 0x60, 0xF0, 0x71, 0x0B }, NULL, NULL, 0xAF61F386, 0x29F1112C, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (E) (M4) [f2] (NTSC)", { 0x5C, 0xA3, 0xA4, 0x5C, 0x21, 0xE1, 0x6E, 0xDA, 0xFB, 0xAF, 0xE1, 0xBD, 0x04, 0x91, 0xDC, 0x8D }, NULL, NULL, 0x93C5ED78, 0xF67E8528, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [!]", { 0xFA, 0x27, 0x08, 0x9C, 0x42, 0x5D, 0xBA, 0xB9, 0x9F, 0x19, 0x24, 0x5C, 0x5C, 0x99, 0x76, 0x13 }, NULL, NULL, 0x1FBAF161, 0x2C1C54F1, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [b1]", { 0xE4, 0x28, 0x18, 0x1D, 0x57, 0x3E, 0x25, 0xDC, 0xC0, 0xDC, 0x7F, 0x9F, 0x3B, 0xF4, 0xD1, 0xE1 }, NULL, NULL, 0x92072A84, 0x275952F8, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [b2]", { 0xA3, 0xD3, 0x0F, 0xBD, 0xFD, 0x84, 0xB5, 0xE7, 0x29, 0x85, 0x68, 0xBB, 0xD5, 0xCE, 0xD7, 0xFD }, NULL, NULL, 0x1FBAF161, 0x2C1C54F1, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [b3]", { 0xFE, 0x15, 0xA6, 0xE7, 0xAF, 0x4E, 0x37, 0x48, 0x72, 0x52, 0x36, 0x9D, 0x6F, 0x0A, 0xB3, 0x5B }, NULL, NULL, 0x92072A84, 0x275952F8, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [b4]", { 0x76, 0x57, 0xC4, 0xBB, 0x92, 0xE3, 0xF6, 0xF1, 0x26, 0xD9, 0x4F, 0x59, 0x42, 0xFD, 0xB4, 0x45 }, NULL, NULL, 0x92072A84, 0x275952F8, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [b5]", { 0xC7, 0xAC, 0x74, 0x60, 0xAF, 0x38, 0x97, 0xBB, 0x38, 0xD6, 0x74, 0x5B, 0xC4, 0x55, 0x7C, 0x8E }, NULL, NULL, 0x92072A84, 0x275952F8, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [b6]", { 0xFE, 0x32, 0x03, 0x27, 0xCF, 0x6E, 0xDC, 0x64, 0xD0, 0x6B, 0xFA, 0x56, 0xD8, 0xE7, 0xA0, 0x85 }, NULL, NULL, 0x92072A84, 0x275952F8, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [b7]", { 0xC3, 0x6A, 0xC0, 0x32, 0xE3, 0x6C, 0x61, 0x72, 0x36, 0x98, 0x34, 0x4C, 0x33, 0xDC, 0x1F, 0x7E }, NULL, NULL, 0x92072A84, 0x275952F8, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [b8]", { 0xDA, 0xFE, 0x88, 0x0C, 0xEF, 0x56, 0xAF, 0x02, 0x31, 0xEB, 0xA2, 0x39, 0x02, 0x59, 0xA2, 0xAC }, NULL, NULL, 0x92072A84, 0x275952F8, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [b9]", { 0xA0, 0xB2, 0xE3, 0x9F, 0xD3, 0xFE, 0x38, 0x02, 0xC3, 0x69, 0xA6, 0x93, 0x74, 0x16, 0xB3, 0x8E }, NULL, NULL, 0x1FBAF161, 0x2C1C54F1, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [ba]", { 0x2C, 0x6A, 0x75, 0x57, 0x09, 0x97, 0xBA, 0x7A, 0x12, 0x44, 0x95, 0x0A, 0xC8, 0xFE, 0x6C, 0xBF }, NULL, NULL, 0x35F53383, 0x0C8D0AE4, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [f1] (DS-1)", { 0x3B, 0x56, 0x91, 0xB8, 0x95, 0xB4, 0x15, 0x05, 0x6E, 0x4E, 0xA6, 0x96, 0x95, 0xDC, 0x26, 0xB4 }, NULL, NULL, 0x92072A84, 0x275952F8, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [f2] (PAL)", { 0x6C, 0xEA, 0xCF, 0x73, 0xF0, 0x3B, 0xA3, 0xDE, 0x74, 0x0B, 0xDB, 0x00, 0xD7, 0xCC, 0x18, 0xA1 }, NULL, NULL, 0x9207357A, 0xE85D4001, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [f2][b1]", { 0x76, 0x5D, 0xC0, 0x57, 0x50, 0x7A, 0xA3, 0x2D, 0xAA, 0xEC, 0x19, 0x4E, 0x32, 0xFF, 0x26, 0xB1 }, NULL, NULL, 0x1FBAF161, 0x2C1C54F1, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [f3][t1]", { 0x1E, 0xD9, 0xC6, 0x97, 0xBD, 0x2F, 0x2A, 0xEB, 0xE6, 0xB3, 0xB8, 0xBF, 0x0D, 0x24, 0xA8, 0xCA }, NULL, NULL, 0x92072A84, 0x275952F8, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [f3][t2] (All Levels)", { 0xC7, 0x05, 0x78, 0x05, 0x4A, 0xA0, 0x0D, 0x7F, 0x95, 0xAE, 0x1D, 0x64, 0xE3, 0xAA, 0x99, 0x95 }, NULL, NULL, 0x92072A84, 0x275952F8, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [f4] (PAL-Z64)", { 0x00, 0xCE, 0x20, 0x76, 0x68, 0x66, 0x88, 0x30, 0x63, 0xAF, 0x3A, 0x6C, 0x33, 0x68, 0x03, 0x9F }, NULL, NULL, 0x92072A84, 0x275952F8, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [f5] (SRAM)", { 0xAE, 0xE3, 0xFA, 0x92, 0x8B, 0x2C, 0x1B, 0x73, 0xD8, 0x41, 0xB4, 0x70, 0x74, 0xD9, 0x1C, 0x71 }, NULL, NULL, 0x92072A84, 0x275952F8, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [h1C]", { 0xB5, 0xAC, 0x31, 0xD5, 0x84, 0xBB, 0x2E, 0xF9, 0x3C, 0x2A, 0x22, 0x9E, 0x19, 0xB6, 0xD9, 0xA1 }, NULL, NULL, 0x35F53383, 0x0C8D0AE4, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1080 Snowboarding (JU) (M2) [h2C]", { 0x13, 0x62, 0x45, 0x69, 0x2E, 0x02, 0x00, 0x3E, 0xD1, 0xA9, 0x72, 0xF4, 0x24, 0xCD, 0x93, 0x23 }, NULL, NULL, 0x92072A84, 0x275952F8, 2, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "1964 Demo by Steb (PD)", { 0xEC, 0x44, 0x58, 0x44, 0x3F, 0xBA, 0x0F, 0x09, 0xB8, 0x59, 0x3A, 0xC5, 0xED, 0x11, 0x4C, 0x26 }, NULL, NULL, 0x5C450380, 0x4B5CB6E6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "2 Blokes & An Armchair - Nintendo 64 Remix Remix by Tesko (PD) [f1]", { 0xE7, 0x6E, 0xA3, 0x0A, 0x71, 0xF9, 0xDC, 0x19, 0xC6, 0x50, 0x25, 0x91, 0xFA, 0x7C, 0xB8, 0xE2 }, NULL, NULL, 0x04815914, 0x87141455, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "2 Blokes & An Armchair - Nintendo 64 Remix Remix by Tesko (PD)", { 0xB0, 0x5E, 0x10, 0x85, 0x7A, 0x76, 0xAB, 0x70, 0xA8, 0x30, 0x17, 0xAD, 0xDE, 0x8A, 0x8A, 0xCC }, NULL, NULL, 0x04815914, 0x87141455, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "3DS Model Conversion by Snake (PD)", { 0x8B, 0xEC, 0x4E, 0xDF, 0xA1, 0x44, 0x68, 0x59, 0xDA, 0x89, 0x6E, 0x4E, 0xBA, 0xE8, 0xF9, 0x25 }, NULL, NULL, 0x4C304819, 0x2CBE7573, 4, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "3DS Model Conversion by Snake (PD) [h1C]", { 0xDF, 0x6B, 0xC3, 0x8C, 0x3D, 0x0C, 0x72, 0x2D, 0xAD, 0xD4, 0xEE, 0xDB, 0x5D, 0xFC, 0xE3, 0x05 }, NULL, NULL, 0x4C304819, 0x2CBE7573, 4, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "40 Winks (E) (M3) (Prototype)", { 0x0A, 0x5A, 0xCF, 0xEA, 0x0C, 0x7C, 0xF6, 0x8A, 0xE2, 0x52, 0x02, 0x04, 0x0D, 0x5A, 0xD1, 0xEB }, NULL, NULL, 0xABA51D09, 0xC668BAD9, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "40 Winks (U) (Prototype)", { 0x8C, 0x3E, 0x4F, 0xE5, 0xF6, 0xB2, 0xD3, 0x7C, 0x66, 0xA7, 0x10, 0x97, 0xE8, 0xB1, 0xC7, 0x2A }, NULL, NULL, 0xAA94493C, 0x3736CC22, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "40 Winks (U) (Unl)", { 0xB8, 0x8C, 0x17, 0x2E, 0xD1, 0x4F, 0x4A, 0xCB, 0x43, 0xC4, 0xA3, 0x52, 0xD7, 0x1C, 0xC6, 0x40 }, NULL, NULL, 0x5EF44642, 0x44D05A25, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "64 Hanafuda - Tenshi no Yakusoku (J) [!]", { 0x66, 0x33, 0x5F, 0x4D, 0xC6, 0xAB, 0x27, 0x03, 0x43, 0x98, 0xBC, 0x26, 0xF2, 0x63, 0xB8, 0x97 }, NULL, NULL, 0x36F22FBF, 0x318912F2, 5, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "64 Oozumou (J) [!]", { 0x2C, 0xF9, 0xED, 0xB5, 0x1A, 0xDA, 0x9D, 0xE2, 0xAE, 0x7A, 0xD9, 0xFD, 0x5A, 0xCC, 0x55, 0x80 }, NULL, NULL, 0x9C961069, 0xF5EA488D, 5, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "64 Oozumou (J) [b1]", { 0x88, 0x76, 0x3C, 0x3F, 0xD5, 0x0E, 0x03, 0x6B, 0xBB, 0x9C, 0xF5, 0x04, 0xF7, 0x7C, 0x07, 0x41 }, NULL, NULL, 0x9C961069, 0xF5EA488D, 5, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "64 Oozumou (J) [b2]", { 0x9A, 0x73, 0x76, 0x09, 0xD5, 0xA7, 0x56, 0x55, 0x89, 0xDA, 0x44, 0x38, 0x1C, 0x47, 0x6F, 0xD3 }, NULL, NULL, 0x9C961069, 0xF5EA488D, 5, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "64 Oozumou (J) [b3]", { 0xCD, 0x4F, 0x6C, 0x55, 0xA7, 0x56, 0x7A, 0x25, 0x95, 0x49, 0x08, 0xDF, 0x61, 0x3B, 0x23, 0x6F }, NULL, NULL, 0x9C961069, 0xF5EA488D, 5, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "64 Oozumou 2 (J) [!]", { 0xF7, 0xC7, 0x96, 0x37, 0x1E, 0x77, 0xE0, 0xA6, 0xFB, 0xD0, 0x2E, 0xB8, 0x66, 0x34, 0x19, 0x52 }, NULL, NULL, 0x85C18B16, 0xDF9622AF, 5, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "64 Trump Collection - Alice no Wakuwaku Trump World (J) [!]", { 0x6B, 0x94, 0x7F, 0x65, 0x47, 0x75, 0xCF, 0x5D, 0xAC, 0xD1, 0xE5, 0xD5, 0x3D, 0x57, 0x7D, 0xA7 }, NULL, NULL, 0x7A6081FC, 0xFF8F7A78, 5, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "64 Trump Collection - Alice no Wakuwaku Trump World (J) [h1C]", { 0x2C, 0x6F, 0xDC, 0xF4, 0xA6, 0xA6, 0x61, 0x4D, 0x09, 0x22, 0x4E, 0xFA, 0xA5, 0x5F, 0xB5, 0x31 }, NULL, NULL, 0x7A6081FC, 0xFF8F7A78, 5, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "64 de Hakken!! Tamagotchi Minna de Tamagotchi World (J) [!]", { 0xEA, 0x6A, 0x92, 0xDE, 0x5A, 0x22, 0x1A, 0x00, 0x81, 0x4F, 0x74, 0x48, 0xBF, 0x6F, 0x1B, 0x31 }, NULL, NULL, 0xB98BA456, 0x5B2B76AF, 2, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45F },
+    { "64 de Hakken!! Tamagotchi Minna de Tamagotchi World (J) [b1]", { 0x11, 0xB2, 0x0C, 0xFE, 0x8E, 0x3E, 0xCC, 0xC6, 0x80, 0xAA, 0x81, 0x57, 0xA7, 0x90, 0x6D, 0x6D }, NULL, NULL, 0xB98BA456, 0x5B2B76AF, 2, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45F },
+    { "64 de Hakken!! Tamagotchi Minna de Tamagotchi World (J) [h1C]", { 0xD8, 0xF6, 0xD8, 0x87, 0xB9, 0x4B, 0xA9, 0x13, 0xEF, 0x60, 0xA0, 0xB0, 0x3F, 0x78, 0x1A, 0xE6 }, NULL, NULL, 0xB98BA456, 0x5B2B76AF, 2, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45F },
+    { "64 de Hakken!! Tamagotchi Minna de Tamagotchi World (J) [h2C]", { 0x32, 0x6B, 0xF8, 0x5C, 0x5E, 0xF1, 0x58, 0x20, 0x53, 0x64, 0x71, 0x04, 0x54, 0xEE, 0x1A, 0xF1 }, NULL, NULL, 0xB98BA456, 0x5B2B76AF, 2, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45F },
+    { "64 de Hakken!! Tamagotchi Minna de Tamagotchi World (J) [o1]", { 0x11, 0xB8, 0x91, 0xB7, 0x55, 0x1B, 0xFB, 0xDB, 0x79, 0x73, 0x2B, 0xFB, 0x94, 0xB4, 0x56, 0x03 }, NULL, NULL, 0xB98BA456, 0x5B2B76AF, 2, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45F },
+    { "77a Special Edition by Count0 (PD)", { 0x14, 0xE8, 0xE1, 0x76, 0x1B, 0x89, 0x94, 0xC5, 0x4B, 0x30, 0x44, 0x18, 0xCE, 0xA4, 0x97, 0x73 }, NULL, NULL, 0x975B7845, 0xA2505C18, 1, SAVETYPE_EEPROM_16K, 2, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "77a Special Edition by Count0 (PD) [b1]", { 0x45, 0xC6, 0x10, 0xFC, 0x44, 0x3D, 0x0D, 0xF0, 0x7E, 0xD9, 0xF0, 0x7A, 0xC8, 0xB7, 0xC5, 0x4A }, NULL, NULL, 0x975B7845, 0xA2505C18, 1, SAVETYPE_EEPROM_16K, 2, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "77a by Count0 (POM '98) (PD)", { 0x7D, 0x6A, 0xC6, 0x29, 0x5E, 0xF6, 0xA0, 0xAB, 0xB3, 0xD4, 0x59, 0x4A, 0xF4, 0x07, 0xB7, 0xA6 }, NULL, NULL, 0xD6D29529, 0xD4EADEE4, 1, SAVETYPE_NONE, 2, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "77a by Count0 (POM '98) (PD) [b1]", { 0xA8, 0x42, 0x61, 0x80, 0xC6, 0x5A, 0x4C, 0x9D, 0xD1, 0xDF, 0x9F, 0xD0, 0x33, 0xDD, 0xCB, 0xB6 }, NULL, NULL, 0xD6D29529, 0xD4EADEE4, 1, SAVETYPE_NONE, 2, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "AI Shougi 3 (J) [!]", { 0x4A, 0x5C, 0x50, 0x9A, 0x20, 0xDB, 0x7A, 0x42, 0x9D, 0xC1, 0xDD, 0x4E, 0x21, 0x9A, 0xD4, 0xA2 }, NULL, NULL, 0x8CC182A6, 0xC2D0CAB0, 1, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "Absolute Crap #2 by Lem (PD)", { 0xD9, 0xFE, 0x93, 0xEB, 0xA6, 0x10, 0xE6, 0x0F, 0x8F, 0x5D, 0x98, 0x80, 0xE5, 0x2D, 0xB0, 0x56 }, NULL, NULL, 0x2E7E893C, 0x4E68B642, 3, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Absolute Crap #2 by Lem (PD) [b1]", { 0x9E, 0x59, 0x88, 0x21, 0x63, 0xEA, 0x99, 0xA4, 0x56, 0x29, 0xB9, 0xB8, 0xB4, 0x91, 0xD8, 0x6B }, NULL, NULL, 0x2E7E893C, 0x4E68B642, 3, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Absolute Crap #2 by Lem (PD) [b2]", { 0xD5, 0xF7, 0x3B, 0xB1, 0xFC, 0x46, 0x32, 0x84, 0x40, 0xC3, 0xBD, 0x98, 0x12, 0xA4, 0x92, 0x84 }, NULL, NULL, 0x2E7E893C, 0x4E68B642, 3, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Absolute Crap Intro #1 by Kid Stardust (PD) [b1]", { 0x2F, 0x02, 0xD4, 0x78, 0xFC, 0x89, 0xE4, 0x6F, 0xA1, 0x43, 0xB1, 0x28, 0xE2, 0x9B, 0x43, 0x4C }, NULL, NULL, 0xB0667DED, 0xBB39A4B8, 5, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Absolute Crap Intro #1 by Kid Stardust (PD) [h1C]", { 0xE0, 0x6A, 0x71, 0x90, 0xB2, 0xDF, 0x9C, 0xCC, 0xCA, 0x30, 0xC1, 0x72, 0x4D, 0xDF, 0xE9, 0x5B }, NULL, NULL, 0xB0667DED, 0xBB39A4B8, 5, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Absolute Crap Intro #1 by Kid Stardust (PD)", { 0xFF, 0x4D, 0x4F, 0xEF, 0xF0, 0xAF, 0x8A, 0x0F, 0x9B, 0x9A, 0xE5, 0x09, 0xDA, 0x7D, 0x90, 0x71 }, NULL, NULL, 0xB0667DED, 0xBB39A4B8, 5, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Action Replay Pro 64 V3.0 (Unl)", { 0x35, 0xBA, 0x40, 0x7E, 0xA9, 0xE4, 0xEF, 0x7C, 0x0A, 0xCE, 0x8B, 0x4F, 0x58, 0xBE, 0xEC, 0x41 }, NULL, NULL, 0xF1297BC9, 0x42CDAE9D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x7 },
+    { "Action Replay Pro 64 V3.0 (Unl) [b1]", { 0x0D, 0x77, 0x91, 0x8E, 0x6C, 0x98, 0x92, 0x61, 0xEE, 0xF8, 0x1F, 0xE2, 0x44, 0xE4, 0x8E, 0xEF }, NULL, NULL, 0x158A155D, 0xC1538CDB, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x7 },
+    { "Action Replay Pro 64 V3.0 (Unl) [f1]", { 0xFD, 0x86, 0x81, 0xCB, 0xF1, 0xA5, 0x99, 0xFF, 0x2E, 0xA5, 0x5D, 0xBF, 0x40, 0xEA, 0x7D, 0x27 }, NULL, NULL, 0x8A155D15, 0x53C1DB8C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x7 },
+    { "Action Replay Pro 64 V3.3 (Unl)", { 0x67, 0xAF, 0xA5, 0xDF, 0x80, 0xA5, 0xCF, 0xC9, 0x1F, 0xCE, 0x1D, 0xC9, 0x18, 0xEA, 0x0A, 0x4F }, NULL, NULL, 0xA8D1DAF2, 0x31206B53, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x7 },
+    { "AeroFighters Assault (E) (M3) [!]", { 0x75, 0x58, 0xE3, 0xDA, 0x72, 0x25, 0x71, 0x29, 0x36, 0xD3, 0xBA, 0x3D, 0xCE, 0x21, 0x0C, 0x36 }, NULL, NULL, 0x62F6BE95, 0xF102D6D6, 3, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "AeroFighters Assault (E) (M3) [f1] (NTSC)", { 0x91, 0x5E, 0x77, 0x62, 0x36, 0x4C, 0x24, 0x49, 0xAA, 0xEB, 0xC4, 0xCA, 0x52, 0x78, 0xD1, 0xE8 }, NULL, NULL, 0x0BBCDFCF, 0x2DD952CC, 3, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "AeroFighters Assault (E) (M3) [o1]", { 0x6C, 0x25, 0xC8, 0xD7, 0xCE, 0x39, 0x3C, 0x02, 0x14, 0x91, 0x7A, 0x21, 0x1A, 0x19, 0x9F, 0x0C }, NULL, NULL, 0x62F6BE95, 0xF102D6D6, 3, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "AeroFighters Assault (U) [!]", { 0x79, 0xFB, 0x6E, 0x24, 0x52, 0xAF, 0x07, 0x7C, 0x5E, 0xF1, 0xDD, 0xE5, 0xFC, 0x81, 0x0F, 0x04 }, NULL, NULL, 0x1B598BF1, 0xECA29B45, 3, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "AeroFighters Assault (U) [b1]", { 0xCF, 0x5F, 0xF9, 0x2E, 0xED, 0x5F, 0xD3, 0xC7, 0x14, 0xBC, 0x3C, 0x4D, 0x15, 0xC4, 0x7A, 0xE3 }, NULL, NULL, 0x1B598BF1, 0xECA29B45, 3, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "AeroFighters Assault (U) [b2]", { 0x7E, 0x3E, 0x9B, 0xC4, 0x18, 0x8B, 0x37, 0xA4, 0xFC, 0x28, 0x3E, 0x22, 0xBE, 0xDB, 0x5D, 0x49 }, NULL, NULL, 0x1B598BF1, 0xECA29B45, 3, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "AeroFighters Assault (U) [b3]", { 0x48, 0x52, 0x2C, 0xCF, 0x3D, 0x05, 0x9D, 0xDF, 0x2D, 0xCF, 0x5D, 0x6A, 0xEE, 0x2D, 0x1F, 0xD7 }, NULL, NULL, 0x1B598BF1, 0xECA29B45, 3, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "AeroFighters Assault (U) [f1] (PAL)", { 0x24, 0xCA, 0x46, 0xD2, 0xC8, 0xE2, 0xD6, 0x89, 0x78, 0xAE, 0xAE, 0x46, 0xC3, 0x86, 0x2F, 0x1E }, NULL, NULL, 0x5C4EB1C9, 0x12A49603, 3, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "AeroFighters Assault (U) [h1C]", { 0x06, 0x35, 0xFE, 0x16, 0x01, 0x8B, 0xB2, 0x16, 0xE5, 0xCD, 0x29, 0xC3, 0x00, 0xCA, 0xDC, 0x74 }, NULL, NULL, 0x1B598BF1, 0xECA29B45, 3, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "AeroFighters Assault (U) [h2C]", { 0x6A, 0x56, 0x58, 0x9E, 0xC8, 0xFA, 0xDD, 0x11, 0x39, 0xEC, 0x4B, 0x6E, 0xED, 0x9D, 0x19, 0xAE }, NULL, NULL, 0x1B598BF1, 0xECA29B45, 3, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "AeroFighters Assault (U) [h3C]", { 0x63, 0x65, 0x72, 0x76, 0xE7, 0x25, 0x6D, 0xCA, 0x56, 0x2F, 0x02, 0x4F, 0xC7, 0x1F, 0x4A, 0x47 }, NULL, NULL, 0x1B598BF1, 0xECA29B45, 3, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "AeroGauge (E) (M3) [!]", { 0x05, 0x05, 0x60, 0x45, 0x44, 0x7B, 0xF1, 0xFB, 0xA8, 0xF9, 0x87, 0x8A, 0x7F, 0x60, 0x09, 0xF3 }, NULL, NULL, 0xD83045C8, 0xF29D3A36, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (E) (M3) [f1] (NTSC)", { 0xFD, 0x97, 0x97, 0x68, 0xAC, 0x0E, 0xC6, 0xCB, 0xBC, 0xA8, 0xC5, 0x33, 0x9D, 0x62, 0xBB, 0x05 }, NULL, NULL, 0x440355A4, 0x869CE5F9, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (E) (M3) [h1C]", { 0xE0, 0x25, 0x6E, 0x42, 0x70, 0x88, 0x7B, 0x99, 0xDA, 0x7E, 0x91, 0xA6, 0x20, 0xFF, 0xEF, 0xF3 }, NULL, NULL, 0xD83045C8, 0xF29D3A36, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (E) (M3) [h2C]", { 0x25, 0xD1, 0x94, 0x87, 0xCB, 0x80, 0xDB, 0x72, 0x4D, 0xB9, 0xD7, 0x35, 0xF2, 0xC2, 0x8E, 0x8B }, NULL, NULL, 0xD83045C8, 0xF29D3A36, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (J) (V1.0) (Kiosk Demo) [!]", { 0xE9, 0x70, 0xAF, 0x3D, 0xE2, 0x5B, 0xB5, 0xAE, 0x11, 0x54, 0x01, 0x0E, 0x26, 0xAF, 0x77, 0x6F }, NULL, NULL, 0xB00903C9, 0x3916C146, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (J) (V1.0) (Kiosk Demo) [b1]", { 0x6A, 0x52, 0x18, 0x8E, 0x8A, 0x7D, 0x00, 0x8F, 0x19, 0x21, 0xAA, 0x8A, 0x6D, 0x40, 0xA7, 0x4C }, NULL, NULL, 0x3F47EEA0, 0x5DDF7A3C, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (J) (V1.0) (Kiosk Demo) [b2]", { 0x5A, 0xB4, 0x77, 0x3B, 0xB2, 0x70, 0xBE, 0x3A, 0x72, 0xBB, 0x79, 0xEF, 0x68, 0xDE, 0xA4, 0x14 }, NULL, NULL, 0xB00903C9, 0x3916C146, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (J) (V1.0) (Kiosk Demo) [b3]", { 0x13, 0xCC, 0xAA, 0x36, 0xD3, 0x09, 0xB7, 0x8D, 0x20, 0xC9, 0xC0, 0xC8, 0x9A, 0x8C, 0xE6, 0x50 }, NULL, NULL, 0xB00903C9, 0x3916C146, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (J) (V1.0) (Kiosk Demo) [b4]", { 0xAC, 0x58, 0x28, 0xBA, 0x75, 0x0A, 0x4D, 0xCD, 0xC8, 0x40, 0x05, 0x0D, 0xE6, 0x63, 0x05, 0xE2 }, NULL, NULL, 0x3F47EEA0, 0x5DDF7A3C, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (J) (V1.1) [!]", { 0x06, 0x20, 0xC2, 0xD1, 0x34, 0xA0, 0x43, 0x0F, 0x4A, 0xFA, 0x20, 0x8F, 0xFE, 0xDA, 0x67, 0xB8 }, NULL, NULL, 0x80F41131, 0x384645F6, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (J) (V1.1) [b1]", { 0xCC, 0x8C, 0x56, 0xB4, 0xE3, 0x7B, 0xC5, 0xA5, 0x01, 0x08, 0x7E, 0x7C, 0xE8, 0xC1, 0x2C, 0xC5 }, NULL, NULL, 0x80F41131, 0x384645F6, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (J) (V1.1) [b2]", { 0x42, 0x67, 0x25, 0xBF, 0xE1, 0xA5, 0x05, 0xD4, 0xC3, 0xB1, 0x28, 0x62, 0x18, 0x8A, 0x25, 0x26 }, NULL, NULL, 0x80F41131, 0x384645F6, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (J) (V1.1) [b3]", { 0xA7, 0x44, 0x29, 0x73, 0x86, 0x48, 0xC9, 0x6F, 0xAB, 0x23, 0x94, 0x4C, 0xCB, 0x06, 0xAA, 0x6C }, NULL, NULL, 0x80F41131, 0x384645F6, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (J) (V1.1) [b4]", { 0xE3, 0x8C, 0x4D, 0x24, 0x25, 0x4B, 0xB3, 0xCB, 0x6C, 0x9E, 0xC7, 0x5C, 0xD2, 0x9A, 0x65, 0x66 }, NULL, NULL, 0x80F41131, 0x384645F6, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (J) (V1.1) [b5]", { 0xE8, 0x0A, 0xD3, 0x8B, 0x31, 0x39, 0xCB, 0xA5, 0xA3, 0x67, 0xCB, 0x9B, 0x0B, 0x21, 0xAA, 0xFA }, NULL, NULL, 0x80F41131, 0x384645F6, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (J) (V1.1) [b6]", { 0xCD, 0xCB, 0x71, 0x01, 0x47, 0x1D, 0xD1, 0x12, 0x9D, 0xF6, 0x3D, 0x60, 0x76, 0x83, 0x43, 0x37 }, NULL, NULL, 0x80F41131, 0x384645F6, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (J) (V1.1) [b7]", { 0xAB, 0x36, 0xED, 0x30, 0x03, 0x3F, 0x41, 0x01, 0xD3, 0xF6, 0x60, 0x95, 0x1A, 0x56, 0x84, 0x13 }, NULL, NULL, 0x80F41131, 0x384645F6, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (J) (V1.1) [f1] (PAL)", { 0x9D, 0x7D, 0xAD, 0x00, 0xEA, 0xAC, 0x50, 0x4D, 0x45, 0x96, 0x08, 0xAB, 0x30, 0xCB, 0x0C, 0x1E }, NULL, NULL, 0x4795217F, 0x63D42538, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (U) [!]", { 0x72, 0xC7, 0xFF, 0xCE, 0xA6, 0xC1, 0x43, 0x06, 0x16, 0x86, 0x76, 0x16, 0xF5, 0xE9, 0xD5, 0x1A }, NULL, NULL, 0xAEBE463E, 0xCC71464B, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (U) [T+Ita0.01_Cattivik66]", { 0xB8, 0xBA, 0x26, 0xF0, 0xC2, 0x72, 0x53, 0xB8, 0x0E, 0x5C, 0x7D, 0x96, 0xB0, 0xFB, 0x66, 0xAB }, NULL, NULL, 0xAEBE463E, 0xCC71464B, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (U) [b1]", { 0x3D, 0x6C, 0x79, 0x2E, 0xD4, 0xFA, 0x3C, 0xE5, 0xC9, 0x20, 0x13, 0xF1, 0x5B, 0xCC, 0xD3, 0x27 }, NULL, NULL, 0xAEBE463E, 0xCC71464B, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (U) [f1] (PAL)", { 0xB7, 0xDB, 0x0D, 0x2C, 0xDC, 0xAB, 0x30, 0x7D, 0x74, 0x4B, 0x63, 0x70, 0xF1, 0xBB, 0xA9, 0xC1 }, NULL, NULL, 0xFDAA963C, 0xFDCCD971, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (U) [h1C]", { 0x11, 0xBE, 0x82, 0x18, 0x6C, 0x64, 0xEF, 0x40, 0x7B, 0x28, 0x40, 0x3D, 0x49, 0xB1, 0x99, 0xDB }, NULL, NULL, 0xAEBE463E, 0xCC71464B, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "AeroGauge (U) [h2C]", { 0x31, 0xE7, 0x39, 0xE6, 0x42, 0x0D, 0xA8, 0x8A, 0xBF, 0x49, 0x80, 0xAD, 0x0C, 0x76, 0x43, 0x9A }, NULL, NULL, 0xAEBE463E, 0xCC71464B, 4, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "Aidyn Chronicles - The First Mage (E) [!]", { 0x54, 0xD0, 0xA3, 0x91, 0x23, 0xC1, 0x5F, 0x74, 0xAA, 0xBB, 0x1E, 0xCC, 0x24, 0xD4, 0xD6, 0xA0 }, NULL, NULL, 0x2DC4FFCC, 0xC8FF5A21, 3, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "Aidyn Chronicles - The First Mage (U) (V1.0) [!]", { 0xAF, 0x14, 0x93, 0x36, 0xB3, 0xDD, 0xB8, 0x99, 0x59, 0x8E, 0x7B, 0xE8, 0x74, 0x0D, 0x7D, 0xC6 }, NULL, NULL, 0xE6A95A4F, 0xBAD2EA23, 3, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "Aidyn Chronicles - The First Mage (U) (V1.0) [o1]", { 0x31, 0x44, 0x8B, 0x07, 0xCB, 0xC9, 0x32, 0x01, 0x88, 0x70, 0xF7, 0x1D, 0x12, 0x54, 0xE3, 0x17 }, NULL, NULL, 0xE6A95A4F, 0xBAD2EA23, 3, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "Aidyn Chronicles - The First Mage (U) (V1.1) [!]", { 0xE8, 0xCD, 0xDF, 0x0C, 0x52, 0xB7, 0x24, 0x53, 0xD5, 0x2D, 0xA3, 0x85, 0x32, 0x2D, 0xFE, 0x15 }, NULL, NULL, 0x112051D2, 0x68BEF8AC, 3, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "Aidyn Chronicles - The First Mage (U) (Beta) (2000-02-10)", { 0xCD, 0x24, 0x76, 0x3B, 0xEC, 0xFA, 0x1D, 0x00, 0x53, 0xE5, 0x43, 0x8B, 0x0E, 0xF5, 0xE7, 0x5E }, NULL, NULL, 0x40066883, 0x9375D98F, 3, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "Aidyn Chronicles - The First Mage (U) (Beta) (2000-05-09)", { 0xCC, 0x6E, 0xAE, 0x9E, 0xD5, 0x82, 0x04, 0x4C, 0xC2, 0x79, 0x45, 0x68, 0x4F, 0xD3, 0x96, 0xCD }, NULL, NULL, 0xFC8BED44, 0xD640D904, 3, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "Airboarder 64 (E) [!]", { 0xE8, 0x89, 0x1F, 0x8F, 0x49, 0x8A, 0x61, 0x5A, 0x6C, 0xBA, 0xF7, 0x5B, 0x7D, 0xDC, 0x9F, 0xA6 }, NULL, NULL, 0x27C425D0, 0x8C2D99C1, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (E) [f1] (NTSC)", { 0xDC, 0xFB, 0x92, 0xA4, 0xB1, 0x06, 0xFE, 0x61, 0xE5, 0x45, 0x79, 0xB1, 0xD3, 0xB7, 0x33, 0x6E }, NULL, NULL, 0x89A498AE, 0xDE3CD49A, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (E) [h1C]", { 0xA0, 0xEE, 0x74, 0x84, 0x50, 0x01, 0x78, 0xBA, 0xB4, 0x4F, 0xDE, 0x0A, 0xF6, 0xD5, 0x74, 0x8F }, NULL, NULL, 0x27C425D0, 0x8C2D99C1, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (J) [!]", { 0xCC, 0xEE, 0x2F, 0xCF, 0x38, 0xDC, 0x22, 0x00, 0x12, 0x8D, 0x75, 0xD1, 0x5D, 0xB5, 0x32, 0x83 }, NULL, NULL, 0x6C45B60C, 0xDCE50E30, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (J) [b1]", { 0xF5, 0x58, 0x16, 0x53, 0x11, 0xC9, 0xCD, 0xCA, 0x73, 0xFB, 0x08, 0x9E, 0x29, 0x8F, 0x20, 0x56 }, NULL, NULL, 0x6C45B60C, 0xDCE50E30, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (J) [b1][t1]", { 0x62, 0xB0, 0x05, 0xD0, 0xE9, 0xDA, 0xE9, 0x65, 0x26, 0x44, 0x34, 0x98, 0xD6, 0x42, 0x0E, 0xC3 }, NULL, NULL, 0xF255D6F1, 0xB65D6728, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (J) [b2]", { 0xC4, 0x29, 0xFE, 0x5C, 0x86, 0xF1, 0x47, 0x64, 0x92, 0x3F, 0x08, 0xD4, 0x48, 0x84, 0xC8, 0x23 }, NULL, NULL, 0xF255D6F1, 0xB65D6728, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (J) [b3]", { 0x16, 0xCB, 0x66, 0xDD, 0x44, 0xF7, 0xA4, 0x6E, 0xEA, 0xC5, 0xFF, 0xCB, 0x38, 0xFB, 0xE2, 0x6B }, NULL, NULL, 0x6C45B60C, 0xDCE50E30, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (J) [f1] (PAL)", { 0x27, 0x8E, 0xF4, 0xB7, 0x9B, 0x35, 0x44, 0xDE, 0x32, 0x7C, 0xF7, 0xDB, 0xCD, 0xD6, 0x00, 0x81 }, NULL, NULL, 0x26809B20, 0x39A516A4, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (J) [h1C]", { 0xC0, 0x2C, 0x32, 0x35, 0x1B, 0xD6, 0x9C, 0xB2, 0xD3, 0xFA, 0xC3, 0x55, 0xBE, 0x07, 0x4D, 0xC0 }, NULL, NULL, 0x6C45B60C, 0xDCE50E30, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (J) [h2C]", { 0x78, 0xCA, 0xBB, 0x69, 0x6C, 0xA4, 0x84, 0x7B, 0xFA, 0xD0, 0x9B, 0x01, 0x25, 0x7C, 0x6F, 0xDA }, NULL, NULL, 0x6C45B60C, 0xDCE50E30, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (J) [h3C]", { 0xB6, 0x89, 0x48, 0x26, 0xF5, 0x38, 0x60, 0x19, 0xB1, 0x9F, 0x0A, 0x77, 0x5D, 0x11, 0xB0, 0x42 }, NULL, NULL, 0x6C45B60C, 0xDCE50E30, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (J) [h4C]", { 0xF9, 0x02, 0x7D, 0xF3, 0x90, 0x9C, 0x84, 0x9C, 0xBA, 0xDD, 0xAB, 0x1C, 0x14, 0x68, 0xBA, 0xCC }, NULL, NULL, 0x6C45B60C, 0xDCE50E30, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (J) [h5C]", { 0x41, 0xBE, 0x85, 0x23, 0x60, 0x52, 0xA2, 0xE8, 0xEE, 0xD1, 0x44, 0x98, 0x9B, 0x0A, 0x3E, 0x0A }, NULL, NULL, 0xF255D6F1, 0xB65D6728, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (J) [h6C]", { 0x03, 0x7B, 0x58, 0xEE, 0x5F, 0xB4, 0xF3, 0xBF, 0xF4, 0x08, 0xEE, 0x40, 0x6E, 0x35, 0x39, 0xC0 }, NULL, NULL, 0x6C45B60C, 0xDCE50E30, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Airboarder 64 (J) [t1]", { 0x63, 0xF8, 0x50, 0xD7, 0xCC, 0x82, 0x9B, 0x28, 0x7F, 0xF1, 0xDC, 0x61, 0xCA, 0x3F, 0x7C, 0xCA }, NULL, NULL, 0xF255D6F1, 0xB65D6728, 4, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Akumajou Dracula Mokushiroku - Real Action Adventure (J) [!]", { 0x25, 0x6A, 0x1C, 0xB2, 0x3F, 0x9E, 0x1A, 0x27, 0x62, 0xA7, 0xA1, 0x71, 0x41, 0x7B, 0x5D, 0x68 }, NULL, NULL, 0xB6951A94, 0x63C849AF, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Akumajou Dracula Mokushiroku Gaiden - Legend of Cornell (J) [!]", { 0x47, 0xEA, 0x23, 0x97, 0x17, 0xC4, 0xD2, 0x25, 0xC9, 0xD0, 0xE9, 0xFD, 0x37, 0xB9, 0xFC, 0xB3 }, NULL, NULL, 0xA5533106, 0xB9F25E5B, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Alienstyle Intro by Renderman (PD) [a1]", { 0xEC, 0xD1, 0x27, 0xA5, 0x7E, 0x25, 0xCE, 0x85, 0x14, 0x30, 0x7B, 0xB4, 0x7E, 0xCC, 0x1E, 0x95 }, NULL, NULL, 0x43EFB5BB, 0xD8C62E2B, 5, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Alienstyle Intro by Renderman (PD)", { 0x23, 0x2A, 0x5D, 0xC2, 0xE9, 0x8C, 0x6C, 0xAB, 0x1D, 0x9F, 0x73, 0xC1, 0xD1, 0xC1, 0xC7, 0x3A }, NULL, NULL, 0x888EEC7A, 0x42361983, 5, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "All Star Tennis '99 (E) (M5) [!]", { 0xE3, 0xF4, 0xC8, 0x68, 0x91, 0x7A, 0x12, 0xBD, 0x5E, 0x84, 0xD9, 0x4D, 0x1C, 0x26, 0x0C, 0x7D }, NULL, NULL, 0xDFD784AD, 0xAE426603, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "All Star Tennis '99 (E) (M5) [f1] (NTSC)", { 0x4D, 0xC6, 0x14, 0xB1, 0x02, 0x22, 0x52, 0xF4, 0x1E, 0x4E, 0x18, 0x22, 0x49, 0xFA, 0x7B, 0xAA }, NULL, NULL, 0x3015A8AD, 0x8CEAF5F8, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "All Star Tennis '99 (E) (M5) [f2] (NTSC)", { 0x37, 0x96, 0x2C, 0xB6, 0xD5, 0x8C, 0x2D, 0x6B, 0x04, 0x4E, 0xAE, 0xCD, 0xCF, 0x70, 0xEC, 0x09 }, NULL, NULL, 0x6FD0035D, 0x371B785D, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "All Star Tennis '99 (E) (M5) [f3] (NTSC)", { 0xE0, 0x34, 0xC9, 0x69, 0xBC, 0xDC, 0x2E, 0x8D, 0xBE, 0x2C, 0x8A, 0x73, 0xBE, 0xD5, 0x7B, 0x53 }, NULL, NULL, 0x2E341C3D, 0x5AC8DEA3, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "All Star Tennis '99 (E) (M5) [f4] (NTSC)", { 0x7F, 0xB6, 0x42, 0x2E, 0x5B, 0xBF, 0x60, 0xFE, 0xE3, 0x96, 0x51, 0xEF, 0xF3, 0xF7, 0x9B, 0xAB }, NULL, NULL, 0xF3700A53, 0x4795C23D, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "All Star Tennis '99 (U) [!]", { 0xAF, 0xC3, 0xDC, 0x9B, 0xB7, 0x37, 0xD8, 0x19, 0x03, 0xF6, 0xCE, 0x48, 0x75, 0xB6, 0x3A, 0xE9 }, NULL, NULL, 0xE185E291, 0x4E50766D, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "All Star Tennis '99 (U) [T+Bra1.0_Guto]", { 0xA9, 0x0F, 0xE0, 0x1F, 0xDA, 0xFF, 0xB7, 0x0D, 0xD1, 0x23, 0xC0, 0xBA, 0x04, 0x58, 0x9F, 0xAA }, NULL, NULL, 0xE185E291, 0x4E50766D, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "All Star Tennis '99 (U) [f1] (PAL)", { 0xA2, 0xFA, 0x12, 0xA1, 0xDE, 0xFC, 0xB1, 0x52, 0xDF, 0xD0, 0x4E, 0x82, 0x96, 0x8C, 0x7D, 0x3A }, NULL, NULL, 0x2D56F77B, 0xCBE813FC, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "All Star Tennis '99 (U) [f2] (PAL)", { 0xD3, 0x41, 0xA4, 0x0E, 0xA9, 0xFB, 0xE9, 0x5B, 0x6F, 0x0F, 0x99, 0xDF, 0xC5, 0x90, 0x1F, 0xB7 }, NULL, NULL, 0x35D13E0D, 0xE8652252, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "All Star Tennis '99 (U) [h1C]", { 0x95, 0x3B, 0x00, 0x88, 0x2A, 0x99, 0xD6, 0x50, 0xE1, 0xF2, 0x81, 0x76, 0x74, 0x59, 0x5F, 0x0B }, NULL, NULL, 0xE185E291, 0x4E50766D, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "All-Star Baseball '99 (E) [!]", { 0xED, 0x5F, 0x1E, 0x12, 0xDA, 0x36, 0xDB, 0xEC, 0x8A, 0x0A, 0x24, 0xED, 0x98, 0xD4, 0xAE, 0xD5 }, NULL, NULL, 0xD9EDD54D, 0x6BB8E274, 3, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "All-Star Baseball '99 (U) [!]", { 0x78, 0x55, 0x1D, 0x23, 0xF2, 0x30, 0xB5, 0x8B, 0x9F, 0x44, 0x9C, 0xDB, 0x4A, 0x28, 0x57, 0x61 }, NULL, NULL, 0xC43E23A7, 0x40B1681A, 3, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "All-Star Baseball '99 (U) [f1] (PAL)", { 0x04, 0x5E, 0x0B, 0x80, 0x1F, 0x70, 0xAD, 0xE6, 0x99, 0x81, 0xFC, 0xBB, 0x2E, 0xDE, 0x53, 0x76 }, NULL, NULL, 0xA6421764, 0xED1A13E9, 3, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "All-Star Baseball '99 (U) [o1]", { 0x13, 0xB5, 0xAE, 0x64, 0x6C, 0xC0, 0x98, 0x76, 0xD6, 0x43, 0x66, 0xBB, 0x07, 0x79, 0x6C, 0x78 }, NULL, NULL, 0xC43E23A7, 0x40B1681A, 3, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "All-Star Baseball 2000 (E) [!]", { 0x90, 0x44, 0x8C, 0x41, 0x75, 0xEE, 0x9D, 0x02, 0x47, 0x67, 0x44, 0x74, 0xDC, 0xAB, 0xDF, 0xED }, NULL, NULL, 0xA19F8089, 0x77884B51, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "All-Star Baseball 2000 (E) [f1] (NTSC)", { 0xE4, 0x07, 0x6E, 0x07, 0xDB, 0xDA, 0x9C, 0xEA, 0xB5, 0xED, 0xCE, 0xF4, 0xD4, 0x64, 0x8E, 0xAB }, NULL, NULL, 0x581900E5, 0x8E662FC8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "All-Star Baseball 2000 (U) [!]", { 0xAA, 0xDA, 0x35, 0x8C, 0xE9, 0x7F, 0x06, 0xC4, 0xDF, 0x5B, 0xF5, 0x59, 0x87, 0x26, 0x88, 0x44 }, NULL, NULL, 0x5E547A4D, 0x90E60795, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "All-Star Baseball 2000 (U) [f1] (PAL)", { 0x5D, 0x29, 0xC0, 0x1B, 0x96, 0xA7, 0x38, 0xC3, 0xEB, 0x68, 0x25, 0x4E, 0xF4, 0x05, 0x52, 0xF3 }, NULL, NULL, 0x44127A31, 0x6D341229, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "All-Star Baseball 2000 (U) [h1C]", { 0x93, 0xB9, 0x8D, 0x93, 0x27, 0x5F, 0x80, 0x3E, 0xF4, 0xC9, 0x25, 0xBA, 0xE5, 0xFB, 0x71, 0x1F }, NULL, NULL, 0x5E547A4D, 0x90E60795, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "All-Star Baseball 2000 (U) [h2C]", { 0x07, 0xAB, 0x7C, 0x19, 0xDB, 0xE8, 0x5C, 0x8C, 0xC0, 0x96, 0x1B, 0xAA, 0xF3, 0xB5, 0xCA, 0x79 }, NULL, NULL, 0x5E547A4D, 0x90E60795, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "All-Star Baseball 2001 (U) [!]", { 0x6E, 0x01, 0xB8, 0xD4, 0x25, 0xAE, 0x74, 0xEF, 0x5A, 0x0F, 0x87, 0x5C, 0x70, 0x0A, 0x3B, 0x18 }, NULL, NULL, 0x5446C6EF, 0xE18E47BB, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "All-Star Baseball 2001 (U) [f1] (PAL)", { 0xCD, 0x04, 0xAB, 0xC5, 0x97, 0x9F, 0x22, 0xEF, 0x5D, 0x6F, 0xDC, 0x4D, 0xCF, 0xAA, 0x4D, 0x50 }, NULL, NULL, 0x993CC742, 0xEE65D7A4, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Alleycat 64 by Dosin (POM '99) (PD)", { 0x9B, 0xC0, 0xE3, 0x36, 0x13, 0x85, 0x71, 0x3B, 0xDF, 0x50, 0xF0, 0xEE, 0xBF, 0x59, 0xFF, 0xE0 }, NULL, NULL, 0x306B3375, 0x05F4E698, 3, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Alleycat 64 by Dosin (POM '99) (PD) [b1]", { 0x2D, 0xCE, 0x0F, 0x65, 0x56, 0xC0, 0x0B, 0x44, 0x36, 0x75, 0x86, 0xFD, 0x1E, 0xEB, 0x40, 0xE5 }, NULL, NULL, 0x306B3375, 0x05F4E698, 3, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Analogue Test Utility by WT_Riker (POM '99) (PD) [b1]", { 0x58, 0xB2, 0x7A, 0xE9, 0xB4, 0x1B, 0x75, 0x5E, 0x4F, 0x9C, 0x50, 0x36, 0x56, 0xB9, 0x3A, 0x97 }, NULL, NULL, 0xE4C44FDA, 0x98532F4A, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Analogue Test Utility by WT_Riker (POM '99) (PD)", { 0x25, 0x09, 0x9E, 0xEB, 0x13, 0xE4, 0xFB, 0x47, 0xE3, 0x90, 0x08, 0x7E, 0xF6, 0xA2, 0x0C, 0xBC }, NULL, NULL, 0xE4C44FDA, 0x98532F4A, 5, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Armorines - Project S.W.A.R.M. (E) [!]", { 0x0C, 0x2C, 0xBA, 0xFE, 0xC6, 0xF1, 0x84, 0xAD, 0x39, 0xEF, 0x29, 0xB2, 0xB5, 0xE0, 0xF4, 0x4A }, NULL, NULL, 0x3CC77150, 0x21CDB987, 5, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Armorines - Project S.W.A.R.M. (E) [f1] (NTSC)", { 0x0B, 0x5F, 0x90, 0x95, 0x46, 0xDE, 0x5A, 0x41, 0x4F, 0x22, 0x81, 0xAD, 0x0C, 0x83, 0xD9, 0xF9 }, NULL, NULL, 0xCCDEAF02, 0x8AFC4B28, 5, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Armorines - Project S.W.A.R.M. (G) [!]", { 0x2B, 0xC4, 0x8B, 0x3E, 0x6F, 0x61, 0x89, 0x6B, 0x9B, 0xC7, 0xBE, 0xF5, 0x20, 0x5C, 0xC4, 0x9C }, NULL, NULL, 0xC0F6DB17, 0x80E0D532, 5, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Armorines - Project S.W.A.R.M. (G) [f1] (NTSC)", { 0x43, 0xC2, 0x3D, 0x76, 0xE4, 0xB6, 0xB1, 0xCB, 0xFC, 0xE4, 0x46, 0xDF, 0xAD, 0xFB, 0x03, 0x96 }, NULL, NULL, 0x2CEEE754, 0x31B69DBE, 5, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Armorines - Project S.W.A.R.M. (U) [!]", { 0x6E, 0x6E, 0x7A, 0x70, 0x3C, 0x13, 0x1A, 0xDA, 0xDD, 0xF4, 0x17, 0x5E, 0x90, 0x37, 0xA2, 0xEB }, NULL, NULL, 0x1FB5D932, 0x3BA9481B, 5, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Armorines - Project S.W.A.R.M. (U) [f1] (PAL)", { 0x4C, 0x15, 0xC8, 0x52, 0x80, 0xDF, 0xB0, 0x03, 0xC3, 0xBE, 0x65, 0x06, 0xB2, 0x17, 0xB7, 0x75 }, NULL, NULL, 0xEA090572, 0x192F9673, 5, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Armorines - Project S.W.A.R.M. (U) [t1]", { 0x0F, 0xDC, 0x4A, 0xCA, 0xB1, 0xB5, 0x31, 0xCB, 0xB4, 0xDF, 0xB1, 0x42, 0xCD, 0x63, 0x0B, 0x7A }, NULL, NULL, 0xE820670A, 0xA99ED0EF, 5, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Army Men - Air Combat (U) [!]", { 0x75, 0x5D, 0xF7, 0xF5, 0x7E, 0xDF, 0x87, 0x70, 0x6D, 0x4C, 0x80, 0xFF, 0x15, 0x88, 0x33, 0x12 }, NULL, NULL, 0x4C52BBB2, 0xCEAB0F6B, 3, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Army Men - Sarge's Heroes (E) (M3) [!]", { 0x53, 0xE2, 0x87, 0x26, 0x12, 0x76, 0x01, 0x33, 0xAB, 0x7B, 0x2C, 0xC2, 0xE2, 0x2B, 0x84, 0x7C }, NULL, NULL, 0xB210DF19, 0x98B58D1A, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Army Men - Sarge's Heroes (U) [!]", { 0xB8, 0x08, 0x5C, 0x2E, 0xDB, 0x1C, 0x6D, 0x23, 0xE5, 0x2E, 0xD8, 0xC0, 0x6D, 0x92, 0xB4, 0xF8 }, NULL, NULL, 0x862C0657, 0x8DFD896D, 4, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Army Men - Sarge's Heroes (U) [b1]", { 0x90, 0x6D, 0x5A, 0x77, 0x18, 0x8A, 0x0D, 0xC9, 0x0E, 0xBF, 0x29, 0x4E, 0xF8, 0xA3, 0x91, 0x5E }, NULL, NULL, 0xD51CF20D, 0x5534AF93, 4, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Army Men - Sarge's Heroes (U) [f1] (PAL)", { 0xF1, 0x11, 0x6F, 0xAE, 0xBB, 0xA9, 0x32, 0xA0, 0x15, 0x9B, 0x88, 0x2A, 0xF9, 0x94, 0x6B, 0xE6 }, NULL, NULL, 0x94123517, 0x300EEA90, 4, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Army Men - Sarge's Heroes (U) [t1]", { 0x3D, 0x1C, 0x87, 0xBC, 0xF3, 0xF8, 0xAE, 0x8E, 0x55, 0xFC, 0x87, 0xA2, 0x5B, 0xE4, 0x17, 0x3C }, NULL, NULL, 0xA7507855, 0x0D454C66, 4, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Army Men - Sarge's Heroes (U) [t2]", { 0x4E, 0x39, 0x47, 0x41, 0x36, 0xC9, 0x4C, 0xE2, 0x50, 0x61, 0xFB, 0x6C, 0x0B, 0x47, 0x3E, 0x29 }, NULL, NULL, 0x5E23985B, 0xE3CF7CDA, 4, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Army Men - Sarge's Heroes (U) [t3]", { 0xA9, 0x52, 0xE4, 0x95, 0x07, 0x7D, 0x13, 0xC8, 0xD9, 0x58, 0x7B, 0x7B, 0x8B, 0xBD, 0xE2, 0xDB }, NULL, NULL, 0x5E23985B, 0xE3CF7CDA, 4, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Army Men - Sarge's Heroes 2 (U) [!]", { 0x6E, 0xEA, 0x5C, 0x4A, 0x62, 0x56, 0x09, 0x2E, 0xD8, 0xF9, 0xBA, 0x88, 0x61, 0xC6, 0x89, 0xC6 }, NULL, NULL, 0xB20F73B6, 0x2975FC34, 3, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Army Men - Sarge's Heroes 2 (U) [t1]", { 0xF8, 0x18, 0xFB, 0x61, 0x33, 0x11, 0x22, 0xD4, 0x55, 0x69, 0x2C, 0x00, 0xED, 0xB2, 0xA2, 0xFF }, NULL, NULL, 0xB24303F4, 0x9F7D2445, 3, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47F },
+    { "Asteroids Hyper 64 (U) [!]", { 0x87, 0x4C, 0x7B, 0x7B, 0x36, 0x5D, 0x2C, 0x20, 0xAA, 0xA1, 0xA0, 0xC9, 0x0C, 0x93, 0xF9, 0xB8 }, NULL, NULL, 0xD1F7D8AB, 0x293B0446, 3, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Asteroids Hyper 64 (U) [o1]", { 0x94, 0x75, 0x1F, 0xE9, 0x35, 0x10, 0xEB, 0xA2, 0xD4, 0x2D, 0x82, 0x26, 0x9B, 0x22, 0x4C, 0xF8 }, NULL, NULL, 0xD1F7D8AB, 0x293B0446, 3, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Asteroids Hyper 64 (U) [o1][f1] (PAL)", { 0x48, 0xE6, 0xA6, 0x29, 0x10, 0x1B, 0x20, 0x0A, 0x70, 0x87, 0x35, 0x89, 0xB5, 0xD2, 0xF5, 0x24 }, NULL, NULL, 0x39CE39C1, 0x04271200, 3, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Asteroids Hyper 64 (U) [o1][t1]", { 0x00, 0x39, 0x6D, 0x6B, 0x4E, 0x66, 0xD3, 0x23, 0xD4, 0xAD, 0x29, 0x83, 0x3A, 0x53, 0xDF, 0x74 }, NULL, NULL, 0x5638C715, 0x5EA6181D, 3, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Attax64 by Pookae (POM '99) (PD)", { 0xCF, 0x63, 0xAB, 0x6A, 0xF5, 0xFB, 0xD5, 0xDB, 0xFE, 0x50, 0x0D, 0xD9, 0xA6, 0x58, 0xE0, 0x69 }, NULL, NULL, 0x26E43C40, 0xE11F283C, 3, SAVETYPE_NONE, 4, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Attax64 by Pookae (POM '99) (PD) [b1]", { 0x55, 0x30, 0x37, 0xC4, 0x1F, 0x90, 0x29, 0xF5, 0x44, 0x35, 0x3B, 0x84, 0x46, 0xBE, 0x77, 0xD9 }, NULL, NULL, 0x26E43C40, 0xE11F283C, 3, SAVETYPE_NONE, 4, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Automobili Lamborghini (E) [!]", { 0x78, 0x53, 0xF0, 0x2D, 0xC6, 0x6A, 0x35, 0xBC, 0x8C, 0x2B, 0xC3, 0x3D, 0x03, 0xB8, 0xF0, 0xCA }, NULL, NULL, 0xFC7797BF, 0x4A95E83C, 4, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (E) [o1]", { 0xDE, 0x46, 0x31, 0xD6, 0x41, 0x9B, 0x73, 0x61, 0xDE, 0x9C, 0x4A, 0x54, 0x72, 0x96, 0x4D, 0x21 }, NULL, NULL, 0xFC7797BF, 0x4A95E83C, 4, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [!]", { 0xEC, 0x39, 0x57, 0x9F, 0x06, 0x6A, 0x97, 0x14, 0xFF, 0x03, 0x0D, 0x07, 0xDE, 0xC3, 0xC9, 0xD3 }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [T+Ita_cattivik66][b3]", { 0xE8, 0x6A, 0x02, 0x28, 0x15, 0xD0, 0xB7, 0xE6, 0x5F, 0xD5, 0x55, 0x7F, 0x0B, 0x34, 0x51, 0xD4 }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [T+Ita_cattivik66][b4]", { 0xB2, 0x93, 0xE4, 0x49, 0x96, 0x7B, 0x24, 0x64, 0x51, 0x56, 0x4B, 0x25, 0xA4, 0xA3, 0x6B, 0xEC }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [b1]", { 0x1F, 0x32, 0x4E, 0x92, 0xAF, 0x23, 0xCD, 0xC5, 0x49, 0x9B, 0xBC, 0x35, 0xF3, 0x84, 0x02, 0x05 }, NULL, NULL, 0x4DB05DC4, 0x28DBF801, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [b2]", { 0x40, 0x86, 0x11, 0x4F, 0xFB, 0x03, 0xB1, 0x56, 0xDB, 0xCA, 0xA0, 0x36, 0x4E, 0xB0, 0xF8, 0x1B }, NULL, NULL, 0x4DB05DC4, 0x28DBF801, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [b3]", { 0xD8, 0x61, 0xB7, 0x52, 0xF5, 0x97, 0x74, 0xA5, 0x59, 0x7E, 0x66, 0xE8, 0xC5, 0x8E, 0x52, 0xD9 }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [b4]", { 0xB7, 0x08, 0x60, 0x1A, 0x36, 0x05, 0x4F, 0xCA, 0x51, 0xD8, 0x49, 0xD6, 0xD2, 0x6C, 0xEC, 0x5C }, NULL, NULL, 0xDB833E34, 0x63548286, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [b5]", { 0x0D, 0x0D, 0x6A, 0x17, 0x08, 0x71, 0xED, 0x34, 0x33, 0xA5, 0x2D, 0x11, 0x0B, 0x01, 0x35, 0x7E }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [b6]", { 0x69, 0x43, 0x1C, 0x0E, 0x91, 0x52, 0xA9, 0xC5, 0xB6, 0x21, 0x31, 0xC0, 0x34, 0x25, 0x0A, 0x25 }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [f1]", { 0xD4, 0x41, 0xBB, 0x80, 0xEF, 0xD8, 0x6B, 0x8F, 0xD6, 0x5C, 0xE8, 0x55, 0xFE, 0xC2, 0x16, 0x31 }, NULL, NULL, 0x4DB05DC4, 0x28DBF801, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [h1C]", { 0x4C, 0xEF, 0x5C, 0xDD, 0x83, 0x36, 0x01, 0x27, 0xB0, 0x44, 0x5E, 0x7A, 0x9E, 0xA0, 0xBC, 0x8F }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [h2C]", { 0xDA, 0xC7, 0x7D, 0x63, 0x8F, 0xF0, 0x3E, 0x77, 0xF5, 0x69, 0x11, 0x91, 0x16, 0xD4, 0xB6, 0x68 }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [o1]", { 0x17, 0x95, 0x14, 0x44, 0x83, 0x06, 0x96, 0xAA, 0xFC, 0x07, 0xF3, 0x11, 0xAB, 0x12, 0x80, 0x99 }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [o1][T+Ita_cattivik66]", { 0x8F, 0xF8, 0xB8, 0x61, 0xA0, 0xD0, 0x95, 0xB9, 0x10, 0xDD, 0x97, 0xEB, 0x1E, 0xCC, 0x02, 0xFF }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [o2]", { 0x87, 0xD7, 0xEE, 0xBD, 0x0E, 0x6B, 0x40, 0x3A, 0x20, 0x22, 0xBB, 0xD8, 0x4B, 0xC1, 0x28, 0x68 }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [o3]", { 0x80, 0x5F, 0x74, 0xAE, 0xF6, 0x10, 0xBA, 0x2C, 0x1F, 0x6F, 0xCE, 0xF7, 0x23, 0xCD, 0x19, 0x70 }, NULL, NULL, 0x4DB05DC4, 0x28DBF801, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [o4]", { 0xEC, 0x9B, 0x39, 0x3B, 0x3F, 0x52, 0xB7, 0x6C, 0x02, 0xE3, 0xBF, 0x2A, 0xA2, 0x01, 0x45, 0xA5 }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [o5]", { 0x4E, 0x73, 0x0D, 0x04, 0x5A, 0xC3, 0x3A, 0x64, 0xBA, 0x97, 0xD5, 0x67, 0x25, 0x89, 0xC6, 0xC7 }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [o6]", { 0x8E, 0x2F, 0x18, 0x6F, 0xC1, 0xB8, 0x6A, 0xBC, 0x1C, 0xC0, 0x4F, 0xFE, 0x18, 0x45, 0xC6, 0xAC }, NULL, NULL, 0xDB833E34, 0x63548286, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [o7]", { 0x83, 0x5E, 0x98, 0xC0, 0xB8, 0xA1, 0x64, 0x01, 0xBD, 0xC6, 0x65, 0x3E, 0x88, 0x55, 0xF0, 0xD6 }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [o7][T+Ita_cattivik66]", { 0x0A, 0xD7, 0x11, 0x1C, 0x5D, 0xB3, 0xCA, 0x07, 0x5D, 0xCD, 0x5A, 0xC9, 0x83, 0x8C, 0x3B, 0x24 }, NULL, NULL, 0x41B25DC4, 0x1B726786, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "Automobili Lamborghini (U) [t1]", { 0xA6, 0x83, 0x65, 0x24, 0xB4, 0xE7, 0x1E, 0x5A, 0xD1, 0x4D, 0xD8, 0xC3, 0x65, 0x16, 0x65, 0xAD }, NULL, NULL, 0xDB833E34, 0x63548286, 4, SAVETYPE_NONE, 5, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43F },
+    { "BB SRAM Manager (PD)", { 0x3B, 0x43, 0x30, 0x44, 0x5D, 0x9A, 0xAE, 0x1E, 0xF9, 0xC5, 0x6B, 0x13, 0x93, 0xE2, 0x81, 0xE3 }, NULL, NULL, 0x4E5507F2, 0xE7D3B413, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "BMP View by Count0 (PD)", { 0x82, 0x22, 0xD1, 0x12, 0x93, 0x94, 0xAB, 0x4F, 0x38, 0x24, 0x76, 0xD8, 0x23, 0x1E, 0xF9, 0xF6 }, NULL, NULL, 0x273433C0, 0x02B1F61B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Baku Bomberman (J) [!]", { 0x81, 0x83, 0x68, 0x8A, 0x4B, 0x7D, 0x0A, 0x39, 0x04, 0x96, 0xB5, 0x65, 0x5B, 0xCD, 0x25, 0x2E }, NULL, NULL, 0xE340A49C, 0x74318D41, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Baku Bomberman (J) [b1]", { 0x70, 0x41, 0x5D, 0x91, 0x7D, 0x5B, 0x7B, 0xEE, 0xFE, 0xDA, 0xFD, 0xB6, 0x5C, 0xD6, 0x4D, 0x43 }, NULL, NULL, 0xE340A49C, 0x74318D41, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Baku Bomberman (J) [h1C]", { 0x52, 0x59, 0xF6, 0x33, 0x13, 0x89, 0xF6, 0xAF, 0x55, 0xB8, 0x67, 0xF6, 0x0A, 0xA3, 0x73, 0xC8 }, NULL, NULL, 0xE340A49C, 0x74318D41, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Baku Bomberman (J) [t1]", { 0x70, 0x63, 0x2E, 0xE1, 0x19, 0xE5, 0x4F, 0x76, 0xA3, 0x44, 0xA7, 0xB0, 0x43, 0x40, 0xA6, 0xF9 }, NULL, NULL, 0x3A595B0E, 0xF8788AA6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Baku Bomberman 2 (J) [!]", { 0xCA, 0x95, 0x60, 0x15, 0xB6, 0x82, 0x0D, 0xCF, 0xF1, 0xC8, 0x14, 0xF3, 0x53, 0x2E, 0x18, 0xB1 }, NULL, NULL, 0xE73C7C4F, 0xAF93B838, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bakuretsu Muteki Bangai-O (J) [!]", { 0x81, 0x07, 0x82, 0x5A, 0xC2, 0xA5, 0x22, 0x05, 0x74, 0x22, 0x46, 0x3E, 0xD8, 0x1E, 0x27, 0x6B }, NULL, NULL, 0xDF98B95D, 0x58840978, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Bakuretsu Muteki Bangai-O (J) [f1] (PAL)", { 0xA7, 0x85, 0x17, 0x54, 0x08, 0x76, 0xAE, 0x94, 0xC2, 0x02, 0x7F, 0xE2, 0x60, 0x63, 0x3C, 0xA8 }, NULL, NULL, 0x0866BEDD, 0xAE31C2EE, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Bakuretsu Muteki Bangai-O (J) [h1C]", { 0x04, 0x05, 0x38, 0xEA, 0x3C, 0x22, 0x5D, 0x1E, 0x7F, 0x24, 0x97, 0xAC, 0xEF, 0xDE, 0x8C, 0xD0 }, NULL, NULL, 0xDF98B95D, 0x58840978, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Bakushou Jinsei 64 - Mezase! Resort Ou (J) [!]", { 0x09, 0xFD, 0x63, 0xAF, 0xA1, 0x15, 0x64, 0x05, 0xE6, 0x18, 0x75, 0x2F, 0xC5, 0x83, 0xDF, 0x93 }, NULL, NULL, 0x88CF980A, 0x8ED52EB5, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Bakushou Jinsei 64 - Mezase! Resort Ou (J) [h1C]", { 0xE1, 0x6C, 0xFE, 0x92, 0x68, 0xE4, 0x72, 0xA7, 0x81, 0x4C, 0x58, 0x78, 0x3A, 0xE7, 0xD3, 0xA2 }, NULL, NULL, 0x88CF980A, 0x8ED52EB5, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Banjo to Kazooie no Daibouken (J) [!]", { 0x3D, 0x38, 0x55, 0xA8, 0x6F, 0xD5, 0xA1, 0xB4, 0xD3, 0x0B, 0xEB, 0x0F, 0x5A, 0x4A, 0x85, 0xAF }, NULL, NULL, 0x5168D520, 0xCA5FCD0D, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo to Kazooie no Daibouken (J) [f1]", { 0x7F, 0xDA, 0xFD, 0x32, 0x52, 0xC0, 0xF5, 0x9F, 0xFB, 0xA5, 0x9C, 0xD4, 0x27, 0x29, 0xD9, 0x59 }, NULL, NULL, 0x18439105, 0x60424C9E, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo to Kazooie no Daibouken (J) [f2]", { 0x89, 0xBB, 0xBB, 0x73, 0x9E, 0x54, 0x72, 0x1F, 0x77, 0xF1, 0xA6, 0x44, 0x1C, 0x00, 0xC0, 0x93 }, NULL, NULL, 0x18439105, 0x60424C9E, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo to Kazooie no Daibouken (J) [f3]", { 0xB4, 0x9E, 0xC8, 0x88, 0x94, 0x0F, 0xAB, 0x43, 0x65, 0x1E, 0x48, 0xF7, 0x60, 0xBF, 0x7B, 0xBD }, NULL, NULL, 0x18439105, 0x60424C9E, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo to Kazooie no Daibouken 2 (J) [!]", { 0x71, 0x5A, 0x88, 0x16, 0xF3, 0x0F, 0xA2, 0x4B, 0x8D, 0x17, 0x4D, 0xC5, 0xCB, 0x6F, 0x25, 0xA9 }, NULL, NULL, 0x514B6900, 0xB4B19881, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (E) (M3) [!]", { 0x06, 0xA4, 0x3B, 0xAC, 0xF5, 0xC0, 0x68, 0x7F, 0x59, 0x6D, 0xF9, 0xB0, 0x18, 0xCA, 0x6D, 0x7F }, NULL, NULL, 0x733FCCB1, 0x444892F9, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (E) [T+Spa1.1_PacoChan]", { 0xD0, 0x41, 0x0D, 0x2C, 0x39, 0x9C, 0xBF, 0x21, 0x6B, 0xB7, 0x56, 0xF3, 0x5E, 0x5A, 0xC4, 0xEC }, NULL, NULL, 0x8B2FCAD3, 0x361B412C, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (E) (M3) [f1]", { 0x5F, 0xC8, 0x11, 0x6D, 0xAF, 0xDE, 0xC7, 0x3D, 0xE9, 0xC5, 0xCC, 0xC2, 0xD8, 0xE1, 0x4B, 0x4F }, NULL, NULL, 0x192C1422, 0x5B8CFF48, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (E) (M3) [f2]", { 0xF8, 0x1C, 0x31, 0x4B, 0x04, 0xCE, 0xE9, 0xDC, 0x92, 0xFD, 0x4D, 0x50, 0x81, 0x1F, 0x6F, 0xBB }, NULL, NULL, 0x192C15DA, 0x74BD6300, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (U) (V1.0) [!]", { 0xB2, 0x95, 0x99, 0x65, 0x1A, 0x13, 0xF6, 0x81, 0xC9, 0x92, 0x3D, 0x69, 0x35, 0x4B, 0xF4, 0xA3 }, NULL, NULL, 0xA4BF9306, 0xBF0CDFD1, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (U) (V1.0) [b1]", { 0x8E, 0x87, 0x00, 0x36, 0xE7, 0xA4, 0x0B, 0xA4, 0x28, 0x03, 0xC3, 0x33, 0xA4, 0x12, 0xEF, 0xE7 }, NULL, NULL, 0xA4BF9306, 0xBF0CDFD1, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (U) (V1.0) [b2]", { 0x63, 0x60, 0x92, 0x25, 0xDA, 0x40, 0xE2, 0xBA, 0xEC, 0x42, 0x5F, 0x4A, 0xEB, 0x36, 0x53, 0x30 }, NULL, NULL, 0xA4BF9306, 0xBF0CDFD1, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (U) (V1.0) [b3]", { 0x88, 0x0B, 0xB3, 0x9F, 0x8B, 0x31, 0xC0, 0x87, 0xD6, 0x6F, 0x71, 0x93, 0xD3, 0x52, 0x8E, 0xFE }, NULL, NULL, 0xA4BF9306, 0xBF0CDFD1, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (U) (V1.0) [b4]", { 0x6E, 0x3F, 0xBA, 0xF9, 0x5C, 0x79, 0xA3, 0x66, 0x8B, 0x6A, 0x92, 0x11, 0xF1, 0x37, 0x22, 0x16 }, NULL, NULL, 0x16EDC447, 0xB291F183, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (U) (V1.0) [b5]", { 0x50, 0x8B, 0x2D, 0x76, 0x88, 0x7E, 0x3F, 0xE1, 0x69, 0xB6, 0x0B, 0x6C, 0xF7, 0x0E, 0x6D, 0xBA }, NULL, NULL, 0xA4BF9306, 0xBF0CDFD1, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (U) (V1.0) [b6]", { 0x47, 0x82, 0xCA, 0x6F, 0x89, 0x3A, 0xA0, 0x3F, 0x70, 0x1D, 0x6E, 0xDA, 0x75, 0x52, 0x71, 0x1B }, NULL, NULL, 0xFEF9D364, 0xFBD6D06E, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (U) (V1.0) [b7]", { 0xB6, 0xBC, 0x12, 0x3E, 0x51, 0xAE, 0x5C, 0x31, 0x90, 0xBC, 0xA4, 0x1C, 0xFC, 0x1D, 0x63, 0x7F }, NULL, NULL, 0xA4BF9306, 0xBF0CDFD1, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (U) (V1.0) [f1]", { 0xF9, 0xE8, 0xFE, 0xF0, 0x00, 0x5E, 0x26, 0x72, 0x0E, 0xB0, 0xD0, 0xFD, 0xFA, 0xB7, 0xA8, 0x59 }, NULL, NULL, 0x16EDC447, 0xB291F183, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (U) (V1.0) [t1]", { 0x71, 0x73, 0x25, 0x0D, 0xC6, 0x6C, 0xA5, 0x80, 0x24, 0xC1, 0xC4, 0xD2, 0x7B, 0x0F, 0x87, 0x20 }, NULL, NULL, 0x16EDC447, 0xB291F183, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Kazooie (U) (V1.1) [!]", { 0xB1, 0x1F, 0x47, 0x6D, 0x4B, 0xC8, 0xE0, 0x39, 0x35, 0x52, 0x41, 0xE8, 0x71, 0xDC, 0x08, 0xCF }, NULL, NULL, 0xCD7559AC, 0xB26CF5AE, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Tooie (A) [!]", { 0x61, 0xB5, 0xC5, 0xC3, 0xE5, 0xE1, 0xA8, 0x1E, 0x5D, 0x37, 0x07, 0x2C, 0x01, 0xB3, 0x9B, 0x76 }, NULL, NULL, 0x155B7CDF, 0xF0DA7325, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Tooie (E) (M4) [!]", { 0x8B, 0x2E, 0x56, 0xF1, 0x84, 0x21, 0xA6, 0x7B, 0xCA, 0x86, 0x14, 0x27, 0x45, 0x3A, 0x1E, 0x19 }, NULL, NULL, 0xC9176D39, 0xEA4779D1, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Banjo-Tooie (U) [!]", { 0x40, 0xE9, 0x8F, 0xAA, 0x24, 0xAC, 0x3E, 0xBE, 0x1D, 0x25, 0xCB, 0x5E, 0x5D, 0xDF, 0x49, 0xE4 }, NULL, NULL, 0xC2E9AA9A, 0x475D70AA, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bass Hunter 64 (E) [!]", { 0xBF, 0x3E, 0x84, 0xCD, 0xD0, 0x1C, 0xAC, 0x05, 0x98, 0x7F, 0xD8, 0xDA, 0x51, 0x91, 0x53, 0x4B }, NULL, NULL, 0xB088FBB4, 0x441E4B1D, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Bass Rush - ECOGEAR PowerWorm Championship (J) [!]", { 0x2C, 0x61, 0x8F, 0x6C, 0x69, 0xC3, 0xB4, 0x80, 0x3F, 0x08, 0x76, 0x2A, 0x03, 0x83, 0x51, 0x39 }, NULL, NULL, 0xD76333AC, 0x0CB6219D, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x73 },
+    { "Bass Rush - ECOGEAR PowerWorm Championship (J) [b1]", { 0xB1, 0xAB, 0x1D, 0x5B, 0x3B, 0x92, 0xB0, 0xAC, 0xA3, 0x80, 0xD0, 0x29, 0x1D, 0xA0, 0x68, 0x9E }, NULL, NULL, 0xD76333AC, 0x0CB6219D, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x73 },
+    { "Bass Rush - ECOGEAR PowerWorm Championship (J) [b2]", { 0x1F, 0x99, 0x7B, 0x26, 0x06, 0x2B, 0x7D, 0x59, 0xF2, 0x31, 0x93, 0xF4, 0x48, 0x15, 0x7E, 0xE3 }, NULL, NULL, 0xD76333AC, 0x0CB6219D, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x73 },
+    { "Bassmasters 2000 (U) [!]", { 0x93, 0x0C, 0x7F, 0x6E, 0x58, 0x63, 0x47, 0x1D, 0xDE, 0x18, 0x16, 0xD2, 0x8A, 0x10, 0xEB, 0x88 }, NULL, NULL, 0xBCFACCAA, 0xB814D8EF, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bassmasters 2000 (U) [b1]", { 0xD8, 0x90, 0x35, 0x86, 0xB5, 0xE4, 0x79, 0xE6, 0xC4, 0x93, 0x78, 0x79, 0x65, 0x0D, 0x0D, 0x2D }, NULL, NULL, 0xBCFACCAA, 0xB814D8EF, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bassmasters 2000 (U) [f1] (PAL)", { 0x34, 0x24, 0x76, 0xD2, 0x0D, 0x7A, 0x7B, 0xF4, 0xC5, 0x48, 0x4D, 0x2D, 0xEF, 0xCC, 0x79, 0xE7 }, NULL, NULL, 0xDC41E81E, 0xAC36CAD1, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Batman Beyond - Return of the Joker (U) [!]", { 0xA0, 0x86, 0x76, 0x12, 0x4B, 0x32, 0x6B, 0x10, 0x35, 0xB2, 0x02, 0xC8, 0x3A, 0x97, 0x46, 0x8F }, NULL, NULL, 0x204489C1, 0x1286CF2B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Batman Beyond - Return of the Joker (U) [o1]", { 0xE4, 0x49, 0x8D, 0x8F, 0xE1, 0x1A, 0x6E, 0x0C, 0xC0, 0x73, 0x7D, 0x89, 0x36, 0x1D, 0xE0, 0x97 }, NULL, NULL, 0x204489C1, 0x1286CF2B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Batman Beyond - Return of the Joker (U) [o1][t1]", { 0x1C, 0x7F, 0xA3, 0x12, 0x71, 0xE5, 0x58, 0x8C, 0x96, 0x86, 0x75, 0xE9, 0x32, 0xC0, 0x89, 0x91 }, NULL, NULL, 0xD8928E46, 0x965CE432, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Batman of the Future - Return of the Joker (E) (M3) [!]", { 0xA5, 0xEE, 0x8A, 0x6C, 0x34, 0x86, 0x3E, 0x3D, 0x0E, 0xB8, 0xC0, 0x6A, 0xE8, 0x66, 0x8B, 0x30 }, NULL, NULL, 0x259F7F84, 0x7C9EED26, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Batman of the Future - Return of the Joker (E) (M3) [b1]", { 0xF5, 0xC9, 0xB6, 0xE4, 0xDB, 0x93, 0x82, 0x58, 0xEA, 0x27, 0x76, 0x70, 0xB6, 0xD3, 0x7F, 0x16 }, NULL, NULL, 0x259F7F84, 0x7C9EED26, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Batman of the Future - Return of the Joker (E) (M3) [o1]", { 0x87, 0x43, 0xBD, 0xDE, 0x07, 0xA2, 0xE9, 0xE0, 0xE5, 0xA0, 0x79, 0x2D, 0x7D, 0x86, 0x78, 0xCB }, NULL, NULL, 0x259F7F84, 0x7C9EED26, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "BattleTanx (U) [!]", { 0x34, 0x06, 0xA5, 0x05, 0xC2, 0x2B, 0xAC, 0x2F, 0x40, 0xD9, 0xBF, 0xC6, 0xFF, 0x08, 0xCF, 0x86 }, NULL, NULL, 0x6AA4DDE7, 0xE3E2F4E7, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "BattleTanx (U) [b1]", { 0x94, 0xA7, 0x60, 0x5A, 0x28, 0x86, 0x1C, 0x43, 0xF6, 0x36, 0xAE, 0x0F, 0xF7, 0xF2, 0x5F, 0x2E }, NULL, NULL, 0x6AA4DDE7, 0xE3E2F4E7, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "BattleTanx (U) [b1][t1]", { 0x72, 0x2D, 0x55, 0xC7, 0x03, 0x68, 0x32, 0x3D, 0x79, 0xAB, 0x1B, 0x63, 0x69, 0x6A, 0x45, 0xE4 }, NULL, NULL, 0x3D615CF5, 0x6984930A, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "BattleTanx (U) [f1] (PAL)", { 0xED, 0xD7, 0x18, 0x7C, 0x79, 0xCE, 0xBD, 0xB0, 0xD1, 0xFA, 0xBC, 0x04, 0x05, 0x02, 0xE9, 0x40 }, NULL, NULL, 0x9A75C9C2, 0xA4488353, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "BattleTanx (U) [t1]", { 0x22, 0x0B, 0x85, 0x77, 0x1E, 0x64, 0xC5, 0x54, 0x51, 0x41, 0x63, 0x12, 0x0C, 0x2F, 0x82, 0xF4 }, NULL, NULL, 0x3D615CF5, 0x6984930A, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "BattleTanx - Global Assault (E) (M3) [!]", { 0xD6, 0xE6, 0x67, 0xFE, 0x10, 0xAF, 0xE8, 0xF7, 0x11, 0x68, 0x88, 0xEF, 0xDE, 0x98, 0xAE, 0x0E }, NULL, NULL, 0x0CAD17E6, 0x71A5B797, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "BattleTanx - Global Assault (U) [!]", { 0x65, 0x45, 0x57, 0xC3, 0x16, 0xF9, 0x01, 0xA2, 0xCA, 0x6F, 0x7F, 0x4B, 0x43, 0x34, 0x31, 0x47 }, NULL, NULL, 0x75A4E247, 0x6008963D, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "BattleTanx - Global Assault (U) [f1] (Country Check)", { 0xDC, 0x5A, 0xAE, 0x1C, 0xAD, 0xF4, 0x3D, 0xF4, 0x31, 0x84, 0xD2, 0x93, 0x5C, 0x32, 0xC2, 0x6C }, NULL, NULL, 0x8A2E80DC, 0x00F61BE4, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "BattleTanx - Global Assault (U) [f2] (PAL)", { 0xD6, 0xD3, 0x05, 0x77, 0xE6, 0xE8, 0x34, 0x14, 0x95, 0xB7, 0xD8, 0x06, 0x60, 0x35, 0xC2, 0x1D }, NULL, NULL, 0x90111D7E, 0xE4B49428, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Battlezone - Rise of the Black Dogs (U) [!]", { 0x26, 0x6C, 0x09, 0x89, 0xED, 0x09, 0x29, 0xDF, 0x49, 0x93, 0x89, 0x95, 0x47, 0x79, 0xEA, 0x97 }, NULL, NULL, 0x55D4C4CE, 0x7753C78A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Beetle Adventure Racing! (E) (M3) [!]", { 0xA9, 0x41, 0x35, 0xD1, 0x63, 0xE6, 0x09, 0x1C, 0x96, 0x0A, 0xDC, 0x91, 0x8C, 0x1F, 0xB8, 0xA7 }, NULL, NULL, 0xA1B64A61, 0xD014940B, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Beetle Adventure Racing! (E) (M3) [h1C]", { 0x9D, 0x5A, 0x1B, 0x77, 0x9F, 0x8B, 0x43, 0xE6, 0x3E, 0x8C, 0xE8, 0x42, 0x76, 0x75, 0xA7, 0xEF }, NULL, NULL, 0xA1B64A61, 0xD014940B, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Beetle Adventure Racing! (E) (M3) [t1]", { 0x6B, 0x43, 0x98, 0xCE, 0x56, 0xA9, 0xC4, 0x78, 0x6F, 0x20, 0x87, 0xF6, 0x81, 0xFF, 0xFA, 0xF3 }, NULL, NULL, 0x59445C71, 0x1F1FE699, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Beetle Adventure Racing! (J) [!]", { 0x5F, 0xFD, 0x43, 0x08, 0x9B, 0x73, 0x34, 0x07, 0x2B, 0x2B, 0x74, 0x42, 0x16, 0x18, 0xD9, 0x73 }, NULL, NULL, 0x9C7318D2, 0x24AE0DC1, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Beetle Adventure Racing! (J) [b1]", { 0xE1, 0x26, 0xB8, 0x4F, 0xA2, 0x42, 0x91, 0x62, 0x89, 0xD0, 0x4D, 0x68, 0xC0, 0xE2, 0x0B, 0xFE }, NULL, NULL, 0x9C7318D2, 0x24AE0DC1, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Beetle Adventure Racing! (U) (M3) [!]", { 0xCF, 0x97, 0xC3, 0x36, 0x47, 0x9D, 0xDB, 0xF1, 0x21, 0x7E, 0x4D, 0xDE, 0x89, 0xD9, 0xD2, 0xD3 }, NULL, NULL, 0xEDF419A8, 0xBF1904CC, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Beetle Adventure Racing! (U) (M3) [b1]", { 0xD1, 0x1B, 0xC3, 0x8F, 0x26, 0xEA, 0x28, 0x35, 0xFB, 0xF0, 0x17, 0xFE, 0x9B, 0xD4, 0x04, 0xFE }, NULL, NULL, 0xEDF419A8, 0xBF1904CC, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Beetle Adventure Racing! (U) (M3) [b2]", { 0x40, 0xCB, 0xC5, 0xA2, 0x3B, 0x7D, 0x8C, 0x1F, 0xDD, 0x47, 0xD7, 0x8C, 0xAC, 0xA2, 0x92, 0x48 }, NULL, NULL, 0xEDF419A8, 0xBF1904CC, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Beetle Adventure Racing! (U) (M3) [f1] (PAL)", { 0xCC, 0x9F, 0x8A, 0x21, 0x81, 0xC6, 0xC9, 0xC5, 0xED, 0x49, 0xB7, 0x7F, 0xF6, 0x32, 0x39, 0x5A }, NULL, NULL, 0x1E17A377, 0x9D8C5E86, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Beetle Adventure Racing! (U) (M3) [t1]", { 0xEF, 0xFB, 0x7B, 0x42, 0xC6, 0xD7, 0xC2, 0x95, 0x40, 0xC9, 0x30, 0x06, 0xE6, 0x14, 0x2F, 0x99 }, NULL, NULL, 0x559A0FD3, 0x897F777C, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Beetle Adventure Racing! (U) (M3) [t2]", { 0xC2, 0x46, 0xBD, 0x29, 0x9A, 0xA7, 0x56, 0x45, 0x91, 0x93, 0xF4, 0x06, 0xA2, 0x61, 0xD1, 0xD1 }, NULL, NULL, 0x522409D3, 0x9340EBFF, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Berney Must Die! by Nop_ (POM '99) (PD)", { 0xAD, 0x7C, 0x7B, 0x99, 0x49, 0x94, 0xCF, 0x56, 0x48, 0x1E, 0x44, 0x50, 0xE9, 0x58, 0x04, 0x9F }, NULL, NULL, 0x3A089BBC, 0x54AB2C06, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x40F },
+    { "Berney Must Die! by Nop_ (POM '99) (PD) [t1]", { 0x10, 0x8A, 0x60, 0x5E, 0x3D, 0x57, 0xA5, 0xE5, 0xC5, 0x23, 0x98, 0xB6, 0x75, 0x86, 0x1E, 0xF4 }, NULL, NULL, 0x861F9BDC, 0xC3353C85, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x40F },
+    { "Big Mountain 2000 (U) [!]", { 0xBF, 0x67, 0x80, 0xE2, 0x98, 0x2C, 0x16, 0xD4, 0xA4, 0xFD, 0xB5, 0x53, 0xBE, 0x8F, 0x92, 0x26 }, NULL, NULL, 0x08FFA4B7, 0x01F453B6, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Big Mountain 2000 (U) [t1]", { 0xCF, 0xE3, 0xE7, 0x5B, 0x8B, 0x4C, 0x75, 0xF2, 0x31, 0xCB, 0xBD, 0x9C, 0x99, 0x80, 0x4E, 0xC3 }, NULL, NULL, 0xB0119B37, 0xB9774FD5, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bike Race '98 V1.0 by NAN (PD)", { 0x00, 0x59, 0xB6, 0x5E, 0x1C, 0x81, 0x3B, 0xC8, 0xBD, 0x1A, 0x61, 0xA1, 0xFE, 0x00, 0x9C, 0xCD }, NULL, NULL, 0x713FDDD3, 0x72D6A0EF, 2, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Bike Race '98 V1.0 by NAN (PD) [b1]", { 0xA1, 0x02, 0x5E, 0x61, 0x22, 0x9D, 0x5D, 0x85, 0x5D, 0x23, 0x22, 0x10, 0xB3, 0x9F, 0x5E, 0x66 }, NULL, NULL, 0x713FDDD3, 0x72D6A0EF, 2, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Bike Race '98 V1.2 by NAN (PD)", { 0x1C, 0xCD, 0x7D, 0xB5, 0xB3, 0xF5, 0x79, 0x44, 0xCA, 0xF7, 0xDA, 0x86, 0xEF, 0x17, 0x63, 0xE3 }, NULL, NULL, 0xF4B64159, 0x46FC16CF, 2, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Bike Race '98 V1.2 by NAN (PD) [b1]", { 0x58, 0xB2, 0x71, 0x63, 0x89, 0xBA, 0x3C, 0x55, 0x75, 0xB5, 0xA2, 0x87, 0xE5, 0x9F, 0x49, 0xAF }, NULL, NULL, 0xF4B64159, 0x46FC16CF, 2, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Bike Race '98 V1.2 by NAN (PD) [b2]", { 0x13, 0x3B, 0x66, 0x15, 0xCD, 0x09, 0x36, 0xAC, 0x70, 0x5D, 0xFC, 0x81, 0xE4, 0x38, 0x9C, 0xBB }, NULL, NULL, 0xF4B64159, 0x46FC16CF, 2, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Bio F.R.E.A.K.S. (E) [!]", { 0x42, 0x67, 0x2B, 0xA5, 0xE9, 0x8C, 0xD2, 0x1D, 0x7F, 0x3E, 0x37, 0x45, 0xE6, 0x90, 0x38, 0xDD }, NULL, NULL, 0xAB7C101D, 0xEC58C8B0, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bio F.R.E.A.K.S. (E) [b1]", { 0x0F, 0x41, 0x2C, 0x4C, 0xDE, 0x69, 0xAE, 0x41, 0xB8, 0x9D, 0x39, 0x07, 0x31, 0xD3, 0x4F, 0x71 }, NULL, NULL, 0xAB7C101D, 0xEC58C8B0, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bio F.R.E.A.K.S. (U) [!]", { 0xB9, 0x0A, 0xB8, 0xF7, 0x60, 0x5D, 0x97, 0x1C, 0xC7, 0xA6, 0xD9, 0xBA, 0x5E, 0x67, 0xD1, 0xAF }, NULL, NULL, 0x08123595, 0x0510F1DE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bio F.R.E.A.K.S. (U) [b1]", { 0x80, 0x1E, 0xCC, 0x49, 0xDA, 0xF0, 0x4F, 0xBA, 0x09, 0x9C, 0x6F, 0x75, 0xA0, 0x6F, 0x04, 0x54 }, NULL, NULL, 0x08123595, 0x0510F1DE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bio F.R.E.A.K.S. (U) [b2]", { 0xF6, 0x4B, 0x26, 0x3F, 0x67, 0xAC, 0xA5, 0xDE, 0x19, 0x57, 0x29, 0x9F, 0xD9, 0x2F, 0xB3, 0x5A }, NULL, NULL, 0x08123595, 0x0510F1DE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bio F.R.E.A.K.S. (U) [b3]", { 0x3F, 0x28, 0x02, 0xF1, 0x20, 0x58, 0xB4, 0x51, 0x1A, 0x07, 0x78, 0xA8, 0x91, 0x05, 0x02, 0x97 }, NULL, NULL, 0xB6223A7B, 0x2139CEA6, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bio F.R.E.A.K.S. (U) [h1C]", { 0xE0, 0x2A, 0xEF, 0x75, 0xAC, 0x05, 0x9F, 0xC2, 0x44, 0x6B, 0xFF, 0xDD, 0x06, 0xEE, 0x64, 0xA9 }, NULL, NULL, 0x08123595, 0x0510F1DE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bio F.R.E.A.K.S. (U) [t1]", { 0x87, 0x9A, 0x08, 0x5B, 0x07, 0xB7, 0xE6, 0xD5, 0x2D, 0xFE, 0x2C, 0xE6, 0x36, 0xD7, 0xA2, 0x39 }, NULL, NULL, 0xB6223A7B, 0x2139CEA6, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Biohazard 2 (J) [!]", { 0xF7, 0x7D, 0x70, 0x95, 0x92, 0x22, 0x27, 0x64, 0x91, 0x22, 0x2F, 0x31, 0xEB, 0xFF, 0x3B, 0xF1 }, NULL, NULL, 0x7EAE2488, 0x9D40A35A, 0, SAVETYPE_SRAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Birthday Demo for Steve by Nep (PD) [b1]", { 0x13, 0xD7, 0x83, 0x42, 0x91, 0xA3, 0x11, 0x07, 0x7B, 0x84, 0xB9, 0xA2, 0x81, 0x6A, 0xF6, 0xFC }, NULL, NULL, 0xC2B35C2F, 0x5CD995A2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Birthday Demo for Steve by Nep (PD)", { 0x44, 0x43, 0xB1, 0x1C, 0x45, 0x73, 0x48, 0xB0, 0xB6, 0xB6, 0x46, 0x50, 0x90, 0x9F, 0x01, 0x43 }, NULL, NULL, 0xC2B35C2F, 0x5CD995A2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Blast Corps (E) (M2) [!]", { 0x88, 0x9D, 0x4D, 0x33, 0x7A, 0xD1, 0x1C, 0xE9, 0x43, 0x57, 0x51, 0x1C, 0x72, 0x5E, 0xAB, 0x6A }, NULL, NULL, 0x7C64E6DB, 0x55B924DB, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Blast Corps (E) (M2) [b1]", { 0x7C, 0x9C, 0x00, 0x0B, 0x61, 0xBF, 0x0B, 0xCF, 0x81, 0xAF, 0xD4, 0xE5, 0x83, 0xEC, 0x9B, 0x2A }, NULL, NULL, 0x7C64E6DB, 0x55B924DB, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Blast Corps (E) (M2) [b2]", { 0x36, 0xC9, 0x7C, 0x12, 0xDD, 0xAB, 0xB0, 0x2D, 0x7D, 0x2D, 0x3F, 0x6B, 0x33, 0xB3, 0xD8, 0x3F }, NULL, NULL, 0x7C64E6DB, 0x55B924DB, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Blast Corps (U) (V1.0) [!]", { 0xA8, 0xDF, 0xDF, 0xF4, 0x91, 0x44, 0x62, 0x74, 0x92, 0xDA, 0x9B, 0x0B, 0x65, 0xB9, 0x18, 0x45 }, NULL, NULL, 0x7C647C25, 0xD9D901E6, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Blast Corps (U) (V1.0) [b1]", { 0x00, 0x0E, 0x40, 0x36, 0x6E, 0xCE, 0x22, 0x55, 0x65, 0xD3, 0xEC, 0x83, 0xBE, 0x7D, 0x97, 0xA4 }, NULL, NULL, 0x7C647C25, 0xD9D901E6, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Blast Corps (U) (V1.0) [b2]", { 0x4B, 0xFB, 0x72, 0xFC, 0x9A, 0x78, 0x75, 0x43, 0x32, 0x3A, 0xDE, 0xFC, 0x8E, 0xC2, 0xA0, 0x42 }, NULL, NULL, 0x7C647C25, 0xD9D901E6, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Blast Corps (U) (V1.1) [!]", { 0x58, 0x75, 0xFC, 0x73, 0x06, 0x90, 0x77, 0xC9, 0x3E, 0x21, 0x42, 0x33, 0xB6, 0x0F, 0x0B, 0xDC }, NULL, NULL, 0x7C647E65, 0x1948D305, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Blast Dozer (J) [!]", { 0x16, 0xB8, 0x2D, 0x53, 0xD7, 0xF0, 0x38, 0xA8, 0xFE, 0x67, 0xA7, 0x80, 0x27, 0x72, 0x05, 0x16 }, NULL, NULL, 0x65234451, 0xEBD3346F, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Blast Dozer (J) [b1]", { 0xFA, 0x3A, 0x55, 0x97, 0x01, 0x2B, 0x71, 0x0C, 0x84, 0x46, 0x82, 0xDA, 0x58, 0x6A, 0x62, 0xC9 }, NULL, NULL, 0x65234451, 0xEBD3346F, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Blues Brothers 2000 (E) (M6) [!]", { 0x31, 0xB4, 0xA8, 0xED, 0x52, 0xB4, 0x8E, 0x75, 0x6B, 0x34, 0x4C, 0x9F, 0x22, 0x73, 0x6E, 0x50 }, NULL, NULL, 0xD571C883, 0x822D3FCF, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Blues Brothers 2000 (U) [!]", { 0x99, 0x7F, 0xD8, 0xF7, 0x9C, 0xD6, 0xF3, 0xCD, 0x1C, 0x1C, 0x1F, 0xD2, 0x1E, 0x35, 0x87, 0x17 }, NULL, NULL, 0x7CD08B12, 0x1153FF89, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Blues Brothers 2000 (U) [f1] (PAL-NTSC)", { 0x96, 0xD5, 0x91, 0x0A, 0x6F, 0xFD, 0x3E, 0xE5, 0x36, 0x38, 0x25, 0x1A, 0xCE, 0x86, 0xE0, 0xCB }, NULL, NULL, 0xA9A17EF3, 0xAB1F8703, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Blues Brothers 2000 (U) [t1]", { 0xA6, 0xE0, 0x3F, 0xA1, 0x94, 0xA2, 0x93, 0x2D, 0x36, 0xE0, 0xA6, 0x7F, 0x9F, 0x64, 0xD9, 0x2E }, NULL, NULL, 0xA0976BE9, 0xFF41562B, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Blues Brothers 2000 (U) [t1][f1] (PAL-NTSC)", { 0xA8, 0xD3, 0x1D, 0x97, 0x15, 0xBB, 0x56, 0x45, 0xEF, 0xC3, 0x24, 0x5A, 0x64, 0x97, 0xF5, 0x42 }, NULL, NULL, 0xABB57137, 0x960F561D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Body Harvest (E) (M3) [!]", { 0xB2, 0x7F, 0xA5, 0xE9, 0xAD, 0x0C, 0xB4, 0x7B, 0xB3, 0xA7, 0x4F, 0xFA, 0xC7, 0xBC, 0x8E, 0xDF }, NULL, NULL, 0x0B58B8CD, 0xB7B291D2, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Body Harvest (E) (M3) [f1] (NTSC)", { 0x0E, 0xF2, 0x44, 0x8C, 0x24, 0x3F, 0x86, 0xC4, 0xC9, 0xF1, 0x94, 0xF4, 0x9C, 0xFD, 0x83, 0x52 }, NULL, NULL, 0x6F66B92D, 0x80B9E520, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Body Harvest (U) [!]", { 0x3B, 0x85, 0x85, 0xED, 0x03, 0xE8, 0xDD, 0xB8, 0x9D, 0x7D, 0xE4, 0x56, 0x31, 0x75, 0x45, 0xE7 }, NULL, NULL, 0x5326696F, 0xFE9A99C3, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Body Harvest (U) [T+Spa0.98_jackic]", { 0x8D, 0x21, 0xDF, 0xCD, 0xE6, 0x53, 0x41, 0x27, 0xCB, 0xB4, 0x44, 0xB7, 0x36, 0x1B, 0x0D, 0x99 }, NULL, NULL, 0x810CED2D, 0xD7B3F710, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Body Harvest (U) [b1]", { 0x77, 0x55, 0x48, 0x10, 0x62, 0x9D, 0x4E, 0xF4, 0xD9, 0x35, 0x19, 0x74, 0x5F, 0xA6, 0x06, 0x6B }, NULL, NULL, 0x5326696F, 0xFE9A99C3, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Body Harvest (U) [b1][t1]", { 0xD2, 0x66, 0xB2, 0x88, 0x82, 0x91, 0x93, 0xBD, 0x82, 0x05, 0xDD, 0xDC, 0xDF, 0xA5, 0xCF, 0x30 }, NULL, NULL, 0xC535091F, 0xD60CCF6C, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Body Harvest (U) [b2]", { 0x13, 0x53, 0x25, 0x19, 0xCB, 0xC4, 0x3B, 0xFA, 0x63, 0x8F, 0xD5, 0xA7, 0x75, 0x4E, 0xE2, 0x81 }, NULL, NULL, 0x00A46EE3, 0x554158C6, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Body Harvest (U) [t1]", { 0xD8, 0xBD, 0x69, 0xAE, 0xE8, 0x24, 0x6A, 0x31, 0x27, 0xA5, 0x8E, 0x20, 0x2D, 0x44, 0x7B, 0xA1 }, NULL, NULL, 0xC535091F, 0xD60CCF6C, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Bokujou Monogatari 2 (J) (V1.0) [!]", { 0x1C, 0xF3, 0x1E, 0x7F, 0x6E, 0x0D, 0xEB, 0x2C, 0x18, 0xC3, 0x9D, 0xDD, 0x4E, 0xED, 0x9E, 0x51 }, NULL, NULL, 0xB3D451C6, 0xE1CB58E2, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x453 },
+    { "Bokujou Monogatari 2 (J) (V1.0) [b1]", { 0xC9, 0x02, 0xBB, 0x72, 0x03, 0xC6, 0xC7, 0x7D, 0xDA, 0x16, 0xAB, 0xCD, 0xF8, 0x99, 0x5E, 0x32 }, NULL, NULL, 0xB3D451C6, 0xE1CB58E2, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x453 },
+    { "Bokujou Monogatari 2 (J) (V1.1) [!]", { 0xE6, 0x27, 0xB8, 0x98, 0xA7, 0x69, 0x2C, 0x08, 0xB5, 0x95, 0xA8, 0xD2, 0x17, 0x8E, 0x34, 0xA0 }, NULL, NULL, 0x7365D8F8, 0x9ED9326F, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x453 },
+    { "Bokujou Monogatari 2 (J) (V1.2) [!]", { 0x24, 0xE3, 0xEE, 0x6A, 0x54, 0x27, 0x8D, 0xB6, 0x5C, 0x46, 0x38, 0x04, 0xF2, 0xBB, 0x62, 0x23 }, NULL, NULL, 0x736657F6, 0x3C88A702, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x453 },
+    { "Bomberman 64 (E) [!]", { 0xB6, 0x8F, 0x49, 0xAA, 0x8F, 0x6F, 0x74, 0x99, 0x18, 0x4A, 0xC6, 0xB7, 0xB8, 0x57, 0x0F, 0x2B }, NULL, NULL, 0x5A160336, 0xBC7B37B0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bomberman 64 (E) [b1]", { 0xB9, 0xE6, 0xA3, 0x8B, 0x28, 0x10, 0x8E, 0x4D, 0x6E, 0x6A, 0x0A, 0x47, 0xBF, 0x98, 0x17, 0x47 }, NULL, NULL, 0x5A160336, 0xBC7B37B0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bomberman 64 (E) [b2]", { 0x4D, 0x5C, 0x42, 0xB2, 0x39, 0xDF, 0xD6, 0x7E, 0x40, 0xD4, 0xE9, 0x47, 0x6A, 0x20, 0x8A, 0x1E }, NULL, NULL, 0x5A160336, 0xBC7B37B0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bomberman 64 (E) [h1C]", { 0x02, 0x83, 0xCC, 0x12, 0x5A, 0xEA, 0x29, 0xEF, 0x72, 0xA0, 0x3B, 0xEE, 0x7D, 0x75, 0x9C, 0x5D }, NULL, NULL, 0x5A160336, 0xBC7B37B0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bomberman 64 (E) [t1]", { 0x99, 0x76, 0x83, 0x33, 0x01, 0x11, 0x6D, 0x0C, 0xB9, 0xE2, 0x78, 0xE8, 0x57, 0x92, 0x1B, 0xF6 }, NULL, NULL, 0x938CA401, 0x43339F1B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bomberman 64 (U) [!]", { 0x09, 0x30, 0x58, 0xEC, 0xE1, 0x4C, 0x8C, 0xC1, 0xA8, 0x87, 0xB2, 0x08, 0x7E, 0xB5, 0xCF, 0xE9 }, NULL, NULL, 0xF568D51E, 0x7E49BA1E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bomberman 64 (U) [b1]", { 0xBB, 0x4C, 0x57, 0x69, 0xEE, 0xD6, 0x93, 0x62, 0xF1, 0xA9, 0x0A, 0x2B, 0xE1, 0x99, 0x98, 0xD6 }, NULL, NULL, 0xF568D51E, 0x7E49BA1E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bomberman 64 (U) [o1]", { 0xFA, 0x43, 0x47, 0xAC, 0x05, 0xBC, 0x0C, 0x0B, 0xBC, 0x8C, 0xAB, 0xE3, 0xED, 0x90, 0xB8, 0xA4 }, NULL, NULL, 0xF568D51E, 0x7E49BA1E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bomberman 64 - Arcade Edition (J) [f1] (PAL)", { 0x56, 0x7B, 0x89, 0x14, 0xE0, 0x64, 0x27, 0x21, 0x40, 0x8D, 0x46, 0x62, 0x7E, 0x36, 0x00, 0x3B }, NULL, NULL, 0xDF6FF0F4, 0x29D14238, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Bomberman 64 - Arcade Edition (J) [f2] (PAL-CRC)", { 0x85, 0x2E, 0x86, 0x51, 0xD6, 0xC6, 0x10, 0xCE, 0x59, 0x3C, 0x35, 0xCE, 0xA6, 0x78, 0xC9, 0xF1 }, NULL, NULL, 0xE87F1ACE, 0x809F204B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Bomberman 64 - Arcade Edition (J) [!]", { 0xD5, 0x4F, 0xD7, 0x06, 0x7B, 0xD7, 0x74, 0xE3, 0x2B, 0x57, 0xF9, 0xC2, 0xC0, 0x49, 0x68, 0x99 }, NULL, NULL, 0xDF6FF0F4, 0x29D14238, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Bomberman 64 - Arcade Edition (J) [b1]", { 0x08, 0xE4, 0x91, 0xF8, 0x74, 0x45, 0xC6, 0xE5, 0xC1, 0x68, 0xD9, 0x82, 0xFC, 0x66, 0x5D, 0x5F }, NULL, NULL, 0xDF6FF0F4, 0x29D14238, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Bomberman 64 - Arcade Edition (J) [T+Eng1.3_Zoinkity]", { 0xC7, 0x14, 0x80, 0x6B, 0x4C, 0xC1, 0x44, 0xA3, 0xEA, 0xBD, 0x23, 0x4C, 0x07, 0x41, 0x21, 0x09 }, NULL, NULL, 0x9780C9FB, 0x67CF6B4A, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Bomberman 64 - The Second Attack! (U) [!]", { 0xAE, 0xC1, 0xFD, 0xB0, 0xF1, 0xCA, 0xAD, 0x86, 0xC9, 0xF4, 0x57, 0x98, 0x9A, 0x4C, 0xE4, 0x82 }, NULL, NULL, 0x237E73B4, 0xD63B6B37, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bomberman 64 - The Second Attack! (U) [t1][f1] (PAL-NTSC)", { 0x90, 0x58, 0x97, 0x0D, 0xDF, 0x26, 0x43, 0x1A, 0x4D, 0xAF, 0x35, 0x3C, 0x2E, 0xEA, 0x86, 0xAB }, NULL, NULL, 0x9BA3E5CC, 0xEB222304, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bomberman Hero (E) [!]", { 0xF7, 0x9E, 0xF0, 0x81, 0x31, 0x57, 0x88, 0x0F, 0xFB, 0xAD, 0x61, 0x99, 0xE0, 0x75, 0x79, 0xBE }, NULL, NULL, 0xD85C4E29, 0x88E276AF, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero (E) [b1]", { 0xEA, 0x6D, 0x0E, 0xBD, 0x67, 0x3A, 0x66, 0xC3, 0x95, 0x56, 0x9A, 0x2A, 0x23, 0x0A, 0xEA, 0x6F }, NULL, NULL, 0xD85C4E29, 0x88E276AF, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero (E) [b2]", { 0x14, 0x14, 0x30, 0xD0, 0x34, 0xC1, 0x6F, 0xC4, 0xB4, 0xBA, 0x20, 0xD5, 0x3E, 0xAB, 0x61, 0xC1 }, NULL, NULL, 0xD85C4E29, 0x88E276AF, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero (E) [b3]", { 0x8A, 0x8E, 0x73, 0xD7, 0x0C, 0xBC, 0x90, 0x2C, 0xD9, 0x9C, 0x7A, 0x4E, 0x2B, 0x98, 0x27, 0x78 }, NULL, NULL, 0xD85C4E29, 0x88E276AF, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero (E) [f1] (NTSC)", { 0x00, 0x87, 0x10, 0xF6, 0x28, 0xC2, 0x9D, 0x69, 0xBD, 0x93, 0x90, 0x66, 0xA4, 0x4A, 0xB8, 0x77 }, NULL, NULL, 0xD85C4E29, 0x88E276AF, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero (U) [!]", { 0xEF, 0x24, 0x53, 0xBF, 0xF7, 0xAD, 0x0C, 0x4B, 0xFA, 0x9A, 0xB0, 0xBD, 0x63, 0x24, 0xEB, 0xF3 }, NULL, NULL, 0x4446FDD6, 0xE3788208, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero (U) [b1]", { 0x56, 0x42, 0xE5, 0x1D, 0x74, 0x6F, 0x60, 0x3D, 0xFE, 0x5A, 0x71, 0xC5, 0xCB, 0xDB, 0x5C, 0x73 }, NULL, NULL, 0x4446FDD6, 0xE3788208, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero (U) [b2]", { 0x11, 0x43, 0xB4, 0x9D, 0x78, 0x8B, 0xA4, 0x77, 0xDA, 0xE9, 0x8C, 0x05, 0xD6, 0x62, 0x33, 0x44 }, NULL, NULL, 0xDA573DB9, 0x9442D273, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero (U) [b3]", { 0x1B, 0xCE, 0xD1, 0xBA, 0x1B, 0xF5, 0xA0, 0xE2, 0xFF, 0x57, 0x68, 0xC7, 0x14, 0xEE, 0x46, 0x27 }, NULL, NULL, 0xDA573DB9, 0x9442D273, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero (U) [t1]", { 0x8A, 0x04, 0x79, 0x71, 0x42, 0x59, 0x95, 0x4B, 0xAE, 0x41, 0xD5, 0x27, 0x5A, 0xC9, 0x26, 0xF4 }, NULL, NULL, 0xDA573DB9, 0x9442D273, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero - Mirian Oujo wo Sukue! (J) [!]", { 0xEE, 0x27, 0x37, 0x63, 0xC7, 0x39, 0x14, 0x58, 0x86, 0x5F, 0xF2, 0x6C, 0x7E, 0xA0, 0xC3, 0xF1 }, NULL, NULL, 0x67FF12CC, 0x76BF0212, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero - Mirian Oujo wo Sukue! (J) [b1]", { 0xE7, 0xD3, 0xA4, 0xA7, 0x3D, 0x37, 0x3D, 0xA5, 0x34, 0xA0, 0x25, 0xE9, 0x9B, 0x4D, 0x0E, 0xEF }, NULL, NULL, 0x67FF12CC, 0x76BF0212, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero - Mirian Oujo wo Sukue! (J) [b2]", { 0x8F, 0xA5, 0xE5, 0x5E, 0x55, 0x97, 0xE2, 0x61, 0x5F, 0x81, 0xCD, 0x23, 0x6D, 0xCA, 0x47, 0x21 }, NULL, NULL, 0xDDEF1333, 0xE7209D07, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero - Mirian Oujo wo Sukue! (J) [b3]", { 0xF3, 0x94, 0x76, 0x59, 0x1E, 0x14, 0x79, 0x06, 0x29, 0x1B, 0xA4, 0x81, 0x45, 0xF3, 0x04, 0xB0 }, NULL, NULL, 0xDDEF1333, 0xE7209D07, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero - Mirian Oujo wo Sukue! (J) [b4]", { 0x49, 0xE9, 0xC7, 0xAA, 0xCF, 0x83, 0x9E, 0x46, 0xEA, 0x2D, 0x25, 0x5A, 0x99, 0xFB, 0x26, 0x13 }, NULL, NULL, 0x67FF12CC, 0x76BF0212, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero - Mirian Oujo wo Sukue! (J) [b5]", { 0xD4, 0x80, 0x6C, 0xD9, 0xD9, 0xDF, 0xC7, 0xE5, 0x2D, 0x6F, 0x82, 0x5B, 0x5D, 0x5C, 0xC7, 0xC2 }, NULL, NULL, 0xDDEF1333, 0xE7209D07, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero - Mirian Oujo wo Sukue! (J) [b6]", { 0x30, 0x19, 0x43, 0x20, 0xB5, 0x4F, 0xF6, 0x7C, 0xB0, 0xCD, 0xA5, 0xDD, 0xB0, 0x61, 0xD9, 0x33 }, NULL, NULL, 0xDDEF1333, 0xE7209D07, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero - Mirian Oujo wo Sukue! (J) [b7]", { 0x2C, 0x68, 0xA2, 0xD1, 0x2C, 0x1E, 0xBF, 0xA2, 0xAD, 0x8F, 0x0B, 0xE1, 0xA0, 0x9A, 0xEE, 0xE7 }, NULL, NULL, 0x67FF12CC, 0x76BF0212, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero - Mirian Oujo wo Sukue! (J) [b8]", { 0x40, 0x22, 0xB2, 0xA0, 0xF2, 0x22, 0x18, 0x87, 0x07, 0x64, 0xCD, 0xAE, 0x73, 0x58, 0x07, 0x62 }, NULL, NULL, 0xDDEF1333, 0xE7209D07, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero - Mirian Oujo wo Sukue! (J) [o1]", { 0xA1, 0x2B, 0x36, 0x1F, 0x9D, 0x38, 0xFD, 0xFE, 0x31, 0x83, 0xC2, 0xB4, 0xC1, 0xF2, 0xF2, 0x17 }, NULL, NULL, 0x67FF12CC, 0x76BF0212, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Bomberman Hero - Mirian Oujo wo Sukue! (J) [t1]", { 0xC4, 0x54, 0x3F, 0x27, 0xB4, 0xE4, 0x81, 0xD0, 0x81, 0x8B, 0x51, 0x03, 0x6B, 0x67, 0xDF, 0xEF }, NULL, NULL, 0xDDEF1333, 0xE7209D07, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Boot Emu by Jovis (PD)", { 0xB5, 0x77, 0x2A, 0x28, 0x27, 0xBE, 0xFC, 0x81, 0xE1, 0x07, 0xAE, 0x75, 0x6B, 0x36, 0xBB, 0x2A }, NULL, NULL, 0x2D15DC8C, 0xD3BBDB52, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Bottom of the 9th (U) [!]", { 0xFB, 0x19, 0xAF, 0xD5, 0xE8, 0xC4, 0x99, 0x78, 0xE6, 0xE6, 0xAE, 0x36, 0x22, 0xE0, 0x49, 0x8A }, NULL, NULL, 0xD72FD14D, 0x1FED32C4, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Bottom of the 9th (U) [b1]", { 0x6E, 0x20, 0x7C, 0x47, 0xFA, 0xAD, 0x2A, 0x4F, 0x64, 0xAE, 0x72, 0x1A, 0x3A, 0x8F, 0x61, 0x61 }, NULL, NULL, 0xD72FD14D, 0x1FED32C4, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Brunswick Circuit Pro Bowling (U) [!]", { 0x62, 0xE9, 0x21, 0x02, 0xD6, 0xFD, 0x17, 0x01, 0xA6, 0xE9, 0x04, 0xDA, 0x6A, 0xB5, 0x8A, 0xE8 }, NULL, NULL, 0x1E22CF2E, 0x42AAC813, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Brunswick Circuit Pro Bowling (U) [b1]", { 0x14, 0xD0, 0x70, 0x07, 0x7D, 0x70, 0xC9, 0x4C, 0xBB, 0x14, 0x13, 0xC7, 0x64, 0x1E, 0x72, 0x72 }, NULL, NULL, 0x91644B9F, 0x8CDD0DA5, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Brunswick Circuit Pro Bowling (U) [o1]", { 0x2D, 0x30, 0xFB, 0xE4, 0x5C, 0x28, 0x58, 0x95, 0x7F, 0x9E, 0xFD, 0xB5, 0xE9, 0x00, 0x00, 0x33 }, NULL, NULL, 0x1E22CF2E, 0x42AAC813, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Brunswick Circuit Pro Bowling (U) [o1][f1] (PAL)", { 0xC3, 0xA5, 0x5D, 0x50, 0x6E, 0x5B, 0xD0, 0x11, 0xEC, 0x20, 0xF6, 0x01, 0xEA, 0x2B, 0x33, 0xBB }, NULL, NULL, 0x91644B9F, 0x8CDD0DA5, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Buck Bumble (E) (M5) [!]", { 0xA2, 0xE4, 0xBE, 0x02, 0x87, 0x6C, 0xB0, 0xF0, 0xD1, 0xE9, 0x25, 0xFF, 0x95, 0x09, 0x0C, 0x96 }, NULL, NULL, 0xD5B2339C, 0xCABCCAED, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Buck Bumble (J) [!]", { 0xAE, 0xE9, 0x81, 0x97, 0x7D, 0x8F, 0x06, 0x90, 0x03, 0x57, 0x4C, 0xD1, 0x0A, 0x26, 0x8D, 0x47 }, NULL, NULL, 0xD7C762B6, 0xF83D9642, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Buck Bumble (U) [!]", { 0x41, 0x41, 0x7F, 0xCE, 0x2B, 0x37, 0xEA, 0xAE, 0x78, 0x7C, 0x5A, 0x84, 0x5A, 0x00, 0x15, 0xC4 }, NULL, NULL, 0x85AE781A, 0xC756F05D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Buck Bumble (U) [b1][t1]", { 0x01, 0x93, 0x3A, 0x0C, 0xBB, 0xDE, 0x1D, 0x4E, 0xB4, 0xC5, 0x8C, 0xC6, 0xC6, 0xC2, 0x76, 0x33 }, NULL, NULL, 0x3C2B07FC, 0x8C6AC97B, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Buck Bumble (U) [b2]", { 0xCD, 0x19, 0x78, 0x8A, 0xE0, 0x4D, 0xAD, 0x7A, 0xF2, 0x7F, 0xD0, 0xC5, 0x91, 0x98, 0x3C, 0xCE }, NULL, NULL, 0xE8522F04, 0x43FA513A, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Buck Bumble (U) [f1] (PAL)", { 0xC1, 0x29, 0xEE, 0x8D, 0xA7, 0xFE, 0x1B, 0x97, 0x6D, 0x71, 0x93, 0x27, 0x33, 0x38, 0x54, 0x38 }, NULL, NULL, 0x3C2AC7FA, 0x72BC3A5F, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Buck Bumble (U) [t1]", { 0x28, 0xF8, 0xF7, 0xD8, 0x42, 0x3B, 0x29, 0x1E, 0x30, 0x56, 0x04, 0x7C, 0x62, 0xE2, 0x93, 0x7A }, NULL, NULL, 0x3C2B07FC, 0x8C6AC97B, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bug's Life, A (E) [!]", { 0xED, 0x3E, 0x96, 0x26, 0x53, 0xA1, 0xCD, 0x56, 0xAA, 0xB1, 0x75, 0xDE, 0xEE, 0x6E, 0xE5, 0x2A }, NULL, NULL, 0x8F12C096, 0x45DC17E1, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bug's Life, A (E) [f1] (NTSC)", { 0x5B, 0xF0, 0xF2, 0x35, 0x1A, 0xEE, 0x57, 0x7A, 0x83, 0x45, 0xD6, 0xE1, 0x3D, 0x19, 0x7E, 0x06 }, NULL, NULL, 0x09035DC5, 0x870C1041, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bug's Life, A (F) [!]", { 0xD2, 0x86, 0x0D, 0x4F, 0xBD, 0x0E, 0xC4, 0xB2, 0x71, 0x1A, 0x6E, 0xF8, 0xD7, 0x8F, 0x98, 0x66 }, NULL, NULL, 0x2B38AEC0, 0x6350B810, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bug's Life, A (F) [f1] (NTSC)", { 0x50, 0x4C, 0x92, 0xA5, 0x97, 0x8B, 0x7E, 0xAE, 0x7A, 0x3F, 0xD3, 0x06, 0x45, 0xE0, 0x6D, 0x39 }, NULL, NULL, 0xBD58346E, 0x67E74459, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bug's Life, A (G) [!]", { 0xCB, 0xEF, 0x54, 0x76, 0x86, 0x70, 0xF4, 0xB5, 0x60, 0x2C, 0xCB, 0xC9, 0x01, 0x50, 0x00, 0x7A }, NULL, NULL, 0xDFF227D9, 0x0D4D8169, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bug's Life, A (G) [f1] (NTSC)", { 0x91, 0x9E, 0x5D, 0x60, 0xA7, 0xF9, 0xA7, 0x9D, 0x89, 0xAC, 0x17, 0x91, 0x23, 0xD4, 0x7E, 0xEE }, NULL, NULL, 0x31E33A96, 0x2744267B, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bug's Life, A (I) [!]", { 0xE3, 0x60, 0x9F, 0xD1, 0x23, 0x69, 0xC4, 0x64, 0xE8, 0x32, 0xC6, 0xD2, 0xA4, 0xD2, 0x07, 0x90 }, NULL, NULL, 0xF63B89CE, 0x4582D57D, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bug's Life, A (U) [!]", { 0x7F, 0xD6, 0xBF, 0xFB, 0x80, 0xF9, 0x20, 0xE0, 0x1E, 0xF8, 0x69, 0x82, 0x9D, 0x48, 0x5E, 0xA3 }, NULL, NULL, 0x82DC04FD, 0xCF2D82F4, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bug's Life, A (U) [b1]", { 0x14, 0xAC, 0xC2, 0x04, 0x54, 0xB0, 0xC2, 0x78, 0x9C, 0x9F, 0x7E, 0xF7, 0xA5, 0x56, 0x23, 0x1A }, NULL, NULL, 0x82DC04FD, 0xCF2D82F4, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bug's Life, A (U) [b1][f1] (PAL)", { 0x64, 0x72, 0xBD, 0x44, 0x4D, 0x20, 0x25, 0xB1, 0xD8, 0x83, 0xFF, 0xAE, 0x35, 0xD9, 0x4F, 0xD4 }, NULL, NULL, 0x2FE62885, 0xF6853DAF, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bug's Life, A (U) [f1] (PAL)", { 0x08, 0xE3, 0xF4, 0xEE, 0xEA, 0x56, 0xC8, 0x73, 0xA8, 0x4E, 0xA0, 0x76, 0xAA, 0x36, 0x2E, 0xDD }, NULL, NULL, 0x2FE62885, 0xF6853DAF, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bug's Life, A (U) [t1]", { 0xB8, 0xB7, 0x60, 0x61, 0x3C, 0xAA, 0x70, 0x2E, 0x33, 0xF2, 0x71, 0x74, 0x11, 0x70, 0x63, 0x2A }, NULL, NULL, 0x3F4AFB7B, 0x2D24C8F8, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bug's Life, A (U) [t2]", { 0x30, 0xAA, 0xE8, 0xA5, 0x34, 0xC7, 0x2F, 0xFC, 0x89, 0x34, 0x3E, 0x8E, 0xF0, 0xF1, 0xC5, 0xA1 }, NULL, NULL, 0x3F4AFB7B, 0x2D24C8F8, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Bust-A-Move '99 (U) [!]", { 0x85, 0x67, 0x38, 0x2D, 0x3C, 0xD5, 0xBC, 0x04, 0x06, 0xB7, 0xB4, 0xC7, 0x80, 0xF6, 0x21, 0xDC }, NULL, NULL, 0x4222D89F, 0xAFE0B637, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bust-A-Move '99 (U) [b1]", { 0xB2, 0x92, 0xB1, 0x4B, 0xBC, 0x7F, 0xFC, 0xC2, 0xA7, 0x41, 0xFE, 0x87, 0xA8, 0x0B, 0x8D, 0x4D }, NULL, NULL, 0x8AFB2D9A, 0x9F186C02, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bust-A-Move '99 (U) [f1] (PAL)", { 0x4E, 0xA8, 0x62, 0x77, 0x01, 0xC3, 0xD6, 0xAF, 0x50, 0xDD, 0xAA, 0x60, 0x7A, 0xA3, 0xB7, 0xF9 }, NULL, NULL, 0xF23CA406, 0xEC2ACE78, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bust-A-Move 2 - Arcade Edition (E) [!]", { 0x09, 0x4F, 0x63, 0x9A, 0x9B, 0xA6, 0x3B, 0x21, 0x36, 0xD2, 0x88, 0x7C, 0x8D, 0x72, 0xBC, 0xA0 }, NULL, NULL, 0xCEDCDE1E, 0x513A0502, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bust-A-Move 2 - Arcade Edition (E) [b1]", { 0xAE, 0x06, 0x93, 0xC8, 0xD7, 0x3E, 0x5A, 0x14, 0x07, 0xA2, 0xED, 0xF4, 0x1F, 0x11, 0x64, 0xA9 }, NULL, NULL, 0xB121ED86, 0x883423F1, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bust-A-Move 2 - Arcade Edition (U) [!]", { 0x88, 0x97, 0xA3, 0x9E, 0x34, 0xAE, 0xE4, 0xD3, 0xF8, 0x07, 0xAF, 0x25, 0x5C, 0x66, 0x17, 0xD6 }, NULL, NULL, 0x8A86F073, 0xCD45E54B, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bust-A-Move 2 - Arcade Edition (U) [b1]", { 0x84, 0xDD, 0x20, 0xF8, 0x0D, 0xB2, 0x3C, 0xB4, 0x9B, 0xFE, 0x98, 0x63, 0x9B, 0xE6, 0xCD, 0x71 }, NULL, NULL, 0x8A86F073, 0xCD45E54B, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bust-A-Move 2 - Arcade Edition (U) [b2]", { 0x50, 0x65, 0xD7, 0xA8, 0x33, 0xFC, 0x73, 0xCB, 0x75, 0xDE, 0xD8, 0xD6, 0x39, 0xAA, 0xAD, 0xA5 }, NULL, NULL, 0x2D03FD5B, 0xD5C096D5, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bust-A-Move 2 - Arcade Edition (U) [b3]", { 0xEF, 0x3D, 0x1E, 0x90, 0x59, 0x72, 0x37, 0x66, 0x94, 0x1F, 0xF4, 0xE0, 0xE9, 0x13, 0xC9, 0x41 }, NULL, NULL, 0x322EF540, 0x38D316EB, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bust-A-Move 2 - Arcade Edition (U) [b4]", { 0x8E, 0xEF, 0x2B, 0xB9, 0x54, 0x3B, 0x78, 0x19, 0x7C, 0xED, 0xDA, 0x6D, 0xA8, 0x60, 0xDA, 0x97 }, NULL, NULL, 0x8A86F073, 0xCD45E54B, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Bust-A-Move 3 DX (E) [!]", { 0x3E, 0xA2, 0x12, 0x56, 0xDD, 0xC4, 0x15, 0x7C, 0x32, 0x31, 0xAE, 0x5C, 0xC9, 0xC4, 0x65, 0x2A }, NULL, NULL, 0xE328B4FA, 0x004A28E1, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bust-A-Move 3 DX (E) [b1]", { 0x16, 0xD7, 0x67, 0x6C, 0x23, 0x94, 0xE4, 0x22, 0x07, 0x6F, 0x7C, 0xB8, 0x55, 0xDE, 0x90, 0x1B }, NULL, NULL, 0x364C4ADC, 0xD3050993, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bust-A-Move 3 DX (E) [b2]", { 0x0B, 0xD4, 0xAE, 0xB1, 0x2E, 0x50, 0x2C, 0x39, 0x14, 0x0E, 0x4D, 0xA5, 0x2F, 0x77, 0x64, 0x2E }, NULL, NULL, 0xE328B4FA, 0x004A28E1, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bust-A-Move 3 DX (E) [b3]", { 0x08, 0x9D, 0x12, 0xEE, 0x45, 0xBF, 0xAC, 0xD4, 0xA9, 0xFC, 0x93, 0x18, 0x5A, 0xF5, 0xC4, 0x2B }, NULL, NULL, 0xE328B4FA, 0x004A28E1, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bust-A-Move 3 DX (E) [f1] (NTSC100%)", { 0x1B, 0xDC, 0x2B, 0xFD, 0xD0, 0xB6, 0xCA, 0x9D, 0x8F, 0xD3, 0x54, 0xAE, 0xAF, 0x1A, 0x3C, 0xF6 }, NULL, NULL, 0x364C4ADC, 0xD3050993, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bust-A-Move 3 DX (E) [f2] (NTSC-Z64)", { 0xF7, 0xCA, 0x97, 0xBE, 0x22, 0x56, 0x30, 0xB7, 0x69, 0x0A, 0x86, 0x2F, 0xCA, 0x97, 0xE4, 0x42 }, NULL, NULL, 0xD5BDCD1D, 0x393AFE43, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Bust-A-Move 3 DX (E) [f3] (NTSC)", { 0x3C, 0xA4, 0x6A, 0xD4, 0x3F, 0x9B, 0x62, 0xDF, 0x40, 0x97, 0x59, 0xD5, 0x64, 0x68, 0xF1, 0x8E }, NULL, NULL, 0xD5BDCD1D, 0x393AFE43, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "CD64 BIOS Direct-Upgrade V1.08", { 0x6A, 0x78, 0xDA, 0x71, 0x54, 0x40, 0xC0, 0xC6, 0x87, 0x2B, 0x5D, 0x78, 0xD3, 0x1B, 0xFD, 0x3B }, NULL, NULL, 0x549EA1B0, 0xF666F794, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS Direct-Upgrade V1.09", { 0x17, 0x6D, 0x51, 0x8A, 0xD6, 0xE1, 0xD8, 0x9B, 0xC0, 0xFE, 0xF0, 0x67, 0x2A, 0x4C, 0x18, 0x82 }, NULL, NULL, 0x8E3D8D2E, 0x9850573F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS Direct-Upgrade V1.10", { 0x0B, 0x7C, 0x2A, 0x6D, 0x2B, 0x3D, 0xE3, 0xD7, 0xD0, 0xFF, 0x7A, 0xAF, 0xAB, 0x6F, 0x8D, 0xA7 }, NULL, NULL, 0x3E93A24F, 0xAC2D58E1, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS Direct-Upgrade V1.11", { 0x30, 0xD7, 0xD7, 0x30, 0xE8, 0xC1, 0x31, 0xC7, 0x7E, 0xC6, 0xF6, 0x39, 0x0B, 0x9E, 0xB8, 0xB3 }, NULL, NULL, 0xFAB972E4, 0x1CB0882B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS Direct-Upgrade V1.13", { 0xCF, 0x1E, 0x4E, 0x42, 0xB9, 0x3E, 0xCB, 0xB0, 0x80, 0xC0, 0x5B, 0x73, 0xBB, 0x4A, 0xF8, 0x08 }, NULL, NULL, 0x960621E3, 0x7D4D5BB0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS Direct-Upgrade V1.20", { 0xB0, 0x3E, 0x6F, 0xAF, 0xEA, 0x6A, 0x31, 0x42, 0x85, 0xD0, 0x18, 0x1D, 0x5D, 0x2A, 0xBB, 0xAB }, NULL, NULL, 0xD32264A1, 0x989987EA, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS Direct-Upgrade V1.21", { 0xA9, 0x11, 0xF1, 0x3E, 0x7D, 0x4C, 0xF1, 0x57, 0xC7, 0x93, 0x30, 0xE9, 0x08, 0xBA, 0xE9, 0xA7 }, NULL, NULL, 0x4F354F88, 0xA75E40E0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS Direct-Upgrade V1.23", { 0x67, 0x11, 0xB9, 0xD8, 0x0D, 0x4D, 0x22, 0xAD, 0x0D, 0xC4, 0xAF, 0x20, 0xC9, 0x08, 0x87, 0x63 }, NULL, NULL, 0xAAD9FC15, 0xB2C9DA6F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS Direct-Upgrade V1.30", { 0x35, 0x4E, 0x8A, 0x1B, 0xC6, 0x46, 0x83, 0xF0, 0x1F, 0xE5, 0x98, 0xF5, 0x1D, 0x5A, 0xB4, 0xBE }, NULL, NULL, 0x6BF11774, 0xD330D7ED, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.08 [a1]", { 0xF7, 0x0A, 0x06, 0x30, 0x5D, 0x5C, 0x54, 0x59, 0x80, 0xD9, 0xD2, 0xD1, 0x6E, 0xF1, 0x22, 0xB2 }, NULL, NULL, 0x626C7AA3, 0xC1480B86, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.08", { 0x4E, 0xA4, 0x11, 0x9D, 0x7D, 0x07, 0xFD, 0x96, 0x5B, 0xB0, 0x9A, 0x97, 0x43, 0x41, 0xE0, 0xF3 }, NULL, NULL, 0x57D1CEA5, 0xE2CCC89F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.09", { 0xD4, 0x7E, 0xC4, 0x84, 0x4C, 0x8C, 0x39, 0x46, 0xA3, 0x22, 0x2F, 0xB2, 0x2E, 0x10, 0x3F, 0x04 }, NULL, NULL, 0xCADEA283, 0x46EAF060, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.10", { 0xE7, 0xC8, 0xD1, 0x09, 0x0F, 0xA9, 0x0E, 0x9B, 0x8C, 0x29, 0xB4, 0x87, 0x34, 0xCF, 0x3A, 0x78 }, NULL, NULL, 0xBE4AF7A0, 0x14E3D32C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.11 (Even Bytes)", { 0xE7, 0x30, 0xED, 0xA7, 0x16, 0xAE, 0x40, 0xBD, 0xBC, 0x40, 0x4F, 0x76, 0x01, 0x49, 0x1D, 0x77 }, NULL, NULL, 0x43362020, 0x20202020, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.11 (Odd Bytes)", { 0x70, 0x6D, 0xB1, 0x9D, 0x4A, 0xA4, 0xEA, 0xF9, 0x02, 0xC8, 0xB4, 0x85, 0x44, 0x88, 0x4C, 0xEF }, NULL, NULL, 0x44342020, 0x20202056, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.11", { 0xCB, 0xEA, 0x29, 0x8B, 0xFE, 0x9B, 0x59, 0xBB, 0xDB, 0xC3, 0x79, 0xAB, 0xFD, 0x2C, 0xD2, 0x08 }, NULL, NULL, 0x4A0CD2F4, 0xF1F22FE3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.21 (Even Bytes)", { 0x81, 0x91, 0xF6, 0x94, 0x5D, 0xAB, 0x90, 0xA1, 0x7E, 0x75, 0x2A, 0xA3, 0xC9, 0x4B, 0x04, 0x02 }, NULL, NULL, 0x43362020, 0x20202020, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.21 (Odd Bytes)", { 0x1D, 0xF4, 0xF3, 0x50, 0x3F, 0xEF, 0xFB, 0xA6, 0x21, 0x40, 0x92, 0xE0, 0xAB, 0xBA, 0x33, 0xB2 }, NULL, NULL, 0x44342020, 0x20202056, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.21", { 0x16, 0xE7, 0x7C, 0x21, 0xE1, 0xEA, 0x47, 0xFD, 0xD8, 0xC5, 0x63, 0x5C, 0xFF, 0xF9, 0x4B, 0xFD }, NULL, NULL, 0xE74607D1, 0x751139B4, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.23 (Even Bytes)", { 0xAA, 0xAA, 0x05, 0x51, 0xDB, 0x73, 0x72, 0x8D, 0x79, 0xEB, 0xC1, 0xD1, 0xED, 0xD1, 0x27, 0xF6 }, NULL, NULL, 0x43362020, 0x20202020, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.23 (Odd Bytes)", { 0x16, 0x88, 0x72, 0x48, 0x4F, 0x1E, 0x93, 0x3F, 0xF3, 0x51, 0xD1, 0xC3, 0xDC, 0x1F, 0xC6, 0x01 }, NULL, NULL, 0x44342020, 0x20202056, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.23", { 0xDA, 0x02, 0x7D, 0xB6, 0xDC, 0xB6, 0x43, 0xB0, 0xBF, 0xCE, 0x71, 0x72, 0x0A, 0x1F, 0x75, 0x00 }, NULL, NULL, 0xFE169919, 0x46F54C2D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.30 (Even Bytes)", { 0x78, 0x1A, 0xE1, 0x74, 0xBE, 0xDA, 0x86, 0x41, 0xE3, 0xF0, 0xE1, 0xEF, 0xAD, 0x76, 0x10, 0x50 }, NULL, NULL, 0x43362020, 0x20202020, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.30 (Odd Bytes)", { 0x39, 0x65, 0xF1, 0x4D, 0x45, 0x0F, 0x01, 0x9B, 0xEB, 0x85, 0x91, 0xAA, 0x10, 0xAF, 0xC2, 0xBF }, NULL, NULL, 0x44342020, 0x20202056, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 BIOS EEPROM-Burner V1.30", { 0x51, 0x31, 0x3E, 0x88, 0xD8, 0x6D, 0xFF, 0x53, 0x1E, 0x38, 0x65, 0x29, 0xBB, 0xE4, 0x5D, 0xD5 }, NULL, NULL, 0xC7F15051, 0xEE3DEE75, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CD64 Memory Test (PD)", { 0xA9, 0x9D, 0x3F, 0x43, 0x34, 0xF2, 0xF5, 0x9B, 0x24, 0x7F, 0xD5, 0xCB, 0x3D, 0xC8, 0x5A, 0x77 }, NULL, NULL, 0x95081A8B, 0x49DFE4FA, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "CZN Module Player (PD)", { 0x22, 0x61, 0x27, 0xFD, 0xBA, 0x21, 0xFC, 0x90, 0x19, 0x39, 0x7E, 0xD2, 0xC5, 0xE5, 0xB1, 0x9F }, NULL, NULL, 0x5B9D65DF, 0xA18AB4AE, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "California Speed (E) (Prototype)", { 0x29, 0xB7, 0x9B, 0xF5, 0x81, 0x2E, 0x5F, 0x9E, 0x5E, 0xCE, 0xF0, 0x73, 0xD5, 0x9F, 0x89, 0x15 }, NULL, NULL, 0xCA2A7444, 0x71DAB71C, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "California Speed (U) [!]", { 0x96, 0x5A, 0xD2, 0xFA, 0x31, 0x7F, 0x06, 0x44, 0xE4, 0x9A, 0x89, 0xA3, 0x21, 0x97, 0x19, 0xCB }, NULL, NULL, 0xAC16400E, 0xCF5D071A, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "California Speed (U) [f1] (Country Check)", { 0xC9, 0x53, 0x53, 0xC1, 0x4C, 0x4A, 0xE3, 0xDC, 0x95, 0xD1, 0xD9, 0x1D, 0x65, 0x66, 0xEF, 0x92 }, NULL, NULL, 0xAC16460E, 0x46F60594, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "California Speed (U) [f2] (PAL)", { 0x76, 0x58, 0x07, 0x5D, 0x52, 0xC4, 0x03, 0x78, 0x36, 0x40, 0xDF, 0xAC, 0x2F, 0x8B, 0x6A, 0x9E }, NULL, NULL, 0x41D44009, 0x5E94483F, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "California Speed (U) [t1]", { 0xEE, 0xEA, 0xD6, 0x9D, 0x62, 0xEB, 0x43, 0xF0, 0x93, 0xD9, 0xD4, 0x6C, 0x38, 0xA8, 0x2A, 0xC5 }, NULL, NULL, 0x150DDE31, 0x969D3994, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Carmageddon 64 (E) (M4) (Eng-Spa-Fre-Ger) [!]", { 0xCA, 0x21, 0x46, 0x7B, 0xDE, 0x6B, 0x35, 0x5E, 0x7A, 0x15, 0xB8, 0xF1, 0xAD, 0xA7, 0xB2, 0x4D }, NULL, NULL, 0x580162EC, 0xE3108BF1, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Carmageddon 64 (E) (M4) (Eng-Spa-Fre-Ger) [f1] (NTSC)", { 0xA5, 0xDB, 0x49, 0x6C, 0x32, 0x8C, 0x36, 0x68, 0x2E, 0xB7, 0x70, 0xCE, 0xFE, 0x6C, 0x20, 0x64 }, NULL, NULL, 0xBCC83145, 0x6B7F5DA6, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Carmageddon 64 (E) (M4) (Eng-Spa-Fre-Ita) [!]", { 0x59, 0xEB, 0x56, 0x46, 0xFA, 0x07, 0x9B, 0xCB, 0xD7, 0xA3, 0x40, 0xD7, 0xA1, 0x01, 0x96, 0xDD }, NULL, NULL, 0xE48E01F5, 0xE6E51F9B, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Carmageddon 64 (E) (M4) (Eng-Spa-Fre-Ita) [b1]", { 0xD5, 0x27, 0x1D, 0xB3, 0xCB, 0xE6, 0xB2, 0x40, 0x99, 0xDC, 0xC6, 0x87, 0x8C, 0x13, 0x7F, 0xF7 }, NULL, NULL, 0xE48E01F5, 0xE6E51F9B, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Carmageddon 64 (E) (M4) (Eng-Spa-Fre-Ita) [f1] (NTSC)", { 0xBC, 0xD2, 0xA4, 0x5C, 0x39, 0x12, 0x8B, 0x7D, 0x7E, 0x29, 0xE3, 0x51, 0x78, 0x8E, 0x86, 0x0E }, NULL, NULL, 0xA1CC026F, 0xE09D1766, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Carmageddon 64 (E) (M4) (Eng-Spa-Fre-Ita) [f2] (NTSC)", { 0x35, 0x59, 0xBE, 0x56, 0xB7, 0x0B, 0xAF, 0xB7, 0x7C, 0x90, 0x05, 0x16, 0xB9, 0x09, 0xBF, 0xEF }, NULL, NULL, 0x5D0283F5, 0x2CDEEA76, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Carmageddon 64 (U) [!]", { 0x31, 0xBB, 0x57, 0xC1, 0xFA, 0xD0, 0xD4, 0x7D, 0xC2, 0x35, 0x3C, 0x19, 0x50, 0xB1, 0x18, 0x86 }, NULL, NULL, 0xF00F2D4E, 0x340FAAF4, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Castlevania (E) (M3) [!]", { 0x57, 0x14, 0x6B, 0x6C, 0xD8, 0xEE, 0x7D, 0x96, 0xB0, 0x1A, 0x81, 0x1F, 0x98, 0xA1, 0xAC, 0x61 }, NULL, NULL, 0x64F1B7CA, 0x71A23755, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania (E) (M3) [b1]", { 0xDE, 0x30, 0xF7, 0xC3, 0xD0, 0x77, 0x77, 0x83, 0x80, 0xE2, 0xB3, 0xD5, 0x07, 0xEF, 0xE2, 0xD3 }, NULL, NULL, 0x64F1B7CA, 0x71A23755, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania (E) (M3) [t1]", { 0x96, 0xC8, 0xDA, 0x6D, 0x15, 0x67, 0xF4, 0x35, 0x70, 0xCC, 0xB3, 0x62, 0x81, 0x11, 0x14, 0xDE }, NULL, NULL, 0xDA0E5024, 0x969ED261, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania (U) (V1.0) [!]", { 0x1C, 0xC5, 0xCF, 0x3B, 0x4D, 0x29, 0xD8, 0xC3, 0xAD, 0xE9, 0x57, 0x64, 0x8B, 0x52, 0x9D, 0xC1 }, NULL, NULL, 0xF35D5F95, 0x8AFE3D69, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania (U) (V1.0) [b1]", { 0xC1, 0x9E, 0x5A, 0x3F, 0xCD, 0xF5, 0x2C, 0x72, 0x92, 0x09, 0x7F, 0x21, 0x5D, 0xDC, 0x42, 0x8A }, NULL, NULL, 0xF35D5F95, 0x8AFE3D69, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania (U) (V1.0) [b2]", { 0x1A, 0x9E, 0xBA, 0x4D, 0x8C, 0xB6, 0x47, 0xFD, 0x03, 0xAA, 0xEB, 0x02, 0x2D, 0x04, 0x34, 0x4F }, NULL, NULL, 0xF35D5F95, 0x8AFE3D69, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania (U) (V1.0) [b3]", { 0xA4, 0xDB, 0x62, 0xBA, 0xBE, 0x85, 0x83, 0xE5, 0xF5, 0x67, 0x4F, 0xFC, 0xFF, 0x8B, 0x8D, 0xFC }, NULL, NULL, 0xF35D5F95, 0x8AFE3D69, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania (U) (V1.0) [b4]", { 0x3E, 0x97, 0x2E, 0x33, 0x40, 0xBE, 0xD6, 0xE4, 0x7D, 0x3C, 0x51, 0x5D, 0xD1, 0x0E, 0xAE, 0xDA }, NULL, NULL, 0xF35D5F95, 0x8AFE3D69, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania (U) (V1.0) [t1]", { 0x1F, 0xEC, 0x5A, 0x43, 0xF7, 0x56, 0xC4, 0xAA, 0xE9, 0x58, 0xCD, 0x28, 0x6F, 0x64, 0x51, 0xC5 }, NULL, NULL, 0x0B28EBA3, 0x5E062616, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania (U) (V1.0) [t2]", { 0xEB, 0xDC, 0x90, 0x53, 0x48, 0x5A, 0xAE, 0xE0, 0x53, 0x78, 0xA9, 0xD9, 0x5D, 0x99, 0x11, 0x04 }, NULL, NULL, 0x036CBFE5, 0x9E626365, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania (U) (V1.0) [t3]", { 0x8F, 0x94, 0xC0, 0xA4, 0x3D, 0x69, 0x7D, 0x8D, 0xEA, 0xE9, 0xDE, 0x66, 0x08, 0x65, 0xA9, 0x66 }, NULL, NULL, 0x0B28EBA3, 0x5E062616, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania (U) (V1.0) [t4]", { 0x8A, 0xDA, 0x90, 0xFB, 0xD3, 0x31, 0x3D, 0x50, 0x80, 0x00, 0x79, 0x05, 0xD1, 0x83, 0xCB, 0xD4 }, NULL, NULL, 0x0B28EBA3, 0x5E062616, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania (U) (V1.1) [!]", { 0xCE, 0x71, 0xD1, 0xCE, 0x0A, 0x2B, 0x6D, 0x59, 0x7F, 0x72, 0xCB, 0x4F, 0xC0, 0x8F, 0x58, 0x44 }, NULL, NULL, 0xF35D5335, 0xB7667CB7, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania (U) (V1.2) [!]", { 0x06, 0xB5, 0x86, 0x73, 0xF7, 0xD3, 0x1C, 0x56, 0xF8, 0xFE, 0x81, 0x86, 0xE8, 0x6F, 0x6B, 0xD6 }, NULL, NULL, 0x4BCDFF47, 0xAAA3AF8F, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania - Legacy of Darkness (E) (M3) [!]", { 0x78, 0xD5, 0xF8, 0xA9, 0x8A, 0x5E, 0xD2, 0x1D, 0x08, 0x17, 0x85, 0x6B, 0xCD, 0x2A, 0xD7, 0x50 }, NULL, NULL, 0xA2C54BE7, 0x6719CBB2, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania - Legacy of Darkness (E) (M3) [h1C]", { 0x31, 0x52, 0xB8, 0x2C, 0x03, 0xFC, 0x7B, 0x92, 0x8D, 0x3D, 0x5C, 0x43, 0xF9, 0x5A, 0xEF, 0x51 }, NULL, NULL, 0xA2C54BE7, 0x6719CBB2, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania - Legacy of Darkness (E) (M3) [o1]", { 0x45, 0xEF, 0x27, 0x94, 0xA1, 0xAC, 0x6A, 0xD7, 0x37, 0x28, 0x8A, 0x65, 0x77, 0xD5, 0x51, 0x94 }, NULL, NULL, 0xA2C54BE7, 0x6719CBB2, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania - Legacy of Darkness (U) [!]", { 0x25, 0x25, 0x84, 0x60, 0xF9, 0x8F, 0x56, 0x74, 0x97, 0xB2, 0x48, 0x44, 0xAB, 0xE3, 0xA0, 0x5B }, NULL, NULL, 0x1CC06338, 0x87388926, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania - Legacy of Darkness (U) [b1]", { 0x5F, 0x73, 0x63, 0x4C, 0x62, 0x2A, 0xBE, 0xDF, 0x62, 0x04, 0xCB, 0x80, 0x18, 0x72, 0xC7, 0x9C }, NULL, NULL, 0x1CC06338, 0x87388926, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania - Legacy of Darkness (U) [f1] (PAL)", { 0x2D, 0x6A, 0xBF, 0x55, 0x9A, 0x9A, 0xAE, 0x65, 0xBB, 0xEB, 0x0E, 0x60, 0xB3, 0xF8, 0x2D, 0x1B }, NULL, NULL, 0x0CE3D2E6, 0x6C6E443D, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania - Legacy of Darkness (U) [f2] (PAL)", { 0xDE, 0x4C, 0xA7, 0xC5, 0xF9, 0xDD, 0x92, 0x16, 0x77, 0x14, 0x51, 0xA5, 0xAF, 0xF9, 0xF6, 0x34 }, NULL, NULL, 0x7FD0761E, 0x2190A9ED, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Castlevania - Legacy of Darkness (U) [t1]", { 0x95, 0x6F, 0xCD, 0x46, 0xE8, 0x50, 0xE9, 0xD1, 0x0E, 0x62, 0x3C, 0x67, 0x49, 0xD5, 0x52, 0x4E }, NULL, NULL, 0x64B62D16, 0x43A2A592, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Centre Court Tennis (E) [!]", { 0x31, 0xFB, 0x88, 0x04, 0x80, 0x76, 0xAC, 0xE4, 0xBD, 0x42, 0x05, 0xC5, 0xF4, 0x04, 0x14, 0xAB }, NULL, NULL, 0xDCCF2134, 0x9DD63578, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Centre Court Tennis (E) [f1] (NTSC)", { 0xF5, 0x26, 0x61, 0xEF, 0x93, 0xB9, 0xFD, 0x4D, 0xF1, 0x6F, 0x1F, 0x11, 0x30, 0x82, 0xAE, 0xAA }, NULL, NULL, 0xB6C4F400, 0x92A39D47, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Centre Court Tennis (E) [h1C]", { 0x53, 0xEE, 0x01, 0x72, 0xE2, 0x9C, 0xDC, 0xBB, 0xFA, 0x59, 0x57, 0xA4, 0x42, 0x86, 0x3E, 0x5A }, NULL, NULL, 0xDCCF2134, 0x9DD63578, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Chameleon Twist (E) [!]", { 0x1C, 0xD9, 0x0B, 0x13, 0xB7, 0xFD, 0x6A, 0xFD, 0xCB, 0x83, 0x8F, 0x80, 0x1D, 0x80, 0x78, 0x26 }, NULL, NULL, 0xB9AF8CC6, 0xDEC9F19F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chameleon Twist (E) [b1]", { 0xAB, 0x7D, 0x53, 0x66, 0xFE, 0xDC, 0xF8, 0xEC, 0x2D, 0x41, 0x4B, 0x60, 0x01, 0xBE, 0xB3, 0x99 }, NULL, NULL, 0xB9AF8CC6, 0xDEC9F19F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chameleon Twist (E) [b2]", { 0x7C, 0x74, 0xD0, 0x8A, 0x04, 0xB6, 0xB1, 0xB6, 0x70, 0xD9, 0x0C, 0xDB, 0x15, 0x3F, 0x08, 0x3C }, NULL, NULL, 0xB9AF8CC6, 0xDEC9F19F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chameleon Twist (E) [b3]", { 0x21, 0x51, 0xAB, 0x86, 0x29, 0xDA, 0xCD, 0x89, 0x36, 0x43, 0x9F, 0xC9, 0x0F, 0x0A, 0xFD, 0x10 }, NULL, NULL, 0xB9AF8CC6, 0xDEC9F19F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chameleon Twist (E) [f1] (NTSC)", { 0x36, 0x82, 0xAE, 0xBA, 0x1D, 0xA1, 0x91, 0xA1, 0xCB, 0x2C, 0x51, 0x3B, 0x1F, 0x83, 0x4F, 0x70 }, NULL, NULL, 0x4191BA80, 0x41C5E21A, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chameleon Twist (E) [o1]", { 0xC7, 0x17, 0x50, 0xC4, 0xB8, 0x40, 0x81, 0xF3, 0x33, 0x1D, 0x95, 0x7D, 0x3F, 0xE9, 0x32, 0xAD }, NULL, NULL, 0xB9AF8CC6, 0xDEC9F19F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chameleon Twist (E) [o2]", { 0x37, 0x28, 0xBE, 0x19, 0xFD, 0xCF, 0xC3, 0xEC, 0xEB, 0xD8, 0xC7, 0x50, 0x4C, 0x13, 0xD1, 0xF5 }, NULL, NULL, 0xB9AF8CC6, 0xDEC9F19F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chameleon Twist (J) [!]", { 0xC0, 0xEB, 0x51, 0x91, 0x22, 0xD6, 0x3A, 0x94, 0x4A, 0x12, 0x24, 0x37, 0xEC, 0x1B, 0x98, 0xEE }, NULL, NULL, 0xA4F2F521, 0xF0EB168E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chameleon Twist (U) (V1.0) [!]", { 0x39, 0x7B, 0xE5, 0x2D, 0x4F, 0xB7, 0xDF, 0x1E, 0x26, 0xC6, 0x27, 0x5E, 0x05, 0x42, 0x55, 0x71 }, NULL, NULL, 0x6420535A, 0x50028062, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chameleon Twist (U) (V1.0) [b1]", { 0xAB, 0x29, 0x9B, 0x39, 0x43, 0x16, 0x1B, 0x9C, 0x2A, 0xBF, 0x03, 0xF5, 0xA9, 0x82, 0x4E, 0x9F }, NULL, NULL, 0x6420535A, 0x50028062, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chameleon Twist (U) (V1.0) [b2]", { 0x95, 0x9E, 0x64, 0xF0, 0x82, 0x44, 0x9B, 0xDB, 0xD0, 0xE5, 0x16, 0x4C, 0x32, 0x49, 0x14, 0x70 }, NULL, NULL, 0x6420535A, 0x50028062, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chameleon Twist (U) (V1.0) [b3]", { 0x27, 0x7D, 0x85, 0x2D, 0xF9, 0xC7, 0x1B, 0xE8, 0xDC, 0xBA, 0x01, 0xBA, 0x8C, 0x86, 0x24, 0x82 }, NULL, NULL, 0x6420535A, 0x50028062, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chameleon Twist (U) (V1.0) [t1]", { 0x0A, 0x04, 0xF5, 0xF5, 0x93, 0x82, 0x18, 0xB5, 0x10, 0xA5, 0x73, 0xB8, 0x69, 0x67, 0xB1, 0x99 }, NULL, NULL, 0x1CD50DF2, 0x345593AF, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chameleon Twist (U) (V1.1) [!]", { 0xD8, 0xA8, 0x8A, 0xCF, 0xCD, 0x89, 0xDF, 0x7A, 0x59, 0xD9, 0xA1, 0xB0, 0x50, 0xFD, 0xA7, 0x40 }, NULL, NULL, 0xD81963C7, 0x4271A3AA, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chameleon Twist 2 (E) [!]", { 0x45, 0xD1, 0xD0, 0x39, 0xAB, 0x79, 0x26, 0xAD, 0xC7, 0x48, 0xDE, 0x64, 0x0A, 0xFD, 0x98, 0x6A }, NULL, NULL, 0x07A69D01, 0x9A7D41A1, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Chameleon Twist 2 (E) [b1]", { 0x3A, 0x5E, 0xDF, 0x72, 0x56, 0xEA, 0x5E, 0x7A, 0xF4, 0xB4, 0x51, 0xE0, 0x7C, 0xC5, 0x40, 0x03 }, NULL, NULL, 0x07A69D01, 0x9A7D41A1, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Chameleon Twist 2 (J) [!]", { 0x74, 0x0A, 0xD4, 0xDB, 0x03, 0x95, 0x2B, 0xBE, 0x99, 0x7D, 0xB0, 0x99, 0x47, 0xA4, 0x1E, 0x62 }, NULL, NULL, 0x0549765A, 0x93B9D042, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Chameleon Twist 2 (J) [b1]", { 0x7A, 0x63, 0x84, 0x31, 0xCE, 0x96, 0x6D, 0xDA, 0x97, 0xB2, 0x82, 0xFF, 0x04, 0xB1, 0xD9, 0xD7 }, NULL, NULL, 0x0549765A, 0x93B9D042, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Chameleon Twist 2 (J) [b2]", { 0x24, 0x65, 0x8C, 0x0D, 0x8A, 0xC2, 0xC4, 0xFD, 0x58, 0xA7, 0x4F, 0x13, 0xBC, 0xA1, 0xD1, 0x6A }, NULL, NULL, 0x7D5772F8, 0x3A6785EF, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Chameleon Twist 2 (J) [b3]", { 0x99, 0x60, 0x57, 0x63, 0xAD, 0x74, 0xD4, 0x0D, 0x5B, 0x2D, 0x24, 0xCF, 0x3F, 0x0A, 0x3C, 0xD5 }, NULL, NULL, 0x0549765A, 0x93B9D042, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Chameleon Twist 2 (J) [b4]", { 0x33, 0xB9, 0xDD, 0xDD, 0x6D, 0x70, 0x39, 0xCE, 0x1C, 0x9E, 0x67, 0x73, 0x05, 0x6A, 0x65, 0xC8 }, NULL, NULL, 0x0549765A, 0x93B9D042, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Chameleon Twist 2 (J) [b5]", { 0xA5, 0x5A, 0xF4, 0x33, 0xE6, 0x5E, 0x36, 0x90, 0xE2, 0xDC, 0x2B, 0x16, 0x01, 0x8E, 0x9A, 0x0F }, NULL, NULL, 0x0549765A, 0x93B9D042, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Chameleon Twist 2 (J) [o2]", { 0x4C, 0x5F, 0x3C, 0x38, 0x74, 0x3E, 0xBB, 0x2D, 0x12, 0x15, 0x4A, 0x83, 0xC0, 0x26, 0xDA, 0x46 }, NULL, NULL, 0x0549765A, 0x93B9D042, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Chameleon Twist 2 (J) [t1]", { 0xD8, 0x5C, 0x29, 0xFD, 0x57, 0xFE, 0x48, 0x1A, 0x34, 0xAF, 0xBC, 0xDB, 0x97, 0x74, 0x39, 0x5A }, NULL, NULL, 0x7D5772F8, 0x3A6785EF, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Chameleon Twist 2 (U) [!]", { 0x00, 0x32, 0x7E, 0x0B, 0x5D, 0xF6, 0xDC, 0xE6, 0xDE, 0xCC, 0x31, 0x35, 0x3F, 0x33, 0xA3, 0xD3 }, NULL, NULL, 0xCD538CE4, 0x618AFCF9, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Chameleon Twist 2 (U) [t1]", { 0x80, 0xF4, 0xCD, 0x56, 0x31, 0x72, 0x18, 0x26, 0x4E, 0x35, 0x89, 0x4B, 0xA2, 0x2C, 0xAD, 0x35 }, NULL, NULL, 0x752E1BF8, 0xE81DF66D, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Chaos 89 Demo (PD)", { 0x4A, 0x32, 0x63, 0xEA, 0xB6, 0x7F, 0xAB, 0x2D, 0x11, 0x71, 0xA2, 0x37, 0x65, 0xD7, 0x3A, 0xC6 }, NULL, NULL, 0xEDA1A0C7, 0x58EE0464, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Charlie Blast's Territory (E) [!]", { 0xDD, 0x53, 0xE1, 0xF8, 0x3E, 0x87, 0x89, 0xD2, 0x3D, 0xF6, 0xAF, 0x94, 0x2F, 0xFE, 0xF2, 0x36 }, NULL, NULL, 0xFB3C48D0, 0x8D28F69F, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Charlie Blast's Territory (E) [o1]", { 0xA7, 0xC1, 0x5E, 0x0C, 0x1E, 0x7D, 0x89, 0x8C, 0x1B, 0x20, 0x27, 0x6D, 0xF7, 0xA6, 0x26, 0x60 }, NULL, NULL, 0xFB3C48D0, 0x8D28F69F, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Charlie Blast's Territory (U) [!]", { 0x74, 0x7E, 0x76, 0xD5, 0x0D, 0xC3, 0xC0, 0x6F, 0xD3, 0x5E, 0x14, 0x61, 0x29, 0x70, 0x6A, 0x60 }, NULL, NULL, 0x1E0E96E8, 0x4E28826B, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Charlie Blast's Territory (U) [b1]", { 0x59, 0xFA, 0x8C, 0x6D, 0x53, 0x3D, 0x36, 0xC0, 0xFF, 0xC2, 0xAA, 0xFA, 0xB7, 0x16, 0x6E, 0x6F }, NULL, NULL, 0x1E0E96E8, 0x4E28826B, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Charlie Blast's Territory (U) [hIR]", { 0x7F, 0xFD, 0x84, 0xFC, 0x7D, 0x11, 0x2E, 0xAB, 0x4E, 0xEF, 0x15, 0xCB, 0x10, 0x18, 0x9A, 0x38 }, NULL, NULL, 0x1E0E96E8, 0x4E28826B, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Charlie Blast's Territory (U) [hI]", { 0x7C, 0xBB, 0x43, 0x47, 0x35, 0x97, 0xF4, 0x8A, 0xA9, 0xA8, 0xE0, 0xB0, 0xD3, 0x8C, 0xE6, 0x85 }, NULL, NULL, 0xA6FD0808, 0x6E6B3ECA, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Chopper Attack (E) [!]", { 0x8F, 0x6B, 0xED, 0x63, 0x3B, 0xE2, 0x14, 0xCF, 0x03, 0x9D, 0xBD, 0xAC, 0x35, 0x62, 0x31, 0xCE }, NULL, NULL, 0x2E359339, 0x3FA5EDA6, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chopper Attack (E) [b1]", { 0xAC, 0x12, 0x9A, 0xB2, 0x68, 0x8C, 0x02, 0x41, 0x9F, 0xC1, 0x90, 0xA8, 0x7F, 0x2A, 0x2E, 0x93 }, NULL, NULL, 0x2E359339, 0x3FA5EDA6, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chopper Attack (E) [t1]", { 0x0A, 0x39, 0x55, 0xC7, 0x04, 0x21, 0x02, 0x25, 0xD9, 0x59, 0x37, 0xDC, 0xAB, 0x86, 0xC9, 0xE3 }, NULL, NULL, 0xD852E238, 0x0E52A960, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chopper Attack (U) [!]", { 0xC3, 0x7E, 0x8A, 0xFB, 0x4F, 0x3E, 0xCC, 0x86, 0xD0, 0x1C, 0xE7, 0x38, 0x8C, 0xA5, 0x93, 0x47 }, NULL, NULL, 0x214CAD94, 0xBE1A3B24, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chopper Attack (U) [b1]", { 0x14, 0xAE, 0xB9, 0x27, 0xF3, 0x62, 0x0E, 0xFE, 0x48, 0xAF, 0x7F, 0xC7, 0x48, 0xC1, 0x93, 0x1F }, NULL, NULL, 0xACBF6069, 0xEABEE162, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chopper Attack (U) [b2]", { 0xB8, 0xBE, 0xA2, 0x19, 0x4D, 0x7D, 0x75, 0xA1, 0x71, 0x1C, 0x02, 0x4F, 0x50, 0x69, 0xD1, 0x8E }, NULL, NULL, 0x214CAD94, 0xBE1A3B24, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chopper Attack (U) [b3]", { 0x34, 0x95, 0x7B, 0x17, 0x3C, 0xD3, 0x3C, 0x99, 0x9B, 0x95, 0x4E, 0x70, 0x34, 0xFC, 0x01, 0xEA }, NULL, NULL, 0x214CAD94, 0xBE1A3B24, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chopper Attack (U) [b4]", { 0xB3, 0x4C, 0xBC, 0xA3, 0xEE, 0xE5, 0xC0, 0x10, 0xFF, 0x3E, 0x50, 0x4A, 0xF2, 0x06, 0x40, 0x69 }, NULL, NULL, 0xBF5D6D65, 0x3F4A9C03, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chopper Attack (U) [b5]", { 0x5F, 0xA3, 0x9E, 0xF0, 0xEB, 0xE1, 0x8D, 0xA5, 0x5C, 0x26, 0x0A, 0x3A, 0x89, 0xF9, 0x35, 0xB6 }, NULL, NULL, 0x214CAD94, 0xBE1A3B24, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chopper Attack (U) [b6]", { 0x64, 0xC7, 0x5E, 0x19, 0x89, 0x0A, 0xCD, 0xE2, 0x58, 0x42, 0xA8, 0x15, 0xA2, 0x1D, 0x55, 0xC9 }, NULL, NULL, 0x214CAD94, 0xBE1A3B24, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chopper Attack (U) [t1]", { 0xF1, 0x0D, 0x60, 0x1D, 0x64, 0x78, 0x6C, 0x52, 0xCA, 0xC1, 0xFD, 0x0A, 0xB5, 0x51, 0x1C, 0x82 }, NULL, NULL, 0xBF5D6D65, 0x3F4A9C03, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Choro Q 64 (J) [!]", { 0x82, 0x87, 0xA9, 0x08, 0xE3, 0x6E, 0x79, 0xB2, 0xD3, 0xAF, 0x0B, 0xD2, 0x2C, 0x43, 0xEC, 0xD9 }, NULL, NULL, 0x2BCCF9C4, 0x403D9F6F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Choro Q 64 (J) [b1]", { 0x2C, 0x94, 0x43, 0x19, 0x01, 0x7A, 0x21, 0x65, 0x25, 0x66, 0xCC, 0x41, 0x96, 0xC7, 0x14, 0xCC }, NULL, NULL, 0x2BCCF9C4, 0x403D9F6F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Choro Q 64 (J) [b2]", { 0x47, 0x0E, 0x16, 0x35, 0xA9, 0x69, 0x31, 0x02, 0xB4, 0x26, 0xA8, 0x40, 0xDB, 0xD6, 0x91, 0xE5 }, NULL, NULL, 0x2BCCF9C4, 0x403D9F6F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Choro Q 64 (J) [b3]", { 0x04, 0xA2, 0xC1, 0xA6, 0xEF, 0xAE, 0x28, 0xE0, 0x7A, 0x4A, 0xD7, 0x76, 0x03, 0x08, 0x1F, 0x86 }, NULL, NULL, 0x2BCCF9C4, 0x403D9F6F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Choro Q 64 (J) [b4]", { 0x5F, 0x4D, 0x85, 0x2B, 0xD3, 0xB7, 0x07, 0xC1, 0xB4, 0xFE, 0x29, 0xF2, 0xFE, 0x19, 0xC6, 0x87 }, NULL, NULL, 0x2BCCF9C4, 0x403D9F6F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Choro Q 64 (J) [h1C]", { 0x71, 0x51, 0xAE, 0x13, 0x0B, 0xA8, 0xDC, 0x97, 0xA2, 0x05, 0xB6, 0x2F, 0xF0, 0xEE, 0x0F, 0xB6 }, NULL, NULL, 0x2BCCF9C4, 0x403D9F6F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Choro Q 64 II - Hacha Mecha Grand Prix Race (J) [!]", { 0x90, 0x81, 0x37, 0x01, 0x41, 0x07, 0x90, 0x31, 0xEB, 0xBD, 0xBC, 0xA5, 0x6F, 0xC8, 0xC7, 0xD8 }, NULL, NULL, 0x26CD0F54, 0x53EBEFE0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x633 },
+    { "Chou Kuukan Night Pro Yakyuu King (J) [!]", { 0x78, 0x83, 0x8C, 0x20, 0x2C, 0x4F, 0xF5, 0xA4, 0x60, 0x58, 0x64, 0x51, 0xEE, 0x91, 0x82, 0xAA }, NULL, NULL, 0x8ACE6683, 0x3FBA426E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Chou Kuukan Night Pro Yakyuu King (J) [b1]", { 0x52, 0x24, 0xCC, 0xBE, 0x26, 0x0A, 0x4B, 0x77, 0x13, 0xD6, 0x62, 0xD9, 0xBC, 0x26, 0x90, 0x63 }, NULL, NULL, 0x8ACE6683, 0x3FBA426E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Chou Kuukan Night Pro Yakyuu King (J) [h1C]", { 0x9C, 0x39, 0x39, 0x1D, 0x10, 0x3E, 0x6D, 0xB3, 0x9C, 0xEC, 0x6C, 0x77, 0x4E, 0xDB, 0x08, 0x2A }, NULL, NULL, 0x8ACE6683, 0x3FBA426E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Chou Kuukan Night Pro Yakyuu King 2 (J) [!]", { 0x97, 0xEA, 0xB4, 0xDC, 0x83, 0xDA, 0x0A, 0xD2, 0x89, 0x0D, 0xE2, 0xAA, 0xAA, 0x5D, 0x10, 0x9A }, NULL, NULL, 0x3A180FF4, 0x5C8E8AF7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Chou Snobow Kids (J) [!]", { 0x94, 0x66, 0x61, 0x8F, 0x44, 0x97, 0xDA, 0x6C, 0x90, 0x91, 0xE0, 0x5C, 0xC9, 0x66, 0x67, 0x86 }, NULL, NULL, 0xA7941528, 0x61F1199D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Chou Snobow Kids (J) [f1] (PAL)", { 0x74, 0x34, 0x10, 0x14, 0x04, 0x3C, 0xC4, 0x2D, 0x88, 0x04, 0xDA, 0xDB, 0xF2, 0x52, 0xB3, 0x44 }, NULL, NULL, 0x2FEB152B, 0x9C205EA5, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Christmas Flame Demo by Halley's Comet Software (PD)", { 0xBA, 0x14, 0x5D, 0x51, 0xB6, 0x81, 0xEF, 0x44, 0x32, 0xDB, 0x59, 0xC1, 0xDA, 0x70, 0x30, 0x47 }, NULL, NULL, 0xB484EB31, 0xD44B1928, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "City-Tour GP - Zennihon GT Senshuken (J) [!]", { 0x2A, 0x0B, 0xF5, 0xA9, 0xA1, 0x36, 0xD5, 0x7A, 0xF0, 0x1D, 0x19, 0x9B, 0x16, 0x89, 0x96, 0x34 }, NULL, NULL, 0xF8009DB0, 0x6B291823, 0, SAVETYPE_EEPROM_16K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "City-Tour GP - Zennihon GT Senshuken (J) [b1]", { 0x48, 0x08, 0xE8, 0x12, 0x9B, 0x22, 0xAC, 0x8B, 0x31, 0x85, 0xB3, 0x72, 0x43, 0x11, 0x30, 0x05 }, NULL, NULL, 0xF8009DB0, 0x6B291823, 0, SAVETYPE_EEPROM_16K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "City-Tour GP - Zennihon GT Senshuken (J) [b2]", { 0x2B, 0xD6, 0x14, 0xA2, 0xA1, 0xA3, 0x17, 0xEC, 0xBE, 0xEB, 0x41, 0x93, 0x95, 0x4C, 0x5F, 0xA5 }, NULL, NULL, 0xF8009DB0, 0x6B291823, 0, SAVETYPE_EEPROM_16K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "City-Tour GP - Zennihon GT Senshuken (J) [b3]", { 0xE2, 0x26, 0x80, 0x1C, 0x0B, 0x57, 0xFD, 0x2F, 0x2D, 0x2E, 0x30, 0x39, 0x86, 0xDB, 0x5E, 0x5C }, NULL, NULL, 0xF8009DB0, 0x6B291823, 0, SAVETYPE_EEPROM_16K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Clay Fighter - Sculptor's Cut (U) [!]", { 0x30, 0xE7, 0xE0, 0x83, 0xB9, 0x78, 0x40, 0x8D, 0x5B, 0x77, 0x60, 0xD0, 0xCE, 0x4D, 0xC6, 0x1D }, NULL, NULL, 0xFA5A3DFF, 0xB4C9CDB9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Clay Fighter - Sculptor's Cut (U) [b1]", { 0x05, 0x2B, 0xB2, 0xC8, 0xC4, 0x17, 0x46, 0x33, 0xA0, 0xD3, 0x8D, 0xEB, 0x4D, 0x31, 0xC7, 0x19 }, NULL, NULL, 0xFA5A3DFF, 0xB4C9CDB9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Clay Fighter - Sculptor's Cut (U) [b2]", { 0xD4, 0x7A, 0xB8, 0xCA, 0x78, 0xD9, 0x68, 0x6A, 0x70, 0x21, 0xEB, 0xBB, 0xA0, 0x0B, 0x0A, 0xA0 }, NULL, NULL, 0xFA5A3DFF, 0xB4C9CDB9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Clay Fighter - Sculptor's Cut (U) [h1C]", { 0xB8, 0x04, 0x75, 0x51, 0xF6, 0xE4, 0x4E, 0x36, 0x78, 0x62, 0xE9, 0xBC, 0x9C, 0x2A, 0x4D, 0xDF }, NULL, NULL, 0xFA5A3DFF, 0xB4C9CDB9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Clay Fighter - Sculptor's Cut (U) [h2C]", { 0xCC, 0xD8, 0x69, 0xC8, 0xD4, 0x5C, 0x39, 0x98, 0xAD, 0xDC, 0xBF, 0x43, 0x79, 0x1D, 0x6C, 0x56 }, NULL, NULL, 0xFA5A3DFF, 0xB4C9CDB9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Clay Fighter - Sculptor's Cut (U) [t1]", { 0xCD, 0x00, 0xC3, 0x17, 0x00, 0x3B, 0x03, 0xCD, 0x0B, 0xBE, 0xEC, 0x45, 0x70, 0xD2, 0xB5, 0x5D }, NULL, NULL, 0x6C48FE11, 0x8E1A27EC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Clay Fighter 63 1-3 (Beta) [!]", { 0xCB, 0xBE, 0xAF, 0xF5, 0xA9, 0x07, 0x4D, 0x1A, 0x55, 0x07, 0xCF, 0x46, 0xCD, 0x68, 0x3D, 0x36 }, NULL, NULL, 0x2B6FA7C0, 0x09A71225, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Clay Fighter 63 1-3 (Beta) [b1]", { 0xBE, 0x41, 0xBA, 0x94, 0x87, 0x89, 0x99, 0x98, 0x7D, 0xC8, 0xD2, 0xFD, 0x3A, 0x55, 0x51, 0xD9 }, NULL, NULL, 0x2B6FA7C0, 0x09A71225, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Clay Fighter 63 1-3 (E) [!]", { 0x41, 0x96, 0x5B, 0x53, 0x3F, 0x3D, 0xD9, 0x56, 0x63, 0x36, 0x1D, 0x9D, 0xF6, 0x8B, 0x0C, 0x1F }, NULL, NULL, 0x8E9692B3, 0x4264BB2A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Clay Fighter 63 1-3 (E) [b1][h1C]", { 0x46, 0xB9, 0x5E, 0xA3, 0xEB, 0x82, 0x65, 0x44, 0x39, 0xA6, 0x75, 0x04, 0x43, 0xBC, 0xDE, 0x53 }, NULL, NULL, 0x8E9692B3, 0x4264BB2A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Clay Fighter 63 1-3 (E) [h1C]", { 0x20, 0x84, 0x97, 0x4C, 0x90, 0x98, 0xB2, 0xD0, 0x1C, 0x1F, 0x58, 0xB0, 0xE5, 0x6E, 0xE0, 0x58 }, NULL, NULL, 0x8E9692B3, 0x4264BB2A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Clay Fighter 63 1-3 (U) [!]", { 0x32, 0x07, 0xBF, 0x22, 0xE3, 0x05, 0xC4, 0x88, 0x10, 0x9B, 0x09, 0xA0, 0x37, 0x06, 0xF3, 0x6F }, NULL, NULL, 0xF03C24CA, 0xC5237BCC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Clay Fighter 63 1-3 (U) [b1]", { 0x7A, 0x4A, 0xCA, 0xB8, 0x99, 0x7D, 0x18, 0x0C, 0x04, 0x5D, 0x92, 0x86, 0xC9, 0x17, 0xED, 0x1B }, NULL, NULL, 0xF03C24CA, 0xC5237BCC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Clay Fighter 63 1-3 (U) [b2]", { 0x0E, 0xDB, 0xCB, 0x64, 0x15, 0x9B, 0x7E, 0x32, 0xDD, 0xA1, 0x65, 0xA7, 0xA3, 0x63, 0xAB, 0x35 }, NULL, NULL, 0xF03C24CA, 0xC5237BCC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Clay Fighter 63 1-3 (U) [o1]", { 0xD4, 0x1E, 0xE7, 0x55, 0xC8, 0xDD, 0xF4, 0xBB, 0xD5, 0xE3, 0x68, 0x67, 0x0C, 0x67, 0x24, 0x88 }, NULL, NULL, 0x2B6FA7C0, 0x09A71225, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Clay Fighter 63 1-3 (U) [o2]", { 0x67, 0x46, 0xF4, 0xCC, 0x43, 0xAC, 0xEB, 0xF3, 0xF0, 0x4B, 0x16, 0x77, 0xB1, 0x6C, 0x19, 0x35 }, NULL, NULL, 0xF03C24CA, 0xC5237BCC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Cliffi's Little Intro by Cliffi (POM '99) (PD) [b1]", { 0x0E, 0x38, 0x73, 0x2B, 0xC5, 0xF5, 0x64, 0xD7, 0x4D, 0x57, 0xEF, 0x0A, 0x0C, 0xBA, 0x8D, 0x56 }, NULL, NULL, 0x10637557, 0x03E93693, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Cliffi's Little Intro by Cliffi (POM '99) (PD)", { 0xBE, 0x2A, 0xB7, 0xCD, 0x9D, 0xBD, 0xDA, 0x8D, 0xDA, 0xE1, 0xEA, 0x28, 0x8C, 0x66, 0x3F, 0x15 }, NULL, NULL, 0x4B0313E2, 0x65657446, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Command & Conquer (E) (M2) [!]", { 0x42, 0xDA, 0x4C, 0x7D, 0x04, 0x0F, 0x9E, 0x7C, 0xD0, 0x46, 0xA4, 0x2E, 0xC3, 0xE6, 0x80, 0x27 }, NULL, NULL, 0xAE5B9465, 0xC54D6576, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Command & Conquer (E) (M2) [b1]", { 0x4D, 0x97, 0x2A, 0xE7, 0xFA, 0xA1, 0xAA, 0x3E, 0xD2, 0x60, 0x26, 0xF6, 0xF4, 0x6C, 0x8A, 0x6A }, NULL, NULL, 0xAE5B9465, 0xC54D6576, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Command & Conquer (E) (M2) [b2]", { 0xC0, 0xCC, 0x62, 0xAC, 0x4B, 0x06, 0x41, 0x6C, 0x9D, 0xB5, 0xB7, 0x65, 0xAD, 0xE5, 0xF6, 0x26 }, NULL, NULL, 0xAE5B9465, 0xC54D6576, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Command & Conquer (E) (M2) [b3]", { 0x1D, 0x26, 0xE8, 0xB6, 0x5C, 0xD2, 0xF1, 0xBF, 0x1E, 0xAB, 0xAF, 0xFD, 0xBB, 0xFC, 0x1F, 0x26 }, NULL, NULL, 0xAE5B9465, 0xC54D6576, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Command & Conquer (E) (M2) [f1] (Z64)", { 0xE1, 0x9F, 0x76, 0x21, 0x82, 0xF4, 0xB4, 0xAD, 0xF5, 0xD8, 0xF6, 0xD9, 0x98, 0x03, 0x30, 0x59 }, NULL, NULL, 0xEA630EC7, 0x2B2F37F3, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Command & Conquer (G) [!]", { 0x1A, 0x91, 0x95, 0x66, 0x2C, 0x89, 0xDC, 0xBE, 0xA8, 0x8B, 0xCF, 0xA9, 0x9B, 0x09, 0x6C, 0xDE }, NULL, NULL, 0xB5025BAD, 0xD32675FD, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Command & Conquer (G) [f1] (Z64)", { 0x19, 0xA6, 0x46, 0xE0, 0x14, 0x8E, 0xA6, 0x69, 0x5E, 0x79, 0x7C, 0x19, 0x90, 0x91, 0x9B, 0x8A }, NULL, NULL, 0x705AC38A, 0xA8D714E8, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Command & Conquer (U) [!]", { 0xB4, 0x36, 0xF4, 0x71, 0x7A, 0xC5, 0x85, 0xB0, 0xD8, 0x47, 0x75, 0x64, 0x68, 0xFD, 0x63, 0x93 }, NULL, NULL, 0x95286EB4, 0xB76AD58F, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Command & Conquer (U) [b1]", { 0x57, 0x04, 0x4E, 0x8F, 0x22, 0x3D, 0x11, 0x7F, 0x55, 0xB2, 0x2E, 0x7F, 0xD2, 0xED, 0xF7, 0x1E }, NULL, NULL, 0xF921961E, 0xE09D8B11, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Command & Conquer (U) [f1] (Z64)", { 0x71, 0x5D, 0x53, 0x7C, 0x6D, 0x78, 0x44, 0x0C, 0x08, 0x5D, 0xDD, 0x22, 0xE8, 0x27, 0xC2, 0x60 }, NULL, NULL, 0x22AD2E8E, 0x73CC712C, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Congratulations Demo for SPLiT by Widget and Immortal (PD) [b1]", { 0xB2, 0x06, 0xF9, 0x17, 0xC1, 0xB4, 0xFD, 0x41, 0xCD, 0xAD, 0xC4, 0x06, 0x4C, 0x48, 0xB0, 0x7B }, NULL, NULL, 0xD2B908C8, 0xE0E73A1D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Congratulations Demo for SPLiT by Widget and Immortal (PD)", { 0x26, 0x16, 0xB2, 0x90, 0x1F, 0x79, 0x4E, 0xAD, 0xFD, 0x26, 0xD5, 0xFA, 0x2B, 0xF5, 0x56, 0x4D }, NULL, NULL, 0xD2B908C8, 0xE0E73A1D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Conker's Bad Fur Day (E) [!]", { 0x05, 0x19, 0x4D, 0x49, 0xC1, 0x4E, 0x52, 0x05, 0x5D, 0xF7, 0x2A, 0x54, 0xD4, 0x07, 0x91, 0xE1 }, NULL, NULL, 0x373F5889, 0x9A6CA80A, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Conker's Bad Fur Day (U) (Debug Version) [f1] (Decrypted)", { 0x70, 0xE9, 0xEB, 0x9B, 0xF2, 0xF7, 0xBC, 0x76, 0xCA, 0x38, 0xCE, 0x45, 0x0B, 0xA0, 0x1C, 0x2E }, NULL, NULL, 0x8BC3A47A, 0x74221294, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Conker's Bad Fur Day (U) (Demo) (V_ECTS_Decrypted)", { 0x13, 0xEC, 0xBA, 0xEE, 0xF7, 0x11, 0x1D, 0x53, 0x43, 0xD7, 0x3A, 0x80, 0xE0, 0x3E, 0x35, 0x3A }, NULL, NULL, 0xA08D0F77, 0x6F82E38C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Conker's Bad Fur Day (U) [!]", { 0x00, 0xE2, 0x92, 0x06, 0x65, 0xF2, 0x32, 0x9B, 0x95, 0x79, 0x7A, 0x7E, 0xAA, 0xBC, 0x23, 0x90 }, NULL, NULL, 0x30C7AC50, 0x7704072D, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Conker's Bad Fur Day (U) [T+Fre1.3_Corrigo]", { 0x25, 0x65, 0x64, 0xDA, 0xF2, 0x93, 0x11, 0x49, 0x79, 0x17, 0xBA, 0xAA, 0x14, 0xED, 0x3F, 0x6D }, NULL, NULL, 0x30C7AC50, 0x7704072D, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Conker's Bad Fur Day (U) [T+Spa1.1_Blade133bo]", { 0x79, 0xA8, 0xA0, 0x07, 0x09, 0x2D, 0x1E, 0x5B, 0x00, 0xD0, 0xED, 0x94, 0xF8, 0x36, 0x20, 0xEB }, NULL, NULL, 0x34AEB154, 0xA4253B86, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n Exotica (U) [!]", { 0xDB, 0x7A, 0x03, 0xB7, 0x7D, 0x44, 0xDB, 0x81, 0xB8, 0xA3, 0xFC, 0xDF, 0xC4, 0xB7, 0x2D, 0x8C }, NULL, NULL, 0x46A3F7AF, 0x0F7591D0, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n Exotica (U) [t1]", { 0xA8, 0x26, 0x67, 0x78, 0x59, 0x19, 0x94, 0xEF, 0xA3, 0xA3, 0xB9, 0xE6, 0xE8, 0x06, 0xF8, 0xC8 }, NULL, NULL, 0x1E4C4743, 0xFEA2C4D1, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n USA (E) [!]", { 0x69, 0xCD, 0x5B, 0xA6, 0xBC, 0x93, 0x10, 0xB9, 0xE3, 0x7C, 0xCB, 0x1B, 0xC6, 0xBD, 0x16, 0xAD }, NULL, NULL, 0x503EA760, 0xE1300E96, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Cruis'n USA (U) (V1.0) [!]", { 0x00, 0xA3, 0xE8, 0x85, 0xF8, 0xD8, 0x99, 0x64, 0x62, 0x28, 0xA2, 0x1D, 0x94, 0x6B, 0x21, 0x02 }, NULL, NULL, 0xFF2F2FB4, 0xD161149A, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Cruis'n USA (U) (V1.0) [T+Ita0.40]", { 0x19, 0x09, 0x06, 0xA8, 0xA5, 0xF1, 0xC1, 0xD4, 0x90, 0x9F, 0x63, 0x74, 0xA7, 0x84, 0xEC, 0xA4 }, NULL, NULL, 0xFF2F2FB4, 0xD161149A, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Cruis'n USA (U) (V1.0) [b1]", { 0x63, 0x5C, 0x94, 0x43, 0x49, 0x22, 0xDC, 0x73, 0xC5, 0x89, 0x65, 0x00, 0x4E, 0x3F, 0x69, 0x9D }, NULL, NULL, 0xFF2F2FB4, 0xD161149A, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Cruis'n USA (U) (V1.0) [b2]", { 0xD3, 0x7A, 0xB1, 0x7D, 0x3E, 0x27, 0xED, 0x33, 0x37, 0x04, 0xC4, 0x4D, 0xCF, 0xAA, 0x28, 0xE7 }, NULL, NULL, 0xFF2F2FB4, 0xD161149A, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Cruis'n USA (U) (V1.0) [b3]", { 0x1D, 0x48, 0x43, 0xF0, 0xC6, 0x9E, 0x27, 0x3A, 0x10, 0x99, 0xA4, 0x26, 0x7B, 0xB9, 0xF5, 0x26 }, NULL, NULL, 0xFF2F2FB4, 0xD161149A, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Cruis'n USA (U) (V1.0) [b4]", { 0xB0, 0x67, 0x9C, 0x68, 0x5A, 0x1F, 0xB4, 0xD2, 0xBA, 0x96, 0xE4, 0xBB, 0x94, 0x12, 0x62, 0xDE }, NULL, NULL, 0xFF2F2FB4, 0xD161149A, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Cruis'n USA (U) (V1.0) [b5]", { 0xA8, 0xD5, 0xB5, 0xF1, 0x90, 0x2A, 0xFB, 0x13, 0x46, 0xD9, 0x7A, 0x9D, 0x0D, 0x52, 0xB2, 0x92 }, NULL, NULL, 0xFF2F2FB4, 0xD161149A, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Cruis'n USA (U) (V1.0) (VC) [!]", { 0x41, 0xCA, 0x21, 0xBD, 0x73, 0x7E, 0x16, 0xBA, 0x81, 0x16, 0x89, 0x82, 0xB7, 0x42, 0x76, 0xF1 }, NULL, NULL, 0xFF2F2FB4, 0xD161149A, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Cruis'n USA (U) (V1.1) [!]", { 0x45, 0xFC, 0x88, 0xE2, 0xBA, 0x67, 0x11, 0xF2, 0x5F, 0x0D, 0xE9, 0x88, 0xE7, 0x19, 0xDF, 0x29 }, NULL, NULL, 0x5306CF45, 0xCBC49250, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Cruis'n USA (U) (V1.2) [!]", { 0x28, 0x38, 0xA9, 0x01, 0x8A, 0xD2, 0xBC, 0xB8, 0xB7, 0xF6, 0x16, 0x1C, 0x74, 0x6A, 0x1B, 0x71 }, NULL, NULL, 0xB3402554, 0x7340C004, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Cruis'n World (E) [!]", { 0xAF, 0x95, 0x0A, 0x1B, 0x6C, 0x46, 0x0D, 0x7F, 0xC3, 0xE7, 0x83, 0x75, 0xD3, 0x50, 0x47, 0xEF }, NULL, NULL, 0x83F3931E, 0xCB72223D, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n World (E) (V1.1) [!]", { 0x20, 0xDB, 0x5E, 0x4D, 0xDB, 0x0C, 0xD5, 0xB0, 0x4C, 0x4B, 0xF0, 0x9C, 0xDC, 0x95, 0x59, 0x2F }, NULL, NULL, 0x33E61153, 0x97A2E2C5, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n World (E) [b1]", { 0x62, 0x64, 0x78, 0xCC, 0x07, 0x90, 0xB1, 0x45, 0x20, 0x45, 0xA3, 0xD8, 0x53, 0xB4, 0x6C, 0x18 }, NULL, NULL, 0x312E2FC5, 0xCB76AB4D, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n World (E) [b2]", { 0x94, 0x2A, 0x09, 0x96, 0x6E, 0xC7, 0x52, 0xA5, 0xEE, 0x81, 0xD0, 0x42, 0xAF, 0x11, 0xD4, 0xBB }, NULL, NULL, 0xAFF44E2D, 0x2ECB9679, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n World (E) [f1]", { 0xB2, 0x2A, 0x6E, 0x18, 0x4C, 0xB0, 0x65, 0x78, 0x82, 0xCB, 0x4D, 0x6A, 0x81, 0x53, 0x42, 0x54 }, NULL, NULL, 0xAFF44E2D, 0x2ECB9679, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n World (E) [f2]", { 0x0B, 0xD7, 0x14, 0x26, 0xA0, 0x24, 0x0C, 0xA4, 0xD8, 0x71, 0xA8, 0xF5, 0x4B, 0x77, 0x61, 0xF0 }, NULL, NULL, 0xAFF44E2D, 0x2ECB9679, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n World (E) [f3] (NTSC)", { 0x12, 0xCE, 0x26, 0x7F, 0x5D, 0x53, 0x8C, 0x29, 0x59, 0xBD, 0xEB, 0xA5, 0xE8, 0x7B, 0xDE, 0x79 }, NULL, NULL, 0xAF3E4E2D, 0x9C63E651, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n World (U) [!]", { 0xAA, 0xDA, 0x4C, 0xBD, 0x93, 0x8E, 0x58, 0xA4, 0x47, 0xB3, 0x99, 0xA1, 0xD4, 0x6F, 0x03, 0xE6 }, NULL, NULL, 0xDFE61153, 0xD76118E6, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n World (U) [b1]", { 0xB9, 0x7C, 0x96, 0x32, 0x35, 0x63, 0x56, 0x72, 0xCB, 0xEA, 0xB3, 0x51, 0x54, 0xDF, 0xDF, 0xA2 }, NULL, NULL, 0xE2A32049, 0x46E8F8E2, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n World (U) [b2]", { 0x82, 0xC6, 0x21, 0x3E, 0xF9, 0x21, 0xBF, 0x28, 0x05, 0xB3, 0xCA, 0x7C, 0xA4, 0xF0, 0x8B, 0xFB }, NULL, NULL, 0xE2A32049, 0x46E8F8E2, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n World (U) [b3]", { 0x63, 0xDA, 0x31, 0x50, 0xAC, 0x7B, 0x60, 0x31, 0x87, 0xDE, 0x39, 0x51, 0xA3, 0x27, 0x0F, 0x6E }, NULL, NULL, 0xDFE61153, 0xD76118E6, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n World (U) [f1]", { 0x4B, 0xCD, 0xE2, 0x37, 0xF4, 0xA3, 0x90, 0xA5, 0x64, 0x36, 0x96, 0x96, 0xD0, 0x57, 0x97, 0x60 }, NULL, NULL, 0xE2A32049, 0x46E8F8E2, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cruis'n World (U) [o1]", { 0xAD, 0x4A, 0x78, 0x10, 0x24, 0xE2, 0x9F, 0x4A, 0x73, 0x5C, 0xB4, 0xB8, 0x7F, 0x2D, 0x59, 0xDB }, NULL, NULL, 0xDFE61153, 0xD76118E6, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Cube Demo (PD)", { 0x8D, 0x4D, 0xAA, 0x86, 0xBF, 0x54, 0x2D, 0x8A, 0x55, 0x46, 0x0F, 0x56, 0xC5, 0x2F, 0x7D, 0x02 }, NULL, NULL, 0x0E3ED77B, 0x8E1C26FD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Cube Demo (PD) [b1]", { 0x6F, 0x93, 0x6E, 0xCE, 0x2B, 0xA8, 0xEA, 0x8C, 0x74, 0xBD, 0xBB, 0xA9, 0xBD, 0xA1, 0x40, 0x7A }, NULL, NULL, 0x0E3ED77B, 0x8E1C26FD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Cube Demo (PD) [b2]", { 0x9A, 0x30, 0x14, 0xED, 0x85, 0xF7, 0x96, 0xCC, 0xB8, 0x36, 0xE8, 0x5E, 0x78, 0xD2, 0x61, 0x8A }, NULL, NULL, 0x0E3ED77B, 0x8E1C26FD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Cube Demo by Msftug (PD)", { 0x82, 0x7C, 0xFF, 0xD3, 0x64, 0x81, 0x16, 0x51, 0x1E, 0xD2, 0xD5, 0xDA, 0x76, 0xC8, 0x3F, 0xBB }, NULL, NULL, 0x37BDF228, 0x92CF779C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Custom Robo (Ch) (iQue) [!]", { 0x33, 0xF2, 0xBC, 0x68, 0x47, 0x98, 0x5F, 0x96, 0xDE, 0x81, 0x77, 0x14, 0x7D, 0xCD, 0x3B, 0x85 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x11 },
+    { "Custom Robo (J) [!]", { 0xA0, 0x6D, 0x2E, 0x83, 0xCF, 0x26, 0x28, 0x91, 0x5E, 0x88, 0x47, 0xF6, 0x09, 0x47, 0x46, 0x61 }, NULL, NULL, 0x83CB0B87, 0x7E325457, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Custom Robo V2 (J) [!]", { 0x11, 0x51, 0x18, 0xDD, 0x5E, 0x0F, 0x02, 0xD8, 0x2B, 0xA1, 0xBF, 0x07, 0x0A, 0x7B, 0x78, 0xF1 }, NULL, NULL, 0x079501B9, 0xAB0232AB, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "CyberTiger (E) [!]", { 0x8C, 0x4A, 0x4C, 0xD4, 0x72, 0xD6, 0x10, 0xCD, 0xA5, 0x45, 0x9B, 0x3A, 0x92, 0xF2, 0x1D, 0x30 }, NULL, NULL, 0xD1A78A07, 0x52A3DD3E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "CyberTiger (U) [!]", { 0x88, 0x07, 0x2F, 0x30, 0xD4, 0xF9, 0xCF, 0x38, 0x4B, 0x2B, 0x3A, 0x03, 0x00, 0x64, 0x92, 0x18 }, NULL, NULL, 0xE8FC8EA1, 0x9F738391, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "DKONG Demo (PD)", { 0x98, 0x01, 0xAA, 0xA8, 0x7D, 0x65, 0x0C, 0x42, 0xB0, 0x21, 0xF9, 0x4D, 0x5C, 0x34, 0xC7, 0xA4 }, NULL, NULL, 0xB323E37C, 0xBBC35EC4, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "DS1 Manager V1.0 by R. Bubba Magillicutty (PD)", { 0xF0, 0xD6, 0x2C, 0x8F, 0xD7, 0x73, 0xF5, 0x5A, 0x34, 0xEA, 0xAC, 0x20, 0xD3, 0xB9, 0x5F, 0x17 }, NULL, NULL, 0x1194FFD2, 0x808C6FB1, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "DS1 Manager V1.1 by R. Bubba Magillicutty (PD)", { 0x4F, 0x94, 0xD9, 0x02, 0x94, 0xD6, 0xE5, 0xC1, 0xFC, 0x11, 0x6E, 0x07, 0x3D, 0xD3, 0xF5, 0x42 }, NULL, NULL, 0xD7484C2A, 0x56CFF26D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "DS1 SRAM Manager V1.1 by _Sage_ (PD)", { 0x52, 0x03, 0x7E, 0xD1, 0x17, 0xD0, 0x9F, 0x46, 0xF8, 0x2C, 0x3F, 0x72, 0x04, 0x43, 0x66, 0xE7 }, NULL, NULL, 0x201DA461, 0xEC0C992B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Dance Dance Revolution - Disney Dancing Museum (J) [!]", { 0x0B, 0x86, 0xFA, 0x92, 0x59, 0xE2, 0xB7, 0x51, 0x11, 0x1A, 0x17, 0x01, 0x09, 0x16, 0x44, 0xB1 }, NULL, NULL, 0x7188F445, 0x84410A68, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Dance Dance Revolution - Disney Dancing Museum (J) [o1]", { 0x3A, 0x14, 0x88, 0xC2, 0xA8, 0xA8, 0xF2, 0xAB, 0x93, 0x68, 0xD7, 0xC0, 0x56, 0xEB, 0x02, 0xA2 }, NULL, NULL, 0x7188F445, 0x84410A68, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Dance Dance Revolution - Disney Dancing Museum (J) [o2]", { 0x88, 0x5A, 0x29, 0xB9, 0xA5, 0x21, 0x83, 0xB9, 0x6E, 0x5D, 0x63, 0x6F, 0x2B, 0x76, 0x52, 0x31 }, NULL, NULL, 0x7188F445, 0x84410A68, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Dark Rift (E) [!]", { 0x42, 0x42, 0xFD, 0xE5, 0xB7, 0x4F, 0x22, 0xAA, 0xF5, 0x74, 0x64, 0x59, 0xE1, 0x26, 0x12, 0x1F }, NULL, NULL, 0x7ED67CD4, 0xB4415E6D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Dark Rift (E) [b1]", { 0x0D, 0xD2, 0x88, 0x7A, 0xF6, 0x4C, 0x57, 0x86, 0xC1, 0xC6, 0x68, 0x77, 0xAF, 0xCC, 0x0B, 0x97 }, NULL, NULL, 0x7ED67CD4, 0xB4415E6D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Dark Rift (U) [!]", { 0xEC, 0xB1, 0x70, 0xEB, 0xBF, 0xDA, 0x0E, 0x93, 0x2C, 0x07, 0x52, 0x40, 0x40, 0xBC, 0xC3, 0x6C }, NULL, NULL, 0xA4A52B58, 0x23759841, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Dark Rift (U) [t1]", { 0xCB, 0xFE, 0xAD, 0x02, 0xC5, 0x08, 0xDA, 0xDF, 0xB4, 0x4A, 0x00, 0xE7, 0xF7, 0xED, 0x61, 0xB8 }, NULL, NULL, 0xDAA66890, 0xED4CCD04, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Deadly Arts (U) [!]", { 0xA2, 0xA4, 0xA0, 0x31, 0x8D, 0xAB, 0x36, 0x6A, 0x59, 0x53, 0x36, 0xB6, 0xF8, 0x0F, 0xF3, 0xAB }, NULL, NULL, 0xF5363349, 0xDBF9D21B, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Deadly Arts (U) [b1]", { 0xF4, 0x03, 0xFC, 0xEB, 0x3F, 0xCD, 0x41, 0xBB, 0x58, 0x30, 0x14, 0x29, 0x89, 0xFC, 0x94, 0x86 }, NULL, NULL, 0xF5363349, 0xDBF9D21B, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Defi au Tetris Magique (F) [!]", { 0xC6, 0x44, 0xE3, 0x18, 0xB3, 0x3C, 0x4E, 0xBD, 0x94, 0x69, 0x5C, 0x0C, 0x3E, 0x1E, 0x80, 0xFF }, NULL, NULL, 0x3F66A9D9, 0x9BCB5B00, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Densha de Go! 64 (J) [!]", { 0x77, 0x2F, 0xA1, 0x66, 0xE5, 0xDB, 0x51, 0xEF, 0xFC, 0x77, 0xFB, 0x8D, 0x83, 0x2A, 0xC4, 0xD2 }, NULL, NULL, 0x17C54A61, 0x4A83F2E7, 0, SAVETYPE_EEPROM_16K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Densha de Go! 64 (J) [f1] (PAL)", { 0xBA, 0x99, 0xC4, 0x45, 0xAD, 0xC6, 0x99, 0x4C, 0x97, 0xFE, 0x64, 0x63, 0xF3, 0xE0, 0xEC, 0x10 }, NULL, NULL, 0xCF138879, 0x2A6144CB, 0, SAVETYPE_EEPROM_16K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Densha de Go! 64 (J) (Localization Patch v1.01)", { 0xFD, 0xFF, 0xA6, 0x62, 0xAE, 0x33, 0x57, 0xBF, 0x59, 0x70, 0x33, 0x8E, 0xE7, 0x58, 0x9F, 0x6C }, NULL, NULL, 0x68D128AE, 0x67D60F21, 0, SAVETYPE_EEPROM_16K, 1, 1, 1, 0, 1, 1, 0, 0x900, 100, 0x27B },
+    { "Derby Stallion 64 (J) (Beta)", { 0x10, 0x51, 0xE1, 0x40, 0x2E, 0xE1, 0x10, 0xF3, 0xC5, 0xE3, 0x72, 0xC9, 0xE1, 0xC5, 0xB3, 0x38 }, NULL, NULL, 0x96BA4EFB, 0xC9988E4E, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Derby Stallion 64 (J) [!]", { 0x7F, 0x57, 0x46, 0x38, 0x56, 0x54, 0x01, 0x04, 0xB2, 0x1A, 0x52, 0x89, 0x31, 0x2B, 0x62, 0x6F }, NULL, NULL, 0xA5F667E1, 0xDA1FBD1F, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Destruction Derby 64 (E) (M3) [!]", { 0xBD, 0xA7, 0x17, 0xEC, 0xC8, 0x43, 0x4F, 0x12, 0xF3, 0x13, 0x34, 0x24, 0x85, 0x82, 0x8B, 0x58 }, NULL, NULL, 0x630AA37D, 0x896BD7DB, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Destruction Derby 64 (U) [!]", { 0x7F, 0xCC, 0xB4, 0x74, 0x98, 0xEE, 0xC0, 0x6E, 0x96, 0xAE, 0x93, 0x72, 0x24, 0x7D, 0x1E, 0x90 }, NULL, NULL, 0xDEE584A2, 0x0F161187, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Destruction Derby 64 (U) [f1] (PAL)", { 0x02, 0xEE, 0xF6, 0xED, 0x11, 0x17, 0x46, 0x64, 0xA5, 0x48, 0x62, 0x63, 0x37, 0x87, 0x9E, 0x8C }, NULL, NULL, 0x8637C692, 0xCAD23999, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Destruction Derby 64 (U) [t1]", { 0x82, 0x5E, 0xA8, 0x02, 0xBC, 0x3C, 0xBA, 0x52, 0x36, 0x67, 0xB6, 0x4D, 0xD6, 0x96, 0xC5, 0x97 }, NULL, NULL, 0x8637BEAA, 0x9B0EB296, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Dexanoid R1 by Protest Design (PD)", { 0x6D, 0x75, 0x71, 0x9B, 0xFA, 0x62, 0x44, 0xC4, 0x59, 0x10, 0x70, 0xD3, 0xF7, 0x35, 0x60, 0x72 }, NULL, NULL, 0x76712159, 0x35666812, 3, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Dexanoid R1 by Protest Design (PD) [b1]", { 0x87, 0x5F, 0xA7, 0x77, 0x26, 0xE7, 0xCD, 0x99, 0xBD, 0x41, 0x0E, 0x3F, 0xC8, 0x6C, 0x77, 0x77 }, NULL, NULL, 0x1EDA4DE0, 0x22BF698D, 3, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Dexanoid R1 by Protest Design (PD) [f1] (PAL)", { 0xCF, 0x22, 0x76, 0xAF, 0xD8, 0x4E, 0x06, 0xAC, 0x78, 0x0D, 0xBA, 0x2E, 0x0E, 0xA4, 0x80, 0x6D }, NULL, NULL, 0xCFEAACE9, 0x1D532607, 3, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Dexanoid R1 by Protest Design (PD) [f2] (PAL)", { 0xAE, 0x13, 0xE5, 0x75, 0x38, 0x67, 0x75, 0xE7, 0x66, 0xF0, 0xE0, 0x0A, 0xD2, 0xA4, 0x0C, 0x9E }, NULL, NULL, 0x3C7AEE05, 0x56099CB6, 3, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Dexanoid R1 by Protest Design (PD) [t1]", { 0x8E, 0x4D, 0x5C, 0x6D, 0x95, 0xEF, 0xD1, 0xC9, 0x4B, 0xB1, 0x36, 0x44, 0xF7, 0x67, 0x29, 0x09 }, NULL, NULL, 0x0EC580B5, 0xEBEE9C03, 3, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Dezaemon 3D (J) [!]", { 0x54, 0xBE, 0x26, 0x5E, 0x7B, 0x2C, 0x28, 0xAB, 0x92, 0xBF, 0x1A, 0x41, 0x30, 0xAC, 0xB5, 0xA2 }, NULL, NULL, 0x8979169C, 0xF189F6A0, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Dezaemon 3D (J) [b1]", { 0x01, 0xE3, 0x4C, 0xD8, 0xA4, 0x51, 0xF0, 0xB5, 0xAE, 0xF9, 0x3C, 0xCF, 0x9A, 0xDB, 0x37, 0xAF }, NULL, NULL, 0x8979169C, 0xF189F6A0, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Dezaemon 3D (J) [b1][t1]", { 0x60, 0xA5, 0xF3, 0xE1, 0xE9, 0x4F, 0x69, 0x6B, 0xF5, 0x38, 0x40, 0x22, 0x24, 0x7B, 0x40, 0x59 }, NULL, NULL, 0x33487563, 0xAC0AE62A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Dezaemon 3D (J) [b2]", { 0x35, 0x89, 0x41, 0xCA, 0x39, 0x3F, 0x6D, 0x74, 0x15, 0xE9, 0x9B, 0x28, 0xD4, 0x9C, 0xCF, 0x68 }, NULL, NULL, 0x8979169C, 0xF189F6A0, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Dezaemon 3D (J) [t1]", { 0x10, 0x8B, 0x1A, 0x72, 0xE6, 0xF9, 0x3E, 0x69, 0x35, 0xE1, 0xAD, 0x8D, 0x61, 0x97, 0x97, 0xDB }, NULL, NULL, 0x33487563, 0xAC0AE62A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Die Hard 64 (U) (Prototype) (Level 1)", { 0x82, 0x09, 0x29, 0xEB, 0xBE, 0x6F, 0xD3, 0x32, 0xAC, 0x17, 0x20, 0xF9, 0x4B, 0x74, 0x5A, 0x8B }, NULL, NULL, 0x870611BA, 0xD8B1226C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Die Hard 64 (U) (Prototype) (Level 2)", { 0x3D, 0x1E, 0x03, 0xB0, 0x97, 0xF2, 0x12, 0x4F, 0x8F, 0x71, 0x30, 0x13, 0xD8, 0x21, 0x92, 0x91 }, NULL, NULL, 0x08D49262, 0x03763D39, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Die Hard 64 (U) (Prototype) (Level 3)", { 0x1B, 0x28, 0xC4, 0xCA, 0x21, 0x64, 0x8D, 0x31, 0x8B, 0xC6, 0xDD, 0x3E, 0xF2, 0x7B, 0xB1, 0xFA }, NULL, NULL, 0xA1F51C25, 0x16D61291, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Diddy Kong Racing (E) (M3) (V1.0) [!]", { 0x0F, 0x0B, 0x7B, 0x78, 0xB3, 0x45, 0xFB, 0xF2, 0x58, 0x1D, 0x83, 0x4C, 0xB4, 0xA8, 0x12, 0x45 }, NULL, NULL, 0xFD73F775, 0x9724755A, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (E) (M3) (V1.0) [f1]", { 0x79, 0x74, 0x8E, 0x4E, 0x03, 0x0B, 0x04, 0x7D, 0xBA, 0xE8, 0x25, 0x2C, 0x21, 0x30, 0x5C, 0x75 }, NULL, NULL, 0x85443325, 0x77D72F56, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (E) (M3) (V1.0) [o1]", { 0x54, 0x2F, 0xED, 0x78, 0x64, 0x21, 0x81, 0x56, 0xEA, 0x90, 0x05, 0x00, 0x13, 0xCD, 0x04, 0x8E }, NULL, NULL, 0xFD73F775, 0x9724755A, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (E) (M3) (V1.1) [!]", { 0x6B, 0x2B, 0xAF, 0xE5, 0x40, 0xE0, 0xAF, 0x05, 0x2A, 0x78, 0xE8, 0x5B, 0x99, 0x2B, 0xE9, 0x99 }, NULL, NULL, 0x596E145B, 0xF7D9879F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (E) (M3) (V1.1) [T+Ita1.0_Rulesless]", { 0x14, 0xAB, 0xD7, 0xC0, 0xFA, 0x3B, 0x52, 0x56, 0xFC, 0x62, 0x82, 0x40, 0x39, 0xF0, 0x6A, 0x20 }, NULL, NULL, 0x568E02F5, 0xE212A80C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (E) (M3) (V1.1) [f1] (Z64)", { 0x35, 0xCF, 0x26, 0xD4, 0xD3, 0x37, 0x17, 0xBA, 0x73, 0x0D, 0x79, 0x78, 0xE2, 0xF2, 0x10, 0x7D }, NULL, NULL, 0xD84C17CA, 0x13F8F651, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (J) [!]", { 0x10, 0x74, 0x76, 0x62, 0xA5, 0x52, 0x41, 0xB9, 0x23, 0x4C, 0xD1, 0x14, 0xC9, 0x40, 0x50, 0x4F }, NULL, NULL, 0x7435C9BB, 0x39763CF4, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (J) [f1] (Z64)", { 0x0D, 0x68, 0xA4, 0x05, 0xBC, 0xB0, 0x43, 0x18, 0xA2, 0x94, 0xDB, 0xEA, 0xBF, 0x1D, 0xE0, 0x63 }, NULL, NULL, 0xF389A35A, 0x17785562, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [!]", { 0x4F, 0x0E, 0x07, 0xF0, 0xEE, 0xAC, 0x7E, 0x5D, 0x7C, 0xE3, 0xA7, 0x54, 0x61, 0x88, 0x8D, 0x03 }, NULL, NULL, 0x53D440E7, 0x7519B011, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [T+Bra_EmuBrazil]", { 0x94, 0xD8, 0x1D, 0x14, 0xA2, 0xD7, 0x68, 0xDD, 0x0E, 0xDA, 0x3A, 0x84, 0x5A, 0xFB, 0x25, 0xCD }, NULL, NULL, 0x53D440E7, 0x7519B011, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [b1]", { 0x49, 0x55, 0x1E, 0x72, 0x9A, 0x39, 0xF9, 0x64, 0x00, 0x58, 0xAB, 0x57, 0x71, 0xA4, 0x93, 0x11 }, NULL, NULL, 0xD5295672, 0x9CB57015, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [b2]", { 0xDB, 0xE3, 0xF0, 0x86, 0x9F, 0x81, 0x7D, 0xCD, 0x52, 0xA5, 0xCB, 0x9D, 0x43, 0xBB, 0x4F, 0xD1 }, NULL, NULL, 0xD5295672, 0x9CB57015, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [b3]", { 0xAB, 0x34, 0xFE, 0xCD, 0x9A, 0x7A, 0x10, 0x30, 0xEC, 0x08, 0x92, 0x32, 0x8F, 0x9C, 0xEF, 0x8A }, NULL, NULL, 0xD5295672, 0x9CB57015, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [b4]", { 0x69, 0x9A, 0x6B, 0xA5, 0x28, 0x1E, 0xA0, 0xC8, 0x31, 0x90, 0xE9, 0xD4, 0x5C, 0x70, 0x8C, 0x26 }, NULL, NULL, 0xD5295672, 0x9CB57015, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [b5]", { 0xF3, 0x88, 0xEE, 0x41, 0x48, 0xA7, 0xA4, 0xA2, 0xC8, 0xA8, 0x15, 0x82, 0x3D, 0x23, 0x14, 0x9C }, NULL, NULL, 0xD5295672, 0x9CB57015, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [b6]", { 0xC9, 0x80, 0xD2, 0xC0, 0x7B, 0x98, 0x45, 0x21, 0x10, 0xA3, 0xA8, 0xE5, 0x2D, 0xB5, 0xDA, 0x88 }, NULL, NULL, 0xD5295672, 0x9CB57015, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [b7]", { 0x07, 0x70, 0x3E, 0x5A, 0x62, 0x68, 0xEE, 0xDF, 0x55, 0x2F, 0xE7, 0x70, 0xF2, 0x42, 0x73, 0xA7 }, NULL, NULL, 0xD5295672, 0x9CB57015, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [f1]", { 0xA3, 0x55, 0x15, 0x78, 0xB7, 0x29, 0x8A, 0x2E, 0x47, 0x19, 0xA9, 0x10, 0x8E, 0x0A, 0xA3, 0x7B }, NULL, NULL, 0xD5295672, 0x9CB57015, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [f1][h1C]", { 0x12, 0x36, 0xFB, 0x3F, 0xC8, 0x46, 0x4B, 0x55, 0x9B, 0xDE, 0xDF, 0xA9, 0x66, 0xD6, 0x67, 0x9F }, NULL, NULL, 0xD5295672, 0x9CB57015, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [f2]", { 0xA1, 0xD4, 0x7D, 0xB4, 0xC6, 0xB9, 0x3C, 0x78, 0xFE, 0x55, 0xCB, 0xFC, 0x1B, 0xB2, 0x8D, 0x28 }, NULL, NULL, 0xD5295672, 0x9CB57015, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [f3]", { 0xB4, 0xE6, 0x58, 0xDF, 0xF0, 0x37, 0x70, 0x6F, 0xFB, 0x2E, 0xB6, 0x4F, 0x1D, 0xFD, 0xBB, 0x3F }, NULL, NULL, 0xE9C8E262, 0xA1D5FACA, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [f4]", { 0xFA, 0x94, 0x64, 0x5F, 0x1A, 0x15, 0xAB, 0xA4, 0x40, 0xAD, 0x01, 0x36, 0xED, 0x92, 0xE9, 0xD1 }, NULL, NULL, 0x2954A98F, 0xC2236510, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [o1]", { 0x51, 0x18, 0x33, 0xA4, 0x6B, 0xE4, 0xE0, 0x0D, 0x1B, 0x36, 0x55, 0xC8, 0x8E, 0x27, 0x84, 0x22 }, NULL, NULL, 0x53D440E7, 0x7519B011, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [o1][f1]", { 0xDF, 0x4F, 0xC3, 0xC4, 0x63, 0x07, 0x52, 0x77, 0x07, 0xF9, 0x10, 0x6E, 0x75, 0x07, 0x48, 0x29 }, NULL, NULL, 0xD5295672, 0x9CB57015, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.0) [o2]", { 0x42, 0x2F, 0xD8, 0x83, 0x3F, 0x86, 0x5C, 0x4A, 0x6C, 0x17, 0xFC, 0xAC, 0x44, 0x50, 0xA6, 0x9E }, NULL, NULL, 0x53D440E7, 0x7519B011, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing (U) (M2) (V1.1) [!]", { 0xB3, 0x1F, 0x8C, 0xCA, 0x50, 0xF3, 0x1A, 0xCC, 0x9B, 0x99, 0x9E, 0xD5, 0xB7, 0x79, 0xD6, 0xED }, NULL, NULL, 0xE402430D, 0xD2FCFC9D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Diddy Kong Racing SRAM by Group5 (PD)", { 0xFB, 0xCC, 0xFE, 0xD5, 0x1A, 0x43, 0xB0, 0x01, 0x2C, 0xE9, 0x27, 0xCC, 0x73, 0xD6, 0xAA, 0xDA }, NULL, NULL, 0x9F35059D, 0x48B7F411, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Dinosaur Planet (Dec 2000 Beta)", { 0xC4, 0xC1, 0xB5, 0x2F, 0x9C, 0x44, 0x69, 0xC6, 0xC7, 0x47, 0x94, 0x28, 0x91, 0xDE, 0x3C, 0xFD }, NULL, NULL, 0x906C3F77, 0xCE495EA1, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Disney's Donald Duck - Goin' Quackers (U) [!]", { 0x0E, 0x0E, 0x92, 0x0A, 0xB1, 0x3E, 0xF1, 0x35, 0x08, 0xF5, 0xA9, 0x8C, 0xC4, 0xCD, 0x2F, 0xF8 }, NULL, NULL, 0xC16C421B, 0xA21580F7, 0, SAVETYPE_NONE, 1, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Disney's Tarzan (E) [!]", { 0xBD, 0x1D, 0xE2, 0xFC, 0x1C, 0xF3, 0x10, 0x96, 0x42, 0x35, 0x63, 0xA4, 0x0E, 0xCB, 0xF9, 0x33 }, NULL, NULL, 0xD614E5BF, 0xA76DBCC1, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Disney's Tarzan (E) [h1C]", { 0xAF, 0x74, 0x0B, 0x22, 0x4E, 0x5D, 0xD0, 0xBD, 0x09, 0xF7, 0x25, 0x48, 0x11, 0x55, 0x9A, 0xDF }, NULL, NULL, 0xD614E5BF, 0xA76DBCC1, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Disney's Tarzan (F) [!]", { 0x5D, 0x82, 0xE9, 0x03, 0xF6, 0x53, 0x41, 0x48, 0x7D, 0xDC, 0x11, 0xAF, 0x80, 0xAD, 0x60, 0x7A }, NULL, NULL, 0x001A3BD0, 0xAFB3DE1A, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Disney's Tarzan (G) [!]", { 0xDF, 0x3C, 0xDD, 0x95, 0x9E, 0x8C, 0x63, 0xB4, 0x5F, 0x55, 0x7F, 0xC1, 0x97, 0xCE, 0x0E, 0x63 }, NULL, NULL, 0x4C261323, 0x4F295E1A, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Disney's Tarzan (G) [h1C]", { 0xA2, 0x9E, 0x20, 0x3D, 0xDB, 0x62, 0x93, 0xB7, 0xD1, 0x05, 0xBF, 0x4A, 0x2E, 0xEE, 0xDD, 0x1E }, NULL, NULL, 0x4C261323, 0x4F295E1A, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Disney's Tarzan (U) [!]", { 0xEA, 0xE7, 0xE0, 0xEE, 0x53, 0x28, 0xED, 0x9F, 0x13, 0xB9, 0xCF, 0x99, 0x90, 0x18, 0x99, 0x28 }, NULL, NULL, 0xCBFE69C7, 0xF2C0AB2A, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Disney's Tarzan (U) [f1] (PAL)", { 0xC5, 0x6A, 0xD8, 0xAB, 0xD0, 0xFB, 0x5E, 0xFE, 0xF1, 0xFA, 0x02, 0x29, 0xF9, 0xA2, 0xEF, 0xF0 }, NULL, NULL, 0x988C4CC3, 0xC9F310C5, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Disney's Tarzan (U) [f2] (PAL)", { 0xCC, 0x8B, 0x0A, 0x9F, 0x15, 0xB9, 0x2D, 0x68, 0x96, 0x36, 0x68, 0xA3, 0x49, 0x5A, 0x6B, 0xF6 }, NULL, NULL, 0x8BDDD635, 0xEC0E9198, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Disney's Tarzan (U) [t1]", { 0xE9, 0xC2, 0xB2, 0x0E, 0xA2, 0x7E, 0x6C, 0xAB, 0x89, 0x84, 0x2A, 0xF4, 0xD7, 0x68, 0x72, 0x4E }, NULL, NULL, 0x8BEE2831, 0xD09BC906, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Display List Ate My Mind Demo by Kid Stardust (PD)", { 0x38, 0xDC, 0xF6, 0x7C, 0xBA, 0x39, 0xA8, 0x41, 0x08, 0xAD, 0xF4, 0x8E, 0xE5, 0x35, 0x44, 0xB0 }, NULL, NULL, 0x887C368D, 0xD1663AA2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.01", { 0xA9, 0x2F, 0x9F, 0xCD, 0x93, 0xD2, 0x07, 0x78, 0xED, 0x8F, 0xF1, 0x55, 0x46, 0xBB, 0x30, 0xF5 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.02", { 0x35, 0x09, 0xA4, 0xE2, 0x1E, 0x43, 0xCE, 0xDB, 0xD7, 0x04, 0xF8, 0xA1, 0x19, 0x2C, 0x31, 0xDF }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.03", { 0xA7, 0xBD, 0x2F, 0x54, 0xD9, 0x64, 0x6D, 0x43, 0xA2, 0xA4, 0xAD, 0x38, 0x84, 0x50, 0x22, 0x3B }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.04", { 0x30, 0xE2, 0x57, 0x93, 0xAC, 0xC9, 0x55, 0x29, 0xF8, 0xC6, 0x9A, 0x55, 0xC6, 0x67, 0x9E, 0x73 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.05", { 0x9B, 0x69, 0xD3, 0x03, 0xAF, 0xFA, 0x2C, 0xD9, 0xAB, 0xA9, 0x6C, 0x21, 0xA2, 0xC2, 0x14, 0x76 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.08", { 0xAD, 0xE8, 0x8A, 0x15, 0x44, 0xD4, 0x69, 0xD7, 0x7D, 0x45, 0x68, 0x36, 0x4E, 0xF2, 0x53, 0x19 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.09", { 0x1C, 0x0F, 0xCF, 0xC7, 0xB3, 0x04, 0x69, 0x8F, 0x77, 0x06, 0x9A, 0x5F, 0x31, 0xD2, 0x7D, 0xE1 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.10", { 0xA1, 0x33, 0xF0, 0x8F, 0x88, 0xF6, 0xD4, 0x9E, 0x1D, 0x23, 0xD0, 0x51, 0x52, 0x4A, 0xD0, 0x94 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.10r (RBubba Hack)", { 0x60, 0x1E, 0x53, 0x35, 0xE4, 0x3F, 0x83, 0x67, 0x6F, 0x9F, 0x34, 0x1B, 0x57, 0xD0, 0x36, 0x11 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.11", { 0x4A, 0xFA, 0x73, 0xE3, 0x10, 0x31, 0xC0, 0xF5, 0x82, 0xC1, 0x1C, 0xDA, 0x47, 0xCC, 0x87, 0x29 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.21", { 0xAA, 0xC7, 0xB0, 0x40, 0x83, 0xFB, 0x1B, 0x9A, 0xC5, 0xB4, 0x78, 0xAD, 0x89, 0xD8, 0xD3, 0xBA }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.22", { 0x4E, 0xAE, 0x45, 0x34, 0x03, 0x00, 0x29, 0x30, 0x65, 0xCE, 0xF5, 0xB5, 0x98, 0xC0, 0xAC, 0x6E }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.30", { 0xED, 0x9D, 0x2C, 0x04, 0xA7, 0xA0, 0x93, 0x43, 0x72, 0x21, 0x6E, 0xD8, 0x32, 0x1E, 0xA6, 0xE3 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.31 (Blue)", { 0x04, 0x18, 0x13, 0x68, 0x43, 0x40, 0xCE, 0x4D, 0x98, 0x8B, 0x2E, 0xBA, 0x34, 0x1C, 0xE5, 0xC5 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.31", { 0x2D, 0xF9, 0x42, 0x63, 0x6F, 0xB2, 0xBF, 0x92, 0x48, 0x44, 0xA8, 0xF4, 0x12, 0x99, 0x13, 0xBE }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.32", { 0xB9, 0x78, 0xDD, 0x8B, 0xA5, 0xF4, 0xDA, 0xC6, 0x85, 0x0B, 0x7D, 0x12, 0x97, 0xEB, 0x1F, 0x11 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.33", { 0xF0, 0x15, 0xAE, 0x0F, 0x3A, 0xD8, 0x09, 0x75, 0xFB, 0x21, 0xB4, 0x3E, 0xF7, 0xF1, 0x44, 0x22 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.33b", { 0xF9, 0xD9, 0x66, 0x6D, 0xE2, 0xF9, 0x46, 0xC9, 0xA7, 0xD6, 0x17, 0x3D, 0xFA, 0xDF, 0x9A, 0x81 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.40", { 0xE6, 0x0C, 0xE3, 0xD4, 0x35, 0x40, 0x66, 0xCF, 0xD8, 0x01, 0x29, 0xCB, 0x6C, 0x24, 0x66, 0xD5 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.40b", { 0xD6, 0x25, 0x66, 0xC4, 0xA4, 0x73, 0x96, 0xBF, 0xC9, 0x71, 0x73, 0xD8, 0xCF, 0x46, 0x8A, 0x5D }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.41", { 0x22, 0x13, 0x4E, 0x81, 0x10, 0x0D, 0x28, 0x54, 0x32, 0x3B, 0x06, 0x4E, 0xDD, 0x98, 0xAA, 0xC4 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.41b", { 0x25, 0xD9, 0xCD, 0xCD, 0x8C, 0x23, 0xAF, 0x65, 0x59, 0x22, 0x8C, 0x44, 0x35, 0xFF, 0x0C, 0xB3 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.50", { 0x69, 0xA7, 0xD3, 0xA2, 0xF2, 0x80, 0x5B, 0xC2, 0xFC, 0x84, 0xDB, 0x91, 0x7F, 0x8A, 0xF5, 0x92 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.51", { 0x95, 0x16, 0x79, 0x46, 0x50, 0xA5, 0x6E, 0x60, 0x35, 0x31, 0x35, 0xBB, 0x9A, 0x63, 0xC8, 0x72 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.52 (CH2 Hack)", { 0xFC, 0xB5, 0x47, 0x2F, 0x92, 0x9C, 0x8D, 0xA0, 0xDA, 0xED, 0x4C, 0x09, 0x84, 0xF8, 0x05, 0x3B }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.52", { 0x27, 0x36, 0x9B, 0xF6, 0x65, 0xAD, 0x2F, 0xE9, 0xF2, 0x3C, 0x6C, 0x6D, 0x20, 0x2A, 0xA5, 0xE8 }, NULL, NULL, 0x204F4E4C, 0x59000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.53", { 0x94, 0x1B, 0xA2, 0x9D, 0x29, 0x45, 0xFA, 0x5C, 0x90, 0x3F, 0xB0, 0xFC, 0x64, 0x91, 0xAC, 0x62 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.60", { 0xE7, 0xC2, 0x94, 0x47, 0x74, 0xE1, 0x61, 0x0E, 0xE6, 0xDF, 0x73, 0x58, 0x71, 0x7B, 0x5D, 0xA3 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.61", { 0xB8, 0x5F, 0xCE, 0xC6, 0x0C, 0x7B, 0xEA, 0x91, 0x06, 0xBD, 0x9B, 0x9C, 0x14, 0x47, 0x9E, 0xE7 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.70", { 0xD4, 0xBC, 0x7E, 0x32, 0x27, 0x22, 0x5E, 0x30, 0x3A, 0x7F, 0x64, 0x91, 0xC1, 0xDB, 0xB4, 0xCB }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.71", { 0xBC, 0xAC, 0x01, 0x08, 0xF0, 0xD5, 0x21, 0xFF, 0x54, 0x78, 0xBA, 0x6C, 0x50, 0xB2, 0x37, 0x74 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.72", { 0xD2, 0xDA, 0x27, 0x87, 0x2F, 0x13, 0xC0, 0xBB, 0xB2, 0xD6, 0x86, 0xC4, 0x95, 0xF1, 0x34, 0x99 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.73", { 0x13, 0xCD, 0x4C, 0x03, 0xFC, 0xA1, 0xBC, 0x23, 0xAE, 0x8B, 0x57, 0x88, 0x5E, 0x76, 0xBC, 0xA6 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.74 (Revive Version)", { 0xA2, 0x60, 0x4C, 0xB5, 0x59, 0xD2, 0x89, 0x83, 0x7F, 0x71, 0x8D, 0xB0, 0x2A, 0xFE, 0xA8, 0x5E }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.74", { 0x8B, 0x95, 0xAB, 0xB5, 0xF6, 0xE7, 0x14, 0x54, 0xFE, 0x2C, 0x41, 0x5A, 0x07, 0x87, 0xA3, 0x84 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.75", { 0x83, 0xB1, 0x22, 0xB1, 0x8B, 0x98, 0xB9, 0x6A, 0x63, 0xC6, 0xF8, 0x24, 0x83, 0x31, 0x16, 0xBC }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.76", { 0xB4, 0x44, 0xCC, 0x20, 0xAE, 0xFA, 0xD0, 0xDE, 0x4A, 0x55, 0x2D, 0x8D, 0xD0, 0x48, 0x6E, 0x82 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.80", { 0xB5, 0xD9, 0x2F, 0xF0, 0x99, 0xB3, 0xB7, 0x4C, 0x6D, 0x0F, 0x0D, 0x75, 0x59, 0x0E, 0xAC, 0x36 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.81", { 0x8C, 0xD8, 0xFD, 0xF7, 0x4A, 0x47, 0xCA, 0x16, 0x3C, 0xD2, 0x3A, 0xE1, 0xD0, 0x1B, 0x7E, 0x95 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.82", { 0xAA, 0xD6, 0x80, 0x7D, 0x24, 0x0F, 0xC3, 0xFF, 0x4F, 0xED, 0xAB, 0x57, 0x13, 0x5A, 0xD4, 0x58 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.83", { 0x41, 0x21, 0xDD, 0x79, 0xCE, 0xBF, 0x67, 0xEB, 0xCA, 0x1A, 0xA2, 0xB3, 0xA7, 0xAE, 0xD8, 0x58 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.90", { 0xD3, 0xEA, 0x65, 0x4D, 0x46, 0x79, 0xE0, 0xBF, 0x40, 0xBB, 0x67, 0x1C, 0xA7, 0xD4, 0xA7, 0xA3 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.91", { 0xCF, 0x8B, 0x2C, 0x13, 0x4C, 0x3F, 0xCD, 0x5A, 0x5D, 0x74, 0x40, 0x2D, 0x75, 0xCA, 0x05, 0x43 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.92", { 0x0F, 0x83, 0x62, 0x64, 0x97, 0xB7, 0xAC, 0xC4, 0xAA, 0xB3, 0xEB, 0x39, 0xCD, 0xE8, 0x93, 0xD3 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.93", { 0x6B, 0x62, 0x6C, 0x55, 0xC9, 0x9C, 0xD1, 0x2E, 0x88, 0xA3, 0xDB, 0x3B, 0x52, 0x37, 0x21, 0x04 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V1.94", { 0x48, 0x3B, 0xD8, 0x72, 0x37, 0xBB, 0x38, 0x88, 0x4E, 0x7E, 0x22, 0xF4, 0x98, 0x1A, 0xCF, 0xDB }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V2.00", { 0x55, 0x3F, 0x6E, 0x67, 0x66, 0xB8, 0x5C, 0xB0, 0x24, 0x7E, 0x5C, 0xA6, 0x2F, 0x51, 0x5C, 0x75 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V2.00b", { 0xA8, 0x97, 0x61, 0x01, 0x8F, 0xA9, 0x8E, 0x5C, 0x91, 0x9F, 0x4C, 0xA0, 0xBB, 0x3E, 0x60, 0x01 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V2.01 (Red)", { 0xAE, 0x36, 0xDD, 0x0B, 0xCC, 0x2F, 0x51, 0x59, 0x17, 0xB0, 0xCF, 0x52, 0xAE, 0xE4, 0x8A, 0xC1 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V2.01", { 0x0C, 0x91, 0xC4, 0x61, 0xED, 0x69, 0xEC, 0x1E, 0x93, 0xE9, 0xE0, 0xDE, 0xF9, 0x05, 0x35, 0x46 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V2.01b", { 0xBA, 0x28, 0x16, 0xF0, 0xB7, 0x75, 0x09, 0x9E, 0x42, 0xF1, 0x24, 0xE5, 0xC4, 0x3F, 0xE3, 0x0C }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V2.02", { 0xDD, 0xD1, 0x95, 0x8D, 0xF0, 0x33, 0x0B, 0x79, 0x28, 0x8B, 0x51, 0xE6, 0x5E, 0x1E, 0x36, 0xA0 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V2.02b", { 0x5A, 0xAA, 0x98, 0xD1, 0xFD, 0xF9, 0x63, 0xFB, 0x88, 0xB3, 0xD2, 0x54, 0x76, 0x92, 0x4A, 0x04 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V2.03 (Black)", { 0x03, 0x0E, 0xAB, 0x31, 0x6D, 0xC3, 0xA2, 0xD3, 0x3A, 0xAC, 0x3D, 0xE1, 0x5F, 0xDC, 0x44, 0x73 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V2.03 (Blue)", { 0x2F, 0x4E, 0x88, 0xC4, 0x88, 0x23, 0x71, 0x48, 0x25, 0xF3, 0x51, 0x48, 0xF5, 0xB5, 0x73, 0x8D }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V2.03 (Green)", { 0x7F, 0x34, 0xEB, 0x3E, 0x13, 0x63, 0x58, 0x0F, 0xEA, 0x95, 0xB2, 0x3A, 0x9C, 0xB1, 0xC3, 0xAF }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V2.03 (Purple)", { 0xA5, 0x50, 0xDE, 0xBD, 0xF7, 0x2B, 0x75, 0x3B, 0x52, 0x88, 0x2A, 0x1A, 0x57, 0x35, 0x60, 0xB5 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V2.03 (Red)", { 0x01, 0x4A, 0x2B, 0x82, 0xFD, 0xF9, 0xA7, 0x2F, 0xC5, 0xA2, 0x6A, 0x7E, 0xAF, 0x8F, 0x81, 0x76 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Doctor V64 BIOS V2.03", { 0x41, 0x01, 0x0B, 0x4B, 0xFE, 0x1F, 0x8D, 0xB8, 0x01, 0x23, 0x7B, 0x02, 0xA9, 0xFA, 0x26, 0x5F }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Donald Duck - Quack Attack (E) (M5) [!]", { 0xE8, 0xB4, 0x03, 0xA0, 0xF0, 0xE2, 0x12, 0xFA, 0x5C, 0x12, 0x20, 0xAF, 0x10, 0xD9, 0xC3, 0x79 }, NULL, NULL, 0x3DF17480, 0x193DED5A, 0, SAVETYPE_NONE, 1, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Donald Duck - Quack Attack (E) (M5) [b1]", { 0x07, 0xC4, 0x94, 0x4D, 0xDA, 0xAD, 0x23, 0x4F, 0x1F, 0x6B, 0x0B, 0x20, 0x0B, 0xEA, 0x60, 0xB2 }, NULL, NULL, 0x85E42D70, 0x132BD5C2, 0, SAVETYPE_NONE, 1, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Donald Duck - Quack Attack (E) (M5) [f1] (NTSC)", { 0x3B, 0xAF, 0xF0, 0x4C, 0x5D, 0xD3, 0x67, 0xF3, 0x62, 0x24, 0x8D, 0xC6, 0x27, 0xD8, 0x48, 0xC1 }, NULL, NULL, 0x8A5B9018, 0x0A661D8F, 0, SAVETYPE_NONE, 1, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Donchan Puzzle Hanabi de Doon! (Aleck64)", { 0x31, 0x41, 0xA1, 0xEE, 0x8D, 0xCD, 0xE0, 0xF7, 0x72, 0xE9, 0x15, 0xE6, 0x29, 0x82, 0x3F, 0x13 }, NULL, NULL, 0xD52FE29D, 0x8EA6A759, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xB },
+    { "Animal Crossing (Ch) (iQue) [!]", { 0xAF, 0x83, 0xE0, 0xCF, 0x36, 0x29, 0x8E, 0x62, 0xE9, 0xEB, 0x2E, 0xB8, 0xC8, 0x9A, 0xA7, 0x10 }, NULL, NULL, 0x916EB31B, 0xF47097A5, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Donkey Kong 64 (E) (M4) [!]", { 0x11, 0x8E, 0x9C, 0xE3, 0x60, 0xB9, 0x7A, 0x6F, 0x8D, 0xAB, 0x2C, 0x9F, 0x30, 0x66, 0x0B, 0xF5 }, NULL, NULL, 0x11936D8C, 0x6F2C4B43, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Donkey Kong 64 (E) (M4) [b1]", { 0x42, 0x80, 0x67, 0xDC, 0x7D, 0xB4, 0x2D, 0xFC, 0x97, 0x7A, 0x77, 0x5F, 0x0A, 0x6E, 0x55, 0xB1 }, NULL, NULL, 0x11936D8C, 0x6F2C4B43, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Donkey Kong 64 (E) (M4) [f1] (Boot&Save)", { 0xC4, 0x8C, 0x46, 0x36, 0x26, 0x02, 0x76, 0x6E, 0xA7, 0x58, 0xFA, 0xAE, 0xED, 0x88, 0xAF, 0x50 }, NULL, NULL, 0x1F95CAAA, 0x047FC22A, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Donkey Kong 64 (E) (M4) [f1] (Save)", { 0x7B, 0xE2, 0xAA, 0xB2, 0x59, 0xC4, 0x37, 0xE8, 0xBA, 0x91, 0xFF, 0x8E, 0x59, 0x03, 0x83, 0x7C }, NULL, NULL, 0x1F95CAAA, 0x047FC22A, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Donkey Kong 64 (J) [!]", { 0x5B, 0x67, 0x7F, 0x4B, 0xF9, 0x3D, 0x65, 0x78, 0x25, 0x2F, 0xCA, 0xD2, 0xC8, 0xCE, 0xB6, 0x37 }, NULL, NULL, 0x053C89A7, 0xA5064302, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Donkey Kong 64 (U) (Kiosk Demo) [!]", { 0x98, 0xA5, 0x83, 0x6E, 0x3A, 0x5D, 0xA7, 0xBD, 0x0B, 0x58, 0x19, 0xE7, 0x49, 0x8A, 0xCE, 0xA2 }, NULL, NULL, 0x0DD4ABAB, 0xB5A2A91E, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x6B },
+    { "Donkey Kong 64 (U) (Kiosk Demo) [b1]", { 0x84, 0x3D, 0xB0, 0x32, 0x83, 0x9B, 0xF1, 0xAA, 0x74, 0x75, 0x9F, 0x2E, 0x39, 0xA2, 0xAB, 0xDC }, NULL, NULL, 0xF5C21403, 0x8FCA0710, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x6B },
+    { "Donkey Kong 64 (U) (Kiosk Demo) [b2]", { 0x34, 0xE6, 0xB3, 0x52, 0x60, 0xF0, 0x3C, 0xA7, 0x25, 0x93, 0xFA, 0x37, 0x3E, 0x38, 0xBB, 0xEA }, NULL, NULL, 0x0DD4ABAB, 0xB5A2A91E, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x6B },
+    { "Donkey Kong 64 (U) (Kiosk Demo) [f1] (PAL)", { 0x3F, 0x1A, 0x1B, 0x94, 0x1E, 0x58, 0xFF, 0x97, 0x7E, 0xF4, 0x7B, 0x65, 0xCE, 0x35, 0x9A, 0x26 }, NULL, NULL, 0xF5C21403, 0x8FCA0710, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x6B },
+    { "Donkey Kong 64 (U) [!]", { 0x9E, 0xC4, 0x1A, 0xBF, 0x25, 0x19, 0xFC, 0x38, 0x6C, 0xAD, 0xD0, 0x73, 0x1F, 0x6E, 0x86, 0x8C }, NULL, NULL, 0xEC58EABF, 0xAD7C7169, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Donkey Kong 64 (U) [b1]", { 0x6B, 0x47, 0x72, 0xAA, 0x17, 0x43, 0xFE, 0xAC, 0x19, 0x19, 0x61, 0x8B, 0x3F, 0xC6, 0xB3, 0xE1 }, NULL, NULL, 0xEC58EABF, 0xAD7C7169, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Donkey Kong 64 (U) [f1] (Save)", { 0x4D, 0x44, 0x83, 0xC0, 0xCA, 0x3B, 0x86, 0x99, 0x7E, 0x41, 0xA7, 0x03, 0x2F, 0x6A, 0xD2, 0x5F }, NULL, NULL, 0xCE84793D, 0x27ECC1AD, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Donkey Kong 64 (U) [f2]", { 0xCE, 0xD7, 0x10, 0x61, 0xB6, 0xA8, 0x58, 0x1D, 0xC0, 0xB9, 0x59, 0x70, 0xD5, 0x22, 0x84, 0x8A }, NULL, NULL, 0xCE84793D, 0x27ECC1AD, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Donkey Kong 64 (U) [f3]", { 0xE5, 0x6E, 0xF2, 0x44, 0xD6, 0x1B, 0x15, 0xDB, 0xAE, 0xF4, 0x74, 0xF9, 0xC0, 0xC0, 0xB2, 0x3A }, NULL, NULL, 0xCED986FD, 0x3344AC38, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Donkey Kong 64 - Tag Anywhere (V5) (U)", { 0x11, 0xDA, 0x2A, 0x2D, 0x0E, 0x91, 0x07, 0x4B, 0xB8, 0xFF, 0x1F, 0xCB, 0x02, 0x95, 0x35, 0xFD }, NULL, NULL, 0x31739C69, 0xA99E3CB2, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Doom 64 (E) [!]", { 0x19, 0x0C, 0xCC, 0xA6, 0x52, 0x6D, 0xC4, 0xA1, 0xF6, 0x11, 0xE3, 0xB4, 0x0F, 0x51, 0x31, 0xC0 }, NULL, NULL, 0x2C739EAC, 0x9EF77726, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doom 64 (E) [b1]", { 0xB4, 0x82, 0xF5, 0x1B, 0x61, 0x6F, 0x43, 0x37, 0xF1, 0xB3, 0xBF, 0x5E, 0xFD, 0xD6, 0x50, 0xD4 }, NULL, NULL, 0x2C739EAC, 0x9EF77726, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doom 64 (J) [!]", { 0x06, 0xF1, 0x5E, 0xF2, 0x22, 0x8C, 0x1B, 0x11, 0x47, 0xC4, 0x1D, 0xCC, 0xAA, 0x07, 0xD9, 0xDE }, NULL, NULL, 0x7AA65B36, 0xFDCEE5AD, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doom 64 (J) [b1]", { 0x05, 0x3B, 0xB6, 0xD2, 0xE1, 0x4D, 0x67, 0xF0, 0xFB, 0x0B, 0x50, 0x9F, 0x2A, 0x6B, 0x44, 0x85 }, NULL, NULL, 0x7AA65B36, 0xFDCEE5AD, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doom 64 (U) (V1.0) [!]", { 0xB6, 0x77, 0x48, 0xB6, 0x4A, 0x2C, 0xC7, 0xEF, 0xD2, 0xF3, 0xAD, 0x45, 0x04, 0x56, 0x1E, 0x0E }, NULL, NULL, 0xA83E101A, 0xE937B69D, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doom 64 (U) (V1.0) [T+Bra1.0_Doom64BR]", { 0xBF, 0x71, 0x0F, 0x7D, 0x1D, 0x51, 0xEC, 0x89, 0xAC, 0x3F, 0x58, 0x02, 0x2B, 0x2B, 0x5D, 0x7F }, NULL, NULL, 0xB01A1DAB, 0x7F7827E3, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doom 64 (U) (V1.0) [b1]", { 0x6E, 0xAC, 0xFE, 0x4F, 0x39, 0x26, 0x5F, 0x24, 0xFB, 0x81, 0x45, 0xFD, 0xED, 0x82, 0x72, 0xF6 }, NULL, NULL, 0xA83E101A, 0xE937B69D, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doom 64 (U) (V1.0) [b2]", { 0x81, 0xFD, 0x53, 0x2B, 0x1C, 0x7C, 0x2C, 0xCD, 0x68, 0x7E, 0x56, 0x69, 0x6E, 0x07, 0x3C, 0x83 }, NULL, NULL, 0xA83E101A, 0xE937B69D, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doom 64 (U) (V1.0) [o1]", { 0x74, 0x97, 0xAD, 0xAD, 0xAD, 0xA8, 0x92, 0x30, 0x82, 0x7C, 0x06, 0xE4, 0xBF, 0xFB, 0xBB, 0xD8 }, NULL, NULL, 0xA83E101A, 0xE937B69D, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doom 64 (U) (V1.0) [t1]", { 0x4D, 0xC8, 0x85, 0x15, 0x0D, 0xFE, 0xC6, 0x7A, 0xCD, 0xD8, 0x07, 0xF9, 0xFF, 0xE9, 0x59, 0x6E }, NULL, NULL, 0x13D0EE29, 0xD57A41AD, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doom 64 (U) (V1.0) [t2]", { 0x29, 0xE8, 0x5B, 0x9D, 0x90, 0x72, 0xAC, 0x23, 0x2C, 0xEB, 0x87, 0xEF, 0xE8, 0x26, 0x26, 0x9A }, NULL, NULL, 0x13D0EE29, 0xD57A41AD, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doom 64: Complete Edition (Doom 64 Hack)", { 0xFE, 0x63, 0xF9, 0x70, 0xBB, 0x7F, 0x1D, 0x67, 0x98, 0x87, 0x8D, 0x58, 0x35, 0xE1, 0x02, 0x6C }, NULL, NULL, 0x5318786C, 0x994249C6, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doom 64 (U) (V1.1) [!]", { 0x1B, 0x13, 0x78, 0xBB, 0x9E, 0xE8, 0x19, 0xF7, 0x40, 0x55, 0x0F, 0x56, 0x67, 0x45, 0xAF, 0x73 }, NULL, NULL, 0x423E96F4, 0xCE88F05B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doraemon - Nobita to 3tsu no Seireiseki (J) [!]", { 0xC2, 0x16, 0x64, 0x55, 0xE9, 0x4E, 0x89, 0xE9, 0xE3, 0xAB, 0x61, 0x2B, 0x43, 0x77, 0xC4, 0x43 }, NULL, NULL, 0xBFF7B1C2, 0xAEBF148E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Doraemon - Nobita to 3tsu no Seireiseki (J) [b1]", { 0x98, 0x9E, 0x7B, 0x15, 0xD2, 0x46, 0x49, 0xB7, 0x84, 0x81, 0x3E, 0x1A, 0x07, 0xDF, 0x68, 0x87 }, NULL, NULL, 0xBFF7B1C2, 0xAEBF148E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Doraemon - Nobita to 3tsu no Seireiseki (J) [b2]", { 0x7E, 0x0D, 0xA0, 0x17, 0x55, 0x11, 0x01, 0xDA, 0x1C, 0x4F, 0xB6, 0xA0, 0xC4, 0x9A, 0x23, 0x28 }, NULL, NULL, 0xBFF7B1C2, 0xAEBF148E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Doraemon - Nobita to 3tsu no Seireiseki (J) [b3]", { 0xBE, 0x00, 0x00, 0xD3, 0x41, 0x57, 0x87, 0xF9, 0x92, 0x0E, 0x17, 0x89, 0x42, 0xC2, 0x97, 0xC5 }, NULL, NULL, 0xBFF7B1C2, 0xAEBF148E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Doraemon - Nobita to 3tsu no Seireiseki (J) [t1]", { 0xC2, 0x90, 0x9D, 0x57, 0x99, 0x09, 0x98, 0x19, 0xE9, 0xA7, 0xEC, 0xE3, 0xCD, 0x47, 0x37, 0xFC }, NULL, NULL, 0x55C0515C, 0x901DA4A7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Doraemon 2 - Nobita to Hikari no Shinden (J) [!]", { 0x05, 0x80, 0xD9, 0x6A, 0x71, 0x67, 0x1C, 0x9E, 0x69, 0x72, 0xFD, 0xCF, 0x58, 0x97, 0xCC, 0x26 }, NULL, NULL, 0xB6306E99, 0xB63ED2B2, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Doraemon 2 - Nobita to Hikari no Shinden (J) [b1]", { 0x7C, 0xC1, 0x6A, 0x60, 0x90, 0xCA, 0xC3, 0x74, 0x9D, 0xD6, 0xB7, 0x1C, 0xA7, 0xA5, 0x86, 0x05 }, NULL, NULL, 0xB6306E99, 0xB63ED2B2, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Doraemon 2 - Nobita to Hikari no Shinden (J) [b2]", { 0x5A, 0x28, 0x00, 0x8B, 0x05, 0x92, 0x30, 0x16, 0xEA, 0x41, 0x1B, 0xAC, 0xE0, 0x6E, 0xF3, 0x2A }, NULL, NULL, 0x4E30BD3A, 0xB77D6DFB, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Doraemon 2 - Nobita to Hikari no Shinden (J) [f1] (PAL)", { 0x7E, 0x4B, 0xCA, 0x92, 0xDA, 0x50, 0x14, 0x5C, 0x99, 0x06, 0xB2, 0xA7, 0x2F, 0x93, 0x51, 0xB5 }, NULL, NULL, 0x4E30BD3A, 0xB77D6DFB, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Doraemon 2 - Nobita to Hikari no Shinden (J) [f2]", { 0x58, 0xAD, 0xC1, 0x79, 0x03, 0x75, 0x4F, 0xEB, 0xF7, 0x7D, 0xC9, 0xCD, 0x3D, 0xB8, 0xB7, 0xD8 }, NULL, NULL, 0x4E30BD3A, 0xB77D6DFB, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Doraemon 2 - Nobita to Hikari no Shinden (J) [t1]", { 0xBE, 0xFA, 0x31, 0x99, 0x19, 0x47, 0x4B, 0xAE, 0x05, 0xDF, 0xCB, 0x57, 0x0C, 0xC0, 0xCF, 0x31 }, NULL, NULL, 0x4ECEB1DE, 0x552B6E88, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Doraemon 3 - Nobita no Machi SOS! (J) [!]", { 0xA4, 0xA1, 0xD4, 0x90, 0xBA, 0x67, 0x83, 0x17, 0x75, 0xFC, 0x38, 0x1B, 0x84, 0x6E, 0x21, 0x68 }, NULL, NULL, 0xA8275140, 0xB9B056E8, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Doraemon 3 - Nobita no Machi SOS! (J) [f1] (PAL-NTSC)", { 0xFB, 0x75, 0x65, 0xFE, 0x1E, 0xAA, 0xED, 0x1C, 0xAC, 0xFA, 0xE3, 0xB0, 0x11, 0xFA, 0x6C, 0xB6 }, NULL, NULL, 0xD8059804, 0x92739B11, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Doubutsu no Mori (J) [!]", { 0xA4, 0xF7, 0xC5, 0x7C, 0x18, 0x02, 0x97, 0xB2, 0xE7, 0xBA, 0x5A, 0x5F, 0xEB, 0x44, 0xFE, 0x0B }, NULL, NULL, 0xBD8E206D, 0x98C35E1C, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doubutsu no Mori (J) [T+Eng2007-08-10_Brandon Dixon]", { 0x4A, 0xB8, 0xD6, 0x53, 0x50, 0x28, 0x80, 0x5F, 0x57, 0x94, 0xD3, 0xF0, 0x10, 0x03, 0xCF, 0xD5 }, NULL, NULL, 0xBD8E206D, 0x98C35E1C, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doubutsu no Mori (J) [T+Eng2010-12-02_Zoinkity]", { 0x01, 0xBD, 0xCC, 0x85, 0x4D, 0x0A, 0xB7, 0x98, 0x50, 0x0E, 0x7B, 0xC3, 0x1A, 0x24, 0xD9, 0x4F }, NULL, NULL, 0x0290AEB9, 0x67A3B6C1, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doubutsu no Mori (J) [T+Eng90%]", { 0x7D, 0xDB, 0xCA, 0x3F, 0x64, 0x2C, 0xB4, 0xCA, 0xA7, 0x80, 0xE8, 0x17, 0x33, 0xC9, 0x40, 0x37 }, NULL, NULL, 0x8F0CC36D, 0xC738259E, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doubutsu no Mori (J) [T-Eng2007-02-08_Brandon Dixon]", { 0x7C, 0x58, 0xDB, 0x7E, 0xE1, 0x70, 0x91, 0x2A, 0x2D, 0xF8, 0x4E, 0x67, 0xA4, 0x89, 0x05, 0x8A }, NULL, NULL, 0xBD8E206D, 0x98C35E1C, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doubutsu no Mori (J) [T-Eng2007-02-09_Brandon Dixon]", { 0x5E, 0x2A, 0x5C, 0x56, 0xCA, 0x1A, 0x0C, 0xCA, 0xEA, 0x3A, 0xE5, 0xF8, 0x52, 0xE0, 0xC5, 0x8D }, NULL, NULL, 0xBD8E206D, 0x98C35E1C, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Doubutsu no Mori (J) [T-Eng2007-03-22_Brandon Dixon]", { 0x0A, 0xA8, 0xE4, 0xB9, 0x6E, 0xBB, 0x5B, 0x8A, 0x5C, 0xF9, 0x1C, 0xFB, 0x04, 0xBC, 0x37, 0x41 }, NULL, NULL, 0xBD8E206D, 0x98C35E1C, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Dr. Mario 64 (Ch) (iQue) [!]", { 0xDD, 0x29, 0x1B, 0x9C, 0x65, 0x42, 0x0F, 0xD8, 0x92, 0x10, 0x7F, 0x6C, 0x66, 0x5B, 0x7A, 0x45 }, NULL, NULL, 0xEF62A343, 0x11E41E37, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Dr. Mario 64 (Ch) (V2) (iQue) (Manual) [!]", { 0xFE, 0x49, 0x42, 0x07, 0x25, 0xF9, 0xC1, 0xCF, 0x0F, 0x15, 0xBA, 0x56, 0x82, 0xD2, 0x77, 0x09 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Dr. Mario 64 (Ch) (V4) (iQue) (Manual) [!]", { 0xB5, 0x24, 0xD1, 0x0A, 0x8A, 0x26, 0x76, 0x4E, 0xB2, 0x19, 0x8A, 0xCE, 0xC3, 0xF0, 0x99, 0x48 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Dr. Mario 64 (U) [!]", { 0x1A, 0x79, 0x36, 0x36, 0x74, 0x13, 0xE5, 0xD6, 0x87, 0x4A, 0xBD, 0xA6, 0xD6, 0x23, 0xAD, 0x32 }, NULL, NULL, 0x769D4D13, 0xDA233FFE, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Dr. Mario 64 (U) [T+Jap1.0_Zoinkity]", { 0x36, 0xB3, 0xD9, 0x08, 0xFB, 0x50, 0xE5, 0x52, 0x1D, 0xEF, 0xBE, 0xB2, 0xC3, 0x9F, 0x47, 0xB0 }, NULL, NULL, 0xB74388D7, 0x7DBD6DFB, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Dragon King by CrowTRobo (PD) [b1]", { 0x0A, 0xD0, 0x80, 0x0D, 0x35, 0x1F, 0x77, 0xEC, 0x31, 0x09, 0x20, 0x96, 0xD5, 0x8C, 0x25, 0xF0 }, NULL, NULL, 0x19E0E54C, 0xCB721FD2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Dragon King by CrowTRobo (PD)", { 0x94, 0x4E, 0xCE, 0xD5, 0x0E, 0x57, 0xD4, 0x67, 0x79, 0x57, 0x6F, 0x73, 0x2C, 0xB2, 0x7D, 0xC0 }, NULL, NULL, 0x19E0E54C, 0xCB721FD2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Dragon Sword 64 (E) (Prototype)", { 0x77, 0x0D, 0x0D, 0x2B, 0xB0, 0x82, 0x35, 0x61, 0x35, 0x69, 0x66, 0x7A, 0x28, 0x4B, 0xCA, 0x2C }, NULL, NULL, 0x40DFEDA0, 0x3AA09CB2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Dragon Sword 64 (U) (Prototype) (1999-08-25)", { 0x64, 0x01, 0x1D, 0xD5, 0x6F, 0xF8, 0x4C, 0xF9, 0xEB, 0x46, 0x15, 0x3E, 0x7A, 0xEC, 0xCD, 0x26 }, NULL, NULL, 0xAE6B1E11, 0xB7CBD69E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Dual Heroes (E) [!]", { 0xF1, 0x20, 0xFA, 0xDB, 0x52, 0xB4, 0x14, 0xEB, 0x4F, 0xB7, 0xD1, 0x30, 0x92, 0xAC, 0x3C, 0xDB }, NULL, NULL, 0xB6524461, 0xED6D04B1, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Dual Heroes (E) [b1]", { 0xB0, 0x1D, 0x03, 0x1B, 0xE1, 0x78, 0x95, 0x65, 0xE2, 0xB8, 0xA4, 0x4C, 0xD7, 0x6B, 0x96, 0xC6 }, NULL, NULL, 0xB6524461, 0xED6D04B1, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Dual Heroes (E) [b2]", { 0xDF, 0xEB, 0xF3, 0xA9, 0x57, 0x0B, 0x95, 0xD9, 0x5C, 0xA6, 0xBE, 0x2C, 0xE8, 0x31, 0x1D, 0x1D }, NULL, NULL, 0xB6524461, 0xED6D04B1, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Dual Heroes (E) [f1] (NTSC)", { 0xB4, 0x06, 0xAD, 0x16, 0x94, 0xD6, 0x57, 0x25, 0xFD, 0x31, 0xA0, 0x54, 0xF6, 0xEC, 0xE2, 0x13 }, NULL, NULL, 0x926C2E3B, 0x9829A216, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Dual Heroes (J) [!]", { 0xE7, 0x65, 0x2E, 0xD5, 0xCE, 0xCE, 0xB5, 0xB1, 0xBC, 0x14, 0x49, 0x5C, 0x58, 0x54, 0x6D, 0x1C }, NULL, NULL, 0x056EAB63, 0xC215FCD5, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Dual Heroes (J) [o1]", { 0xA7, 0xD3, 0xE4, 0x2E, 0xFF, 0xD6, 0xE7, 0x93, 0x5D, 0xA7, 0xC9, 0xA6, 0xB6, 0x89, 0x9C, 0xAC }, NULL, NULL, 0x056EAB63, 0xC215FCD5, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Dual Heroes (J) [o2]", { 0x54, 0xC6, 0x10, 0x27, 0x0D, 0x3F, 0x5E, 0xEA, 0x39, 0xBC, 0x6A, 0x8F, 0x73, 0xB3, 0xB9, 0x09 }, NULL, NULL, 0x056EAB63, 0xC215FCD5, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Dual Heroes (U) [!]", { 0x92, 0x3D, 0x65, 0xE6, 0x9F, 0x51, 0x85, 0x8C, 0x69, 0x7E, 0x0E, 0x57, 0x59, 0xCD, 0x03, 0x8B }, NULL, NULL, 0xA62230C3, 0xF0834488, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Dual Heroes (U) [b1]", { 0xE3, 0xEF, 0x8D, 0x7A, 0xCC, 0xA9, 0xCC, 0xB5, 0x51, 0xC2, 0x6B, 0x0F, 0x87, 0x9E, 0x6B, 0x25 }, NULL, NULL, 0xA62230C3, 0xF0834488, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Duck Dodgers Starring Daffy Duck (U) (M3) [!]", { 0x02, 0x19, 0x2B, 0x4B, 0x37, 0x97, 0x98, 0x3B, 0xBE, 0x5E, 0x45, 0x23, 0x36, 0x58, 0x42, 0x08 }, NULL, NULL, 0xFBB9F1FA, 0x6BF88689, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Duck Dodgers Starring Daffy Duck (U) (M3) [t1]", { 0xB5, 0xA5, 0xA7, 0x14, 0x83, 0x67, 0x9D, 0xCC, 0xAC, 0xBD, 0xA7, 0x70, 0x64, 0x7A, 0x9D, 0xBF }, NULL, NULL, 0x83E7E0D2, 0xB5B7E503, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Duke Nukem - ZER0 H0UR (E) [!]", { 0x86, 0xE9, 0x8A, 0xAC, 0xA0, 0xD9, 0x0B, 0xF7, 0x44, 0xDA, 0x09, 0x05, 0x39, 0xBA, 0x4A, 0xD8 }, NULL, NULL, 0xDC36626A, 0x3F3770CB, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Duke Nukem - ZER0 H0UR (E) [f1] (NTSC)", { 0x51, 0xA1, 0xEE, 0xE4, 0x41, 0x24, 0x02, 0x29, 0xBE, 0xB2, 0xE6, 0xCD, 0x8F, 0xAB, 0x28, 0x5C }, NULL, NULL, 0x0BD8008B, 0x26051E1D, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Duke Nukem - ZER0 H0UR (F) [!]", { 0xE2, 0xB7, 0x3F, 0xEB, 0x08, 0x43, 0x87, 0x4E, 0xA8, 0x31, 0xA2, 0xE0, 0x07, 0x6F, 0xCB, 0x72 }, NULL, NULL, 0x32CA974B, 0xB2C29C50, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Duke Nukem - ZER0 H0UR (U) [!]", { 0x02, 0x67, 0x89, 0xD4, 0x7D, 0xB5, 0xFE, 0x20, 0x2A, 0x76, 0xF8, 0x97, 0x97, 0xB3, 0x3A, 0xC7 }, NULL, NULL, 0x04DAF07F, 0x0D18E688, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Duke Nukem - ZER0 H0UR (U) [b1]", { 0x69, 0xED, 0x32, 0x66, 0x64, 0xE4, 0x8B, 0xAA, 0x9C, 0xE7, 0x43, 0xE6, 0xE9, 0xC4, 0x50, 0xDA }, NULL, NULL, 0x04DAF07F, 0x0D18E688, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Duke Nukem - ZER0 H0UR (U) [b2]", { 0x75, 0x23, 0x9D, 0x11, 0xAE, 0xE9, 0x06, 0xC9, 0xAB, 0xEA, 0x75, 0x2B, 0xA1, 0xE2, 0xAA, 0x00 }, NULL, NULL, 0xBCEAF9B7, 0xF84FF876, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Duke Nukem - ZER0 H0UR (U) [b3]", { 0x44, 0x46, 0xE9, 0x9E, 0x8D, 0x43, 0xE1, 0xB7, 0x55, 0x74, 0x12, 0xAC, 0xEA, 0x91, 0x8F, 0x68 }, NULL, NULL, 0xBCEAF9B7, 0xF84FF876, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Duke Nukem - ZER0 H0UR (U) [b4]", { 0xBD, 0x4E, 0x03, 0x62, 0x05, 0x67, 0xC6, 0x29, 0x1F, 0x11, 0xB9, 0x21, 0x7A, 0xC6, 0x7C, 0x28 }, NULL, NULL, 0x04DAF07F, 0x0D18E688, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Duke Nukem - ZER0 H0UR (U) [t1]", { 0xA3, 0xD4, 0x9A, 0xAC, 0x6B, 0xC8, 0xEE, 0xA0, 0xD7, 0x07, 0x04, 0x2A, 0x68, 0xD2, 0xD4, 0x8C }, NULL, NULL, 0xBCEAF9B7, 0xF84FF876, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Duke Nukem 64 (E) [!]", { 0x86, 0x57, 0xCB, 0xA9, 0x5C, 0x40, 0x9B, 0x74, 0xC1, 0xF5, 0x63, 0x2C, 0xBC, 0x36, 0x64, 0x3F }, NULL, NULL, 0x57BFF74D, 0xDE747743, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Duke Nukem 64 (E) (Beta)", { 0xBB, 0x24, 0x72, 0xB3, 0xF8, 0xA4, 0x1F, 0xBF, 0x3A, 0xEC, 0x3C, 0xCE, 0xF7, 0xEA, 0x8C, 0x78 }, NULL, NULL, 0xFF14C1DA, 0x167FDE92, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Duke Nukem 64 (E) [b1]", { 0xA6, 0xAC, 0x9D, 0x14, 0x01, 0x12, 0xBD, 0x7A, 0x3A, 0xA8, 0xA5, 0xAB, 0xA7, 0x9E, 0xBD, 0x88 }, NULL, NULL, 0x57BFF74D, 0xDE747743, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Duke Nukem 64 (E) [o1]", { 0x31, 0xF0, 0x8F, 0x1D, 0x2F, 0x78, 0x9C, 0x5D, 0x69, 0x8B, 0x7E, 0x05, 0xF2, 0x87, 0xE7, 0xAE }, NULL, NULL, 0x57BFF74D, 0xDE747743, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Duke Nukem 64 (F)", { 0xE2, 0xE7, 0x9C, 0x71, 0x67, 0xBD, 0xB2, 0x6E, 0x17, 0x6D, 0x22, 0x09, 0x04, 0x73, 0x9C, 0x91 }, NULL, NULL, 0x1E12883D, 0xD3B92718, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Duke Nukem 64 (U) [!]", { 0xC7, 0xF1, 0xA4, 0x37, 0x64, 0xA2, 0x6D, 0xA2, 0xE4, 0x3F, 0x2A, 0x36, 0xA5, 0xF7, 0x6E, 0x4C }, NULL, NULL, 0xA273AB56, 0xDA33DB9A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Duke Nukem 64 (U) [b1]", { 0x9B, 0xE6, 0x38, 0x92, 0xA2, 0xAA, 0x2B, 0x20, 0xB7, 0x5B, 0x3A, 0xC4, 0xE7, 0xB7, 0xDC, 0xDF }, NULL, NULL, 0x3F84EB47, 0x141964BF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Duke Nukem 64 (U) [b2]", { 0x68, 0x5E, 0xB7, 0xD3, 0xD1, 0xF2, 0xC8, 0x29, 0x32, 0xED, 0xF7, 0xB4, 0x76, 0xA6, 0xE2, 0x1B }, NULL, NULL, 0xA273AB56, 0xDA33DB9A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Duke Nukem 64 (U) [b3]", { 0xD1, 0x3D, 0x7E, 0x9A, 0xA2, 0x9D, 0x97, 0x2C, 0xB9, 0x3C, 0x39, 0xA1, 0x5F, 0x30, 0x4F, 0xAA }, NULL, NULL, 0xA273AB56, 0xDA33DB9A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Duke Nukem 64 (U) [h1C]", { 0x82, 0xFE, 0x39, 0x16, 0x99, 0x7D, 0xA1, 0x4A, 0x02, 0xC2, 0x30, 0x1A, 0xC2, 0xB5, 0xE3, 0x21 }, NULL, NULL, 0xA273AB56, 0xDA33DB9A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Duke Nukem 64 (U) [o1]", { 0x6F, 0x14, 0xB9, 0x99, 0x49, 0x9E, 0x90, 0x76, 0x1D, 0x84, 0x44, 0xF7, 0x84, 0x56, 0x4A, 0xB3 }, NULL, NULL, 0xA273AB56, 0xDA33DB9A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Duke Nukem 64 (U) [t1]", { 0x55, 0x7F, 0x89, 0xA2, 0x63, 0xB2, 0x02, 0x89, 0x36, 0x75, 0x39, 0x56, 0xF7, 0x90, 0x22, 0x99 }, NULL, NULL, 0x3F84EB47, 0x141964BF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Duke Nukem 64 (U) [t2]", { 0xA6, 0xDF, 0x7D, 0x8C, 0x1E, 0x2D, 0xAB, 0x58, 0x49, 0x6E, 0xF6, 0x33, 0xAC, 0x09, 0x36, 0x6E }, NULL, NULL, 0x3F84EB47, 0x141964BF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Duke Nukem 64 (U) [t3]", { 0x8B, 0x7E, 0x6F, 0xF3, 0x45, 0x3F, 0x66, 0x0D, 0xCF, 0xC7, 0xB9, 0x68, 0xE6, 0x22, 0xE7, 0xC9 }, NULL, NULL, 0x3F84EB47, 0x141964BF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Dynamix Intro (Hidden Song) by Widget and Immortal (PD)", { 0x9A, 0x00, 0x8A, 0xF4, 0xE9, 0x0D, 0x7C, 0x55, 0xF2, 0x10, 0x39, 0xF4, 0xE8, 0x21, 0x70, 0xEF }, NULL, NULL, 0xB8E73356, 0x040E42EC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Dynamix Intro by Widget and Immortal (PD)", { 0x58, 0x09, 0x67, 0x0A, 0x42, 0xCA, 0x34, 0xD3, 0x9A, 0x39, 0x59, 0x8E, 0xFA, 0x82, 0xF5, 0xF3 }, NULL, NULL, 0x086E91C9, 0x89F47C51, 3, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Dynamix Readme by Widget and Immortal (PD)", { 0xE0, 0x6B, 0x80, 0x4B, 0x5A, 0x88, 0x09, 0xC4, 0x2E, 0x99, 0xB2, 0x29, 0x10, 0x6C, 0xC8, 0x13 }, NULL, NULL, 0x186CC1A9, 0xA0DE4C8D, 3, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Dynamix Intro by Widget and Immortal (PD) [h1C]", { 0xF3, 0x2E, 0x61, 0xE3, 0x0C, 0x5B, 0xC2, 0x32, 0xA0, 0x1E, 0x52, 0xF8, 0xBC, 0x2E, 0xEF, 0x07 }, NULL, NULL, 0x086E91C9, 0x89F47C51, 3, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "ECW Hardcore Revolution (E) [!]", { 0x18, 0x30, 0xED, 0xE2, 0x55, 0x7E, 0x86, 0x85, 0xE6, 0xF7, 0x6D, 0x05, 0xCC, 0x65, 0x07, 0x6A }, NULL, NULL, 0x8C38E5DB, 0xB37C27D7, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "ECW Hardcore Revolution (G) [!]", { 0x5D, 0x1E, 0x41, 0xAA, 0x28, 0x16, 0x9E, 0x71, 0xB4, 0x91, 0x9F, 0xA0, 0x8F, 0x1A, 0xCD, 0x9B }, NULL, NULL, 0x2138A076, 0x408AD8B2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "ECW Hardcore Revolution (E) [b1]", { 0x91, 0x54, 0x5C, 0x26, 0x42, 0xDB, 0x63, 0x49, 0xB8, 0xD1, 0x8B, 0xF0, 0xBE, 0xE2, 0x91, 0x62 }, NULL, NULL, 0x8C38E5DB, 0xB37C27D7, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "ECW Hardcore Revolution (U) [!]", { 0x8E, 0xEB, 0xB1, 0x6B, 0x7A, 0x4D, 0x39, 0xAE, 0x8B, 0xC8, 0xCC, 0xCB, 0xC4, 0x1F, 0x0A, 0x01 }, NULL, NULL, 0xBDF9766D, 0xBD068D70, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Earthworm Jim 3D (E) (M6) [!]", { 0xBF, 0x2D, 0xF4, 0xB8, 0x6F, 0xAA, 0x21, 0x81, 0xA7, 0xAC, 0xFE, 0x26, 0x43, 0xFA, 0x22, 0x93 }, NULL, NULL, 0x492B9DE8, 0xC6CCC81C, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Earthworm Jim 3D (E) (M6) [b1]", { 0x97, 0xEA, 0x07, 0x9E, 0xCF, 0x10, 0x5E, 0xA1, 0x66, 0x54, 0xA8, 0x55, 0x64, 0x4D, 0x87, 0x0A }, NULL, NULL, 0x492B9DE8, 0xC6CCC81C, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Earthworm Jim 3D (U) [!]", { 0x98, 0x0D, 0xFB, 0x38, 0xAD, 0x9A, 0x88, 0x31, 0x19, 0xDE, 0x13, 0x5F, 0x45, 0xB7, 0xDB, 0x36 }, NULL, NULL, 0xDF574191, 0x9EB5123D, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Earthworm Jim 3D (U) [T+Rus]", { 0x55, 0x4E, 0xE4, 0xBF, 0x15, 0x38, 0x8D, 0xDE, 0x58, 0x6D, 0xE9, 0x0A, 0xC7, 0x2E, 0xF5, 0xFA }, NULL, NULL, 0x34DBB6CF, 0xEA06789D, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Earthworm Jim 3D (U) [f1] (PAL)", { 0xB2, 0x73, 0x36, 0xA2, 0x78, 0x65, 0x8A, 0xC6, 0xD6, 0x2A, 0xB6, 0xC4, 0xC3, 0xFB, 0x1D, 0xB6 }, NULL, NULL, 0x04853364, 0x948ACF82, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Earthworm Jim 3D (U) [hI]", { 0x6B, 0x87, 0x0E, 0xBE, 0xDC, 0xBD, 0x81, 0xB9, 0xFF, 0x36, 0x90, 0x08, 0xF9, 0x04, 0xC1, 0xCD }, NULL, NULL, 0x04842D98, 0x1A9FF551, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Earthworm Jim 3D (U) [t1]", { 0x60, 0xF0, 0xCB, 0xE1, 0x0D, 0xCE, 0x67, 0xFD, 0xD6, 0x52, 0x7A, 0x78, 0xB5, 0x1D, 0xCC, 0xBC }, NULL, NULL, 0x0484CD98, 0x1AFE0B59, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Eikou no Saint Andrews (J) [!]", { 0x93, 0x5D, 0xD8, 0x5A, 0xD1, 0x98, 0xBB, 0xDE, 0x92, 0x16, 0x1C, 0xDC, 0xE4, 0x7C, 0xBF, 0xB3 }, NULL, NULL, 0x0DED0568, 0x1502515E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Eikou no Saint Andrews (J) [b1]", { 0x93, 0x6D, 0xB7, 0x4A, 0xE7, 0x66, 0xBB, 0x12, 0x19, 0xE8, 0xA7, 0x12, 0xF0, 0xD0, 0x6E, 0x4A }, NULL, NULL, 0x0DED0568, 0x1502515E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Eikou no Saint Andrews (J) [b2]", { 0x0F, 0x7C, 0x52, 0xAD, 0x7C, 0x7C, 0x88, 0x10, 0x39, 0x60, 0xF4, 0x4F, 0xCD, 0x0B, 0x11, 0x9A }, NULL, NULL, 0x0DED0568, 0x1502515E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Eikou no Saint Andrews (J) [h1C]", { 0x08, 0xCC, 0xA8, 0xD3, 0x72, 0xEA, 0x8C, 0x38, 0x14, 0x8F, 0x77, 0xAB, 0x5A, 0x03, 0x35, 0x4D }, NULL, NULL, 0x0DED0568, 0x1502515E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Eikou no Saint Andrews (J) [h2C]", { 0xCE, 0xC8, 0x24, 0xB5, 0xDA, 0x28, 0xB9, 0x74, 0xB1, 0x56, 0x23, 0x38, 0xEB, 0x72, 0x88, 0x05 }, NULL, NULL, 0x0DED0568, 0x1502515E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Eleven Beat - World Tournament (Aleck64)", { 0x7E, 0xB0, 0xC2, 0x7F, 0x16, 0x2B, 0x74, 0x03, 0x2C, 0x38, 0x23, 0xE7, 0x21, 0xED, 0xA0, 0x0B }, NULL, NULL, 0x6D9D1FE4, 0x84D10BEA, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Elmo's Letter Adventure (U) [!]", { 0x15, 0xDF, 0x97, 0xA5, 0x9B, 0x23, 0x54, 0xB1, 0x30, 0xDE, 0xC3, 0xFB, 0x86, 0xBB, 0xA5, 0x13 }, NULL, NULL, 0xF2A653CB, 0x60633B3B, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Elmo's Number Journey (U) [!]", { 0xF7, 0x33, 0x45, 0x3E, 0xD2, 0x6A, 0xFA, 0x0A, 0xCA, 0x8D, 0x3E, 0xB3, 0xB5, 0xB6, 0xD8, 0xEA }, NULL, NULL, 0x02B1538F, 0xC94B88D0, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Eltale Monsters (J) [!]", { 0x9B, 0x45, 0x6A, 0xCB, 0x96, 0x29, 0x1F, 0xC8, 0xB5, 0x52, 0x32, 0xA0, 0x8A, 0xE0, 0x33, 0x46 }, NULL, NULL, 0xE13AE2DC, 0x4FB65CE8, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Eltale Monsters (J) [b1]", { 0x75, 0x2E, 0xF6, 0xD2, 0xC2, 0xA6, 0xDB, 0xBB, 0x8C, 0xBA, 0xEF, 0xB5, 0x96, 0x41, 0x2C, 0x1D }, NULL, NULL, 0xE13AE2DC, 0x4FB65CE8, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Eltale Monsters (J) [b2]", { 0xD4, 0x2C, 0xC7, 0x8A, 0x2B, 0xF0, 0xD3, 0x45, 0x18, 0xB8, 0xE0, 0xD0, 0x43, 0x9E, 0x43, 0x2E }, NULL, NULL, 0xE13AE2DC, 0x4FB65CE8, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Eurasia First N64 Intro by Sispeo (PD)", { 0x75, 0xA8, 0xF2, 0x5B, 0x67, 0x9A, 0x0D, 0x14, 0x8F, 0x0D, 0x8E, 0x11, 0x43, 0x10, 0x48, 0x45 }, NULL, NULL, 0x52F22511, 0xB9D85F75, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Eurasia Intro by Ste (PD) [b1]", { 0x76, 0x1D, 0xC0, 0xDE, 0x09, 0x13, 0xD6, 0x97, 0xED, 0x1F, 0x98, 0x99, 0x94, 0x85, 0x52, 0xBB }, NULL, NULL, 0x52F22511, 0xB9D85F75, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Eurasia Intro by Ste (PD)", { 0xF7, 0xE6, 0xC9, 0xCF, 0xF1, 0xBC, 0x16, 0xB0, 0xDE, 0xDA, 0x0E, 0xCE, 0xFC, 0x5C, 0x3D, 0xFB }, NULL, NULL, 0x93A94333, 0x5A613C39, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Evek - V64jr Save Manager by WT_Riker (PD)", { 0xF1, 0xD0, 0x40, 0x6A, 0x74, 0xAD, 0x74, 0xBE, 0x58, 0x91, 0x62, 0x0B, 0x7F, 0xE6, 0x64, 0x0D }, NULL, NULL, 0xD49DFF90, 0x8DB53A8C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Excitebike 64 (Ch) (iQue) [!]", { 0xF4, 0xB4, 0x18, 0x63, 0x44, 0x01, 0x37, 0xC6, 0xA3, 0xBA, 0x22, 0x94, 0x2F, 0x3E, 0x0D, 0xA2 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x51 },
+    { "Excitebike 64 (Ch) (iQue) (Manual) [!]", { 0x87, 0x6F, 0x87, 0xC9, 0x1A, 0x4B, 0x63, 0x39, 0xDA, 0xA8, 0xFC, 0x1F, 0x41, 0xEB, 0x7A, 0xCD }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Excitebike 64 (E) [!]", { 0x8F, 0xA2, 0x53, 0xFD, 0x69, 0xB7, 0x3D, 0xF9, 0xA8, 0x31, 0xEF, 0x2F, 0x73, 0x14, 0x91, 0xF2 }, NULL, NULL, 0x202A8EE4, 0x83F88B89, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Excitebike 64 (J) [!]", { 0xBF, 0x15, 0xA6, 0x1A, 0xFF, 0x71, 0xC9, 0x3B, 0xF5, 0xE0, 0x52, 0x43, 0xF5, 0x7B, 0xCA, 0x1D }, NULL, NULL, 0x861C3519, 0xF6091CE5, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Excitebike 64 (U) (Kiosk Demo) [!]", { 0xE0, 0x01, 0x8C, 0x33, 0x34, 0x67, 0x14, 0xB6, 0x3A, 0x55, 0xC0, 0xE0, 0x40, 0xF2, 0x3D, 0xEA }, NULL, NULL, 0xAF754F7B, 0x1DD17381, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x42B },
+    { "Excitebike 64 (U) (V1.0) [!]", { 0x72, 0x00, 0xD1, 0xC1, 0xCF, 0x48, 0x9F, 0xAF, 0xFF, 0x76, 0x77, 0x29, 0xF2, 0x15, 0xE6, 0xE6 }, NULL, NULL, 0x07861842, 0xA12EBC9F, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Excitebike 64 (U) (V1.0) [b1]", { 0x49, 0x69, 0x29, 0xEA, 0x74, 0x18, 0x31, 0x98, 0xD1, 0x21, 0x03, 0x5E, 0xA8, 0x08, 0xC4, 0x80 }, NULL, NULL, 0x07861842, 0xA12EBC9F, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Excitebike 64 (U) (V1.0) [f1]", { 0x48, 0xD1, 0xFA, 0x27, 0x9F, 0xEA, 0x4C, 0x99, 0xCF, 0xEE, 0xC9, 0x0E, 0x9A, 0xD1, 0x66, 0x8F }, NULL, NULL, 0xE5B7F405, 0x2C4462BF, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Excitebike 64 (U) (V1.0) [f2] (Save)", { 0x28, 0x5D, 0x32, 0x77, 0xD2, 0x8C, 0xA3, 0xB9, 0xA5, 0xA2, 0xBE, 0x89, 0x71, 0xCC, 0xD7, 0x67 }, NULL, NULL, 0xE5B7F405, 0x2C4462BF, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Excitebike 64 (U) (V1.1) [!]", { 0x21, 0x95, 0x4E, 0x4E, 0x40, 0x4D, 0x9E, 0x87, 0xDB, 0xDB, 0x87, 0xDD, 0x30, 0x9F, 0x3E, 0x94 }, NULL, NULL, 0xF9D411E3, 0x7CB29BC0, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Explode Demo by NaN (PD)", { 0x6D, 0xCF, 0xDE, 0x04, 0x23, 0xD1, 0xDB, 0x58, 0xEA, 0x9E, 0x6A, 0x8F, 0x1B, 0xFF, 0xD8, 0x49 }, NULL, NULL, 0x3E5D6755, 0x9AE4BD3B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Extreme-G (E) (M5) [!]", { 0x3B, 0x2C, 0xA0, 0xDA, 0x08, 0x10, 0xC9, 0x5B, 0x31, 0xDF, 0x8C, 0x1F, 0xB8, 0x81, 0x1B, 0xE2 }, NULL, NULL, 0x8E9D834E, 0x1E8B29A9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Extreme-G (E) (M5) [b1]", { 0xBF, 0x72, 0xE1, 0x0E, 0xB7, 0x9E, 0x00, 0xE0, 0x95, 0x82, 0x91, 0x12, 0x57, 0x6F, 0x01, 0xFE }, NULL, NULL, 0x8E9D834E, 0x1E8B29A9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Extreme-G (E) (M5) [b2]", { 0xA0, 0x59, 0xE2, 0x7D, 0xE4, 0x10, 0xBD, 0xA0, 0x5D, 0x86, 0x03, 0xC2, 0x27, 0x76, 0x97, 0x9F }, NULL, NULL, 0x8E9D834E, 0x1E8B29A9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Extreme-G (E) (M5) [b3]", { 0xB7, 0x4A, 0x05, 0x9D, 0x22, 0x78, 0x30, 0xC6, 0x06, 0xBA, 0x79, 0x13, 0x42, 0x78, 0xF5, 0x5E }, NULL, NULL, 0x8E9D834E, 0x1E8B29A9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Extreme-G (E) (M5) [b4]", { 0x22, 0x57, 0x94, 0x5E, 0xAB, 0xC0, 0x08, 0xE4, 0xD6, 0x46, 0x41, 0x96, 0xB2, 0x88, 0xD5, 0xBF }, NULL, NULL, 0x8E9D834E, 0x1E8B29A9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Extreme-G (E) (M5) [h1C]", { 0x97, 0x2D, 0x04, 0x68, 0xCE, 0xB1, 0x22, 0x12, 0x14, 0xAD, 0xED, 0x71, 0x81, 0xDA, 0x78, 0x53 }, NULL, NULL, 0x8E9D834E, 0x1E8B29A9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Extreme-G (J) [!]", { 0xA7, 0xCD, 0x65, 0xE5, 0xA4, 0xA8, 0x83, 0x8D, 0x1C, 0xD4, 0x52, 0xBA, 0x66, 0xE7, 0x4D, 0xF6 }, NULL, NULL, 0xEE802DC4, 0x690BD57D, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Extreme-G (U) [!]", { 0x3E, 0x66, 0x0D, 0x3F, 0x99, 0x1C, 0x05, 0x29, 0xE9, 0x0B, 0xFE, 0xC0, 0x24, 0x4D, 0xB3, 0x1A }, NULL, NULL, 0xFDA245D2, 0xA74A3D47, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Extreme-G (U) [h1C]", { 0x6D, 0x95, 0x42, 0x94, 0xE2, 0x54, 0xE2, 0x39, 0xB3, 0xEA, 0x69, 0x4C, 0x2D, 0x9A, 0xDF, 0xF9 }, NULL, NULL, 0xFDA245D2, 0xA74A3D47, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Extreme-G (U) [o1]", { 0xE5, 0xD2, 0xC7, 0xCE, 0x59, 0x28, 0x2C, 0x0D, 0x71, 0x6D, 0xD6, 0x7C, 0xA7, 0x87, 0xCF, 0x7B }, NULL, NULL, 0xFDA245D2, 0xA74A3D47, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Extreme-G (U) [t1]", { 0xB7, 0x60, 0xD4, 0xC3, 0x53, 0x03, 0xC7, 0x4B, 0x89, 0x3F, 0x11, 0x68, 0x41, 0x5D, 0x74, 0x3D }, NULL, NULL, 0x9FD881BC, 0x0A62D002, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Extreme-G XG2 (E) (M5) [!]", { 0xBB, 0x7F, 0x98, 0xE6, 0x57, 0xFB, 0x4B, 0x5F, 0xCC, 0x7D, 0xC0, 0x4B, 0xD7, 0x2E, 0x2D, 0x2B }, NULL, NULL, 0x1185EC85, 0x4B5A7731, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Extreme-G XG2 (J) [!]", { 0xF1, 0x78, 0x84, 0xA2, 0xC1, 0x6F, 0xB6, 0xFD, 0x11, 0xA7, 0x4D, 0x65, 0xB1, 0x38, 0x8B, 0x4A }, NULL, NULL, 0x399B9B81, 0xD533AD11, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Extreme-G XG2 (U) [!]", { 0x44, 0xFE, 0x06, 0xBA, 0x36, 0x86, 0xC0, 0x2A, 0x79, 0x88, 0xF2, 0x76, 0x00, 0xA5, 0x33, 0xDA }, NULL, NULL, 0x5CD4150B, 0x470CC2F1, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Extreme-G XG2 (U) [t1]", { 0xB0, 0xF9, 0xC3, 0xEC, 0x65, 0xC1, 0xC8, 0x8A, 0x43, 0xC6, 0x94, 0xEB, 0xF4, 0x29, 0xE0, 0x08 }, NULL, NULL, 0x21910973, 0x0F2E70D2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "F-1 Pole Position 64 (E) (M3) [!]", { 0xA6, 0xBD, 0x93, 0xEA, 0x57, 0x6C, 0xDF, 0x85, 0x69, 0xF6, 0x81, 0x71, 0x45, 0x2F, 0x7E, 0x8A }, NULL, NULL, 0xFDD248B2, 0x569A020E, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "F-1 Pole Position 64 (E) (M3) [b1]", { 0xAC, 0xBB, 0x37, 0xB2, 0x42, 0x38, 0xF8, 0x2B, 0x23, 0x33, 0xB7, 0x10, 0xCB, 0xEE, 0x38, 0x8A }, NULL, NULL, 0xFDD248B2, 0x569A020E, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "F-1 Pole Position 64 (U) (M3) [!]", { 0x04, 0x9D, 0xB6, 0x57, 0xF4, 0x22, 0x3D, 0x94, 0x9F, 0x56, 0xE9, 0xDC, 0x5B, 0x6A, 0x91, 0x80 }, NULL, NULL, 0xAE82687A, 0x9A3F388D, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "F-1 Pole Position 64 (U) (M3) [b1]", { 0x6C, 0xE5, 0xD1, 0x6E, 0x97, 0x7B, 0x1D, 0x4E, 0x0E, 0x71, 0xE2, 0x09, 0xB2, 0x93, 0x20, 0x99 }, NULL, NULL, 0xAE82687A, 0x9A3F388D, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "F-1 Pole Position 64 (U) (M3) [b2]", { 0xC8, 0xC1, 0x4D, 0x74, 0x86, 0x79, 0xAE, 0x6F, 0x8F, 0xF1, 0xA6, 0x2C, 0x4A, 0xD3, 0xB6, 0x1E }, NULL, NULL, 0xAE82687A, 0x9A3F388D, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "F-1 Pole Position 64 (U) (M3) [h1C]", { 0x9E, 0x68, 0x4F, 0xDC, 0xAC, 0x7B, 0x59, 0x99, 0xCC, 0x86, 0x30, 0x84, 0xDE, 0xCA, 0x46, 0x3D }, NULL, NULL, 0xAE82687A, 0x9A3F388D, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "F-1 World Grand Prix (E) (Prototype) [!]", { 0x9F, 0xBE, 0x33, 0x63, 0xDA, 0x6C, 0x14, 0x6E, 0xF2, 0xE2, 0x96, 0x05, 0xBC, 0xA8, 0x34, 0xFF }, NULL, NULL, 0xCC3CC8B3, 0x0EC405A4, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix (E) (Prototype) [h1C]", { 0x08, 0xB8, 0x94, 0x2E, 0x97, 0x7A, 0x81, 0xCA, 0xF8, 0x1D, 0xAC, 0x22, 0x37, 0xE1, 0xAA, 0x65 }, NULL, NULL, 0xCC3CC8B3, 0x0EC405A4, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix (E) [!]", { 0xFA, 0xC4, 0x50, 0xEA, 0xFF, 0x8F, 0xA4, 0x6A, 0x14, 0x14, 0xDB, 0x02, 0xE6, 0xEE, 0xAB, 0x9F }, NULL, NULL, 0xC006E3C0, 0xA67B4BBB, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix (F) [!]", { 0x35, 0xF6, 0xC4, 0x2D, 0x5A, 0x92, 0x84, 0x68, 0x82, 0x84, 0xC2, 0x42, 0x50, 0xF4, 0xD6, 0xBE }, NULL, NULL, 0xB70BAEE5, 0x3A5005A8, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix (G) [!]", { 0xA8, 0xC7, 0x84, 0x54, 0xC7, 0x0B, 0xD7, 0x33, 0x75, 0xAA, 0xF6, 0x9C, 0x40, 0x78, 0xD5, 0xDA }, NULL, NULL, 0x38442634, 0x66B3F060, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix (G) [b1]", { 0xAA, 0x15, 0xFA, 0x62, 0xA7, 0x76, 0x91, 0x7E, 0x59, 0x4A, 0x17, 0xB4, 0x9B, 0xBC, 0x69, 0x80 }, NULL, NULL, 0x38442634, 0x66B3F060, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix (G) [b1][o1]", { 0x43, 0x11, 0x51, 0x45, 0xF2, 0xDC, 0x0F, 0x3D, 0x0C, 0x60, 0x91, 0xD0, 0x5C, 0xB9, 0xFA, 0x52 }, NULL, NULL, 0x38442634, 0x66B3F060, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix (G) [h1C]", { 0x38, 0xB0, 0xDB, 0x49, 0x16, 0x32, 0x86, 0x72, 0xED, 0x59, 0x27, 0x59, 0xFF, 0xB1, 0xF0, 0x9C }, NULL, NULL, 0x38442634, 0x66B3F060, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix (G) [o1]", { 0x3C, 0xEE, 0x18, 0x95, 0xA8, 0x00, 0x05, 0x94, 0x08, 0x87, 0xC9, 0x83, 0x0B, 0x09, 0xDD, 0xE6 }, NULL, NULL, 0x38442634, 0x66B3F060, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix (G) [o1][h1C]", { 0x6E, 0x58, 0x58, 0xA4, 0x7C, 0xB4, 0x2F, 0x9B, 0x1C, 0xB2, 0x60, 0x42, 0xBA, 0x22, 0x9E, 0xF6 }, NULL, NULL, 0x38442634, 0x66B3F060, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix (J) [!]", { 0xF2, 0x48, 0xF0, 0xAA, 0xE6, 0x09, 0x11, 0x1B, 0xA9, 0xDF, 0xF9, 0xFD, 0x7A, 0xFB, 0xC4, 0x85 }, NULL, NULL, 0x64BF47C4, 0xF4BD22BA, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix (J) [h1C]", { 0x7D, 0xFE, 0x40, 0xE3, 0x87, 0x97, 0x12, 0x69, 0xF3, 0x8F, 0xE3, 0xCB, 0xE8, 0x03, 0x56, 0x7A }, NULL, NULL, 0x64BF47C4, 0xF4BD22BA, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix (U) [!]", { 0xA8, 0x1B, 0x1D, 0xE8, 0x64, 0xDF, 0x3F, 0x4B, 0xB0, 0x90, 0x37, 0x60, 0xBE, 0x67, 0x3F, 0x21 }, NULL, NULL, 0xCC3CC8B3, 0x0EC405A4, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix (U) [h1C]", { 0x4E, 0x45, 0x0D, 0xD2, 0x89, 0x9F, 0xE7, 0x43, 0x41, 0x10, 0xE3, 0x0E, 0x19, 0xDD, 0x10, 0xA2 }, NULL, NULL, 0xCC3CC8B3, 0x0EC405A4, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix (U) [h2C]", { 0x05, 0x42, 0x65, 0x47, 0xE5, 0xAD, 0x9D, 0xBF, 0x88, 0xCF, 0x0A, 0x40, 0x10, 0x32, 0x07, 0x9D }, NULL, NULL, 0xCC3CC8B3, 0x0EC405A4, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-1 World Grand Prix II (E) (M4) [!]", { 0xBC, 0x0F, 0xD2, 0x46, 0x8A, 0xC7, 0x76, 0x9A, 0x37, 0xC3, 0xC5, 0x8C, 0xD5, 0x69, 0x95, 0x85 }, NULL, NULL, 0x07C1866E, 0x5775CCDE, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "F-1 World Grand Prix II (E) (M4) [f1] (NTSC)", { 0xD9, 0xB5, 0x9E, 0x46, 0x3A, 0x73, 0xFA, 0x88, 0x0E, 0x66, 0x82, 0xA0, 0x8D, 0x1C, 0x30, 0x71 }, NULL, NULL, 0x67C38660, 0x94038DC6, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "F-1 World Grand Prix II (E) (M4) [h1C]", { 0xE9, 0x4A, 0x91, 0x42, 0xB1, 0xD9, 0x81, 0xA6, 0x55, 0x67, 0x47, 0xBA, 0x14, 0x7E, 0x1A, 0x19 }, NULL, NULL, 0x07C1866E, 0x5775CCDE, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "F-ZERO X (Ch) (iQue) [!]", { 0x40, 0x24, 0x47, 0x7A, 0xAE, 0xD7, 0xDD, 0x5F, 0xF5, 0xEA, 0x60, 0xBF, 0x56, 0x81, 0x23, 0xB7 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x11 },
+    { "F-ZERO X (Ch) (V2) (iQue) (Manual) [!]", { 0x84, 0x00, 0xC0, 0x87, 0x5E, 0x16, 0xF5, 0x99, 0xC1, 0xB7, 0xFC, 0x43, 0x3E, 0x33, 0x9D, 0x58 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "F-ZERO X (Ch) (V4) (iQue) (Manual) [!]", { 0x97, 0x29, 0xFC, 0x39, 0x7E, 0x8D, 0x17, 0x8E, 0xA9, 0x74, 0x86, 0x9E, 0x07, 0xDF, 0x05, 0x02 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "F-ZERO X (E) [!]", { 0xEE, 0x79, 0xA8, 0xFE, 0x28, 0x7B, 0x5D, 0xCA, 0xEA, 0x58, 0x44, 0x39, 0x36, 0x33, 0x42, 0xFC }, NULL, NULL, 0x776646F6, 0x06B9AC2B, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (E) [b1]", { 0x07, 0x22, 0xE6, 0x79, 0xF9, 0x69, 0x5D, 0x9E, 0x5F, 0x1D, 0x28, 0x23, 0xDC, 0x7D, 0x80, 0x04 }, NULL, NULL, 0x776646F6, 0x06B9AC2B, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (E) [b2]", { 0x99, 0xDC, 0x3F, 0xF7, 0x83, 0x56, 0xCE, 0x77, 0xCB, 0x24, 0x0A, 0xC7, 0x78, 0x2E, 0xE6, 0xE5 }, NULL, NULL, 0xDAA6CA7D, 0x56AA4394, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (E) [b3]", { 0x2E, 0x95, 0xE5, 0x83, 0x38, 0x94, 0xA6, 0xE1, 0xE3, 0xD1, 0x09, 0xE3, 0xB3, 0xD8, 0x09, 0xF1 }, NULL, NULL, 0xEC986EA9, 0xEB463E4A, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (E) [b4]", { 0x30, 0x83, 0x84, 0xEE, 0xEB, 0x6A, 0x88, 0xB5, 0xB4, 0x98, 0x17, 0x9E, 0x74, 0x84, 0x94, 0x4F }, NULL, NULL, 0xDAA6CA7D, 0x56AA4394, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (E) [f1]", { 0xD1, 0x36, 0x8C, 0x0E, 0x38, 0x69, 0xB8, 0x59, 0x47, 0xA5, 0x5C, 0x3D, 0xA6, 0xFF, 0xCA, 0x10 }, NULL, NULL, 0xDAA6CA7D, 0x56AA4394, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (E) [h1C]", { 0xAC, 0xE5, 0x8F, 0x32, 0x5D, 0x5E, 0xEC, 0xBE, 0x03, 0x3B, 0x21, 0xF2, 0xC7, 0xBF, 0xE8, 0x70 }, NULL, NULL, 0x776646F6, 0x06B9AC2B, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (J) [!]", { 0x58, 0xD2, 0x00, 0xD4, 0x36, 0x20, 0x00, 0x73, 0x14, 0x30, 0x4F, 0x4E, 0x6C, 0x9E, 0x65, 0x28 }, NULL, NULL, 0x4D3E622E, 0x9B828B4E, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (J) [b1]", { 0xC1, 0x4A, 0xE1, 0x4C, 0x6D, 0xE0, 0xDC, 0xA1, 0x26, 0xC4, 0x23, 0xC4, 0xAD, 0xBE, 0xE3, 0x15 }, NULL, NULL, 0x076C5C15, 0xBDA9D062, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (J) [b2]", { 0xE6, 0xEC, 0x9D, 0x86, 0xF9, 0x4C, 0xEB, 0x2E, 0x31, 0x1F, 0x9C, 0x23, 0xBB, 0xD3, 0x78, 0x1F }, NULL, NULL, 0x076C5C15, 0xBDA9D062, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (J) [b3]", { 0x6A, 0xC1, 0x2C, 0x2D, 0x6C, 0x0C, 0xCD, 0xF2, 0x7C, 0x0D, 0x51, 0x79, 0xA5, 0x00, 0xBB, 0x2D }, NULL, NULL, 0x076C5C15, 0xBDA9D062, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (J) [t1]", { 0x75, 0xAE, 0xA2, 0xB2, 0x52, 0x30, 0x95, 0x52, 0xE4, 0x34, 0xB3, 0x0E, 0xDF, 0xE7, 0x27, 0x11 }, NULL, NULL, 0x076C5C15, 0xBDA9D062, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (U) (DXP Track Pack Hack)", { 0xC1, 0xCD, 0xB7, 0x7B, 0xEA, 0x29, 0xA4, 0xB6, 0xF9, 0xA0, 0x82, 0x9F, 0x8B, 0xA8, 0xA3, 0xF3 }, NULL, NULL, 0x3983D1A9, 0x2004158C, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (U) [!]", { 0x75, 0x34, 0x37, 0xD0, 0xD8, 0xAD, 0xA1, 0xD1, 0x2F, 0x3F, 0x9C, 0xF0, 0xF0, 0xA5, 0x17, 0x1F }, NULL, NULL, 0xB30ED978, 0x3003C9F9, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (U) [T+Por0.99_byftr]", { 0x20, 0xF5, 0xEE, 0xEE, 0x84, 0x9D, 0xB4, 0x41, 0x46, 0xAA, 0xFB, 0x1B, 0x97, 0xA8, 0x57, 0xF6 }, NULL, NULL, 0x485256FF, 0xCF6DF912, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (U) [f1] (Sex V1.0 Hack)", { 0x3A, 0xE3, 0x26, 0x58, 0xB8, 0x39, 0xFF, 0xA3, 0x18, 0x9E, 0x3C, 0xA8, 0x4E, 0x0B, 0x88, 0x4A }, NULL, NULL, 0x7E399849, 0x03DAC1CD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "F-ZERO X (U) [f1] (Sex V1.1 Hack)", { 0x83, 0x63, 0xF1, 0x02, 0xFE, 0x49, 0x6B, 0x8D, 0x06, 0x49, 0x4A, 0xA2, 0x2E, 0x18, 0x3A, 0x3E }, NULL, NULL, 0xD767D118, 0xA1B07602, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "F-ZERO X (U) [f1]", { 0x7A, 0xC3, 0xB9, 0xA3, 0xAA, 0x84, 0x6C, 0x43, 0x95, 0x75, 0x91, 0x28, 0x11, 0xB3, 0xE6, 0xE0 }, NULL, NULL, 0xB0B4EDFF, 0xB2A20628, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F-ZERO X (U) [f2] (GameShark)", { 0xEA, 0x16, 0x89, 0x57, 0xB6, 0x44, 0xAF, 0xE8, 0x52, 0xDA, 0x1B, 0x82, 0x7A, 0xFC, 0x3F, 0x9F }, NULL, NULL, 0x0B46D03D, 0x5FFAE173, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "F1 Racing Championship (B) (M2) [!]", { 0x44, 0xD5, 0xF8, 0x71, 0x27, 0x05, 0x3A, 0x21, 0xDB, 0x12, 0x0B, 0xD1, 0x08, 0xB7, 0xAC, 0x0C }, NULL, NULL, 0x53CCAD28, 0xAEA6EDA2, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "F1 Racing Championship (E) (M5) [!]", { 0x95, 0x81, 0xFC, 0x6C, 0xEA, 0xC8, 0x6D, 0xC8, 0xA2, 0xAE, 0xE4, 0x05, 0x30, 0x43, 0xE4, 0x22 }, NULL, NULL, 0x3CECBCB8, 0x6126BF07, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "F1 Racing Championship (E) (M5) [f1] (NTSC)", { 0xAA, 0x95, 0x12, 0x94, 0x52, 0x8C, 0xA2, 0xCF, 0x55, 0xF8, 0x10, 0xF9, 0xFE, 0x43, 0x3F, 0x8D }, NULL, NULL, 0x67D239A0, 0x960F3A1A, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "FIFA - Road to World Cup 98 (E) (M7) [!]", { 0x26, 0xB1, 0x8D, 0x35, 0x98, 0x45, 0x28, 0xAE, 0x2F, 0x90, 0xAD, 0xBB, 0x2F, 0x26, 0x42, 0xF7 }, NULL, NULL, 0x0E31EDF0, 0xC37249D5, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA - Road to World Cup 98 (E) (M7) [o1]", { 0x47, 0x95, 0x54, 0x12, 0x9E, 0xB2, 0x7A, 0x35, 0x46, 0xBA, 0xC9, 0x6C, 0x80, 0xAF, 0x4F, 0x88 }, NULL, NULL, 0x0E31EDF0, 0xC37249D5, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA - Road to World Cup 98 (U) (M7) [!]", { 0x2C, 0x6D, 0x14, 0x6A, 0x84, 0x73, 0x51, 0x1C, 0xFC, 0xFB, 0xBE, 0x85, 0x18, 0xF4, 0x9D, 0x71 }, NULL, NULL, 0xCB1ACDDE, 0xCF291DF2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA - Road to World Cup 98 (U) (M7) [b1]", { 0x4E, 0x27, 0x5B, 0x05, 0xBA, 0xBC, 0xA9, 0xF2, 0xCD, 0x77, 0x74, 0x90, 0x26, 0xBE, 0xA5, 0xED }, NULL, NULL, 0xCB1ACDDE, 0xCF291DF2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA - Road to World Cup 98 (U) (M7) [b2]", { 0x4C, 0xAA, 0xE8, 0xCA, 0x91, 0xF5, 0x8D, 0x74, 0x6B, 0x6A, 0x00, 0xBC, 0xBC, 0x12, 0x2B, 0x87 }, NULL, NULL, 0xCB1ACDDE, 0xCF291DF2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA - Road to World Cup 98 (U) (M7) [b3]", { 0x21, 0x7D, 0x93, 0xB2, 0x1F, 0xEC, 0x3A, 0x55, 0x06, 0xDB, 0x01, 0x4B, 0xF4, 0x45, 0xB5, 0x81 }, NULL, NULL, 0xCB1ACDDE, 0xCF291DF2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA - Road to World Cup 98 (U) (M7) [b4]", { 0x44, 0x21, 0xF8, 0x91, 0xF0, 0xBA, 0x3C, 0xC7, 0xAA, 0x0F, 0xD5, 0x66, 0xA1, 0x62, 0xF2, 0xC8 }, NULL, NULL, 0xCB1ACDDE, 0xCF291DF2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA - Road to World Cup 98 (U) (M7) [o1]", { 0x0B, 0x83, 0x03, 0xE3, 0x3B, 0x3F, 0x6E, 0x57, 0x53, 0x1F, 0xB8, 0xEB, 0x3F, 0xAE, 0x65, 0xE9 }, NULL, NULL, 0xCB1ACDDE, 0xCF291DF2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA - Road to World Cup 98 - World Cup heno Michi (J) [!]", { 0x36, 0x11, 0x77, 0x9F, 0x29, 0x99, 0x72, 0x67, 0x62, 0x2C, 0xBC, 0x80, 0xE2, 0xD0, 0x87, 0xCC }, NULL, NULL, 0xF5733C67, 0x17A3973A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA 99 (E) (M8) [!]", { 0x64, 0x32, 0xC6, 0x22, 0xC0, 0x5E, 0xA9, 0xCD, 0x32, 0x17, 0xE2, 0x80, 0xAC, 0x2C, 0xE3, 0x7C }, NULL, NULL, 0x0198A651, 0xFC219D84, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA 99 (E) (M8) [hI]", { 0x94, 0x0F, 0xFB, 0x6C, 0x94, 0xF8, 0x4B, 0xFF, 0xD9, 0x72, 0xA6, 0x9E, 0xD8, 0x6D, 0xD2, 0xFD }, NULL, NULL, 0xF82C85BE, 0xDEB717E2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA 99 (U) [!]", { 0x14, 0x8D, 0xE3, 0x07, 0x37, 0x27, 0xB9, 0xFD, 0x15, 0x6F, 0x10, 0xAF, 0xAD, 0xD4, 0x68, 0x64 }, NULL, NULL, 0x7613A630, 0x3ED696F3, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA 99 (U) [b1]", { 0x22, 0x08, 0x2B, 0x8D, 0x89, 0x2A, 0x25, 0x60, 0x03, 0x2F, 0xD4, 0xDA, 0x5A, 0xB9, 0x75, 0xA1 }, NULL, NULL, 0x21250314, 0xE6A82CB9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA Soccer 64 (E) (M3) [!]", { 0x9A, 0x70, 0x06, 0x21, 0x29, 0x47, 0xEE, 0x76, 0x48, 0xEE, 0x1D, 0x13, 0x16, 0x2E, 0x55, 0xE0 }, NULL, NULL, 0xC3F19159, 0x65D2BC5A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA Soccer 64 (E) (M3) [b1]", { 0x1D, 0x71, 0x76, 0x17, 0x71, 0xE3, 0xBF, 0xFC, 0x09, 0x1E, 0x38, 0xB9, 0xE8, 0xB5, 0xE5, 0x90 }, NULL, NULL, 0xC3F19159, 0x65D2BC5A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA Soccer 64 (E) (M3) [o1]", { 0xB5, 0xFB, 0xF0, 0x33, 0xD7, 0x6F, 0xDE, 0x89, 0x37, 0x5D, 0x84, 0xB8, 0x91, 0x8A, 0x5B, 0x61 }, NULL, NULL, 0xC3F19159, 0x65D2BC5A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA Soccer 64 (E) (M3) [o2]", { 0x08, 0x4A, 0xBA, 0x16, 0xD8, 0x4C, 0x87, 0x71, 0x2A, 0x73, 0x1D, 0x48, 0x5F, 0xCD, 0xBE, 0x3E }, NULL, NULL, 0xC3F19159, 0x65D2BC5A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA Soccer 64 (E) (M3) [o3]", { 0x37, 0x6F, 0xFE, 0xC4, 0x60, 0x44, 0x34, 0x09, 0xBC, 0x29, 0xBB, 0x81, 0x5A, 0xBF, 0xB4, 0x2A }, NULL, NULL, 0xC3F19159, 0x65D2BC5A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA Soccer 64 (E) (M3) [o4]", { 0xCF, 0x55, 0x22, 0x3F, 0x9E, 0x3B, 0xD1, 0x18, 0x96, 0x9A, 0x34, 0x95, 0x0B, 0xED, 0xFD, 0x1F }, NULL, NULL, 0xC3F19159, 0x65D2BC5A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA Soccer 64 (U) (M3) [!]", { 0xCC, 0x7C, 0x58, 0xA0, 0x32, 0xAA, 0xBA, 0x19, 0xE7, 0x2C, 0xCB, 0xFA, 0x6B, 0x3E, 0xEF, 0xF6 }, NULL, NULL, 0xC3F19159, 0x65D2BC5A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA Soccer 64 (U) (M3) [b1]", { 0xCA, 0x56, 0xF2, 0xDE, 0x80, 0x83, 0x9E, 0xC8, 0x87, 0x50, 0xC1, 0x5A, 0x21, 0xAA, 0x7C, 0x53 }, NULL, NULL, 0xC3F19159, 0x65D2BC5A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "FIFA Soccer 64 (U) (M3) [o1]", { 0x37, 0xB2, 0x4E, 0xE7, 0x46, 0xA1, 0xEF, 0xD5, 0x47, 0x30, 0xB5, 0xE2, 0x45, 0x51, 0xE8, 0xCB }, NULL, NULL, 0xC3F19159, 0x65D2BC5A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Famista 64 (J) [!]", { 0xD9, 0x9B, 0x1A, 0x3F, 0x6D, 0x72, 0xDE, 0xFD, 0x76, 0xF3, 0x62, 0x09, 0x59, 0xB9, 0x49, 0x44 }, NULL, NULL, 0x6DFF4C37, 0xB1B763FD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x403 },
+    { "Famista 64 (J) [b1]", { 0xEA, 0xCE, 0x22, 0x71, 0xAE, 0x7F, 0x32, 0xA7, 0x16, 0x25, 0xC9, 0x07, 0x41, 0x15, 0xD6, 0x40 }, NULL, NULL, 0x6DFF4C37, 0xB1B763FD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Famista 64 (J) [b2]", { 0xFE, 0x1B, 0x92, 0xF6, 0xA7, 0xE1, 0x5A, 0x1A, 0xF3, 0x67, 0xFA, 0xD9, 0x57, 0x37, 0x5B, 0x20 }, NULL, NULL, 0x6DFF4C37, 0xB1B763FD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Famista 64 (J) [b3]", { 0x4C, 0x9B, 0x28, 0x48, 0xA2, 0xEE, 0xD7, 0x23, 0xC3, 0x31, 0x97, 0x3A, 0x92, 0x64, 0x88, 0xAB }, NULL, NULL, 0x6DFF4C37, 0xB1B763FD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Famista 64 (J) [b4]", { 0x35, 0xF3, 0x92, 0x8F, 0x12, 0xDA, 0x62, 0x7D, 0xB7, 0x9E, 0xDF, 0xC9, 0x6B, 0x93, 0xF8, 0xD3 }, NULL, NULL, 0x6DFF4C37, 0xB1B763FD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Famista 64 (J) [b5]", { 0x92, 0x13, 0x24, 0x31, 0x18, 0xAC, 0xCE, 0x56, 0x64, 0xD1, 0xA3, 0x5C, 0xCD, 0xCC, 0xD8, 0x7E }, NULL, NULL, 0x6DFF4C37, 0xB1B763FD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Famista 64 (J) [b6]", { 0x15, 0x5F, 0xA3, 0x6D, 0xD3, 0x92, 0x7A, 0x73, 0x53, 0x44, 0x61, 0xB5, 0x04, 0x17, 0x32, 0x5F }, NULL, NULL, 0x6DFF4C37, 0xB1B763FD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Famista 64 (J) [b7]", { 0x30, 0x41, 0x36, 0x78, 0xCE, 0x47, 0xE1, 0xA2, 0xEB, 0x8D, 0xA8, 0x0A, 0xF0, 0xD7, 0x68, 0xF5 }, NULL, NULL, 0x6DFF4C37, 0xB1B763FD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Famista 64 (J) [o1]", { 0xAD, 0xAD, 0x4F, 0xF1, 0x8E, 0x09, 0xD2, 0xF5, 0xB2, 0x9A, 0xA6, 0xB5, 0xF1, 0x59, 0xEF, 0x4E }, NULL, NULL, 0x6DFF4C37, 0xB1B763FD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Fighter Destiny 2 (U) [!]", { 0x04, 0xDD, 0x2A, 0x31, 0x9F, 0x4F, 0x5C, 0x22, 0x56, 0x9B, 0x61, 0x2C, 0xFD, 0xF9, 0xF0, 0x0C }, NULL, NULL, 0xAEEF2F45, 0xF97E30F1, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Fighter Destiny 2 (U) [f1] (PAL-NTSC)", { 0x7B, 0x5A, 0xFA, 0x5D, 0x60, 0xF5, 0x3F, 0xA6, 0x40, 0xA5, 0xF2, 0xF2, 0x4F, 0x5B, 0x27, 0x41 }, NULL, NULL, 0x11FBD007, 0xE7029A81, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Fighter's Destiny (E) [!]", { 0xEF, 0x5C, 0xB2, 0x4C, 0xE3, 0xFE, 0x4E, 0x0F, 0x85, 0x09, 0x01, 0x20, 0x54, 0x37, 0xB5, 0x74 }, NULL, NULL, 0x36F1C74B, 0xF2029939, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Fighter's Destiny (F) [!]", { 0x44, 0xB0, 0xBE, 0x1C, 0x4B, 0x48, 0xF6, 0x11, 0x9D, 0x3A, 0xC9, 0x42, 0x49, 0x03, 0xD0, 0xEB }, NULL, NULL, 0x0C41F9C2, 0x01717A0D, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Fighter's Destiny (G) [!]", { 0x1C, 0xF3, 0x79, 0xAC, 0xA2, 0x39, 0x72, 0x22, 0xAF, 0x9F, 0x3D, 0xC5, 0xD8, 0xE3, 0xC4, 0x44 }, NULL, NULL, 0xFE94E570, 0xE4873A9C, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Fighter's Destiny (U) [!]", { 0xD6, 0x1D, 0x97, 0xA7, 0x65, 0x8C, 0x41, 0x9A, 0x25, 0xA9, 0xBA, 0xC9, 0x6B, 0x0A, 0x3D, 0xF8 }, NULL, NULL, 0x52F78805, 0x8B8FCAB7, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Fighter's Destiny (U) [b1]", { 0x6E, 0x7C, 0x82, 0xAF, 0xF9, 0xF7, 0x3A, 0x3D, 0xBF, 0x5B, 0x18, 0xD9, 0x24, 0xBD, 0xF1, 0x03 }, NULL, NULL, 0x52F78805, 0x8B8FCAB7, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Fighter's Destiny (U) [o1]", { 0x5F, 0xB4, 0xDE, 0x8B, 0x47, 0x5C, 0x44, 0x27, 0xF0, 0xF3, 0x0A, 0x28, 0xC1, 0x26, 0x6C, 0xF9 }, NULL, NULL, 0x52F78805, 0x8B8FCAB7, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Fighting Cup (J) [!]", { 0x72, 0x2C, 0x3A, 0x74, 0xA9, 0x03, 0x05, 0xD6, 0x07, 0x9A, 0x37, 0x99, 0x4C, 0xEB, 0xF5, 0xB2 }, NULL, NULL, 0x49E46C2D, 0x7B1A110C, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Fighting Force 64 (E) [!]", { 0x00, 0x35, 0xE8, 0x20, 0x53, 0x36, 0x98, 0x2E, 0x36, 0x24, 0x02, 0xAA, 0xEA, 0x37, 0xD1, 0x47 }, NULL, NULL, 0x66CF0FFE, 0xAD697F9C, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Fighting Force 64 (U) [!]", { 0xE7, 0x00, 0x8D, 0x17, 0xFD, 0x71, 0xD9, 0xC2, 0xBD, 0xA1, 0x36, 0x2C, 0x88, 0x53, 0x88, 0xB2 }, NULL, NULL, 0x32EFC7CB, 0xC3EA3F20, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Fighting Force 64 (U) [T+Ita_Cattivik66]", { 0x13, 0x96, 0x29, 0x10, 0xEF, 0xD8, 0x2C, 0x2A, 0x23, 0x33, 0xCF, 0x38, 0xEE, 0x1F, 0xCD, 0x96 }, NULL, NULL, 0x32EFC7CB, 0xC3EA3F20, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Fighting Force 64 (U) [t1]", { 0x55, 0x86, 0x8E, 0xCC, 0xCC, 0x14, 0xF4, 0x3B, 0xF6, 0x10, 0x32, 0xDE, 0x21, 0xD9, 0xF0, 0x26 }, NULL, NULL, 0x655BE931, 0x9FB2E4FB, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Fighting Force 64 (U) [t1][f1] (PAL)", { 0xF4, 0x27, 0x03, 0x3D, 0x91, 0x84, 0xAC, 0xA1, 0x64, 0xB9, 0x71, 0xE5, 0x59, 0xC0, 0xB4, 0x20 }, NULL, NULL, 0x6976748D, 0x1BF61F62, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Fire Demo by Lac (PD)", { 0x3B, 0x86, 0xA6, 0xC5, 0xB4, 0x78, 0xA0, 0xD3, 0x3A, 0x65, 0x47, 0xD3, 0xEA, 0x27, 0x6A, 0xFE }, NULL, NULL, 0x8E248649, 0x2E1CDE52, 3, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Fireworks Demo by CrowTRobo (PD)", { 0x75, 0xF4, 0xA7, 0xE5, 0x93, 0x2F, 0xB4, 0xAE, 0x79, 0x18, 0x75, 0xE7, 0x70, 0xE5, 0x1C, 0x72 }, NULL, NULL, 0xECAEC238, 0xEE351DDA, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Fish Demo by NaN (PD)", { 0xBD, 0x46, 0xDD, 0x62, 0x75, 0x07, 0x7D, 0x5A, 0x70, 0x14, 0x82, 0x57, 0x1F, 0x5D, 0xCD, 0xCC }, NULL, NULL, 0x5CABD891, 0x6229F6CE, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Flying Dragon (E) [!]", { 0xAD, 0xD1, 0x15, 0xAA, 0xD0, 0xAB, 0x7D, 0x33, 0xBF, 0xD2, 0x43, 0x93, 0x6D, 0x80, 0x91, 0x78 }, NULL, NULL, 0x22E9623F, 0xB60E52AD, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Flying Dragon (U) [!]", { 0x27, 0x2B, 0x35, 0x9D, 0x8F, 0x8A, 0xC4, 0x8A, 0xCB, 0xF0, 0x53, 0xC2, 0x62, 0xF4, 0x22, 0xE4 }, NULL, NULL, 0xA92D52E5, 0x1D26B655, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Flying Dragon (U) [b1]", { 0x46, 0xE9, 0xA3, 0x52, 0xAD, 0x6A, 0xFB, 0x83, 0xB0, 0x55, 0x7E, 0xC6, 0x59, 0x95, 0x7B, 0x2E }, NULL, NULL, 0xA92D52E5, 0x1D26B655, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Flying Dragon (U) [b2]", { 0x1E, 0x67, 0x27, 0x43, 0xA9, 0xB6, 0xB4, 0xE9, 0xDF, 0xB4, 0x0D, 0x40, 0x04, 0x73, 0x5F, 0x38 }, NULL, NULL, 0xA92D52E5, 0x1D26B655, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Fogworld USA Demo by Horizon64 (PD) [h1C][o1]", { 0x17, 0x1E, 0x55, 0xBF, 0x43, 0x83, 0x67, 0x6C, 0x0B, 0x8F, 0x3D, 0x38, 0xB0, 0xD6, 0xA7, 0x39 }, NULL, NULL, 0x11C646E7, 0x4D86C048, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Fogworld USA Demo by Horizon64 (PD)", { 0xB9, 0xA7, 0xBE, 0xFA, 0xDF, 0xC4, 0xC4, 0x6D, 0x61, 0x88, 0x3B, 0x01, 0x2F, 0xD2, 0xE6, 0x9F }, NULL, NULL, 0x11C646E7, 0x4D86C048, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Forsaken 64 (E) (M4) [!]", { 0x82, 0x86, 0xDE, 0xD7, 0x01, 0xDF, 0xA2, 0x24, 0x36, 0xD3, 0x11, 0xBD, 0x5B, 0x93, 0xBD, 0x29 }, NULL, NULL, 0x142A17AA, 0x13028D96, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Forsaken 64 (G) [!]", { 0x74, 0x65, 0x0F, 0x71, 0x54, 0xE0, 0xB2, 0xDD, 0x7C, 0x36, 0x4F, 0x51, 0x1B, 0x0D, 0x6A, 0x77 }, NULL, NULL, 0xC3CD76FF, 0x9B9DCBDE, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Forsaken 64 (G) [h1C]", { 0xF0, 0x23, 0xF3, 0x18, 0x97, 0x22, 0xA9, 0x6A, 0xCD, 0xCF, 0x0B, 0xDD, 0x91, 0x54, 0xEF, 0x11 }, NULL, NULL, 0xC3CD76FF, 0x9B9DCBDE, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Forsaken 64 (G) [o1]", { 0xB7, 0x75, 0xE4, 0xFF, 0x02, 0x05, 0xC4, 0x05, 0xE3, 0xAA, 0x0A, 0x8D, 0xF5, 0x0C, 0x54, 0xDE }, NULL, NULL, 0xC3CD76FF, 0x9B9DCBDE, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Forsaken 64 (U) [!]", { 0x5C, 0xDE, 0xE5, 0x50, 0x3A, 0x57, 0xD1, 0x45, 0x33, 0xC6, 0x6B, 0x35, 0xA5, 0x84, 0x88, 0x99 }, NULL, NULL, 0x9E330C01, 0x8C0314BA, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Forsaken 64 (U) [b1]", { 0xC6, 0x1F, 0xBF, 0x0B, 0xE5, 0x6F, 0xBC, 0xD8, 0xFD, 0x37, 0x3E, 0xDF, 0xB5, 0xD3, 0xE5, 0x38 }, NULL, NULL, 0x9E330C01, 0x8C0314BA, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Forsaken 64 (U) [t1]", { 0x79, 0x5F, 0x7C, 0x1D, 0x3D, 0x98, 0x12, 0x5C, 0x3A, 0xEA, 0x0F, 0xFF, 0xE5, 0x44, 0x10, 0xDE }, NULL, NULL, 0x21FF0391, 0x09F141A1, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Forsaken 64 (U) [t2]", { 0xEC, 0xB9, 0x2E, 0x26, 0x63, 0xD5, 0xB3, 0xEE, 0xA0, 0x8A, 0x14, 0x9F, 0xC3, 0x1E, 0x37, 0x01 }, NULL, NULL, 0x21FF0391, 0x09F141A1, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Forsaken 64 (U) [t3]", { 0xA5, 0x01, 0x82, 0xB0, 0x2E, 0x3F, 0x0D, 0x28, 0xBE, 0x1A, 0xC3, 0x41, 0xDD, 0xC9, 0x2D, 0xCA }, NULL, NULL, 0x5E0C3DF7, 0x8BA027D9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Fox Sports College Hoops '99 (U) [!]", { 0x36, 0x0D, 0xC6, 0xBE, 0x6D, 0x06, 0xDC, 0xA1, 0x2E, 0x53, 0xC0, 0x77, 0xAC, 0x0D, 0x25, 0x71 }, NULL, NULL, 0x3261D479, 0xED0DBC25, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Fox Sports College Hoops '99 (U) [f1] (PAL)", { 0xEE, 0x0C, 0x75, 0x6F, 0x83, 0x28, 0x27, 0xE3, 0xAC, 0xDF, 0x6D, 0xBD, 0x41, 0x0A, 0xDC, 0xA4 }, NULL, NULL, 0x3261D429, 0x70AF148E, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Fractal Zoomer Demo by RedboX (PD)", { 0x5C, 0x44, 0x96, 0xC6, 0xD9, 0x37, 0x36, 0x4D, 0xE0, 0x02, 0x2D, 0x1C, 0x07, 0xBE, 0x38, 0xA1 }, NULL, NULL, 0x30E6FE79, 0x3EEA5386, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Freekworld BBS Intro by Rene (PD) [a1]", { 0x7C, 0x87, 0x83, 0x1B, 0x28, 0xD5, 0xE4, 0x9F, 0x4E, 0xC2, 0xBD, 0xAE, 0x9D, 0x01, 0xF3, 0xB9 }, NULL, NULL, 0x714001E3, 0x2EB04B67, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Freekworld BBS Intro by Rene (PD)", { 0xDE, 0x73, 0x84, 0xA7, 0xDA, 0x97, 0xEE, 0xEA, 0xEF, 0x80, 0xCB, 0xEF, 0xBD, 0x17, 0x96, 0x1A }, NULL, NULL, 0x714001E3, 0x2EB04B67, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Freekworld New Intro by Ste (PD)", { 0x7C, 0xCB, 0x9B, 0x38, 0x5D, 0x14, 0x05, 0x60, 0x3E, 0x7F, 0x64, 0x53, 0x52, 0xEA, 0x62, 0xAA }, NULL, NULL, 0x69458FFE, 0xC9D007AB, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Friendship Demo by Renderman (PD) [b1]", { 0x37, 0x2F, 0x76, 0xC0, 0xDB, 0xE0, 0xBE, 0x41, 0xF5, 0xA0, 0xA4, 0x72, 0x52, 0x86, 0x9E, 0x8E }, NULL, NULL, 0xCEE5C8CD, 0xD3D85466, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Friendship Demo by Renderman (PD)", { 0xC1, 0x8F, 0x1C, 0x91, 0xF6, 0xF1, 0x59, 0x71, 0xDB, 0x18, 0x16, 0x7E, 0xB7, 0x2E, 0x6C, 0xEF }, NULL, NULL, 0xCEE5C8CD, 0xD3D85466, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Frogger 2 (U) (Prototype 1) [!]", { 0x09, 0x71, 0x89, 0xB4, 0xC9, 0xBF, 0x67, 0x75, 0xE4, 0x68, 0x59, 0x51, 0xB6, 0xE6, 0x6F, 0x24 }, NULL, NULL, 0xAD19A172, 0x9004666A, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x403 },
+    { "Frogger 2 (U) (Prototype 2) [!]", { 0xCB, 0x2C, 0x9C, 0x61, 0x04, 0xC3, 0xEF, 0x69, 0xA1, 0xCF, 0x97, 0x95, 0x25, 0xF2, 0xF7, 0x3D }, NULL, NULL, 0xE8E5B179, 0x44AA30E8, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x403 },
+    { "Frogger 2 (U) (Alpha) [o1]", { 0x27, 0xF6, 0x1A, 0x55, 0xE2, 0x7E, 0xA7, 0xF1, 0xED, 0xE4, 0xCA, 0x11, 0x96, 0x6A, 0xCC, 0x7C }, NULL, NULL, 0xE8E5B179, 0x44AA30E8, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x403 },
+    { "Frogger 2 (U) (Alpha) [o2]", { 0xFA, 0x6C, 0xE4, 0x4E, 0xCF, 0x86, 0xDE, 0xC0, 0xAF, 0xA3, 0x21, 0xD8, 0x2C, 0xD3, 0xED, 0x6E }, NULL, NULL, 0xE8E5B179, 0x44AA30E8, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x403 },
+    { "Fushigi no Dungeon - Fuurai no Shiren 2 - Oni Shuurai! Shiren Jou! (J) [!]", { 0xBB, 0xCD, 0xE4, 0x96, 0x6B, 0xEE, 0x56, 0x02, 0xA8, 0x0D, 0x9B, 0x8C, 0x10, 0x11, 0xDF, 0xA6 }, NULL, NULL, 0xF774EAEE, 0xF0D8B13E, 0, SAVETYPE_SRAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "G.A.S.P!! Fighter's NEXTream (E) [!]", { 0x31, 0x6C, 0x59, 0xDA, 0xE4, 0x5C, 0x20, 0x25, 0x0A, 0x04, 0x19, 0xA9, 0x37, 0xE7, 0xD6, 0x5B }, NULL, NULL, 0x68FCF726, 0x49658CBC, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "G.A.S.P!! Fighter's NEXTream (J) [!]", { 0x6C, 0x73, 0x55, 0x8D, 0xE5, 0xA1, 0xEE, 0xE6, 0x59, 0x7D, 0x72, 0x64, 0xF9, 0xA1, 0x1B, 0x0C }, NULL, NULL, 0xAF8679B6, 0x5E1011BF, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "G.A.S.P!! Fighter's NEXTream (J) [o1]", { 0xD7, 0xC9, 0x83, 0xF6, 0x03, 0xEE, 0x7A, 0xE8, 0x15, 0x6C, 0x6E, 0xAE, 0xEF, 0x71, 0x95, 0xC4 }, NULL, NULL, 0xAF8679B6, 0x5E1011BF, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "GBlator for CD64 (PD) [f1] (V64-PAL)", { 0xF6, 0x17, 0x57, 0xBE, 0x8E, 0xCF, 0x0D, 0x70, 0x68, 0xC2, 0x3C, 0xFC, 0xE2, 0x3D, 0x2F, 0x10 }, NULL, NULL, 0x5D1795D2, 0xC0D72338, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GBlator for CD64 (PD)", { 0xEC, 0xE2, 0x32, 0xD9, 0x8B, 0x09, 0x56, 0x04, 0xD1, 0xC1, 0x5F, 0x95, 0x71, 0xDE, 0x45, 0xF8 }, NULL, NULL, 0x5D8B9226, 0x47605A2A, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GBlator for NTSC Dr V64 (PD)", { 0xE3, 0xFD, 0xAB, 0x4E, 0x3C, 0x41, 0x7E, 0x62, 0x3A, 0x02, 0x87, 0x5D, 0x6A, 0x6E, 0x74, 0x67 }, NULL, NULL, 0x5C1AAD1C, 0xAF7BF297, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GBlator for PAL Dr V64 (PD)", { 0x0F, 0x85, 0x54, 0x3F, 0x27, 0x89, 0x68, 0x56, 0xEB, 0x82, 0xC5, 0x2E, 0x3C, 0x7C, 0xCA, 0xB5 }, NULL, NULL, 0x5D0F8DD2, 0x990BE538, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GT 64 - Championship Edition (E) (M3) [!]", { 0x62, 0x8A, 0xA3, 0xCD, 0x49, 0x25, 0x59, 0xB7, 0x05, 0x48, 0x8F, 0x63, 0x47, 0x97, 0xE0, 0x45 }, NULL, NULL, 0xEE4A0E33, 0x8FD588C9, 0, SAVETYPE_EEPROM_16K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "GT 64 - Championship Edition (E) (M3) [b1]", { 0x15, 0xDB, 0x71, 0x69, 0x42, 0xC3, 0x6A, 0x0C, 0xB3, 0x92, 0x22, 0x60, 0x01, 0x53, 0x6A, 0x2A }, NULL, NULL, 0xB6A90FB4, 0xE2C235BA, 0, SAVETYPE_EEPROM_16K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "GT 64 - Championship Edition (E) (M3) [f1] (NTSC)", { 0x69, 0x69, 0xE9, 0x79, 0x39, 0x5A, 0x0A, 0xF6, 0x4C, 0xAF, 0x2D, 0xF9, 0xC1, 0x05, 0x4C, 0x94 }, NULL, NULL, 0xB6A90FB4, 0xE2C235BA, 0, SAVETYPE_EEPROM_16K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "GT 64 - Championship Edition (E) (M3) [f2] (NTSC)", { 0xF3, 0xE2, 0x5D, 0x0A, 0x7B, 0x98, 0xE8, 0xE2, 0x5B, 0x75, 0x70, 0xA6, 0xE0, 0x56, 0xD3, 0x3C }, NULL, NULL, 0x93A292F1, 0xADF98E2E, 0, SAVETYPE_EEPROM_16K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "GT 64 - Championship Edition (U) [!]", { 0xFE, 0x81, 0xAA, 0x38, 0x17, 0x19, 0xFA, 0xDA, 0x69, 0x3D, 0x80, 0x3B, 0xAE, 0x7D, 0x5E, 0xB9 }, NULL, NULL, 0xC49ADCA2, 0xF1501B62, 0, SAVETYPE_EEPROM_16K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "GT 64 - Championship Edition (U) [b1]", { 0x46, 0x95, 0xA9, 0x44, 0xB0, 0x19, 0xF3, 0x82, 0x9F, 0x26, 0x16, 0x59, 0x16, 0x59, 0xA7, 0xCE }, NULL, NULL, 0xC49ADCA2, 0xF1501B62, 0, SAVETYPE_EEPROM_16K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "GT Demo (PD) [a1]", { 0x9B, 0x5A, 0x92, 0xF3, 0x2B, 0x9C, 0x80, 0x7B, 0x2A, 0x9C, 0x01, 0xE4, 0x2E, 0xF8, 0xF4, 0x61 }, NULL, NULL, 0x2575EF19, 0xD13D2A2C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GT Demo (PD)", { 0xC4, 0x1F, 0x0D, 0x1E, 0xDD, 0x2C, 0x82, 0x59, 0xEB, 0x27, 0xA8, 0xC9, 0x7C, 0xAA, 0x3D, 0x71 }, NULL, NULL, 0x2575EF19, 0xD13D2A2C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Game Boy 64 (POM '98) (PD) (Illegal Mode Enabled)", { 0x3D, 0xE0, 0x2C, 0xF3, 0x63, 0xE4, 0xD0, 0x81, 0x53, 0x0F, 0xEF, 0x53, 0xFD, 0xAB, 0x57, 0x80 }, NULL, NULL, 0x97FC2167, 0x4616872B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Game Boy 64 (POM '98) (PD)", { 0x6C, 0x36, 0xE6, 0xA3, 0x9A, 0xBB, 0xAB, 0x3E, 0x91, 0x39, 0xE9, 0xEC, 0xBC, 0x67, 0xE5, 0x69 }, NULL, NULL, 0x97FC2167, 0x4616872B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Game Boy 64 + Super Mario 3 (PD)", { 0x47, 0xC7, 0xDF, 0x82, 0xB3, 0xAD, 0xEA, 0xE1, 0x9C, 0x8A, 0xFA, 0xCE, 0x40, 0xFE, 0xB1, 0xAC }, NULL, NULL, 0x60D0A702, 0x432236C6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GameBooster 64 V1.1 (NTSC) (Unl) [b1]", { 0x7A, 0xD9, 0x54, 0xAD, 0xD3, 0x77, 0x9F, 0xB3, 0xBE, 0x59, 0x04, 0xD1, 0xB9, 0x35, 0xEB, 0xFB }, NULL, NULL, 0x1A5C1CAD, 0x7BAF97F2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GameBooster 64 V1.1 (NTSC) (Unl) [f1]", { 0xC6, 0x0F, 0x99, 0xDC, 0xF6, 0xB0, 0x5F, 0xAA, 0x2C, 0x33, 0x97, 0x04, 0x62, 0xF9, 0x38, 0x65 }, NULL, NULL, 0x5C1AAD1C, 0xAF7BF297, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GameBooster 64 V1.1 (NTSC) (Unl)", { 0x60, 0xD0, 0x26, 0x4B, 0x38, 0xE2, 0x2E, 0xF0, 0xD6, 0xB9, 0x54, 0x9E, 0x4C, 0x81, 0xC2, 0x9F }, NULL, NULL, 0x12678830, 0x4E5AE439, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GameBooster 64 V1.1 (PAL) (Unl) [b1]", { 0xDB, 0x02, 0xD3, 0x65, 0x55, 0xE2, 0x47, 0x3E, 0xA3, 0x03, 0x6B, 0x8E, 0x08, 0x68, 0x25, 0x4E }, NULL, NULL, 0xD06002A7, 0x2243C636, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GameBooster 64 V1.1 (PAL) (Unl) [f1] (Sound)", { 0x4C, 0x38, 0x3E, 0x57, 0xBC, 0x10, 0x62, 0x46, 0x63, 0x28, 0xD0, 0xB5, 0x9F, 0xB7, 0xAA, 0x67 }, NULL, NULL, 0x3BCCD2DB, 0x953FA1F5, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GameBooster 64 V1.1 (PAL) (Unl)", { 0x1A, 0x56, 0xFE, 0x2B, 0x2F, 0xE3, 0x39, 0xC7, 0xDD, 0x4F, 0xF8, 0xD3, 0x7E, 0xC8, 0x65, 0x4B }, NULL, NULL, 0x12678830, 0x4E5AE439, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GameShark Pro V2.0 (Unl)", { 0x43, 0x7E, 0xFD, 0x7F, 0xD7, 0xF8, 0x4F, 0x4C, 0x0F, 0x80, 0x2D, 0x3B, 0xF1, 0xF8, 0x46, 0x4E }, NULL, NULL, 0x16FB52A4, 0x7AED1FB3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GameShark Pro V3.3 (Apr 2000) (Unl) [!]", { 0xF2, 0x75, 0xA4, 0x21, 0x67, 0x44, 0xD8, 0xF0, 0x4B, 0x4A, 0x0C, 0xD7, 0x4D, 0xE5, 0x31, 0x11 }, NULL, NULL, 0xEA6D5BF8, 0xE2B4696C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GameShark Pro V3.3 (Mar 2000) (Unl) [!]", { 0x9F, 0x55, 0x6D, 0x18, 0x4D, 0x94, 0x53, 0x69, 0xDD, 0xD1, 0x1B, 0x5F, 0x81, 0x58, 0x14, 0xA8 }, NULL, NULL, 0x8F89ABA0, 0xC34C2610, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Ganbare Goemon - Derodero Douchuu Obake Tenkomori (J) [!]", { 0x96, 0xCA, 0x36, 0xD4, 0x74, 0xE8, 0x2C, 0x27, 0x0A, 0x12, 0x9D, 0x77, 0x5C, 0x63, 0x16, 0x7A }, NULL, NULL, 0x457B9CD9, 0x09C55352, 0, SAVETYPE_SRAM, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Ganbare Goemon - Derodero Douchuu Obake Tenkomori (J) [t1]", { 0x7E, 0xB0, 0x76, 0x75, 0xE2, 0xE9, 0xCB, 0x54, 0x7A, 0x3B, 0x23, 0x8A, 0xA7, 0x1F, 0x57, 0xCC }, NULL, NULL, 0xBD8E0304, 0x33E3998A, 0, SAVETYPE_SRAM, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Ganbare Goemon - Derodero Douchuu Obake Tenkomori (J) [t2]", { 0x3F, 0x50, 0x71, 0x20, 0x11, 0xBE, 0x1C, 0xB5, 0x9B, 0x45, 0x68, 0x4D, 0x7D, 0x61, 0xF1, 0x1E }, NULL, NULL, 0xA39C0306, 0xF1DD4CC6, 0, SAVETYPE_SRAM, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Ganbare Goemon - Mononoke Sugoroku (J) [!]", { 0x2B, 0xDE, 0x49, 0xF2, 0x85, 0x50, 0x30, 0xDE, 0x34, 0x29, 0x76, 0xC9, 0xA9, 0x5B, 0x81, 0xB3 }, NULL, NULL, 0xB2C6D27F, 0x2DA48CFD, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Ganbare Goemon - Neo Momoyama Bakufu no Odori (J) [!]", { 0x9B, 0x92, 0x9E, 0x0B, 0xF8, 0xD6, 0x3E, 0x62, 0x82, 0x0F, 0x2F, 0xA6, 0x25, 0x7C, 0xC5, 0xCF }, NULL, NULL, 0x832C168B, 0x56A2CDAE, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Ganbare Goemon - Neo Momoyama Bakufu no Odori (J) [b1]", { 0x7F, 0x4E, 0x8F, 0x2E, 0xCF, 0x04, 0xBE, 0x27, 0xE6, 0x60, 0xAC, 0x2E, 0xFD, 0xAC, 0x0C, 0x68 }, NULL, NULL, 0x832C168B, 0x56A2CDAE, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Ganbare Goemon - Neo Momoyama Bakufu no Odori (J) [b2]", { 0x19, 0xBF, 0xC2, 0xC0, 0x12, 0x4C, 0x00, 0x9B, 0x51, 0xFE, 0x17, 0x24, 0xB0, 0x7F, 0xAC, 0x81 }, NULL, NULL, 0x832C168B, 0x56A2CDAE, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Ganbare Goemon - Neo Momoyama Bakufu no Odori (J) [h1C]", { 0xA2, 0xB8, 0x1C, 0x0B, 0x7E, 0x39, 0x89, 0x15, 0x2C, 0xA9, 0x09, 0x01, 0xD0, 0x5E, 0x63, 0x52 }, NULL, NULL, 0x832C168B, 0x56A2CDAE, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Ganbare Goemon - Neo Momoyama Bakufu no Odori (J) [h1C][t1]", { 0xA7, 0xC8, 0x2B, 0xB5, 0x09, 0x8A, 0x75, 0x26, 0xD5, 0x41, 0x7E, 0xE9, 0xA8, 0x98, 0x1F, 0x48 }, NULL, NULL, 0x7BB5698F, 0xD99BF02B, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Ganbare Nippon! Olympics 2000 (J) [!]", { 0x8D, 0x8F, 0x3A, 0x83, 0x93, 0xF3, 0xF5, 0x48, 0x9B, 0x3B, 0x14, 0x43, 0x69, 0x56, 0x55, 0x94 }, NULL, NULL, 0x21FFFD0A, 0xFA0D1D98, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Gauntlet Legends (E) [!]", { 0x28, 0xC2, 0x10, 0x8A, 0x37, 0x5F, 0x77, 0x31, 0xE7, 0x19, 0x33, 0x3A, 0x09, 0x43, 0x9D, 0x2F }, NULL, NULL, 0xD543BCD6, 0x2BA5E256, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Gauntlet Legends (E) [b1]", { 0x08, 0x06, 0xE6, 0xDB, 0x8B, 0x2B, 0xF0, 0x50, 0x1B, 0xE9, 0xF2, 0xD7, 0x8D, 0x28, 0x0D, 0xCF }, NULL, NULL, 0xD543BCD6, 0x2BA5E256, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Gauntlet Legends (J) [!]", { 0x3B, 0x26, 0x15, 0xD7, 0x54, 0xA6, 0x1E, 0x45, 0xB1, 0x03, 0x4D, 0x55, 0x5D, 0x83, 0x0A, 0x78 }, NULL, NULL, 0x70B0260E, 0x6716D04C, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Gauntlet Legends (U) [!]", { 0x9C, 0xB9, 0x63, 0xE8, 0xB7, 0x1F, 0x18, 0x56, 0x8F, 0x78, 0xEC, 0x1A, 0xF1, 0x20, 0x36, 0x2E }, NULL, NULL, 0x729B5E32, 0xB728D980, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Gauntlet Legends (U) [f1] (PAL)", { 0x50, 0xF8, 0xE7, 0x3C, 0xA0, 0x16, 0x0E, 0xB1, 0xA3, 0x39, 0xAC, 0x21, 0x37, 0xA7, 0xB5, 0x59 }, NULL, NULL, 0xAA89A18D, 0x0FC2AFE6, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Getter Love!! (J) [!]", { 0x52, 0x70, 0xD9, 0x8F, 0x9E, 0x67, 0xDC, 0x7E, 0xF3, 0x54, 0xEC, 0xE1, 0x09, 0xC2, 0xA1, 0x8F }, NULL, NULL, 0x489C84E6, 0x4C6E49F9, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Getter Love!! (J) [T+Eng1.01_ozidual]", { 0x0A, 0xC7, 0xA1, 0x6F, 0x8A, 0xFC, 0xC0, 0x30, 0x31, 0x83, 0x5C, 0x89, 0xD0, 0x95, 0xD7, 0xB9 }, NULL, NULL, 0xCDDB4BDF, 0x84E5EFAC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Getter Love!! (J) [b1]", { 0x3B, 0xE1, 0x70, 0xE7, 0xE9, 0x4A, 0x03, 0xBD, 0x4E, 0x36, 0x73, 0x2E, 0xB1, 0x37, 0xEE, 0x39 }, NULL, NULL, 0x489C84E6, 0x4C6E49F9, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Getter Love!! (J) [b2]", { 0x1E, 0x65, 0x73, 0xF2, 0xA7, 0x45, 0x4C, 0x13, 0x3E, 0xB0, 0x5A, 0x14, 0xC1, 0x59, 0x09, 0xA9 }, NULL, NULL, 0x489C84E6, 0x4C6E49F9, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Gex 3 - Deep Cover Gecko (E) (M2) (Fre-Ger) [!]", { 0x43, 0xB9, 0xA7, 0xA5, 0xCC, 0xB6, 0xEA, 0x3F, 0x48, 0x60, 0xF9, 0xF8, 0x0D, 0x73, 0x66, 0x9D }, NULL, NULL, 0x874733A4, 0xA823745A, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Gex 3 - Deep Cover Gecko (E) (M3) (Eng-Spa-Ita) [!]", { 0x9F, 0x04, 0x92, 0xA3, 0x4D, 0x7A, 0x2D, 0x7C, 0x4E, 0x9F, 0x29, 0xDC, 0x18, 0x48, 0xA0, 0x4A }, NULL, NULL, 0x99179359, 0x2FE7EBC3, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Gex 3 - Deep Cover Gecko (U) [!]", { 0x67, 0x70, 0xDD, 0xEC, 0x84, 0xEB, 0x21, 0xA5, 0xE0, 0xD0, 0xF5, 0x5D, 0xFD, 0x52, 0xA0, 0x1A }, NULL, NULL, 0x3EDC7E12, 0xE26C1CC9, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Gex 3 - Deep Cover Gecko (U) [f1] (PAL)", { 0x6E, 0x0F, 0xCF, 0xF9, 0x36, 0x00, 0xA2, 0x8C, 0x37, 0x9E, 0xF5, 0x29, 0x40, 0xC5, 0x4E, 0x68 }, NULL, NULL, 0xE68A9F6E, 0x24FB3315, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Gex 3 - Deep Cover Gecko (U) [t1]", { 0xEF, 0x09, 0x88, 0xEF, 0xDC, 0xEA, 0x31, 0xB8, 0x8A, 0x39, 0x20, 0xCE, 0xEC, 0x17, 0xB4, 0xFF }, NULL, NULL, 0xE6896018, 0x6013AD31, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Gex 64 - Enter the Gecko (E) [!]", { 0x5B, 0xBA, 0x45, 0x7E, 0x28, 0x6D, 0x25, 0x01, 0x01, 0xCE, 0x27, 0x4E, 0x0E, 0x58, 0x08, 0x0D }, NULL, NULL, 0xE68A000E, 0x639166DD, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Gex 64 - Enter the Gecko (U) [!]", { 0x47, 0xF9, 0xD9, 0x00, 0xC9, 0x7E, 0xCE, 0x15, 0x4B, 0xB4, 0x0A, 0x9C, 0x6D, 0xCC, 0xD3, 0xFD }, NULL, NULL, 0x89FED774, 0xCAAFE21B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Gex 64 - Enter the Gecko (U) [f1] (PAL)", { 0xA3, 0x36, 0x77, 0xB0, 0x48, 0x70, 0xDE, 0x18, 0x01, 0x3B, 0x76, 0x0B, 0x4F, 0x53, 0xF6, 0xBF }, NULL, NULL, 0x4445612B, 0xF8CC9F8B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Gex 64 - Enter the Gecko (U) [t1]", { 0x68, 0x82, 0x8B, 0xDC, 0xAA, 0xE1, 0xC2, 0x22, 0xDA, 0xBB, 0x67, 0x9B, 0x74, 0xB8, 0xAC, 0xD0 }, NULL, NULL, 0x71ED5D14, 0x76A110D0, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Ghemor - CD64 Xfer & Save Util (CommsLink) by CrowTRobo (PD)", { 0x34, 0x19, 0xEC, 0x10, 0xEE, 0x47, 0x0F, 0x18, 0x88, 0x81, 0x1D, 0x4A, 0x9B, 0x5F, 0xAA, 0xCE }, NULL, NULL, 0x2F67DC59, 0x74AAD9F1, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Ghemor - CD64 Xfer & Save Util (Parallel) by CrowTRobo (PD)", { 0x20, 0xDA, 0x03, 0xC2, 0x09, 0x8F, 0x83, 0xA7, 0x90, 0xE9, 0x29, 0xAC, 0x9A, 0x4C, 0xDB, 0x2E }, NULL, NULL, 0x0D99E899, 0x43E0FCD1, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Glover (E) (M3) [!]", { 0x2F, 0x21, 0x63, 0xC5, 0x3D, 0xB1, 0x35, 0x79, 0x23, 0x31, 0xDF, 0x00, 0x39, 0x8B, 0x3F, 0x87 }, NULL, NULL, 0xF5237301, 0x99E3EE93, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Glover (E) (M3) [f1] (NTSC)", { 0x88, 0x81, 0xFB, 0xEA, 0xE9, 0xB8, 0x44, 0x85, 0xCF, 0x66, 0x87, 0x6B, 0x60, 0xCD, 0x45, 0xDF }, NULL, NULL, 0x4D2B5318, 0x47DB5316, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Glover (Prototype)", { 0x43, 0xC3, 0x37, 0x5B, 0xBD, 0x64, 0x96, 0xB6, 0xC5, 0x1D, 0x08, 0xEC, 0x19, 0x3B, 0xC8, 0xED }, NULL, NULL, 0x254CC736, 0x6F5C721B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Glover (U) [!]", { 0x87, 0xAA, 0x57, 0x40, 0xDF, 0xF7, 0x92, 0x91, 0xEE, 0x97, 0x83, 0x2D, 0xA1, 0xF8, 0x62, 0x05 }, NULL, NULL, 0x8E6E01FF, 0xCCB4F948, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Glover (U) [b1]", { 0xA1, 0xC3, 0x47, 0x17, 0x47, 0x60, 0x27, 0xDF, 0xBA, 0x72, 0xEE, 0xA5, 0x6F, 0x94, 0xD6, 0x50 }, NULL, NULL, 0x0E450FFC, 0x9FFC8375, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Glover (U) [b2]", { 0x87, 0x3D, 0xC6, 0x33, 0x04, 0xF6, 0x32, 0xA7, 0x1B, 0x30, 0x99, 0x88, 0xC3, 0x9C, 0x48, 0xF7 }, NULL, NULL, 0x7773E2BB, 0x71D0A925, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Glover (U) [t1]", { 0x87, 0x61, 0x58, 0x22, 0xA0, 0xE0, 0x0D, 0xD4, 0xFC, 0x7F, 0xDF, 0x63, 0x6D, 0x4B, 0x81, 0x39 }, NULL, NULL, 0x51938192, 0xBD4A98A1, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Glover 2 - Unreleased Beta Version (New Build) (Prototype)", { 0x4E, 0x15, 0xD9, 0x2C, 0xCA, 0x23, 0xE1, 0xA0, 0x1B, 0xB6, 0x52, 0x46, 0x43, 0x1B, 0x5C, 0x5A }, NULL, NULL, 0x8E9F21D2, 0xDC19C5AB, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Glover 2 (Prototype)", { 0xA8, 0x56, 0x7D, 0xDA, 0xBD, 0x36, 0x72, 0xFF, 0xF1, 0x8B, 0xC5, 0xDF, 0x93, 0x3C, 0xF8, 0xC7 }, NULL, NULL, 0xB7F40BCF, 0x553556A5, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Goemon's Great Adventure (U) [!]", { 0x29, 0xBC, 0x5C, 0x1A, 0x24, 0xD3, 0x97, 0x9D, 0x37, 0x6A, 0xD4, 0x21, 0x00, 0x0A, 0xC9, 0xCB }, NULL, NULL, 0x4252A5AD, 0xAE6FBF4E, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Golden Nugget 64 (U) [!]", { 0x23, 0x1B, 0xAC, 0x1A, 0xFB, 0x3D, 0xE1, 0x38, 0x07, 0x2C, 0x2D, 0x69, 0x77, 0x83, 0x05, 0x9B }, NULL, NULL, 0x4690FB1C, 0x4CD56D44, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Golden Nugget 64 (U) [b1]", { 0x7C, 0xE2, 0x8A, 0xDA, 0xB6, 0xFE, 0x43, 0x20, 0x7B, 0x4B, 0xB1, 0x95, 0x64, 0xC3, 0x8A, 0xEF }, NULL, NULL, 0x4690FB1C, 0x4CD56D44, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Golden Nugget 64 (U) [b2]", { 0x53, 0x40, 0xDD, 0x96, 0xCF, 0x1C, 0xD7, 0xAC, 0x6D, 0x72, 0x00, 0x0D, 0x40, 0xB9, 0x15, 0xCE }, NULL, NULL, 0x4690FB1C, 0x4CD56D44, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Golden Nugget 64 (U) [b3]", { 0xE0, 0x48, 0xC2, 0xFE, 0x22, 0x66, 0x34, 0xF0, 0x39, 0x88, 0x2C, 0x35, 0xA2, 0xA4, 0xEE, 0xA9 }, NULL, NULL, 0x4690FB1C, 0x4CD56D44, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Golden Nugget 64 (U) [b3][f1] (PAL)", { 0x2D, 0xB6, 0xED, 0x9A, 0x6A, 0x24, 0x4C, 0xB2, 0x09, 0xFF, 0xDF, 0x52, 0xD9, 0x00, 0x6E, 0x4D }, NULL, NULL, 0x438CEBDC, 0x44C1837C, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Golden Nugget 64 (U) [b3][h1C]", { 0xF6, 0x8F, 0x02, 0xA6, 0x98, 0x29, 0x46, 0x9F, 0x20, 0x8D, 0x53, 0x8D, 0x7C, 0xF4, 0xA2, 0x15 }, NULL, NULL, 0x4690FB1C, 0x4CD56D44, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "GoldenEye 007 (E) [!]", { 0xCF, 0xF6, 0x9B, 0x70, 0xA8, 0xAD, 0x67, 0x4A, 0x0E, 0xFE, 0x55, 0x58, 0x76, 0x58, 0x55, 0xC9 }, NULL, NULL, 0x0414CA61, 0x2E57B8AA, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (E) [T+Spa2.0_Sogun&IlDucci]", { 0x6E, 0x23, 0xE6, 0xBA, 0xD2, 0x8F, 0x8A, 0xC5, 0xC0, 0x73, 0x44, 0xDC, 0xB0, 0xC2, 0x66, 0xB8 }, NULL, NULL, 0x625E0850, 0x1F1B2327, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (E) [b1]", { 0xEC, 0xD4, 0xF0, 0x78, 0xDC, 0x77, 0xF4, 0xB2, 0xD1, 0x2C, 0x1C, 0x0F, 0x5C, 0xAB, 0xA3, 0x23 }, NULL, NULL, 0x0414CA61, 0x2E57B8AA, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (E) [h1C]", { 0xD8, 0x3B, 0xDE, 0x15, 0x6D, 0x6F, 0xC4, 0x00, 0xC2, 0x83, 0x08, 0xA4, 0x47, 0xB8, 0xFC, 0xA0 }, NULL, NULL, 0x0414CA61, 0x2E57B8AA, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (E) [t1] (Rapid Fire)", { 0xF7, 0xA0, 0xEF, 0xCF, 0x8D, 0xB9, 0x0F, 0xBD, 0x6F, 0xD9, 0xBF, 0xC5, 0x70, 0xA4, 0x80, 0x4A }, NULL, NULL, 0x540F359D, 0xFF327745, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (J) [!]", { 0x18, 0x80, 0xDA, 0x35, 0x8F, 0x87, 0x5C, 0x07, 0x40, 0xD4, 0xA6, 0x73, 0x1E, 0x11, 0x01, 0x09 }, NULL, NULL, 0xA24F4CF1, 0xA82327BA, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (J) [t1] (Rapid Fire)", { 0xFB, 0x91, 0x6F, 0x91, 0x4D, 0x96, 0x35, 0xF8, 0xFC, 0xBC, 0xE3, 0x7A, 0x64, 0x66, 0x07, 0x9D }, NULL, NULL, 0xB244B30C, 0x72A648D8, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (U) (Frozen Enemies Hack)", { 0x3A, 0xA7, 0xD5, 0xF5, 0x5E, 0x3E, 0x5E, 0x6C, 0x74, 0x19, 0xCC, 0x16, 0x25, 0xAF, 0x69, 0xBC }, NULL, NULL, 0xDCBCACD1, 0xD72FAA33, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GoldenEye 007 (E) (Citadel Hack)", { 0x9A, 0xB9, 0xFB, 0x97, 0x82, 0xC7, 0xBB, 0x42, 0xA4, 0x8C, 0x14, 0x65, 0xCD, 0x8F, 0x4E, 0xF6 }, NULL, NULL, 0x44853212, 0xB1F75C3E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GoldenEye 007 (U) (Citadel Hack)", { 0xEC, 0xAB, 0x08, 0x39, 0xD3, 0xED, 0x0E, 0x3A, 0xA8, 0x51, 0x6E, 0xF1, 0xC0, 0x77, 0xCF, 0x0D }, NULL, NULL, 0x1C6F7718, 0xCBAC1E7E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GoldenEye 007 (U) (G5 Multi (for backups) Hack)", { 0x7D, 0xD2, 0xF0, 0xE1, 0x9E, 0x35, 0x51, 0x1C, 0x3E, 0x1C, 0x81, 0xD2, 0x06, 0xCD, 0xC4, 0x72 }, NULL, NULL, 0xF2C3A524, 0xA1C4DB13, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GoldenEye 007 (U) (G5 Multi Hack)", { 0xF4, 0xAB, 0x4C, 0xD6, 0xA8, 0xAF, 0x21, 0xE8, 0xA5, 0x1B, 0xF4, 0x85, 0x78, 0xCC, 0x7F, 0x24 }, NULL, NULL, 0xDCBC50D1, 0x09FD1AA3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GoldenEye 007 (U) (Tetris Hack)", { 0xFD, 0x35, 0xD8, 0xA9, 0xDE, 0x0F, 0x5A, 0xB5, 0x00, 0xA5, 0x88, 0xA6, 0xAB, 0x5F, 0x6F, 0xB9 }, NULL, NULL, 0xA84D23BA, 0xA1974DBD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GoldenEye 007 (U) (God Mode Hack)", { 0x3B, 0xC5, 0x05, 0x11, 0xDE, 0x85, 0x98, 0xA4, 0x9E, 0x79, 0xF4, 0xCF, 0x2E, 0x4C, 0xF8, 0xE0 }, NULL, NULL, 0xDCBCACD1, 0xE1051EA6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GoldenEye 007 (U) (No Music Hack)", { 0x86, 0xC6, 0xB9, 0x96, 0xA5, 0x5F, 0x90, 0xFC, 0x24, 0x10, 0xB1, 0x6A, 0xE4, 0xBA, 0x5E, 0xE0 }, NULL, NULL, 0xDCBCACD1, 0xA67DDFB4, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GoldenEye 007 (U) (No Power Bar Hack)", { 0x15, 0xB5, 0x7C, 0xDE, 0xCA, 0x50, 0x6B, 0x34, 0xFF, 0x62, 0x46, 0xED, 0x06, 0xAA, 0xBD, 0x50 }, NULL, NULL, 0xDCBCACD1, 0xF294D541, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GoldenEye 007 (U) [!]", { 0x70, 0xC5, 0x25, 0x88, 0x02, 0x40, 0xC1, 0xE8, 0x38, 0xB8, 0xB1, 0xBE, 0x35, 0x66, 0x6C, 0x3B }, NULL, NULL, 0xDCBC50D1, 0x09FD1AA3, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (U) [T+Spa2.0_Sogun&IlDucci]", { 0x78, 0xF8, 0x35, 0x25, 0xE0, 0xCC, 0x98, 0x64, 0x1A, 0xEA, 0xCE, 0x37, 0xE3, 0xFF, 0x7F, 0x16 }, NULL, NULL, 0x3A03E50F, 0xE78D1CA7, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (U) [b1]", { 0x0B, 0x5A, 0x50, 0xE8, 0xD4, 0x77, 0xB3, 0xBC, 0x53, 0xBE, 0x99, 0x72, 0x64, 0xFE, 0x84, 0xA5 }, NULL, NULL, 0xDCBC50D1, 0x09FD1AA3, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (U) [h1C]", { 0xC7, 0xA2, 0x2D, 0xC5, 0xD9, 0x5E, 0xBE, 0x1F, 0x8E, 0xDB, 0x0D, 0x68, 0xC1, 0x30, 0x27, 0xC1 }, NULL, NULL, 0xDCBC50D1, 0x09FD1AA3, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (U) [o1]", { 0x22, 0xFF, 0x6C, 0x18, 0xEB, 0x02, 0x87, 0x92, 0xEF, 0x35, 0x05, 0x54, 0xB1, 0xE1, 0xFA, 0x68 }, NULL, NULL, 0xDCBC50D1, 0x09FD1AA3, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (U) [o2]", { 0x6B, 0x8B, 0xA0, 0x63, 0xC4, 0x04, 0x20, 0xC1, 0x64, 0xAA, 0x81, 0xAC, 0xB6, 0x08, 0x9C, 0xB6 }, NULL, NULL, 0xDCBC50D1, 0x09FD1AA3, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (U) [t1] (Rapid Fire)", { 0x18, 0xC0, 0x0B, 0x5C, 0x3D, 0x9D, 0xF0, 0x9A, 0xB9, 0xE8, 0xA7, 0x37, 0xE6, 0x1C, 0x3B, 0x47 }, NULL, NULL, 0xE09DAF6C, 0x8A2B86F4, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (U) [t2]", { 0x2E, 0x50, 0xBC, 0x85, 0x3F, 0x6E, 0xFC, 0x1E, 0x0D, 0x5E, 0x46, 0x79, 0x73, 0x9F, 0x43, 0xC4 }, NULL, NULL, 0x8E1B3303, 0x9D4F5035, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 (U) [t3] (All Guns Zoom Mode)", { 0x95, 0xB7, 0x84, 0xD6, 0xDD, 0x34, 0x70, 0x90, 0x3B, 0xAF, 0x6B, 0xBB, 0x53, 0x3E, 0x08, 0x8B }, NULL, NULL, 0x1C6F7718, 0xCBAC1E7E, 4, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "GoldenEye 007 Intro by SonCrap (PD)", { 0xAD, 0x3D, 0x09, 0x9C, 0x84, 0x09, 0x6D, 0xBA, 0xCA, 0xD7, 0xF1, 0xCF, 0x98, 0x26, 0x31, 0xB2 }, NULL, NULL, 0x9303DD17, 0x0813B398, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "GoldenEye X", { 0x67, 0xF2, 0xE1, 0x8E, 0xD1, 0x8A, 0x5F, 0x0E, 0xA3, 0xFE, 0x2D, 0x91, 0x3E, 0x3F, 0x17, 0x86 }, NULL, NULL, 0xFDF95D15, 0x618546CA, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x63B },
+    { "GoldenEye X", { 0x43, 0x5D, 0x75, 0xD0, 0x78, 0x78, 0xD3, 0x05, 0x29, 0x3E, 0xC4, 0xD5, 0x91, 0xB8, 0x63, 0x03 }, NULL, NULL, 0xE8B3F63D, 0xE5A997B1, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x63B },
+    { "GoldenEye 007 (UE) (Switch Online) [!]", { 0xEA, 0x0E, 0x3E, 0x6A, 0xEF, 0xA5, 0x87, 0x38, 0xA1, 0x29, 0x06, 0x29, 0x83, 0x73, 0x21, 0x8B }, NULL, NULL, 0xDCBC50D1, 0x09FD1AA3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "HIPTHRUST by MooglyGuy (PD)", { 0x9B, 0x8A, 0x75, 0x41, 0xD0, 0x23, 0x4F, 0x4D, 0x97, 0x00, 0x4E, 0xCB, 0xC2, 0x16, 0xD9, 0xC2 }, NULL, NULL, 0x88A12FB3, 0x8A583CBD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "HSD Quick Intro (PD)", { 0x82, 0x1A, 0x73, 0x97, 0x90, 0xF1, 0xD3, 0x90, 0xDC, 0x7D, 0x41, 0x68, 0xC5, 0xE0, 0x32, 0xDE }, NULL, NULL, 0xBD1263E5, 0x388C9BE7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "HSV Adventure Racing (A) [!]", { 0x26, 0xF7, 0xD8, 0xF4, 0x64, 0x0E, 0xBD, 0xFA, 0x82, 0x3F, 0x84, 0xE5, 0xF8, 0x9D, 0x62, 0xBF }, NULL, NULL, 0x72611D7D, 0x9919BDD2, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "HSV Adventure Racing (A) [b1]", { 0x7B, 0x38, 0xC3, 0xF7, 0xDA, 0x8D, 0x97, 0x78, 0xB4, 0x1B, 0x00, 0x47, 0xA1, 0x33, 0x59, 0x0A }, NULL, NULL, 0x72611D7D, 0x9919BDD2, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "HSV Adventure Racing (A) [f1] (NTSC)", { 0x8C, 0x7A, 0xF3, 0x7A, 0x3C, 0xB7, 0x30, 0x6E, 0xBC, 0xCA, 0xC4, 0x02, 0x9E, 0xB5, 0xC5, 0x7D }, NULL, NULL, 0xB20CC247, 0xB879579A, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hamster Monogatari 64 (J) [!]", { 0x3D, 0x4C, 0x7B, 0x11, 0x07, 0x6B, 0xAF, 0xA4, 0x62, 0x0B, 0xCC, 0x15, 0x4C, 0x0E, 0xEE, 0xF3 }, NULL, NULL, 0x95A80114, 0xE0B72A7F, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x453 },
+    { "Hard Coded Demo by Silo and Fractal (PD) [a1]", { 0x61, 0x71, 0x97, 0xEF, 0x2B, 0x6B, 0x51, 0xE5, 0x84, 0x88, 0xC9, 0xF6, 0xB7, 0x5F, 0x11, 0x2E }, NULL, NULL, 0x775AFA9C, 0x0EB52EF6, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x43 },
+    { "Hard Coded Demo by Silo and Fractal (PD)", { 0xFB, 0x89, 0x74, 0xC6, 0x13, 0x0A, 0x6B, 0x85, 0x85, 0xEA, 0x98, 0xD6, 0x66, 0x15, 0x53, 0xBC }, NULL, NULL, 0x775AFA9C, 0x0EB52EF6, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x43 },
+    { "Hard Pom '99 Demo by TS_Garp (POM '99) (PD)", { 0x19, 0x39, 0x13, 0xBB, 0x06, 0x3F, 0x3D, 0x94, 0x50, 0x19, 0xE8, 0xF7, 0x65, 0xF4, 0x8F, 0x1C }, NULL, NULL, 0x9856E53D, 0xAF483207, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Harukanaru Augusta Masters 98 (J) [!]", { 0xA0, 0x2A, 0x4F, 0xB4, 0xB9, 0x3E, 0x98, 0x47, 0x34, 0x84, 0x40, 0x65, 0x2C, 0xEF, 0x8D, 0x4D }, NULL, NULL, 0x09AE57B1, 0x182A5637, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Harukanaru Augusta Masters 98 (J) [b1]", { 0x39, 0x7A, 0x69, 0xAA, 0x38, 0x29, 0xEA, 0x5F, 0xEC, 0xB4, 0xCD, 0xF3, 0x99, 0x08, 0x4E, 0x31 }, NULL, NULL, 0x09AE57B1, 0x182A5637, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Harukanaru Augusta Masters 98 (J) [b2]", { 0xFA, 0x6B, 0x3E, 0x3A, 0x04, 0xDE, 0x8D, 0x96, 0xB2, 0xC2, 0x6F, 0x97, 0x4F, 0x59, 0xA3, 0x4D }, NULL, NULL, 0x09AE57B1, 0x182A5637, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Harukanaru Augusta Masters 98 (J) [h1C]", { 0x44, 0x54, 0x12, 0x2E, 0xC7, 0x35, 0x25, 0x2E, 0x40, 0xEC, 0x22, 0xFF, 0x5D, 0xE0, 0x21, 0xC6 }, NULL, NULL, 0x09AE57B1, 0x182A5637, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Harvest Moon 64 (U) [!]", { 0x6D, 0xA8, 0x48, 0xA7, 0x0D, 0x83, 0xEC, 0xE1, 0x30, 0xD2, 0x74, 0x12, 0x47, 0x60, 0x92, 0x8E }, NULL, NULL, 0x98DF9DFC, 0x6606C189, 0, SAVETYPE_SRAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Harvest Moon 64 (U) [T+Pol001]", { 0x3C, 0xDD, 0x87, 0x02, 0x6E, 0xFE, 0xC9, 0xA0, 0x36, 0x48, 0xD2, 0x25, 0xF9, 0x78, 0x58, 0xA5 }, NULL, NULL, 0x98DF9DFC, 0x6606C189, 0, SAVETYPE_SRAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Harvest Moon 64 (U) [b1]", { 0x24, 0x5F, 0xD6, 0xD7, 0x74, 0xB7, 0x4D, 0x47, 0x03, 0x82, 0x25, 0x11, 0xCA, 0x17, 0x4A, 0x54 }, NULL, NULL, 0x98DF9DFC, 0x6606C189, 0, SAVETYPE_SRAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Harvest Moon 64 (U) [f1] (PAL)", { 0x21, 0x8D, 0xE5, 0xB3, 0x70, 0x95, 0x55, 0xDA, 0x38, 0x70, 0xCE, 0x85, 0x9D, 0x19, 0x75, 0xE5 }, NULL, NULL, 0x6BCF21E8, 0xCAB5AF4F, 0, SAVETYPE_SRAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Harvest Moon 64 (U) [t1]", { 0x95, 0x6A, 0xEC, 0x11, 0x1B, 0x74, 0x72, 0x0D, 0x55, 0x49, 0x6F, 0x81, 0xAD, 0xA0, 0xFE, 0xFD }, NULL, NULL, 0x60CC9644, 0xC62AE877, 0, SAVETYPE_SRAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Harvest Moon 64 (U) [t1][f1] (PAL-NTSC)", { 0x54, 0xAD, 0x82, 0x38, 0x12, 0xD2, 0xC2, 0xE8, 0xB1, 0x68, 0x8C, 0x4A, 0xCE, 0x2E, 0x65, 0x4D }, NULL, NULL, 0x60CC9644, 0xC62AE877, 0, SAVETYPE_SRAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Heavy 64 Demo by Destop (PD)", { 0x19, 0xF4, 0x69, 0x4B, 0x85, 0x57, 0xBC, 0x09, 0x5E, 0xE0, 0x7B, 0x5C, 0x8F, 0xBD, 0x23, 0xB5 }, NULL, NULL, 0x5D391A40, 0x84D7A637, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Heiwa Pachinko World 64 (J) [!]", { 0x5E, 0x85, 0x39, 0xE0, 0x37, 0xEE, 0xA8, 0x8C, 0x5A, 0x27, 0x46, 0xF6, 0x0E, 0x43, 0x1C, 0x8D }, NULL, NULL, 0x3E70E866, 0x4438BAE8, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Heiwa Pachinko World 64 (J) [T+Eng1.0_Zoinkity]", { 0x78, 0xE2, 0xED, 0x1D, 0xB5, 0xF9, 0x0E, 0x2E, 0xA9, 0xC0, 0x47, 0x71, 0xB2, 0x76, 0x85, 0xBC }, NULL, NULL, 0x3AE679E2, 0x1A3C42DB, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Heiwa Pachinko World 64 (J) [b1]", { 0x9D, 0x0D, 0x85, 0xE3, 0xA0, 0xC9, 0x4B, 0x98, 0xD6, 0x40, 0x4E, 0x8F, 0xC2, 0x8E, 0x7B, 0x01 }, NULL, NULL, 0x3E70E866, 0x4438BAE8, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Heiwa Pachinko World 64 (J) [b2]", { 0xC2, 0xBE, 0xDC, 0xB3, 0x64, 0x16, 0x2D, 0x6D, 0xAC, 0x86, 0x54, 0x8D, 0x77, 0x21, 0xF8, 0x27 }, NULL, NULL, 0x3E70E866, 0x4438BAE8, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Heiwa Pachinko World 64 (J) [b3]", { 0x3B, 0x69, 0x94, 0xB3, 0x73, 0xBE, 0xC6, 0xE9, 0x17, 0xF0, 0xB8, 0x34, 0xAA, 0x6D, 0x1A, 0x46 }, NULL, NULL, 0x3E70E866, 0x4438BAE8, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Heiwa Pachinko World 64 (J) [h1C]", { 0x01, 0x3E, 0x13, 0x0D, 0x0D, 0x4F, 0x13, 0x27, 0x41, 0xAA, 0x38, 0xD1, 0xA3, 0x97, 0xE1, 0x0A }, NULL, NULL, 0x3E70E866, 0x4438BAE8, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Heiwa Pachinko World 64 (J) [o1]", { 0xFD, 0xF7, 0x97, 0xC5, 0xFF, 0xB5, 0x31, 0xFC, 0xF0, 0x4E, 0x0A, 0x19, 0x28, 0x69, 0x1E, 0xA3 }, NULL, NULL, 0x3E70E866, 0x4438BAE8, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Hercules - The Legendary Journeys (E) (M6) [!]", { 0x15, 0x46, 0x87, 0x7F, 0xD8, 0x5C, 0x00, 0xA8, 0x35, 0x15, 0x00, 0x57, 0x27, 0xE5, 0xFD, 0xA5 }, NULL, NULL, 0xAE90DBEB, 0x79B89123, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hercules - The Legendary Journeys (U) [!]", { 0x6B, 0xBD, 0x8C, 0x42, 0xF6, 0xEF, 0x8F, 0x5B, 0x95, 0x41, 0xD6, 0xF4, 0xDB, 0x65, 0x7D, 0xD7 }, NULL, NULL, 0x7F3CEB77, 0x8981030A, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hercules - The Legendary Journeys (U) [o1]", { 0x57, 0xD8, 0xE0, 0x20, 0x64, 0x31, 0x46, 0xB3, 0x25, 0xA1, 0x16, 0x12, 0xFE, 0xFA, 0xCF, 0x74 }, NULL, NULL, 0x7F3CEB77, 0x8981030A, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hercules - The Legendary Journeys (U) [t1][f1] (PAL-NTSC)", { 0x8C, 0xF8, 0x04, 0x3B, 0xDF, 0xA8, 0x9A, 0x2B, 0x0C, 0x46, 0x99, 0xD0, 0xE6, 0x95, 0xE8, 0x44 }, NULL, NULL, 0xDB7184C9, 0xF53AC14A, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hercules - The Legendary Journeys (U) [t1][f1][b1]", { 0xC2, 0xC3, 0x11, 0x58, 0x21, 0xC7, 0x38, 0xA4, 0x83, 0x4E, 0x97, 0x7E, 0x83, 0x25, 0xF8, 0x9E }, NULL, NULL, 0xDB7184C9, 0xF53AC14A, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hercules - The Legendary Journeys (U) [t1][f2] (PAL-NTSC)", { 0x3F, 0x1C, 0xF2, 0xD6, 0xC1, 0x58, 0x0F, 0xDC, 0xCD, 0x66, 0x2F, 0x9F, 0xCF, 0x8C, 0x42, 0x14 }, NULL, NULL, 0xDB7184C9, 0xF53AC14A, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hexen (E) [!]", { 0x20, 0x80, 0x26, 0x2A, 0x25, 0x1D, 0x27, 0x0F, 0x9C, 0xE8, 0x19, 0x88, 0x7F, 0x21, 0x04, 0xA7 }, NULL, NULL, 0x95B2B30B, 0x2B6415C1, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Hexen (E) [h1C]", { 0xE8, 0x6A, 0x8B, 0xF4, 0x69, 0x85, 0xB7, 0xCE, 0x84, 0x59, 0xAF, 0xBE, 0x5F, 0xC3, 0xDC, 0xC3 }, NULL, NULL, 0x95B2B30B, 0x2B6415C1, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Hexen (F) [!]", { 0xA5, 0x92, 0x1C, 0x00, 0x11, 0x12, 0x00, 0x25, 0x72, 0x84, 0xCE, 0x0A, 0xBA, 0x09, 0x04, 0xCA }, NULL, NULL, 0x5C1B5FBD, 0x7E961634, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Hexen (G) [!]", { 0x08, 0xCB, 0xB1, 0x41, 0xDE, 0xC6, 0x04, 0xE4, 0xDA, 0xD2, 0x78, 0x7F, 0x23, 0x7D, 0x57, 0xA2 }, NULL, NULL, 0x9AB3B50A, 0xBC666105, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Hexen (G) [h1C]", { 0x35, 0xE9, 0xEC, 0xE1, 0x13, 0x06, 0xEF, 0x7D, 0x8F, 0x5F, 0x09, 0xF6, 0x57, 0x61, 0xD3, 0x65 }, NULL, NULL, 0x9AB3B50A, 0xBC666105, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Hexen (J) [!]", { 0x67, 0x21, 0x52, 0xCF, 0x4D, 0xCB, 0x5D, 0x0A, 0x19, 0x66, 0x2C, 0x11, 0xEF, 0xF7, 0x14, 0x52 }, NULL, NULL, 0x66751A57, 0x54A29D6E, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Hexen (U) [!]", { 0xEB, 0x98, 0xF1, 0xB8, 0xC6, 0x89, 0x8A, 0xF7, 0x41, 0x7F, 0x68, 0x82, 0x94, 0x6D, 0xA9, 0xB3 }, NULL, NULL, 0x9CAB6AEA, 0x87C61C00, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Hexen (U) [b1]", { 0xB0, 0x66, 0x25, 0x70, 0x3D, 0xB3, 0xA0, 0x3B, 0xAE, 0x3D, 0x02, 0xFD, 0x0F, 0x90, 0x45, 0x41 }, NULL, NULL, 0x9CAB6AEA, 0x87C61C00, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Hexen (U) [h1C]", { 0xEA, 0x5A, 0x22, 0xA5, 0xA2, 0xDA, 0x96, 0xD8, 0x89, 0x39, 0x17, 0x1C, 0xEA, 0x41, 0xA1, 0xF1 }, NULL, NULL, 0x9CAB6AEA, 0x87C61C00, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Hexen (U) [t1]", { 0x93, 0x01, 0x92, 0x3A, 0xE9, 0x38, 0x32, 0x0F, 0xF0, 0x18, 0x6B, 0x72, 0x79, 0xAF, 0xE6, 0xD8 }, NULL, NULL, 0xE6BA0A06, 0x8A3D2C2F, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Hexen (U) [t2]", { 0x59, 0xBA, 0x99, 0x12, 0x0B, 0xE9, 0xD4, 0x38, 0xC5, 0x3E, 0xAE, 0xD6, 0x09, 0x1B, 0x9B, 0x7D }, NULL, NULL, 0xE6BA0A06, 0x8A3D2C2F, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Hey You, Pikachu! (U) [!]", { 0x12, 0x80, 0xC7, 0x8F, 0x28, 0x6F, 0xC1, 0xC4, 0x37, 0xA4, 0x90, 0x5E, 0xE4, 0x2C, 0x47, 0xF1 }, NULL, NULL, 0xD3F10E5D, 0x052EA579, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 88, 0x203B },
+    { "HiRes CFB Demo (PD)", { 0xDC, 0xC3, 0x16, 0xEF, 0xFC, 0x49, 0x28, 0xF5, 0xB0, 0xAE, 0x8D, 0x27, 0x3D, 0x80, 0x24, 0xBF }, NULL, NULL, 0x4072572D, 0xA23DB72C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Hiryuu no Ken Twin (J) [!]", { 0x73, 0x08, 0x44, 0x95, 0xF3, 0x20, 0x9C, 0x54, 0x90, 0x05, 0x25, 0x43, 0x6B, 0xBB, 0xC5, 0x31 }, NULL, NULL, 0x35FF8F1A, 0x6E79E3BE, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hiryuu no Ken Twin (J) [h1C]", { 0x89, 0x76, 0x91, 0x3E, 0xFB, 0xE9, 0x8E, 0xFE, 0xD3, 0xB0, 0xB3, 0x2C, 0xBC, 0xAA, 0x8B, 0x49 }, NULL, NULL, 0x35FF8F1A, 0x6E79E3BE, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hiryuu no Ken Twin (J) [h2C]", { 0xE0, 0xC3, 0x9E, 0x55, 0xDE, 0x1D, 0x58, 0x83, 0x71, 0xD5, 0xF9, 0x90, 0x56, 0xF3, 0x57, 0x8C }, NULL, NULL, 0x35FF8F1A, 0x6E79E3BE, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hiryuu no Ken Twin (J) [h3C]", { 0xEA, 0x9B, 0x6E, 0xA3, 0x2C, 0xCE, 0xB8, 0xF7, 0xEF, 0xBB, 0x2F, 0xEA, 0x21, 0x1B, 0x8E, 0x89 }, NULL, NULL, 0x35FF8F1A, 0x6E79E3BE, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Holy Magic Century (E) [!]", { 0x80, 0xCC, 0x11, 0x2F, 0x62, 0xE9, 0xA8, 0x58, 0x1A, 0x1B, 0xB6, 0xA1, 0xD1, 0xE1, 0x48, 0x8B }, NULL, NULL, 0x277B129D, 0xDD3879FF, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Holy Magic Century (E) [b1]", { 0xFA, 0x6A, 0x2E, 0x00, 0xBB, 0xFF, 0x23, 0x6D, 0xAC, 0x91, 0xF0, 0x85, 0x44, 0xAF, 0xFA, 0x40 }, NULL, NULL, 0x277B129D, 0xDD3879FF, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Holy Magic Century (F)", { 0x98, 0x8F, 0x5A, 0xBD, 0x96, 0x25, 0x91, 0x96, 0x34, 0x36, 0x59, 0xE9, 0x13, 0x66, 0x68, 0x20 }, NULL, NULL, 0xB35FEBB0, 0x7427B204, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Holy Magic Century (F) [h1C]", { 0x66, 0x89, 0x08, 0xC4, 0x95, 0x43, 0x2A, 0xD0, 0x99, 0xC5, 0x43, 0x9E, 0x38, 0x80, 0x90, 0x53 }, NULL, NULL, 0xB35FEBB0, 0x7427B204, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Holy Magic Century (F) [o1]", { 0x27, 0xD3, 0xEF, 0xBD, 0x35, 0xB1, 0xF5, 0x80, 0x33, 0x09, 0x61, 0x48, 0x0B, 0x98, 0x8F, 0xB5 }, NULL, NULL, 0xB35FEBB0, 0x7427B204, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Holy Magic Century (G) [!]", { 0xAB, 0x67, 0x6C, 0x3E, 0x9D, 0x26, 0xA7, 0x74, 0x50, 0xDD, 0xB4, 0xAA, 0xCD, 0x1A, 0x38, 0x61 }, NULL, NULL, 0x75FA0E14, 0xC9B3D105, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Holy Magic Century (G) [b1]", { 0xAC, 0xF8, 0x23, 0xA6, 0xEF, 0x4E, 0x77, 0xFE, 0x5B, 0x94, 0x0D, 0x71, 0x6D, 0xCE, 0xD6, 0xE9 }, NULL, NULL, 0x75FA0E14, 0xC9B3D105, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Holy Magic Century (G) [b2]", { 0xE2, 0x6F, 0x4F, 0xFD, 0x2A, 0xA1, 0x9E, 0x6E, 0xE9, 0xF9, 0x21, 0x6A, 0x15, 0x18, 0x9F, 0x14 }, NULL, NULL, 0x75FA0E14, 0xC9B3D105, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Holy Magic Century (G) [b3]", { 0xF4, 0x0D, 0x3D, 0xE4, 0x74, 0x5B, 0xAC, 0xC6, 0x94, 0x58, 0xBA, 0xB2, 0x5D, 0x60, 0x67, 0xF9 }, NULL, NULL, 0x75FA0E14, 0xC9B3D105, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Hoshi no Kirby 64 (J) (V1.0) [!]", { 0xB1, 0xA6, 0x7A, 0xEB, 0xC2, 0xBE, 0x89, 0xA8, 0x00, 0xE5, 0xEB, 0x60, 0xC0, 0xDF, 0xA9, 0x68 }, NULL, NULL, 0xC1D702BD, 0x6D416547, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Hoshi no Kirby 64 (J) (V1.0) [f1]", { 0x46, 0x0A, 0x42, 0xED, 0x56, 0x12, 0xEB, 0xBF, 0x92, 0xF3, 0x86, 0x68, 0x90, 0x67, 0x38, 0x4E }, NULL, NULL, 0x22F301B6, 0xD0A03C3C, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Hoshi no Kirby 64 (J) (V1.0) [f2]", { 0x07, 0xEA, 0x11, 0x68, 0x4D, 0x74, 0xDA, 0x87, 0x71, 0x9F, 0x05, 0xA1, 0xBD, 0xC4, 0xCC, 0xB3 }, NULL, NULL, 0x57CD5D6D, 0x046282B1, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Hoshi no Kirby 64 (J) (V1.1) [!]", { 0xFF, 0xDB, 0x44, 0x56, 0xF7, 0x99, 0x72, 0x2B, 0xCF, 0xE4, 0x30, 0x63, 0x2C, 0x39, 0x86, 0xAE }, NULL, NULL, 0xCA1BB86F, 0x41CCA5C5, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Hoshi no Kirby 64 (J) (V1.2) [!]", { 0x3E, 0xC0, 0x47, 0x1E, 0x2C, 0xBE, 0xE1, 0x74, 0x71, 0xDD, 0xBF, 0x80, 0xC5, 0x66, 0x06, 0xD5 }, NULL, NULL, 0x0C581C7A, 0x3D6E20E4, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Hoshi no Kirby 64 (J) (V1.3) [!]", { 0x35, 0xE0, 0x39, 0xF8, 0xE7, 0x98, 0x43, 0x91, 0x7D, 0x02, 0xBE, 0x06, 0xD0, 0x0C, 0x45, 0x7B }, NULL, NULL, 0xBCB1F89F, 0x060752A2, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Hot Wheels Turbo Racing (E) (M3) [!]", { 0xEF, 0x34, 0xDA, 0x35, 0xEF, 0x8A, 0x07, 0x34, 0x84, 0x3C, 0xB1, 0x82, 0xC1, 0x9F, 0xEB, 0x26 }, NULL, NULL, 0xE7D20193, 0xC1158E93, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Hot Wheels Turbo Racing (E) (M3) [b1]", { 0xBB, 0x8A, 0x58, 0x28, 0x2C, 0x5D, 0x4E, 0x32, 0xB3, 0x45, 0x56, 0x40, 0x7A, 0xCD, 0x92, 0x0E }, NULL, NULL, 0xE7D20193, 0xC1158E93, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Hot Wheels Turbo Racing (U) [!]", { 0x43, 0x11, 0xA1, 0xAE, 0xF1, 0x89, 0x86, 0x78, 0x33, 0x1F, 0x7E, 0x34, 0x86, 0x05, 0x53, 0x07 }, NULL, NULL, 0xC7C98F8E, 0x42145DDE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Hot Wheels Turbo Racing (U) [f1] (PAL)", { 0x50, 0x09, 0x16, 0x68, 0x74, 0x3D, 0x2D, 0xE7, 0xCA, 0xA2, 0x53, 0x42, 0x0D, 0x32, 0xC2, 0xD8 }, NULL, NULL, 0x14DE709E, 0xF882947D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Hot Wheels Turbo Racing (U) [t1]", { 0x7D, 0x32, 0xA6, 0x65, 0x02, 0x7A, 0xBB, 0x58, 0x5B, 0xD4, 0xFB, 0x71, 0x94, 0x75, 0x2B, 0x34 }, NULL, NULL, 0x1FDFCBDC, 0xFCD77D11, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Human Grand Prix - New Generation (J) [!]", { 0x97, 0xE7, 0x06, 0xED, 0x9C, 0xC6, 0xF3, 0x07, 0x08, 0xFF, 0xDC, 0x18, 0x7C, 0x85, 0xD5, 0x9F }, NULL, NULL, 0x5535972E, 0xBD8E3295, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Human Grand Prix - New Generation (J) [b1]", { 0xF9, 0xA6, 0xFF, 0xD3, 0x5D, 0x47, 0x8A, 0x8E, 0x2B, 0x36, 0x94, 0x60, 0xBF, 0xAB, 0x2C, 0xC8 }, NULL, NULL, 0x5535972E, 0xBD8E3295, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Human Grand Prix - New Generation (J) [o1]", { 0x7B, 0xD3, 0xF1, 0x0D, 0x47, 0xDB, 0x6D, 0x06, 0x22, 0x80, 0xD8, 0xAE, 0x75, 0x0A, 0x1A, 0xCB }, NULL, NULL, 0x5535972E, 0xBD8E3295, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Hybrid Heaven (E) (M3) [!]", { 0xDA, 0x86, 0x1C, 0x4D, 0x92, 0x02, 0xF6, 0x61, 0x57, 0x54, 0x66, 0x45, 0x0A, 0x27, 0xC4, 0x12 }, NULL, NULL, 0x641D3A7F, 0x86820466, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Hybrid Heaven (E) (M3) [b1]", { 0x24, 0xB0, 0x23, 0x69, 0x69, 0x75, 0xD2, 0x7E, 0xAE, 0x83, 0x19, 0xEF, 0x40, 0x00, 0x13, 0x48 }, NULL, NULL, 0x641D3A7F, 0x86820466, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Hybrid Heaven (E) (M3) [f1] (NTSC)", { 0xE6, 0xF1, 0x83, 0x36, 0x40, 0x6E, 0xF3, 0xBF, 0xC9, 0x90, 0x48, 0x3B, 0xBF, 0x18, 0x4A, 0xCD }, NULL, NULL, 0xDCCEDB8F, 0xBA79BEDE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Hybrid Heaven (J) [!]", { 0x99, 0x46, 0xEF, 0xF9, 0x15, 0xFC, 0x94, 0x7A, 0x22, 0x64, 0x07, 0xAC, 0x1F, 0x7B, 0x35, 0xC4 }, NULL, NULL, 0x0DE2CE36, 0xD41D29E6, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Hybrid Heaven (J) [b1]", { 0x94, 0xB2, 0x84, 0x28, 0x6A, 0x09, 0x0B, 0x59, 0x80, 0xB7, 0xF1, 0x8A, 0x4F, 0xA7, 0x78, 0x53 }, NULL, NULL, 0x0DE2CE36, 0xD41D29E6, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Hybrid Heaven (J) [f1] (PAL)", { 0x15, 0x1E, 0x92, 0xF5, 0xE3, 0xEE, 0x29, 0x4B, 0xAF, 0xF5, 0xD4, 0xC3, 0xE4, 0xE9, 0x5D, 0x77 }, NULL, NULL, 0xDE4E5E2E, 0xDCD0615D, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Hybrid Heaven (U) [!]", { 0xC4, 0x7E, 0x95, 0xBB, 0x32, 0xAB, 0x13, 0x2C, 0x41, 0xD6, 0x7B, 0xD2, 0x43, 0xF9, 0xE0, 0x2A }, NULL, NULL, 0x102888BF, 0x434888CA, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Hybrid Heaven (U) [f1] (PAL)", { 0x11, 0x55, 0x21, 0xBA, 0xC1, 0x16, 0x08, 0xFE, 0xBC, 0xE8, 0x74, 0xF2, 0x43, 0xAC, 0xC6, 0x6E }, NULL, NULL, 0xFB610592, 0x898A9705, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Hybrid Heaven (U) [t1]", { 0x0A, 0x44, 0x39, 0x3E, 0x1C, 0x97, 0xE4, 0xF9, 0x13, 0x03, 0x02, 0x9E, 0x27, 0xF2, 0x8A, 0xF4 }, NULL, NULL, 0xE8DBC96A, 0xDAC9E2EE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Hydro Thunder (E) [!]", { 0x43, 0x4B, 0xB8, 0xDE, 0x49, 0x01, 0x15, 0x73, 0xAC, 0x38, 0xE8, 0x93, 0x22, 0x4C, 0x56, 0x23 }, NULL, NULL, 0xB58988E9, 0xB1FC4BE8, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hydro Thunder (E) [f1] (NTSC)", { 0x1F, 0x57, 0x19, 0x4E, 0xA2, 0x72, 0xCF, 0x5D, 0xB5, 0x00, 0xD2, 0x28, 0xE9, 0xC9, 0x4D, 0x75 }, NULL, NULL, 0xEDFB6B01, 0x8893F62C, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hydro Thunder (F) [!]", { 0x4B, 0x4C, 0x85, 0xD9, 0xDD, 0x2D, 0x46, 0x0A, 0xDA, 0xFA, 0xBA, 0xE8, 0xDB, 0x48, 0xB4, 0xFA }, NULL, NULL, 0x29A045CE, 0xABA9060E, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hydro Thunder (U) [!]", { 0x54, 0xF4, 0x3E, 0x6B, 0x68, 0x78, 0x2E, 0x98, 0xCA, 0xAB, 0xEA, 0x5E, 0x79, 0x76, 0xB2, 0xBE }, NULL, NULL, 0xC8DC65EB, 0x3D8C8904, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hydro Thunder (U) [b1]", { 0x22, 0xAA, 0xD5, 0x44, 0xC0, 0x62, 0xFB, 0x8A, 0x2D, 0xC6, 0xB2, 0xDE, 0xB3, 0x2D, 0xE1, 0x88 }, NULL, NULL, 0xC8DC65EB, 0x3D8C8904, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hydro Thunder (U) [b1][f1] (PAL)", { 0x71, 0xDC, 0xDB, 0xE9, 0xF4, 0xB3, 0x7A, 0x25, 0x1E, 0x28, 0x77, 0x90, 0x0C, 0xDB, 0xF4, 0x06 }, NULL, NULL, 0x63CCD041, 0xF12A8BC0, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hydro Thunder (U) [b1][t1]", { 0xA5, 0xB6, 0xE5, 0xD7, 0xB6, 0x89, 0x21, 0x6B, 0xA5, 0xC8, 0xF6, 0x36, 0x0B, 0xF8, 0x9B, 0x67 }, NULL, NULL, 0xB6DB2595, 0xBC45273B, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hydro Thunder (U) [b2]", { 0x85, 0xAC, 0xEB, 0xC8, 0x51, 0xA4, 0x07, 0x63, 0x0D, 0x74, 0x64, 0xCC, 0xB6, 0x34, 0x08, 0xBE }, NULL, NULL, 0xC8DC65EB, 0x3D8C8904, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hydro Thunder (U) [b3]", { 0xF4, 0x75, 0x75, 0xC3, 0x5C, 0x73, 0x52, 0xE6, 0x85, 0xB8, 0x48, 0xCD, 0xAF, 0xF9, 0x6B, 0x80 }, NULL, NULL, 0xC8DC65EB, 0x3D8C8904, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Hyper Olympics in Nagano 64 (J) [!]", { 0xD2, 0xF7, 0xB3, 0xAC, 0xE7, 0x5A, 0x2C, 0xE7, 0xA0, 0x6B, 0xEA, 0xC9, 0x29, 0x71, 0x1D, 0x94 }, NULL, NULL, 0x2FC5C34C, 0x7A05CC9D, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Hyper Olympics in Nagano 64 (J) [b1]", { 0x3B, 0x6F, 0xF1, 0x82, 0x9C, 0xBB, 0xEA, 0xE8, 0x77, 0x04, 0xF5, 0x39, 0x50, 0x79, 0x1D, 0x64 }, NULL, NULL, 0x2FC5C34C, 0x7A05CC9D, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Hyper Olympics in Nagano 64 (J) [b2]", { 0xF4, 0xD2, 0xBE, 0x1C, 0x47, 0x48, 0x6A, 0xB3, 0xA6, 0xFC, 0xCC, 0xD2, 0xE7, 0x53, 0x2C, 0x67 }, NULL, NULL, 0x2FC5C34C, 0x7A05CC9D, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Hyper Olympics in Nagano 64 (J) [b3]", { 0xBA, 0xC8, 0x63, 0x4F, 0x10, 0xF2, 0x86, 0xE6, 0xA0, 0xDB, 0x88, 0x9F, 0xCD, 0x12, 0xB2, 0x5E }, NULL, NULL, 0x2FC5C34C, 0x7A05CC9D, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Hyper Olympics in Nagano 64 (J) [o1]", { 0x20, 0xAE, 0x0B, 0xA6, 0x86, 0x01, 0xEB, 0x0A, 0x49, 0xD6, 0x1B, 0xC7, 0xA0, 0x0F, 0xEA, 0xDD }, NULL, NULL, 0x2FC5C34C, 0x7A05CC9D, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Ide Yousuke no Mahjong Juku (J) [!]", { 0x92, 0xA6, 0xFF, 0xA1, 0xC8, 0xD5, 0x37, 0xC7, 0xA9, 0x7C, 0x5C, 0x61, 0x3C, 0xAE, 0x05, 0xC6 }, NULL, NULL, 0x77DA3B8D, 0x162B0D7C, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Ide Yousuke no Mahjong Juku (J) [b1]", { 0xDC, 0x57, 0x7D, 0x70, 0xE9, 0x30, 0x8F, 0x94, 0xE5, 0xF3, 0xCE, 0x03, 0xF3, 0x50, 0x85, 0x39 }, NULL, NULL, 0x77DA3B8D, 0x162B0D7C, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Iggy's Reckin' Balls (E) [!]", { 0x25, 0xB2, 0x97, 0x14, 0x3E, 0x9E, 0x5C, 0xCB, 0xB4, 0xB8, 0x0A, 0x7F, 0xB6, 0xAF, 0x39, 0x9B }, NULL, NULL, 0xD692CC5E, 0xEC58D072, 0, SAVETYPE_NONE, 2, 1, 2, 1, 0, 1, 0, 0x900, 100, 0x53B },
+    { "Iggy's Reckin' Balls (E) [o1]", { 0x26, 0xCE, 0xC7, 0xA5, 0x6A, 0xBB, 0x81, 0xF3, 0x46, 0x8C, 0xFA, 0x26, 0xD8, 0xF1, 0x6B, 0x67 }, NULL, NULL, 0xD692CC5E, 0xEC58D072, 0, SAVETYPE_NONE, 2, 1, 2, 1, 0, 1, 0, 0x900, 100, 0x53B },
+    { "Iggy's Reckin' Balls (U) [!]", { 0x46, 0x42, 0x11, 0xAB, 0xB6, 0x02, 0xEE, 0x10, 0x05, 0x97, 0x4D, 0x2D, 0x83, 0x5A, 0x3B, 0xCF }, NULL, NULL, 0xE616B5BC, 0xC9658B88, 0, SAVETYPE_NONE, 2, 1, 2, 1, 0, 1, 0, 0x900, 100, 0x53B },
+    { "Iggy's Reckin' Balls (U) [o1]", { 0x8B, 0xF0, 0xEA, 0xFB, 0x70, 0x14, 0xB7, 0xB5, 0xCE, 0x8E, 0x7D, 0x77, 0x8B, 0x6B, 0x4B, 0x99 }, NULL, NULL, 0xE616B5BC, 0xC9658B88, 0, SAVETYPE_NONE, 2, 1, 2, 1, 0, 1, 0, 0x900, 100, 0x53B },
+    { "Iggy-kun no Bura Bura Poyon (J) [!]", { 0xC7, 0x0B, 0x0B, 0x68, 0x08, 0x07, 0xF2, 0xB8, 0xC2, 0xC3, 0xD5, 0xDC, 0x49, 0x5F, 0xA8, 0xC2 }, NULL, NULL, 0x69458B9E, 0xFC95F936, 0, SAVETYPE_NONE, 2, 1, 2, 1, 0, 1, 0, 0x900, 100, 0x53B },
+    { "Iggy-kun no Bura Bura Poyon (J) [o1]", { 0x82, 0x71, 0x06, 0x23, 0x67, 0x56, 0xDC, 0x5B, 0x58, 0x5C, 0x42, 0x26, 0x18, 0x48, 0x35, 0xFA }, NULL, NULL, 0x69458B9E, 0xFC95F936, 0, SAVETYPE_NONE, 2, 1, 2, 1, 0, 1, 0, 0x900, 100, 0x53B },
+    { "In-Fisherman Bass Hunter 64 (U) [!]", { 0xC6, 0x05, 0xF4, 0x0B, 0xF6, 0x69, 0xE0, 0x0A, 0x5E, 0x51, 0xBA, 0xF0, 0xD0, 0x06, 0x21, 0xEA }, NULL, NULL, 0x8C138BE0, 0x95700E46, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "In-Fisherman Bass Hunter 64 (U) [f1] (PAL)", { 0x1A, 0xF9, 0x39, 0x22, 0xA6, 0x70, 0x85, 0xAB, 0x2C, 0x77, 0x7B, 0x1F, 0x08, 0xAF, 0x36, 0x5B }, NULL, NULL, 0xF050D644, 0xB5A5CED1, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Indiana Jones and the Infernal Machine (U) [!]", { 0x70, 0xDE, 0x1E, 0xAB, 0x50, 0x85, 0x96, 0xB6, 0xBB, 0xEF, 0xD1, 0x68, 0xB5, 0xD0, 0x71, 0x94 }, NULL, NULL, 0xAF9DCC15, 0x1A723D88, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Indiana Jones and the Infernal Machine (E) (Unreleased)", { 0x63, 0xD7, 0xAB, 0x29, 0xBA, 0x3D, 0xFC, 0x5D, 0x5B, 0x12, 0xC1, 0xD9, 0xC5, 0x83, 0x23, 0x55 }, NULL, NULL, 0x3A6F8C6B, 0x2897BAEB, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Indy Racing 2000 (U) [!]", { 0xA7, 0x78, 0x1D, 0x44, 0x1A, 0xF5, 0x5C, 0x4F, 0xF8, 0xAF, 0xC6, 0x8A, 0xB3, 0xA5, 0x93, 0x13 }, NULL, NULL, 0xE436467A, 0x82DE8F9B, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "International Superstar Soccer '98 (E) [!]", { 0x34, 0x48, 0x93, 0x65, 0xB5, 0x50, 0xF3, 0x2C, 0x97, 0x33, 0x7D, 0x86, 0xD5, 0x2D, 0x8C, 0x84 }, NULL, NULL, 0xF41B6343, 0xC10661E6, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "International Superstar Soccer '98 (U) [!]", { 0x7D, 0xCC, 0x05, 0xB9, 0x8E, 0x2F, 0xA6, 0x90, 0xB4, 0x78, 0x80, 0x8E, 0xBB, 0xAD, 0x5D, 0x1A }, NULL, NULL, 0x7F0FDA09, 0x6061CE0B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "International Superstar Soccer '98 (U) [o1]", { 0x43, 0xB3, 0x26, 0xB2, 0x7B, 0x89, 0x28, 0x8F, 0x2D, 0x17, 0xD2, 0x2E, 0xA4, 0x9F, 0x86, 0xBD }, NULL, NULL, 0x7F0FDA09, 0x6061CE0B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "International Superstar Soccer 2000 (E) (M2) (Eng-Ger) [!]", { 0x9F, 0x10, 0x1B, 0x6F, 0x6B, 0xEF, 0x4F, 0x26, 0x7D, 0xEB, 0x5C, 0x6C, 0x37, 0xA2, 0x4B, 0x97 }, NULL, NULL, 0x336364A0, 0x06C8D5BF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "International Superstar Soccer 2000 (E) (M2) (Fre-Ita) [!]", { 0xCC, 0x2B, 0xE9, 0x7A, 0x16, 0x74, 0x48, 0x60, 0xFA, 0xE8, 0xA9, 0x46, 0x11, 0x47, 0x9C, 0x4C }, NULL, NULL, 0xBAE8E871, 0x35FF944E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "International Superstar Soccer 2000 (U) (M2) [!]", { 0x23, 0xA4, 0xED, 0x8D, 0x79, 0x88, 0x25, 0x94, 0x20, 0x61, 0x73, 0xB1, 0xD4, 0x76, 0xF0, 0xE9 }, NULL, NULL, 0x8E835437, 0xCD5748B4, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "International Superstar Soccer 2000 (U) (M2) [f1] (PAL)", { 0xAC, 0xF1, 0x88, 0x22, 0x45, 0x7A, 0x45, 0x1B, 0x09, 0xBD, 0x88, 0xE1, 0x5A, 0x70, 0x50, 0x5C }, NULL, NULL, 0x30B6A6AB, 0x319EFD09, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "International Superstar Soccer 2000 (U) (V1.1) (M2) [!]", { 0xDE, 0x94, 0x98, 0xBE, 0x76, 0x13, 0x4B, 0xD0, 0x66, 0xAA, 0x71, 0x4C, 0xE2, 0xC7, 0x1A, 0x16 }, NULL, NULL, 0x96816CCD, 0x0272EA8C, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "International Superstar Soccer 64 (E) [!]", { 0x37, 0x68, 0x03, 0xF2, 0x8C, 0xA8, 0xB2, 0x13, 0x36, 0x71, 0x78, 0x34, 0x19, 0x93, 0x3C, 0xA2 }, NULL, NULL, 0xE2D37CF0, 0xF57E4EAE, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "International Superstar Soccer 64 (E) [b1]", { 0x7F, 0xCC, 0x22, 0xF4, 0xBF, 0x1F, 0xC8, 0x2F, 0x88, 0x6C, 0x45, 0x59, 0x81, 0xD2, 0xA4, 0x20 }, NULL, NULL, 0xE2D37CF0, 0xF57E4EAE, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "International Superstar Soccer 64 (E) [b2]", { 0xFD, 0x01, 0x02, 0xD5, 0x35, 0xBC, 0x3B, 0xBB, 0x22, 0xDD, 0x82, 0x3A, 0x63, 0x6D, 0xC7, 0x57 }, NULL, NULL, 0xE2D37CF0, 0xF57E4EAE, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "International Superstar Soccer 64 (E) [h1C]", { 0x65, 0xB9, 0xCA, 0xC3, 0x90, 0x04, 0x35, 0xED, 0x68, 0x93, 0xB9, 0xD4, 0x89, 0xF1, 0x65, 0x5F }, NULL, NULL, 0xE2D37CF0, 0xF57E4EAE, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "International Superstar Soccer 64 (E) [h2C]", { 0x70, 0xD4, 0x80, 0xA7, 0x3D, 0xB5, 0x75, 0x1E, 0xED, 0x9E, 0x82, 0x61, 0x08, 0x00, 0x58, 0x34 }, NULL, NULL, 0xE2D37CF0, 0xF57E4EAE, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "International Superstar Soccer 64 (U) [!]", { 0x6A, 0x34, 0x54, 0x02, 0xAE, 0x1D, 0xB5, 0xCE, 0x10, 0x41, 0x36, 0x5E, 0x36, 0x12, 0x6B, 0xCE }, NULL, NULL, 0x5F2763C4, 0x62412AE5, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "International Superstar Soccer 64 (U) [b1]", { 0xC0, 0x96, 0x9E, 0x1C, 0x14, 0x1B, 0xE6, 0xE1, 0x44, 0xE6, 0x51, 0xCA, 0xB1, 0xAE, 0xA3, 0xD8 }, NULL, NULL, 0x5F2763C4, 0x62412AE5, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "International Superstar Soccer 64 (U) [h1C]", { 0x03, 0x21, 0xFC, 0xDC, 0xD3, 0x5E, 0x6D, 0xC0, 0xD3, 0xF4, 0xDC, 0x12, 0x51, 0x91, 0x99, 0x97 }, NULL, NULL, 0x5F2763C4, 0x62412AE5, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "International Superstar Soccer 64 (U) [h2C]", { 0x37, 0xA4, 0xF6, 0x34, 0xCA, 0xDB, 0x89, 0xDC, 0x3E, 0x43, 0xD3, 0x89, 0xED, 0x05, 0x09, 0x25 }, NULL, NULL, 0x5F2763C4, 0x62412AE5, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "International Track & Field 2000 (U) [!]", { 0x35, 0x66, 0x2C, 0xFD, 0x07, 0xFD, 0x6A, 0xF4, 0xBA, 0xB9, 0x0C, 0xA2, 0x3F, 0x7C, 0x98, 0xE6 }, NULL, NULL, 0x20073BC7, 0x5E3B0111, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "International Track & Field Summer Games (E) (M3) [!]", { 0x97, 0x04, 0x88, 0xFB, 0x7D, 0x9C, 0x5C, 0x25, 0xBD, 0x92, 0x4E, 0x6F, 0x89, 0x8B, 0x84, 0xA0 }, NULL, NULL, 0x6712C779, 0x3B72781D, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "iQue Club (Ch) (V3) (iQue) [!]", { 0xF9, 0x19, 0x0D, 0xBA, 0xF5, 0x47, 0xD6, 0xD3, 0xF5, 0xF3, 0x56, 0x9A, 0xCC, 0xF2, 0x60, 0x61 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "J.League Dynamite Soccer 64 (J) [!]", { 0x12, 0x47, 0xB0, 0x93, 0xE0, 0xFD, 0x6C, 0xCF, 0xD5, 0x0D, 0x15, 0xDE, 0x59, 0x30, 0x10, 0x76 }, NULL, NULL, 0x87766747, 0x91C27165, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "J.League Dynamite Soccer 64 (J) [b1]", { 0x84, 0x9D, 0xA5, 0xF1, 0x79, 0x0A, 0x38, 0x6B, 0x1C, 0xD9, 0x11, 0x8C, 0xA1, 0x39, 0x8E, 0x9D }, NULL, NULL, 0x87766747, 0x91C27165, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "J.League Dynamite Soccer 64 (J) [b2]", { 0xF3, 0xA1, 0xB0, 0x4E, 0x1F, 0x34, 0x36, 0xE1, 0x83, 0x93, 0x2B, 0x54, 0x21, 0x2B, 0x75, 0xB5 }, NULL, NULL, 0x87766747, 0x91C27165, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "J.League Dynamite Soccer 64 (J) [b3]", { 0x20, 0xFB, 0xBA, 0x5F, 0xCC, 0xB7, 0x45, 0x43, 0x67, 0xE0, 0x71, 0xA7, 0x44, 0xD6, 0xBB, 0x2F }, NULL, NULL, 0x87766747, 0x91C27165, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "J.League Dynamite Soccer 64 (J) [b4]", { 0x20, 0x85, 0xFB, 0xD9, 0x94, 0xD3, 0x59, 0x7A, 0x8A, 0x52, 0x0F, 0x69, 0x5E, 0x33, 0x63, 0x82 }, NULL, NULL, 0x87766747, 0x91C27165, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "J.League Dynamite Soccer 64 (J) [h1C]", { 0xE0, 0x07, 0x1B, 0x3C, 0xE2, 0xE2, 0x95, 0x97, 0xDC, 0x4C, 0x73, 0xD8, 0x34, 0x02, 0x72, 0x3C }, NULL, NULL, 0x87766747, 0x91C27165, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "J.League Dynamite Soccer 64 (J) [h2C]", { 0xF7, 0x54, 0x4B, 0x9D, 0xF7, 0x8D, 0x3C, 0xDB, 0x1C, 0x1B, 0x31, 0x00, 0x63, 0x72, 0xC5, 0x31 }, NULL, NULL, 0x87766747, 0x91C27165, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "J.League Dynamite Soccer 64 (J) [h3C]", { 0xF8, 0x48, 0xE3, 0x4D, 0xC2, 0x91, 0x8C, 0x70, 0x8D, 0x2D, 0x0C, 0x02, 0xE0, 0x82, 0xB0, 0x6B }, NULL, NULL, 0x87766747, 0x91C27165, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "J.League Eleven Beat 1997 (J) [!]", { 0x30, 0xE2, 0x3D, 0x3D, 0xE4, 0x46, 0xE3, 0x7E, 0x5E, 0x7F, 0xBE, 0xF6, 0x79, 0x4A, 0x6F, 0xC9 }, NULL, NULL, 0x4FBFA429, 0x6920BB15, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "J.League Eleven Beat 1997 (J) [b1][h1C]", { 0xE3, 0xCE, 0x4A, 0xDB, 0x8A, 0x7C, 0x0C, 0xF3, 0x9E, 0x11, 0xA2, 0x84, 0x6E, 0x00, 0x17, 0x8A }, NULL, NULL, 0x4FBFA429, 0x6920BB15, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "J.League Eleven Beat 1997 (J) [b2][h1C]", { 0xBE, 0xF0, 0xF3, 0x65, 0x13, 0xF6, 0xFA, 0x8B, 0x01, 0x63, 0x83, 0x19, 0x25, 0x2B, 0x2B, 0x99 }, NULL, NULL, 0x4FBFA429, 0x6920BB15, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "J.League Eleven Beat 1997 (J) [h1C]", { 0x47, 0x6F, 0xDC, 0x05, 0x54, 0xBD, 0x3B, 0x47, 0x46, 0xFC, 0x87, 0x1F, 0xDD, 0x02, 0xF4, 0xB2 }, NULL, NULL, 0x4FBFA429, 0x6920BB15, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "J.League Live 64 (J) [!]", { 0x20, 0x9D, 0xB8, 0x33, 0x3E, 0xEB, 0x52, 0x6A, 0xE9, 0xA9, 0x12, 0x09, 0x17, 0x53, 0x48, 0xCE }, NULL, NULL, 0x54554A42, 0xE4985FFB, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "J.League Live 64 (J) [b1]", { 0x46, 0xF5, 0x84, 0xDB, 0xFA, 0x1E, 0x29, 0x2F, 0x0E, 0xCA, 0x74, 0xCA, 0x1B, 0x12, 0x00, 0x9C }, NULL, NULL, 0x54554A42, 0xE4985FFB, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "J.League Tactics Soccer (J) (V1.0) [!]", { 0x80, 0x0A, 0xCC, 0x7D, 0x60, 0x9E, 0xCD, 0xB3, 0xE0, 0x9E, 0x68, 0xCB, 0xD0, 0x5F, 0x5F, 0xA0 }, NULL, NULL, 0xE8D29DA0, 0x15E61D94, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "J.League Tactics Soccer (J) (V1.0) [b1]", { 0xF6, 0x04, 0x70, 0x1C, 0x59, 0xC7, 0xD2, 0xBB, 0xA2, 0x49, 0x2D, 0x00, 0x73, 0xE9, 0x28, 0xF2 }, NULL, NULL, 0xE8D29DA0, 0x15E61D94, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "J.League Tactics Soccer (J) (V1.0) [f1] (PAL)", { 0x7D, 0x5A, 0xFC, 0xD9, 0x53, 0xBB, 0x15, 0xEC, 0x20, 0x4B, 0x17, 0x57, 0x61, 0xCA, 0x28, 0xC2 }, NULL, NULL, 0xE8D2A500, 0x5AA8DBCA, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "J.League Tactics Soccer (J) (V1.1) [!]", { 0x79, 0x3D, 0xBF, 0x50, 0x4E, 0x20, 0xC9, 0x2F, 0x6B, 0x73, 0xB4, 0xE8, 0xA2, 0x5A, 0x22, 0x0C }, NULL, NULL, 0xC6CE0AAA, 0xD117F019, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "JPEG Slideshow Viewer by Garth Elgar (PD)", { 0x45, 0xF6, 0xB7, 0xEA, 0xF4, 0x0E, 0x84, 0x45, 0x20, 0x59, 0x04, 0x93, 0x4E, 0xE3, 0x65, 0xA6 }, NULL, NULL, 0xA957851C, 0x535A5667, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Jangou Simulation Mahjong Do 64 (J) [!]", { 0x8E, 0xE0, 0x1D, 0xE7, 0xDA, 0x2E, 0x9A, 0xD0, 0x8D, 0x7E, 0xD9, 0x13, 0xA5, 0xEE, 0x86, 0x32 }, NULL, NULL, 0xC73AD016, 0x48C5537D, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jangou Simulation Mahjong Do 64 (J) [b1]", { 0x82, 0x38, 0x8A, 0x4B, 0x44, 0xEF, 0x74, 0xF9, 0xC2, 0x50, 0xC8, 0x15, 0x2A, 0xB9, 0x36, 0x69 }, NULL, NULL, 0xC73AD016, 0x48C5537D, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jangou Simulation Mahjong Do 64 (J) [b2]", { 0x01, 0x44, 0x64, 0xF2, 0xAC, 0x70, 0xFB, 0xBB, 0x94, 0xB0, 0x8B, 0x97, 0x62, 0xE6, 0x5A, 0x72 }, NULL, NULL, 0xC73AD016, 0x48C5537D, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jangou Simulation Mahjong Do 64 (J) [b3]", { 0x30, 0x4F, 0x49, 0x6C, 0xE0, 0x85, 0x89, 0x59, 0x70, 0x0C, 0x7F, 0x71, 0xE5, 0x5C, 0x55, 0xB7 }, NULL, NULL, 0xC73AD016, 0x48C5537D, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Japan Pro Golf Tour 64 (J) [CART HACK]", { 0xE3, 0x70, 0x68, 0x65, 0x24, 0x1D, 0x2B, 0xCA, 0x4F, 0x39, 0x7B, 0x45, 0x67, 0xCF, 0x2C, 0x2E }, NULL, NULL, 0xC99936D1, 0x23D1D65D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Jeopardy! (U) [!]", { 0xA4, 0x5F, 0x72, 0x00, 0x53, 0x7C, 0x0D, 0x92, 0x8A, 0x88, 0xCB, 0xBA, 0x2D, 0xFE, 0xB6, 0x80 }, NULL, NULL, 0x69256460, 0xB9A3F586, 0, SAVETYPE_NONE, 3, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Jeopardy! (U) [h1C]", { 0x05, 0x31, 0x87, 0x21, 0xC2, 0x73, 0xCB, 0x65, 0xCF, 0xBD, 0xF7, 0x8A, 0xC2, 0x72, 0x4B, 0xF2 }, NULL, NULL, 0x69256460, 0xB9A3F586, 0, SAVETYPE_NONE, 3, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Jeopardy! (U) [o1]", { 0x19, 0x05, 0x84, 0xD9, 0xC0, 0xDC, 0x28, 0x75, 0x18, 0x3F, 0xB8, 0x4C, 0x50, 0x72, 0xB8, 0xF1 }, NULL, NULL, 0x69256460, 0xB9A3F586, 0, SAVETYPE_NONE, 3, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Jeopardy! (U) [o1][h1C]", { 0x79, 0xBD, 0xD4, 0x46, 0x7E, 0x10, 0x2A, 0x1C, 0xBB, 0x4C, 0xC7, 0x4D, 0xFC, 0x96, 0xBF, 0x7D }, NULL, NULL, 0x69256460, 0xB9A3F586, 0, SAVETYPE_NONE, 3, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Jeremy McGrath Supercross 2000 (E) [!]", { 0x4C, 0x5B, 0xE1, 0xBF, 0xC1, 0xCC, 0xCF, 0xF5, 0x01, 0xEB, 0xA2, 0xA6, 0x85, 0x22, 0x69, 0x62 }, NULL, NULL, 0x21F7ABFB, 0x6A8AA7E8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Jeremy McGrath Supercross 2000 (U) [!]", { 0x80, 0x46, 0xA4, 0xB8, 0xAB, 0xD4, 0x35, 0x3B, 0x2A, 0xB9, 0x69, 0x61, 0x06, 0xCC, 0xF8, 0xD2 }, NULL, NULL, 0xBB30B1A5, 0xFCF712CE, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Jeremy McGrath Supercross 2000 (U) [f1]", { 0x29, 0xE0, 0xAB, 0x31, 0xB3, 0xFC, 0x6A, 0x6B, 0x1E, 0xFC, 0x11, 0xFB, 0xDB, 0x82, 0xCB, 0x97 }, NULL, NULL, 0x46C6F185, 0xE13841C8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Jet Force Gemini (E) (M4) [!]", { 0xBA, 0xAF, 0x23, 0x7E, 0x71, 0xAA, 0x75, 0x26, 0xC9, 0xB2, 0xF0, 0x1C, 0x08, 0xB6, 0x8A, 0x53 }, NULL, NULL, 0x68D7A1DE, 0x0079834A, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Jet Force Gemini (E) (M4) [T+Ita0.9beta_Rulesless]", { 0x82, 0x1E, 0x7F, 0x74, 0x88, 0x0B, 0xBD, 0x04, 0xAA, 0x95, 0x01, 0xD3, 0xBB, 0x25, 0x13, 0x8E }, NULL, NULL, 0x68D7A1DE, 0x0079834A, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Jet Force Gemini (E) (M4) [f1]", { 0x76, 0x99, 0x6A, 0x6C, 0xC8, 0x68, 0xAC, 0x0E, 0x2B, 0xB2, 0x50, 0x6A, 0x3C, 0x4D, 0xB6, 0x06 }, NULL, NULL, 0xB66E0F7C, 0x2709C22F, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Jet Force Gemini (U) (Kiosk Demo) [!]", { 0x5B, 0xBE, 0x9A, 0xDE, 0x71, 0x71, 0xF2, 0xE1, 0xDA, 0xAA, 0x7C, 0x48, 0xFA, 0xD3, 0x87, 0x28 }, NULL, NULL, 0xDFD8AB47, 0x3CDBEB89, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Jet Force Gemini (U) (Kiosk Demo) [b1]", { 0xE4, 0x23, 0xA2, 0x1C, 0x97, 0x1B, 0x8A, 0x91, 0xC3, 0xE8, 0x98, 0x0E, 0x26, 0x05, 0xB8, 0x40 }, NULL, NULL, 0xDFD8AB47, 0x3CDBEB89, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Jet Force Gemini (U) (Kiosk Demo) [b1][f1] (Save)", { 0x25, 0x25, 0xE3, 0x73, 0x4B, 0x92, 0x1E, 0x66, 0x29, 0x03, 0xE9, 0x4B, 0xAB, 0x11, 0x9C, 0x32 }, NULL, NULL, 0x9C660FA0, 0xC06A610D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Jet Force Gemini (U) (Kiosk Demo) [b1][f2]", { 0xB4, 0xE3, 0x48, 0x9F, 0x9B, 0x65, 0x54, 0x39, 0xF9, 0x90, 0x2F, 0x7A, 0x46, 0x6C, 0xF9, 0x73 }, NULL, NULL, 0x8547FED3, 0xC4945FAF, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Jet Force Gemini (U) (Kiosk Demo) [b2]", { 0x69, 0x14, 0x4C, 0xEE, 0xD3, 0xF4, 0xD7, 0xB2, 0x08, 0xD8, 0x1A, 0x3D, 0xC3, 0xF5, 0x7A, 0xD0 }, NULL, NULL, 0xDFD8AB47, 0x3CDBEB89, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Jet Force Gemini (U) [!]", { 0x77, 0x2C, 0xC6, 0xEA, 0xB2, 0x62, 0x0D, 0x2D, 0x3C, 0xDC, 0x17, 0xBB, 0xC2, 0x6C, 0x4F, 0x68 }, NULL, NULL, 0x8A6009B6, 0x94ACE150, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Jet Force Gemini (U) [b1]", { 0x92, 0xE6, 0x11, 0x72, 0x85, 0xEC, 0x6A, 0x2D, 0x83, 0x6B, 0x1C, 0x68, 0x39, 0xDD, 0xFD, 0x9B }, NULL, NULL, 0x75CAA990, 0x9FFDC9BD, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Jet Force Gemini (U) [b2]", { 0x74, 0x5F, 0xCD, 0x72, 0xA9, 0x21, 0xED, 0x17, 0x8A, 0xF6, 0xC3, 0x19, 0xB0, 0x9D, 0xF1, 0xF3 }, NULL, NULL, 0xCDB8B4D0, 0x8832352D, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Jikkyou G1 Stable (J) (V1.0) [!]", { 0x87, 0x8D, 0x8A, 0x26, 0xFD, 0x02, 0xFD, 0xB0, 0x82, 0x00, 0x46, 0x4C, 0xB6, 0xF5, 0x66, 0xEF }, NULL, NULL, 0xAF19D9F5, 0xB70223CC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou G1 Stable (J) (V1.0) [b1]", { 0x4B, 0xBA, 0xF0, 0x35, 0x94, 0xC6, 0xDC, 0xEC, 0xB1, 0x35, 0xAC, 0x8C, 0x57, 0xCB, 0x4C, 0xD7 }, NULL, NULL, 0xAF19D9F5, 0xB70223CC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou G1 Stable (J) (V1.1) [!]", { 0x48, 0x2B, 0xDD, 0x39, 0xAD, 0x25, 0x74, 0xB9, 0x43, 0xDB, 0x78, 0x0B, 0x12, 0xA9, 0xBD, 0xFB }, NULL, NULL, 0x575F340B, 0x9F1398B2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou J.League 1999 - Perfect Striker 2 (J) (V1.0) [!]", { 0x1F, 0xB4, 0x0E, 0xE3, 0x86, 0xB5, 0x8F, 0xEA, 0xB6, 0xCF, 0x29, 0xDD, 0xB3, 0x3B, 0xCC, 0xCC }, NULL, NULL, 0x63112A53, 0xA29FA88F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Jikkyou J.League 1999 - Perfect Striker 2 (J) (V1.0) [b1]", { 0x3D, 0x2C, 0xCA, 0x1B, 0x2E, 0x3B, 0xDE, 0x26, 0x77, 0x69, 0x81, 0x22, 0x19, 0xED, 0xB8, 0x64 }, NULL, NULL, 0x63112A53, 0xA29FA88F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Jikkyou J.League 1999 - Perfect Striker 2 (J) (V1.0) [b2]", { 0x84, 0xB1, 0x42, 0x1F, 0x65, 0x8D, 0x51, 0x85, 0x81, 0x2D, 0x86, 0x1E, 0x23, 0x43, 0x75, 0x20 }, NULL, NULL, 0x63112A53, 0xA29FA88F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Jikkyou J.League 1999 - Perfect Striker 2 (J) (V1.0) [f1] (PAL)", { 0xB1, 0x41, 0xC4, 0x6C, 0x0F, 0xB2, 0x91, 0x8D, 0x59, 0x93, 0x31, 0x07, 0xEA, 0x8C, 0x1B, 0x7A }, NULL, NULL, 0x3DBD5E85, 0xEA9A328A, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Jikkyou J.League 1999 - Perfect Striker 2 (J) (V1.0) [f2] (PAL)", { 0x47, 0x62, 0x03, 0xB6, 0x4E, 0x22, 0x04, 0x30, 0x6B, 0x59, 0x1D, 0x5D, 0x3A, 0xFC, 0x71, 0x83 }, NULL, NULL, 0x22CA2C52, 0xCA62736F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Jikkyou J.League 1999 - Perfect Striker 2 (J) (V1.1) [!]", { 0xD9, 0xF8, 0xB8, 0x4F, 0xD6, 0xFD, 0x21, 0xF0, 0xB1, 0xD7, 0x50, 0x06, 0x2A, 0xC8, 0x6E, 0xFC }, NULL, NULL, 0x6309FC17, 0x1D4F5EF3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Jikkyou J.League Perfect Striker (J) [!]", { 0x58, 0x15, 0x3A, 0xC5, 0xC4, 0x03, 0x0D, 0x1B, 0xFD, 0x3C, 0x15, 0xCF, 0x57, 0xFB, 0x02, 0xE7 }, NULL, NULL, 0x146C4366, 0x72A6DEB3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou J.League Perfect Striker (J) [b1]", { 0x75, 0x9B, 0x87, 0x49, 0xE5, 0x51, 0x13, 0x52, 0x6E, 0x8C, 0x1C, 0x46, 0x8E, 0x24, 0x4C, 0xA8 }, NULL, NULL, 0x146C4366, 0x72A6DEB3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou J.League Perfect Striker (J) [b2]", { 0xF0, 0x12, 0xDC, 0x3C, 0x0C, 0xAA, 0x38, 0x61, 0x8A, 0x1F, 0xAD, 0x27, 0xC7, 0x3F, 0xCB, 0xD5 }, NULL, NULL, 0x146C4366, 0x72A6DEB3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou J.League Perfect Striker (J) [b3]", { 0x6D, 0x1D, 0x46, 0x5E, 0xBA, 0xAC, 0xD3, 0x74, 0x7B, 0x13, 0x62, 0x03, 0x7A, 0xBE, 0xD9, 0xEF }, NULL, NULL, 0x146C4366, 0x72A6DEB3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou J.League Perfect Striker (J) [f1] (PAL)", { 0xC7, 0x15, 0x21, 0x67, 0x91, 0x5E, 0x8E, 0xB9, 0x28, 0xC0, 0xCB, 0xBF, 0x9A, 0xF9, 0x88, 0x6E }, NULL, NULL, 0x3BCCA16E, 0x0AF6D30F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu - Basic Ban 2001 (J) (V1.0) [!]", { 0x7F, 0xC9, 0x33, 0xA6, 0x48, 0x84, 0xA3, 0x82, 0xAA, 0x07, 0x60, 0x5E, 0xA7, 0x20, 0x4F, 0xF5 }, NULL, NULL, 0x6EDD4766, 0xA93E9BA8, 0, SAVETYPE_EEPROM_4K, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x453 },
+    { "Jikkyou Powerful Pro Yakyuu - Basic Ban 2001 (J) (V1.1) [!]", { 0xF1, 0x3D, 0x08, 0x03, 0x88, 0x5B, 0x73, 0xB4, 0xA6, 0xB3, 0x5E, 0xDD, 0xD4, 0x0B, 0x92, 0x53 }, NULL, NULL, 0xB00E3829, 0x29F232D1, 0, SAVETYPE_EEPROM_4K, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x453 },
+    { "Jikkyou Powerful Pro Yakyuu 2000 (J) (V1.0) [!]", { 0x23, 0x40, 0x96, 0x68, 0xA6, 0xE6, 0xC4, 0xEC, 0xE7, 0xB5, 0xFB, 0x0B, 0x7D, 0x0E, 0x8F, 0x2C }, NULL, NULL, 0x0AC244D1, 0x1F0EC605, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x613 },
+    { "Jikkyou Powerful Pro Yakyuu 2000 (J) (V1.1) [!]", { 0xB6, 0x53, 0xC9, 0x63, 0xED, 0x8D, 0x3A, 0x74, 0x96, 0x76, 0x81, 0x0F, 0x07, 0xCF, 0xE4, 0xE5 }, NULL, NULL, 0x4264DF23, 0xBE28BDF7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x613 },
+    { "Jikkyou Powerful Pro Yakyuu 4 (J) (V1.0) [!]", { 0xFD, 0xA5, 0x7F, 0x65, 0xEB, 0x15, 0x92, 0x78, 0x22, 0x3E, 0xB9, 0xD0, 0x32, 0x67, 0xC2, 0x7F }, NULL, NULL, 0x34495BAD, 0x502E9D26, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu 4 (J) (V1.0) [b1]", { 0x7C, 0xC3, 0x28, 0xFF, 0xAA, 0x5B, 0x77, 0xCD, 0x62, 0x47, 0x12, 0x4D, 0xD0, 0xAF, 0x88, 0x99 }, NULL, NULL, 0x34495BAD, 0x502E9D26, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu 4 (J) (V1.0) [b2]", { 0x92, 0x4E, 0x65, 0x53, 0xAE, 0xDE, 0x5E, 0xA6, 0x6E, 0x2E, 0x14, 0xD2, 0x9E, 0x48, 0xD9, 0x29 }, NULL, NULL, 0x34495BAD, 0x502E9D26, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu 4 (J) (V1.0) [b3]", { 0xD9, 0xBA, 0x9F, 0xC6, 0x09, 0xBF, 0xCD, 0xAC, 0x00, 0x81, 0xB7, 0xC5, 0x68, 0x31, 0x1B, 0xE1 }, NULL, NULL, 0x34495BAD, 0x502E9D26, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu 4 (J) (V1.0) [b4]", { 0x2B, 0xBD, 0x48, 0x4B, 0xFA, 0x0F, 0x16, 0xC0, 0x9C, 0x7F, 0x13, 0xFB, 0xDC, 0x26, 0x37, 0xC6 }, NULL, NULL, 0x34495BAD, 0x502E9D26, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu 4 (J) (V1.0) [b5]", { 0x14, 0x80, 0xE7, 0x55, 0xE9, 0x6B, 0x39, 0x24, 0x90, 0xF6, 0x06, 0xA7, 0x5B, 0xC3, 0x06, 0xC6 }, NULL, NULL, 0x34495BAD, 0x502E9D26, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu 4 (J) (V1.0) [o1]", { 0x95, 0x0B, 0x88, 0x95, 0x59, 0x33, 0xF4, 0x25, 0x14, 0xA3, 0xF4, 0x28, 0x4F, 0x5A, 0x28, 0x5C }, NULL, NULL, 0x34495BAD, 0x502E9D26, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu 4 (J) (V1.1) [!]", { 0xB4, 0x54, 0x49, 0x0E, 0xB4, 0x4F, 0x09, 0x78, 0xF0, 0x09, 0xFA, 0x41, 0xDE, 0x8C, 0x47, 0x8E }, NULL, NULL, 0xD7891F1C, 0xC3E43788, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu 5 (J) (V1.0) [!]", { 0xE9, 0xF9, 0x89, 0xE0, 0x9E, 0x3F, 0x15, 0x19, 0xAE, 0xFE, 0x61, 0x98, 0x89, 0xA4, 0xF7, 0x10 }, NULL, NULL, 0xD22943DA, 0xAC2B77C0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu 5 (J) (V1.0) [b1]", { 0xCA, 0xFF, 0x2D, 0xAC, 0x14, 0x2F, 0x16, 0x9E, 0xE7, 0x69, 0x65, 0xCA, 0x00, 0x51, 0x8B, 0x26 }, NULL, NULL, 0xD22943DA, 0xAC2B77C0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu 5 (J) (V1.0) [f1]", { 0x4A, 0xC1, 0x58, 0x9C, 0x06, 0x7A, 0xC5, 0x73, 0xFD, 0x63, 0x91, 0x2A, 0x5C, 0x6C, 0x47, 0xA5 }, NULL, NULL, 0x95854656, 0xC8A24DC5, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu 5 (J) (V1.0) [f2] (PAL)", { 0x8A, 0xF9, 0xD0, 0x4D, 0xBA, 0x13, 0x13, 0xD1, 0xF5, 0xF4, 0xBA, 0x51, 0xD9, 0x59, 0x2F, 0xBB }, NULL, NULL, 0x38D637C1, 0x5F05D28F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu 5 (J) (V1.1) [!]", { 0x6E, 0xF1, 0x9B, 0xF8, 0xD8, 0xD6, 0x19, 0x63, 0x90, 0x74, 0x5F, 0x1B, 0x85, 0x8A, 0xC1, 0x6A }, NULL, NULL, 0x1C8CDF74, 0xF761051F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu 5 (J) (V1.2) [!]", { 0x68, 0xA2, 0x7F, 0xBA, 0xB0, 0x60, 0x85, 0x7C, 0x26, 0x7A, 0x63, 0x99, 0x31, 0xD2, 0xC3, 0xD6 }, NULL, NULL, 0xAC173077, 0x5A14C012, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou Powerful Pro Yakyuu 6 (J) (V1.0) [!]", { 0x06, 0x0D, 0x03, 0x13, 0xE2, 0x3B, 0x66, 0x01, 0x80, 0x44, 0x1F, 0xCC, 0x7D, 0x24, 0xD7, 0xDB }, NULL, NULL, 0xB75E20B7, 0xB3FEFDFD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x603 },
+    { "Jikkyou Powerful Pro Yakyuu 6 (J) (V1.0) [b1]", { 0xE6, 0x12, 0x94, 0x60, 0xE2, 0x31, 0x70, 0xFF, 0xD4, 0xEC, 0x4B, 0x09, 0xD5, 0xE0, 0xCC, 0x56 }, NULL, NULL, 0xB75E20B7, 0xB3FEFDFD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x603 },
+    { "Jikkyou Powerful Pro Yakyuu 6 (J) (V1.1) [!]", { 0x23, 0xEE, 0x24, 0xFA, 0xBA, 0x0E, 0xDF, 0xB0, 0x4B, 0x5B, 0x04, 0x07, 0xE1, 0x74, 0x49, 0x6B }, NULL, NULL, 0x3C084040, 0x081B060C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x603 },
+    { "Jikkyou Powerful Pro Yakyuu 6 (J) (V1.2) [!]", { 0x03, 0xBD, 0x8E, 0x5C, 0xA2, 0xB1, 0xB7, 0xD7, 0x43, 0x98, 0xDB, 0x47, 0x39, 0x97, 0x92, 0x82 }, NULL, NULL, 0x438E6026, 0x3BA24E07, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x603 },
+    { "Jikkyou World Soccer - World Cup France '98 (J) (V1.0) [!]", { 0xA0, 0x5E, 0x7D, 0xB2, 0x40, 0x9D, 0xEE, 0xCC, 0xA3, 0x6E, 0x48, 0xE9, 0xD9, 0x31, 0xCA, 0xCB }, NULL, NULL, 0x3FEA5620, 0x7456DB40, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou World Soccer - World Cup France '98 (J) (V1.1) [!]", { 0x53, 0x8B, 0x54, 0xC2, 0xAA, 0xEA, 0x73, 0xFA, 0xA3, 0xA0, 0x21, 0xD4, 0x2A, 0x32, 0x25, 0xBE }, NULL, NULL, 0xC954B38C, 0x6F62BEB3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou World Soccer - World Cup France '98 (J) (V1.2) [!]", { 0x2E, 0x5F, 0xD9, 0x30, 0x31, 0x38, 0xE8, 0xF5, 0x58, 0xBF, 0x67, 0xBB, 0x9E, 0x79, 0x99, 0x60 }, NULL, NULL, 0xE1C7ABD6, 0x4E707F28, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Jikkyou World Soccer 3 (J) [!]", { 0xEF, 0x0F, 0x42, 0x56, 0x89, 0x58, 0x68, 0x50, 0xA6, 0xF5, 0x79, 0x61, 0x24, 0xB0, 0xC8, 0x5B }, NULL, NULL, 0xE0A79F8C, 0x32CC97FA, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x453 },
+    { "Jinsei Game 64 (J) [!]", { 0x68, 0x23, 0x0D, 0x51, 0x00, 0x15, 0xFF, 0x68, 0x17, 0xEF, 0x89, 0x8C, 0x0B, 0x8B, 0x63, 0x6C }, NULL, NULL, 0x4AAAF6ED, 0x376428AD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Jinsei Game 64 (J) [f1] (PAL)", { 0xFB, 0xB0, 0xF6, 0xAF, 0x0A, 0x93, 0x1E, 0xE4, 0xFE, 0xAE, 0xE4, 0xF3, 0xCC, 0x7D, 0xBE, 0x03 }, NULL, NULL, 0x7B016055, 0xF8AC6092, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "John Romero's Daikatana (E) (M3) [!]", { 0x7A, 0xB2, 0x9C, 0x6A, 0xD2, 0xD8, 0xF4, 0x00, 0x7D, 0x82, 0x13, 0xEB, 0x34, 0x11, 0xE0, 0xBD }, NULL, NULL, 0x0F743195, 0xD8A6DB95, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "John Romero's Daikatana (E) (M3) [f1] (NTSC)", { 0x2B, 0x41, 0x7A, 0xD2, 0x82, 0xDB, 0x32, 0x1C, 0x9C, 0x67, 0xED, 0xA7, 0x13, 0x1A, 0x7F, 0x06 }, NULL, NULL, 0xB6835E54, 0x04A4A0D0, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "John Romero's Daikatana (E) (M3) [h1C]", { 0x16, 0x40, 0x50, 0x08, 0x45, 0x61, 0xEC, 0xB6, 0x91, 0xA5, 0x1B, 0x6D, 0x1E, 0x5B, 0xF4, 0xAE }, NULL, NULL, 0x0F743195, 0xD8A6DB95, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "John Romero's Daikatana (J) [!]", { 0x57, 0xD3, 0x1E, 0xA7, 0x12, 0x1D, 0xD5, 0xA0, 0x5B, 0x54, 0x72, 0x25, 0xEF, 0xA5, 0xCF, 0xD7 }, NULL, NULL, 0x9D7E3C4B, 0xE60F4A6C, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "John Romero's Daikatana (U) [!]", { 0x5B, 0x4C, 0x26, 0x84, 0x22, 0x46, 0x9F, 0x50, 0xB9, 0x47, 0x79, 0xE6, 0x55, 0xF2, 0xB7, 0x98 }, NULL, NULL, 0xD0151AB0, 0xFE5CA14B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Kakutou Denshou - F-Cup Maniax (J) [!]", { 0xDF, 0xF0, 0xEF, 0xE2, 0xB3, 0x5F, 0xCD, 0xE5, 0x06, 0xD2, 0x1B, 0x0C, 0x0B, 0xD3, 0x73, 0xA5 }, NULL, NULL, 0x4F29474F, 0x30CB707A, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Kakutou Denshou - F-Cup Maniax (J) [f1] (PAL)", { 0x9A, 0x70, 0xD3, 0x01, 0x14, 0xF4, 0x40, 0xB5, 0x24, 0x0C, 0x10, 0x26, 0x0A, 0xB2, 0xC8, 0xED }, NULL, NULL, 0xF6E3494A, 0xE4EC8933, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Ken Griffey Jr.'s Slugfest (U) [!]", { 0xEE, 0xC0, 0xFA, 0xB7, 0x5A, 0xF5, 0x9E, 0x9C, 0x23, 0xE6, 0xDE, 0x21, 0x32, 0xDE, 0x89, 0xFF }, NULL, NULL, 0x36281F23, 0x009756CF, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Ken Griffey Jr.'s Slugfest (U) [b1]", { 0x04, 0x0A, 0x9E, 0xA8, 0x4F, 0xA3, 0xC7, 0x3A, 0x8F, 0x31, 0x83, 0x58, 0xE3, 0x25, 0x0A, 0xA4 }, NULL, NULL, 0x76A8C9F4, 0x3391893D, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Ken Griffey Jr.'s Slugfest (U) [b2]", { 0xD9, 0x16, 0x0E, 0x48, 0xCE, 0x1F, 0x06, 0xB9, 0xB7, 0x49, 0xB4, 0x3A, 0x38, 0x36, 0x7A, 0x28 }, NULL, NULL, 0x36281F23, 0x009756CF, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Ken Griffey Jr.'s Slugfest (U) [f1]", { 0xBF, 0x07, 0xDE, 0x58, 0x16, 0xFF, 0xEC, 0x94, 0xAF, 0x30, 0xCB, 0x9B, 0x9B, 0x35, 0x90, 0x9F }, NULL, NULL, 0x76A8C9F4, 0x3391893D, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Ken Griffey Jr.'s Slugfest (U) [f2] (PAL)", { 0x47, 0xB0, 0x34, 0x80, 0x20, 0xC4, 0x20, 0x06, 0x08, 0xB7, 0xEB, 0xD5, 0x12, 0x02, 0x87, 0x88 }, NULL, NULL, 0x76A8C9F4, 0x3391893D, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Ken Griffey Jr.'s Slugfest (U) [f3] (Nosave)", { 0x57, 0xC6, 0xB3, 0xE6, 0x30, 0x9A, 0xC2, 0xF4, 0xBB, 0x64, 0xB5, 0x16, 0x1E, 0x4E, 0xD8, 0xEF }, NULL, NULL, 0x730D25F4, 0x4A37A36E, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Ken Griffey Jr.'s Slugfest (U) [f4] (Nosave-Z64)", { 0x3E, 0x00, 0x3A, 0x77, 0xF0, 0x44, 0xF0, 0xC9, 0x77, 0x48, 0xBE, 0x68, 0x61, 0xC5, 0x50, 0x38 }, NULL, NULL, 0xEAC07419, 0x0F9F72A0, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Ken Griffey Jr.'s Slugfest (U) [f5]", { 0x93, 0x62, 0xC5, 0xAC, 0x8C, 0xA7, 0x8C, 0x12, 0xFF, 0x55, 0x3C, 0xB7, 0xF1, 0x2A, 0x7F, 0xF1 }, NULL, NULL, 0x76A8C9F4, 0x3391893D, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Kid Stardust Intro with Sound by Kid Stardust (PD)", { 0x69, 0xF3, 0xD2, 0x58, 0x0C, 0xB4, 0xC9, 0x1C, 0x91, 0xC2, 0xE2, 0x38, 0xC7, 0x2B, 0x44, 0x03 }, NULL, NULL, 0x64709212, 0x699BCF3B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Kid Stardust Intro with Sound by Kid Stardust (PD) [a1]", { 0x68, 0xEB, 0x17, 0x13, 0x15, 0x66, 0x05, 0xD5, 0xB0, 0x5C, 0xFB, 0x83, 0x8C, 0x21, 0x4E, 0xF2 }, NULL, NULL, 0x64709212, 0x699BCF3B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Killer Instinct Gold (E) [!]", { 0xC9, 0x3D, 0x92, 0xF1, 0x0A, 0x1A, 0x97, 0xD2, 0xBA, 0x87, 0x38, 0x6B, 0xE7, 0xD1, 0x78, 0xFD }, NULL, NULL, 0x979B263E, 0xF8470004, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (E) [o1]", { 0xA6, 0x3F, 0x43, 0xCC, 0x53, 0xD9, 0xE5, 0x7A, 0x04, 0x5E, 0x1E, 0x20, 0xA5, 0xB1, 0x25, 0x92 }, NULL, NULL, 0x979B263E, 0xF8470004, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.0) [!]", { 0x8E, 0x33, 0xAD, 0x20, 0xC3, 0x1F, 0xEB, 0x61, 0xD7, 0x23, 0x0F, 0xAD, 0x28, 0x84, 0x6C, 0x5C }, NULL, NULL, 0x9E8FE2BA, 0x8B270770, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.0) [b1]", { 0xF7, 0x3E, 0xA6, 0x17, 0x1B, 0x04, 0xCD, 0x9F, 0xF0, 0x5B, 0x76, 0x27, 0x4E, 0x82, 0x41, 0x94 }, NULL, NULL, 0x9E8FE2BA, 0x8B270770, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.0) [b1][t1]", { 0xF8, 0x71, 0xB0, 0x7C, 0x70, 0x0F, 0x5B, 0xB3, 0x73, 0xE6, 0x48, 0xFC, 0x64, 0xD9, 0x9D, 0x2E }, NULL, NULL, 0x06CB44B7, 0x3163DB94, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.0) [b2]", { 0xD4, 0xCD, 0x4F, 0x6A, 0x50, 0x29, 0x04, 0x8B, 0x44, 0xC8, 0xB4, 0x20, 0x98, 0x2E, 0x66, 0x4E }, NULL, NULL, 0x06CB44B7, 0x3163DB94, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.0) [b3]", { 0x3E, 0xE5, 0xEF, 0x09, 0x47, 0x1E, 0xD2, 0xAD, 0xF0, 0x2E, 0x6E, 0x1B, 0xA8, 0xD1, 0x79, 0x63 }, NULL, NULL, 0x06CB44B7, 0x3163DB94, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.0) [b4]", { 0xDD, 0x44, 0xE1, 0xD7, 0x99, 0xFB, 0x90, 0x00, 0x98, 0x3C, 0x52, 0x91, 0xD9, 0xD3, 0x43, 0x06 }, NULL, NULL, 0x06CB44B7, 0x3163DB94, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.0) [b5]", { 0xC0, 0xB6, 0xDE, 0xEF, 0x90, 0x0B, 0x63, 0xA5, 0xE4, 0x62, 0x48, 0x04, 0xB1, 0x4A, 0x1B, 0xA6 }, NULL, NULL, 0x9E8FE2BA, 0x8B270770, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.0) [o1]", { 0x4C, 0x58, 0x60, 0x8F, 0x38, 0x79, 0x62, 0x78, 0x86, 0x05, 0x1B, 0x7C, 0x03, 0x5E, 0x3C, 0x23 }, NULL, NULL, 0x9E8FE2BA, 0x8B270770, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.0) [o2]", { 0xDF, 0x60, 0x7E, 0x79, 0xB1, 0x53, 0x9F, 0x7D, 0x6F, 0x9A, 0xD3, 0x4C, 0x31, 0xF4, 0x22, 0x96 }, NULL, NULL, 0x9E8FE2BA, 0x8B270770, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.0) [t1]", { 0x74, 0x96, 0xF1, 0x81, 0x4A, 0xFB, 0xD1, 0xFC, 0x85, 0xFE, 0x76, 0xD6, 0xEB, 0xE9, 0xEA, 0x03 }, NULL, NULL, 0x06CB44B7, 0x3163DB94, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.0) [t2]", { 0x1C, 0x3B, 0x29, 0xCC, 0x7F, 0x36, 0x2C, 0xA6, 0x3A, 0xC1, 0xC2, 0x64, 0x56, 0x73, 0x7B, 0xB3 }, NULL, NULL, 0x06CB44B7, 0x3163DB94, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.1) [!]", { 0x4C, 0x9B, 0x41, 0x9D, 0xC5, 0x83, 0xC0, 0xDF, 0x4A, 0xB9, 0x08, 0xAD, 0xF8, 0x3B, 0xFC, 0x65 }, NULL, NULL, 0x9E8FCDFA, 0x49F5652B, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.1) [o1]", { 0x0C, 0xFF, 0x6A, 0x7C, 0x1B, 0x13, 0x34, 0xE0, 0x75, 0x85, 0xF0, 0xC5, 0xCD, 0xB5, 0x3B, 0x40 }, NULL, NULL, 0x9E8FCDFA, 0x49F5652B, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.2) [!]", { 0xDD, 0x0A, 0x82, 0xFC, 0xC1, 0x03, 0x97, 0xAF, 0xB3, 0x7F, 0x12, 0xBB, 0x7F, 0x94, 0xE6, 0x7A }, NULL, NULL, 0xF908CA4C, 0x36464327, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.2) [b1]", { 0x2D, 0x79, 0xC3, 0x95, 0x76, 0x5A, 0x60, 0x1F, 0x96, 0x7C, 0xD3, 0xEF, 0x7C, 0xBF, 0x43, 0x9E }, NULL, NULL, 0x06CB44B7, 0x3163DB94, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Killer Instinct Gold (U) (V1.2) [o1]", { 0x31, 0x66, 0xBE, 0x57, 0x87, 0xBC, 0x30, 0x52, 0x6E, 0x71, 0x27, 0x7E, 0xCA, 0x30, 0x91, 0xDF }, NULL, NULL, 0xF908CA4C, 0x36464327, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "King Hill 64 - Extreme Snowboarding (J) [!]", { 0xCC, 0xA4, 0xE8, 0x7E, 0xC2, 0x06, 0xB5, 0xB6, 0x5A, 0xEA, 0xB9, 0x53, 0x1C, 0x0F, 0x27, 0x5B }, NULL, NULL, 0x519EA4E1, 0xEB7584E8, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "King Hill 64 - Extreme Snowboarding (J) [b1]", { 0xCE, 0x9A, 0xE0, 0xAA, 0x6D, 0xBB, 0xF9, 0x65, 0xB1, 0xF7, 0x2B, 0xC3, 0xAA, 0x6A, 0x7C, 0xEF }, NULL, NULL, 0x519EA4E1, 0xEB7584E8, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "King Hill 64 - Extreme Snowboarding (J) [b2]", { 0x18, 0xE7, 0x41, 0xAA, 0xC7, 0x2E, 0xCA, 0x5A, 0x9F, 0xEF, 0xEF, 0xE6, 0xF7, 0xA3, 0xE5, 0x7A }, NULL, NULL, 0x519EA4E1, 0xEB7584E8, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Kira to Kaiketsu! 64 Tanteidan (J) [!]", { 0x32, 0x25, 0x7B, 0xFF, 0xFD, 0x9B, 0x2D, 0x68, 0x0F, 0x58, 0x2E, 0x14, 0x8E, 0x9B, 0x06, 0x11 }, NULL, NULL, 0x75BC6AD6, 0x78552BC9, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Kirby 64 - The Crystal Shards (E) [!]", { 0xA4, 0x4B, 0x7A, 0x61, 0x29, 0x64, 0xA6, 0xD6, 0x13, 0x9D, 0x04, 0x26, 0xE5, 0x69, 0xD9, 0xC9 }, NULL, NULL, 0x0D93BA11, 0x683868A6, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Kirby 64 - The Crystal Shards (E) [b1]", { 0xE3, 0xBF, 0xAF, 0x1A, 0xD4, 0xA5, 0x8A, 0x3A, 0xB7, 0xFD, 0x73, 0x10, 0xC1, 0xF4, 0x5D, 0x81 }, NULL, NULL, 0x0D93BA11, 0x683868A6, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Kirby 64 - The Crystal Shards (E) [f1]", { 0xE3, 0x23, 0x85, 0xEC, 0xE9, 0x3D, 0xF2, 0x22, 0x8F, 0xBE, 0xFE, 0x31, 0x13, 0x22, 0x0A, 0x20 }, NULL, NULL, 0x94593D97, 0x846A278C, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Kirby 64 - The Crystal Shards (U) [!]", { 0xD3, 0x3E, 0x42, 0x54, 0x33, 0x63, 0x83, 0xA1, 0x7F, 0xF4, 0x72, 0x83, 0x60, 0x56, 0x2A, 0xDA }, NULL, NULL, 0x46039FB4, 0x0337822C, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Kirby 64 - The Crystal Shards (U) [b1]", { 0x32, 0x9C, 0x0A, 0x56, 0x4D, 0x3B, 0x44, 0x77, 0xE2, 0x88, 0x70, 0x97, 0x38, 0x9A, 0xB7, 0xD6 }, NULL, NULL, 0x80A2BBB5, 0x828DFD3E, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Kirby 64 - The Crystal Shards (U) [b2]", { 0x0C, 0xBA, 0x02, 0xD6, 0xEA, 0x55, 0x80, 0x9A, 0x1E, 0x8D, 0x9B, 0xA0, 0x2D, 0x19, 0x9B, 0x7D }, NULL, NULL, 0x22F301B6, 0xD0A03C3C, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Kirby 64 - The Crystal Shards (U) [f1]", { 0x0A, 0x01, 0x0D, 0xFF, 0xB2, 0x0B, 0x9A, 0x4F, 0xB7, 0xBA, 0x2F, 0x96, 0x27, 0x88, 0xF5, 0x4F }, NULL, NULL, 0xD3F52BA5, 0x1258EDFE, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Kirby 64 - The Crystal Shards (U) [t1]", { 0x99, 0xF4, 0x65, 0x2F, 0xEF, 0xF7, 0x37, 0x35, 0x76, 0xED, 0x44, 0x0E, 0x1D, 0x33, 0xDB, 0x24 }, NULL, NULL, 0xCBF72BBD, 0x5D1587B2, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Knife Edge - Nose Gunner (E) [!]", { 0xD3, 0x1A, 0x94, 0xA5, 0x68, 0x5A, 0x21, 0xA9, 0x32, 0xCC, 0x88, 0x6D, 0x64, 0xCC, 0x9B, 0x21 }, NULL, NULL, 0x4A997C74, 0xE2087F99, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Knife Edge - Nose Gunner (J) [!]", { 0x43, 0x6B, 0xA8, 0x73, 0xE9, 0x46, 0x6A, 0xAB, 0x23, 0x7D, 0x94, 0x29, 0x34, 0x8A, 0x5F, 0x70 }, NULL, NULL, 0x931AEF3F, 0xEF196B90, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Knife Edge - Nose Gunner (U) [!]", { 0x80, 0x43, 0xD8, 0x29, 0xFC, 0xD4, 0xF8, 0xF7, 0x2D, 0xD8, 0x1E, 0x5C, 0x6D, 0xDE, 0x91, 0x6F }, NULL, NULL, 0xFCE0D799, 0x65316C54, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Knife Edge - Nose Gunner (U) [b1][t1]", { 0xAB, 0xFD, 0xAA, 0x35, 0xC9, 0x95, 0xC8, 0x39, 0xD0, 0x77, 0x3D, 0x36, 0x01, 0xD5, 0x9E, 0x67 }, NULL, NULL, 0x84F5C897, 0xA870AC11, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Knife Edge - Nose Gunner (U) [hI]", { 0xFC, 0xFB, 0xFD, 0x04, 0xA5, 0x64, 0x00, 0xDE, 0x8B, 0x84, 0x29, 0x7C, 0xF3, 0x7C, 0xEE, 0x3D }, NULL, NULL, 0x84F5CF63, 0x08EE7EDC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Knife Edge - Nose Gunner (U) [hI][t1]", { 0x76, 0x01, 0x10, 0xBC, 0x57, 0x33, 0xA4, 0xAC, 0x31, 0xEE, 0x68, 0x0A, 0x06, 0xF4, 0xF2, 0xA1 }, NULL, NULL, 0x84F5C897, 0xA870AC11, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Knife Edge - Nose Gunner (U) [t1]", { 0x2C, 0xA8, 0x2F, 0x82, 0x28, 0x4D, 0x2B, 0x3F, 0xE3, 0x81, 0x99, 0x98, 0x89, 0x35, 0x08, 0x55 }, NULL, NULL, 0x84F5C897, 0xA870AC11, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Knockout Kings 2000 (E) [!]", { 0xE9, 0x5D, 0x73, 0xFF, 0x55, 0xFB, 0xB6, 0x3E, 0x79, 0xAA, 0x9E, 0xAB, 0x14, 0x60, 0x85, 0x84 }, NULL, NULL, 0xE3D6A795, 0x2A1C5D3C, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Knockout Kings 2000 (U) [!]", { 0x00, 0x8B, 0x47, 0x38, 0x41, 0xCE, 0x4D, 0x9A, 0xC0, 0x50, 0xD5, 0x5F, 0x99, 0xB4, 0xB5, 0xD4 }, NULL, NULL, 0x0894909C, 0xDAD4D82D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Knockout Kings 2000 (U) [f1] (PAL)", { 0x63, 0x04, 0x00, 0xD4, 0xE2, 0xDC, 0xED, 0x3D, 0xDE, 0x56, 0xDF, 0xCC, 0xF3, 0x9A, 0x51, 0x2A }, NULL, NULL, 0x8D6F5219, 0xD43B163C, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Kobe Bryant in NBA Courtside (E) [!]", { 0xC6, 0xB0, 0x1C, 0x02, 0x0F, 0xDF, 0xD2, 0xE5, 0xC0, 0x37, 0xC5, 0xA3, 0x30, 0xB1, 0x61, 0xAD }, NULL, NULL, 0x1739EFBA, 0xD0B43A68, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Kobe Bryant in NBA Courtside (E) [f1]", { 0x54, 0xFD, 0x26, 0x59, 0xFC, 0xCE, 0x58, 0xFC, 0xC6, 0xEE, 0x54, 0x4F, 0x95, 0xF8, 0xF7, 0xA3 }, NULL, NULL, 0xD03F0CCB, 0x11F19CDD, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Kobe Bryant's NBA Courtside (U) [!]", { 0xD3, 0x7C, 0x79, 0xE4, 0xE4, 0xEA, 0xBC, 0xB5, 0xDC, 0x6A, 0x07, 0xBD, 0x76, 0x68, 0x82, 0x23 }, NULL, NULL, 0x616B8494, 0x8A509210, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Kobe Bryant's NBA Courtside (U) [f1]", { 0xEF, 0x9A, 0x84, 0xFB, 0xF0, 0xB4, 0xC3, 0x1E, 0x58, 0x16, 0x48, 0xF2, 0x56, 0xE8, 0xED, 0x81 }, NULL, NULL, 0x5BC51145, 0xD3A29FE7, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Kobe Bryant's NBA Courtside (U) [h1C]", { 0xAA, 0x07, 0x27, 0xF8, 0xF2, 0xB2, 0xC2, 0x33, 0xF7, 0xBF, 0xD2, 0x02, 0x19, 0x4D, 0x41, 0xBC }, NULL, NULL, 0x616B8494, 0x8A509210, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Kuru Kuru Fever (Aleck64)", { 0x3E, 0x2A, 0xD6, 0x00, 0xBD, 0x89, 0xB2, 0x15, 0x31, 0xF5, 0x9A, 0x84, 0x83, 0x9F, 0xE7, 0x32 }, NULL, NULL, 0x4248BA87, 0x99BE605D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xB },
+    { "Kyojin no Doshin 1 (J) [CART HACK]", { 0x6B, 0x53, 0xB9, 0x4B, 0x64, 0xDD, 0x8A, 0xCA, 0xE1, 0xB4, 0x3B, 0xDA, 0x2C, 0xAF, 0x23, 0xFC }, NULL, NULL, 0x0837F87A, 0xD1436FF8, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Kyojin no Doshin 1 (J) (Kiosk Demo) [CART HACK]", { 0x73, 0xFF, 0xAC, 0xDB, 0x7F, 0x64, 0x91, 0x54, 0x98, 0x4A, 0x59, 0x57, 0xED, 0x45, 0x12, 0x57 }, NULL, NULL, 0xE7BDA0BE, 0xADA09CAC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Kyojin no Doshin: Kaihou Sensen Chibikko Chikko Daishuugou (J) [CART HACK]", { 0xC5, 0x7C, 0x4D, 0xD6, 0x78, 0x74, 0x8C, 0x6E, 0xD7, 0xCB, 0xF4, 0x98, 0x44, 0x5D, 0xE2, 0x47 }, NULL, NULL, 0x8C47CE8B, 0x06019FEF, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "LCARS Demo by WT Riker (PD)", { 0x28, 0x80, 0x3D, 0xC0, 0xD1, 0xCD, 0x12, 0x0E, 0x5C, 0x02, 0x85, 0xF7, 0x29, 0x16, 0x26, 0xB8 }, NULL, NULL, 0xF828DF21, 0xC5E83F66, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "LCARS Demo by WT Riker (PD) [b1]", { 0xE7, 0x43, 0x2C, 0x73, 0xFE, 0x47, 0x99, 0x1B, 0x52, 0xEB, 0x4A, 0x44, 0x15, 0x6A, 0x8D, 0x9D }, NULL, NULL, 0xF828DF21, 0xC5E83F66, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "LEGO Racers (E) (M10) [!]", { 0x63, 0x10, 0xC7, 0x17, 0x33, 0x85, 0xED, 0x2B, 0x06, 0x02, 0x0F, 0x3B, 0x90, 0x15, 0x8E, 0x9E }, NULL, NULL, 0xF478D8B3, 0x9716DD6D, 0, SAVETYPE_NONE, 2, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "LEGO Racers (U) (M10) [!]", { 0x26, 0xB5, 0xEA, 0xA1, 0x3D, 0xC5, 0xB5, 0xE3, 0x53, 0x07, 0xFE, 0x8C, 0x0C, 0xF5, 0xB6, 0xBA }, NULL, NULL, 0x096A40EA, 0x8ABE0A10, 0, SAVETYPE_NONE, 2, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "LEGO Racers (U) (M10) [b1]", { 0x97, 0xC4, 0xCA, 0xE5, 0x84, 0xF4, 0x27, 0xEC, 0x44, 0x26, 0x6E, 0x9B, 0x98, 0xFB, 0xF7, 0xB6 }, NULL, NULL, 0x096A40EA, 0x8ABE0A10, 0, SAVETYPE_NONE, 2, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "LEGO Racers (U) (M10) [b1][f1] (PAL)", { 0xE7, 0x44, 0x04, 0xED, 0x5A, 0x70, 0x76, 0x85, 0x5C, 0xDE, 0x38, 0x32, 0x47, 0x47, 0x51, 0xB6 }, NULL, NULL, 0xBB53C809, 0x269594C6, 0, SAVETYPE_NONE, 2, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "LEGO Racers (U) (M10) [b1][t1]", { 0x12, 0x21, 0xC6, 0x7C, 0x46, 0xC7, 0x74, 0x87, 0xD3, 0x5F, 0x03, 0xD3, 0xD1, 0x3A, 0x30, 0x22 }, NULL, NULL, 0xB0AC4321, 0x3F4DA1AF, 0, SAVETYPE_NONE, 2, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "LaC's MOD Player - The Temple Gates (PD)", { 0x05, 0x05, 0x31, 0x13, 0x9C, 0x08, 0x2E, 0x35, 0xB1, 0x01, 0xE0, 0x92, 0x9B, 0x6E, 0x07, 0xEA }, NULL, NULL, 0x8E97A4A6, 0xD1F31B33, 3, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "LaC's Universal Bootemu V1.0 (PD)", { 0x96, 0x02, 0x76, 0x8E, 0xA8, 0x8F, 0x4F, 0x5B, 0x53, 0x23, 0x7E, 0x1A, 0xA2, 0x0D, 0xE6, 0x8A }, NULL, NULL, 0xEF623F50, 0xECBB509B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "LaC's Universal Bootemu V1.1 (PD)", { 0xEB, 0x71, 0x2F, 0x2E, 0x8A, 0x6A, 0x89, 0x31, 0x41, 0xB8, 0x26, 0x07, 0xB1, 0x1D, 0xA8, 0xA2 }, NULL, NULL, 0xBB752DA7, 0x30D8BEF4, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "LaC's Universal Bootemu V1.2 (PD)", { 0x15, 0xC2, 0xC3, 0x7D, 0x4F, 0xFA, 0x1E, 0x2C, 0x5B, 0xC4, 0xD1, 0x02, 0x9B, 0xC2, 0x25, 0xAC }, NULL, NULL, 0xFF0AC362, 0xF4EC09B3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Last Legion UX (J) [!]", { 0xEB, 0x11, 0xFC, 0x07, 0x97, 0xAE, 0x11, 0x07, 0x20, 0x1C, 0x46, 0x01, 0xFE, 0xE5, 0x47, 0x1A }, NULL, NULL, 0x7F304099, 0x52CF5276, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Last Legion UX (J) [a1]", { 0x8E, 0x55, 0xFD, 0x69, 0x90, 0x47, 0x2A, 0x08, 0x56, 0x83, 0x24, 0x30, 0x9C, 0x2F, 0xD3, 0x1F }, NULL, NULL, 0x7F304099, 0x52CF5276, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Last Legion UX (J) [b1]", { 0x7B, 0x59, 0x88, 0x13, 0x8A, 0x8A, 0xDC, 0xA5, 0x92, 0xDE, 0x61, 0x62, 0x60, 0xB2, 0x70, 0x0D }, NULL, NULL, 0x7F304099, 0x52CF5276, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Last Legion UX (J) [b2]", { 0xF8, 0xD7, 0x05, 0xAD, 0x5E, 0xFF, 0x0D, 0xB9, 0xE3, 0xE1, 0x7A, 0x7E, 0xCB, 0x6D, 0x21, 0x23 }, NULL, NULL, 0x7F304099, 0x52CF5276, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Zelda no Densetsu - Toki no Ocarina - Zelda Collection Version (J) (GC) [!]", { 0x0C, 0x13, 0xE0, 0x44, 0x9A, 0x28, 0xEA, 0x5B, 0x92, 0x5C, 0xDB, 0x8A, 0xF8, 0xD2, 0x97, 0x68 }, NULL, "D109A814 0320,8109A814 0000,D109A816 F809,8109A816 0000", 0xF7F52DB8, 0x2195E636, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Zelda no Densetsu - Toki no Ocarina GC (J) (GC) [!]", { 0x33, 0xFB, 0x78, 0x52, 0xC1, 0x80, 0xB1, 0x8E, 0xA0, 0xB9, 0x62, 0x0B, 0x63, 0x0F, 0x41, 0x3F }, NULL, "D109A834 0320,8109A834 0000,D109A836 F809,8109A836 0000", 0xF611F4BA, 0xC584135C, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Zelda no Densetsu - Toki no Ocarina GC URA (J) (GC) [!]", { 0x69, 0x89, 0x5C, 0x5C, 0x78, 0x44, 0x22, 0x60, 0xF6, 0xEA, 0xFB, 0x25, 0x06, 0xDC, 0x48, 0x2A }, NULL, "D109A814 0320,8109A814 0000,D109A816 F809,8109A816 0000", 0xF43B45BA, 0x2F0E9B6F, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Legend of Zelda, The - Majora's Mask (E) (M4) (V1.0) [!]", { 0x13, 0xFA, 0xB6, 0x7E, 0x60, 0x3B, 0x00, 0x2C, 0xEA, 0xF0, 0xEE, 0xA8, 0x41, 0x30, 0xE9, 0x73 }, NULL, NULL, 0xE97955C6, 0xBC338D38, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (E) (M4) (V1.0) [T+Ita1.0Beta_Vampire]", { 0x57, 0x98, 0xE8, 0x44, 0x95, 0x36, 0x62, 0x88, 0x0C, 0x5E, 0xB4, 0x13, 0x4F, 0x88, 0x69, 0x09 }, NULL, NULL, 0xE97955C6, 0xBC338D38, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (E) (M4) (V1.0) [T-Ita0.9M_Vampire]", { 0x36, 0x75, 0x9C, 0x85, 0x69, 0x4A, 0x4C, 0xF5, 0xA1, 0xF0, 0x89, 0xA4, 0x13, 0x6D, 0xAE, 0x2B }, NULL, NULL, 0xE97955C6, 0xBC338D38, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (E) (M4) (V1.0) [T-Ita0.9P1+G_Vampire]", { 0x6C, 0xBA, 0xC6, 0xE5, 0xB1, 0x3A, 0x4A, 0x92, 0x34, 0x74, 0x88, 0xDE, 0x1C, 0x80, 0x6B, 0xC0 }, NULL, NULL, 0xE97955C6, 0xBC338D38, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (E) (M4) (V1.0) [T-Ita0.9Z3_Vampire]", { 0x44, 0x49, 0x4C, 0xD5, 0xD6, 0xE3, 0x33, 0x2F, 0x79, 0x46, 0x5D, 0xE5, 0x1C, 0x2E, 0xC6, 0x36 }, NULL, NULL, 0xE97955C6, 0xBC338D38, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (E) (M4) (V1.0) [T-Ita0.9e_Vampire]", { 0x58, 0x5A, 0xA9, 0x6C, 0xBB, 0x44, 0xDF, 0x3B, 0xBB, 0x3B, 0x29, 0x45, 0x38, 0xB0, 0x60, 0x5A }, NULL, NULL, 0xE97955C6, 0xBC338D38, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (E) (M4) (V1.0) [T-Ita0.9f_Vampire]", { 0x5F, 0xD0, 0xF1, 0xEE, 0x3F, 0x6E, 0x0C, 0x1E, 0x0B, 0xA9, 0xA9, 0x1E, 0xD7, 0x97, 0xA8, 0xB9 }, NULL, NULL, 0xE97955C6, 0xBC338D38, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (E) (M4) (V1.0) [f1]", { 0x03, 0x52, 0x39, 0x28, 0x19, 0x94, 0xE1, 0xE2, 0x54, 0xD7, 0xAF, 0xC7, 0x9F, 0x55, 0x70, 0xFB }, NULL, NULL, 0xE7428718, 0x97751A86, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (E) (M4) (V1.1) [!]", { 0xBE, 0xCC, 0xFD, 0xED, 0x43, 0xA2, 0xF1, 0x59, 0xD0, 0x35, 0x55, 0x02, 0x74, 0x62, 0xA9, 0x50 }, NULL, NULL, 0x0A5D8F83, 0x98C5371A, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (E) (M4) (V1.1) (Debug Version)", { 0x71, 0xFB, 0xAE, 0x5D, 0x2B, 0x27, 0x92, 0x6E, 0xA5, 0x4E, 0x92, 0xCE, 0x2F, 0xC9, 0x16, 0x22 }, NULL, NULL, 0x9FC385E5, 0x3ECC05C7, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (E) (M4) (VC) [!]", { 0x60, 0x9B, 0x47, 0xB7, 0x9D, 0xA2, 0x1F, 0x3D, 0xF9, 0xB3, 0x1D, 0x06, 0xC9, 0x5C, 0x09, 0xA1 }, NULL, NULL, 0x0A5D8F83, 0x98C5371A, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (E) (M4) (V1.1) [T+Ita1.0Beta_Vampire]", { 0x6D, 0xC8, 0x85, 0x03, 0xDF, 0x78, 0xFE, 0x4F, 0xAA, 0x16, 0xBC, 0xF7, 0xAE, 0xC4, 0xD1, 0xE7 }, NULL, NULL, 0x0A5D8F83, 0x98C5371A, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (U) [!]", { 0x2A, 0x0A, 0x8A, 0xCB, 0x61, 0x53, 0x82, 0x35, 0xBC, 0x10, 0x94, 0xD2, 0x97, 0xFB, 0x65, 0x56 }, NULL, NULL, 0x5354631C, 0x03A2DEF0, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (U) [T+Ita2.0_Rulesless]", { 0xA9, 0xBA, 0x75, 0x23, 0x59, 0x1C, 0x97, 0x5A, 0xC0, 0x03, 0x09, 0xED, 0x51, 0x6F, 0xD2, 0x48 }, NULL, NULL, 0x5242DFBC, 0x2FDE6D42, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (U) [T+Pol1.0]", { 0x9C, 0x7D, 0x1B, 0x51, 0xEC, 0xBC, 0x9A, 0xC3, 0x33, 0xD0, 0x02, 0x73, 0xF9, 0x67, 0x58, 0xB1 }, NULL, NULL, 0x5354631C, 0x03A2DEF0, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (U) [T+Rus0.85_Alex]", { 0xB9, 0x0B, 0x72, 0x8E, 0x06, 0x43, 0xAB, 0xC5, 0x82, 0x79, 0x3B, 0x45, 0x14, 0x44, 0x73, 0x3E }, NULL, NULL, 0x5354631C, 0x03A2DEF0, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (U) [T+RusPreAlpha_Alex&gottax]", { 0x04, 0x15, 0x0A, 0x63, 0xD1, 0x57, 0x46, 0x73, 0xBE, 0xAB, 0x03, 0x6E, 0x4E, 0xB5, 0xA2, 0x49 }, NULL, NULL, 0x5354631C, 0x03A2DEF0, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (U) [T-Rus0.1_Alex]", { 0x5D, 0x5D, 0xD3, 0x80, 0x11, 0x5A, 0xBF, 0x43, 0x95, 0x8A, 0x71, 0x0C, 0x7B, 0x59, 0x77, 0x71 }, NULL, NULL, 0x5354631C, 0x03A2DEF0, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (U) [T-Rus0.2_Alex]", { 0x78, 0x63, 0xED, 0x3E, 0xE5, 0x4F, 0x72, 0xBD, 0x59, 0xCF, 0x97, 0x0C, 0x5C, 0x40, 0x2F, 0xA2 }, NULL, NULL, 0x5354631C, 0x03A2DEF0, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (U) [T-Rus0.36Alex]", { 0xE6, 0x84, 0xC6, 0x72, 0xC2, 0xBF, 0x64, 0x71, 0x7A, 0x10, 0xF1, 0xD1, 0x04, 0x10, 0x89, 0x98 }, NULL, NULL, 0x5354631C, 0x03A2DEF0, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (U) [T-Rus0.50_Alex]", { 0xBD, 0x26, 0xBC, 0x90, 0x75, 0x0D, 0x63, 0x88, 0x97, 0x2C, 0x7E, 0x29, 0x44, 0x10, 0x39, 0xDF }, NULL, NULL, 0x5354631C, 0x03A2DEF0, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask (U) [f1]", { 0x3D, 0xF7, 0xF2, 0xAF, 0x3E, 0x7B, 0x1F, 0x2F, 0xD5, 0x5C, 0x2C, 0x02, 0x12, 0x5F, 0x01, 0x30 }, NULL, NULL, 0x696F2896, 0x764F6D3F, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask - Preview Demo (U) [!]", { 0x8F, 0x28, 0x18, 0x00, 0xFB, 0xA5, 0xDD, 0xCB, 0x1D, 0x2B, 0x37, 0x77, 0x31, 0xFC, 0x02, 0x15 }, NULL, NULL, 0xBF799345, 0x39FF7A02, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Legend of Zelda, The - Majora's Mask (U) (GC)", { 0xAC, 0x07, 0x51, 0xDB, 0xC2, 0x3A, 0xB2, 0xEC, 0x0C, 0x31, 0x44, 0x20, 0x3A, 0xCA, 0x00, 0x03 }, NULL, NULL, 0xB443EB08, 0x4DB31193, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Majora's Mask - Collector's Edition (E) (M4) (GC) [!]", { 0xDB, 0xE9, 0xAF, 0x0D, 0xB4, 0x62, 0x56, 0xE4, 0x2B, 0x5C, 0x67, 0x90, 0x2B, 0x69, 0x65, 0x49 }, NULL, NULL, 0x6AECEC4F, 0xF0924814, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Zelda no Densetsu - Toki no Ocarina (J) (V1.0) [!]", { 0x9F, 0x04, 0xC8, 0xE6, 0x85, 0x34, 0xB8, 0x70, 0xF7, 0x07, 0xC2, 0x47, 0xFA, 0x4B, 0x50, 0xFC }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Zelda no Densetsu - Toki no Ocarina (J) (V1.0) [T+Chi.02_madcell]", { 0xA0, 0x4E, 0xBD, 0x75, 0x32, 0x76, 0xC5, 0x2E, 0x95, 0xE2, 0x5A, 0xF7, 0x68, 0x3D, 0xA3, 0x2D }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Zelda no Densetsu - Toki no Ocarina (J) (V1.0) [T+Chi]", { 0xD4, 0x8C, 0xFE, 0x3F, 0xBF, 0x77, 0xD5, 0x33, 0x57, 0x31, 0x50, 0x9B, 0xFD, 0xE1, 0x0D, 0x47 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Zelda no Densetsu - Toki no Ocarina (J) (V1.0) [f1]", { 0xBF, 0x06, 0x22, 0xC4, 0xC4, 0x79, 0xE8, 0xFF, 0x59, 0x83, 0xDB, 0x37, 0x86, 0xF8, 0x42, 0x93 }, NULL, NULL, 0x9FD0987D, 0x7EAE10D8, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Zelda no Densetsu - Toki no Ocarina (J) (V1.1) [!]", { 0x1B, 0xF5, 0xF4, 0x2B, 0x98, 0xC3, 0xE9, 0x79, 0x48, 0xF0, 0x11, 0x55, 0xF1, 0x2E, 0x2D, 0x88 }, NULL, NULL, 0xD43DA81F, 0x021E1E19, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Zelda no Densetsu - Toki no Ocarina (J) (V1.2) [!]", { 0x22, 0x58, 0x05, 0x28, 0x47, 0xBD, 0xD0, 0x56, 0xC8, 0x40, 0x6A, 0x9E, 0xF6, 0x42, 0x7F, 0x13 }, NULL, NULL, 0x693BA2AE, 0xB7F14E9F, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (E) (M3) (V1.0) [!]", { 0xE0, 0x40, 0xDE, 0x91, 0xA7, 0x4B, 0x61, 0xE3, 0x20, 0x1D, 0xB0, 0xE2, 0x32, 0x3F, 0x76, 0x8A }, NULL, NULL, 0xB044B569, 0x373C1985, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (E) (M3) (V1.0) [b1]", { 0x2B, 0x60, 0xEF, 0x77, 0x7F, 0x75, 0x9B, 0x4F, 0x0E, 0x19, 0xDD, 0xF3, 0xCB, 0x84, 0xD9, 0xAB }, NULL, NULL, 0xB044B569, 0x373C1985, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (E) (M3) (V1.0) [f1] (zpfc)", { 0x20, 0xC6, 0x8E, 0xAF, 0xDF, 0xCB, 0x1B, 0xA9, 0x8B, 0x49, 0x5E, 0x5B, 0xEE, 0xD5, 0xE4, 0xB6 }, NULL, NULL, 0xEEE48FAF, 0x6A92BAFF, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (E) (M3) (V1.0) [f2] (zpc1)", { 0x17, 0x5E, 0xDA, 0xB7, 0xF1, 0xA3, 0xDF, 0xBB, 0x5D, 0x23, 0xC4, 0xAA, 0x1B, 0x9D, 0x64, 0x7E }, NULL, NULL, 0x96961E83, 0xB5DE0894, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (E) (M3) (V1.1) [!]", { 0xD7, 0x14, 0x58, 0x0D, 0xD7, 0x4C, 0x2C, 0x03, 0x3F, 0x5E, 0x1B, 0x6D, 0xC0, 0xAE, 0xAC, 0x77 }, NULL, NULL, 0xB2055FBD, 0x0BAB4E0C, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [!]", { 0x5B, 0xD1, 0xFE, 0x10, 0x7B, 0xF8, 0x10, 0x6B, 0x2A, 0xB6, 0x65, 0x0A, 0xBE, 0xCD, 0x54, 0xD6 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) (Room121 Hack)", { 0xA4, 0x3A, 0x35, 0x03, 0x85, 0xFA, 0x81, 0x4E, 0xC9, 0x79, 0x3B, 0x7A, 0xCD, 0x9E, 0x18, 0xF4 }, NULL, NULL, 0xEBE8AA17, 0xB1EF65E6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T+Dut]", { 0x64, 0x0B, 0x92, 0x8A, 0xD3, 0x87, 0xB2, 0x71, 0x09, 0x4F, 0x64, 0xB9, 0xB9, 0x3A, 0xBB, 0xFC }, NULL, NULL, 0xC7C3086D, 0x93826E6E, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T+Ita100]", { 0x6B, 0x3D, 0xB6, 0xAA, 0xA3, 0x48, 0xF5, 0x72, 0x1A, 0xFA, 0xF8, 0x92, 0xE9, 0xB2, 0x74, 0xDE }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T+Pol1.3]", { 0x48, 0xCA, 0x89, 0x95, 0x61, 0x20, 0xE0, 0x52, 0x2D, 0x4B, 0x6B, 0x7E, 0x28, 0x10, 0xD0, 0x4C }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T+Por1.0]", { 0x77, 0xBF, 0x20, 0xD3, 0xEC, 0xA1, 0x9E, 0xBC, 0xFC, 0x5F, 0xED, 0x35, 0xF5, 0xCF, 0x65, 0xDC }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T+Por1.5BetaFinal]", { 0x7F, 0xD3, 0xBA, 0x9B, 0x09, 0x5C, 0x24, 0x43, 0x67, 0xE8, 0x4A, 0x6E, 0x44, 0x93, 0x34, 0x9B }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T+Rus1.0beta2_Sergey Anton]", { 0x70, 0x37, 0xDF, 0x7E, 0x00, 0x50, 0xA6, 0xD8, 0xB9, 0xB3, 0x38, 0xC7, 0x74, 0xA1, 0xCE, 0xB0 }, NULL, NULL, 0xF8B1C7C7, 0x1EFCA431, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T+Rus101b2]", { 0xB0, 0xBB, 0x6C, 0xAB, 0x39, 0x5C, 0x93, 0xC9, 0x66, 0xF1, 0xCA, 0x48, 0x5F, 0xC1, 0xBF, 0xBC }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T+Spa01b_toruzz]", { 0x10, 0xA2, 0xE0, 0x87, 0x08, 0xE2, 0x51, 0x95, 0xE0, 0x63, 0xD2, 0xE0, 0x52, 0x31, 0xAB, 0x66 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T+Spa097b2]", { 0xBB, 0xCC, 0xE8, 0x48, 0x67, 0x9F, 0x3D, 0x07, 0x22, 0xCB, 0xA6, 0x22, 0x50, 0x5F, 0xB2, 0x06 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T+Spa1.0]", { 0x51, 0x77, 0x8E, 0x50, 0xCE, 0x70, 0x46, 0x67, 0x96, 0xF8, 0xD5, 0x1C, 0x68, 0x62, 0x24, 0xC4 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T+Spa2.0_eduardo_a2j]", { 0x44, 0xE6, 0x92, 0x1A, 0x25, 0x7E, 0x91, 0x39, 0x77, 0x08, 0x8B, 0x9B, 0x6B, 0xA9, 0xD2, 0x5B }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T+Spa2.2_eduardo_a2j]", { 0x86, 0xA9, 0x55, 0x0A, 0xD8, 0xCD, 0xDA, 0xCA, 0x13, 0x81, 0x37, 0x65, 0x04, 0x5A, 0x00, 0xEE }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Pol1.2]", { 0xAA, 0xEB, 0x5A, 0xCA, 0x09, 0x29, 0x1E, 0x8F, 0x5F, 0xED, 0xFA, 0x1F, 0x57, 0x6D, 0x9F, 0x0A }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Por.09]", { 0x17, 0x46, 0xD1, 0xCC, 0x38, 0xC4, 0x2F, 0x08, 0xF0, 0xCD, 0x12, 0xD1, 0x70, 0xC0, 0x46, 0xB8 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Por.14]", { 0x0D, 0x63, 0x31, 0xC2, 0xFA, 0x06, 0x2F, 0x20, 0x27, 0x2C, 0xC1, 0xA7, 0xF8, 0x0F, 0x72, 0x71 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Por.22]", { 0xFF, 0x7C, 0x6D, 0x99, 0x09, 0xD3, 0x6D, 0x3A, 0x11, 0xD4, 0xC9, 0x05, 0x2E, 0xAF, 0xB2, 0xE8 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Por.26]", { 0xD4, 0x71, 0x8E, 0x7E, 0xA7, 0x58, 0x47, 0x64, 0x60, 0x25, 0xD0, 0x76, 0x26, 0xA1, 0xDF, 0x69 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Por.28]", { 0xE7, 0x84, 0x35, 0x3B, 0x07, 0xDA, 0xFC, 0xB6, 0x66, 0x90, 0x19, 0x3B, 0x03, 0xCC, 0x3E, 0x1F }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Por.30]", { 0xE6, 0xA5, 0xB9, 0xA1, 0x8B, 0xB8, 0xD0, 0x50, 0x8F, 0xBB, 0x70, 0x3E, 0xB9, 0x07, 0x03, 0xB7 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Por.33]", { 0x79, 0xBE, 0x4E, 0xEE, 0xB2, 0xDD, 0x94, 0xE5, 0x42, 0x51, 0x6D, 0xFC, 0x18, 0x9B, 0x09, 0x9E }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Por.35]", { 0x65, 0xAC, 0x77, 0x55, 0xCB, 0x41, 0xE9, 0x37, 0xA1, 0xDC, 0x5C, 0x58, 0x90, 0x2A, 0x42, 0x22 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Por.37]", { 0x7B, 0x3A, 0xD8, 0xB6, 0xFE, 0x2D, 0x8F, 0x06, 0x02, 0xED, 0x10, 0x06, 0xFD, 0x67, 0x39, 0x70 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Por.42]", { 0xF8, 0x5F, 0xC5, 0xCE, 0x44, 0x51, 0xC1, 0xE9, 0xF3, 0xEE, 0x00, 0xB8, 0x14, 0x48, 0x9A, 0x51 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Rus.01]", { 0x92, 0xAE, 0xD3, 0xD8, 0x4A, 0x1A, 0xA0, 0x08, 0x2B, 0x12, 0x8E, 0x2C, 0xFD, 0x84, 0xC4, 0xAA }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Rus.06]", { 0x5D, 0xF9, 0x8A, 0xE5, 0xEA, 0xC2, 0x79, 0x75, 0x55, 0x58, 0x7D, 0x33, 0x91, 0x22, 0x2F, 0xE4 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Rus.82]", { 0xA1, 0xF1, 0x8D, 0xE7, 0xD5, 0x57, 0x0A, 0x50, 0x2C, 0x7C, 0x93, 0xB7, 0xBF, 0x27, 0xE8, 0x68 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Rus099bfix]", { 0xA5, 0xA8, 0xA0, 0x24, 0x9E, 0x14, 0xA0, 0x52, 0x22, 0x7B, 0x3E, 0xD7, 0x1A, 0x98, 0xF0, 0xB4 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Rus099wip]", { 0x3F, 0xE0, 0x76, 0xD5, 0x99, 0x2C, 0x53, 0xDE, 0x6E, 0x09, 0x5E, 0x53, 0xE5, 0x3D, 0x9B, 0xC5 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [T-Spa1.0_eduardo]", { 0x40, 0xF4, 0xA3, 0xA5, 0xFE, 0x70, 0x35, 0x27, 0xE0, 0x3C, 0x57, 0x47, 0xBC, 0x0A, 0x2F, 0xD6 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [b1]", { 0xEE, 0x38, 0xA9, 0x03, 0x55, 0x6C, 0x24, 0x52, 0x0C, 0xD1, 0x62, 0xFD, 0x04, 0x67, 0x48, 0xA2 }, NULL, NULL, 0xEC7011B7, 0x7616D72B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [f1]", { 0x8C, 0x13, 0x48, 0x87, 0x2D, 0x9A, 0xC3, 0x1F, 0xF9, 0xD2, 0x2C, 0x07, 0xD7, 0x18, 0x6C, 0xCB }, NULL, NULL, 0x9FD0987D, 0x7EAE10D8, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [f2]", { 0xDB, 0x2D, 0x73, 0x7D, 0xE0, 0xF1, 0x17, 0xD4, 0x19, 0xB3, 0xA4, 0x84, 0x42, 0xB6, 0xDB, 0x22 }, NULL, NULL, 0x9FD0987D, 0x7EAE10D8, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.0) [f3]", { 0x44, 0x72, 0xB1, 0xF6, 0xB9, 0xD5, 0x94, 0xB6, 0x36, 0x1D, 0xFA, 0x39, 0x6F, 0x8C, 0xFB, 0x2C }, NULL, NULL, 0x9FD0987D, 0x7EAE10D8, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.1) [!]", { 0x72, 0x1F, 0xDC, 0xC6, 0xF5, 0xF3, 0x4B, 0xE5, 0x5C, 0x43, 0xA8, 0x07, 0xF2, 0xA1, 0x6A, 0xF4 }, NULL, NULL, 0xD43DA81F, 0x021E1E19, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.1) [T+Ita100]", { 0x92, 0xC8, 0x42, 0xFC, 0x8C, 0xF7, 0x06, 0xFF, 0x29, 0x00, 0x44, 0xD4, 0x0A, 0x64, 0xD3, 0x46 }, NULL, NULL, 0xD43DA81F, 0x021E1E19, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.1) [T+Por1.0]", { 0xF5, 0xB3, 0x3D, 0xC7, 0xDC, 0x76, 0xBB, 0x30, 0x88, 0x01, 0xCB, 0x51, 0x8B, 0x15, 0x15, 0xF3 }, NULL, NULL, 0xD43DA81F, 0x021E1E19, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.1) [T+Por100%]", { 0xC9, 0x49, 0xE4, 0x92, 0x9A, 0x00, 0x1B, 0x33, 0x9D, 0xAE, 0x00, 0x0A, 0x3D, 0xA9, 0xE0, 0xA8 }, NULL, NULL, 0xD43DA81F, 0x021E1E19, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.1) [T+Spa01b_toruzz]", { 0x53, 0xE0, 0x9E, 0x6B, 0x72, 0xF1, 0x14, 0x44, 0x0B, 0x38, 0x9F, 0xA8, 0x54, 0x9E, 0x8F, 0x97 }, NULL, NULL, 0xD43DA81F, 0x021E1E19, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.1) [T-Spa1.0_eduardo]", { 0xEA, 0x4F, 0xA9, 0x40, 0x72, 0x84, 0x9F, 0x88, 0xCA, 0xC9, 0x6E, 0x60, 0xC1, 0xED, 0xD4, 0x1D }, NULL, NULL, 0xD43DA81F, 0x021E1E19, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.1) [T-Spa1.0_eduardo][b1]", { 0xB3, 0xE1, 0xD1, 0xB9, 0x26, 0x26, 0xBA, 0x86, 0xE5, 0xBD, 0xF0, 0xF1, 0x84, 0x09, 0xA2, 0x5B }, NULL, NULL, 0xD43DA81F, 0x021E1E19, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.1) [b1]", { 0x46, 0x8F, 0x7E, 0xAA, 0x4B, 0x94, 0xB8, 0x31, 0xAE, 0xED, 0x8B, 0x83, 0xC0, 0x62, 0xB5, 0xCB }, NULL, NULL, 0xD43DA81F, 0x021E1E19, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.1) [b2]", { 0xDD, 0x82, 0x4A, 0x8E, 0x1A, 0x67, 0x78, 0xFA, 0x52, 0x29, 0x43, 0x31, 0x09, 0xAF, 0xAE, 0xFF }, NULL, NULL, 0xCF8EC901, 0x7EC2C48D, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Legend of Zelda, The - Ocarina of Time (U) (V1.2) [!]", { 0x57, 0xA9, 0x71, 0x9A, 0xD5, 0x47, 0xC5, 0x16, 0x34, 0x2E, 0x1A, 0x15, 0xD5, 0xC2, 0x8C, 0x3D }, NULL, NULL, 0x693BA2AE, 0xB7F14E9F, 0, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Legend of Zelda, The - Ocarina of Time (U) (GC) [!]", { 0xCD, 0x09, 0x02, 0x9E, 0xDC, 0xFB, 0x7C, 0x09, 0x7A, 0xC0, 0x19, 0x86, 0xA0, 0xF8, 0x3D, 0x3F }, NULL, "D109A814 0320,8109A814 0000,D109A816 F809,8109A816 0000", 0xF3DD35BA, 0x4152E075, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Legend of Zelda, The - Ocarina of Time (E) (GC) [!]", { 0x2C, 0x27, 0xB4, 0xE0, 0x00, 0xE8, 0x5F, 0xD7, 0x8D, 0xBC, 0xA5, 0x51, 0xF1, 0xB1, 0xC9, 0x65 }, NULL, "D109A8E4 0320,8109A8E4 0000,D109A8E6 F809,8109A8E6 0000", 0x09465AC3, 0xF8CB501B, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Legend of Zelda, The - Ocarina of Time (E) (GC) [f1]", { 0x77, 0x31, 0x4F, 0xE3, 0xC3, 0xED, 0xD4, 0x72, 0xD0, 0x55, 0x4C, 0x12, 0xFE, 0xDB, 0x38, 0xF4 }, NULL, "D109A8E4 0320,8109A8E4 0000,D109A8E6 F809,8109A8E6 0000", 0xA3271D83, 0x05B533A5, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Legend of Zelda, The - Ocarina of Time - Master Quest (E) (GC) [!]", { 0x16, 0x18, 0x40, 0x34, 0x27, 0xE4, 0x34, 0x4A, 0x57, 0x83, 0x30, 0x43, 0xDB, 0x5C, 0xE3, 0xC3 }, NULL, "D109A8C4 0320,8109A8C4 0000,D109A8C6 F809,8109A8C6 0000", 0x1D4136F3, 0xAF63EEA9, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Legend of Zelda, The - Ocarina of Time - Master Quest (E) (GC) [T+Ita70%_Rulesless]", { 0xBC, 0x2E, 0xCB, 0xE9, 0x6B, 0x04, 0xED, 0xC5, 0x6B, 0x08, 0x34, 0x7D, 0xF7, 0xC7, 0xFE, 0xCD }, NULL, "D109A8C4 0320,8109A8C4 0000,D109A8C6 F809,8109A8C6 0000", 0x1D4136F3, 0xAF63EEA9, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Legend of Zelda, The - Ocarina of Time - Master Quest (E) (GC) [T+Pol1.0]", { 0x83, 0x67, 0x3D, 0x0A, 0x0E, 0xF4, 0x70, 0x5C, 0x62, 0x40, 0x43, 0x78, 0x8E, 0xBF, 0x11, 0xEE }, NULL, "D109A8C4 0320,8109A8C4 0000,D109A8C6 F809,8109A8C6 0000", 0x1D4136F3, 0xAF63EEA9, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Legend of Zelda, The - Ocarina of Time - Master Quest (E) (GC) [f1] (NTSC)", { 0xA3, 0x40, 0x93, 0xAC, 0x2B, 0x03, 0x8A, 0x92, 0xCC, 0xF5, 0x25, 0xCA, 0xB4, 0xCE, 0x34, 0x6E }, NULL, "D109A8C4 0320,8109A8C4 0000,D109A8C6 F809,8109A8C6 0000", 0x27A3831D, 0xB505A533, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Legend of Zelda, The - Ocarina of Time - Master Quest (E) (GC) [h1C]", { 0x2D, 0xE4, 0xD0, 0xF0, 0x78, 0x88, 0x71, 0xCC, 0x4B, 0xB6, 0xD3, 0x0B, 0x60, 0xF7, 0x21, 0x84 }, NULL, "D109A8C4 0320,8109A8C4 0000,D109A8C6 F809,8109A8C6 0000", 0x1D4136F3, 0xAF63EEA9, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Legend of Zelda, The - Ocarina of Time - Master Quest (U) (GC) [!]", { 0xDA, 0x35, 0x57, 0x7F, 0xE5, 0x45, 0x79, 0xF6, 0xA2, 0x66, 0x93, 0x1C, 0xC7, 0x5F, 0x51, 0x2D }, NULL, "D109A7F4 0320,8109A7F4 0000,D109A7F6 F809,8109A7F6 0000", 0xF034001A, 0xAE47ED06, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Legend of Zelda, The - Ocarina of Time - Master Quest (U) (Debug Version) [f1]", { 0x26, 0xA1, 0x61, 0x66, 0x67, 0xEE, 0xC8, 0x22, 0x88, 0x53, 0x4C, 0x47, 0xB6, 0x92, 0x7D, 0x45 }, NULL, "D109A7F4 0320,8109A7F4 0000,D109A7F6 F809,8109A7F6 0000", 0x917D1B16, 0x831F9BE1, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Legend of Zelda, The - Ocarina of Time - Master Quest (U) (Debug Version) [f2]", { 0x8A, 0xD8, 0xD2, 0x4E, 0xA3, 0x8B, 0x68, 0xDF, 0xAB, 0x15, 0x4C, 0x25, 0x85, 0xFB, 0x55, 0x0C }, NULL, "D109A7F4 0320,8109A7F4 0000,D109A7F6 F809,8109A7F6 0000", 0x917D18F6, 0x69BC5453, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Legend of Zelda, The - Ocarina of Time - Master Quest (U) (Debug Version)", { 0x8C, 0xA7, 0x1E, 0x87, 0xDE, 0x4C, 0xE5, 0xE9, 0xF6, 0xEC, 0x91, 0x62, 0x02, 0xA6, 0x23, 0xE9 }, NULL, "D109A7F4 0320,8109A7F4 0000,D109A7F6 F809,8109A7F6 0000", 0x917D18F6, 0x69BC5453, 4, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xBF },
+    { "Legend of Zelda, The - Ocarina of Time (Ch) (iQue) [!]", { 0x0A, 0xB4, 0x8B, 0x2D, 0x44, 0xA7, 0x4B, 0x3B, 0xB2, 0xD3, 0x84, 0xF6, 0x17, 0x0C, 0x27, 0x42 }, NULL, NULL, 0xB1E1E07B, 0x051269DD, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Legend of Zelda, The - Ocarina of Time (Ch) (V2) (iQue) (Manual) [!]", { 0x97, 0x29, 0xA6, 0x8F, 0x40, 0xF1, 0x97, 0xD4, 0xD0, 0x40, 0xFA, 0x64, 0x1F, 0xF0, 0x99, 0xE7 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Legend of Zelda, The - Ocarina of Time (Ch) (V4) (iQue) (Manual) [!]", { 0x91, 0x26, 0x28, 0x11, 0x8E, 0x67, 0xFE, 0xA6, 0x70, 0xED, 0x2C, 0x63, 0xF7, 0xA7, 0xB0, 0x03 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Legend of Zelda, The - Ocarina of Time (Ch) (Traditional) (iQue) [!]", { 0xA4, 0x75, 0xE9, 0xF8, 0x61, 0x55, 0x13, 0x66, 0x6A, 0x26, 0x5C, 0x46, 0x47, 0x08, 0xAE, 0x8F }, NULL, NULL, 0x3D81FB3E, 0xBD843E34, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Les Razmoket - La Chasse Aux Tresors (F) [!]", { 0x55, 0x68, 0x5D, 0x63, 0x24, 0xEF, 0xDE, 0x5B, 0xC9, 0xD2, 0x6C, 0x98, 0x70, 0x6B, 0x0B, 0x8A }, NULL, NULL, 0x2B696CB4, 0x7B93DCD8, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Let's Smash Tennis (J) [!]", { 0xAE, 0xE5, 0x01, 0x6E, 0x6D, 0x60, 0xD1, 0x2A, 0xD7, 0x68, 0xE9, 0xF6, 0xD1, 0x0A, 0xDD, 0xE8 }, NULL, NULL, 0x3D67C62B, 0x31D03150, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Light Force First N64 Demo by Fractal (PD)", { 0xEF, 0x87, 0x8D, 0xFA, 0xCF, 0x5C, 0xD5, 0xC0, 0x0B, 0xA3, 0x29, 0x7B, 0x0D, 0xC8, 0x88, 0xD2 }, NULL, NULL, 0x7D292963, 0xD5277C1F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Liner V1.00 by Colin Phillipps of Memir (PD)", { 0x96, 0x56, 0xC4, 0xA5, 0x25, 0x1F, 0x05, 0x47, 0x04, 0xE3, 0x51, 0x34, 0x00, 0x6C, 0xFF, 0xC7 }, NULL, NULL, 0x8A8E474B, 0x6458BF2B, 1, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Liner V1.00 by Colin Phillipps of Memir (PD) [b1]", { 0xAF, 0x70, 0x1E, 0xE8, 0x52, 0xEC, 0xD1, 0x3F, 0x5F, 0x9F, 0x32, 0x84, 0xEB, 0xE6, 0x05, 0x61 }, NULL, NULL, 0x8A8E474B, 0x6458BF2B, 1, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Liner V1.00 by Colin Phillipps of Memir (PD) [b2]", { 0x50, 0x0A, 0xFE, 0x6D, 0x67, 0x32, 0xE0, 0x88, 0x8D, 0x10, 0x84, 0x10, 0xD1, 0x35, 0xB7, 0x8E }, NULL, NULL, 0x8A8E474B, 0x6458BF2B, 1, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Liner V1.02 by Colin Phillipps of Memir (PD)", { 0x99, 0x38, 0x0A, 0x8E, 0xD8, 0x4C, 0x89, 0xE5, 0x4D, 0xE5, 0x3E, 0x0B, 0x1F, 0xB4, 0x23, 0xC9 }, NULL, NULL, 0xF7B1C8E8, 0x70536D3E, 1, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Lode Runner 3-D (E) (M5) [!]", { 0xE6, 0x2F, 0x4F, 0xDC, 0xC8, 0x2C, 0x24, 0x4B, 0xA9, 0x70, 0x9E, 0x40, 0x75, 0x6D, 0x9B, 0x62 }, NULL, NULL, 0x60460680, 0x305F0E72, 3, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Lode Runner 3-D (E) (M5) [b1]", { 0x6B, 0x1E, 0x29, 0x4A, 0x91, 0x99, 0xE6, 0xF2, 0x2D, 0xBC, 0x6A, 0xBC, 0x59, 0xBD, 0x75, 0x68 }, NULL, NULL, 0xE378B28A, 0x0CA18BCC, 3, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Lode Runner 3-D (J) [!]", { 0xD2, 0xBD, 0x8D, 0xD8, 0xC3, 0xBE, 0x1E, 0x8F, 0x0B, 0x8A, 0xE4, 0x92, 0x06, 0xDB, 0xD7, 0xE5 }, NULL, NULL, 0x964ADD0B, 0xB29213DB, 3, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Lode Runner 3-D (U) [!]", { 0xD0, 0x38, 0x81, 0x35, 0x41, 0x58, 0x9F, 0x0B, 0x3F, 0x1F, 0x90, 0x0F, 0x4F, 0xD2, 0x2C, 0x9B }, NULL, NULL, 0x255018DF, 0x57D6AE3A, 3, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Lode Runner 3-D (U) [b1][f1] (PAL)", { 0x5F, 0xBA, 0x92, 0xD9, 0x08, 0xB9, 0x96, 0x2F, 0x26, 0xD3, 0x89, 0xC8, 0x5F, 0x6E, 0x88, 0xCF }, NULL, NULL, 0x275A4533, 0xACD94796, 3, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Lode Runner 3-D (U) [f1] (PAL)", { 0x3F, 0x5C, 0xA8, 0x11, 0x83, 0xEA, 0x0E, 0x69, 0xF3, 0x54, 0x17, 0xF6, 0xBB, 0xD7, 0xC5, 0xAC }, NULL, NULL, 0x275A4533, 0xACD94796, 3, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Lode Runner 3-D (U) [t1]", { 0x78, 0x94, 0x82, 0xB7, 0x93, 0x14, 0x19, 0xFC, 0xE7, 0xFC, 0x24, 0x72, 0x02, 0x6E, 0x1C, 0x65 }, NULL, NULL, 0xBD13F636, 0x02079573, 3, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Looney Tunes - Duck Dodgers (E) (M6) [!]", { 0x14, 0x08, 0xFC, 0xF6, 0x8B, 0x60, 0xD8, 0x45, 0xF0, 0x90, 0x10, 0x7E, 0xF3, 0x55, 0xA7, 0xE5 }, NULL, NULL, 0x0AA0055B, 0x7637DF65, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Lt. Duck Dodgers (Prototype)", { 0x4C, 0xCF, 0xF8, 0x61, 0xAD, 0x2C, 0xFD, 0x65, 0xCC, 0x66, 0x0F, 0x49, 0x6C, 0x1D, 0x16, 0x64 }, NULL, NULL, 0xFBB9F1FA, 0x6BF88689, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x73 },
+    { "Lylat Wars (A) (M3) [!]", { 0x7A, 0x99, 0x62, 0x8E, 0xDF, 0x0A, 0x66, 0x02, 0xD0, 0xC4, 0x08, 0xF3, 0x1B, 0x70, 0x14, 0x35 }, NULL, NULL, 0x2483F22B, 0x136E025E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Lylat Wars (A) (M3) [f1]", { 0xB1, 0x82, 0xBB, 0xBC, 0x8C, 0xE2, 0x2B, 0xD3, 0xF4, 0x4B, 0xB6, 0xED, 0x91, 0xF6, 0xAC, 0xD4 }, NULL, NULL, 0x2483F22B, 0x136E025E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Lylat Wars (A) (M3) [t1] (Boost)", { 0x1E, 0x03, 0x88, 0x4F, 0x70, 0x17, 0x23, 0x0E, 0x96, 0xF7, 0x41, 0x08, 0x5E, 0x58, 0x17, 0xF8 }, NULL, NULL, 0xAF13E2C2, 0x2D502822, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Lylat Wars (A) (M3) [t2] (No Damage-Unbreakable Wings)", { 0xA2, 0x95, 0x7C, 0x46, 0xE6, 0x2C, 0xEC, 0x7B, 0x10, 0xED, 0xE4, 0x54, 0x7F, 0x70, 0x42, 0x5F }, NULL, NULL, 0x8B31F4AD, 0xF366CBFA, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Lylat Wars (E) (M3) [!]", { 0x88, 0x4C, 0xCC, 0xA3, 0x5C, 0xBE, 0xED, 0xB8, 0xED, 0x28, 0x83, 0x26, 0xF9, 0x66, 0x21, 0x00 }, NULL, NULL, 0xF4CBE92C, 0xB392ED12, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Lylat Wars (E) (M3) [f1]", { 0xF0, 0xFF, 0x28, 0xB0, 0xD2, 0x6C, 0xDE, 0xFC, 0x11, 0xF2, 0x2F, 0xE7, 0x31, 0x48, 0xA6, 0xDC }, NULL, NULL, 0xF4CBE92C, 0xB392ED12, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Lylat Wars (E) (M3) [f1][h1C]", { 0x37, 0xF7, 0xF2, 0xF2, 0xCF, 0xB4, 0x88, 0xE4, 0x8A, 0x27, 0x06, 0xFC, 0x8C, 0x4B, 0x2D, 0xD5 }, NULL, NULL, 0xF4CBE92C, 0xB392ED12, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Lylat Wars (E) (M3) [f2] (NTSC)", { 0x49, 0x90, 0x13, 0xDA, 0x36, 0xAD, 0x50, 0xC9, 0x4B, 0x2C, 0xE6, 0xB7, 0x94, 0xCC, 0x99, 0x83 }, NULL, NULL, 0xF667DC04, 0x86510A81, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Lylat Wars (E) (M3) [t1] (Boost)", { 0x12, 0xF0, 0x67, 0x1C, 0x66, 0xD2, 0x56, 0x22, 0xC4, 0xC9, 0xCD, 0x71, 0xC6, 0x78, 0xA1, 0xF6 }, NULL, NULL, 0x834C19FF, 0x8A93F7D4, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Lylat Wars (E) (M3) [t2] (No Damage-Unbreakable Wings)", { 0x28, 0x1E, 0x75, 0x41, 0x23, 0xEC, 0x0C, 0xC6, 0x88, 0xC4, 0xAA, 0x7C, 0x85, 0x3D, 0xE3, 0x03 }, NULL, NULL, 0x58B5EA62, 0x27177133, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "MAME 64 Beta 3 (PD)", { 0x41, 0xFE, 0x06, 0xC6, 0x89, 0x15, 0x66, 0x6E, 0x5F, 0x8F, 0xEF, 0x81, 0xB8, 0xFF, 0xF5, 0x9F }, NULL, NULL, 0xD5CA46C2, 0xF8555155, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "MAME 64 Demo (PD) [b1]", { 0x38, 0x03, 0xF7, 0x09, 0x82, 0x90, 0x7C, 0x7C, 0x24, 0x71, 0x3A, 0x7F, 0x97, 0x42, 0xB6, 0xCD }, NULL, NULL, 0x9CCE5B1D, 0x6351E283, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "MAME 64 Demo (PD) [b2]", { 0x0E, 0x25, 0x16, 0xC6, 0x5B, 0x94, 0x21, 0x4C, 0x89, 0x1B, 0x2D, 0x07, 0xC3, 0xD9, 0x2A, 0xEC }, NULL, NULL, 0x9CCE5B1D, 0x6351E283, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "MAME 64 Demo (PD)", { 0x42, 0xAC, 0x30, 0x39, 0x96, 0x88, 0xF9, 0x8E, 0x58, 0xBE, 0x6A, 0xD1, 0xD2, 0x21, 0x7E, 0x56 }, NULL, NULL, 0x9CCE5B1D, 0x6351E283, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "MAME 64 V1.0 (PD) [b1]", { 0xC9, 0x31, 0x9D, 0x97, 0xDA, 0xBE, 0x9E, 0x84, 0x24, 0x01, 0x43, 0x3A, 0x27, 0xE0, 0x0D, 0xAC }, NULL, NULL, 0x9CCE5B1D, 0x6351E283, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "MAME 64 V1.0 (PD)", { 0x65, 0x91, 0xA5, 0xFC, 0xFF, 0xF8, 0x87, 0x93, 0x82, 0xC9, 0x66, 0x90, 0x6C, 0x31, 0x86, 0xE0 }, NULL, NULL, 0x9CCE5B1D, 0x6351E283, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "MMR by Count0 (PD) [b1]", { 0xD6, 0x3F, 0xAF, 0x99, 0xE7, 0x87, 0x6C, 0x39, 0xA9, 0xAC, 0xA2, 0x65, 0x95, 0x96, 0x34, 0x2F }, NULL, NULL, 0x9E6581AB, 0x57CC8CED, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "MMR by Count0 (PD)", { 0x65, 0xB7, 0x1F, 0x40, 0x4D, 0xC3, 0xCF, 0x9A, 0x13, 0x5D, 0x32, 0x29, 0xFF, 0xEA, 0x3C, 0x15 }, NULL, NULL, 0x9E6581AB, 0x57CC8CED, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mini Racers (U) (Prototype)", { 0x9C, 0x6C, 0xF9, 0xD3, 0xCB, 0x58, 0x52, 0x43, 0x9D, 0xE4, 0xEF, 0x4A, 0x39, 0x92, 0x53, 0xB9 }, NULL, NULL, 0x21548CA9, 0x9059F32C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "MRC - Multi Racing Championship (E) (M3) [!]", { 0x00, 0x54, 0xB7, 0xFC, 0x0C, 0x2A, 0xCB, 0xED, 0x65, 0x0E, 0xFE, 0x72, 0x7C, 0xDB, 0xA4, 0x72 }, NULL, NULL, 0xB8F0BD03, 0x4479189E, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (E) (M3) [b1]", { 0x36, 0x2D, 0x10, 0xC7, 0xD2, 0x70, 0xAE, 0x48, 0xD8, 0x3D, 0x1D, 0x7B, 0xB7, 0x8B, 0xF5, 0x27 }, NULL, NULL, 0xB8F0BD03, 0x4479189E, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (E) (M3) [b2]", { 0x25, 0xE3, 0x9A, 0x8B, 0x45, 0xFD, 0xDF, 0xA1, 0x98, 0x9C, 0xE6, 0x66, 0x2F, 0x87, 0xEF, 0x23 }, NULL, NULL, 0xB8F0BD03, 0x4479189E, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (E) (M3) [b3]", { 0xF5, 0x72, 0x3C, 0x4C, 0xCF, 0xB9, 0xA1, 0xCE, 0x28, 0x42, 0x69, 0x62, 0xD5, 0x9C, 0xC8, 0x5F }, NULL, NULL, 0xB8F0BD03, 0x4479189E, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (E) (M3) [h1C]", { 0xFE, 0xA0, 0x6F, 0x46, 0xF6, 0x1D, 0xEB, 0x72, 0x1C, 0xF9, 0x05, 0xC7, 0x85, 0x29, 0x99, 0x94 }, NULL, NULL, 0xB8F0BD03, 0x4479189E, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (E) (M3) [o1]", { 0x74, 0x90, 0x4F, 0x30, 0x2A, 0x25, 0x62, 0x0D, 0x7F, 0x63, 0xC0, 0xCB, 0x53, 0x33, 0xD4, 0x64 }, NULL, NULL, 0xB8F0BD03, 0x4479189E, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (J) [!]", { 0x8E, 0x18, 0x06, 0x4A, 0x2C, 0x4B, 0x3E, 0xC1, 0x5A, 0x20, 0xC3, 0xD6, 0x76, 0x64, 0x4B, 0x3A }, NULL, NULL, 0xA6B6B413, 0x15D113CC, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (J) [b1]", { 0xC3, 0x06, 0xC8, 0x0A, 0x07, 0x74, 0x3F, 0x75, 0xB0, 0xC6, 0x9A, 0xF2, 0xB4, 0x84, 0xE9, 0x57 }, NULL, NULL, 0xA6B6B413, 0x15D113CC, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (J) [b2]", { 0xCB, 0xA2, 0xCC, 0xCD, 0x3C, 0x37, 0x72, 0xB9, 0x6C, 0xDA, 0x71, 0x28, 0x09, 0x0C, 0x1F, 0xD7 }, NULL, NULL, 0xA6B6B413, 0x15D113CC, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (J) [b3]", { 0x8F, 0x33, 0xFE, 0x36, 0x83, 0x71, 0x98, 0xB3, 0xF2, 0x1C, 0xC1, 0xF3, 0x7F, 0xC6, 0x7C, 0xC8 }, NULL, NULL, 0xA6B6B413, 0x15D113CC, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (J) [b4]", { 0x60, 0x73, 0x17, 0x4A, 0x8D, 0xA1, 0x30, 0x5C, 0xF9, 0x1B, 0x59, 0x36, 0x9F, 0xAE, 0xFD, 0xDF }, NULL, NULL, 0xA6B6B413, 0x15D113CC, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (J) [b5]", { 0xBB, 0x82, 0xAD, 0xC5, 0x15, 0x62, 0xF8, 0xCD, 0xDC, 0xDF, 0x4F, 0x6F, 0xAD, 0x24, 0x79, 0xBA }, NULL, NULL, 0xA6B6B413, 0x15D113CC, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (U) [!]", { 0xFC, 0x61, 0xD6, 0x0F, 0x2C, 0x6F, 0xE4, 0x61, 0x0F, 0x70, 0xCE, 0x49, 0x49, 0xA7, 0xA0, 0x62 }, NULL, NULL, 0x2AF9B65C, 0x85E2A2D7, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (U) [b1]", { 0xE3, 0x8F, 0x1D, 0xAE, 0x2A, 0x20, 0x23, 0xA5, 0x29, 0xB4, 0x7A, 0x26, 0xE4, 0x66, 0x67, 0x59 }, NULL, NULL, 0x2AF9B65C, 0x85E2A2D7, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (U) [b2]", { 0x53, 0x59, 0x95, 0x50, 0x61, 0x05, 0xD0, 0xEA, 0xBA, 0x79, 0x6E, 0x37, 0x16, 0x60, 0xCB, 0xF2 }, NULL, NULL, 0x2AF9B65C, 0x85E2A2D7, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (U) [b3]", { 0x7E, 0x8F, 0x02, 0x84, 0x11, 0x74, 0x6C, 0xF8, 0x16, 0x84, 0x83, 0x84, 0xB7, 0x88, 0xB6, 0x24 }, NULL, NULL, 0x2AF9B65C, 0x85E2A2D7, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MRC - Multi Racing Championship (U) [o1]", { 0x67, 0x73, 0x56, 0x69, 0x1E, 0x55, 0xA9, 0x06, 0x17, 0x72, 0x58, 0x5C, 0xDD, 0xFD, 0x7F, 0x76 }, NULL, NULL, 0x2AF9B65C, 0x85E2A2D7, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "MSFTUG Intro #1 by LaC (PD)", { 0x72, 0xF3, 0x24, 0xB7, 0xE1, 0x15, 0x61, 0x87, 0x71, 0xC5, 0x06, 0xAF, 0x3F, 0x60, 0x4F, 0x8F }, NULL, NULL, 0x94D3D5CB, 0xE8808606, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mace - The Dark Age (E) [!]", { 0x52, 0x38, 0x83, 0xA7, 0x66, 0xC6, 0x62, 0xE8, 0x37, 0x7C, 0xD2, 0x56, 0x75, 0x5B, 0x27, 0xB4 }, NULL, NULL, 0x1145443D, 0x11610EDB, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (E) [b1]", { 0x9C, 0xF1, 0x67, 0x83, 0x68, 0x76, 0x86, 0xC8, 0xFE, 0x2A, 0xBE, 0x0B, 0x71, 0x31, 0x6C, 0x3D }, NULL, NULL, 0x1145443D, 0x11610EDB, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (E) [b2]", { 0x22, 0x49, 0xD9, 0x31, 0xB5, 0xD2, 0xD4, 0x54, 0x4E, 0xEB, 0x75, 0xE5, 0xB4, 0x13, 0x67, 0x09 }, NULL, NULL, 0x1145443D, 0x11610EDB, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (E) [o1]", { 0x87, 0xBD, 0x53, 0x30, 0x84, 0xAC, 0xB4, 0xDC, 0x6C, 0x3E, 0x01, 0xB3, 0x2F, 0x26, 0x35, 0x7C }, NULL, NULL, 0x1145443D, 0x11610EDB, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (E) [o2]", { 0x8E, 0x2B, 0x95, 0x16, 0x78, 0x78, 0x5D, 0xB1, 0xF5, 0x4A, 0x31, 0xF7, 0x78, 0xBF, 0xA4, 0x91 }, NULL, NULL, 0x1145443D, 0x11610EDB, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (U) [!]", { 0x39, 0xA2, 0xBC, 0xA1, 0xC1, 0x7C, 0xD4, 0xCF, 0x1A, 0x9F, 0x3A, 0xE2, 0xB7, 0x25, 0xB5, 0xC6 }, NULL, NULL, 0x6B700750, 0x29D621FE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (U) [b1]", { 0xDF, 0x34, 0x2B, 0x03, 0x2E, 0xD1, 0xED, 0x15, 0xC2, 0x44, 0x48, 0xEC, 0x6B, 0xE9, 0xF3, 0x4E }, NULL, NULL, 0x6B700750, 0x29D621FE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (U) [b2]", { 0x57, 0xCB, 0x2D, 0x2F, 0x6C, 0x87, 0xF5, 0x20, 0x01, 0x6A, 0xAC, 0xF7, 0xE2, 0x78, 0x52, 0x22 }, NULL, NULL, 0x6B700750, 0x29D621FE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (U) [b3]", { 0xD1, 0xCE, 0x0F, 0xA3, 0xD4, 0x6C, 0xA2, 0x7F, 0x1C, 0x15, 0xE7, 0x82, 0xAC, 0xEC, 0x49, 0xDA }, NULL, NULL, 0x022E6456, 0x75BBB3C7, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (U) [b4]", { 0x24, 0x3F, 0x8C, 0x40, 0x67, 0xD5, 0x0D, 0x99, 0x4C, 0x1E, 0x88, 0x39, 0x68, 0xDE, 0x8C, 0x61 }, NULL, NULL, 0x022E6456, 0x75BBB3C7, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (U) [b5]", { 0x88, 0xB6, 0x38, 0x82, 0x5A, 0x16, 0xE4, 0x68, 0x37, 0xFB, 0x52, 0x1E, 0xDA, 0x32, 0x8C, 0x5A }, NULL, NULL, 0x6B700750, 0x29D621FE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (U) [b6]", { 0x62, 0xA0, 0xCE, 0x9A, 0x58, 0x27, 0x38, 0x11, 0xE3, 0x4C, 0xC7, 0x3B, 0xE8, 0xE6, 0xF8, 0xC4 }, NULL, NULL, 0x6B700750, 0x29D621FE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (U) [b7]", { 0xB9, 0x6A, 0xBF, 0xBD, 0x74, 0x6B, 0xC2, 0x52, 0x43, 0xD6, 0x07, 0x61, 0x32, 0x97, 0xD7, 0x69 }, NULL, NULL, 0x6B700750, 0x29D621FE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (U) [b8]", { 0x1D, 0x4B, 0xD8, 0x85, 0xDB, 0x0C, 0x0C, 0x53, 0x65, 0x69, 0x85, 0x26, 0x07, 0x7E, 0x10, 0xF4 }, NULL, NULL, 0x6B700750, 0x29D621FE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (U) [b9]", { 0x1C, 0x89, 0x7E, 0xC0, 0x59, 0xC6, 0xC3, 0x4C, 0x8E, 0xD5, 0x7E, 0x19, 0x65, 0x41, 0x0F, 0x2E }, NULL, NULL, 0x6B700750, 0x29D621FE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mace - The Dark Age (U) [o1]", { 0x64, 0xD5, 0x08, 0xC5, 0xE0, 0xF1, 0x05, 0x00, 0x48, 0xBE, 0x42, 0x9E, 0x20, 0xEF, 0x4B, 0x07 }, NULL, NULL, 0x6B700750, 0x29D621FE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Madden Football 64 (E) [!]", { 0x67, 0xC9, 0x60, 0x76, 0x45, 0x9E, 0xB5, 0xF7, 0x17, 0x33, 0xF3, 0x9D, 0x7F, 0xCC, 0x76, 0xA3 }, NULL, NULL, 0xA197CB52, 0x7520DE0E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Madden Football 64 (E) [b1]", { 0x5C, 0xBF, 0x54, 0x62, 0x76, 0x93, 0xF8, 0x00, 0x52, 0x40, 0x38, 0x12, 0x7B, 0xBF, 0x46, 0xBF }, NULL, NULL, 0xA197CB52, 0x7520DE0E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Madden Football 64 (U) [!]", { 0x90, 0x3B, 0x91, 0x2C, 0xE8, 0x86, 0x26, 0x90, 0x02, 0x21, 0x73, 0x12, 0x24, 0xE9, 0xDB, 0xE8 }, NULL, NULL, 0x13836389, 0x265B3C76, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Madden Football 64 (U) [b1]", { 0x5C, 0xA2, 0xA7, 0xF7, 0x12, 0xB6, 0xC5, 0x73, 0x7D, 0x0B, 0x46, 0xE6, 0x7C, 0x8D, 0xDA, 0x44 }, NULL, NULL, 0x13836389, 0x265B3C76, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Madden Football 64 (U) [b2]", { 0x9A, 0xE9, 0x41, 0xA1, 0x29, 0x74, 0xB7, 0xB5, 0x6C, 0xFA, 0x8B, 0x5E, 0xA1, 0xE6, 0x70, 0xD7 }, NULL, NULL, 0x13836389, 0x265B3C76, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Madden Football 64 (U) [h1C]", { 0xCA, 0x71, 0x61, 0xF2, 0x98, 0xDF, 0x38, 0xBC, 0x81, 0x82, 0xB2, 0x1B, 0xB7, 0x54, 0xDB, 0x4B }, NULL, NULL, 0x13836389, 0x265B3C76, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Madden Football 64 (U) [o1]", { 0x73, 0x21, 0x67, 0xD1, 0x9C, 0x62, 0x7C, 0xAF, 0x73, 0x84, 0xC7, 0x80, 0xC6, 0x4A, 0xB8, 0x0A }, NULL, NULL, 0x13836389, 0x265B3C76, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Madden Football 64 (U) [o1][h1C]", { 0xE9, 0x79, 0xBF, 0x2E, 0x2B, 0x43, 0xCC, 0xB5, 0xE2, 0xE0, 0xA2, 0x79, 0x8A, 0xD7, 0x77, 0x0C }, NULL, NULL, 0x13836389, 0x265B3C76, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Madden Football 64 (U) [o2]", { 0x09, 0x66, 0xCB, 0x68, 0x8D, 0x6A, 0x5F, 0x1B, 0x22, 0xB4, 0xFA, 0xB5, 0xA3, 0x93, 0xC0, 0xE2 }, NULL, NULL, 0x13836389, 0x265B3C76, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Madden Football 64 (U) [o3]", { 0xDB, 0x24, 0xA5, 0xDB, 0xA6, 0x8F, 0x21, 0xD4, 0x51, 0x3A, 0x37, 0xF7, 0xA7, 0xB0, 0xCF, 0x60 }, NULL, NULL, 0x13836389, 0x265B3C76, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Madden NFL 2000 (U) [!]", { 0x95, 0x5D, 0x19, 0xE2, 0x6B, 0x4B, 0xA7, 0xCC, 0x94, 0x1F, 0x86, 0xA5, 0x4A, 0x0F, 0xC1, 0x3D }, NULL, NULL, 0x0CB81686, 0x5FD85A81, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Madden NFL 2001 (U) [!]", { 0x44, 0x1F, 0xA6, 0x5F, 0xAA, 0x5C, 0x12, 0x33, 0x9F, 0x89, 0xA0, 0xBB, 0x7D, 0xB4, 0x3C, 0x8F }, NULL, NULL, 0xEB38F792, 0x190EA246, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Madden NFL 2002 (U) [!]", { 0xAD, 0x0F, 0x2E, 0xC5, 0x65, 0xD7, 0x57, 0x5F, 0xB3, 0x75, 0x12, 0xBC, 0x8D, 0xF8, 0xA0, 0x92 }, NULL, NULL, 0xD7134F8D, 0xC11A00B5, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Madden NFL 99 (E) [!]", { 0xE7, 0xBF, 0x80, 0x86, 0x1A, 0x0A, 0xB2, 0xA7, 0x88, 0x95, 0x94, 0x63, 0xD9, 0x53, 0xB5, 0xD5 }, NULL, NULL, 0x3925D625, 0x8C83C75E, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Madden NFL 99 (E) [h1C]", { 0x9C, 0xB5, 0xF5, 0xCD, 0x6A, 0xB1, 0x41, 0x45, 0x4D, 0x64, 0x5C, 0x92, 0xFD, 0x9B, 0xF6, 0x7C }, NULL, NULL, 0x3925D625, 0x8C83C75E, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Madden NFL 99 (U) [!]", { 0x50, 0x7C, 0xEA, 0xB7, 0x2E, 0xF2, 0xA1, 0xBF, 0x14, 0x5B, 0xF1, 0x90, 0xF5, 0xCE, 0x1C, 0x80 }, NULL, NULL, 0xDEB78BBA, 0x52F6BD9D, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Madden NFL 99 (U) [o1]", { 0xC0, 0x49, 0xFC, 0xD4, 0xCB, 0x18, 0x5A, 0x55, 0x3D, 0x81, 0x22, 0xCF, 0xE6, 0xC3, 0x01, 0x39 }, NULL, NULL, 0xDEB78BBA, 0x52F6BD9D, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Madden NFL 99 (U) (V1.1) [!]", { 0x5A, 0xD8, 0x0A, 0x8E, 0xF4, 0x4D, 0xEE, 0x1F, 0xDC, 0x45, 0x6D, 0x66, 0x10, 0x41, 0x65, 0xB4 }, NULL, NULL, 0xDF09D625, 0x1791C87D, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Madden NFL 99 (Beta) (1998-08-05) [!]", { 0x5F, 0x3D, 0x42, 0xD5, 0xF9, 0x61, 0x91, 0xF3, 0xCE, 0x50, 0xD7, 0x0E, 0x0E, 0x42, 0x12, 0x7A }, NULL, NULL, 0x076F8FB3, 0x509A2054, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Magical Tetris Challenge (E) [!]", { 0x20, 0xE5, 0x1B, 0x27, 0xE8, 0x09, 0x8A, 0x9D, 0x10, 0x1B, 0x44, 0x68, 0x90, 0x14, 0xC2, 0x81 }, NULL, NULL, 0xE4906679, 0x9F243F05, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Magical Tetris Challenge (E) [b1]", { 0x20, 0xD0, 0x2E, 0xEC, 0xFA, 0x88, 0x7D, 0xC5, 0xA3, 0x19, 0x48, 0xB1, 0x8B, 0x4B, 0xB1, 0x8D }, NULL, NULL, 0xE4906679, 0x9F243F05, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Magical Tetris Challenge (E) [f1] (NTSC)", { 0x5B, 0xDE, 0x53, 0x96, 0x0A, 0xD9, 0x5F, 0x4C, 0x25, 0xC7, 0x6C, 0x0F, 0x70, 0xC3, 0x52, 0x44 }, NULL, NULL, 0x70BF6C4C, 0x6F365E21, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Magical Tetris Challenge (G) [!]", { 0xE0, 0x99, 0x2A, 0x90, 0x19, 0x1B, 0xE4, 0xF1, 0xB2, 0xBA, 0x02, 0x25, 0x85, 0x99, 0x33, 0x4E }, NULL, NULL, 0xE1EF93F7, 0x14908B0B, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Magical Tetris Challenge (U) [!]", { 0x79, 0xFC, 0xC9, 0x80, 0x02, 0xD1, 0xF4, 0xC7, 0x9D, 0xEA, 0xF5, 0x57, 0x84, 0x22, 0x2D, 0xF8 }, NULL, NULL, 0x75B61647, 0x7ADABF78, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Magical Tetris Challenge (U) [b1][hI]", { 0xBD, 0x5B, 0xB4, 0xCE, 0x1F, 0xAC, 0xE9, 0x11, 0xF9, 0xD8, 0xC7, 0x77, 0xE2, 0x59, 0x49, 0x98 }, NULL, NULL, 0xCDCCFF87, 0x1D76A49E, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Magical Tetris Challenge (U) [hI]", { 0x36, 0xBE, 0xDF, 0xD1, 0x5C, 0xB7, 0x04, 0x78, 0x91, 0x6B, 0xAA, 0x46, 0x94, 0x91, 0xD8, 0x0D }, NULL, NULL, 0xCDCCFF87, 0x1D76A49E, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Magical Tetris Challenge Featuring Mickey (J) [!]", { 0xF1, 0xFF, 0x1F, 0x36, 0x4C, 0x45, 0x97, 0x01, 0xF4, 0x2B, 0xEB, 0x89, 0x89, 0x67, 0x5D, 0x44 }, NULL, NULL, 0x80C8564A, 0x929C65AB, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Magical Tetris Challenge Featuring Mickey (J) [b1]", { 0x9F, 0x6D, 0xB6, 0x72, 0x62, 0x22, 0x0C, 0x62, 0x53, 0x6C, 0xEB, 0xE0, 0xAF, 0x3C, 0x8E, 0x73 }, NULL, NULL, 0xE6FCB468, 0xCFAC7528, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mahjong 64 (J) [!]", { 0x8A, 0xE2, 0xE8, 0xF0, 0xC3, 0x56, 0xFE, 0xE6, 0x38, 0xC8, 0xD9, 0x08, 0xDC, 0xBB, 0x33, 0x81 }, NULL, NULL, 0xC53EDC41, 0xECE19359, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Mahjong 64 (J) [o1]", { 0xE6, 0x76, 0x51, 0xE5, 0x8A, 0x4B, 0x86, 0x47, 0x65, 0xA7, 0x52, 0xE3, 0xBE, 0xB5, 0xF4, 0xE4 }, NULL, NULL, 0xC53EDC41, 0xECE19359, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Mahjong 64 (J) [o2]", { 0xF9, 0x31, 0xE1, 0xDF, 0x95, 0x24, 0xBA, 0xCE, 0xF6, 0xB7, 0x31, 0xD5, 0x0D, 0x7D, 0xC1, 0x0F }, NULL, NULL, 0xC53EDC41, 0xECE19359, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Mahjong Hourouki Classic (J) [!]", { 0xE9, 0x42, 0xA3, 0xEE, 0xB1, 0xEB, 0x57, 0x2B, 0xAD, 0xD6, 0xF7, 0x05, 0xEB, 0x12, 0xA2, 0x2C }, NULL, NULL, 0xCCCC821E, 0x96E88A83, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Mahjong Hourouki Classic (J) [b1]", { 0x50, 0xA8, 0xB4, 0x7E, 0x5F, 0x8F, 0xE5, 0xBF, 0x95, 0x5A, 0xFA, 0x70, 0xFE, 0x38, 0x93, 0xAC }, NULL, NULL, 0xCCCC821E, 0x96E88A83, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Mahjong Hourouki Classic (J) [b2]", { 0xD2, 0xCB, 0x04, 0xB8, 0x8E, 0x56, 0x51, 0x70, 0xD8, 0x20, 0xE3, 0xCF, 0x78, 0xB5, 0x48, 0x63 }, NULL, NULL, 0xCCCC821E, 0x96E88A83, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Mahjong Hourouki Classic (J) [b3]", { 0xD1, 0x85, 0x5B, 0x19, 0xBA, 0x0D, 0x65, 0xC1, 0x03, 0xFE, 0x93, 0x18, 0xF1, 0x4F, 0x5D, 0x7D }, NULL, NULL, 0xCCCC821E, 0x96E88A83, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Mahjong Master (J) [!]", { 0xCF, 0x0D, 0x22, 0x8E, 0x8E, 0xFD, 0xF8, 0x23, 0xA2, 0x27, 0x97, 0x9B, 0xB3, 0x52, 0xDD, 0x5B }, NULL, NULL, 0x0FC42C70, 0x8754F1CD, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Mahjong Master (J) [b1]", { 0xAD, 0x1A, 0xD9, 0xFE, 0x15, 0xC4, 0x56, 0x5F, 0xF8, 0x8B, 0x9B, 0x48, 0xAF, 0x6F, 0x30, 0x0C }, NULL, NULL, 0x0FC42C70, 0x8754F1CD, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Mahjong Master (J) [b2]", { 0xE0, 0xD1, 0x17, 0x0D, 0x52, 0x1B, 0x49, 0xE3, 0xA5, 0xED, 0xAC, 0xA3, 0xA6, 0xF5, 0x79, 0xAB }, NULL, NULL, 0x0FC42C70, 0x8754F1CD, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Mahjong Master (J) [o1]", { 0x3B, 0xD1, 0x6F, 0x3D, 0xDB, 0x0D, 0xD8, 0x90, 0x41, 0x2B, 0xFE, 0x1E, 0x59, 0xCA, 0x54, 0x63 }, NULL, NULL, 0x0FC42C70, 0x8754F1CD, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Major League Baseball Featuring Ken Griffey Jr. (E) [!]", { 0x15, 0x2B, 0x99, 0x39, 0xA5, 0xF5, 0x07, 0x34, 0xD5, 0x40, 0x19, 0x80, 0x02, 0x88, 0x56, 0xB4 }, NULL, NULL, 0xCDB998BE, 0x1024A5C8, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Major League Baseball Featuring Ken Griffey Jr. (E) [b1]", { 0x62, 0xCD, 0x83, 0xFC, 0x8F, 0xC8, 0xE8, 0xCF, 0x88, 0x99, 0x32, 0x0B, 0xF2, 0x54, 0x74, 0xCE }, NULL, NULL, 0x59F34558, 0x0C3130E4, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Major League Baseball Featuring Ken Griffey Jr. (E) [f1]", { 0xD5, 0x69, 0x6C, 0xB5, 0xA4, 0xF2, 0x18, 0x5B, 0xD8, 0x46, 0x9D, 0xF0, 0x18, 0xB7, 0x85, 0x6B }, NULL, NULL, 0x59F34558, 0x0C3130E4, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Major League Baseball Featuring Ken Griffey Jr. (U) [!]", { 0x76, 0x4F, 0x22, 0xAD, 0x3D, 0x0F, 0x59, 0x66, 0x7A, 0x7F, 0x08, 0x3D, 0x2F, 0x78, 0x9B, 0x31 }, NULL, NULL, 0x80C1C05C, 0xEA065EF4, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Major League Baseball Featuring Ken Griffey Jr. (U) [b1]", { 0x97, 0xFE, 0x61, 0xE8, 0x71, 0x9C, 0xF0, 0xA4, 0x74, 0x73, 0x01, 0xE9, 0x7C, 0x75, 0x9C, 0xBF }, NULL, NULL, 0xB1CF1114, 0x5E59B81D, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Major League Baseball Featuring Ken Griffey Jr. (U) [b2]", { 0xE1, 0xBD, 0x01, 0x69, 0x61, 0xED, 0xEB, 0x89, 0x5F, 0x12, 0x67, 0x6A, 0xD4, 0xB7, 0x7F, 0xB5 }, NULL, NULL, 0x0BFC12D9, 0x1B377DA7, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Major League Baseball Featuring Ken Griffey Jr. (U) [b3]", { 0x16, 0xF2, 0x64, 0x41, 0x56, 0xAC, 0x9D, 0xD1, 0x5C, 0xA8, 0xCC, 0x01, 0xDE, 0xAE, 0x5E, 0x7E }, NULL, NULL, 0x80C1C05C, 0xEA065EF4, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Major League Baseball Featuring Ken Griffey Jr. (U) [f1]", { 0x25, 0x70, 0x57, 0x55, 0x3D, 0x60, 0xC1, 0xDD, 0x1B, 0x7F, 0xDC, 0x58, 0x14, 0xCB, 0x21, 0xD9 }, NULL, NULL, 0xB1CF1114, 0x5E59B81D, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mandelbrot Zoomer by RedBox (PD)", { 0x30, 0xB2, 0xE1, 0xF7, 0xF3, 0xAF, 0xDC, 0x5D, 0x8E, 0x6A, 0x42, 0xC8, 0x88, 0x5A, 0xAD, 0x93 }, NULL, NULL, 0x30E6FE79, 0x3EEA5386, 3, SAVETYPE_NONE, 0, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Manic Miner - Hidden Levels by RedboX (PD)", { 0x4E, 0x05, 0x46, 0x10, 0xA8, 0x72, 0xE1, 0x31, 0x32, 0x28, 0x63, 0x7C, 0x81, 0x5E, 0x51, 0x4C }, NULL, NULL, 0xA47D4AD4, 0xF5B0C6CB, 1, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Manic Miner by RedboX (PD)", { 0xB1, 0x8B, 0xC6, 0x0E, 0xA6, 0xB9, 0xC7, 0x20, 0x48, 0xFD, 0x84, 0xA2, 0xB8, 0xF1, 0x82, 0xD4 }, NULL, NULL, 0xA47D4AD4, 0x8BFA81F9, 1, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Mario Artist: Communication Kit (J) [CART HACK]", { 0x59, 0xF0, 0x83, 0x9C, 0xAE, 0x93, 0x5F, 0x8B, 0x06, 0xBA, 0xEC, 0x43, 0x4C, 0xB2, 0x93, 0x18 }, NULL, NULL, 0xAB9EB27D, 0x5F05605F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mario Artist: Polygon Studio (J) [CART HACK]", { 0x6A, 0x2B, 0x06, 0x06, 0x06, 0xCF, 0xC2, 0x0E, 0x0E, 0xE0, 0xA2, 0x67, 0x59, 0xFE, 0x00, 0x1B }, NULL, NULL, 0x2D5EFCC5, 0x98CF79D2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mario Artist: Paint Studio (J) [CART HACK]", { 0x9C, 0x1E, 0x3D, 0x60, 0x7B, 0x1C, 0xC5, 0xFB, 0x90, 0xAD, 0x62, 0xD3, 0xF0, 0x2A, 0x50, 0xED }, NULL, NULL, 0x3A3EB7FB, 0x0DDD515C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x213 },
+    { "Mario Artist: Paint Studio (J) [CART HACK] [T+Eng0.2_LuigiBlood]", { 0xE8, 0x11, 0x55, 0x4E, 0x6C, 0x6A, 0x61, 0xBE, 0x75, 0x0A, 0x1E, 0xD3, 0x15, 0x90, 0x98, 0x40 }, NULL, NULL, 0xDD16F47C, 0xA8B748C7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x213 },
+    { "Mario Artist: Talent Studio (J) [CART HACK]", { 0xED, 0x1C, 0xBF, 0xC5, 0xD3, 0x75, 0x6A, 0x15, 0x20, 0xCD, 0x2D, 0x57, 0xF6, 0x99, 0x8B, 0xDF }, NULL, NULL, 0x4CBC3B56, 0xFDB69B1C, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x213 },
+    { "Mario Artist: Talent Studio (J) [CART HACK] [T+Eng0.1_LuigiBlood]", { 0x33, 0x6A, 0xE6, 0x3B, 0xD1, 0xEB, 0xAC, 0xC6, 0x4D, 0x9D, 0x92, 0x37, 0x0B, 0x55, 0x55, 0x37 }, NULL, NULL, 0x73C0403D, 0xE821D951, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x213 },
+    { "Mario Golf (E) [!]", { 0x55, 0x63, 0x4F, 0xF9, 0x0E, 0xE9, 0x97, 0x79, 0x07, 0x81, 0xF7, 0x9A, 0x5B, 0x00, 0x97, 0xEE }, NULL, NULL, 0x62E957D0, 0x7FC15A5D, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf (E) [b1]", { 0x4D, 0x01, 0x0A, 0xE1, 0xAF, 0x4B, 0x04, 0xD6, 0xB7, 0x0B, 0x79, 0x9C, 0x56, 0xF0, 0x59, 0x93 }, NULL, NULL, 0x62E957D0, 0x7FC15A5D, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf (E) [f1] (Z64-Save)", { 0xCF, 0x6B, 0xD6, 0xE2, 0x0B, 0x40, 0x63, 0x5B, 0x0E, 0x6D, 0xED, 0x5B, 0xB5, 0x11, 0x48, 0x75 }, NULL, NULL, 0x1D82BE21, 0x7EF19C9A, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf (E) [f2] (Z64-Save)", { 0x02, 0xC8, 0xE8, 0xFD, 0x7E, 0xB1, 0x9B, 0xFE, 0xB3, 0x25, 0xE2, 0xDB, 0x03, 0x80, 0x50, 0x6A }, NULL, NULL, 0x1D82BE21, 0x7EF19C9A, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf (E) [h1C]", { 0x18, 0xE0, 0x9C, 0x06, 0x50, 0xFA, 0x3F, 0x83, 0xA9, 0x00, 0x89, 0xDA, 0xDD, 0x96, 0xA2, 0x13 }, NULL, NULL, 0x62E957D0, 0x7FC15A5D, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf (E) [o1][h1C]", { 0x78, 0xBB, 0x5B, 0x9A, 0x27, 0x91, 0x56, 0xBD, 0x61, 0xBE, 0x13, 0x28, 0x17, 0xA9, 0xB2, 0xC8 }, NULL, NULL, 0x62E957D0, 0x7FC15A5D, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf (U) [!]", { 0x90, 0x3E, 0x69, 0x29, 0x66, 0x65, 0x31, 0xD7, 0x2D, 0x05, 0xD1, 0xE4, 0xC5, 0x22, 0xE3, 0x05 }, NULL, NULL, 0x664BA3D4, 0x678A80B7, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf (U) [b1]", { 0xD3, 0x14, 0x66, 0xB4, 0xB1, 0x4B, 0x03, 0x38, 0x7F, 0xE5, 0x2F, 0xBB, 0xBC, 0xD2, 0x5A, 0x5C }, NULL, NULL, 0xE8761702, 0x26AD5DBE, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf (U) [b1][f1] (PAL)", { 0x11, 0xFE, 0xD9, 0x30, 0xD4, 0xC4, 0xDD, 0x0C, 0xA7, 0xCB, 0x03, 0xB5, 0xF1, 0xBF, 0x0A, 0x12 }, NULL, NULL, 0x84CDFB72, 0x9CA8D544, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf (U) [b2]", { 0x37, 0x4F, 0xD8, 0x1C, 0x3E, 0x8E, 0x85, 0x8E, 0xEB, 0x22, 0x26, 0x50, 0x16, 0x59, 0xB3, 0x33 }, NULL, NULL, 0x84CDFB72, 0x9CA8D544, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf (U) [b3]", { 0x7A, 0x5D, 0x0D, 0x77, 0xA4, 0x62, 0xB5, 0xA7, 0xC3, 0x72, 0xFB, 0x19, 0xEF, 0xDE, 0x1A, 0x5F }, NULL, NULL, 0x664BA3D4, 0x678A80B7, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf (U) [f1] (PAL)", { 0xBE, 0x28, 0xEF, 0x71, 0xE1, 0xEE, 0x00, 0x92, 0xEE, 0xC4, 0xAA, 0x39, 0x5A, 0xCF, 0xEE, 0xFF }, NULL, NULL, 0x84CDFB72, 0x9CA8D544, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf (U) [f2] (Z64-Save)", { 0x2F, 0xAC, 0xDF, 0x2F, 0x3E, 0x52, 0xEE, 0x8A, 0x60, 0x3D, 0xE7, 0x93, 0x48, 0xE4, 0x41, 0xE6 }, NULL, NULL, 0xA19FA3D0, 0xE06B2D11, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf (U) [t1]", { 0x12, 0x56, 0x9B, 0x4F, 0xA5, 0x23, 0x9A, 0x3A, 0xD5, 0x3D, 0xE5, 0xD2, 0xE0, 0x24, 0x34, 0x88 }, NULL, NULL, 0x26647A17, 0x8D3980C3, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf 64 (J) (V1.0) [!]", { 0xCD, 0x87, 0xBA, 0x29, 0x98, 0xD6, 0x3C, 0x13, 0xB4, 0x36, 0x6E, 0xB2, 0xC5, 0x4E, 0x1E, 0xB6 }, NULL, NULL, 0xD48944D1, 0xB0D93A0E, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf 64 (J) (V1.0) [b1]", { 0xB5, 0xA9, 0x8C, 0xED, 0x4B, 0x9A, 0x10, 0x68, 0x29, 0x88, 0xCC, 0xB2, 0x19, 0xA5, 0xC9, 0xA7 }, NULL, NULL, 0xD48944D1, 0xB0D93A0E, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf 64 (J) (V1.0) [b1][f1] (PAL)", { 0x33, 0x4D, 0x4E, 0x84, 0x43, 0xA6, 0x7E, 0x96, 0x46, 0x49, 0xB2, 0x84, 0x28, 0xC8, 0xF1, 0xAE }, NULL, NULL, 0xB771E0A9, 0x7B4A96E6, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf 64 (J) (V1.0) [b2]", { 0x6D, 0x84, 0x65, 0x7C, 0x9A, 0x14, 0x5E, 0x67, 0xB2, 0xA8, 0xA6, 0x1C, 0xD3, 0x1A, 0x72, 0x18 }, NULL, NULL, 0xD48944D1, 0xB0D93A0E, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf 64 (J) (V1.0) [b3]", { 0xE5, 0xA0, 0x41, 0xB1, 0xB7, 0xC8, 0xE3, 0xB4, 0xC2, 0xE8, 0x17, 0x8E, 0x5A, 0x13, 0x8E, 0x2D }, NULL, NULL, 0xD48944D1, 0xB0D93A0E, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf 64 (J) (V1.0) [f1] (PAL)", { 0xC1, 0x40, 0x90, 0xCD, 0x5C, 0xF3, 0x13, 0xA4, 0x71, 0xB5, 0xCD, 0x3D, 0x55, 0xEC, 0x0B, 0x53 }, NULL, NULL, 0xB771E0A9, 0x7B4A96E6, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Golf 64 (J) (V1.1) [!]", { 0x57, 0x0B, 0x4F, 0x55, 0xA3, 0x00, 0x5B, 0x70, 0x9E, 0x6E, 0xD5, 0xD6, 0x25, 0x98, 0x1B, 0x90 }, NULL, NULL, 0x734F816B, 0xC6A6EB67, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Kart 64 (Ch) (V4) (iQue) [!]", { 0x78, 0x77, 0x1B, 0xEB, 0x34, 0x9D, 0x48, 0x1E, 0x69, 0xBA, 0xA9, 0x22, 0x5B, 0x36, 0xD6, 0x3A }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Mario Kart 64 (Ch) (V5) (iQue) [!]", { 0x5E, 0xA0, 0xED, 0x74, 0xCF, 0x1D, 0xDA, 0xAA, 0x96, 0x4D, 0x72, 0x8A, 0x12, 0x9E, 0x7C, 0xF9 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Mario Kart 64 (Ch) (V2) (iQue) (Manual) [!]", { 0xC7, 0x0A, 0xF6, 0x19, 0x7E, 0x67, 0xB3, 0x10, 0xF3, 0x16, 0xC3, 0x4C, 0xCE, 0xD6, 0x4C, 0x19 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Mario Kart 64 (Ch) (V6) (iQue) (Manual) [!]", { 0x76, 0x17, 0x6B, 0x23, 0x7D, 0x4F, 0x60, 0xE5, 0x9F, 0x98, 0xD2, 0x47, 0x28, 0x3D, 0x93, 0x65 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Mario Kart 64 (E) (V1.0) [!]", { 0x8F, 0xAD, 0x1E, 0x4F, 0xA7, 0xBA, 0xF1, 0x44, 0x3B, 0x7F, 0x21, 0xAD, 0x19, 0x47, 0xB4, 0x29 }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0xC3B6DE9D, 0x65D2DE76, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (E) (V1.0) (Super W00ting Hack)", { 0xEC, 0x0F, 0xAE, 0x80, 0x02, 0xAC, 0x63, 0x56, 0xE0, 0x47, 0x0C, 0xE2, 0x1B, 0xFE, 0xFA, 0x4F }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0xE470469D, 0xE105C984, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (E) (V1.0) [T+Ita_Cattivik66]", { 0xB9, 0x7F, 0xC8, 0xB1, 0xD0, 0x0B, 0x9D, 0x67, 0x3C, 0x22, 0x9C, 0xA7, 0xFA, 0xE4, 0x53, 0xD4 }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0xC3B6DE9D, 0x65D2DE76, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (E) (V1.0) [b1]", { 0xE2, 0x92, 0x55, 0x14, 0x71, 0x76, 0x6D, 0x7F, 0x51, 0x90, 0x7F, 0x2B, 0xC6, 0x50, 0x79, 0xAA }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0xC3B6DE9D, 0x65D2DE76, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (E) (V1.0) [b2]", { 0x8E, 0x63, 0x2F, 0x2A, 0xFF, 0x9A, 0xEF, 0x3F, 0x5C, 0x1A, 0xE2, 0xFE, 0xBD, 0x48, 0x2D, 0x9D }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0xC3B6DE9D, 0x65D2DE76, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (E) (V1.1) [!]", { 0x2B, 0xB1, 0x49, 0xA5, 0x83, 0xFD, 0xEF, 0xEA, 0x96, 0x80, 0x5F, 0x62, 0x8F, 0xE4, 0x2F, 0xD9 }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0x2577C7D4, 0xD18FAAAE, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (E) (V1.1) [T+Ita_Cattivik66][b1]", { 0x2A, 0x64, 0x63, 0x2C, 0x71, 0xFF, 0xB9, 0x0D, 0xF3, 0xAE, 0x83, 0x83, 0x6D, 0xED, 0xD7, 0xA6 }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0x2577C7D4, 0xD18FAAAE, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (E) (V1.1) [o1]", { 0xA3, 0x0C, 0xFA, 0x60, 0xCC, 0xCE, 0x25, 0xF1, 0x32, 0x4D, 0x4A, 0xD9, 0x8C, 0x26, 0xAF, 0x5D }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0x2577C7D4, 0xD18FAAAE, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (J) (V1.0) [!]", { 0xBF, 0x96, 0x4C, 0xEC, 0xA7, 0x8A, 0x13, 0xA8, 0x20, 0x55, 0xEB, 0xDA, 0x80, 0xB9, 0x5C, 0xCA }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0x6BFF4758, 0xE5FF5D5E, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (J) (V1.0) [T+Ita_Cattivik66][b1]", { 0x8F, 0xD3, 0xC0, 0x6E, 0xD1, 0x3C, 0xD2, 0x7B, 0xB3, 0xD6, 0x64, 0xC9, 0x2A, 0x45, 0x5A, 0xA8 }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0x6BFF4758, 0xE5FF5D5E, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (J) (V1.0) [b1]", { 0x37, 0xAA, 0x3A, 0x35, 0x4F, 0xBE, 0x50, 0x8F, 0x54, 0x49, 0xE0, 0xC5, 0x15, 0x08, 0x31, 0x28 }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0x6BFF4758, 0xE5FF5D5E, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (J) (V1.0) [b2]", { 0x80, 0xB4, 0xF9, 0x29, 0x70, 0xCB, 0xB1, 0x33, 0x44, 0xF5, 0x7E, 0x82, 0x7C, 0x60, 0x95, 0x9B }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0x6BFF4758, 0xE5FF5D5E, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (J) (V1.0) [o1]", { 0x36, 0x29, 0x59, 0x82, 0x65, 0x1A, 0x99, 0x74, 0xEB, 0x73, 0x42, 0xB1, 0xDD, 0x52, 0x45, 0xE1 }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0x6BFF4758, 0xE5FF5D5E, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (J) (V1.1) [!]", { 0x60, 0x53, 0x52, 0x65, 0xBA, 0xE4, 0x3D, 0xDF, 0xCB, 0xDB, 0x0D, 0x71, 0x59, 0x4B, 0x16, 0x93 }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0xC9C3A987, 0x5810344C, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (J) (V1.1) [b1]", { 0x23, 0x1F, 0x01, 0x34, 0xD2, 0x89, 0x9C, 0x08, 0x93, 0x0F, 0x6E, 0x34, 0x68, 0x2D, 0x2C, 0x0B }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0xC9C3A987, 0x5810344C, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (J) (V1.1) [b1][T+Ita_Cattivik66]", { 0x84, 0xF1, 0x1C, 0xAC, 0xB9, 0x60, 0x8E, 0x2E, 0x59, 0x5F, 0xA5, 0xFB, 0xB8, 0xC9, 0x1C, 0xE9 }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0xC9C3A987, 0x5810344C, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (J) (V1.1) [b1][f1] (PAL)", { 0xB5, 0xD6, 0x8F, 0xF8, 0xE5, 0xA9, 0x82, 0x40, 0x05, 0x56, 0xC5, 0x30, 0x40, 0x92, 0x63, 0xDB }, NULL, "81001A1C 2409,81001A1E 0002,81001C74 240A,81001C76 0002", 0xB6F68615, 0xF4E26039, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [!]", { 0x3A, 0x67, 0xD9, 0x98, 0x6F, 0x54, 0xEB, 0x28, 0x29, 0x24, 0xFC, 0xA4, 0xCD, 0x5F, 0x6D, 0xFF }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x3E5055B6, 0x2E92DA52, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) (Super W00ting Hack)", { 0xB6, 0x33, 0x46, 0x46, 0x5F, 0xE7, 0x0D, 0xA3, 0xB1, 0xE7, 0x49, 0x3C, 0xE5, 0xA1, 0x5A, 0x31 }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x4D9C55B6, 0x85E58D87, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [T+Ita0.01_Cattivik66]", { 0xD1, 0x95, 0x81, 0x41, 0x56, 0x6E, 0xCC, 0x49, 0x42, 0xC7, 0x1D, 0x1E, 0x97, 0x17, 0x16, 0x39 }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x3E5055B6, 0x2E92DA52, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [T+Ita1.0_Rulesless]", { 0x22, 0xFA, 0xCE, 0xD4, 0x32, 0xB0, 0xA9, 0xA4, 0xEC, 0x69, 0xA7, 0x94, 0x52, 0xD1, 0x60, 0x49 }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x4578A055, 0x3F31815D, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [T+Por1.0_Dr_X]", { 0x65, 0xCB, 0xD8, 0xDC, 0xEC, 0x6B, 0x7C, 0xE6, 0x1E, 0x1C, 0xB2, 0x33, 0xEF, 0xA4, 0xA3, 0x17 }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x3E5055B6, 0x2E92DA52, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [T+Spa1.1_Blade133bo]", { 0x79, 0x74, 0x37, 0x43, 0x90, 0x4E, 0xEA, 0x72, 0x7C, 0xB8, 0x27, 0x25, 0xBE, 0x76, 0x5E, 0xC6 }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x40CA1EC9, 0x8CC292D4, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [b1]", { 0x4A, 0x5E, 0x85, 0xA3, 0xE7, 0x11, 0x8A, 0x74, 0x2E, 0x36, 0x78, 0xF8, 0xF7, 0xE8, 0x2B, 0x0E }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x3E5055B6, 0x2E92DA52, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [b2]", { 0xAB, 0xDB, 0x8D, 0x8C, 0x53, 0xE1, 0xF9, 0x38, 0x85, 0x3E, 0xC8, 0x07, 0x42, 0xC8, 0xAF, 0x77 }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x3E5055B6, 0x2E92DA52, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [b3]", { 0xFE, 0x75, 0xAB, 0xB3, 0x93, 0x4F, 0x88, 0x42, 0x9E, 0x13, 0x80, 0x19, 0x14, 0x6E, 0x83, 0x93 }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x3E5055B6, 0x2E92DA52, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [b4]", { 0xC3, 0x56, 0x5B, 0x1C, 0x98, 0x3B, 0x83, 0xC6, 0xC9, 0x65, 0xBB, 0x88, 0xE2, 0x41, 0x35, 0xB2 }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x3E5055B6, 0x2E92DA52, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [h1C]", { 0x7D, 0x54, 0xD8, 0x88, 0x96, 0x4A, 0x3B, 0x0D, 0x05, 0x8E, 0xB8, 0x08, 0x86, 0xC4, 0x4C, 0x88 }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x3E5055B6, 0x2E92DA52, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [o1]", { 0x7C, 0x5E, 0x79, 0x4E, 0x85, 0x63, 0x11, 0x40, 0x3F, 0xEF, 0x54, 0x8D, 0xAE, 0x98, 0xA1, 0x83 }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x3E5055B6, 0x2E92DA52, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [o2]", { 0x6C, 0x63, 0x4D, 0x0C, 0xE7, 0xCD, 0x99, 0xCC, 0xCB, 0xB4, 0xCE, 0x8E, 0xB8, 0x37, 0xED, 0xB4 }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x3E5055B6, 0x2E92DA52, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [t1]", { 0x3A, 0xA8, 0xC8, 0xC0, 0x23, 0xF6, 0xAB, 0x83, 0x84, 0xCB, 0xDD, 0x41, 0x2D, 0xEC, 0xF9, 0x77 }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x465035CA, 0xC6DE1A09, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [t2] (Course Cheat)", { 0x22, 0xE1, 0x83, 0xBD, 0x8A, 0xF5, 0x7A, 0x79, 0xDE, 0xB6, 0x67, 0x9C, 0xA9, 0x19, 0xB6, 0x1E }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x085055B6, 0x5346ED7B, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [t3] (Star Cheat)", { 0x9F, 0x85, 0xF6, 0x4C, 0x6D, 0xD3, 0x0C, 0xA6, 0x7E, 0xB3, 0x55, 0xEF, 0x03, 0x32, 0xF1, 0x02 }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x0B623F24, 0xF8D4F434, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Kart 64 (U) [t4]", { 0x0B, 0x2B, 0x6C, 0xC6, 0x2C, 0xFE, 0xEB, 0x7C, 0x46, 0x42, 0xA3, 0x64, 0x3A, 0x3E, 0xD3, 0xC8 }, NULL, "81001A38 2409,81001A3A 0002,81001A3C 2409,81001A3E 0002,81001C90 240A,81001C92 0002,81001C94 240A,81001C96 0002", 0x465035CA, 0xC6DE1A09, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49F },
+    { "Mario Party (E) (M3) [!]", { 0x97, 0x73, 0x15, 0x07, 0x09, 0xBD, 0x80, 0x4B, 0x8E, 0x57, 0xE3, 0x5F, 0x1D, 0x6B, 0x0E, 0xED }, NULL, NULL, 0x9C663069, 0x80F24A80, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party (E) (M3) [T+Spa1.0_PacoChan]", { 0x1E, 0xAC, 0x55, 0x82, 0x6A, 0x43, 0x5F, 0xD1, 0xC0, 0xE0, 0xFE, 0xEF, 0xE8, 0x9F, 0xAC, 0x15 }, NULL, NULL, 0x45C59BC3, 0xD4C62468, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party (E) (M3) [b1]", { 0x26, 0x08, 0xA4, 0xD7, 0xA6, 0x95, 0xD0, 0xB1, 0xA1, 0xBB, 0xC4, 0x76, 0x95, 0xEA, 0xCE, 0x0E }, NULL, NULL, 0x9C663069, 0x80F24A80, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party (E) (M3) [h1C]", { 0x37, 0xEB, 0x3D, 0x60, 0xA2, 0xE8, 0x5B, 0xE5, 0x07, 0x7F, 0x73, 0xA5, 0xDF, 0x65, 0x1F, 0x05 }, NULL, NULL, 0x9C663069, 0x80F24A80, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party (J) [!]", { 0x3F, 0x55, 0x6C, 0xC3, 0xB3, 0xA9, 0x96, 0xCD, 0x2F, 0x47, 0x1F, 0xA0, 0xD9, 0x92, 0xD5, 0x29 }, NULL, NULL, 0xADA815BE, 0x6028622F, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party (U) [!]", { 0x8B, 0xC2, 0x71, 0x21, 0x39, 0xFB, 0xF0, 0xC5, 0x6C, 0x8E, 0xA8, 0x35, 0x80, 0x2C, 0x52, 0xDC }, NULL, NULL, 0x2829657E, 0xA0621877, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party (U) [f1] (PAL)", { 0xD0, 0x72, 0xDD, 0xBC, 0xC5, 0x96, 0x1A, 0xE8, 0x5E, 0x6F, 0xA9, 0xBF, 0x50, 0x24, 0x13, 0x70 }, NULL, NULL, 0x5B904BAE, 0x4CA06CC9, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party 2 (E) (M5) [!]", { 0xF7, 0x01, 0x12, 0xB6, 0x52, 0xB0, 0xEE, 0x48, 0x56, 0xAF, 0x83, 0xF4, 0xE8, 0x00, 0x5C, 0x31 }, NULL, NULL, 0x82380387, 0xDFC744D9, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party 2 (J) [!]", { 0xF2, 0x3E, 0x4C, 0xD4, 0x37, 0x46, 0x5F, 0x3E, 0x72, 0x52, 0x62, 0x25, 0x3C, 0xF3, 0xEA, 0x59 }, NULL, NULL, 0xED567D0F, 0x38B08915, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party 2 (U) [!]", { 0x04, 0x84, 0x06, 0x12, 0xA3, 0x5E, 0xCE, 0x22, 0x2A, 0xFD, 0xB2, 0xDF, 0xBF, 0x92, 0x64, 0x09 }, NULL, NULL, 0x9EA95858, 0xAF72B618, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party 2 (U) [f1] (PAL)", { 0xF2, 0x53, 0xC5, 0xA0, 0xFB, 0x69, 0xAB, 0x56, 0xA1, 0x54, 0x8D, 0x43, 0x5A, 0xF8, 0x4D, 0x0F }, NULL, NULL, 0xC6C71B88, 0x6422C633, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party 2 (U) [f2] (PAL)", { 0xCD, 0x75, 0xCC, 0xD3, 0x2E, 0xB4, 0x35, 0x71, 0x3E, 0xA5, 0x4D, 0xFF, 0x31, 0x3F, 0xA5, 0x0C }, NULL, NULL, 0xC63B1ADA, 0x9CEAEB08, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party 3 (E) (M4) [!]", { 0x8E, 0x62, 0xEC, 0x6F, 0xBE, 0x3C, 0xC9, 0xFF, 0x62, 0x84, 0x19, 0x1C, 0x9C, 0x88, 0xE6, 0x8F }, NULL, NULL, 0xC5674160, 0x0F5F453C, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party 3 (J) [!]", { 0xED, 0x99, 0xF3, 0x30, 0xCE, 0x7A, 0x26, 0x38, 0xAB, 0x13, 0x35, 0x10, 0x12, 0xEE, 0xB8, 0x6B }, NULL, NULL, 0x0B0AB4CD, 0x7B158937, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party 3 (U) [!]", { 0x76, 0xA8, 0xBB, 0xC8, 0x1B, 0xC2, 0x06, 0x0E, 0xC9, 0x9C, 0x96, 0x45, 0x86, 0x72, 0x37, 0xCC }, NULL, NULL, 0x7C3829D9, 0x6E8247CE, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party 3 (U) [f1]", { 0xBD, 0xD7, 0x9F, 0x49, 0x8F, 0x37, 0xD0, 0x1B, 0x89, 0x58, 0xF5, 0x6E, 0xC6, 0xFF, 0xA0, 0x97 }, NULL, NULL, 0x65DB63E3, 0x64357A65, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party 3 (U) [f2] (PAL)", { 0xF8, 0xF9, 0x11, 0x62, 0x79, 0xFB, 0xAF, 0xD5, 0x11, 0x74, 0x85, 0x42, 0x99, 0x45, 0x98, 0xB2 }, NULL, NULL, 0x822E0915, 0x0338FD50, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Party 3 (U) [f3]", { 0x5C, 0x3D, 0x26, 0x99, 0xC0, 0x1E, 0xBD, 0x30, 0xD4, 0x2C, 0x6F, 0x52, 0x49, 0x1E, 0xA7, 0xF0 }, NULL, NULL, 0xDF0C666A, 0x1F52B368, 0, SAVETYPE_EEPROM_16K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Mario Story (J) [!]", { 0xDF, 0x54, 0xF1, 0x7F, 0xB8, 0x4F, 0xB5, 0xB5, 0xBC, 0xF6, 0xAA, 0x9A, 0xF6, 0x5B, 0x09, 0x42 }, NULL, NULL, 0x3BA7CDDC, 0x464E52A0, 2, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Mario Tennis (E) [!]", { 0xFF, 0xF9, 0xB3, 0xE2, 0x2A, 0xBB, 0x9B, 0x60, 0x21, 0x5D, 0xAF, 0xB1, 0x3A, 0xD5, 0xA4, 0xDE }, NULL, NULL, 0x839F3AD5, 0x406D15FA, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Tennis (U) [!]", { 0x75, 0x93, 0x58, 0xFA, 0xD1, 0xED, 0x5A, 0xE3, 0x1D, 0xCB, 0x20, 0x01, 0xA0, 0x7F, 0x2F, 0xE5 }, NULL, NULL, 0x5001CF4F, 0xF30CB3BD, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Tennis (U) [f1] (Save)", { 0x7F, 0xB2, 0x56, 0x33, 0xFD, 0xB2, 0x26, 0xF3, 0x5A, 0x22, 0x2B, 0x4E, 0xA1, 0x7B, 0xD2, 0xDC }, NULL, NULL, 0xBC47A8BF, 0x5529DE0F, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Tennis 64 (J) [!]", { 0x8E, 0xB1, 0xC2, 0x44, 0x3D, 0x0B, 0x2E, 0x6E, 0xDA, 0x52, 0xA4, 0xEE, 0xA6, 0x6D, 0x6C, 0x35 }, NULL, NULL, 0x3A6C42B5, 0x1ACADA1B, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario Tennis 64 (J) [f1] (Country Check)", { 0xDD, 0x4A, 0x58, 0x0E, 0x27, 0xD8, 0x2B, 0xCC, 0xA6, 0xA2, 0x29, 0xBA, 0x17, 0xC6, 0x93, 0x68 }, NULL, NULL, 0x3A3FA519, 0x9595CD82, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mario no Photopie (J) [!]", { 0x7F, 0x4E, 0xD2, 0xAA, 0xF9, 0x4A, 0x21, 0x97, 0xB0, 0xAD, 0x63, 0xC6, 0xEC, 0xE9, 0xDE, 0xA9 }, NULL, NULL, 0x9A9890AC, 0xF0C313DF, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "Mario no Photopie (J) [a1]", { 0x6B, 0xAB, 0x5F, 0x2A, 0x62, 0xA4, 0xBA, 0xBA, 0xF4, 0x56, 0xD5, 0xDA, 0x29, 0x76, 0x87, 0x1D }, NULL, NULL, 0x9A9890AC, 0xF0C313DF, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x13 },
+    { "MeeTING Demo by Renderman (PD)", { 0xDD, 0x65, 0xE5, 0xF4, 0xB1, 0x92, 0xA1, 0x29, 0x66, 0xBB, 0xDD, 0x67, 0x18, 0xB6, 0x94, 0xE6 }, NULL, NULL, 0xA806749B, 0x1F521F45, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "MeeTING Demo by Renderman (PD) [b1]", { 0x22, 0x02, 0xB3, 0x9B, 0x90, 0x17, 0xBB, 0x06, 0x18, 0x22, 0x55, 0x2A, 0xF8, 0x3F, 0xD3, 0x31 }, NULL, NULL, 0xA806749B, 0x1F521F45, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mega Man 64 (U) [!]", { 0x36, 0x20, 0x67, 0x4A, 0xCB, 0x51, 0xE4, 0x36, 0xD5, 0x15, 0x07, 0x38, 0xAC, 0x1C, 0x09, 0x69 }, NULL, NULL, 0x0EC158F5, 0xFB3E6896, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mega Man 64 (U) (Beta) [!]", { 0xCD, 0x08, 0x24, 0xE9, 0x40, 0x51, 0x85, 0xAF, 0x43, 0x48, 0x37, 0xBA, 0x1C, 0x8C, 0x0C, 0xD5 }, NULL, NULL, 0x27C985A8, 0xED7CE5C6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mega Man 64 (U) [t1][f1] (PAL-NTSC)", { 0x01, 0xA1, 0x30, 0x4D, 0x98, 0xA5, 0x8E, 0x2D, 0x50, 0x69, 0x07, 0x9A, 0x4F, 0x44, 0x41, 0xF9 }, NULL, NULL, 0xB63200D4, 0xE36CF5AA, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Memory Manager V1.0b by R. Bubba Magillicutty (PD)", { 0x2F, 0x4C, 0x29, 0xDD, 0x26, 0xB6, 0xD5, 0x31, 0x1F, 0x3D, 0x46, 0x06, 0x3A, 0x39, 0x36, 0x87 }, NULL, NULL, 0x4DEC9986, 0xA8904450, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mempack Manager for Jr 0.9 by deas (PD)", { 0xC7, 0x7A, 0xC9, 0xBC, 0x65, 0xEE, 0xEA, 0x76, 0x1F, 0xC8, 0xB0, 0x81, 0xAF, 0x72, 0x8C, 0xDB }, NULL, NULL, 0x81A3F478, 0xB6965E3E, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mempack Manager for Jr 0.9b by deas (PD)", { 0xE1, 0xA9, 0xCB, 0xDB, 0x3C, 0x06, 0x6E, 0x4B, 0xC0, 0xA4, 0xFB, 0x71, 0xAD, 0xA7, 0x0C, 0xB2 }, NULL, NULL, 0x1EC6C03C, 0xB0954ADA, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mempack Manager for Jr 0.9c by deas (PD)", { 0x9C, 0xF3, 0x3B, 0x5F, 0x0D, 0x67, 0x7C, 0x7B, 0xCE, 0x85, 0xCB, 0x87, 0x7B, 0x09, 0x42, 0xCD }, NULL, NULL, 0xD2015E56, 0xA9FE0CE6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mempack to N64 Uploader by Destop V1.0 (PD)", { 0xBA, 0xD7, 0xC9, 0x73, 0x10, 0x29, 0xAD, 0x48, 0x80, 0xFF, 0x4B, 0x92, 0xE5, 0x56, 0x90, 0x65 }, NULL, NULL, 0x6A097D8B, 0xF999048C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mia Hamm Soccer 64 (U) (M2) [!]", { 0xA4, 0x03, 0x93, 0x68, 0xE0, 0x47, 0x2C, 0x68, 0xE3, 0x07, 0x2C, 0x02, 0xC7, 0xA8, 0x0F, 0x94 }, NULL, NULL, 0x1001F10C, 0x3D51D8C1, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Michael Owens WLS 2000 (E) [!]", { 0x89, 0x22, 0x22, 0xCC, 0x4B, 0xAF, 0x99, 0x58, 0x40, 0x5D, 0x20, 0xBC, 0x49, 0x21, 0x75, 0xBF }, NULL, NULL, 0xE36166C2, 0x8613A2E5, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Michael Owens WLS 2000 (E) [b1]", { 0x6A, 0x81, 0x4E, 0x33, 0xBB, 0x6D, 0x44, 0x9B, 0xE2, 0x3F, 0xBB, 0xCA, 0xC7, 0x60, 0x6C, 0x0B }, NULL, NULL, 0xE36166C2, 0x8613A2E5, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Michael Owens WLS 2000 (E) [b2]", { 0xEC, 0x70, 0x09, 0x09, 0xD0, 0x9C, 0x08, 0x1D, 0xA0, 0xE4, 0xBA, 0xE4, 0x54, 0xC6, 0x57, 0xF0 }, NULL, NULL, 0x9ABC592A, 0x2AA5DEE2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Michael Owens WLS 2000 (E) [f1] (NTSC)", { 0xBD, 0x5D, 0x21, 0x4B, 0xED, 0x53, 0xC4, 0x68, 0x2E, 0x9F, 0xF8, 0xB8, 0xE9, 0x91, 0x9C, 0xD4 }, NULL, NULL, 0x9ABC592A, 0x2AA5DEE2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mickey no Racing Challenge USA (J) [!]", { 0x28, 0x8A, 0x51, 0x4E, 0x98, 0x97, 0x2B, 0xF9, 0xD3, 0x29, 0x16, 0x7A, 0xA2, 0x9E, 0x66, 0xB6 }, NULL, NULL, 0x736AE6AF, 0x4117E9C7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mickey's Speedway USA (E) (M5) [!]", { 0x5B, 0xA3, 0xDC, 0x37, 0x86, 0x0C, 0x08, 0xA2, 0x09, 0xF2, 0x42, 0x86, 0xB8, 0xDF, 0xEC, 0x8C }, NULL, NULL, 0xDED0DD9A, 0xE78225A7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mickey's Speedway USA (U) [!]", { 0x0B, 0xF6, 0x44, 0x27, 0xCF, 0x68, 0xE4, 0x9C, 0x70, 0xE9, 0xEC, 0x2C, 0x9D, 0x81, 0x52, 0x09 }, NULL, NULL, 0xFA8C4571, 0xBBE7F9C0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Mickey's Speedway USA (U) [t1]", { 0xB0, 0x25, 0xF0, 0xE2, 0x0F, 0xB4, 0x1A, 0x0A, 0xAE, 0x28, 0x08, 0x47, 0x32, 0x9C, 0xB9, 0x19 }, NULL, NULL, 0x38112EC7, 0xE91410C3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Micro Machines 64 Turbo (E) (M5) [!]", { 0x9A, 0x84, 0x65, 0xE3, 0x02, 0x26, 0x3D, 0x63, 0x55, 0x57, 0xA1, 0x4A, 0xA1, 0x97, 0xFE, 0x3C }, NULL, NULL, 0x2A49018D, 0xD0034A02, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x42B },
+    { "Micro Machines 64 Turbo (E) (M5) [b1]", { 0x68, 0x24, 0x6C, 0xF0, 0xAB, 0x9D, 0xE7, 0xB6, 0xF8, 0x47, 0x51, 0xFC, 0xC8, 0x6A, 0x95, 0x9A }, NULL, NULL, 0x2A49018D, 0xD0034A02, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x42B },
+    { "Micro Machines 64 Turbo (E) (M5) [b1][f1] (NTSC)", { 0x7D, 0x61, 0xBB, 0x9D, 0x25, 0xBA, 0xF9, 0xA6, 0x08, 0x13, 0x95, 0x92, 0xDC, 0x4E, 0x28, 0xDC }, NULL, NULL, 0x700F6DD9, 0xE2EB805F, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x42B },
+    { "Micro Machines 64 Turbo (E) (M5) [t1]", { 0xE4, 0x85, 0x59, 0xE9, 0x90, 0xDE, 0x24, 0x45, 0x8F, 0x8A, 0x3A, 0xCD, 0xF3, 0xAE, 0xE9, 0x01 }, NULL, NULL, 0xADCDEC69, 0xD0179F38, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x42B },
+    { "Micro Machines 64 Turbo (U) [!]", { 0x74, 0xEB, 0x41, 0x5E, 0x16, 0xC3, 0x33, 0xB2, 0x52, 0x84, 0x7A, 0x8E, 0x09, 0x43, 0x2F, 0xD9 }, NULL, NULL, 0xF1850C35, 0xACE07912, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x42B },
+    { "Micro Machines 64 Turbo (U) [a1][!]", { 0xBB, 0x9F, 0x2E, 0x48, 0x01, 0x5D, 0x9D, 0xFB, 0x34, 0x7B, 0x4B, 0xE4, 0xC2, 0xDF, 0xB3, 0x34 }, NULL, NULL, 0xF1850C35, 0xACE07912, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x42B },
+    { "Micro Machines 64 Turbo (U) [b1]", { 0x65, 0x6B, 0x14, 0x42, 0x01, 0x5C, 0xF9, 0x5D, 0x4D, 0x1E, 0x01, 0x71, 0x33, 0x09, 0xF7, 0x1D }, NULL, NULL, 0xF1850C35, 0xACE07912, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x42B },
+    { "Micro Machines 64 Turbo (U) [t1]", { 0xC4, 0x4D, 0x99, 0xD0, 0x43, 0x71, 0x42, 0x21, 0x1D, 0xAC, 0xA4, 0x82, 0x6F, 0x8E, 0xCB, 0x88 }, NULL, NULL, 0xA986ECC1, 0x50AC924B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x42B },
+    { "Midway's Greatest Arcade Hits Volume 1 (U) [!]", { 0x2B, 0x86, 0x77, 0x5E, 0xA4, 0xD8, 0x48, 0x20, 0x2E, 0x4F, 0x4A, 0x39, 0xC3, 0x35, 0x71, 0xCA }, NULL, NULL, 0xE4B35E4C, 0x1AC45CC9, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Midway's Greatest Arcade Hits Volume 1 (U) [b1]", { 0x47, 0xEA, 0x6F, 0x03, 0x7B, 0x09, 0x33, 0x81, 0xCA, 0x88, 0xA4, 0x1F, 0xBB, 0x6C, 0x41, 0x99 }, NULL, NULL, 0xE4B35E4C, 0x1AC45CC9, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Midway's Greatest Arcade Hits Volume 1 (U) [b2]", { 0x1F, 0xE5, 0x99, 0x64, 0xEC, 0x1A, 0x58, 0x99, 0xF3, 0xC7, 0xD9, 0x75, 0x90, 0xF6, 0x76, 0xEB }, NULL, NULL, 0x3F462D42, 0x93AE9238, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Midway's Greatest Arcade Hits Volume 1 (U) [o1]", { 0xB0, 0x7F, 0xF4, 0xF9, 0x72, 0xB2, 0x69, 0xF2, 0xBD, 0xC6, 0x97, 0x13, 0xB4, 0xB7, 0x01, 0xA7 }, NULL, NULL, 0xE4B35E4C, 0x1AC45CC9, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Midway's Greatest Arcade Hits Volume 1 (U) [o1][t1]", { 0x24, 0x46, 0x7B, 0x76, 0xA1, 0x92, 0xDF, 0xB6, 0x70, 0x69, 0xC5, 0xA8, 0x7B, 0x86, 0x06, 0xD0 }, NULL, NULL, 0x3F462D42, 0x93AE9238, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Midway's Greatest Arcade Hits Volume 1 (U) [t1]", { 0xD3, 0x0A, 0x47, 0x23, 0xE2, 0x66, 0xD5, 0x7D, 0x86, 0xBD, 0xC5, 0x2F, 0x93, 0x2D, 0x0D, 0xF1 }, NULL, NULL, 0x3F462D42, 0x93AE9238, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Midway's Greatest Arcade Hits Volume 1 (U) [t2]", { 0xEB, 0x35, 0x75, 0x05, 0xEF, 0xC9, 0xD1, 0x7A, 0x08, 0xAD, 0xBA, 0x55, 0x90, 0x89, 0x6C, 0x4D }, NULL, NULL, 0x3F462D42, 0x93AE9238, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Midway's Greatest Arcade Hits Volume 1 (U) [t2][b1]", { 0x9D, 0x40, 0x1F, 0xA1, 0xA1, 0xDD, 0xDF, 0x5C, 0x89, 0x95, 0x27, 0x8E, 0x09, 0xE2, 0x21, 0x0D }, NULL, NULL, 0x3F462D42, 0x93AE9238, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Mike Piazza's Strike Zone (U) [!]", { 0xEB, 0x19, 0x08, 0xE5, 0x1C, 0x8D, 0x10, 0xAF, 0x8B, 0x9C, 0xAF, 0x77, 0x79, 0x7B, 0xFE, 0x00 }, NULL, NULL, 0x09D53E16, 0x3AB268B9, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mike Piazza's Strike Zone (U) [h1C]", { 0xF5, 0x97, 0x8A, 0x54, 0xBB, 0x22, 0xE3, 0xBC, 0x4D, 0x46, 0xC0, 0xC3, 0xE9, 0x59, 0x7B, 0x12 }, NULL, NULL, 0x09D53E16, 0x3AB268B9, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mike Piazza's Strike Zone (U) [h2C]", { 0x1B, 0x41, 0xA8, 0x85, 0xCB, 0xAA, 0x69, 0x37, 0x14, 0x57, 0x53, 0x83, 0xDB, 0x4C, 0x05, 0xBE }, NULL, NULL, 0x09D53E16, 0x3AB268B9, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mike Piazza's Strike Zone (U) [h3C]", { 0x83, 0xC5, 0x1E, 0x3C, 0xD8, 0x2A, 0x0D, 0x86, 0xCA, 0xCE, 0x6D, 0x85, 0x29, 0x90, 0x81, 0x4F }, NULL, NULL, 0x09D53E16, 0x3AB268B9, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Milo's Astro Lanes (E) [!]", { 0x43, 0xB0, 0x2A, 0xF2, 0x78, 0x99, 0x90, 0xA1, 0x4F, 0x77, 0xCE, 0x02, 0x0E, 0x6F, 0x13, 0x5C }, NULL, NULL, 0x9A490D9D, 0x8F013ADC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Milo's Astro Lanes (E) [o1]", { 0x98, 0x8B, 0x49, 0x0C, 0x2A, 0xEB, 0xF7, 0xDE, 0x3C, 0x27, 0x4B, 0x7E, 0xAE, 0xEF, 0x09, 0x99 }, NULL, NULL, 0x9A490D9D, 0x8F013ADC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Milo's Astro Lanes (E) [o2]", { 0xF1, 0x52, 0xC4, 0xA9, 0x0B, 0x33, 0xD0, 0xD2, 0xBF, 0xAF, 0x78, 0x2F, 0x56, 0xB2, 0x02, 0xDF }, NULL, NULL, 0x9A490D9D, 0x8F013ADC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Milo's Astro Lanes (U) [!]", { 0x4F, 0x25, 0x61, 0x46, 0xBA, 0xC4, 0xA3, 0xDD, 0xE5, 0xAD, 0x0D, 0x5F, 0x9C, 0x90, 0x92, 0x51 }, NULL, NULL, 0x2E955ECD, 0xF3000884, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Milo's Astro Lanes (U) [b1]", { 0xAC, 0x00, 0x46, 0x67, 0xAB, 0x45, 0x78, 0xBA, 0xA9, 0xA1, 0xC0, 0xA7, 0x77, 0x1E, 0x8B, 0x17 }, NULL, NULL, 0x2E955ECD, 0xF3000884, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Milo's Astro Lanes (U) [h1C]", { 0xBE, 0x83, 0x56, 0x6E, 0x7C, 0x7B, 0x92, 0x49, 0xFA, 0xC7, 0x3D, 0xD2, 0xF1, 0x12, 0x14, 0x24 }, NULL, NULL, 0x2E955ECD, 0xF3000884, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Milo's Astro Lanes (U) [h2C]", { 0x0F, 0xE3, 0x1A, 0x11, 0x3E, 0xF3, 0x89, 0xF8, 0xF9, 0x54, 0x60, 0xD3, 0x40, 0xC7, 0xD9, 0x22 }, NULL, NULL, 0x2E955ECD, 0xF3000884, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Milo's Astro Lanes (U) [o1]", { 0x3D, 0x5F, 0x01, 0x7D, 0x75, 0x67, 0x9C, 0xEF, 0xCE, 0x21, 0x27, 0xCA, 0xCC, 0x46, 0xC9, 0xF2 }, NULL, NULL, 0x2E955ECD, 0xF3000884, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Milo's Astro Lanes (U) [o1][b1]", { 0xFD, 0x85, 0xE6, 0xB2, 0x0A, 0x90, 0x99, 0xF6, 0x70, 0xC3, 0xCF, 0xBD, 0x13, 0xAE, 0xE7, 0x19 }, NULL, NULL, 0x2E955ECD, 0xF3000884, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mind Present Demo 0 by Widget and Immortal (POM '98) (PD) [b1]", { 0xC0, 0x51, 0x3A, 0xE9, 0x49, 0x44, 0x62, 0x43, 0x3C, 0xDC, 0x83, 0x87, 0x03, 0x20, 0xDA, 0x4E }, NULL, NULL, 0xC811CBB1, 0x8FB7617C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mind Present Demo 0 by Widget and Immortal (POM '98) (PD)", { 0x58, 0x9D, 0xD7, 0x44, 0xC7, 0xB0, 0x7E, 0xC4, 0xDA, 0x91, 0x56, 0x8C, 0xFB, 0xAC, 0x09, 0xEF }, NULL, NULL, 0xC811CBB1, 0x8FB7617C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mind Present Demo Readme by Widget and Immortal (POM '98) (PD)", { 0x4D, 0x12, 0x43, 0xD7, 0x1F, 0x55, 0x36, 0xA4, 0x16, 0xF3, 0x66, 0x4A, 0x02, 0xFD, 0xF8, 0xE2 }, NULL, NULL, 0x139A06BC, 0x416B0055, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mischief Makers (E) [!]", { 0xEB, 0x3B, 0x07, 0x8A, 0x74, 0xD4, 0xDC, 0x82, 0x7E, 0x1E, 0x79, 0x79, 0x10, 0x04, 0xDF, 0xBB }, NULL, NULL, 0x418BDA98, 0x248A0F58, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Mischief Makers (E) [b1]", { 0x56, 0x90, 0xD7, 0x41, 0x57, 0xC6, 0x62, 0x3E, 0x29, 0x28, 0xA6, 0xF0, 0x35, 0x3E, 0xF4, 0xAF }, NULL, NULL, 0x418BDA98, 0x248A0F58, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Mischief Makers (U) (V1.0) [!]", { 0x49, 0x5A, 0x9B, 0xFF, 0xD6, 0x62, 0x0B, 0xE4, 0x32, 0x25, 0xDB, 0x71, 0x33, 0x37, 0x3F, 0xC5 }, NULL, NULL, 0x0B93051B, 0x603D81F9, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Mischief Makers (U) (V1.0) [b1]", { 0xCC, 0xF0, 0x12, 0xDF, 0x82, 0x02, 0x2D, 0x47, 0x97, 0xCE, 0x4C, 0xC5, 0x40, 0x5E, 0x08, 0x4F }, NULL, NULL, 0x0B93051B, 0x603D81F9, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Mischief Makers (U) (V1.0) [o1]", { 0xB3, 0xA1, 0x72, 0xFE, 0x81, 0xF7, 0xBB, 0x47, 0x51, 0x9D, 0x8E, 0x19, 0xE5, 0xF0, 0x81, 0x54 }, NULL, NULL, 0x0B93051B, 0x603D81F9, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Mischief Makers (U) (V1.1) [!]", { 0x2E, 0xE9, 0x17, 0x36, 0x6F, 0x64, 0xA0, 0x64, 0x72, 0xD7, 0x62, 0x2A, 0x2A, 0x05, 0x99, 0x0E }, NULL, NULL, 0xBFA526B4, 0x0691E430, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Mission Impossible (E) [!]", { 0x59, 0x9B, 0x5D, 0x40, 0xB5, 0x1F, 0x53, 0xC2, 0xC9, 0xA9, 0x09, 0xE0, 0x13, 0x97, 0x02, 0xFC }, NULL, NULL, 0x2256ECDA, 0x71AB1B9C, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (E) [b1]", { 0x5C, 0xDC, 0x05, 0x2C, 0x88, 0xA5, 0xCA, 0xDC, 0xC3, 0xC7, 0x3B, 0x16, 0x51, 0x63, 0xE8, 0xC7 }, NULL, NULL, 0x2256ECDA, 0x71AB1B9C, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (F) [!]", { 0xFD, 0x0C, 0x0E, 0x8C, 0x52, 0x34, 0x37, 0xF9, 0xB6, 0xB6, 0x30, 0xE3, 0x69, 0xFD, 0xFC, 0x69 }, NULL, NULL, 0x20095B34, 0x343D9E87, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (F) [b1]", { 0xFF, 0x9C, 0xC9, 0xE0, 0x39, 0x93, 0xDD, 0x15, 0xF1, 0x43, 0x6A, 0xF3, 0x87, 0x4F, 0x94, 0xCF }, NULL, NULL, 0x20095B34, 0x343D9E87, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (F) [b2]", { 0xD2, 0x44, 0x29, 0x69, 0xE0, 0x39, 0x25, 0x4C, 0xF1, 0xB9, 0xB0, 0x59, 0xDB, 0xB6, 0x31, 0x1C }, NULL, NULL, 0x20095B34, 0x343D9E87, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (G) [!]", { 0x41, 0x11, 0x48, 0x2C, 0x92, 0xEE, 0x80, 0x64, 0x84, 0xAA, 0xA2, 0xC2, 0x10, 0x89, 0x3A, 0x52 }, NULL, NULL, 0x93EB3F7E, 0x81675E44, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (I) [!]", { 0x66, 0xC7, 0xEB, 0x81, 0x48, 0xE0, 0x71, 0x4B, 0x5A, 0x71, 0xF5, 0x71, 0x7D, 0xFF, 0x86, 0x42 }, NULL, NULL, 0xEBA949DC, 0x39BAECBD, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (I) [f1] (NTSC)", { 0xCA, 0x60, 0x96, 0x78, 0x22, 0xCC, 0xCE, 0xFE, 0x22, 0x29, 0x96, 0x91, 0xB4, 0x53, 0xD8, 0x93 }, NULL, NULL, 0xC76B18F6, 0xAAB1BDF3, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (S) [!]", { 0xD1, 0xBA, 0x3B, 0x18, 0x99, 0x57, 0x6A, 0x4B, 0x67, 0x90, 0x8A, 0xBB, 0x65, 0x44, 0xD7, 0x5A }, NULL, NULL, 0x5F6A04E2, 0xD4FA070D, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (S) [f1] (NTSC)", { 0x21, 0x7B, 0x0E, 0x47, 0x23, 0xDB, 0xAC, 0xDA, 0x40, 0xB7, 0x0B, 0x26, 0xE6, 0x10, 0xF5, 0xF9 }, NULL, NULL, 0x635CB5C6, 0xE9192BFF, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (S) (V1.1) [!]", { 0x16, 0xA3, 0x14, 0x3D, 0xC0, 0xE5, 0xFE, 0x66, 0x39, 0xF4, 0x9D, 0xB7, 0xA5, 0x1D, 0x24, 0xD4 }, NULL, NULL, 0x5F6DDEA2, 0x4DD9E759, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (U) [!]", { 0xEE, 0xBD, 0xFB, 0xD7, 0xCB, 0x57, 0x20, 0x2D, 0x70, 0xCF, 0xFF, 0xCA, 0xAF, 0x55, 0xE9, 0x3E }, NULL, NULL, 0x26035CF8, 0x802B9135, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (U) [b1]", { 0x55, 0x0F, 0x4C, 0x17, 0x79, 0x42, 0xFC, 0x0D, 0xF0, 0x0B, 0x64, 0x6C, 0x42, 0xEB, 0x4A, 0x90 }, NULL, NULL, 0x26035CF8, 0x802B9135, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (U) [b2]", { 0x0D, 0x97, 0x15, 0x8C, 0x34, 0x08, 0xF8, 0xE3, 0xE6, 0xD3, 0x8A, 0x17, 0x22, 0x3A, 0xC8, 0x81 }, NULL, NULL, 0x09D4D757, 0xF2775DBD, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (U) [f1] (PAL)", { 0xFA, 0x31, 0x74, 0x3C, 0x3F, 0xC0, 0x23, 0x6D, 0x6C, 0xEC, 0x0B, 0xD5, 0x14, 0xDF, 0xB0, 0x53 }, NULL, NULL, 0x09D4D757, 0xF2775DBD, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Mission Impossible (U) [t1]", { 0x53, 0x20, 0x60, 0x8C, 0x72, 0x9C, 0x9F, 0x5B, 0x32, 0x58, 0x1F, 0x81, 0x60, 0x4D, 0x75, 0xE6 }, NULL, NULL, 0xB0105C85, 0x6E5094B9, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Monaco Grand Prix (U) [!]", { 0x4F, 0xF9, 0x58, 0x9A, 0x32, 0x24, 0xAA, 0xA4, 0x6E, 0x98, 0x77, 0xD6, 0xB2, 0x5E, 0x68, 0xE3 }, NULL, NULL, 0x28768D6D, 0xB379976C, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Monaco Grand Prix (U) [f1] (PAL)", { 0x9B, 0xF4, 0xD7, 0xFB, 0xE8, 0x15, 0x7C, 0x9D, 0x68, 0x66, 0xA9, 0x02, 0x69, 0xDC, 0xA7, 0xCB }, NULL, NULL, 0xDA233397, 0xFF46DF64, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Monaco Grand Prix - Racing Simulation 2 (E) (M4) [!]", { 0xC9, 0x3A, 0x17, 0xD1, 0x30, 0xB9, 0x6F, 0xBA, 0x27, 0xA0, 0xE9, 0x59, 0xCA, 0xB2, 0xA4, 0x50 }, NULL, NULL, 0x28705FA5, 0xB509690E, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Money Creates Taste Demo by Count0 (POM '99) (PD) [f1]", { 0xF8, 0x15, 0x80, 0xC9, 0xC4, 0x80, 0xDD, 0xF1, 0xB8, 0xF7, 0xE6, 0xA5, 0x6D, 0x1B, 0x9C, 0xD5 }, NULL, NULL, 0x97E57686, 0xF271C12F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Money Creates Taste Demo by Count0 (POM '99) (PD)", { 0xA7, 0x4D, 0xBA, 0xA3, 0xBF, 0x59, 0xDE, 0x13, 0xB6, 0xA1, 0x91, 0xA6, 0x67, 0x5C, 0x85, 0xD7 }, NULL, NULL, 0x282A4262, 0x58B47E76, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Monopoly (U) [!]", { 0xD5, 0x15, 0x06, 0xED, 0xB0, 0xA9, 0x41, 0xA0, 0x0E, 0xB4, 0x58, 0x50, 0x70, 0x3B, 0x32, 0xCB }, NULL, NULL, 0x5AC383E1, 0xD712E387, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Monopoly (U) [f1] (PAL)", { 0x26, 0xC3, 0x65, 0x4D, 0x20, 0xB8, 0x71, 0x8A, 0x75, 0xB5, 0xFE, 0x8D, 0xA5, 0xB3, 0x28, 0x4A }, NULL, NULL, 0xB9D36858, 0x559A8241, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Monster Truck Madness 64 (E) (M5) [!]", { 0xE3, 0xB4, 0x08, 0x99, 0x7D, 0x7D, 0xB9, 0x1F, 0x82, 0x19, 0xF1, 0x68, 0xC6, 0xD5, 0x7D, 0x26 }, NULL, NULL, 0xD3D806FC, 0xB43AA2A8, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Monster Truck Madness 64 (E) (M5) [f1] (NTSC)", { 0x12, 0x53, 0x4D, 0xAB, 0x32, 0xDB, 0xFC, 0x6C, 0xA4, 0xF6, 0x6D, 0x05, 0x72, 0x91, 0x02, 0xE6 }, NULL, NULL, 0xAE5E467C, 0xD7194A71, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Monster Truck Madness 64 (U) [!]", { 0x51, 0x4D, 0x61, 0xD3, 0xB3, 0xD5, 0xE6, 0x32, 0x68, 0x69, 0x78, 0x3E, 0xB2, 0xE8, 0x4A, 0x00 }, NULL, NULL, 0xB19AD999, 0x7E585118, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Monster Truck Madness 64 (U) [t1]", { 0x3C, 0x9F, 0x32, 0x9D, 0x5E, 0x0C, 0x7F, 0xE5, 0x73, 0x55, 0xB8, 0xDC, 0x68, 0xF7, 0x93, 0x31 }, NULL, NULL, 0x29A9E7F6, 0x1B90CFCE, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Morita Shougi 64 (J) [!]", { 0x46, 0x2B, 0x9C, 0x4F, 0x38, 0x75, 0x8C, 0x2E, 0x55, 0x83, 0x12, 0xAC, 0x60, 0xDF, 0x2B, 0x91 }, NULL, NULL, 0xE8E8DD70, 0x415DD198, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Mortal Kombat 4 (E) [!]", { 0x26, 0x4B, 0x82, 0xF0, 0xFC, 0x24, 0x31, 0xD6, 0xEE, 0xFD, 0xE9, 0xC9, 0xF3, 0xED, 0x75, 0x96 }, NULL, NULL, 0x73036F3B, 0xCE0D69E9, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat 4 (E) [h1C]", { 0x58, 0xEF, 0xAF, 0x3D, 0x7D, 0x09, 0x85, 0xBC, 0x42, 0x62, 0x45, 0xEF, 0xA5, 0x41, 0x8C, 0xC2 }, NULL, NULL, 0x73036F3B, 0xCE0D69E9, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat 4 (E) [t1] (Hit Anywhere)", { 0x61, 0x9B, 0x1F, 0x19, 0x6B, 0x70, 0x26, 0x0D, 0xCE, 0x89, 0xB2, 0x1E, 0x66, 0xD1, 0x09, 0x34 }, NULL, NULL, 0x72836ECB, 0x75D15FAE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat 4 (U) [!]", { 0xC7, 0x0B, 0x91, 0x43, 0x08, 0x66, 0x30, 0x0C, 0xE3, 0x8B, 0x49, 0x09, 0x80, 0x19, 0xEF, 0x9D }, NULL, NULL, 0x417DD4F4, 0x1B482FE2, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat 4 (U) [b1]", { 0xCC, 0xD5, 0xA3, 0xB8, 0x29, 0x76, 0xD6, 0x5B, 0x3B, 0x42, 0xE8, 0xE2, 0xB2, 0xB4, 0x3B, 0x48 }, NULL, NULL, 0xF96E28F7, 0x421A4285, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat 4 (U) [b2]", { 0x4C, 0x70, 0x92, 0x58, 0x5C, 0xF6, 0x4B, 0xBE, 0x7F, 0x26, 0xEC, 0xA7, 0x20, 0xAE, 0x89, 0x41 }, NULL, NULL, 0xDB6E353B, 0x205B0C53, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat 4 (U) [b3]", { 0x48, 0x08, 0x55, 0xE2, 0x34, 0x8D, 0x6B, 0x85, 0x72, 0x1C, 0x62, 0x0A, 0xE9, 0xFE, 0xF1, 0x38 }, NULL, NULL, 0x417DD4F4, 0x1B482FE2, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat 4 (U) [h1C]", { 0xF9, 0x72, 0xB6, 0x34, 0xF6, 0x38, 0xCC, 0x54, 0xAD, 0x6D, 0xCB, 0xFD, 0xC6, 0x61, 0xCC, 0x02 }, NULL, NULL, 0x417DD4F4, 0x1B482FE2, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat 4 (U) [t1]", { 0xA5, 0xF7, 0xC9, 0xF5, 0xB7, 0x11, 0xEC, 0xA7, 0xC2, 0xA2, 0x92, 0x3E, 0xEA, 0x6C, 0xF7, 0x62 }, NULL, NULL, 0xDB6E353B, 0x205B0C53, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat 4 (U) [t1][f1] (PAL)", { 0x24, 0xE3, 0x9D, 0x47, 0xA0, 0xD1, 0xAF, 0xA1, 0x38, 0xB1, 0xF3, 0x9A, 0xA2, 0xDA, 0xA6, 0x48 }, NULL, NULL, 0xDB6E353B, 0x205B0C53, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat 4 (U) [t2] (Hit Anywhere)", { 0x18, 0xE1, 0xCA, 0x4B, 0xE7, 0xD8, 0xE5, 0x6A, 0xC9, 0x40, 0x85, 0x2E, 0xC5, 0xE3, 0xED, 0x22 }, NULL, NULL, 0x417DD7F4, 0xC95B6E9E, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat Mythologies - Sub-Zero (E) [!]", { 0x38, 0xA8, 0x2A, 0x56, 0xAE, 0x61, 0xA4, 0xD3, 0x54, 0xC6, 0xA2, 0x6E, 0x64, 0xD2, 0x5E, 0x1C }, NULL, NULL, 0xFF44EDC4, 0x1AAE9213, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat Mythologies - Sub-Zero (E) [h1C]", { 0xDA, 0xFE, 0xE0, 0xC1, 0xFC, 0x99, 0x88, 0x2A, 0x2C, 0x6A, 0x34, 0x0B, 0xF0, 0xE5, 0x8A, 0x08 }, NULL, NULL, 0xFF44EDC4, 0x1AAE9213, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat Mythologies - Sub-Zero (E) [t1] (Endless Ice)", { 0x52, 0x84, 0x45, 0xFB, 0x76, 0xD0, 0xF0, 0x60, 0xDF, 0x5C, 0xBE, 0x71, 0xAE, 0xED, 0xA2, 0x0F }, NULL, NULL, 0x6DF2CB25, 0x4D4821F8, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat Mythologies - Sub-Zero (U) [!]", { 0xDE, 0xEC, 0x4F, 0xAE, 0xC4, 0x16, 0xF4, 0xE0, 0x2D, 0x93, 0x4C, 0x2E, 0x42, 0xC0, 0xCA, 0xAD }, NULL, NULL, 0xC34304AC, 0x2D79C021, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat Mythologies - Sub-Zero (U) [b1]", { 0x8F, 0x25, 0x44, 0xF0, 0x95, 0xEF, 0x7D, 0x9A, 0x50, 0x96, 0xE3, 0xD5, 0x24, 0x72, 0xD6, 0x99 }, NULL, NULL, 0x834304AE, 0x5845CD3A, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat Mythologies - Sub-Zero (U) [b2]", { 0x17, 0x93, 0xB4, 0x5C, 0x47, 0x97, 0xD9, 0x41, 0x86, 0x85, 0x94, 0x6A, 0x00, 0x2B, 0x5D, 0x15 }, NULL, NULL, 0xC34304AC, 0x2D79C021, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat Mythologies - Sub-Zero (U) [b3]", { 0x54, 0x43, 0xBF, 0xB7, 0x2D, 0x91, 0xD0, 0xDF, 0xD7, 0x2F, 0xC1, 0xC6, 0xFA, 0x03, 0xA1, 0x13 }, NULL, NULL, 0xC34304AC, 0x2D79C021, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat Mythologies - Sub-Zero (U) [f1]", { 0x7C, 0xCC, 0x13, 0x88, 0x82, 0xA6, 0x42, 0x67, 0xAD, 0x58, 0x44, 0x9F, 0x30, 0x9F, 0xC1, 0xD1 }, NULL, NULL, 0x834304AE, 0x5845CD3A, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat Mythologies - Sub-Zero (U) [f3] (PAL)", { 0xA6, 0xC5, 0x19, 0x54, 0xEE, 0x5D, 0xF3, 0x73, 0xE1, 0x59, 0xE0, 0xE5, 0x5D, 0xEA, 0xE2, 0x39 }, NULL, NULL, 0x834304AE, 0x5845CD3A, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat Mythologies - Sub-Zero (U) [h1C]", { 0xFF, 0xF4, 0xE1, 0x45, 0x5C, 0x03, 0xF7, 0x12, 0x72, 0x06, 0x3C, 0x30, 0x9D, 0x9F, 0x91, 0x02 }, NULL, NULL, 0xC34304AC, 0x2D79C021, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat Mythologies - Sub-Zero (U) [h2C]", { 0xFC, 0xD0, 0xBF, 0xF9, 0x03, 0x06, 0xB1, 0x3E, 0xB8, 0xE5, 0x00, 0x7E, 0x5B, 0x4C, 0x2C, 0xB7 }, NULL, NULL, 0x834304AE, 0x5845CD3A, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat Mythologies - Sub-Zero (U) [o1]", { 0x55, 0x83, 0x52, 0x7E, 0xD4, 0xAA, 0x49, 0xCF, 0x71, 0x3F, 0xAE, 0x40, 0x0E, 0x77, 0xF9, 0xA2 }, NULL, NULL, 0xC34304AC, 0x2D79C021, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat Mythologies - Sub-Zero (U) [t1]", { 0xAB, 0x06, 0xE6, 0xD7, 0x77, 0xAE, 0x71, 0x0F, 0x9B, 0x5A, 0x4D, 0xC4, 0xE7, 0xA2, 0x95, 0xC8 }, NULL, NULL, 0x5972E751, 0x228381B3, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat Mythologies - Sub-Zero (U) [t2] (Endless Ice)", { 0x85, 0xB9, 0x9F, 0x3D, 0x09, 0xC4, 0x07, 0x0E, 0xEA, 0x76, 0x69, 0xA0, 0x9D, 0x20, 0x24, 0x3F }, NULL, NULL, 0xADDD6241, 0xAA79B2F2, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Mortal Kombat SRAM Loader (PD)", { 0xB2, 0x78, 0xDD, 0xD3, 0xFB, 0x63, 0xF7, 0x0B, 0x8B, 0x6E, 0xFE, 0xF4, 0x45, 0xD8, 0x15, 0x95 }, NULL, NULL, 0x947A4B47, 0x90BFECA6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mortal Kombat Trilogy (E) [!]", { 0x7A, 0x55, 0x8B, 0xBA, 0xD8, 0xCE, 0x88, 0x28, 0x41, 0x4A, 0x9C, 0xF3, 0xB0, 0x44, 0xA8, 0x7D }, NULL, NULL, 0x8C3D1192, 0xBEF172E1, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (E) [b1]", { 0x1C, 0x6F, 0xE6, 0xA4, 0x0A, 0xAC, 0x4B, 0xD5, 0x15, 0x37, 0x3B, 0x6E, 0xD8, 0xD2, 0x5D, 0xBF }, NULL, NULL, 0x8C3D1192, 0xBEF172E1, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (E) [h1C]", { 0x0F, 0x9B, 0x89, 0xC9, 0x03, 0xBE, 0xFE, 0xDC, 0xFD, 0x10, 0x7E, 0x5B, 0x5A, 0xDE, 0x68, 0x7F }, NULL, NULL, 0x8C3D1192, 0xBEF172E1, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (E) [o1]", { 0xB0, 0x5D, 0xEC, 0x10, 0xCD, 0xEF, 0xAC, 0xF4, 0x15, 0x3E, 0x34, 0x59, 0x40, 0x41, 0x04, 0x77 }, NULL, NULL, 0x8C3D1192, 0xBEF172E1, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (E) [t1] (Hit Anywhere)", { 0xAB, 0x72, 0xCB, 0x89, 0x71, 0xFA, 0x37, 0x17, 0x6D, 0x32, 0x19, 0xB5, 0xF4, 0x9A, 0xF4, 0x42 }, NULL, NULL, 0x8C3D1192, 0xB5096A18, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (E) [t2] (All Attacks Hurt P1)", { 0xCF, 0xC1, 0x96, 0x10, 0x3E, 0x35, 0x5B, 0x12, 0xA5, 0x06, 0x05, 0xAB, 0x26, 0x89, 0x92, 0xFA }, NULL, NULL, 0x833D11B6, 0x1848E72B, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (E) [t3] (All Attacks Hurt P2)", { 0x9C, 0xC6, 0x0D, 0x04, 0x63, 0x72, 0xD2, 0xC9, 0xA5, 0x29, 0xED, 0x22, 0x5E, 0x3C, 0xDB, 0x08 }, NULL, NULL, 0x833D1192, 0xD3C58762, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (E) [t4] (Hyper Mode)", { 0xEB, 0xF2, 0xAC, 0x19, 0x0E, 0xBB, 0x2F, 0xE6, 0xD7, 0x5A, 0xD0, 0xAC, 0xAA, 0x2A, 0x82, 0xCD }, NULL, NULL, 0x93ED1192, 0x2B2C6244, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (E) [t5] (2x Aggressor)", { 0xED, 0x77, 0x73, 0x98, 0x8B, 0xCC, 0x03, 0xD0, 0x6E, 0x23, 0x30, 0xA8, 0xE7, 0x7B, 0xEC, 0x6F }, NULL, NULL, 0x8C352E50, 0x6B93F13B, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (E) [t6] (P1 Invincible)", { 0xDF, 0x00, 0xC6, 0x98, 0xE2, 0xB1, 0x8A, 0x6C, 0xA9, 0x4C, 0x09, 0xCC, 0xD8, 0x2C, 0xAC, 0xEB }, NULL, NULL, 0x8C3511AE, 0x57115A86, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [!]", { 0x9B, 0x7F, 0x29, 0xAA, 0xB9, 0x11, 0xD6, 0x75, 0x3F, 0x20, 0x11, 0xC4, 0x8D, 0xA7, 0x52, 0xBF }, NULL, NULL, 0xD9F75C12, 0xA8859B59, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [b1]", { 0x7C, 0xD3, 0x86, 0xC8, 0xD2, 0xE6, 0x9D, 0xBB, 0xF5, 0x5F, 0x02, 0xA5, 0x64, 0xBD, 0x6A, 0x9A }, NULL, NULL, 0xD9F75C12, 0xA8859B59, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [b2]", { 0x77, 0xCE, 0x01, 0xC3, 0x2E, 0x17, 0x2C, 0x7D, 0xD8, 0x12, 0xC4, 0xF1, 0x17, 0x9F, 0xBA, 0x2E }, NULL, NULL, 0xD9F75C12, 0xA8859B59, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [b3]", { 0x9D, 0xA1, 0xE1, 0x43, 0xFF, 0x58, 0x08, 0x34, 0xFE, 0x48, 0x5D, 0x08, 0xC2, 0x1B, 0x6D, 0x01 }, NULL, NULL, 0xD9F75C12, 0xA8859B59, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [b4]", { 0xED, 0x44, 0x14, 0xB5, 0x12, 0xCF, 0x22, 0xDA, 0x64, 0xB0, 0x80, 0xD3, 0x4B, 0x5E, 0x2F, 0x4F }, NULL, NULL, 0xD9F75C12, 0xA8859B59, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [b5]", { 0x57, 0x46, 0x48, 0x01, 0xA0, 0x58, 0xB9, 0x7E, 0x05, 0x67, 0x66, 0xDD, 0xFC, 0xF9, 0x3A, 0x69 }, NULL, NULL, 0xD9F75C12, 0xA8859B59, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [h1C]", { 0x8C, 0xE0, 0xA4, 0x1C, 0xB2, 0x9C, 0x14, 0x30, 0x0B, 0x48, 0x2E, 0x0E, 0x98, 0x97, 0xEB, 0xBF }, NULL, NULL, 0xD9F75C12, 0xA8859B59, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [h2C]", { 0x4D, 0xBA, 0xD6, 0xB0, 0xE2, 0xF3, 0x0A, 0x63, 0xF9, 0x74, 0xA8, 0x55, 0x13, 0xB6, 0x68, 0xE0 }, NULL, NULL, 0xD9F75C12, 0xA8859B59, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [o1]", { 0x97, 0x68, 0x25, 0xDA, 0xB0, 0x7E, 0x6F, 0x5D, 0x69, 0xBF, 0xD5, 0xB4, 0x63, 0x37, 0xDE, 0x85 }, NULL, NULL, 0xD9F75C12, 0xA8859B59, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [o1][h1C]", { 0xEE, 0x05, 0x2C, 0x69, 0xFF, 0xA6, 0x7D, 0xB3, 0x54, 0x48, 0x72, 0xAB, 0x0E, 0x74, 0x5D, 0xDF }, NULL, NULL, 0xD9F75C12, 0xA8859B59, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [o1][h2C]", { 0x10, 0x77, 0x4B, 0xFB, 0xC9, 0xD8, 0x15, 0x19, 0x4A, 0xD9, 0x04, 0xF8, 0x98, 0xCB, 0xE9, 0x6F }, NULL, NULL, 0xD9F75C12, 0xA8859B59, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [t1] (Hit Anywhere)", { 0x04, 0xA3, 0xF6, 0xD2, 0xA3, 0x0F, 0xED, 0xE6, 0xCA, 0xDC, 0x5C, 0x2F, 0xCB, 0xCF, 0xBD, 0x12 }, NULL, NULL, 0xF9F75B92, 0xAFEC042B, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [t2] (All Attacks Hurt P1)", { 0xCC, 0xD0, 0xBA, 0x9C, 0x22, 0x0D, 0x1E, 0xE9, 0x1B, 0x39, 0x74, 0x7A, 0x6E, 0x50, 0x65, 0xEE }, NULL, NULL, 0xF2F75C36, 0x36637257, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [t3] (All Attacks Hurt P2)", { 0x54, 0x8C, 0x44, 0x4F, 0xB6, 0x04, 0xCA, 0x17, 0x9E, 0xAD, 0x41, 0x15, 0xFF, 0xB0, 0x70, 0xFC }, NULL, NULL, 0xD2F75C12, 0xE89EB415, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [t4] (Hyper Mode)", { 0x4D, 0xED, 0x93, 0x81, 0xCD, 0x0D, 0x39, 0x6A, 0xE6, 0xC9, 0x63, 0x4D, 0x57, 0x5D, 0xD9, 0x3C }, NULL, NULL, 0xA2015C11, 0xC317ECAB, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [t5] (2x Aggressor)", { 0xF5, 0x50, 0x9B, 0x1E, 0xA8, 0x3A, 0x49, 0xD0, 0x1E, 0x5E, 0x4E, 0xF4, 0x75, 0xB8, 0x72, 0x78 }, NULL, NULL, 0xD9FECC50, 0xD3AA8423, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.0) [t6] (P1 Invincible)", { 0xD6, 0x8F, 0xC4, 0xD8, 0x56, 0x8B, 0x7D, 0x02, 0xEF, 0xD4, 0x7F, 0x32, 0xB9, 0xC0, 0x91, 0xD7 }, NULL, NULL, 0xA1815C2E, 0xC6806731, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.1) [!]", { 0x26, 0x12, 0x94, 0x19, 0x79, 0x9D, 0xB0, 0x1B, 0xFE, 0x79, 0xF2, 0x79, 0xEC, 0x43, 0xB3, 0x34 }, NULL, NULL, 0x19F55D46, 0x73A27B34, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.2) [!]", { 0x3D, 0xCB, 0x15, 0x04, 0x30, 0x63, 0xBD, 0x65, 0x6A, 0x02, 0x23, 0xC5, 0x19, 0x21, 0x8C, 0xFB }, NULL, NULL, 0x83F33AA9, 0xA901D40D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.2) [t1] (Hit Anywhere)", { 0x27, 0xF7, 0x61, 0xB7, 0xDD, 0x73, 0xE1, 0x2B, 0xB3, 0x11, 0x77, 0x27, 0x80, 0xD6, 0xB9, 0xF4 }, NULL, NULL, 0x83F33AA9, 0x2649847A, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.2) [t2] (All Attacks Hurt P1)", { 0x8A, 0x7B, 0x5A, 0x6A, 0xB0, 0xE8, 0x15, 0xDB, 0xDF, 0xFD, 0x1F, 0xC9, 0x99, 0x39, 0xCE, 0x9F }, NULL, NULL, 0xBCF33AAD, 0xBF3C37EC, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.2) [t3] (All Attacks Hurt P2)", { 0x37, 0xFE, 0xB7, 0x17, 0x87, 0x12, 0x98, 0x0D, 0xD0, 0x95, 0x3D, 0x19, 0x51, 0x87, 0xC3, 0x5D }, NULL, NULL, 0x9CF33AA9, 0x3F05381F, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.2) [t4] (Hyper Mode)", { 0xD3, 0xB2, 0x8E, 0x1E, 0x15, 0x4C, 0x5B, 0x58, 0xA4, 0x0E, 0x3D, 0x71, 0xD8, 0x59, 0x9C, 0xE2 }, NULL, NULL, 0x9C013AA8, 0xEB3267A7, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.2) [t5] (2x Aggressor)", { 0x0D, 0x70, 0x8D, 0xDE, 0x7E, 0xC6, 0xB6, 0x7E, 0x70, 0x5F, 0x1D, 0x86, 0x5D, 0x70, 0xAF, 0xDA }, NULL, NULL, 0x83FB2B69, 0x7A5D2980, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (V1.2) [t6] (P1 Invincible)", { 0x68, 0xEB, 0xC8, 0xC8, 0x49, 0x45, 0x9F, 0xE3, 0x0E, 0x71, 0x62, 0xD4, 0x8E, 0xBA, 0xC0, 0xBD }, NULL, NULL, 0x83F33AA9, 0xA901D40D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Mortal Kombat Trilogy (U) (Beta) (1996-05-13) [!]", { 0xB6, 0xA7, 0xB8, 0x5C, 0x12, 0x3D, 0xF4, 0xE0, 0xB9, 0xCC, 0x11, 0x85, 0x78, 0xDB, 0xC9, 0xA2 }, NULL, NULL, 0xD9F75C12, 0xA8859B59, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Ms. Pac-Man - Maze Madness (U) [!]", { 0x08, 0xBE, 0xA3, 0x31, 0x0E, 0x77, 0x8A, 0x65, 0x84, 0xEB, 0x64, 0xCD, 0x3F, 0x15, 0xF8, 0x6E }, NULL, NULL, 0x1938525C, 0x586E9656, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "My Angel Demo (PD)", { 0xF9, 0x05, 0xCA, 0x22, 0xCC, 0x03, 0x0B, 0xBE, 0xD5, 0x16, 0xF3, 0xD1, 0xB6, 0xC2, 0x15, 0x3A }, NULL, NULL, 0x9865799F, 0x006F908C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mystical Ninja 2 Starring Goemon (E) (M3) [!]", { 0xE6, 0xB5, 0xC1, 0x7B, 0x7B, 0xBB, 0xB7, 0xC4, 0x32, 0xB3, 0x50, 0x6C, 0x08, 0x5D, 0x16, 0xC4 }, NULL, NULL, 0x7F9345D3, 0x841ECADE, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Mystical Ninja 2 Starring Goemon (E) (M3) [hI]", { 0x75, 0xAD, 0x77, 0x14, 0x25, 0xCB, 0xE2, 0xB1, 0xE8, 0xC7, 0xB4, 0xD9, 0x4E, 0x67, 0xB1, 0xCA }, NULL, NULL, 0xC27F7CEC, 0x85E0806F, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Mystical Ninja 2 Starring Goemon (E) (M3) [t1]", { 0x00, 0x4E, 0xA3, 0x4E, 0xE1, 0x2C, 0xBA, 0xBD, 0xC0, 0x53, 0x41, 0x97, 0x14, 0xE6, 0x6D, 0xD4 }, NULL, NULL, 0xC27F7CEC, 0x85E0806F, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Mystical Ninja Starring Goemon (E) [!]", { 0x69, 0x89, 0x30, 0xC7, 0xCC, 0xD8, 0x44, 0x67, 0x3D, 0x77, 0xFF, 0xEC, 0xCB, 0x3D, 0xD6, 0x6E }, NULL, NULL, 0xF5360FBE, 0x2BF1691D, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Mystical Ninja Starring Goemon (E) [b1]", { 0xDB, 0xD2, 0xBC, 0x43, 0xFC, 0xDA, 0xDA, 0xCD, 0x23, 0x4A, 0xEF, 0xC8, 0x13, 0x0A, 0x54, 0x13 }, NULL, NULL, 0xF5360FBE, 0x2BF1691D, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Mystical Ninja Starring Goemon (E) [h1C]", { 0x8F, 0x1C, 0x1F, 0xEA, 0xAF, 0x0D, 0x05, 0x3E, 0x23, 0x03, 0x61, 0xE3, 0xF8, 0x1B, 0x02, 0x69 }, NULL, NULL, 0xF5360FBE, 0x2BF1691D, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Mystical Ninja Starring Goemon (E) [t1]", { 0x1F, 0xFB, 0xDA, 0xB7, 0x27, 0xC9, 0xD6, 0x34, 0xD4, 0xF4, 0xDD, 0xBD, 0x9F, 0x35, 0x84, 0x45 }, NULL, NULL, 0x835B97A2, 0xFF6C0060, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Mystical Ninja Starring Goemon (U) [!]", { 0x64, 0x3C, 0xCE, 0x1A, 0xB0, 0x6F, 0x97, 0xE9, 0x59, 0x02, 0x41, 0xD2, 0x7E, 0x5C, 0x23, 0x63 }, NULL, NULL, 0xFCBCCB21, 0x72903C6B, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Mystical Ninja Starring Goemon (U) [h1C]", { 0x42, 0xE2, 0x82, 0xA3, 0xF2, 0x08, 0xC4, 0xBD, 0xE5, 0x0A, 0x4A, 0x43, 0x01, 0x18, 0x1B, 0x16 }, NULL, NULL, 0xFCBCCB21, 0x72903C6B, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Mystical Ninja Starring Goemon (U) [t1]", { 0x07, 0xA7, 0xD3, 0xDB, 0x5B, 0x64, 0xA6, 0xCC, 0xF9, 0xD4, 0x4B, 0x32, 0x14, 0x72, 0xCC, 0x21 }, NULL, NULL, 0x7AADA8DD, 0x94DAB468, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Mystical Ninja Starring Goemon (U) [t1][h2C]", { 0x55, 0xF9, 0x9A, 0x3F, 0x34, 0x02, 0x49, 0x1E, 0x95, 0x17, 0x98, 0x0B, 0xE6, 0x36, 0xE3, 0xFE }, NULL, NULL, 0x7AADA8DD, 0x94DAB468, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Mystical Ninja Starring Goemon (U) [t2]", { 0x4D, 0x18, 0x21, 0x88, 0x63, 0x52, 0xEA, 0xA2, 0xF6, 0x63, 0xCF, 0xF6, 0x3E, 0xD1, 0x7D, 0xD8 }, NULL, NULL, 0x7AADA8DD, 0x94DAB468, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "N64 Scene Gallery by CALi (PD)", { 0x17, 0xB8, 0x39, 0xB8, 0xE7, 0x2A, 0x62, 0x87, 0xA5, 0xBB, 0x3C, 0xEF, 0xCB, 0xC0, 0x35, 0xE9 }, NULL, NULL, 0x6D2C07F1, 0xC884F0D0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "N64 Seminar Demo - CPU by ZoRAXE (PD)", { 0x88, 0x2B, 0x30, 0x62, 0x5B, 0x72, 0x2B, 0x5C, 0x29, 0xD0, 0xD9, 0x4E, 0x70, 0xD9, 0x30, 0x2E }, NULL, NULL, 0xFD61BB45, 0xFBB51EB2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "N64 Seminar Demo - RSP by ZoRAXE (PD)", { 0x8B, 0x78, 0x16, 0xE9, 0x75, 0xDB, 0x27, 0xB4, 0xBF, 0x59, 0x1B, 0xFC, 0x73, 0xC4, 0x39, 0x44 }, NULL, NULL, 0x6D03673A, 0x1D63C191, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "N64 Stars Demo (PD) [b1]", { 0x02, 0x31, 0x75, 0xB6, 0xC8, 0x09, 0x70, 0x4F, 0x00, 0xA3, 0x17, 0xAB, 0xCD, 0x25, 0xA8, 0xF9 }, NULL, NULL, 0x71255651, 0xC6AE0EA6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "N64 Stars Demo (PD)", { 0x67, 0x83, 0x6F, 0xE6, 0x39, 0x01, 0x31, 0x98, 0x74, 0xE0, 0x75, 0x4B, 0xC9, 0x18, 0xAF, 0x7D }, NULL, NULL, 0x71255651, 0xC6AE0EA6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "N64probe (Button Test) by MooglyGuy (PD)", { 0xF4, 0xB5, 0x86, 0x3F, 0x55, 0x0B, 0xC8, 0x3C, 0x79, 0x24, 0xE4, 0x23, 0xB0, 0x1E, 0x1C, 0x5A }, NULL, NULL, 0x44410533, 0x0C61FA96, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "NASCAR 2000 (U) [!]", { 0x45, 0xFE, 0xB0, 0xFB, 0xBE, 0xC6, 0xCB, 0x48, 0xFF, 0x21, 0xDE, 0xAE, 0x17, 0x6E, 0x9B, 0x6B }, NULL, NULL, 0xDF331A18, 0x5FD4E044, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NASCAR 2000 (U) [f1] (PAL)", { 0xDB, 0x3A, 0x91, 0x8F, 0xA6, 0x1E, 0x1F, 0xB3, 0x11, 0x0C, 0xFE, 0x6E, 0x9D, 0xA3, 0x3E, 0x97 }, NULL, NULL, 0x651F2792, 0xE40CC56B, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NASCAR 99 (E) (M3) [!]", { 0x15, 0xA8, 0x7A, 0x6D, 0x01, 0xDB, 0xA1, 0xA7, 0xC4, 0x37, 0x5F, 0xFB, 0xC1, 0x21, 0x4B, 0xB8 }, NULL, NULL, 0xAE4992C9, 0x9253B253, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NASCAR 99 (E) (M3) [h1C]", { 0xA3, 0x1A, 0xD7, 0xE7, 0xE6, 0x17, 0x7B, 0xED, 0x73, 0x45, 0x63, 0x5F, 0xDA, 0x56, 0x3F, 0xCA }, NULL, NULL, 0xAE4992C9, 0x9253B253, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NASCAR 99 (U) [!]", { 0xDC, 0x5F, 0x1A, 0x81, 0x4C, 0x84, 0x23, 0xB4, 0xB4, 0x3F, 0x71, 0xC2, 0x29, 0xD6, 0x5A, 0x84 }, NULL, NULL, 0x23749578, 0x80DC58FD, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NASCAR 99 (U) [b1]", { 0xAC, 0x88, 0xA7, 0xD8, 0x1F, 0xF0, 0xB7, 0x12, 0xEA, 0x3A, 0x30, 0x24, 0x19, 0xF3, 0xA9, 0x27 }, NULL, NULL, 0x23749578, 0x80DC58FD, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NASCAR 99 (U) [b2]", { 0xDA, 0x77, 0xC8, 0xAB, 0x76, 0xE6, 0x20, 0x95, 0x50, 0xD5, 0x6F, 0xED, 0x18, 0x17, 0xAF, 0xBD }, NULL, NULL, 0xFCB2955B, 0xB302626D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NASCAR 99 (U) [b3]", { 0xA2, 0x67, 0xD8, 0xC9, 0x40, 0x31, 0x67, 0x8D, 0xD3, 0x95, 0xFE, 0x46, 0x67, 0xC4, 0xA7, 0x6A }, NULL, NULL, 0x23E39896, 0x73AB48DC, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NASCAR 99 (U) [f1] (PAL)", { 0x71, 0xBE, 0x7A, 0x48, 0x77, 0x87, 0x37, 0xFD, 0xDD, 0x3C, 0xDE, 0x78, 0x49, 0x50, 0x2C, 0x5B }, NULL, NULL, 0xFCB2955B, 0xB302626D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NASCAR 99 (U) [o1]", { 0xDB, 0x64, 0x48, 0x59, 0xC4, 0xDC, 0xE5, 0x41, 0x80, 0x10, 0xA2, 0x42, 0x7E, 0x39, 0x04, 0xC0 }, NULL, NULL, 0x23749578, 0x80DC58FD, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Courtside 2 - Featuring Kobe Bryant (U) [!]", { 0x73, 0xBB, 0x54, 0xFF, 0xD3, 0xC0, 0xFC, 0x71, 0xF9, 0x41, 0xD9, 0xA8, 0xCC, 0x57, 0xE2, 0xA1 }, NULL, NULL, 0x916852D8, 0x73DBEAEF, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "NBA Courtside 2 - Featuring Kobe Bryant (U) [f1] (PAL)", { 0xEE, 0x4D, 0xCA, 0xED, 0x67, 0x59, 0xCE, 0x01, 0x3B, 0xC7, 0xB5, 0xE8, 0xE8, 0x15, 0xB3, 0x43 }, NULL, NULL, 0x3F16568F, 0x37D93603, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "NBA Courtside 2 - Featuring Kobe Bryant (U) [f2]", { 0xF7, 0x34, 0x66, 0x7E, 0xF2, 0x1D, 0xA9, 0x70, 0x92, 0xF5, 0x4D, 0x25, 0x47, 0xE1, 0x1E, 0x51 }, NULL, NULL, 0x2816D957, 0xA59FF70A, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "NBA Courtside 2 - Featuring Kobe Bryant (U) [hI]", { 0x03, 0x2A, 0xDE, 0xEF, 0x1C, 0x2D, 0x0B, 0x43, 0x87, 0xFA, 0xC0, 0x99, 0x33, 0x4F, 0x72, 0xE3 }, NULL, NULL, 0x24F7EB57, 0x74B3F9F4, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "NBA Courtside 2 - Featuring Kobe Bryant (U) [hI][f1] (PAL)", { 0x94, 0xE3, 0xF2, 0xAC, 0xE3, 0xEB, 0x74, 0x15, 0x0F, 0x03, 0x6B, 0x21, 0x7F, 0xF5, 0x03, 0x70 }, NULL, NULL, 0x26211297, 0x97DB4DFC, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "NBA Hangtime (E) [!]", { 0x62, 0x36, 0x54, 0x63, 0x74, 0x38, 0x57, 0xCF, 0xC8, 0x23, 0x97, 0x8E, 0x0E, 0x59, 0x0D, 0x84 }, NULL, NULL, 0xC788DCAE, 0xBD03000A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "NBA Hangtime (E) [h1C]", { 0x00, 0x57, 0xA5, 0x61, 0xD7, 0x03, 0x43, 0x92, 0xD4, 0x26, 0x7A, 0x41, 0x34, 0xDA, 0x41, 0xB0 }, NULL, NULL, 0xC788DCAE, 0xBD03000A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "NBA Hangtime (U) [!]", { 0xDC, 0x15, 0xFC, 0xBE, 0xAE, 0x0F, 0x1F, 0xEF, 0x7B, 0xEE, 0x14, 0x1D, 0x77, 0xBB, 0x25, 0xA0 }, NULL, NULL, 0x4E69B487, 0xFE18E290, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "NBA Hangtime (U) [b1]", { 0x9C, 0x59, 0x5E, 0x5A, 0x5F, 0x02, 0x73, 0x85, 0xA3, 0x40, 0xAD, 0xDF, 0x60, 0x98, 0x52, 0xDD }, NULL, NULL, 0x4E69B487, 0xFE18E290, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "NBA Hangtime (U) [b2]", { 0x49, 0x55, 0xDE, 0xA9, 0x35, 0x6D, 0x15, 0x06, 0xD6, 0xDE, 0x8B, 0xD8, 0xDA, 0x10, 0xE9, 0x38 }, NULL, NULL, 0x4E69B487, 0xFE18E290, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "NBA Hangtime (U) [b3]", { 0xC8, 0xD6, 0xA4, 0x14, 0x50, 0x55, 0x95, 0xC1, 0x3C, 0x7D, 0xA4, 0xD0, 0x7A, 0x17, 0x23, 0x43 }, NULL, NULL, 0x4E69B487, 0xFE18E290, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "NBA Hangtime (U) [f1] (PAL)", { 0xC2, 0xD0, 0x94, 0x77, 0x8D, 0xA5, 0x3C, 0x7A, 0x84, 0x46, 0x61, 0x30, 0xEC, 0x5C, 0x65, 0xB0 }, NULL, NULL, 0x4E69B487, 0xFE18E290, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "NBA Hangtime (U) [o1]", { 0x80, 0xF9, 0x18, 0xD9, 0x0D, 0xF4, 0x2C, 0x98, 0x41, 0xAE, 0x99, 0x8A, 0x89, 0x22, 0x3C, 0x1E }, NULL, NULL, 0x4E69B487, 0xFE18E290, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "NBA Hangtime (U) [o1][f1]", { 0x62, 0xE1, 0x82, 0xD0, 0x19, 0xDC, 0xE0, 0xC0, 0xEE, 0xAA, 0x3B, 0xE2, 0x02, 0x3A, 0x32, 0x7A }, NULL, NULL, 0x4E69B487, 0xFE18E290, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "NBA In the Zone '98 (J) [!]", { 0x4C, 0x7A, 0x2F, 0x48, 0x81, 0xEA, 0xCA, 0x75, 0xDC, 0x2F, 0xC3, 0x66, 0x73, 0xAE, 0x2A, 0x20 }, NULL, NULL, 0x36ACBA9B, 0xF28D4D94, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA In the Zone '98 (J) [o1]", { 0x41, 0x51, 0xED, 0x80, 0x56, 0x8E, 0xFC, 0xCA, 0x34, 0xF8, 0x83, 0x1D, 0x95, 0x7E, 0xB7, 0xA6 }, NULL, NULL, 0x36ACBA9B, 0xF28D4D94, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA In the Zone '98 (J) [o2]", { 0x23, 0x21, 0x56, 0x42, 0xF5, 0xFA, 0xAA, 0xD0, 0x76, 0x11, 0x66, 0xEA, 0x01, 0x89, 0x63, 0xF0 }, NULL, NULL, 0x36ACBA9B, 0xF28D4D94, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA In the Zone '98 (U) [!]", { 0xBB, 0xB4, 0x8B, 0xE1, 0x98, 0x08, 0x9A, 0x26, 0x05, 0x0C, 0x84, 0xFE, 0x5B, 0x7B, 0x8B, 0xD5 }, NULL, NULL, 0x6A121930, 0x665CC274, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA In the Zone '98 (U) [b1]", { 0xEE, 0x43, 0xF0, 0x10, 0xF2, 0xE8, 0x7B, 0xC6, 0x85, 0x35, 0xD3, 0x33, 0xFE, 0x64, 0xC5, 0x16 }, NULL, NULL, 0x6A121930, 0x665CC274, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA In the Zone '98 (U) [b2]", { 0x49, 0xB4, 0x9E, 0x6D, 0xD5, 0x28, 0xE8, 0x96, 0xDE, 0x9B, 0xCE, 0x3D, 0xCC, 0xF3, 0x44, 0x2E }, NULL, NULL, 0x6A121930, 0x665CC274, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA In the Zone '98 (U) [b3]", { 0x42, 0xF3, 0xA1, 0x77, 0xF5, 0x4C, 0x86, 0xF2, 0xC8, 0xEE, 0x6A, 0xFD, 0xB8, 0x92, 0xA5, 0xA9 }, NULL, NULL, 0x36ACBA9B, 0xF28D4D94, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA In the Zone '98 (U) [h1C]", { 0xBF, 0x33, 0xC3, 0x71, 0xBF, 0x39, 0x6A, 0x5F, 0x6E, 0x72, 0x62, 0x7A, 0x34, 0xAE, 0xDA, 0xF5 }, NULL, NULL, 0x6A121930, 0x665CC274, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA In the Zone '98 (U) [h2C]", { 0x62, 0xDF, 0xA8, 0xA5, 0x90, 0x6E, 0x97, 0x3A, 0x2C, 0x92, 0x3A, 0x16, 0x5E, 0xBE, 0x00, 0xA1 }, NULL, NULL, 0x6A121930, 0x665CC274, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA In the Zone '98 (U) [o1]", { 0x92, 0xD2, 0xBD, 0x86, 0x8B, 0x17, 0xB3, 0xCA, 0x8A, 0x19, 0x11, 0x6A, 0xDD, 0xB9, 0x63, 0xB0 }, NULL, NULL, 0x6A121930, 0x665CC274, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA In the Zone '99 (U) [!]", { 0x6C, 0xBF, 0x40, 0x14, 0xC0, 0x53, 0xE1, 0x68, 0x52, 0xA3, 0xDB, 0x80, 0xAE, 0xB4, 0xC8, 0x53 }, NULL, NULL, 0xA292524F, 0x3D6C2A49, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "NBA In the Zone 2 (J) [!]", { 0xF8, 0xF8, 0x7A, 0xEB, 0x2C, 0x53, 0x7C, 0x9C, 0xB2, 0xE9, 0x91, 0x30, 0x50, 0xBF, 0xC9, 0x28 }, NULL, NULL, 0xAAE11F01, 0x2625A045, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA In the Zone 2000 (E) [!]", { 0x42, 0x44, 0xCC, 0x48, 0x67, 0x4C, 0x26, 0xBD, 0x84, 0x87, 0x18, 0xC0, 0x56, 0x88, 0xF8, 0x21 }, NULL, NULL, 0xB3054F9F, 0x96B69EB5, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA In the Zone 2000 (E) [h1C]", { 0xAF, 0x65, 0x21, 0xE3, 0x3F, 0xDE, 0x91, 0x8B, 0x9A, 0x22, 0x98, 0xFA, 0x0B, 0xD3, 0xAA, 0x90 }, NULL, NULL, 0xB3054F9F, 0x96B69EB5, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA In the Zone 2000 (U) [!]", { 0x19, 0x42, 0x83, 0x3A, 0xC1, 0xA7, 0x1B, 0xE8, 0xBA, 0xE7, 0x4B, 0xBD, 0xFD, 0x6D, 0xE2, 0x78 }, NULL, NULL, 0x8DF95B18, 0xECDA497B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA In the Zone 2000 (U) [f1] (PAL)", { 0xF4, 0x40, 0x1B, 0xCC, 0x9D, 0xD2, 0x52, 0x54, 0x50, 0x3E, 0x32, 0xB4, 0x82, 0xEB, 0x3F, 0xAA }, NULL, NULL, 0x4F8AA5EC, 0x1E6E72DE, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Jam 2000 (E) [!]", { 0x60, 0x4F, 0xEB, 0x17, 0x25, 0x80, 0x44, 0xA3, 0xE6, 0xC3, 0xAA, 0x9D, 0x2C, 0x5B, 0x62, 0xF9 }, NULL, NULL, 0xB6D0CAA0, 0xE3F493C8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Jam 2000 (U) [!]", { 0xAF, 0xEC, 0xC9, 0xA2, 0xDF, 0x7B, 0x1A, 0x66, 0xA6, 0xB7, 0xAB, 0x3A, 0xA8, 0xB4, 0xBD, 0x2E }, NULL, NULL, 0xEBEEA8DB, 0xF2ECB23C, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Jam 2000 (U) [f1] (PAL)", { 0xE2, 0x5F, 0x3A, 0x11, 0x36, 0xC9, 0xC8, 0x17, 0x02, 0xE0, 0x82, 0x70, 0x40, 0xC5, 0xA1, 0x15 }, NULL, NULL, 0xF3996B67, 0x3A3030FA, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Jam 99 (E) [!]", { 0xBE, 0x72, 0xBE, 0x37, 0x0B, 0xC0, 0xA7, 0x6D, 0x40, 0x3F, 0xF2, 0xB9, 0xED, 0x2A, 0x91, 0x73 }, NULL, NULL, 0xE600831E, 0x59F422A8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "NBA Jam 99 (E) [h1C]", { 0x0A, 0x9D, 0x53, 0xEF, 0x71, 0xA0, 0xC6, 0xF2, 0xAE, 0x3A, 0x04, 0x35, 0xE3, 0xD5, 0x87, 0x47 }, NULL, NULL, 0xE600831E, 0x59F422A8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "NBA Jam 99 (U) [!]", { 0xAD, 0xBE, 0x5C, 0xA1, 0x0F, 0x65, 0x9A, 0xF2, 0xBE, 0x71, 0x20, 0x38, 0xE8, 0x52, 0x27, 0x04 }, NULL, NULL, 0x810729F6, 0xE03FCFC1, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "NBA Jam 99 (U) [b1]", { 0x73, 0x44, 0x48, 0x31, 0x30, 0x99, 0x5C, 0xA2, 0x11, 0xB5, 0xB9, 0xFF, 0x98, 0x91, 0xA9, 0xDE }, NULL, NULL, 0x810729F6, 0xE03FCFC1, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "NBA Jam 99 (U) [f1] (PAL)", { 0x53, 0x82, 0xAD, 0x48, 0x84, 0x4A, 0x34, 0x73, 0xD4, 0xCB, 0xA8, 0x7C, 0x85, 0xF2, 0xBA, 0xC2 }, NULL, NULL, 0x61079876, 0x32DB765E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "NBA Live 2000 (E) (M4) [!]", { 0x7F, 0xEC, 0x09, 0x9D, 0x1A, 0x98, 0x9D, 0x52, 0x22, 0xD3, 0xF9, 0xE1, 0xA7, 0x77, 0x04, 0x04 }, NULL, NULL, 0xEB499C8F, 0xCD4567B6, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Live 2000 (U) (M4) [!]", { 0xFC, 0x47, 0xF8, 0x5C, 0xC5, 0x01, 0xC8, 0xC5, 0xBD, 0x9D, 0x0C, 0xA4, 0xDB, 0x48, 0x25, 0x8F }, NULL, NULL, 0x5F25B0EE, 0x6227C1DB, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Live 99 (E) (M5) [!]", { 0x22, 0x6C, 0x19, 0xC8, 0x75, 0x93, 0x14, 0xAC, 0x74, 0x04, 0x20, 0xDD, 0xC3, 0xA3, 0x4E, 0xB4 }, NULL, NULL, 0xCF84F45F, 0x00E4F6EB, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Live 99 (U) (M5) [!]", { 0xDB, 0xE7, 0x9A, 0xE6, 0x53, 0x1B, 0x49, 0x1B, 0x8F, 0x8E, 0xE8, 0xB2, 0xB8, 0x14, 0xD6, 0x65 }, NULL, NULL, 0x57F81C9B, 0x1133FA35, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Live 99 (U) (M5) [b1]", { 0x70, 0x44, 0xE1, 0x35, 0xE7, 0x02, 0xB3, 0x2D, 0xFC, 0xF1, 0x3E, 0x68, 0x84, 0x61, 0x96, 0x7F }, NULL, NULL, 0x57F81C9B, 0x1133FA35, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Live 99 (U) (M5) [b2]", { 0x4D, 0xD6, 0xA2, 0xCF, 0x60, 0x91, 0xA9, 0x2C, 0x43, 0xCE, 0x1B, 0x4A, 0x1B, 0x6F, 0x15, 0x56 }, NULL, NULL, 0x57F81C9B, 0x1133FA35, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Live 99 (U) (M5) [b3]", { 0x5F, 0x46, 0xFC, 0x37, 0x80, 0xA5, 0x0D, 0x5B, 0xB8, 0xFC, 0xB0, 0xF1, 0xC9, 0x56, 0x86, 0xB0 }, NULL, NULL, 0x57F81C9B, 0x1133FA35, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Pro 98 (E) [!]", { 0xA4, 0x11, 0x1A, 0x6C, 0xDD, 0xBD, 0xE0, 0xA4, 0x54, 0x89, 0x10, 0x6F, 0x0D, 0xF0, 0xCA, 0x2B }, NULL, NULL, 0xACDE962F, 0xB2CBF87F, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Pro 99 (E) [!]", { 0xC5, 0xEB, 0xBD, 0xD4, 0x1E, 0xAE, 0xA8, 0xBD, 0x02, 0xCF, 0x52, 0x06, 0x40, 0xCC, 0xCC, 0xDF }, NULL, NULL, 0x8D1780B6, 0x57B3B976, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Pro 99 (E) [f1] (NTSC)", { 0x9A, 0x20, 0x35, 0x06, 0xDB, 0x21, 0x3F, 0x97, 0xFE, 0x28, 0x21, 0x0A, 0xAF, 0x56, 0xF8, 0x20 }, NULL, NULL, 0x356130AD, 0x29367E56, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NBA Showtime - NBA on NBC (U) [!]", { 0x88, 0x1E, 0x98, 0xB4, 0x7F, 0x32, 0x09, 0x3C, 0x33, 0x0A, 0x8B, 0x0D, 0xAD, 0x6B, 0xB6, 0x5D }, NULL, NULL, 0x3FFE80F4, 0xA7C15F7E, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "NBA Showtime - NBA on NBC (U) [f1] (Country Check)", { 0x76, 0xDB, 0x89, 0x75, 0x91, 0x21, 0x71, 0x0C, 0x41, 0x6E, 0xCF, 0xB1, 0x73, 0x6B, 0x5E, 0x39 }, NULL, NULL, 0xE78F66E6, 0x754ABDF5, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "NBA Showtime - NBA on NBC (U) [f1] (PAL)", { 0x76, 0x0D, 0x5F, 0x0A, 0x57, 0x8D, 0x65, 0xE6, 0x8F, 0x5B, 0x4E, 0x8F, 0x64, 0x27, 0x1C, 0x88 }, NULL, NULL, 0x9CEED5BA, 0x62A146D5, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "NBC First Intro by CALi (PD)", { 0xA0, 0x5D, 0x4F, 0xF4, 0x83, 0xAF, 0x3F, 0x1C, 0x55, 0xBE, 0xDC, 0x45, 0x5E, 0x7E, 0xDB, 0xBE }, NULL, NULL, 0x15DB95D4, 0x77BC52D8, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "NBC-LFC Kings of Porn Vol 01 (PD) [a1]", { 0x32, 0x5B, 0x9D, 0xCD, 0x5D, 0x23, 0xF2, 0x69, 0x01, 0x7C, 0x16, 0xE2, 0xBA, 0x62, 0xDE, 0xA3 }, NULL, NULL, 0xDD95F49D, 0x2A9B8893, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "NBC-LFC Kings of Porn Vol 01 (PD)", { 0x88, 0x09, 0x5C, 0x9B, 0xD2, 0x22, 0x32, 0x38, 0x3A, 0xF8, 0x22, 0x35, 0xF0, 0x3B, 0x26, 0x58 }, NULL, NULL, 0xAB9F8D97, 0x95EAA766, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "NBCG Special Edition (PD)", { 0xCE, 0x91, 0x5D, 0x72, 0xFE, 0xA8, 0x6A, 0xA9, 0x9D, 0x9C, 0x01, 0x56, 0x61, 0xA3, 0xD7, 0x68 }, NULL, NULL, 0x011F98B2, 0x1E1C8263, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "NBCG's Kings of Porn Demo (PD)", { 0x8C, 0xE5, 0x5D, 0xA2, 0x1D, 0x0F, 0xA7, 0xB4, 0x16, 0x46, 0xA1, 0xF3, 0xF4, 0x5F, 0x57, 0xA1 }, NULL, NULL, 0x61A5FCEE, 0xB59FD8D3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "NBCG's Tag Gallery 01 by CALi (PD)", { 0xC0, 0xAB, 0xE3, 0x98, 0xCB, 0xC4, 0x5E, 0xC9, 0x0D, 0x03, 0xC5, 0xAD, 0xC2, 0x6C, 0x10, 0x65 }, NULL, NULL, 0x15AA9AF2, 0xFF33D333, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "NBCrew 2 Demo (PD)", { 0xF2, 0x73, 0x00, 0xE1, 0x88, 0x3E, 0xA8, 0x49, 0xA6, 0x95, 0x67, 0xD3, 0xAE, 0xDC, 0x5F, 0x56 }, NULL, NULL, 0x84067BAC, 0x87FBA623, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "NEO Myth N64 Menu Demo V0.1 (PD)", { 0x4C, 0xF0, 0x24, 0x93, 0x45, 0x38, 0x8B, 0xB0, 0x98, 0xF7, 0x9D, 0xDC, 0xD7, 0xA0, 0x07, 0x98 }, NULL, NULL, 0x6539E529, 0x1FE8CE01, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "NFL Blitz (U) [!]", { 0x7F, 0x6C, 0x5E, 0x71, 0x71, 0x1D, 0xEC, 0x81, 0xE7, 0x7C, 0xCF, 0x71, 0x06, 0x0F, 0x67, 0xCA }, NULL, NULL, 0xD094B170, 0xD7C4B5CC, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Blitz (U) [f1] (PAL)", { 0xF0, 0xA1, 0xCC, 0x3D, 0x1D, 0x99, 0xA6, 0x0F, 0x35, 0xD3, 0x7D, 0xDC, 0xCF, 0x43, 0xCA, 0xBB }, NULL, NULL, 0x3D6044AB, 0x46768D77, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Blitz - Special Edition (U) [!]", { 0x7E, 0x85, 0x6F, 0xA8, 0xF7, 0x43, 0x90, 0x0F, 0xEB, 0xA5, 0xA4, 0xE2, 0x8C, 0x23, 0x4A, 0xF7 }, NULL, NULL, 0x30EAD54F, 0x31620BF6, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Blitz 2000 (U) (V1.0) [!]", { 0xBA, 0x49, 0x51, 0x44, 0x41, 0x02, 0x37, 0x22, 0xF0, 0x2D, 0x41, 0xC6, 0x26, 0x12, 0xF6, 0xC3 }, NULL, NULL, 0x15A00969, 0x34E5A285, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Blitz 2000 (U) (V1.0) [f1] (PAL)", { 0xDD, 0xBE, 0x42, 0x48, 0xEA, 0x34, 0xE1, 0x1C, 0x09, 0x1A, 0x97, 0x57, 0x76, 0x04, 0x26, 0x70 }, NULL, NULL, 0xFEB72E1D, 0x5BD2C925, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Blitz 2000 (U) (V1.1) [!]", { 0xDD, 0x96, 0xBB, 0x80, 0xE6, 0x52, 0xCD, 0x1C, 0xF2, 0x3C, 0xA4, 0xB8, 0x29, 0x4B, 0xA7, 0xB5 }, NULL, NULL, 0x5B755842, 0x6CA39C7A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Blitz 2001 (U) [!]", { 0xE4, 0xED, 0xD7, 0x3C, 0xB0, 0x36, 0xC6, 0xB1, 0x43, 0xCE, 0xE9, 0xAE, 0xEE, 0xD6, 0x03, 0x41 }, NULL, NULL, 0x36FA35EB, 0xE85E2E36, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Blitz 2001 (U) [f1] (PAL-NTSC)", { 0xD1, 0x3A, 0x38, 0xB9, 0x63, 0x9C, 0xF1, 0x94, 0x4F, 0xE7, 0x02, 0x4E, 0x4C, 0x58, 0x73, 0x9D }, NULL, NULL, 0xEB7709E2, 0x27A91031, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Quarterback Club 2000 (E) [!]", { 0x75, 0xC0, 0x12, 0x1D, 0x84, 0x91, 0x5B, 0xF5, 0xC1, 0xFB, 0xD3, 0x89, 0xCF, 0x9F, 0x9C, 0x17 }, NULL, NULL, 0x88BD5A9E, 0xE81FDFBF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Quarterback Club 2000 (U) [!]", { 0xEC, 0x18, 0xE3, 0x13, 0x10, 0x40, 0x84, 0x2E, 0x32, 0xEB, 0xAB, 0x66, 0xC7, 0x49, 0x6E, 0xBD }, NULL, NULL, 0xE3AB4ED0, 0x83040DD2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Quarterback Club 2000 (U) [b1]", { 0x55, 0x22, 0x4F, 0x11, 0x48, 0xF8, 0x73, 0xA6, 0x89, 0x60, 0x4F, 0x2D, 0xC6, 0x43, 0x26, 0x82 }, NULL, NULL, 0xE3AB4ED0, 0x83040DD2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Quarterback Club 2000 (U) [b2]", { 0x60, 0x4E, 0x2F, 0xB5, 0xAC, 0x9A, 0x26, 0xA8, 0x18, 0x83, 0xA4, 0xC1, 0x90, 0x37, 0x86, 0x2A }, NULL, NULL, 0xE3AB4ED0, 0x83040DD2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Quarterback Club 2001 (U) [!]", { 0xFD, 0x2C, 0xBD, 0xEA, 0x09, 0x92, 0x45, 0x2B, 0x52, 0xE2, 0x80, 0x32, 0x24, 0x23, 0x2D, 0x12 }, NULL, NULL, 0x28784622, 0xFFB22985, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Quarterback Club 98 (E) [!]", { 0xA1, 0x8C, 0xA5, 0xDB, 0xC8, 0x56, 0x68, 0x66, 0x7A, 0xA4, 0x67, 0xAD, 0xD6, 0xA6, 0x2B, 0x39 }, NULL, NULL, 0x4B629EF4, 0x99B21D9B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Quarterback Club 98 (E) [o1]", { 0x37, 0x95, 0x4B, 0xA9, 0x06, 0x78, 0x40, 0xFA, 0xFF, 0x85, 0x10, 0x92, 0x04, 0x3F, 0x04, 0x35 }, NULL, NULL, 0x4B629EF4, 0x99B21D9B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Quarterback Club 98 (U) [!]", { 0x70, 0x9F, 0x96, 0x6C, 0x30, 0xCE, 0x6D, 0xF1, 0x83, 0x3E, 0x95, 0x74, 0x0A, 0x5A, 0x2A, 0xB2 }, NULL, NULL, 0xD89BE2F8, 0x99C97ADF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Quarterback Club 98 (U) [b1]", { 0xB3, 0x9D, 0x12, 0x91, 0x0D, 0x12, 0x49, 0x86, 0x05, 0xA9, 0xF7, 0x93, 0xC2, 0x98, 0x66, 0xBE }, NULL, NULL, 0xD89BE2F8, 0x99C97ADF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Quarterback Club 98 (U) [o1]", { 0x8A, 0x47, 0x09, 0x1F, 0x44, 0x31, 0x17, 0xBF, 0xA6, 0x29, 0xB0, 0xB2, 0x9D, 0x44, 0x50, 0xC6 }, NULL, NULL, 0xD89BE2F8, 0x99C97ADF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Quarterback Club 99 (E) [!]", { 0x7E, 0xC0, 0x48, 0x4C, 0x2B, 0xA6, 0xAA, 0x9F, 0x0A, 0x45, 0xD7, 0xAC, 0x1F, 0x41, 0x17, 0xDA }, NULL, NULL, 0x52A3CF47, 0x4EC13BFC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Quarterback Club 99 (E) [b1]", { 0xEB, 0xDC, 0x15, 0x5D, 0x74, 0x62, 0xF8, 0xC7, 0x3D, 0xB4, 0x73, 0x0C, 0x6B, 0xF4, 0x01, 0x0D }, NULL, NULL, 0x52A3CF47, 0x4EC13BFC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NFL Quarterback Club 99 (U) [!]", { 0x92, 0x88, 0x69, 0xD1, 0xCE, 0x00, 0x1B, 0x81, 0x3B, 0xA9, 0x08, 0xDF, 0xE1, 0x8D, 0x7F, 0x94 }, NULL, NULL, 0xBE76EDFF, 0x20452D09, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL 99 (E) [!]", { 0xB7, 0xE4, 0x1D, 0x34, 0xD2, 0x09, 0xB6, 0xCF, 0xA9, 0x2E, 0x3D, 0x62, 0x2F, 0x91, 0x1C, 0x4E }, NULL, NULL, 0x287D601E, 0xABF4F8AE, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL 99 (U) [!]", { 0xA6, 0x2F, 0xA0, 0x44, 0xBC, 0xB5, 0x50, 0x7D, 0x35, 0x84, 0x24, 0xAB, 0xDA, 0x64, 0x19, 0xDB }, NULL, NULL, 0x591A806E, 0xA5E6921D, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Blades of Steel '99 (U) [!]", { 0x34, 0x9F, 0x61, 0xF9, 0x74, 0x7F, 0x2D, 0x20, 0x98, 0xF3, 0x05, 0x92, 0x4C, 0x97, 0xA1, 0xBF }, NULL, NULL, 0x82EFDC30, 0x806A2461, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Blades of Steel '99 (U) [f1] (PAL)", { 0x9F, 0xF8, 0xAF, 0xF6, 0x64, 0x78, 0x13, 0x84, 0xA5, 0xFC, 0x01, 0x44, 0x9D, 0xC5, 0xAD, 0x8D }, NULL, NULL, 0x82EFDC30, 0x806A2461, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Breakaway 98 (E) [!]", { 0x46, 0x47, 0x6A, 0x56, 0x26, 0xCD, 0x99, 0xB3, 0x74, 0x9A, 0xC1, 0xEE, 0x1E, 0x23, 0x4F, 0xAC }, NULL, NULL, 0x29CE7692, 0x71C58579, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Breakaway 98 (E) [f1] (NTSC)", { 0x43, 0xD7, 0x88, 0xE7, 0xCA, 0xEA, 0x11, 0x46, 0x22, 0x8B, 0x76, 0x3C, 0x13, 0xE8, 0xE7, 0x40 }, NULL, NULL, 0xC5F020F3, 0x27B2CA73, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Breakaway 98 (E) [h1C]", { 0x5C, 0xB5, 0x21, 0xB9, 0x28, 0xFB, 0x94, 0xE8, 0x4F, 0x4E, 0x0E, 0x49, 0xB6, 0xE2, 0x5C, 0xD4 }, NULL, NULL, 0x29CE7692, 0x71C58579, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Breakaway 98 (E) [o1]", { 0x75, 0xF1, 0x97, 0xDE, 0xF1, 0xD0, 0x84, 0x53, 0x48, 0x57, 0x49, 0x35, 0x82, 0xD8, 0x4E, 0x73 }, NULL, NULL, 0x29CE7692, 0x71C58579, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Breakaway 98 (E) [o1][h1C]", { 0x9E, 0xA9, 0x9E, 0xD5, 0xE2, 0x7E, 0x35, 0x97, 0x6E, 0x82, 0x66, 0xFA, 0xCF, 0x50, 0x64, 0xCD }, NULL, NULL, 0x29CE7692, 0x71C58579, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Breakaway 98 (U) [!]", { 0xB6, 0x20, 0x76, 0xFA, 0x14, 0x21, 0xB8, 0xE7, 0xFD, 0xEC, 0x2B, 0x4F, 0x8A, 0x91, 0x0E, 0xA3 }, NULL, NULL, 0x6DFDCDC3, 0x4DE701C8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Breakaway 98 (U) [h1C]", { 0x1D, 0x17, 0x8B, 0x74, 0xA1, 0x63, 0x71, 0x1C, 0xA9, 0xC0, 0x63, 0x27, 0xF3, 0xB7, 0x09, 0xCF }, NULL, NULL, 0x6DFDCDC3, 0x4DE701C8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Breakaway 98 (U) [o1]", { 0xBA, 0x86, 0x35, 0x54, 0x22, 0x2E, 0x50, 0x3B, 0xAC, 0x7F, 0x01, 0xFA, 0x48, 0x88, 0xBE, 0x8A }, NULL, NULL, 0x6DFDCDC3, 0x4DE701C8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Breakaway 98 (U) [o1][h1C]", { 0x5D, 0xFB, 0x02, 0x00, 0xB6, 0x69, 0x8C, 0xEF, 0x2B, 0xA2, 0xA1, 0x77, 0x5B, 0xA2, 0x52, 0xA8 }, NULL, NULL, 0x6DFDCDC3, 0x4DE701C8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Breakaway 99 (E) [!]", { 0x4B, 0xA9, 0x5A, 0xA9, 0x7E, 0xCF, 0xEE, 0x36, 0x05, 0x1E, 0xBE, 0x0A, 0x90, 0x24, 0xEE, 0xE8 }, NULL, NULL, 0x874621CB, 0x0031C127, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Breakaway 99 (E) [b1]", { 0x41, 0x7A, 0xFE, 0x49, 0xBF, 0x73, 0xF3, 0x66, 0x3C, 0x5F, 0x5F, 0x0A, 0xF8, 0x97, 0xFC, 0x79 }, NULL, NULL, 0x874621CB, 0x0031C127, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Breakaway 99 (U) [!]", { 0xAF, 0x1D, 0x07, 0x67, 0x90, 0x14, 0x76, 0x0B, 0x88, 0x92, 0x3A, 0x48, 0x27, 0x65, 0x8C, 0xAF }, NULL, NULL, 0x441768D0, 0x7D73F24F, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Breakaway 99 (U) [b1]", { 0x07, 0xC1, 0x02, 0xE1, 0xAD, 0xF6, 0x19, 0x0E, 0x05, 0xEF, 0x3C, 0x89, 0x70, 0x90, 0xDF, 0xD3 }, NULL, NULL, 0x441768D0, 0x7D73F24F, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Breakaway 99 (U) [b2]", { 0x16, 0x14, 0xE1, 0xC0, 0xBE, 0xBF, 0xAA, 0x08, 0x55, 0xDA, 0x99, 0x90, 0xEF, 0x85, 0x9A, 0x68 }, NULL, NULL, 0xF0C5F320, 0xB22773CA, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Pro 99 (E) [!]", { 0xA6, 0x18, 0x54, 0xCF, 0x27, 0xE5, 0x36, 0xC8, 0x51, 0x31, 0x74, 0xFA, 0xEF, 0x08, 0xDF, 0xCB }, NULL, NULL, 0xA9895CD9, 0x7020016C, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NHL Pro 99 (E) [o1]", { 0xBC, 0xEE, 0x33, 0xDC, 0x37, 0xC8, 0x72, 0xA1, 0x88, 0xA7, 0x2E, 0xEA, 0xF4, 0x13, 0x69, 0xF4 }, NULL, NULL, 0xA9895CD9, 0x7020016C, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "NUTS - Nintendo Ultra64 Test Suite by MooglyGuy (PD)", { 0x3E, 0x21, 0x7E, 0x9C, 0x70, 0x60, 0x8E, 0x56, 0xDA, 0x20, 0xFE, 0xAC, 0x9A, 0x45, 0x8E, 0xFC }, NULL, NULL, 0xEFDAFEA4, 0xE38D6A80, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Nagano Winter Olympics '98 (E) [!]", { 0xB9, 0x35, 0xB8, 0x7F, 0x3D, 0xCC, 0xA8, 0xAE, 0xEB, 0x6A, 0x93, 0x65, 0x12, 0x48, 0x46, 0xDC }, NULL, NULL, 0x6D452016, 0x713C09EE, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Nagano Winter Olympics '98 (E) [h1C]", { 0xD5, 0xCE, 0x3A, 0x47, 0x71, 0x04, 0x21, 0x34, 0x99, 0xFF, 0xEA, 0x3A, 0x0B, 0xCB, 0x15, 0x55 }, NULL, NULL, 0x6D452016, 0x713C09EE, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Nagano Winter Olympics '98 (E) [o1]", { 0xD4, 0xD0, 0x46, 0xF7, 0x4B, 0xE4, 0x0E, 0x06, 0x78, 0x75, 0x70, 0x17, 0x51, 0x64, 0x71, 0x78 }, NULL, NULL, 0x6D452016, 0x713C09EE, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Nagano Winter Olympics '98 (U) [!]", { 0xC1, 0x7F, 0x78, 0xA1, 0x03, 0xD9, 0x9B, 0x21, 0x53, 0x3F, 0x0C, 0x15, 0x66, 0x37, 0x8E, 0xF6 }, NULL, NULL, 0x8D2BAE98, 0xD73725BF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Nagano Winter Olympics '98 (U) [T+Ita_HRG]", { 0x48, 0x78, 0x2B, 0xC5, 0x72, 0x8F, 0x38, 0x09, 0x9B, 0x21, 0xE8, 0xB2, 0x81, 0xAD, 0xC1, 0xCA }, NULL, NULL, 0x8D2BAE98, 0xD73725BF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Nagano Winter Olympics '98 (U) [b1]", { 0x63, 0xC2, 0xA3, 0x27, 0xF7, 0x19, 0x5F, 0xF4, 0x32, 0x29, 0x73, 0x8D, 0x31, 0x5C, 0xF5, 0x1C }, NULL, NULL, 0x8D2BAE98, 0xD73725BF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Nagano Winter Olympics '98 (U) [b2]", { 0x21, 0x31, 0xA0, 0xAE, 0x31, 0x7D, 0x24, 0x36, 0x18, 0xA1, 0xE9, 0x0E, 0x21, 0x53, 0x21, 0x5C }, NULL, NULL, 0x8D2BAE98, 0xD73725BF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Nagano Winter Olympics '98 (U) [h1C]", { 0x96, 0xF8, 0xB3, 0xE6, 0xF6, 0xB9, 0x19, 0x23, 0x46, 0x2B, 0x02, 0x55, 0x40, 0x25, 0xC4, 0x03 }, NULL, NULL, 0x8D2BAE98, 0xD73725BF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Nagano Winter Olympics '98 (U) [o1]", { 0xC9, 0xF6, 0x07, 0x00, 0x2F, 0x05, 0x1F, 0x08, 0x7F, 0x4F, 0xD6, 0x8B, 0x8B, 0x77, 0xB4, 0xD3 }, NULL, NULL, 0x8D2BAE98, 0xD73725BF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Nagano Winter Olympics '98 (U) [o2]", { 0xA8, 0xCD, 0xD4, 0xC6, 0x16, 0x04, 0xB9, 0xC2, 0x79, 0x86, 0x12, 0x89, 0xED, 0x7C, 0x45, 0x42 }, NULL, NULL, 0x8D2BAE98, 0xD73725BF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Namco Museum 64 (U) [!]", { 0xE6, 0x12, 0x51, 0xD2, 0x81, 0x9E, 0x3B, 0xF3, 0xA9, 0xC0, 0xB9, 0x53, 0x29, 0xF6, 0x0F, 0x70 }, NULL, NULL, 0x5129B6DA, 0x9DEF3C8C, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Namco Museum 64 (U) [f1] (PAL)", { 0xEA, 0xD4, 0x17, 0xFF, 0x24, 0xEA, 0xB3, 0x2E, 0x2B, 0xF4, 0x5C, 0xEA, 0x92, 0x00, 0xD4, 0x25 }, NULL, NULL, 0xA896AB1D, 0x27E73688, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Namco Museum 64 (U) [o1]", { 0x1F, 0x45, 0x59, 0x08, 0x26, 0x3C, 0x27, 0x45, 0xE4, 0x10, 0x0C, 0x03, 0x19, 0xB0, 0xF4, 0xC0 }, NULL, NULL, 0x5129B6DA, 0x9DEF3C8C, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Namco Museum 64 (U) [o1][f1] (PAL)", { 0x98, 0xC0, 0xA6, 0x2F, 0xE9, 0x77, 0xA8, 0x20, 0x2F, 0x55, 0x8E, 0x5F, 0x2E, 0x2A, 0x5A, 0x60 }, NULL, NULL, 0xAE21569D, 0x5A5BC572, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Namco Museum 64 (U) [t1]", { 0xE0, 0x01, 0xB3, 0x2D, 0x05, 0xD3, 0x6E, 0xDB, 0x7E, 0x8A, 0x99, 0xB7, 0xC7, 0xE4, 0xC7, 0x89 }, NULL, NULL, 0xA864A921, 0x99082CD0, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Namp64 - N64 MP3-Player by Obsidian (PD)", { 0xCB, 0x7C, 0x26, 0xC0, 0x0A, 0xB0, 0x65, 0xF3, 0x72, 0xDD, 0xA9, 0x95, 0x02, 0x60, 0xBC, 0xBA }, NULL, NULL, 0xC4855DA2, 0x83BBA182, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon Genesis Evangelion (J) [!]", { 0x5E, 0x19, 0x40, 0xCA, 0x12, 0x36, 0xA7, 0x6E, 0x8F, 0x2D, 0x15, 0xDE, 0x04, 0x14, 0xAE, 0x55 }, NULL, NULL, 0x147E0EDB, 0x36C5B12C, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Neon Genesis Evangelion (J) [b1]", { 0x34, 0xF5, 0xF4, 0x02, 0x06, 0x4F, 0x76, 0xB3, 0x75, 0x77, 0x1E, 0xBF, 0x80, 0xDB, 0xE7, 0x34 }, NULL, NULL, 0x147E0EDB, 0x36C5B12C, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Neon Genesis Evangelion (J) [b2]", { 0x43, 0x74, 0xA8, 0x34, 0x2E, 0x61, 0x29, 0x51, 0x14, 0x81, 0x36, 0x19, 0x40, 0x53, 0x96, 0x7C }, NULL, NULL, 0x147E0EDB, 0x36C5B12C, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Neon Genesis Evangelion (J) [b3]", { 0xDB, 0x2A, 0x36, 0x82, 0x45, 0x1F, 0x1A, 0x6C, 0xEA, 0xFB, 0xF4, 0x47, 0x92, 0xD4, 0xA5, 0xA7 }, NULL, NULL, 0x147E0EDB, 0x36C5B12C, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Neon Genesis Evangelion (J) [f1] (PAL)", { 0x7F, 0xE7, 0x19, 0xDD, 0xE2, 0xCF, 0x1C, 0x92, 0x27, 0xBB, 0x96, 0x50, 0xAF, 0xA2, 0x1A, 0x4B }, NULL, NULL, 0xAC000A2B, 0x38E3A55C, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Neon64 First Public Beta Release V2 by Halley's Comet Software (PD)", { 0x47, 0x23, 0xE4, 0x59, 0x9E, 0x37, 0xDB, 0x86, 0xB9, 0xBB, 0xD2, 0xFD, 0x18, 0xBF, 0xDB, 0x8F }, NULL, NULL, 0x3B18F6F9, 0x8C4BE567, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 First Public Beta Release V3 by Halley's Comet Software (PD)", { 0xB7, 0xA1, 0xD8, 0xB4, 0xBD, 0x19, 0xC7, 0x10, 0xE4, 0xB9, 0xDA, 0xAC, 0x55, 0x90, 0xE3, 0x01 }, NULL, NULL, 0x4F707583, 0x2D6326AA, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 First Public Beta Release by Halley's Comet Software (PD)", { 0xE0, 0x62, 0xDD, 0x1E, 0x3C, 0x8B, 0x7A, 0x26, 0x6F, 0xA0, 0x18, 0xC6, 0xFB, 0xC1, 0x74, 0x55 }, NULL, NULL, 0x3B18F4F7, 0x82BFB2B3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 V1.0 by Halley's Comet Software (PD)", { 0x5E, 0x4D, 0xAB, 0xAD, 0xB1, 0x74, 0x39, 0xA1, 0xF2, 0x12, 0x2F, 0x5E, 0x2C, 0x14, 0x1F, 0xD1 }, NULL, NULL, 0xE87D098B, 0x4C70341C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 V1.1 by Halley's Comet Software (PD) [o2]", { 0x83, 0xCB, 0x0C, 0xE8, 0x25, 0x55, 0xFE, 0x73, 0x3A, 0x12, 0x1C, 0x05, 0x2B, 0xDF, 0x36, 0x62 }, NULL, NULL, 0xAE809DD0, 0x0A99B360, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 V1.1 by Halley's Comet Software (PD)", { 0xCA, 0x02, 0xC4, 0x4E, 0x41, 0xD6, 0xA7, 0xCD, 0x51, 0x78, 0x5D, 0xB0, 0x98, 0x1C, 0x54, 0xC7 }, NULL, NULL, 0xED42A2D4, 0x7A71CD91, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 V1.2 by Halley's Comet Software (PD) [o1]", { 0x08, 0xEB, 0xE3, 0x8D, 0x2E, 0xA9, 0xBC, 0xAC, 0xED, 0x94, 0x80, 0x5B, 0xBB, 0xCE, 0x71, 0x92 }, NULL, NULL, 0x7040B082, 0x1BE98D03, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 V1.2 by Halley's Comet Software (PD)", { 0xD5, 0x4F, 0xB5, 0xA7, 0x8A, 0x2A, 0x91, 0x89, 0xD0, 0x1A, 0xCF, 0x20, 0xA6, 0x04, 0x3F, 0x4B }, NULL, NULL, 0xED42A2D4, 0x7A71CD91, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 V1.2a by Halley's Comet Software (PD) [b1]", { 0x43, 0x47, 0x5A, 0xA0, 0xD7, 0x93, 0x80, 0x6C, 0x23, 0xD8, 0x64, 0x5F, 0x49, 0xF6, 0x65, 0x6D }, NULL, NULL, 0xA9F7BB48, 0xD63C5F56, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 V1.2a by Halley's Comet Software (PD) [o1]", { 0x38, 0xD0, 0x4A, 0x1C, 0x19, 0x2D, 0x59, 0x19, 0x40, 0x43, 0x7B, 0x6B, 0xAF, 0x62, 0x81, 0x19 }, NULL, NULL, 0x5AAD4E36, 0x6625D1D2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 V1.2a by Halley's Comet Software (PD)", { 0x9F, 0xFA, 0x64, 0x2B, 0x02, 0xC2, 0x7D, 0x8E, 0x01, 0xEA, 0xB1, 0x7B, 0x0F, 0x0F, 0x42, 0x51 }, NULL, NULL, 0xED42A2D4, 0x7A71CD91, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "New Tetris, The (E) [!]", { 0xC4, 0xEC, 0xFE, 0xC6, 0x6E, 0xCE, 0xEA, 0x23, 0xF3, 0x96, 0x32, 0xAB, 0x67, 0x53, 0x30, 0x0F }, NULL, NULL, 0xE61CFF0A, 0xCE1C0D71, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "New Tetris, The (U) [!]", { 0x7A, 0x28, 0x17, 0x9B, 0x00, 0x73, 0x4C, 0x9A, 0xA0, 0xF0, 0x60, 0x9F, 0xAF, 0xAA, 0xFD, 0x5F }, NULL, NULL, 0x2153143F, 0x992D6351, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "New Tetris, The (U) [f1] (PAL)", { 0x0B, 0x13, 0x98, 0x3A, 0x63, 0x47, 0x32, 0xFD, 0xE9, 0xD2, 0xD6, 0x38, 0xC0, 0xA1, 0x4C, 0x51 }, NULL, NULL, 0x208A0427, 0xDF465260, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "New Tetris, The (U) [f2] (PAL)", { 0x99, 0xB3, 0x5D, 0x78, 0x33, 0xDA, 0xEB, 0xCE, 0x19, 0x9C, 0xDC, 0xC2, 0x40, 0xE2, 0x9F, 0xDF }, NULL, NULL, 0x208A0437, 0x0E53FF5F, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "New Tetris, The (U) [f3] (PAL)", { 0xE2, 0x30, 0x4D, 0xF5, 0xFF, 0x6B, 0x40, 0xE7, 0x4F, 0xD5, 0xBF, 0x62, 0x65, 0x5D, 0x3E, 0x57 }, NULL, NULL, 0x43D67345, 0xA60D5D3D, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Nightmare Creatures (U) [!]", { 0x41, 0x16, 0xCF, 0x43, 0x5D, 0xB3, 0x15, 0xA2, 0x48, 0x1A, 0xF8, 0xD1, 0xE9, 0x35, 0x2F, 0xEB }, NULL, NULL, 0x2857674D, 0xCC4337DA, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Nightmare Creatures (U) [b1]", { 0x60, 0xA2, 0xCF, 0xF1, 0x51, 0x5D, 0x4C, 0x79, 0x02, 0xDD, 0xE3, 0x2A, 0x6E, 0x01, 0xD4, 0x11 }, NULL, NULL, 0x2857674D, 0xCC4337DA, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Nightmare Creatures (U) [b2]", { 0x68, 0xB4, 0x78, 0xC2, 0x74, 0x81, 0x24, 0x50, 0x36, 0x9D, 0xBF, 0x15, 0x3C, 0xAD, 0x18, 0x5D }, NULL, NULL, 0x2857674D, 0xCC4337DA, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Nightmare Creatures (U) [t1]", { 0xFF, 0x02, 0xFE, 0x6A, 0x6F, 0xE7, 0xF6, 0xC3, 0x1B, 0xCA, 0x69, 0x62, 0xE5, 0x3A, 0x63, 0xCA }, NULL, NULL, 0xAFDCF850, 0x5CCD80DE, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Nightmare Creatures (U) [t2]", { 0x49, 0x19, 0x80, 0x56, 0xDD, 0xEB, 0xB4, 0x1B, 0x1A, 0x82, 0x0A, 0x09, 0x28, 0x9A, 0x2E, 0x3F }, NULL, NULL, 0xAFDCF850, 0x5CCD80DE, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Nintama Rantarou 64 Game Gallery (J) [!]", { 0xB0, 0x49, 0x57, 0xD0, 0x52, 0xEF, 0x85, 0x0C, 0x5E, 0xDE, 0xCE, 0x69, 0xDB, 0x73, 0x77, 0xB3 }, NULL, NULL, 0xCD3C3CDF, 0x317793FA, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x53 },
+    { "Nintendo All-Star! Dairantou Smash Brothers (J) [!]", { 0x66, 0xDB, 0x45, 0x7B, 0x13, 0x0D, 0x31, 0xA2, 0x86, 0xA2, 0x3D, 0x6E, 0x4D, 0xD9, 0x72, 0x6E }, NULL, NULL, 0x67D20729, 0xF696774C, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Nintendo All-Star! Dairantou Smash Brothers (J) [b1]", { 0xB2, 0xDF, 0x29, 0x62, 0x7E, 0x02, 0x19, 0xA9, 0xC1, 0x46, 0x05, 0xF4, 0x68, 0x03, 0xC9, 0x4C }, NULL, NULL, 0x67D20729, 0xF696774C, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Nintendo All-Star! Dairantou Smash Brothers (J) [b2]", { 0x57, 0xCB, 0xAD, 0xB7, 0x54, 0x29, 0xAA, 0xFC, 0x0D, 0x70, 0x40, 0xDE, 0x69, 0xDC, 0x8D, 0x70 }, NULL, NULL, 0x88FFAB7D, 0x298294A2, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Nintendo All-Star! Dairantou Smash Brothers (J) [b3]", { 0x3D, 0x78, 0xB9, 0x07, 0x65, 0x79, 0x18, 0xC8, 0xC5, 0x8E, 0xA0, 0x02, 0xFE, 0xEE, 0x1D, 0x0F }, NULL, NULL, 0x67D20729, 0xF696774C, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Nintendo All-Star! Dairantou Smash Brothers (J) [f1]", { 0x4C, 0xFA, 0xED, 0x7D, 0xAD, 0x4E, 0xE5, 0x92, 0x57, 0x29, 0x64, 0xBA, 0x03, 0xD8, 0xC0, 0x7E }, NULL, NULL, 0x308BC746, 0xA229B775, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Nintendo All-Star! Dairantou Smash Brothers (J) [f2]", { 0x9C, 0x0E, 0x45, 0x4C, 0xFF, 0xE6, 0x58, 0x35, 0xAE, 0xD1, 0x2B, 0x39, 0xA8, 0xD9, 0xD6, 0xEC }, NULL, NULL, 0x88FFAB7D, 0x298294A2, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Nintendo All-Star! Dairantou Smash Brothers (J) [f3]", { 0x9A, 0x27, 0xD4, 0x20, 0xB4, 0x3A, 0x90, 0x8E, 0xCF, 0x4F, 0x28, 0xF8, 0x59, 0xE1, 0xC5, 0x41 }, NULL, NULL, 0x88FFAB7D, 0x298294A2, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Nintendo All-Star! Dairantou Smash Brothers (J) [f4] (PAL)", { 0x05, 0x3C, 0x51, 0x5B, 0xEB, 0xE7, 0x33, 0x91, 0xB4, 0x47, 0x9A, 0x90, 0xA8, 0xEE, 0x93, 0xF9 }, NULL, NULL, 0x58886DD0, 0xAD93BCB1, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Nintendo Family by CALi (PD)", { 0x0A, 0xEE, 0x21, 0xA3, 0x65, 0xF9, 0x45, 0x0C, 0x25, 0x8A, 0x59, 0x55, 0x6F, 0x77, 0xED, 0xB8 }, NULL, NULL, 0x60E528A6, 0x9500D4D3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Nintendo On My Mind Demo by Kid Stardust (PD)", { 0xC1, 0x0B, 0x51, 0xEE, 0xAC, 0x9F, 0x52, 0x04, 0x19, 0xF2, 0x3F, 0x95, 0x22, 0x8C, 0x71, 0x9A }, NULL, NULL, 0x6B2AFCC7, 0xEEB27A34, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Nintendo WideBoy 64 by SonCrap (PD)", { 0xF7, 0x9F, 0x17, 0x35, 0x3D, 0xC5, 0x68, 0x3A, 0xB6, 0x02, 0x57, 0x46, 0x2B, 0xE9, 0xD2, 0xFD }, NULL, NULL, 0xD1C6C55D, 0xF010EF52, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Nintro64 Demo by Lem (POM '98) (PD) [b1]", { 0x9E, 0xB9, 0xA0, 0xA4, 0x5C, 0x2D, 0xD3, 0x5D, 0xCB, 0x5A, 0x4A, 0x8A, 0x7F, 0xC4, 0xB1, 0x51 }, NULL, NULL, 0x4E01B4A6, 0xC884D085, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Nintro64 Demo by Lem (POM '98) (PD)", { 0x49, 0x7D, 0x1E, 0x06, 0x77, 0x39, 0x5A, 0x92, 0x1B, 0x60, 0x06, 0xBB, 0xF4, 0x1E, 0xED, 0x04 }, NULL, NULL, 0x4E01B4A6, 0xC884D085, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "NuFan Demo by Kid Stardust (PD) [b1]", { 0x89, 0x83, 0x62, 0xD1, 0xF6, 0xE2, 0x07, 0x81, 0x8E, 0x8C, 0xDF, 0x88, 0x22, 0x50, 0x17, 0xB6 }, NULL, NULL, 0xFA7D3935, 0x97AC54FC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "NuFan Demo by Kid Stardust (PD)", { 0x9E, 0xD8, 0x2C, 0x5E, 0x9B, 0x6B, 0xF2, 0x04, 0x27, 0x6B, 0x43, 0x4C, 0x8B, 0x0F, 0x68, 0x92 }, NULL, NULL, 0xFA7D3935, 0x97AC54FC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Nuclear Strike 64 (E) (M2) [!]", { 0x71, 0x0B, 0xA4, 0x9E, 0xBD, 0x5C, 0x9A, 0x2B, 0x26, 0x65, 0x3F, 0xAE, 0x93, 0xBD, 0x66, 0x7A }, NULL, NULL, 0x8A97A197, 0x272DF6C1, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Nuclear Strike 64 (E) (M2) [h1C]", { 0x59, 0xC2, 0x8E, 0x02, 0xBA, 0xF4, 0x06, 0x50, 0x51, 0xC6, 0x3E, 0xA5, 0x17, 0x36, 0x89, 0x2A }, NULL, NULL, 0x8A97A197, 0x272DF6C1, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Nuclear Strike 64 (G) [!]", { 0xD4, 0x3C, 0x2E, 0x19, 0x38, 0x53, 0x43, 0x63, 0xE5, 0x6A, 0x22, 0x41, 0x3B, 0x91, 0xD0, 0x51 }, NULL, NULL, 0x8F50B845, 0xD729D22F, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Nuclear Strike 64 (U) [!]", { 0xFF, 0xC5, 0x84, 0x04, 0x0D, 0x0D, 0x05, 0x2F, 0xBA, 0xB4, 0xCB, 0x6C, 0x19, 0x24, 0x54, 0x49 }, NULL, NULL, 0x4998DDBB, 0xF7B7AEBC, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Nuclear Strike 64 (U) [b1]", { 0x76, 0xC8, 0xEF, 0xDD, 0x11, 0xF6, 0xD2, 0xE5, 0x53, 0x05, 0x5B, 0x80, 0x1A, 0x02, 0x26, 0x53 }, NULL, NULL, 0x4998DDBB, 0xF7B7AEBC, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Nuclear Strike 64 (U) [f1] (PAL)", { 0xA3, 0x13, 0x4D, 0xAE, 0x77, 0x1A, 0xDD, 0xB8, 0x31, 0x91, 0x42, 0x26, 0x15, 0xDF, 0x85, 0x51 }, NULL, NULL, 0xE6B339F6, 0x22AE6901, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Nuclear Strike 64 (U) [t1]", { 0x2B, 0x73, 0x70, 0xE6, 0x88, 0x0F, 0x83, 0xC8, 0x08, 0xA2, 0xCB, 0x9E, 0x7F, 0x33, 0xDC, 0x46 }, NULL, NULL, 0xFE5DC5D4, 0xE1815BE5, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Nushi Tsuri 64 (J) (V1.0) [!]", { 0x50, 0xC1, 0x00, 0x82, 0xD0, 0xC0, 0x77, 0xFD, 0xB5, 0x65, 0x8E, 0xF5, 0xA6, 0xE3, 0xF5, 0x4F }, NULL, NULL, 0xD83BB920, 0xCC406416, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 1, 1, 0, 0x900, 100, 0x673 },
+    { "Nushi Tsuri 64 (J) (V1.0) [b1]", { 0x74, 0x12, 0x41, 0x7C, 0x50, 0xA4, 0x24, 0x27, 0x63, 0x75, 0x75, 0xA3, 0xCD, 0x2E, 0x65, 0x2E }, NULL, NULL, 0x24081000, 0xAD880000, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 1, 1, 0, 0x900, 100, 0x673 },
+    { "Nushi Tsuri 64 (J) (V1.0) [b2]", { 0xEE, 0xFD, 0x69, 0x5B, 0x00, 0x35, 0x4C, 0x51, 0x99, 0xDF, 0x34, 0x8E, 0xCF, 0x40, 0x4A, 0x0F }, NULL, NULL, 0x9ADD5DE5, 0x451F0A65, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 1, 1, 0, 0x900, 100, 0x673 },
+    { "Nushi Tsuri 64 (J) (V1.0) [b3]", { 0xC1, 0x87, 0xBD, 0x28, 0x5B, 0xA0, 0xE2, 0xD0, 0xEF, 0x5C, 0xFF, 0xEE, 0x44, 0xB3, 0x67, 0xEE }, NULL, NULL, 0xD83BB920, 0xCC406416, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 1, 1, 0, 0x900, 100, 0x673 },
+    { "Nushi Tsuri 64 (J) (V1.0) [b4]", { 0x0B, 0x28, 0x1D, 0x47, 0x8B, 0x1B, 0x4F, 0xF9, 0x32, 0x9B, 0x45, 0xEE, 0xB8, 0x0D, 0x53, 0xF2 }, NULL, NULL, 0xD83BB920, 0xCC406416, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 1, 1, 0, 0x900, 100, 0x673 },
+    { "Nushi Tsuri 64 (J) (V1.0) [b5]", { 0xFA, 0xBC, 0xB3, 0x07, 0x8E, 0xDE, 0x95, 0x5C, 0x04, 0xA0, 0x04, 0x79, 0xEE, 0x11, 0xC4, 0x3F }, NULL, NULL, 0x49D83BB9, 0x20CC4064, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 1, 1, 0, 0x900, 100, 0x673 },
+    { "Nushi Tsuri 64 (J) (V1.1) [!]", { 0xD2, 0xAF, 0x69, 0x93, 0xE4, 0xD6, 0x57, 0xD0, 0x05, 0x20, 0xC2, 0xCC, 0xE7, 0x41, 0x48, 0x0E }, NULL, NULL, 0xC5F1DE79, 0x5D4BEB6E, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 1, 1, 0, 0x900, 100, 0x673 },
+    { "Nushi Tsuri 64 - Shiokaze ni Notte (J) [b1]", { 0x82, 0x8E, 0x0C, 0x39, 0x9C, 0x0A, 0xA7, 0xE3, 0xB0, 0x47, 0x85, 0x9F, 0x4F, 0xAD, 0x35, 0x50 }, NULL, NULL, 0x5B9A9618, 0x4B86828E, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 1, 1, 0, 0x900, 100, 0x273 },
+    { "Nushi Tsuri 64 - Shiokaze ni Notte (J) [b2]", { 0xA3, 0x66, 0xBC, 0xBF, 0x8F, 0xF4, 0x4D, 0x23, 0xA9, 0x45, 0x0E, 0xCD, 0x8C, 0x71, 0x22, 0x3C }, NULL, NULL, 0x5B9B1618, 0x1B43C649, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 1, 1, 0, 0x900, 100, 0x273 },
+    { "Nushi Tsuri 64 - Shiokaze ni Notte (J) [!]", { 0xEE, 0xB6, 0x95, 0x97, 0xE4, 0x2E, 0x2F, 0x5D, 0x29, 0x14, 0x07, 0x0A, 0xCF, 0x16, 0x1B, 0x4F }, NULL, NULL, 0x5B9B1618, 0x1B43C649, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 1, 1, 0, 0x900, 100, 0x273 },
+    { "O.D.T. (E) (M5) [!]", { 0xE2, 0xFB, 0x4F, 0x16, 0xA0, 0x39, 0xA0, 0xE3, 0x02, 0xD2, 0x8A, 0xCA, 0x94, 0xD5, 0xD9, 0x28 }, NULL, NULL, 0xE86415A6, 0x98395B53, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "O.D.T. (U) (M3) [!]", { 0x41, 0x16, 0xE4, 0x92, 0x16, 0x8A, 0xAF, 0xFF, 0x1B, 0xD3, 0x10, 0x0C, 0x7B, 0x0A, 0xA2, 0x8F }, NULL, NULL, 0x2655BB70, 0x667D9925, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Oerjan Intro by Oerjan (POM '99) (PD)", { 0x09, 0xBA, 0x01, 0xC6, 0xEC, 0x8B, 0x17, 0x8A, 0x27, 0xFB, 0xEE, 0x3A, 0x9D, 0xEE, 0x8E, 0xB6 }, NULL, NULL, 0x7F2D025D, 0x2B7DA4AD, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Off Road Challenge (E) [!]", { 0xE9, 0x6F, 0xEC, 0xBA, 0x52, 0x90, 0x5D, 0xB1, 0x4A, 0xDD, 0xAD, 0x7C, 0xFD, 0x61, 0x09, 0x1F }, NULL, NULL, 0x812289D0, 0xC2E53296, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Off Road Challenge (E) [b1]", { 0xF3, 0x0D, 0xFE, 0xCB, 0x19, 0xDB, 0xD8, 0x2A, 0x2F, 0xD3, 0x34, 0xA8, 0xA3, 0x7B, 0x8D, 0x38 }, NULL, NULL, 0x24081000, 0xAD880000, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Off Road Challenge (E) [b2]", { 0x15, 0x38, 0xA4, 0x23, 0x5F, 0xDE, 0xD9, 0xD6, 0x5B, 0x98, 0xC2, 0x5E, 0xDF, 0x6F, 0x9C, 0x0E }, NULL, NULL, 0x812289D0, 0xC2E53296, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Off Road Challenge (U) [!]", { 0xAF, 0x70, 0x83, 0xFC, 0x0A, 0xBC, 0xFD, 0x5A, 0x2C, 0x6A, 0x5E, 0x97, 0x14, 0x53, 0xD8, 0x31 }, NULL, NULL, 0x319093EC, 0x0FC209EF, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Off Road Challenge (U) [b1]", { 0xDC, 0x34, 0xF5, 0xAA, 0x26, 0x48, 0x83, 0x52, 0xB4, 0xD0, 0x25, 0xED, 0xBF, 0x47, 0xFE, 0x39 }, NULL, NULL, 0x319093EC, 0x0FC209EF, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Off Road Challenge (U) [b2]", { 0x6F, 0x37, 0x8F, 0xFB, 0x87, 0x3C, 0x21, 0x76, 0x75, 0xF4, 0xCD, 0xD0, 0x0A, 0x03, 0x18, 0xD4 }, NULL, NULL, 0x319093EC, 0x0FC209EF, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Off Road Challenge (U) [t1]", { 0xD3, 0xBD, 0xAA, 0x50, 0xD6, 0xC0, 0xEF, 0xFF, 0x9D, 0x69, 0x6C, 0x52, 0x1B, 0x70, 0x43, 0x76 }, NULL, NULL, 0x698FE5E8, 0x1D57B278, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Ogre Battle 64 - Person of Lordly Caliber (J) (V1.1) [!]", { 0xA4, 0x5C, 0x39, 0x76, 0x7D, 0x33, 0xAC, 0x21, 0x95, 0x6A, 0x3D, 0x4E, 0x6C, 0x03, 0xCF, 0xA1 }, NULL, NULL, 0x0375CF67, 0x56A93FAA, 0, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Ogre Battle 64 - Person of Lordly Caliber (J) (V1.1) (VC) [!]", { 0x55, 0xCD, 0x36, 0x0F, 0x12, 0xBE, 0x80, 0x63, 0xC9, 0xE7, 0xB6, 0xF5, 0x9F, 0x26, 0x81, 0x70 }, NULL, NULL, 0x0375CF67, 0x56A93FAA, 0, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Ogre Battle 64 - Person of Lordly Caliber (J) (V1.1) [b1]", { 0xA3, 0xF6, 0x4D, 0x34, 0x61, 0x4A, 0x0B, 0x01, 0xB6, 0xA4, 0x9A, 0xE4, 0x03, 0x1A, 0xCB, 0xDF }, NULL, NULL, 0x0375CF67, 0x56A93FAA, 0, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Ogre Battle 64 - Person of Lordly Caliber (J) (V1.1) [b1][o1]", { 0x54, 0x68, 0xA2, 0xAC, 0x2E, 0x93, 0xAD, 0x3F, 0x49, 0xE9, 0xB2, 0x71, 0xC8, 0x34, 0x1C, 0xAC }, NULL, NULL, 0x0375CF67, 0x56A93FAA, 0, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Ogre Battle 64 - Person of Lordly Caliber (J) (V1.1) [b2]", { 0x7A, 0xF7, 0x00, 0x73, 0xE7, 0xCF, 0xD8, 0x94, 0x5E, 0x08, 0x7A, 0x7F, 0xFD, 0x6D, 0x83, 0x48 }, NULL, NULL, 0x0375CF67, 0x56A93FAA, 0, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Ogre Battle 64 - Person of Lordly Caliber (U) (V1.0) [!]", { 0xF6, 0x66, 0xE0, 0x20, 0x21, 0x83, 0x92, 0xE5, 0x26, 0x62, 0xFD, 0xDF, 0xA1, 0xEA, 0x4F, 0x21 }, NULL, NULL, 0xE6419BC5, 0x69011DE3, 0, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Ogre Battle 64 - Person of Lordly Caliber (U) (V1.1) [!]", { 0xEB, 0xB4, 0xB4, 0xD2, 0x80, 0x8D, 0xF4, 0x27, 0xAA, 0xA3, 0x08, 0x5A, 0x41, 0xB8, 0xA9, 0x54 }, NULL, NULL, 0x0ADAECA7, 0xB17F9795, 0, SAVETYPE_SRAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Olympic Hockey Nagano '98 (E) (M4) [!]", { 0x46, 0x5D, 0xFD, 0x27, 0xDD, 0xAB, 0x4F, 0x54, 0x88, 0xF4, 0xDA, 0xDC, 0x09, 0xB7, 0xF9, 0x38 }, NULL, NULL, 0xAE2D3A35, 0x24F0D41A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Olympic Hockey Nagano '98 (E) (M4) [h1C]", { 0x02, 0xAA, 0x0C, 0x05, 0x9E, 0xC3, 0x61, 0x45, 0x92, 0x73, 0x53, 0xC8, 0xE6, 0x17, 0xAA, 0x41 }, NULL, NULL, 0xAE2D3A35, 0x24F0D41A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Olympic Hockey Nagano '98 (J) [!]", { 0x8A, 0x96, 0x46, 0x71, 0xC5, 0xA4, 0xF4, 0xFC, 0x62, 0x78, 0x7F, 0x1F, 0x25, 0xED, 0xD7, 0x0D }, NULL, NULL, 0x90F43037, 0x5C5370F5, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Olympic Hockey Nagano '98 (U) [!]", { 0x9C, 0x99, 0xC6, 0xD9, 0xEA, 0x98, 0xA9, 0x60, 0x05, 0x6C, 0x53, 0x1C, 0xB7, 0x8E, 0xB3, 0x5B }, NULL, NULL, 0x7EC22587, 0xEF1AE323, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Olympic Hockey Nagano '98 (U) [T+Ita_cattivik66]", { 0x8F, 0x98, 0x10, 0x38, 0x3B, 0x86, 0xE8, 0x6E, 0xC4, 0x47, 0xF6, 0x5D, 0x47, 0xCA, 0x74, 0xA7 }, NULL, NULL, 0x7EC22587, 0xEF1AE323, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Olympic Hockey Nagano '98 (U) [b1]", { 0x7B, 0xD9, 0x7D, 0x75, 0xD0, 0x9E, 0x38, 0x99, 0x6F, 0x82, 0xC6, 0x19, 0x07, 0x80, 0xD4, 0x47 }, NULL, NULL, 0x7EC22587, 0xEF1AE323, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Olympic Hockey Nagano '98 (U) [b2]", { 0x3A, 0x31, 0x4C, 0xE9, 0x38, 0x8E, 0x41, 0x78, 0xFD, 0x6F, 0xC9, 0xC7, 0x4D, 0x5E, 0x71, 0x37 }, NULL, NULL, 0x7EC22587, 0xEF1AE323, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Olympic Hockey Nagano '98 (U) [b3]", { 0xCF, 0xCB, 0x20, 0xEA, 0xCF, 0xCE, 0xAA, 0x43, 0xFD, 0xDB, 0xE0, 0x5F, 0xB0, 0xD1, 0x70, 0xD1 }, NULL, NULL, 0x7EC22587, 0xEF1AE323, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Olympic Hockey Nagano '98 (U) [h1C]", { 0x3E, 0x97, 0x3B, 0x5B, 0xBE, 0xF8, 0xB2, 0x4A, 0x4C, 0x4D, 0x7C, 0x32, 0x69, 0x55, 0xE7, 0x1F }, NULL, NULL, 0x7EC22587, 0xEF1AE323, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Onegai Monsters (J) [!]", { 0x37, 0x96, 0x82, 0x9F, 0x54, 0x95, 0x8C, 0xE1, 0x03, 0xDC, 0xF5, 0xE3, 0xE8, 0xEB, 0x80, 0xB4 }, NULL, NULL, 0xDC649466, 0x572FF0D9, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Onegai Monsters (J) [b1]", { 0xB1, 0x98, 0x05, 0xB3, 0xDF, 0xEC, 0xF8, 0x5F, 0xEA, 0x7E, 0x04, 0x61, 0x43, 0x62, 0xDC, 0x28 }, NULL, NULL, 0xDC649466, 0x572FF0D9, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Operation WinBack (E) (M5) [!]", { 0x91, 0xCF, 0x19, 0x82, 0xF3, 0x09, 0xBD, 0x73, 0x82, 0x21, 0x65, 0x08, 0x7D, 0xAD, 0x43, 0x71 }, NULL, NULL, 0xD5898CAF, 0x6007B65B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "PC-Engine 64 (POM '99) (PD) [t1]", { 0xF2, 0xDF, 0x45, 0x77, 0xD3, 0x74, 0x93, 0x45, 0xF9, 0x3B, 0xA0, 0x60, 0x6B, 0xEC, 0xA8, 0xDD }, NULL, NULL, 0x4B548E10, 0xBB510803, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "PC-Engine 64 (POM '99) (PD)", { 0x70, 0xFD, 0x44, 0xB7, 0x22, 0xB5, 0x59, 0x56, 0xBE, 0x86, 0xB6, 0x60, 0xF1, 0x53, 0x71, 0x3D }, NULL, NULL, 0x9118F1B8, 0x987DAC8C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "PD Ultraman Battle Collection 64 (J) [!]", { 0x52, 0xF4, 0xF3, 0x32, 0x06, 0x07, 0xF3, 0xE8, 0xDD, 0x1A, 0x16, 0xA2, 0xF1, 0xBF, 0xBD, 0xB0 }, NULL, NULL, 0xF468118C, 0xE32EE44E, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x61B },
+    { "PD Ultraman Battle Collection 64 (J) [b1]", { 0x4F, 0xD4, 0x24, 0xDF, 0x60, 0xF8, 0x0E, 0xE7, 0xE3, 0x62, 0xA9, 0x57, 0x20, 0x49, 0xBA, 0x11 }, NULL, NULL, 0xF468118C, 0xE32EE44E, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x61B },
+    { "PD Ultraman Battle Collection 64 (J) [f1] (PAL)", { 0x27, 0x55, 0x15, 0x2E, 0x61, 0x68, 0x51, 0x6F, 0x22, 0x24, 0xAD, 0xC6, 0x73, 0x7B, 0x96, 0xF0 }, NULL, NULL, 0x37B52113, 0x3A77A655, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x61B },
+    { "PD Ultraman Battle Collection 64 (J) [f2] (PAL)", { 0x82, 0x6A, 0xE8, 0x5B, 0x4E, 0x74, 0x35, 0x4E, 0xE3, 0x78, 0xE8, 0xDC, 0x2A, 0xD3, 0x32, 0x71 }, NULL, NULL, 0x170D4973, 0x8FA23F51, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x61B },
+    { "PGA European Tour (E) (M5) [!]", { 0x01, 0x12, 0xFF, 0xAA, 0xDA, 0x11, 0x6D, 0x17, 0x2A, 0xBC, 0xE1, 0x36, 0xE9, 0x04, 0x3A, 0x93 }, NULL, NULL, 0xEE08C602, 0x6BC2D5A6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "PGA European Tour (E) (M5) [f1] (NTSC)", { 0x2F, 0x6B, 0x0A, 0xCB, 0x72, 0x70, 0xF7, 0x8C, 0x97, 0x2F, 0x5E, 0x6D, 0x4C, 0x75, 0xB0, 0x2B }, NULL, NULL, 0x5243B915, 0xBE7743B1, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "PGA European Tour (E) (M5) [f2] (NTSC)", { 0x7D, 0xBA, 0x0D, 0x5D, 0x42, 0x79, 0x27, 0x4A, 0xF0, 0x7B, 0x0E, 0xF3, 0xEC, 0x3A, 0x84, 0xAD }, NULL, NULL, 0x76515D11, 0x42BF7875, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "PGA European Tour (U) [!]", { 0x61, 0x7C, 0xEC, 0xA1, 0xD2, 0xBE, 0xFF, 0xCE, 0x94, 0x3E, 0xF8, 0x32, 0x32, 0x68, 0x98, 0xBF }, NULL, NULL, 0xB54CE881, 0xBCCB6126, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "POMbaer Demo by Kid Stardust (POM '99) (PD)", { 0x8E, 0x79, 0xEC, 0x6D, 0x9F, 0x8D, 0xB1, 0xC5, 0x01, 0x00, 0x86, 0x0B, 0xF4, 0x43, 0x74, 0x62 }, NULL, NULL, 0x9D63C653, 0xC26B460F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "POMolizer Demo by Renderman (POM '99) (PD)", { 0x0B, 0xBE, 0x17, 0xEC, 0x22, 0x71, 0xDC, 0x29, 0x3F, 0x1D, 0x2F, 0x4A, 0x7B, 0x0D, 0x61, 0xD4 }, NULL, NULL, 0xEDAFD3C0, 0x39EF3599, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pachinko 365 Nichi (J) [!]", { 0xD6, 0x00, 0x46, 0xC2, 0x34, 0x00, 0xBF, 0xEB, 0xD5, 0xB0, 0x51, 0xF8, 0x9E, 0x7F, 0x2F, 0x07 }, NULL, NULL, 0x74554B3B, 0xF4AEBCB5, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Pachinko 365 Nichi (J) [b1]", { 0x20, 0x02, 0x43, 0x84, 0x91, 0xF9, 0x4C, 0x46, 0x8C, 0xB4, 0x87, 0x03, 0x2A, 0xC4, 0xAA, 0x33 }, NULL, NULL, 0x74554B3B, 0xF4AEBCB5, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Pachinko 365 Nichi (J) [b2]", { 0xF3, 0x8E, 0xCA, 0x58, 0x1B, 0xF6, 0x94, 0x4E, 0xA3, 0x5E, 0x3A, 0x81, 0x6A, 0xD4, 0x72, 0xDF }, NULL, NULL, 0x74554B3B, 0xF4AEBCB5, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Pamela Demo (PD)", { 0xFE, 0x38, 0xBB, 0x1E, 0xAA, 0x1C, 0x74, 0xBA, 0xF0, 0x18, 0x47, 0xBD, 0xE6, 0x4E, 0x7F, 0x9D }, NULL, NULL, 0x26AD85C5, 0xF908A36B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pamela Demo - Resized (PD)", { 0x3A, 0xAF, 0x74, 0xD7, 0xE6, 0xD5, 0x60, 0xC9, 0xCB, 0x13, 0x31, 0x20, 0x9A, 0xD0, 0x0F, 0x22 }, NULL, NULL, 0x26AD85C5, 0xF908A36B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Paper Mario (Ch) (iQue) [!]", { 0x8F, 0x8F, 0x50, 0xAB, 0x00, 0xC4, 0x08, 0x9A, 0xE3, 0x2C, 0x6B, 0x9F, 0xEF, 0xD6, 0x95, 0x43 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Paper Mario (Ch) (V2) (iQue) (Manual) [!]", { 0xC4, 0xD6, 0x52, 0x42, 0x5A, 0xA4, 0xF2, 0xFC, 0x1D, 0x12, 0x56, 0x4D, 0xF0, 0x1F, 0x8A, 0x04 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Paper Mario (Ch) (V4) (iQue) (Manual) [!]", { 0xD9, 0x59, 0x79, 0x22, 0x20, 0x72, 0x98, 0xA8, 0x7F, 0xA4, 0x68, 0x78, 0xC0, 0x17, 0xE6, 0xDA }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Paper Mario (E) (M4) [!]", { 0xA9, 0xBE, 0x6A, 0x49, 0x3A, 0x68, 0x06, 0x42, 0xD8, 0x40, 0xF8, 0x59, 0xA6, 0x58, 0x16, 0xCA }, NULL, NULL, 0x19AB29AF, 0xC71BCD28, 2, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Paper Mario (U) [!]", { 0xA7, 0x22, 0xF8, 0x16, 0x1F, 0xF4, 0x89, 0x94, 0x31, 0x91, 0x33, 0x0B, 0xF8, 0x41, 0x64, 0x96 }, NULL, NULL, 0x65EEE53A, 0xED7D733C, 2, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Paper Mario (U) [T+Chi]", { 0x85, 0x95, 0xBA, 0x0A, 0x0D, 0x2E, 0xA7, 0x39, 0x44, 0x22, 0x8B, 0xDE, 0xD4, 0xA9, 0x69, 0xAD }, NULL, NULL, 0x85F5A08A, 0xEAC7053E, 2, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Paperboy (E) [!]", { 0xB7, 0xF2, 0xEB, 0x79, 0x89, 0xC9, 0xC0, 0x00, 0x96, 0x65, 0x5D, 0x08, 0x7D, 0x72, 0xEC, 0x51 }, NULL, NULL, 0xAC976B38, 0xC3A9C97A, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Paperboy (U) [!]", { 0xC4, 0xCB, 0xCB, 0x54, 0xB0, 0x10, 0xA5, 0xA7, 0x1F, 0xE5, 0xCA, 0xA3, 0x91, 0xE5, 0xC2, 0x5F }, NULL, NULL, 0x3E198D9E, 0xF2E1267E, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Paperboy (U) [f1] (PAL)", { 0x12, 0x82, 0x7E, 0x2E, 0xF6, 0xEB, 0x1F, 0xF0, 0xF8, 0xAA, 0x49, 0x4E, 0x67, 0x1C, 0x30, 0x94 }, NULL, NULL, 0x8952E61E, 0xAA89984C, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Paperboy (U) [hI]", { 0x5D, 0xF3, 0xD2, 0x12, 0x23, 0xF0, 0xDA, 0xFD, 0x04, 0x17, 0x99, 0x8E, 0x9C, 0x1E, 0x70, 0x65 }, NULL, NULL, 0x89529B12, 0x0853ED3B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Paperboy (U) [hI][f1] (PAL)", { 0x04, 0x51, 0x76, 0x85, 0x53, 0xAB, 0x8C, 0xDD, 0x6C, 0x9C, 0xA3, 0x75, 0x14, 0xE6, 0xC3, 0x39 }, NULL, NULL, 0x8F00E51E, 0x030C92C8, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Paperboy (U) [hI][t1]", { 0x1F, 0x72, 0xE5, 0x06, 0x25, 0x0B, 0x16, 0x72, 0x6E, 0x2C, 0x5A, 0x62, 0x9C, 0xAE, 0x8E, 0x0F }, NULL, NULL, 0x8632071E, 0x637E1042, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Paperboy (U) [t1]", { 0xDF, 0x2A, 0x6A, 0x24, 0x46, 0xE8, 0xE0, 0x13, 0x75, 0xAD, 0xE8, 0x72, 0xA8, 0xF9, 0x33, 0x66 }, NULL, NULL, 0x8632071E, 0x637E1042, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Parlor! Pro 64 - Pachinko Jikki Simulation Game (J) [!]", { 0xD7, 0x8E, 0x10, 0xC6, 0xB3, 0xE9, 0x8F, 0x3B, 0x32, 0xFE, 0x0F, 0x23, 0xED, 0x72, 0xDB, 0x42 }, NULL, NULL, 0xCFE2CB31, 0x4D6B1E1D, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Pause Demo by RedboX (PD)", { 0x6D, 0xF5, 0x73, 0xEE, 0x08, 0xC4, 0x57, 0x7B, 0xBB, 0xF1, 0x17, 0xB8, 0x13, 0xD9, 0x3B, 0x19 }, NULL, NULL, 0x7D1727F1, 0x6C6B83EB, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Penny Racers (E) [!]", { 0x20, 0xDA, 0x62, 0xEC, 0xE5, 0x53, 0xED, 0xE8, 0x4D, 0x02, 0x28, 0x31, 0x74, 0xBE, 0xCC, 0x8F }, NULL, NULL, 0xC83CEB83, 0xFDC56219, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "Penny Racers (E) [h1C]", { 0xB6, 0xDF, 0x5A, 0x75, 0xCE, 0xD5, 0x4D, 0xFE, 0xE0, 0xE2, 0x9B, 0xCE, 0x9A, 0xBD, 0x0A, 0xAF }, NULL, NULL, 0xC83CEB83, 0xFDC56219, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "Penny Racers (E) [h2C]", { 0x6A, 0xE9, 0x7E, 0xC4, 0x93, 0x3A, 0x13, 0xC1, 0x53, 0xA2, 0x81, 0xDC, 0x8B, 0x68, 0xA0, 0xD9 }, NULL, NULL, 0xC83CEB83, 0xFDC56219, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "Penny Racers (U) [!]", { 0x51, 0x8B, 0x14, 0x05, 0x4A, 0x66, 0x7A, 0x3B, 0x9E, 0x0B, 0x72, 0xD3, 0xBF, 0x78, 0x4E, 0x41 }, NULL, NULL, 0x73ABB1FB, 0x9CCA6093, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "Penny Racers (U) [hI]", { 0x26, 0xF0, 0x33, 0xC7, 0x71, 0x6A, 0x10, 0x75, 0x5A, 0x3D, 0x22, 0xC6, 0x2A, 0xCF, 0x68, 0x51 }, NULL, NULL, 0xAB5E61C8, 0xA2FA7596, 3, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41F },
+    { "Perfect Dark (E) (M5) [!]", { 0xD9, 0xB5, 0xCD, 0x30, 0x5D, 0x22, 0x84, 0x24, 0x89, 0x1C, 0xE3, 0x8E, 0x71, 0xBC, 0x92, 0x13 }, NULL, NULL, 0xE4B08007, 0xA602FF33, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x63B },
+    { "Perfect Dark (E) (M5) [b1]", { 0x9E, 0x6D, 0x80, 0x93, 0x3B, 0x63, 0xB1, 0x83, 0xCC, 0xBD, 0x8B, 0x5F, 0x65, 0x43, 0xDC, 0xAD }, NULL, NULL, 0xE4B08007, 0xA602FF33, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x63B },
+    { "Perfect Dark (E) (Debug) (2000-04-26) [!]", { 0xAD, 0x2D, 0xE2, 0x10, 0xA3, 0x45, 0x5B, 0xA5, 0xEC, 0x54, 0x1F, 0x0C, 0x78, 0xD9, 0x14, 0x44 }, NULL, NULL, 0xF9864452, 0x890A5EA3, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x63B },
+    { "Perfect Dark (J) [!]", { 0x53, 0x8D, 0x2B, 0x75, 0x94, 0x5E, 0xAE, 0x06, 0x9B, 0x29, 0xC4, 0x61, 0x93, 0xE7, 0x47, 0x90 }, NULL, NULL, 0x96747EB4, 0x104BB243, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x63B },
+    { "Perfect Dark (U) (V1.0) [!]", { 0x7F, 0x41, 0x71, 0xB0, 0xC8, 0xD1, 0x78, 0x15, 0xBE, 0x37, 0x91, 0x3F, 0x53, 0x5E, 0x4E, 0x93 }, NULL, NULL, 0xDDF460CC, 0x3CA634C0, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x63B },
+    { "Perfect Dark (U) (V1.0) [f1] (PAL)", { 0xBF, 0x16, 0x75, 0x23, 0xE0, 0x79, 0xC5, 0x7D, 0xCC, 0xA8, 0x80, 0xA6, 0xF3, 0x88, 0x89, 0xF2 }, NULL, NULL, 0x65264217, 0x7FB64F7F, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x63B },
+    { "Perfect Dark (U) (V1.1) [!]", { 0xE0, 0x3B, 0x08, 0x8B, 0x6A, 0xC9, 0xE0, 0x08, 0x04, 0x40, 0xEF, 0xED, 0x07, 0xC1, 0xE4, 0x0F }, NULL, NULL, 0x41F2B98F, 0xB458B466, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x63B },
+    { "Perfect Dark (U) (Debug) (2000-03-22) [!]", { 0xAA, 0x93, 0xF4, 0xDF, 0x16, 0xFC, 0xEA, 0xDA, 0x39, 0x9A, 0x74, 0x9F, 0x5A, 0xD2, 0xF2, 0x73 }, NULL, NULL, 0x2CE75AEF, 0xE16825BC, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x63B },
+    { "Perfect Dark Plus", { 0x5D, 0x72, 0x15, 0x5E, 0x00, 0xBF, 0x2C, 0xAB, 0x41, 0xB0, 0xF4, 0xA2, 0xF2, 0xE0, 0x9C, 0x61 }, NULL, NULL, 0xFB453D58, 0xAD565422, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x63B },
+    { "Pikachu Genki Dechu (J) [!]", { 0xE0, 0xBC, 0xB2, 0x75, 0x8E, 0xDF, 0x0A, 0xC6, 0xAB, 0x7D, 0xB3, 0x6D, 0x98, 0xE1, 0xE5, 0x7C }, NULL, NULL, 0x3F245305, 0xFC0B74AA, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 88, 0x203B },
+    { "Pikachu Genki Dechu (J) [b1]", { 0xD0, 0xAE, 0x6C, 0x07, 0xAC, 0x04, 0x81, 0xEB, 0xA5, 0xFF, 0x9C, 0xE7, 0x98, 0xA6, 0x95, 0x74 }, NULL, NULL, 0x3F245305, 0xFC0B74AA, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 88, 0x203B },
+    { "Pilotwings 64 (E) (M3) [!]", { 0x3F, 0xCD, 0x49, 0x69, 0xF9, 0xA0, 0x80, 0xBD, 0x2B, 0xCB, 0x91, 0x3E, 0xC5, 0xD7, 0xA3, 0xBD }, NULL, NULL, 0x1AA05AD5, 0x46F52D80, 0, SAVETYPE_EEPROM_4K, 1, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pilotwings 64 (E) (M3) [b1]", { 0xF2, 0x1E, 0x2A, 0x3A, 0x05, 0xAC, 0xF4, 0x95, 0x86, 0xF3, 0x2D, 0xCE, 0x5C, 0x44, 0x9F, 0xE4 }, NULL, NULL, 0x1AA05AD5, 0x46F52D80, 0, SAVETYPE_EEPROM_4K, 1, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pilotwings 64 (E) (M3) [b2]", { 0x98, 0x76, 0x82, 0xCC, 0x63, 0x77, 0x72, 0x21, 0xB9, 0x38, 0xCC, 0x46, 0x56, 0x07, 0xBD, 0x8C }, NULL, NULL, 0x1AA05AD5, 0x46F52D80, 0, SAVETYPE_EEPROM_4K, 1, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pilotwings 64 (E) (M3) [h1C]", { 0x99, 0xFD, 0x0E, 0x1C, 0xBA, 0x30, 0xC1, 0x8C, 0x86, 0x9F, 0x2D, 0xE9, 0x86, 0x78, 0xCD, 0x16 }, NULL, NULL, 0x1AA05AD5, 0x46F52D80, 0, SAVETYPE_EEPROM_4K, 1, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pilotwings 64 (J) [!]", { 0xE8, 0xE6, 0xEC, 0x06, 0x92, 0x00, 0x90, 0x09, 0xF5, 0xDC, 0xA6, 0x82, 0x7B, 0x21, 0xF5, 0x9A }, NULL, NULL, 0x09CC4801, 0xE42EE491, 0, SAVETYPE_EEPROM_4K, 1, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pilotwings 64 (J) [b1]", { 0x27, 0x40, 0xF1, 0xB8, 0x9C, 0xE7, 0xD7, 0x8A, 0x5D, 0x31, 0xCF, 0x60, 0xC9, 0x7A, 0x0C, 0x11 }, NULL, NULL, 0x09CC4801, 0xE42EE491, 0, SAVETYPE_EEPROM_4K, 1, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pilotwings 64 (U) [!]", { 0x8B, 0x34, 0x61, 0x82, 0x73, 0x0C, 0xEA, 0xFF, 0xE5, 0xE2, 0xCC, 0xF6, 0xD2, 0x23, 0xC5, 0xEF }, NULL, NULL, 0xC851961C, 0x78FCAAFA, 0, SAVETYPE_EEPROM_4K, 1, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pilotwings 64 (U) [h1C]", { 0xE2, 0x8F, 0x8F, 0x19, 0xE5, 0x6C, 0xC6, 0xC7, 0xA0, 0xF3, 0xA3, 0x28, 0x6A, 0xEB, 0x60, 0xC1 }, NULL, NULL, 0xC851961C, 0x78FCAAFA, 0, SAVETYPE_EEPROM_4K, 1, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pilotwings 64 (U) [t1]", { 0xF6, 0x9D, 0xE1, 0x58, 0xBC, 0x76, 0x41, 0x6B, 0x4C, 0x6C, 0x47, 0x04, 0xB1, 0x5B, 0x6E, 0xB0 }, NULL, NULL, 0x70478A35, 0xF9897402, 0, SAVETYPE_EEPROM_4K, 1, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pip's Pong by Mr. Pips (PD) [b1]", { 0xBE, 0x9E, 0x0C, 0x9D, 0x50, 0x9A, 0xAB, 0x0C, 0x72, 0xF7, 0x78, 0x8D, 0x6B, 0xE3, 0xB4, 0x43 }, NULL, NULL, 0xD072CFE7, 0xCE134788, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's Pong by Mr. Pips (PD)", { 0xE8, 0x21, 0xB5, 0x40, 0xA9, 0x1B, 0x7B, 0xF0, 0x88, 0xE5, 0x2A, 0xBC, 0x02, 0xA5, 0xCC, 0x9A }, NULL, NULL, 0xD072CFE7, 0xCE134788, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's Porn Pack 1 by Mr. Pips (PD)", { 0x63, 0xCB, 0xAB, 0xEF, 0x90, 0x69, 0xFE, 0x33, 0x75, 0xA7, 0x72, 0x6C, 0x89, 0xE9, 0xE2, 0x5D }, NULL, NULL, 0xD851B920, 0xF3D6C0CE, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's Porn Pack 2 by Mr. Pips (POM '99) (PD)", { 0x3D, 0xF1, 0x64, 0x6C, 0xC2, 0x8C, 0x04, 0x13, 0x3B, 0x3C, 0xB5, 0xEB, 0x14, 0x3A, 0xE0, 0x16 }, NULL, NULL, 0xBF9D0FB0, 0x981C22D1, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's Porn Pack 3 by Mr. Pips (PD)", { 0x54, 0x7C, 0xF2, 0x03, 0x08, 0xF2, 0xCE, 0x2C, 0xE5, 0xB5, 0x31, 0x0A, 0x5E, 0x55, 0x51, 0x13 }, NULL, NULL, 0xEA2A6A75, 0x52B2C00F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's RPGs Beta 12 by Mr. Pips (PD)", { 0x5D, 0x14, 0x4D, 0x32, 0x37, 0x85, 0x81, 0x8A, 0x9B, 0xD5, 0xC6, 0x67, 0xA5, 0x56, 0x7B, 0xBD }, NULL, NULL, 0x3CB8AAB8, 0x05C8E573, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's RPGs Beta 14 by Mr. Pips (PD)", { 0xEF, 0xBC, 0xB6, 0x57, 0xA3, 0xB0, 0x5B, 0x5C, 0xB0, 0x80, 0xFD, 0x62, 0x8B, 0x85, 0x2B, 0xD0 }, NULL, NULL, 0x56563C89, 0xC803F77B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's RPGs Beta 15 by Mr. Pips (PD)", { 0xC6, 0xFA, 0xAC, 0x42, 0x04, 0x5B, 0xE1, 0xAF, 0x76, 0x9E, 0xC5, 0x2C, 0xEA, 0x6D, 0xED, 0x52 }, NULL, NULL, 0xAFBBB9D5, 0x8EE82954, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's RPGs Beta 2 by Mr. Pips (PD)", { 0x10, 0xA2, 0x8D, 0xF3, 0x2D, 0x06, 0xB7, 0xD3, 0xD9, 0xB1, 0x40, 0x91, 0xAC, 0x9D, 0x2E, 0x14 }, NULL, NULL, 0xDAD7F751, 0x8B6322F0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's RPGs Beta 3 by Mr. Pips (PD)", { 0x64, 0x02, 0x49, 0x8E, 0x89, 0x14, 0x55, 0xFF, 0xB8, 0x6C, 0x95, 0xAD, 0x8A, 0xBB, 0x87, 0xF6 }, NULL, NULL, 0xC830954A, 0x29E257FC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's RPGs Beta 6 by Mr. Pips (PD)", { 0x10, 0xE6, 0x29, 0x52, 0x24, 0x48, 0x34, 0xE0, 0xB5, 0x2A, 0xF3, 0x28, 0x98, 0xDE, 0x8D, 0x9F }, NULL, NULL, 0x7194B65B, 0x9DE67E7D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's RPGs Beta 7 by Mr. Pips (PD)", { 0x35, 0xFA, 0xB2, 0xCC, 0x64, 0xE0, 0xE8, 0x08, 0xEB, 0x62, 0x9A, 0x25, 0x54, 0x2C, 0x73, 0x26 }, NULL, NULL, 0xDB363DDA, 0x50C1C2A5, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's RPGs Beta x (PD) [a1]", { 0x9E, 0x35, 0xB5, 0x56, 0x06, 0xBD, 0xF4, 0xC7, 0x7A, 0x1E, 0x81, 0x7C, 0xE5, 0x03, 0xA9, 0x51 }, NULL, NULL, 0x668FA336, 0x2C67F3AC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's RPGs Beta x (PD)", { 0xF8, 0xD6, 0xC5, 0xAB, 0xA6, 0x2F, 0xC3, 0x02, 0xC2, 0x84, 0x8C, 0x53, 0x10, 0x4E, 0x26, 0x83 }, NULL, NULL, 0xBB787C13, 0x78C1605D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's Tic Tak Toe by Mark Pips (PD)", { 0x45, 0xCD, 0xCB, 0xCB, 0x71, 0x59, 0xEB, 0xAE, 0x1E, 0xD4, 0xD7, 0xAA, 0xE7, 0x07, 0x49, 0xE0 }, NULL, NULL, 0x6459533B, 0x7E22B56C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's World Game 1 by Mr. Pips (PD) [b1]", { 0x99, 0xD7, 0x11, 0xAB, 0x6D, 0xFD, 0x36, 0x12, 0x1E, 0x5C, 0x23, 0xC1, 0xDB, 0xA7, 0x8C, 0x01 }, NULL, NULL, 0x762C75D1, 0xAA09C759, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's World Game 1 by Mr. Pips (PD)", { 0x4D, 0x28, 0xDD, 0xB5, 0xB9, 0x3E, 0xA3, 0x02, 0xEE, 0x9F, 0x27, 0x80, 0x5D, 0xE1, 0xB4, 0x6F }, NULL, NULL, 0x762C75D1, 0xAA09C759, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's World Game 2 by Mr. Pips (PD) [b1]", { 0xBB, 0xF5, 0x06, 0x0E, 0x64, 0xBD, 0x02, 0x01, 0x95, 0x4E, 0x65, 0xBD, 0x28, 0x1E, 0xC4, 0x86 }, NULL, NULL, 0xFC051819, 0xA46A48F6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pip's World Game 2 by Mr. Pips (PD)", { 0x93, 0x58, 0xAA, 0x90, 0x88, 0x7F, 0xC3, 0x1C, 0x45, 0xBC, 0x2B, 0x84, 0x9C, 0x37, 0xD6, 0xA0 }, NULL, NULL, 0xFC051819, 0xA46A48F6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pipendo by Mr. Pips (PD)", { 0x9C, 0x1B, 0x75, 0x0A, 0x2F, 0x9D, 0xFC, 0x53, 0x36, 0x1F, 0x72, 0xF4, 0xBF, 0xB6, 0x47, 0xA7 }, NULL, NULL, 0x45627CED, 0x28005F9C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Planet Console Intro (PD)", { 0x1D, 0x7C, 0xFC, 0x7C, 0xDB, 0x5A, 0x0E, 0x1B, 0x69, 0xB1, 0xDC, 0x2E, 0x58, 0xA4, 0xF1, 0x92 }, NULL, NULL, 0x1077590A, 0xB537FDA2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Plasma Demo (PD) [a1]", { 0x83, 0xB7, 0x58, 0x00, 0x69, 0x0A, 0xF2, 0x78, 0x00, 0xDF, 0x36, 0x26, 0x97, 0xE5, 0x20, 0x5E }, NULL, NULL, 0x7D1727F1, 0x6C6B83EB, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Plasma Demo (PD)", { 0xE2, 0x7C, 0x00, 0xC2, 0x11, 0x4A, 0x56, 0xD1, 0x8D, 0xD2, 0x7B, 0x42, 0x61, 0x93, 0xB7, 0x9C }, NULL, NULL, 0xE9F52336, 0x6BEFAA5F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pocket Monsters Snap (J) [!]", { 0xFB, 0xDD, 0x74, 0xED, 0x68, 0xE6, 0xA0, 0xCD, 0x73, 0x45, 0x62, 0xD5, 0x6C, 0xCB, 0x75, 0x2D }, NULL, NULL, 0xEC0F690D, 0x32A7438C, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pocket Monsters Snap (J) (VC) [!]", { 0x33, 0xFD, 0xAB, 0x97, 0x12, 0xD9, 0xFE, 0xA7, 0x93, 0xA3, 0xAE, 0x44, 0x29, 0x39, 0x99, 0xC3 }, NULL, NULL, 0xE0044E9E, 0xCD659D0D, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pocket Monsters Snap (J) [b1]", { 0x42, 0xCC, 0x0F, 0xE1, 0x44, 0x2B, 0x0A, 0x49, 0x8D, 0xFD, 0x8F, 0x74, 0x31, 0x79, 0xC5, 0x1A }, NULL, NULL, 0xBB2D10F8, 0xB8ED4D23, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pocket Monsters Snap (J) [f1]", { 0x76, 0xAE, 0x2B, 0x6F, 0x38, 0xE6, 0x11, 0x68, 0x3A, 0xCA, 0x3B, 0x87, 0xD1, 0xB3, 0xD5, 0xCE }, NULL, NULL, 0xBB2D10F8, 0xB8ED4D23, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pocket Monsters Snap (J) [f2] (GameShark)", { 0xCC, 0xA8, 0xD3, 0x87, 0x49, 0x96, 0xA7, 0x8C, 0x3B, 0x58, 0x28, 0xE7, 0xA6, 0x6A, 0xC9, 0x16 }, NULL, NULL, 0x412D7090, 0xCEDABAC3, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pocket Monsters Stadium (J) [!]", { 0xC4, 0x6E, 0x08, 0x7D, 0x96, 0x6A, 0x35, 0x09, 0x5D, 0xF9, 0x67, 0x99, 0xB0, 0xB4, 0xFF, 0xAE }, NULL, NULL, 0x665E8259, 0xD098BD1D, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pocket Monsters Stadium (J) [b1]", { 0xB4, 0x3B, 0x3C, 0x7A, 0x3D, 0x21, 0x49, 0xFE, 0xED, 0xC8, 0xBA, 0x3B, 0x81, 0x98, 0xBE, 0x5D }, NULL, NULL, 0x665E8259, 0xD098BD1D, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pocket Monsters Stadium (J) [b2]", { 0xD0, 0x69, 0x81, 0x35, 0xC4, 0xA7, 0x4C, 0xDE, 0xA8, 0x37, 0x4D, 0xA0, 0xBD, 0x15, 0xDF, 0xDB }, NULL, NULL, 0x58FBD28F, 0xFEB595F0, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pocket Monsters Stadium (J) [f1] (Boot-PAL)", { 0x1A, 0x5D, 0x6F, 0xBF, 0x59, 0xD1, 0x63, 0x9A, 0xF7, 0x1B, 0x61, 0x41, 0x05, 0x53, 0xAB, 0x04 }, NULL, NULL, 0x58FBD28F, 0xFEB595F0, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pocket Monsters Stadium (J) [f2] (Boot)", { 0x9B, 0xBC, 0x39, 0x45, 0xF5, 0x26, 0xC8, 0x32, 0x97, 0x10, 0x82, 0x4C, 0x29, 0xFF, 0xC0, 0x40 }, NULL, NULL, 0x76AF28D8, 0x64A07F55, 0, SAVETYPE_SRAM, 2, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pocket Monsters Stadium 2 (J) [!]", { 0x24, 0x49, 0xBB, 0x71, 0x2A, 0x64, 0xE3, 0x36, 0x3A, 0x6C, 0xBD, 0x56, 0xF5, 0xAD, 0xED, 0xA5 }, NULL, NULL, 0x63775886, 0x5FB80E7B, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pocket Monsters Stadium 2 (J) [f1]", { 0x90, 0x74, 0x03, 0xB1, 0x2D, 0x2A, 0xD5, 0x9A, 0x0F, 0x18, 0x6A, 0x16, 0x32, 0xAE, 0x39, 0xB9 }, NULL, NULL, 0xFE667A12, 0x0D2195AD, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pocket Monsters Stadium 2 (J) [f2]", { 0x3F, 0x39, 0xC0, 0x14, 0x55, 0xB5, 0x85, 0xCA, 0xEB, 0x2D, 0xF8, 0xA0, 0x97, 0x65, 0xD0, 0xB3 }, NULL, NULL, 0xFE667A12, 0x0D2195AD, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pocket Monsters Stadium 2 (J) [f3]", { 0xDC, 0x8F, 0x45, 0xA2, 0x00, 0xFE, 0xD1, 0x5C, 0x3B, 0x0B, 0xD9, 0x7A, 0x2F, 0x52, 0xAC, 0xA5 }, NULL, NULL, 0x058381EF, 0x6A36FEC6, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pocket Monsters Stadium 2 (J) [f4]", { 0xE5, 0xD7, 0xB5, 0x6B, 0x5E, 0xDB, 0xD8, 0x57, 0x5E, 0xCE, 0xB9, 0xE5, 0xEC, 0xCF, 0x4A, 0x00 }, NULL, NULL, 0xFE667A12, 0x0D2195AD, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pocket Monsters Stadium Kin Gin (J) [!]", { 0xA1, 0x7A, 0xAD, 0xCC, 0x96, 0x23, 0x93, 0xD4, 0x76, 0xED, 0xC3, 0x21, 0xE5, 0x9C, 0x50, 0x4B }, NULL, NULL, 0xEE4FD7C2, 0x9CF1D938, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Puzzle League (E) [!]", { 0x2E, 0xF9, 0xFA, 0x16, 0xDE, 0x2A, 0x09, 0xEA, 0x15, 0xB6, 0x28, 0x94, 0x47, 0xF4, 0x04, 0x90 }, NULL, NULL, 0x4A1CD153, 0xD830AEF8, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Pokemon Puzzle League (E) (VC) [!]", { 0xFB, 0xF5, 0x66, 0x69, 0x3B, 0xCA, 0x31, 0x45, 0xD8, 0x6D, 0xF3, 0x4D, 0x18, 0xDC, 0xDD, 0x43 }, NULL, NULL, 0x4A1CD153, 0xD830AEF8, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Pokemon Puzzle League (F) [!]", { 0xA3, 0xBA, 0x04, 0x4D, 0xFC, 0x00, 0xBB, 0x76, 0x6B, 0x4B, 0x2B, 0xFB, 0x9D, 0x4B, 0x5B, 0xE9 }, NULL, NULL, 0x3EB2E6F3, 0x062F9EFE, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Pokemon Puzzle League (F) (VC) [!]", { 0x86, 0x6D, 0x40, 0x1C, 0x51, 0xCC, 0x05, 0xA3, 0x18, 0x8C, 0x9A, 0x2D, 0x4E, 0x7B, 0xFE, 0xE5 }, NULL, NULL, 0x3EB2E6F3, 0x062F9EFE, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Pokemon Puzzle League (G) [!]", { 0x00, 0x03, 0x64, 0xBA, 0xC8, 0x0E, 0x41, 0xD9, 0x06, 0x0A, 0x31, 0xA5, 0x92, 0x38, 0x74, 0xB7 }, NULL, NULL, 0x7A4747AC, 0x44EEEC23, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Pokemon Puzzle League (G) (VC) [!]", { 0x45, 0xB5, 0x07, 0xAA, 0xAF, 0x0C, 0xCD, 0xB6, 0xEF, 0xE3, 0xCD, 0x71, 0x7F, 0x0D, 0xDB, 0x95 }, NULL, NULL, 0x7A4747AC, 0x44EEEC23, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Pokemon Puzzle League (U) [!]", { 0xE7, 0x22, 0x57, 0x6A, 0x15, 0x18, 0x2C, 0xFE, 0xD6, 0x78, 0x23, 0x79, 0xCE, 0x4B, 0xC8, 0xBE }, NULL, NULL, 0x19C553A7, 0xA70F4B52, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Pokemon Puzzle League (U) (VC) [!]", { 0xD6, 0xF5, 0x8B, 0x98, 0x11, 0x5E, 0x78, 0xD8, 0x41, 0x08, 0x90, 0x74, 0x40, 0x1A, 0xE5, 0x24 }, NULL, NULL, 0x19C553A7, 0xA70F4B52, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Pokemon Puzzle League (U) [t1]", { 0xDC, 0x09, 0xE2, 0x68, 0x5E, 0xB9, 0x54, 0x71, 0x31, 0x1E, 0x57, 0xB3, 0x60, 0x5F, 0x48, 0x94 }, NULL, NULL, 0xE1AAA925, 0x27C9C94B, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Pokemon Puzzle League (U) [t2]", { 0xD5, 0xED, 0xC7, 0xB8, 0x84, 0xDF, 0xBA, 0x7C, 0xF4, 0xAC, 0x4C, 0xDF, 0xA8, 0xAC, 0x64, 0xA4 }, NULL, NULL, 0xAAE125A9, 0xC9274BC9, 0, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Pokemon Snap (A) [!]", { 0xE5, 0xA0, 0xCA, 0x3D, 0xC5, 0x4B, 0x38, 0xEA, 0x7F, 0xCD, 0x92, 0x7E, 0x3C, 0xFF, 0xAD, 0x3B }, NULL, NULL, 0x7BB18D40, 0x83138559, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap (A) [f1] (GameShark)", { 0xA8, 0x8F, 0xCF, 0x3F, 0xF0, 0x0F, 0x21, 0xD3, 0xCE, 0xC4, 0x4D, 0x2E, 0x0F, 0xAA, 0xAA, 0xD8 }, NULL, NULL, 0xF795ACE1, 0x8DEDE03C, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap (E) [!]", { 0xF2, 0xA8, 0x10, 0x64, 0x03, 0xD2, 0xBF, 0x93, 0x50, 0xBF, 0xEA, 0xB0, 0x86, 0x89, 0xD5, 0x4A }, NULL, NULL, 0x4FF5976F, 0xACF559D8, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap (F) [!]", { 0xE9, 0x02, 0x8F, 0x9C, 0xCC, 0x30, 0x78, 0x06, 0x69, 0x5D, 0xD8, 0x17, 0x42, 0xD0, 0x5D, 0x5D }, NULL, NULL, 0xBA6C293A, 0x9FAFA338, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap (F) [b1]", { 0x5F, 0xA7, 0x0A, 0x63, 0xE3, 0x52, 0xEA, 0x80, 0x46, 0x07, 0x99, 0x96, 0x74, 0x38, 0x17, 0x49 }, NULL, NULL, 0xBA6C293A, 0x9FAFA338, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap (G) [!]", { 0x14, 0x4B, 0x89, 0x06, 0xDC, 0x40, 0x53, 0x4C, 0xFB, 0xEF, 0x6D, 0x7B, 0x99, 0x4A, 0x98, 0x2B }, NULL, NULL, 0x5753720D, 0x2A8A884D, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap (I) [!]", { 0x8E, 0x19, 0x68, 0x19, 0x1D, 0xD2, 0x76, 0x55, 0xC0, 0x3B, 0xE8, 0x12, 0xCF, 0x04, 0x1A, 0x95 }, NULL, NULL, 0xC0C85046, 0x61051B05, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap (I) [b1]", { 0xD0, 0x45, 0x34, 0x59, 0x09, 0x5F, 0x69, 0xBE, 0x36, 0xD6, 0x75, 0xD8, 0xF7, 0x43, 0x06, 0x9B }, NULL, NULL, 0xC0C85046, 0x61051B05, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap (S) [!]", { 0xA4, 0x5D, 0x71, 0x15, 0xBE, 0x5A, 0x06, 0xFD, 0x15, 0x67, 0xF9, 0xF9, 0x13, 0xC3, 0xBD, 0xF8 }, NULL, NULL, 0x817D286A, 0xEF417416, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap (U) [!]", { 0xFC, 0x3C, 0x93, 0x29, 0xB7, 0xCD, 0xD6, 0x7C, 0xF7, 0x65, 0x0A, 0xBF, 0x63, 0xB9, 0xA5, 0x80 }, NULL, NULL, 0xCA12B547, 0x71FA4EE4, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap (U) [T+Spa]", { 0xCC, 0xA6, 0xF7, 0x59, 0x33, 0x02, 0xD4, 0x6A, 0xDA, 0x66, 0xC9, 0x91, 0xC9, 0x76, 0xDA, 0x2D }, NULL, NULL, 0xCA12B547, 0x71FA4EE4, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap (U) [f1] (Save)", { 0xE3, 0xD4, 0xF7, 0x5C, 0x24, 0xDA, 0x05, 0x21, 0x48, 0x8E, 0x70, 0x48, 0x12, 0x25, 0x9A, 0x46 }, NULL, NULL, 0x3FF65EDD, 0x0F8158B0, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap (U) [f2] (Save-PAL)", { 0x37, 0x3F, 0xBB, 0xF4, 0xB9, 0x09, 0xE7, 0xC8, 0xA3, 0xAA, 0xB3, 0xDD, 0x80, 0xDE, 0xBD, 0x11 }, NULL, NULL, 0x38186DAF, 0x232AE3D8, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap (U) [f3] (GameShark)", { 0xBC, 0xB2, 0x10, 0xA6, 0xA3, 0xDC, 0xA9, 0xA6, 0x53, 0xF8, 0x36, 0xE2, 0x95, 0x7B, 0xD6, 0xDC }, NULL, NULL, 0x03529CD9, 0x186BDDCD, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap (U) [f3]", { 0x53, 0xA5, 0xD7, 0x4F, 0xA5, 0x5E, 0x37, 0x8A, 0xDA, 0x84, 0xAF, 0x9B, 0x0E, 0xD2, 0xB7, 0x28 }, NULL, NULL, 0x3FF65EDD, 0x0F8158B0, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap Station (U) [!]", { 0xA9, 0xC2, 0x72, 0x68, 0x7D, 0xAB, 0xD5, 0x9C, 0x51, 0x44, 0x77, 0x4B, 0x53, 0xBC, 0xC3, 0x5A }, NULL, NULL, 0x39119872, 0x07722E9F, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Snap Station (U) [f1]", { 0xB8, 0x8F, 0x0E, 0xC1, 0x25, 0xC5, 0x46, 0x85, 0xFA, 0x51, 0x6D, 0x23, 0x3B, 0x56, 0x48, 0x42 }, NULL, NULL, 0x4B34DF0B, 0x5899C0FE, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Pokemon Stadium (E) (V1.0) [!]", { 0x28, 0x59, 0x09, 0x0D, 0x78, 0x58, 0x1E, 0x09, 0x25, 0xA3, 0xAF, 0x80, 0x45, 0xE8, 0x1E, 0x4B }, NULL, NULL, 0x84077275, 0x57315B9C, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (E) (V1.0) [f1]", { 0x9C, 0xC9, 0x40, 0xF5, 0xF4, 0x63, 0x41, 0x6F, 0x0B, 0x2C, 0x15, 0xF0, 0x7A, 0x08, 0x8F, 0x33 }, NULL, NULL, 0x9DFE20E9, 0x18894032, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (E) (V1.1) [!]", { 0x31, 0xEE, 0x2D, 0xE8, 0xE6, 0x5E, 0x30, 0xF5, 0x93, 0x4C, 0x45, 0x0D, 0xBA, 0xA9, 0x24, 0xF0 }, NULL, NULL, 0x91C9E05D, 0xAD3AAFB9, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (F) [!]", { 0x0E, 0x85, 0xA0, 0x98, 0xD0, 0xF0, 0xE8, 0xA7, 0xEB, 0x57, 0x2A, 0x69, 0x61, 0x2A, 0x68, 0x73 }, NULL, NULL, 0xA23553A3, 0x42BF2D39, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (F) [f1]", { 0x46, 0x88, 0xC6, 0x6F, 0x8C, 0x13, 0xED, 0xA1, 0x3D, 0xD5, 0x67, 0x81, 0x76, 0xA7, 0xFD, 0x8A }, NULL, NULL, 0x7E3D8157, 0xD9BF4D91, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (G) [!]", { 0x24, 0xBE, 0x2C, 0xCB, 0x0D, 0xEA, 0x07, 0x55, 0x90, 0x8C, 0x02, 0xBF, 0x67, 0xE2, 0x2F, 0xE5 }, NULL, NULL, 0x42011E1B, 0xE3552DB5, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (G) [f1]", { 0x8F, 0xAA, 0x82, 0x55, 0x07, 0xE6, 0xCD, 0x3F, 0x38, 0x8C, 0xC3, 0x33, 0x43, 0xFA, 0xE5, 0x47 }, NULL, NULL, 0xD7F73553, 0x1347659F, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (I) [!]", { 0xA8, 0x13, 0x21, 0x75, 0x9A, 0xF3, 0x8B, 0xEB, 0x30, 0xA4, 0x0F, 0xDA, 0xCA, 0x2E, 0xA2, 0x2A }, NULL, NULL, 0xA53FA82D, 0xDAE2C15D, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (S) [!]", { 0xD1, 0x4A, 0x49, 0x9B, 0xC4, 0xE3, 0x24, 0x97, 0x4E, 0xAE, 0x3E, 0x42, 0xDE, 0xC5, 0x86, 0x25 }, NULL, NULL, 0xB6E549CE, 0xDC8134C0, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (S) [f1]", { 0x8D, 0x29, 0x6A, 0x61, 0x4A, 0x47, 0xAC, 0x99, 0xB8, 0x0D, 0x1E, 0xDE, 0x66, 0x9E, 0x62, 0xB3 }, NULL, NULL, 0x4C115008, 0x9F124960, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (U) (V1.0) [!]", { 0xED, 0x13, 0x78, 0xBC, 0x12, 0x11, 0x5F, 0x71, 0x20, 0x9A, 0x77, 0x84, 0x49, 0x65, 0xBA, 0x50 }, NULL, NULL, 0x90F5D9B3, 0x9D0EDCF0, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (U) (V1.0) [f1]", { 0xC9, 0x21, 0x49, 0x88, 0xB0, 0x85, 0x11, 0xD2, 0xF4, 0x4F, 0xAC, 0x2F, 0xAD, 0x2E, 0xE6, 0x7A }, NULL, NULL, 0x84EBE70F, 0x352C5E3F, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (U) (V1.1) [!]", { 0x40, 0xE0, 0x3E, 0xDA, 0x83, 0x1C, 0x01, 0xE0, 0xA1, 0x22, 0x94, 0x28, 0x7F, 0xD2, 0x40, 0xE2 }, NULL, NULL, 0x1A122D43, 0xC17DAF0F, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (U) (V1.1) [b1]", { 0xA7, 0x08, 0x7A, 0x96, 0xA7, 0x09, 0xE4, 0xC6, 0x62, 0xA4, 0x59, 0xB4, 0xB4, 0x15, 0x90, 0x94 }, NULL, NULL, 0x1A122D43, 0xC17DAF0F, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (U) (V1.1) [b1][f1]", { 0xA0, 0x08, 0x7A, 0x47, 0x5A, 0x29, 0xF3, 0x8B, 0xD4, 0xCE, 0x5D, 0xF0, 0xA4, 0x1A, 0x89, 0xCB }, NULL, NULL, 0x3FC42B3E, 0xCED602E6, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium (U) (V1.2) [!]", { 0x6D, 0xC6, 0x82, 0x0C, 0xEF, 0x75, 0x5F, 0xC1, 0x25, 0x3D, 0x06, 0xDF, 0x45, 0xC9, 0xBD, 0x2A }, NULL, NULL, 0x9C8FB2FA, 0x9B84A09B, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium 2 (E) [!]", { 0xB1, 0x27, 0x1D, 0xB5, 0x0D, 0x6E, 0xF8, 0xF6, 0xB5, 0x3C, 0xC6, 0x40, 0xC3, 0x74, 0x3E, 0x4F }, NULL, NULL, 0x2952369C, 0xB6E4C3A8, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium 2 (E) [T+Ita0.05]", { 0xBB, 0x16, 0x23, 0xBD, 0x47, 0x51, 0x24, 0x01, 0x38, 0xDE, 0x55, 0xE1, 0x8D, 0x3A, 0xCA, 0x7E }, NULL, NULL, 0x2952369C, 0xB6E4C3A8, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium 2 (F) [!]", { 0x47, 0x48, 0xD9, 0x69, 0x16, 0xAE, 0x2B, 0xCC, 0x5F, 0xC1, 0x63, 0x05, 0x15, 0xEE, 0x25, 0x61 }, NULL, NULL, 0xAC5AA5C7, 0xA9B0CDC3, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium 2 (G) [!]", { 0x48, 0x4F, 0x3E, 0x69, 0x6C, 0x94, 0x98, 0x0A, 0xCF, 0x3D, 0x70, 0x68, 0xF9, 0xAC, 0xC9, 0x8F }, NULL, NULL, 0x439B7E7E, 0xC1A1495D, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium 2 (I) [!]", { 0x5A, 0x04, 0xD7, 0xF1, 0xAB, 0x9C, 0x6B, 0x08, 0x01, 0x76, 0x56, 0x7A, 0xA7, 0x16, 0x8D, 0x3A }, NULL, NULL, 0xEFCEAF00, 0x22094848, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium 2 (S) [!]", { 0xB2, 0x6A, 0xAF, 0xD4, 0x52, 0xC9, 0x81, 0x6E, 0x1B, 0x7A, 0xA0, 0x95, 0x4E, 0x75, 0x82, 0x5F }, NULL, NULL, 0xD0A1FC5B, 0x2FB8074B, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Pokemon Stadium 2 (U) [!]", { 0x15, 0x61, 0xC7, 0x5D, 0x11, 0xCE, 0xDF, 0x35, 0x6A, 0x8D, 0xDB, 0x1A, 0x4A, 0x5F, 0x9D, 0x5D }, NULL, NULL, 0x03571182, 0x892FD06D, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Polaris SnoCross (U) [!]", { 0xBB, 0xDC, 0x4C, 0x4F, 0x1C, 0x47, 0x42, 0x98, 0x18, 0x93, 0x12, 0x00, 0x8A, 0x17, 0x68, 0xC4 }, NULL, NULL, 0x41380792, 0xA167E045, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Polaris SnoCross (U) [o1][t1]", { 0xF2, 0x7C, 0xBD, 0xB6, 0x53, 0xAA, 0xF1, 0xD4, 0x85, 0x6A, 0x53, 0xD5, 0x95, 0x1F, 0x36, 0xDD }, NULL, NULL, 0xB8B73263, 0x1492FC49, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Polaris SnoCross (U) [t1]", { 0x35, 0xA0, 0x1A, 0xEB, 0x01, 0xF3, 0x18, 0x4D, 0xD2, 0x09, 0x04, 0xAF, 0x28, 0xFA, 0x71, 0xC6 }, NULL, NULL, 0xB8B73263, 0x1492FC49, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Pom Part 1 Demo (PD)", { 0x88, 0x47, 0xBD, 0x64, 0x03, 0xBA, 0x49, 0xFD, 0x62, 0x89, 0x91, 0x15, 0xD6, 0x61, 0xB6, 0x23 }, NULL, NULL, 0x1BC0CA2C, 0x0F516B86, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pom Part 2 Demo (PD)", { 0x03, 0x7D, 0x27, 0x27, 0xB9, 0x09, 0x98, 0xBE, 0xD4, 0x1D, 0xA0, 0xF2, 0x90, 0xBB, 0x84, 0x41 }, NULL, NULL, 0xACD51083, 0xEEC8DBED, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pom Part 3 Demo (PD)", { 0x54, 0x26, 0xEA, 0xED, 0x0D, 0x35, 0x03, 0x67, 0x39, 0x3F, 0x38, 0x50, 0x25, 0xAF, 0x16, 0x4C }, NULL, NULL, 0x1FE04890, 0xD6696958, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pom Part 4 Demo (PD)", { 0xC7, 0x92, 0x1F, 0x3D, 0x4B, 0x91, 0xA4, 0x24, 0x72, 0xDA, 0xDD, 0x4D, 0xBA, 0x2C, 0xDC, 0x54 }, NULL, NULL, 0xCFBEE39B, 0x76F0A14A, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pom Part 5 Demo (PD)", { 0xF6, 0x7C, 0x06, 0xAF, 0x4F, 0x66, 0x13, 0x80, 0x4B, 0x3F, 0x70, 0x0B, 0x11, 0x69, 0xB5, 0x8D }, NULL, NULL, 0x2803B8CE, 0x4A1EE409, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pong V0.01 by Omsk (PD)", { 0xBA, 0x97, 0x61, 0x64, 0xC2, 0xA9, 0x00, 0xC0, 0x3F, 0x44, 0x5A, 0xCD, 0x51, 0x51, 0x8F, 0xB0 }, NULL, NULL, 0xC252F9B1, 0xAD70338C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Pong by Oman (PD)", { 0x8E, 0xAC, 0xC9, 0x36, 0x71, 0x24, 0x95, 0x08, 0xBF, 0x12, 0xCF, 0x6E, 0xC1, 0x01, 0x05, 0x6D }, NULL, NULL, 0xDAA76993, 0xD8ACF77C, 3, SAVETYPE_NONE, 2, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Pong by Oman (PD) [a1]", { 0x68, 0xC7, 0xFC, 0x19, 0x24, 0xAB, 0x44, 0x00, 0xCB, 0x65, 0xE4, 0x0C, 0x32, 0xB7, 0xD3, 0xA6 }, NULL, NULL, 0xDAA76993, 0xD8ACF77C, 3, SAVETYPE_NONE, 2, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Pong by Oman (PD) [h1C][o1]", { 0xE3, 0xCF, 0xB5, 0xF1, 0x82, 0x8C, 0xAF, 0x1F, 0x00, 0xB2, 0x3A, 0xDA, 0x86, 0x34, 0x60, 0xAD }, NULL, NULL, 0xDAA76993, 0xD8ACF77C, 3, SAVETYPE_NONE, 2, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Pong by Oman (PD) [t1]", { 0xCD, 0x4D, 0x5C, 0x6C, 0x96, 0xC8, 0xC5, 0x28, 0xA0, 0xFC, 0xE2, 0x95, 0x8A, 0x4A, 0x7A, 0xC9 }, NULL, NULL, 0x6BE878A8, 0x3DC16D91, 3, SAVETYPE_NONE, 2, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Power League 64 (J) [!]", { 0x8C, 0xC7, 0x3C, 0x37, 0x30, 0x16, 0x07, 0x06, 0x47, 0x03, 0x0D, 0xDE, 0x49, 0x2F, 0xDC, 0x8C }, NULL, NULL, 0xD7A6DCFA, 0xCCFEB6B7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Power League 64 (J) [o1]", { 0x65, 0x04, 0xFC, 0x6F, 0x3A, 0xDB, 0x59, 0x6F, 0x7D, 0x68, 0x06, 0x0E, 0xB3, 0x9A, 0x75, 0xB4 }, NULL, NULL, 0xD7A6DCFA, 0xCCFEB6B7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Power Rangers - Lightspeed Rescue (E) [!]", { 0xAE, 0x3B, 0xDF, 0x72, 0x92, 0x14, 0x96, 0x46, 0x20, 0x41, 0x7C, 0xC3, 0x16, 0x3F, 0x0B, 0xB6 }, NULL, NULL, 0x39F60C11, 0xAB2EBA7D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Power Rangers - Lightspeed Rescue (E) [f1] (NTSC)", { 0x24, 0xB5, 0xBF, 0xA8, 0x96, 0x80, 0x22, 0x53, 0xD2, 0xB7, 0x15, 0xFC, 0x76, 0x0D, 0x1B, 0x3E }, NULL, NULL, 0x8CD06379, 0x62319493, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Power Rangers - Lightspeed Rescue (U) [!]", { 0x91, 0xD7, 0x46, 0x21, 0xDD, 0xEF, 0x6D, 0x37, 0xFB, 0x84, 0x5B, 0x3B, 0xC7, 0x05, 0x9A, 0x38 }, NULL, NULL, 0xCF8957AD, 0x96D57EA9, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Powerpuff Girls, The - Chemical X-Traction (U) [!]", { 0x29, 0x91, 0xBB, 0x68, 0xEC, 0xA5, 0x48, 0x13, 0xD6, 0xB8, 0x34, 0xAD, 0xBB, 0xBA, 0xCC, 0x4C }, NULL, NULL, 0xFC74D475, 0x9A0278AB, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Premier Manager 64 (E) [!]", { 0x25, 0xBA, 0xFC, 0x84, 0xBA, 0x4D, 0x87, 0x85, 0x4D, 0xC4, 0x4D, 0xF3, 0xEF, 0x87, 0x64, 0xEA }, NULL, NULL, 0xF3D27F54, 0xC111ACF9, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Premier Manager 64 (E) [f1] (NTSC)", { 0x52, 0x7F, 0x05, 0xF1, 0x66, 0x39, 0x85, 0x99, 0xF0, 0xA1, 0xB1, 0x0F, 0x8E, 0x1F, 0x95, 0x85 }, NULL, NULL, 0xF45A6784, 0xF587C72F, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Premier Manager 64 (E) [f2] (NTSC100%)", { 0xED, 0x4F, 0xE5, 0xEA, 0xA6, 0x63, 0x1B, 0xB1, 0x42, 0xDE, 0xF7, 0xF3, 0x17, 0x31, 0x5D, 0xFA }, NULL, NULL, 0xC98C4580, 0xA8C84DAD, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Pro Mahjong Kiwame 64 (J) (V1.0) [!]", { 0x79, 0x95, 0xD7, 0x6F, 0x4C, 0xE2, 0x36, 0xB0, 0xF0, 0x28, 0x9F, 0x47, 0xAE, 0x52, 0x3D, 0x32 }, NULL, NULL, 0x9BA10C4E, 0x0408ABD3, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x453 },
+    { "Pro Mahjong Kiwame 64 (J) (V1.0) [b1]", { 0xD1, 0x62, 0x49, 0x77, 0xA3, 0xC2, 0x51, 0x92, 0x67, 0x17, 0x72, 0x62, 0x3F, 0xA7, 0x64, 0x38 }, NULL, NULL, 0x9BA10C4E, 0x0408ABD3, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x453 },
+    { "Pro Mahjong Kiwame 64 (J) (V1.0) [o1]", { 0x6F, 0xEC, 0x88, 0xE8, 0x8E, 0xD2, 0x5A, 0xE7, 0xE8, 0x23, 0xA6, 0x94, 0x44, 0xD6, 0x09, 0x8A }, NULL, NULL, 0x9BA10C4E, 0x0408ABD3, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x453 },
+    { "Pro Mahjong Kiwame 64 (J) (V1.1) [!]", { 0xB4, 0x2F, 0x62, 0x48, 0x3F, 0x7C, 0xA2, 0xAA, 0xC5, 0xAF, 0x91, 0x11, 0x75, 0x46, 0x3D, 0xB8 }, NULL, NULL, 0x0AE2B37C, 0xFBC174F0, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x453 },
+    { "Pro Mahjong Tsuwamono 64 - Jansou Battle ni Chousen (J) [!]", { 0xF1, 0xA2, 0xE4, 0xDD, 0x22, 0xAD, 0xF4, 0xF9, 0x0D, 0xA4, 0xBD, 0xDC, 0xA3, 0x7D, 0x5F, 0x18 }, NULL, NULL, 0x1BDCB30F, 0xA132D876, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x453 },
+    { "Psychodelic Demo by Ste (POM '98) (PD) [b1]", { 0x4F, 0xA4, 0xDC, 0x58, 0x2C, 0x23, 0xEE, 0xE8, 0x1F, 0xEB, 0x39, 0xB7, 0xEE, 0xBD, 0x15, 0xD6 }, NULL, NULL, 0xC5C4F0D5, 0x4EEF2573, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Psychodelic Demo by Ste (POM '98) (PD)", { 0x59, 0x22, 0x92, 0xDF, 0x29, 0x82, 0x3A, 0x0F, 0xD8, 0x1E, 0xD3, 0x26, 0x66, 0x87, 0x8C, 0x15 }, NULL, NULL, 0xC5C4F0D5, 0x4EEF2573, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Puyo Puyo 4 - Puyo Puyo Party (J) [!]", { 0x22, 0xB8, 0x6A, 0xB3, 0xF3, 0x20, 0xA6, 0x07, 0x89, 0x9A, 0x05, 0x16, 0xC9, 0x0A, 0x24, 0xD0 }, NULL, NULL, 0x4B4672B9, 0x2DBE5DE7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x233 },
+    { "Puyo Puyo Sun 64 (J) [!]", { 0xFA, 0xAA, 0x20, 0x94, 0xB0, 0x4D, 0xCA, 0x4C, 0x28, 0x7A, 0xF9, 0x33, 0x4D, 0x22, 0x52, 0x9D }, NULL, NULL, 0x94807E6B, 0x60CC62E4, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Puyo Puyo Sun 64 (J) [T+Eng1.1_Zoinkity]", { 0xB8, 0x26, 0x7C, 0x22, 0x55, 0x83, 0xA0, 0x2A, 0xCC, 0x3B, 0x74, 0xB3, 0x17, 0x8B, 0x87, 0xE9 }, NULL, NULL, 0x1C348AFE, 0x5B96ECFA, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Puyo Puyo Sun 64 (J) [T+Kor1.0_Zoinkity&UltimatePenguin]", { 0x98, 0x03, 0xF1, 0x44, 0xAB, 0x70, 0x2A, 0x7C, 0x3E, 0x16, 0x09, 0x2A, 0xA9, 0x29, 0xAB, 0x45 }, NULL, NULL, 0x7FCBF1D2, 0x04546EB4, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Puyo Puyo Sun 64 (J) [b1]", { 0x20, 0xC7, 0xAB, 0xF5, 0xA4, 0xDB, 0x8D, 0xC1, 0xC7, 0x07, 0x25, 0xFD, 0x21, 0x3E, 0x29, 0xA2 }, NULL, NULL, 0x94807E6B, 0x60CC62E4, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Puzzle Bobble 64 (J) [!]", { 0xB4, 0x78, 0xD4, 0xAF, 0x60, 0xD4, 0x3C, 0x38, 0xBA, 0x81, 0xDE, 0x9F, 0xAE, 0xA6, 0xE0, 0x57 }, NULL, NULL, 0xC0DE0747, 0xA2DF72D3, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Puzzle Bobble 64 (J) [f1] (PAL)", { 0x9B, 0x46, 0x3A, 0x87, 0xDA, 0x73, 0xB8, 0xC9, 0x23, 0xB0, 0x5C, 0x3B, 0xD4, 0x6E, 0xDB, 0x09 }, NULL, NULL, 0x53D93EA2, 0xB88836C6, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Puzzle Bobble 64 (J) [f2] (PAL)", { 0xEA, 0x33, 0x5A, 0x87, 0xC8, 0x7F, 0x30, 0x2C, 0x6A, 0x10, 0xD0, 0xD3, 0xD3, 0xE0, 0x9B, 0x72 }, NULL, NULL, 0x412E02B8, 0x51A57E8E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Puzzle Master 64 by Michael Searl (PD)", { 0xFB, 0xDD, 0x42, 0x1F, 0xC2, 0x10, 0x5C, 0xF4, 0xB9, 0x66, 0x3D, 0xF9, 0x7F, 0xD7, 0x04, 0x1D }, NULL, NULL, 0x4BBBA2E2, 0x8BF3BBB2, 2, SAVETYPE_NONE, 1, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Quake 64 (E) [!]", { 0x59, 0x2C, 0xE7, 0x71, 0x8E, 0xFD, 0xD1, 0xFF, 0x2F, 0x07, 0x7C, 0x9B, 0x2B, 0x52, 0x75, 0xFB }, NULL, NULL, 0x16931D74, 0x65DC6D34, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quake 64 (E) [o1]", { 0x30, 0xED, 0xCC, 0xA8, 0x48, 0x50, 0xE3, 0xB4, 0x12, 0x99, 0x36, 0x35, 0x0A, 0x9B, 0x6B, 0x8B }, NULL, NULL, 0x16931D74, 0x65DC6D34, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quake 64 (E) [t1]", { 0xFE, 0x4A, 0xC5, 0x51, 0xB2, 0x84, 0xBD, 0x09, 0x24, 0xF2, 0xAA, 0xA3, 0x87, 0x24, 0x9B, 0x4B }, NULL, NULL, 0x68CE63CC, 0x2FFE262C, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quake 64 (U) [!]", { 0x09, 0x76, 0x05, 0x02, 0x19, 0x51, 0x02, 0x4C, 0x3E, 0xCB, 0x2D, 0x50, 0x2C, 0x0C, 0x2A, 0x9F }, NULL, NULL, 0x9F5BF79C, 0xD2FE08A0, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quake 64 (U) [b1]", { 0x87, 0xF3, 0x5B, 0xC0, 0xC6, 0xE2, 0xEA, 0xD9, 0x81, 0xB4, 0x9D, 0x69, 0x10, 0x95, 0xB1, 0x18 }, NULL, NULL, 0x254CF663, 0xDC8131EE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quake 64 (U) [h1C]", { 0x29, 0x5F, 0xAA, 0x9B, 0x7C, 0xC7, 0x12, 0x7B, 0xC8, 0x2A, 0xEA, 0x90, 0xAD, 0xB2, 0x11, 0xE5 }, NULL, NULL, 0x9F5BF79C, 0xD2FE08A0, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quake 64 (U) [o1]", { 0x21, 0x38, 0xCE, 0x5A, 0xEC, 0x36, 0x3B, 0xAC, 0x2F, 0x18, 0xCE, 0x65, 0xA7, 0x8E, 0xCA, 0x25 }, NULL, NULL, 0x9F5BF79C, 0xD2FE08A0, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quake 64 (U) [o1][t1]", { 0xD5, 0x99, 0x49, 0x09, 0x09, 0xFA, 0xAC, 0xB2, 0x6D, 0x13, 0x4D, 0x15, 0x2C, 0xB5, 0xF1, 0xED }, NULL, NULL, 0x254CF663, 0xDC8131EE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quake 64 (U) [o2]", { 0xF2, 0xFA, 0x48, 0x32, 0x9F, 0xF6, 0xDD, 0xBB, 0x7B, 0xD4, 0xEE, 0xA8, 0x38, 0xFD, 0x80, 0x0B }, NULL, NULL, 0x9F5BF79C, 0xD2FE08A0, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quake 64 (U) [o2][t1]", { 0x7B, 0x59, 0x30, 0x77, 0xEF, 0xC1, 0x5B, 0x44, 0xC8, 0xD8, 0xFF, 0x63, 0x9D, 0x6F, 0xB4, 0x34 }, NULL, NULL, 0x254CF663, 0xDC8131EE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quake 64 (U) [t1]", { 0x95, 0x3B, 0xB3, 0xAD, 0x87, 0xB3, 0xC1, 0xB7, 0xAC, 0x85, 0xF1, 0x2B, 0x13, 0x5F, 0xAA, 0x85 }, NULL, NULL, 0x254CF663, 0xDC8131EE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quake 64 Intro (PD)", { 0xC3, 0x1A, 0x8B, 0xB6, 0x70, 0x5B, 0xD2, 0x11, 0x2A, 0x5A, 0xBF, 0x4F, 0x82, 0x5F, 0xD3, 0xC0 }, NULL, NULL, 0xF4D89C08, 0x3F34930D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Quake II (E) [!]", { 0x67, 0x3D, 0x4B, 0xA4, 0xF4, 0x1A, 0x0F, 0xE2, 0x36, 0x50, 0xF0, 0x6A, 0xF5, 0x3E, 0xEC, 0x50 }, NULL, NULL, 0x7433D9D7, 0x2C4322D0, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quake II (E) [h1C]", { 0x55, 0xA7, 0x89, 0xC5, 0x53, 0x82, 0x71, 0x14, 0x30, 0x6E, 0x29, 0xD7, 0x1E, 0x26, 0xE5, 0xDC }, NULL, NULL, 0x7433D9D7, 0x2C4322D0, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quake II (U) [!]", { 0xCC, 0x93, 0xC3, 0x0C, 0x63, 0x3F, 0xF4, 0x61, 0xC2, 0x9B, 0x54, 0xCE, 0xAB, 0xEF, 0xD7, 0x01 }, NULL, NULL, 0xBDA8F143, 0xB1AF2D62, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quake II (U) [f1] (PAL)", { 0x92, 0x0F, 0xAA, 0xCC, 0xE1, 0xF8, 0xA8, 0x00, 0x22, 0x43, 0x3A, 0xCF, 0xD5, 0xCD, 0x2B, 0xC3 }, NULL, NULL, 0x4F8B1784, 0x763A4E04, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Quest 64 (U) [!]", { 0xEA, 0x55, 0x2E, 0x33, 0x97, 0x34, 0x68, 0x23, 0x3A, 0x07, 0x12, 0xC2, 0x51, 0xAB, 0xDB, 0x6B }, NULL, NULL, 0xC8BB4DD9, 0xCC5F430B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Quest 64 (U) [b1]", { 0x6F, 0x32, 0xB4, 0xDE, 0x3B, 0x3F, 0xC0, 0xC7, 0x19, 0xBF, 0x9E, 0xA2, 0x7E, 0xFC, 0x18, 0xBE }, NULL, NULL, 0xC8BB4DD9, 0xCC5F430B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Quest 64 (U) [b2]", { 0x0E, 0x2C, 0xAB, 0x03, 0xB7, 0x12, 0xE7, 0xD4, 0xE1, 0xC6, 0x50, 0x19, 0x78, 0xE2, 0xE6, 0x37 }, NULL, NULL, 0xC8BB4DD9, 0xCC5F430B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Quest 64 (U) [b3]", { 0x48, 0x90, 0x57, 0x6C, 0x70, 0xE8, 0x48, 0x6D, 0x2A, 0x90, 0x42, 0x4C, 0x57, 0xC5, 0x37, 0x52 }, NULL, NULL, 0xC8BB4DD9, 0xCC5F430B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Quest 64 (U) [b4]", { 0xE9, 0xEF, 0xCC, 0x50, 0x8A, 0x70, 0x54, 0xBB, 0x94, 0xE5, 0xB3, 0x24, 0x30, 0x18, 0xF1, 0xAC }, NULL, NULL, 0xC8BB4DD9, 0xCC5F430B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Quest 64 (U) [b5]", { 0x13, 0x1C, 0xCC, 0x5C, 0x9E, 0x9B, 0xD8, 0x30, 0x14, 0x75, 0x62, 0xDF, 0xD0, 0x64, 0x44, 0xBF }, NULL, NULL, 0xC8BB4DD9, 0xCC5F430B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Quest 64 (U) [t1]", { 0xC0, 0x1A, 0x07, 0x9E, 0x00, 0x05, 0xDC, 0xF5, 0xAD, 0x9A, 0xB0, 0xD5, 0x8C, 0xD9, 0x51, 0x5E }, NULL, NULL, 0x5F48A227, 0xB97D9B7F, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "R.I.P. Jay Demo by Ste (PD) [b1]", { 0x5D, 0xF3, 0x5D, 0x0C, 0x05, 0xE5, 0x8F, 0xCE, 0x93, 0x8B, 0xAE, 0xC6, 0xCB, 0x2A, 0x23, 0x0E }, NULL, NULL, 0x32A92961, 0xDB34982C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "R.I.P. Jay Demo by Ste (PD)", { 0x03, 0x41, 0x8F, 0x15, 0x67, 0xDC, 0x45, 0xCB, 0xB4, 0xB4, 0xE9, 0xDA, 0x77, 0x2C, 0xAA, 0x7F }, NULL, NULL, 0x32A92961, 0xDB34982C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "RADWAR 2K Party Inv. Intro by Ayatolloh (PD)", { 0xFF, 0xE3, 0x83, 0x9F, 0xD3, 0x97, 0x4A, 0x08, 0x58, 0xA6, 0x2C, 0xF3, 0x63, 0xD0, 0xF8, 0xDB }, NULL, NULL, 0xC9011D05, 0xEF078B8C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "RPA Site Intro by Lem (PD)", { 0x34, 0xAF, 0x9F, 0x96, 0xDE, 0x01, 0xA7, 0xDF, 0x6B, 0x29, 0x65, 0x98, 0x90, 0x8B, 0xB3, 0x98 }, NULL, NULL, 0x79E318E1, 0x86861726, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "RR64 - Ridge Racer 64 (E) [!]", { 0x45, 0x61, 0x84, 0x08, 0x40, 0x76, 0x0F, 0xFA, 0x7B, 0x59, 0xF0, 0x3A, 0x5F, 0x41, 0x6A, 0x5C }, NULL, NULL, 0xFEE97010, 0x4E94A9A0, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "RR64 - Ridge Racer 64 (U) [!]", { 0x99, 0x0F, 0x97, 0xD5, 0x64, 0x56, 0xFC, 0x23, 0xE5, 0x2B, 0xD2, 0x63, 0xE7, 0x09, 0xE2, 0x1E }, NULL, NULL, 0x2500267E, 0x2A7EC3CE, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "RR64 - Ridge Racer 64 (U) [f1] (PAL)", { 0x8C, 0xF6, 0x32, 0x67, 0xBA, 0x38, 0xAB, 0x73, 0x76, 0x33, 0x54, 0xC7, 0x9C, 0x4A, 0xDB, 0x74 }, NULL, NULL, 0x4E17004A, 0x259E946C, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "RR64 - Ridge Racer 64 (U) [t1]", { 0x07, 0xD6, 0x00, 0x6F, 0x74, 0x47, 0x27, 0xDA, 0xAC, 0x7F, 0x53, 0x69, 0x2A, 0xD9, 0x50, 0xC4 }, NULL, NULL, 0x5A98A468, 0xAB27C89D, 0, SAVETYPE_EEPROM_16K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "RTL World League Soccer 2000 (G) [!]", { 0xA1, 0x08, 0x2A, 0x66, 0x76, 0x45, 0x5C, 0x04, 0x08, 0x43, 0xFD, 0x75, 0xE9, 0x2D, 0xE1, 0xA3 }, NULL, NULL, 0x658F8F37, 0x1813D28D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "RTL World League Soccer 2000 (G) [f1] (NTSC)", { 0x09, 0xBE, 0xE9, 0xD7, 0xEB, 0x11, 0x59, 0xD1, 0x1E, 0x49, 0xBD, 0xFB, 0x03, 0xA2, 0xC4, 0xCC }, NULL, NULL, 0xD250103E, 0x136A0F0C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "RTL World League Soccer 2000 (G) [f1][o1]", { 0x43, 0x92, 0xF3, 0x3C, 0x42, 0x82, 0xB6, 0x8C, 0x9D, 0xEF, 0x51, 0x11, 0xCC, 0xF7, 0x33, 0xCA }, NULL, NULL, 0xD250103E, 0x136A0F0C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Racing Simulation 2 (G) [!]", { 0xAA, 0x57, 0xD6, 0x98, 0x67, 0xF5, 0x34, 0x56, 0xF3, 0x51, 0xA2, 0x89, 0xEB, 0xA0, 0x8C, 0x3D }, NULL, NULL, 0x2877AC2D, 0xC3DC139A, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Racing Simulation 2 (G) [h1C]", { 0x61, 0x60, 0xD5, 0xDE, 0x99, 0xBE, 0x42, 0x1A, 0xCB, 0x62, 0x0D, 0x2D, 0x20, 0x3C, 0x2F, 0xEC }, NULL, NULL, 0x2877AC2D, 0xC3DC139A, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rakuga Kids (E) [!]", { 0x16, 0x7A, 0x35, 0x02, 0xF0, 0x6C, 0xF0, 0xEE, 0xF5, 0x67, 0x58, 0x53, 0x3F, 0x3D, 0x0E, 0x52 }, NULL, NULL, 0x67D21868, 0xC5424061, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Rakuga Kids (E) [b1]", { 0x28, 0xFE, 0x76, 0x8C, 0xED, 0x3C, 0x87, 0x65, 0x9B, 0x34, 0x3A, 0x78, 0x11, 0xCF, 0xAC, 0x0A }, NULL, NULL, 0x67D21868, 0xC5424061, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Rakuga Kids (E) [f1] (NTSC)", { 0x7F, 0x09, 0x00, 0xDD, 0x97, 0x26, 0xA7, 0xE5, 0x6A, 0x39, 0x8E, 0x91, 0x0D, 0x01, 0x4B, 0x61 }, NULL, NULL, 0x49020C8E, 0xA000B949, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Rakuga Kids (E) [h1C]", { 0x98, 0xA8, 0x02, 0xD4, 0x4F, 0xE4, 0x16, 0x9F, 0xD7, 0x3D, 0x7B, 0x48, 0x1C, 0x08, 0x61, 0x3E }, NULL, NULL, 0x67D21868, 0xC5424061, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Rakuga Kids (J) [!]", { 0x81, 0x3A, 0xD5, 0xC0, 0x0B, 0xAD, 0x7C, 0x4D, 0x41, 0xF8, 0x55, 0x8C, 0xEC, 0xED, 0xAE, 0x51 }, NULL, NULL, 0x9F1ECAF0, 0xEEC48A0E, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Rakuga Kids (J) [b1]", { 0x37, 0x8C, 0x6C, 0xE1, 0x3D, 0xF3, 0x36, 0x3F, 0x77, 0xD7, 0x6B, 0x64, 0xC8, 0xDA, 0xB2, 0x87 }, NULL, NULL, 0x9F1ECAF0, 0xEEC48A0E, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Rakuga Kids (J) [h1C]", { 0x08, 0xD7, 0x9A, 0x5C, 0x0F, 0x39, 0x3D, 0x81, 0x29, 0x6F, 0x50, 0xA6, 0xD5, 0x56, 0xD9, 0x99 }, NULL, NULL, 0x9F1ECAF0, 0xEEC48A0E, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Rally '99 (J) [!]", { 0x06, 0x30, 0x22, 0x6F, 0x63, 0x56, 0x1A, 0x05, 0x91, 0x6E, 0xDC, 0xFB, 0xC8, 0xD9, 0x6C, 0x04 }, NULL, NULL, 0x35D9BA0C, 0xDF485586, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rally '99 (J) [f1] (PAL)", { 0x03, 0x5B, 0x02, 0xE4, 0x93, 0xA3, 0x88, 0xE9, 0x50, 0xFB, 0x42, 0xF4, 0xB3, 0xD8, 0x91, 0xF8 }, NULL, NULL, 0x4C2B343C, 0x7249BAFF, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rally Challenge 2000 (U) [!]", { 0x04, 0x58, 0xBC, 0x47, 0xCD, 0x77, 0x1D, 0x8B, 0xC6, 0x6B, 0x0C, 0xEA, 0xE6, 0x89, 0x57, 0x24 }, NULL, NULL, 0x73A88E3D, 0x3AC5C571, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rampage - World Tour (E) [!]", { 0x08, 0xE0, 0x2F, 0x52, 0xE0, 0x54, 0x76, 0x86, 0xA9, 0xBF, 0xAC, 0x7C, 0xBB, 0x03, 0xC1, 0x29 }, NULL, NULL, 0x84D44448, 0x67CA19B0, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rampage - World Tour (E) [h1C]", { 0x41, 0x01, 0x46, 0xEA, 0x14, 0xCF, 0x34, 0xD1, 0x34, 0xBC, 0x97, 0xC7, 0x85, 0x22, 0xD3, 0x22 }, NULL, NULL, 0x84D44448, 0x67CA19B0, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rampage - World Tour (U) [!]", { 0x46, 0x45, 0x67, 0x2A, 0x0C, 0xF0, 0x0A, 0xDA, 0x9B, 0x5E, 0x37, 0xCF, 0xDE, 0x8B, 0x02, 0x4E }, NULL, NULL, 0xC29FF9E4, 0x264BFE7D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rampage - World Tour (U) [b1]", { 0x16, 0x59, 0xF9, 0xF8, 0xC8, 0xA5, 0xC2, 0x4F, 0x77, 0x5B, 0x24, 0x5B, 0xDA, 0x57, 0x44, 0x62 }, NULL, NULL, 0xC29FF9E4, 0x264BFE7D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rampage - World Tour (U) [b2]", { 0x71, 0xEC, 0x90, 0xE3, 0x44, 0x21, 0xCE, 0xEA, 0xA8, 0xB7, 0x1A, 0xCA, 0xF7, 0x6E, 0xFD, 0x33 }, NULL, NULL, 0xC29FF9E4, 0x264BFE7D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rampage - World Tour (U) [b3]", { 0x66, 0x95, 0x84, 0xEE, 0xB9, 0xF8, 0x5C, 0x7A, 0x8A, 0x96, 0xB7, 0x16, 0xA2, 0xB4, 0x37, 0x39 }, NULL, NULL, 0xC29FF9E4, 0x264BFE7D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rampage - World Tour (U) [b4]", { 0x70, 0xC3, 0xE7, 0x41, 0x2F, 0xF8, 0x19, 0x6E, 0x16, 0xCC, 0xA0, 0x76, 0xB3, 0xB6, 0x22, 0xF7 }, NULL, NULL, 0xC29FF9E4, 0x264BFE7D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rampage - World Tour (U) [h1C]", { 0xBE, 0x82, 0x3D, 0x79, 0x58, 0x15, 0x1B, 0x97, 0xF8, 0x12, 0xFB, 0xF0, 0x1E, 0x76, 0x21, 0xD2 }, NULL, NULL, 0xC29FF9E4, 0x264BFE7D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rampage - World Tour (U) [t1]", { 0xE3, 0x06, 0x0D, 0x3F, 0xAD, 0xA2, 0xA5, 0x02, 0x76, 0x4E, 0x76, 0x5F, 0x81, 0x40, 0xFC, 0x42 }, NULL, NULL, 0x588F980C, 0x63FF7803, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rampage - World Tour (U) [t2]", { 0x4D, 0x28, 0x08, 0x55, 0xEA, 0x4F, 0xFE, 0x98, 0x05, 0x4B, 0xDF, 0x63, 0x3E, 0xA5, 0xA7, 0xF7 }, NULL, NULL, 0x588F980C, 0x63FF7803, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rampage 2 - Universal Tour (E) [!]", { 0x14, 0x92, 0x80, 0x6F, 0x12, 0xD3, 0x3C, 0x3E, 0xA0, 0xED, 0xB6, 0x84, 0x8D, 0x43, 0xB1, 0xCC }, NULL, NULL, 0x5DFC4249, 0x99529C07, 0, SAVETYPE_NONE, 3, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rampage 2 - Universal Tour (U) [!]", { 0x81, 0x13, 0xD0, 0xEA, 0x20, 0x08, 0x40, 0x2D, 0x46, 0x31, 0xF2, 0x41, 0xF6, 0x25, 0xD1, 0x6B }, NULL, NULL, 0x673D099B, 0xA4C808DE, 0, SAVETYPE_NONE, 3, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rampage 2 - Universal Tour (U) [t1]", { 0xEB, 0xAF, 0xB5, 0xC3, 0xBC, 0xC8, 0x45, 0x43, 0xA8, 0xE7, 0xFE, 0xF1, 0x99, 0x3E, 0x57, 0x3F }, NULL, NULL, 0xBF4317E2, 0x2DF987E2, 0, SAVETYPE_NONE, 3, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rampage 2 - Universal Tour (U) [t2]", { 0xEA, 0x38, 0x3E, 0x48, 0x63, 0x7B, 0x44, 0xFF, 0xF9, 0x29, 0x4D, 0x23, 0xB0, 0x76, 0x54, 0x8B }, NULL, NULL, 0xFD2FC875, 0x3BD10D89, 0, SAVETYPE_NONE, 3, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Rape Kombat Trilogy Beta1 (Mortal Kombat Hack)", { 0xC7, 0xB9, 0x02, 0x45, 0x94, 0xF9, 0x32, 0xBA, 0x5E, 0x3A, 0x1F, 0xB7, 0x0F, 0xE9, 0xBD, 0x6B }, NULL, NULL, 0x9A2949C1, 0x04E76074, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Rat Attack (E) (M6) [!]", { 0xBC, 0x66, 0x23, 0x9C, 0x12, 0xAE, 0x86, 0x96, 0x92, 0x6E, 0x50, 0xC2, 0xB6, 0xED, 0x9C, 0x49 }, NULL, "F117DAEC 8014,F117DAEE A1D0", 0x20FD0BF1, 0xF5CF1D87, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49B },
+    { "Rat Attack (E) (M6) [f1] (NTSC)", { 0xE0, 0xBB, 0x65, 0xC3, 0x0C, 0x11, 0x85, 0xFD, 0x99, 0x97, 0x02, 0x0A, 0x19, 0x94, 0xB0, 0x7E }, NULL, "F117DAEC 8014,F117DAEE A1D0", 0x85670AB4, 0x3834BE8A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49B },
+    { "Rat Attack (E) (M6) [h1C]", { 0x6F, 0x86, 0x8B, 0x16, 0x52, 0x18, 0x33, 0x76, 0x66, 0x5F, 0x67, 0xF8, 0x18, 0x3E, 0xEB, 0x5C }, NULL, "F117DAEC 8014,F117DAEE A1D0", 0x20FD0BF1, 0xF5CF1D87, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49B },
+    { "Rat Attack (U) (M6) [!]", { 0xF6, 0x61, 0x88, 0x9F, 0xDF, 0x65, 0xDD, 0xCD, 0x21, 0x2E, 0x9F, 0xB5, 0x3B, 0x2C, 0x8F, 0x50 }, NULL, "F117E34C 8014,F117E34E A8F0", 0x0304C48E, 0xAC4001B8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x49B },
+    { "Rayman 2 - The Great Escape (E) (M5) [!]", { 0x5D, 0xBB, 0xFD, 0x5A, 0xCE, 0x82, 0x22, 0xFA, 0x8F, 0xE5, 0x1B, 0xE1, 0x13, 0x45, 0x3C, 0x13 }, NULL, NULL, 0x60D5E10B, 0x8BEDED46, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Rayman 2 - The Great Escape (E) (M5) [f1] (NTSC)", { 0xEF, 0x20, 0x01, 0xF5, 0x81, 0xA8, 0x0D, 0x76, 0x0C, 0x51, 0xD1, 0x30, 0x72, 0x5A, 0x99, 0x30 }, NULL, NULL, 0xB8C303FA, 0x544BB5FA, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Rayman 2 - The Great Escape (E) (M5) [f2] (NTSC)", { 0x53, 0xB3, 0x25, 0xCC, 0xDF, 0x20, 0x69, 0xAB, 0x20, 0xCA, 0xF1, 0xC9, 0xB4, 0x01, 0xCD, 0x20 }, NULL, NULL, 0x7055FD0A, 0xE0A45808, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Rayman 2 - The Great Escape (U) (M5) [!]", { 0x03, 0xAA, 0x4D, 0x09, 0xFD, 0xE7, 0x7E, 0xED, 0x9B, 0x95, 0xBE, 0x68, 0xE6, 0x03, 0xD2, 0x33 }, NULL, NULL, 0xF3C5BF9B, 0x160F33E2, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Rayman 2 - The Great Escape (U) (M5) [t1]", { 0x2B, 0x1D, 0x9F, 0x38, 0x38, 0x95, 0x22, 0xA3, 0x72, 0xD9, 0x50, 0xE1, 0xBC, 0x6F, 0xA1, 0x3F }, NULL, NULL, 0x8BB6E3EB, 0x2402CC87, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Razor Freestyle Scooter (U) [!]", { 0x40, 0x6B, 0x08, 0x98, 0x7A, 0xB9, 0x2D, 0x73, 0xD7, 0x2B, 0x59, 0x7E, 0xC6, 0xB1, 0x1B, 0xD9 }, NULL, NULL, 0x3918834A, 0x15B50C29, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Re-Volt (E) (M4) [!]", { 0xFA, 0xA6, 0x4A, 0xBB, 0x0D, 0x22, 0x2F, 0xCC, 0x0C, 0x6E, 0x25, 0x15, 0xD3, 0x80, 0x5D, 0x9F }, NULL, NULL, 0xC3E7E29E, 0x5D7251CC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Re-Volt (U) [!]", { 0x3F, 0xC4, 0xD3, 0x18, 0x74, 0x35, 0x44, 0x34, 0x55, 0xF8, 0x35, 0x5B, 0x2D, 0x3F, 0x89, 0x34 }, NULL, NULL, 0x0F1FA987, 0xBFC1AFA6, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Re-Volt (U) [f1] (Country Check)", { 0x37, 0x7D, 0xAF, 0x6E, 0xDD, 0x0C, 0x99, 0x64, 0x22, 0xD2, 0xA9, 0xC8, 0xC5, 0xDE, 0xC0, 0x33 }, NULL, NULL, 0x529AA985, 0xA85509A3, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Re-Volt (U) [f2] (PAL)", { 0x77, 0xDC, 0x38, 0xCC, 0xE0, 0xFF, 0xAB, 0x00, 0x4F, 0xD5, 0x4F, 0x54, 0xEE, 0x25, 0xA5, 0x93 }, NULL, NULL, 0x53575A75, 0x54573214, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Re-Volt (U) [t1]", { 0x19, 0x7E, 0x24, 0xC1, 0xAB, 0x65, 0x03, 0x99, 0x87, 0x98, 0xD7, 0xF5, 0x6E, 0xAE, 0x7A, 0xDD }, NULL, NULL, 0xB754A584, 0xD3530516, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Ready 2 Rumble Boxing (E) (M3) [!]", { 0xAD, 0xC9, 0x5A, 0xE0, 0x18, 0x55, 0xFA, 0x30, 0x5B, 0x13, 0xF8, 0xB2, 0x24, 0x27, 0xE5, 0x97 }, NULL, NULL, 0x8BD4A334, 0x1E138B05, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Ready 2 Rumble Boxing (E) [T+Spa2.0_IlDucci]", { 0x73, 0x16, 0x5C, 0xBE, 0x4E, 0x24, 0x21, 0x47, 0x5C, 0x5F, 0xE9, 0xA2, 0x27, 0xDC, 0xAF, 0xEC }, NULL, NULL, 0x56E06922, 0x10F665F6, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Ready 2 Rumble Boxing (E) (M3) [t1] (P1 Untouchable)", { 0x70, 0xF7, 0x3D, 0x01, 0xFE, 0xAF, 0x76, 0x87, 0x58, 0xF3, 0x1B, 0x23, 0xDE, 0x2C, 0x26, 0x20 }, NULL, NULL, 0x8638A334, 0x8EBF1508, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Ready 2 Rumble Boxing (U) [!]", { 0xA4, 0x2F, 0x6F, 0x14, 0xF7, 0xEA, 0x10, 0xAB, 0xEB, 0x3B, 0x55, 0xFF, 0xD4, 0x2E, 0xB5, 0x72 }, NULL, NULL, 0xEAB7B429, 0xBAC92C57, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Ready 2 Rumble Boxing (U) [f1] (PAL)", { 0x25, 0x62, 0x0A, 0x9C, 0x9F, 0x37, 0x20, 0x23, 0xA8, 0xBA, 0x86, 0x23, 0x30, 0xE6, 0x37, 0x3A }, NULL, NULL, 0x5D6AA6EA, 0x657352B1, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Ready 2 Rumble Boxing (U) [t1] (P1 Untouchable)", { 0xCC, 0xEC, 0xEA, 0xA3, 0x89, 0xA7, 0x84, 0x7D, 0xE3, 0x43, 0x38, 0x88, 0xC6, 0x6A, 0x76, 0xE5 }, NULL, NULL, 0xE655B42D, 0xF22370DD, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Ready 2 Rumble Boxing - Round 2 (U) [!]", { 0xDF, 0x44, 0x46, 0xA2, 0xB5, 0x5C, 0x4D, 0x8D, 0x67, 0xE9, 0xC0, 0xC1, 0x9E, 0x0F, 0xD9, 0xFB }, NULL, NULL, 0xE9219533, 0x13FBAFBD, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Ready 2 Rumble Boxing - Round 2 (U) [t1]", { 0xCB, 0x97, 0x35, 0x0D, 0x5C, 0xAB, 0x48, 0xEA, 0xB8, 0xB9, 0x54, 0xD9, 0x1C, 0x0E, 0x5D, 0xAC }, NULL, NULL, 0x6CED60AC, 0xC74292DC, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Resident Evil 2 (E) (M2) [!]", { 0xB0, 0x4F, 0x29, 0x87, 0x21, 0x22, 0x3A, 0x22, 0xE1, 0x15, 0x0C, 0xEB, 0xC7, 0x12, 0xEE, 0x6A }, NULL, NULL, 0x9B500E8E, 0xE90550B3, 0, SAVETYPE_SRAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Resident Evil 2 (U) (V1.0) [!]", { 0xDD, 0x21, 0x15, 0x0C, 0xBC, 0x21, 0xC0, 0x54, 0x20, 0x30, 0x45, 0x99, 0xEC, 0x57, 0x41, 0x1C }, NULL, NULL, 0x2F493DD0, 0x2E64DFD9, 0, SAVETYPE_SRAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Resident Evil 2 (U) (V1.1) [!]", { 0x1A, 0xDD, 0x2C, 0x02, 0x17, 0x66, 0x2B, 0x30, 0x7C, 0xDF, 0xD8, 0x76, 0xB3, 0x5F, 0xBF, 0x7A }, NULL, NULL, 0xAA18B1A5, 0x07DB6AEB, 0, SAVETYPE_SRAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Road Rash 64 (E) [!]", { 0xAD, 0x92, 0x2D, 0xAE, 0x44, 0x6A, 0x30, 0x1E, 0x1A, 0xAF, 0xE1, 0xDF, 0xBA, 0xD7, 0x5A, 0x2E }, NULL, NULL, 0x02D8366A, 0x6CABEF9C, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Road Rash 64 (E) [h1C]", { 0x5E, 0xB2, 0xB1, 0x89, 0x2B, 0x68, 0x76, 0x7E, 0xB1, 0xD3, 0x10, 0xFF, 0x75, 0x07, 0xD3, 0x4E }, NULL, NULL, 0x02D8366A, 0x6CABEF9C, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Road Rash 64 (U) [!]", { 0x28, 0xC2, 0x37, 0x3F, 0x6D, 0x83, 0x1E, 0xEC, 0x81, 0xF6, 0x14, 0x6A, 0x80, 0x9E, 0x70, 0x1B }, NULL, NULL, 0xF050746C, 0x247B820B, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Road Rash 64 (U) [f1] (PAL)", { 0x79, 0x66, 0xF1, 0x7F, 0x36, 0xC4, 0x3D, 0x38, 0x07, 0xC0, 0x94, 0x9A, 0xAD, 0x45, 0x16, 0x8A }, NULL, NULL, 0x422D29E1, 0xC1FB33F3, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Road Rash 64 (U) [t1]", { 0xC6, 0x86, 0x75, 0x66, 0xC9, 0xE1, 0x73, 0xBE, 0xAB, 0x45, 0x9C, 0x59, 0x45, 0xB6, 0x9C, 0x23 }, NULL, NULL, 0x48176863, 0xE1829A22, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Roadsters Trophy (E) (M6) [!]", { 0x41, 0xF6, 0x7B, 0x5C, 0x8B, 0xB8, 0xDA, 0xEF, 0xFD, 0x98, 0x91, 0x23, 0x84, 0x6F, 0xC0, 0x63 }, NULL, NULL, 0x74E87A70, 0x6293AED4, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Roadsters Trophy (U) (M3) [!]", { 0xD3, 0x64, 0x4B, 0x39, 0x8C, 0x09, 0x05, 0x28, 0xE0, 0xED, 0x9E, 0xB3, 0xC1, 0x40, 0x36, 0x6E }, NULL, NULL, 0x0B6B4DDB, 0x9671E682, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Roadsters Trophy (U) (M3) [f1] (PAL)", { 0xAE, 0x70, 0x5F, 0x25, 0xC5, 0x7A, 0xCA, 0xBB, 0xD0, 0xE8, 0xBA, 0xE5, 0xEC, 0x6E, 0x23, 0x7F }, NULL, NULL, 0x787AECF1, 0xCC8147BA, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Roadsters Trophy (U) (M3) [t1]", { 0x5C, 0x9C, 0x71, 0x54, 0x30, 0xAC, 0xBA, 0xEF, 0x3A, 0x5F, 0xBD, 0xB3, 0xE6, 0x66, 0x1A, 0xCF }, NULL, NULL, 0x74BCA5D3, 0x4A945F7E, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Robot Ponkottsu 64 - 7tsu no Umi no Caramel (J) [!]", { 0x44, 0x4F, 0x70, 0xA6, 0x55, 0xAC, 0x89, 0xCA, 0x90, 0x0F, 0x6F, 0xAF, 0xAF, 0x92, 0x6B, 0x16 }, NULL, NULL, 0x272B690F, 0xAD0A7A77, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Robot Ponkotsu 64 - 7tsu no Umi no Caramel (J) [f1] (PAL)", { 0x34, 0x77, 0x9A, 0xF3, 0x68, 0x1F, 0x58, 0xE4, 0xF6, 0x42, 0xF0, 0x3E, 0xAE, 0xF1, 0x98, 0xF9 }, NULL, NULL, 0x7F564549, 0xED60C5E6, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x21B },
+    { "Robotech - Crystal Dreams (Beta)", { 0x27, 0xC6, 0xF7, 0x80, 0xF9, 0x03, 0x2A, 0x53, 0x1E, 0x9A, 0x32, 0x29, 0x69, 0xCD, 0x91, 0x59 }, NULL, NULL, 0x75A0B893, 0x4CA321B5, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Robotech - Crystal Dreams (Beta) [a1]", { 0xB3, 0x95, 0x92, 0xC6, 0xC9, 0xA3, 0x12, 0x12, 0x58, 0xBD, 0xB6, 0x24, 0x85, 0x95, 0x68, 0x80 }, NULL, NULL, 0x75A0B893, 0x4CA321B5, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Robotron 64 (E) [!]", { 0x2A, 0xBC, 0xD1, 0xAD, 0x41, 0xB3, 0x35, 0x6F, 0xBC, 0x10, 0x18, 0xEC, 0xB1, 0x21, 0x28, 0x3E }, NULL, NULL, 0x9FF69D4F, 0x195F0059, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Robotron 64 (E) [h1C]", { 0x36, 0x00, 0x44, 0xD5, 0x67, 0x5A, 0x32, 0x8E, 0x62, 0x19, 0x12, 0x50, 0xF4, 0x3B, 0x66, 0x71 }, NULL, NULL, 0x9FF69D4F, 0x195F0059, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Robotron 64 (U) [!]", { 0xC4, 0xA9, 0xBB, 0xF9, 0x89, 0xDD, 0xFA, 0xF5, 0xF3, 0x89, 0xE4, 0xAD, 0xC6, 0x19, 0x5D, 0xBC }, NULL, NULL, 0xAC8E4B32, 0xE7B47326, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Robotron 64 (U) [b1]", { 0x56, 0x98, 0x75, 0x78, 0x83, 0xA6, 0xF4, 0x6F, 0xE5, 0xB4, 0xC9, 0xB6, 0xE7, 0x80, 0xB4, 0x80 }, NULL, NULL, 0xAC8E4B32, 0xE7B47326, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Robotron 64 (U) [b2]", { 0x85, 0x55, 0xDC, 0xF1, 0x2F, 0xD3, 0x52, 0x06, 0x45, 0x1F, 0xB4, 0x15, 0xF3, 0xFD, 0x2E, 0xEF }, NULL, NULL, 0x8F4C4B32, 0x6D881FCA, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Robotron 64 (U) [b3]", { 0xAB, 0x50, 0x02, 0x6D, 0xAE, 0xA6, 0x29, 0xF5, 0x54, 0x40, 0x8E, 0x5B, 0xA3, 0xEF, 0xA1, 0x82 }, NULL, NULL, 0x8F4C4B32, 0x6D881FCA, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Robotron 64 (U) [b4]", { 0x1A, 0xA7, 0x9B, 0x5D, 0xEF, 0xE1, 0xF5, 0x85, 0x2D, 0x5A, 0xDD, 0x79, 0x93, 0x83, 0xCC, 0xCD }, NULL, NULL, 0x575CCC2E, 0xA8B5ACE0, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Robotron 64 (U) [f1] (PAL)", { 0x37, 0x7B, 0x9C, 0x40, 0xEB, 0xE4, 0xF4, 0xCF, 0x84, 0x5E, 0x57, 0x7A, 0x8D, 0xC9, 0xAC, 0xCB }, NULL, NULL, 0x8F4C4B32, 0x6D881FCA, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Robotron 64 (U) [o1]", { 0x27, 0xE4, 0xC3, 0x15, 0x40, 0xE1, 0x8E, 0x3E, 0x8C, 0xEA, 0x97, 0xBF, 0xF7, 0x44, 0xCC, 0x11 }, NULL, NULL, 0xAC8E4B32, 0xE7B47326, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Robotron 64 (U) [t1]", { 0xE1, 0x51, 0xCC, 0xE2, 0x59, 0x63, 0x6C, 0x5A, 0xE1, 0x5C, 0xA1, 0xC8, 0xB3, 0x80, 0xEE, 0x76 }, NULL, NULL, 0x575CCC2E, 0xA8B5ACE0, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Rocket - Robot on Wheels (E) (M3) [!]", { 0x42, 0x7C, 0x54, 0x57, 0xD4, 0xA2, 0x9A, 0x22, 0x28, 0x11, 0xF0, 0xCA, 0xA9, 0xCC, 0xA7, 0xB9 }, NULL, NULL, 0x9FD375F8, 0x45F32DC8, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Rocket - Robot on Wheels (U) [!]", { 0xC2, 0x90, 0x7E, 0xB2, 0xF9, 0xA3, 0x50, 0x79, 0x33, 0x17, 0xEC, 0xE8, 0x78, 0xA3, 0xB8, 0xE3 }, NULL, NULL, 0x0C5EE085, 0xA167DD3E, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Rocket - Robot on Wheels (U) [b1]", { 0xE8, 0xCB, 0xAA, 0xDE, 0xDB, 0x6D, 0x19, 0xAC, 0xC1, 0x42, 0xBE, 0x31, 0x05, 0xE9, 0x4C, 0x4F }, NULL, NULL, 0x0C5EE085, 0xA167DD3E, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Rocket - Robot on Wheels (U) [f1] (PAL)", { 0x99, 0x1E, 0x5F, 0x52, 0x7E, 0xC9, 0x33, 0x03, 0x20, 0xE6, 0x52, 0x33, 0xC2, 0x93, 0xD4, 0xC5 }, NULL, NULL, 0xB9233DC7, 0x9CCF2D4C, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Rocket - Robot on Wheels (U) [t1]", { 0xB0, 0x42, 0xC2, 0x38, 0xC4, 0x09, 0x3D, 0xB5, 0x33, 0xEC, 0x4E, 0x84, 0x9C, 0x40, 0xDE, 0x4F }, NULL, NULL, 0xB31A9FBB, 0x26D03050, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Rockman Dash (J) [!]", { 0x0C, 0x74, 0xB4, 0x46, 0x80, 0x27, 0x6F, 0xFE, 0x80, 0x8C, 0xFA, 0x60, 0x45, 0x32, 0x98, 0x19 }, NULL, NULL, 0xD666593B, 0xD7A25C07, 0, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Ronaldinho's Soccer 64 (B) (Unl) (Pirate)", { 0x14, 0xF1, 0xF4, 0x3A, 0x03, 0x14, 0xC3, 0xE3, 0x6D, 0x9D, 0x24, 0x8E, 0x1F, 0x03, 0xEC, 0x2E }, NULL, NULL, 0x6F46DA42, 0xD971A312, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Rotating Demo USA by Rene (PD) [a1]", { 0x73, 0x97, 0x15, 0x08, 0xA3, 0xB4, 0xCA, 0x92, 0xF7, 0xF4, 0xCF, 0x59, 0xC9, 0x17, 0x03, 0x72 }, NULL, NULL, 0x6FA4B821, 0x29561690, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Rotating Demo USA by Rene (PD)", { 0x0B, 0xF7, 0x9F, 0x53, 0x2C, 0x93, 0x83, 0x84, 0x43, 0x1D, 0xA9, 0x40, 0x6B, 0x84, 0x6A, 0xFA }, NULL, NULL, 0x6FA4B821, 0x29561690, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Rugrats - Die grosse Schatzsuche (G) [!]", { 0xDE, 0xC4, 0x59, 0x8A, 0x39, 0x72, 0x8C, 0x28, 0xCD, 0x0C, 0xEB, 0xA4, 0x5A, 0x17, 0x3C, 0xE1 }, NULL, NULL, 0x451ACA0F, 0x7863BC8A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Rugrats - Scavenger Hunt (U) [!]", { 0x8C, 0x43, 0x22, 0x35, 0xA5, 0x7D, 0x34, 0xBC, 0x4A, 0x9B, 0x8B, 0x29, 0x0E, 0x21, 0xE0, 0x1E }, NULL, NULL, 0x0C02B3C5, 0x9E2511B8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Rugrats - Scavenger Hunt (U) [f1] (PAL)", { 0xC3, 0xED, 0x4C, 0xD0, 0x59, 0x78, 0xDE, 0xCF, 0xD7, 0x61, 0xFA, 0x25, 0x03, 0xDC, 0xB3, 0x9E }, NULL, NULL, 0xF04A729C, 0x19971680, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Rugrats - Treasure Hunt (E) [!]", { 0x55, 0x18, 0x50, 0x16, 0x03, 0x1C, 0xDC, 0x73, 0xC0, 0xFD, 0x47, 0x15, 0x27, 0xC3, 0x57, 0x06 }, NULL, NULL, 0x4D3ADFDA, 0x7598FCAE, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Rugrats - Treasure Hunt (E) [h1C]", { 0x95, 0x01, 0x61, 0x32, 0x5C, 0x7E, 0x11, 0xA0, 0x57, 0xCC, 0x85, 0xC9, 0x56, 0x85, 0xDB, 0x05 }, NULL, NULL, 0x4D3ADFDA, 0x7598FCAE, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Rugrats in Paris - The Movie (E) [!]", { 0x22, 0x90, 0x89, 0x08, 0x96, 0x61, 0xF5, 0x17, 0xC8, 0x63, 0x24, 0x2D, 0x6B, 0xB7, 0x77, 0x46 }, NULL, NULL, 0x0AC61D39, 0xABFA03A6, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Rugrats in Paris - The Movie (U) [!]", { 0x20, 0x7E, 0xFE, 0x58, 0xC7, 0xC2, 0x21, 0xDB, 0xDF, 0xFF, 0x28, 0x5A, 0xB8, 0x01, 0x26, 0xC1 }, NULL, NULL, 0x1FC21532, 0x0B6466D4, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Rugrats in Paris - The Movie (U) [T+Spa0.10]", { 0xF3, 0x51, 0x5A, 0x45, 0xEC, 0x01, 0xD2, 0xC9, 0xFE, 0xAF, 0xBA, 0xB2, 0xB8, 0x5D, 0x72, 0xC4 }, NULL, NULL, 0x40D5D2DE, 0x78489F0F, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Rush 2 - Extreme Racing USA (E) (M6) [!]", { 0x68, 0x1D, 0xF5, 0xA3, 0x2E, 0x85, 0x7E, 0x77, 0x19, 0x41, 0x06, 0xB3, 0x53, 0x04, 0xD6, 0xB5 }, NULL, NULL, 0xB7CF2136, 0xFA0AA715, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Rush 2 - Extreme Racing USA (E) (M6) [h1I]", { 0x8A, 0x59, 0x47, 0x7C, 0x29, 0xB4, 0x35, 0x3F, 0xEA, 0xB8, 0x53, 0x03, 0xC5, 0x8B, 0x98, 0xF0 }, NULL, NULL, 0x09A0A6E5, 0x8396630D, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Rush 2 - Extreme Racing USA (E) (M6) [h2I]", { 0xE9, 0xF6, 0x5E, 0xA6, 0x02, 0xA4, 0x42, 0x96, 0x6B, 0xE4, 0xDD, 0xCE, 0x79, 0x9A, 0x8E, 0x20 }, NULL, NULL, 0x09A0A6E5, 0x8396630D, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Rush 2 - Extreme Racing USA (U) [!]", { 0x6A, 0x92, 0x5A, 0xB6, 0x24, 0xEE, 0x3B, 0x34, 0x32, 0x31, 0xD7, 0x99, 0x73, 0x3B, 0xA8, 0x98 }, NULL, NULL, 0xEDD6E031, 0x68136013, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "S.C.A.R.S. (E) (M3) [!]", { 0x7E, 0xD3, 0xF1, 0x0B, 0xC3, 0x2C, 0xF7, 0x6F, 0x17, 0x2D, 0x8C, 0x31, 0xD1, 0x5A, 0x27, 0x99 }, NULL, NULL, 0x918E2D60, 0xF865683E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "S.C.A.R.S. (E) (M3) [h1C]", { 0x0D, 0xC8, 0x0A, 0xDC, 0xD9, 0x5A, 0xF4, 0xFC, 0x8F, 0xE2, 0xC7, 0xE6, 0x48, 0xCA, 0x64, 0xF0 }, NULL, NULL, 0x918E2D60, 0xF865683E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "S.C.A.R.S. (U) [!]", { 0xD0, 0xAA, 0x9D, 0x20, 0xA4, 0xB8, 0x5F, 0xE5, 0x14, 0xD2, 0xA3, 0x15, 0x0D, 0x01, 0x33, 0xEA }, NULL, NULL, 0x769147F3, 0x2033C10E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "S.C.A.R.S. (U) [f1] (PAL)", { 0xD0, 0xA0, 0x50, 0xE8, 0x6E, 0x27, 0x12, 0x6F, 0xD7, 0x32, 0x4B, 0x56, 0x74, 0xA3, 0x07, 0x64 }, NULL, NULL, 0x8954584D, 0xEFE71E95, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "S.C.A.R.S. (U) [t1]", { 0x40, 0x86, 0x6B, 0xBE, 0x16, 0x29, 0xE9, 0xB1, 0x70, 0xDE, 0x55, 0x2A, 0xCA, 0x83, 0xD9, 0x67 }, NULL, NULL, 0x8954A655, 0x3B38F292, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "SD Hiryuu no Ken Densetsu (J) [!]", { 0x63, 0x7A, 0x7E, 0xA2, 0xA3, 0x9F, 0x20, 0xC5, 0xB2, 0x08, 0x34, 0x18, 0x72, 0x30, 0xD8, 0x9D }, NULL, NULL, 0xEBF5F6B7, 0xC956D739, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "SD Hiryuu no Ken Densetsu (J) [f1] (PAL)", { 0xF2, 0x9A, 0x0A, 0x02, 0xC4, 0x18, 0x15, 0xEE, 0x3F, 0x54, 0x37, 0xE4, 0x09, 0xEC, 0x32, 0x7B }, NULL, NULL, 0xEBF5F6B7, 0xC956D739, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "SLiDeS (PD)", { 0x52, 0xFD, 0x60, 0x26, 0x8A, 0x69, 0xDC, 0x7B, 0x53, 0x2A, 0xD5, 0x8E, 0xDD, 0x21, 0x33, 0xC0 }, NULL, NULL, 0x5BBE6E34, 0x088B6D0E, 2, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "SNES 9X Alpha by Loom-Crazy Nation (PD) [f1] (V64BIOS1.91)", { 0xF3, 0x23, 0xE3, 0x80, 0x7A, 0x6A, 0xED, 0xED, 0xEA, 0xC9, 0xE0, 0x73, 0x94, 0x90, 0xD1, 0x3C }, NULL, NULL, 0xCA69ECE5, 0x13A88244, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SNES 9X Alpha by Loom-Crazy Nation (PD)", { 0x29, 0xE8, 0x75, 0xC7, 0xFF, 0xA4, 0x4C, 0xA6, 0x29, 0xF2, 0x57, 0x6C, 0xB4, 0x7A, 0x10, 0x20 }, NULL, NULL, 0xCA69ECE5, 0x13A88244, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SPLiT's Nacho64 by SPLiT (PD)", { 0x91, 0x9A, 0x27, 0xC2, 0xAB, 0xBE, 0xA8, 0x3B, 0xA9, 0x96, 0xCE, 0xE5, 0x53, 0x22, 0x79, 0x29 }, NULL, NULL, 0x1FBD27A9, 0x6CC3EB42, 3, SAVETYPE_NONE, 0, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "SPLiT's Nacho64 by SPLiT (PD) [f1] (PAL)", { 0xA6, 0x39, 0x21, 0xB3, 0x19, 0x0C, 0x45, 0x94, 0x07, 0x21, 0xBA, 0x3A, 0xC6, 0x4D, 0x11, 0x14 }, NULL, NULL, 0x1899FF33, 0x885180E6, 3, SAVETYPE_NONE, 0, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "SRAM Manager V1.0 Beta (32Mbit) (PD) [a1]", { 0x12, 0x34, 0x17, 0x81, 0x1C, 0xDC, 0x49, 0x11, 0x8E, 0xB0, 0x1E, 0xCF, 0x76, 0xBA, 0xF7, 0x60 }, NULL, NULL, 0x029CAE05, 0x2B8F9DF1, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SRAM Manager V1.0 Beta (32Mbit) (PD)", { 0x89, 0x1E, 0x4A, 0x11, 0xB6, 0xF8, 0x0E, 0x31, 0xA2, 0xF2, 0x47, 0xFE, 0xA3, 0x73, 0x07, 0x44 }, NULL, NULL, 0x029CAE05, 0x2B8F9DF1, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SRAM Manager V1.0 Beta (PD)", { 0x98, 0xA5, 0xDB, 0xA8, 0x96, 0x68, 0x5D, 0x86, 0xA0, 0x7C, 0xEE, 0xA2, 0x83, 0xFD, 0x36, 0xD3 }, NULL, NULL, 0x029CAE05, 0x2B8F9DF1, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SRAM Manager V1.0 PAL Beta (PD)", { 0x57, 0xBE, 0xB4, 0xB0, 0xAF, 0xDD, 0x4A, 0xFA, 0xDE, 0x9D, 0xB6, 0xA1, 0x3B, 0x72, 0xD1, 0x7D }, NULL, NULL, 0x4DEC9986, 0xA8904450, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SRAM Manager V2.0 (PD) [a1]", { 0xED, 0x46, 0xA8, 0x67, 0xA6, 0x48, 0xA1, 0x01, 0xD2, 0x39, 0xDA, 0x06, 0x50, 0xB4, 0x97, 0x83 }, NULL, NULL, 0x4E5507F2, 0xE7D3B413, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SRAM Manager V2.0 (PD) [h1C]", { 0x65, 0x78, 0x36, 0xF5, 0x5D, 0xCB, 0x95, 0x2C, 0x56, 0xBC, 0x5C, 0x64, 0x5D, 0x82, 0xD6, 0xC2 }, NULL, NULL, 0x4E5507F2, 0xE7D3B413, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SRAM Manager V2.0 (PD) [h2C]", { 0x2E, 0x83, 0x67, 0xED, 0x95, 0x72, 0x48, 0x16, 0x64, 0x61, 0x31, 0xBA, 0xD4, 0x80, 0xBD, 0xD2 }, NULL, NULL, 0x4E5507F2, 0xE7D3B413, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SRAM Manager V2.0 (PD)", { 0x59, 0x7A, 0xDB, 0x97, 0x02, 0x44, 0x0E, 0x72, 0xD5, 0x95, 0x4D, 0x50, 0x67, 0x1D, 0x9C, 0x57 }, NULL, NULL, 0x4E5507F2, 0xE7D3B413, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SRAM Upload Tool (PD)", { 0x00, 0xF8, 0x46, 0xA9, 0xAA, 0x9E, 0x00, 0x83, 0xCE, 0x8C, 0x0E, 0x56, 0x68, 0x43, 0xA7, 0xC7 }, NULL, NULL, 0x98A2BB11, 0xEE4D4A86, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SRAM Upload Tool + Star Fox 64 SRAM (PD)", { 0x2F, 0xA1, 0xAC, 0x0A, 0x98, 0x9D, 0x5F, 0x08, 0x1D, 0x6A, 0x87, 0x33, 0xF2, 0x33, 0x09, 0x23 }, NULL, NULL, 0x3C524346, 0xE4ABE776, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SRAM Upload Tool V1 by LaC (PD)", { 0x10, 0x35, 0x92, 0xE6, 0x5C, 0x65, 0x46, 0x4C, 0x14, 0x1A, 0x21, 0x84, 0xDB, 0xFD, 0x09, 0x47 }, NULL, NULL, 0x3B8E7E01, 0x6AE876A8, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SRAM Upload Tool V1.1 by Lac (PD) [b1]", { 0x71, 0xC2, 0xE6, 0x6C, 0xCE, 0x1F, 0xEC, 0x92, 0x9B, 0x54, 0x85, 0xAC, 0x41, 0xA6, 0x1D, 0x95 }, NULL, NULL, 0x98A2BB11, 0xEE4D4A86, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SRAM Upload Tool V1.1 by Lac (PD)", { 0x2B, 0x21, 0x86, 0xA3, 0x8B, 0x0B, 0x35, 0x41, 0xC3, 0x22, 0x71, 0x44, 0xEA, 0x3C, 0x71, 0xA3 }, NULL, NULL, 0x3C524346, 0xE4ABE776, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SRAM Uploader-Editor by BlackBag (PD)", { 0xF2, 0x61, 0x02, 0x59, 0x0A, 0xA6, 0x98, 0x2E, 0xA7, 0x87, 0x01, 0xE6, 0xA4, 0x18, 0xBE, 0xD0 }, NULL, NULL, 0xEC9BECFF, 0xCAB83632, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SRAM to DS1 Tool by WT_Riker (PD)", { 0xA5, 0xC1, 0xF8, 0xAF, 0x5D, 0x9A, 0xA7, 0xD2, 0xC7, 0x71, 0xDA, 0x1C, 0x84, 0x84, 0x10, 0x17 }, NULL, NULL, 0x52BA5D2A, 0x9BE3AB78, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Saikyou Habu Shougi (J) [!]", { 0xC4, 0xE4, 0x72, 0x28, 0x70, 0x6B, 0xC7, 0x24, 0xD7, 0xFB, 0xD8, 0x11, 0x23, 0x1D, 0x20, 0xC9 }, NULL, NULL, 0x5E3E60E8, 0x4AB5D495, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Saikyou Habu Shougi (J) [h1C]", { 0xD9, 0x2E, 0xEB, 0xA8, 0x77, 0x94, 0x31, 0x1C, 0x8F, 0x44, 0x43, 0xC2, 0x9C, 0xC1, 0x77, 0xC5 }, NULL, NULL, 0x5E3E60E8, 0x4AB5D495, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Saikyou Habu Shougi (J) [h2C]", { 0x0F, 0x20, 0x5B, 0xA6, 0xB6, 0x63, 0xC3, 0xC3, 0x15, 0x79, 0x89, 0x48, 0x73, 0xCA, 0xFA, 0x66 }, NULL, NULL, 0x5E3E60E8, 0x4AB5D495, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Saikyou Habu Shougi (J) [h3C]", { 0x95, 0xC3, 0x45, 0xEE, 0x26, 0x4F, 0x3A, 0x91, 0xF1, 0x38, 0x1E, 0x76, 0xCA, 0xD8, 0x2F, 0x11 }, NULL, NULL, 0x5E3E60E8, 0x4AB5D495, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Saikyou Habu Shougi (J) [h4C]", { 0x34, 0xF6, 0x23, 0x90, 0x3C, 0x3E, 0x2D, 0xBF, 0x8F, 0xB1, 0xE4, 0x7F, 0x68, 0x8D, 0x18, 0x59 }, NULL, NULL, 0x5E3E60E8, 0x4AB5D495, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Sample Demo by Florian (PD) [b1]", { 0x63, 0x0A, 0x17, 0x7A, 0x8D, 0x5B, 0x60, 0x3F, 0x8C, 0x86, 0xD8, 0xA0, 0x89, 0xE3, 0x47, 0x1B }, NULL, NULL, 0xC541EAB4, 0x7397CB5F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Sample Demo by Florian (PD)", { 0x2F, 0x81, 0x09, 0xE5, 0xC9, 0xBC, 0xC4, 0x5B, 0x99, 0x87, 0xF3, 0x1E, 0xA0, 0x0E, 0xCA, 0x66 }, NULL, NULL, 0xC541EAB4, 0x7397CB5F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "San Francisco Rush - Extreme Racing (E) (M3) [!]", { 0x81, 0xB1, 0x12, 0x2E, 0xE1, 0x5F, 0x7B, 0x50, 0xA3, 0x41, 0xAE, 0x62, 0xE9, 0xC5, 0x71, 0x6B }, NULL, NULL, 0x61D116B0, 0xFA24D60C, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "San Francisco Rush - Extreme Racing (E) (M3) [h1C]", { 0x4F, 0xDF, 0x9E, 0x70, 0x2D, 0x4A, 0x6A, 0x75, 0x12, 0x46, 0x23, 0xD9, 0x43, 0x4B, 0xF9, 0x9F }, NULL, NULL, 0x61D116B0, 0xFA24D60C, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "San Francisco Rush - Extreme Racing (U) (M3) (V1.0) [!]", { 0xF0, 0x15, 0xFC, 0x28, 0xE1, 0xD6, 0x2A, 0x36, 0xB4, 0xEB, 0xF4, 0xC7, 0x9C, 0xA8, 0xF2, 0x85 }, NULL, NULL, 0x2A6B1820, 0x6ABCF466, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "San Francisco Rush - Extreme Racing (U) (M3) (V1.0) [b1]", { 0x2A, 0x80, 0x86, 0x94, 0x53, 0x75, 0x82, 0x6F, 0xA6, 0x49, 0x5F, 0x1E, 0xF2, 0xF1, 0xDF, 0xB6 }, NULL, NULL, 0x2A6B1820, 0x6ABCF466, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "San Francisco Rush - Extreme Racing (U) (M3) (V1.0) [b2]", { 0xC8, 0x70, 0x96, 0x74, 0x73, 0xA8, 0xBD, 0x29, 0x42, 0xD0, 0x0E, 0xAA, 0x3D, 0x7C, 0xCC, 0x9E }, NULL, NULL, 0x2A6B1820, 0x6ABCF466, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "San Francisco Rush - Extreme Racing (U) (M3) (V1.0) [b3]", { 0xCF, 0xD1, 0xB1, 0x23, 0xBB, 0xAB, 0xF1, 0x65, 0x8C, 0xA6, 0xD5, 0x2F, 0x34, 0x43, 0x4A, 0x1E }, NULL, NULL, 0x2A6B1820, 0x6ABCF466, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "San Francisco Rush - Extreme Racing (U) (M3) (V1.0) [o1]", { 0xAD, 0x92, 0x1B, 0x13, 0x36, 0xED, 0xA4, 0x06, 0xD1, 0x24, 0x94, 0x0B, 0xED, 0x17, 0x44, 0x65 }, NULL, NULL, 0x2A6B1820, 0x6ABCF466, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "San Francisco Rush - Extreme Racing (U) (M3) (V1.0) [o2]", { 0x39, 0x0F, 0xC4, 0x66, 0x21, 0x58, 0x1F, 0xA6, 0x2F, 0x7F, 0x4C, 0xC3, 0x53, 0x7F, 0x25, 0x5D }, NULL, NULL, 0x2A6B1820, 0x6ABCF466, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "San Francisco Rush - Extreme Racing (U) (M3) (V1.0) [o3]", { 0x90, 0xCA, 0x5D, 0x19, 0xB7, 0xF0, 0x85, 0x47, 0x4E, 0xBD, 0x21, 0x86, 0xD7, 0x0C, 0x59, 0xAF }, NULL, NULL, 0x2A6B1820, 0x6ABCF466, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "San Francisco Rush - Extreme Racing (U) (M3) (V1.1) [!]", { 0x5B, 0x12, 0x7E, 0x6B, 0x09, 0x0A, 0x0B, 0x3F, 0x68, 0xA1, 0x14, 0xD4, 0xD8, 0x93, 0x23, 0xD4 }, NULL, NULL, 0xAC9F7DA7, 0xA8C029D8, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "San Francisco Rush 2049 (E) (M6) [!]", { 0x02, 0xB1, 0x6A, 0xC2, 0x39, 0x98, 0xF7, 0x8F, 0x09, 0xAF, 0x65, 0x13, 0xF4, 0xAC, 0xB6, 0x64 }, NULL, NULL, 0x51D29418, 0xD5B46AE3, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "San Francisco Rush 2049 (U) [!]", { 0xAF, 0x5B, 0xE0, 0xAD, 0xFF, 0x51, 0xA8, 0xE9, 0xC6, 0xD7, 0x71, 0x28, 0x2C, 0x29, 0x58, 0x10 }, NULL, NULL, 0xB9A9ECA2, 0x17AAE48E, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "San Francisco Rush 2049 (U) [t1]", { 0x19, 0x77, 0xD6, 0x3B, 0x51, 0x1A, 0x90, 0x06, 0x28, 0xDB, 0x2A, 0x3A, 0x10, 0x41, 0x60, 0xAC }, NULL, NULL, 0x01D66F37, 0x365F18B3, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Scooby-Doo! - Classic Creep Capers (E) [!]", { 0x3B, 0x6D, 0xD7, 0xB6, 0x04, 0x37, 0x23, 0x48, 0x95, 0x50, 0x0B, 0xEF, 0xF2, 0x8D, 0xF6, 0xD6 }, NULL, NULL, 0xE3BD221D, 0x3C0834D3, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Scooby-Doo! - Classic Creep Capers (U) (V1.0) [!]", { 0x16, 0xCC, 0x6D, 0xB1, 0x0A, 0x56, 0x33, 0x1B, 0x56, 0xF3, 0x74, 0xB4, 0xFB, 0x25, 0x4D, 0x5E }, NULL, NULL, 0x0C814EC4, 0x58FE5CA8, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Scooby-Doo! - Classic Creep Capers (U) (V1.1) [!]", { 0x01, 0xCD, 0x99, 0x38, 0xDA, 0xE5, 0xDC, 0xDD, 0x4B, 0x26, 0x4A, 0xE7, 0xF2, 0x6C, 0x6D, 0x4D }, NULL, NULL, 0x569433AD, 0xF7E13561, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Shadow Man (B) [!]", { 0xFE, 0x26, 0x05, 0x19, 0x37, 0x36, 0xA1, 0x28, 0xAD, 0x65, 0xDB, 0x1C, 0x98, 0x35, 0xA1, 0x30 }, NULL, NULL, 0x93A625B9, 0x2D6022E6, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Shadow Man (E) (M3) [!]", { 0xA4, 0x85, 0xA6, 0xE9, 0xE3, 0x0B, 0x7D, 0x55, 0xD2, 0x3D, 0x8D, 0xD0, 0x43, 0x77, 0x0C, 0x64 }, NULL, NULL, 0x60C437E5, 0xA2251EE3, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Shadow Man (F) [!]", { 0x23, 0x55, 0x11, 0xBB, 0xDB, 0x21, 0xAF, 0x5A, 0x76, 0x7B, 0xDB, 0x75, 0x02, 0xA8, 0x0F, 0x06 }, NULL, NULL, 0xEA06F8C3, 0x07C2DEED, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Shadow Man (G) [!]", { 0xAF, 0x40, 0xEF, 0x12, 0xCE, 0x92, 0x3F, 0xF1, 0xC2, 0x6E, 0x76, 0xCC, 0x9D, 0x9B, 0x9E, 0xD9 }, NULL, NULL, 0x84D5FD75, 0xBBFD3CDF, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Shadow Man (G) [b1]", { 0xCF, 0xBD, 0xC1, 0xC5, 0xE4, 0x19, 0xFF, 0x16, 0x2D, 0xF0, 0x2A, 0x00, 0x65, 0xD9, 0xBC, 0x1D }, NULL, NULL, 0x84D5FD75, 0xBBFD3CDF, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Shadow Man (G) [b2]", { 0x63, 0x07, 0x76, 0xE4, 0x78, 0xE0, 0x0C, 0xDA, 0x1D, 0x09, 0xBA, 0xB5, 0x56, 0x56, 0xAC, 0xA7 }, NULL, NULL, 0x84D5FD75, 0xBBFD3CDF, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Shadow Man (G) [f1] (NTSC)", { 0x08, 0x02, 0xF5, 0xBB, 0x40, 0x04, 0xD8, 0x94, 0x8A, 0x6C, 0x0B, 0x51, 0xC8, 0x85, 0x7B, 0x74 }, NULL, NULL, 0x720278EC, 0x594B7975, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Shadow Man (U) [!]", { 0xB4, 0x57, 0x29, 0x8B, 0x87, 0xB8, 0x5B, 0xBF, 0x95, 0x0F, 0x24, 0x86, 0x7D, 0xAA, 0x94, 0x75 }, NULL, NULL, 0x3A4760B5, 0x2D74D410, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Shadow Man (U) [b1]", { 0x47, 0x46, 0x47, 0xAE, 0xDF, 0xA9, 0x5A, 0xEF, 0x73, 0x22, 0x9A, 0x27, 0x84, 0x89, 0x7E, 0xDD }, NULL, NULL, 0x3A4760B5, 0x2D74D410, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Shadow Man (U) [b2]", { 0x5A, 0xE3, 0xBB, 0x36, 0x04, 0x53, 0x9A, 0xBD, 0xEB, 0xA6, 0x39, 0xE5, 0x89, 0x2B, 0xD6, 0x0E }, NULL, NULL, 0x3A4760B5, 0x2D74D410, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Shadow Man (U) [b3]", { 0x22, 0xA6, 0x89, 0xC9, 0x7F, 0xAE, 0xDF, 0x39, 0xA8, 0xF1, 0x15, 0xDB, 0x8F, 0x71, 0x83, 0x0C }, NULL, NULL, 0x82342320, 0xBC65A550, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Shadow Man (U) [t1]", { 0xC7, 0x68, 0x28, 0x84, 0x06, 0x68, 0xB6, 0xF3, 0xD4, 0x67, 0x0C, 0xF4, 0xAD, 0x89, 0xC4, 0xAA }, NULL, NULL, 0x82342320, 0xBC65A550, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Shadowgate 64 - Trials Of The Four Towers (E) (M2) (Ita-Spa) [!]", { 0xA0, 0x6E, 0x75, 0x7C, 0xF1, 0x93, 0x0B, 0x29, 0xFA, 0x4C, 0x0B, 0x5C, 0x9F, 0x31, 0x33, 0x5F }, NULL, NULL, 0x02B46F55, 0x61778D0B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Shadowgate 64 - Trials Of The Four Towers (E) (M3) (Fre-Ger-Dut) [!]", { 0x11, 0x16, 0x9A, 0x32, 0xD4, 0x49, 0xEC, 0x3A, 0x89, 0x03, 0xCA, 0x8A, 0x9D, 0x69, 0xA6, 0xAA }, NULL, NULL, 0x2BC1FCF2, 0x7B9A0DF4, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Shadowgate 64 - Trials Of The Four Towers (E) [!]", { 0xE8, 0x95, 0x5C, 0x3B, 0x74, 0x3F, 0xDD, 0xFE, 0x40, 0x3E, 0x52, 0xE7, 0x69, 0xE9, 0x85, 0x3F }, NULL, NULL, 0xD84EEA84, 0x45B2F1B4, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Shadowgate 64 - Trials Of The Four Towers (E) [f1] (NTSC)", { 0x55, 0x82, 0xCF, 0x3B, 0xB6, 0xE6, 0xB1, 0x1D, 0x6D, 0x97, 0xF6, 0xFD, 0xD1, 0xEE, 0x9A, 0x3B }, NULL, NULL, 0x80203B94, 0x57B7F424, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Shadowgate 64 - Trials Of The Four Towers (J) [b1]", { 0xC4, 0xF4, 0xCA, 0x4F, 0xFA, 0x94, 0xA8, 0x70, 0xD0, 0xA3, 0xE1, 0x8B, 0x74, 0xFE, 0x9F, 0xDE }, NULL, NULL, 0xCCEDB696, 0xD3883DB4, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Shadowgate 64 - Trials Of The Four Towers (J) [b2]", { 0x66, 0xC3, 0x1F, 0x31, 0xA3, 0x86, 0x32, 0x0F, 0x61, 0xAA, 0xF8, 0xF5, 0xF7, 0x93, 0x60, 0x53 }, NULL, NULL, 0xCCEDB696, 0xD3883DB4, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Shadowgate 64 - Trials Of The Four Towers (J) [!]", { 0x19, 0x60, 0xA3, 0x87, 0x9F, 0xAD, 0xF2, 0xC5, 0xEF, 0xF5, 0xBE, 0xB4, 0x7E, 0x0E, 0x14, 0x41 }, NULL, NULL, 0xCCEDB696, 0xD3883DB4, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Shadowgate 64 - Trials Of The Four Towers (U) (M2) [!]", { 0x40, 0x7A, 0x1A, 0x18, 0xBD, 0x7D, 0xBE, 0x04, 0x85, 0x32, 0x92, 0x96, 0xC3, 0xF8, 0x4E, 0xB8 }, NULL, NULL, 0x036897CE, 0xE0D4FA54, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Shadowgate 64 - Trials Of The Four Towers (U) (M2) [f1] (PAL)", { 0x3B, 0x21, 0x99, 0x6F, 0x8C, 0x64, 0x96, 0x90, 0x3C, 0x01, 0xDC, 0xBD, 0x77, 0xDD, 0xD6, 0xEE }, NULL, NULL, 0x015BB81E, 0xF105AC82, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Shadowgate 64 - Trials Of The Four Towers (U) (M2) [f2] (PAL)", { 0x3D, 0x8F, 0x43, 0x80, 0x57, 0xCB, 0x98, 0xF3, 0xC9, 0xE1, 0x47, 0x2A, 0xBF, 0xF6, 0x16, 0x10 }, NULL, NULL, 0x123D0F44, 0xCF60A446, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Shag'a'Delic Demo by Steve and NEP (PD)", { 0xF6, 0xB0, 0xE5, 0x75, 0x12, 0xFD, 0xDD, 0x06, 0x34, 0x5D, 0xD4, 0x1B, 0x7C, 0x73, 0xB2, 0x28 }, NULL, NULL, 0x9D9C362D, 0x5BE66B08, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Itoi Shigesato no Bass Tsuri No. 1 Kettei Ban! (J) [!]", { 0x13, 0x89, 0x3D, 0xB9, 0xE9, 0x19, 0xC4, 0xE7, 0xCF, 0x0C, 0x0B, 0x00, 0x64, 0xCC, 0xB5, 0x54 }, NULL, NULL, 0xD137A2CA, 0x62B65053, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x73 },
+    { "Itoi Shigesato no Bass Tsuri No. 1 Kettei Ban! (J) [b1]", { 0x16, 0xEC, 0x78, 0x8C, 0x8A, 0x4E, 0x7E, 0xEE, 0x26, 0x8F, 0xDF, 0x90, 0x72, 0xA4, 0xF0, 0xD4 }, NULL, NULL, 0xD137A2CA, 0x62B65053, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x73 },
+    { "Shin Nihon Pro Wrestling - Toukon Road - Brave Spirits (J) [!]", { 0x13, 0xD9, 0x51, 0x4A, 0x4D, 0x20, 0x8D, 0xC6, 0xC7, 0xB0, 0xC8, 0x33, 0xF6, 0x81, 0x14, 0xD2 }, NULL, NULL, 0xEF703CA4, 0x4D4A9AC9, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Shin Nihon Pro Wrestling - Toukon Road - Brave Spirits (J) [b1]", { 0xDC, 0x1A, 0x78, 0x60, 0x8B, 0x19, 0xDB, 0xE2, 0xAE, 0x3D, 0xC0, 0xCA, 0xD9, 0xB7, 0x94, 0x72 }, NULL, NULL, 0xEF703CA4, 0x4D4A9AC9, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Shin Nihon Pro Wrestling - Toukon Road 2 - The Next Generation (J) [!]", { 0x11, 0x30, 0x44, 0xB1, 0x6B, 0x75, 0xF9, 0x87, 0x92, 0xBF, 0x9C, 0x20, 0xC6, 0xB6, 0x28, 0x2B }, NULL, NULL, 0x551C7F43, 0x9149831C, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Shuffle Puck 64 (PD)", { 0x37, 0x14, 0x9C, 0x40, 0x64, 0xA1, 0xD1, 0x20, 0xB9, 0xF4, 0xF5, 0x48, 0x2A, 0x91, 0x52, 0x62 }, NULL, NULL, 0xF7DF7D0D, 0xED52018F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Sim City 2000 (J) [!]", { 0x24, 0x4B, 0xEA, 0x64, 0xEA, 0x20, 0x99, 0x90, 0xE9, 0xC6, 0x9A, 0x83, 0x0B, 0x50, 0x71, 0x35 }, NULL, NULL, 0xB1D5280C, 0x4BA7BC2A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Sim City 2000 (J) [b1]", { 0xFD, 0x2D, 0x06, 0xE5, 0x9B, 0xF1, 0x7A, 0x1B, 0xD1, 0xDA, 0x98, 0x45, 0x4F, 0x83, 0xAB, 0x0D }, NULL, NULL, 0xB1D5280C, 0x4BA7BC2A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Sim City 2000 (J) [b1][o1]", { 0xF0, 0xAD, 0x16, 0xAA, 0x47, 0x25, 0x88, 0x18, 0xD3, 0x20, 0xA5, 0x21, 0x7F, 0x2E, 0x6B, 0x1E }, NULL, NULL, 0xB1D5280C, 0x4BA7BC2A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Sim City 2000 (J) [b2]", { 0xA6, 0x98, 0xB3, 0x41, 0x96, 0x00, 0xE7, 0xE2, 0x83, 0xAA, 0x13, 0x13, 0xFB, 0x25, 0x22, 0xCF }, NULL, NULL, 0xB1D5280C, 0x4BA7BC2A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Sim City 2000 (J) [h1C]", { 0x65, 0xFC, 0x73, 0xD7, 0xAB, 0xFF, 0xAB, 0xAF, 0xFF, 0x3C, 0x35, 0xFF, 0x3C, 0xB6, 0x0D, 0xE2 }, NULL, NULL, 0xB1D5280C, 0x4BA7BC2A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Sim City 2000 (J) [o1]", { 0x13, 0x74, 0x71, 0xD6, 0x7D, 0xC8, 0x84, 0x78, 0x15, 0xE3, 0x27, 0xA7, 0x3E, 0xA3, 0x00, 0x68 }, NULL, NULL, 0xB1D5280C, 0x4BA7BC2A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Sim City 2000 (J) [o1][h1C]", { 0x97, 0x3D, 0xE8, 0x7C, 0xFC, 0x38, 0x35, 0x32, 0x59, 0xF3, 0xB1, 0xF6, 0x67, 0x8F, 0xEB, 0x76 }, NULL, NULL, 0xB1D5280C, 0x4BA7BC2A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Sim City 64 (J) [CART HACK]", { 0xA0, 0xE6, 0xFB, 0x49, 0x3B, 0x57, 0xC2, 0xFA, 0xEE, 0x8E, 0x51, 0x7E, 0x03, 0x30, 0xC2, 0x3E }, NULL, NULL, 0x909535F8, 0x118FEF8F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Simon for N64 V0.1a by Jean-Luc Picard (POM '99) (PD)", { 0x3E, 0x6F, 0xF3, 0x6A, 0xE5, 0x9F, 0x92, 0x61, 0xED, 0x27, 0x5F, 0xEA, 0xBB, 0xF7, 0x6C, 0xED }, NULL, NULL, 0x18531B7D, 0x074AF73E, 1, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x40F },
+    { "Sinus (PD)", { 0xF7, 0xF4, 0x49, 0x96, 0xDD, 0x11, 0x40, 0x46, 0x9C, 0x6C, 0x86, 0x6D, 0xA0, 0xAF, 0xFA, 0xD7 }, NULL, NULL, 0xC603175E, 0xACADF5EC, 3, SAVETYPE_NONE, 0, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Sitero Demo by Renderman (PD)", { 0x31, 0x94, 0xC6, 0x52, 0x08, 0x04, 0x7C, 0x93, 0x8E, 0xF4, 0x43, 0x32, 0x5E, 0x1E, 0x73, 0xC1 }, NULL, NULL, 0x9A6CF2F5, 0xD5F365EE, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "SmashRemix0.9.4", { 0x5A, 0xAC, 0x6E, 0x65, 0x2C, 0x5C, 0xF1, 0xE3, 0x7A, 0x46, 0x6A, 0xC0, 0x07, 0x3E, 0x88, 0xCA }, NULL, NULL, 0x1B5AAD82, 0x368B88C1, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "SmashRemix0.9.5b", { 0x98, 0x3F, 0x8A, 0x1D, 0x9A, 0x8D, 0x6A, 0xA1, 0xA6, 0x50, 0x0A, 0xF4, 0x13, 0xCE, 0x31, 0xFF }, NULL, NULL, 0xB9CDC5C3, 0x0D2F4668, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "SmashRemix0.9.7", { 0xD8, 0xD0, 0x2E, 0x6F, 0x92, 0x0E, 0x95, 0x04, 0x70, 0x71, 0xE0, 0x44, 0x20, 0xBB, 0x7D, 0x8F }, NULL, NULL, 0x9D2B9C7F, 0x6D90A8EF, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "SmashRemix1.0.0", { 0x8E, 0xC2, 0x99, 0x58, 0xE0, 0xE3, 0xEB, 0x8C, 0x20, 0xAB, 0x7C, 0x9B, 0x3A, 0xCB, 0x07, 0xD8 }, NULL, NULL, 0xFD0E716E, 0xFB029C8E, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "SmashRemix1.0.1", { 0x0A, 0x67, 0x15, 0xA8, 0x09, 0x57, 0xDD, 0x7C, 0x58, 0xF1, 0x2E, 0x1F, 0x33, 0xD7, 0x5F, 0x43 }, NULL, NULL, 0xFDFC3328, 0xA0B2BA23, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "SmashRemix1.1.0", { 0xD8, 0xAB, 0x93, 0x2A, 0xFD, 0x1C, 0xED, 0x97, 0xAC, 0xD3, 0x3F, 0xA9, 0x84, 0xB3, 0x09, 0xED }, NULL, NULL, 0xFB816989, 0x6F442541, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "SmashRemix1.1.1", { 0x70, 0xA6, 0x17, 0x72, 0xB2, 0x12, 0x38, 0x79, 0x36, 0x70, 0x11, 0xA5, 0xE2, 0x90, 0x05, 0x69 }, NULL, NULL, 0xFB816D35, 0x3FC67AFF, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "SmashRemix1.2.0", { 0x44, 0xDE, 0x1F, 0x9E, 0xD1, 0xFA, 0x35, 0xB7, 0x2D, 0x31, 0xA1, 0xF8, 0x09, 0x28, 0x5B, 0x01 }, NULL, NULL, 0xA1BFF9C9, 0x8FB192A2, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Snobow Kids (J) [!]", { 0xB8, 0xD4, 0xB9, 0x2E, 0x66, 0xA3, 0x12, 0x70, 0x86, 0x26, 0xB3, 0x21, 0x6D, 0xE0, 0x7A, 0x3A }, NULL, NULL, 0x84FC04FF, 0xB1253CE9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Snobow Kids (J) [h1C]", { 0xA2, 0x91, 0x29, 0xB8, 0xC0, 0x44, 0xD8, 0xA8, 0x25, 0xF7, 0xF3, 0x78, 0x01, 0x53, 0xFC, 0xC7 }, NULL, NULL, 0x84FC04FF, 0xB1253CE9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Snobow Kids (J) [h2C]", { 0x43, 0x79, 0xC2, 0x6B, 0xF0, 0x67, 0xF7, 0x16, 0x1B, 0xC6, 0x62, 0x94, 0x45, 0xE2, 0x21, 0x88 }, NULL, NULL, 0x84FC04FF, 0xB1253CE9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Snow Speeder (J) [!]", { 0xF7, 0xE6, 0x6D, 0xA2, 0x3C, 0x8B, 0xB8, 0xE5, 0x9F, 0x64, 0x1A, 0x63, 0x6A, 0x9C, 0xAE, 0x82 }, NULL, NULL, 0x2EF4D519, 0xC64A0C5E, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Snow Speeder (J) [b1]", { 0xF0, 0xFE, 0x97, 0x33, 0x38, 0xC7, 0x17, 0x0D, 0x54, 0xCB, 0x41, 0x60, 0x2B, 0x9D, 0x48, 0xA3 }, NULL, NULL, 0x2EF4D519, 0xC64A0C5E, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Snowboard Kids (E) [!]", { 0xAB, 0x43, 0x82, 0xE5, 0x83, 0xAE, 0x13, 0x9E, 0xED, 0xBA, 0xFC, 0xE5, 0xFA, 0x87, 0xE4, 0xC8 }, NULL, NULL, 0x5FD7CDA0, 0xD9BB51AD, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Snowboard Kids (E) [h1C]", { 0x55, 0xD1, 0x3D, 0xC1, 0x51, 0x2B, 0x1A, 0x36, 0x56, 0xDB, 0x81, 0x30, 0xE5, 0x9E, 0x31, 0xD2 }, NULL, NULL, 0x5FD7CDA0, 0xD9BB51AD, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Snowboard Kids (U) [!]", { 0xEB, 0x31, 0xF4, 0xF9, 0xC1, 0xFE, 0x26, 0xA3, 0xA6, 0x63, 0xF7, 0x4E, 0x97, 0x90, 0x51, 0x6E }, NULL, NULL, 0xDBF4EA9D, 0x333E82C0, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Snowboard Kids (U) [b1]", { 0xFB, 0x1F, 0x9F, 0x09, 0x3F, 0x60, 0x81, 0xE5, 0x69, 0x5F, 0x68, 0x8B, 0x9E, 0xFD, 0x40, 0x95 }, NULL, NULL, 0xDBF4EA9D, 0x333E82C0, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Snowboard Kids (U) [b2]", { 0x4B, 0x69, 0x14, 0xD5, 0x55, 0x2E, 0x4F, 0xF3, 0x48, 0xFB, 0x59, 0x0D, 0x52, 0xA6, 0xDF, 0x8A }, NULL, NULL, 0xDBF4EA9D, 0x333E82C0, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Snowboard Kids (U) [b3]", { 0x34, 0x9F, 0xF1, 0xB4, 0xAE, 0x28, 0xE3, 0x1A, 0x2B, 0x2D, 0xC9, 0x3D, 0x76, 0xA5, 0x21, 0x9E }, NULL, NULL, 0xDBF4EA9D, 0x333E82C0, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Snowboard Kids (U) [h1C]", { 0x75, 0x9D, 0xF0, 0xAD, 0xF7, 0xF7, 0x8D, 0x60, 0x3A, 0xD3, 0x44, 0xC8, 0x9F, 0x36, 0x0E, 0x32 }, NULL, NULL, 0xDBF4EA9D, 0x333E82C0, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Snowboard Kids (U) [t1]", { 0x64, 0x1A, 0x65, 0x13, 0xE4, 0xFE, 0x77, 0xB8, 0x80, 0x85, 0x47, 0x8F, 0x99, 0xF1, 0x85, 0x7D }, NULL, NULL, 0xA1E78A63, 0x022A67C9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Snowboard Kids 2 (E) [!]", { 0x47, 0xB5, 0xE3, 0x95, 0x5D, 0x54, 0xF9, 0x69, 0x94, 0x15, 0x33, 0xF2, 0x66, 0x91, 0xAB, 0x38 }, NULL, NULL, 0xC2751D1A, 0xF8C19BFF, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Snowboard Kids 2 (U) [!]", { 0x08, 0xE1, 0x15, 0x2E, 0x9D, 0x97, 0x42, 0xE9, 0xBB, 0xF6, 0xC2, 0x24, 0xB6, 0x95, 0x8F, 0x2D }, NULL, NULL, 0x930C29EA, 0x939245BF, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Snowboard Kids 2 (U) [f1] (PAL)", { 0x22, 0xC7, 0xFC, 0xDB, 0xC7, 0x4D, 0xE2, 0x37, 0xE0, 0xFC, 0x77, 0x78, 0xD8, 0xA6, 0xE6, 0x71 }, NULL, NULL, 0xD3DF2FEE, 0x8090B699, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Snowboard Kids 2 (U) [f2] (PAL)", { 0x83, 0x5B, 0x14, 0x9A, 0x0A, 0x31, 0x22, 0x62, 0xA6, 0x9D, 0xAA, 0x01, 0x07, 0x28, 0xA8, 0x25 }, NULL, NULL, 0xD3DF2FEE, 0x8090B699, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Soncrap Intro by RedboX (PD)", { 0xB7, 0x24, 0x0C, 0xAD, 0xA8, 0x5A, 0x35, 0xB6, 0xC8, 0x72, 0xA8, 0x65, 0xF6, 0xA0, 0x18, 0xA1 }, NULL, NULL, 0xAAA66229, 0x98CA5CAA, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Sonic Wings Assault (J) [!]", { 0x7D, 0x47, 0x91, 0x1B, 0x5C, 0x3D, 0x91, 0xA3, 0x03, 0xEF, 0x19, 0xE7, 0x64, 0xF3, 0xC0, 0x2B }, NULL, NULL, 0x22212351, 0x4046594B, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "South Park (B) [!]", { 0xD3, 0x13, 0xAF, 0x5F, 0x8A, 0xF4, 0xD1, 0x9F, 0x73, 0x2A, 0x1A, 0x2C, 0x4D, 0x4D, 0x66, 0xBB }, NULL, NULL, 0xD21AF769, 0xDE1A0E3D, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "South Park (E) (M3) [!]", { 0x40, 0xCC, 0x20, 0x85, 0xA5, 0xC1, 0x24, 0x56, 0xBE, 0xF8, 0x30, 0xB0, 0x47, 0x06, 0x83, 0x26 }, NULL, NULL, 0x20B53662, 0x7B61899F, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "South Park (E) (M3) [b1]", { 0x26, 0xC9, 0x9A, 0x52, 0x88, 0x62, 0x34, 0x27, 0x91, 0x19, 0x3C, 0xA6, 0xAA, 0xAC, 0xC9, 0xDD }, NULL, NULL, 0x20B53662, 0x7B61899F, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "South Park (E) (M3) [h1C]", { 0x7C, 0x63, 0xBF, 0x48, 0x0D, 0x1F, 0x84, 0xFC, 0x2C, 0x0D, 0x4A, 0x95, 0x91, 0x54, 0xFA, 0x27 }, NULL, NULL, 0x20B53662, 0x7B61899F, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "South Park (G) [!]", { 0x2C, 0x94, 0xA2, 0x46, 0xE7, 0x01, 0xD6, 0x67, 0xBA, 0x80, 0x7D, 0xAB, 0x6C, 0x97, 0x71, 0xE2 }, NULL, NULL, 0x91B66D42, 0x16AC4E46, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "South Park (U) [!]", { 0x17, 0x30, 0x11, 0x9B, 0x04, 0x55, 0xEF, 0x89, 0xC4, 0xE4, 0x95, 0xDE, 0xC8, 0xE9, 0x50, 0xA5 }, NULL, NULL, 0x7ECBE939, 0x3C331795, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "South Park (U) [b1]", { 0xBE, 0x22, 0xC6, 0xB9, 0x55, 0x53, 0xB9, 0xCD, 0x5E, 0x09, 0x34, 0xB6, 0x6B, 0xC3, 0x6C, 0x84 }, NULL, NULL, 0x7ECBE939, 0x3C331795, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "South Park (U) [f1] (PAL)", { 0x69, 0x17, 0xDE, 0xEE, 0xBC, 0x2F, 0xA9, 0xE1, 0x85, 0x58, 0x22, 0x15, 0xE7, 0x46, 0x02, 0x71 }, NULL, NULL, 0x42EDB4BB, 0xDEA42760, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "South Park (U) [t1]", { 0xAC, 0x52, 0x78, 0x1C, 0x22, 0x4E, 0x9E, 0xB0, 0xB8, 0xF4, 0x08, 0xA7, 0x82, 0xFA, 0xC2, 0x2A }, NULL, NULL, 0x018CF733, 0x5409AD45, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "South Park - Chef's Luv Shack (E) [!]", { 0xF1, 0xAE, 0x48, 0xB7, 0x78, 0xC8, 0x43, 0x1A, 0x50, 0xC3, 0x7E, 0xB1, 0xED, 0x96, 0xB1, 0x20 }, NULL, NULL, 0xC00CA948, 0x8E60D34B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "South Park - Chef's Luv Shack (U) [!]", { 0x6A, 0xF5, 0x73, 0xEB, 0x05, 0x56, 0x48, 0xA8, 0x54, 0x2A, 0xA8, 0x2D, 0x95, 0x24, 0xFB, 0x2F }, NULL, NULL, 0xC00CA948, 0x8E60D34B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "South Park - Chef's Luv Shack (U) [f1] (Country Check)", { 0xFE, 0x2A, 0xA2, 0x69, 0xFD, 0x3E, 0xC8, 0x1C, 0x35, 0x88, 0x45, 0xBB, 0xA6, 0xCA, 0x01, 0x67 }, NULL, NULL, 0xC19EA928, 0x226B2610, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "South Park Rally (E) [!]", { 0xC3, 0x3F, 0xA0, 0x27, 0x91, 0x07, 0x7A, 0x71, 0xB0, 0xAF, 0xE1, 0xCF, 0xED, 0x47, 0xC1, 0x80 }, NULL, NULL, 0x4F8AFC3A, 0xF7912DF2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "South Park Rally (U) [!]", { 0x1C, 0x49, 0x47, 0x19, 0x03, 0x2F, 0xF9, 0x93, 0x82, 0xB1, 0x67, 0xC4, 0x3F, 0xB1, 0x17, 0x62 }, NULL, NULL, 0x07F3B276, 0xEC8F3D39, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "South Park Rally (U) [f1] (PAL)", { 0xCD, 0x17, 0x38, 0x8E, 0x17, 0x5B, 0xCF, 0x0F, 0x62, 0x1E, 0xE9, 0x31, 0x3D, 0x5A, 0x1C, 0x8D }, NULL, NULL, 0xA4C8852A, 0xE512045C, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "South Park Rally (U) [t1]", { 0x5D, 0xA2, 0xC2, 0x24, 0x80, 0xA3, 0xF6, 0xFE, 0x9B, 0xEF, 0x9C, 0x6A, 0xD4, 0x85, 0x2D, 0x37 }, NULL, NULL, 0xBE37CDC8, 0xA88CB420, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "South Park Rally (U) [t2]", { 0xDD, 0xA7, 0xAA, 0x9C, 0x5D, 0x1E, 0x61, 0x7D, 0xA1, 0x83, 0x75, 0x0F, 0x82, 0xB5, 0x57, 0x80 }, NULL, NULL, 0xBE37CDC8, 0xA88CB420, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Space Dynamites (J) [!]", { 0x7F, 0x9C, 0xDB, 0xBB, 0x1A, 0xAA, 0xAF, 0x09, 0x83, 0xC6, 0x49, 0x88, 0xEF, 0x9C, 0x58, 0xBE }, NULL, NULL, 0x37463412, 0xEAC5388D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Space Dynamites (J) [b1]", { 0x19, 0xBA, 0x66, 0xFE, 0xE0, 0x88, 0x18, 0x1B, 0xBB, 0x0A, 0xCA, 0x68, 0x94, 0xBB, 0x89, 0x71 }, NULL, NULL, 0x37463412, 0xEAC5388D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Space Invaders (U) [!]", { 0xC7, 0x24, 0x17, 0xE0, 0xF8, 0xF0, 0x43, 0xF9, 0xF1, 0x18, 0x51, 0x63, 0x3C, 0x4B, 0x1A, 0x57 }, NULL, NULL, 0xEBFE2397, 0xFF74DA34, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Space Invaders (U) [f1] (PAL)", { 0x63, 0xFA, 0x04, 0xC3, 0x0C, 0x4A, 0x0F, 0xBE, 0x16, 0x2B, 0xCD, 0xEC, 0x3C, 0xB4, 0x28, 0x88 }, NULL, NULL, 0x00EDCC34, 0x75D2DEA0, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Space Invaders (U) [t1]", { 0x8C, 0x87, 0x83, 0x0F, 0xF2, 0x58, 0x89, 0x3C, 0x45, 0x3D, 0x70, 0xA9, 0x0F, 0x62, 0x01, 0x9F }, NULL, NULL, 0x33828616, 0x933456E0, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Space Invaders (U) [t2]", { 0x4E, 0xE1, 0xDC, 0x95, 0x3B, 0x1F, 0xF2, 0x09, 0x81, 0x1C, 0xF2, 0x80, 0x8D, 0x78, 0xF0, 0x64 }, NULL, NULL, 0x138D7E56, 0x72BCC9D9, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Space Station Silicon Valley (E) (M7) [!]", { 0xFC, 0xA7, 0xAF, 0xCA, 0xDC, 0xF5, 0xE5, 0x54, 0x5A, 0x62, 0x91, 0x9B, 0xA9, 0x4D, 0xAD, 0x18 }, NULL, NULL, 0xFC70E272, 0x08FFE7AA, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Space Station Silicon Valley (E) (M7) [b1]", { 0x59, 0x19, 0x37, 0x1B, 0xCA, 0x05, 0x3C, 0x75, 0x0D, 0x1C, 0xB3, 0x57, 0xC5, 0x89, 0x53, 0xA5 }, NULL, NULL, 0xFC70E272, 0x08FFE7AA, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Space Station Silicon Valley (J) [!]", { 0xE6, 0x6E, 0xD1, 0xCC, 0x4A, 0xB9, 0x5D, 0x08, 0x72, 0xBB, 0x2E, 0xBC, 0x49, 0xB2, 0x06, 0xC4 }, NULL, NULL, 0xBFE23884, 0xEF48EAAF, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Space Station Silicon Valley (U) [!]", { 0x86, 0x8B, 0x37, 0xD1, 0xB6, 0x6D, 0x1D, 0x99, 0x4E, 0x2B, 0xAD, 0x4E, 0x21, 0x8B, 0xF1, 0x29 }, NULL, NULL, 0xBFE23884, 0xEF48EAAF, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Space Station Silicon Valley (U) [f1] (PAL)", { 0x4A, 0x8F, 0x8E, 0xBB, 0x93, 0xAF, 0x51, 0x87, 0x8C, 0x8F, 0xB9, 0x05, 0x7A, 0xD5, 0xF4, 0x3C }, NULL, NULL, 0x47F09853, 0x29CCE24F, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Space Station Silicon Valley (U) [f2] (PAL)", { 0x7A, 0xE0, 0xBA, 0x60, 0x1F, 0xD7, 0x25, 0x14, 0xC9, 0x84, 0xBC, 0x80, 0xEE, 0x6B, 0xAB, 0x8E }, NULL, NULL, 0xBFE23884, 0xEF48EAAF, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Space Station Silicon Valley (U) (V1.1) [!]", { 0xF1, 0xF1, 0xC5, 0xE2, 0xB8, 0x95, 0xDB, 0x63, 0x34, 0x8B, 0xC7, 0x38, 0xC0, 0xCD, 0xC6, 0x45 }, NULL, NULL, 0xFC70E272, 0x08FFE7AA, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Spacer by Memir (POM '99) (PD)", { 0x63, 0x0E, 0x41, 0x22, 0xB0, 0x74, 0x3A, 0x29, 0xC2, 0x46, 0xDA, 0x2C, 0x25, 0x7F, 0x92, 0xDA }, NULL, NULL, 0xA3A044B5, 0x6DB1BF5E, 3, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5F },
+    { "Spacer by Memir (POM '99) (PD) [t1]", { 0x3A, 0x6A, 0x24, 0x98, 0x43, 0xDD, 0xEA, 0xFF, 0xFD, 0x33, 0x4A, 0xB3, 0xC5, 0x93, 0x1F, 0x8D }, NULL, NULL, 0x1B6FAB59, 0x99199038, 3, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5F },
+    { "Spacer by Memir (POM '99) (PD) [t2]", { 0xA8, 0xE8, 0xAD, 0x9B, 0x1A, 0x05, 0x20, 0x50, 0x85, 0xDC, 0xB4, 0xEA, 0xDB, 0xE3, 0x80, 0x20 }, NULL, NULL, 0x1B6FAB59, 0x99199038, 3, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5F },
+    { "Spacer by Memir (POM '99) (PD) [t2][b1]", { 0xE8, 0xD7, 0x0E, 0x02, 0x1C, 0x40, 0x07, 0x8F, 0x8A, 0x82, 0x31, 0x8A, 0xE8, 0x16, 0x5A, 0x73 }, NULL, NULL, 0x1B6FAB59, 0x99199038, 3, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5F },
+    { "Spice Girls Rotator Demo by RedboX (PD) [a1]", { 0x44, 0xD7, 0xF3, 0xFC, 0x23, 0x42, 0x89, 0x13, 0xD1, 0x0E, 0x68, 0x01, 0x7A, 0xCB, 0x09, 0x7F }, NULL, NULL, 0x8F5179C4, 0x803526DC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Spice Girls Rotator Demo by RedboX (PD)", { 0x19, 0x34, 0x61, 0x8C, 0x99, 0xA7, 0x0D, 0xD8, 0xE7, 0x43, 0x05, 0xC6, 0xDB, 0x06, 0xCA, 0xF3 }, NULL, NULL, 0x8F5179C4, 0x803526DC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Spider-Man (U) [!]", { 0x7F, 0x19, 0x91, 0xB8, 0x86, 0x1E, 0x7E, 0x53, 0x2E, 0xC2, 0x1E, 0xCF, 0x2A, 0xF8, 0x21, 0x91 }, NULL, NULL, 0xA60ED171, 0x3D85D06E, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Spider-Man (U) [t1]", { 0x8C, 0x5D, 0x52, 0x22, 0x9D, 0xA5, 0xA2, 0x23, 0xEA, 0x2D, 0xA0, 0x93, 0xA5, 0xB9, 0xD3, 0x1B }, NULL, NULL, 0x3E6250B2, 0x12F5155C, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Split! 3D Demo by Lem (PD)", { 0x04, 0x1C, 0xE6, 0x11, 0x6C, 0x56, 0x0C, 0x23, 0x90, 0x23, 0xEF, 0xB8, 0x87, 0x05, 0xDA, 0x94 }, NULL, NULL, 0x60B8BCC9, 0x2EC4DFB6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Sporting Clays by Charles Doty (PD)", { 0x51, 0x5C, 0x86, 0x48, 0x0A, 0x7F, 0xC1, 0x23, 0x8B, 0xFE, 0x25, 0x2B, 0xD2, 0xC5, 0x3B, 0x36 }, NULL, NULL, 0xE584FE34, 0x9D91B1E2, 3, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Sporting Clays by Charles Doty (PD) [a1]", { 0x99, 0x3C, 0xCC, 0x09, 0x61, 0xCF, 0xD9, 0xF1, 0x34, 0x2A, 0xD9, 0x9A, 0x1B, 0xA2, 0xE2, 0x82 }, NULL, NULL, 0x5402C27E, 0x60021F86, 3, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Sporting Clays by Charles Doty (PD) [b1]", { 0x09, 0x4F, 0xE6, 0x0C, 0x44, 0xF3, 0x5B, 0xDC, 0x7F, 0xBE, 0x85, 0x33, 0x9E, 0x9C, 0x44, 0x70 }, NULL, NULL, 0xE584FE34, 0x9D91B1E2, 3, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Star Fox 64 (Ch) (V5) (iQue) [!]", { 0xB2, 0x24, 0x20, 0x70, 0x80, 0x0B, 0xF8, 0x2E, 0x78, 0xCE, 0x33, 0xDC, 0x92, 0xA1, 0xDB, 0x84 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Star Fox 64 (Ch) (V4) (iQue) (Manual) [!]", { 0x3D, 0xCD, 0x5E, 0x15, 0xAA, 0x35, 0xA7, 0x3C, 0x68, 0xDB, 0x4F, 0x56, 0xE2, 0x67, 0x0F, 0xA2 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Star Fox 64 (J) (V1.0) [!]", { 0x44, 0x6D, 0x52, 0x15, 0xC4, 0xD3, 0x4E, 0xB8, 0xAB, 0x0F, 0x35, 0x5F, 0x32, 0x4B, 0x8D, 0x0E }, NULL, NULL, 0xFFCAA7C1, 0x68858537, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (J) (V1.0) [f1]", { 0xC4, 0x17, 0x97, 0x23, 0xDC, 0x6E, 0x5D, 0x31, 0x9C, 0x97, 0xF2, 0xF6, 0x6A, 0xB0, 0x51, 0x62 }, NULL, NULL, 0xFFCAA7C1, 0x68858537, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (J) (V1.0) [o1]", { 0xD0, 0xDD, 0x14, 0xF1, 0x00, 0xB3, 0x82, 0x55, 0x36, 0xDB, 0x8F, 0x32, 0xC3, 0x32, 0x45, 0x7F }, NULL, NULL, 0xFFCAA7C1, 0x68858537, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (J) (V1.0) [o1][f1]", { 0xD4, 0x3D, 0x1E, 0x41, 0xDB, 0xA1, 0x7F, 0xFF, 0x92, 0x82, 0x9F, 0xD2, 0x49, 0x5B, 0x76, 0x19 }, NULL, NULL, 0xFFCAA7C1, 0x68858537, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (J) (V1.0) [o2][f1]", { 0x0C, 0x9F, 0x7F, 0xA5, 0x4C, 0xA3, 0x6B, 0xFC, 0x6D, 0x8B, 0xE4, 0x18, 0x7E, 0x4A, 0xBD, 0x99 }, NULL, NULL, 0xFFCAA7C1, 0x68858537, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (J) (V1.0) [o3][f1]", { 0xB7, 0x4F, 0x70, 0x65, 0x4B, 0x2F, 0xE3, 0xFC, 0x57, 0x3D, 0x3B, 0xC9, 0x13, 0xA6, 0x22, 0x68 }, NULL, NULL, 0xFFCAA7C1, 0x68858537, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (J) (V1.0) [t1] (Boost)", { 0xAF, 0x8A, 0x5A, 0x43, 0x7F, 0x28, 0x6F, 0xA2, 0x30, 0xD9, 0x95, 0x07, 0x10, 0x9C, 0x79, 0xD9 }, NULL, NULL, 0x305AB328, 0xF72F632A, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (J) (V1.0) [t2] (No Damage-Unbreakable Wings)", { 0x5E, 0x3B, 0x1F, 0xAC, 0x7C, 0x16, 0xD3, 0x04, 0x99, 0xB3, 0xFA, 0xA3, 0x6C, 0xAF, 0x98, 0xFD }, NULL, NULL, 0x1180A247, 0xEBE234B3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (J) (V1.1) (VC) [!]", { 0x91, 0xFC, 0x4C, 0x63, 0xCA, 0x61, 0x35, 0x30, 0xDF, 0x22, 0xC8, 0xBB, 0x81, 0x0C, 0xB2, 0xC3 }, NULL, NULL, 0x65AEDEEF, 0x3857C728, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.0) [!]", { 0xCA, 0xF9, 0xA7, 0x8D, 0xB1, 0x3E, 0xE0, 0x00, 0x02, 0xFF, 0x63, 0xA3, 0xC0, 0xC5, 0xEA, 0xBB }, NULL, NULL, 0xA7D015F8, 0x2289AA43, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.0) [f1]", { 0x56, 0x53, 0xB6, 0xDD, 0xAE, 0x32, 0x8C, 0x87, 0x01, 0x38, 0xE7, 0x1E, 0xC3, 0x01, 0x22, 0xA1 }, NULL, NULL, 0xA7D015F8, 0x2289AA43, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.0) [f1][h1C]", { 0xEC, 0xB9, 0x18, 0x41, 0x42, 0xD2, 0x88, 0xB4, 0x0B, 0xCD, 0x19, 0x8F, 0xB1, 0x91, 0xA2, 0x75 }, NULL, NULL, 0xA7D015F8, 0x2289AA43, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.0) [f1][o1]", { 0xE5, 0x66, 0xD5, 0x86, 0x41, 0xBE, 0xDD, 0x25, 0xC4, 0x50, 0xE4, 0x43, 0x60, 0x8E, 0xB4, 0x6E }, NULL, NULL, 0xA7D015F8, 0x2289AA43, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.0) [f2] (PAL)", { 0xD8, 0x1F, 0xFD, 0x06, 0x31, 0x1A, 0xB9, 0x33, 0x48, 0x58, 0xCC, 0xC2, 0x8E, 0xFE, 0x99, 0x2A }, NULL, NULL, 0xCBD83828, 0x6FDEBEDC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.0) [h1C]", { 0x70, 0x52, 0xF9, 0xC1, 0xBE, 0x69, 0xB1, 0x03, 0xD6, 0xBE, 0x3D, 0xE6, 0x1A, 0x94, 0xF8, 0x61 }, NULL, NULL, 0xA7D015F8, 0x2289AA43, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.0) [o1][f1]", { 0x80, 0xE9, 0xD3, 0x9B, 0x21, 0xE5, 0x37, 0xFF, 0x53, 0xFD, 0x36, 0x2B, 0x72, 0x72, 0xF2, 0x55 }, NULL, NULL, 0xA7D015F8, 0x2289AA43, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.0) [o2][f1]", { 0x06, 0xDB, 0x24, 0xBE, 0xFB, 0x76, 0xC0, 0x4D, 0x06, 0xD4, 0xDD, 0xC3, 0xA5, 0x0D, 0x53, 0x19 }, NULL, NULL, 0xCBD83828, 0x6FDEBEDC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.0) [o3][f1]", { 0x83, 0x1D, 0xC9, 0xEE, 0xB9, 0x11, 0x49, 0x12, 0xAB, 0xAB, 0xC1, 0x5B, 0x6B, 0x14, 0xDA, 0x4B }, NULL, NULL, 0xA7D015F8, 0x2289AA43, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.0) [t1]", { 0x23, 0xE5, 0xAF, 0x30, 0x26, 0x70, 0x36, 0xA6, 0x9A, 0x83, 0x28, 0xF0, 0x05, 0xDF, 0x07, 0xB1 }, NULL, NULL, 0xCBD83828, 0x6FDEBEDC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.0) [t2] (Boost)", { 0x3D, 0x38, 0xBC, 0xD5, 0xB5, 0x7C, 0xEE, 0xCB, 0x09, 0x85, 0x60, 0x9C, 0xCE, 0x94, 0x0F, 0xFA }, NULL, NULL, 0x1B80E202, 0xCB5AE74F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.0) [t3] (No Damage-Unbreakable Wings)", { 0x63, 0xCE, 0x29, 0xBB, 0xA1, 0x30, 0xAA, 0xCD, 0x05, 0x40, 0x2E, 0xFC, 0x06, 0xC0, 0xDC, 0x89 }, NULL, NULL, 0xF6621BFB, 0x186D11A6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.1) [!]", { 0x74, 0x1A, 0x94, 0xEE, 0xE0, 0x93, 0xC4, 0xC8, 0x68, 0x4E, 0x66, 0xB8, 0x9F, 0x86, 0x85, 0xE8 }, NULL, NULL, 0xBA780BA0, 0x0F21DB34, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.1) [t1] (Energy)", { 0xF0, 0xCD, 0x3B, 0x2D, 0xB0, 0xF2, 0x0F, 0xFD, 0xD6, 0x4B, 0xF0, 0x81, 0x17, 0x6E, 0xB4, 0x21 }, NULL, NULL, 0xC3CA0BA3, 0x25397DC8, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Fox 64 (U) (V1.1) [t2] (Boost)", { 0xFF, 0xA5, 0x62, 0x93, 0x6D, 0xB8, 0x63, 0xEA, 0x02, 0x20, 0x4F, 0x9F, 0x51, 0x4B, 0x60, 0x67 }, NULL, NULL, 0x8264014A, 0x3C9FBFC1, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Soldier - Vanishing Earth (J) [!]", { 0x14, 0xA2, 0x19, 0x28, 0xBE, 0x46, 0xC1, 0x8B, 0xA0, 0x41, 0x61, 0x30, 0x5E, 0x89, 0xF5, 0xDE }, NULL, NULL, 0xB703EB23, 0x28AAE53A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Soldier - Vanishing Earth (J) [b1]", { 0x56, 0x5D, 0xA8, 0xD5, 0x34, 0x22, 0xF1, 0x62, 0x07, 0xEC, 0xF1, 0x1A, 0x81, 0xD2, 0xE6, 0x49 }, NULL, NULL, 0xB703EB23, 0x28AAE53A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Soldier - Vanishing Earth (J) [h1C]", { 0x00, 0x6C, 0xAF, 0xEC, 0x9B, 0xA1, 0x30, 0x60, 0xD4, 0xD2, 0xF0, 0xBE, 0x21, 0x10, 0x81, 0xBD }, NULL, NULL, 0xB703EB23, 0x28AAE53A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Soldier - Vanishing Earth (J) [o1]", { 0x97, 0x27, 0x5F, 0x65, 0x85, 0x54, 0x74, 0x62, 0xA7, 0x39, 0x10, 0xE9, 0xA8, 0x0E, 0x40, 0x67 }, NULL, NULL, 0xB703EB23, 0x28AAE53A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Soldier - Vanishing Earth (J) [t1]", { 0xCD, 0x40, 0xD9, 0xDD, 0x23, 0x8E, 0x23, 0xAD, 0x79, 0xDC, 0x44, 0x84, 0xF7, 0x7A, 0x7C, 0x4A }, NULL, NULL, 0x31100ADC, 0x86E97D63, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Soldier - Vanishing Earth (U) [!]", { 0xEE, 0x04, 0x5A, 0x2E, 0x9F, 0x92, 0x4C, 0xD8, 0xFD, 0x00, 0x01, 0x8B, 0x50, 0xE4, 0x66, 0x50 }, NULL, NULL, 0xDDD93C85, 0xDAE381E8, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Soldier - Vanishing Earth (U) [t1]", { 0xA6, 0x8B, 0x65, 0xE6, 0xB4, 0xBC, 0x97, 0x6A, 0xD9, 0xDE, 0xAB, 0x33, 0x5D, 0xE3, 0xBF, 0x70 }, NULL, NULL, 0xDDD982EF, 0x3B0D6FEC, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Soldier - Vanishing Earth Arcade (Aleck64)", { 0x05, 0x29, 0x54, 0x2D, 0xE0, 0x79, 0x43, 0x16, 0x32, 0x0C, 0xF9, 0x9E, 0xA8, 0x0C, 0x51, 0xB7 }, NULL, NULL, 0x315C7466, 0x3A453265, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xB },
+    { "Star Twins (J) [!]", { 0xCA, 0x28, 0xA3, 0x64, 0x5F, 0xC7, 0xAD, 0x96, 0x9E, 0xBD, 0x75, 0xC5, 0xD6, 0x50, 0x6E, 0x7A }, NULL, NULL, 0xF163A242, 0xF2449B3B, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars - Rogue Squadron (E) (M3) (V1.0) [!]", { 0x7F, 0x91, 0x9D, 0x2E, 0x35, 0xCB, 0xE5, 0x61, 0xE1, 0x39, 0xAE, 0x8F, 0xE9, 0x3A, 0xCA, 0x86 }, NULL, NULL, 0x7EE0E8BB, 0x49E411AA, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars - Rogue Squadron (E) (M3) (V1.0) (Language Select Hack)", { 0xE1, 0x37, 0x6F, 0x9B, 0x15, 0x1E, 0xE3, 0xDA, 0x3E, 0x8E, 0xD5, 0x2D, 0x97, 0x04, 0x80, 0xEF }, NULL, NULL, 0x7EE0E945, 0x7D8FEE20, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars - Rogue Squadron (E) (M3) (V1.0) [t1]", { 0x23, 0x1F, 0x61, 0xE0, 0xD6, 0x6A, 0x70, 0xB1, 0x73, 0xBB, 0x22, 0x67, 0x2E, 0xE6, 0x7B, 0xD6 }, NULL, NULL, 0x5E6508BB, 0xF321C996, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars - Rogue Squadron (E) (M3) (V1.1) [!]", { 0xA9, 0xDD, 0x49, 0x8E, 0x6A, 0x28, 0xF5, 0x53, 0x11, 0xCE, 0x4E, 0xF0, 0x57, 0xE1, 0x64, 0xB8 }, NULL, NULL, 0x219191C1, 0x33183C61, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars - Rogue Squadron (U) (M3) (V1.0) [!]", { 0x47, 0xCA, 0xC4, 0xE2, 0xA6, 0x30, 0x94, 0x58, 0x34, 0x2F, 0x21, 0xA9, 0x01, 0x8F, 0xFB, 0xF0 }, NULL, NULL, 0x66A24BEC, 0x2EADD94F, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars - Rogue Squadron (U) (M3) (V1.0) [b1]", { 0x05, 0x83, 0xAD, 0x9F, 0xDD, 0x1E, 0x3D, 0x10, 0x07, 0x6A, 0xAB, 0x40, 0xE5, 0xB4, 0xE7, 0xBB }, NULL, NULL, 0x66A24BEC, 0x2EADD94F, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars - Rogue Squadron (U) (M3) (V1.0) [h1] (Language Select)", { 0x65, 0x60, 0xFF, 0xC9, 0x20, 0x8A, 0x31, 0xF0, 0x51, 0x80, 0x36, 0xF7, 0x93, 0x7B, 0x53, 0xDA }, NULL, NULL, 0x66A24A12, 0x22AF6AC2, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars - Rogue Squadron (U) (M3) (V1.0) [t1]", { 0x49, 0x03, 0xC3, 0x90, 0x07, 0xAE, 0xAC, 0xC1, 0x13, 0xFE, 0x0E, 0x9E, 0x4B, 0xBE, 0x47, 0x11 }, NULL, NULL, 0x165CBDA2, 0x05A62246, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars - Rogue Squadron (U) (M3) (V1.1) [!]", { 0x2E, 0x45, 0x8D, 0x7C, 0xC3, 0x55, 0xD7, 0x91, 0x84, 0x93, 0xB0, 0xE0, 0x36, 0x2C, 0x9A, 0x20 }, NULL, NULL, 0xC7F30CFA, 0xECB0FA36, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars - Shadows of the Empire (E) [!]", { 0x59, 0x1C, 0xF8, 0xE6, 0x72, 0xC9, 0xCC, 0x0F, 0xE9, 0xC8, 0x71, 0xCC, 0x56, 0xDC, 0xC8, 0x54 }, NULL, NULL, 0x4D486681, 0xAB7D9245, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (E) [b1]", { 0x81, 0x87, 0x37, 0x33, 0x8B, 0x3F, 0x1D, 0x87, 0xB7, 0xE1, 0xB7, 0xFB, 0x55, 0x05, 0x7B, 0xB5 }, NULL, NULL, 0x4D486681, 0xAB7D9245, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (E) [b2]", { 0xE8, 0x33, 0x25, 0xEC, 0x6E, 0x85, 0x20, 0xB0, 0xCB, 0xDB, 0x49, 0xB5, 0x24, 0x18, 0xFE, 0x4E }, NULL, NULL, 0x4D486681, 0xAB7D9245, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (E) [b3]", { 0x64, 0xE5, 0x9B, 0xA2, 0xF7, 0xBA, 0x4D, 0xAF, 0xFD, 0xD5, 0x93, 0x4F, 0x81, 0x8D, 0xC7, 0xDA }, NULL, NULL, 0x4D486681, 0xAB7D9245, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (E) [b4]", { 0x55, 0x4B, 0xFC, 0xC8, 0x57, 0xBE, 0x49, 0xB2, 0xAA, 0xCD, 0x07, 0x7E, 0x60, 0x59, 0xB2, 0x81 }, NULL, NULL, 0x4D486681, 0xAB7D9245, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (E) [o1]", { 0x30, 0xBD, 0xF5, 0x40, 0x5A, 0x8C, 0x61, 0x5D, 0xC9, 0x24, 0xDB, 0x94, 0x80, 0xE9, 0x96, 0xB7 }, NULL, NULL, 0x4D486681, 0xAB7D9245, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (Prototype)", { 0x40, 0x76, 0x97, 0x3C, 0xFD, 0xA2, 0x77, 0xFC, 0x87, 0x6E, 0x9F, 0x06, 0x6C, 0xC7, 0x3D, 0xEB }, NULL, NULL, 0xFB315F95, 0x7786CBFB, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Star Wars - Shadows of the Empire (U) (V1.0) [!]", { 0x5C, 0xCE, 0x8A, 0xD5, 0xF8, 0x6E, 0x8A, 0x37, 0x3A, 0x75, 0x25, 0xDC, 0x4C, 0x7E, 0x67, 0x05 }, NULL, NULL, 0x264D7E5C, 0x18874622, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (V1.0) [b1]", { 0xC8, 0x86, 0x37, 0xDC, 0xC7, 0xA0, 0x0F, 0xED, 0x62, 0x97, 0xB6, 0x1E, 0x79, 0xCF, 0x75, 0xA9 }, NULL, NULL, 0xBC3C9F6C, 0x93B3CB13, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (V1.0) [b2]", { 0xC6, 0x8C, 0xB2, 0x60, 0xA7, 0xFD, 0x8D, 0x17, 0x76, 0x40, 0xFA, 0x48, 0x7D, 0xCC, 0xAC, 0xF6 }, NULL, NULL, 0xBDA75F12, 0xBDDC1661, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (V1.0) [o1]", { 0x75, 0x27, 0xB9, 0x05, 0x43, 0xE3, 0xD6, 0x04, 0x2A, 0x72, 0x61, 0x98, 0x18, 0xB4, 0x71, 0x45 }, NULL, NULL, 0x264D7E5C, 0x18874622, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (V1.0) [t1]", { 0xC6, 0x9F, 0xA8, 0x2E, 0x2C, 0xA2, 0x46, 0x00, 0x00, 0xC6, 0x29, 0xE9, 0xD4, 0x6D, 0x4D, 0xC2 }, NULL, NULL, 0xBC3C9F6C, 0x93B3CB13, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (V1.0) [t2]", { 0xF8, 0x90, 0x6B, 0x10, 0xBA, 0xE3, 0x63, 0xAC, 0xB1, 0x70, 0xFA, 0x84, 0x1A, 0x88, 0xE9, 0x6C }, NULL, NULL, 0xBDA75F12, 0xBDDC1661, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (V1.1) [!]", { 0xFA, 0x63, 0x5E, 0x83, 0x72, 0x75, 0xD2, 0x8F, 0xD5, 0xA2, 0x4D, 0x56, 0x75, 0xBA, 0x42, 0xC8 }, NULL, NULL, 0x4147B091, 0x63251060, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (V1.1) [b1]", { 0xE8, 0xEE, 0x7D, 0x44, 0x85, 0x8C, 0x1A, 0xB9, 0x0C, 0x1F, 0x48, 0xA6, 0x49, 0xDC, 0x98, 0xB6 }, NULL, NULL, 0xD3E792A5, 0x05D39C97, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (V1.1) [o1]", { 0x64, 0xB4, 0xFB, 0x2D, 0x4C, 0x49, 0xAE, 0x69, 0x02, 0xF1, 0x31, 0x49, 0xC8, 0x1C, 0xF2, 0xA1 }, NULL, NULL, 0x4147B091, 0x63251060, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (V1.1) [t1]", { 0x7B, 0xC0, 0x8E, 0xAF, 0x55, 0xA6, 0x45, 0xDE, 0x92, 0x26, 0x61, 0x7C, 0x3F, 0x83, 0xB1, 0x9F }, NULL, NULL, 0xD3E792A5, 0x05D39C97, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (V1.2) [!]", { 0xC7, 0xB4, 0x03, 0x52, 0xAA, 0xD8, 0xD8, 0x63, 0xD8, 0x8D, 0x51, 0x67, 0x2F, 0x9A, 0x00, 0x87 }, NULL, NULL, 0x4DD7ED54, 0x74F9287D, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (V1.2) [b1]", { 0x3F, 0xE2, 0xB3, 0x8E, 0x18, 0x15, 0x21, 0x62, 0xA3, 0x4E, 0x30, 0x02, 0xDE, 0xA0, 0x71, 0xF7 }, NULL, NULL, 0xD3E792A5, 0x05D39C97, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (V1.2) [b2]", { 0x3B, 0xD4, 0xEE, 0x76, 0xD4, 0xCB, 0xB1, 0x4D, 0x69, 0xBA, 0x62, 0x85, 0x33, 0xBD, 0x7C, 0xBC }, NULL, NULL, 0xD3E792A5, 0x05D39C97, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (V1.2) [o1]", { 0xCD, 0x2C, 0x0D, 0xFD, 0xAC, 0x55, 0x72, 0x98, 0x8A, 0xAB, 0x98, 0xD1, 0x25, 0xEE, 0xEB, 0x53 }, NULL, NULL, 0x4DD7ED54, 0x74F9287D, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shadows of the Empire (U) (Unl)", { 0x4E, 0x12, 0xB9, 0x76, 0x90, 0x89, 0x74, 0x65, 0xA2, 0x7B, 0xDF, 0x0D, 0xDA, 0x72, 0x28, 0x26 }, NULL, NULL, 0x1C5EE088, 0xD32A963D, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Shutsugeki! Rogue Chuutai (J) [!]", { 0x86, 0x03, 0xB1, 0x80, 0xE7, 0x0B, 0x2A, 0x72, 0xEF, 0x77, 0xD4, 0x6C, 0x2B, 0xEC, 0x22, 0x34 }, NULL, NULL, 0x827E4890, 0x958468DC, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars - Teikoku no Kage (J) [!]", { 0x5B, 0x6B, 0x6B, 0x0C, 0x8C, 0x9A, 0x40, 0x28, 0x6D, 0xCF, 0x61, 0x70, 0x6B, 0x6A, 0x05, 0xCB }, NULL, NULL, 0xFE24AC63, 0x1B41AA17, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Teikoku no Kage (J) [o1]", { 0xB5, 0xFD, 0xFD, 0xF2, 0x6E, 0x1F, 0x27, 0xEA, 0xF0, 0xBD, 0x84, 0x9C, 0xAA, 0x4C, 0xC3, 0xB8 }, NULL, NULL, 0xFE24AC63, 0x1B41AA17, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars - Teikoku no Kage (J) [o2]", { 0x22, 0x2F, 0x1E, 0x75, 0xF7, 0x0A, 0x65, 0x4B, 0x64, 0x23, 0x82, 0x98, 0x9E, 0x02, 0x47, 0x49 }, NULL, NULL, 0xFE24AC63, 0x1B41AA17, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Star Wars Episode I - Battle for Naboo (E) [!]", { 0x0B, 0xD1, 0xF7, 0xBB, 0x9F, 0x4B, 0x02, 0x52, 0x0E, 0x4E, 0x92, 0x85, 0xC8, 0x09, 0xF0, 0x99 }, NULL, NULL, 0xEAE6ACE2, 0x020B4384, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Star Wars Episode I - Battle for Naboo (U) [!]", { 0x3C, 0xB8, 0x8B, 0x93, 0x45, 0x72, 0xE7, 0x52, 0x0F, 0x35, 0xE5, 0x45, 0x87, 0x98, 0x77, 0x5B }, NULL, NULL, 0x3D02989B, 0xD4A381E2, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Star Wars Episode I - Battle for Naboo (U) [b1]", { 0xB4, 0x72, 0x41, 0x20, 0xC2, 0x69, 0xA1, 0xDC, 0x86, 0x99, 0x1D, 0x34, 0xB1, 0x56, 0x1F, 0x3D }, NULL, NULL, 0x3D02989B, 0xD4A381E2, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Star Wars Episode I - Battle for Naboo (U) [t1]", { 0x24, 0xE6, 0xE0, 0x64, 0x45, 0x4D, 0xE9, 0x9C, 0x88, 0xEB, 0xA9, 0xF8, 0xC3, 0x57, 0x4A, 0xF3 }, NULL, NULL, 0xFD8F6875, 0x42608FDC, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Star Wars Episode I - Racer (E) (M3) [!]", { 0x6E, 0xF9, 0xFE, 0xD3, 0x09, 0xF2, 0x8B, 0xD5, 0x9B, 0x60, 0x5F, 0x12, 0x88, 0x69, 0xAA, 0x00 }, NULL, NULL, 0x53ED2DC4, 0x06258002, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars Episode I - Racer (E) [T+Spa1.0.2_IlDucci]", { 0x73, 0x11, 0x3A, 0xE7, 0xAA, 0xF0, 0x91, 0x1B, 0xA6, 0xA1, 0xDF, 0x13, 0x53, 0x98, 0x0D, 0x14 }, NULL, NULL, 0xE857ED95, 0x6028F9AF, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars Episode I - Racer (E) (M3) [f1] (Save)", { 0x8C, 0xC7, 0xE3, 0x19, 0x25, 0xFB, 0xFA, 0x13, 0xA5, 0x84, 0xF5, 0x29, 0xE8, 0x91, 0x22, 0x07 }, NULL, NULL, 0x166312CB, 0xC30220D2, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars Episode I - Racer (J) [!]", { 0x75, 0x79, 0xAB, 0x0E, 0x79, 0xB1, 0x01, 0x14, 0x79, 0xB8, 0x8F, 0x2B, 0xF3, 0x9D, 0x48, 0xE0 }, NULL, NULL, 0x61F5B152, 0x046122AB, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars Episode I - Racer (J) [b1]", { 0xCF, 0xA2, 0x1E, 0x43, 0xDA, 0xC5, 0x0D, 0xFF, 0x31, 0x22, 0xAB, 0xF3, 0xAF, 0x35, 0x11, 0xF8 }, NULL, NULL, 0x61F5B152, 0x046122AB, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars Episode I - Racer (U) [!]", { 0x1E, 0xE8, 0x80, 0x0A, 0x40, 0x03, 0xE7, 0xF9, 0x68, 0x8C, 0x5A, 0x35, 0xF9, 0x29, 0xD0, 0x1B }, NULL, NULL, 0x72F70398, 0x6556A98B, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars Episode I - Racer (U) [f1] (Save)", { 0xE4, 0x35, 0x3B, 0x43, 0xCB, 0x43, 0x02, 0xB7, 0xA3, 0x08, 0xA4, 0x2D, 0x6B, 0xB0, 0x44, 0x35 }, NULL, NULL, 0x86EDC3C1, 0xE983A7BF, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars Episode I - Racer (U) [t1]", { 0xD6, 0xEE, 0xD7, 0xBA, 0x15, 0xE4, 0xCF, 0x88, 0xB4, 0xD2, 0x35, 0xA0, 0x16, 0xB1, 0xC8, 0x80 }, NULL, NULL, 0xC3193C16, 0x53A19708, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars Episode I - Racer (U) [t2]", { 0x81, 0xFE, 0x5A, 0xD0, 0x31, 0x75, 0xB6, 0xF2, 0xD2, 0x3D, 0xBF, 0x5A, 0x54, 0x9B, 0x0C, 0xDA }, NULL, NULL, 0x1C37BF54, 0xAC368304, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars Episode I - Racer (U) [t3]", { 0x0B, 0xE4, 0x95, 0x8B, 0x3E, 0x8E, 0xED, 0x91, 0x63, 0x07, 0xDC, 0x9F, 0x5D, 0xE3, 0x20, 0x6D }, NULL, NULL, 0x88C79381, 0x85786A83, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars Episode I - Racer (U) [t4]", { 0xF2, 0x1C, 0x92, 0x0F, 0x0A, 0x7B, 0xF4, 0x2F, 0x80, 0xC3, 0x8C, 0x39, 0xCD, 0x61, 0xBD, 0x60 }, NULL, NULL, 0xB722133E, 0x5EECEC4D, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Star Wars Episode I - Racer (U) (Unl)", { 0x0B, 0x2B, 0x4D, 0x3C, 0x38, 0x42, 0x67, 0x63, 0x05, 0x9D, 0x68, 0xAA, 0x53, 0xB8, 0x6F, 0xDF }, NULL, NULL, 0x21CD632F, 0x8BCA2AD4, 0, SAVETYPE_EEPROM_16K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "StarCraft 64 (Beta)", { 0x3E, 0xB7, 0x32, 0xA8, 0xD0, 0x04, 0x26, 0x3A, 0xD8, 0xEB, 0x0D, 0xA5, 0x9A, 0x29, 0x58, 0x2A }, NULL, NULL, 0xBC9B2CC3, 0x4ED04DA5, 1, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "StarCraft 64 (Beta) [f1]", { 0x43, 0x2D, 0xF5, 0xEA, 0xC0, 0xBA, 0x57, 0x3C, 0x65, 0x87, 0xA5, 0xBB, 0x4E, 0x51, 0x83, 0x4A }, NULL, NULL, 0xBC9B2CC3, 0x4ED04DA5, 1, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "StarCraft 64 (Beta) [f2] (PAL)", { 0x30, 0x48, 0x6A, 0x26, 0xC7, 0xB8, 0x7C, 0xDB, 0xDB, 0x1A, 0x42, 0x14, 0x93, 0xCC, 0x74, 0x5A }, NULL, NULL, 0x036A20D8, 0xA99C4D3D, 1, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "StarCraft 64 (Beta) [f3] (Country Code)", { 0xA9, 0x68, 0x3B, 0x99, 0xE8, 0x22, 0x71, 0xDB, 0xF8, 0x4D, 0xDB, 0x59, 0x80, 0x6E, 0x94, 0x23 }, NULL, NULL, 0xBC9B2CC3, 0x4ED04DA5, 1, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "StarCraft 64 (E) [!]", { 0x72, 0xB6, 0x0F, 0xAC, 0x5E, 0xE2, 0x57, 0xFA, 0x38, 0x7B, 0x43, 0xC5, 0x76, 0x32, 0xD5, 0x0C }, NULL, NULL, 0x42CF5EA3, 0x9A1334DF, 1, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "StarCraft 64 (E) [b1]", { 0xB7, 0x59, 0x45, 0x40, 0x7D, 0x7D, 0xEA, 0x00, 0xA2, 0xA2, 0x9A, 0xD2, 0x40, 0x56, 0xA4, 0x16 }, NULL, NULL, 0x42CF5EA3, 0x9A1334DF, 1, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "StarCraft 64 (E) [f1] (NTSC)", { 0x76, 0x25, 0x43, 0xCC, 0x64, 0x09, 0xC1, 0x99, 0xFD, 0x50, 0xA3, 0xBC, 0xF5, 0x45, 0x73, 0x0D }, NULL, NULL, 0xC7501968, 0x06533B11, 1, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "StarCraft 64 (G) (Prototype)", { 0x35, 0x6A, 0x5D, 0x3D, 0x59, 0xE0, 0xAD, 0xEF, 0x6E, 0xFA, 0xE6, 0x09, 0x6F, 0xC2, 0x0F, 0x77 }, NULL, NULL, 0xFD6907F0, 0x83CBC160, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "StarCraft 64 (U) [!]", { 0x55, 0x9F, 0x71, 0xB8, 0x61, 0xF6, 0x39, 0xB6, 0x37, 0x6D, 0x89, 0x1E, 0x30, 0x23, 0x41, 0x4B }, NULL, NULL, 0x0684FBFB, 0x5D3EA8A5, 1, SAVETYPE_FLASH_RAM, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Starshot - Space Circus Fever (E) (M3) [!]", { 0xA9, 0xC3, 0x93, 0xAA, 0x23, 0x2B, 0x32, 0x79, 0x8A, 0xDF, 0x37, 0x8F, 0x43, 0x18, 0xF9, 0x9F }, NULL, NULL, 0xD89E0E55, 0xB17AA99A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Starshot - Space Circus Fever (E) (M3) [f1] (NTSC100%)", { 0xB2, 0x3B, 0xFC, 0x7D, 0xC8, 0x74, 0xDD, 0xAA, 0x20, 0x05, 0xF9, 0xAF, 0xF5, 0x9A, 0x47, 0xFF }, NULL, NULL, 0x287AAA27, 0x8C2C02D8, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Starshot - Space Circus Fever (E) (M3) [f2] (NTSC)", { 0xAA, 0x11, 0xE9, 0xE4, 0x4B, 0x40, 0x17, 0x94, 0xC3, 0x72, 0x90, 0x89, 0x6C, 0x94, 0x12, 0xAC }, NULL, NULL, 0xAD199971, 0x1075F279, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Starshot - Space Circus Fever (E) (M3) [f3] (NTSC)", { 0xBA, 0xE5, 0x18, 0xE0, 0xD4, 0x0F, 0x84, 0x6B, 0x17, 0xC5, 0x10, 0xE4, 0xEA, 0x9E, 0x8C, 0x52 }, NULL, NULL, 0xADD78971, 0xA09C18CF, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Starshot - Space Circus Fever (E) (M3) [t1]", { 0x53, 0x0B, 0x79, 0x6E, 0xA3, 0xB1, 0x74, 0x88, 0x41, 0xF9, 0xD0, 0x57, 0xF3, 0xF9, 0xEF, 0xA8 }, NULL, NULL, 0xAD197171, 0x04DB7E9E, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Starshot - Space Circus Fever (U) (M3) [!]", { 0x42, 0xAF, 0x19, 0x92, 0x97, 0x82, 0x29, 0xBB, 0xB5, 0xF5, 0x60, 0x57, 0x17, 0x08, 0xE2, 0x5E }, NULL, NULL, 0x94EDA5B8, 0x8673E903, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Starshot - Space Circus Fever (U) (M3) [b1]", { 0xBD, 0x22, 0xA7, 0x95, 0x68, 0x53, 0x4B, 0x42, 0xEA, 0xA3, 0xD8, 0xDB, 0x9A, 0x7C, 0x4C, 0x91 }, NULL, NULL, 0x94EDA5B8, 0x8673E903, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Stunt Racer 64 (U) [!]", { 0xE8, 0xB6, 0x66, 0xA4, 0x29, 0xFE, 0xDB, 0x2A, 0x1A, 0x12, 0x28, 0xCD, 0x45, 0x0C, 0xD4, 0xFC }, NULL, NULL, 0x9510D8D7, 0x35100DD2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Summer64 Demo by Lem (PD) [b1]", { 0x14, 0xDD, 0xF1, 0x93, 0x82, 0x38, 0x57, 0x74, 0xF2, 0x53, 0x04, 0x9A, 0xBE, 0xAF, 0x01, 0xD2 }, NULL, NULL, 0x4794B85F, 0x3EBD5B68, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Summer64 Demo by Lem (PD)", { 0x1B, 0x1D, 0xC8, 0xB1, 0xDD, 0x95, 0x0E, 0x70, 0xC0, 0xF5, 0x32, 0xDD, 0x81, 0xC9, 0xA9, 0x82 }, NULL, NULL, 0x4794B85F, 0x3EBD5B68, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Super B-Daman - Battle Phoenix 64 (J) [!]", { 0xB3, 0xC1, 0xD4, 0xB9, 0xEC, 0x7D, 0xCD, 0x29, 0x22, 0xE6, 0x81, 0xDB, 0xBC, 0x39, 0x39, 0x15 }, NULL, NULL, 0xF4646B69, 0xC5751095, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x613 },
+    { "Super Bomberman 2 by Rider (POM '99) (PD)", { 0x41, 0x68, 0xC1, 0x45, 0x27, 0x9E, 0xA2, 0x99, 0x12, 0xBA, 0x0E, 0x35, 0xDC, 0xA3, 0x52, 0x89 }, NULL, NULL, 0xBB214F79, 0x8B88B16B, 1, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x17 },
+    { "Super Bowling (J) [!]", { 0x09, 0xC5, 0xB4, 0xD1, 0x93, 0x64, 0xEF, 0xE4, 0x8B, 0xB8, 0x18, 0x08, 0x77, 0x34, 0x97, 0x8E }, NULL, NULL, 0xF3F2F385, 0x6E490C7F, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Super Bowling (U) [!]", { 0xFA, 0x3A, 0x04, 0x39, 0x97, 0xA3, 0xAC, 0xDF, 0x17, 0x33, 0x73, 0x85, 0xB1, 0x26, 0xBC, 0x04 }, NULL, NULL, 0xAA1D215A, 0x91CBBE9A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Super Fighter Demo Halley's Comet Software (PD)", { 0x7F, 0xCF, 0x42, 0x4B, 0x96, 0x0F, 0x4E, 0x42, 0x9F, 0xD6, 0x83, 0xA4, 0xB1, 0x9B, 0x33, 0x56 }, NULL, NULL, 0x1AD61BB9, 0xF1E2BE1A, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Super Irishley Drunk Giant WaLuigi 64 (Super Mario 64 Hack)", { 0xA2, 0x15, 0xBC, 0x1C, 0xE0, 0x69, 0x60, 0xE0, 0xC4, 0x69, 0xDB, 0x95, 0x20, 0xE9, 0x07, 0xC6 }, NULL, NULL, 0x635A42C5, 0xBDC58EDC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Super Mario 64 (Ch) (iQue) [!]", { 0x29, 0x04, 0x7F, 0xBA, 0x82, 0x06, 0x95, 0xBD, 0x14, 0xC5, 0xBD, 0x7A, 0xA1, 0xAA, 0x44, 0x00 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x11 },
+    { "Super Mario 64 (Ch) (V6) (iQue) (Manual) [!]", { 0xB4, 0xBD, 0x31, 0xB1, 0x3E, 0x47, 0x4D, 0xF2, 0x99, 0x22, 0x15, 0x0E, 0x1E, 0xF3, 0xF3, 0x28 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Super Mario 64 (E) (M3) [!]", { 0x45, 0x67, 0x64, 0x29, 0xEF, 0x6B, 0x90, 0xE6, 0x5B, 0x51, 0x71, 0x29, 0xB7, 0x00, 0x30, 0x8E }, NULL, NULL, 0xA03CF036, 0xBCC1C5D2, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (E) (M3) [b1]", { 0x9E, 0xE4, 0x32, 0xF0, 0x7F, 0x1E, 0x4E, 0x9A, 0x13, 0xCD, 0x00, 0x90, 0xCC, 0xC5, 0xA9, 0x4B }, NULL, NULL, 0xA03CF036, 0xBCC1C5D2, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (E) (M3) [b2]", { 0x22, 0x52, 0x23, 0xAB, 0xF4, 0xBC, 0x1F, 0x3E, 0x38, 0xA4, 0x58, 0x73, 0xBA, 0x94, 0xCE, 0xBC }, NULL, NULL, 0xA03CF036, 0xBCC1C5D2, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (E) (M3) [h1C]", { 0x6A, 0x95, 0x4E, 0x08, 0x53, 0x3C, 0x13, 0xDB, 0xD7, 0x59, 0x90, 0x68, 0xD0, 0x3A, 0x3A, 0xDB }, NULL, NULL, 0xA03CF036, 0xBCC1C5D2, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (E) (M3) [o1]", { 0xD1, 0xF6, 0xBC, 0x22, 0x55, 0x7B, 0xF5, 0x60, 0x7A, 0xA2, 0xE3, 0xC6, 0x1B, 0xE4, 0x4D, 0x59 }, NULL, NULL, 0xA03CF036, 0xBCC1C5D2, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (E) (M3) [o2]", { 0xDF, 0x20, 0x31, 0x33, 0x8C, 0x9B, 0x0A, 0xB8, 0x31, 0x76, 0x61, 0xAF, 0xA6, 0x4E, 0x5F, 0x9E }, NULL, NULL, 0xA03CF036, 0xBCC1C5D2, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (E) (M3) [t1]", { 0x12, 0x1A, 0x19, 0xE2, 0xA5, 0x47, 0xC5, 0x54, 0x15, 0x54, 0x33, 0x78, 0x89, 0x86, 0x03, 0x3C }, NULL, NULL, 0x77C44B0F, 0x5E8948A3, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (E) (M3) [t2]", { 0x99, 0x4D, 0x17, 0x1A, 0x01, 0x54, 0xAB, 0xE7, 0x47, 0x33, 0x88, 0x90, 0xAF, 0x17, 0x92, 0x52 }, NULL, NULL, 0x16510823, 0xE2EEE387, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (J) [!]", { 0x85, 0xD6, 0x1F, 0x55, 0x25, 0xAF, 0x70, 0x8C, 0x9F, 0x1E, 0x84, 0xDC, 0xE6, 0xDC, 0x10, 0xE9 }, NULL, NULL, 0x4EAA3D0E, 0x74757C24, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (J) [T+Kor1.0_Minio]", { 0x66, 0x14, 0x29, 0x8A, 0x94, 0x32, 0x34, 0xFD, 0x30, 0x88, 0x5B, 0xD0, 0xB1, 0x38, 0x3C, 0xBB }, NULL, NULL, 0xB36CF0BE, 0xA35F5C7B, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (J) [h1C]", { 0xDB, 0xF7, 0xF4, 0xD8, 0x81, 0xE1, 0xDF, 0x60, 0x4C, 0x41, 0x36, 0x7B, 0x04, 0x23, 0x3E, 0x74 }, NULL, NULL, 0x4EAA3D0E, 0x74757C24, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) [!]", { 0x20, 0xB8, 0x54, 0xB2, 0x39, 0x20, 0x3B, 0xAF, 0x6C, 0x96, 0x1B, 0x85, 0x0A, 0x4A, 0x51, 0xA2 }, NULL, NULL, 0x635A2BFF, 0x8B022326, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) (Enable Hidden Scroller Hack)", { 0xE4, 0x58, 0xF7, 0x4E, 0x69, 0x4B, 0x29, 0x16, 0xEB, 0xA9, 0x81, 0x81, 0x03, 0xF7, 0xCF, 0x13 }, NULL, NULL, 0xDACDE68E, 0x7381B3C9, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) (No Cap Hack)", { 0xFF, 0x5A, 0x05, 0xFF, 0xDE, 0x29, 0x70, 0x7C, 0x15, 0xD8, 0x9E, 0x80, 0x7E, 0xD6, 0x6B, 0x81 }, NULL, NULL, 0x5B5DA9FB, 0x11EEE5E5, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) (Silver Mario Hack)", { 0x6C, 0x5A, 0xEE, 0x2B, 0xE7, 0x68, 0xE5, 0x81, 0x03, 0x8F, 0x3B, 0x21, 0x1D, 0x7F, 0x60, 0x66 }, NULL, NULL, 0x658E2804, 0x443386FA, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) [T+Rus]", { 0x59, 0x72, 0x04, 0xEE, 0x76, 0x6B, 0x93, 0xC1, 0xAE, 0x33, 0xB7, 0xFC, 0x07, 0x39, 0xE1, 0x70 }, NULL, NULL, 0x267FBAD5, 0x7593FADC, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) [T+SpaFinal_Mistergame]", { 0xE5, 0x1A, 0x6F, 0xF9, 0xB2, 0xDB, 0xBD, 0x21, 0x61, 0x58, 0xCA, 0xCF, 0xF3, 0x5E, 0xB2, 0x15 }, NULL, NULL, 0x635A42C5, 0xBDC58EDC, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) [T+SpaFinal_Mistergame][a1]", { 0x99, 0xBD, 0x94, 0x18, 0x50, 0xAA, 0x68, 0x44, 0x0B, 0x88, 0x6E, 0xA0, 0x55, 0x39, 0xF7, 0xDC }, NULL, NULL, 0x635A42C5, 0xBDC58EDC, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) [T+Spa3.9_Blade133bo]", { 0xE2, 0xFC, 0xF7, 0x78, 0x2B, 0x62, 0x24, 0x95, 0xFA, 0xBE, 0x12, 0xFC, 0x72, 0x44, 0xB3, 0x5B }, NULL, NULL, 0x88EC3675, 0x59CE4583, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Super Mario 64 (U) [T-Ita1.0final_beta1_Rulesless]", { 0x35, 0xBB, 0xAF, 0x48, 0x69, 0xD0, 0xB0, 0xD2, 0x14, 0x7D, 0x35, 0xF1, 0xEC, 0x3C, 0xF2, 0xCA }, NULL, NULL, 0x819D5B33, 0xA5096295, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) [T+Ita2.0final_beta2_Rulesless]", { 0xCD, 0xAC, 0xC6, 0xFE, 0x2C, 0xC7, 0x85, 0x1A, 0x11, 0x10, 0xA6, 0x0C, 0xE7, 0x6F, 0xBD, 0xFB }, NULL, NULL, 0x490A59F2, 0x22BC515E, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) [T+Ita4.2_Rulesless]", { 0xE5, 0x54, 0x4B, 0x15, 0x68, 0x33, 0x12, 0x0E, 0x7B, 0x97, 0xA0, 0x5A, 0xAB, 0x74, 0x3F, 0x98 }, NULL, NULL, 0x5EDE011C, 0x0E166686, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Super Mario 64 (U) [b1]", { 0x93, 0x3C, 0x47, 0x4F, 0xC9, 0x70, 0xA0, 0xE7, 0xD6, 0x59, 0xF3, 0x23, 0x34, 0xDB, 0x64, 0x75 }, NULL, NULL, 0x635A2BFF, 0x8B022326, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) [b2]", { 0x05, 0x13, 0xA5, 0x84, 0xBC, 0x6B, 0x38, 0x59, 0x55, 0x5E, 0x72, 0xE1, 0x00, 0x08, 0xB5, 0x5F }, NULL, NULL, 0x77C44B0F, 0x5E8948A3, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) [h1C]", { 0xC3, 0xA4, 0xEB, 0xEE, 0xA4, 0xD2, 0x2D, 0x8F, 0xC2, 0x45, 0xB3, 0x46, 0xD5, 0xC1, 0xA8, 0x1E }, NULL, NULL, 0x635A2BFF, 0x8B022326, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) [h2C]", { 0x17, 0x95, 0x37, 0xA4, 0x9D, 0xAA, 0x33, 0xBF, 0x03, 0x1F, 0x09, 0xA9, 0x58, 0x9E, 0xAA, 0x28 }, NULL, NULL, 0x635A2BFF, 0x8B022326, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) [o1]", { 0xAE, 0xD2, 0x9A, 0x73, 0x10, 0x56, 0xF3, 0x4B, 0x79, 0xE6, 0xB9, 0x96, 0xBD, 0xBA, 0xFB, 0x63 }, NULL, NULL, 0x635A2BFF, 0x8B022326, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) [t1] (Invincible)", { 0x3F, 0x3E, 0xBF, 0xAD, 0x62, 0x4D, 0x62, 0x3F, 0xAF, 0xEF, 0x76, 0x7B, 0x99, 0x60, 0x9E, 0x15 }, NULL, NULL, 0x5C8BD407, 0x63F71E2A, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) [t2] (Speed)", { 0xB4, 0x8A, 0x8F, 0x8E, 0x2D, 0x9C, 0x74, 0x03, 0x21, 0x0C, 0x2A, 0xA5, 0x26, 0x2D, 0x94, 0xC7 }, NULL, NULL, 0x5B652BFF, 0x8FA82E35, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 (U) [t3]", { 0xC2, 0x93, 0xD2, 0xAD, 0xF0, 0x1E, 0x05, 0x28, 0x55, 0x4C, 0xDB, 0xAD, 0xF0, 0xF8, 0x65, 0x54 }, NULL, NULL, 0xFECE2B85, 0x331406D1, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario Magic Plant Adventure 64 (Super Mario 64 Hack)", { 0xA7, 0x56, 0x37, 0xB1, 0xD2, 0x2F, 0x59, 0xF2, 0xC3, 0x2B, 0xDA, 0x35, 0x9A, 0x9E, 0xE7, 0x9E }, NULL, NULL, 0x635A42C5, 0xBDC58EDC, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "SM64 Splitscreen Multiplayer Beta", { 0x33, 0x8F, 0xAA, 0x6E, 0x25, 0x0F, 0x72, 0xF1, 0xB1, 0xD7, 0xB8, 0x73, 0xBF, 0xAE, 0xE9, 0x18 }, NULL, NULL, 0x5C277FBA, 0xE8A351C9, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "SM64 Splitscreen Multiplayer", { 0xF0, 0x59, 0x5A, 0x36, 0xEA, 0xB6, 0x10, 0x9C, 0x5F, 0xF2, 0x42, 0x0E, 0xB4, 0x52, 0xB6, 0xE2 }, NULL, NULL, 0x13CD0830, 0x3CCF65E9, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Mario 64 - Shindou Edition (J) [!]", { 0x2D, 0x72, 0x7C, 0x32, 0x78, 0xAA, 0x23, 0x2D, 0x94, 0xF2, 0xFB, 0x45, 0xAE, 0xC4, 0xD3, 0x03 }, NULL, NULL, 0xD6FBA4A8, 0x6326AA2C, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Super Mario 64 - Shindou Edition (J) [T+Kor1.0_Minio]", { 0xA0, 0x0D, 0x0D, 0x09, 0x55, 0x92, 0x11, 0x3A, 0x27, 0x9A, 0x27, 0xAC, 0xD7, 0x85, 0xCE, 0x50 }, NULL, NULL, 0xC1373DC8, 0xED88D197, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Super Mario 64 - Shindou Edition (J) [b1]", { 0x23, 0x03, 0x30, 0x85, 0x56, 0x1C, 0xD3, 0x31, 0xCC, 0x81, 0xF0, 0x02, 0x6F, 0xCB, 0x2C, 0xE2 }, NULL, NULL, 0xD6FBA4A8, 0x6326AA2C, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Super Mario 64 - Shindou Edition (J) [b2]", { 0x8C, 0x36, 0x1E, 0x92, 0x83, 0xD7, 0x40, 0xE2, 0xF2, 0x66, 0x78, 0x2D, 0x9C, 0x1C, 0xE9, 0x14 }, NULL, NULL, 0xD6FBA4A8, 0x6326AA2C, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Super Mario 64 - Shindou Edition (J) [h1C]", { 0xE8, 0x24, 0xB2, 0x89, 0xA8, 0x50, 0xE7, 0xE1, 0x61, 0xAF, 0x76, 0x1D, 0x87, 0x6F, 0x1C, 0xAE }, NULL, NULL, 0xD6FBA4A8, 0x6326AA2C, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Super Mario 64 - Shindou Edition (J) [h2C]", { 0x7B, 0xA9, 0x90, 0x00, 0x89, 0x66, 0xBD, 0xA7, 0x1D, 0x8C, 0xB7, 0x8F, 0xB7, 0xBA, 0x41, 0x4E }, NULL, NULL, 0xD6FBA4A8, 0x6326AA2C, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Super Robot Spirits (J) [!]", { 0x3E, 0xC3, 0xF8, 0x3E, 0xAB, 0x22, 0x70, 0x2E, 0x14, 0x6C, 0x46, 0x7E, 0xB1, 0xDB, 0x45, 0xFA }, NULL, NULL, 0x66572080, 0x28E348E1, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Super Robot Spirits (J) [b1]", { 0xE9, 0x2F, 0xC6, 0xAE, 0x19, 0x30, 0x92, 0xF6, 0xB5, 0x97, 0xE0, 0x59, 0x46, 0xB5, 0x58, 0xEB }, NULL, NULL, 0x66572080, 0x28E348E1, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Super Robot Taisen 64 (J) [!]", { 0x3F, 0x4B, 0x73, 0x96, 0x3A, 0xBC, 0x91, 0xCE, 0xE5, 0x9C, 0x41, 0x60, 0x63, 0xEF, 0xD4, 0xAE }, NULL, NULL, 0x1649D810, 0xF73AD6D2, 0, SAVETYPE_SRAM, 1, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x61B },
+    { "Super Robot Taisen 64 (J) [b1]", { 0x46, 0x2A, 0x2A, 0xF0, 0xE3, 0xB7, 0x2D, 0xA4, 0xA0, 0xE9, 0x26, 0x60, 0x78, 0xEE, 0x57, 0x17 }, NULL, NULL, 0x1649D810, 0xF73AD6D2, 0, SAVETYPE_SRAM, 1, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x61B },
+    { "Super Robot Taisen 64 (J) [b2]", { 0xBB, 0x5C, 0x21, 0xBF, 0xEA, 0x9A, 0xA7, 0xE9, 0xC9, 0x0F, 0xE7, 0x6C, 0x13, 0x2B, 0xEC, 0x49 }, NULL, NULL, 0x1649D810, 0xF73AD6D2, 0, SAVETYPE_SRAM, 1, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x61B },
+    { "Super Robot Taisen 64 (J) [f1] (PAL)", { 0x9A, 0xF2, 0x91, 0x9C, 0x27, 0xFC, 0xF6, 0x97, 0x29, 0x86, 0x99, 0x3C, 0x56, 0x49, 0x47, 0xCD }, NULL, NULL, 0xAF981AB7, 0xAA1A0A7A, 0, SAVETYPE_SRAM, 1, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x61B },
+    { "Super Smash Bros. (A) [!]", { 0x69, 0x4D, 0xEA, 0x68, 0xDB, 0xF1, 0xC3, 0xF0, 0x6F, 0xF0, 0x47, 0x6A, 0xCF, 0x21, 0x69, 0xE6 }, NULL, NULL, 0xDD26FDA1, 0xCB4A6BE3, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Super Smash Bros. (A) [f1]", { 0x7F, 0x18, 0xA0, 0x6B, 0xB1, 0x6A, 0x50, 0x7E, 0x23, 0xF9, 0xDD, 0x63, 0x6B, 0x70, 0x46, 0xA6 }, NULL, NULL, 0x9624C4F9, 0x3FB02E03, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Super Smash Bros. (Ch) (iQue) [!]", { 0x7B, 0x81, 0x58, 0x46, 0xEC, 0x91, 0xE6, 0xC4, 0xA8, 0xB8, 0xBA, 0xA0, 0xCE, 0x40, 0x78, 0xF0 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x11 },
+    { "Super Smash Bros. (Ch) (iQue) (Manual) [!]", { 0x3A, 0xBC, 0x2D, 0x34, 0xAD, 0x3C, 0xE6, 0x23, 0xF4, 0xED, 0x8F, 0x12, 0x6D, 0x30, 0xCC, 0x80 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Super Smash Bros. (E) (M3) [!]", { 0x5E, 0x54, 0xC6, 0xC5, 0x63, 0xB0, 0x9C, 0x10, 0x7F, 0x86, 0xFB, 0x33, 0xE9, 0x14, 0xEF, 0x81 }, NULL, NULL, 0x93945F48, 0x5C0F2E30, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Super Smash Bros. (E) (M3) [b1]", { 0x4D, 0x37, 0x72, 0x6F, 0xDF, 0xEC, 0x03, 0x9C, 0xB3, 0x6E, 0x2A, 0xAE, 0x65, 0xB9, 0x72, 0x7D }, NULL, NULL, 0x593BD58B, 0xC330786C, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Super Smash Bros. (E) (M3) [f1]", { 0x99, 0xC1, 0xAB, 0x76, 0x12, 0x6B, 0x7B, 0xAD, 0xFA, 0x90, 0x23, 0xD5, 0x0D, 0xCA, 0x14, 0x30 }, NULL, NULL, 0x593BD58B, 0xC330786C, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Super Smash Bros. (U) [!]", { 0xF7, 0xC5, 0x25, 0x68, 0xA3, 0x1A, 0xAD, 0xF2, 0x6E, 0x14, 0xDC, 0x2B, 0x64, 0x16, 0xB2, 0xED }, NULL, NULL, 0x916B8B5B, 0x780B85A4, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Super Smash Bros. (U) [b1]", { 0x50, 0x8B, 0xE8, 0x60, 0x97, 0x4B, 0x75, 0x47, 0x08, 0x51, 0xA2, 0xD2, 0x5C, 0x0F, 0xCB, 0x36 }, NULL, NULL, 0x916B8B5B, 0x780B85A4, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Super Smash Bros. (U) [b2]", { 0x31, 0x3F, 0x15, 0x41, 0x74, 0x8A, 0xCF, 0x01, 0xC4, 0x35, 0x5B, 0xA4, 0x71, 0x04, 0x38, 0x68 }, NULL, NULL, 0x916B8B5B, 0x780B85A4, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Super Smash Bros. (U) [f1]", { 0x32, 0x6D, 0xC2, 0x27, 0xFC, 0xCA, 0xA4, 0x97, 0x55, 0x83, 0xE6, 0x36, 0x24, 0xDD, 0xFD, 0xA1 }, NULL, NULL, 0x3409CEB6, 0xCEC8517A, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Super Smash Bros. (U) [f2] (PAL)", { 0xC2, 0xDB, 0xAE, 0x0C, 0x18, 0xC6, 0x66, 0x63, 0x36, 0xF4, 0xCF, 0xA8, 0x96, 0xD8, 0xED, 0x18 }, NULL, NULL, 0x8CF1CECB, 0xC8902FF4, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Super Smash Bros. (U) [f3]", { 0x5A, 0x19, 0xD3, 0x95, 0xB6, 0xA8, 0xB1, 0x91, 0x1D, 0xEB, 0x33, 0x4E, 0x39, 0x2F, 0x45, 0x26 }, NULL, NULL, 0x3409CEB6, 0xCEC8517A, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Super Smash Bros. (U) [f4] (GameShark)", { 0x98, 0xA3, 0x12, 0x2A, 0x6D, 0x7C, 0x9B, 0x02, 0x38, 0x1F, 0xC5, 0xB0, 0xCF, 0xB8, 0xC1, 0x4B }, NULL, NULL, 0xEA6D4C3F, 0x13837E54, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Super Smash Bros. (U) [hI]", { 0xED, 0x86, 0x41, 0xA7, 0x04, 0x91, 0x0B, 0xB4, 0xA0, 0xFA, 0xC9, 0xAD, 0x08, 0xF9, 0xC1, 0xD2 }, NULL, NULL, 0x916B8B5B, 0x780B85A4, 3, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7F },
+    { "Super Speed Race 64 (J) [!]", { 0x6B, 0x5D, 0x93, 0xB3, 0x56, 0x6E, 0x96, 0x14, 0x70, 0x09, 0xD1, 0xAC, 0x4F, 0xB1, 0x5C, 0x97 }, NULL, NULL, 0x9CE02E22, 0x206EF1B0, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Super Speed Race 64 (J) [o1]", { 0x27, 0xA7, 0xA2, 0xA1, 0x9F, 0xC6, 0x73, 0x46, 0xBB, 0x25, 0xE3, 0xC5, 0xBB, 0x3A, 0x91, 0xCE }, NULL, NULL, 0x9CE02E22, 0x206EF1B0, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Super WaLuigi 64 (Super Mario 64 Hack)", { 0xDB, 0x50, 0x2D, 0x45, 0x77, 0xEE, 0x90, 0x81, 0x60, 0x44, 0x1D, 0x38, 0x53, 0x1E, 0xBB, 0x8D }, NULL, NULL, 0x635A42C5, 0xBDC58EDC, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Wario 64 (Super Mario 64 Hack)", { 0x99, 0x13, 0x8C, 0xB0, 0xD1, 0x32, 0x5F, 0x7B, 0xB7, 0xC2, 0xED, 0xAB, 0x5D, 0x7F, 0x6C, 0x54 }, NULL, NULL, 0x635A42C5, 0xBDC58EDC, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Wario 64 V1.0 by Rulesless (Super Mario 64 Hack) [T+Ita]", { 0x7D, 0xDF, 0x1C, 0xC6, 0x34, 0x01, 0xCF, 0x43, 0x83, 0x6B, 0xD1, 0x4F, 0x19, 0x9B, 0x6C, 0x70 }, NULL, NULL, 0x75A15B07, 0x2E391683, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Super Wario 64 V1.0 by Rulesless (Super Mario 64 Hack)", { 0x93, 0x58, 0x2A, 0x59, 0xF4, 0x42, 0x50, 0x2C, 0xAD, 0xAA, 0x39, 0xBD, 0x6C, 0xC1, 0xB2, 0xCE }, NULL, NULL, 0x635A42C5, 0xBDC58EDC, 4, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "Supercross 2000 (E) (M3) [!]", { 0x6D, 0x58, 0xA0, 0x1E, 0xF7, 0xA7, 0xA7, 0xC7, 0x79, 0xD2, 0xA6, 0x63, 0x15, 0x99, 0x2C, 0x5F }, NULL, NULL, 0x2CBB127F, 0x09C2BFD8, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Supercross 2000 (U) [!]", { 0x60, 0x34, 0x72, 0x00, 0xA1, 0xA7, 0xCA, 0xBC, 0x0D, 0x84, 0x9E, 0xE6, 0x9E, 0xC5, 0x1D, 0xF7 }, NULL, NULL, 0xC1452553, 0x5D7B24D9, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Supercross 2000 (U) [b1]", { 0x53, 0x92, 0x28, 0x02, 0xF7, 0x74, 0x4C, 0xC3, 0x8B, 0xDD, 0x75, 0x85, 0x22, 0x14, 0x05, 0x7F }, NULL, NULL, 0xC1452553, 0x5D7B24D9, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Supercross 2000 (U) [f1] (PAL)", { 0x4E, 0xAB, 0x63, 0xBE, 0x36, 0xDC, 0xC7, 0xFA, 0x6D, 0x61, 0x2B, 0xE7, 0x80, 0xBF, 0x79, 0xC1 }, NULL, NULL, 0x1917566C, 0x8BE6CD0F, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Superman (E) (M6) [!]", { 0x5A, 0xB3, 0x9F, 0x2D, 0x7A, 0x14, 0x4E, 0x1B, 0xA2, 0x43, 0xDF, 0x05, 0x95, 0x60, 0xE8, 0x78 }, NULL, NULL, 0xB44CAB74, 0x07029A29, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Superman (U) (M3) [!]", { 0x3F, 0x64, 0xB4, 0xF7, 0x2E, 0x61, 0x22, 0x5E, 0xF3, 0xAE, 0x93, 0x97, 0x6C, 0x9B, 0xFC, 0x7C }, NULL, NULL, 0xA2E8F35B, 0xC9DC87D9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Superman (U) (M3) (Beta) [!]", { 0x11, 0x70, 0x03, 0x39, 0x80, 0xAD, 0xC1, 0x98, 0x15, 0x05, 0xCF, 0x95, 0x8F, 0x35, 0xF1, 0xEB }, NULL, NULL, 0x944FAFC4, 0xB288266A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Superman (U) (M3) [T+Ita100_Cattivik66]", { 0x04, 0xA6, 0xF2, 0x5C, 0xB0, 0xF2, 0x08, 0x4E, 0x63, 0x1B, 0x3B, 0x7F, 0xFF, 0x76, 0xBE, 0xFD }, NULL, NULL, 0xA2E8F35B, 0xC9DC87D9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Superman (U) (M3) [b1]", { 0x3C, 0x28, 0xC9, 0x51, 0xB1, 0xEA, 0x46, 0x69, 0x00, 0x65, 0xDC, 0x32, 0x86, 0x22, 0x72, 0xE4 }, NULL, NULL, 0xA2E8F35B, 0xC9DC87D9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Superman (U) (M3) [b2]", { 0x57, 0x47, 0x04, 0xAF, 0xFB, 0xD2, 0x8C, 0x7A, 0x27, 0x28, 0xDA, 0x85, 0xCC, 0x1D, 0xA0, 0xF3 }, NULL, NULL, 0xA2E8F35B, 0xC9DC87D9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Superman (U) (M3) [f1] (PAL)", { 0x12, 0x56, 0x2B, 0xFF, 0x12, 0x7E, 0x52, 0xA6, 0xEE, 0x9B, 0x4F, 0xEF, 0x92, 0x05, 0x0A, 0xF9 }, NULL, NULL, 0xEEF7DE23, 0x57E4FEA9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Superman (U) (M3) [f2] (PAL)", { 0x94, 0x33, 0x37, 0xC9, 0x45, 0xDA, 0x68, 0x9A, 0xF8, 0x69, 0x87, 0x74, 0x98, 0xC7, 0xAA, 0x2C }, NULL, NULL, 0x06F6B180, 0x97F0AD11, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Superman (U) (M3) [t1]", { 0xDB, 0xA2, 0x37, 0xED, 0x84, 0x15, 0x38, 0x3A, 0xFC, 0xAB, 0xA0, 0x35, 0xD8, 0x17, 0x27, 0x2F }, NULL, NULL, 0x5AEB33A3, 0x23063A25, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Susume! Taisen Puzzle Dama Toukon! Marumata Chou (J) [!]", { 0x26, 0xF4, 0xCA, 0x20, 0xF7, 0xB9, 0xC8, 0x81, 0x99, 0xAC, 0x04, 0x6C, 0x57, 0xE2, 0x82, 0xB4 }, NULL, NULL, 0x35E811F3, 0x99792724, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Susume! Taisen Puzzle Dama Toukon! Marumata Chou (J) [b1]", { 0x59, 0x98, 0x52, 0x49, 0xF8, 0x24, 0xF7, 0x4C, 0x33, 0x5C, 0x6C, 0x47, 0xA6, 0xE2, 0x9C, 0x4A }, NULL, NULL, 0x35E811F3, 0x99792724, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Susume! Taisen Puzzle Dama Toukon! Marumata Chou (J) [b2]", { 0x99, 0x3A, 0x67, 0xEC, 0xD0, 0x22, 0x12, 0xB4, 0xBE, 0x5B, 0x2E, 0x14, 0x65, 0x2F, 0x83, 0x5B }, NULL, NULL, 0x35E811F3, 0x99792724, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Susume! Taisen Puzzle Dama Toukon! Marumata Chou (J) [b3]", { 0xEF, 0xE2, 0xCE, 0xBF, 0x5B, 0xB2, 0x1B, 0xF7, 0x66, 0xFF, 0x72, 0xC0, 0x55, 0xDF, 0x36, 0xBE }, NULL, NULL, 0x35E811F3, 0x99792724, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Susume! Taisen Puzzle Dama Toukon! Marumata Chou (J) [h1C]", { 0xB0, 0xFE, 0x13, 0x43, 0xA2, 0xED, 0x21, 0xD2, 0xF0, 0x83, 0x04, 0x1B, 0x1F, 0xE1, 0xB7, 0xA9 }, NULL, NULL, 0x35E811F3, 0x99792724, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Susume! Taisen Puzzle Dama Toukon! Marumata Chou (J) [h2C]", { 0x98, 0x7A, 0x07, 0xDA, 0xF0, 0xF0, 0x65, 0x67, 0xBC, 0x8E, 0x79, 0x42, 0x91, 0xD9, 0x86, 0x95 }, NULL, NULL, 0x35E811F3, 0x99792724, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Susume! Taisen Puzzle Dama Toukon! Marumata Chou (J) [o1]", { 0xE9, 0x46, 0x85, 0x5E, 0xEF, 0x7F, 0x1B, 0xBD, 0x47, 0xAE, 0xEC, 0xA3, 0x3A, 0x27, 0x37, 0xBB }, NULL, NULL, 0x35E811F3, 0x99792724, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Susume! Taisen Puzzle Dama Toukon! Marumata Chou (J) [o2]", { 0xD6, 0xB0, 0x13, 0x5B, 0xE0, 0x6D, 0xF3, 0x54, 0x5A, 0x89, 0x31, 0x95, 0x7F, 0xE8, 0x05, 0xFA }, NULL, NULL, 0x35E811F3, 0x99792724, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Susume! Taisen Puzzle Dama Toukon! Marumata Chou (J) [o2][b1]", { 0x69, 0x22, 0xA2, 0xD0, 0xDB, 0x71, 0x9A, 0xD7, 0x97, 0x2C, 0x0D, 0xC1, 0x46, 0xFF, 0x0D, 0x8C }, NULL, NULL, 0x35E811F3, 0x99792724, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Sydney 2000 (E) (Prototype)", { 0xFC, 0x32, 0x00, 0x7B, 0xA0, 0x3F, 0xF2, 0x51, 0x00, 0x20, 0xE9, 0x79, 0xC7, 0xBD, 0xAD, 0x4F }, NULL, NULL, 0xECBD95DD, 0x1FAB637D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Sydney 2000 (U) (Prototype)", { 0x2E, 0xEA, 0x8D, 0x20, 0xBE, 0xF2, 0x6F, 0x88, 0xA5, 0xE8, 0x2F, 0xDD, 0x39, 0xF8, 0x7E, 0x75 }, NULL, NULL, 0x80A78080, 0x5F9F8833, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "T-Shirt Demo by Neptune and Steve (POM '98) (PD) [b1]", { 0x4B, 0xC1, 0xD3, 0x07, 0x4F, 0xA3, 0xA3, 0xDC, 0xAF, 0x1F, 0x16, 0x88, 0x8B, 0x82, 0xA9, 0x66 }, NULL, NULL, 0x1AA71519, 0x51360D55, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "T-Shirt Demo by Neptune and Steve (POM '98) (PD)", { 0xE4, 0xD3, 0x14, 0xC5, 0x36, 0xF7, 0xBF, 0x78, 0xF6, 0x01, 0x97, 0xEC, 0x23, 0x85, 0x14, 0xAE }, NULL, NULL, 0x1AA71519, 0x51360D55, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "TG Rally 2 (E) [!]", { 0xAC, 0xD0, 0x11, 0x8A, 0xC4, 0x70, 0x9D, 0xB3, 0x94, 0x3B, 0x3D, 0x35, 0x11, 0x2C, 0x20, 0x01 }, NULL, NULL, 0xF82DD377, 0x8C3FB347, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "TR64 Demo by FIres and Icepir8 (PD)", { 0x65, 0xE6, 0x7D, 0x43, 0xE0, 0xA9, 0xB1, 0x46, 0xD7, 0x88, 0x1C, 0xBC, 0x80, 0x3E, 0xC5, 0xC3 }, NULL, NULL, 0x2070044B, 0xE7D82D16, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "TRON Demo (PD) [a1]", { 0x07, 0x66, 0x0B, 0x03, 0x45, 0x6D, 0xD0, 0xF7, 0x76, 0xF3, 0x92, 0xEF, 0x3E, 0x05, 0xC4, 0x81 }, NULL, NULL, 0xCB3FF554, 0x8773CD0B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "TRON Demo (PD)", { 0x4D, 0x6E, 0x12, 0xE0, 0xAB, 0x62, 0xD4, 0x04, 0x5B, 0x49, 0x34, 0xB6, 0xD7, 0xBB, 0x8B, 0xDC }, NULL, NULL, 0xCB3FF554, 0x8773CD0B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "TRSI Intro by Ayatollah (POM '99) (PD)", { 0x50, 0x3C, 0x54, 0x8F, 0x7B, 0x38, 0xA3, 0x72, 0x1B, 0x93, 0xFD, 0x0A, 0xBF, 0x97, 0x90, 0x19 }, NULL, NULL, 0x2DD07E20, 0x24D40CD6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Tamiya Racing 64 (U) (Prototype)", { 0xCE, 0xCA, 0xB8, 0xDF, 0x02, 0xC0, 0x2F, 0x38, 0xC9, 0xCF, 0x1B, 0xDD, 0x57, 0xB1, 0xDA, 0x00 }, NULL, NULL, 0x37955E65, 0xC6F2B7B3, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Taz Express (E) (M6) [!]", { 0x19, 0x2B, 0x71, 0x5E, 0x8B, 0xC5, 0x97, 0x2A, 0x49, 0x86, 0xDF, 0x21, 0xDC, 0x8B, 0xF3, 0x57 }, NULL, NULL, 0xAEBCDD54, 0x15FF834A, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Taz Express (E) (M6) [f1] (NTSC)", { 0x53, 0xDF, 0xA5, 0x93, 0x01, 0x9B, 0xDA, 0x07, 0x0D, 0xD3, 0xCD, 0x5F, 0xC5, 0xB5, 0x84, 0x36 }, NULL, NULL, 0x17679054, 0xE235F4A7, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Taz Express (E) (M6) [f2] (NTSC)", { 0xAD, 0x47, 0xA9, 0x52, 0x19, 0x88, 0xCE, 0xDD, 0x8D, 0x43, 0x09, 0x7C, 0xFD, 0x9B, 0xE0, 0x42 }, NULL, NULL, 0x00BC1D78, 0x00709D53, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Taz Express (U) (Prototype)", { 0x7A, 0x94, 0xF9, 0x44, 0x85, 0xBD, 0x28, 0xF0, 0xD6, 0xD6, 0x72, 0x57, 0x05, 0x0B, 0x26, 0xD4 }, NULL, NULL, 0x6C2C6C49, 0x9BE5CA66, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Telefoot Soccer 2000 (F) [!]", { 0x7F, 0x24, 0x4A, 0xFF, 0x8D, 0x72, 0x94, 0x17, 0xE3, 0x2B, 0x6A, 0x5B, 0x29, 0x9A, 0xFD, 0xA5 }, NULL, NULL, 0xD9042FBB, 0xFCFF997C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Telefoot Soccer 2000 (F) [b1]", { 0x8F, 0x96, 0xFF, 0x06, 0xD9, 0xB3, 0xC3, 0x21, 0x9C, 0xEB, 0xA5, 0xCD, 0xB7, 0xCF, 0x19, 0xED }, NULL, NULL, 0x6440D7CE, 0xF6597A03, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Telefoot Soccer 2000 (F) [f1] (NTSC)", { 0xD1, 0xB6, 0xD2, 0x77, 0xF9, 0xFA, 0xE2, 0x02, 0x9A, 0x75, 0x32, 0xD8, 0xE1, 0xF4, 0xD6, 0xB2 }, NULL, NULL, 0x6440D7CE, 0xF6597A03, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x433 },
+    { "Tetris 64 (J) [!]", { 0x7C, 0x8E, 0xFC, 0xF4, 0xFB, 0xA2, 0x8F, 0x9F, 0x5B, 0x5E, 0xA1, 0x0A, 0x71, 0x28, 0x3B, 0xF3 }, NULL, NULL, 0x963ADBA6, 0xF7D5C89B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 1, 0x64, 100, 0x1813 },
+    { "Tetris 64 (J) [T+Ita]", { 0x15, 0x87, 0xB1, 0x73, 0x44, 0xA4, 0x35, 0x32, 0xB7, 0x91, 0xDC, 0xEB, 0x23, 0x7D, 0x2B, 0xFC }, NULL, NULL, 0x963ADBA6, 0xF7D5C89B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 1, 0x64, 100, 0x1813 },
+    { "Tetris 64 (J) [b1]", { 0xEC, 0xC0, 0x66, 0x17, 0x15, 0x61, 0x22, 0x88, 0x2C, 0x4F, 0xA4, 0xBB, 0xCD, 0x24, 0x1A, 0x4F }, NULL, NULL, 0x963ADBA6, 0xF7D5C89B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 1, 0x64, 100, 0x1813 },
+    { "Tetris 64 (J) [b2]", { 0x90, 0x36, 0xBB, 0x44, 0xA5, 0x1A, 0x62, 0xCB, 0x0A, 0x74, 0xC2, 0x88, 0xEB, 0xB8, 0x50, 0xC7 }, NULL, NULL, 0x963ADBA6, 0xF7D5C89B, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 1, 0x64, 100, 0x1813 },
+    { "Tetris Beta Demo by FusionMan (POM '98) (PD) [b1]", { 0x8C, 0x9F, 0x13, 0x9B, 0xF5, 0xFC, 0x0B, 0x7A, 0x04, 0x97, 0xF2, 0x82, 0x41, 0xC6, 0xF8, 0x19 }, NULL, NULL, 0x81361532, 0x2AEB643F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Tetris Beta Demo by FusionMan (POM '98) (PD)", { 0x67, 0x4D, 0x41, 0x6C, 0x2B, 0xD1, 0xEF, 0x01, 0x92, 0xBE, 0xE3, 0x4A, 0xA2, 0x60, 0xB2, 0x1A }, NULL, NULL, 0x81361532, 0x2AEB643F, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Tetrisphere (E) [!]", { 0x76, 0x5A, 0x33, 0x0D, 0x5C, 0xE2, 0xDB, 0xE7, 0x12, 0x0C, 0x6C, 0x8E, 0x18, 0xA1, 0x48, 0x7D }, NULL, NULL, 0x0FE684A9, 0x8BB77AC4, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Tetrisphere (E) [b1]", { 0xA8, 0x74, 0x55, 0x24, 0x49, 0x19, 0xBD, 0xA6, 0xE4, 0x4F, 0xA3, 0x2C, 0x7E, 0x72, 0xBF, 0xBA }, NULL, NULL, 0x0FE684A9, 0x8BB77AC4, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Tetrisphere (E) [b2]", { 0x82, 0x21, 0x54, 0xEE, 0x2B, 0x96, 0xBF, 0x78, 0xBC, 0xE2, 0xE4, 0x6A, 0xF6, 0x57, 0x81, 0x31 }, NULL, NULL, 0x0FE684A9, 0x8BB77AC4, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Tetrisphere (U) [!]", { 0x3F, 0x88, 0x07, 0x8E, 0x2D, 0x9D, 0xBF, 0x6C, 0x93, 0x72, 0xF6, 0x37, 0x3C, 0xF9, 0xAE, 0x09 }, NULL, NULL, 0x3C1FDABE, 0x02A4E0BA, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Tetrisphere (U) [b1]", { 0x72, 0x11, 0x95, 0x1F, 0xDF, 0x7D, 0xA8, 0x09, 0xD5, 0xF3, 0xD5, 0x1C, 0xA0, 0x6C, 0xD4, 0x65 }, NULL, NULL, 0x3C1FDABE, 0x02A4E0BA, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Tetrisphere (U) [t1]", { 0x9F, 0x75, 0x27, 0xEE, 0x8A, 0x80, 0xDA, 0xE3, 0x39, 0xDB, 0x76, 0x9E, 0xAE, 0x70, 0x7D, 0xCC }, NULL, NULL, 0x4EF87A50, 0x975A7CC7, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Textlight Demo by Horizon64 (PD) [b1]", { 0xB1, 0x1B, 0x30, 0x53, 0x6D, 0x44, 0x5A, 0xB6, 0xC7, 0xDC, 0x22, 0xC8, 0x5C, 0x68, 0xA2, 0x18 }, NULL, NULL, 0x41B1BF58, 0xA1EB9BB7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Textlight Demo by Horizon64 (PD)", { 0x33, 0xCF, 0x09, 0xD5, 0xEA, 0xB2, 0xFB, 0x12, 0x42, 0x10, 0x8A, 0x17, 0x2E, 0x18, 0x44, 0xC2 }, NULL, NULL, 0x41B1BF58, 0xA1EB9BB7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "The Corporation 1st Intro by i_savant (PD) [b1]", { 0xDA, 0x93, 0x4F, 0xF1, 0xA6, 0xCE, 0x9E, 0xEC, 0x70, 0xC2, 0x35, 0xF8, 0x79, 0xB2, 0x3A, 0xFE }, NULL, NULL, 0x44705CED, 0x6FDFDE02, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "The Corporation 1st Intro by i_savant (PD)", { 0xB4, 0x2C, 0x11, 0xB1, 0xDC, 0xBF, 0xC0, 0xAE, 0x42, 0x55, 0x10, 0x21, 0xCD, 0x69, 0xAB, 0x22 }, NULL, NULL, 0x44705CED, 0x6FDFDE02, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "The Corporation 2nd Intro by TS_Garp (PD) [a1]", { 0xF6, 0xAE, 0x85, 0xB8, 0xCC, 0x2B, 0x64, 0x3F, 0x37, 0xDE, 0x95, 0xD7, 0xF5, 0x68, 0x22, 0x62 }, NULL, NULL, 0xC3AB938D, 0xD48143B2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "The Corporation 2nd Intro by TS_Garp (PD) [b1]", { 0xEA, 0x9D, 0x71, 0xAF, 0x15, 0x08, 0x63, 0x6E, 0x88, 0xD9, 0x5A, 0xC1, 0xD5, 0x25, 0xEF, 0x93 }, NULL, NULL, 0xC3AB938D, 0xD48143B2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "The Corporation 2nd Intro by TS_Garp (PD)", { 0x75, 0x63, 0x25, 0x37, 0x84, 0x80, 0xE1, 0x25, 0x2C, 0xB0, 0x89, 0x11, 0x0A, 0x68, 0x95, 0x63 }, NULL, NULL, 0xC3AB938D, 0xD48143B2, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "The Corporation XMAS Demo '99 by TS_Garp (PD) [b1]", { 0xD5, 0x2E, 0x87, 0x1B, 0x56, 0x2A, 0xD0, 0x00, 0xBA, 0x37, 0x28, 0xD9, 0xB4, 0x5E, 0xC9, 0xCB }, NULL, NULL, 0x93DA8551, 0xD231E8AB, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "The Corporation XMAS Demo '99 by TS_Garp (PD)", { 0xAF, 0x28, 0x4A, 0xB7, 0xFF, 0x93, 0x63, 0x01, 0x67, 0x82, 0xE9, 0x9D, 0x00, 0x57, 0x4E, 0x70 }, NULL, NULL, 0x93DA8551, 0xD231E8AB, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Tigger's Honey Hunt (E) (M7) [!]", { 0xA0, 0x96, 0x63, 0xB5, 0x96, 0xF3, 0x48, 0xD2, 0x8A, 0xF8, 0x46, 0xA5, 0x13, 0x75, 0xEB, 0x81 }, NULL, NULL, 0xE0C4F72F, 0x769E1506, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Tigger's Honey Hunt (U) [!]", { 0xF8, 0x63, 0x65, 0x14, 0xB5, 0xB0, 0xED, 0xEB, 0xF3, 0x76, 0xC3, 0x11, 0x1D, 0x24, 0x41, 0x7A }, NULL, NULL, 0x4EBFDD33, 0x664C9D84, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Tigger's Honey Hunt (U) [t1]", { 0x7B, 0x41, 0xF2, 0x8A, 0x92, 0x01, 0x12, 0xF1, 0x74, 0x01, 0xD6, 0x33, 0xB3, 0x68, 0xBA, 0x0C }, NULL, NULL, 0xE972B385, 0x7668D414, 0, SAVETYPE_FLASH_RAM, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Tokisora Senshi Turok (J) [!]", { 0x7B, 0x26, 0x12, 0x47, 0x15, 0x0C, 0x43, 0x1D, 0xE5, 0x5A, 0xB3, 0x71, 0xE8, 0xB4, 0x6E, 0xA8 }, NULL, NULL, 0x916AE6B8, 0x8817AB22, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Tom Clancy's Rainbow Six (E) [!]", { 0x1B, 0x99, 0x1C, 0xF4, 0x1C, 0x70, 0xFF, 0x2C, 0x92, 0xFF, 0xBE, 0xFA, 0xCA, 0xBE, 0x8D, 0x03 }, NULL, NULL, 0x4875AF3D, 0x9A66D3A2, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Tom Clancy's Rainbow Six (E) [b1]", { 0xFC, 0x2D, 0x2F, 0x7E, 0xF0, 0x24, 0x84, 0xEA, 0x04, 0x78, 0xA5, 0xEA, 0xFD, 0x0C, 0xBF, 0xF0 }, NULL, NULL, 0x4875AF3D, 0x9A66D3A2, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Tom Clancy's Rainbow Six (E) [h1C]", { 0xC0, 0x61, 0x2A, 0xA1, 0x28, 0x88, 0xC1, 0x0E, 0x95, 0x65, 0xA5, 0x7E, 0xB2, 0xC3, 0x60, 0x5D }, NULL, NULL, 0x4875AF3D, 0x9A66D3A2, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Tom Clancy's Rainbow Six (E) [o1]", { 0xAA, 0xD3, 0xD4, 0x2A, 0x9E, 0x80, 0x07, 0x80, 0x08, 0x70, 0x09, 0xB1, 0x6A, 0xFB, 0x13, 0x27 }, NULL, NULL, 0x4875AF3D, 0x9A66D3A2, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Tom Clancy's Rainbow Six (F) [!]", { 0x15, 0xE4, 0xC1, 0xB4, 0xF3, 0xF4, 0x59, 0xD4, 0xCA, 0xA7, 0xF7, 0xE2, 0xCF, 0x0C, 0x95, 0xDA }, NULL, NULL, 0x486BF335, 0x034DCC81, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Tom Clancy's Rainbow Six (G) [!]", { 0xFD, 0xC7, 0x6A, 0x53, 0xB1, 0x05, 0x6D, 0x3E, 0x50, 0xEA, 0x6A, 0x3E, 0x29, 0x5F, 0xE4, 0xD1 }, NULL, NULL, 0x8D412933, 0x588F64DB, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Tom Clancy's Rainbow Six (U) [!]", { 0x80, 0xF3, 0xB1, 0xAB, 0xD9, 0xFB, 0x9A, 0xE7, 0x39, 0x97, 0x48, 0x9D, 0xB1, 0x85, 0xA7, 0x4D }, NULL, NULL, 0x392A0C42, 0xB790E77D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Tom Clancy's Rainbow Six (U) [f1] (PAL)", { 0x2C, 0xF9, 0x56, 0x8A, 0x14, 0x91, 0x77, 0xAC, 0x0B, 0x86, 0x37, 0x8F, 0xBC, 0x8D, 0xCB, 0x71 }, NULL, NULL, 0x8B79DBFD, 0x0BB32AC0, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Tom Demo (PD)", { 0xB9, 0xEF, 0x94, 0x04, 0x08, 0xE1, 0xDF, 0xD6, 0x3F, 0x86, 0x75, 0x27, 0xE4, 0x21, 0x2B, 0x9D }, NULL, NULL, 0x5ECE09AE, 0x8230C82D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Tom and Jerry in Fists of Furry (E) (M6) [!]", { 0x46, 0xBE, 0x5D, 0x00, 0x68, 0x2F, 0xCC, 0x1F, 0x7F, 0xC0, 0xFB, 0xA5, 0x07, 0xE8, 0xE5, 0xC1 }, NULL, NULL, 0x2B4F4EFB, 0x43C511FE, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Tom and Jerry in Fists of Furry (E) (M6) [f1] (NTSC)", { 0x9E, 0xAA, 0x60, 0xF2, 0x95, 0xDB, 0xA9, 0xA9, 0x68, 0x7E, 0x32, 0x38, 0xDA, 0xBA, 0x14, 0xEE }, NULL, NULL, 0xEC6F66AC, 0x618EF742, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Tom and Jerry in Fists of Furry (U) [!]", { 0xA6, 0x3A, 0x9A, 0xF8, 0x5B, 0xE8, 0xBB, 0x47, 0xC1, 0x74, 0x1B, 0x8A, 0x37, 0x11, 0x53, 0x54 }, NULL, NULL, 0x63E7391C, 0xE6CCEA33, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Tom and Jerry in Fists of Furry (U) [t1]", { 0x17, 0xD6, 0xD6, 0xDA, 0x5D, 0x03, 0xC9, 0xD2, 0x95, 0xD7, 0x2A, 0x21, 0x2A, 0x71, 0x9E, 0xB2 }, NULL, NULL, 0x9BF2A817, 0xEE20252A, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Tommy Thunder (U) (Prototype)", { 0x99, 0xF9, 0x5A, 0xD4, 0xA3, 0xB0, 0xC7, 0x8B, 0x6F, 0x58, 0xA0, 0xFC, 0x3A, 0xD2, 0x2D, 0xB6 }, NULL, NULL, 0x21260D94, 0x06AE1DFE, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Tonic Trouble (E) (M5) [!]", { 0x3D, 0x35, 0x73, 0xA8, 0x55, 0x83, 0x5A, 0x98, 0xDE, 0x29, 0xD5, 0x98, 0xC3, 0x55, 0x90, 0xE0 }, NULL, NULL, 0x093F916E, 0x4408B698, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Tonic Trouble (U) (V1.1) [!]", { 0x7D, 0x3E, 0x93, 0x51, 0x56, 0x84, 0x4D, 0xE0, 0x00, 0x2D, 0xB8, 0x75, 0xE1, 0x07, 0x6A, 0x5C }, NULL, NULL, 0xEF9E9714, 0xC03B2C7D, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Tonic Trouble (U) (V1.1) [b1]", { 0xA6, 0xC5, 0x62, 0x5F, 0xF1, 0x27, 0xD9, 0xE7, 0x41, 0xF5, 0x95, 0xEB, 0xF3, 0xB3, 0xAB, 0xB9 }, NULL, NULL, 0xEF9E9714, 0xC03B2C7D, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Tonic Trouble (U) (V1.1) [f1] (PAL)", { 0x01, 0x2C, 0x9D, 0xAF, 0x61, 0x70, 0x5F, 0x10, 0x93, 0x92, 0xA8, 0x5B, 0x26, 0x21, 0xCD, 0x42 }, NULL, NULL, 0x1671E7BC, 0xB7D756B9, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Tonic Trouble (U) (V1.1) [t1]", { 0x19, 0x87, 0xE0, 0xF1, 0x2D, 0xDD, 0x61, 0x9F, 0x44, 0x0C, 0xD9, 0x63, 0x7D, 0xF7, 0xCC, 0x28 }, NULL, NULL, 0x1671F4A0, 0x5C0E7928, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Tony Hawk's Pro Skater (E) [!]", { 0xC9, 0xE9, 0xC4, 0xA1, 0x8B, 0x15, 0x40, 0xC6, 0xB4, 0x11, 0x13, 0x31, 0xD7, 0xC6, 0x63, 0xB8 }, NULL, NULL, 0x9F8926A5, 0x0587B409, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Tony Hawk's Pro Skater (U) (V1.0) [!]", { 0x5E, 0xD7, 0xE3, 0x92, 0x19, 0x8A, 0x5F, 0xA5, 0x6E, 0xE3, 0x7E, 0xA9, 0xE9, 0x3A, 0x8D, 0x50 }, NULL, NULL, 0x204EC022, 0xB119D185, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Tony Hawk's Pro Skater (U) (V1.0) [t1]", { 0x30, 0xEC, 0x0E, 0xEA, 0x5C, 0x48, 0x7E, 0x56, 0x09, 0xD9, 0xF9, 0xF3, 0x56, 0xD2, 0x1F, 0x27 }, NULL, NULL, 0x85C52CA4, 0x017EE9A6, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Tony Hawk's Pro Skater (U) (V1.1) [!]", { 0xAF, 0xF4, 0x24, 0xA1, 0x88, 0x3D, 0xC7, 0xBB, 0x92, 0xC7, 0xB2, 0xEB, 0xE9, 0x34, 0x2F, 0x85 }, NULL, NULL, 0xE0144180, 0x650B78C9, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Tony Hawk's Pro Skater 2 (E) [!]", { 0x6B, 0xE0, 0x30, 0x47, 0x5C, 0x4D, 0xB5, 0x2F, 0x27, 0x3E, 0xF8, 0xA0, 0x2B, 0x4D, 0xAF, 0xA8 }, NULL, NULL, 0x84EAB557, 0xC88A190F, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Tony Hawk's Pro Skater 2 (U) [!]", { 0x29, 0x97, 0x46, 0x92, 0x80, 0x8C, 0x11, 0x2B, 0x30, 0x6F, 0xBD, 0x25, 0x92, 0x73, 0xDC, 0x96 }, NULL, NULL, 0x99150E18, 0x1266E6A5, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Tony Hawk's Pro Skater 3 (U)", { 0x9D, 0x48, 0x91, 0xBF, 0x26, 0x88, 0x1C, 0x45, 0x41, 0x17, 0x1B, 0x02, 0x35, 0x01, 0x5F, 0xD4 }, NULL, NULL, 0x1A7F70B5, 0x00B7B9FD, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Toon Panic (J) (Prototype)", { 0xB6, 0xFD, 0x2A, 0x04, 0x8D, 0x1F, 0x4F, 0x32, 0x4C, 0xEB, 0xC9, 0x7B, 0xA0, 0x98, 0x72, 0xBB }, NULL, NULL, 0x9A746EBF, 0x2802EA99, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Top Gear Hyper Bike (Beta)", { 0xB6, 0x0D, 0x26, 0xC2, 0xC2, 0x24, 0x2B, 0xFF, 0x61, 0xF7, 0x64, 0x69, 0xFC, 0x27, 0x2D, 0x2A }, NULL, NULL, 0x75FBDE20, 0xA3189B31, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Top Gear Hyper Bike (E) [!]", { 0x00, 0x72, 0x53, 0x8E, 0xF9, 0x25, 0x64, 0x5D, 0xB3, 0x10, 0xF8, 0xE2, 0x3A, 0x48, 0x0B, 0x89 }, NULL, NULL, 0x5F3F49C6, 0x0DC714B0, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Top Gear Hyper Bike (E) [b1]", { 0x56, 0x1B, 0x43, 0x8F, 0x6E, 0x82, 0x40, 0xBE, 0xF1, 0xDA, 0xEB, 0x36, 0xAA, 0xE7, 0x26, 0x75 }, NULL, NULL, 0x5F3F49C6, 0x0DC714B0, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Top Gear Hyper Bike (J) [!]", { 0x43, 0x47, 0x17, 0x4B, 0xB4, 0x15, 0xCA, 0x97, 0x0F, 0x2D, 0x50, 0xDF, 0x29, 0x73, 0xF6, 0x56 }, NULL, NULL, 0x845B0269, 0x57DE9502, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Top Gear Hyper Bike (U) [!]", { 0x72, 0x58, 0xF4, 0xAB, 0x36, 0x7B, 0x02, 0x5C, 0x95, 0xA4, 0xF4, 0x76, 0xC4, 0x61, 0xE7, 0x17 }, NULL, NULL, 0x8ECC02F0, 0x7F8BDE81, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Top Gear Overdrive (E) [!]", { 0x6C, 0x65, 0xA2, 0x52, 0xF2, 0x27, 0xAE, 0xF1, 0x8D, 0xF2, 0xDD, 0x3C, 0xE0, 0x4C, 0xC8, 0x21 }, NULL, NULL, 0xD09BA538, 0x1C1A5489, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Top Gear Overdrive (E) [h1C]", { 0x11, 0xD6, 0xFF, 0xF2, 0x88, 0xDE, 0x1B, 0xD6, 0x1C, 0xCB, 0xD7, 0xCC, 0xA0, 0xC4, 0xA9, 0x7B }, NULL, NULL, 0xD09BA538, 0x1C1A5489, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Top Gear Overdrive (J) [!]", { 0xB5, 0x69, 0x17, 0x94, 0xA8, 0x51, 0xD8, 0xB6, 0x03, 0xF0, 0xC7, 0x41, 0xD4, 0x4A, 0xA2, 0x44 }, NULL, NULL, 0x0578F24F, 0x9175BF17, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Top Gear Overdrive (J) [b1]", { 0x8C, 0x0F, 0x46, 0xFE, 0xF9, 0xA6, 0x03, 0x4F, 0xCF, 0x0B, 0x7D, 0x69, 0x52, 0xFF, 0xEC, 0x53 }, NULL, NULL, 0x0578F24F, 0x9175BF17, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Top Gear Overdrive (U) [!]", { 0x78, 0x18, 0x69, 0x64, 0x26, 0xC0, 0xA4, 0x29, 0xFB, 0xFC, 0xCC, 0x4E, 0xFE, 0x8D, 0x55, 0x70 }, NULL, NULL, 0xD741CD80, 0xACA9B912, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Top Gear Overdrive (U) [o1]", { 0x77, 0x3F, 0xD4, 0x46, 0xDA, 0x7F, 0x4E, 0x39, 0x29, 0x07, 0x50, 0x50, 0x53, 0xBF, 0x2A, 0x42 }, NULL, NULL, 0xD741CD80, 0xACA9B912, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Top Gear Overdrive (U) [t1]", { 0x21, 0x12, 0x56, 0xAB, 0xBC, 0x08, 0x44, 0xD9, 0x15, 0x2D, 0x6A, 0x7F, 0xFA, 0x9E, 0x48, 0xBD }, NULL, NULL, 0x0F5FD10B, 0xAAEDEBEB, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "Top Gear Rally (As) [!]", { 0x50, 0x19, 0x52, 0x16, 0xC8, 0xA3, 0x7F, 0x9B, 0xD5, 0xB2, 0x10, 0x5A, 0x40, 0xEE, 0x8D, 0x8F }, NULL, NULL, 0x1A4D3AD8, 0x59AF7FA9, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Top Gear Rally (E) [!]", { 0x16, 0x98, 0x50, 0x8F, 0x52, 0x12, 0x80, 0xD0, 0xA8, 0x0E, 0x07, 0x8E, 0xC9, 0x81, 0xD4, 0xAC }, NULL, NULL, 0x7F43E701, 0x536328D1, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Top Gear Rally (E) [b1]", { 0x48, 0xD6, 0xC1, 0x94, 0xAE, 0x10, 0x60, 0x18, 0xDD, 0xFC, 0x34, 0x86, 0xA8, 0xB3, 0x47, 0xF7 }, NULL, NULL, 0x7F43E701, 0x536328D1, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Top Gear Rally (E) [h1C]", { 0x10, 0x8F, 0x66, 0x09, 0xCB, 0x13, 0x18, 0x30, 0xEC, 0x4C, 0x67, 0xF4, 0xA8, 0xA7, 0x1D, 0x30 }, NULL, NULL, 0x7F43E701, 0x536328D1, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Top Gear Rally (J) [!]", { 0x6E, 0x0A, 0xF1, 0x3D, 0xCE, 0xFE, 0xE6, 0xA1, 0x1C, 0x4D, 0x72, 0x62, 0x20, 0x6D, 0x6D, 0x2D }, NULL, NULL, 0x0E596247, 0x753D4B8B, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Top Gear Rally (U) [!]", { 0x6F, 0x70, 0x30, 0x28, 0x4B, 0x6B, 0xC8, 0x4A, 0x49, 0xE0, 0x7D, 0xA8, 0x64, 0x52, 0x6B, 0x52 }, NULL, NULL, 0x62269B3D, 0xFE11B1E8, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Top Gear Rally (U) [b1]", { 0xFA, 0x88, 0x96, 0x9E, 0xCF, 0xA7, 0x23, 0x58, 0xEF, 0x1C, 0x04, 0x50, 0x35, 0x44, 0x2F, 0x5C }, NULL, NULL, 0x62269B3D, 0xFE11B1E8, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Top Gear Rally (U) [b2]", { 0xE9, 0xE3, 0x68, 0x0C, 0x47, 0xCE, 0x09, 0x3A, 0x3F, 0x07, 0x65, 0x53, 0x9F, 0x31, 0xC6, 0xAE }, NULL, NULL, 0x62269B3D, 0xFE11B1E8, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Top Gear Rally (U) [b3]", { 0x19, 0x4C, 0xE1, 0x3B, 0x2B, 0x6B, 0x1F, 0x58, 0x45, 0x87, 0xA6, 0x8C, 0xC2, 0xF3, 0x98, 0xDC }, NULL, NULL, 0x62269B3D, 0xFE11B1E8, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Top Gear Rally (U) [o1]", { 0x4F, 0xCD, 0x85, 0xC4, 0x87, 0xE1, 0xFB, 0xED, 0xFD, 0x85, 0xE2, 0x7F, 0x99, 0x1D, 0x1F, 0xA6 }, NULL, NULL, 0x62269B3D, 0xFE11B1E8, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Top Gear Rally 2 (Beta)", { 0xC3, 0x3C, 0xD9, 0x26, 0xE1, 0xE7, 0x1F, 0x39, 0xF7, 0x23, 0x8A, 0xF7, 0xB9, 0xE0, 0xDC, 0x5C }, NULL, NULL, 0xEFDF9140, 0xA4168D6B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Top Gear Rally 2 (E) [!]", { 0x44, 0xC4, 0x56, 0x65, 0x72, 0xDC, 0x06, 0x62, 0xD4, 0x29, 0x9A, 0xB5, 0xB1, 0x90, 0x43, 0xAE }, NULL, NULL, 0xBEBAB677, 0x51B0B5E4, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Top Gear Rally 2 (J) [!]", { 0xB1, 0x0D, 0x78, 0x1E, 0xC6, 0x25, 0xCA, 0x45, 0x71, 0x3F, 0xD3, 0x4E, 0x50, 0x96, 0xC2, 0x4A }, NULL, NULL, 0xCFEF2CD6, 0xC9E973E6, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Top Gear Rally 2 (U) [!]", { 0x1F, 0xA4, 0x09, 0xFC, 0xAC, 0x00, 0x7D, 0xDE, 0xCC, 0xC4, 0xCF, 0x43, 0x9A, 0x0D, 0x8D, 0xAE }, NULL, NULL, 0xBE5973E0, 0x89B0EDB8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Top Gear Rally 2 (U) [f1] (PAL)", { 0x46, 0x48, 0xC4, 0xF6, 0x56, 0xBD, 0x4A, 0x74, 0x64, 0x7D, 0xF6, 0xA7, 0xA2, 0x98, 0x5F, 0x37 }, NULL, NULL, 0x1C952873, 0xFDA4238B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "TopGun Demo by Horizon64 (PD)", { 0xCA, 0xA7, 0xCA, 0xA9, 0xAD, 0xFB, 0x4B, 0x8E, 0x4B, 0x2D, 0xBE, 0xD8, 0x8F, 0x96, 0x3D, 0x07 }, NULL, NULL, 0xE8BF8416, 0xF2D9DA43, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Tower&Shaft (Aleck64)", { 0x3C, 0xBB, 0x80, 0x12, 0xF1, 0x25, 0x6A, 0x37, 0xD5, 0x28, 0x4A, 0x85, 0xB8, 0x59, 0xCC, 0x8B }, NULL, NULL, 0x90AF8D2C, 0xE1AC1B37, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xB },
+    { "Toy Story 2 - Buzz Lightyear to the Rescue! (E) [!]", { 0x5F, 0x2C, 0x9E, 0x5E, 0x39, 0xAB, 0x09, 0x31, 0x1D, 0x96, 0xE6, 0xC7, 0x51, 0x18, 0x4B, 0x6B }, NULL, NULL, 0xCCEB3858, 0x26952D97, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Toy Story 2 - Buzz L'eclair A La Rescousse! (F) [!]", { 0xFA, 0x0F, 0x12, 0xC1, 0x5B, 0x36, 0x55, 0xF9, 0xF5, 0x68, 0x88, 0xC3, 0x24, 0x9B, 0x1C, 0xED }, NULL, NULL, 0xCB93DB97, 0x7F5C63D5, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Toy Story 2 - Captain Buzz Lightyear auf Rettungsmission! (G) (V1.0) [!]", { 0x3F, 0x40, 0xF3, 0x7B, 0x04, 0x64, 0xDD, 0x06, 0x50, 0x67, 0x52, 0x3F, 0xB2, 0x10, 0x16, 0xDD }, NULL, NULL, 0x782A9075, 0xE552631D, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Toy Story 2 - Captain Buzz Lightyear auf Rettungsmission! (G) (V1.1) [!]", { 0xA4, 0xA2, 0xB8, 0x25, 0x79, 0x7E, 0x20, 0x59, 0xB5, 0xDF, 0x60, 0xD7, 0x33, 0x46, 0x1F, 0x34 }, NULL, NULL, 0xBC4F2AB8, 0xAA99E32E, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Toy Story 2 - Buzz Lightyear to the Rescue! (U) [!]", { 0xB4, 0x4E, 0x9C, 0x2D, 0x9D, 0x2F, 0x2D, 0xE3, 0xAF, 0x47, 0x93, 0xB8, 0x24, 0xCC, 0xF9, 0x36 }, NULL, NULL, 0xA150743E, 0xCF2522CD, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Toy Story 2 - Buzz Lightyear to the Rescue! (U) (V1.0) [f1] (PAL)", { 0x9E, 0x4F, 0x62, 0xBD, 0x67, 0x2E, 0x36, 0x01, 0xF1, 0xBB, 0xF9, 0xCD, 0xAB, 0x79, 0x1F, 0x9F }, NULL, NULL, 0x161545FE, 0xA3C44C28, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Toy Story 2 - Buzz Lightyear to the Rescue! (U) (V1.0) [t1]", { 0xF5, 0x51, 0xAD, 0xA6, 0xC6, 0xFC, 0x18, 0x77, 0xFC, 0xA0, 0x51, 0x5D, 0xF4, 0xF5, 0x15, 0xDF }, NULL, NULL, 0x1416FEBB, 0x93472028, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Toy Story 2 - Buzz Lightyear to the Rescue! (U) (V1.1) [!]", { 0xCD, 0x61, 0xA7, 0xFD, 0xBD, 0x72, 0x97, 0x73, 0x3B, 0x24, 0x62, 0x04, 0xE8, 0x36, 0x0D, 0x83 }, NULL, NULL, 0xC151AD61, 0x280FFF22, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Transformers - Beast Wars Metals 64 (J) [!]", { 0x3D, 0x22, 0xD5, 0xBD, 0x79, 0x97, 0x29, 0x36, 0x12, 0xEC, 0xDD, 0x30, 0x46, 0xBE, 0xBA, 0x13 }, NULL, NULL, 0x91691C3D, 0xF4AC5B4D, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 1, 1, 0, 0x900, 100, 0x23B },
+    { "Transformers - Beast Wars Transmetal (U) [!]", { 0x6D, 0x38, 0x90, 0x9F, 0xAA, 0x28, 0x40, 0xFC, 0x40, 0x9A, 0xFA, 0x22, 0x14, 0x89, 0xDE, 0x49 }, NULL, NULL, 0x4D79D316, 0xE8501B33, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Triple Play 2000 (U) [!]", { 0x6F, 0x2C, 0x37, 0xA2, 0x0E, 0x6E, 0xCC, 0xB6, 0x57, 0xFB, 0xFC, 0x4B, 0xA3, 0x6A, 0x34, 0xBB }, NULL, NULL, 0xFE4B6B43, 0x081D29A7, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Tristar and Lightforce Quake Intro by Ayatollah & Mike (PD)", { 0x25, 0xE0, 0x37, 0x63, 0xFC, 0x8A, 0x38, 0x8A, 0x33, 0x87, 0x1C, 0x58, 0xDF, 0xEB, 0x7C, 0x0E }, NULL, NULL, 0xF4D89C08, 0x3F34930D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Tsumi to Batsu - Hoshi no Keishousha (Ch) (iQue) [!]", { 0x5B, 0xA3, 0xAA, 0x29, 0x53, 0xC4, 0x7C, 0x8B, 0x2E, 0x61, 0x5B, 0x21, 0xE6, 0x0F, 0x2F, 0x17 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x11 },
+    { "Tsumi to Batsu - Hoshi no Keishousha (Ch) (iQue) (Manual) [!]", { 0x9A, 0xBB, 0x0F, 0x6F, 0x79, 0xE0, 0x1F, 0xC9, 0xA9, 0x42, 0xD6, 0x02, 0x77, 0x19, 0xC3, 0xE4 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Tsumi to Batsu - Hoshi no Keishousha (J) [!]", { 0xA0, 0x65, 0x7B, 0xC9, 0x9E, 0x16, 0x91, 0x53, 0xFD, 0x46, 0xAE, 0xCC, 0xFD, 0xE7, 0x48, 0xF3 }, NULL, NULL, 0xB6BC0FB0, 0xE3812198, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Tsumi to Batsu - Hoshi no Keishousha (J) [T+Eng1.0_Zoinkity]", { 0x6E, 0x51, 0xB1, 0x40, 0xA9, 0xB0, 0xC3, 0x0D, 0x6F, 0x55, 0xCA, 0x79, 0x42, 0xA9, 0x69, 0xFC }, NULL, NULL, 0xB73AB6F6, 0x296267DD, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Tsumi to Batsu - Hoshi no Keishousha (J) [T+Spa1.0b_TheFireRed&IlDucci]", { 0x79, 0xBD, 0x05, 0xA9, 0x7E, 0x50, 0xAC, 0x63, 0xA6, 0x38, 0xE4, 0xE9, 0x0A, 0xB9, 0x58, 0x8B }, NULL, NULL, 0xB1C7794B, 0xD93DC5F3, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Tsumi to Batsu - Hoshi no Keishousha (J) [T+Spa1.0b_TheFireRed&IlDucci] (Fandub)", { 0x10, 0x3E, 0x16, 0xBF, 0x7F, 0xCF, 0xB4, 0xD7, 0x13, 0xD2, 0xEB, 0xE1, 0x9D, 0xCB, 0x53, 0x11 }, NULL, NULL, 0xB1C7794B, 0xD93DC5F3, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "Turok - Dinosaur Hunter (E) (V1.0) [!]", { 0x13, 0xFA, 0xA5, 0x86, 0x04, 0x59, 0x7E, 0x4E, 0xDC, 0x60, 0x80, 0x70, 0xF8, 0xE0, 0xAE, 0x24 }, NULL, NULL, 0x2F7009DD, 0xFC3BAC53, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (E) (V1.0) [b1]", { 0x6D, 0x51, 0x47, 0xA9, 0xCD, 0x7D, 0xDD, 0x0F, 0x1F, 0xA8, 0xB8, 0xBD, 0xA4, 0x39, 0xA7, 0x34 }, NULL, NULL, 0x665F09DD, 0xFC3BAC53, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (E) (V1.0) [h1C]", { 0xE8, 0x87, 0xBE, 0xE5, 0xB1, 0xDE, 0x4E, 0x4D, 0x92, 0xAD, 0xA1, 0x83, 0xA2, 0x45, 0x15, 0x0E }, NULL, NULL, 0x2F7009DD, 0xFC3BAC53, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (E) (V1.1) [!]", { 0x99, 0x2B, 0xA7, 0x2F, 0x4A, 0x1E, 0x9C, 0x51, 0x93, 0x4F, 0xF3, 0x45, 0xCD, 0xD0, 0xD9, 0x0C }, NULL, NULL, 0x2F700DCD, 0x176CC5C9, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (E) (V1.2) [!]", { 0x54, 0x8F, 0xC0, 0xE6, 0x03, 0x5B, 0x65, 0xBC, 0x21, 0x08, 0x25, 0x50, 0x39, 0x85, 0x99, 0x34 }, NULL, NULL, 0x2F700DCD, 0x176CC5C9, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (G) (V1.0) [!]", { 0x0C, 0x0B, 0xFD, 0x10, 0x38, 0xED, 0xA4, 0xF5, 0xC9, 0x58, 0xDC, 0x36, 0x2C, 0xDF, 0xF2, 0xD6 }, NULL, NULL, 0x665FD963, 0xB5CC6612, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (G) (V1.1) [!]", { 0x38, 0x84, 0x40, 0x01, 0x36, 0x41, 0x88, 0x7D, 0x85, 0xB7, 0x91, 0xCF, 0x01, 0x72, 0x9F, 0xA8 }, NULL, NULL, 0x665FC793, 0x6934A73B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (G) (V1.2) [!]", { 0xF0, 0xF6, 0x87, 0xB4, 0x49, 0xA9, 0xF4, 0xB0, 0xBF, 0xF0, 0x81, 0x04, 0xC3, 0x5E, 0xA0, 0x8C }, NULL, NULL, 0x665FC793, 0x6934A73B, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (U) (V1.0) (Analog Movement Controls_1.01 - No Invert)", { 0x85, 0xF6, 0x16, 0xE5, 0x41, 0x60, 0xFF, 0xE1, 0x4E, 0x4E, 0x81, 0x70, 0x65, 0xEA, 0x61, 0xCE }, NULL, NULL, 0x2F70F10D, 0x5C4187FF, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (U) (V1.0) [!]", { 0xAE, 0x51, 0x07, 0xEF, 0xDD, 0x3C, 0x21, 0x0E, 0x1E, 0xDD, 0x4A, 0xCD, 0x9B, 0x3C, 0xAC, 0x31 }, NULL, NULL, 0x2F70F10D, 0x5C4187FF, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (U) (V1.0) [b1]", { 0xE5, 0xB2, 0x07, 0xE7, 0xC8, 0xDB, 0xD8, 0xBA, 0xF9, 0xB4, 0x2C, 0x96, 0xEF, 0x3C, 0x42, 0xE8 }, NULL, NULL, 0x2F70F10D, 0x5C4187FF, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (U) (V1.0) [h1C]", { 0x7B, 0xBD, 0x5A, 0x15, 0x94, 0x52, 0x6D, 0xE1, 0xCE, 0x6A, 0x16, 0xF4, 0xFA, 0xF8, 0x2E, 0x7D }, NULL, NULL, 0x2F70F10D, 0x5C4187FF, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (U) (V1.0) [o1]", { 0x9D, 0x25, 0x8D, 0xF0, 0x27, 0xED, 0x36, 0x98, 0x86, 0xA0, 0x24, 0x9B, 0xFC, 0xA9, 0x36, 0xBD }, NULL, NULL, 0x2F70F10D, 0x5C4187FF, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (U) (V1.0) [t1]", { 0xE7, 0x91, 0x68, 0x45, 0xB4, 0x6C, 0x34, 0x82, 0xCF, 0x48, 0x43, 0x96, 0x83, 0x70, 0x55, 0x7E }, NULL, NULL, 0x9542E183, 0xB1D245E6, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (U) (V1.0) [t2]", { 0x3D, 0xC5, 0x41, 0xC0, 0xB9, 0x7D, 0xB9, 0xC9, 0x5A, 0x6A, 0xA8, 0xC2, 0xDE, 0xD2, 0x7F, 0x4A }, NULL, NULL, 0x9542E183, 0xB1D245E6, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (U) (V1.1) [!]", { 0x37, 0x26, 0x02, 0x87, 0xD5, 0x9F, 0xE4, 0xEC, 0x60, 0x49, 0xC1, 0xD2, 0x2B, 0x56, 0x14, 0xE6 }, NULL, NULL, 0x2F700DCD, 0x176CC5C9, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Dinosaur Hunter (U) (V1.2) [!]", { 0x03, 0x98, 0x75, 0xB9, 0x2C, 0x0E, 0x4F, 0xEF, 0x97, 0x97, 0xEC, 0x17, 0x44, 0x87, 0x7B, 0x17 }, NULL, NULL, 0x2F700DCD, 0x176CC5C9, 0, SAVETYPE_NONE, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Turok - Legenden des Verlorenen Landes (G) [!]", { 0x72, 0xA6, 0xAA, 0x28, 0x60, 0x8E, 0xE9, 0x3A, 0x1C, 0xB6, 0xFE, 0xB0, 0xA5, 0xF4, 0xC2, 0x8C }, NULL, NULL, 0x66E4FA0F, 0xDE88C7D0, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok - Rage Wars (E) (M3) (Eng-Fre-Ita) [!]", { 0x24, 0x1C, 0xF9, 0x4B, 0xED, 0x48, 0x7F, 0xFF, 0x62, 0xFF, 0xB7, 0xB8, 0x46, 0xDA, 0x46, 0xAB }, NULL, NULL, 0xB6BE20A5, 0xFACAF66D, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok - Rage Wars (E) [!]", { 0xDB, 0xA1, 0x66, 0xA4, 0x27, 0x10, 0xF4, 0x0D, 0xC7, 0x8D, 0xC5, 0x2E, 0xB3, 0x7B, 0x0B, 0xE6 }, NULL, NULL, 0x1EA26214, 0xE790900F, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok - Rage Wars (U) (V1.0) [!]", { 0xCF, 0x5B, 0x28, 0x57, 0x8F, 0xD6, 0x2F, 0xA1, 0xFF, 0x86, 0x90, 0x07, 0x9F, 0x5D, 0x68, 0xF5 }, NULL, NULL, 0xADB9498B, 0xDAF28F55, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok - Rage Wars (U) (V1.0) [f1] (PAL)", { 0x07, 0xE1, 0x23, 0xE1, 0x04, 0xBA, 0x7B, 0x33, 0x5B, 0x53, 0x93, 0x2E, 0xDB, 0x2C, 0xFB, 0x2F }, NULL, NULL, 0x700694EA, 0x636C43D5, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok - Rage Wars (U) (V1.0) [f2] (PAL)", { 0xCA, 0x82, 0x52, 0x27, 0xE9, 0xE2, 0x03, 0xE8, 0x42, 0x96, 0x00, 0x18, 0x98, 0x25, 0xAD, 0x74 }, NULL, NULL, 0x72618906, 0x0EDC784B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok - Rage Wars (U) (V1.1) [!]", { 0x9B, 0x2F, 0xFE, 0x72, 0x08, 0x0B, 0x03, 0xA5, 0xF9, 0x2E, 0xB8, 0x7E, 0xA8, 0x49, 0xCA, 0xC4 }, NULL, NULL, 0x2388984C, 0xDA7B3CC5, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 2 - Seeds of Evil (E) (Kiosk Demo) [!]", { 0xCE, 0x72, 0x23, 0x77, 0x07, 0xF4, 0x81, 0xCF, 0xE9, 0x7F, 0xDE, 0x33, 0x0C, 0x2A, 0xFC, 0xD6 }, NULL, NULL, 0xE8C95AFC, 0x35D121DA, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 2 - Seeds of Evil (E) (M4) [!]", { 0x14, 0x4B, 0x10, 0xA4, 0x84, 0xA2, 0x23, 0x67, 0xFD, 0x26, 0x79, 0x52, 0x9D, 0xBD, 0x2F, 0xED }, NULL, NULL, 0x2E0E7749, 0xB8B49D59, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 2 - Seeds of Evil (E) [!]", { 0xE5, 0xA3, 0x95, 0x21, 0xFA, 0x95, 0x4E, 0xB9, 0x7B, 0x96, 0xAC, 0x21, 0x54, 0xA5, 0xFD, 0x7A }, NULL, NULL, 0xE0B92B94, 0x80E87CBD, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 2 - Seeds of Evil (E) [b1]", { 0xAC, 0x1C, 0x00, 0x16, 0x7B, 0x95, 0x92, 0x9F, 0x8E, 0xE4, 0x0D, 0xFA, 0xCB, 0x49, 0xBB, 0x57 }, NULL, NULL, 0xE0B92B94, 0x80E87CBD, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 2 - Seeds of Evil (G) [!]", { 0xB9, 0x32, 0x11, 0x6C, 0x96, 0x77, 0x95, 0x07, 0x6B, 0x5C, 0x11, 0x28, 0x41, 0xAB, 0x44, 0x27 }, NULL, NULL, 0xFE05840B, 0x9393320C, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 2 - Seeds of Evil (U) (Kiosk Demo) [!]", { 0x3B, 0xD4, 0x2F, 0x6A, 0xEC, 0x47, 0x7C, 0x05, 0x6E, 0x1A, 0xFE, 0xBB, 0x35, 0x15, 0x49, 0x5C }, NULL, NULL, 0xE8C95AFC, 0x35D121DA, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 2 - Seeds of Evil (U) (Kiosk Demo) (Gore On Hack)", { 0x42, 0x50, 0xFF, 0x02, 0x65, 0xAD, 0x72, 0xFC, 0x79, 0x8E, 0x6A, 0xBA, 0x61, 0xCF, 0xCD, 0x0E }, NULL, NULL, 0xAAD95AFC, 0xBB3A44AC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 2 - Seeds of Evil (U) (Kiosk Demo) [h1C]", { 0x4E, 0xA0, 0xF7, 0x56, 0x3F, 0x2E, 0xAE, 0xB3, 0xD4, 0x6E, 0x86, 0x0C, 0x12, 0xFA, 0xBF, 0xCB }, NULL, NULL, 0xE8C95AFC, 0x35D121DA, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 2 - Seeds of Evil (U) (V1.1) [!]", { 0x16, 0x62, 0x21, 0x36, 0x5D, 0xB7, 0x0D, 0x44, 0x6C, 0x42, 0x06, 0x08, 0x3D, 0x42, 0x2D, 0xD1 }, NULL, NULL, 0xE0B92B94, 0xB9A7E025, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 2 - Seeds of Evil (U) (V1.0) [!]", { 0xFA, 0xD4, 0xDA, 0x8E, 0x17, 0xCE, 0x12, 0xF6, 0x8C, 0xDF, 0x29, 0x18, 0x0C, 0xDD, 0x4A, 0x90 }, NULL, NULL, 0x49088A11, 0x6494957E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 2 - Seeds of Evil (U) (V1.0) [t1]", { 0x8D, 0xC2, 0x01, 0xA0, 0xA9, 0xCF, 0xD1, 0xD2, 0xC8, 0x5E, 0xE2, 0xB4, 0x2D, 0x8A, 0xC4, 0x9A }, NULL, NULL, 0x544E3629, 0x875BDD4A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 2 - Seeds of Evil (U) (V1.0) [t2]", { 0x72, 0xBA, 0x2C, 0x69, 0x3E, 0xFA, 0x5F, 0xF3, 0xB8, 0x03, 0x74, 0xCD, 0xBD, 0x0C, 0x95, 0x7B }, NULL, NULL, 0x544E3629, 0x875BDD4A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 2 - Seeds of Evil (U) (V1.0) [t3]", { 0x40, 0x1C, 0x0D, 0xBD, 0xF4, 0x9A, 0x64, 0x29, 0x4D, 0xAA, 0x2B, 0xC8, 0x60, 0x72, 0x45, 0xDD }, NULL, NULL, 0x544E3629, 0x875BDD4A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 3 - Shadow of Oblivion (E) [!]", { 0x27, 0x9E, 0xC8, 0x3B, 0xD6, 0x0A, 0x3C, 0xCE, 0x69, 0xA1, 0xDB, 0x22, 0xB0, 0xA5, 0xC3, 0x18 }, NULL, NULL, 0x6A162FF2, 0x2093704C, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 3 - Shadow of Oblivion (E) (Beta) (2000-05-31)", { 0x03, 0xD1, 0x7A, 0xA3, 0xDC, 0x76, 0x63, 0x50, 0x20, 0x17, 0xD3, 0xCC, 0x5A, 0x19, 0xAA, 0x8B }, NULL, NULL, 0xD124DBB7, 0x7C9FF5E5, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 3 - Shadow of Oblivion (E) (Beta) (2000-06-06)", { 0x69, 0xCE, 0x88, 0xC4, 0x6A, 0x7C, 0x82, 0x9C, 0x6F, 0x54, 0x00, 0x4D, 0xE9, 0x3E, 0xFC, 0xEF }, NULL, NULL, 0x37FA8F16, 0x5F824D37, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 3 - Shadow of Oblivion (E) (Beta) (2000-07-10)", { 0xC3, 0x8A, 0xCB, 0xAE, 0x77, 0x3C, 0xC3, 0x84, 0x5E, 0xA3, 0x54, 0x42, 0x1E, 0x17, 0x19, 0x98 }, NULL, NULL, 0xD25C1211, 0x13EEBF67, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 3 - Shadow of Oblivion (U) (Beta) [h1C]", { 0x0A, 0x3A, 0x4C, 0x76, 0x19, 0x60, 0xF7, 0xD6, 0x48, 0xAF, 0xA6, 0x0B, 0x1E, 0x56, 0x5C, 0x7C }, NULL, NULL, 0xD25C1211, 0x13EEBF67, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 3 - Shadow of Oblivion (U) [!]", { 0x12, 0x11, 0xC5, 0x56, 0xD7, 0x7B, 0x16, 0x9D, 0x81, 0xA6, 0x66, 0xA9, 0x66, 0x1E, 0x17, 0x77 }, NULL, NULL, 0x89A579F1, 0x667E97EF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Turok 3 - Shadow of Oblivion (U) [t1]", { 0x8A, 0x5F, 0x9B, 0x33, 0x08, 0x10, 0x7C, 0x25, 0x3E, 0xC5, 0xDC, 0xA1, 0x98, 0xF5, 0x5C, 0x83 }, NULL, NULL, 0x6192E59D, 0x538A78CF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Twintris by Twinsen (POM '98) (PD)", { 0xA7, 0x47, 0x38, 0xD0, 0x3A, 0xCA, 0x4E, 0x51, 0x69, 0x04, 0x08, 0xD2, 0x03, 0xE8, 0x6D, 0x49 }, NULL, NULL, 0x37B8F920, 0xA58BB3EF, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Twisted Edge Extreme Snowboarding (E) [!]", { 0x42, 0x0C, 0x9F, 0xDB, 0xAE, 0x15, 0x76, 0x7C, 0x5E, 0x58, 0x40, 0x70, 0x20, 0x9F, 0xF2, 0x53 }, NULL, NULL, 0xE688A5B8, 0xB14B3F18, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Twisted Edge Extreme Snowboarding (E) [b1]", { 0x4F, 0x0E, 0x2A, 0xF2, 0x05, 0xBE, 0xEB, 0x49, 0x27, 0x01, 0x54, 0x81, 0x06, 0x60, 0xFF, 0x37 }, NULL, NULL, 0xBBC99D32, 0x117DAA80, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Twisted Edge Extreme Snowboarding (E) [h1C]", { 0xFD, 0xE5, 0xF9, 0x10, 0x97, 0x4A, 0x8B, 0x9C, 0x56, 0x1A, 0x27, 0xB0, 0x7E, 0x68, 0xF2, 0x44 }, NULL, NULL, 0xE688A5B8, 0xB14B3F18, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Twisted Edge Extreme Snowboarding (U) [!]", { 0x9D, 0xF6, 0xC2, 0xC9, 0x7F, 0xA3, 0x4A, 0x97, 0x8E, 0xF3, 0xCB, 0x77, 0x63, 0x15, 0x36, 0xFE }, NULL, NULL, 0xBBC99D32, 0x117DAA80, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "U64 (Chrome) Demo by Horizon64 (PD) [a1]", { 0x0B, 0x0D, 0xF8, 0xEC, 0x74, 0x7B, 0xF9, 0x9F, 0x3A, 0x55, 0xA3, 0x30, 0x0C, 0xE8, 0xBC, 0x0D }, NULL, NULL, 0x7739A454, 0xA2F52A66, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "U64 (Chrome) Demo by Horizon64 (PD) [a1][b1]", { 0x9B, 0x4E, 0xFC, 0x22, 0x8C, 0x89, 0x4E, 0x1B, 0xA8, 0x0D, 0x7D, 0x11, 0xFD, 0xA4, 0xE0, 0x37 }, NULL, NULL, 0x7739A454, 0xA2F52A66, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "U64 (Chrome) Demo by Horizon64 (PD) [b1]", { 0xDF, 0xB4, 0x37, 0xBF, 0xB3, 0x28, 0x64, 0xA1, 0x7E, 0x90, 0x3F, 0xED, 0xE9, 0xEC, 0x3A, 0x27 }, NULL, NULL, 0x95013CCC, 0x73F7C072, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "U64 (Chrome) Demo by Horizon64 (PD)", { 0x33, 0xEF, 0xC3, 0x23, 0xAA, 0x05, 0xF5, 0x22, 0xCE, 0xF2, 0x32, 0x4C, 0xC1, 0xD3, 0xF5, 0xDD }, NULL, NULL, 0x7739A454, 0xA2F52A66, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "U64 (Chrome) Demo by Horizon64 (older) (PD) [b1]", { 0xA5, 0x6B, 0xEF, 0x4C, 0x7E, 0x68, 0x99, 0xA9, 0x6F, 0x1F, 0x33, 0x42, 0x4B, 0x43, 0x47, 0x90 }, NULL, NULL, 0x95013CCC, 0x73F7C072, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "U64 (Chrome) Demo by Horizon64 (older) (PD)", { 0x26, 0x28, 0x81, 0x8A, 0xF2, 0xFE, 0xE3, 0xC6, 0x49, 0xAA, 0xF8, 0x62, 0x79, 0x81, 0xA6, 0x3D }, NULL, NULL, 0x95013CCC, 0x73F7C072, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Uchhannanchan no Hono no Challenger - Denryu IraIra Bou (J) [!]", { 0xFF, 0xEB, 0x5C, 0x1A, 0x85, 0xBA, 0xBB, 0xBE, 0x60, 0xF2, 0xFE, 0xBA, 0x2B, 0x35, 0xC8, 0x93 }, NULL, NULL, 0x28D5562D, 0xE4D5AE50, 0, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x73 },
+    { "Uchhannanchan no Hono no Challenger - Denryu IraIra Bou (J) [h1C]", { 0x07, 0xB7, 0xA5, 0xCF, 0xDE, 0x9B, 0xC4, 0x3F, 0x02, 0xA6, 0x22, 0x38, 0x7C, 0x5B, 0x5C, 0x58 }, NULL, NULL, 0x28D5562D, 0xE4D5AE50, 0, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x73 },
+    { "Uchhannanchan no Hono no Challenger - Denryu IraIra Bou (J) [h2C]", { 0x6A, 0xFA, 0x47, 0x67, 0x87, 0xB7, 0x62, 0xDC, 0x08, 0xF5, 0xB9, 0xEE, 0xB2, 0x37, 0xC4, 0xEE }, NULL, NULL, 0x28D5562D, 0xE4D5AE50, 0, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x73 },
+    { "Uchhannanchan no Hono no Challenger - Denryu IraIra Bou (J) [o1]", { 0xD4, 0x2E, 0x44, 0x96, 0xBE, 0xA3, 0xC6, 0x1E, 0x35, 0x36, 0x43, 0xC8, 0x43, 0x8C, 0xD9, 0xC7 }, NULL, NULL, 0x28D5562D, 0xE4D5AE50, 0, SAVETYPE_EEPROM_4K, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x73 },
+    { "Ultra Demo Bootcode by Locke^ (PD) [h1C]", { 0xCE, 0xED, 0xAB, 0x23, 0x29, 0x9F, 0xA0, 0x03, 0xF3, 0x29, 0x75, 0xA4, 0xC1, 0xE4, 0x07, 0xE3 }, NULL, NULL, 0xED42A2D4, 0x7A71CD91, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Ultra Demo Bootcode by Locke^ (PD)", { 0xB8, 0x82, 0xED, 0xA9, 0xCB, 0xF8, 0x32, 0xBE, 0xEA, 0x26, 0x41, 0xE4, 0x42, 0xA7, 0x9E, 0xDD }, NULL, NULL, 0xED42A2D4, 0x7A71CD91, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Ultra Demo by Locke^ (PD) [a1]", { 0x7E, 0x64, 0x56, 0xE1, 0x04, 0x50, 0x3B, 0x51, 0xA9, 0x77, 0x35, 0xC8, 0xFF, 0x34, 0x9E, 0x4C }, NULL, NULL, 0xED42A2D4, 0x7A71CD91, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Ultra Demo by Locke^ (PD)", { 0x2E, 0x2C, 0x99, 0x0D, 0x8B, 0xBA, 0xEE, 0x7E, 0x06, 0x81, 0xFD, 0xC8, 0x9C, 0x29, 0xC0, 0xF3 }, NULL, NULL, 0xED42A2D4, 0x7A71CD91, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "UltraMSX2 V1.0 by Jos Kwanten (PD) [f1] (V64)", { 0x1D, 0xE0, 0x7F, 0xCA, 0x04, 0xFB, 0x08, 0x10, 0xD9, 0x5B, 0x8A, 0xE4, 0xDA, 0x17, 0x3A, 0x2E }, NULL, NULL, 0x31C41A8B, 0x544057AE, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "UltraMSX2 V1.0 by Jos Kwanten (PD)", { 0x6A, 0x11, 0xF7, 0xEB, 0x31, 0x9C, 0xF6, 0x03, 0xAB, 0x30, 0xA2, 0x81, 0xE0, 0x63, 0x91, 0x26 }, NULL, NULL, 0x4E7DE4EF, 0x0DEC3712, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "UltraMSX2 V1.0 w-F1 Spirit by Jos Kwanten (PD)", { 0xFC, 0xA7, 0xBE, 0x07, 0x8D, 0x6D, 0xC6, 0x8A, 0xC6, 0xF2, 0xE1, 0xB7, 0xB4, 0x36, 0x97, 0x20 }, NULL, NULL, 0x504ABA0A, 0x269AA7F4, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "UltraMSX2 V1.0 w-Salamander by Jos Kwanten (PD)", { 0xD2, 0xBD, 0x19, 0xA0, 0x87, 0x3A, 0x69, 0x00, 0xAE, 0xF0, 0x7E, 0xCC, 0xE1, 0x03, 0x71, 0x0C }, NULL, NULL, 0xFF922478, 0x570B5673, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "UltraSMS V1.0 by Jos Kwanten (PD) [f1] (V64)", { 0x8E, 0x3D, 0x79, 0xFD, 0x6C, 0x08, 0x9F, 0x88, 0xED, 0x7A, 0x2C, 0xC1, 0xCD, 0xBD, 0xD5, 0x35 }, NULL, NULL, 0xCD29E6E5, 0x4533F032, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "UltraSMS V1.0 by Jos Kwanten (PD)", { 0x80, 0x95, 0xB5, 0x92, 0x6A, 0x9F, 0xA7, 0xA0, 0xC9, 0xDA, 0x7B, 0x46, 0x73, 0x15, 0x13, 0xA1 }, NULL, NULL, 0xF291B959, 0xA24CBCAF, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Ultrafox 64 by Megahawks (PD)", { 0x27, 0xCB, 0x29, 0x0F, 0xAB, 0x6C, 0x32, 0xFA, 0xA7, 0x5E, 0xB0, 0xE5, 0x3B, 0xE7, 0x34, 0x18 }, NULL, NULL, 0x66D8DE56, 0xC2AA25B2, 3, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Unix SRAM-Upload Utility 1.0 by Madman (PD)", { 0xC0, 0xB2, 0x45, 0xE9, 0x5A, 0x0C, 0xE7, 0x36, 0xE1, 0x40, 0x1A, 0x21, 0x83, 0xC3, 0xBB, 0xD1 }, NULL, NULL, 0x5F44492A, 0x18552A0A, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "V-Rally Edition 99 (E) (M3) [!]", { 0xDC, 0xAC, 0x12, 0xEB, 0x58, 0x32, 0xD4, 0xA4, 0x89, 0x18, 0x83, 0x30, 0xEB, 0x9E, 0xC3, 0x87 }, NULL, NULL, 0x636E6B19, 0xE57DDC5F, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "V-Rally Edition 99 (E) (M3) [f1] (NTSC)", { 0x7D, 0xCE, 0xAF, 0xF2, 0x4B, 0xB1, 0xBB, 0x3D, 0x9B, 0x8F, 0xE9, 0xB7, 0x8C, 0xCC, 0x70, 0x48 }, NULL, NULL, 0x75CF4CCD, 0xF47E10F6, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "V-Rally Edition 99 (J) [!]", { 0x85, 0x41, 0xD7, 0xA8, 0x73, 0x7B, 0xE0, 0x9C, 0x52, 0xD4, 0xEC, 0x12, 0x74, 0xDE, 0x2A, 0x91 }, NULL, NULL, 0x4D0224A5, 0x1BEB5794, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "V-Rally Edition 99 (U) [!]", { 0x0C, 0x34, 0x48, 0xA9, 0xD8, 0x53, 0x00, 0xAC, 0xB9, 0xC5, 0x55, 0x6F, 0x27, 0xA8, 0x4B, 0x23 }, NULL, NULL, 0x3C059038, 0xC8BF2182, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "V-Rally Edition 99 (U) [f1] (PAL)", { 0x97, 0x68, 0xA9, 0x87, 0x4D, 0x83, 0x29, 0x56, 0x9F, 0x8F, 0xB2, 0x7E, 0xC0, 0xAB, 0x72, 0x3B }, NULL, NULL, 0x6F48FF84, 0x754B4549, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "V64Jr 512M Backup Program by HKPhooey (PD)", { 0x7E, 0x0A, 0xC3, 0x91, 0x72, 0x27, 0xED, 0xF5, 0x11, 0x32, 0xFB, 0xEB, 0xB8, 0x67, 0xFF, 0x9B }, NULL, NULL, 0x760EF304, 0xAD6D6A7C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "V64Jr Backup Tool V0.2b_Beta by RedboX (PD)", { 0xFD, 0x52, 0x3A, 0xF9, 0x83, 0x2B, 0x5A, 0x17, 0xF0, 0xEB, 0x96, 0xED, 0x2A, 0x77, 0xE7, 0x7B }, NULL, NULL, 0xF11B663A, 0x698824C0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "V64Jr Backup Tool by WT_Riker (PD)", { 0x5B, 0xAA, 0x85, 0x76, 0x8F, 0x24, 0x10, 0xC6, 0x1F, 0xBE, 0x2D, 0xFB, 0x62, 0xC3, 0xD8, 0x36 }, NULL, NULL, 0x4BD245D4, 0x4202B322, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "V64Jr Flash Save Util by CrowTRobo (PD)", { 0x19, 0xBA, 0x19, 0x83, 0x4F, 0x94, 0x8E, 0xEE, 0x38, 0x28, 0x64, 0x02, 0x46, 0x40, 0x5B, 0x5D }, NULL, NULL, 0x6FC4EEBC, 0x125BF459, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "VNES64 + Galaga (PD)", { 0x1A, 0x23, 0x2A, 0x07, 0xB0, 0xD2, 0xA1, 0x02, 0xCA, 0x52, 0x8E, 0x75, 0xCB, 0x7B, 0xBA, 0x22 }, NULL, NULL, 0xDCBE12CD, 0xFCCB5E58, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x40F },
+    { "VNES64 + Mario (PD)", { 0x49, 0x5E, 0x0B, 0x30, 0x31, 0x8F, 0xC6, 0x79, 0x78, 0xD6, 0x8B, 0xD0, 0x34, 0x16, 0x59, 0x81 }, NULL, NULL, 0x66807E77, 0xEBEA2D76, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x40F },
+    { "VNES64 + Test Cart (PD)", { 0x29, 0x53, 0x09, 0x1D, 0x64, 0x8E, 0xD1, 0xB6, 0x0A, 0x67, 0x20, 0x0B, 0x17, 0xA9, 0x41, 0x0D }, NULL, NULL, 0x4537BDFF, 0xD1ECB425, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "VNES64 V0.1 by Jean-Luc Picard (POM '98) (PD)", { 0xBE, 0x80, 0x4A, 0x03, 0x17, 0xF1, 0x38, 0x77, 0x54, 0x54, 0x40, 0x51, 0x55, 0xC1, 0xD9, 0xA5 }, NULL, NULL, 0x4537BDFF, 0xD1ECB425, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x40F },
+    { "VNES64 V0.12 by Jean-Luc Picard (PD)", { 0x06, 0x2C, 0x3A, 0xD1, 0x34, 0x78, 0xD5, 0xC7, 0x5B, 0x4E, 0x8D, 0xB2, 0xFF, 0xD5, 0x00, 0xDC }, NULL, NULL, 0x0E4B8C92, 0x7F47A9B8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x40F },
+    { "Vector Demo by Destop (POM '99) (PD)", { 0xB6, 0x1F, 0x53, 0x69, 0x55, 0x17, 0xD3, 0x80, 0xEB, 0x72, 0x40, 0x33, 0x1A, 0x23, 0x42, 0xC2 }, NULL, NULL, 0x1CEACBA0, 0x42BC06D6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "View N64 Test Program (PD) [b1]", { 0xA9, 0x54, 0x42, 0xCE, 0x25, 0xEE, 0xB3, 0xBD, 0x31, 0xCE, 0xF8, 0x52, 0x5B, 0x99, 0x36, 0xFD }, NULL, NULL, 0xA38F7AA6, 0x03A48A45, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "View N64 Test Program (PD)", { 0xCF, 0x17, 0xAF, 0x84, 0x66, 0x2E, 0x14, 0x57, 0xE6, 0x1A, 0xD5, 0x45, 0x75, 0xD5, 0x0D, 0x20 }, NULL, NULL, 0x34B493C9, 0x07654185, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Vigilante 8 (E) [!]", { 0xDF, 0x01, 0x1E, 0x19, 0xF4, 0x1B, 0x1B, 0x19, 0xC2, 0x1F, 0x1E, 0x77, 0xE1, 0x37, 0x80, 0xB7 }, NULL, NULL, 0x151F79F4, 0x8EEDC8E5, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Vigilante 8 (E) [h1C]", { 0x63, 0x7B, 0x9A, 0x40, 0xBE, 0xD7, 0x77, 0xFC, 0x96, 0xEB, 0x1B, 0xD0, 0x7E, 0xA7, 0x47, 0x83 }, NULL, NULL, 0x151F79F4, 0x8EEDC8E5, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Vigilante 8 (F) [!]", { 0xFF, 0x9F, 0x85, 0xC5, 0x09, 0x82, 0xDB, 0xDB, 0xA9, 0x85, 0x3A, 0x89, 0x15, 0x32, 0x1D, 0x31 }, NULL, NULL, 0xE2BC82A2, 0x591CD694, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Vigilante 8 (F) [b1]", { 0xB6, 0x9B, 0x84, 0x08, 0x3D, 0x1B, 0x4E, 0xC9, 0x9A, 0x46, 0x5B, 0x30, 0x67, 0xF7, 0x44, 0x17 }, NULL, NULL, 0xE2BC82A2, 0x591CD694, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Vigilante 8 (G) [!]", { 0x37, 0xB4, 0x30, 0xEE, 0x16, 0x16, 0x78, 0x31, 0xC6, 0xC6, 0x29, 0x29, 0x94, 0xF9, 0x32, 0x77 }, NULL, NULL, 0x6EDA5178, 0xD396FEC1, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Vigilante 8 (U) [!]", { 0xD6, 0x16, 0xAD, 0xF6, 0x44, 0x1A, 0xCB, 0xBD, 0x0E, 0x6B, 0xEF, 0x02, 0x3A, 0x8F, 0x60, 0x31 }, NULL, NULL, 0xEA71056A, 0xE4214847, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Vigilante 8 (U) [b1]", { 0x9F, 0x42, 0x20, 0x9E, 0x41, 0x3A, 0x1A, 0x92, 0xC7, 0x88, 0xBF, 0x7B, 0xC2, 0x6B, 0xFB, 0x7B }, NULL, NULL, 0x5573C64D, 0x905B49FA, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Vigilante 8 (U) [b2]", { 0x5D, 0xDC, 0xE4, 0x47, 0x5A, 0x98, 0xF7, 0xBA, 0x9C, 0xCE, 0x2F, 0x25, 0x57, 0x23, 0xEB, 0x31 }, NULL, NULL, 0xEA71056A, 0xE4214847, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Vigilante 8 (U) [f1] (PAL)", { 0xB6, 0x15, 0x4E, 0xCD, 0x50, 0x05, 0x3C, 0xA9, 0x69, 0x53, 0x17, 0x64, 0x04, 0xB0, 0x78, 0x24 }, NULL, NULL, 0x4FAFC64B, 0xB7DBE63A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Vigilante 8 (U) [f2] (PAL)", { 0xF7, 0x47, 0xB1, 0x78, 0xFF, 0xAB, 0x97, 0xEE, 0x85, 0x45, 0xF7, 0xE6, 0xEF, 0xAE, 0xF7, 0xCA }, NULL, NULL, 0x44C54A0B, 0x22C0B63A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Vigilante 8 (U) [t1]", { 0x82, 0x9E, 0x4F, 0x5D, 0xDE, 0xCE, 0xD5, 0xDB, 0x6C, 0x64, 0xE3, 0x46, 0xED, 0xA4, 0x7E, 0x5C }, NULL, NULL, 0x5573C64D, 0x905B49FA, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Vigilante 8 - 2nd Offence (E) [!]", { 0x47, 0x66, 0x1E, 0xF1, 0x96, 0x45, 0x24, 0xB6, 0x31, 0x9B, 0x75, 0x99, 0x13, 0xF0, 0x8B, 0x62 }, NULL, NULL, 0xDD10BC7E, 0xF900B351, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Vigilante 8 - 2nd Offense (U) [!]", { 0x60, 0xCD, 0xF7, 0x44, 0x5F, 0xAD, 0x2A, 0xBA, 0x05, 0xC9, 0x58, 0xF4, 0x66, 0x91, 0x50, 0x1B }, NULL, NULL, 0xF5C5866D, 0x052713D9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Vigilante 8 - 2nd Offense (U) [f1] (PAL)", { 0x5E, 0x30, 0xD0, 0x20, 0x8F, 0xC4, 0xCB, 0x81, 0x0A, 0x46, 0x4E, 0x5D, 0xEF, 0xFB, 0x29, 0xA3 }, NULL, NULL, 0x098D46A2, 0xD1A4CF3B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Violence Killer - Turok New Generation (J) [!]", { 0xC3, 0x00, 0x5D, 0x76, 0xAF, 0x42, 0xE9, 0x29, 0xE5, 0xC6, 0x74, 0x21, 0xA1, 0x9F, 0x82, 0x35 }, NULL, NULL, 0x60006C98, 0x2605A381, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Violence Killer - Turok New Generation (J) [b1]", { 0x50, 0x27, 0x2F, 0x8E, 0xA9, 0x9E, 0x4E, 0x06, 0xAD, 0xD8, 0xCC, 0xAB, 0x5F, 0x5A, 0x4F, 0x41 }, NULL, NULL, 0x60006C98, 0x2605A381, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Virtual Chess 64 (E) (M6) [!]", { 0xE7, 0x90, 0xBE, 0x1A, 0x5B, 0x88, 0x3B, 0xEB, 0xA4, 0x4B, 0xC0, 0xD2, 0x66, 0x6C, 0x65, 0xF5 }, NULL, NULL, 0x2FDAA221, 0xA588A7CE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Virtual Chess 64 (E) (M6) [b1]", { 0x41, 0x66, 0xD0, 0x34, 0x02, 0x39, 0x7A, 0x56, 0x04, 0x3A, 0xC2, 0xCD, 0x45, 0xF4, 0xCB, 0x87 }, NULL, NULL, 0x2FDAA221, 0xA588A7CE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Virtual Chess 64 (E) (M6) [b2]", { 0xC5, 0x59, 0x4D, 0xEF, 0xBC, 0xFE, 0x16, 0xD5, 0x62, 0x84, 0xC6, 0x6F, 0xDE, 0x49, 0xE5, 0x40 }, NULL, NULL, 0x2FDAA221, 0xA588A7CE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Virtual Chess 64 (E) (M6) [o1]", { 0x88, 0xD8, 0x92, 0x82, 0xB2, 0x34, 0x6F, 0x98, 0xC7, 0xF3, 0x08, 0x50, 0xB0, 0x61, 0xD4, 0x86 }, NULL, NULL, 0x2FDAA221, 0xA588A7CE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Virtual Chess 64 (E) (M6) [o1][h1C]", { 0xCB, 0x2B, 0x72, 0x14, 0xBE, 0x10, 0x84, 0xF2, 0xBF, 0xAE, 0xE5, 0x56, 0xB0, 0xB4, 0xFD, 0x2C }, NULL, NULL, 0x2FDAA221, 0xA588A7CE, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Virtual Chess 64 (U) (M3) [!]", { 0xF8, 0xA3, 0x52, 0x70, 0x27, 0x9B, 0x27, 0x75, 0x86, 0xD7, 0x21, 0x0F, 0xD1, 0x51, 0x34, 0xFF }, NULL, NULL, 0x82B3248B, 0xE73E244D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Virtual Chess 64 (U) (M3) [b1]", { 0xF0, 0x5B, 0xD2, 0xDA, 0xD0, 0x1F, 0x3E, 0x35, 0x47, 0x13, 0x38, 0x0A, 0xAF, 0xFB, 0x63, 0xE9 }, NULL, NULL, 0x82B3248B, 0xE73E244D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Virtual Chess 64 (U) (M3) [b1][o1]", { 0xC2, 0x52, 0xFE, 0xC9, 0x61, 0x71, 0xAB, 0xD0, 0x7A, 0x6C, 0x5B, 0x99, 0xB7, 0x49, 0x24, 0xD4 }, NULL, NULL, 0x82B3248B, 0xE73E244D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Virtual Chess 64 (U) (M3) [f1] (PAL)", { 0xF4, 0x1F, 0xCA, 0x7F, 0x18, 0x5B, 0x3E, 0xC4, 0x5E, 0xD9, 0x04, 0x91, 0xBC, 0x8C, 0x09, 0x83 }, NULL, NULL, 0x46F3248B, 0x534F2F61, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Virtual Chess 64 (U) (M3) [f1][o1]", { 0xE6, 0x27, 0x51, 0xEF, 0xDE, 0x53, 0x12, 0xED, 0x12, 0xDE, 0xC6, 0xC9, 0xFD, 0xCB, 0xF0, 0x62 }, NULL, NULL, 0x46F3248B, 0x534F2F61, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Virtual Chess 64 (U) [o1]", { 0x03, 0x43, 0xB9, 0x90, 0xF5, 0x8C, 0xD8, 0x16, 0xD9, 0x6F, 0xBE, 0x5D, 0x5E, 0x71, 0x0C, 0x82 }, NULL, NULL, 0x82B3248B, 0xE73E244D, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Virtual Pool 64 (E) [!]", { 0xAB, 0x68, 0xFB, 0x43, 0xF0, 0x12, 0xC1, 0xA4, 0x5A, 0xF1, 0xDB, 0xCC, 0x8E, 0x8C, 0x10, 0x9C }, NULL, NULL, 0x98F9F2D0, 0x03D9F09C, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Virtual Pool 64 (E) [o1]", { 0xC4, 0xFD, 0x61, 0xC7, 0x07, 0x97, 0x7F, 0x1B, 0xF4, 0x8D, 0xC1, 0x5E, 0x31, 0xBD, 0x2F, 0xB1 }, NULL, NULL, 0x98F9F2D0, 0x03D9F09C, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Virtual Pool 64 (U) [!]", { 0x6D, 0x3D, 0xB6, 0x73, 0x19, 0xDA, 0x33, 0x9D, 0xF4, 0xB6, 0x8A, 0xD0, 0x08, 0x49, 0x04, 0xD5 }, NULL, NULL, 0x4E4A7643, 0xA37439D7, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Virtual Pool 64 (U) [o1]", { 0xC6, 0x85, 0x5D, 0xF0, 0x0B, 0xD5, 0xBE, 0x8A, 0x41, 0xDC, 0xE8, 0x09, 0x09, 0x3E, 0xE4, 0x0B }, NULL, NULL, 0x4E4A7643, 0xA37439D7, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Virtual Pro Wrestling 2 - Oudou Keishou (J) [!]", { 0x90, 0x00, 0x25, 0x01, 0x77, 0x7E, 0x32, 0x37, 0x73, 0x9F, 0x5E, 0xD9, 0xB0, 0xE3, 0x49, 0xE2 }, NULL, NULL, 0xCD094235, 0x88074B62, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Virtual Pro Wrestling 64 (J) [!]", { 0x5E, 0x62, 0x02, 0x20, 0x0A, 0xF4, 0x0A, 0x8F, 0x02, 0x67, 0x80, 0xED, 0xFE, 0x1E, 0x15, 0xD0 }, NULL, NULL, 0x045C08C4, 0x4AFD798B, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Virtual Pro Wrestling 64 (J) [b1]", { 0x7F, 0xDC, 0x16, 0xC9, 0x6B, 0x51, 0x7D, 0x4E, 0x43, 0x3C, 0xF7, 0x35, 0x3B, 0x22, 0xFB, 0xA6 }, NULL, NULL, 0x045C08C4, 0x4AFD798B, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Virtual Pro Wrestling 64 (J) [f1]", { 0x29, 0x0B, 0xE4, 0x4B, 0x47, 0x11, 0x0A, 0x01, 0x15, 0x23, 0xA3, 0x43, 0x78, 0x6A, 0x15, 0xA0 }, NULL, NULL, 0xB3CD11F6, 0x60725EB0, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Virtual Pro Wrestling 64 (J) [f2]", { 0x9B, 0x24, 0x11, 0x03, 0xCE, 0x0F, 0x13, 0xCA, 0xD5, 0xFE, 0x52, 0x2D, 0xF6, 0x7E, 0xD8, 0x8B }, NULL, NULL, 0xB3CD11F6, 0x60725EB0, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Virtual Pro Wrestling 64 (J) [h1C]", { 0x1D, 0x2C, 0xB8, 0x8B, 0xBC, 0xB6, 0x7E, 0x12, 0x28, 0x9B, 0x74, 0xF5, 0xBD, 0x88, 0xAE, 0x4C }, NULL, NULL, 0x045C08C4, 0x4AFD798B, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Virtual Springfield Site Intro by Presten (PD)", { 0x35, 0xBF, 0x5C, 0x39, 0x0A, 0xF1, 0xAD, 0x73, 0x0E, 0x00, 0xEB, 0x61, 0x8A, 0xED, 0x7B, 0x72 }, NULL, NULL, 0x4F55D05C, 0x0CD66C91, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Vivid Dolls (Aleck64)", { 0x2A, 0xEE, 0x59, 0xCC, 0x8D, 0xDA, 0x43, 0x82, 0x96, 0x9B, 0xB7, 0x6D, 0xC9, 0x7D, 0x42, 0x28 }, NULL, NULL, 0x2F57C9F7, 0xF1E29CA6, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0xB },
+    { "WCW Backstage Assault (U) [!]", { 0x02, 0xAE, 0xD1, 0x69, 0xEB, 0x57, 0x94, 0x94, 0xAC, 0xE7, 0x5D, 0x22, 0xE1, 0x0D, 0x78, 0x9B }, NULL, NULL, 0x396F5ADD, 0x6693ECA7, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WCW Mayhem (E) [!]", { 0x9E, 0x94, 0x37, 0x52, 0xBC, 0xF4, 0xFB, 0xA9, 0xCA, 0x30, 0x28, 0xE5, 0x96, 0xF4, 0xEB, 0x4A }, NULL, NULL, 0xAA7B0658, 0x9C96937B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WCW Mayhem (E) [h1C]", { 0xF1, 0xAF, 0x35, 0x37, 0x55, 0x19, 0xE9, 0x7B, 0xB7, 0xC0, 0xE3, 0x7E, 0x2F, 0x68, 0x41, 0x6E }, NULL, NULL, 0xAA7B0658, 0x9C96937B, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WCW Mayhem (U) [!]", { 0x87, 0xBF, 0x37, 0x84, 0x70, 0x9C, 0xD0, 0x96, 0x93, 0xCD, 0x7B, 0xCC, 0x08, 0x46, 0x0C, 0x63 }, NULL, NULL, 0x33BE8CD6, 0xEC186912, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WCW Mayhem (U) [f1] (PAL)", { 0x5D, 0x73, 0x68, 0xD9, 0x5B, 0x89, 0xF4, 0x51, 0xE6, 0x8F, 0x08, 0x32, 0xED, 0x2B, 0xA8, 0xFF }, NULL, NULL, 0x2AD07230, 0x7A0719F7, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WCW Nitro (U) [!]", { 0x1E, 0x9F, 0xEA, 0xD7, 0x01, 0xFE, 0x5A, 0xAA, 0xA2, 0x48, 0xD4, 0x71, 0x38, 0x91, 0x77, 0x5D }, NULL, NULL, 0xD4C45A1A, 0xF425B25E, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "WCW Nitro (U) [b3]", { 0xEC, 0x09, 0x7E, 0xB3, 0x3B, 0xAD, 0x93, 0xA8, 0xAC, 0x6E, 0x15, 0xF7, 0x83, 0x97, 0x62, 0xAB }, NULL, NULL, 0xD4C45A1A, 0xF425B25E, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "WCW Nitro (U) [b1]", { 0xBC, 0x8B, 0xA6, 0x70, 0x65, 0xFD, 0xBA, 0xA7, 0x31, 0xDE, 0xFC, 0x86, 0x6D, 0x25, 0xB8, 0xC2 }, NULL, NULL, 0xD4C45A1A, 0xF425B25E, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "WCW Nitro (U) [b2]", { 0xCE, 0x86, 0xCE, 0x53, 0x5A, 0x5B, 0x55, 0xAE, 0x4A, 0x0E, 0x6C, 0xC9, 0x42, 0x70, 0x10, 0x82 }, NULL, NULL, 0x5DDB495C, 0xCE6E5573, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "WCW Nitro (U) [f1] (PAL)", { 0x85, 0x24, 0xD9, 0x2A, 0x74, 0x2B, 0xC9, 0xD0, 0xD6, 0xF0, 0x72, 0xF9, 0xF8, 0x0E, 0x88, 0x7C }, NULL, NULL, 0x85DB4944, 0x43ADE940, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "WCW Nitro (U) [f2] (PAL)", { 0xA6, 0xA0, 0x10, 0x90, 0x23, 0x83, 0x7C, 0x4E, 0xD5, 0xCA, 0xC6, 0x2F, 0x4A, 0x66, 0xAB, 0xA6 }, NULL, NULL, 0xACDCA0C6, 0x0F4C66F9, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "WCW vs. nWo - World Tour (E) [!]", { 0x55, 0x3D, 0x8D, 0x53, 0x47, 0x96, 0x9C, 0x66, 0xE5, 0xD9, 0x1C, 0x3F, 0xE3, 0x52, 0x08, 0xB9 }, NULL, NULL, 0x8BDBAF68, 0x345B4B36, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WCW vs. nWo - World Tour (U) (V1.0) [!]", { 0x20, 0x3C, 0x3B, 0xBF, 0xDD, 0x10, 0xC5, 0xA0, 0xB7, 0xC5, 0xD0, 0xCD, 0xB0, 0x85, 0xD8, 0x53 }, NULL, NULL, 0x2C3E19BD, 0x5113EE5E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WCW vs. nWo - World Tour (U) (V1.0) [b1]", { 0x6B, 0xD5, 0xC8, 0x5E, 0x25, 0xBF, 0x31, 0x46, 0xA4, 0x2F, 0x96, 0x2A, 0x37, 0x9B, 0x4F, 0x54 }, NULL, NULL, 0x2C3E19BD, 0x5113EE5E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WCW vs. nWo - World Tour (U) (V1.1) [!]", { 0xB7, 0xA2, 0x20, 0xB5, 0x93, 0x03, 0xD4, 0x7F, 0x3B, 0xEA, 0xE2, 0x33, 0xCA, 0x86, 0x8C, 0xFD }, NULL, NULL, 0x71BE60B9, 0x1DDBFB3C, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WCW-nWo Revenge (E) [!]", { 0x30, 0xC6, 0x67, 0x6E, 0xC1, 0xD6, 0x21, 0x22, 0xF4, 0xE7, 0x60, 0x7E, 0xF3, 0xAB, 0xBD, 0x41 }, NULL, NULL, 0x68E8A875, 0x0CE7A486, 0, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "WCW-nWo Revenge (E) [h1C]", { 0x07, 0xF0, 0xAD, 0x84, 0x13, 0x50, 0xBD, 0x7C, 0xA1, 0xE6, 0xA9, 0x9F, 0xB7, 0xE8, 0x87, 0xE6 }, NULL, NULL, 0x68E8A875, 0x0CE7A486, 0, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "WCW-nWo Revenge (U) [!]", { 0xC1, 0x38, 0x4F, 0x36, 0x37, 0xD7, 0xA3, 0x81, 0xB2, 0x93, 0x41, 0xFE, 0xD3, 0xEF, 0x3C, 0xEB }, NULL, NULL, 0xDEE596AB, 0xAF3B7AE7, 0, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "WCW-nWo Revenge (U) [b1]", { 0xB2, 0x30, 0xD3, 0x07, 0x42, 0x8F, 0x4B, 0x69, 0xB3, 0xA8, 0x01, 0x09, 0xAC, 0x90, 0x5A, 0x44 }, NULL, NULL, 0xDEE596AB, 0xAF3B7AE7, 0, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "WCW-nWo Revenge (U) [b2]", { 0x11, 0x7E, 0xF2, 0x63, 0x9E, 0x04, 0x85, 0x21, 0x0C, 0x7A, 0xB7, 0x0C, 0xBF, 0x3E, 0x0C, 0x00 }, NULL, NULL, 0xDEE596AB, 0xAF3B7AE7, 0, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "WCW-nWo Revenge (U) [f1] (PAL)", { 0xD6, 0xCD, 0x1A, 0xF1, 0x59, 0x7C, 0xF0, 0xD2, 0x79, 0xA3, 0x9F, 0x75, 0xEE, 0x07, 0xC4, 0x3A }, NULL, NULL, 0x768AD2AA, 0xC3C79B68, 0, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "WCW-nWo Revenge (U) [f2] (PAL)", { 0x84, 0x7A, 0x00, 0xF2, 0xC5, 0xDA, 0x66, 0x96, 0xFC, 0x49, 0x70, 0x24, 0x31, 0xDF, 0x31, 0x50 }, NULL, NULL, 0x768AD2AA, 0xC3C79B68, 0, SAVETYPE_SRAM, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x7B },
+    { "WWF - War Zone (E) [!]", { 0xEB, 0xC0, 0xCF, 0x55, 0xFC, 0x58, 0x84, 0x5C, 0x6E, 0xE8, 0x6C, 0xF8, 0xB2, 0xD8, 0x73, 0x03 }, NULL, NULL, 0x33A275A4, 0xB8504459, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF - War Zone (U) [!]", { 0x23, 0x22, 0xDA, 0x2B, 0x9E, 0x7D, 0xC7, 0x46, 0x78, 0xCD, 0x68, 0x3B, 0x7A, 0x24, 0x6B, 0x49 }, NULL, NULL, 0xCD5BEC0F, 0x86FD1008, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF Attitude (E) [!]", { 0x3F, 0xDB, 0x2E, 0x5F, 0x99, 0x82, 0xFD, 0xA2, 0xC2, 0x34, 0x4A, 0x88, 0x3B, 0x8A, 0xB6, 0xEF }, NULL, NULL, 0x5BF45B7B, 0x596BEEE8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF Attitude (G) [!]", { 0xB8, 0x6E, 0xC8, 0xD1, 0x9D, 0x7D, 0x1A, 0x50, 0xEA, 0x90, 0x0E, 0xA1, 0x03, 0x55, 0xA7, 0x35 }, NULL, NULL, 0x8F3151C8, 0x4F3AF545, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF Attitude (G) [b1]", { 0x5A, 0xC5, 0xCE, 0xDB, 0xD2, 0x2C, 0xEE, 0xA8, 0xDD, 0x50, 0xCF, 0x60, 0x84, 0x19, 0x33, 0x57 }, NULL, NULL, 0x8F3151C8, 0x4F3AF545, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF Attitude (U) [!]", { 0x9F, 0xAF, 0x51, 0x4C, 0xB3, 0xDB, 0xB7, 0x42, 0xC1, 0x29, 0xDE, 0xB3, 0x95, 0xDC, 0xA3, 0x42 }, NULL, NULL, 0xD2BE2F14, 0x38453788, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF Attitude (U) [b1]", { 0x6D, 0x4C, 0xBA, 0x7F, 0xB2, 0xE9, 0x10, 0xCA, 0x1A, 0x87, 0xE6, 0x3A, 0x4C, 0x19, 0x24, 0xC2 }, NULL, NULL, 0xD2BE2F14, 0x38453788, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF Attitude (U) [b2]", { 0x44, 0xBC, 0x02, 0x9B, 0x52, 0x19, 0xE1, 0xA1, 0x6F, 0x3B, 0x99, 0x12, 0x50, 0x56, 0xF9, 0x8B }, NULL, NULL, 0xD2BE2F14, 0x38453788, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF Attitude (U) [f1] (PAL)", { 0x38, 0x2E, 0xCA, 0x33, 0xC5, 0xDD, 0x52, 0xB8, 0xC0, 0x3A, 0x56, 0xD2, 0x0F, 0x2D, 0x3F, 0x21 }, NULL, NULL, 0xD89261A9, 0xB1A2C9AF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF No Mercy (E) (V1.0) [!]", { 0xD9, 0x4A, 0x8F, 0x78, 0x17, 0x84, 0x73, 0xD4, 0xBA, 0x4B, 0xED, 0x62, 0xFA, 0x8E, 0x2E, 0x66 }, NULL, NULL, 0x6D8DF08E, 0xD008C3CF, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF No Mercy (E) (V1.0) [b1]", { 0x47, 0x3F, 0xDD, 0xBB, 0x12, 0x12, 0x55, 0xA1, 0x71, 0xA4, 0x0C, 0x14, 0x13, 0x0D, 0x01, 0x65 }, NULL, NULL, 0x6D8DF08E, 0xD008C3CF, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF No Mercy (E) (V1.0) [b2]", { 0xC9, 0xA6, 0x44, 0x69, 0x18, 0xDA, 0x5D, 0x65, 0x61, 0x2C, 0x52, 0x1D, 0x43, 0x2B, 0x7D, 0xA1 }, NULL, NULL, 0x6D8DF08E, 0xD008C3CF, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF No Mercy (E) (V1.1) [!]", { 0x40, 0x0A, 0x14, 0xF1, 0x32, 0xD9, 0x93, 0xF5, 0x54, 0x4F, 0x8B, 0x00, 0x8E, 0xC1, 0x36, 0xFA }, NULL, NULL, 0x8CDB94C2, 0xCB46C6F0, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF No Mercy (U) (V1.0) [!]", { 0x04, 0xC4, 0x92, 0xBE, 0x7F, 0x89, 0xFC, 0x6F, 0x42, 0x52, 0x38, 0xBD, 0x67, 0x62, 0x95, 0x44 }, NULL, NULL, 0x4E4B0640, 0x1B49BCFB, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF No Mercy (U) (V1.0) [t1]", { 0x51, 0x07, 0x4C, 0xFE, 0x7A, 0x31, 0x92, 0x70, 0xCF, 0x08, 0x8A, 0x7C, 0x65, 0x38, 0x73, 0x68 }, NULL, NULL, 0x361E1288, 0x7A26BE5F, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF No Mercy (U) (V1.1) [!]", { 0x66, 0xB8, 0xEC, 0x24, 0x55, 0x7A, 0x50, 0x51, 0x4A, 0x81, 0x4F, 0x15, 0x42, 0x9B, 0xD5, 0x59 }, NULL, NULL, 0x6C80F13B, 0x427EDEAA, 0, SAVETYPE_FLASH_RAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF WrestleMania 2000 (E) [!]", { 0xB7, 0x51, 0x49, 0xF8, 0x7C, 0xC5, 0xF3, 0xA5, 0x08, 0x64, 0x3A, 0xC3, 0x77, 0xF2, 0xFC, 0xC9 }, NULL, NULL, 0xC71353BE, 0xAA09A6EE, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF WrestleMania 2000 (E) [h1C]", { 0xEB, 0xB9, 0xE3, 0xD3, 0x78, 0x23, 0x47, 0x74, 0x3B, 0xFF, 0xB8, 0xB6, 0xD1, 0x78, 0xFC, 0x8A }, NULL, NULL, 0xC71353BE, 0xAA09A6EE, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF WrestleMania 2000 (J) [!]", { 0x11, 0xEE, 0xE2, 0xF3, 0x4B, 0xF8, 0xDA, 0x05, 0xA1, 0xB8, 0xF4, 0xFB, 0x9F, 0xE9, 0xF7, 0x4C }, NULL, NULL, 0x12737DA5, 0x23969159, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF WrestleMania 2000 (J) [b1]", { 0xAF, 0xC5, 0xEE, 0xDD, 0x3F, 0xCE, 0xEF, 0x85, 0x45, 0x8E, 0x9C, 0x8F, 0xA1, 0x62, 0xB3, 0x03 }, NULL, NULL, 0x12737DA5, 0x23969159, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF WrestleMania 2000 (U) [!]", { 0xD9, 0x03, 0x0C, 0xA3, 0x0E, 0x4D, 0x1A, 0xF8, 0x05, 0xAC, 0xCE, 0x1B, 0xFE, 0xD9, 0x88, 0xCC }, NULL, NULL, 0x90A59003, 0x31089864, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF WrestleMania 2000 (U) [b1]", { 0xCB, 0x17, 0x4F, 0xA8, 0x9F, 0x35, 0x2D, 0xD8, 0x45, 0x1A, 0x43, 0xFE, 0xF2, 0xB8, 0xD1, 0xAA }, NULL, NULL, 0x90A59003, 0x31089864, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WWF WrestleMania 2000 (U) [t1] (Never Drop Weapons)", { 0x9E, 0xAF, 0xCA, 0x83, 0x14, 0x87, 0x92, 0x3E, 0x0B, 0xE7, 0x97, 0x17, 0xA6, 0x78, 0x89, 0x4E }, NULL, NULL, 0x90A59003, 0x31089864, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Waialae Country Club - True Golf Classics (E) (M4) (V1.0) [!]", { 0x5F, 0x19, 0x06, 0xDF, 0x4E, 0xB3, 0x05, 0x37, 0xC2, 0xAC, 0x2F, 0xCB, 0xD0, 0x05, 0x90, 0x7D }, NULL, NULL, 0x93053075, 0x261E0F43, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Waialae Country Club - True Golf Classics (E) (M4) (V1.0) [b1]", { 0x1F, 0xC5, 0x40, 0xD2, 0x16, 0x86, 0x50, 0xE1, 0x35, 0xBC, 0xC7, 0xD3, 0xB5, 0x42, 0xE0, 0x3A }, NULL, NULL, 0x93053075, 0x261E0F43, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Waialae Country Club - True Golf Classics (E) (M4) (V1.1) [!]", { 0xF7, 0xC1, 0xB1, 0xEE, 0x1C, 0xE3, 0x7C, 0xE0, 0x9A, 0xA4, 0x8C, 0x7E, 0x0A, 0x11, 0x5E, 0xFA }, NULL, NULL, 0x0C5057AD, 0x046E126E, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Waialae Country Club - True Golf Classics (U) (V1.0) [!]", { 0xDD, 0x81, 0x54, 0xD5, 0x07, 0xC8, 0x86, 0x94, 0xAF, 0xD6, 0x9C, 0x7A, 0xF1, 0x6A, 0x8C, 0xD6 }, NULL, NULL, 0x8066D58A, 0xC3DECAC1, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Waialae Country Club - True Golf Classics (U) (V1.1) [!]", { 0x67, 0xF7, 0x5C, 0x4D, 0xD3, 0x09, 0x22, 0xA0, 0x01, 0xC8, 0xC3, 0x2A, 0xEB, 0x93, 0x33, 0xAC }, NULL, NULL, 0xDD318CE2, 0xB73798BA, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "War Gods (E) [!]", { 0xD2, 0x5D, 0xD1, 0x59, 0x03, 0xBD, 0xCB, 0x77, 0x24, 0xA2, 0xE8, 0xA0, 0x25, 0x61, 0x98, 0x7F }, NULL, NULL, 0xD715CC70, 0x271CF5D6, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "War Gods (U) [!]", { 0x9F, 0xF2, 0xBA, 0x3C, 0x84, 0x08, 0xDE, 0x9F, 0x0E, 0xDB, 0x6D, 0x76, 0x4A, 0x97, 0xC1, 0x97 }, NULL, NULL, 0xF7FE28F6, 0xC3F2ACC3, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "War Gods (U) [o1]", { 0xD0, 0x8D, 0x61, 0xE3, 0xC2, 0x44, 0xA0, 0x81, 0xC1, 0x66, 0xC6, 0xA8, 0xD5, 0x39, 0xA1, 0x81 }, NULL, NULL, 0xF7FE28F6, 0xC3F2ACC3, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "War Gods (U) [o1][h1C]", { 0x0D, 0x3F, 0x2F, 0x58, 0x31, 0x03, 0x87, 0xC6, 0x0F, 0x93, 0x2F, 0x6E, 0xC9, 0x36, 0x78, 0x8D }, NULL, NULL, 0xF7FE28F6, 0xC3F2ACC3, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "War Gods (U) [o2]", { 0xF8, 0x79, 0x37, 0xC9, 0xDE, 0x37, 0x03, 0x89, 0x8C, 0x48, 0x0F, 0xC8, 0x4C, 0x69, 0x25, 0x23 }, NULL, NULL, 0xF7FE28F6, 0xC3F2ACC3, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "War Gods (U) [o3]", { 0x5C, 0x98, 0x46, 0x6C, 0x2B, 0x2A, 0xAF, 0x7F, 0x3B, 0x51, 0xD4, 0x40, 0x6E, 0xEE, 0x39, 0xFD }, NULL, NULL, 0xF7FE28F6, 0xC3F2ACC3, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "War Gods (U) [t1] (God Mode)", { 0x77, 0x1F, 0xC1, 0x7C, 0xDC, 0x84, 0x0E, 0xD3, 0x6D, 0xB8, 0xA6, 0x99, 0x75, 0x7C, 0x37, 0xF8 }, NULL, NULL, 0x59BEB6F9, 0xE6DC1630, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "War Gods (U) (Power Bar Hack)", { 0xD2, 0x44, 0x35, 0xC6, 0x5C, 0x48, 0xE8, 0xDE, 0x08, 0x31, 0xFC, 0x8F, 0x46, 0x6B, 0xAA, 0x51 }, NULL, NULL, 0xAFBEB6F6, 0xB0E715DC, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Wave Race 64 (Ch) (iQue) [!]", { 0x1F, 0x83, 0x66, 0x3B, 0x2C, 0x84, 0x51, 0x2F, 0xC3, 0x70, 0x6A, 0x6C, 0xAC, 0xC1, 0xA9, 0xF3 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Wave Race 64 (Ch) (V2) (iQue) (Manual) [!]", { 0xA6, 0x6F, 0xEE, 0x7A, 0xF8, 0x9D, 0x58, 0xB2, 0x4A, 0x25, 0xC3, 0x46, 0xA0, 0xE9, 0x01, 0x72 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Wave Race 64 (Ch) (V4) (iQue) (Manual) [!]", { 0x92, 0x6B, 0x14, 0x95, 0x56, 0x54, 0x35, 0xDA, 0x0A, 0xF2, 0x9B, 0xB6, 0x60, 0x53, 0x2D, 0xA3 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Wave Race 64 (E) (M2) [!]", { 0x31, 0x06, 0x59, 0x11, 0x5E, 0x99, 0x39, 0xF2, 0x19, 0xA7, 0x83, 0xAB, 0xDD, 0x45, 0x6C, 0xE9 }, NULL, NULL, 0x650EFA96, 0x30DDF9A7, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wave Race 64 (E) (M2) [h1C]", { 0xA9, 0x92, 0xE0, 0x10, 0xBC, 0x37, 0x40, 0xC7, 0xC2, 0x66, 0xD4, 0xF6, 0xE9, 0x02, 0x26, 0xA1 }, NULL, NULL, 0x650EFA96, 0x30DDF9A7, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wave Race 64 (E) (M2) [o1]", { 0x47, 0x0D, 0x3E, 0x39, 0x1A, 0x2B, 0x4C, 0xEB, 0xF0, 0xA9, 0xE1, 0x5E, 0xC4, 0x9C, 0xD3, 0x24 }, NULL, NULL, 0x650EFA96, 0x30DDF9A7, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wave Race 64 (J) [!]", { 0xB3, 0x2E, 0x55, 0x5B, 0xC1, 0xA3, 0x75, 0x25, 0x6E, 0x8A, 0x40, 0x21, 0xA2, 0x53, 0x39, 0xBE }, NULL, NULL, 0x5C9191D6, 0xB30AC306, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wave Race 64 (J) (V1.1) [!]", { 0xD0, 0x5C, 0x6F, 0x3C, 0xAF, 0x90, 0x59, 0xB3, 0x06, 0xCC, 0x13, 0x53, 0x5E, 0x2A, 0x8B, 0xA6 }, NULL, NULL, 0x44995484, 0x20A5FC5E, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wave Race 64 (U) (V1.0) [!]", { 0xAE, 0x48, 0x00, 0x13, 0xF3, 0x9D, 0x4A, 0xEC, 0x86, 0xEE, 0xA1, 0xB4, 0x99, 0x56, 0x00, 0xD1 }, NULL, NULL, 0x7DE11F53, 0x74872F9D, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wave Race 64 (U) (V1.0) [t1]", { 0xD6, 0x53, 0xE6, 0xB0, 0x50, 0xF6, 0x3B, 0x5E, 0x1C, 0x1E, 0x98, 0x56, 0x31, 0x92, 0x87, 0xE1 }, NULL, NULL, 0xC5F4865F, 0x03340B83, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wave Race 64 (U) (V1.1) [!]", { 0x20, 0x48, 0xA6, 0x40, 0xC1, 0x2D, 0x1C, 0xF2, 0x05, 0x2B, 0xA1, 0x62, 0x99, 0x37, 0xD2, 0xFF }, NULL, NULL, 0x492F4B61, 0x04E5146A, 0, SAVETYPE_EEPROM_4K, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wave Race 64 - Shindou Edition (J) (V1.2) [!]", { 0xFF, 0x67, 0xDF, 0x97, 0x47, 0x6C, 0x21, 0x0D, 0x15, 0x87, 0x79, 0xAE, 0x61, 0x42, 0xF2, 0x39 }, NULL, NULL, 0x535DF3E2, 0x609789F1, 0, SAVETYPE_EEPROM_4K, 2, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Wave Race 64 - Shindou Edition (J) (V1.2) [T+Eng1.0_Zoinkity]", { 0xEC, 0xC1, 0x69, 0x2D, 0x12, 0xFD, 0xCB, 0x0C, 0x3F, 0x60, 0x5E, 0x44, 0xDD, 0x54, 0xCE, 0x8C }, NULL, NULL, 0x57AF893E, 0x884A377C, 0, SAVETYPE_EEPROM_4K, 2, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Wave Race 64 - Shindou Edition (J) (V1.2) [T+Eng1.1_Zoinkity]", { 0xD0, 0x47, 0x21, 0x73, 0x52, 0x4D, 0x6E, 0xC4, 0xE7, 0x8C, 0xBC, 0xA3, 0x0E, 0xFD, 0x98, 0xFC }, NULL, NULL, 0x57AF893E, 0x8EEF209A, 0, SAVETYPE_EEPROM_4K, 2, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Wave Race 64 - Shindou Edition (J) (V1.2) [b1]", { 0xAF, 0xBC, 0x69, 0x4A, 0x3B, 0xA5, 0xAE, 0x83, 0xD3, 0xCE, 0xEF, 0x90, 0x6B, 0xF0, 0x18, 0x39 }, NULL, NULL, 0x535DF3E2, 0x609789F1, 0, SAVETYPE_EEPROM_4K, 2, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Wave Race 64 - Shindou Edition (J) (V1.2) [b2]", { 0x41, 0xE4, 0x19, 0xF4, 0x39, 0x2C, 0xFE, 0xF2, 0xC3, 0x54, 0x00, 0x61, 0x69, 0x36, 0x22, 0x86 }, NULL, NULL, 0x535DF3E2, 0x609789F1, 0, SAVETYPE_EEPROM_4K, 2, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Wave Race 64 - Shindou Edition (J) (V1.2) [h1C]", { 0xCA, 0xD9, 0x93, 0x12, 0x8A, 0x11, 0xB5, 0x61, 0x6E, 0x5D, 0xDE, 0x5C, 0xF5, 0x0C, 0xB9, 0x98 }, NULL, NULL, 0x535DF3E2, 0x609789F1, 0, SAVETYPE_EEPROM_4K, 2, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Wave Race 64 - Shindou Edition (J) (V1.2) [o1]", { 0xF9, 0xDA, 0x7E, 0xB7, 0x4E, 0x39, 0x1C, 0x5E, 0x68, 0x13, 0x21, 0x2F, 0x7F, 0x55, 0x95, 0x9A }, NULL, NULL, 0x535DF3E2, 0x609789F1, 0, SAVETYPE_EEPROM_4K, 2, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Wayne Gretzky's 3D Hockey '98 (E) (M4) [!]", { 0x24, 0xA0, 0xD8, 0xC8, 0xCA, 0xBC, 0x22, 0x11, 0x6E, 0x46, 0x94, 0x76, 0xFF, 0x6C, 0x69, 0x1D }, NULL, NULL, 0x661B45F3, 0x9ED6266D, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wayne Gretzky's 3D Hockey '98 (U) [!]", { 0x81, 0x0F, 0x8B, 0xC2, 0xC8, 0xC6, 0x6B, 0xDA, 0x3B, 0x20, 0x6C, 0x7D, 0xD4, 0xB6, 0xD4, 0x2F }, NULL, NULL, 0x5A9D3859, 0x97AAE710, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wayne Gretzky's 3D Hockey '98 (U) [T+Ita_cattivik66]", { 0x09, 0x67, 0x26, 0x49, 0x8E, 0x69, 0x8B, 0x51, 0xAF, 0xE7, 0x2A, 0xAB, 0x52, 0x62, 0xA1, 0x5A }, NULL, NULL, 0x5A9D3859, 0x97AAE710, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Wayne Gretzky's 3D Hockey '98 (U) [h1C]", { 0xC9, 0xF9, 0x5F, 0x94, 0x80, 0xB5, 0x86, 0x7B, 0x03, 0xCF, 0xC0, 0x53, 0x3F, 0x31, 0x92, 0x53 }, NULL, NULL, 0x5A9D3859, 0x97AAE710, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Wayne Gretzky's 3D Hockey '98 (U) [h2C]", { 0xF7, 0xE5, 0xBD, 0xF8, 0xE4, 0x07, 0x6C, 0x27, 0x96, 0x1B, 0xAF, 0x9A, 0x42, 0xC7, 0x35, 0x24 }, NULL, NULL, 0x5A9D3859, 0x97AAE710, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Wayne Gretzky's 3D Hockey (E) (M4) [!]", { 0x31, 0x98, 0x16, 0xAA, 0xA3, 0x0E, 0x51, 0x28, 0x27, 0xBE, 0x7B, 0x7F, 0x81, 0xF8, 0x0D, 0x86 }, NULL, NULL, 0x2209094B, 0x2C9559AF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wayne Gretzky's 3D Hockey (E) (M4) [b1]", { 0x65, 0xF1, 0xD5, 0x83, 0xB5, 0x39, 0x2D, 0x34, 0x67, 0xBD, 0x18, 0x72, 0x24, 0xFB, 0xBD, 0x89 }, NULL, NULL, 0x2209095F, 0xECD28311, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wayne Gretzky's 3D Hockey (E) (M4) [h1C]", { 0x09, 0x05, 0xA3, 0x7D, 0xBB, 0x3B, 0x9C, 0xEC, 0x38, 0xB5, 0x2F, 0x6E, 0x10, 0x9A, 0x9E, 0xAA }, NULL, NULL, 0x2209094B, 0x2C9559AF, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wayne Gretzky's 3D Hockey (J) [!]", { 0x61, 0xE6, 0x37, 0xB5, 0x42, 0xD5, 0xDF, 0x17, 0x80, 0x40, 0x45, 0x40, 0x75, 0xC2, 0x8E, 0x19 }, NULL, NULL, 0xF1301043, 0xFD80541A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Wayne Gretzky's 3D Hockey (J) [b1]", { 0x37, 0x16, 0x20, 0x87, 0x16, 0x60, 0x76, 0x79, 0x00, 0xFC, 0x00, 0xF7, 0x26, 0x81, 0xE1, 0xFD }, NULL, NULL, 0xF1301043, 0xFD80541A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Wayne Gretzky's 3D Hockey (J) [o1]", { 0x03, 0x87, 0x7A, 0x5C, 0xD0, 0xDD, 0x1E, 0x8C, 0x14, 0xEE, 0xEE, 0x70, 0x66, 0x0E, 0x79, 0xDA }, NULL, NULL, 0xF1301043, 0xFD80541A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Wayne Gretzky's 3D Hockey (J) [o2]", { 0x81, 0xEF, 0xB8, 0x0D, 0xB5, 0xE0, 0x14, 0xD8, 0x65, 0xEC, 0x2E, 0xC8, 0x8C, 0x39, 0x3E, 0x4D }, NULL, NULL, 0xF1301043, 0xFD80541A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Wayne Gretzky's 3D Hockey (U) (V1.0) [!]", { 0x6D, 0xF0, 0xD6, 0x25, 0x92, 0x61, 0xD0, 0x09, 0x6C, 0x90, 0xBB, 0xC6, 0xAA, 0x03, 0x7D, 0x8E }, NULL, NULL, 0x6B45223F, 0xF00E5C56, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wayne Gretzky's 3D Hockey (U) (V1.0) [b1]", { 0xED, 0xBD, 0xB5, 0x5A, 0xD5, 0x85, 0x54, 0xC4, 0x8B, 0x25, 0xA4, 0x7D, 0x7E, 0x17, 0x85, 0x13 }, NULL, NULL, 0x6B45223F, 0xF00E5C56, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wayne Gretzky's 3D Hockey (U) (V1.0) [o1]", { 0x53, 0x49, 0xAB, 0xD4, 0xEE, 0x13, 0xC8, 0xF0, 0x29, 0xA6, 0x00, 0x32, 0x73, 0x5B, 0x1A, 0xE3 }, NULL, NULL, 0x6B45223F, 0xF00E5C56, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wayne Gretzky's 3D Hockey (U) (V1.1) [!]", { 0x04, 0xE6, 0x50, 0xB7, 0x74, 0x2A, 0x69, 0xDA, 0xE9, 0x8F, 0x12, 0x5D, 0x1B, 0x49, 0x2D, 0x78 }, NULL, NULL, 0xDC3BAA59, 0x0ABB456A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "Wet Dreams Can Beta Demo by Immortal (POM '99) (PD)", { 0x98, 0xC2, 0x0A, 0x22, 0x91, 0x70, 0xCF, 0x39, 0x3B, 0xBF, 0x44, 0x2D, 0x44, 0xFF, 0xC5, 0xB1 }, NULL, NULL, 0xCA3BC095, 0x9649860A, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Wet Dreams Madeiragames Demo by Immortal (POM '99) (PD)", { 0xD6, 0x52, 0x76, 0x9F, 0x8E, 0xE9, 0xBB, 0xE5, 0xF0, 0xBD, 0x5D, 0xF9, 0xB9, 0x55, 0xD4, 0x7E }, NULL, NULL, 0x993B7D7A, 0x2E54F04D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Wet Dreams Main Demo by Immortal (POM '99) (PD)", { 0x37, 0xC0, 0xC9, 0x7D, 0xFC, 0xE9, 0x9F, 0x99, 0x68, 0x77, 0x84, 0x48, 0xF5, 0xC9, 0xF0, 0xB6 }, NULL, NULL, 0xA3A95A57, 0x9FE6C27D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Wet Dreams Readme by Immortal (POM '99) (PD)", { 0x7B, 0x7B, 0x29, 0x16, 0xA8, 0x57, 0xB9, 0xFC, 0x51, 0x3C, 0x5F, 0x96, 0x19, 0xB3, 0x6C, 0x98 }, NULL, NULL, 0x9C044945, 0xD31E0B0C, 5, SAVETYPE_NONE, 0, 0, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Wetrix (E) (M6) [!]", { 0xA9, 0x9E, 0x2C, 0xB6, 0xAC, 0xEF, 0x7A, 0x00, 0x49, 0x61, 0xDE, 0x5F, 0x6D, 0xFE, 0xEF, 0xF0 }, NULL, NULL, 0xCEA8B54F, 0x7F21D503, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Wetrix (E) (M6) [f1] (NTSC)", { 0x15, 0xF4, 0x25, 0x82, 0x9D, 0x54, 0xDD, 0x29, 0x04, 0x51, 0xD2, 0xF3, 0xEB, 0xAF, 0x95, 0x3F }, NULL, NULL, 0x792C3A8E, 0x0F2200F7, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Wetrix (E) (M6) [t1]", { 0x08, 0x7B, 0x6C, 0x2D, 0x5F, 0xBD, 0x77, 0x86, 0x67, 0xC1, 0x2D, 0x7F, 0xC7, 0xC3, 0x05, 0xA7 }, NULL, NULL, 0x773E3E8E, 0x1E8A0CBE, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Wetrix (J) [!]", { 0xE8, 0x99, 0x7B, 0xF5, 0x66, 0x25, 0x40, 0xB1, 0x84, 0xFB, 0xF8, 0x27, 0x7D, 0x26, 0x09, 0x84 }, NULL, NULL, 0xDCB6EAFA, 0xC6BBCFA3, 0, SAVETYPE_EEPROM_4K, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Wetrix (J) [o1]", { 0x08, 0x82, 0x6E, 0x96, 0xF3, 0xFB, 0x02, 0x2A, 0x1C, 0x63, 0x51, 0x77, 0x41, 0x98, 0xBA, 0x9D }, NULL, NULL, 0xDCB6EAFA, 0xC6BBCFA3, 0, SAVETYPE_EEPROM_4K, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Wetrix (U) (M6) [!]", { 0x6E, 0x81, 0xD3, 0x05, 0x6E, 0x40, 0x92, 0x08, 0xE4, 0xAF, 0x2D, 0x39, 0xA2, 0xFF, 0x0F, 0x03 }, NULL, NULL, 0xCEA8B54F, 0x7F21D503, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Wheel of Fortune (U) [!]", { 0x2A, 0xBE, 0x36, 0x75, 0x4E, 0x86, 0x6B, 0x9B, 0x6C, 0x4B, 0xDC, 0xFF, 0xC1, 0xD1, 0x1A, 0xBF }, NULL, NULL, 0xE896092B, 0xDC244D4E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Wheel of Fortune (U) [b1]", { 0xCC, 0x75, 0xD0, 0x77, 0x1D, 0xBC, 0x82, 0x5A, 0xC9, 0xF4, 0x99, 0x40, 0x04, 0x43, 0xA6, 0xA0 }, NULL, NULL, 0xE896092B, 0xDC244D4E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Wheel of Fortune (U) [o1]", { 0xD2, 0x0F, 0x2C, 0x67, 0x04, 0xD5, 0xB9, 0x33, 0x72, 0x81, 0x6B, 0xA0, 0x55, 0x9E, 0x4E, 0x0F }, NULL, NULL, 0xE896092B, 0xDC244D4E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Wheel of Fortune (U) [o1][b1]", { 0xCC, 0x84, 0x60, 0xB1, 0x17, 0xAA, 0xFB, 0xD4, 0x84, 0xCF, 0x43, 0xC1, 0xEB, 0x3D, 0x8E, 0x15 }, NULL, NULL, 0xE896092B, 0xDC244D4E, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "WideBoy BIOS V980910", { 0x76, 0x4D, 0xCD, 0xF5, 0x16, 0x3D, 0x3F, 0xCE, 0x81, 0xD3, 0xE7, 0x18, 0x9F, 0xA9, 0x7E, 0x05 }, NULL, NULL, 0xD1C6C55D, 0xF010EF52, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "WideBoy BIOS V980914", { 0xFF, 0xF6, 0x32, 0xA8, 0x67, 0xCD, 0xAD, 0xB5, 0xAB, 0x20, 0x98, 0xCB, 0x8E, 0x2C, 0xFA, 0xDC }, NULL, NULL, 0x64F1084A, 0x763C7E91, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Wild Choppers (J) [!]", { 0xF8, 0x5F, 0x2A, 0x2B, 0x6C, 0xA6, 0x48, 0x98, 0xF0, 0xAD, 0xD2, 0xA7, 0x8C, 0xCD, 0xCC, 0xF3 }, NULL, NULL, 0x0CEBC4C7, 0x0C9CE932, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Wild Choppers (J) [b1]", { 0xBA, 0x53, 0x8C, 0xBF, 0x43, 0x47, 0x1B, 0x35, 0x22, 0xC4, 0xD0, 0x8B, 0xAD, 0x07, 0x97, 0xA7 }, NULL, NULL, 0x0CEBC4C7, 0x0C9CE932, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Wild Choppers (J) [b2]", { 0xAC, 0x13, 0x39, 0x20, 0x7A, 0x3E, 0x44, 0x2B, 0x61, 0xEC, 0x0E, 0x07, 0x46, 0x73, 0xC9, 0x3B }, NULL, NULL, 0xF4520439, 0x753A6281, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Wild Choppers (J) [b3]", { 0xDF, 0xB5, 0x5C, 0x3F, 0x9B, 0x2D, 0x2A, 0x18, 0x86, 0x16, 0xE9, 0xC1, 0x23, 0xE0, 0xC8, 0x16 }, NULL, NULL, 0x0CEBC4C7, 0x0C9CE932, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Wild Choppers (J) [o1]", { 0x7F, 0xE1, 0x35, 0xD0, 0x80, 0x35, 0x78, 0x2A, 0x8A, 0xAE, 0x0B, 0xEF, 0xE9, 0xA9, 0x78, 0x0B }, NULL, NULL, 0x0CEBC4C7, 0x0C9CE932, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Wild Choppers (J) [t1]", { 0xB2, 0xDE, 0x25, 0x61, 0x37, 0x55, 0xB2, 0x34, 0xA3, 0x76, 0x74, 0x74, 0x22, 0xD8, 0x3B, 0xBC }, NULL, NULL, 0xF4520439, 0x753A6281, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Wildwaters (U) (Prototype)", { 0xB8, 0x67, 0x88, 0x0C, 0x96, 0xC9, 0xE8, 0xD3, 0x13, 0x0D, 0xDE, 0x55, 0x26, 0xC9, 0x54, 0x39 }, NULL, NULL, 0xA04237B9, 0x68F62C72, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "WinBack (J) (V1.0) [!]", { 0xEE, 0x3D, 0x35, 0x50, 0xAC, 0xC4, 0x63, 0xCA, 0x57, 0x40, 0x8B, 0xF1, 0x4E, 0x54, 0x1F, 0x68 }, NULL, NULL, 0x1FA056E0, 0xA4B9946A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WinBack (J) (V1.0) [b1]", { 0x1B, 0x94, 0xD9, 0x8F, 0x50, 0x9F, 0x46, 0x7F, 0x9B, 0xC5, 0x41, 0x10, 0x2F, 0x6E, 0xBD, 0xFC }, NULL, NULL, 0x1FA056E0, 0xA4B9946A, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WinBack (J) (V1.1) [!]", { 0x97, 0x89, 0xA4, 0x8E, 0x1D, 0x9E, 0x42, 0xC2, 0xF6, 0x9C, 0x59, 0x96, 0x43, 0x71, 0x08, 0x9F }, NULL, NULL, 0xC52E0BC6, 0x56BC6556, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WinBack - Covert Operations (U) [!]", { 0x48, 0xDA, 0x6C, 0xDC, 0xAB, 0x83, 0x81, 0x53, 0xCA, 0xA2, 0xEC, 0xC3, 0xDD, 0x59, 0x2A, 0x65 }, NULL, NULL, 0xED98957E, 0x8242DCAC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WinBack - Covert Operations (U) [b1]", { 0xAC, 0xC6, 0xFD, 0x4E, 0x26, 0xD3, 0x60, 0xD1, 0xBE, 0xD5, 0x4C, 0x31, 0x6D, 0x7E, 0x33, 0xB9 }, NULL, NULL, 0xED98957E, 0x8242DCAC, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WinBack - Covert Operations (U) [f1] (PAL)", { 0xF3, 0x36, 0x5B, 0x47, 0xE4, 0x30, 0x01, 0x1D, 0x89, 0x16, 0x2F, 0xB0, 0xD7, 0xDD, 0x8D, 0xE5 }, NULL, NULL, 0x337F24EE, 0x73A807D9, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "WinBack - Covert Operations (U) [t1]", { 0xFA, 0x34, 0xEA, 0xEB, 0xAA, 0x8A, 0x4E, 0x48, 0xD6, 0xBB, 0xD9, 0x3D, 0xF6, 0x2C, 0xD9, 0x95 }, NULL, NULL, 0x35F51C8E, 0x39EF72B8, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Wipeout 64 (E) [!]", { 0x57, 0x83, 0x37, 0x36, 0x34, 0xB1, 0x1F, 0x81, 0xC8, 0x69, 0x08, 0xC3, 0xD8, 0x1C, 0xA9, 0x88 }, NULL, NULL, 0x54310E7D, 0x6B5430D8, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Wipeout 64 (E) (Beta) [!]", { 0x72, 0x60, 0xDA, 0x1C, 0xEC, 0xD0, 0xD8, 0x84, 0x4C, 0x5E, 0x29, 0xAA, 0x63, 0x47, 0x6D, 0xEF }, NULL, NULL, 0x136EBEE3, 0x35B7229E, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Wipeout 64 (U) [!]", { 0x73, 0xC6, 0xD8, 0x7D, 0xBE, 0x50, 0xF7, 0x3F, 0x3B, 0x44, 0xE0, 0xF2, 0x37, 0xA5, 0x46, 0xD7 }, NULL, NULL, 0x132D2732, 0xC70E9118, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Wipeout 64 (U) [o1]", { 0x36, 0x1F, 0x65, 0xD3, 0x7F, 0x41, 0x53, 0x6C, 0xDE, 0x98, 0xF8, 0x3C, 0xAD, 0x45, 0x62, 0x17 }, NULL, NULL, 0x132D2732, 0xC70E9118, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Wipeout 64 (U) [t1]", { 0x0E, 0x27, 0x4A, 0x16, 0x2C, 0xAD, 0x0B, 0x1B, 0x50, 0xF9, 0xB8, 0xD6, 0x4D, 0x9F, 0x82, 0xFC }, NULL, NULL, 0xA6A99491, 0x52B4E765, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Wipeout 64 (U) [t2]", { 0xB8, 0xDD, 0x77, 0xF1, 0x7A, 0x8B, 0x63, 0x8B, 0x1D, 0x38, 0xF5, 0x7C, 0x81, 0xEA, 0xA8, 0x9A }, NULL, NULL, 0xA6A99491, 0x52B4E765, 0, SAVETYPE_NONE, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Wonder Project J2 - Koruro no Mori no Jozet (J) [!]", { 0x0F, 0xF1, 0xF8, 0x62, 0x8D, 0x8F, 0xE6, 0x95, 0x82, 0xDB, 0x54, 0x57, 0x2D, 0x2B, 0xEA, 0x79 }, NULL, NULL, 0xE43C9765, 0x05B1C1BE, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Wonder Project J2 - Koruro no Mori no Jozet (J) [b1]", { 0xD6, 0xE5, 0x6B, 0x92, 0xEC, 0x7D, 0xBF, 0xB8, 0xB1, 0x4D, 0xD5, 0xD8, 0xCF, 0xF6, 0x49, 0x2E }, NULL, NULL, 0xE43C9765, 0x05B1C1BE, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Wonder Project J2 - Koruro no Mori no Jozet (J) [h1C]", { 0xF5, 0x97, 0x79, 0x68, 0xB6, 0x21, 0xE7, 0x47, 0x73, 0xE8, 0x0C, 0xC4, 0xA3, 0x3F, 0x7D, 0x2E }, NULL, NULL, 0xE43C9765, 0x05B1C1BE, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Wonder Project J2 - Koruro no Mori no Jozet (J) [T+Eng1.0_Ryu]", { 0x3C, 0x02, 0xF5, 0x6D, 0xD7, 0xB1, 0xA0, 0x6B, 0xE8, 0x3A, 0x7A, 0x28, 0x87, 0x55, 0x61, 0x2F }, NULL, NULL, 0x4F1E88F7, 0x4A5A3F96, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "World Cup 98 (E) (M8) [!]", { 0x3A, 0xA2, 0x63, 0xAC, 0xA6, 0x6F, 0x3A, 0x07, 0xBB, 0x08, 0x1B, 0x57, 0x5D, 0x66, 0xDE, 0xEB }, NULL, NULL, 0xF9FC3090, 0xFF014EC2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "World Cup 98 (E) (M8) [f1] (NTSC)", { 0xE3, 0xDB, 0x18, 0x63, 0xE1, 0x38, 0xB3, 0xAD, 0x56, 0x85, 0xA1, 0x60, 0x29, 0xD0, 0xA4, 0x4C }, NULL, NULL, 0xF9FC3090, 0xFF014EC2, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "World Cup 98 (U) (M8) [!]", { 0x4B, 0xEF, 0x5E, 0x9A, 0xA9, 0xE7, 0x12, 0x05, 0xDA, 0xC1, 0xA7, 0x06, 0x0E, 0x77, 0x82, 0x35 }, NULL, NULL, 0xBD636D6A, 0x5D1F54BA, 0, SAVETYPE_NONE, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x41B },
+    { "World Driver Championship (E) (M5) [!]", { 0x43, 0x1D, 0xE8, 0xF6, 0x61, 0x1A, 0x81, 0x31, 0xB5, 0x36, 0xF0, 0xED, 0xE1, 0xF3, 0x30, 0xD9 }, NULL, NULL, 0xAC062778, 0xDFADFCB8, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "World Driver Championship (E) (M5) [h1C]", { 0x9A, 0x2B, 0x0F, 0x32, 0x26, 0xFB, 0x8D, 0x12, 0x9B, 0xEB, 0x75, 0x09, 0xC1, 0x69, 0x47, 0x6A }, NULL, NULL, 0xAC062778, 0xDFADFCB8, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "World Driver Championship (U) [!]", { 0x7C, 0x56, 0x7A, 0x5B, 0xB1, 0xAD, 0x4C, 0xBE, 0x41, 0x4F, 0xB6, 0xBB, 0xFF, 0x66, 0xE3, 0x36 }, NULL, NULL, 0x308DFEC8, 0xCE2EB5F6, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "World Driver Championship (U) [b1]", { 0x4B, 0x86, 0xC3, 0x73, 0x53, 0x3D, 0x01, 0x58, 0x60, 0x46, 0x7C, 0x5D, 0xC1, 0xF1, 0xC6, 0x62 }, NULL, NULL, 0x308DFEC8, 0xCE2EB5F6, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "World Driver Championship (U) [f1] (PAL)", { 0x0C, 0x26, 0x66, 0x5C, 0x2F, 0x40, 0xA7, 0x86, 0x77, 0x8E, 0xE4, 0x37, 0x0C, 0x3A, 0x43, 0xFC }, NULL, NULL, 0x2A721F06, 0x4097F7B1, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "World Driver Championship (U) [f2] (PAL)", { 0x62, 0x8C, 0x10, 0xA5, 0xD2, 0xAC, 0xC4, 0x62, 0xC5, 0x52, 0x7E, 0x63, 0x02, 0x46, 0x74, 0x40 }, NULL, NULL, 0x2A980400, 0x7D805B1C, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "World Driver Championship (U) [t1]", { 0xA4, 0x59, 0x9E, 0xF8, 0x8F, 0x36, 0xE6, 0x2C, 0x16, 0x92, 0xBC, 0xEC, 0x41, 0x6C, 0x54, 0x77 }, NULL, NULL, 0xC8FEF05D, 0xDAA3407D, 0, SAVETYPE_NONE, 2, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Worms - Armageddon (E) (M6) [!]", { 0x44, 0xFC, 0x2A, 0x7F, 0x02, 0x8F, 0x0B, 0x6F, 0x71, 0xB2, 0x55, 0xF6, 0x72, 0xC8, 0xB4, 0x95 }, NULL, NULL, 0x2D21C57B, 0x8FE4C58C, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Worms - Armageddon (E) (M6) [f1] (NTSC)", { 0x35, 0xFD, 0xA6, 0x8C, 0x84, 0x81, 0xF7, 0xC3, 0x41, 0x9C, 0xCD, 0x91, 0xED, 0xBB, 0x6A, 0x9E }, NULL, NULL, 0x94FBA5FD, 0xBC8FE181, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Worms - Armageddon (U) (M3) [!]", { 0x49, 0x1D, 0x4D, 0xB6, 0x71, 0x83, 0x02, 0x48, 0x9B, 0xF0, 0x5F, 0xB9, 0x62, 0xC7, 0x36, 0x51 }, NULL, NULL, 0x13E959A0, 0x0E93CAB0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1B },
+    { "Xena Warrior Princess - The Talisman of Fate (E) [!]", { 0xEC, 0x2B, 0xCB, 0x1B, 0x7F, 0xC7, 0xD0, 0x68, 0xBE, 0x1F, 0x39, 0xE7, 0x9E, 0x49, 0xA8, 0x42 }, NULL, NULL, 0x0A1667C7, 0x293346A6, 0, SAVETYPE_NONE, 4, 1, 4, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Xena Warrior Princess - The Talisman of Fate (U) [!]", { 0x1A, 0xC2, 0x34, 0x64, 0x9D, 0x28, 0xF0, 0x9E, 0x82, 0xC0, 0xD1, 0x1A, 0xBB, 0x17, 0xF0, 0x3B }, NULL, NULL, 0x0553AE9D, 0xEAD8E0C1, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Xena Warrior Princess - The Talisman of Fate (U) [f1] (PAL)", { 0x68, 0x7A, 0xF4, 0x71, 0xA5, 0xA1, 0x6D, 0x66, 0x5E, 0x16, 0xAC, 0x1E, 0x90, 0x69, 0xD1, 0x6B }, NULL, NULL, 0xBC875B60, 0x8C993DF1, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Xena Warrior Princess - The Talisman of Fate (U) [t1]", { 0x6C, 0xB3, 0x59, 0x99, 0xD2, 0xE3, 0x82, 0x03, 0x91, 0x91, 0x3F, 0x0E, 0x4B, 0x9B, 0xC0, 0x72 }, NULL, NULL, 0xBEADC61C, 0x8622D9F6, 0, SAVETYPE_NONE, 4, 1, 3, 0, 0, 1, 0, 0x900, 100, 0x47B },
+    { "Xeno Crisis (A)", { 0xBC, 0x4B, 0xCD, 0x45, 0xFA, 0x71, 0x2E, 0xCD, 0xD8, 0xA8, 0x59, 0x18, 0xA9, 0xCA, 0x5F, 0x4B }, NULL, NULL, 0x470112E9, 0x53C66CB4, 0, SAVETYPE_NONE, 2, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x43B },
+    { "Xplorer64 BIOS V1.067 (G)", { 0x91, 0x37, 0x12, 0x9A, 0x58, 0x6E, 0x1B, 0xCA, 0xB6, 0xAE, 0x81, 0xBA, 0xC6, 0xB0, 0x12, 0x75 }, NULL, NULL, 0x656C6561, 0x73652031, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "XtraLife Dextrose Demo by RedboX (PD) [h1C]", { 0x76, 0x3E, 0x5E, 0xAC, 0xA4, 0x60, 0x6E, 0x15, 0xA1, 0xE4, 0xD6, 0x7D, 0xD6, 0xD9, 0x87, 0xC0 }, NULL, NULL, 0x1EDA4DE0, 0x22BF698D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "XtraLife Dextrose Demo by RedboX (PD)", { 0x46, 0xC4, 0x56, 0x20, 0xF2, 0x6E, 0x4E, 0xD7, 0x7B, 0x91, 0x8F, 0x86, 0x2F, 0xA5, 0x97, 0xCD }, NULL, NULL, 0x1EDA4DE0, 0x22BF698D, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Y2K Demo by WT_Riker (PD) [b1]", { 0xA9, 0x54, 0xE2, 0xBC, 0x5D, 0x77, 0x4D, 0xC6, 0xE1, 0xCE, 0xBC, 0xE5, 0x29, 0xF1, 0xCD, 0xED }, NULL, NULL, 0x83F9F2CB, 0xE7BC4744, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Y2K Demo by WT_Riker (PD)", { 0x76, 0xA1, 0x48, 0x0B, 0xE9, 0x98, 0x5D, 0x30, 0xFC, 0x58, 0x0E, 0x42, 0x16, 0x97, 0x4D, 0x3E }, NULL, NULL, 0x83F9F2CB, 0xE7BC4744, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Yakouchuu II - Satsujin Kouru (J) [!]", { 0xE2, 0x49, 0x42, 0x94, 0x8F, 0x71, 0x40, 0xEE, 0x42, 0x60, 0x26, 0x8D, 0xB7, 0x63, 0xD0, 0xFD }, NULL, NULL, 0x9F8B96C3, 0xA01194DC, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x73 },
+    { "Yoshi's Story (Ch) (iQue) [!]", { 0xF7, 0xAA, 0x4F, 0x81, 0x9F, 0x41, 0xCB, 0x42, 0x36, 0x79, 0x2A, 0x81, 0x45, 0x68, 0x46, 0x27 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Yoshi's Story (Ch) (V2) (iQue) (Manual) [!]", { 0xDF, 0x81, 0x64, 0xDA, 0x75, 0x3C, 0x9E, 0xF0, 0xB7, 0xC2, 0x61, 0x1F, 0x58, 0x4E, 0x81, 0xA9 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Yoshi's Story (Ch) (V4) (iQue) (Manual) [!]", { 0xD6, 0x77, 0x8D, 0x9D, 0x56, 0x0D, 0xEC, 0x35, 0xD8, 0xC0, 0x5A, 0xF4, 0x73, 0x8E, 0x27, 0xAA }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Yoshi's Story (Ch) (V6) (iQue) (Manual) [!]", { 0x85, 0xA9, 0x0C, 0x61, 0xB6, 0x5B, 0x56, 0x33, 0x4E, 0x00, 0x95, 0x02, 0x10, 0xC6, 0xCF, 0xC4 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Yoshi Story (J) [!]", { 0xDD, 0x8A, 0x0E, 0x54, 0x72, 0xF1, 0x3E, 0xA8, 0x7B, 0x17, 0x6F, 0x01, 0x55, 0xFA, 0x0C, 0x66 }, NULL, NULL, 0x2DCFCA60, 0x8354B147, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi Story (J) [b1]", { 0xB7, 0xB2, 0x36, 0x05, 0x1E, 0x43, 0x47, 0x42, 0x82, 0x88, 0xF8, 0xD8, 0x40, 0xBF, 0xD2, 0xE4 }, NULL, NULL, 0xE3CCFE36, 0x398FBC75, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi Story (J) [f1]", { 0x4B, 0xA4, 0xB1, 0xA2, 0xAB, 0xAF, 0x72, 0xEC, 0x83, 0xA2, 0xDB, 0x4C, 0xB6, 0xAE, 0xB7, 0xD6 }, NULL, NULL, 0x70666F63, 0xFEC28A44, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi Story (J) [f2]", { 0x38, 0xF0, 0x04, 0xF6, 0x8D, 0x5F, 0x1A, 0xBB, 0xC4, 0x39, 0x1D, 0x15, 0x6D, 0xEB, 0xCA, 0xEF }, NULL, NULL, 0x70666F63, 0xFEC28A44, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi Story (J) [f3]", { 0xC4, 0x3E, 0x3E, 0x28, 0xD8, 0x4F, 0x33, 0x7F, 0xF1, 0xBC, 0x88, 0xFA, 0x77, 0x99, 0x6D, 0x33 }, NULL, NULL, 0x05BCD54E, 0x97E2A8C9, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi Story (J) [f4]", { 0x20, 0xED, 0x95, 0x59, 0xD4, 0x75, 0x35, 0xEA, 0x49, 0x1D, 0x35, 0x48, 0xFB, 0x9E, 0x15, 0xE2 }, NULL, NULL, 0xD4DD9982, 0xFDBA7B67, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi Story (J) [t1]", { 0x3B, 0x41, 0xBA, 0xD4, 0x1A, 0xBF, 0x45, 0x12, 0xFB, 0xF6, 0x27, 0x27, 0x41, 0x0E, 0xAC, 0x71 }, NULL, NULL, 0x369B314B, 0xE7780D04, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi Story (J) [t2] (Health and Eggs)", { 0xCF, 0x38, 0x02, 0xA9, 0x9D, 0x8F, 0xE4, 0x12, 0x35, 0x9F, 0x1E, 0xB0, 0x18, 0xFD, 0x99, 0x1F }, NULL, NULL, 0xAF5F3773, 0xB29B2C9A, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (E) (M3) [!]", { 0x25, 0x24, 0xE5, 0xFB, 0x8E, 0xD4, 0xBB, 0x8C, 0x83, 0x1C, 0x5A, 0xC0, 0x57, 0xE8, 0xF3, 0x44 }, NULL, NULL, 0xD3F97D49, 0x6924135B, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (E) (M3) [b1]", { 0x6E, 0x5E, 0x91, 0x9D, 0x0F, 0xA2, 0x92, 0xB9, 0x7A, 0xAD, 0x08, 0xE9, 0x20, 0x0E, 0x8C, 0x9C }, NULL, NULL, 0xD3F97D49, 0x6924135B, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (E) (M3) [b2]", { 0x5D, 0x3C, 0x79, 0x35, 0x19, 0x3A, 0x3B, 0x73, 0x27, 0x02, 0x1B, 0x5E, 0x47, 0x40, 0xDE, 0xB6 }, NULL, NULL, 0xD3F97D49, 0x6924135B, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (E) (M3) [b2][f1]", { 0xE2, 0xF6, 0xEF, 0x5D, 0x41, 0x81, 0x55, 0x86, 0x56, 0xDD, 0xE8, 0xB0, 0x16, 0x2D, 0x39, 0xD3 }, NULL, NULL, 0x9CB1BBB0, 0xBC3439C7, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (E) (M3) [b3]", { 0xC8, 0x0D, 0x0A, 0x81, 0x93, 0xD5, 0x30, 0x53, 0x0A, 0xE8, 0x75, 0xF8, 0xD9, 0x39, 0x8E, 0x82 }, NULL, NULL, 0xD3F97D49, 0x6924135B, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (E) (M3) [t1] (Health and Eggs)", { 0xAD, 0xEE, 0x58, 0x35, 0xA1, 0x12, 0x67, 0x7C, 0xCF, 0x74, 0xD5, 0xF4, 0xA1, 0x50, 0x32, 0x94 }, NULL, NULL, 0x94FEDD3F, 0x95719E88, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (U) (M2) [!]", { 0x58, 0x6A, 0x09, 0x2E, 0x22, 0x60, 0x48, 0x40, 0x97, 0x3B, 0x82, 0xDF, 0xAC, 0xEA, 0xC7, 0x7A }, NULL, NULL, 0x2337D8E8, 0x6B8E7CEC, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (U) (M2) [b1]", { 0xB9, 0x07, 0xC0, 0x51, 0xF1, 0xD7, 0xD0, 0xD1, 0x5D, 0xE6, 0x5E, 0xA8, 0x7C, 0xF3, 0xF9, 0x22 }, NULL, NULL, 0x9CB1BBB0, 0xBC3439C7, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (U) (M2) [b2]", { 0xB4, 0xA2, 0x12, 0x70, 0x33, 0xCB, 0x67, 0x1E, 0xEF, 0xE5, 0x35, 0xB0, 0x8F, 0x1A, 0xFB, 0x38 }, NULL, NULL, 0x88047F1D, 0x3B837D28, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (U) (M2) [b3]", { 0xD6, 0x35, 0x82, 0x4B, 0x5F, 0xC2, 0x56, 0xDA, 0x0F, 0x2E, 0x45, 0x76, 0x63, 0xCF, 0xF2, 0x86 }, NULL, NULL, 0xCCE336FE, 0x8F3975BC, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (U) (M2) [b4]", { 0x75, 0xF9, 0x1A, 0x5D, 0x30, 0x12, 0x08, 0x0E, 0xE9, 0xBF, 0x90, 0xC0, 0x17, 0xB5, 0x12, 0x8F }, NULL, NULL, 0x395E91DF, 0x441D95C5, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (U) (M2) [b5]", { 0x8F, 0x47, 0xF6, 0xA8, 0x07, 0x34, 0xD6, 0xC8, 0x50, 0x1A, 0xDE, 0xD5, 0x49, 0xFF, 0x65, 0xC5 }, NULL, NULL, 0xE3CCFE36, 0x398FBC75, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (U) (M2) [f1]", { 0x0D, 0xCF, 0x29, 0x47, 0x8A, 0x6D, 0xB0, 0xA3, 0x11, 0x3B, 0x9E, 0xDD, 0x2A, 0xE4, 0x28, 0xE1 }, NULL, NULL, 0xE3CCFE36, 0x398FBC75, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (U) (M2) [t1]", { 0x7C, 0xE4, 0x55, 0x9F, 0xED, 0x0E, 0xA7, 0xD8, 0x26, 0x70, 0xE9, 0xA4, 0xEC, 0xC3, 0x70, 0xCD }, NULL, NULL, 0x88047F1D, 0x3B837D28, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story (U) (M2) [t2] (Health and Eggs)", { 0x3D, 0xA2, 0xC5, 0xFA, 0x29, 0xD1, 0x1D, 0x04, 0x81, 0xB6, 0x0F, 0x6C, 0x6B, 0x14, 0x39, 0x3A }, NULL, NULL, 0xE606EE26, 0x8783EC43, 0, SAVETYPE_EEPROM_16K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3B },
+    { "Yoshi's Story BootEmu (PD)", { 0x5F, 0xE7, 0x48, 0x6A, 0x5A, 0x45, 0x8D, 0x53, 0x81, 0x79, 0xDA, 0x89, 0x8B, 0x06, 0x7A, 0xD3 }, NULL, NULL, 0x83D8A30C, 0x8552C117, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Yuke Yuke!! Trouble Makers (J) [!]", { 0x2A, 0xE3, 0x5B, 0xDF, 0x16, 0x36, 0x13, 0x02, 0x4D, 0x87, 0x6A, 0x09, 0xF2, 0x50, 0x63, 0xF3 }, NULL, NULL, 0x9FE6162D, 0xE97E4037, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Yuke Yuke!! Trouble Makers (J) [a1]", { 0x6F, 0x9E, 0x56, 0xC8, 0xA2, 0xB6, 0xBA, 0x5F, 0x6D, 0xBE, 0x52, 0x14, 0xE3, 0x52, 0x59, 0x0D }, NULL, NULL, 0x9FE6162D, 0xE97E4037, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Yuke Yuke!! Trouble Makers (J) [b1]", { 0xBE, 0x73, 0x4B, 0x15, 0x77, 0x0D, 0x28, 0xC0, 0xA2, 0x6D, 0x2D, 0xB9, 0x8D, 0xF6, 0xCC, 0xCC }, NULL, NULL, 0x9FE6162D, 0xE97E4037, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Yuke Yuke!! Trouble Makers (J) [o1]", { 0xBA, 0xDC, 0xED, 0xF5, 0xB6, 0xBE, 0xCD, 0xBC, 0xCA, 0x72, 0x67, 0xBD, 0x2D, 0x79, 0x1E, 0xB1 }, NULL, NULL, 0x9FE6162D, 0xE97E4037, 0, SAVETYPE_EEPROM_4K, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x5B },
+    { "Z64 BIOS V1.05", { 0xC6, 0x6D, 0x20, 0x37, 0xA6, 0x54, 0x37, 0x8C, 0x5C, 0xD3, 0x65, 0xB1, 0x35, 0xE3, 0x6D, 0x87 }, NULL, NULL, 0x551E06B4, 0x02CD16A8, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V1.07", { 0x73, 0x02, 0x09, 0xAD, 0x52, 0xC1, 0x78, 0x55, 0x1C, 0x29, 0x07, 0x4F, 0x49, 0xAE, 0x9B, 0x39 }, NULL, NULL, 0x551E06B4, 0x02CD16A8, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V1.08 (Ravemax Hack V1.00b)", { 0x60, 0xBC, 0x7F, 0xE2, 0x82, 0xC6, 0xBE, 0x6B, 0x90, 0xEA, 0x0B, 0x5F, 0xC6, 0x3B, 0xC9, 0x44 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V1.08", { 0xF5, 0x44, 0x15, 0x80, 0xB2, 0x7E, 0xCF, 0xB9, 0x4A, 0x8C, 0x6B, 0x79, 0x89, 0xB1, 0xD1, 0x01 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V1.09", { 0x60, 0xA3, 0x9B, 0xA7, 0xF3, 0xDC, 0xC5, 0x92, 0x11, 0x2F, 0xDF, 0x82, 0x20, 0x33, 0x5F, 0x3D }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V1.10b", { 0x14, 0x12, 0xDD, 0xDC, 0xFD, 0x2D, 0xC9, 0x60, 0xDA, 0x7D, 0x28, 0x2D, 0x99, 0xFC, 0x23, 0x56 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V1.11", { 0x40, 0xE7, 0x4D, 0xA1, 0x02, 0x55, 0xDC, 0xF0, 0x0A, 0x45, 0xF0, 0x2B, 0xED, 0x1A, 0xFC, 0xAD }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V1.12", { 0xE8, 0x10, 0x62, 0xB3, 0x6B, 0x08, 0x07, 0x8C, 0xE4, 0xCF, 0xF5, 0xA3, 0x62, 0xF4, 0x47, 0x64 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.00 (Barebones)", { 0xFF, 0xAA, 0xAF, 0xB3, 0x2A, 0x2D, 0x87, 0xC6, 0xB6, 0x21, 0xB6, 0x2F, 0xFC, 0x85, 0xA2, 0xD6 }, NULL, NULL, 0xB038EEEB, 0x00BA6901, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.00", { 0xA1, 0xCD, 0xE7, 0x73, 0xE4, 0xFB, 0x8B, 0x69, 0x10, 0x98, 0xF2, 0xB3, 0xD5, 0xF2, 0xDB, 0xBA }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.00b (Ravemax Hack)", { 0x31, 0x93, 0x77, 0xA6, 0xD8, 0x11, 0xEF, 0x8A, 0xD7, 0xB3, 0xE1, 0x6B, 0x53, 0x7E, 0x63, 0x46 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.10NTSC", { 0x72, 0x77, 0x5A, 0xB8, 0x5B, 0x51, 0x06, 0xA9, 0x7D, 0xEC, 0xB0, 0x52, 0x0D, 0xFD, 0x91, 0x80 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.10PAL", { 0xDB, 0x67, 0xB8, 0xD7, 0x25, 0x13, 0x14, 0x16, 0x3E, 0x4F, 0x71, 0x37, 0x24, 0xF5, 0x5C, 0x66 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.11NTSC", { 0xB1, 0x5D, 0x75, 0x5B, 0x8C, 0x6A, 0x4B, 0x59, 0x33, 0x80, 0x2E, 0x5F, 0x22, 0x7A, 0x18, 0x3C }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.11PAL", { 0x0C, 0xC1, 0xA1, 0x39, 0xF9, 0xC3, 0x86, 0x5F, 0xE6, 0x98, 0xC6, 0x42, 0x09, 0xC4, 0x52, 0x53 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.12NTSC", { 0xE7, 0x6F, 0x05, 0x36, 0xCD, 0xAD, 0x4C, 0x6F, 0x89, 0x80, 0x2E, 0x15, 0xA9, 0x8A, 0xE9, 0x85 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.12PAL", { 0xCC, 0x24, 0x33, 0xDF, 0xB7, 0x73, 0x8D, 0x5C, 0xB7, 0x1A, 0x75, 0xB0, 0x54, 0xE5, 0x2D, 0xD5 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.12b (Nintendo Backup Crew Hack)", { 0x07, 0xC4, 0x68, 0xE5, 0x05, 0x0F, 0xC6, 0x19, 0x79, 0x14, 0x37, 0x93, 0x0D, 0x74, 0x0B, 0x10 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.12b3", { 0x01, 0x70, 0xC8, 0x6E, 0x42, 0xE1, 0x5A, 0x36, 0x4C, 0xDC, 0x6E, 0x17, 0x6A, 0x63, 0xA5, 0x00 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.12b4", { 0xD6, 0x5B, 0x99, 0x35, 0x62, 0x96, 0xCA, 0x8F, 0x6B, 0x32, 0x73, 0x54, 0x02, 0x03, 0xE0, 0xAA }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.13", { 0xB6, 0xD6, 0xED, 0xA2, 0x44, 0xC3, 0x08, 0xE6, 0x3D, 0x36, 0xEE, 0xC6, 0x07, 0x94, 0x26, 0x05 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.15", { 0xA4, 0xB1, 0x38, 0xCA, 0xED, 0xCE, 0x03, 0x8D, 0x93, 0xC5, 0xB1, 0xFE, 0xDD, 0x89, 0x7E, 0x7D }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.16", { 0x4F, 0x55, 0x7C, 0x3F, 0x71, 0xC0, 0xD0, 0x4A, 0x54, 0x77, 0x64, 0x50, 0x91, 0x3E, 0x02, 0x7F }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.16b", { 0x8E, 0xEE, 0x06, 0xC8, 0x86, 0x13, 0xB1, 0x26, 0x57, 0x21, 0xB2, 0x65, 0x17, 0xB6, 0x4F, 0x2C }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.17 [h1]", { 0xB2, 0x92, 0x40, 0xBC, 0x2F, 0xFA, 0x6C, 0x46, 0xB8, 0x30, 0x23, 0xF2, 0x22, 0x6E, 0x3C, 0xDE }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.17 by zmod.onestop.net (ORB HDisk ZIP250 2.18zd Hack)", { 0x06, 0x58, 0xD6, 0x9E, 0xBA, 0x23, 0x6F, 0xDF, 0x6D, 0xA5, 0xD4, 0x91, 0xBD, 0xC9, 0x65, 0x74 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.17 by zmod.onestop.net (ORB HDisk ZIP250 Hack)", { 0x56, 0x8D, 0x51, 0xE1, 0xD4, 0x60, 0x2C, 0xD7, 0x4A, 0xC3, 0xA2, 0xD9, 0x71, 0x9A, 0x39, 0x0A }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.17", { 0x16, 0x30, 0xA4, 0x46, 0x85, 0x7F, 0x28, 0xD3, 0x06, 0x89, 0x07, 0xF3, 0x02, 0xB0, 0x21, 0x14 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Zelda 64 Boot Emu V1 by Crazy Nation (PD) [a1]", { 0x73, 0x44, 0x70, 0x8B, 0x7E, 0x0F, 0xC0, 0x68, 0x3B, 0xBA, 0x86, 0xD9, 0x02, 0xB9, 0x60, 0x3D }, NULL, NULL, 0x9A7A9F14, 0x05137CC7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Zelda 64 Boot Emu V1 by Crazy Nation (PD)", { 0x01, 0x5A, 0x3F, 0x07, 0x36, 0x6C, 0xEF, 0x93, 0xB5, 0xCB, 0x38, 0xB3, 0x86, 0xE6, 0x59, 0xF4 }, NULL, NULL, 0x9A7A9F14, 0x05137CC7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Zelda 64 Boot Emu V2 by Crazy Nation (PD) [a1]", { 0xE4, 0x19, 0x77, 0x4A, 0x71, 0x13, 0xF1, 0xB8, 0x2F, 0x66, 0x21, 0xEA, 0x51, 0x2F, 0x10, 0xCF }, NULL, NULL, 0x60005D15, 0x65727EFF, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Zelda 64 Boot Emu V2 by Crazy Nation (PD)", { 0x01, 0xE2, 0xC4, 0x44, 0x38, 0x55, 0x97, 0xDC, 0x4F, 0xCF, 0x09, 0xE4, 0x5C, 0x52, 0x2B, 0x01 }, NULL, NULL, 0x60005D15, 0x65727EFF, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Zool - Majou Tsukai Densetsu (J) [!]", { 0x69, 0x2A, 0x33, 0xB0, 0xD7, 0x45, 0x6F, 0xC7, 0x33, 0xA8, 0x1A, 0xB8, 0x3C, 0x20, 0x38, 0x2B }, NULL, NULL, 0x1C010CCD, 0x22D3B7FA, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Zool - Majou Tsukai Densetsu (J) [f1] (PAL)", { 0x4F, 0x8E, 0x53, 0x41, 0xB8, 0x9E, 0x6C, 0x20, 0x69, 0xA3, 0x19, 0xEF, 0x2F, 0xB5, 0x8B, 0x16 }, NULL, NULL, 0x7711DBA7, 0x4856F7E0, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x413 },
+    { "Neon64 GS V1.05 (Gameshark Version) (PD)", { 0x1D, 0xDE, 0x4D, 0x26, 0xCE, 0xDB, 0x2E, 0x85, 0x65, 0xAA, 0xCB, 0x2C, 0x80, 0x98, 0xDF, 0x8D }, NULL, NULL, 0x03D7F021, 0x8FDE0000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 GS V1.1 (Gameshark Version) (PD)", { 0x77, 0x5E, 0x6D, 0x93, 0x05, 0xBF, 0x21, 0x9C, 0x06, 0x96, 0x06, 0x3C, 0x80, 0x9F, 0x2B, 0x48 }, NULL, NULL, 0x3C0A8030, 0x354A4E78, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 GS V1.2 (Gameshark Version) (PD)", { 0x4C, 0x3F, 0x1B, 0x48, 0xE7, 0x25, 0x23, 0x91, 0xB3, 0x37, 0xD9, 0xBA, 0xE4, 0x04, 0xCF, 0x83 }, NULL, NULL, 0x3C0A8030, 0x354A5198, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 GS V1.2 (Pro Action Replay Version) (PD)", { 0x81, 0xA2, 0xC7, 0xE1, 0xEC, 0x42, 0x6D, 0x3A, 0xEE, 0x1C, 0x4B, 0x82, 0x3A, 0x2B, 0xC7, 0xBF }, NULL, NULL, 0x3C0A802D, 0x354A3458, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 GS V1.2a (Gameshark Version) (PD)", { 0x90, 0xFA, 0xF5, 0x46, 0x1E, 0x5F, 0x5C, 0xD5, 0xB6, 0x7C, 0xE7, 0x89, 0x1B, 0x9B, 0x05, 0x5B }, NULL, NULL, 0x3C0A8030, 0x354A51B0, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Neon64 GS V1.2a (Pro Action Replay Version) (PD)", { 0xB9, 0xA0, 0x6A, 0x02, 0x9A, 0x84, 0x22, 0x07, 0xA9, 0xE1, 0x7A, 0xA4, 0x0A, 0x70, 0x2F, 0x7B }, NULL, NULL, 0x3C0A802D, 0x354A3470, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Z64 BIOS V2.18", { 0x9B, 0xE7, 0x95, 0x56, 0x3D, 0xBA, 0x80, 0x2D, 0xD5, 0x66, 0xDF, 0x75, 0xD6, 0x10, 0x6C, 0xFC }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "N64probe by MooglyGuy (PD)", { 0x4B, 0x2D, 0xBC, 0x0D, 0x44, 0x8B, 0x7A, 0xD8, 0x56, 0x92, 0x91, 0xE4, 0xE4, 0x48, 0x21, 0xF0 }, NULL, NULL, 0xB216B9F1, 0xAB27D881, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "ObjectVIEWER V1.1 by Kid Stardust (PD)", { 0xD7, 0xCB, 0x11, 0xA8, 0x2E, 0xDA, 0xEE, 0x3F, 0x51, 0x93, 0x46, 0xC7, 0xEA, 0xE2, 0x01, 0xE9 }, NULL, NULL, 0x34E42466, 0xF50868AC, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "TheMuscularDemo by megahawks (PD)", { 0xA1, 0xD2, 0x3D, 0x8C, 0x7A, 0x31, 0x94, 0xDC, 0xD0, 0xAC, 0x0C, 0xA1, 0xAF, 0x79, 0x13, 0x6E }, NULL, NULL, 0xB0565CCB, 0xBDA2C237, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Mupen64Plus Demo by Marshallh (GPL)", { 0xDB, 0xF0, 0x47, 0x73, 0xEC, 0x2B, 0x8A, 0xDF, 0x8A, 0x94, 0xDB, 0x7E, 0x3E, 0x46, 0x11, 0x38 }, NULL, NULL, 0xDDBA4DE5, 0xB107004A, 5, SAVETYPE_NONE, 0, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1F },
+    { "DS1 Manager V1.1 by R. Bubba Magillicutty (PD) [T+Ita]", { 0x46, 0xC9, 0x46, 0x1B, 0x0B, 0x6F, 0x23, 0x2C, 0x5A, 0x50, 0xCA, 0x79, 0x53, 0x95, 0xD7, 0x06 }, NULL, NULL, 0x868214B8, 0xAB2BE6B7, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "F-ZERO Expansion Kit (N64DD)", { 0x02, 0xE3, 0x44, 0xEC, 0x82, 0x4B, 0xBA, 0x4A, 0x4C, 0xFF, 0xCA, 0xC5, 0xFE, 0xAD, 0xEA, 0x51 }, NULL, NULL, 0x2129FFF8, 0xAD000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "F-Zero X Expansion Kit (J) [CART HACK]", { 0x68, 0x5B, 0x2F, 0x0D, 0xEC, 0xB5, 0xBE, 0x33, 0xD2, 0x51, 0x45, 0xE5, 0x5F, 0x24, 0xA6, 0xD3 }, NULL, NULL, 0xBBFDEC37, 0xD93B9EC0, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "F-Zero X Expansion Kit (U) [CART HACK]", { 0x59, 0x32, 0xD0, 0x7D, 0x6A, 0xAA, 0x84, 0xB7, 0xD7, 0x4F, 0x52, 0x51, 0xD8, 0x94, 0x2C, 0x91 }, NULL, NULL, 0xC6E39C0A, 0xD2726676, 0, SAVETYPE_EEPROM_4K, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x33 },
+    { "N64DD IPLROM (J)", { 0x8D, 0x3D, 0x9F, 0x29, 0x4B, 0x6E, 0x17, 0x4B, 0xC7, 0xB1, 0xD2, 0xFD, 0x1C, 0x72, 0x75, 0x30 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Wonder Project J2 - Koruro no Mori no Jozet (J) [T-Eng0.05]", { 0x83, 0x80, 0x7A, 0x54, 0x37, 0xA2, 0xEA, 0x21, 0xE2, 0x13, 0x3D, 0xBA, 0x1E, 0x41, 0x07, 0x50 }, NULL, NULL, 0x3A4B5938, 0xA26F989D, 0, SAVETYPE_NONE, 1, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x45B },
+    { "Z64 BIOS V2.20cf", { 0xE0, 0x53, 0x0F, 0x18, 0x2E, 0xA3, 0xBB, 0x78, 0x0A, 0x62, 0x64, 0xB1, 0xD0, 0x67, 0x37, 0xA1 }, NULL, NULL, 0x00000000, 0x00005053, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3 },
+    { "Zelda no Densetsu - Mujura no Kamen (J) (GC) [!]", { 0xD3, 0x92, 0x9A, 0xAD, 0xF7, 0x64, 0x0F, 0x8C, 0x5B, 0x4C, 0xE8, 0x32, 0x1A, 0xD4, 0x39, 0x3A }, NULL, NULL, 0x8473D0C1, 0x23120666, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Zelda no Densetsu - Mujura no Kamen (J) (V1.0) [!]", { 0x15, 0xD1, 0xA2, 0x21, 0x7C, 0xAD, 0x61, 0xC3, 0x9C, 0xFE, 0xCB, 0xFF, 0xA0, 0x70, 0x3E, 0x25 }, NULL, NULL, 0xEC417312, 0xEB31DE5F, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Zelda no Densetsu - Mujura no Kamen (J) (V1.0) [b1]", { 0x3E, 0x60, 0xCA, 0x69, 0x3B, 0xAB, 0xFF, 0x1F, 0x62, 0xCF, 0x8C, 0x0A, 0xEC, 0x33, 0x85, 0x56 }, NULL, NULL, 0xEC417312, 0xEB31DE5F, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Zelda no Densetsu - Mujura no Kamen (J) (V1.0) [b1][o1]", { 0x0F, 0x6D, 0x3E, 0xDB, 0x57, 0x97, 0xA7, 0x75, 0x75, 0x73, 0x36, 0x54, 0x9A, 0x8A, 0x9B, 0x94 }, NULL, NULL, 0xEC417312, 0xEB31DE5F, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Zelda no Densetsu - Mujura no Kamen (J) (V1.0) [f1]", { 0xE0, 0xCE, 0xD3, 0x0B, 0xF1, 0x0F, 0x05, 0xEB, 0xAF, 0x1F, 0x1A, 0x27, 0x56, 0x3E, 0x3E, 0x5D }, NULL, NULL, 0xEE7AF9EC, 0xA750B2D3, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Zelda no Densetsu - Mujura no Kamen (J) (V1.0) [o1]", { 0x0F, 0xA2, 0x3C, 0xD3, 0x0B, 0x68, 0xEB, 0x86, 0x54, 0x86, 0x30, 0xFE, 0x63, 0x5B, 0xB9, 0x0E }, NULL, NULL, 0xEC417312, 0xEB31DE5F, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "Zelda no Densetsu - Mujura no Kamen (J) (V1.1) [!]", { 0xC3, 0x8A, 0x7F, 0x6F, 0x6B, 0x61, 0x86, 0x2E, 0xA3, 0x83, 0xA7, 0x5C, 0xDF, 0x88, 0x82, 0x79 }, NULL, NULL, 0x69AE0438, 0x2C63F3F3, 4, SAVETYPE_FLASH_RAM, 1, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x3F },
+    { "64DD IPL (JPN)", { 0x8D, 0x3D, 0x9F, 0x29, 0x4B, 0x6E, 0x17, 0x4B, 0xC7, 0xB1, 0xD2, 0xFD, 0x1C, 0x72, 0x75, 0x30 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "64DD IPL (USA)", { 0x37, 0xC3, 0x6E, 0x42, 0x86, 0xD3, 0x68, 0x92, 0xA9, 0xFC, 0x70, 0xEA, 0xFE, 0x41, 0x04, 0xBE }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Mario Artist Paint Studio (J)", { 0x84, 0x85, 0x64, 0x3E, 0x58, 0x30, 0xCD, 0x67, 0xED, 0x4C, 0x0A, 0x5F, 0xD4, 0x9E, 0x24, 0x91 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Mario Artist Talent Studio (J)", { 0x88, 0x22, 0x8E, 0x99, 0x0B, 0x58, 0xA9, 0x4E, 0x9B, 0x34, 0x60, 0xBE, 0xFF, 0x63, 0x23, 0x04 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Mario Artist Communication Kit (J)", { 0x11, 0x4A, 0xF7, 0x22, 0x02, 0x9D, 0x63, 0x86, 0xC3, 0xBF, 0xEA, 0x4C, 0xC8, 0xFA, 0x60, 0x3C }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Mario Artist Polygon Studio (J)", { 0xDA, 0x23, 0xEE, 0x56, 0x15, 0x78, 0xB7, 0xDA, 0xD7, 0x7E, 0xD7, 0x27, 0x28, 0xB4, 0x6D, 0x30 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Sim City 64 (J)", { 0xEB, 0xBA, 0x03, 0xF2, 0x00, 0x96, 0xFC, 0x2B, 0xC1, 0x78, 0xFC, 0x3A, 0x1F, 0x4E, 0xC2, 0xB6 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Nihon Pro Golf Tour 64 (J)", { 0x9F, 0x79, 0x7A, 0x9C, 0x70, 0x4B, 0x5E, 0xBD, 0x04, 0xD6, 0xA2, 0xB0, 0x36, 0x30, 0x9A, 0xF2 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Kyojin no Doshin 1 (J)", { 0xE8, 0xEB, 0x81, 0x0D, 0x99, 0x6E, 0x12, 0xCD, 0x6C, 0x47, 0x44, 0x5F, 0x87, 0xA9, 0x4C, 0x72 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Kyojin no Doshin 1 (J) (Store Demo)", { 0xAF, 0xE0, 0x59, 0xAE, 0x12, 0x10, 0x75, 0x1B, 0x6C, 0x84, 0x9C, 0xFB, 0x48, 0x2C, 0x99, 0xDD }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Randnet Disk (J) [Rev. 00]", { 0x26, 0x08, 0x7E, 0x07, 0x50, 0xFC, 0x6D, 0xA0, 0xF3, 0xDE, 0x2A, 0x43, 0x1E, 0x34, 0xBD, 0xDF }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Randnet Disk (J) [Rev. 01]", { 0x33, 0xCB, 0xC5, 0x97, 0x86, 0x06, 0x32, 0x85, 0xDC, 0x3C, 0x09, 0x0E, 0x0E, 0xD3, 0x12, 0xE3 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Kyojin no Doshin - Kaihou Sensen Chibikkochikko Dai Shuugou (J)", { 0xFC, 0xCA, 0x9A, 0xF8, 0xC1, 0x17, 0x4C, 0x40, 0xB4, 0x78, 0xEA, 0x0E, 0x02, 0x67, 0x3B, 0x16 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "F-ZERO X Expansion Kit (J)", { 0xCB, 0x2F, 0xB0, 0x0C, 0x39, 0x21, 0x24, 0x5A, 0xE0, 0x4B, 0xB3, 0x8B, 0xA0, 0x1A, 0xBE, 0x92 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Super Mario 64 Disk Version (J) (Spaceworld 1996 Demo)", { 0xD9, 0xEA, 0x90, 0x57, 0x27, 0xB4, 0x4F, 0x27, 0x74, 0x92, 0x6C, 0xB0, 0x3C, 0x23, 0x00, 0xA7 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x1 },
+    { "Dezaemon 3D Expansion Disk (J) (Proto)", { 0x84, 0x70, 0x6E, 0x10, 0x02, 0x6B, 0xD2, 0xEE, 0x96, 0x54, 0xDA, 0x5E, 0x98, 0x21, 0x59, 0x8D }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x9 },
+    { "Dezaemon 3D Expansion Disk (J) (Proto)", { 0x7B, 0xB3, 0x97, 0x47, 0x54, 0xA5, 0x4B, 0xA2, 0x7A, 0x93, 0xF9, 0x66, 0x91, 0xDC, 0x46, 0x95 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x9 },
+    { "Dezaemon 3D Expansion Disk (J) (Proto)", { 0x40, 0xAA, 0x8E, 0xC5, 0x2C, 0x5E, 0x02, 0x5D, 0x6C, 0x6A, 0xD9, 0x4C, 0xEB, 0xC2, 0x21, 0x8F }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x9 },
+    { "Dezaemon 3D Expansion Disk (J) (Proto) [a1]", { 0xC1, 0x08, 0xA9, 0xB1, 0xEB, 0x02, 0x4F, 0x0D, 0x23, 0x17, 0xC0, 0x59, 0x76, 0xBA, 0x49, 0xF2 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_SRAM, 4, 1, 2, 0, 0, 1, 0, 0x900, 100, 0x9 },
+    { "Mario Artist Paint Studio (J) (1999-02-11 Proto)", { 0x4D, 0x02, 0xF5, 0xA7, 0x19, 0xBD, 0x45, 0x5F, 0x67, 0x72, 0x1C, 0x64, 0xB1, 0x6A, 0xE0, 0xCB }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x41 },
+    { "Mario Artist Paint Studio (J) (1999-02-11 Proto)", { 0xA7, 0x6B, 0x61, 0x9E, 0xC8, 0x32, 0xA7, 0xE2, 0xAB, 0xCF, 0xBD, 0xFE, 0xB5, 0x37, 0x5E, 0x39 }, NULL, NULL, 0x00000000, 0x00000000, 0, SAVETYPE_EEPROM_4K, 4, 1, 1, 0, 0, 1, 0, 0x900, 100, 0x41 },
+};
+
+/* romdb_entries indices sorted by MD5, and the start of each first byte */
+static const uint16_t romdb_md5_index[3278] = {
+    2193, 295, 485, 969, 175, 1862, 1536, 1894, 275, 2595, 2838, 336,
+    1375, 562, 28, 556, 2428, 2099, 2827, 1132, 1257, 726, 3228, 3217,
+    363, 1715, 776, 2457, 3230, 623, 799, 1875, 804, 320, 2082, 3011,
+    2452, 1629, 3245, 615, 722, 1231, 1891, 2301, 2998, 1411, 2321, 123,
+    2243, 3097, 2900, 2345, 1313, 2922, 211, 1328, 1420, 682, 2563, 2120,
+    2322, 141, 1694, 882, 508, 1843, 2753, 3046, 960, 3102, 1393, 79,
+    2703, 553, 2600, 524, 1261, 751, 2039, 900, 766, 2607, 1310, 88,
+    2968, 2320, 76, 3224, 219, 449, 2585, 750, 908, 2774, 646, 1869,
+    148, 2940, 1984, 3216, 729, 2307, 2905, 1168, 3027, 2464, 1043, 5,
+    945, 3109, 3111, 393, 887, 1858, 1143, 842, 2319, 2323, 2520, 377,
+    328, 2016, 3094, 322, 383, 2566, 1578, 3089, 1000, 2280, 2066, 2309,
+    2674, 212, 1365, 473, 496, 2925, 1188, 37, 2502, 1922, 780, 1497,
+    1048, 786, 200, 2040, 2933, 2023, 2058, 2652, 1684, 1096, 156, 399,
+    936, 598, 2104, 2637, 392, 577, 2650, 1728, 2395, 2889, 1401, 3150,
+    155, 2958, 2392, 718, 2573, 1364, 3213, 1351, 187, 3064, 1456, 637,
+    1855, 65, 1781, 2409, 3191, 602, 658, 1529, 3137, 2295, 539, 2219,
+    536, 306, 630, 2437, 281, 3254, 841, 712, 1011, 1824, 3256, 161,
+    1756, 3139, 2430, 2883, 611, 636, 1842, 272, 626, 2852, 2158, 1449,
+    2160, 2471, 2485, 339, 3262, 591, 1187, 2752, 3030, 733, 49, 52,
+    101, 2843, 747, 3051, 1634, 2926, 2686, 1392, 2420, 648, 1236, 1792,
+    2756, 1639, 1151, 2118, 4, 578, 1525, 2298, 279, 311, 31, 2492,
+    2481, 971, 142, 86, 701, 289, 2483, 555, 2884, 1404, 1515, 3204,
+    334, 2909, 2204, 1301, 940, 2333, 2593, 634, 375, 498, 357, 2670,
+    53, 2393, 1185, 1609, 2069, 1134, 957, 2238, 2786, 1880, 1093, 1396,
+    3252, 1013, 845, 2814, 3108, 1985, 1488, 3226, 1322, 2326, 2916, 2313,
+    417, 2850, 1778, 298, 116, 2456, 391, 415, 2482, 1615, 981, 2530,
+    1455, 1438, 398, 1812, 192, 2705, 1872, 2822, 828, 1083, 1100, 1630,
+    1806, 1357, 1262, 563, 748, 2778, 2560, 1115, 1916, 2857, 2476, 2454,
+    2352, 2828, 547, 2963, 2543, 1038, 1126, 2964, 1028, 2181, 784, 546,
+    441, 2383, 3157, 2363, 1212, 760, 2671, 629, 1748, 3127, 2810, 340,
+    394, 1433, 675, 1349, 2538, 1823, 246, 1568, 439, 277, 461, 313,
+    964, 1978, 544, 3008, 566, 1567, 943, 2170, 6, 3233, 2947, 414,
+    1519, 1050, 980, 3016, 1686, 26, 2646, 183, 2001, 1190, 2121, 3069,
+    240, 2862, 1281, 3057, 1740, 444, 1866, 2106, 3023, 3079, 2402, 1140,
+    533, 1240, 1248, 1202, 2691, 1437, 2272, 1590, 1061, 2125, 573, 1589,
+    3176, 921, 1239, 2848, 1995, 2283, 464, 1777, 934, 1123, 863, 1712,
+    941, 254, 689, 2636, 1556, 2682, 869, 1434, 423, 1928, 2401, 2468,
+    1193, 2268, 2521, 1682, 1671, 1098, 2715, 1072, 1665, 2604, 1904, 3034,
+    128, 1294, 2460, 1221, 2587, 1312, 2902, 1563, 1742, 2183, 2487, 1122,
+    479, 3087, 1181, 2255, 2221, 75, 1805, 316, 2640, 154, 3179, 453,
+    1272, 2357, 557, 125, 1616, 1205, 2258, 82, 690, 2877, 1538, 3268,
+    1687, 1849, 552, 2938, 1796, 259, 1494, 929, 1389, 1790, 2527, 1206,
+    2129, 2759, 1109, 978, 694, 2146, 2097, 472, 117, 2921, 2741, 2375,
+    2953, 1161, 2385, 1002, 1851, 1526, 571, 2216, 862, 1386, 1726, 1042,
+    2366, 366, 2314, 2678, 3006, 2966, 2282, 2257, 2834, 424, 1071, 1266,
+    758, 2417, 1416, 519, 1657, 2445, 2377, 3113, 3195, 3010, 2346, 2432,
+    1321, 1436, 2053, 1738, 1656, 1300, 157, 521, 1035, 1486, 238, 349,
+    22, 931, 47, 506, 2529, 1373, 2817, 41, 358, 455, 2713, 1353,
+    1076, 152, 1492, 683, 2946, 2610, 1101, 1316, 2426, 910, 1767, 2769,
+    2189, 61, 1062, 1716, 723, 2100, 2441, 2429, 1638, 348, 958, 2655,
+    1258, 911, 379, 1617, 2616, 3026, 400, 1244, 672, 523, 2831, 2278,
+    3072, 2734, 731, 105, 451, 1354, 1005, 3209, 2497, 3092, 300, 435,
+    102, 2218, 813, 458, 534, 1358, 1940, 51, 2735, 1363, 1642, 1625,
+    2711, 481, 3269, 2798, 2936, 589, 1402, 2174, 250, 1060, 243, 1216,
+    2374, 500, 1970, 2516, 1, 2303, 740, 2006, 2439, 670, 405, 434,
+    1233, 2660, 625, 2241, 64, 2699, 3009, 635, 1171, 1144, 955, 889,
+    2161, 3154, 2378, 992, 937, 3136, 1713, 1663, 1537, 1406, 465, 785,
+    1595, 293, 2486, 3096, 2899, 467, 998, 2211, 1635, 1224, 946, 2384,
+    2350, 2318, 1961, 131, 2090, 1232, 1661, 950, 2976, 3105, 3259, 1688,
+    1523, 1853, 1528, 3041, 2890, 1807, 893, 2019, 668, 3174, 2449, 420,
+    1117, 469, 1559, 599, 2087, 476, 1668, 2556, 3143, 1085, 1681, 2109,
+    2728, 922, 2478, 1044, 865, 3177, 202, 23, 1131, 2455, 1199, 307,
+    974, 730, 1091, 1608, 2913, 2630, 1049, 3142, 2754, 1794, 396, 2638,
+    2865, 1121, 894, 167, 628, 2874, 1282, 2824, 214, 2588, 1112, 1757,
+    99, 2035, 2479, 3193, 2898, 1850, 2568, 1020, 2153, 1425, 1333, 1988,
+    1382, 3253, 872, 2495, 443, 2089, 390, 2653, 1170, 2719, 1343, 741,
+    1139, 285, 2185, 2707, 2868, 2721, 1034, 1689, 1513, 2751, 2794, 2349,
+    2141, 3035, 1469, 2629, 3045, 2920, 350, 904, 2347, 2617, 2477, 184,
+    2412, 3275, 267, 2526, 2228, 3205, 236, 1470, 727, 2324, 1773, 2026,
+    2065, 709, 362, 1903, 2989, 2673, 1982, 531, 122, 569, 3084, 2369,
+    1527, 2929, 654, 601, 1914, 2914, 90, 280, 2387, 734, 1530, 2667,
+    2175, 541, 1868, 1908, 892, 1174, 3146, 2654, 2840, 2018, 1189, 1105,
+    1368, 2007, 2508, 1029, 2310, 1750, 1218, 1051, 158, 1064, 1973, 1581,
+    935, 290, 807, 1408, 2373, 1119, 2569, 1474, 963, 3040, 2860, 926,
+    2559, 2505, 1452, 3153, 878, 2304, 2680, 2194, 54, 2164, 475, 452,
+    1254, 570, 1878, 1167, 2722, 1795, 1207, 2325, 1972, 2863, 2081, 2220,
+    1482, 1017, 532, 2819, 3163, 3244, 979, 1249, 3074, 507, 2010, 3043,
+    2466, 2234, 1285, 2983, 1247, 229, 930, 1331, 2519, 1022, 2606, 126,
+    1739, 1057, 1802, 520, 1280, 714, 2235, 74, 1993, 2296, 1444, 861,
+    2851, 3129, 174, 2609, 2030, 3155, 640, 1897, 1764, 2965, 860, 2044,
+    1524, 1907, 346, 487, 57, 1674, 2552, 775, 1306, 678, 3240, 1191,
+    2515, 3149, 3173, 1981, 1279, 2770, 583, 3145, 296, 160, 1027, 3235,
+    1346, 1264, 483, 1801, 1902, 954, 1350, 933, 1516, 190, 1946, 2036,
+    1627, 3277, 1761, 1871, 2332, 2166, 2730, 744, 319, 2775, 542, 1839,
+    130, 757, 1931, 1846, 1618, 8, 2632, 1069, 932, 168, 899, 197,
+    2915, 407, 382, 2749, 680, 2547, 638, 2930, 1753, 3221, 3232, 596,
+    2266, 9, 2858, 2096, 2443, 1784, 1175, 1506, 2849, 2987, 2776, 370,
+    387, 1585, 228, 2733, 1602, 2054, 1046, 3047, 652, 421, 1793, 2564,
+    1451, 2128, 802, 597, 513, 1554, 206, 1047, 2259, 1809, 2095, 2415,
+    2666, 1783, 1074, 3101, 1550, 1925, 1315, 2133, 2748, 2213, 2344, 2779,
+    1479, 163, 460, 2244, 632, 1813, 2077, 2154, 1845, 2888, 1125, 622,
+    796, 103, 1192, 1378, 1780, 2, 2399, 1957, 177, 3022, 715, 2615,
+    835, 1626, 1501, 821, 2473, 1818, 972, 2661, 2290, 2075, 2512, 1870,
+    2839, 338, 2579, 2594, 325, 3225, 1763, 2380, 549, 1646, 436, 1837,
+    2755, 3133, 1405, 1484, 2423, 1332, 1561, 2034, 1323, 1136, 825, 1287,
+    1409, 3185, 297, 1760, 770, 278, 153, 914, 1797, 2549, 2611, 2267,
+    2277, 3247, 2695, 2427, 2760, 1768, 1150, 2048, 431, 1620, 491, 2236,
+    2737, 768, 721, 2498, 2750, 85, 3037, 1587, 2467, 2451, 1324, 737,
+    2634, 2878, 1727, 2962, 1056, 1270, 1440, 1591, 368, 1702, 994, 3066,
+    2372, 1573, 11, 1974, 1571, 2618, 1769, 987, 2155, 829, 146, 3181,
+    1421, 2138, 3015, 661, 2540, 2342, 2979, 2300, 2119, 1466, 1980, 2005,
+    779, 2985, 2576, 2013, 2729, 3004, 1127, 1648, 2365, 2830, 3056, 2866,
+    1588, 1932, 509, 454, 502, 2203, 967, 1512, 221, 1410, 3194, 263,
+    677, 2747, 1958, 1918, 1664, 1546, 1414, 2027, 3203, 624, 3201, 2984,
+    1025, 838, 2312, 1113, 2102, 1798, 234, 3095, 1893, 574, 1012, 3151,
+    1565, 114, 1610, 1910, 1901, 356, 1376, 2463, 2440, 2555, 1388, 7,
+    564, 225, 78, 2413, 2973, 1994, 2152, 2589, 1214, 582, 124, 2545,
+    789, 2159, 1442, 2518, 938, 1867, 376, 2626, 503, 1569, 2614, 2253,
+    256, 2608, 1736, 2425, 1532, 1462, 1534, 1227, 1672, 2773, 3093, 2491,
+    2689, 40, 1160, 2328, 3048, 2475, 1774, 2032, 404, 1145, 2289, 538,
+    2790, 1053, 1552, 1876, 67, 1570, 1104, 3060, 2404, 1318, 1731, 3246,
+    817, 3158, 1059, 1309, 2028, 2249, 1336, 1856, 1274, 2532, 2767, 3231,
+    188, 2725, 1014, 1863, 1403, 643, 691, 561, 2923, 805, 1335, 2948,
+    1621, 1229, 84, 77, 397, 1723, 2407, 2683, 917, 2127, 2535, 2941,
+    1509, 633, 1443, 262, 743, 1383, 2740, 713, 837, 1099, 46, 1710,
+    1135, 3024, 2833, 70, 1021, 2694, 1680, 2842, 1006, 3159, 1407, 1912,
+    883, 24, 1290, 2875, 3001, 3039, 2885, 2746, 617, 1643, 873, 1120,
+    2231, 1415, 864, 3099, 2124, 149, 2853, 1054, 355, 1079, 227, 2881,
+    895, 3180, 159, 966, 3112, 754, 170, 1308, 2641, 820, 2876, 2294,
+    2072, 2854, 2340, 586, 3196, 2263, 1447, 205, 1930, 2583, 207, 411,
+    1962, 2504, 2329, 1094, 1228, 1213, 554, 2355, 2094, 2047, 510, 218,
+    550, 232, 1886, 2431, 1194, 2327, 1413, 859, 2795, 1475, 968, 252,
+    2841, 3134, 3210, 2901, 2657, 2919, 97, 1553, 3200, 1153, 2642, 2354,
+    1576, 1924, 3227, 2394, 1888, 3135, 1384, 477, 2055, 2590, 517, 1277,
+    984, 490, 1541, 1348, 756, 1734, 806, 2621, 848, 920, 68, 162,
+    2803, 2644, 1705, 1288, 2517, 850, 1861, 918, 1955, 1975, 975, 3189,
+    1372, 1938, 1650, 851, 2659, 3162, 3117, 1612, 16, 427, 2791, 25,
+    1269, 3165, 1699, 2176, 2051, 1937, 788, 3067, 1275, 608, 1487, 2847,
+    309, 3234, 1445, 1834, 2351, 2846, 419, 178, 140, 1422, 1647, 512,
+    1514, 1631, 119, 450, 1128, 1095, 1253, 989, 2367, 1673, 631, 2261,
+    558, 2882, 1263, 1461, 71, 1593, 2022, 535, 1822, 1636, 478, 2781,
+    1517, 1320, 924, 1023, 2553, 2078, 2809, 1110, 1463, 2808, 2286, 1399,
+    961, 3106, 2727, 2718, 3274, 2895, 2627, 1179, 2086, 736, 3148, 778,
+    1679, 2528, 463, 995, 2785, 292, 493, 767, 1297, 997, 1814, 1833,
+    1073, 3192, 1176, 2825, 2524, 1678, 1252, 1732, 55, 2101, 1217, 2956,
+    1088, 777, 2744, 897, 2960, 763, 73, 769, 2945, 1949, 1551, 1033,
+    844, 1965, 2408, 2315, 2726, 2561, 2782, 724, 2134, 1037, 1709, 612,
+    1947, 2602, 2542, 1706, 133, 1292, 1225, 614, 2676, 1446, 374, 215,
+    3005, 3123, 2009, 1926, 492, 1250, 283, 1369, 1265, 195, 2952, 1662,
+    1157, 2584, 2816, 486, 1900, 209, 3088, 2334, 2317, 204, 2612, 413,
+    3236, 2442, 3098, 755, 2649, 627, 1108, 1268, 2793, 203, 1256, 616,
+    2098, 1210, 588, 983, 505, 2061, 2982, 581, 819, 2586, 2522, 199,
+    923, 1490, 3249, 704, 2171, 1749, 2014, 905, 739, 3273, 3032, 3260,
+    1237, 1283, 386, 1666, 3020, 326, 2957, 2381, 380, 2115, 3170, 1196,
+    1820, 2688, 2892, 2633, 810, 2192, 2551, 1453, 1092, 801, 1067, 249,
+    172, 618, 1068, 855, 1278, 287, 1065, 1557, 3014, 194, 2281, 593,
+    1941, 226, 1936, 3261, 1873, 2242, 1521, 600, 42, 1063, 385, 291,
+    1564, 2991, 2421, 1722, 1154, 2045, 216, 341, 1964, 2405, 2927, 1852,
+    335, 2083, 1495, 447, 1598, 1307, 235, 2147, 1874, 823, 703, 1690,
+    35, 1208, 2845, 1472, 2716, 38, 2397, 592, 2562, 1111, 2546, 2789,
+    1496, 2252, 2643, 707, 1838, 1943, 2306, 1137, 308, 2225, 3258, 585,
+    1041, 2918, 1542, 2205, 1558, 198, 1339, 2951, 621, 1398, 1697, 1655,
+    2103, 224, 2248, 1707, 2501, 1255, 831, 3222, 389, 1865, 1811, 1426,
+    1545, 3190, 494, 2110, 446, 2783, 2085, 856, 344, 2222, 1651, 1660,
+    193, 3003, 2788, 1572, 1632, 143, 331, 165, 2184, 511, 2450, 3237,
+    1499, 3161, 830, 69, 2418, 372, 2092, 2256, 2577, 2292, 956, 797,
+    1298, 3071, 1967, 1203, 1465, 1476, 1911, 1276, 1149, 241, 2702, 2745,
+    2168, 839, 1334, 840, 147, 939, 695, 575, 2757, 787, 516, 173,
+    251, 1184, 639, 1892, 2400, 1302, 692, 138, 2287, 1580, 1124, 457,
+    927, 471, 1102, 2438, 1394, 1504, 425, 438, 1032, 302, 1996, 1234,
+    2596, 1498, 906, 870, 2493, 1840, 2959, 1685, 3128, 1390, 1177, 833,
+    515, 1613, 594, 2271, 834, 2499, 2143, 2764, 1751, 1159, 762, 2738,
+    738, 2422, 2316, 2002, 3103, 2305, 2743, 2390, 2887, 1507, 2761, 2565,
+    1183, 2687, 480, 321, 301, 2024, 2697, 2731, 2165, 909, 1366, 2823,
+    2144, 824, 1935, 2038, 3147, 587, 942, 1326, 43, 1730, 1086, 2879,
+    1574, 2724, 3007, 2907, 847, 2274, 2934, 1018, 673, 1832, 1107, 1036,
+    2182, 151, 816, 3239, 1785, 2037, 2169, 1622, 514, 1896, 1535, 1418,
+    2084, 1584, 1045, 1828, 2217, 1555, 1719, 1129, 2896, 1745, 2835, 3,
+    261, 96, 1835, 2932, 2162, 2871, 59, 885, 2131, 3012, 1976, 2820,
+    3055, 2043, 742, 2046, 2681, 1052, 1429, 1219, 2978, 1031, 1597, 2796,
+    3265, 1683, 3038, 886, 3062, 1971, 2020, 2230, 2714, 1116, 1430, 867,
+    1939, 1314, 2880, 590, 2470, 244, 2806, 21, 2494, 111, 276, 2308,
+    351, 676, 2188, 1960, 1066, 3208, 3242, 649, 1467, 2677, 702, 1885,
+    2507, 1520, 663, 605, 1039, 360, 136, 1658, 2052, 1881, 1058, 1491,
+    647, 2062, 2191, 14, 809, 2076, 1721, 1933, 2356, 1441, 1359, 3152,
+    2074, 2207, 1260, 1500, 2459, 772, 2869, 3220, 442, 774, 991, 725,
+    482, 0, 2937, 1142, 1468, 1195, 2434, 430, 247, 1804, 1986, 1969,
+    2419, 2821, 1338, 3070, 201, 2599, 2490, 3021, 812, 880, 1815, 2826,
+    822, 303, 2229, 2114, 91, 2928, 1788, 2710, 3278, 1215, 210, 671,
+    489, 1040, 871, 795, 2223, 898, 560, 56, 1070, 2792, 2200, 716,
+    890, 1998, 304, 568, 294, 2557, 135, 403, 669, 260, 169, 2970,
+    3164, 2656, 3073, 422, 3107, 1417, 2113, 2214, 2662, 2605, 1381, 2664,
+    891, 2311, 2137, 928, 416, 679, 2813, 708, 145, 579, 1454, 1819,
+    470, 642, 95, 2511, 2382, 1162, 2999, 1826, 462, 1675, 1370, 1754,
+    1427, 495, 3121, 2911, 2533, 87, 1883, 881, 3130, 2772, 913, 1222,
+    1163, 1582, 1606, 2132, 1103, 2780, 584, 271, 2448, 2364, 959, 1923,
+    2353, 977, 674, 3184, 384, 620, 717, 2254, 3077, 2893, 2371, 330,
+    2706, 29, 1502, 361, 104, 1983, 2805, 2461, 2453, 1915, 1505, 2070,
+    660, 732, 2575, 572, 3083, 134, 3052, 3267, 1919, 2832, 791, 1729,
+    402, 2391, 2031, 2361, 1825, 34, 1147, 567, 1741, 1448, 879, 2763,
+    2861, 2797, 233, 2232, 1284, 3212, 1518, 1619, 2091, 1166, 239, 551,
+    2567, 576, 3029, 2663, 2237, 836, 1821, 305, 3223, 381, 182, 223,
+    3124, 2033, 655, 3075, 501, 2376, 1963, 1766, 2672, 1481, 793, 2800,
+    2264, 548, 2179, 705, 2870, 1303, 2465, 2639, 2273, 749, 2708, 217,
+    3187, 2679, 1273, 650, 783, 2844, 353, 800, 1641, 30, 1667, 706,
+    944, 2635, 2837, 2980, 2969, 1977, 1669, 1295, 752, 120, 317, 2975,
+    1857, 230, 3219, 2126, 2836, 186, 2523, 868, 2574, 3049, 2658, 875,
+    986, 2011, 3025, 3172, 100, 1968, 2116, 526, 164, 2270, 697, 3125,
+    3036, 2944, 39, 2215, 378, 98, 499, 2506, 3138, 3186, 282, 1419,
+    2912, 1989, 1566, 684, 580, 1653, 3238, 982, 318, 2818, 518, 719,
+    1950, 3120, 1979, 2247, 609, 1267, 1201, 1720, 3198, 2665, 2233, 811,
+    323, 2723, 876, 1547, 1173, 1735, 1905, 1450, 1004, 2239, 2167, 901,
+    1489, 3160, 2338, 3018, 699, 2212, 433, 1987, 659, 2668, 1424, 976,
+    808, 1594, 1725, 613, 1700, 764, 2531, 1637, 540, 530, 1921, 3197,
+    2967, 2330, 1755, 2150, 1412, 1246, 771, 1432, 1330, 857, 2135, 832,
+    1909, 237, 273, 753, 866, 1659, 2299, 118, 1586, 1759, 2812, 1230,
+    1944, 2954, 1345, 543, 468, 3276, 2041, 365, 3028, 1645, 915, 1992,
+    2057, 999, 440, 919, 761, 270, 2995, 2388, 765, 2709, 1130, 1138,
+    1899, 2736, 2986, 1543, 2288, 2859, 2537, 1677, 19, 497, 3257, 2924,
+    2704, 359, 2398, 2570, 1019, 115, 3175, 1737, 352, 2178, 1186, 735,
+    2379, 657, 2117, 2111, 2435, 2021, 2474, 3000, 2990, 665, 1385, 1934,
+    1211, 1024, 988, 607, 3199, 3002, 2368, 2620, 2622, 1377, 2157, 27,
+    1649, 1209, 1799, 329, 1291, 466, 2544, 2469, 1717, 2245, 1097, 17,
+    2628, 2337, 815, 3183, 2446, 2619, 884, 1898, 314, 2227, 1531, 1786,
+    1337, 1478, 426, 645, 3044, 2829, 1997, 3090, 2015, 429, 2601, 949,
+    1775, 1575, 2906, 208, 2864, 3085, 2578, 1305, 3054, 2992, 1001, 3271,
+    2004, 2360, 1544, 529, 412, 371, 604, 3215, 1220, 108, 3114, 948,
+    3116, 666, 89, 2291, 268, 1355, 2209, 2177, 1844, 1800, 527, 2358,
+    112, 1765, 528, 150, 1714, 1485, 2539, 364, 107, 2631, 2597, 2251,
+    44, 2873, 1696, 1640, 2700, 94, 448, 2908, 3019, 1942, 1356, 843,
+    2777, 745, 2943, 1605, 2971, 401, 619, 3178, 947, 2904, 72, 176,
+    1628, 711, 265, 2645, 2462, 1827, 2088, 2447, 274, 1078, 1511, 220,
+    2206, 3082, 3076, 2180, 1691, 3063, 2411, 2410, 2140, 2571, 266, 912,
+    1954, 818, 2224, 2262, 1604, 1670, 2784, 1776, 1562, 2684, 3115, 1772,
+    3068, 3061, 310, 369, 2060, 2950, 1510, 1603, 700, 1198, 1743, 2525,
+    1633, 1367, 1362, 137, 2370, 565, 1379, 3251, 1854, 2073, 710, 537,
+    849, 2942, 2049, 2572, 189, 1458, 525, 408, 347, 1431, 698, 1342,
+    1991, 1789, 432, 2804, 2017, 327, 1611, 2284, 1990, 2198, 60, 2105,
+    2977, 965, 688, 3188, 1533, 3104, 3078, 3218, 3169, 1848, 2766, 3031,
+    258, 3140, 255, 2648, 2196, 1439, 2123, 1007, 3241, 2582, 1081, 484,
+    185, 242, 474, 2503, 312, 2500, 50, 3053, 1329, 2436, 3042, 2112,
+    951, 902, 2130, 1299, 3272, 1286, 58, 418, 3263, 1493, 1884, 1180,
+    2799, 191, 20, 1808, 1026, 1579, 2008, 1473, 1879, 2742, 1887, 3211,
+    559, 2903, 2758, 1864, 641, 1929, 1428, 3243, 2690, 2197, 1895, 2484,
+    2071, 1204, 257, 1882, 2186, 2955, 1152, 110, 1352, 2362, 781, 1344,
+    1708, 488, 1711, 3059, 1483, 3171, 1952, 2541, 1951, 720, 437, 179,
+    456, 996, 1223, 2396, 1810, 1831, 2972, 2685, 2122, 1560, 662, 2359,
+    653, 1703, 1347, 36, 3168, 2935, 3122, 792, 1325, 858, 2003, 1241,
+    81, 286, 132, 2136, 1435, 1075, 3250, 2012, 62, 826, 1592, 2339,
+    2139, 1155, 3255, 1607, 264, 2603, 2386, 213, 545, 1718, 1614, 522,
+    2025, 3166, 1920, 1164, 2172, 2148, 1654, 803, 814, 3182, 2064, 2698,
+    2331, 1361, 373, 1259, 92, 1549, 1791, 1360, 1245, 2250, 2210, 3144,
+    798, 129, 1010, 144, 3229, 1271, 13, 2647, 245, 2692, 1733, 2771,
+    1953, 2696, 2701, 2581, 746, 1644, 2199, 2910, 2894, 874, 2187, 687,
+    1999, 1311, 2997, 315, 1508, 2550, 1599, 1423, 1460, 1860, 916, 1182,
+    970, 2195, 410, 1387, 1391, 794, 33, 3214, 1459, 2988, 2897, 1583,
+    696, 409, 343, 93, 3206, 1623, 2151, 2717, 2613, 181, 1141, 2886,
+    109, 2472, 3110, 728, 2669, 2389, 106, 2558, 2145, 3266, 2625, 2202,
+    2720, 1601, 2765, 903, 1374, 2067, 83, 1577, 667, 2856, 2297, 2406,
+    1304, 1106, 925, 2275, 2336, 1480, 2293, 1148, 48, 333, 1156, 2802,
+    952, 2000, 664, 1397, 1746, 2513, 1744, 1762, 1395, 1146, 2335, 2080,
+    3050, 3264, 3033, 1966, 445, 1829, 3017, 1652, 1956, 3156, 180, 32,
+    1724, 196, 10, 1087, 603, 2580, 990, 2787, 3081, 127, 1080, 1009,
+    2226, 1624, 367, 1836, 2424, 2260, 139, 1830, 2739, 1698, 681, 3100,
+    253, 2598, 1841, 993, 342, 1471, 3126, 1906, 1889, 907, 2063, 1779,
+    1327, 428, 2056, 1055, 1317, 2343, 337, 1172, 388, 962, 1503, 1380,
+    2156, 2762, 269, 1289, 685, 2444, 985, 2712, 2994, 1948, 2489, 2591,
+    595, 2891, 2510, 1522, 504, 166, 790, 1293, 1752, 877, 2265, 2534,
+    3013, 853, 2554, 1596, 2651, 2142, 1693, 896, 1695, 2433, 1945, 1030,
+    2240, 2414, 2201, 2093, 2285, 2068, 2416, 827, 3131, 2403, 644, 2107,
+    345, 1238, 1015, 606, 1165, 2996, 973, 1917, 1197, 1089, 854, 1877,
+    1200, 459, 3202, 1847, 2872, 113, 1539, 3141, 1747, 1477, 248, 1251,
+    1008, 284, 2341, 2079, 2246, 1077, 2149, 2801, 2480, 1692, 406, 846,
+    1890, 1340, 2981, 1242, 288, 332, 2042, 1082, 3167, 3058, 2732, 45,
+    395, 3091, 2509, 852, 2496, 1787, 171, 222, 1243, 3119, 1464, 2807,
+    1341, 3065, 2623, 2993, 2163, 1400, 1913, 1701, 121, 1859, 1235, 1600,
+    1803, 1178, 686, 3086, 231, 2867, 12, 1782, 3132, 2675, 299, 324,
+    2624, 1158, 1118, 1003, 2855, 651, 2348, 2269, 2059, 888, 2917, 354,
+    2514, 773, 1114, 1084, 1319, 656, 2276, 2173, 2190, 2811, 2768, 2208,
+    1927, 1548, 2548, 2949, 693, 3270, 1817, 1371, 1226, 1770, 1959, 2488,
+    1090, 2961, 1758, 66, 80, 1296, 2815, 2931, 1133, 610, 15, 953,
+    2458, 2536, 18, 2108, 782, 2279, 759, 1676, 1016, 1540, 2029, 63,
+    2693, 3080, 1457, 1771, 2974, 2592, 3207, 2050, 1169, 2302, 2939, 1816,
+    3118, 1704,
+};
+
+static const uint16_t romdb_md5_buckets[257] = {
+    0, 17, 30, 40, 54, 70, 82, 92, 105, 122, 134, 148,
+    165, 176, 186, 194, 206, 217, 233, 247, 262, 278, 293, 310,
+    320, 326, 343, 353, 362, 373, 384, 391, 403, 423, 431, 450,
+    462, 477, 491, 507, 521, 531, 542, 550, 561, 572, 580, 589,
+    597, 612, 628, 634, 644, 657, 674, 686, 710, 718, 723, 734,
+    751, 759, 778, 791, 808, 824, 841, 856, 875, 893, 903, 920,
+    938, 951, 963, 970, 981, 996, 1012, 1026, 1038, 1051, 1059, 1068,
+    1083, 1096, 1116, 1124, 1138, 1149, 1163, 1173, 1185, 1196, 1211, 1222,
+    1236, 1250, 1256, 1266, 1284, 1295, 1308, 1316, 1328, 1340, 1355, 1368,
+    1383, 1394, 1409, 1425, 1434, 1449, 1459, 1472, 1483, 1494, 1512, 1530,
+    1541, 1554, 1566, 1578, 1594, 1610, 1624, 1635, 1661, 1673, 1685, 1701,
+    1711, 1720, 1731, 1738, 1751, 1766, 1771, 1782, 1790, 1808, 1814, 1833,
+    1849, 1860, 1869, 1880, 1889, 1900, 1912, 1919, 1934, 1949, 1969, 1982,
+    1997, 2011, 2020, 2033, 2047, 2062, 2073, 2083, 2094, 2110, 2122, 2138,
+    2152, 2166, 2182, 2195, 2207, 2221, 2236, 2248, 2266, 2280, 2291, 2306,
+    2314, 2332, 2342, 2357, 2371, 2385, 2398, 2410, 2423, 2432, 2441, 2455,
+    2466, 2477, 2488, 2498, 2511, 2528, 2532, 2543, 2559, 2564, 2576, 2588,
+    2599, 2618, 2634, 2643, 2662, 2674, 2686, 2698, 2711, 2725, 2735, 2753,
+    2757, 2767, 2779, 2788, 2805, 2816, 2830, 2837, 2853, 2872, 2879, 2892,
+    2907, 2917, 2927, 2940, 2955, 2975, 2989, 3003, 3018, 3036, 3049, 3063,
+    3075, 3088, 3100, 3113, 3123, 3133, 3143, 3153, 3173, 3188, 3197, 3215,
+    3225, 3236, 3250, 3262, 3278,
+};
+
+/* romdb_entries indices sorted by CRC, and the start of each first CRC1 byte */
+static const uint16_t romdb_crc_index[3224] = {
+    679, 680, 684, 685, 688, 690, 695, 696, 697, 698, 699, 700,
+    701, 702, 703, 704, 705, 706, 707, 708, 709, 710, 711, 712,
+    713, 714, 715, 716, 717, 718, 719, 720, 721, 722, 723, 724,
+    725, 726, 727, 3248, 3201, 3202, 3203, 3204, 3205, 3206, 3208, 3209,
+    3210, 3211, 3212, 3213, 3214, 3215, 3216, 3217, 3218, 3219, 3220, 3221,
+    3222, 3223, 3224, 3225, 3226, 3239, 3250, 661, 311, 2780, 2545, 1942,
+    2478, 2533, 938, 2454, 1562, 1563, 776, 2420, 2421, 2422, 846, 2470,
+    2364, 2365, 2341, 3, 2212, 2238, 2477, 2655, 445, 2074, 2075, 2076,
+    2077, 2078, 3233, 1078, 1080, 1081, 3004, 3005, 3008, 33, 34, 837,
+    838, 836, 804, 805, 808, 737, 477, 478, 480, 481, 482, 483,
+    3157, 794, 795, 796, 2844, 2845, 2186, 3175, 2661, 1341, 1342, 1343,
+    1344, 1348, 1349, 1353, 2757, 915, 916, 917, 918, 1588, 859, 860,
+    591, 475, 476, 901, 903, 2538, 282, 283, 284, 286, 1383, 1682,
+    210, 825, 827, 1375, 628, 273, 368, 2824, 1486, 1389, 1390, 2985,
+    2405, 2406, 1116, 1117, 1118, 1119, 2145, 2146, 1781, 1782, 1746, 1747,
+    1748, 1749, 3156, 1412, 1414, 1415, 1515, 1294, 2401, 2080, 2264, 1698,
+    444, 446, 447, 925, 305, 1683, 2370, 1764, 1765, 1766, 69, 802,
+    1614, 2397, 963, 3058, 1170, 2388, 2389, 2456, 255, 1580, 455, 3119,
+    3120, 3122, 3123, 1359, 1360, 1061, 738, 740, 1183, 1184, 839, 840,
+    841, 842, 843, 929, 930, 585, 586, 587, 1066, 2968, 2853, 1713,
+    621, 2349, 2848, 1320, 1322, 1605, 1606, 1607, 1608, 2791, 2792, 2793,
+    1721, 1186, 539, 2170, 106, 1554, 1555, 1556, 1557, 1558, 2576, 876,
+    733, 734, 595, 981, 982, 961, 2479, 1025, 1028, 3051, 3052, 3135,
+    3136, 3134, 1572, 1573, 1574, 1575, 1576, 1577, 1578, 1579, 2547, 1761,
+    2712, 757, 758, 3155, 2872, 983, 1287, 1288, 1289, 1290, 2005, 2006,
+    2007, 2008, 1175, 428, 2972, 2973, 234, 65, 1950, 1944, 1939, 2871,
+    2721, 2722, 2723, 2687, 2609, 2643, 2827, 2828, 2277, 2278, 227, 231,
+    232, 1029, 2098, 1377, 2779, 608, 215, 216, 217, 2495, 826, 2419,
+    2749, 221, 222, 1858, 2113, 2195, 2196, 786, 787, 1849, 2228, 2229,
+    2849, 1023, 2835, 2141, 2142, 2143, 2144, 2770, 2771, 2676, 71, 72,
+    73, 74, 76, 77, 78, 2498, 2556, 2557, 2558, 2588, 2242, 2265,
+    3231, 2270, 2649, 2632, 1087, 1102, 1308, 2863, 453, 454, 473, 2969,
+    1488, 1489, 1490, 1492, 1628, 1629, 490, 491, 492, 814, 268, 356,
+    358, 560, 2903, 1718, 618, 3162, 3163, 735, 736, 3126, 3127, 159,
+    12, 14, 21, 25, 2418, 2402, 1176, 2244, 1233, 1770, 1771, 1772,
+    597, 856, 244, 245, 2830, 669, 670, 671, 672, 673, 674, 675,
+    676, 677, 678, 681, 682, 683, 686, 687, 689, 691, 692, 693,
+    694, 2773, 2023, 2024, 2526, 2527, 2528, 2338, 2340, 941, 2823, 3245,
+    829, 497, 499, 500, 502, 503, 2022, 1535, 879, 2605, 2652, 1264,
+    989, 990, 1041, 3092, 3094, 3093, 2524, 1768, 1769, 550, 1285, 977,
+    1167, 1364, 3185, 1882, 1883, 1887, 330, 2907, 1885, 2055, 2068, 1517,
+    1518, 1891, 2305, 1064, 2281, 2284, 2286, 2287, 1511, 1018, 1019, 1656,
+    1657, 1658, 247, 248, 249, 1779, 1780, 1892, 2618, 2621, 2065, 1639,
+    2695, 117, 2108, 2109, 511, 176, 177, 2373, 203, 1512, 1513, 1157,
+    1158, 1491, 109, 111, 1714, 2246, 1890, 1690, 1788, 2026, 2027, 2028,
+    1786, 1784, 2311, 2312, 1959, 2663, 1968, 2939, 2940, 2941, 2942, 2232,
+    2233, 651, 1191, 1794, 1972, 1974, 1975, 1976, 1730, 1731, 2444, 2445,
+    2446, 2447, 2448, 2449, 2450, 3150, 3151, 3015, 1548, 1549, 1550, 1551,
+    1552, 369, 2819, 1501, 529, 530, 537, 2471, 505, 506, 507, 508,
+    509, 510, 3023, 3024, 748, 749, 2746, 2137, 158, 387, 353, 3153,
+    136, 1621, 103, 3171, 2776, 2909, 132, 494, 495, 58, 59, 60,
+    1753, 1754, 1755, 1756, 1757, 1758, 2509, 2510, 2362, 3010, 1060, 2884,
+    2886, 2887, 2888, 2899, 2900, 2892, 2893, 2894, 2895, 2896, 1198, 1199,
+    1200, 1201, 1202, 2988, 2989, 2990, 2991, 2992, 376, 377, 517, 130,
+    2575, 151, 152, 2036, 3148, 3149, 1222, 556, 557, 994, 1617, 1949,
+    2597, 574, 2600, 747, 2070, 2071, 2072, 2947, 372, 388, 993, 992,
+    2300, 2301, 803, 970, 971, 624, 626, 1219, 3131, 2546, 3033, 3014,
+    573, 2735, 2737, 1296, 1297, 1298, 1299, 1300, 1301, 1302, 558, 2971,
+    835, 3241, 1935, 137, 2320, 2759, 2760, 2761, 2762, 2763, 2764, 2765,
+    2766, 2767, 3132, 22, 30, 1153, 1154, 1155, 1156, 3047, 1327, 1329,
+    391, 394, 3177, 1902, 1903, 1904, 1908, 962, 40, 1953, 553, 2542,
+    2543, 2777, 2097, 2928, 588, 2923, 1729, 2211, 890, 891, 892, 893,
+    894, 895, 1307, 2214, 2347, 1583, 1584, 2816, 3189, 3011, 919, 877,
+    174, 2254, 1095, 271, 515, 1622, 1708, 2465, 2466, 2467, 3249, 207,
+    1707, 1214, 1128, 2012, 2010, 2430, 1, 1703, 1291, 1027, 2958, 1312,
+    3236, 3238, 3234, 3235, 3237, 2794, 2795, 365, 363, 366, 2429, 2432,
+    620, 2155, 155, 927, 2638, 2639, 1948, 252, 254, 1502, 1500, 1284,
+    728, 2117, 1668, 1670, 1672, 1674, 1675, 1676, 1677, 1678, 1679, 1680,
+    864, 2562, 1127, 1129, 1130, 1131, 1132, 1133, 399, 2191, 2192, 1053,
+    1889, 2139, 2140, 1740, 1742, 1743, 1744, 1745, 84, 87, 378, 379,
+    607, 816, 821, 822, 823, 2230, 1314, 2210, 2213, 1936, 107, 1152,
+    1673, 2403, 788, 2177, 2275, 2239, 2624, 2626, 1799, 1802, 1803, 1806,
+    1762, 1763, 465, 2797, 2798, 180, 181, 182, 185, 187, 188, 190,
+    191, 192, 193, 194, 196, 197, 199, 200, 427, 2136, 2221, 380,
+    2367, 760, 1382, 1071, 1295, 2657, 2658, 2532, 410, 413, 416, 419,
+    1076, 1313, 2235, 2025, 127, 80, 146, 1983, 1984, 411, 414, 417,
+    420, 1877, 1058, 337, 338, 2799, 2800, 1086, 3076, 2981, 2396, 2966,
+    2967, 2169, 1671, 1032, 1686, 1362, 1681, 1684, 1072, 1073, 1074, 1075,
+    1077, 559, 1266, 2996, 2997, 3160, 2670, 2671, 96, 2552, 2368, 921,
+    2814, 2810, 2811, 2812, 2813, 1047, 1049, 1050, 2315, 2917, 2700, 832,
+    833, 3079, 2050, 2051, 2059, 968, 412, 2189, 2190, 1367, 1318, 540,
+    2215, 2268, 2093, 1960, 1961, 2276, 449, 2962, 2225, 662, 663, 2321,
+    35, 36, 162, 1624, 2957, 1063, 2399, 2400, 914, 2611, 2612, 2613,
+    2614, 2615, 2616, 2875, 1669, 183, 184, 189, 195, 2628, 2631, 1716,
+    2423, 2043, 2044, 2306, 768, 769, 770, 3001, 3002, 3046, 202, 2424,
+    2425, 2426, 2427, 1895, 1896, 1897, 1898, 1899, 1900, 1901, 2948, 2688,
+    2690, 2807, 771, 2796, 3142, 1325, 403, 3009, 2011, 1917, 2537, 2292,
+    2980, 1244, 1245, 1246, 1247, 2201, 1705, 561, 2949, 1999, 2001, 218,
+    214, 1068, 1355, 1356, 1357, 2452, 270, 1417, 2100, 2350, 1965, 1966,
+    2434, 850, 851, 965, 966, 967, 570, 759, 307, 309, 1416, 1418,
+    1419, 1420, 1421, 1422, 1423, 1424, 2351, 3080, 3083, 3084, 3085, 3086,
+    926, 638, 639, 652, 654, 2274, 2641, 2565, 1082, 3133, 149, 2918,
+    2919, 2920, 1248, 1249, 397, 2485, 3199, 3200, 1177, 1178, 1179, 2978,
+    2982, 269, 765, 259, 175, 2156, 634, 2457, 2354, 2204, 2383, 2386,
+    1280, 3081, 3082, 810, 812, 813, 1168, 407, 1929, 1930, 1931, 1932,
+    429, 144, 2039, 2331, 2332, 1526, 2180, 2181, 7, 9, 1969, 2730,
+    2731, 262, 633, 1819, 3067, 1610, 1611, 317, 318, 319, 320, 2307,
+    3088, 3089, 3090, 3091, 2019, 1789, 2758, 2693, 2708, 5, 6, 1952,
+    1691, 2061, 2062, 2063, 423, 2415, 1380, 3035, 1010, 1024, 1142, 2711,
+    32, 75, 2707, 3075, 976, 878, 434, 1011, 1008, 1126, 2357, 1009,
+    3019, 2333, 991, 168, 169, 2435, 2436, 2437, 2438, 2439, 145, 147,
+    148, 2604, 2818, 2701, 39, 1927, 1229, 1230, 1231, 1232, 2838, 2839,
+    2954, 2299, 1776, 1778, 2511, 2512, 3229, 3230, 2986, 2987, 1508, 2563,
+    2459, 1124, 1125, 1022, 2342, 2040, 1925, 1379, 1381, 2927, 1943, 2442,
+    2443, 2644, 2645, 2854, 2855, 2856, 2857, 2858, 1079, 406, 1626, 1627,
+    1630, 1631, 68, 70, 1286, 613, 1281, 1282, 1283, 2691, 2702, 2704,
+    2705, 2706, 2677, 2696, 2697, 2710, 2742, 2743, 2745, 1777, 2955, 2183,
+    1194, 2821, 1180, 1181, 469, 470, 471, 472, 2783, 2784, 2164, 1335,
+    1336, 457, 896, 897, 3118, 436, 437, 3072, 3073, 3074, 1879, 298,
+    299, 2135, 1946, 972, 3161, 2694, 2308, 2577, 1700, 2114, 3087, 1632,
+    1636, 2719, 2720, 2178, 2179, 2885, 2890, 2891, 2889, 1145, 2965, 2162,
+    2608, 2606, 2607, 969, 2953, 2901, 1234, 2334, 902, 2032, 2033, 2035,
+    2313, 2314, 2316, 928, 342, 343, 346, 349, 351, 2279, 610, 1267,
+    1268, 3026, 3027, 1005, 1260, 1261, 1262, 1263, 1434, 1484, 1209, 1210,
+    997, 1425, 973, 2073, 3257, 1720, 1905, 1906, 1907, 1909, 1910, 1911,
+    2921, 250, 251, 1428, 2041, 3099, 3100, 3101, 1559, 1560, 1561, 1564,
+    1565, 1566, 1567, 1568, 1569, 8, 1123, 2251, 405, 1659, 1660, 1661,
+    1662, 1663, 2781, 112, 113, 116, 118, 119, 120, 121, 123, 528,
+    3048, 2360, 1874, 1872, 1989, 1990, 1991, 3042, 3043, 3044, 844, 1809,
+    1977, 1978, 1979, 1980, 951, 952, 953, 954, 955, 956, 957, 958,
+    959, 2976, 1292, 2393, 2959, 306, 2394, 2395, 2963, 131, 2905, 1732,
+    2016, 2149, 2344, 547, 3173, 3174, 1044, 1591, 1875, 1876, 275, 276,
+    995, 996, 598, 599, 600, 2160, 3025, 1059, 2464, 1109, 1110, 2906,
+    1798, 1045, 2646, 1796, 1797, 1332, 219, 1646, 315, 316, 1726, 2322,
+    2128, 1625, 2289, 2290, 636, 2105, 2106, 2107, 2372, 2369, 486, 2375,
+    2376, 2744, 256, 1593, 1358, 1276, 2956, 1162, 1163, 1164, 1165, 2837,
+    2960, 940, 2165, 2166, 2101, 617, 3031, 3032, 2410, 784, 1328, 1330,
+    1331, 1334, 2182, 3232, 2933, 2934, 2936, 3109, 1113, 1114, 907, 908,
+    913, 1067, 2686, 2703, 1203, 1204, 2868, 2371, 3108, 2303, 2193, 2194,
+    46, 47, 750, 751, 1869, 1870, 1871, 1319, 2199, 1040, 1699, 294,
+    295, 296, 297, 291, 292, 293, 301, 2124, 2171, 1503, 479, 484,
+    3077, 922, 2220, 288, 2084, 2085, 2086, 2087, 2088, 2089, 2530, 2531,
+    601, 602, 2602, 2603, 1217, 1218, 2066, 1397, 1398, 1399, 1400, 1135,
+    1136, 2850, 2851, 2852, 2374, 1860, 2271, 456, 2473, 3059, 1363, 2769,
+    1612, 1615, 1596, 88, 89, 90, 91, 92, 93, 94, 95, 1923,
+    1924, 308, 2067, 2069, 2789, 2790, 2207, 2699, 1717, 1701, 2468, 2469,
+    1692, 2592, 2633, 2993, 2994, 2995, 2998, 374, 375, 1970, 1971, 1036,
+    1037, 1038, 1039, 1828, 1827, 1811, 1814, 1815, 1817, 1525, 1866, 1704,
+    590, 3194, 800, 1851, 1850, 1856, 572, 3164, 3165, 1855, 1945, 2216,
+    2840, 3251, 1634, 1635, 1637, 2323, 2324, 2461, 2462, 2463, 2833, 2227,
+    1370, 1372, 1373, 1371, 2506, 2507, 2508, 631, 1273, 2339, 362, 45,
+    2831, 3020, 729, 2115, 857, 272, 164, 2121, 2122, 616, 615, 2355,
+    3244, 2647, 627, 1981, 1982, 1051, 1236, 1237, 1238, 1239, 1240, 1241,
+    1242, 1243, 3187, 3192, 668, 128, 1107, 1955, 2650, 212, 213, 2698,
+    2034, 2037, 2038, 2119, 2118, 2411, 2412, 622, 623, 625, 110, 2926,
+    1057, 66, 257, 730, 1275, 385, 386, 389, 1504, 1505, 1506, 2047,
+    2048, 512, 513, 514, 381, 220, 1520, 2817, 2346, 554, 2353, 3022,
+    666, 667, 1211, 1831, 1830, 828, 830, 1826, 1822, 1823, 1824, 1825,
+    1385, 57, 2255, 3045, 2736, 1934, 1992, 1993, 1994, 1995, 1996, 1997,
+    1998, 2815, 1376, 1916, 1101, 974, 398, 1065, 1221, 531, 532, 533,
+    1393, 865, 866, 867, 868, 869, 870, 1069, 2841, 2120, 777, 367,
+    3036, 3037, 2381, 2382, 2384, 2049, 2559, 2560, 1031, 258, 657, 2494,
+    3053, 3054, 3055, 2865, 2083, 2226, 2094, 357, 359, 1888, 2874, 2809,
+    2732, 2733, 2734, 2739, 732, 1495, 1496, 1494, 2408, 2409, 2529, 2218,
+    13, 15, 16, 17, 18, 19, 20, 23, 26, 27, 28, 29,
+    31, 24, 793, 1103, 3056, 3057, 2520, 1368, 321, 2729, 1015, 2458,
+    852, 11, 2804, 2805, 1773, 1829, 166, 2752, 1361, 1821, 2269, 2272,
+    1553, 2667, 2668, 3154, 3184, 2935, 2937, 2938, 422, 2669, 548, 2897,
+    2898, 1306, 1112, 1140, 1141, 401, 2726, 2785, 2786, 2787, 2788, 1510,
+    2133, 1223, 1438, 611, 53, 54, 329, 1337, 1338, 1787, 1020, 1021,
+    1115, 1859, 665, 2428, 2431, 1120, 1121, 1122, 2999, 3000, 2834, 1052,
+    3104, 150, 2337, 1750, 1751, 1752, 2497, 2836, 253, 3227, 3228, 1709,
+    1710, 1143, 1144, 1724, 1725, 2056, 2361, 2261, 2262, 2263, 331, 2822,
+    1854, 3106, 1272, 1685, 1687, 1688, 263, 264, 2231, 41, 42, 43,
+    44, 1146, 1147, 1148, 3182, 3186, 1528, 1529, 1530, 1531, 1532, 2740,
+    2741, 1938, 1853, 2500, 2103, 1323, 2480, 2217, 987, 988, 1533, 1534,
+    1350, 1351, 1339, 1340, 1345, 1346, 1347, 1694, 2317, 2318, 2319, 656,
+    2280, 2282, 2283, 2285, 2829, 3166, 1413, 1432, 1472, 1473, 1474, 2387,
+    875, 3195, 3196, 3197, 3198, 2377, 2378, 2680, 2681, 2682, 2683, 2684,
+    2685, 3125, 555, 303, 2870, 1848, 1570, 1571, 143, 1638, 260, 261,
+    2505, 433, 2518, 629, 1846, 2219, 1083, 815, 817, 818, 819, 820,
+    1912, 450, 451, 452, 2751, 2753, 2754, 2755, 1487, 2970, 1034, 2555,
+    3105, 1619, 1618, 603, 223, 224, 225, 226, 228, 230, 2539, 468,
+    2223, 126, 612, 2561, 797, 798, 141, 3137, 3138, 1542, 1543, 1544,
+    1545, 1546, 1547, 493, 167, 516, 2578, 2579, 2580, 2581, 2583, 2584,
+    2586, 1711, 1712, 772, 752, 754, 755, 756, 1090, 2003, 2000, 67,
+    978, 979, 980, 4, 1254, 1737, 1986, 1987, 302, 2018, 2363, 2675,
+    3012, 3013, 1046, 38, 2523, 2914, 404, 1913, 2198, 2129, 280, 281,
+    1620, 1941, 37, 304, 2009, 3146, 3147, 425, 426, 1309, 2234, 2379,
+    2380, 2385, 2116, 2451, 498, 2243, 3021, 1933, 2666, 2664, 1000, 1689,
+    2904, 1733, 2665, 1820, 2002, 2081, 2082, 1880, 1881, 541, 542, 543,
+    544, 1792, 789, 2014, 882, 883, 884, 885, 1134, 2778, 97, 98,
+    99, 101, 102, 960, 1519, 1278, 1279, 578, 3178, 10, 858, 1006,
+    1007, 2724, 1213, 2157, 3068, 2029, 2030, 575, 576, 577, 83, 85,
+    86, 1293, 1783, 274, 753, 3207, 1435, 1436, 3242, 61, 62, 63,
+    237, 1392, 924, 384, 1793, 2882, 2883, 1613, 1616, 2487, 2488, 2489,
+    2490, 2491, 2492, 2493, 1497, 1439, 1111, 170, 163, 3240, 0, 171,
+    1084, 1035, 1914, 1915, 920, 2391, 594, 571, 1159, 1160, 1161, 2689,
+    3006, 3007, 313, 314, 1427, 2750, 518, 546, 2102, 1189, 285, 287,
+    766, 767, 1715, 790, 791, 792, 1269, 1321, 125, 1013, 1014, 2880,
+    2902, 459, 1918, 1195, 2224, 1667, 2593, 2594, 2595, 2596, 889, 2651,
+    2881, 785, 2352, 1310, 1311, 1642, 1645, 2404, 1070, 2240, 2241, 2343,
+    824, 1536, 1537, 1538, 1539, 1540, 1541, 2390, 48, 49, 50, 51,
+    52, 2453, 461, 462, 463, 464, 466, 467, 2499, 1790, 2202, 2203,
+    2590, 1220, 2673, 2175, 2176, 1265, 1391, 1395, 2163, 2930, 2932, 3246,
+    2619, 2622, 1706, 2869, 3158, 2653, 2654, 2656, 1171, 430, 806, 807,
+    809, 1852, 241, 242, 1108, 1514, 370, 3145, 1033, 774, 775, 778,
+    779, 780, 2620, 2623, 2291, 831, 2540, 2541, 409, 2862, 1967, 3159,
+    2860, 2335, 501, 504, 1426, 2153, 1767, 2550, 2551, 2553, 761, 762,
+    763, 764, 888, 2534, 2535, 2205, 2206, 2273, 157, 2714, 2747, 2748,
+    2873, 658, 2536, 1166, 2247, 2519, 1861, 1862, 2325, 2326, 2327, 2328,
+    2329, 2330, 289, 290, 236, 2648, 1810, 1812, 1813, 1816, 1818, 2801,
+    2802, 2803, 1651, 1653, 1654, 1655, 2591, 984, 985, 986, 2348, 942,
+    943, 944, 945, 946, 947, 948, 949, 950, 140, 142, 2004, 1016,
+    1017, 3128, 310, 312, 1598, 1599, 1600, 2440, 2441, 1697, 2266, 2267,
+    1973, 2060, 3078, 2496, 1696, 1695, 1253, 3247, 3049, 3050, 1255, 1256,
+    1257, 1258, 2659, 1775, 1893, 1894, 1442, 1174, 421, 2610, 1759, 1760,
+    2159, 2125, 2126, 2127, 2147, 2148, 2293, 2294, 2295, 2296, 2297, 2298,
+    1192, 1193, 1196, 1197, 3152, 2302, 235, 1315, 2260, 1259, 1664, 1665,
+    1666, 2208, 2209, 1169, 424, 3103, 2416, 2417, 408, 931, 932, 933,
+    934, 935, 936, 2774, 2775, 2867, 2582, 2585, 2587, 1366, 664, 886,
+    887, 898, 899, 900, 1601, 1602, 1603, 1604, 156, 3188, 2866, 2474,
+    2475, 2476, 3003, 2951, 2031, 485, 3034, 233, 1277, 1609, 1594, 1595,
+    1048, 744, 745, 3107, 3112, 746, 383, 998, 999, 609, 1928, 2256,
+    1483, 2245, 2123, 619, 2861, 1324, 1378, 1026, 2150, 2151, 1947, 2842,
+    2843, 2237, 2922, 2481, 2482, 592, 2042, 3117, 172, 173, 1719, 2525,
+    1304, 1305, 2309, 2310, 2924, 2925, 551, 552, 3038, 3039, 3040, 1845,
+    402, 1791, 2521, 2522, 2625, 2627, 2629, 2630, 1151, 1365, 3179, 3180,
+    3181, 3183, 1433, 1475, 1476, 1477, 1478, 1479, 1480, 1481, 1482, 1640,
+    1641, 1643, 1644, 853, 3016, 3017, 3018, 3176, 165, 640, 641, 642,
+    643, 644, 645, 646, 647, 648, 649, 653, 731, 1042, 1043, 300,
+    2092, 360, 395, 396, 1527, 659, 660, 2392, 1205, 1206, 55, 56,
+    2713, 2715, 2716, 2717, 2718, 1582, 3061, 354, 355, 2846, 2847, 596,
+    238, 239, 240, 923, 1303, 2252, 2253, 361, 2222, 773, 474, 79,
+    81, 82, 2054, 2057, 2058, 635, 2472, 2152, 496, 332, 333, 334,
+    335, 336, 3041, 246, 1962, 1963, 1964, 2662, 2, 2782, 139, 1832,
+    1833, 1834, 1835, 1836, 1837, 1838, 1839, 1840, 1841, 1842, 1847, 438,
+    1785, 339, 340, 341, 604, 909, 911, 912, 2248, 2249, 2250, 2692,
+    2158, 2161, 1801, 1804, 1805, 1137, 1138, 1139, 186, 198, 201, 2513,
+    2514, 2515, 2516, 2517, 801, 3102, 243, 2090, 2091, 3110, 3111, 1089,
+    1094, 1096, 1097, 1098, 1099, 1106, 1092, 1085, 1091, 1093, 2964, 1182,
+    458, 460, 2983, 1623, 2725, 3060, 1940, 3243, 2598, 2599, 344, 345,
+    347, 348, 350, 352, 2134, 1185, 1585, 1586, 1727, 614, 3028, 3029,
+    3030, 1587, 1702, 1878, 834, 325, 327, 328, 209, 211, 129, 1270,
+    1271, 1274, 579, 582, 584, 371, 2174, 2832, 1100, 1317, 2910, 2911,
+    2916, 2806, 847, 848, 849, 134, 135, 138, 2197, 1316, 1592, 580,
+    581, 583, 2974, 2975, 1224, 1225, 1226, 1227, 1228, 390, 392, 393,
+    204, 205, 206, 1722, 1723, 1509, 1956, 1957, 1958, 2455, 3172, 3190,
+    3191, 1374, 655, 1215, 3139, 3140, 3141, 1652, 431, 432, 1589, 1590,
+    2130, 2131, 1738, 1739, 1741, 153, 154, 2564, 2566, 861, 862, 1921,
+    1922, 3193, 1207, 1208, 2021, 2079, 2358, 2929, 2931, 1055, 1056, 1054,
+    104, 105, 2052, 1149, 1150, 1597, 208, 1411, 415, 1937, 1384, 1172,
+    1173, 161, 364, 2642, 2064, 1633, 2013, 326, 3113, 3114, 3115, 3116,
+    1105, 2864, 2908, 2913, 2915, 1250, 1251, 1252, 1188, 1001, 1002, 1003,
+    1795, 593, 2359, 2808, 1404, 1405, 1406, 1407, 1408, 1409, 1410, 650,
+    2172, 2460, 160, 2154, 545, 2738, 1030, 2977, 2979, 2356, 1333, 2637,
+    1581, 1926, 1954, 1774, 1441, 1919, 2413, 2414, 2544, 2173, 3252, 3253,
+    3254, 3256, 742, 743, 2820, 1429, 1430, 1431, 1440, 1443, 1444, 1445,
+    1446, 1448, 1449, 1450, 1451, 1452, 1453, 1454, 1455, 1456, 1457, 1458,
+    1459, 1460, 1461, 1462, 1463, 1464, 1465, 1466, 1467, 1468, 1469, 1470,
+    1471, 910, 2433, 975, 2768, 2015, 2017, 2020, 2943, 2944, 2945, 2946,
+    1693, 3129, 3130, 487, 2104, 2407, 265, 266, 267, 1190, 2099, 1012,
+    2188, 3255, 871, 1437, 2756, 1394, 781, 2483, 2484, 2825, 2826, 2236,
+    1988, 2859, 435, 1493, 534, 535, 536, 538, 2398, 2366, 1212, 1985,
+    2961, 64, 3095, 3096, 3097, 3098, 2601, 1734, 1735, 1736, 382, 114,
+    115, 122, 124, 2952, 845, 1088, 1844, 448, 439, 440, 441, 442,
+    443, 133, 637, 1920, 2345, 2258, 1485, 2674, 1216, 1403, 3121, 3124,
+    2259, 2672, 2095, 2096, 1388, 277, 278, 279, 1521, 1522, 1523, 2288,
+    2877, 1062, 1863, 1864, 1865, 605, 606, 322, 323, 324, 937, 739,
+    741, 2984, 1402, 373, 2589, 1524, 1326, 1004, 2200, 1507, 2486, 1401,
+    3062, 3063, 3064, 3065, 3066, 519, 520, 521, 522, 1386, 1387, 939,
+    2772, 1447, 1352, 1354, 549, 1800, 2132, 863, 1843, 3143, 3144, 523,
+    524, 525, 526, 527, 2045, 2046, 1728, 400, 2617, 488, 489, 2138,
+    1187, 2503, 2504, 799, 1516, 2167, 2168, 2548, 2549, 2554, 2257, 178,
+    179, 108, 1884, 1886, 1867, 1868, 1369, 2501, 2336, 1873, 2660, 630,
+    632, 2640, 872, 873, 874, 100, 880, 881, 1104, 2502, 2912, 418,
+    2634, 2635, 2636, 2876, 2053, 2184, 2185, 2187, 964, 1951, 2709, 2304,
+    229, 1396, 811, 562, 563, 564, 565, 566, 567, 568, 569, 1807,
+    1808, 2950, 2569, 2570, 2571, 2572, 2573, 2574,
+};
+
+static const uint16_t romdb_crc_buckets[257] = {
+    0, 71, 76, 86, 99, 113, 128, 137, 150, 162, 182, 191,
+    205, 219, 231, 241, 252, 256, 270, 275, 292, 303, 311, 326,
+    330, 336, 346, 358, 372, 384, 390, 403, 416, 453, 471, 482,
+    489, 494, 509, 523, 533, 551, 560, 577, 590, 597, 605, 620,
+    647, 660, 669, 677, 685, 698, 717, 730, 738, 747, 758, 771,
+    778, 796, 805, 828, 850, 855, 886, 896, 905, 922, 929, 941,
+    946, 956, 966, 971, 980, 988, 1009, 1036, 1050, 1053, 1062, 1074,
+    1099, 1109, 1120, 1125, 1140, 1150, 1159, 1171, 1184, 1194, 1202, 1217,
+    1230, 1242, 1251, 1264, 1286, 1303, 1318, 1338, 1353, 1360, 1373, 1384,
+    1406, 1418, 1441, 1443, 1450, 1460, 1472, 1479, 1490, 1498, 1512, 1527,
+    1542, 1544, 1546, 1555, 1558, 1567, 1573, 1588, 1604, 1619, 1629, 1643,
+    1666, 1687, 1696, 1706, 1718, 1731, 1741, 1757, 1766, 1781, 1792, 1809,
+    1821, 1830, 1848, 1863, 1878, 1889, 1901, 1912, 1920, 1930, 1934, 1950,
+    1956, 1983, 1988, 2000, 2023, 2032, 2044, 2060, 2065, 2076, 2079, 2092,
+    2101, 2112, 2122, 2133, 2140, 2156, 2164, 2188, 2206, 2223, 2237, 2246,
+    2260, 2263, 2266, 2286, 2301, 2311, 2326, 2330, 2340, 2356, 2370, 2377,
+    2390, 2397, 2404, 2417, 2444, 2449, 2463, 2468, 2482, 2501, 2509, 2517,
+    2531, 2546, 2557, 2565, 2573, 2582, 2590, 2604, 2618, 2636, 2657, 2669,
+    2685, 2709, 2723, 2737, 2752, 2774, 2789, 2797, 2814, 2822, 2831, 2841,
+    2858, 2875, 2879, 2898, 2905, 2930, 2941, 2952, 2961, 3005, 3022, 3029,
+    3038, 3048, 3058, 3067, 3080, 3097, 3110, 3115, 3125, 3134, 3143, 3152,
+    3161, 3175, 3190, 3205, 3224,
+};
+
+#endif
@@ -28,6 +28,7 @@
 #include "plugin/plugin.h"
 #include "device/rcp/ri/ri_controller.h"
 #include "device/rcp/vi/vi_controller.h"
+#include <mupen64plus-next_common.h>
 
 #include <stdio.h>
 #include <stddef.h>
@@ -141,6 +142,10 @@ static void aiLenChanged(void* user_data, const void* buffer, size_t size)
       p[i + 1] ^= p[i + 3];
    }
 
+   /* the frontend or run-ahead discards this frame's audio */
+   if (retro_speculative_frame & RETRO_SPECULATIVE_AUDIO)
+      return;
+
 audio_batch:
    out               = NULL;
    ratio             = 44100.0 / GameFreq;
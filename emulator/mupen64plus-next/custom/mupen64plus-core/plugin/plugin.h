@@ -78,6 +78,7 @@ typedef struct _gfx_plugin_functions
 	ptr_FBRead          fBRead;
 	ptr_FBWrite         fBWrite;
 	ptr_FBGetFrameBufferInfo fBGetFrameBufferInfo;
+	ptr_FBWriteRange    fBWriteRange;
 } gfx_plugin_functions;
 
 extern gfx_plugin_functions gfx;
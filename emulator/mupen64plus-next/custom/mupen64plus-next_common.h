@@ -55,6 +55,9 @@ void plugin_connect_rsp_api(enum rsp_plugin_type type);
 void plugin_connect_rdp_api(enum rdp_plugin_type type);
 void plugin_connect_all();
 
+// RDRAM written by a plugin outside of the core's DMA paths
+void plugin_notify_dram_write(uint32_t address, uint32_t length);
+
 uint32_t get_retro_screen_width();
 uint32_t get_retro_screen_height();
 
@@ -71,6 +74,14 @@ extern struct xoshiro256pp_state l_mpk_idgen;
 extern bool retro_savestate_complete;
 extern int  retro_savestate_result;
 
+// Run-ahead globals
+enum retro_speculative_flags
+{
+    RETRO_SPECULATIVE_VIDEO = 1, // the frame will not be presented
+    RETRO_SPECULATIVE_AUDIO = 2  // the frame's audio will be discarded
+};
+extern int  retro_speculative_frame;
+
 // 64DD globals
 extern char* retro_dd_path_img;
 extern char* retro_dd_path_rom;
@@ -120,6 +131,14 @@ extern uint32_t EnableLODEmulation;
 extern uint32_t EnableFullspeed;
 extern uint32_t CountPerOp;
 extern uint32_t CountPerOpDenomPot;
+extern uint32_t CachedInterpSuperblocks;
+extern uint32_t NetplayRollbackFrames;
+extern uint32_t NetplayInputRedundancy;
+extern uint32_t NetplayDesyncCheck;
+extern uint32_t RewindBufferSize;
+extern int RewindButton;
+extern uint32_t RunAheadFrames;
+extern uint32_t EnableProfiler;
 extern uint32_t CountPerScanlineOverride;
 extern uint32_t BackgroundMode;
 extern uint32_t EnableEnhancedTextureStorage;
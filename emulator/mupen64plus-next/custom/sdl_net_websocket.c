@@ -18,6 +18,10 @@
  *  - js_ws_receive(id, buf_ptr, buf_len) -> bytes_received, 0 none, -2 closed, -1 error
  *  - js_ws_close(id)
  *  - js_ws_last_error(id) -> ptr to malloc'd UTF8 string on WASM heap (caller must not free)
+ *
+ * Incoming messages are written to the WASM heap once, when they arrive; the
+ * inbox only holds { ptr, len, off } records for them and reads copy inside
+ * the heap.
  */
 
 EM_JS(int, js_ws_open, (const char* url_ptr), {
@@ -37,9 +41,12 @@ EM_JS(int, js_ws_open, (const char* url_ptr), {
     Module._wsErrors[id] = null;
     ws.onmessage = function(ev) {
       try {
-        if (ev && ev.data) {
+        if (ev && ev.data && ev.data.byteLength) {
           var arr = new Uint8Array(ev.data);
-          Module._wsInbox[id].push(arr);
+          var ptr = _malloc(arr.length);
+          if (!ptr) throw "out of memory";
+          HEAPU8.set(arr, ptr);
+          Module._wsInbox[id].push({ ptr: ptr, len: arr.length, off: 0 });
         }
       } catch(e) {
         Module._wsErrors[id] = String(e);
@@ -84,14 +91,12 @@ EM_JS(int, js_ws_receive, (int id, unsigned char* buf_ptr, int buf_len), {
       if (totalCopied === 0) return -2;
       return totalCopied;
     }
-    var toCopy = Math.min(buf_len - totalCopied, chunk.length);
-    for (var i = 0; i < toCopy; i++) {
-      HEAPU8[buf_ptr + totalCopied + i] = chunk[i];
-    }
-    if (toCopy < chunk.length) {
-      Module._wsInbox[id][0] = chunk.subarray(toCopy);
-    } else {
+    var toCopy = Math.min(buf_len - totalCopied, chunk.len - chunk.off);
+    HEAPU8.copyWithin(buf_ptr + totalCopied, chunk.ptr + chunk.off, chunk.ptr + chunk.off + toCopy);
+    chunk.off += toCopy;
+    if (chunk.off === chunk.len) {
       queue.shift();
+      _free(chunk.ptr);
     }
     totalCopied += toCopy;
   }
@@ -101,6 +106,7 @@ EM_JS(int, js_ws_receive, (int id, unsigned char* buf_ptr, int buf_len), {
 EM_JS(void, js_ws_close, (int id), {
   if (Module._wsSockets && Module._wsSockets[id]) {
     try { Module._wsSockets[id].close(); } catch(e) {}
+    Module._wsInbox[id].forEach(function(chunk) { if (chunk !== null) _free(chunk.ptr); });
     delete Module._wsSockets[id];
     delete Module._wsInbox[id];
     delete Module._wsErrors[id];
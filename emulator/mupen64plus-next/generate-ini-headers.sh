@@ -16,6 +16,9 @@ MUPEN_CORE_FOOTER=";
 "
 cat <<< ${MUPEN_CORE_HEADER}${MUPEN_CORE_CONTENTS}${MUPEN_CORE_FOOTER} > custom/mupen64plus-core/main/mupen64plus.ini.h
 
+# Generate mupen64plus.romdb.h, the same database compiled into lookup tables
+python3 ./generate-romdb-header.py
+
 # Generate GLideN64.custom.ini.h 
 GLIDEN64_HEADER="#ifndef __CUSTOM_INI__
 #define __CUSTOM_INI__
@@ -0,0 +1,335 @@
+#!/usr/bin/env python3
+#
+# Compiles mupen64plus-core/data/mupen64plus.ini into static lookup tables,
+# so that the libretro core does not have to parse the ini at startup.
+#
+# The entries are resolved exactly like romdatabase_open/romdatabase_resolve
+# would do it at runtime, then written as romdatabase_entry initializers,
+# followed by MD5 and CRC indices sorted and bucketed by their first byte.
+
+import os
+import re
+import sys
+
+INI_PATH = "mupen64plus-core/data/mupen64plus.ini"
+HEADER_PATH = "custom/mupen64plus-core/main/mupen64plus.romdb.h"
+
+# fgets(buffer, 255, ...) in romdatabase_open
+LINE_MAX = 254
+
+DEFAULT_COUNT_PER_OP = 2
+DEFAULT_DISABLE_EXTRA_MEM = 0
+DEFAULT_SI_DMA_DURATION = 0x900
+DEFAULT_AI_DMA_MODIFIER = 100
+
+SAVETYPES = {
+    "Eeprom 4KB": "SAVETYPE_EEPROM_4K",
+    "Eeprom 16KB": "SAVETYPE_EEPROM_16K",
+    "SRAM": "SAVETYPE_SRAM",
+    "Flash RAM": "SAVETYPE_FLASH_RAM",
+    "Controller Pack": "SAVETYPE_CONTROLLER_PAK",
+    "None": "SAVETYPE_NONE",
+}
+
+FLAGS = {
+    "goodname": 1 << 0,
+    "crc": 1 << 1,
+    "status": 1 << 2,
+    "savetype": 1 << 3,
+    "players": 1 << 4,
+    "rumble": 1 << 5,
+    "countperop": 1 << 6,
+    "cheats": 1 << 7,
+    "disableextramem": 1 << 8,
+    "transferpak": 1 << 9,
+    "mempak": 1 << 10,
+    "biopak": 1 << 11,
+    "sidmaduration": 1 << 12,
+    "aidmamodifier": 1 << 13,
+}
+
+# fields inherited through RefMD5, in romdatabase_resolve_round order
+INHERITED = [
+    ("goodname", ["goodname"]),
+    ("crc", ["crc1", "crc2"]),
+    ("status", ["status"]),
+    ("savetype", ["savetype"]),
+    ("players", ["players"]),
+    ("rumble", ["rumble"]),
+    ("countperop", ["countperop"]),
+    ("cheats", ["cheats"]),
+    ("disableextramem", ["disableextramem"]),
+    ("transferpak", ["transferpak"]),
+    ("mempak", ["mempak"]),
+    ("biopak", ["biopak"]),
+    ("sidmaduration", ["sidmaduration"]),
+    ("aidmamodifier", ["aidmamodifier"]),
+]
+
+C_SPACE = " \t\n\v\f\r"
+
+
+def parse_hex(s, size):
+    if not re.fullmatch(r"[0-9A-Fa-f]{%d}" % (2 * size), s):
+        return None
+    return bytes.fromhex(s)
+
+
+def string_to_int(s):
+    if not re.fullmatch(r"[+-]?[0-9]+", s):
+        return None
+    return int(s)
+
+
+def atoi(s):
+    m = re.match(r"[" + C_SPACE + r"]*([+-]?[0-9]+)", s)
+    return int(m.group(1)) if m else 0
+
+
+def parse_crc(s):
+    m = re.fullmatch(r"[" + C_SPACE + r"]*(?:0[xX])?([0-9A-Fa-f]+)[" + C_SPACE + r"]*(?:0[xX])?([0-9A-Fa-f]+)", s)
+    if not m:
+        return None
+    return (int(m.group(1), 16) & 0xffffffff, int(m.group(2), 16) & 0xffffffff)
+
+
+def read_lines(data):
+    pos = 0
+    while pos < len(data):
+        end = data.find(b"\n", pos, pos + LINE_MAX)
+        end = pos + LINE_MAX if end < 0 else end + 1
+        yield data[pos:end].decode("latin-1")
+        pos = end
+
+
+def new_entry(md5):
+    return {
+        "goodname": None,
+        "md5": md5,
+        "refmd5": None,
+        "cheats": None,
+        "crc1": 0,
+        "crc2": 0,
+        "status": 0,
+        "savetype": "SAVETYPE_EEPROM_4K",
+        "players": 4,
+        "rumble": 1,
+        "countperop": DEFAULT_COUNT_PER_OP,
+        "disableextramem": DEFAULT_DISABLE_EXTRA_MEM,
+        "transferpak": 0,
+        "mempak": 1,
+        "biopak": 0,
+        "sidmaduration": DEFAULT_SI_DMA_DURATION,
+        "aidmamodifier": DEFAULT_AI_DMA_MODIFIER,
+        "set_flags": 0,
+        "crc_indexed": False,
+    }
+
+
+def yes_no(entry, flag, value):
+    if value == "Yes":
+        entry[flag] = 1
+    elif value == "No":
+        entry[flag] = 0
+    else:
+        return
+    entry["set_flags"] |= FLAGS[flag]
+
+
+def bounded_int(entry, flag, value, lo, hi, lo_strict=False):
+    v = string_to_int(value)
+    if v is None or v > hi or v < lo or (lo_strict and v == lo):
+        return
+    entry[flag] = v
+    entry["set_flags"] |= FLAGS[flag]
+
+
+def parse_ini(data):
+    entries = []
+    entry = None
+
+    for raw in read_lines(data):
+        line = raw.split("\n", 1)[0].strip(C_SPACE)
+
+        if line[:1] in ("#", ";"):
+            continue
+        if line[:1] == "[" and line[-1:] == "]":
+            md5 = parse_hex(line[1:-1].strip(C_SPACE), 16)
+            if md5 is None:
+                entry = None
+                continue
+            entry = new_entry(md5)
+            entries.append(entry)
+            continue
+        if "=" not in line:
+            continue
+
+        name, value = line.split("=", 1)
+        name = name.strip(C_SPACE)
+        value = value.strip(C_SPACE)
+        if entry is None:
+            continue
+
+        if name == "GoodName":
+            entry["goodname"] = value
+            entry["set_flags"] |= FLAGS["goodname"]
+        elif name == "CRC":
+            crc = parse_crc(value)
+            if crc is not None:
+                if entry["crc_indexed"]:
+                    sys.exit("%s: duplicate CRC for %s" % (INI_PATH, entry["md5"].hex().upper()))
+                entry["crc1"], entry["crc2"] = crc
+                entry["crc_indexed"] = True
+                entry["set_flags"] |= FLAGS["crc"]
+            else:
+                entry["crc1"] = entry["crc2"] = 0
+        elif name == "RefMD5":
+            md5 = parse_hex(value, 16)
+            if md5 is not None:
+                entry["refmd5"] = md5
+        elif name == "SaveType":
+            if value in SAVETYPES:
+                entry["savetype"] = SAVETYPES[value]
+                entry["set_flags"] |= FLAGS["savetype"]
+        elif name == "Status":
+            bounded_int(entry, "status", value, 0, 5)
+        elif name == "Players":
+            bounded_int(entry, "players", value, 0, 7)
+        elif name == "Rumble":
+            yes_no(entry, "rumble", value)
+        elif name == "CountPerOp":
+            bounded_int(entry, "countperop", value, 0, 4, lo_strict=True)
+        elif name == "DisableExtraMem":
+            entry["disableextramem"] = atoi(value) & 0xff
+            entry["set_flags"] |= FLAGS["disableextramem"]
+        elif name.startswith("Cheat"):
+            if value:
+                entry["cheats"] = value if not entry["cheats"] else entry["cheats"] + ";" + value
+            entry["set_flags"] |= FLAGS["cheats"]
+        elif name == "Transferpak":
+            yes_no(entry, "transferpak", value)
+        elif name == "Mempak":
+            yes_no(entry, "mempak", value)
+        elif name == "Biopak":
+            yes_no(entry, "biopak", value)
+        elif name == "SiDmaDuration":
+            bounded_int(entry, "sidmaduration", value, 0, 0x10000)
+        elif name == "AiDmaModifier":
+            bounded_int(entry, "aidmamodifier", value, 0, 200)
+
+    return entries
+
+
+def resolve(entries, by_md5):
+    last_skipped = None
+    while True:
+        skipped = 0
+        for entry in entries:
+            if entry["refmd5"] is None:
+                continue
+            ref = by_md5.get(entry["refmd5"])
+            if ref is None:
+                continue
+            if ref["refmd5"] is not None:
+                skipped += 1
+                continue
+            for flag, fields in INHERITED:
+                if not entry["set_flags"] & FLAGS[flag] and ref["set_flags"] & FLAGS[flag]:
+                    for field in fields:
+                        entry[field] = ref[field]
+                    entry["set_flags"] |= FLAGS[flag]
+            entry["refmd5"] = None
+        if skipped == last_skipped or skipped == 0:
+            return
+        last_skipped = skipped
+
+
+def c_string(s):
+    if s is None:
+        return "NULL"
+    out = []
+    for ch in s:
+        c = ord(ch)
+        if ch in "\\\"":
+            out.append("\\" + ch)
+        elif 0x20 <= c < 0x7f and ch != "?":
+            out.append(ch)
+        else:
+            out.append("\\%03o" % c)
+    return "\"" + "".join(out) + "\""
+
+
+def buckets(keys):
+    offsets = []
+    i = 0
+    for b in range(256):
+        offsets.append(i)
+        while i < len(keys) and keys[i] == b:
+            i += 1
+    offsets.append(len(keys))
+    return offsets
+
+
+def write_u16_table(out, name, values):
+    out.append("static const uint16_t %s[%d] = {" % (name, len(values)))
+    for i in range(0, len(values), 12):
+        out.append("    " + ", ".join("%d" % v for v in values[i:i + 12]) + ",")
+    out.append("};")
+    out.append("")
+
+
+def main():
+    os.chdir(os.path.dirname(os.path.abspath(__file__)))
+
+    with open(INI_PATH, "rb") as f:
+        entries = parse_ini(f.read())
+
+    if len(entries) >= 0x10000:
+        sys.exit("%s: too many entries for 16-bit indices" % INI_PATH)
+
+    # MD5 lookups find the last section with that MD5
+    by_md5 = {}
+    last_index = {}
+    for i, entry in enumerate(entries):
+        by_md5[entry["md5"]] = entry
+        last_index[entry["md5"]] = i
+
+    resolve(entries, by_md5)
+
+    md5_index = sorted(last_index.values(), key=lambda i: entries[i]["md5"])
+    crc_index = sorted((i for i, e in enumerate(entries) if e["crc_indexed"]),
+                       key=lambda i: (entries[i]["crc1"], entries[i]["crc2"], i))
+
+    out = []
+    out.append("/* Generated by generate-romdb-header.py from %s, do not edit. */" % INI_PATH)
+    out.append("")
+    out.append("#ifndef __ROMDB_H__")
+    out.append("#define __ROMDB_H__")
+    out.append("")
+    out.append("static const romdatabase_entry romdb_entries[%d] = {" % len(entries))
+    for e in entries:
+        out.append("    { %s, { %s }, NULL, %s, 0x%08X, 0x%08X, %d, %s, %d, %d, %d, %d, %d, %d, %d, 0x%X, %d, 0x%X }," % (
+            c_string(e["goodname"]),
+            ", ".join("0x%02X" % b for b in e["md5"]),
+            c_string(e["cheats"]),
+            e["crc1"], e["crc2"],
+            e["status"], e["savetype"], e["players"], e["rumble"],
+            e["countperop"], e["disableextramem"],
+            e["transferpak"], e["mempak"], e["biopak"],
+            e["sidmaduration"], e["aidmamodifier"], e["set_flags"]))
+    out.append("};")
+    out.append("")
+    out.append("/* romdb_entries indices sorted by MD5, and the start of each first byte */")
+    write_u16_table(out, "romdb_md5_index", md5_index)
+    write_u16_table(out, "romdb_md5_buckets", buckets([entries[i]["md5"][0] for i in md5_index]))
+    out.append("/* romdb_entries indices sorted by CRC, and the start of each first CRC1 byte */")
+    write_u16_table(out, "romdb_crc_index", crc_index)
+    write_u16_table(out, "romdb_crc_buckets", buckets([entries[i]["crc1"] >> 24 for i in crc_index]))
+    out.append("#endif")
+
+    with open(HEADER_PATH, "w", newline="\n") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
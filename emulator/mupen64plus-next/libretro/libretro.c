@@ -81,6 +81,7 @@ void angrylion_set_overscan(unsigned value);
 void angrylion_set_synclevel(unsigned value);
 void angrylion_set_vi_dedither(unsigned value);
 void angrylion_set_vi(unsigned value);
+void angrylion_set_vi_async(unsigned value);
 
 struct rgba
 {
@@ -153,6 +154,7 @@ static char rdp_plugin_last[32] = {0};
 // Savestate globals
 bool retro_savestate_complete = false;
 int  retro_savestate_result = 0;
+int  retro_speculative_frame = 0;
 
 // 64DD globals
 char* retro_dd_path_img = NULL;
@@ -216,6 +218,14 @@ uint32_t OverscanBottom = 0;
 uint32_t EnableFullspeed = 0;
 uint32_t CountPerOp = 0;
 uint32_t CountPerOpDenomPot = 0;
+uint32_t CachedInterpSuperblocks = 1;
+uint32_t NetplayRollbackFrames = 0;
+uint32_t NetplayInputRedundancy = 0;
+uint32_t NetplayDesyncCheck = 0;
+uint32_t RewindBufferSize = 0;
+int RewindButton = -1;
+uint32_t RunAheadFrames = 0;
+uint32_t EnableProfiler = 0;
 uint32_t CountPerScanlineOverride = 0;
 uint32_t ForceDisableExtraMem = 0;
 uint32_t IgnoreTLBExceptions = 0;
@@ -1400,6 +1410,13 @@ static void update_variables(bool startup)
              r4300_emumode = EMUMODE_DYNAREC;
        }
 
+       var.key = CORE_NAME "-CachedInterpSuperblocks";
+       var.value = NULL;
+       if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+       {
+          CachedInterpSuperblocks = !strcmp(var.value, "False") ? 0 : 1;
+       }
+
        var.key = CORE_NAME "-aspect";
        var.value = NULL;
        if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
@@ -1472,6 +1489,60 @@ static void update_variables(bool startup)
           CountPerOpDenomPot = atoi(var.value);
        }
 
+       var.key = CORE_NAME "-NetplayRollbackFrames";
+       var.value = NULL;
+       if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+       {
+          NetplayRollbackFrames = atoi(var.value);
+       }
+
+       var.key = CORE_NAME "-NetplayInputRedundancy";
+       var.value = NULL;
+       if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+       {
+          NetplayInputRedundancy = atoi(var.value);
+       }
+
+       var.key = CORE_NAME "-NetplayDesyncCheck";
+       var.value = NULL;
+       if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+       {
+          NetplayDesyncCheck = atoi(var.value);
+       }
+
+       var.key = CORE_NAME "-rewind-buffer";
+       var.value = NULL;
+       if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+       {
+          RewindBufferSize = !strcmp(var.value, "Off") ? 0 : atoi(var.value);
+       }
+
+       var.key = CORE_NAME "-rewind-button";
+       var.value = NULL;
+       if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+       {
+          if (!strcmp(var.value, "L3"))
+             RewindButton = RETRO_DEVICE_ID_JOYPAD_L3;
+          else if (!strcmp(var.value, "R3"))
+             RewindButton = RETRO_DEVICE_ID_JOYPAD_R3;
+          else
+             RewindButton = -1;
+       }
+
+       var.key = CORE_NAME "-run-ahead";
+       var.value = NULL;
+       if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+       {
+          RunAheadFrames = !strcmp(var.value, "disabled") ? 0 : atoi(var.value);
+       }
+
+       var.key = CORE_NAME "-profiler";
+       var.value = NULL;
+       if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+       {
+          EnableProfiler = !strcmp(var.value, "True") ? 1 : 0;
+       }
+
        if(EnableFullspeed)
        {
           CountPerOp = 1; // Force CountPerOp == 1
@@ -1767,6 +1838,14 @@ static void update_variables(bool startup)
         {
            angrylion_set_overscan(0);
         }
+
+        var.key = CORE_NAME "-angrylion-vi-async";
+        var.value = NULL;
+
+        if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+           angrylion_set_vi_async(!strcmp(var.value, "enabled"));
+        else
+           angrylion_set_vi_async(0);
     }
 #endif // HAVE_THR_AL
 
@@ -2035,10 +2114,21 @@ void retro_run (void)
 {
     libretro_swap_buffer = false;
     static bool updated = false;
+    int av_enable = 3;
 
     if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated)
        update_variables(false);
 
+    // Frontend run-ahead disables audio and/or video on the frames it throws away,
+    // native run-ahead sets the flags itself
+    if (!RunAheadFrames)
+    {
+       if (!environ_cb(RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE, &av_enable))
+          av_enable = 3;
+       retro_speculative_frame = ((av_enable & 1) ? 0 : RETRO_SPECULATIVE_VIDEO)
+                               | ((av_enable & 2) ? 0 : RETRO_SPECULATIVE_AUDIO);
+    }
+
     if(current_rdp_type == RDP_PLUGIN_GLIDEN64)
     {
        if(EnableThreadedRenderer)
@@ -1371,6 +1371,20 @@ struct retro_core_option_v2_definition option_defs_us[] = {
         },
         "disabled"
     },
+    {
+        CORE_NAME "-angrylion-vi-async",
+        "Async VI filtering",
+        NULL,
+        "(AL) Run the VI Overlay filters on separate threads while emulation continues. Frames are shown one frame late.",
+        "Run the VI Overlay filters on separate threads while emulation continues. Frames are shown one frame late.",
+        "angrylion",
+        {
+            {"disabled", NULL},
+            {"enabled", NULL},
+            { NULL, NULL },
+        },
+        "disabled"
+    },
 #endif
     {
         CORE_NAME "-cpucore",
@@ -1393,6 +1407,20 @@ struct retro_core_option_v2_definition option_defs_us[] = {
         "cached_interpreter"
 #endif
     },
+    {
+        CORE_NAME "-CachedInterpSuperblocks",
+        "Cached Interpreter Superblocks",
+        NULL,
+        "Run straight-line code between branches without going back to the dispatch loop after every instruction. Only used by the Cached Interpreter.",
+        NULL,
+        NULL,
+        {
+            {"False", NULL},
+            {"True", NULL},
+            { NULL, NULL },
+        },
+        "True"
+    },
     {
         CORE_NAME "-rsp-plugin",
         "RSP Plugin",
@@ -1530,6 +1558,131 @@ struct retro_core_option_v2_definition option_defs_us[] = {
         },
         "0"
     },
+    {
+        CORE_NAME "-NetplayRollbackFrames",
+        "Netplay Rollback Frames",
+        NULL,
+        "Predict remote input for up to this many frames and rewind when the prediction was wrong, instead of waiting for the input to arrive. 0 keeps the delay-based netplay. Each frame keeps a full savestate in memory.",
+        NULL,
+        NULL,
+        {
+            {"0", NULL},
+            {"1", NULL},
+            {"2", NULL},
+            {"3", NULL},
+            {"4", NULL},
+            {"5", NULL},
+            {"6", NULL},
+            {"7", NULL},
+            {"8", NULL},
+            { NULL, NULL },
+        },
+        "0"
+    },
+    {
+        CORE_NAME "-NetplayInputRedundancy",
+        "Netplay Input Batching",
+        NULL,
+        "Send the input of all local controllers in one binary message per frame, repeating the input of this many recent frames so a lost message does not stall, and request remote input with one message. 0 keeps one message per controller per frame. The server must support the batched messages.",
+        NULL,
+        NULL,
+        {
+            {"0", NULL},
+            {"1", NULL},
+            {"2", NULL},
+            {"3", NULL},
+            {"4", NULL},
+            {"5", NULL},
+            {"6", NULL},
+            {"7", NULL},
+            {"8", NULL},
+            { NULL, NULL },
+        },
+        "0"
+    },
+    {
+        CORE_NAME "-NetplayDesyncCheck",
+        "Netplay Desync Detection",
+        NULL,
+        "Hash RDRAM, RSP memory, the interrupt queue and PIF RAM every this many frames and compare the digests with the other players, logging the first memory range that differs. Only the pages written since the last digest are hashed when possible. The server must relay the digests.",
+        NULL,
+        NULL,
+        {
+            {"0", "disabled"},
+            {"1", NULL},
+            {"2", NULL},
+            {"4", NULL},
+            {"15", NULL},
+            {"60", NULL},
+            { NULL, NULL },
+        },
+        "0"
+    },
+    {
+        CORE_NAME "-rewind-buffer",
+        "Rewind Buffer Size",
+        NULL,
+        "Memory used to keep compressed savestates of recent frames for rewinding, in MB. Two uncompressed savestates are kept on top of this.",
+        NULL,
+        NULL,
+        {
+            {"Off", NULL},
+            {"16", "16 MB"},
+            {"32", "32 MB"},
+            {"64", "64 MB"},
+            {"128", "128 MB"},
+            {"256", "256 MB"},
+            {"512", "512 MB"},
+            { NULL, NULL },
+        },
+        "Off"
+    },
+    {
+        CORE_NAME "-rewind-button",
+        "Rewind Button",
+        NULL,
+        "Holding this button on the first controller steps back one frame per VI while the rewind buffer is enabled.",
+        NULL,
+        NULL,
+        {
+            {"disabled", NULL},
+            {"L3", NULL},
+            {"R3", NULL},
+            { NULL, NULL },
+        },
+        "disabled"
+    },
+    {
+        CORE_NAME "-run-ahead",
+        "Run-Ahead Frames",
+        NULL,
+        "Run this many frames ahead with the current input and present the last one, then go back to the real frame. Hides the game's own input lag at the cost of running and saving a full state every frame. Rewind does not record while run-ahead is active.",
+        NULL,
+        NULL,
+        {
+            {"disabled", NULL},
+            {"1", NULL},
+            {"2", NULL},
+            {"3", NULL},
+            {"4", NULL},
+            { NULL, NULL },
+        },
+        "disabled"
+    },
+    {
+        CORE_NAME "-profiler",
+        "Profiler",
+        NULL,
+        "Append a JSON line per VI to mupen64plus_profile.jsonl in the save directory, with the hottest guest code, the time spent in each interrupt handler, memory accesses per device and dynarec block activity.",
+        NULL,
+        NULL,
+        {
+            {"False", "Disabled"},
+            {"True", "Enabled"},
+            { NULL, NULL },
+        },
+        "False"
+    },
     {
         CORE_NAME "-astick-deadzone",
         "Analog Deadzone (percent)",
@@ -225,10 +225,12 @@ typedef struct
 typedef void (*ptr_FBRead)(unsigned int addr);
 typedef void (*ptr_FBWrite)(unsigned int addr, unsigned int size);
 typedef void (*ptr_FBGetFrameBufferInfo)(void *p);
+typedef void (*ptr_FBWriteRange)(unsigned int begin, unsigned int end);
 #if defined(M64P_PLUGIN_PROTOTYPES)
 EXPORT void CALL FBRead(unsigned int addr);
 EXPORT void CALL FBWrite(unsigned int addr, unsigned int size);
 EXPORT void CALL FBGetFrameBufferInfo(void *p);
+EXPORT void CALL FBWriteRange(unsigned int begin, unsigned int end);
 #endif
 
 /* audio plugin function pointers */
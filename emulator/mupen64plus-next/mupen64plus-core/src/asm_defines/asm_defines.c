@@ -117,8 +117,10 @@ DEFINE(cp0, count_per_op);
 DEFINE(cp0, tlb);
 
 DEFINE(tlb, entries);
+#ifndef MICRO_TLB
 DEFINE(tlb, LUT_r);
 DEFINE(tlb, LUT_w);
+#endif
 
 DEFINE(r4300_core, cached_interp);
 DEFINE(cached_interp, invalid_code);
@@ -27,6 +27,7 @@
 #include "device/device.h"
 #include "device/rcp/rsp/rsp_core.h"
 #include "device/pif/pif.h"
+#include "main/profiler.h"
 
 #ifdef DBG
 #include <string.h>
@@ -202,9 +203,10 @@ static void map_region(struct memory* mem,
     else
 #endif
     {
-        (void)type;
         mem->handlers[region] = *handler;
     }
+
+    profiler_map_region(region, type);
 }
 
 void apply_mem_mapping(struct memory* mem, const struct mem_mapping* mapping)
@@ -28,15 +28,22 @@
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 #include <string.h>
+#include <mupen64plus-next_common.h>
 
 #include "api/callbacks.h"
 #include "api/debugger.h"
 #include "api/m64p_types.h"
 #include "device/r4300/r4300_core.h"
 #include "device/r4300/idec.h"
+#include "device/r4300/idle_loop.h"
+#include "device/memory/memory.h"
 #include "main/main.h"
+#include "main/profiler.h"
 #include "osal/preproc.h"
 
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
 #ifdef DBG
 #include "debugger/dbg_debugger.h"
 #endif
@@ -97,6 +104,7 @@ void cached_interp_##name(void) \
         cp0_update_count(r4300); \
     } \
     r4300->cp0.last_addr = *r4300_pc(r4300); \
+    profiler_tick(r4300_cp0_regs(&r4300->cp0)[CP0_COUNT_REG], r4300->cp0.last_addr); \
     if (*r4300_cp0_cycle_count(&r4300->cp0) >= 0) gen_interrupt(r4300); \
 } \
  \
@@ -130,24 +138,19 @@ void cached_interp_##name##_OUT(void) \
         cp0_update_count(r4300); \
     } \
     r4300->cp0.last_addr = *r4300_pc(r4300); \
+    profiler_tick(r4300_cp0_regs(&r4300->cp0)[CP0_COUNT_REG], r4300->cp0.last_addr); \
     if (*r4300_cp0_cycle_count(&r4300->cp0) >= 0) gen_interrupt(r4300); \
 } \
   \
 void cached_interp_##name##_IDLE(void) \
 { \
     DECLARE_R4300 \
-    uint32_t* cp0_regs = r4300_cp0_regs(&r4300->cp0); \
-    int* cp0_cycle_count = r4300_cp0_cycle_count(&r4300->cp0); \
     const int take_jump = (condition); \
     if (cop1 && check_cop1_unusable(r4300)) return; \
     if (take_jump) \
     { \
         cp0_update_count(r4300); \
-        if(*cp0_cycle_count < 0) \
-        { \
-            cp0_regs[CP0_COUNT_REG] -= *cp0_cycle_count; \
-            *cp0_cycle_count = 0; \
-        } \
+        r4300_idle_skip(r4300); \
     } \
     cached_interp_##name(); \
 }
@@ -240,6 +243,7 @@ void cached_interp_NOTCOMPILED(void)
         DebugMessage(M64MSG_ERROR, "not compiled exception");
     }
     else {
+        profiler_count(PROFILER_BLOCK_COMPILE);
         r4300->cached_interp.recompile_block(r4300, mem, r4300->cached_interp.blocks[*r4300_pc(r4300) >> 12], *r4300_pc(r4300));
     }
 
@@ -341,15 +345,25 @@ static void (*const ci_table[R4300_OPCODES_COUNT])(void) =
 #undef X
 
 /* return 0:normal, 1:idle, 2:out */
-static int infer_jump_sub_type(uint32_t target, uint32_t pc, uint32_t next_iw, const struct precomp_block* block)
+static int infer_jump_sub_type(struct r4300_core* r4300, uint32_t target, uint32_t pc, uint32_t next_iw, const struct precomp_block* block)
 {
     /* test if jumping to same location with empty delay slot */
-    if (target == pc) {
-        if (next_iw == 0) {
+    if (target == pc && next_iw == 0) {
+        return 1;
+    }
+
+    /* test if jumping back to the start of an idle loop within the block,
+     * the recompiler only knows how to skip to the next event */
+    if (r4300->emumode == EMUMODE_INTERPRETER
+     && target <= pc && target >= block->start && pc != (block->end - 4)
+     && (pc - target) / 4 < IDLE_LOOP_MAX_LENGTH) {
+        const uint32_t* iw = fast_mem_access(r4300, target);
+        if (iw != NULL && r4300_is_idle_loop(iw, (pc - target) / 4 + 1)) {
             return 1;
         }
     }
-    else {
+
+    if (target != pc) {
         /* test if target is outside of block, or if we're at the end of block */
         if (target < block->start || target >= block->end || (pc == (block->end - 4))) {
             return 2;
@@ -393,7 +407,7 @@ enum r4300_opcode r4300_decode(struct precomp_instr* inst, struct r4300_core* r4
     case R4300_OP_JAL:
         inst->f.j.inst_index  = (iw & UINT32_C(0x3ffffff));
         /* select normal, idle or out jump type */
-        opcode += infer_jump_sub_type((inst->addr & ~0xfffffff) | (idec_imm(iw, idec) & 0xfffffff), inst->addr, next_iw, block);
+        opcode += infer_jump_sub_type(r4300, (inst->addr & ~0xfffffff) | (idec_imm(iw, idec) & 0xfffffff), inst->addr, next_iw, block);
         break;
 
     case R4300_OP_BC0F:
@@ -429,7 +443,7 @@ enum r4300_opcode r4300_decode(struct precomp_instr* inst, struct r4300_core* r4
         inst->f.i.immediate  = (int16_t)iw;
 
         /* select normal, idle or out branch type */
-        opcode += infer_jump_sub_type(inst->addr + inst->f.i.immediate*4 + 4, inst->addr, next_iw, block);
+        opcode += infer_jump_sub_type(r4300, inst->addr + inst->f.i.immediate*4 + 4, inst->addr, next_iw, block);
         break;
 
     case R4300_OP_ADD:
@@ -747,9 +761,27 @@ size_t get_block_memsize(const struct precomp_block *block)
     return ((length+1)+(length>>2)) * sizeof(struct precomp_instr);
 }
 
+/* Hash of the code under an unmapped RDRAM block, 0 for other blocks.
+ * A block whose hash did not change since it was decoded can be reused
+ * as is when its page gets invalidated. */
+static uint64_t hash_block_code(struct r4300_core* r4300, const struct precomp_block* block)
+{
+    uint32_t paddr = block->start & UINT32_C(0x1ffff000);
+    uint64_t hash;
+
+    if ((block->start & UINT32_C(0xc0000000)) != UINT32_C(0x80000000)
+     || paddr >= RDRAM_MAX_SIZE) {
+        return 0;
+    }
+
+    hash = XXH3_64bits(mem_base_u32(r4300->mem->base, paddr), block->end - block->start);
+    return (hash != 0) ? hash : 1;
+}
+
 void cached_interp_init_block(struct r4300_core* r4300, uint32_t address)
 {
     int i, length;
+    uint64_t hash;
 
     struct precomp_block** block = &r4300->cached_interp.blocks[address >> 12];
 
@@ -759,34 +791,52 @@ void cached_interp_init_block(struct r4300_core* r4300, uint32_t address)
         (*block)->block = NULL;
         (*block)->start = address & ~UINT32_C(0xfff);
         (*block)->end = (address & ~UINT32_C(0xfff)) + 0x1000;
+        (*block)->xxhash = 0;
     }
 
     struct precomp_block* b = *block;
 
     length = get_block_length(b);
+    hash = hash_block_code(r4300, b);
 
+    if (b->block && hash != 0 && hash == b->xxhash)
+    {
+        /* the page was written to but its code is unchanged,
+         * keep the instructions decoded so far */
+        profiler_count(PROFILER_BLOCK_HASH_HIT);
+    }
+    else
+    {
 #ifdef DBG
-    DebugMessage(M64MSG_INFO, "init block %" PRIX32 " - %" PRIX32, b->start, b->end);
+        DebugMessage(M64MSG_INFO, "init block %" PRIX32 " - %" PRIX32, b->start, b->end);
 #endif
 
-    /* allocate block instructions */
-    if (!b->block)
-    {
-        size_t memsize = get_block_memsize(b);
-        b->block = (struct precomp_instr*)malloc(memsize);
-        if (!b->block) {
-            DebugMessage(M64MSG_ERROR, "Memory error: couldn't allocate memory for cached interpreter.");
-            return;
+        if (b->block && b->xxhash != 0) {
+            profiler_count(PROFILER_BLOCK_HASH_MISS);
         }
 
-        memset(b->block, 0, memsize);
-    }
+        /* allocate block instructions */
+        if (!b->block)
+        {
+            size_t memsize = get_block_memsize(b);
+            b->block = (struct precomp_instr*)malloc(memsize);
+            if (!b->block) {
+                DebugMessage(M64MSG_ERROR, "Memory error: couldn't allocate memory for cached interpreter.");
+                return;
+            }
 
-    /* reset block instructions (addr + ops) */
-    for (i = 0; i < length; ++i)
-    {
-        b->block[i].addr = b->start + 4*i;
-        b->block[i].ops = cached_interp_NOTCOMPILED;
+            memset(b->block, 0, memsize);
+        }
+
+        /* reset block instructions (addr + ops) */
+        for (i = 0; i < length; ++i)
+        {
+            b->block[i].addr = b->start + 4*i;
+            b->block[i].ops = cached_interp_NOTCOMPILED;
+            b->block[i].run = 0;
+        }
+
+        b->xxhash = hash;
     }
 
     /* here we're marking the block as a valid code even if it's not compiled
@@ -826,9 +876,19 @@ void cached_interp_free_block(struct precomp_block* block)
     }
 }
 
+/* ops that can leave straight-line flow through a delay slot or an exception return */
+static int is_control_opcode(enum r4300_opcode opcode)
+{
+    return (opcode >= R4300_OP_BC0F && opcode <= R4300_OP_BNEL_OUT)
+        || (opcode >= R4300_OP_J && opcode <= R4300_OP_JR_OUT)
+        || opcode == R4300_OP_BREAK
+        || opcode == R4300_OP_ERET
+        || opcode == R4300_OP_SYSCALL;
+}
+
 void cached_interp_recompile_block(struct r4300_core* r4300, const uint32_t* iw, struct precomp_block* block, uint32_t func)
 {
-    int i, length, length2, finished;
+    int i, j, first, length, length2, finished;
     struct precomp_instr* inst;
     enum r4300_opcode opcode;
 
@@ -839,11 +899,8 @@ void cached_interp_recompile_block(struct r4300_core* r4300, const uint32_t* iw,
     length = get_block_length(block);
     length2 = length - 2 + (length >> 2);
 
-    /* reset xxhash */
-    block->xxhash = 0;
-
-
-    for (i = (func & 0xFFF) / 4, finished = 0; finished != 2; ++i)
+    first = (func & 0xFFF) / 4;
+    for (i = first, finished = 0; finished != 2; ++i)
     {
         inst = block->block + i;
 
@@ -860,6 +917,7 @@ void cached_interp_recompile_block(struct r4300_core* r4300, const uint32_t* iw,
 
         /* decode instruction */
         opcode = r4300_decode(inst, r4300, r4300_get_idec(iw[i]), iw[i], iw[i+1], block);
+        inst->opcode = (uint16_t)opcode;
 
         /* decode ending conditions */
         if (i >= length2) { finished = 2; }
@@ -876,17 +934,30 @@ void cached_interp_recompile_block(struct r4300_core* r4300, const uint32_t* iw,
         }
     }
 
+    /* superblock runs stop at the next control op, or at the end of the
+     * decoded range since what follows may be recompiled separately */
+    for (j = i - 1; j >= first; --j)
+    {
+        inst = block->block + j;
+        if (is_control_opcode(inst->opcode))
+            inst->run = 0;
+        else
+            inst->run = (j == i - 1) ? 1 : inst[1].run + 1;
+    }
+
     if (i >= length)
     {
         inst = block->block + i;
         inst->addr = block->start + i*4;
         inst->ops = cached_interp_FIN_BLOCK;
+        inst->run = 0;
         ++i;
         if (i <= length2) // useful when last opcode is a jump
         {
             inst = block->block + i;
             inst->addr = block->start + i*4;
             inst->ops = cached_interp_FIN_BLOCK;
+            inst->run = 0;
             i++;
         }
     }
@@ -953,6 +1024,7 @@ void invalidate_cached_code_hacktarux(struct r4300_core* r4300, uint32_t address
     {
         /* invalidate everthing */
         memset(r4300->cached_interp.invalid_code, 1, 0x100000);
+        profiler_count(PROFILER_BLOCK_FLUSH);
     }
     else
     {
@@ -969,6 +1041,7 @@ void invalidate_cached_code_hacktarux(struct r4300_core* r4300, uint32_t address
                  || r4300->cached_interp.blocks[i]->block[(addr & 0xfff) / 4].ops != r4300->cached_interp.not_compiled)
                 {
                     r4300->cached_interp.invalid_code[i] = 1;
+                    profiler_count(PROFILER_BLOCK_INVALIDATE);
                     /* go directly to next i */
                     addr &= ~0xfff;
                     addr |= 0xffc;
@@ -984,8 +1057,94 @@ void invalidate_cached_code_hacktarux(struct r4300_core* r4300, uint32_t address
     }
 }
 
+#if !defined(COMPARE_CORE) && !defined(DBG)
+#define CI_DIRECT(op) case R4300_OP_##op: cached_interp_##op(); break;
+
+/* Executes straight-line instructions until the PC reaches one that can
+ * branch. Common ops are called directly so they can be inlined into the
+ * loop; every handler still advances the PC itself, so an exception or a
+ * block reinit only changes which instruction is looked at next. Count and
+ * pending interrupts are still handled by the branch at the end of the run. */
+static void cached_interp_run_superblock(struct r4300_core* r4300)
+{
+    struct precomp_instr** pc = r4300_pc_struct(r4300);
+    struct precomp_instr* inst;
+
+    while ((inst = *pc)->run != 0)
+    {
+        switch (inst->opcode)
+        {
+        CI_DIRECT(NOP)
+        CI_DIRECT(LUI)
+        CI_DIRECT(ADDIU)
+        CI_DIRECT(ADDU)
+        CI_DIRECT(SUBU)
+        CI_DIRECT(DADDIU)
+        CI_DIRECT(DADDU)
+        CI_DIRECT(AND)
+        CI_DIRECT(ANDI)
+        CI_DIRECT(OR)
+        CI_DIRECT(ORI)
+        CI_DIRECT(XOR)
+        CI_DIRECT(XORI)
+        CI_DIRECT(NOR)
+        CI_DIRECT(SLL)
+        CI_DIRECT(SRL)
+        CI_DIRECT(SRA)
+        CI_DIRECT(SLLV)
+        CI_DIRECT(SRLV)
+        CI_DIRECT(SRAV)
+        CI_DIRECT(SLT)
+        CI_DIRECT(SLTU)
+        CI_DIRECT(SLTI)
+        CI_DIRECT(SLTIU)
+        CI_DIRECT(MFHI)
+        CI_DIRECT(MFLO)
+        CI_DIRECT(MULT)
+        CI_DIRECT(MULTU)
+        CI_DIRECT(LB)
+        CI_DIRECT(LBU)
+        CI_DIRECT(LH)
+        CI_DIRECT(LHU)
+        CI_DIRECT(LW)
+        CI_DIRECT(LD)
+        CI_DIRECT(SB)
+        CI_DIRECT(SH)
+        CI_DIRECT(SW)
+        CI_DIRECT(SD)
+        CI_DIRECT(LWC1)
+        CI_DIRECT(SWC1)
+        CI_DIRECT(LDC1)
+        CI_DIRECT(SDC1)
+        default:
+            /* CP0 writes may raise an interrupt and stop the core */
+            inst->ops();
+            if (*r4300_stop(r4300))
+                return;
+            break;
+        }
+    }
+}
+
+#undef CI_DIRECT
+#endif
+
 void run_cached_interpreter(struct r4300_core* r4300)
 {
+#if !defined(COMPARE_CORE) && !defined(DBG)
+    if (CachedInterpSuperblocks)
+    {
+        while (!*r4300_stop(r4300))
+        {
+            if ((*r4300_pc_struct(r4300))->run != 0)
+                cached_interp_run_superblock(r4300);
+            else
+                (*r4300_pc_struct(r4300))->ops();
+        }
+        return;
+    }
+#endif
+
     while (!*r4300_stop(r4300))
     {
 #ifdef COMPARE_CORE
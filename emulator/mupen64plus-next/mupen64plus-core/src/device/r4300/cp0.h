@@ -22,6 +22,7 @@
 #ifndef M64P_DEVICE_R4300_CP0_H
 #define M64P_DEVICE_R4300_CP0_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "interrupt.h"
@@ -141,30 +142,29 @@ enum r4300_cp0_registers
 
 
 enum { INTERRUPT_NODES_POOL_CAPACITY = 16 };
+enum { INTERRUPT_TYPES_COUNT = 15 };
 
 struct interrupt_event
 {
     int type;
     unsigned int count;
-};
-
-struct node
-{
-    struct interrupt_event data;
-    struct node *next;
-};
-
-struct pool
-{
-    struct node nodes [INTERRUPT_NODES_POOL_CAPACITY];
-    struct node* stack[INTERRUPT_NODES_POOL_CAPACITY];
-    size_t index;
+    uint64_t order; /* insertion order, breaks ties between equal counts */
 };
 
 struct interrupt_queue
 {
-    struct pool pool;
-    struct node* first;
+    /* CHECK_INT events, due before anything else, latest last */
+    struct interrupt_event front[INTERRUPT_NODES_POOL_CAPACITY];
+    size_t front_size;
+
+    /* binary min-heap of the other events, ordered by count relative to
+     * the earliest one. slot gives the heap index of the event of each
+     * type, and is only meaningful while type_count for that type is 1. */
+    struct interrupt_event events[INTERRUPT_NODES_POOL_CAPACITY];
+    size_t size;
+    uint8_t slot[INTERRUPT_TYPES_COUNT];
+    uint8_t type_count[INTERRUPT_TYPES_COUNT];
+    uint64_t order;
 };
 
 struct interrupt_handler
@@ -0,0 +1,194 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - idle_loop.c                                             *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Generic idle loop detection.
+ *
+ * Games wait for interrupts or DMAs in short loops polling a RDRAM flag or
+ * a status register. Such a loop has no side effect and no state carried
+ * from one iteration to the next, so running it again before the next event
+ * gives the same result, and count can be moved straight to that event. The
+ * loop body still runs after each skip, which keeps it exact whatever it
+ * was waiting for. */
+
+#include "idle_loop.h"
+
+#include "device/r4300/cp0.h"
+#include "device/r4300/r4300_core.h"
+#include "main/profiler.h"
+
+#define RS_OF(iw) (((iw) >> 21) & 0x1f)
+#define RT_OF(iw) (((iw) >> 16) & 0x1f)
+#define RD_OF(iw) (((iw) >> 11) & 0x1f)
+
+#define REG(r)    (UINT32_C(1) << (r))
+
+enum idle_insn
+{
+    IDLE_INSN_REJECT,
+    IDLE_INSN_PLAIN,
+    IDLE_INSN_BRANCH
+};
+
+/* classifies iw and returns the registers it reads and writes */
+static enum idle_insn idle_insn_regs(uint32_t iw, uint32_t* reads, uint32_t* writes)
+{
+    uint32_t rs = REG(RS_OF(iw)), rt = REG(RT_OF(iw)), rd = REG(RD_OF(iw));
+
+    *reads = 0;
+    *writes = 0;
+
+    switch (iw >> 26)
+    {
+    case 0x00: /* SPECIAL */
+        switch (iw & 0x3f)
+        {
+        case 0x00: case 0x02: case 0x03:            /* SLL SRL SRA */
+        case 0x38: case 0x3a: case 0x3b:            /* DSLL DSRL DSRA */
+        case 0x3c: case 0x3e: case 0x3f:            /* DSLL32 DSRL32 DSRA32 */
+            *reads = rt; *writes = rd;
+            return IDLE_INSN_PLAIN;
+        case 0x04: case 0x06: case 0x07:            /* SLLV SRLV SRAV */
+        case 0x14: case 0x16: case 0x17:            /* DSLLV DSRLV DSRAV */
+        case 0x21: case 0x23: case 0x24: case 0x25: /* ADDU SUBU AND OR */
+        case 0x26: case 0x27: case 0x2a: case 0x2b: /* XOR NOR SLT SLTU */
+        case 0x2d: case 0x2f:                       /* DADDU DSUBU */
+            *reads = rs | rt; *writes = rd;
+            return IDLE_INSN_PLAIN;
+        case 0x0f:                                  /* SYNC */
+            return IDLE_INSN_PLAIN;
+        /* MFHI and MFLO read what nothing in the body can write */
+        case 0x10: case 0x12:
+            *writes = rd;
+            return IDLE_INSN_PLAIN;
+        }
+        return IDLE_INSN_REJECT;
+
+    case 0x01: /* REGIMM */
+        switch (RT_OF(iw))
+        {
+        case 0x00: case 0x01: case 0x02: case 0x03: /* BLTZ BGEZ BLTZL BGEZL */
+            *reads = rs;
+            return IDLE_INSN_BRANCH;
+        }
+        return IDLE_INSN_REJECT;
+
+    case 0x02: /* J */
+        return IDLE_INSN_BRANCH;
+
+    case 0x04: case 0x05: case 0x14: case 0x15:     /* BEQ BNE BEQL BNEL */
+        *reads = rs | rt;
+        return IDLE_INSN_BRANCH;
+
+    case 0x06: case 0x07: case 0x16: case 0x17:     /* BLEZ BGTZ BLEZL BGTZL */
+        *reads = rs;
+        return IDLE_INSN_BRANCH;
+
+    case 0x09: case 0x0a: case 0x0b: case 0x0c:     /* ADDIU SLTI SLTIU ANDI */
+    case 0x0d: case 0x0e: case 0x19:                /* ORI XORI DADDIU */
+        *reads = rs; *writes = rt;
+        return IDLE_INSN_PLAIN;
+
+    case 0x0f:                                      /* LUI */
+        *writes = rt;
+        return IDLE_INSN_PLAIN;
+
+    case 0x20: case 0x21: case 0x23: case 0x24:     /* LB LH LW LBU */
+    case 0x25: case 0x27: case 0x37:                /* LHU LWU LD */
+        *reads = rs; *writes = rt;
+        return IDLE_INSN_PLAIN;
+
+    case 0x22: case 0x26:                           /* LWL LWR */
+        *reads = rs | rt; *writes = rt;
+        return IDLE_INSN_PLAIN;
+    }
+
+    return IDLE_INSN_REJECT;
+}
+
+int r4300_is_idle_loop(const uint32_t* iw, size_t length)
+{
+    uint32_t reads, writes;
+    uint32_t read_first = 0, written = 0;
+    size_t i;
+
+    if (length == 0 || length > IDLE_LOOP_MAX_LENGTH) {
+        return 0;
+    }
+
+    /* body, branch then delay slot, in execution order */
+    for (i = 0; i <= length; ++i)
+    {
+        enum idle_insn insn = idle_insn_regs(iw[i], &reads, &writes);
+
+        if (insn == IDLE_INSN_REJECT || (insn == IDLE_INSN_BRANCH) != (i == length - 1)) {
+            return 0;
+        }
+
+        read_first |= reads & ~written;
+        written |= writes;
+    }
+
+    /* r0 reads as 0 whatever is written to it */
+    return ((read_first & written) & ~REG(0)) == 0;
+}
+
+void r4300_idle_skip(struct r4300_core* r4300)
+{
+    uint32_t* cp0_regs = r4300_cp0_regs(&r4300->cp0);
+    int* cp0_cycle_count = r4300_cp0_cycle_count(&r4300->cp0);
+    int skip = -*cp0_cycle_count;
+
+    if (skip <= 0) {
+        return;
+    }
+
+    if (r4300->idle_wake_pending)
+    {
+        int32_t wake = (int32_t)(r4300->idle_wake - cp0_regs[CP0_COUNT_REG]);
+
+        if (wake < skip) {
+            skip = (wake > 0) ? wake : 0;
+        }
+        r4300->idle_wake_pending = 0;
+    }
+
+    if (skip == 0) {
+        return;
+    }
+
+    cp0_regs[CP0_COUNT_REG] += skip;
+    *cp0_cycle_count += skip;
+
+    profiler_count(PROFILER_IDLE_SKIP);
+    profiler_add(PROFILER_IDLE_CYCLES, skip);
+}
+
+void r4300_idle_wake(struct r4300_core* r4300, unsigned int cycles)
+{
+    const uint32_t* cp0_regs = r4300_cp0_regs(&r4300->cp0);
+    uint32_t wake = cp0_regs[CP0_COUNT_REG] + cycles;
+
+    /* keep the earliest of the values read since the last skip */
+    if (!r4300->idle_wake_pending
+     || (int32_t)(wake - r4300->idle_wake) < 0) {
+        r4300->idle_wake = wake;
+    }
+    r4300->idle_wake_pending = 1;
+}
@@ -0,0 +1,47 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - idle_loop.h                                             *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef M64P_DEVICE_R4300_IDLE_LOOP_H
+#define M64P_DEVICE_R4300_IDLE_LOOP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct r4300_core;
+
+/* longest loop body, branch included, that is considered for idle skipping */
+enum { IDLE_LOOP_MAX_LENGTH = 16 };
+
+/* Tells whether the backward branch at iw[length - 1] (delay slot at
+ * iw[length]) closes an idle loop starting at iw[0]: the body only loads
+ * and computes, and every register it reads before writing is left alone,
+ * so each iteration does the same thing until memory is changed by an
+ * event. */
+int r4300_is_idle_loop(const uint32_t* iw, size_t length);
+
+/* Moves count forward to the next event, or to the wake point set by the
+ * last time-dependent register read, whichever comes first. */
+void r4300_idle_skip(struct r4300_core* r4300);
+
+/* Called by registers whose value depends on count: the value read now
+ * stays valid for that many cycles. */
+void r4300_idle_wake(struct r4300_core* r4300, unsigned int cycles);
+
+#endif /* M64P_DEVICE_R4300_IDLE_LOOP_H */
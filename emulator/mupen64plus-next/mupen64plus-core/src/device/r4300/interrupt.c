@@ -44,61 +44,58 @@
 #include "device/rcp/ai/ai_controller.h"
 #include "device/rcp/vi/vi_controller.h"
 #include "main/main.h"
+#include "main/profiler.h"
 #include "main/savestates.h"
 
 
 /***************************************************************************
- * Pool of Single Linked List Nodes
+ * Interrupt Queue
  **************************************************************************/
 
-static struct node* alloc_node(struct pool* p);
-static void free_node(struct pool* p, struct node* node);
-static void clear_pool(struct pool* p);
-
-
-/* node allocation/deallocation on a given pool */
-static struct node* alloc_node(struct pool* p)
+/* index of a *_INT type in slot/type_count, -1 for unknown types */
+static int event_type_index(int type)
 {
-    /* return NULL if pool is too small */
-    if (p->index >= INTERRUPT_NODES_POOL_CAPACITY) {
-        return NULL;
+    int i;
+
+    if (type <= 0 || type > DD_DV_INT || (type & (type - 1)) != 0) {
+        return -1;
     }
 
-    return p->stack[p->index++];
+    for (i = 0; (type & 1) == 0; type >>= 1, ++i);
+
+    return i;
 }
 
-static void free_node(struct pool* p, struct node* node)
+static void clear_queue(struct interrupt_queue* q)
 {
-    if (p->index == 0 || node == NULL) {
-        return;
-    }
-
-    p->stack[--p->index] = node;
+    q->front_size = 0;
+    q->size = 0;
+    q->order = 0;
+    memset(q->type_count, 0, sizeof(q->type_count));
 }
 
-/* release all nodes */
-static void clear_pool(struct pool* p)
+static const struct interrupt_event* first_event(const struct interrupt_queue* q)
 {
-    size_t i;
-
-    for (i = 0; i < INTERRUPT_NODES_POOL_CAPACITY; ++i) {
-        p->stack[i] = &p->nodes[i];
+    if (q->front_size != 0) {
+        return &q->front[q->front_size - 1];
     }
 
-    p->index = 0;
+    return (q->size != 0)
+        ? &q->events[0]
+        : NULL;
 }
 
-/***************************************************************************
- * Interrupt Queue
- **************************************************************************/
-
-static void clear_queue(struct interrupt_queue* q)
+/* counts are compared relative to base, equal counts fire in insertion order */
+static int before_event(const struct interrupt_event* e1, const struct interrupt_event* e2, uint32_t base)
 {
-    q->first = NULL;
-    clear_pool(&q->pool);
+    if (e1->count != e2->count) {
+        return (e1->count - base) < (e2->count - base);
+    }
+
+    return e1->order < e2->order;
 }
 
-static int before_event(const struct cp0* cp0, unsigned int evt1, unsigned int evt2, int type2)
+static uint32_t queue_base(const struct cp0* cp0)
 {
     const uint32_t* cp0_regs = r4300_cp0_regs((struct cp0*)cp0); /* OK to cast away const qualifier */
     uint32_t count = cp0_regs[CP0_COUNT_REG];
@@ -108,8 +105,150 @@ static int before_event(const struct cp0* cp0, unsigned int evt1, unsigned int e
     if (*cp0_cycle_count > 0)
         count -= *cp0_cycle_count;
 
-    if ((evt1 - count) < (evt2 - count)) return 1;
-    else return 0;
+    return count;
+}
+
+static void set_event(struct interrupt_queue* q, size_t i, const struct interrupt_event* e)
+{
+    int idx = event_type_index(e->type);
+
+    q->events[i] = *e;
+    if (idx >= 0) {
+        q->slot[idx] = (uint8_t)i;
+    }
+}
+
+static void sift_up(struct interrupt_queue* q, size_t i, uint32_t base)
+{
+    struct interrupt_event e = q->events[i];
+
+    while (i > 0 && before_event(&e, &q->events[(i - 1) / 2], base)) {
+        set_event(q, i, &q->events[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    set_event(q, i, &e);
+}
+
+static void sift_down(struct interrupt_queue* q, size_t i, uint32_t base)
+{
+    struct interrupt_event e = q->events[i];
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+
+        if (child >= q->size) {
+            break;
+        }
+        if (child + 1 < q->size && before_event(&q->events[child + 1], &q->events[child], base)) {
+            ++child;
+        }
+        if (!before_event(&q->events[child], &e, base)) {
+            break;
+        }
+        set_event(q, i, &q->events[child]);
+        i = child;
+    }
+    set_event(q, i, &e);
+}
+
+static int push_event(struct interrupt_queue* q, int type, unsigned int count, uint32_t base)
+{
+    struct interrupt_event e;
+    int idx = event_type_index(type);
+
+    if (q->front_size + q->size >= INTERRUPT_NODES_POOL_CAPACITY) {
+        return 0;
+    }
+
+    e.type = type;
+    e.count = count;
+    e.order = q->order++;
+
+    if (idx >= 0) {
+        ++q->type_count[idx];
+    }
+
+    q->events[q->size] = e;
+    sift_up(q, q->size++, base);
+
+    return 1;
+}
+
+static void remove_event_at(struct interrupt_queue* q, size_t i)
+{
+    /* the earliest event is not later than any other, so it serves as base */
+    uint32_t base = q->events[0].count;
+    int type = q->events[i].type;
+    int idx = event_type_index(type);
+    size_t last = --q->size;
+
+    if (i != last) {
+        set_event(q, i, &q->events[last]);
+        sift_down(q, i, base);
+        sift_up(q, i, base);
+    }
+
+    if (idx >= 0 && --q->type_count[idx] == 1) {
+        /* slot may have followed the removed duplicate */
+        for (i = 0; q->events[i].type != type; ++i);
+        q->slot[idx] = (uint8_t)i;
+    }
+}
+
+/* heap index of the earliest event of the given type, or q->size */
+static size_t find_event(const struct interrupt_queue* q, int type)
+{
+    size_t i, found = q->size;
+    int idx = event_type_index(type);
+
+    if (idx >= 0) {
+        if (q->type_count[idx] == 0) {
+            return q->size;
+        }
+        if (q->type_count[idx] == 1) {
+            return q->slot[idx];
+        }
+    }
+
+    /* duplicated or unknown type */
+    for (i = 0; i < q->size; ++i) {
+        if (q->events[i].type == type
+         && (found == q->size || before_event(&q->events[i], &q->events[found], q->events[0].count))) {
+            found = i;
+        }
+    }
+
+    return found;
+}
+
+/* index in q->front of the latest front event of the given type, or q->front_size */
+static size_t find_front_event(const struct interrupt_queue* q, int type)
+{
+    size_t i;
+
+    for (i = q->front_size; i-- > 0; ) {
+        if (q->front[i].type == type) {
+            return i;
+        }
+    }
+
+    return q->front_size;
+}
+
+static void update_next_interrupt(struct cp0* cp0)
+{
+    const uint32_t* cp0_regs = r4300_cp0_regs(cp0);
+    unsigned int* cp0_next_interrupt = r4300_cp0_next_interrupt(cp0);
+    int* cp0_cycle_count = r4300_cp0_cycle_count(cp0);
+    const struct interrupt_event* e = first_event(&cp0->q);
+
+    *cp0_next_interrupt = (e != NULL)
+        ? e->count
+        : 0;
+
+    *cp0_cycle_count = (e != NULL)
+        ? (cp0_regs[CP0_COUNT_REG] - e->count)
+        : 0;
 }
 
 unsigned int add_random_interrupt_time(struct r4300_core* r4300)
@@ -134,145 +273,94 @@ void add_interrupt_event(struct cp0* cp0, int type, unsigned int delay)
 
 void add_interrupt_event_count(struct cp0* cp0, int type, unsigned int count)
 {
-    struct node* event;
-    struct node* e;
-    const uint32_t* cp0_regs = r4300_cp0_regs(cp0);
-    unsigned int* cp0_next_interrupt = r4300_cp0_next_interrupt(cp0);
-    int* cp0_cycle_count = r4300_cp0_cycle_count(cp0);
-
     if (get_event(&cp0->q, type)) {
         DebugMessage(M64MSG_WARNING, "two events of type 0x%x in interrupt queue", type);
     }
 
-    event = alloc_node(&cp0->q.pool);
-    if (event == NULL)
+    if (!push_event(&cp0->q, type, count, queue_base(cp0)))
     {
         DebugMessage(M64MSG_ERROR, "Failed to allocate node for new interrupt event");
         return;
     }
 
-    event->data.count = count;
-    event->data.type = type;
-
-    if (cp0->q.first == NULL)
-    {
-        cp0->q.first = event;
-        event->next = NULL;
-    }
-    else if (before_event(cp0, count, cp0->q.first->data.count, cp0->q.first->data.type))
-    {
-        event->next = cp0->q.first;
-        cp0->q.first = event;
-    }
-    else
-    {
-        for (e = cp0->q.first;
-            e->next != NULL &&
-            (!before_event(cp0, count, e->next->data.count, e->next->data.type));
-            e = e->next);
-
-        if (e->next == NULL)
-        {
-            e->next = event;
-            event->next = NULL;
-        }
-        else
-        {
-            for(; e->next != NULL && e->next->data.count == count; e = e->next);
-
-            event->next = e->next;
-            e->next = event;
-        }
-    }
-    *cp0_next_interrupt = cp0->q.first->data.count;
-    *cp0_cycle_count = cp0_regs[CP0_COUNT_REG] - cp0->q.first->data.count;
+    update_next_interrupt(cp0);
 }
 
 void remove_interrupt_event(struct cp0* cp0)
 {
-    struct node* e;
-    const uint32_t* cp0_regs = r4300_cp0_regs(cp0);
-    unsigned int* cp0_next_interrupt = r4300_cp0_next_interrupt(cp0);
-    int* cp0_cycle_count = r4300_cp0_cycle_count(cp0);
-
-    e = cp0->q.first;
-    cp0->q.first = e->next;
-    free_node(&cp0->q.pool, e);
-
-    *cp0_next_interrupt = (cp0->q.first != NULL)
-        ? cp0->q.first->data.count
-        : 0;
+    if (cp0->q.front_size != 0) {
+        --cp0->q.front_size;
+    }
+    else {
+        remove_event_at(&cp0->q, 0);
+    }
 
-    *cp0_cycle_count = (cp0->q.first != NULL)
-        ? (cp0_regs[CP0_COUNT_REG] - cp0->q.first->data.count)
-        : 0;
+    update_next_interrupt(cp0);
 }
 
 unsigned int* get_event(const struct interrupt_queue* q, int type)
 {
-    struct node* e = q->first;
-
-    if (e == NULL) {
-        return NULL;
-    }
+    /* OK to cast away const qualifier */
+    struct interrupt_queue* mq = (struct interrupt_queue*)q;
+    size_t i;
 
-    if (e->data.type == type) {
-        return &e->data.count;
+    if ((i = find_front_event(q, type)) < q->front_size) {
+        return &mq->front[i].count;
     }
 
-    for (; e->next != NULL && e->next->data.type != type; e = e->next);
-
-    return (e->next != NULL)
-        ? &e->next->data.count
+    return ((i = find_event(q, type)) < q->size)
+        ? &mq->events[i].count
         : NULL;
 }
 
 int get_next_event_type(const struct interrupt_queue* q)
 {
-    return (q->first == NULL)
+    const struct interrupt_event* e = first_event(q);
+
+    return (e == NULL)
         ? 0
-        : q->first->data.type;
+        : e->type;
 }
 
-void remove_event(struct interrupt_queue* q, int type)
+unsigned int get_next_event_count(const struct interrupt_queue* q)
 {
-    struct node* to_del;
-    struct node* e = q->first;
+    const struct interrupt_event* e = first_event(q);
 
-    if (e == NULL) {
-        return;
-    }
+    return (e == NULL)
+        ? 0
+        : e->count;
+}
 
-    if (e->data.type == type)
-    {
-        q->first = e->next;
-        free_node(&q->pool, e);
-    }
-    else
-    {
-        for (; e->next != NULL && e->next->data.type != type; e = e->next);
+void remove_event(struct interrupt_queue* q, int type)
+{
+    size_t i;
 
-        if (e->next != NULL)
-        {
-            to_del = e->next;
-            e->next = to_del->next;
-            free_node(&q->pool, to_del);
-        }
+    if ((i = find_front_event(q, type)) < q->front_size) {
+        memmove(&q->front[i], &q->front[i + 1], (q->front_size - i - 1) * sizeof(q->front[0]));
+        --q->front_size;
+    }
+    else if ((i = find_event(q, type)) < q->size) {
+        remove_event_at(q, i);
     }
 }
 
 void translate_event_queue(struct cp0* cp0, unsigned int base)
 {
-    struct node* e;
+    size_t i;
     uint32_t* cp0_regs = r4300_cp0_regs(cp0);
     int* cp0_cycle_count = r4300_cp0_cycle_count(cp0);
 
     remove_event(&cp0->q, COMPARE_INT);
     remove_event(&cp0->q, SPECIAL_INT);
 
-    for (e = cp0->q.first; e != NULL; e = e->next)
+    /* shifting every count by the same amount keeps the heap ordered */
+    for (i = 0; i < cp0->q.front_size; ++i)
     {
-        e->data.count = (e->data.count - cp0_regs[CP0_COUNT_REG]) + base;
+        cp0->q.front[i].count = (cp0->q.front[i].count - cp0_regs[CP0_COUNT_REG]) + base;
+    }
+    for (i = 0; i < cp0->q.size; ++i)
+    {
+        cp0->q.events[i].count = (cp0->q.events[i].count - cp0_regs[CP0_COUNT_REG]) + base;
     }
 
     cp0_regs[CP0_COUNT_REG] = base;
@@ -285,21 +373,31 @@ void translate_event_queue(struct cp0* cp0, unsigned int base)
     cp0_regs[CP0_COUNT_REG] -= cp0->count_per_op;
 
     /* Update next interrupt in case first event is COMPARE_INT */
-    *cp0_cycle_count = cp0_regs[CP0_COUNT_REG] - cp0->q.first->data.count;
+    *cp0_cycle_count = cp0_regs[CP0_COUNT_REG] - get_next_event_count(&cp0->q);
 }
 
 int save_eventqueue_infos(const struct cp0* cp0, char *buf)
 {
     int len;
-    struct node* e;
+    size_t i;
+    struct interrupt_queue q = cp0->q;
 
     len = 0;
 
-    for (e = cp0->q.first; e != NULL; e = e->next)
+    /* events are saved in firing order */
+    for (i = q.front_size; i-- > 0; )
+    {
+        memcpy(buf + len    , &q.front[i].type , 4);
+        memcpy(buf + len + 4, &q.front[i].count, 4);
+        len += 8;
+    }
+
+    while (q.size != 0)
     {
-        memcpy(buf + len    , &e->data.type , 4);
-        memcpy(buf + len + 4, &e->data.count, 4);
+        memcpy(buf + len    , &q.events[0].type , 4);
+        memcpy(buf + len + 4, &q.events[0].count, 4);
         len += 8;
+        remove_event_at(&q, 0);
     }
 
     *((unsigned int*)&buf[len]) = 0xFFFFFFFF;
@@ -334,7 +432,6 @@ void init_interrupt(struct cp0* cp0)
 
 void r4300_check_interrupt(struct r4300_core* r4300, uint32_t cause_ip, int set_cause)
 {
-    struct node* event;
     uint32_t* cp0_regs = r4300_cp0_regs(&r4300->cp0);
     unsigned int* cp0_next_interrupt = r4300_cp0_next_interrupt(&r4300->cp0);
     int* cp0_cycle_count = r4300_cp0_cycle_count(&r4300->cp0);
@@ -351,29 +448,18 @@ void r4300_check_interrupt(struct r4300_core* r4300, uint32_t cause_ip, int set_
     }
     if (cp0_regs[CP0_STATUS_REG] & cp0_regs[CP0_CAUSE_REG] & UINT32_C(0xFF00))
     {
-        event = alloc_node(&r4300->cp0.q.pool);
-
-        if (event == NULL)
+        if (r4300->cp0.q.front_size + r4300->cp0.q.size >= INTERRUPT_NODES_POOL_CAPACITY)
         {
             DebugMessage(M64MSG_ERROR, "Failed to allocate node for new interrupt event");
             return;
         }
 
-        event->data.count = *cp0_next_interrupt = cp0_regs[CP0_COUNT_REG];
-        event->data.type = CHECK_INT;
-        *cp0_cycle_count = 0;
+        r4300->cp0.q.front[r4300->cp0.q.front_size].type = CHECK_INT;
+        r4300->cp0.q.front[r4300->cp0.q.front_size].count = cp0_regs[CP0_COUNT_REG];
+        ++r4300->cp0.q.front_size;
 
-        if (r4300->cp0.q.first == NULL)
-        {
-            r4300->cp0.q.first = event;
-            event->next = NULL;
-        }
-        else
-        {
-            event->next = r4300->cp0.q.first;
-            r4300->cp0.q.first = event;
-
-        }
+        *cp0_next_interrupt = cp0_regs[CP0_COUNT_REG];
+        *cp0_cycle_count = 0;
     }
 }
 
@@ -406,7 +492,7 @@ void compare_int_handler(void* opaque)
     cp0_regs[CP0_COUNT_REG] -= r4300->cp0.count_per_op;
 
     /* Update next interrupt in case first event is COMPARE_INT */
-    *cp0_cycle_count = cp0_regs[CP0_COUNT_REG] - r4300->cp0.q.first->data.count;
+    *cp0_cycle_count = cp0_regs[CP0_COUNT_REG] - get_next_event_count(&r4300->cp0.q);
 
     raise_maskable_interrupt(r4300, CP0_CAUSE_IP7);
 }
@@ -529,15 +615,19 @@ static void call_interrupt_handler(const struct cp0* cp0, size_t index)
 
     const struct interrupt_handler* handler = &cp0->interrupt_handlers[index];
 
+    if (g_profiler.enabled)
+    {
+        profiler_interrupt_begin(index);
+        handler->callback(handler->opaque);
+        profiler_interrupt_end();
+        return;
+    }
+
     handler->callback(handler->opaque);
 }
 
 void gen_interrupt(struct r4300_core* r4300)
 {
-    uint32_t* cp0_regs = r4300_cp0_regs(&r4300->cp0);
-    unsigned int* cp0_next_interrupt = r4300_cp0_next_interrupt(&r4300->cp0);
-    int* cp0_cycle_count = r4300_cp0_cycle_count(&r4300->cp0);
-
     if (*r4300_stop(r4300) == 1)
     {
         g_gs_vi_counter = 0; // debug
@@ -556,6 +646,14 @@ void gen_interrupt(struct r4300_core* r4300)
             return;
         }
 
+#ifdef __LIBRETRO__
+        if (savestates_get_snapshot_job() == savestates_job_load)
+        {
+            savestates_snapshot_load();
+            return;
+        }
+#endif
+
         if (r4300->reset_hard_job)
         {
             call_interrupt_handler(&r4300->cp0, 11);
@@ -568,20 +666,14 @@ void gen_interrupt(struct r4300_core* r4300)
         uint32_t dest = r4300->skip_jump;
         r4300->skip_jump = 0;
 
-        *cp0_next_interrupt = (r4300->cp0.q.first != NULL)
-            ? r4300->cp0.q.first->data.count
-            : 0;
-
-        *cp0_cycle_count = (r4300->cp0.q.first != NULL)
-            ? (cp0_regs[CP0_COUNT_REG] - r4300->cp0.q.first->data.count)
-            : 0;
+        update_next_interrupt(&r4300->cp0);
 
         r4300->cp0.last_addr = dest;
         generic_jump_to(r4300, dest);
         return;
     }
 
-    switch (r4300->cp0.q.first->data.type)
+    switch (get_next_event_type(&r4300->cp0.q))
     {
         case VI_INT:
             call_interrupt_handler(&r4300->cp0, 0);
@@ -657,7 +749,7 @@ void gen_interrupt(struct r4300_core* r4300)
             break;
 
         default:
-            DebugMessage(M64MSG_ERROR, "Unknown interrupt queue event type %.8X.", r4300->cp0.q.first->data.type);
+            DebugMessage(M64MSG_ERROR, "Unknown interrupt queue event type %.8X.", get_next_event_type(&r4300->cp0.q));
             remove_interrupt_event(&r4300->cp0);
             exception_general(r4300);
             break;
@@ -665,6 +757,11 @@ void gen_interrupt(struct r4300_core* r4300)
 
     if (!r4300->cp0.interrupt_unsafe_state)
     {
+#ifdef __LIBRETRO__
+        if (savestates_get_snapshot_job() == savestates_job_save)
+            savestates_snapshot_save();
+#endif
+
         if (savestates_get_job() == savestates_job_save)
         {
             savestates_save();
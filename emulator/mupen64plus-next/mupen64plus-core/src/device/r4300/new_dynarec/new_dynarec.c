@@ -34,16 +34,19 @@
 #include "api/m64p_types.h"
 #include "api/callbacks.h"
 #include "main/main.h"
+#include "main/profiler.h"
 #include "main/rom.h"
 #include "device/memory/memory.h"
 #include "device/r4300/cached_interp.h"
 #include "device/r4300/cp0.h"
 #include "device/r4300/cp1.h"
+#include "device/r4300/idle_loop.h"
 #include "device/r4300/interrupt.h"
 #include "device/r4300/tlb.h"
 #include "device/r4300/fpu.h"
 #include "device/rcp/mi/mi_controller.h"
 #include "device/rcp/rsp/rsp_core.h"
+#include "device/rdram/rdram.h"
 
 #if !defined(WIN32)
 #ifndef HAVE_LIBNX
@@ -2821,10 +2824,19 @@ static void invalidate_page(u_int page)
 void invalidate_block(u_int block)
 {
   u_int page;
+  if(block>=0x80000&&block<0x80800) {
+    rdram_mark_dirty(&g_dev.rdram,(block&0x7ff)<<12,4096);
+    // No code in the page, the write was only trapped to mark it dirty
+    if(g_dev.r4300.cached_interp.invalid_code[block]==INVALID_CODE_DIRTY_TRAP) {
+      g_dev.r4300.cached_interp.invalid_code[block]=1;
+      return;
+    }
+  }
   page=block^0x80000;
   if(page>262143&&g_dev.r4300.cp0.tlb.LUT_r[block]) page=(g_dev.r4300.cp0.tlb.LUT_r[block]^0x80000000)>>12;
   if(page>2048) page=2048+(page&2047);
   inv_debug("INVALIDATE: %x (%d)\n",block<<12,page);
+  profiler_count(PROFILER_BLOCK_INVALIDATE);
   u_int first,last;
   first=last=page;
   struct ll_entry *head;
@@ -2935,6 +2947,7 @@ void invalidate_cached_code_new_dynarec(struct r4300_core* r4300, uint32_t addre
     if (size == 0)
     {
         invalidate_all_pages();
+        profiler_count(PROFILER_BLOCK_FLUSH);
     }
     else
     {
@@ -2949,6 +2962,20 @@ void invalidate_cached_code_new_dynarec(struct r4300_core* r4300, uint32_t addre
     }
 }
 
+// Unmapped dram stores only take the invalid_code check, so make the
+// next store to each page without code trap once. Mapped stores are not
+// checked, there is nothing to arm once the TLB is in use.
+int new_dynarec_track_dram_writes(void)
+{
+  u_int page;
+  if(using_tlb) return 0;
+  for(page=0x80000;page<0x80800;page++) {
+    if(g_dev.r4300.cached_interp.invalid_code[page]==1)
+      g_dev.r4300.cached_interp.invalid_code[page]=INVALID_CODE_DIRTY_TRAP;
+  }
+  return 1;
+}
+
 // If a code block was found to be unmodified (bit was set in
 // restore_candidate) and it remains unmodified (bit is clear
 // in invalid_code) then move the entries for that 4K page from
@@ -3031,6 +3058,16 @@ void dynarec_gen_interrupt(void)
     struct r4300_core* r4300 = &g_dev.r4300;
     struct new_dynarec_hot_state* state = &r4300->new_dynarec_hot_state;
     cp0_update_count(r4300);
+    profiler_tick(state->cp0_regs[CP0_COUNT_REG], state->pcaddr);
+
+    // Reached from a polling loop before the next event
+    if (state->cycle_count < 0)
+    {
+        r4300_idle_skip(r4300);
+        if (state->cycle_count < 0)
+            return;
+    }
+
     uint32_t page = ((state->cp0_regs[CP0_COUNT_REG]>>19)&0x1fc);
     unsigned int *candidate = (unsigned int *)&restore_candidate[page];
     page <<= 3;
@@ -4493,6 +4530,20 @@ static void do_cc(int i,signed char i_regmap[],int *adj,int addr,int taken,int i
     jaddr=(intptr_t)out;
     emit_jmp(0);
   }
+  else if(taken==TAKEN && ba[i]>=start && ba[i]<=start+i*4 &&
+          r4300_is_idle_loop((const uint32_t*)&source[(ba[i]-start)>>2],i-((ba[i]-start)>>2)+1)) {
+    // Polling loop, always go through the stub so that count is moved
+    // forward by dynarec_gen_interrupt
+    if(*adj==0||invert) {
+      if(g_dev.r4300.cp0.count_per_op_denom_pot) {
+        count += (1 << g_dev.r4300.cp0.count_per_op_denom_pot) - 1;
+        count >>= g_dev.r4300.cp0.count_per_op_denom_pot;
+      }
+      emit_addimm(HOST_CCREG,CLOCK_DIVIDER*(count+2),HOST_CCREG);
+    }
+    jaddr=(intptr_t)out;
+    emit_jmp(0);
+  }
   else if(*adj==0||invert) {
     if(g_dev.r4300.cp0.count_per_op_denom_pot) {
       count += (1 << g_dev.r4300.cp0.count_per_op_denom_pot) - 1;
@@ -8726,6 +8777,8 @@ void new_dynarec_init(void)
   int n;
   for(n=0x80000;n<0x80800;n++)
     g_dev.r4300.cached_interp.invalid_code[n]=1;
+  // Disarms the pages trapped for the dirty page tracking
+  rdram_mark_untracked(&g_dev.rdram);
   for(n=0;n<65536;n++)
     hash_table[n][0]=hash_table[n][1]=NULL;
   memset(g_dev.r4300.new_dynarec_hot_state.mini_ht,-1,sizeof(g_dev.r4300.new_dynarec_hot_state.mini_ht));
@@ -8788,6 +8841,7 @@ int new_recompile_block(int addr)
 #endif
 
   assem_debug("NOTCOMPILED: addr = %x -> %x", (int)addr, (intptr_t)out);
+  profiler_count(PROFILER_BLOCK_COMPILE);
 #if COUNT_NOTCOMPILEDS
   notcompiledCount++;
   DebugMessage(M64MSG_VERBOSE, "notcompiledCount=%i", notcompiledCount );
@@ -89,7 +89,12 @@ struct new_dynarec_hot_state
 extern unsigned int stop_after_jal;
 extern unsigned int using_tlb;
 
+/* invalid_code value of a page without code whose next store is trapped
+ * only to mark it dirty */
+#define INVALID_CODE_DIRTY_TRAP 2
+
 void invalidate_cached_code_new_dynarec(struct r4300_core* r4300, uint32_t address, size_t size);
+int new_dynarec_track_dram_writes(void);
 void new_dynarec_init(void);
 void new_dyna_start(void);
 void new_dynarec_cleanup(void);
@@ -29,7 +29,9 @@
 #include "api/callbacks.h"
 #include "api/debugger.h"
 #include "api/m64p_types.h"
+#include "device/r4300/idle_loop.h"
 #include "device/r4300/r4300_core.h"
+#include "main/profiler.h"
 #include "osal/preproc.h"
 
 #ifdef DBG
@@ -72,22 +74,17 @@ static void InterpretOpcode(struct r4300_core* r4300);
          cp0_update_count(r4300); \
       } \
       r4300->cp0.last_addr = r4300->interp_PC.addr; \
+      profiler_tick(r4300_cp0_regs(&r4300->cp0)[CP0_COUNT_REG], r4300->interp_PC.addr); \
       if (*r4300_cp0_cycle_count(&r4300->cp0) >= 0) gen_interrupt(r4300); \
    } \
    static void name##_IDLE(struct r4300_core* r4300, uint32_t op) \
    { \
-      uint32_t* cp0_regs = r4300_cp0_regs(&r4300->cp0); \
-      int* cp0_cycle_count = r4300_cp0_cycle_count(&r4300->cp0); \
       const int take_jump = (condition); \
       if (cop1 && check_cop1_unusable(r4300)) return; \
       if (take_jump) \
       { \
          cp0_update_count(r4300); \
-         if(*cp0_cycle_count < 0) \
-         { \
-             cp0_regs[CP0_COUNT_REG] -= *cp0_cycle_count; \
-             *cp0_cycle_count = 0; \
-         } \
+         r4300_idle_skip(r4300); \
       } \
       name(r4300, op); \
    }
@@ -104,11 +101,28 @@ static void InterpretOpcode(struct r4300_core* r4300);
 #define JUMP_OF(op)    ((op) & UINT32_C(0x3FFFFFF))
 
 /* Determines whether a relative jump in a 16-bit immediate goes back to the
- * same instruction without doing any work in its delay slot. The jump is
- * relative to the instruction in the delay slot, so 1 instruction backwards
- * (-1) goes back to the jump. */
+ * same instruction without doing any work in its delay slot, or to the start
+ * of a short loop that only polls memory. The jump is relative to the
+ * instruction in the delay slot, so 1 instruction backwards (-1) goes back
+ * to the jump. */
 #define IS_RELATIVE_IDLE_LOOP(r4300, op, addr) \
-	(IMM16S_OF(op) == -1 && *fast_mem_access((r4300), (addr) + 4) == 0)
+	(IMM16S_OF(op) < 0 && is_relative_idle_loop((r4300), IMM16S_OF(op), (addr)))
+
+static int is_relative_idle_loop(struct r4300_core* r4300, int16_t offset, uint32_t addr)
+{
+	const uint32_t target = addr + 4 + offset * 4;
+	const uint32_t* iw;
+
+	if (offset == -1 && *fast_mem_access(r4300, addr + 4) == 0)
+		return 1;
+
+	/* stay in the page of the branch so that fetching cannot fault */
+	if (offset < -IDLE_LOOP_MAX_LENGTH || (target ^ addr) & ~UINT32_C(0xfff))
+		return 0;
+
+	iw = fast_mem_access(r4300, target);
+	return iw != NULL && r4300_is_idle_loop(iw, -offset);
+}
 
 /* Determines whether an absolute jump in a 26-bit immediate goes back to the
  * same instruction without doing any work in its delay slot. The jump is
@@ -35,6 +35,7 @@
 #include "debugger/dbg_debugger.h"
 #endif
 #include "main/main.h"
+#include "main/profiler.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -79,6 +80,7 @@ void poweron_r4300(struct r4300_core* r4300)
     r4300->delay_slot = 0;
     r4300->skip_jump = 0;
     r4300->reset_hard_job = 0;
+    r4300->idle_wake_pending = 0;
 
 
     /* recomp init */
@@ -311,6 +313,7 @@ int r4300_read_aligned_word(struct r4300_core* r4300, uint32_t address, uint32_t
     }
 
     address &= UINT32_C(0x1ffffffc);
+    profiler_count_mmio(address);
 
     mem_read32(mem_get_handler(r4300->mem, address), address & ~UINT32_C(3), value);
 
@@ -337,6 +340,7 @@ int r4300_read_aligned_dword(struct r4300_core* r4300, uint32_t address, uint64_
     }
 
     address &= UINT32_C(0x1ffffffc);
+    profiler_count_mmio(address);
 
     const struct mem_handler* handler = mem_get_handler(r4300->mem, address);
     mem_read32(handler, address + 0, &w[0]);
@@ -367,6 +371,7 @@ int r4300_write_aligned_word(struct r4300_core* r4300, uint32_t address, uint32_
     invalidate_r4300_cached_code(r4300, address ^ UINT32_C(0x20000000), 4);
 
     address &= UINT32_C(0x1ffffffc);
+    profiler_count_mmio(address);
 
     mem_write32(mem_get_handler(r4300->mem, address), address & ~UINT32_C(3), value, mask);
 
@@ -397,6 +402,7 @@ int r4300_write_aligned_dword(struct r4300_core* r4300, uint32_t address, uint64
     invalidate_r4300_cached_code(r4300, address ^ UINT32_C(0x20000000), 8);
 
     address &= UINT32_C(0x1ffffffc);
+    profiler_count_mmio(address);
 
     const struct mem_handler* handler = mem_get_handler(r4300->mem, address);
     mem_write32(handler, address + 0, value >> 32,      mask >> 32);
@@ -422,6 +428,17 @@ void invalidate_r4300_cached_code(struct r4300_core* r4300, uint32_t address, si
     }
 }
 
+int r4300_track_dram_writes(struct r4300_core* r4300)
+{
+    if (r4300->emumode != EMUMODE_DYNAREC)
+        return 1;
+#ifdef NEW_DYNAREC
+    return new_dynarec_track_dram_writes();
+#else
+    return 0;
+#endif
+}
+
 
 void generic_jump_to(struct r4300_core* r4300, uint32_t address)
 {
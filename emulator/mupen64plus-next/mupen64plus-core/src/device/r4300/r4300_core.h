@@ -36,6 +36,9 @@
 #include "recomp_types.h" /* for precomp_instr, regcache_state */
 
 #include "new_dynarec/new_dynarec.h"
+#include "device/memory/memory.h"
+#include "device/rdram/rdram.h"
+#include "main/profiler.h"
 
 #include "osal/preproc.h"
 
@@ -200,6 +203,10 @@ struct r4300_core
     uint32_t randomize_interrupt;
 
     uint32_t start_address;
+
+    /* count at which a value polled by an idle loop changes */
+    uint32_t idle_wake;
+    int idle_wake_pending;
 };
 
 #define R4300_KSEG0 UINT32_C(0x80000000)
@@ -247,6 +254,50 @@ int r4300_write_aligned_dword(struct r4300_core* r4300, uint32_t address, uint64
  */
 void invalidate_r4300_cached_code(struct r4300_core* r4300, uint32_t address, size_t size);
 
+/* Returns whether the dram writes made from now on are all reported
+ * through rdram_mark_dirty. The new dynarec has to be asked again after
+ * every rdram_clear_dirty, and cannot once the TLB is in use. */
+int r4300_track_dram_writes(struct r4300_core* r4300);
+
+/* Interpreter load/store fast path: KSEG0/KSEG1 words backed by plain
+ * RDRAM are accessed in place. Everything else, including TLB mapped
+ * addresses and pages whose handlers were replaced (MMIO, protected
+ * framebuffers, debugger breakpoints, uncalibrated RDRAM), goes through
+ * r4300_read_aligned_word / r4300_write_aligned_word. The profiler counts
+ * the accesses of both paths. */
+static osal_inline int r4300_read_aligned_word_fast(struct r4300_core* r4300, uint32_t address, uint32_t* value)
+{
+    uint32_t paddr = address & UINT32_C(0x1ffffffc);
+
+    if ((address & UINT32_C(0xc0000000)) == UINT32_C(0x80000000)
+     && paddr < r4300->rdram->dram_size
+     && mem_get_handler(r4300->mem, paddr)->read32 == read_rdram_dram) {
+        profiler_count_mmio(paddr);
+        *value = r4300->rdram->dram[rdram_dram_address(paddr)];
+        return 1;
+    }
+
+    return r4300_read_aligned_word(r4300, address, value);
+}
+
+static osal_inline int r4300_write_aligned_word_fast(struct r4300_core* r4300, uint32_t address, uint32_t value, uint32_t mask)
+{
+    uint32_t paddr = address & UINT32_C(0x1ffffffc);
+
+    if ((address & UINT32_C(0xc0000000)) == UINT32_C(0x80000000)
+     && paddr < r4300->rdram->dram_size
+     && mem_get_handler(r4300->mem, paddr)->write32 == write_rdram_dram) {
+        profiler_count_mmio(paddr);
+        invalidate_r4300_cached_code(r4300, address, 4);
+        invalidate_r4300_cached_code(r4300, address ^ UINT32_C(0x20000000), 4);
+        masked_write(&r4300->rdram->dram[rdram_dram_address(paddr)], value, mask);
+        rdram_mark_dirty(r4300->rdram, paddr, 4);
+        return 1;
+    }
+
+    return r4300_write_aligned_word(r4300, address, value, mask);
+}
+
 /* Jump to the given address. This works for all r4300 emulator, but is slower.
  * Use this for common code which can be executed from any r4300 emulator. */
 void generic_jump_to(struct r4300_core* r4300, unsigned int address);
@@ -43,6 +43,7 @@
 #include "device/r4300/recomp_types.h"
 #include "device/r4300/tlb.h"
 #include "main/main.h"
+#include "main/profiler.h"
 #if defined(PROFILE)
 #include "main/profile.h"
 #endif
@@ -933,7 +934,10 @@ void dynarec_cp0_update_count(void)
 /* Parameterless version of gen_interrupt to ease usage in dynarec. */
 void dynarec_gen_interrupt(void)
 {
-    gen_interrupt(&g_dev.r4300);
+    struct r4300_core* r4300 = &g_dev.r4300;
+
+    profiler_tick(r4300_cp0_regs(&r4300->cp0)[CP0_COUNT_REG], *r4300_pc(r4300));
+    gen_interrupt(r4300);
 }
 
 /* Parameterless version of read_aligned_word to ease usage in dynarec. */
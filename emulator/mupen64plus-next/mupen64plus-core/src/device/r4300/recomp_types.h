@@ -69,6 +69,10 @@ struct precomp_instr
     } f;
     uint32_t addr; /* word-aligned instruction address in r4300 address space */
 
+    /* these fields are cached interpreter specific */
+    uint16_t opcode; /* decoded enum r4300_opcode */
+    uint16_t run;    /* straight-line instructions starting here, 0 if this one can branch */
+
     /* these fields are recomp specific */
     unsigned int local_addr; /* byte offset to start of corresponding x86_64 instructions, from start of code block */
     struct reg_cache reg_cache_infos;
@@ -29,6 +29,115 @@
 #include <assert.h>
 #include <string.h>
 
+#ifdef MICRO_TLB
+/* true if the half of an entry starting at start is translated at all,
+ * the same conditions tlb_map applies before filling the LUTs */
+static int tlb_half_mapped(char v, unsigned int start, unsigned int end, unsigned int phys)
+{
+    return v
+        && start < end
+        && !(start >= 0x80000000 && end < 0xC0000000)
+        && phys < 0x20000000;
+}
+
+void tlb_flush_micro(struct tlb* tlb)
+{
+    memset(tlb->micro_r, 0, sizeof(tlb->micro_r));
+    memset(tlb->micro_w, 0, sizeof(tlb->micro_w));
+}
+
+void poweron_tlb(struct tlb* tlb)
+{
+    /* clear TLB entries */
+    memset(tlb->entries, 0, 32 * sizeof(tlb->entries[0]));
+    tlb_flush_micro(tlb);
+}
+
+void tlb_unmap(struct tlb* tlb, size_t entry)
+{
+    assert(entry < 32);
+    tlb_flush_micro(tlb);
+}
+
+void tlb_map(struct tlb* tlb, size_t entry)
+{
+    assert(entry < 32);
+    tlb_flush_micro(tlb);
+}
+
+/* Unlike the LUTs, where the last mapped entry wins, overlapping entries
+ * resolve to the lowest index. Games do not rely on either: overlapping
+ * matches shut the real TLB down. */
+uint32_t tlb_lookup(struct tlb* tlb, uint32_t address, int w)
+{
+    uint32_t page = address >> 12;
+    uint32_t base = address & ~UINT32_C(0xFFF);
+    struct micro_tlb_entry* m = ((w == 1) ? tlb->micro_w : tlb->micro_r) + (page % MICRO_TLB_SIZE);
+    size_t i;
+
+    if (m->tag == page + 1)
+        return m->value;
+
+    for (i = 0; i < 32; ++i)
+    {
+        const struct tlb_entry* e = &tlb->entries[i];
+        uint32_t value = 0;
+
+        if (base >= e->start_even && base < e->end_even)
+        {
+            if (tlb_half_mapped(e->v_even, e->start_even, e->end_even, e->phys_even) && (w != 1 || e->d_even))
+                value = UINT32_C(0x80000000) | (e->phys_even + (base - e->start_even) + 0xFFF);
+        }
+        else if (base >= e->start_odd && base < e->end_odd)
+        {
+            if (tlb_half_mapped(e->v_odd, e->start_odd, e->end_odd, e->phys_odd) && (w != 1 || e->d_odd))
+                value = UINT32_C(0x80000000) | (e->phys_odd + (base - e->start_odd) + 0xFFF);
+        }
+
+        if (value != 0)
+        {
+            m->tag = page + 1;
+            m->value = value;
+            return value;
+        }
+    }
+
+    return 0;
+}
+
+static void tlb_build_lut_half(unsigned char* lut, unsigned int start, unsigned int end, unsigned int phys)
+{
+    unsigned int i;
+
+    for (i = start; i < end; i += 0x1000)
+    {
+        uint32_t value = UINT32_C(0x80000000) | (phys + (i - start) + 0xFFF);
+        unsigned char* p = lut + 4 * (i >> 12);
+
+        p[0] = (unsigned char)(value);
+        p[1] = (unsigned char)(value >> 8);
+        p[2] = (unsigned char)(value >> 16);
+        p[3] = (unsigned char)(value >> 24);
+    }
+}
+
+void tlb_build_lut(const struct tlb* tlb, unsigned char* lut, int w)
+{
+    size_t i;
+
+    memset(lut, 0, 0x100000 * sizeof(uint32_t));
+
+    for (i = 0; i < 32; ++i)
+    {
+        const struct tlb_entry* e = &tlb->entries[i];
+
+        if (tlb_half_mapped(e->v_even, e->start_even, e->end_even, e->phys_even) && (w != 1 || e->d_even))
+            tlb_build_lut_half(lut, e->start_even, e->end_even, e->phys_even);
+        if (tlb_half_mapped(e->v_odd, e->start_odd, e->end_odd, e->phys_odd) && (w != 1 || e->d_odd))
+            tlb_build_lut_half(lut, e->start_odd, e->end_odd, e->phys_odd);
+    }
+}
+#else
 void poweron_tlb(struct tlb* tlb)
 {
     /* clear TLB entries */
@@ -101,14 +210,23 @@ void tlb_map(struct tlb* tlb, size_t entry)
     }
 }
 
+uint32_t tlb_lookup(struct tlb* tlb, uint32_t address, int w)
+{
+    return (w == 1)
+        ? tlb->LUT_w[address >> 12]
+        : tlb->LUT_r[address >> 12];
+}
+#endif /* MICRO_TLB */
+
 uint32_t virtual_to_physical_address(struct r4300_core* r4300, uint32_t address, int w)
 {
-    const struct tlb* tlb = &r4300->cp0.tlb;
-    unsigned int addr = address >> 12;
+    struct tlb* tlb = &r4300->cp0.tlb;
+    uint32_t value;
 
 #ifdef NEW_DYNAREC
     if (r4300->emumode == EMUMODE_DYNAREC)
     {
+        unsigned int addr = address >> 12;
         intptr_t map = r4300->new_dynarec_hot_state.memory_map[addr];
         if ((tlb->LUT_w[addr]) && (w == 1))
         {
@@ -128,16 +246,9 @@ uint32_t virtual_to_physical_address(struct r4300_core* r4300, uint32_t address,
     }
 #endif
 
-    if (w == 1)
-    {
-        if (tlb->LUT_w[addr])
-            return (tlb->LUT_w[addr] & UINT32_C(0xFFFFF000)) | (address & UINT32_C(0xFFF));
-    }
-    else
-    {
-        if (tlb->LUT_r[addr])
-            return (tlb->LUT_r[addr] & UINT32_C(0xFFFFF000)) | (address & UINT32_C(0xFFF));
-    }
+    value = tlb_lookup(tlb, address, w);
+    if (value)
+        return (value & UINT32_C(0xFFFFF000)) | (address & UINT32_C(0xFFF));
     //printf("tlb exception !!! @ %x, %x, add:%x\n", address, w, r4300->pc->addr);
     //getchar();
 
@@ -52,11 +52,34 @@ struct tlb_entry
    unsigned int phys_odd;
 };
 
+/* Build with MICRO_TLB to replace the 8 MB LUT_r/LUT_w tables by a small
+ * direct-mapped cache of recent translations in front of a search over the
+ * 32 entries. The dynarecs index the tables directly, so this is limited
+ * to interpreter-only builds. */
+#ifdef MICRO_TLB
+#if defined(DYNAREC) || defined(NEW_DYNAREC)
+#error "MICRO_TLB is not supported by the dynarecs"
+#endif
+
+#define MICRO_TLB_SIZE 64
+
+struct micro_tlb_entry
+{
+    uint32_t tag;   /* virtual page number + 1, 0 if empty */
+    uint32_t value; /* same encoding as LUT_r/LUT_w */
+};
+#endif
+
 struct tlb
 {
     struct tlb_entry entries[32];
+#ifdef MICRO_TLB
+    struct micro_tlb_entry micro_r[MICRO_TLB_SIZE];
+    struct micro_tlb_entry micro_w[MICRO_TLB_SIZE];
+#else
     uint32_t LUT_r[0x100000];
     uint32_t LUT_w[0x100000];
+#endif
 };
 
 void poweron_tlb(struct tlb* tlb);
@@ -64,6 +87,21 @@ void poweron_tlb(struct tlb* tlb);
 void tlb_unmap(struct tlb* tlb, size_t entry);
 void tlb_map(struct tlb* tlb, size_t entry);
 
+/* Returns the LUT_r (w == 0) or LUT_w (w == 1) value for the page
+ * containing address: 0x80000000 | physical page | 0xfff, or 0 if the
+ * page is not mapped. Does not raise exceptions. */
+uint32_t tlb_lookup(struct tlb* tlb, uint32_t address, int w);
+
+#ifdef MICRO_TLB
+/* Drops cached translations, to be called after entries were modified
+ * without going through tlb_map/tlb_unmap. */
+void tlb_flush_micro(struct tlb* tlb);
+
+/* Writes the 0x100000 little-endian LUT_r (w == 0) or LUT_w (w == 1)
+ * words the table-based build would hold, for savestate compatibility. */
+void tlb_build_lut(const struct tlb* tlb, unsigned char* lut, int w);
+#endif
+
 uint32_t virtual_to_physical_address(struct r4300_core* r4300, uint32_t address, int w);
 
 #endif /* M64P_DEVICE_R4300_TLB_H */
@@ -25,6 +25,7 @@
 
 #include "backends/api/audio_out_backend.h"
 #include "device/memory/memory.h"
+#include "device/r4300/idle_loop.h"
 #include "device/r4300/r4300_core.h"
 #include "device/rcp/mi/mi_controller.h"
 #include "device/rcp/ri/ri_controller.h"
@@ -56,6 +57,9 @@ static uint32_t get_remaining_dma_length(struct ai_controller* ai)
 
     remaining_dma_duration = *next_ai_event - cp0_regs[CP0_COUNT_REG];
 
+    /* the length goes down with count, a loop polling it is not idle */
+    r4300_idle_wake(ai->mi->r4300, 0);
+
     uint64_t dma_length = (uint64_t)remaining_dma_duration * ai->fifo[0].length / ai->fifo[0].duration;
     return dma_length&~7;
 }
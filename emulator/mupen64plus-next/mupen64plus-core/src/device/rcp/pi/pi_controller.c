@@ -34,6 +34,7 @@
 #include "device/rcp/mi/mi_controller.h"
 #include "device/rcp/rdp/rdp_core.h"
 #include "device/rcp/ri/ri_controller.h"
+#include "device/rdram/rdram.h"
 
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
@@ -113,6 +114,7 @@ static void dma_pi_write(struct pi_controller* pi)
         length -= dram_addr & 0x7;
     unsigned int cycles = handler->dma_write(opaque, dram, dram_addr, cart_addr, length);
 
+    rdram_mark_dirty(pi->ri->rdram, dram_addr, length);
     post_framebuffer_write(&pi->dp->fb, dram_addr, length);
 
     /* Mark DMA as busy */
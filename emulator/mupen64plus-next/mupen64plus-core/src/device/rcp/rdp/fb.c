@@ -36,18 +36,26 @@ static osal_inline size_t fb_buffer_size(const FrameBufferInfo* fb_info)
     return fb_info->width * fb_info->height * fb_info->size;
 }
 
+static osal_inline unsigned char fb_page_infos(const struct fb* fb, uint32_t address)
+{
+    return ((address >> 12) < FB_DIRTY_PAGES_COUNT)
+        ? fb->page_infos[address >> 12]
+        : 0;
+}
+
 void pre_framebuffer_read(struct fb* fb, uint32_t address)
 {
-    if (!fb->infos[0].addr) {
+    size_t i;
+    unsigned char infos = fb_page_infos(fb, address);
+
+    if (infos == 0 || !fb->dirty_page[address >> 12]) {
         return;
     }
 
-    size_t i;
-
     for (i = 0; i < FB_INFOS_COUNT; ++i) {
 
-        /* skip empty fb info */
-        if (fb->infos[i].addr == 0) {
+        /* skip fb infos not overlapping this page */
+        if ((infos & (1 << i)) == 0) {
             continue;
         }
 
@@ -65,11 +73,12 @@ void pre_framebuffer_read(struct fb* fb, uint32_t address)
 
 void post_framebuffer_write(struct fb* fb, uint32_t address, uint32_t length)
 {
-    if (!fb->infos[0].addr) {
+    if (!fb->infos[0].addr || length == 0) {
         return;
     }
 
     size_t i, j;
+    unsigned char infos = 0;
     unsigned char size;
     if (length % 4 == 0)
         size = 4;
@@ -78,10 +87,15 @@ void post_framebuffer_write(struct fb* fb, uint32_t address, uint32_t length)
     else
         size = 1;
 
+    /* gather the fb infos overlapping the written pages */
+    for (j = address >> 12; j <= ((address + length - 1) >> 12) && j < FB_DIRTY_PAGES_COUNT; ++j) {
+        infos |= fb->page_infos[j];
+    }
+
     for (i = 0; i < FB_INFOS_COUNT; ++i) {
 
-        /* skip empty fb info */
-        if (fb->infos[i].addr == 0) {
+        /* skip fb infos not overlapping the write */
+        if ((infos & (1 << i)) == 0) {
             continue;
         }
 
@@ -89,6 +103,17 @@ void post_framebuffer_write(struct fb* fb, uint32_t address, uint32_t length)
         uint32_t begin = fb->infos[i].addr;
         uint32_t end   = fb->infos[i].addr + fb_buffer_size(&fb->infos[i]) - 1;
 
+        if (gfx.fBWriteRange != NULL && length > 4) {
+            /* notify the whole intersection at once */
+            uint32_t first = (address > begin) ? address : begin;
+            uint32_t last  = (address + length - 1 < end) ? address + length - 1 : end;
+
+            if (first <= last) {
+                gfx.fBWriteRange(first, last);
+            }
+            continue;
+        }
+
         for (j = 0; j < length; j += size) {
             if ((address + j >= begin) && (address + j <= end)) {
                 gfx.fBWrite(address + j, size);
@@ -111,6 +136,7 @@ void init_fb(struct fb* fb,
 void poweron_fb(struct fb* fb)
 {
     memset(fb->dirty_page, 0, FB_DIRTY_PAGES_COUNT*sizeof(fb->dirty_page[0]));
+    memset(fb->page_infos, 0, FB_DIRTY_PAGES_COUNT*sizeof(fb->page_infos[0]));
     memset(fb->infos, 0, FB_INFOS_COUNT*sizeof(fb->infos[0]));
     fb->once = 1;
 }
@@ -202,6 +228,7 @@ void protect_framebuffers(struct fb* fb)
 
     /* ask fb info to gfx plugin */
     gfx.fBGetFrameBufferInfo(fb->infos);
+    memset(fb->page_infos, 0, FB_DIRTY_PAGES_COUNT*sizeof(fb->page_infos[0]));
 
     /* return early if not FB info is present */
     if (fb->infos[0].addr == 0) {
@@ -220,9 +247,10 @@ void protect_framebuffers(struct fb* fb)
         fb_mapping.end   = fb->infos[i].addr + fb_buffer_size(&fb->infos[i]) - 1;
         apply_mem_mapping(fb->mem, &fb_mapping);
 
-        /* mark all pages that are within a fb as dirty */
-        for (j = fb_mapping.begin >> 12; j <= (fb_mapping.end >> 12); ++j) {
+        /* mark all pages that are within a fb as dirty, and index them */
+        for (j = fb_mapping.begin >> 12; j <= (fb_mapping.end >> 12) && j < FB_DIRTY_PAGES_COUNT; ++j) {
             fb->dirty_page[j] = 1;
+            fb->page_infos[j] |= (unsigned char)(1 << i);
         }
 
         /* disable dynarec "fast memory" code generation to avoid direct memory accesses */
@@ -40,6 +40,8 @@ struct fb
     struct r4300_core* r4300;
 
     unsigned char dirty_page[FB_DIRTY_PAGES_COUNT];
+    /* bitmask of the infos overlapping each page */
+    unsigned char page_infos[FB_DIRTY_PAGES_COUNT];
     FrameBufferInfo infos[FB_INFOS_COUNT];
     unsigned int once;
 };
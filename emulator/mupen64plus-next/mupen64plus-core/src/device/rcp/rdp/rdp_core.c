@@ -26,7 +26,9 @@
 #include "device/memory/memory.h"
 #include "device/rcp/mi/mi_controller.h"
 #include "device/rcp/rsp/rsp_core.h"
+#include "device/rdram/rdram.h"
 #include "plugin/plugin.h"
+#include <mupen64plus-next_common.h>
 
 static void update_dpc_status(struct rdp_core* dp, uint32_t w)
 {
@@ -41,7 +43,7 @@ static void update_dpc_status(struct rdp_core* dp, uint32_t w)
 
         if (dp->do_on_unfreeze & DELAY_DP_INT)
             signal_rcp_interrupt(dp->mi, MI_INTR_DP);
-        if (dp->do_on_unfreeze & DELAY_UPDATESCREEN)
+        if ((dp->do_on_unfreeze & DELAY_UPDATESCREEN) && !(retro_speculative_frame & RETRO_SPECULATIVE_VIDEO))
             gfx.updateScreen();
         dp->do_on_unfreeze = 0;
     }
@@ -77,6 +79,7 @@ void poweron_rdp(struct rdp_core* dp)
 
     dp->do_on_unfreeze = 0;
 
+    rdp_reset_dram_writes(dp);
     poweron_fb(&dp->fb);
 }
 
@@ -115,6 +118,7 @@ void write_dpc_regs(void* opaque, uint32_t address, uint32_t value, uint32_t mas
         break;
     case DPC_END_REG:
         unprotect_framebuffers(&dp->fb);
+        rdp_track_dram_writes(dp);
         gfx.processRDPList();
         protect_framebuffers(&dp->fb);
         signal_rcp_interrupt(dp->mi, MI_INTR_DP);
@@ -146,3 +150,145 @@ void rdp_interrupt_event(void* opaque)
     raise_rcp_interrupt(dp->mi, MI_INTR_DP);
 }
 
+
+/* The RDP only writes dram through its color and depth images, within the
+ * scissor lines. The command lists are scanned for these before the gfx
+ * plugin runs them, and the lines drawn to are marked dirty. */
+enum
+{
+    RDP_CMD_FILL_RECT         = 0x36,
+    RDP_CMD_TEX_RECT          = 0x24,
+    RDP_CMD_TEX_RECT_FLIP     = 0x25,
+    RDP_CMD_SET_SCISSOR       = 0x2d,
+    RDP_CMD_SET_OTHER_MODES   = 0x2f,
+    RDP_CMD_SET_MASK_IMAGE    = 0x3e,
+    RDP_CMD_SET_COLOR_IMAGE   = 0x3f
+};
+
+static unsigned int rdp_command_length(uint32_t id)
+{
+    /* length in 64-bit words of the triangle commands */
+    static const unsigned char tri_length[8] = { 4, 6, 12, 14, 12, 14, 20, 22 };
+
+    if (id >= 0x08 && id <= 0x0f)
+        return tri_length[id - 0x08];
+    if (id == RDP_CMD_TEX_RECT || id == RDP_CMD_TEX_RECT_FLIP)
+        return 2;
+    return 1;
+}
+
+static uint32_t rdp_command_word(const struct rdp_core* dp, uint32_t address)
+{
+    if (dp->dpc_regs[DPC_STATUS_REG] & DPC_STATUS_XBUS_DMEM_DMA)
+        return dp->sp->mem[(address & 0xfff) >> 2];
+
+    address &= 0xffffff;
+    return (address < dp->fb.rdram->dram_size)
+        ? dp->fb.rdram->dram[address >> 2]
+        : 0;
+}
+
+static void rdp_mark_lines(struct rdp_core* dp, uint32_t image, uint32_t pitch)
+{
+    struct rdram* rdram = dp->fb.rdram;
+    uint32_t begin = (image & 0xffffff) + dp->writes.scissor_y0 * pitch;
+    uint32_t end = (image & 0xffffff) + (dp->writes.scissor_y1 + 1) * pitch;
+
+    if (end > rdram->dram_size)
+        end = (uint32_t)rdram->dram_size;
+    if (begin < end)
+        rdram_mark_dirty(rdram, begin, end - begin);
+}
+
+static void rdp_flush_dram_writes(struct rdp_core* dp)
+{
+    struct rdp_dram_writes* w = &dp->writes;
+
+    /* images set before a savestate was loaded are unknown, so
+     * anything drawn to them may be anywhere in dram */
+    if ((w->color_drawn && w->color_width == 0)
+     || (w->depth_drawn && (!w->depth_known || w->color_width == 0))) {
+        rdram_mark_dirty(dp->fb.rdram, 0, (uint32_t)dp->fb.rdram->dram_size);
+    }
+    else {
+        if (w->color_drawn)
+            rdp_mark_lines(dp, w->color_image, (w->color_width << w->color_size) >> 1);
+        if (w->depth_drawn)
+            rdp_mark_lines(dp, w->depth_image, w->color_width * 2);
+    }
+
+    w->color_drawn = 0;
+    w->depth_drawn = 0;
+}
+
+void rdp_reset_dram_writes(struct rdp_core* dp)
+{
+    struct rdp_dram_writes* w = &dp->writes;
+
+    memset(w, 0, sizeof(*w));
+    w->z_update = 1;
+    w->scissor_y1 = 0x3ff;
+}
+
+void rdp_track_dram_writes(struct rdp_core* dp)
+{
+    struct rdp_dram_writes* w = &dp->writes;
+    uint32_t current = dp->dpc_regs[DPC_CURRENT_REG] & ~UINT32_C(7);
+    uint32_t end = dp->dpc_regs[DPC_END_REG] & ~UINT32_C(7);
+
+    while (current < end) {
+        uint32_t w0, w1, id;
+
+        /* rest of a command started in the previous list */
+        if (w->skip != 0) {
+            uint32_t words = (end - current) >> 3;
+            if (words > w->skip)
+                words = w->skip;
+            w->skip -= words;
+            current += words << 3;
+            continue;
+        }
+
+        w0 = rdp_command_word(dp, current);
+        w1 = rdp_command_word(dp, current + 4);
+        id = (w0 >> 24) & 0x3f;
+
+        switch (id)
+        {
+        case RDP_CMD_SET_COLOR_IMAGE:
+            rdp_flush_dram_writes(dp);
+            w->color_image = w1 & 0x3ffffff;
+            w->color_size = (w0 >> 19) & 0x3;
+            w->color_width = (w0 & 0x3ff) + 1;
+            break;
+        case RDP_CMD_SET_MASK_IMAGE:
+            rdp_flush_dram_writes(dp);
+            w->depth_image = w1 & 0x3ffffff;
+            w->depth_known = 1;
+            break;
+        case RDP_CMD_SET_SCISSOR:
+            rdp_flush_dram_writes(dp);
+            w->scissor_y0 = (w0 & 0xfff) >> 2;
+            w->scissor_y1 = (w1 & 0xfff) >> 2;
+            break;
+        case RDP_CMD_SET_OTHER_MODES:
+            /* z_update_en, not in copy or fill cycle type */
+            w->z_update = (w1 & 0x20) && ((w0 >> 20) & 0x3) < 2;
+            break;
+        case RDP_CMD_FILL_RECT:
+        case RDP_CMD_TEX_RECT:
+        case RDP_CMD_TEX_RECT_FLIP:
+        case 0x08: case 0x09: case 0x0a: case 0x0b:
+        case 0x0c: case 0x0d: case 0x0e: case 0x0f:
+            w->color_drawn = 1;
+            w->depth_drawn |= w->z_update;
+            break;
+        }
+
+        w->skip = rdp_command_length(id) - 1;
+        current += 8;
+    }
+
+    rdp_flush_dram_writes(dp);
+}
+
@@ -81,12 +81,31 @@ enum
     DELAY_UPDATESCREEN = 0x002
 };
 
+/* state of the command stream bounding the dram the RDP writes,
+ * see rdp_track_dram_writes */
+struct rdp_dram_writes
+{
+    uint32_t color_image;
+    uint32_t color_width;   /* in pixels, 0 until a color image is set */
+    uint32_t color_size;
+    uint32_t depth_image;
+    int depth_known;
+    int z_update;           /* other modes allow depth writes */
+    uint32_t scissor_y0;    /* lines, inclusive */
+    uint32_t scissor_y1;
+    uint32_t skip;          /* words left of a command split across lists */
+    int color_drawn;
+    int depth_drawn;
+};
+
 struct rdp_core
 {
     uint32_t dpc_regs[DPC_REGS_COUNT];
     uint32_t dps_regs[DPS_REGS_COUNT];
     unsigned char do_on_unfreeze;
 
+    struct rdp_dram_writes writes;
+
     struct fb fb;
 
     struct rsp_core* sp;
@@ -120,4 +139,7 @@ void write_dps_regs(void* opaque, uint32_t address, uint32_t value, uint32_t mas
 
 void rdp_interrupt_event(void* opaque);
 
+void rdp_reset_dram_writes(struct rdp_core* dp);
+void rdp_track_dram_writes(struct rdp_core* dp);
+
 #endif
@@ -60,11 +60,16 @@ static void do_sp_dma(struct rsp_core* sp, const struct sp_dma* dma)
                 memaddr++;
                 dramaddr++;
             }
-            if (dramaddr <= 0x800000)
+            rdram_mark_dirty(sp->ri->rdram, dramaddr - length, length);
+            /* contiguous rows are notified at once below */
+            if (skip != 0 && dramaddr <= 0x800000)
                 post_framebuffer_write(&sp->dp->fb, dramaddr - length, length);
             dramaddr+=skip;
         }
 
+        if (skip == 0 && dramaddr - count * length < 0x800000)
+            post_framebuffer_write(&sp->dp->fb, dramaddr - count * length, count * length);
+
         sp->regs[SP_MEM_ADDR_REG] = memaddr & 0xfff;
         sp->regs[SP_DRAM_ADDR_REG] = dramaddr & 0xffffff;
         sp->regs[SP_RD_LEN_REG] = 0xff8;
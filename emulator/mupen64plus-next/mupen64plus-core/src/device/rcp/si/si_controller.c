@@ -68,6 +68,7 @@ static void copy_pif_rdram(struct si_controller* si)
         for(i = 0; i < (PIF_RAM_SIZE / 4); ++i) {
             dram[i] = tohl(pif_ram[i]);
         }
+        rdram_mark_dirty(si->ri->rdram, dram_addr, PIF_RAM_SIZE);
     }
 }
 
@@ -25,6 +25,7 @@
 
 #include "api/m64p_types.h"
 #include "device/memory/memory.h"
+#include "device/r4300/idle_loop.h"
 #include "device/r4300/r4300_core.h"
 #include "device/rcp/mi/mi_controller.h"
 #include "main/main.h"
@@ -99,8 +100,14 @@ void read_vi_regs(void* opaque, uint32_t address, uint32_t* value)
     {
         uint32_t* next_vi = get_event(&vi->mi->r4300->cp0.q, VI_INT);
         if (next_vi != NULL) {
+            uint32_t elapsed;
+
             cp0_update_count(vi->mi->r4300);
-            vi->regs[VI_CURRENT_REG] = (vi->delay - (*next_vi - cp0_regs[CP0_COUNT_REG])) / vi->count_per_scanline;
+            elapsed = vi->delay - (*next_vi - cp0_regs[CP0_COUNT_REG]);
+            vi->regs[VI_CURRENT_REG] = elapsed / vi->count_per_scanline;
+
+            /* idle loops may only skip to the next line */
+            r4300_idle_wake(vi->mi->r4300, vi->count_per_scanline - elapsed % vi->count_per_scanline);
 
             /* wrap around VI_CURRENT_REG if needed */
             if (vi->regs[VI_CURRENT_REG] >= vi->regs[VI_V_SYNC_REG])
@@ -167,10 +174,14 @@ void write_vi_regs(void* opaque, uint32_t address, uint32_t value, uint32_t mask
 void vi_vertical_interrupt_event(void* opaque)
 {
     struct vi_controller* vi = (struct vi_controller*)opaque;
-    if (vi->dp->do_on_unfreeze & DELAY_DP_INT)
-        vi->dp->do_on_unfreeze |= DELAY_UPDATESCREEN;
-    else
-        gfx.updateScreen();
+
+    /* frames thrown away by run-ahead skip the VI output entirely */
+    if (!(retro_speculative_frame & RETRO_SPECULATIVE_VIDEO)) {
+        if (vi->dp->do_on_unfreeze & DELAY_DP_INT)
+            vi->dp->do_on_unfreeze |= DELAY_UPDATESCREEN;
+        else
+            gfx.updateScreen();
+    }
 
     /* allow main module to do things on VI event */
     new_vi();
@@ -139,6 +139,7 @@ void poweron_rdram(struct rdram* rdram)
     size_t modules = get_modules_count(rdram);
     memset(rdram->regs, 0, RDRAM_MAX_MODULES_COUNT*RDRAM_REGS_COUNT*sizeof(uint32_t));
     memset(rdram->dram, 0, rdram->dram_size);
+    memset(rdram->dirty, 0xff, sizeof(rdram->dirty));
 
     DebugMessage(M64MSG_INFO, "Initializing %u RDRAM modules for a total of %u MB",
         (uint32_t) modules, (uint32_t) rdram->dram_size / (1024*1024));
@@ -156,6 +157,12 @@ void poweron_rdram(struct rdram* rdram)
 }
 
 
+void rdram_clear_dirty(struct rdram* rdram, enum rdram_dirty_client client)
+{
+    memset(rdram->dirty[client], 0, sizeof(rdram->dirty[client]));
+    rdram->untracked[client] = !r4300_track_dram_writes(rdram->r4300);
+}
+
 void read_rdram_regs(void* opaque, uint32_t address, uint32_t* value)
 {
     struct rdram* rdram = (struct rdram*)opaque;
@@ -249,5 +256,6 @@ void write_rdram_dram(void* opaque, uint32_t address, uint32_t value, uint32_t m
     if (address < rdram->dram_size)
     {
         masked_write(&rdram->dram[addr], value, mask);
+        rdram_mark_dirty(rdram, address, 4);
     }
 }
@@ -47,6 +47,19 @@ enum rdram_registers
 /* IPL3 rdram initialization accepts up to 8 RDRAM modules */
 enum { RDRAM_MAX_MODULES_COUNT = 8 };
 
+/* dirty page tracking granularity (4KB pages over the 8MB dram) */
+enum { RDRAM_DIRTY_PAGE_SHIFT = 12 };
+enum { RDRAM_DIRTY_PAGE_SIZE = 1 << RDRAM_DIRTY_PAGE_SHIFT };
+enum { RDRAM_DIRTY_PAGES_COUNT = 0x800000 >> RDRAM_DIRTY_PAGE_SHIFT };
+
+/* each consumer of the dirty pages keeps its own bitmap */
+enum rdram_dirty_client
+{
+    RDRAM_DIRTY_SAVESTATE,  /* delta savestates */
+    RDRAM_DIRTY_DIGEST,     /* netplay state digests */
+    RDRAM_DIRTY_CLIENTS_COUNT
+};
+
 struct rdram
 {
     uint32_t regs[RDRAM_MAX_MODULES_COUNT][RDRAM_REGS_COUNT];
@@ -54,6 +67,16 @@ struct rdram
     uint32_t* dram;
     size_t dram_size;
 
+    /* pages written since the client's last rdram_clear_dirty.
+     * Writes going through the core (mem handlers, PI/SI/SP DMA), the
+     * lines drawn by RDP command lists and writes reported by the plugins
+     * through plugin_notify_dram_write are tracked, and so are the new
+     * dynarec's stores, trapped once per page after each clear. untracked
+     * is set when all of dram was replaced, or when the dynarec's stores
+     * cannot be trapped because the TLB is in use */
+    uint32_t dirty[RDRAM_DIRTY_CLIENTS_COUNT][RDRAM_DIRTY_PAGES_COUNT / 32];
+    int untracked[RDRAM_DIRTY_CLIENTS_COUNT];
+
     struct r4300_core* r4300;
 };
 
@@ -67,6 +90,32 @@ static osal_inline uint32_t rdram_dram_address(uint32_t address)
     return (address & 0xffffff) >> 2;
 }
 
+/* mark [address, address+length) of dram as written, address is a byte offset in dram */
+static osal_inline void rdram_mark_dirty(struct rdram* rdram, uint32_t address, uint32_t length)
+{
+    uint32_t page = (address & 0x7fffff) >> RDRAM_DIRTY_PAGE_SHIFT;
+    uint32_t last = ((address + (length ? length : 1) - 1) & 0x7fffff) >> RDRAM_DIRTY_PAGE_SHIFT;
+
+    for (;;) {
+        rdram->dirty[RDRAM_DIRTY_SAVESTATE][page >> 5] |= UINT32_C(1) << (page & 31);
+        rdram->dirty[RDRAM_DIRTY_DIGEST][page >> 5] |= UINT32_C(1) << (page & 31);
+        if (page == last)
+            break;
+        page = (page + 1) & (RDRAM_DIRTY_PAGES_COUNT - 1);
+    }
+}
+
+static osal_inline int rdram_page_dirty(const struct rdram* rdram, enum rdram_dirty_client client, uint32_t page)
+{
+    return (rdram->dirty[client][page >> 5] >> (page & 31)) & 1;
+}
+
+static osal_inline void rdram_mark_untracked(struct rdram* rdram)
+{
+    rdram->untracked[RDRAM_DIRTY_SAVESTATE] = 1;
+    rdram->untracked[RDRAM_DIRTY_DIGEST] = 1;
+}
+
 void init_rdram(struct rdram* rdram,
                 uint32_t* dram,
                 size_t dram_size,
@@ -74,6 +123,8 @@ void init_rdram(struct rdram* rdram,
 
 void poweron_rdram(struct rdram* rdram);
 
+void rdram_clear_dirty(struct rdram* rdram, enum rdram_dirty_client client);
+
 void read_rdram_regs(void* opaque, uint32_t address, uint32_t* value);
 void write_rdram_regs(void* opaque, uint32_t address, uint32_t value, uint32_t mask);
 
@@ -81,7 +81,10 @@
 
 #include "custom/saved_memory.h"
 
+#include "profiler.h"
+#include "rewind.h"
 #include "rom.h"
+#include "runahead.h"
 #include "savestates.h"
 #include "screenshot.h"
 #include "util.h"
@@ -688,7 +691,7 @@ m64p_error main_reset(int do_hard_reset)
 static void video_plugin_render_callback(int bScreenRedrawn)
 {
     // if the input plugin specified a render callback, call it now
-    if(input.renderCallback)
+    if(input.renderCallback && !(retro_speculative_frame & RETRO_SPECULATIVE_VIDEO))
     {
         input.renderCallback();
     }
@@ -833,7 +836,9 @@ void new_vi(void)
 {
 #if defined(PROFILE)
     timed_sections_refresh();
+    timed_sections_frame(retro_speculative_frame & RETRO_SPECULATIVE_VIDEO);
 #endif
+    profiler_vi();
 
     gs_apply_cheats(&g_cheat_ctx);
 
@@ -841,7 +846,19 @@ void new_vi(void)
     main_check_inputs();
 
     netplay_check_sync(&g_dev.r4300.cp0);
+    netplay_rollback_vi();
+
+    /* frames replayed by a netplay rollback are not handed to the frontend */
+    if (netplay_is_resimulating())
+        return;
+
+    /* neither are frames run ahead of the real one, except the last */
+    if (!runahead_vi())
+        return;
+
     retro_run();
+
+    rewind_vi();
 }
 
 static void main_switch_pak(int control_id)
@@ -1563,7 +1580,6 @@ m64p_error main_run(void)
             cin_compats[i].last_pak_type = Controls[i].Plugin;
             cin_compats[i].last_input = 0;
             cin_compats[i].netplay_count = 0;
-            cin_compats[i].event_first = NULL;
 
             Controls[i].Plugin = PLUGIN_NONE;
 
@@ -1591,7 +1607,6 @@ m64p_error main_run(void)
             cin_compats[i].last_pak_type = Controls[i].Plugin;
             cin_compats[i].last_input = 0;
             cin_compats[i].netplay_count = 0;
-            cin_compats[i].event_first = NULL;
 
             l_gb_carts_data[i].control_id = (int)i;
 
@@ -1749,6 +1764,10 @@ m64p_error main_run(void)
 
     run_device(&g_dev);
 
+    rewind_deinit();
+    runahead_deinit();
+    profiler_deinit();
+
     /* release gb_carts */
     for(i = 0; i < GAME_CONTROLLERS_COUNT; ++i) {
         if (!Controls[i].RawData  && (Controls[i].Type == CONT_TYPE_STANDARD) && g_dev.gb_carts[i].read_gb_cart != NULL) {
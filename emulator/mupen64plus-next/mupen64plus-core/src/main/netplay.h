@@ -28,15 +28,11 @@
 
 #define NETPLAY_CORE_VERSION 1
 
-struct netplay_event {
-    uint32_t buttons;
-    uint8_t plugin;
-    uint32_t count;
-    struct netplay_event* next;
-};
-
 struct controller_input_compat;
 
+/* receives the input log of a netplay session, once per VI */
+typedef void (*netplay_log_writer)(void* opaque, const void* data, size_t size);
+
 #ifdef M64P_NETPLAY
 
 m64p_error netplay_start(const char* host, int port);
@@ -49,11 +45,17 @@ int netplay_get_controller(uint8_t player);
 file_status_t netplay_read_storage(const char *filename, void *data, size_t size);
 void netplay_sync_settings(uint32_t *count_per_op, uint32_t *count_per_op_denom_pot, uint32_t *disable_extra_mem, int32_t *si_dma_duration, uint32_t *emumode, int32_t *no_compiled_jump);
 void netplay_check_sync(struct cp0* cp0);
+void netplay_rollback_vi(void);
+int netplay_is_resimulating();
 int netplay_next_controller();
 void netplay_read_registration(struct controller_input_compat* cin_compats);
 void netplay_update_input(struct pif* pif);
 m64p_error netplay_send_config(char* data, int size);
 m64p_error netplay_receive_config(char* data, int size);
+m64p_error netplay_record_start(netplay_log_writer writer, void* opaque, uint32_t keyframe_interval);
+void netplay_record_stop(void);
+m64p_error netplay_replay_start(void);
+m64p_error netplay_replay_feed(const void* data, size_t size);
 
 #else
 
@@ -104,6 +106,15 @@ static osal_inline void netplay_check_sync(struct cp0* cp0)
 {
 }
 
+static osal_inline void netplay_rollback_vi(void)
+{
+}
+
+static osal_inline int netplay_is_resimulating()
+{
+    return 0;
+}
+
 static osal_inline int netplay_next_controller()
 {
     return 0;
@@ -131,6 +142,25 @@ static osal_inline m64p_error netplay_receive_config(char* data, int size)
     return M64ERR_INCOMPATIBLE;
 }
 
+static osal_inline m64p_error netplay_record_start(netplay_log_writer writer, void* opaque, uint32_t keyframe_interval)
+{
+    return M64ERR_INCOMPATIBLE;
+}
+
+static osal_inline void netplay_record_stop(void)
+{
+}
+
+static osal_inline m64p_error netplay_replay_start(void)
+{
+    return M64ERR_INCOMPATIBLE;
+}
+
+static osal_inline m64p_error netplay_replay_feed(const void* data, size_t size)
+{
+    return M64ERR_INCOMPATIBLE;
+}
+
 #endif
 
 #endif
@@ -0,0 +1,126 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - netplay_batch.c                                         *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "netplay_batch.h"
+
+#include <string.h>
+
+static uint32_t batch_read32(const uint8_t* b)
+{
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+static void batch_write32(uint32_t v, uint8_t* b)
+{
+    b[0] = (uint8_t)(v >> 24);
+    b[1] = (uint8_t)(v >> 16);
+    b[2] = (uint8_t)(v >> 8);
+    b[3] = (uint8_t)v;
+}
+
+void netplay_batch_reset(struct netplay_batch* batch, uint32_t redundancy)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->redundancy = (redundancy < NETPLAY_BATCH_MAX_FRAMES) ? (uint8_t)redundancy : NETPLAY_BATCH_MAX_FRAMES;
+}
+
+void netplay_batch_put(struct netplay_batch* batch, uint8_t control_id, uint32_t count,
+                       uint32_t keys, uint8_t plugin)
+{
+    uint8_t index = count % NETPLAY_BATCH_MAX_FRAMES;
+
+    /* only consecutive counts can be resent, start over after a gap */
+    if (count != batch->count[control_id] + 1)
+        batch->frames[control_id] = 0;
+    batch->sent[control_id][index].buttons = keys;
+    batch->sent[control_id][index].plugin = plugin;
+    batch->count[control_id] = count;
+    if (batch->frames[control_id] < batch->redundancy)
+        ++batch->frames[control_id];
+    batch->pending |= 1 << control_id;
+}
+
+size_t netplay_batch_encode(struct netplay_batch* batch, uint8_t* data)
+{
+    size_t curr = 1;
+    uint8_t blocks = 0;
+
+    if (batch->pending == 0)
+        return 0;
+
+    for (uint8_t i = 0; i < 4; ++i)
+    {
+        if (!(batch->pending & (1 << i)))
+            continue;
+        data[curr] = i;
+        batch_write32(batch->count[i], &data[curr + 1]);
+        data[curr + 5] = batch->frames[i];
+        curr += 6;
+        for (uint8_t f = 0; f < batch->frames[i]; ++f)
+        {
+            uint8_t index = (batch->count[i] - f) % NETPLAY_BATCH_MAX_FRAMES;
+            batch_write32(batch->sent[i][index].buttons, &data[curr]);
+            data[curr + 4] = batch->sent[i][index].plugin;
+            curr += 5;
+        }
+        ++blocks;
+    }
+    data[0] = blocks;
+    batch->pending = 0;
+    return curr;
+}
+
+size_t netplay_batch_decode_key_info(uint8_t player, uint8_t entries, const uint8_t* data,
+                                     const uint8_t* end, netplay_key_info_fn put, void* opaque)
+{
+    size_t curr = 0;
+
+    if (player >= 4 || data > end || (size_t)(end - data) < (size_t)entries * 9)
+        return 0;
+
+    for (uint8_t i = 0; i < entries; ++i)
+    {
+        put(opaque, player, batch_read32(&data[curr]), batch_read32(&data[curr + 4]), data[curr + 8]);
+        curr += 9;
+    }
+    return curr;
+}
+
+void netplay_batch_decode(const uint8_t* data, const uint8_t* end, uint8_t lag[4],
+                          netplay_key_info_fn put, void* opaque)
+{
+    size_t curr = 1, used;
+
+    if (data >= end)
+        return;
+
+    for (uint8_t block = 0; block < data[0] && data + curr + 3 <= end; ++block)
+    {
+        uint8_t player = data[curr];
+
+        if (player >= 4)
+            break;
+        lag[player] = data[curr + 1];
+        used = netplay_batch_decode_key_info(player, data[curr + 2], &data[curr + 3], end, put, opaque);
+        if (used == 0 && data[curr + 2] != 0)
+            break;
+        curr += 3 + used;
+    }
+}
@@ -0,0 +1,79 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - netplay_batch.h                                         *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef M64P_MAIN_NETPLAY_BATCH_H
+#define M64P_MAIN_NETPLAY_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Batched input messages.
+ *
+ * The sender records each local input and sends every controller's input
+ * of one PIF round in one message, each with the inputs of up to
+ * NETPLAY_BATCH_MAX_FRAMES - 1 earlier counts, so that a lost message is
+ * covered by the next one:
+ *   [blocks] then per block [control_id][newest count][frames]
+ *   [frames * (keys, plugin)], newest first.
+ * The server answers with the key info of every player:
+ *   [blocks] then per block [player][lag][entries]
+ *   [entries * (count, keys, plugin)].
+ * Both leave out the message type, and the answer its status byte, which
+ * the caller handles. Values are big endian. */
+#define NETPLAY_BATCH_MAX_FRAMES 8
+#define NETPLAY_BATCH_MAX_SIZE (1 + 4 * (6 + NETPLAY_BATCH_MAX_FRAMES * 5))
+
+struct netplay_batch {
+    struct {
+        uint32_t buttons;
+        uint8_t plugin;
+    } sent[4][NETPLAY_BATCH_MAX_FRAMES];
+    uint32_t count[4];          /* count of the newest input in sent */
+    uint8_t frames[4];
+    uint8_t pending;            /* bitmask of controllers with new input */
+    uint8_t redundancy;         /* frames sent per controller, 0 when off */
+};
+
+/* called for each decoded (count, keys, plugin) record of player */
+typedef void (*netplay_key_info_fn)(void* opaque, uint8_t player, uint32_t count, uint32_t keys, uint8_t plugin);
+
+/* forgets the recorded inputs; redundancy is clamped to
+ * NETPLAY_BATCH_MAX_FRAMES */
+void netplay_batch_reset(struct netplay_batch* batch, uint32_t redundancy);
+
+/* records the local input of count for the next message */
+void netplay_batch_put(struct netplay_batch* batch, uint8_t control_id, uint32_t count,
+                       uint32_t keys, uint8_t plugin);
+
+/* writes the message for the inputs recorded since the last one, at most
+ * NETPLAY_BATCH_MAX_SIZE bytes. Returns its size, 0 if nothing is new */
+size_t netplay_batch_encode(struct netplay_batch* batch, uint8_t* data);
+
+/* decodes entries records of player. Returns the number of bytes they
+ * take, or 0 if they would run past end */
+size_t netplay_batch_decode_key_info(uint8_t player, uint8_t entries, const uint8_t* data,
+                                     const uint8_t* end, netplay_key_info_fn put, void* opaque);
+
+/* decodes a batched answer and stores each block's lag in lag[player];
+ * stops at the first block which is invalid or runs past end */
+void netplay_batch_decode(const uint8_t* data, const uint8_t* end, uint8_t lag[4],
+                          netplay_key_info_fn put, void* opaque);
+
+#endif
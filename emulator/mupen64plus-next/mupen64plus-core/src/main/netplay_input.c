@@ -0,0 +1,63 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - netplay_input.c                                         *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#include "netplay_input.h"
+
+#include <stddef.h>
+
+void netplay_input_reset(struct netplay_input_ring* ring)
+{
+    /* a count that maps to the slot but will not be seen for 2^31 frames */
+    for (int i = 0; i < 4; ++i) {
+        for (uint32_t j = 0; j < NETPLAY_INPUT_RING_SIZE; ++j) {
+            struct netplay_input_slot* slot = &ring->slots[i][j];
+            __atomic_store_n(&slot->count, j ^ 0x80000000, __ATOMIC_RELEASE);
+            slot->used = j ^ 0x80000000;
+            slot->predicted = 0;
+        }
+    }
+}
+
+int netplay_input_put(struct netplay_input_ring* ring, uint8_t control_id, uint32_t count,
+                      uint32_t keys, uint8_t plugin, uint32_t next)
+{
+    struct netplay_input_slot* slot = netplay_input_slot(ring, control_id, count);
+
+    if (count - (next - NETPLAY_INPUT_AHEAD) >= NETPLAY_INPUT_RING_SIZE
+     || __atomic_load_n(&slot->count, __ATOMIC_RELAXED) == count)
+        return 0;
+
+    slot->buttons = keys;
+    slot->plugin = plugin;
+    __atomic_store_n(&slot->count, count, __ATOMIC_RELEASE);
+    return 1;
+}
+
+struct netplay_input_slot* netplay_input_get(struct netplay_input_ring* ring, uint8_t control_id, uint32_t count)
+{
+    struct netplay_input_slot* slot = netplay_input_slot(ring, control_id, count);
+    return (__atomic_load_n(&slot->count, __ATOMIC_ACQUIRE) == count) ? slot : NULL;
+}
+
+struct netplay_input_slot* netplay_input_slot(struct netplay_input_ring* ring, uint8_t control_id, uint32_t count)
+{
+    return &ring->slots[control_id][count & (NETPLAY_INPUT_RING_SIZE - 1)];
+}
@@ -0,0 +1,74 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - netplay_input.h                                         *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef M64P_MAIN_NETPLAY_INPUT_H
+#define M64P_MAIN_NETPLAY_INPUT_H
+
+#include <stdint.h>
+
+/* Received input, one power-of-two ring per controller indexed by count.
+ * The receiving side fills a slot and then publishes its count; the
+ * emulation side only trusts a slot whose published count matches, so
+ * the two sides need no lock.
+ *
+ * Counts are accepted in [next - NETPLAY_INPUT_AHEAD, next +
+ * NETPLAY_INPUT_AHEAD), next being the first count the emulation has not
+ * consumed. Storing count overwrites count - NETPLAY_INPUT_RING_SIZE, which
+ * is then more than NETPLAY_INPUT_AHEAD counts behind: the inputs which are
+ * not consumed yet are kept, and so are the last consumed ones, which
+ * rollback re-simulates from. The emulation side fields are the rollback
+ * predictions and are never touched by the receiving side. */
+#define NETPLAY_INPUT_RING_SIZE 256 /* must be a power of two */
+#define NETPLAY_INPUT_AHEAD (NETPLAY_INPUT_RING_SIZE / 2)
+
+struct netplay_input_slot {
+    uint32_t count;             /* published last */
+    uint32_t buttons;
+    uint8_t plugin;
+
+    /* emulation side only */
+    uint8_t predicted;          /* used was consumed from the prediction */
+    uint8_t predicted_plugin;
+    uint32_t predicted_buttons;
+    uint32_t used;              /* last count consumed from the slot */
+    uint32_t vi;                /* VI it was consumed in */
+};
+
+struct netplay_input_ring {
+    struct netplay_input_slot slots[4][NETPLAY_INPUT_RING_SIZE];
+};
+
+/* empties the ring; neither side may use it meanwhile */
+void netplay_input_reset(struct netplay_input_ring* ring);
+
+/* receiving side: stores an input unless it is already there or outside
+ * the window around next. Returns 1 if it was stored */
+int netplay_input_put(struct netplay_input_ring* ring, uint8_t control_id, uint32_t count,
+                      uint32_t keys, uint8_t plugin, uint32_t next);
+
+/* emulation side: the slot holding the received input of count, or NULL
+ * if it has not arrived */
+struct netplay_input_slot* netplay_input_get(struct netplay_input_ring* ring, uint8_t control_id, uint32_t count);
+
+/* emulation side: the slot count maps to, whether it arrived or not */
+struct netplay_input_slot* netplay_input_slot(struct netplay_input_ring* ring, uint8_t control_id, uint32_t count);
+
+#endif
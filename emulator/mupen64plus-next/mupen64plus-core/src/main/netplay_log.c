@@ -0,0 +1,220 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - netplay_log.c                                           *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "netplay_log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t log_read32(const uint8_t* b)
+{
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+static void log_write32(uint32_t v, uint8_t* b)
+{
+    b[0] = (uint8_t)(v >> 24);
+    b[1] = (uint8_t)(v >> 16);
+    b[2] = (uint8_t)(v >> 8);
+    b[3] = (uint8_t)v;
+}
+
+int netplay_log_reserve(uint8_t** buf, size_t* cap, size_t len)
+{
+    size_t new_cap = *cap ? *cap : 4096;
+    uint8_t* new_buf;
+
+    if (len <= *cap)
+        return 1;
+    while (new_cap < len)
+        new_cap *= 2;
+    if ((new_buf = realloc(*buf, new_cap)) == NULL)
+        return 0;
+    *buf = new_buf;
+    *cap = new_cap;
+    return 1;
+}
+
+void netplay_log_reset(struct netplay_log* log)
+{
+    memset(log->last, 0, sizeof(log->last));
+    log->len = 0;
+}
+
+void netplay_log_free(struct netplay_log* log)
+{
+    free(log->buf);
+    memset(log, 0, sizeof(*log));
+}
+
+uint8_t* netplay_log_write_record(struct netplay_log* log, uint8_t type, size_t size)
+{
+    uint8_t* record;
+
+    if (!netplay_log_reserve(&log->buf, &log->cap, log->len + 1 + size))
+        return NULL;
+    record = &log->buf[log->len];
+    record[0] = type;
+    log->len += 1 + size;
+    return &record[1];
+}
+
+int netplay_log_write_input(struct netplay_log* log, uint8_t control_id, uint32_t count,
+                            uint32_t keys, uint8_t plugin)
+{
+    struct netplay_log_input* last = &log->last[control_id];
+    uint8_t* record;
+
+    if (last->valid && count == last->count + 1 && keys == last->keys && plugin == last->plugin) {
+        if ((record = netplay_log_write_record(log, NETPLAY_LOG_REPEAT, 1)) == NULL)
+            return 0;
+        record[0] = control_id;
+    } else {
+        if ((record = netplay_log_write_record(log, NETPLAY_LOG_INPUT, 10)) == NULL)
+            return 0;
+        record[0] = control_id;
+        log_write32(count, &record[1]);
+        log_write32(keys, &record[5]);
+        record[9] = plugin;
+    }
+    last->count = count;
+    last->keys = keys;
+    last->plugin = plugin;
+    last->valid = 1;
+    return 1;
+}
+
+int netplay_log_write_keyframe(struct netplay_log* log, uint32_t vi, const uint32_t netplay_count[4],
+                               const uint8_t* data, uint32_t size)
+{
+    uint8_t* record = netplay_log_write_record(log, NETPLAY_LOG_KEYFRAME, 24 + (size_t)size);
+
+    if (record == NULL)
+        return 0;
+    log_write32(vi, &record[0]);
+    for (int i = 0; i < 4; ++i)
+        log_write32(netplay_count[i], &record[4 + i * 4]);
+    log_write32(size, &record[20]);
+    memcpy(&record[24], data, size);
+
+    /* a spectator joining here has not seen what a REPEAT would refer to */
+    memset(log->last, 0, sizeof(log->last));
+    return 1;
+}
+
+int netplay_log_write_vi(struct netplay_log* log, uint32_t vi)
+{
+    uint8_t* record = netplay_log_write_record(log, NETPLAY_LOG_VI, 4);
+
+    if (record == NULL)
+        return 0;
+    log_write32(vi, record);
+    return 1;
+}
+
+size_t netplay_log_read_record(struct netplay_log_reader* reader, const uint8_t* data, size_t len)
+{
+    struct netplay_log_input* last;
+    uint32_t settings[NETPLAY_LOG_SETTINGS_COUNT];
+    uint32_t netplay_count[4];
+    uint32_t count, keys;
+    size_t ext_len, size;
+
+    if (len == 0)
+        return 0;
+
+    switch (data[0]) {
+        case NETPLAY_LOG_SETTINGS:
+            if (len < 1 + NETPLAY_LOG_SETTINGS_COUNT * 4)
+                return 0;
+            for (int i = 0; i < NETPLAY_LOG_SETTINGS_COUNT; ++i)
+                settings[i] = log_read32(&data[1 + i * 4]);
+            reader->settings(reader->opaque, settings);
+            return 1 + NETPLAY_LOG_SETTINGS_COUNT * 4;
+
+        case NETPLAY_LOG_STORAGE:
+            ext_len = strnlen((const char*)&data[1], len - 1);
+            if (ext_len + 6 > len)
+                return 0;
+            size = log_read32(&data[ext_len + 2]);
+            if (ext_len + 6 + size > len)
+                return 0;
+            if (!reader->storage(reader->opaque, (const char*)&data[1], &data[ext_len + 6], (uint32_t)size))
+                return 0;
+            return ext_len + 6 + size;
+
+        case NETPLAY_LOG_CONTROLLERS:
+            if (len < 13)
+                return 0;
+            reader->controllers(reader->opaque, &data[1]);
+            return 13;
+
+        case NETPLAY_LOG_INPUT:
+            if (len < 2)
+                return 0;
+            if (data[1] >= 4)
+                return NETPLAY_LOG_INVALID;
+            if (len < 11)
+                return 0;
+            last = &reader->last[data[1]];
+            count = log_read32(&data[2]);
+            keys = log_read32(&data[6]);
+            if (!reader->input(reader->opaque, data[1], count, keys, data[10]))
+                return 0;
+            last->count = count;
+            last->keys = keys;
+            last->plugin = data[10];
+            last->valid = 1;
+            return 11;
+
+        case NETPLAY_LOG_REPEAT:
+            if (len < 2)
+                return 0;
+            if (data[1] >= 4)
+                return NETPLAY_LOG_INVALID;
+            last = &reader->last[data[1]];
+            if (last->valid) {
+                if (!reader->input(reader->opaque, data[1], last->count + 1, last->keys, last->plugin))
+                    return 0;
+                ++last->count;
+            }
+            return 2;
+
+        case NETPLAY_LOG_VI:
+            if (len < 5)
+                return 0;
+            reader->vi(reader->opaque, log_read32(&data[1]));
+            return 5;
+
+        case NETPLAY_LOG_KEYFRAME:
+            if (len < 25)
+                return 0;
+            size = log_read32(&data[21]);
+            if (len - 25 < size)
+                return 0;
+            for (int i = 0; i < 4; ++i)
+                netplay_count[i] = log_read32(&data[5 + i * 4]);
+            reader->keyframe(reader->opaque, log_read32(&data[1]), netplay_count, &data[25], (uint32_t)size);
+            return 25 + size;
+
+        default:
+            return NETPLAY_LOG_INVALID;
+    }
+}
@@ -0,0 +1,107 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - netplay_log.h                                           *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef M64P_MAIN_NETPLAY_LOG_H
+#define M64P_MAIN_NETPLAY_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Spectator input log: the settings, save data, controllers and every
+ * confirmed input of a session as a byte stream, which spectators replay
+ * instead of talking to the server. Records start with their type:
+ *   SETTINGS     [6 * u32] as exchanged by netplay_sync_settings
+ *   STORAGE      [extension\0][size u32][size bytes]
+ *   CONTROLLERS  [4 * (present, plugin, raw data)]
+ *   INPUT        [control_id][count u32][keys u32][plugin]
+ *   REPEAT       [control_id], the next count with the same keys and plugin
+ *   VI           [vi u32]
+ *   KEYFRAME     [vi u32][4 * count u32][size u32][m64p savestate]
+ * Values are big endian. A stream made of the header records, a keyframe
+ * and the records after it lets a spectator join late: the keyframe is
+ * loaded before any input. */
+#define NETPLAY_LOG_SETTINGS 0
+#define NETPLAY_LOG_STORAGE 1
+#define NETPLAY_LOG_CONTROLLERS 2
+#define NETPLAY_LOG_INPUT 3
+#define NETPLAY_LOG_REPEAT 4
+#define NETPLAY_LOG_VI 5
+#define NETPLAY_LOG_KEYFRAME 6
+
+#define NETPLAY_LOG_SETTINGS_COUNT 6
+
+/* returned by netplay_log_read_record for a record that cannot be parsed */
+#define NETPLAY_LOG_INVALID SIZE_MAX
+
+struct netplay_log_input {
+    uint32_t count;
+    uint32_t keys;
+    uint8_t plugin;
+    uint8_t valid;
+};
+
+/* records written since the last flush, which sets len back to 0 */
+struct netplay_log {
+    uint8_t* buf;
+    size_t len;
+    size_t cap;
+    struct netplay_log_input last[4];
+};
+
+/* what a reader does with each record; storage and input return 0 to stop
+ * before the record, which is then parsed again by the next call */
+struct netplay_log_reader {
+    void* opaque;
+    void (*settings)(void* opaque, const uint32_t settings[NETPLAY_LOG_SETTINGS_COUNT]);
+    int (*storage)(void* opaque, const char* extension, const uint8_t* data, uint32_t size);
+    void (*controllers)(void* opaque, const uint8_t controllers[12]);
+    int (*input)(void* opaque, uint8_t control_id, uint32_t count, uint32_t keys, uint8_t plugin);
+    void (*vi)(void* opaque, uint32_t vi);
+    void (*keyframe)(void* opaque, uint32_t vi, const uint32_t netplay_count[4], const uint8_t* data, uint32_t size);
+
+    struct netplay_log_input last[4];
+};
+
+/* grows *buf to hold at least len bytes. Returns 0 if it cannot */
+int netplay_log_reserve(uint8_t** buf, size_t* cap, size_t len);
+
+/* forgets the inputs a REPEAT refers to, for a new stream */
+void netplay_log_reset(struct netplay_log* log);
+void netplay_log_free(struct netplay_log* log);
+
+/* appends a record of type with size bytes of payload and returns the
+ * payload, or NULL if there is no memory for it */
+uint8_t* netplay_log_write_record(struct netplay_log* log, uint8_t type, size_t size);
+
+/* these return 0 if there is no memory for the record. The inputs after a
+ * keyframe are written in full, and the writer has to write again the
+ * inputs it wrote before the keyframe that are consumed after it */
+int netplay_log_write_input(struct netplay_log* log, uint8_t control_id, uint32_t count,
+                            uint32_t keys, uint8_t plugin);
+int netplay_log_write_keyframe(struct netplay_log* log, uint32_t vi, const uint32_t netplay_count[4],
+                               const uint8_t* data, uint32_t size);
+int netplay_log_write_vi(struct netplay_log* log, uint32_t vi);
+
+/* parses the record at data, of at most len bytes, and hands it to the
+ * reader. Returns its size, 0 if it is incomplete or the reader stopped,
+ * or NETPLAY_LOG_INVALID */
+size_t netplay_log_read_record(struct netplay_log_reader* reader, const uint8_t* data, size_t len);
+
+#endif
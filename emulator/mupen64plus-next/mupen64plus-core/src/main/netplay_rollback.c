@@ -0,0 +1,167 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - netplay_rollback.c                                      *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "netplay_rollback.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int netplay_rollback_init(struct netplay_rollback* rb, struct netplay_input_ring* ring, uint32_t frames,
+                          size_t image_size, const uint32_t netplay_count[4])
+{
+    memset(rb, 0, sizeof(*rb));
+    rb->ring = ring;
+    for (int i = 0; i < 4; ++i)
+        rb->confirmed_count[i] = netplay_count[i];
+
+    if (frames > NETPLAY_ROLLBACK_MAX_FRAMES)
+        frames = NETPLAY_ROLLBACK_MAX_FRAMES;
+    if (frames == 0)
+        return 1;
+
+    for (int i = 0; i < 2; ++i) {
+        /* zero filled past the image, like every m64p image */
+        rb->base[i] = calloc(1, image_size);
+        rb->base_block[i] = UINT32_MAX;
+        if (rb->base[i] == NULL) {
+            netplay_rollback_free(rb);
+            return 0;
+        }
+    }
+
+    rb->frames = (uint8_t)frames;
+    return 1;
+}
+
+void netplay_rollback_free(struct netplay_rollback* rb)
+{
+    for (int i = 0; i <= NETPLAY_ROLLBACK_MAX_FRAMES; ++i) {
+        free(rb->snapshots[i].state.delta);
+        memset(&rb->snapshots[i], 0, sizeof(rb->snapshots[i]));
+    }
+    for (int i = 0; i < 2; ++i) {
+        savestates_snapshot_free_base(rb->base[i]);
+        free(rb->base[i]);
+        rb->base[i] = NULL;
+    }
+    rb->frames = 0;
+    rb->pending = 0;
+    rb->resimulating = 0;
+}
+
+const struct netplay_input_slot* netplay_rollback_confirm(struct netplay_rollback* rb, uint8_t control_id)
+{
+    uint32_t count = rb->confirmed_count[control_id];
+    struct netplay_input_slot* slot = netplay_input_get(rb->ring, control_id, count);
+
+    if (slot == NULL)
+        return NULL;
+
+    if (slot->predicted && slot->used == count) {
+        if (slot->predicted_buttons != slot->buttons || slot->predicted_plugin != slot->plugin) {
+            if (!rb->pending || (int32_t)(slot->vi - rb->rollback_vi) < 0)
+                rb->rollback_vi = slot->vi;
+            rb->pending = 1;
+        }
+        slot->predicted = 0;
+    }
+
+    ++rb->confirmed_count[control_id];
+    return slot;
+}
+
+int netplay_rollback_behind(const struct netplay_rollback* rb, uint8_t control_id, uint32_t count, uint32_t vi)
+{
+    uint32_t oldest = rb->confirmed_count[control_id];
+    uint32_t pending = count - oldest;
+    const struct netplay_input_slot* slot = netplay_input_slot(rb->ring, control_id, oldest);
+
+    if (pending == 0 || pending > UINT32_MAX / 2)
+        return 0;
+    /* past this the ring could overwrite the predictions */
+    if (pending >= NETPLAY_INPUT_AHEAD)
+        return 1;
+    return slot->predicted && slot->used == oldest && (vi - slot->vi) > rb->frames;
+}
+
+uint32_t netplay_rollback_input(struct netplay_rollback* rb, uint8_t control_id, uint32_t count,
+                                uint32_t vi, uint8_t* plugin)
+{
+    struct netplay_input_slot* slot = netplay_input_slot(rb->ring, control_id, count);
+
+    slot->used = count;
+    slot->vi = vi;
+
+    if (netplay_input_get(rb->ring, control_id, count) == NULL) {
+        const struct netplay_input_slot* last = netplay_input_get(rb->ring, control_id, rb->confirmed_count[control_id] - 1);
+
+        slot->predicted_buttons = (last != NULL) ? last->buttons : 0;
+        slot->predicted_plugin = (last != NULL) ? last->plugin : *plugin;
+        slot->predicted = 1;
+        *plugin = slot->predicted_plugin;
+        return slot->predicted_buttons;
+    }
+
+    /* received, but only confirmed once every count before it is */
+    slot->predicted = 0;
+    *plugin = slot->plugin;
+    return slot->buttons;
+}
+
+struct netplay_snapshot* netplay_rollback_start(struct netplay_rollback* rb, uint32_t vi)
+{
+    struct netplay_snapshot* target = netplay_rollback_find(rb, rb->rollback_vi);
+
+    rb->pending = 0;
+    if (target != NULL) {
+        rb->resim_target = vi;
+        rb->resimulating = 1;
+        ++rb->total;
+    }
+    return target;
+}
+
+struct netplay_snapshot* netplay_rollback_snapshot(struct netplay_rollback* rb, uint32_t vi,
+                                                   const uint32_t netplay_count[4], int* rebase)
+{
+    uint32_t period = rb->frames + 1;
+    uint32_t block = vi / period;
+    struct netplay_snapshot* snap = &rb->snapshots[vi % period];
+
+    /* also rebase when the first VI of the block had no snapshot */
+    *rebase = (vi % period == 0) || rb->base_block[block & 1] != block;
+    rb->base_block[block & 1] = block;
+
+    snap->state.base = rb->base[block & 1];
+    snap->state.valid = 0;  /* until the save has run */
+    snap->vi = vi;
+    memcpy(snap->netplay_count, netplay_count, sizeof(snap->netplay_count));
+    return snap;
+}
+
+struct netplay_snapshot* netplay_rollback_find(struct netplay_rollback* rb, uint32_t vi)
+{
+    struct netplay_snapshot* snap;
+
+    if (rb->frames == 0)
+        return NULL;
+    snap = &rb->snapshots[vi % (rb->frames + 1)];
+    return (snap->state.valid && snap->vi == vi) ? snap : NULL;
+}
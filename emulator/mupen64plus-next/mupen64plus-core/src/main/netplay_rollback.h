@@ -0,0 +1,95 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - netplay_rollback.h                                      *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef M64P_MAIN_NETPLAY_ROLLBACK_H
+#define M64P_MAIN_NETPLAY_ROLLBACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "netplay_input.h"
+#include "savestates_delta.h"
+
+/* Rollback netplay: remote input that has not arrived yet is predicted
+ * from the last confirmed input, every VI is snapshotted, and an input
+ * confirmed differently from its prediction rewinds to the snapshot of
+ * the VI it was consumed in and re-simulates up to the present. The
+ * predictions are kept next to the received input, in the input ring.
+ *
+ * Snapshots are deltas against one of two base images. The VIs are cut
+ * in blocks of frames + 1; the first snapshot of a block is a full image
+ * in the base of the block's parity, the others are deltas against it.
+ * A base is only rewritten two blocks after it was taken, when no
+ * snapshot in the window refers to it any more. */
+#define NETPLAY_ROLLBACK_MAX_FRAMES 8
+
+struct netplay_snapshot {
+    struct savestate_snapshot state;
+    uint32_t vi;
+    uint32_t netplay_count[4];
+};
+
+struct netplay_rollback {
+    uint8_t frames;     /* 0 when rollback is off */
+    struct netplay_input_ring* ring;
+    uint32_t confirmed_count[4]; /* every count below this one is confirmed */
+    int pending;
+    uint32_t rollback_vi;
+    uint32_t resim_target;
+    int resimulating;
+    uint32_t total;
+    char* base[2];
+    uint32_t base_block[2];      /* block each base was taken for */
+    struct netplay_snapshot snapshots[NETPLAY_ROLLBACK_MAX_FRAMES + 1];
+};
+
+/* allocates the bases of image_size bytes; returns 0 and leaves rollback
+ * off when the memory is not available */
+int netplay_rollback_init(struct netplay_rollback* rb, struct netplay_input_ring* ring, uint32_t frames,
+                          size_t image_size, const uint32_t netplay_count[4]);
+void netplay_rollback_free(struct netplay_rollback* rb);
+
+/* confirms the received input which extends the confirmed run, and
+ * schedules a rollback to the VI it was consumed in if it had been
+ * predicted differently. Returns its slot, or NULL if it has not arrived */
+const struct netplay_input_slot* netplay_rollback_confirm(struct netplay_rollback* rb, uint8_t control_id);
+
+/* true when the oldest unconfirmed input before count was predicted
+ * further back than the snapshots reach, or the ring is about to wrap */
+int netplay_rollback_behind(const struct netplay_rollback* rb, uint8_t control_id, uint32_t count, uint32_t vi);
+
+/* consumes the input of count in vi, predicting it from the last
+ * confirmed input when it has not been confirmed yet. *plugin holds the
+ * plugin to predict without a confirmed input and receives the input's */
+uint32_t netplay_rollback_input(struct netplay_rollback* rb, uint8_t control_id, uint32_t count,
+                                uint32_t vi, uint8_t* plugin);
+
+/* takes the pending rollback: the snapshot to load, after which the VIs up
+ * to vi are re-simulated, or NULL when it has left the window */
+struct netplay_snapshot* netplay_rollback_start(struct netplay_rollback* rb, uint32_t vi);
+
+/* the snapshot to save at vi; rebase tells whether it is a full image */
+struct netplay_snapshot* netplay_rollback_snapshot(struct netplay_rollback* rb, uint32_t vi,
+                                                   const uint32_t netplay_count[4], int* rebase);
+
+/* the snapshot taken at vi, or NULL */
+struct netplay_snapshot* netplay_rollback_find(struct netplay_rollback* rb, uint32_t vi);
+
+#endif
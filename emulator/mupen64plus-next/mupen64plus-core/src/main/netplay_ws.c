@@ -38,7 +38,18 @@
 #include "plugin/plugin.h"
 #include "backends/plugins_compat/plugins_compat.h"
 #include "netplay.h"
+#include "netplay_batch.h"
+#include "netplay_input.h"
+#include "netplay_log.h"
+#include "netplay_rollback.h"
+#include "rdram_digest.h"
+#include "savestates.h"
 #include "custom/libretro_private.h"
+#include "device/device.h"
+#include "device/r4300/interrupt.h"
+
+#define XXH_INLINE_ALL
+#include <xxhash.h>
 
 #include <mupen64plus-next_common.h>
 
@@ -143,12 +154,124 @@ static uint8_t l_plugin[4];
 static uint8_t l_buffer_target;
 static uint8_t l_player_lag[4];
 
+/* rollback mode, see netplay_rollback.h */
+static struct netplay_rollback l_rollback;
+
+/* received input and, in rollback mode, the predictions, see netplay_input.h */
+static struct netplay_input_ring l_input;
+
+#define netplay_load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define netplay_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* packets are received and decoded into l_input by a dedicated thread when
+ * one could be started; the emulation thread only sleeps on l_receive_cond
+ * while it waits for a count, until that count arrives or a 5 ms request
+ * deadline passes. Without the thread it polls the socket itself. */
+#define NETPLAY_STALL_REPORT 600 /* VIs between stall reports */
+
+static SDL_Thread* l_receive_thread;
+static SDL_mutex* l_receive_lock;
+static SDL_cond* l_receive_cond;
+static void* l_receive_packet;
+static int l_receive_quit;
+static int l_wait_control = -1;    /* controller the emulation thread sleeps on */
+static uint32_t l_wait_count;
+
+/* time the emulation thread spent waiting for input */
+static uint32_t l_stall_frame;     /* ms in the current VI */
+static uint32_t l_stall_total;     /* ms since the last report */
+static uint32_t l_stall_worst;
+static uint32_t l_stalled_frames;
+
+/* batched input: one message per frame carries every local controller's
+ * input for the last l_batch.redundancy counts, and one request covers
+ * all remote controllers; 0 keeps one packet per controller per frame */
+static struct netplay_batch l_batch;
+
+/* desync detection: every NetplayDesyncCheck VIs the state is reduced to
+ * NETPLAY_DIGEST_COUNT hashes (RDRAM in regions, RSP memory, interrupt
+ * queue, PIF RAM) and sent to the server, which relays the digests of the
+ * other players. Every RDRAM page keeps its last hash and only the pages
+ * written since the previous digest are hashed again, unless the writes
+ * could not be tracked. */
+#define NETPLAY_DIGEST_REGIONS 32
+#define NETPLAY_DIGEST_SP_MEM (NETPLAY_DIGEST_REGIONS + 0)
+#define NETPLAY_DIGEST_QUEUE (NETPLAY_DIGEST_REGIONS + 1)
+#define NETPLAY_DIGEST_PIF_RAM (NETPLAY_DIGEST_REGIONS + 2)
+#define NETPLAY_DIGEST_COUNT (NETPLAY_DIGEST_REGIONS + 3)
+#define NETPLAY_DIGEST_HISTORY 64 /* must be a power of two */
+#define NETPLAY_DIGEST_NONE UINT32_MAX
+
+struct netplay_digest {
+    uint32_t vi;        /* remote digests publish it last */
+    uint8_t player;
+    uint8_t checked;
+    uint64_t hash[NETPLAY_DIGEST_COUNT];
+};
+
+static struct rdram_digest l_rdram_digest;
+static struct netplay_digest l_local_digest[NETPLAY_DIGEST_HISTORY];
+static struct netplay_digest l_remote_digest[NETPLAY_DIGEST_HISTORY];
+static int l_desync_found;
+
+/* spectator log: a player can record the session into a byte stream,
+ * handed to a writer once per VI, which spectators replay instead of
+ * talking to the server, see netplay_log.h */
+#define NETPLAY_LOG_TIMEOUT 10000 /* ms a spectator waits for the stream */
+
+struct netplay_log_storage {
+    char* extension;   /* one allocation with data */
+    uint32_t size;
+    uint8_t* data;
+};
+
+struct netplay_keyframe {
+    uint8_t* data;
+    uint32_t vi;
+    uint32_t netplay_count[4];
+};
+
+/* recording */
+static netplay_log_writer l_log_writer;
+static void* l_log_opaque;
+static struct netplay_log l_log;
+static uint32_t l_keyframe_interval;
+static struct netplay_keyframe l_keyframe;
+static struct savestate_snapshot l_keyframe_snap;  /* delay mode saves l_keyframe.data through it */
+static int l_keyframe_pending;     /* the snapshot save of l_keyframe is queued */
+
+/* replaying; the fed bytes are shared with the frontend thread */
+static int l_replaying;
+static SDL_mutex* l_replay_lock;
+static uint8_t* l_replay_buf;
+static size_t l_replay_len;
+static size_t l_replay_cap;
+static size_t l_replay_pos;
+static int l_replay_inputs;        /* an input record has been parsed */
+static int l_replay_have_settings;
+static uint32_t l_replay_settings[6];
+static int l_replay_have_controllers;
+static uint8_t l_replay_controllers[4][3];
+static struct netplay_log_storage* l_replay_storage;
+static int l_replay_storage_count;
+static int l_replay_storage_cap;
+static int l_replay_storage_next;
+static struct netplay_keyframe l_replay_seed;
+static int l_replay_seeded;        /* the seed's load job has been queued */
+static int l_replay_started;       /* a record past the header was parsed */
+static struct netplay_log_reader l_replay_reader;
+
 /* packet / protocol codes (same as upstream) */
 #define UDP_SEND_KEY_INFO 0
 #define UDP_RECEIVE_KEY_INFO 1
 #define UDP_REQUEST_KEY_INFO 2
 #define UDP_RECEIVE_KEY_INFO_GRATUITOUS 3
 #define UDP_SYNC_DATA 4
+#define UDP_SEND_KEY_INFO_BATCH 5
+#define UDP_RECEIVE_KEY_INFO_BATCH 6
+#define UDP_REQUEST_KEY_INFO_BATCH 7
+#define UDP_SYNC_DIGEST 8
+#define UDP_RECEIVE_SYNC_DIGEST 9
 
 #define TCP_SEND_SAVE 1
 #define TCP_RECEIVE_SAVE 2
@@ -158,15 +281,35 @@ static uint8_t l_player_lag[4];
 #define TCP_GET_REGISTRATION 6
 #define TCP_DISCONNECT_NOTICE 7
 
+/* first count the emulation thread has not consumed yet */
+static uint32_t netplay_next_count(uint8_t control_id)
+{
+    return netplay_load_acquire(&l_cin_compats[control_id].netplay_count);
+}
+
+/* receiving side: store an input unless it is stale, too far ahead or
+ * already there */
+static int netplay_ring_put(uint8_t control_id, uint32_t count, uint32_t keys, uint8_t plugin)
+{
+    return netplay_input_put(&l_input, control_id, count, keys, plugin, netplay_next_count(control_id));
+}
+
+/* emulation side: the slot holding count, or NULL if it has not arrived */
+static const struct netplay_input_slot* netplay_ring_get(uint8_t control_id, uint32_t count)
+{
+    return netplay_input_get(&l_input, control_id, count);
+}
+
 /* helper to compute local buffer size */
 static uint8_t buffer_size(uint8_t control_id)
 {
     uint8_t counter = 0;
-    struct netplay_event* current = l_cin_compats[control_id].event_first;
-    while (current != NULL) {
-        current = current->next;
-        ++counter;
+    if (l_rollback.frames > 0) {
+        uint32_t ahead = l_rollback.confirmed_count[control_id] - l_cin_compats[control_id].netplay_count;
+        return (ahead < NETPLAY_INPUT_AHEAD) ? (uint8_t)ahead : 0;
     }
+    while (counter < UINT8_MAX && netplay_ring_get(control_id, l_cin_compats[control_id].netplay_count + counter) != NULL)
+        ++counter;
     return counter;
 }
 
@@ -187,8 +330,12 @@ static inline void net_write32(uint32_t v, uint8_t* b) { Write32(v, b); }
 
 /* forward declarations */
 static void netplay_request_input(uint8_t control_id);
+static void netplay_rollback_stop(void);
 static int netplay_ensure_valid(uint8_t control_id);
 static void netplay_process(void);
+static void netplay_stop_receive_thread(void);
+static void netplay_log_input(uint8_t control_id, uint32_t count, uint32_t keys, uint8_t plugin);
+static void netplay_replay_stop(void);
 
 /* start netplay, connecting to host:port */
 m64p_error netplay_start(const char* host, int port)
@@ -274,31 +421,24 @@ m64p_error netplay_start(const char* host, int port)
 /* stop netplay and clean up */
 m64p_error netplay_stop()
 {
+    if (l_replaying) {
+        netplay_replay_stop();
+        return M64ERR_SUCCESS;
+    }
     if (l_udpSocket == NULL)
         return M64ERR_INVALID_STATE;
 
-    if (l_cin_compats != NULL)
-    {
-        for (int i = 0; i < 4; ++i)
-        {
-            struct netplay_event* current = l_cin_compats[i].event_first;
-            struct netplay_event* next;
-            while (current != NULL)
-            {
-                next = current->next;
-                free(current);
-                current = next;
-            }
-        }
-    }
+    netplay_record_stop();
 
-    /* notify server of disconnect if possible */
+/* notify server of disconnect if possible */
     char output_data[5];
     output_data[0] = TCP_DISCONNECT_NOTICE;
     net_write32(l_reg_id, (uint8_t*)&output_data[1]);
     if (l_tcpSocket)
         TCP_Send(l_tcpSocket, &output_data[0], 5);
 
+    netplay_stop_receive_thread();
+
     /* unbind/close sockets */
     if (l_udpSocket) {
         UDP_Unbind(l_udpSocket, l_udpChannel);
@@ -310,6 +450,9 @@ m64p_error netplay_stop()
         l_tcpSocket = NULL;
     }
 
+    netplay_rollback_stop();
+    netplay_batch_reset(&l_batch, 0);
+
     l_udpChannel = -1;
     l_netplay_is_init = 0;
     NET_Quit();
@@ -318,6 +461,25 @@ m64p_error netplay_stop()
 
 int netplay_is_init() { return l_netplay_is_init; }
 
+/* release the rollback snapshots and go back to delay-based input */
+static void netplay_rollback_stop(void)
+{
+    if (l_rollback.total > 0)
+        log_cb(RETRO_LOG_INFO, "Netplay: %u rollbacks\n", l_rollback.total);
+    if (l_rollback.frames > 0)
+        savestates_set_snapshot_job(savestates_job_nothing, NULL, 0);
+    netplay_rollback_free(&l_rollback);
+}
+
+/* first count the server still has to send us; in rollback mode this is
+ * the oldest input that was predicted rather than the current one */
+static uint32_t requested_count(uint8_t control_id)
+{
+    if (l_rollback.frames > 0)
+        return l_rollback.confirmed_count[control_id];
+    return l_cin_compats[control_id].netplay_count;
+}
+
 /* request input for a given player via UDP request packet */
 static void netplay_request_input(uint8_t control_id)
 {
@@ -329,7 +491,7 @@ static void netplay_request_input(uint8_t control_id)
     ((uint8_t*)(((UDPpacket*)packet)->data))[0] = UDP_REQUEST_KEY_INFO;
     ((uint8_t*)(((UDPpacket*)packet)->data))[1] = control_id;
     net_write32(l_reg_id, &((uint8_t*)(((UDPpacket*)packet)->data))[2]);
-    net_write32(l_cin_compats[control_id].netplay_count, &((uint8_t*)(((UDPpacket*)packet)->data))[6]);
+    net_write32(requested_count(control_id), &((uint8_t*)(((UDPpacket*)packet)->data))[6]);
     ((uint8_t*)(((UDPpacket*)packet)->data))[10] = l_spectator;
     ((uint8_t*)(((UDPpacket*)packet)->data))[11] = buffer_size(control_id);
     ((UDPpacket*)packet)->len = 12;
@@ -339,7 +501,7 @@ static void netplay_request_input(uint8_t control_id)
     p->data[0] = UDP_REQUEST_KEY_INFO;
     p->data[1] = control_id;
     Write32(l_reg_id, &p->data[2]);
-    Write32(l_cin_compats[control_id].netplay_count, &p->data[6]);
+    Write32(requested_count(control_id), &p->data[6]);
     p->data[10] = l_spectator;
     p->data[11] = buffer_size(control_id);
     p->len = 12;
@@ -349,91 +511,125 @@ static void netplay_request_input(uint8_t control_id)
     free_packet(packet);
 }
 
+/* request input for every connected controller in one packet:
+ * [type][reg_id][spectator][blocks] then per block [control_id][count][buffer size] */
+static void netplay_request_input_batch(void)
+{
+    UDPpacket* p = (UDPpacket*)alloc_packet(7 + 4 * 6);
+    uint32_t curr = 7;
+    uint8_t blocks = 0;
+
+    if (!p) return;
+
+    p->data[0] = UDP_REQUEST_KEY_INFO_BATCH;
+    net_write32(l_reg_id, &p->data[1]);
+    p->data[5] = l_spectator;
+    for (uint8_t i = 0; i < 4; ++i)
+    {
+        if (!Controls[i].Present)
+            continue;
+        p->data[curr] = i;
+        net_write32(requested_count(i), &p->data[curr + 1]);
+        p->data[curr + 5] = buffer_size(i);
+        curr += 6;
+        ++blocks;
+    }
+    p->data[6] = blocks;
+    p->len = curr;
+    if (blocks > 0)
+        UDP_Send(l_udpSocket, l_udpChannel, p);
+
+    free_packet(p);
+}
+
 /* check whether an event count is already present in our local buffer */
 static int check_valid(uint8_t control_id, uint32_t count)
 {
-    struct netplay_event* current = l_cin_compats[control_id].event_first;
-    while (current != NULL) {
-        if (current->count == count) return 1;
-        current = current->next;
-    }
-    return 0;
+    return netplay_ring_get(control_id, count) != NULL;
 }
 
-/* thread helper used to request input until it arrives (or timeout) */
-static int netplay_require_response(void* opaque)
+/* confirm the received inputs that extend the confirmed run, which
+ * schedules a rollback if one had been predicted differently */
+static void netplay_rollback_drain(uint8_t control_id)
 {
-    uint8_t control_id = *(uint8_t*)opaque;
-    uint32_t timeout = SDL_GetTicks() + 10000;
-    while (!check_valid(control_id, l_cin_compats[control_id].netplay_count))
-    {
-        if (SDL_GetTicks() > timeout) {
-            l_udpChannel = -1;
-            return 0;
-        }
-        netplay_request_input(control_id);
-        SDL_Delay(5);
+    const struct netplay_input_slot* slot;
+
+    while ((slot = netplay_rollback_confirm(&l_rollback, control_id)) != NULL)
+        netplay_log_input(control_id, slot->count, slot->buttons, slot->plugin);
+}
+
+/* log de-syncs and disconnects announced by the server */
+static void netplay_process_status(uint8_t current_status)
+{
+    if (current_status == l_status)
+        return;
+
+    if (((current_status & 0x1) ^ (l_status & 0x1)) != 0)
+        log_cb(RETRO_LOG_INFO, "Netplay: players have de-synced at VI %u\n", l_vi_counter);
+    for (int dis = 1; dis < 5; ++dis) {
+        if (((current_status & (0x1 << dis)) ^ (l_status & (0x1 << dis))) != 0)
+            log_cb(RETRO_LOG_INFO, "Netplay: player %u has disconnected\n", dis);
     }
-    return 1;
+    l_status = current_status;
+}
+
+/* store a decoded (count, keys, plugin) record in l_input */
+static void netplay_process_key_info(void* opaque, uint8_t player, uint32_t count, uint32_t keys, uint8_t plugin)
+{
+    netplay_ring_put(player, count, keys, plugin);
+}
+
+/* store a digest relayed by the server; runs on the receive thread if
+ * there is one, the emulation thread only trusts a slot whose vi is the
+ * same before and after copying it */
+static void netplay_digest_receive(uint8_t player, uint32_t vi, const uint8_t* data)
+{
+    struct netplay_digest* digest = &l_remote_digest[vi & (NETPLAY_DIGEST_HISTORY - 1)];
+
+    if (vi == NETPLAY_DIGEST_NONE)
+        return;
+
+    netplay_store_release(&digest->vi, NETPLAY_DIGEST_NONE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    digest->player = player;
+    for (int i = 0; i < NETPLAY_DIGEST_COUNT; ++i)
+        digest->hash[i] = ((uint64_t)net_read32(&data[i * 8]) << 32) | net_read32(&data[i * 8 + 4]);
+    netplay_store_release(&digest->vi, vi);
 }
 
-/* process incoming UDP packets and insert into local event lists */
+/* decode every pending UDP packet into l_input; runs on the receive thread
+ * if there is one */
 static void netplay_process()
 {
-    void* packet = alloc_packet(512);
-    if (!packet) return;
+    void* packet = l_receive_packet;
+    if (!packet && !(packet = l_receive_packet = alloc_packet(512))) return;
 
     while (UDP_Recv(l_udpSocket, packet) == 1)
     {
-#if defined(__EMSCRIPTEN__)
-        uint8_t* data = (uint8_t*)(((UDPpacket*)packet)->data);
-        int datalen = ((UDPpacket*)packet)->len;
-#else
         uint8_t* data = ((UDPpacket*)packet)->data;
-        int datalen = ((UDPpacket*)packet)->len;
-#endif
-        uint32_t curr = 0;
-        uint32_t count, keys;
-        uint8_t player, plugin, current_status;
+        const uint8_t* end = data + ((UDPpacket*)packet)->len;
+        uint8_t player;
 
         switch (data[0]) {
             case UDP_RECEIVE_KEY_INFO:
             case UDP_RECEIVE_KEY_INFO_GRATUITOUS:
                 player = data[1];
-                current_status = data[2];
-                if (data[0] == UDP_RECEIVE_KEY_INFO)
+                if (player < 4 && data[0] == UDP_RECEIVE_KEY_INFO)
                     l_player_lag[player] = data[3];
+                netplay_process_status(data[2]);
+                netplay_batch_decode_key_info(player, data[4], &data[5], end, netplay_process_key_info, NULL);
+                break;
 
-                if (current_status != l_status) {
-                    if (((current_status & 0x1) ^ (l_status & 0x1)) != 0)
-                        log_cb(RETRO_LOG_INFO, "Netplay: players have de-synced at VI %u\n", l_vi_counter);
-                    for (int dis = 1; dis < 5; ++dis) {
-                        if (((current_status & (0x1 << dis)) ^ (l_status & (0x1 << dis))) != 0)
-                            log_cb(RETRO_LOG_INFO, "Netplay: player %u has disconnected\n", dis);
-                    }
-                    l_status = current_status;
-                }
+            /* [type][status] then the batch, see netplay_batch.h */
+            case UDP_RECEIVE_KEY_INFO_BATCH:
+                netplay_process_status(data[1]);
+                netplay_batch_decode(&data[2], end, l_player_lag, netplay_process_key_info, NULL);
+                break;
 
-                curr = 5;
-                for (uint8_t i = 0; i < data[4]; ++i)
-                {
-                    count = net_read32(&data[curr]); curr += 4;
-
-                    if (((count - l_cin_compats[player].netplay_count) > (UINT32_MAX / 2)) || (check_valid(player, count))) {
-                        curr += 5; /* skip */
-                        continue;
-                    }
-
-                    keys = net_read32(&data[curr]); curr += 4;
-                    plugin = data[curr]; curr += 1;
-
-                    struct netplay_event* new_event = (struct netplay_event*)malloc(sizeof(struct netplay_event));
-                    new_event->count = count;
-                    new_event->buttons = keys;
-                    new_event->plugin = plugin;
-                    new_event->next = l_cin_compats[player].event_first;
-                    l_cin_compats[player].event_first = new_event;
-                }
+            /* [type][player][vi][count][count * hash] */
+            case UDP_RECEIVE_SYNC_DIGEST:
+                if (data + 7 + NETPLAY_DIGEST_COUNT * 8 <= end && data[6] == NETPLAY_DIGEST_COUNT)
+                    netplay_digest_receive(data[1], net_read32(&data[2]), &data[7]);
                 break;
 
             default:
@@ -441,40 +637,552 @@ static void netplay_process()
                 break;
         }
     }
+}
 
-    free_packet(packet);
+/* wake the emulation thread if the count it waits for has arrived */
+static void netplay_receive_wake(void)
+{
+    int control_id = __atomic_load_n(&l_wait_control, __ATOMIC_SEQ_CST);
+
+    if (control_id < 0 || netplay_ring_get(control_id, __atomic_load_n(&l_wait_count, __ATOMIC_SEQ_CST)) == NULL)
+        return;
+
+    SDL_LockMutex(l_receive_lock);
+    SDL_CondSignal(l_receive_cond);
+    SDL_UnlockMutex(l_receive_lock);
 }
 
-/* ensure we have an event available for the control_id; spawn requester thread if needed */
-static int netplay_ensure_valid(uint8_t control_id)
+static int netplay_receive_thread(void* opaque)
 {
-    if (check_valid(control_id, l_cin_compats[control_id].netplay_count)) return 1;
-    if (l_udpChannel == -1) return 0;
+#if !defined(__EMSCRIPTEN__)
+    SDLNet_SocketSet set = SDLNet_AllocSocketSet(1);
+    if (set != NULL)
+        SDLNet_UDP_AddSocket(set, (UDPsocket)l_udpSocket);
+#endif
+
+    while (!__atomic_load_n(&l_receive_quit, __ATOMIC_ACQUIRE))
+    {
+#if !defined(__EMSCRIPTEN__)
+        if (set != NULL)
+            SDLNet_CheckSockets(set, 5);
+        else
+#endif
+            SDL_Delay(1);
+        netplay_process();
+        netplay_receive_wake();
+    }
+
+#if !defined(__EMSCRIPTEN__)
+    if (set != NULL)
+        SDLNet_FreeSocketSet(set);
+#endif
+    return 0;
+}
+
+static void netplay_start_receive_thread(void)
+{
+    l_receive_quit = 0;
+    l_wait_control = -1;
+    l_receive_lock = SDL_CreateMutex();
+    l_receive_cond = SDL_CreateCond();
+    if (l_receive_lock != NULL && l_receive_cond != NULL)
+        l_receive_thread = SDL_CreateThread(netplay_receive_thread, "Netplay receive", NULL);
+    if (l_receive_thread == NULL)
+        log_cb(RETRO_LOG_INFO, "Netplay: could not start the receive thread, polling from the emulation thread\n");
+}
+
+static void netplay_stop_receive_thread(void)
+{
+    if (l_receive_thread != NULL) {
+        __atomic_store_n(&l_receive_quit, 1, __ATOMIC_RELEASE);
+        SDL_WaitThread(l_receive_thread, NULL);
+        l_receive_thread = NULL;
+    }
+    if (l_receive_cond != NULL) {
+        SDL_DestroyCond(l_receive_cond);
+        l_receive_cond = NULL;
+    }
+    if (l_receive_lock != NULL) {
+        SDL_DestroyMutex(l_receive_lock);
+        l_receive_lock = NULL;
+    }
+    free_packet(l_receive_packet);
+    l_receive_packet = NULL;
+}
+
+/* a log missing a record would not replay, so recording stops when one
+ * does not fit in memory */
+static void netplay_log_failed(void)
+{
+    log_cb(RETRO_LOG_ERROR, "Netplay: no memory for an input log record, recording stopped\n");
+    netplay_record_stop();
+}
+
+/* append a record to the log, flushed to the writer by netplay_log_flush */
+static uint8_t* netplay_log_record(uint8_t type, size_t size)
+{
+    uint8_t* record;
+
+    if (l_log_writer == NULL)
+        return NULL;
+    if ((record = netplay_log_write_record(&l_log, type, size)) == NULL)
+        netplay_log_failed();
+    return record;
+}
+
+static void netplay_log_flush(void)
+{
+    if (l_log_writer != NULL && l_log.len > 0)
+        l_log_writer(l_log_opaque, l_log.buf, l_log.len);
+    l_log.len = 0;
+}
+
+static void netplay_log_input(uint8_t control_id, uint32_t count, uint32_t keys, uint8_t plugin)
+{
+    if (l_log_writer != NULL && !netplay_log_write_input(&l_log, control_id, count, keys, plugin))
+        netplay_log_failed();
+}
+
+/* the keyframe is written after the inputs it takes its counts from, so the
+ * inputs logged before it and consumed after it are logged again for a
+ * spectator who starts there */
+static void netplay_log_keyframe(const struct netplay_keyframe* keyframe)
+{
+    const struct netplay_input_slot* slot;
+    uint32_t count, end;
+
+    if (l_log_writer == NULL)
+        return;
+    if (!netplay_log_write_keyframe(&l_log, keyframe->vi, keyframe->netplay_count, keyframe->data,
+                                    (uint32_t)retro_serialize_size())) {
+        netplay_log_failed();
+        return;
+    }
+
+    for (uint8_t i = 0; i < 4; ++i) {
+        end = (l_rollback.frames > 0) ? l_rollback.confirmed_count[i] : l_cin_compats[i].netplay_count;
+        if (end - keyframe->netplay_count[i] > NETPLAY_INPUT_AHEAD)
+            continue;
+        for (count = keyframe->netplay_count[i]; count != end; ++count) {
+            if ((slot = netplay_ring_get(i, count)) != NULL)
+                netplay_log_input(i, count, slot->buttons, slot->plugin);
+        }
+    }
+}
+
+/* called every VI by netplay_check_sync while recording: closes the VI and
+ * takes a keyframe every l_keyframe_interval settled VIs. In delay mode the
+ * savestate is taken by the snapshot job, which a retro_serialize cannot
+ * replace, and the keyframe is written one VI late, once it exists */
+static void netplay_log_vi(int settled)
+{
+    struct netplay_snapshot* snap;
+
+    if (l_keyframe_pending) {
+        l_keyframe_pending = 0;
+        /* not saved if a frontend load cleared the job */
+        if (l_keyframe_snap.valid)
+            netplay_log_keyframe(&l_keyframe);
+    }
+
+    if (l_keyframe_interval > 0 && l_vi_counter % l_keyframe_interval == 0 && settled && l_keyframe.data != NULL) {
+        if (l_rollback.frames > 0) {
+            /* the previous VI was settled too, reuse its snapshot */
+            snap = netplay_rollback_find(&l_rollback, l_vi_counter - 1);
+            if (snap != NULL && savestates_snapshot_image(&snap->state, 0, (char*)l_keyframe.data, retro_serialize_size()) != NULL) {
+                memcpy(l_keyframe.netplay_count, snap->netplay_count, sizeof(l_keyframe.netplay_count));
+                l_keyframe.vi = snap->vi;
+                netplay_log_keyframe(&l_keyframe);
+            }
+        } else if (savestates_get_snapshot_job() == savestates_job_nothing) {
+            for (int i = 0; i < 4; ++i)
+                l_keyframe.netplay_count[i] = l_cin_compats[i].netplay_count;
+            l_keyframe.vi = l_vi_counter;
+            l_keyframe_pending = 1;
+            l_keyframe_snap.base = (char*)l_keyframe.data;
+            l_keyframe_snap.valid = 0;
+            savestates_set_snapshot_job(savestates_job_save, &l_keyframe_snap, 1);
+        }
+    }
+
+    if (l_log_writer != NULL && !netplay_log_write_vi(&l_log, l_vi_counter))
+        netplay_log_failed();
+    netplay_log_flush();
+}
+
+m64p_error netplay_record_start(netplay_log_writer writer, void* opaque, uint32_t keyframe_interval)
+{
+    if (!netplay_is_init() || l_replaying)
+        return M64ERR_NOT_INIT;
+    if (l_log_writer != NULL)
+        return M64ERR_INVALID_STATE;
+
+    if (keyframe_interval > 0 && (l_keyframe.data = calloc(1, retro_serialize_size())) == NULL)
+        return M64ERR_NO_MEMORY;
+
+    l_keyframe_interval = keyframe_interval;
+    l_keyframe_pending = 0;
+    netplay_log_reset(&l_log);
+    l_log_writer = writer;
+    l_log_opaque = opaque;
+    return M64ERR_SUCCESS;
+}
+
+void netplay_record_stop(void)
+{
+    netplay_log_flush();
+    l_log_writer = NULL;
+    l_log_opaque = NULL;
+    netplay_log_free(&l_log);
+    if (savestates_get_snapshot() == &l_keyframe_snap)
+        savestates_set_snapshot_job(savestates_job_nothing, NULL, 0);
+    savestates_snapshot_free_base((const char*)l_keyframe.data);
+    free(l_keyframe.data);
+    l_keyframe.data = NULL;
+    l_keyframe_pending = 0;
+}
+
+/* true if the input of control_id at count fits the ring; stale inputs
+ * are dropped, the ones too far ahead are kept in the stream for later */
+static int netplay_replay_input(void* opaque, uint8_t control_id, uint32_t count, uint32_t keys, uint8_t plugin)
+{
+    uint32_t ahead;
+
+    if (l_cin_compats == NULL)
+        return 0;
+    ahead = count - netplay_next_count(control_id);
+    if (ahead >= NETPLAY_INPUT_AHEAD && ahead < UINT32_MAX / 2)
+        return 0;
+    netplay_ring_put(control_id, count, keys, plugin);
+    l_replay_inputs = l_replay_started = 1;
+    return 1;
+}
+
+static void netplay_replay_settings(void* opaque, const uint32_t settings[NETPLAY_LOG_SETTINGS_COUNT])
+{
+    memcpy(l_replay_settings, settings, sizeof(l_replay_settings));
+    l_replay_have_settings = 1;
+}
+
+/* keep the save data of a STORAGE record until the core reads it */
+static int netplay_replay_storage_record(void* opaque, const char* extension, const uint8_t* data, uint32_t size)
+{
+    struct netplay_log_storage* storage;
+    size_t ext_len = strlen(extension);
+
+    if (l_replay_storage_count == l_replay_storage_cap) {
+        int new_cap = l_replay_storage_cap ? l_replay_storage_cap * 2 : 4;
+        if ((storage = realloc(l_replay_storage, new_cap * sizeof(*storage))) == NULL)
+            goto no_memory;
+        l_replay_storage = storage;
+        l_replay_storage_cap = new_cap;
+    }
+
+    storage = &l_replay_storage[l_replay_storage_count];
+    if ((storage->extension = malloc(ext_len + 1 + size)) == NULL)
+        goto no_memory;
+    memcpy(storage->extension, extension, ext_len + 1);
+    storage->data = (uint8_t*)&storage->extension[ext_len + 1];
+    storage->size = size;
+    memcpy(storage->data, data, size);
+    ++l_replay_storage_count;
+    return 1;
+
+no_memory:
+    log_cb(RETRO_LOG_ERROR, "Netplay: no memory for the %s save data of the input log, replay stopped\n", extension);
+    l_udpChannel = -1;
+    return 0;
+}
+
+static void netplay_replay_controllers(void* opaque, const uint8_t controllers[12])
+{
+    memcpy(l_replay_controllers, controllers, sizeof(l_replay_controllers));
+    l_replay_have_controllers = 1;
+}
+
+static void netplay_replay_vi_record(void* opaque, uint32_t vi)
+{
+    l_replay_started = 1;
+}
+
+/* only a stream that starts at a keyframe is seeded from it */
+static void netplay_replay_keyframe(void* opaque, uint32_t vi, const uint32_t netplay_count[4],
+                                    const uint8_t* data, uint32_t size)
+{
+    l_replay_started = 1;
+    if (!l_replay_inputs && !l_replay_seeded && l_replay_seed.data == NULL && size == retro_serialize_size()
+     && (l_replay_seed.data = malloc(size)) != NULL) {
+        l_replay_seed.vi = vi;
+        memcpy(l_replay_seed.netplay_count, netplay_count, sizeof(l_replay_seed.netplay_count));
+        memcpy(l_replay_seed.data, data, size);
+    }
+}
+
+/* emulation thread: parse the records fed so far */
+static void netplay_replay_parse(void)
+{
+    size_t used;
+
+    SDL_LockMutex(l_replay_lock);
+    while (l_replay_pos < l_replay_len
+        && (used = netplay_log_read_record(&l_replay_reader, &l_replay_buf[l_replay_pos], l_replay_len - l_replay_pos)) > 0) {
+        if (used == NETPLAY_LOG_INVALID) {
+            log_cb(RETRO_LOG_WARN, "Netplay: invalid record %u in the input log, replay stopped\n", l_replay_buf[l_replay_pos]);
+            l_udpChannel = -1;
+            break;
+        }
+        l_replay_pos += used;
+    }
+    SDL_UnlockMutex(l_replay_lock);
+}
+
+/* wait until a header record of the stream takes *value above above */
+static int netplay_replay_wait(const int* value, int above)
+{
+    uint32_t start = SDL_GetTicks();
+
+    for (;;) {
+        netplay_replay_parse();
+        if (*value > above)
+            return 1;
+        if (l_udpChannel == -1 || SDL_GetTicks() - start > NETPLAY_LOG_TIMEOUT)
+            return 0;
+        SDL_Delay(1);
+    }
+}
+
+/* save data of the recorded game, read in the same order */
+static file_status_t netplay_replay_storage(const char* extension, void* data, size_t size)
+{
+    const struct netplay_log_storage* storage;
+    int sum = 0;
+
+    if (!netplay_replay_wait(&l_replay_storage_count, l_replay_storage_next))
+        return file_open_error;
+
+    storage = &l_replay_storage[l_replay_storage_next++];
+    if (strcmp(storage->extension, extension) != 0 || storage->size != size) {
+        log_cb(RETRO_LOG_WARN, "Netplay: the input log has no %s save data\n", extension);
+        return file_open_error;
+    }
+    memcpy(data, storage->data, size);
+
+    for (size_t i = 0; i < size; ++i)
+        sum |= storage->data[i];
+    return (sum == 0) ? file_open_error : file_ok;
+}
+
+/* replace the power-on state with the keyframe a late stream starts at */
+static void netplay_replay_vi(void)
+{
+    if (l_replay_seed.data == NULL || savestates_get_job() != savestates_job_nothing)
+        return;
+
+    /* loaded by now */
+    if (l_replay_seeded) {
+        free(l_replay_seed.data);
+        l_replay_seed.data = NULL;
+        return;
+    }
+
+    l_replay_seeded = 1;
+    savestates_set_job(savestates_job_load, savestates_type_m64p, (const char*)l_replay_seed.data);
+    for (int i = 0; i < 4; ++i)
+        l_cin_compats[i].netplay_count = l_replay_seed.netplay_count[i];
+    netplay_input_reset(&l_input);
+    l_vi_counter = l_replay_seed.vi;
+    log_cb(RETRO_LOG_INFO, "Netplay: joined the input log at VI %u\n", l_vi_counter);
+}
+
+m64p_error netplay_replay_start(void)
+{
+    if (netplay_is_init())
+        return M64ERR_ALREADY_INIT;
+    if ((l_replay_lock = SDL_CreateMutex()) == NULL)
+        return M64ERR_SYSTEM_FAIL;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        l_netplay_control[i] = -1;
+        l_plugin[i] = 0;
+        l_player_lag[i] = 0;
+    }
+
+    l_replay_len = l_replay_pos = 0;
+    l_replay_inputs = l_replay_started = l_replay_seeded = 0;
+    l_replay_have_settings = l_replay_have_controllers = 0;
+    l_replay_storage_count = l_replay_storage_next = 0;
+    memset(&l_replay_reader, 0, sizeof(l_replay_reader));
+    l_replay_reader.settings = netplay_replay_settings;
+    l_replay_reader.storage = netplay_replay_storage_record;
+    l_replay_reader.controllers = netplay_replay_controllers;
+    l_replay_reader.input = netplay_replay_input;
+    l_replay_reader.vi = netplay_replay_vi_record;
+    l_replay_reader.keyframe = netplay_replay_keyframe;
+    l_cin_compats = NULL;
+    l_udpChannel = 0;
+    l_canFF = 0;
+    l_netplay_controller = 0;
+    l_spectator = 1;
+    l_vi_counter = 0;
+    l_status = 0;
+    l_replaying = 1;
+    l_netplay_is_init = 1;
+
+    return M64ERR_SUCCESS;
+}
+
+m64p_error netplay_replay_feed(const void* data, size_t size)
+{
+    m64p_error ret = M64ERR_SUCCESS;
+
+    if (!l_replaying)
+        return M64ERR_NOT_INIT;
+
+    SDL_LockMutex(l_replay_lock);
+    /* drop what has been parsed before growing the buffer */
+    if (l_replay_pos > 0) {
+        memmove(l_replay_buf, &l_replay_buf[l_replay_pos], l_replay_len - l_replay_pos);
+        l_replay_len -= l_replay_pos;
+        l_replay_pos = 0;
+    }
+    if (netplay_log_reserve(&l_replay_buf, &l_replay_cap, l_replay_len + size)) {
+        memcpy(&l_replay_buf[l_replay_len], data, size);
+        l_replay_len += size;
+    } else {
+        ret = M64ERR_NO_MEMORY;
+    }
+    SDL_UnlockMutex(l_replay_lock);
+
+    return ret;
+}
 
-    SDL_Thread* thread = SDL_CreateThread(netplay_require_response, "Netplay key request", &control_id);
+static void netplay_replay_stop(void)
+{
+    for (int i = 0; i < l_replay_storage_count; ++i)
+        free(l_replay_storage[i].extension);
+    free(l_replay_storage);
+    l_replay_storage = NULL;
+    l_replay_storage_count = l_replay_storage_cap = l_replay_storage_next = 0;
+    free(l_replay_seed.data);
+    l_replay_seed.data = NULL;
+    free(l_replay_buf);
+    l_replay_buf = NULL;
+    l_replay_cap = l_replay_len = l_replay_pos = 0;
+    SDL_DestroyMutex(l_replay_lock);
+    l_replay_lock = NULL;
+
+    l_udpChannel = -1;
+    l_replaying = 0;
+    l_netplay_is_init = 0;
+}
 
-    while (!check_valid(control_id, l_cin_compats[control_id].netplay_count) && l_udpChannel != -1)
+/* emulation thread: pick up the input received so far */
+static void netplay_poll(void)
+{
+    if (l_replaying)
+        netplay_replay_parse();
+    else if (l_receive_thread == NULL)
         netplay_process();
+    if (l_rollback.frames > 0) {
+        for (uint8_t i = 0; i < 4; ++i)
+            netplay_rollback_drain(i);
+    }
+}
 
-    int success;
-    SDL_WaitThread(thread, &success);
-    return success;
+/* true when control_id has to wait for confirmed input before predicting
+ * more, see netplay_rollback_behind */
+static int netplay_input_behind(uint8_t control_id)
+{
+    return netplay_rollback_behind(&l_rollback, control_id, l_cin_compats[control_id].netplay_count, l_vi_counter);
 }
 
-/* delete a specific event node from the linked list */
-static void netplay_delete_event(struct netplay_event* current, uint8_t control_id)
+/* wait until the input control_id needs has arrived: the current count
+ * in delay mode, or enough confirmed counts to be back inside the rollback
+ * window. The input is requested again every 5 ms; gives up after 10 s */
+static int netplay_wait_input(uint8_t control_id, int rollback)
 {
-    struct netplay_event* find = l_cin_compats[control_id].event_first;
-    while (find != NULL) {
-        if (find->next == current) {
-            find->next = current->next;
+    uint32_t start = SDL_GetTicks();
+    uint32_t next_request = start;
+    uint32_t now;
+    int ready;
+
+    for (;;)
+    {
+        netplay_poll();
+        if (rollback)
+            ready = !netplay_input_behind(control_id);
+        else
+            ready = check_valid(control_id, l_cin_compats[control_id].netplay_count);
+        if (ready)
             break;
+
+        now = SDL_GetTicks();
+        if (l_udpChannel == -1 || now - start > 10000) {
+            l_udpChannel = -1;
+            break;
+        }
+        if (!l_replaying && (int32_t)(now - next_request) >= 0) {
+            netplay_request_input(control_id);
+            next_request = now + 5;
+        }
+
+        if (l_replaying) {
+            SDL_Delay(1);
+        } else if (l_receive_thread != NULL) {
+            SDL_LockMutex(l_receive_lock);
+            __atomic_store_n(&l_wait_count, rollback ? l_rollback.confirmed_count[control_id] : l_cin_compats[control_id].netplay_count, __ATOMIC_SEQ_CST);
+            __atomic_store_n(&l_wait_control, control_id, __ATOMIC_SEQ_CST);
+            if (netplay_ring_get(control_id, l_wait_count) == NULL)
+                SDL_CondWaitTimeout(l_receive_cond, l_receive_lock, 5);
+            __atomic_store_n(&l_wait_control, -1, __ATOMIC_SEQ_CST);
+            SDL_UnlockMutex(l_receive_lock);
         }
-        find = find->next;
     }
-    if (current == l_cin_compats[control_id].event_first)
-        l_cin_compats[control_id].event_first = l_cin_compats[control_id].event_first->next;
-    free(current);
+
+    l_stall_frame += SDL_GetTicks() - start;
+    return ready;
+}
+
+/* ensure the input for the current count of control_id is available */
+static int netplay_ensure_valid(uint8_t control_id)
+{
+    if (check_valid(control_id, l_cin_compats[control_id].netplay_count)) return 1;
+    if (l_udpChannel == -1) return 0;
+    return netplay_wait_input(control_id, 0);
+}
+
+/* wait for the server until control_id is back inside the rollback window */
+static int netplay_rollback_stall(uint8_t control_id)
+{
+    if (!netplay_input_behind(control_id))
+        return 1;
+    return netplay_wait_input(control_id, 1);
+}
+
+/* a rollback, or a state loaded by the frontend, replaces the state */
+static int netplay_load_pending(void)
+{
+    return savestates_get_snapshot_job() == savestates_job_load || savestates_get_job() == savestates_job_load;
+}
+
+/* consume the input for the current count, predicting it from the last
+ * confirmed input when the server has not sent it yet */
+static uint32_t netplay_predict_input(uint8_t control_id)
+{
+    uint8_t plugin = l_plugin[control_id];
+    uint32_t keys;
+
+    if (!l_rollback.resimulating && !netplay_rollback_stall(control_id)) {
+        log_cb(RETRO_LOG_INFO, "Netplay: lost connection to server\n");
+        main_core_state_set(M64CORE_EMU_STATE, M64EMU_STOPPED);
+        return 0;
+    }
+
+    keys = netplay_rollback_input(&l_rollback, control_id, l_cin_compats[control_id].netplay_count, l_vi_counter, &plugin);
+    Controls[control_id].Plugin = plugin;
+    netplay_store_release(&l_cin_compats[control_id].netplay_count, l_cin_compats[control_id].netplay_count + 1);
+    return keys;
 }
 
 /* get the next input for the given control_id (consumes an event) */
@@ -483,8 +1191,21 @@ static uint32_t netplay_get_input(uint8_t control_id)
     uint32_t keys;
     struct retro_fastforwarding_override ff_override;
 
-    netplay_process();
-    netplay_request_input(control_id);
+    if (l_rollback.frames > 0) {
+        /* a rollback is about to rewind this frame, don't consume anything */
+        if (netplay_load_pending())
+            return 0;
+        if (l_rollback.resimulating)
+            return netplay_predict_input(control_id);
+    }
+
+    /* the state is about to be replaced by the keyframe, don't consume anything */
+    if (l_replaying && ((l_replay_seed.data != NULL && !l_replay_seeded) || savestates_get_job() == savestates_job_load))
+        return 0;
+
+    netplay_poll();
+    if (!l_replaying && l_batch.redundancy == 0)
+        netplay_request_input(control_id);
 
     if (l_player_lag[control_id] > 0 && buffer_size(control_id) > l_buffer_target) {
         l_canFF = 1;
@@ -503,14 +1224,17 @@ static uint32_t netplay_get_input(uint8_t control_id)
         l_canFF = 0;
     }
 
+    if (l_rollback.frames > 0)
+        return netplay_predict_input(control_id);
+
     if (netplay_ensure_valid(control_id)) {
-        struct netplay_event* current = l_cin_compats[control_id].event_first;
-        while (current->count != l_cin_compats[control_id].netplay_count)
-            current = current->next;
-        keys = current->buttons;
-        Controls[control_id].Plugin = current->plugin;
-        netplay_delete_event(current, control_id);
-        ++l_cin_compats[control_id].netplay_count;
+        uint32_t count = l_cin_compats[control_id].netplay_count;
+        const struct netplay_input_slot* slot = netplay_ring_get(control_id, count);
+        keys = slot->buttons;
+        Controls[control_id].Plugin = slot->plugin;
+        netplay_log_input(control_id, count, keys, slot->plugin);
+        /* hands the slot back to the receiving side */
+        netplay_store_release(&l_cin_compats[control_id].netplay_count, count + 1);
     } else {
         log_cb(RETRO_LOG_INFO, "Netplay: lost connection to server\n");
         main_core_state_set(M64CORE_EMU_STATE, M64EMU_STOPPED);
@@ -523,6 +1247,20 @@ static uint32_t netplay_get_input(uint8_t control_id)
 /* send local input for a player */
 static void netplay_send_input(uint8_t control_id, uint32_t keys)
 {
+    if (l_rollback.frames > 0) {
+        /* re-simulated or about to be rewound: the server already has it */
+        if (netplay_load_pending() || check_valid(control_id, l_cin_compats[control_id].netplay_count))
+            return;
+        /* stored before it is sent, so the copy the server echoes is dropped */
+        netplay_ring_put(control_id, l_cin_compats[control_id].netplay_count, keys, l_plugin[control_id]);
+        netplay_rollback_drain(control_id);
+    }
+
+    if (l_batch.redundancy > 0) {
+        netplay_batch_put(&l_batch, control_id, l_cin_compats[control_id].netplay_count, keys, l_plugin[control_id]);
+        return;
+    }
+
     void* packet = alloc_packet(11);
     if (!packet) return;
 
@@ -549,6 +1287,26 @@ static void netplay_send_input(uint8_t control_id, uint32_t keys)
     free_packet(packet);
 }
 
+/* send the inputs recorded by netplay_send_input this PIF round, each with
+ * the inputs of the previous counts: [type] then the batch, see
+ * netplay_batch.h */
+static void netplay_flush_input(void)
+{
+    UDPpacket* p;
+
+    if (l_batch.pending == 0)
+        return;
+
+    p = (UDPpacket*)alloc_packet(1 + NETPLAY_BATCH_MAX_SIZE);
+    if (!p) return;
+
+    p->data[0] = UDP_SEND_KEY_INFO_BATCH;
+    p->len = 1 + netplay_batch_encode(&l_batch, &p->data[1]);
+    UDP_Send(l_udpSocket, l_udpChannel, p);
+
+    free_packet(p);
+}
+
 /* register player via TCP; server returns buffer target */
 uint8_t netplay_register_player(uint8_t player, uint8_t plugin, uint8_t rawdata, uint32_t reg_id)
 {
@@ -582,6 +1340,9 @@ file_status_t netplay_read_storage(const char *filename, void *data, size_t size
     if (!file_extension) file_extension = "";
     else file_extension += 1;
 
+    if (l_replaying)
+        return netplay_replay_storage(file_extension, data, size);
+
     uint32_t buffer_pos = 0;
     char *output_data = malloc(size + strlen(file_extension) + 6);
     if (!output_data) return file_open_error;
@@ -603,6 +1364,7 @@ file_status_t netplay_read_storage(const char *filename, void *data, size_t size
         buffer_pos += size;
 
         TCP_Send(l_tcpSocket, &output_data[0], buffer_pos);
+        ret = file_ok;  // player 1 plays with its own save
     }
     else
     {
@@ -629,6 +1391,13 @@ file_status_t netplay_read_storage(const char *filename, void *data, size_t size
             ret = file_ok;
     }
     free(output_data);
+
+    uint8_t* record = netplay_log_record(NETPLAY_LOG_STORAGE, strlen(file_extension) + 5 + size);
+    if (record != NULL) {
+        memcpy(record, file_extension, strlen(file_extension) + 1);
+        net_write32((uint32_t)size, &record[strlen(file_extension) + 1]);
+        memcpy(&record[strlen(file_extension) + 5], data, size);
+    }
     return ret;
 }
 
@@ -637,6 +1406,20 @@ void netplay_sync_settings(uint32_t *count_per_op, uint32_t *count_per_op_denom_
 {
     if (!netplay_is_init()) return;
 
+    if (l_replaying) {
+        if (!netplay_replay_wait(&l_replay_have_settings, 0)) {
+            log_cb(RETRO_LOG_WARN, "Netplay: the input log has no settings\n");
+            return;
+        }
+        *count_per_op = l_replay_settings[0];
+        *count_per_op_denom_pot = l_replay_settings[1];
+        *disable_extra_mem = l_replay_settings[2];
+        *si_dma_duration = (int32_t)l_replay_settings[3];
+        *emumode = l_replay_settings[4];
+        *no_compiled_jump = (int32_t)l_replay_settings[5];
+        return;
+    }
+
     char output_data[SETTINGS_SIZE + 1];
     uint8_t request;
     if (l_netplay_control[0] != -1)
@@ -666,6 +1449,128 @@ void netplay_sync_settings(uint32_t *count_per_op, uint32_t *count_per_op_denom_
         *emumode = net_read32((uint8_t*)&output_data[16]);
         *no_compiled_jump = (int32_t)net_read32((uint8_t*)&output_data[20]);
     }
+
+    uint8_t* record = netplay_log_record(NETPLAY_LOG_SETTINGS, SETTINGS_SIZE);
+    if (record != NULL) {
+        net_write32(*count_per_op, &record[0]);
+        net_write32(*count_per_op_denom_pot, &record[4]);
+        net_write32(*disable_extra_mem, &record[8]);
+        net_write32((uint32_t)*si_dma_duration, &record[12]);
+        net_write32(*emumode, &record[16]);
+        net_write32((uint32_t)*no_compiled_jump, &record[20]);
+    }
+}
+
+/* in rollback mode the state is only final once no input is predicted */
+static int netplay_rollback_settled(void)
+{
+    if (l_rollback.frames == 0)
+        return 1;
+    if (l_rollback.resimulating || l_rollback.pending)
+        return 0;
+    for (int i = 0; i < 4; ++i) {
+        if (Controls[i].Present && (l_cin_compats[i].netplay_count - l_rollback.confirmed_count[i]) - 1 < UINT32_MAX / 2)
+            return 0;
+    }
+    return 1;
+}
+
+static void netplay_digest_reset(void)
+{
+    for (int i = 0; i < NETPLAY_DIGEST_HISTORY; ++i) {
+        l_local_digest[i].vi = NETPLAY_DIGEST_NONE;
+        l_remote_digest[i].vi = NETPLAY_DIGEST_NONE;
+    }
+    rdram_digest_reset(&l_rdram_digest);
+    l_desync_found = 0;
+}
+
+static void netplay_digest_compute(struct netplay_digest* digest)
+{
+    uint32_t region_pages = RDRAM_DIRTY_PAGES_COUNT / NETPLAY_DIGEST_REGIONS;
+    char queue[1024];
+    int queue_len;
+
+    /* only the pages written since the last digest are rehashed */
+    rdram_digest_update(&l_rdram_digest, &g_dev.rdram, RDRAM_DIRTY_DIGEST, 0);
+    rdram_clear_dirty(&g_dev.rdram, RDRAM_DIRTY_DIGEST);
+
+    for (int i = 0; i < NETPLAY_DIGEST_REGIONS; ++i)
+        digest->hash[i] = rdram_digest_pages(&l_rdram_digest, i * region_pages, region_pages);
+
+    queue_len = save_eventqueue_infos(&g_dev.r4300.cp0, queue);
+    digest->hash[NETPLAY_DIGEST_SP_MEM] = XXH3_64bits(g_dev.sp.mem, SP_MEM_SIZE);
+    digest->hash[NETPLAY_DIGEST_QUEUE] = XXH3_64bits(queue, queue_len);
+    digest->hash[NETPLAY_DIGEST_PIF_RAM] = XXH3_64bits(g_dev.pif.ram, PIF_RAM_SIZE);
+}
+
+/* [type][vi][count][count * hash], hashes as two big endian words */
+static void netplay_digest_send(const struct netplay_digest* digest)
+{
+    UDPpacket* p = (UDPpacket*)alloc_packet(6 + NETPLAY_DIGEST_COUNT * 8);
+    if (!p) return;
+
+    p->data[0] = UDP_SYNC_DIGEST;
+    net_write32(digest->vi, &p->data[1]);
+    p->data[5] = NETPLAY_DIGEST_COUNT;
+    for (int i = 0; i < NETPLAY_DIGEST_COUNT; ++i) {
+        net_write32((uint32_t)(digest->hash[i] >> 32), &p->data[6 + i * 8]);
+        net_write32((uint32_t)digest->hash[i], &p->data[10 + i * 8]);
+    }
+    p->len = 6 + NETPLAY_DIGEST_COUNT * 8;
+    UDP_Send(l_udpSocket, l_udpChannel, p);
+
+    free_packet(p);
+}
+
+static int netplay_digest_fetch(uint32_t vi, struct netplay_digest* out)
+{
+    const struct netplay_digest* digest = &l_remote_digest[vi & (NETPLAY_DIGEST_HISTORY - 1)];
+
+    if (netplay_load_acquire(&digest->vi) != vi)
+        return 0;
+    memcpy(out, digest, sizeof(*out));
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return netplay_load_acquire(&digest->vi) == vi;
+}
+
+/* compare the local digests with the ones relayed so far and log the
+ * first subsystem, or RDRAM range, of the first mismatch */
+static void netplay_digest_check(void)
+{
+    static const char* names[] = { "RSP memory", "the interrupt queue", "PIF RAM" };
+    uint32_t region_size = RDRAM_MAX_SIZE / NETPLAY_DIGEST_REGIONS;
+    struct netplay_digest remote;
+
+    for (int i = 0; i < NETPLAY_DIGEST_HISTORY; ++i) {
+        struct netplay_digest* local = &l_local_digest[i];
+
+        if (local->vi == NETPLAY_DIGEST_NONE || local->checked || !netplay_digest_fetch(local->vi, &remote))
+            continue;
+        local->checked = 1;
+
+        for (int h = 0; h < NETPLAY_DIGEST_COUNT && !l_desync_found; ++h) {
+            if (local->hash[h] == remote.hash[h])
+                continue;
+            l_desync_found = 1;
+            if (h < NETPLAY_DIGEST_REGIONS)
+                log_cb(RETRO_LOG_WARN, "Netplay: state differs from player %u at VI %u, first in RDRAM 0x%06x-0x%06x\n",
+                       remote.player + 1, local->vi, h * region_size, (h + 1) * region_size - 1);
+            else
+                log_cb(RETRO_LOG_WARN, "Netplay: state differs from player %u at VI %u, first in %s\n",
+                       remote.player + 1, local->vi, names[h - NETPLAY_DIGEST_REGIONS]);
+        }
+    }
+}
+
+static void netplay_digest_vi(void)
+{
+    struct netplay_digest* digest = &l_local_digest[l_vi_counter & (NETPLAY_DIGEST_HISTORY - 1)];
+
+    netplay_digest_compute(digest);
+    digest->vi = l_vi_counter;
+    digest->checked = 0;
+    netplay_digest_send(digest);
 }
 
 /* periodic sync/check for desyncs (send CP0 registers) */
@@ -675,7 +1580,35 @@ void netplay_check_sync(struct cp0* cp0)
 
     const uint32_t* cp0_regs = r4300_cp0_regs(cp0);
 
-    if (l_vi_counter % 600 == 0)
+    if (l_stall_frame > 0) {
+        ++l_stalled_frames;
+        l_stall_total += l_stall_frame;
+        if (l_stall_frame > l_stall_worst)
+            l_stall_worst = l_stall_frame;
+        l_stall_frame = 0;
+    }
+    if (l_vi_counter % NETPLAY_STALL_REPORT == 0 && l_stalled_frames > 0) {
+        log_cb(RETRO_LOG_INFO, "Netplay: %u of the last %u frames waited for input, %u ms in total, worst %u ms\n",
+               l_stalled_frames, NETPLAY_STALL_REPORT, l_stall_total, l_stall_worst);
+        l_stall_total = l_stall_worst = l_stalled_frames = 0;
+    }
+
+    if (l_replaying) {
+        netplay_replay_vi();
+        ++l_vi_counter;
+        return;
+    }
+
+    if (l_log_writer != NULL)
+        netplay_log_vi(netplay_rollback_settled());
+
+    if (NetplayDesyncCheck > 0) {
+        if (l_vi_counter % NetplayDesyncCheck == 0 && netplay_rollback_settled())
+            netplay_digest_vi();
+        netplay_digest_check();
+    }
+
+    if (l_vi_counter % 600 == 0 && netplay_rollback_settled())
     {
         uint32_t packet_len = (CP0_REGS_COUNT * 4) + 5;
         void* packet = alloc_packet(packet_len);
@@ -703,12 +1636,110 @@ void netplay_check_sync(struct cp0* cp0)
     ++l_vi_counter;
 }
 
+/* called every VI right after netplay_check_sync: either rewinds to the
+ * snapshot of a mispredicted VI or snapshots the current one */
+void netplay_rollback_vi(void)
+{
+    struct netplay_snapshot* snap;
+    uint32_t netplay_count[4];
+    int rebase;
+
+    if (!netplay_is_init() || l_rollback.frames == 0)
+        return;
+
+    if (l_rollback.resimulating && l_vi_counter == l_rollback.resim_target)
+        l_rollback.resimulating = 0;
+
+    /* the state is replaced by the frontend this VI */
+    if (savestates_get_job() == savestates_job_load) {
+        if ((snap = netplay_rollback_find(&l_rollback, l_vi_counter)) != NULL)
+            snap->state.valid = 0;
+        return;
+    }
+
+    if (!l_rollback.resimulating) {
+        for (int i = 0; i < 4; ++i) {
+            if (Controls[i].Present && !netplay_rollback_stall(i)) {
+                log_cb(RETRO_LOG_INFO, "Netplay: lost connection to server\n");
+                main_core_state_set(M64CORE_EMU_STATE, M64EMU_STOPPED);
+                return;
+            }
+        }
+        netplay_poll();
+
+        if (l_rollback.pending) {
+            struct netplay_snapshot* target = netplay_rollback_start(&l_rollback, l_vi_counter);
+            if (target != NULL) {
+                l_vi_counter = target->vi;
+                for (int i = 0; i < 4; ++i)
+                    netplay_store_release(&l_cin_compats[i].netplay_count, target->netplay_count[i]);
+                /* the other snapshots of its base are still needed */
+                savestates_set_snapshot_job(savestates_job_load, &target->state, 0);
+                return;
+            }
+            log_cb(RETRO_LOG_INFO, "Netplay: VI %u is outside the rollback window, players may de-sync\n", l_rollback.rollback_vi);
+        }
+    }
+
+    for (int i = 0; i < 4; ++i)
+        netplay_count[i] = l_cin_compats[i].netplay_count;
+    snap = netplay_rollback_snapshot(&l_rollback, l_vi_counter, netplay_count, &rebase);
+    savestates_set_snapshot_job(savestates_job_save, &snap->state, rebase);
+}
+
+int netplay_is_resimulating() { return l_rollback.resimulating; }
+
+/* allocate the snapshot bases for rollback mode; falls back to
+ * delay-based netplay if the memory is not available */
+static void netplay_rollback_setup(uint32_t frames)
+{
+    uint32_t netplay_count[4];
+
+    for (int i = 0; i < 4; ++i)
+        netplay_count[i] = l_cin_compats[i].netplay_count;
+
+    if (!netplay_rollback_init(&l_rollback, &l_input, frames, retro_serialize_size(), netplay_count)) {
+        log_cb(RETRO_LOG_WARN, "Netplay: not enough memory for %u rollback frames\n", frames);
+        return;
+    }
+
+    if (l_rollback.frames > 0)
+        log_cb(RETRO_LOG_INFO, "Netplay: rollback enabled, %u frames\n", l_rollback.frames);
+}
+
+/* controllers of the recorded game; also waits for the record after them
+ * so a keyframe a late stream starts at is known before any input is read */
+static void netplay_replay_registration(void)
+{
+    if (!netplay_replay_wait(&l_replay_have_controllers, 0) || !netplay_replay_wait(&l_replay_started, 0))
+        log_cb(RETRO_LOG_WARN, "Netplay: the input log has no controllers\n");
+
+    for (int i = 0; i < 4; ++i)
+    {
+        Controls[i].Present = l_replay_controllers[i][0];
+        Controls[i].Plugin = l_replay_controllers[i][1];
+        Controls[i].RawData = l_replay_controllers[i][2];
+        l_plugin[i] = Controls[i].Plugin;
+    }
+
+    netplay_rollback_free(&l_rollback);
+    netplay_batch_reset(&l_batch, 0);
+    l_stall_frame = l_stall_total = l_stall_worst = l_stalled_frames = 0;
+    log_cb(RETRO_LOG_INFO, "Netplay: replaying an input log\n");
+}
+
 /* read server registration (called right before game starts) */
 void netplay_read_registration(struct controller_input_compat* cin_compats)
 {
     if (!netplay_is_init()) return;
 
     l_cin_compats = cin_compats;
+    netplay_input_reset(&l_input);
+
+    if (l_replaying) {
+        netplay_replay_registration();
+        return;
+    }
 
     uint32_t reg_id;
     char output_data = TCP_GET_REGISTRATION;
@@ -745,6 +1776,27 @@ void netplay_read_registration(struct controller_input_compat* cin_compats)
             ++curr;
         }
     }
+
+    uint8_t* record = netplay_log_record(NETPLAY_LOG_CONTROLLERS, 12);
+    if (record != NULL) {
+        for (int i = 0; i < 4; ++i) {
+            record[i * 3] = (uint8_t)Controls[i].Present;
+            record[i * 3 + 1] = (uint8_t)Controls[i].Plugin;
+            record[i * 3 + 2] = (uint8_t)Controls[i].RawData;
+        }
+    }
+
+    netplay_rollback_setup(NetplayRollbackFrames);
+
+    netplay_batch_reset(&l_batch, NetplayInputRedundancy);
+    if (l_batch.redundancy > 0)
+        log_cb(RETRO_LOG_INFO, "Netplay: batched input, %u frames of redundancy\n", l_batch.redundancy);
+
+    l_stall_frame = l_stall_total = l_stall_worst = l_stalled_frames = 0;
+    netplay_digest_reset();
+    if (NetplayDesyncCheck > 0)
+        log_cb(RETRO_LOG_INFO, "Netplay: comparing state digests every %u frames\n", NetplayDesyncCheck);
+    netplay_start_receive_thread();
 }
 
 /* send/receive raw PIF-level input (used by emulator core) */
@@ -794,11 +1846,28 @@ static void netplay_get_raw_input(struct pif* pif)
     }
 }
 
+/* true if the PIF round polls at least one connected controller */
+static int netplay_reads_input(struct pif* pif)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        if (Controls[i].Present == 1 && pif->channels[i].tx && pif->channels[i].tx_buf[0] == JCMD_CONTROLLER_READ)
+            return 1;
+    }
+    return 0;
+}
+
 void netplay_update_input(struct pif* pif)
 {
     if (netplay_is_init())
     {
         netplay_send_raw_input(pif);
+        if (l_batch.redundancy > 0)
+        {
+            netplay_flush_input();
+            if (netplay_reads_input(pif))
+                netplay_request_input_batch();
+        }
         netplay_get_raw_input(pif);
     }
 }
@@ -807,6 +1876,7 @@ void netplay_update_input(struct pif* pif)
 m64p_error netplay_send_config(char* data, int size)
 {
     if (!netplay_is_init()) return M64ERR_NOT_INIT;
+    if (l_replaying) return M64ERR_INVALID_STATE;
 
     if (l_netplay_control[0] != -1 || size == 1)
     {
@@ -821,6 +1891,7 @@ m64p_error netplay_send_config(char* data, int size)
 m64p_error netplay_receive_config(char* data, int size)
 {
     if (!netplay_is_init()) return M64ERR_NOT_INIT;
+    if (l_replaying) return M64ERR_INVALID_STATE;
 
     if (l_netplay_control[0] == -1)
     {
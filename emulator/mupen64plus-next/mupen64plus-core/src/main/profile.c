@@ -29,6 +29,11 @@
 static long long int time_in_section[NUM_TIMED_SECTIONS];
 static long long int last_start[NUM_TIMED_SECTIONS];
 
+/* time between consecutive VIs, split by whether the frame was presented */
+static long long int last_frame;
+static long long int frame_time[2];
+static long long int frame_count[2];
+
 #if defined(WIN32) && !defined(__MINGW32__)
   // timing
   #include <windows.h>
@@ -74,26 +79,49 @@ void timed_section_end(enum timed_section section)
    time_in_section[section] += end - last_start[section];
 }
 
+void timed_sections_frame(int hidden)
+{
+   long long int curr_time = get_time();
+   hidden = !!hidden;
+   if (last_frame != 0)
+   {
+      frame_time[hidden] += curr_time - last_frame;
+      frame_count[hidden]++;
+   }
+   last_frame = curr_time;
+}
+
 void timed_sections_refresh()
 {
    long long int curr_time = get_time();
    if(time_to_nsec(curr_time - last_start[TIMED_SECTION_ALL]) >= 2000000000)
    {
       time_in_section[TIMED_SECTION_ALL] = curr_time - last_start[TIMED_SECTION_ALL];
-      DebugMessage(M64MSG_INFO, "gfx=%f%% - audio=%f%% - compiler=%f%%, idle=%f%%",
+      DebugMessage(M64MSG_INFO, "gfx=%f%% - audio=%f%% - compiler=%f%%, idle=%f%%, savestate=%f%%",
          100.0 * (double)time_in_section[TIMED_SECTION_GFX] / time_in_section[TIMED_SECTION_ALL],
          100.0 * (double)time_in_section[TIMED_SECTION_AUDIO] / time_in_section[TIMED_SECTION_ALL],
          100.0 * (double)time_in_section[TIMED_SECTION_COMPILER] / time_in_section[TIMED_SECTION_ALL],
-         100.0 * (double)time_in_section[TIMED_SECTION_IDLE] / time_in_section[TIMED_SECTION_ALL]);
-      DebugMessage(M64MSG_INFO, "gfx=%llins - audio=%llins - compiler %llins - idle=%llins",
+         100.0 * (double)time_in_section[TIMED_SECTION_IDLE] / time_in_section[TIMED_SECTION_ALL],
+         100.0 * (double)time_in_section[TIMED_SECTION_SAVESTATE] / time_in_section[TIMED_SECTION_ALL]);
+      DebugMessage(M64MSG_INFO, "gfx=%llins - audio=%llins - compiler %llins - idle=%llins - savestate=%llins",
          time_to_nsec(time_in_section[TIMED_SECTION_GFX]),
          time_to_nsec(time_in_section[TIMED_SECTION_AUDIO]),
          time_to_nsec(time_in_section[TIMED_SECTION_COMPILER]),
-         time_to_nsec(time_in_section[TIMED_SECTION_IDLE]));
+         time_to_nsec(time_in_section[TIMED_SECTION_IDLE]),
+         time_to_nsec(time_in_section[TIMED_SECTION_SAVESTATE]));
+      if (frame_count[1] != 0)
+      {
+         DebugMessage(M64MSG_INFO, "presented frames=%lli avg=%llins - hidden frames=%lli avg=%llins",
+            frame_count[0], frame_count[0] ? time_to_nsec(frame_time[0] / frame_count[0]) : 0,
+            frame_count[1], time_to_nsec(frame_time[1] / frame_count[1]));
+      }
+      frame_time[0] = frame_time[1] = 0;
+      frame_count[0] = frame_count[1] = 0;
       time_in_section[TIMED_SECTION_GFX] = 0;
       time_in_section[TIMED_SECTION_AUDIO] = 0;
       time_in_section[TIMED_SECTION_COMPILER] = 0;
       time_in_section[TIMED_SECTION_IDLE] = 0;
+      time_in_section[TIMED_SECTION_SAVESTATE] = 0;
       last_start[TIMED_SECTION_ALL] = curr_time;
    }
 }
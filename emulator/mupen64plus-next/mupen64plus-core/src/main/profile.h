@@ -31,11 +31,13 @@ enum timed_section
     TIMED_SECTION_AUDIO,
     TIMED_SECTION_COMPILER,
     TIMED_SECTION_IDLE,
+    TIMED_SECTION_SAVESTATE,
     NUM_TIMED_SECTIONS
 };
 
 void timed_section_start(enum timed_section section);
 void timed_section_end(enum timed_section section);
 void timed_sections_refresh(void);
+void timed_sections_frame(int hidden);
 
 #endif
@@ -0,0 +1,309 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - profiler.c                                              *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Runtime profiler.
+ *
+ * The guest PC is sampled every PROFILER_SAMPLE_PERIOD counts: at the first
+ * branch or superblock exit past the sample point in the interpreters, and
+ * at the next call to dynarec_gen_interrupt in the dynarecs, which leave
+ * their blocks for nothing else. Samples are bucketed by 64-byte line in an
+ * open-addressing table that is cleared every VI, so each trace line holds
+ * the hot spots of a single frame. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libretro.h>
+#include <mupen64plus-next_common.h>
+
+#include "api/callbacks.h"
+#include "api/m64p_types.h"
+#include "profiler.h"
+
+#define PROFILER_PC_SLOTS      1024
+#define PROFILER_PC_MAX        (PROFILER_PC_SLOTS / 2)
+#define PROFILER_PC_TOP        16
+#define PROFILER_INTERRUPTS    16
+#define PROFILER_MEM_TYPES     (M64P_MEM_BREAKPOINT + 1)
+
+#if defined(WIN32) && !defined(__MINGW32__)
+  #include <windows.h>
+
+  static long long int get_time(void)
+  {
+      LARGE_INTEGER counter;
+      QueryPerformanceCounter(&counter);
+      return counter.QuadPart;
+  }
+  static long long int time_to_nsec(long long int time)
+  {
+      static LARGE_INTEGER freq = { 0 };
+      if (freq.QuadPart == 0)
+          QueryPerformanceFrequency(&freq);
+      return time * 1000000000 / freq.QuadPart;
+  }
+
+#else  /* Not WIN32 */
+  #include <time.h>
+
+  static long long int get_time(void)
+  {
+     struct timespec ts;
+     clock_gettime(CLOCK_MONOTONIC, &ts);
+     return (long long int)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+  static long long int time_to_nsec(long long int time)
+  {
+      return time;
+  }
+#endif
+
+struct profiler_pc
+{
+    uint32_t line;
+    uint32_t count;
+};
+
+struct profiler_state g_profiler;
+
+static const char* const l_interrupt_names[PROFILER_INTERRUPTS] = {
+    "vi", "compare", "check", "si", "pi", "special", "ai", "sp",
+    "dp", "hw2", "nmi", "reset", "rsp_dma", "dd_mc", "dd_bm", "dd_dv"
+};
+
+static const char* const l_mem_type_names[PROFILER_MEM_TYPES] = {
+    "nomem", "nothing", "rdram", "rdram_regs", "rsp_mem", "rsp_regs", "rsp",
+    "dp", "dps", "vi", "ai", "pi", "ri", "si", "dd_regs", "dd_rom",
+    "flashram", "rom", "pif", "mi", "breakpoint"
+};
+
+static unsigned char l_region_type[PROFILER_MMIO_REGIONS];
+
+/* l_pc_slot holds an l_pcs index + 1, or 0 for a free slot */
+static uint16_t l_pc_slot[PROFILER_PC_SLOTS];
+static struct profiler_pc l_pcs[PROFILER_PC_MAX];
+static unsigned int l_pc_used;
+static uint32_t l_pc_samples;
+static uint32_t l_pc_dropped;
+
+static long long int l_interrupt_start;
+static size_t l_interrupt_handler;
+static uint32_t l_interrupt_count[PROFILER_INTERRUPTS];
+static long long int l_interrupt_time[PROFILER_INTERRUPTS];
+
+static FILE* l_trace;
+static uint32_t l_option;
+static uint32_t l_vi;
+static long long int l_last_vi;
+
+static void profiler_reset(void)
+{
+    memset(g_profiler.mmio_hits, 0, sizeof(g_profiler.mmio_hits));
+    memset(g_profiler.counters, 0, sizeof(g_profiler.counters));
+    memset(l_pc_slot, 0, sizeof(l_pc_slot));
+    memset(l_interrupt_count, 0, sizeof(l_interrupt_count));
+    memset(l_interrupt_time, 0, sizeof(l_interrupt_time));
+    l_pc_used = 0;
+    l_pc_samples = 0;
+    l_pc_dropped = 0;
+    l_interrupt_start = 0;
+}
+
+static void profiler_open(void)
+{
+    const char* dir = NULL;
+    char path[4096];
+
+    if (!environ_cb(RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY, &dir) || dir == NULL)
+        environ_cb(RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY, &dir);
+
+    snprintf(path, sizeof(path), "%s%smupen64plus_profile.jsonl",
+             dir ? dir : ".", (dir && *dir) ? "/" : "");
+
+    if ((l_trace = fopen(path, "w")) == NULL) {
+        DebugMessage(M64MSG_WARNING, "Profiler: could not open '%s'", path);
+        return;
+    }
+
+    DebugMessage(M64MSG_INFO, "Profiler: writing '%s'", path);
+    profiler_reset();
+    l_vi = 0;
+    l_last_vi = get_time();
+    g_profiler.enabled = 1;
+}
+
+static void profiler_close(void)
+{
+    g_profiler.enabled = 0;
+    if (l_trace != NULL) {
+        fclose(l_trace);
+        l_trace = NULL;
+    }
+}
+
+static int profiler_pc_compare(const void* a, const void* b)
+{
+    const struct profiler_pc* pa = (const struct profiler_pc*)a;
+    const struct profiler_pc* pb = (const struct profiler_pc*)b;
+
+    if (pa->count != pb->count)
+        return (pa->count < pb->count) ? 1 : -1;
+    return (pa->line > pb->line) - (pa->line < pb->line);
+}
+
+static void profiler_write(long long int frame_time)
+{
+    uint64_t mem_hits[PROFILER_MEM_TYPES] = { 0 };
+    const char* sep;
+    unsigned int i;
+
+    fprintf(l_trace, "{\"vi\":%u,\"ns\":%lld,\"pc_samples\":%u,\"pc_dropped\":%u,\"pc\":[",
+            l_vi, time_to_nsec(frame_time), l_pc_samples, l_pc_dropped);
+
+    qsort(l_pcs, l_pc_used, sizeof(l_pcs[0]), profiler_pc_compare);
+    for (i = 0; i < l_pc_used && i < PROFILER_PC_TOP; ++i) {
+        fprintf(l_trace, "%s{\"pc\":\"%08X\",\"n\":%u}", (i == 0) ? "" : ",",
+                (unsigned int)l_pcs[i].line, (unsigned int)l_pcs[i].count);
+    }
+
+    fputs("],\"interrupts\":{", l_trace);
+    for (i = 0, sep = ""; i < PROFILER_INTERRUPTS; ++i) {
+        if (l_interrupt_count[i] == 0)
+            continue;
+        fprintf(l_trace, "%s\"%s\":{\"n\":%u,\"ns\":%lld}", sep, l_interrupt_names[i],
+                l_interrupt_count[i], time_to_nsec(l_interrupt_time[i]));
+        sep = ",";
+    }
+
+    for (i = 0; i < PROFILER_MMIO_REGIONS; ++i) {
+        if (g_profiler.mmio_hits[i] != 0)
+            mem_hits[l_region_type[i]] += g_profiler.mmio_hits[i];
+    }
+
+    fputs("},\"mmio\":{", l_trace);
+    for (i = 0, sep = ""; i < PROFILER_MEM_TYPES; ++i) {
+        if (mem_hits[i] == 0)
+            continue;
+        fprintf(l_trace, "%s\"%s\":%llu", sep, l_mem_type_names[i], (unsigned long long)mem_hits[i]);
+        sep = ",";
+    }
+
+    fprintf(l_trace, "},\"blocks\":{\"compiled\":%u,\"invalidated\":%u,\"flushed\":%u,"
+            "\"hash_hits\":%u,\"hash_misses\":%u},\"idle\":{\"skips\":%u,\"cycles\":%u}}\n",
+            g_profiler.counters[PROFILER_BLOCK_COMPILE],
+            g_profiler.counters[PROFILER_BLOCK_INVALIDATE],
+            g_profiler.counters[PROFILER_BLOCK_FLUSH],
+            g_profiler.counters[PROFILER_BLOCK_HASH_HIT],
+            g_profiler.counters[PROFILER_BLOCK_HASH_MISS],
+            g_profiler.counters[PROFILER_IDLE_SKIP],
+            g_profiler.counters[PROFILER_IDLE_CYCLES]);
+}
+
+void profiler_map_region(uint16_t region, int type)
+{
+    if (region < PROFILER_MMIO_REGIONS)
+        l_region_type[region] = (type >= 0 && type < PROFILER_MEM_TYPES) ? type : M64P_MEM_NOMEM;
+}
+
+void profiler_sample_pc(uint32_t count, uint32_t pc)
+{
+    uint32_t line = pc & ~UINT32_C(63);
+    unsigned int slot = ((line >> 6) * UINT32_C(2654435761)) >> 22;
+    unsigned int index;
+
+    /* stay on the grid, unless the count was skipped ahead or loaded */
+    if ((uint32_t)(count - g_profiler.next_sample) < PROFILER_SAMPLE_PERIOD)
+        g_profiler.next_sample += PROFILER_SAMPLE_PERIOD;
+    else
+        g_profiler.next_sample = count + PROFILER_SAMPLE_PERIOD;
+
+    ++l_pc_samples;
+
+    while ((index = l_pc_slot[slot]) != 0) {
+        if (l_pcs[index - 1].line == line) {
+            ++l_pcs[index - 1].count;
+            return;
+        }
+        slot = (slot + 1) & (PROFILER_PC_SLOTS - 1);
+    }
+
+    if (l_pc_used == PROFILER_PC_MAX) {
+        ++l_pc_dropped;
+        return;
+    }
+
+    l_pcs[l_pc_used].line = line;
+    l_pcs[l_pc_used].count = 1;
+    l_pc_slot[slot] = (uint16_t)++l_pc_used;
+}
+
+void profiler_interrupt_begin(size_t handler)
+{
+    l_interrupt_handler = handler;
+    l_interrupt_start = get_time();
+}
+
+void profiler_interrupt_end(void)
+{
+    /* cleared when the handler went through profiler_vi */
+    if (l_interrupt_start == 0)
+        return;
+
+    ++l_interrupt_count[l_interrupt_handler];
+    l_interrupt_time[l_interrupt_handler] += get_time() - l_interrupt_start;
+    l_interrupt_start = 0;
+}
+
+void profiler_vi(void)
+{
+    long long int now;
+
+    if (EnableProfiler != l_option) {
+        l_option = EnableProfiler;
+        if (l_option)
+            profiler_open();
+        else
+            profiler_close();
+        return;
+    }
+
+    if (!g_profiler.enabled)
+        return;
+
+    /* the VI handler is timed up to here, the rest of new_vi belongs to
+     * the frontend */
+    now = get_time();
+    if (l_interrupt_start != 0) {
+        ++l_interrupt_count[l_interrupt_handler];
+        l_interrupt_time[l_interrupt_handler] += now - l_interrupt_start;
+    }
+
+    profiler_write(now - l_last_vi);
+    profiler_reset();
+    ++l_vi;
+    l_last_vi = get_time();
+}
+
+void profiler_deinit(void)
+{
+    profiler_close();
+    l_option = 0;
+}
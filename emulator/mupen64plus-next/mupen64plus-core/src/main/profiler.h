@@ -0,0 +1,108 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - profiler.h                                              *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "osal/preproc.h"
+
+/* Runtime profiler, unlike profile.h it is built in every configuration and
+ * only costs a flag check while disabled. Counters are reset every VI, after
+ * being appended as one JSON line to mupen64plus_profile.jsonl in the save
+ * directory. */
+
+enum profiler_counter
+{
+    PROFILER_BLOCK_COMPILE,
+    PROFILER_BLOCK_INVALIDATE,
+    PROFILER_BLOCK_FLUSH,
+    PROFILER_BLOCK_HASH_HIT,
+    PROFILER_BLOCK_HASH_MISS,
+    PROFILER_IDLE_SKIP,
+    PROFILER_IDLE_CYCLES,
+    PROFILER_COUNTERS
+};
+
+/* 64KB regions of the physical address space */
+enum { PROFILER_MMIO_REGIONS = 0x2000 };
+
+/* counts between two guest PC samples, about 380 per VI */
+enum { PROFILER_SAMPLE_PERIOD = 0x800 };
+
+struct profiler_state
+{
+    int enabled;
+    uint32_t next_sample;  /* count of the next PC sample */
+    uint32_t mmio_hits[PROFILER_MMIO_REGIONS];
+    uint32_t counters[PROFILER_COUNTERS];
+};
+
+extern struct profiler_state g_profiler;
+
+/* address is physical */
+static osal_inline void profiler_count_mmio(uint32_t address)
+{
+    if (g_profiler.enabled)
+        ++g_profiler.mmio_hits[(address >> 16) & (PROFILER_MMIO_REGIONS - 1)];
+}
+
+static osal_inline void profiler_count(enum profiler_counter counter)
+{
+    if (g_profiler.enabled)
+        ++g_profiler.counters[counter];
+}
+
+static osal_inline void profiler_add(enum profiler_counter counter, uint32_t value)
+{
+    if (g_profiler.enabled)
+        g_profiler.counters[counter] += value;
+}
+
+/* Records which device a region of the mem_handler table belongs to. */
+void profiler_map_region(uint16_t region, int type);
+
+/* Adds the guest PC to this VI's histogram. */
+void profiler_sample_pc(uint32_t count, uint32_t pc);
+
+/* Samples the guest PC once count has crossed the next sample point, from
+ * where the interpreters and the dynarec have COUNT up to date, so that
+ * the histogram follows guest time rather than the interrupts. */
+static osal_inline void profiler_tick(uint32_t count, uint32_t pc)
+{
+    if (g_profiler.enabled && (uint32_t)(g_profiler.next_sample - count - 1) >= PROFILER_SAMPLE_PERIOD)
+        profiler_sample_pc(count, pc);
+}
+
+/* Times one call of an interrupt handler, indexed like the cp0
+ * interrupt_handlers. */
+void profiler_interrupt_begin(size_t handler);
+void profiler_interrupt_end(void);
+
+/* Called once per VI: writes and resets the counters, and follows the
+ * profiler core option. */
+void profiler_vi(void);
+
+/* Closes the trace. */
+void profiler_deinit(void);
+
+#endif
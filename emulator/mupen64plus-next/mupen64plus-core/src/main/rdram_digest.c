@@ -0,0 +1,56 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - rdram_digest.c                                          *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "rdram_digest.h"
+
+#include <string.h>
+
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
+void rdram_digest_reset(struct rdram_digest* digest)
+{
+    memset(digest->page_hash, 0, sizeof(digest->page_hash));
+    digest->valid = 0;
+}
+
+void rdram_digest_update(struct rdram_digest* digest, const struct rdram* rdram,
+                         enum rdram_dirty_client client, int rescan)
+{
+    uint32_t words = (uint32_t)(rdram->dram_size >> (RDRAM_DIRTY_PAGE_SHIFT + 5));
+    int all = rescan || !digest->valid || rdram->untracked[client];
+    uint32_t w;
+
+    for (w = 0; w < words; ++w) {
+        uint32_t bits = all ? UINT32_MAX : rdram->dirty[client][w];
+        while (bits != 0) {
+            uint32_t page = (w << 5) + __builtin_ctz(bits);
+            bits &= bits - 1;
+            digest->page_hash[page] = XXH3_64bits((const uint8_t*)rdram->dram + (page << RDRAM_DIRTY_PAGE_SHIFT), RDRAM_DIRTY_PAGE_SIZE);
+        }
+    }
+
+    digest->valid = 1;
+}
+
+uint64_t rdram_digest_pages(const struct rdram_digest* digest, uint32_t first_page, uint32_t count)
+{
+    return XXH3_64bits(&digest->page_hash[first_page], count * sizeof(digest->page_hash[0]));
+}
@@ -0,0 +1,48 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - rdram_digest.h                                          *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef M64P_MAIN_RDRAM_DIGEST_H
+#define M64P_MAIN_RDRAM_DIGEST_H
+
+#include <stdint.h>
+
+#include "device/rdram/rdram.h"
+
+/* Hashes of each dram page, kept up to date from the pages a dirty page
+ * client saw written so that hashing dram costs in proportion to what the
+ * game wrote rather than to the size of dram. */
+struct rdram_digest
+{
+    uint64_t page_hash[RDRAM_DIRTY_PAGES_COUNT];
+    int valid;
+};
+
+void rdram_digest_reset(struct rdram_digest* digest);
+
+/* Rehash the pages written since the client was last cleared, or all of
+ * dram when nothing was hashed yet, the client is untracked or rescan is
+ * set. Clearing the client afterwards is left to the caller. */
+void rdram_digest_update(struct rdram_digest* digest, const struct rdram* rdram,
+                         enum rdram_dirty_client client, int rescan);
+
+/* hash of the page hashes of [first_page, first_page + count) */
+uint64_t rdram_digest_pages(const struct rdram_digest* digest, uint32_t first_page, uint32_t count);
+
+#endif
@@ -0,0 +1,390 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - rewind.c                                                *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Core-side rewind.
+ *
+ * Every VI the m64p savestate is serialized into a spare image. The XOR of
+ * that image with the previous one is mostly zero, so a background thread
+ * run-length encodes it and pushes it onto a ring of deltas bounded by a
+ * byte budget. Stepping back XORs the newest delta into the current image
+ * and loads the result.
+ * Captures and loads go through the core's snapshot job rather than the
+ * frontend's savestate job, which a retro_serialize or retro_unserialize
+ * in the same frame would replace. Three images rotate, so that the next
+ * capture is written while the thread still compresses the previous two. */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libretro.h>
+#include <mupen64plus-next_common.h>
+
+#include "api/callbacks.h"
+#include "api/m64p_types.h"
+#include "netplay.h"
+#include "rewind.h"
+#include "savestates.h"
+#include "savestates_delta.h"
+
+#define REWIND_MAX_DELTAS 65536
+
+extern retro_input_state_t input_cb;
+
+/* XOR of two consecutive images, stored as (zero words, literal words,
+ * literals...) tokens, or verbatim when that would not be smaller */
+struct rewind_delta {
+    size_t words;
+    int raw;
+    uint32_t data[];
+};
+
+static size_t l_budget;
+static size_t l_image_words;
+static uint32_t* l_cur;     /* last image captured or loaded */
+static uint32_t* l_next;    /* target of the pending capture */
+static uint32_t* l_spare;   /* old image of the delta being compressed */
+static uint32_t* l_scratch;
+static int l_have_cur;
+static int l_capture_pending;
+static int l_rewinding;
+
+/* full images only, rebased on the buffer they are saved to or loaded from */
+static struct savestate_snapshot l_snap;
+
+static struct rewind_delta* l_ring[REWIND_MAX_DELTAS];
+static unsigned int l_head;
+static unsigned int l_count;
+static size_t l_used;
+
+static pthread_t l_thread;
+static pthread_mutex_t l_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t l_cond = PTHREAD_COND_INITIALIZER;
+static const uint32_t* l_job_old;
+static const uint32_t* l_job_new;
+static int l_thread_running;
+static int l_busy;
+static int l_quit;
+
+static size_t rewind_delta_bytes(const struct rewind_delta* delta)
+{
+    return sizeof(*delta) + delta->words * sizeof(uint32_t);
+}
+
+static struct rewind_delta* rewind_compress(const uint32_t* old, const uint32_t* new)
+{
+    struct rewind_delta* delta;
+    size_t words = l_image_words;
+    size_t i = 0, k, out = 0;
+
+    while (i < words) {
+        size_t zeros = 0, literals = 0;
+
+        while (i + zeros < words && old[i + zeros] == new[i + zeros])
+            ++zeros;
+        i += zeros;
+
+        /* a single matching word is cheaper inside the literal run */
+        while (i + literals < words) {
+            if (old[i + literals] == new[i + literals]
+             && (i + literals + 1 == words || old[i + literals + 1] == new[i + literals + 1]))
+                break;
+            ++literals;
+        }
+
+        if (out + 2 + literals >= words) {
+            out = 0;
+            break;
+        }
+
+        l_scratch[out++] = (uint32_t)zeros;
+        l_scratch[out++] = (uint32_t)literals;
+        for (k = 0; k < literals; ++k)
+            l_scratch[out++] = old[i + k] ^ new[i + k];
+        i += literals;
+    }
+
+    if (out != 0) {
+        delta = malloc(sizeof(*delta) + out * sizeof(uint32_t));
+        if (delta == NULL)
+            return NULL;
+        memcpy(delta->data, l_scratch, out * sizeof(uint32_t));
+        delta->words = out;
+        delta->raw = 0;
+        return delta;
+    }
+
+    delta = malloc(sizeof(*delta) + words * sizeof(uint32_t));
+    if (delta == NULL)
+        return NULL;
+    for (i = 0; i < words; ++i)
+        delta->data[i] = old[i] ^ new[i];
+    delta->words = words;
+    delta->raw = 1;
+    return delta;
+}
+
+static void rewind_apply(uint32_t* image, const struct rewind_delta* delta)
+{
+    size_t i, k, pos = 0;
+
+    if (delta->raw) {
+        for (i = 0; i < delta->words; ++i)
+            image[i] ^= delta->data[i];
+        return;
+    }
+
+    for (i = 0; i < delta->words; ) {
+        uint32_t literals;
+
+        pos += delta->data[i++];
+        literals = delta->data[i++];
+        for (k = 0; k < literals; ++k)
+            image[pos++] ^= delta->data[i++];
+    }
+}
+
+/* must be called with l_lock held */
+static void rewind_drop_oldest(void)
+{
+    unsigned int oldest = (l_head - l_count) % REWIND_MAX_DELTAS;
+
+    l_used -= rewind_delta_bytes(l_ring[oldest]);
+    free(l_ring[oldest]);
+    l_ring[oldest] = NULL;
+    --l_count;
+}
+
+/* must be called with l_lock held */
+static void rewind_push(struct rewind_delta* delta)
+{
+    if (l_count == REWIND_MAX_DELTAS)
+        rewind_drop_oldest();
+
+    l_ring[l_head] = delta;
+    l_head = (l_head + 1) % REWIND_MAX_DELTAS;
+    ++l_count;
+    l_used += rewind_delta_bytes(delta);
+
+    while (l_used > l_budget && l_count > 1)
+        rewind_drop_oldest();
+}
+
+static struct rewind_delta* rewind_pop(void)
+{
+    struct rewind_delta* delta = NULL;
+
+    pthread_mutex_lock(&l_lock);
+    if (l_count != 0) {
+        l_head = (l_head + REWIND_MAX_DELTAS - 1) % REWIND_MAX_DELTAS;
+        delta = l_ring[l_head];
+        l_ring[l_head] = NULL;
+        l_used -= rewind_delta_bytes(delta);
+        --l_count;
+    }
+    pthread_mutex_unlock(&l_lock);
+
+    return delta;
+}
+
+static void* rewind_thread(void* arg)
+{
+    struct rewind_delta* delta;
+
+    pthread_mutex_lock(&l_lock);
+    for (;;) {
+        while (!l_busy && !l_quit)
+            pthread_cond_wait(&l_cond, &l_lock);
+        if (l_quit)
+            break;
+
+        pthread_mutex_unlock(&l_lock);
+        delta = rewind_compress(l_job_old, l_job_new);
+        pthread_mutex_lock(&l_lock);
+
+        if (delta != NULL)
+            rewind_push(delta);
+        l_busy = 0;
+        pthread_cond_broadcast(&l_cond);
+    }
+    pthread_mutex_unlock(&l_lock);
+
+    return NULL;
+}
+
+static void rewind_wait_idle(void)
+{
+    pthread_mutex_lock(&l_lock);
+    while (l_busy)
+        pthread_cond_wait(&l_cond, &l_lock);
+    pthread_mutex_unlock(&l_lock);
+}
+
+/* once the capture requested on a previous VI has been written to l_next,
+ * queue its delta against l_cur and make it the current image; returns 0
+ * while it is still pending */
+static int rewind_finish_capture(void)
+{
+    uint32_t* image;
+
+    if (!l_capture_pending)
+        return 1;
+
+    if (savestates_get_snapshot() == &l_snap)
+        return 0;
+    l_capture_pending = 0;
+
+    /* dropped by a frontend load or replaced by run-ahead */
+    if (!l_snap.valid)
+        return 1;
+
+    if (l_have_cur) {
+        /* the previous delta is done with l_spare, which is captured to next */
+        rewind_wait_idle();
+        pthread_mutex_lock(&l_lock);
+        l_job_old = l_cur;
+        l_job_new = l_next;
+        l_busy = 1;
+        pthread_cond_broadcast(&l_cond);
+        pthread_mutex_unlock(&l_lock);
+    }
+
+    image = l_spare;
+    l_spare = l_cur;
+    l_cur = l_next;
+    l_next = image;
+    l_have_cur = 1;
+    return 1;
+}
+
+static void rewind_queue(savestates_job job, uint32_t* image)
+{
+    l_snap.base = (char*)image;
+    l_snap.valid = (job == savestates_job_load);
+    savestates_set_snapshot_job(job, &l_snap, 1);
+}
+
+static void rewind_configure(void)
+{
+    size_t budget = (size_t)RewindBufferSize << 20;
+
+    if (budget == l_budget)
+        return;
+
+    rewind_deinit();
+    l_budget = budget;
+    if (budget == 0)
+        return;
+
+    l_image_words = retro_serialize_size() / sizeof(uint32_t);
+    l_cur = calloc(l_image_words, sizeof(uint32_t));
+    l_next = calloc(l_image_words, sizeof(uint32_t));
+    l_spare = calloc(l_image_words, sizeof(uint32_t));
+    l_scratch = malloc(l_image_words * sizeof(uint32_t));
+
+    if (l_cur == NULL || l_next == NULL || l_spare == NULL || l_scratch == NULL
+     || pthread_create(&l_thread, NULL, rewind_thread, NULL) != 0) {
+        DebugMessage(M64MSG_WARNING, "Rewind: could not allocate the rewind buffer");
+        rewind_deinit();
+        l_budget = budget;
+        return;
+    }
+
+    l_thread_running = 1;
+    DebugMessage(M64MSG_INFO, "Rewind: keeping up to %u MB of history", RewindBufferSize);
+}
+
+void rewind_vi(void)
+{
+    struct rewind_delta* delta;
+
+    if (netplay_is_init())
+        return;
+
+    rewind_configure();
+    if (!l_thread_running)
+        return;
+
+    if (!rewind_finish_capture())
+        return;
+
+    /* the frontend owns the savestate job this VI, and run-ahead the
+     * snapshot job */
+    if (savestates_get_job() != savestates_job_nothing
+     || savestates_get_snapshot_job() != savestates_job_nothing)
+        return;
+
+    if (RewindButton >= 0 && l_have_cur && input_cb(0, RETRO_DEVICE_JOYPAD, 0, RewindButton)) {
+        /* the first step goes back to the last capture, the following ones
+         * undo one delta each; at the oldest frame the image is reloaded */
+        if (l_rewinding) {
+            rewind_wait_idle();
+            if ((delta = rewind_pop()) != NULL) {
+                rewind_apply(l_cur, delta);
+                free(delta);
+            }
+        }
+        l_rewinding = 1;
+        rewind_queue(savestates_job_load, l_cur);
+        return;
+    }
+
+    l_rewinding = 0;
+    rewind_queue(savestates_job_save, l_next);
+    l_capture_pending = 1;
+}
+
+void rewind_deinit(void)
+{
+    if (savestates_get_snapshot() == &l_snap)
+        savestates_set_snapshot_job(savestates_job_nothing, NULL, 0);
+    savestates_snapshot_free_base((const char*)l_cur);
+    savestates_snapshot_free_base((const char*)l_next);
+    savestates_snapshot_free_base((const char*)l_spare);
+
+    if (l_thread_running) {
+        pthread_mutex_lock(&l_lock);
+        while (l_busy)
+            pthread_cond_wait(&l_cond, &l_lock);
+        l_quit = 1;
+        pthread_cond_broadcast(&l_cond);
+        pthread_mutex_unlock(&l_lock);
+        pthread_join(l_thread, NULL);
+        l_thread_running = 0;
+        l_quit = 0;
+    }
+
+    while (l_count != 0)
+        rewind_drop_oldest();
+    l_head = 0;
+    l_used = 0;
+
+    free(l_cur);
+    free(l_next);
+    free(l_spare);
+    free(l_scratch);
+    l_cur = l_next = l_spare = l_scratch = NULL;
+    memset(&l_snap, 0, sizeof(l_snap));
+    l_have_cur = 0;
+    l_capture_pending = 0;
+    l_rewinding = 0;
+    l_budget = 0;
+}
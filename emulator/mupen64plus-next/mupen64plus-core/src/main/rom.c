@@ -21,6 +21,7 @@
  * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
 
 #include <ctype.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -45,8 +46,21 @@
 #include "rom.h"
 #include "util.h"
 
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #define CHUNKSIZE 1024*128 /* Read files 128KB at a time. */
 
+/* Roms are byte-swapped and hashed by chunks spread over a few threads. */
+enum { ROM_HASH_CHUNK_SIZE = 0x100000 };
+enum { ROM_HASH_THREADS = 4 };
+
 /* Number of cpu cycles per instruction */
 enum { DEFAULT_COUNT_PER_OP = 2 };
 /* by default, extra mem is enabled */
@@ -57,9 +71,19 @@ enum { DEFAULT_SI_DMA_DURATION = 0x900 };
 enum { DEFAULT_AI_DMA_MODIFIER = 100 };
 
 static romdatabase_entry* ini_search_by_md5(md5_byte_t* md5);
+static int hash_index_search(uint64_t xxh3, uint32_t size, md5_byte_t* md5);
+static void hash_index_add(uint64_t xxh3, uint32_t size, const md5_byte_t* md5);
 
 static _romdatabase g_romdatabase;
 
+#if defined(__LIBRETRO__) && !defined(M64P_ROMDB_INI)
+/* The libretro core ships the ini compiled into static tables,
+ * see generate-romdb-header.py. M64P_ROMDB_INI keeps the parser, which
+ * test_romdb checks the tables against */
+#define ROMDB_PRECOMPILED
+#include "main/mupen64plus.romdb.h"
+#endif
+
 /* Global loaded rom size. */
 int g_rom_size = 0;
 
@@ -86,55 +110,168 @@ static int is_valid_rom(const unsigned char *buffer, unsigned int size)
         return 0;
 }
 
+static unsigned char rom_image_type(const void* src)
+{
+    if (memcmp(src, V64_SIGNATURE, sizeof(V64_SIGNATURE)) == 0)
+        return V64IMAGE;
+    else if (memcmp(src, N64_SIGNATURE, sizeof(N64_SIGNATURE)) == 0)
+        return N64IMAGE;
+    else
+        return Z64IMAGE;
+}
+
 /* Copies the source block of memory to the destination block of memory while
  * switching the endianness of .v64 and .n64 images to the .z64 format, which
  * is native to the Nintendo 64. The data extraction routines and MD5 hashing
  * function may only act on the .z64 big-endian format.
  *
- * IN: src: The source block of memory. This must be a valid Nintendo 64 ROM
- *          image of 'len' bytes.
+ * IN: src: A block of 'len' bytes of a Nintendo 64 ROM image, starting on a
+ *          word boundary of the image.
  *     len: The length of the source and destination, in bytes.
+ *     imagetype: V64IMAGE, N64IMAGE or Z64IMAGE, the format of the image as
+ *                given by rom_image_type.
  * OUT: dst: The destination block of memory. This must be a valid buffer for
  *           at least 'len' bytes.
- *      imagetype: A pointer to a byte that gets updated with the value of
- *                 V64IMAGE, N64IMAGE or Z64IMAGE according to the format of
- *                 the source block. The value is undefined if 'src' does not
- *                 represent a valid Nintendo 64 ROM image.
  */
-static void swap_copy_rom(void* dst, const void* src, size_t len, unsigned char* imagetype)
+static void swap_copy_rom(void* dst, const void* src, size_t len, unsigned char imagetype)
 {
-    if (memcmp(src, V64_SIGNATURE, sizeof(V64_SIGNATURE)) == 0)
+    size_t i = 0;
+
+    if (imagetype == V64IMAGE)
     {
-        size_t i;
         const uint16_t* src16 = (const uint16_t*) src;
         uint16_t* dst16 = (uint16_t*) dst;
 
-        *imagetype = V64IMAGE;
         /* .v64 images have byte-swapped half-words (16-bit). */
-        for (i = 0; i < len; i += 2)
+#if defined(__SSE2__)
+        for (; i + 16 <= len; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)((const uint8_t*)src + i));
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            _mm_storeu_si128((__m128i*)((uint8_t*)dst + i), v);
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 16 <= len; i += 16)
         {
-            *dst16++ = m64p_swap16(*src16++);
+            vst1q_u8((uint8_t*)dst + i, vrev16q_u8(vld1q_u8((const uint8_t*)src + i)));
+        }
+#endif
+        for (; i < len; i += 2)
+        {
+            dst16[i / 2] = m64p_swap16(src16[i / 2]);
         }
     }
-    else if (memcmp(src, N64_SIGNATURE, sizeof(N64_SIGNATURE)) == 0)
+    else if (imagetype == N64IMAGE)
     {
-        size_t i;
         const uint32_t* src32 = (const uint32_t*) src;
         uint32_t* dst32 = (uint32_t*) dst;
 
-        *imagetype = N64IMAGE;
         /* .n64 images have byte-swapped words (32-bit). */
-        for (i = 0; i < len; i += 4)
+#if defined(__SSE2__)
+        for (; i + 16 <= len; i += 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)((const uint8_t*)src + i));
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+            v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+            _mm_storeu_si128((__m128i*)((uint8_t*)dst + i), v);
+        }
+#elif defined(__ARM_NEON)
+        for (; i + 16 <= len; i += 16)
+        {
+            vst1q_u8((uint8_t*)dst + i, vrev32q_u8(vld1q_u8((const uint8_t*)src + i)));
+        }
+#endif
+        for (; i < len; i += 4)
         {
-            *dst32++ = m64p_swap32(*src32++);
+            dst32[i / 4] = m64p_swap32(src32[i / 4]);
         }
     }
     else {
-        *imagetype = Z64IMAGE;
         memcpy(dst, src, len);
     }
 }
 
+struct rom_hash_job
+{
+    uint8_t* dst;
+    const uint8_t* src;
+    size_t size;
+    unsigned char imagetype;
+    XXH64_hash_t* digests;
+    size_t first;
+    size_t chunks;
+};
+
+/* Byte-swaps every ROM_HASH_THREADS-th chunk starting at job->first, and
+ * hashes it while it is still in cache. */
+static void* rom_hash_worker(void* arg)
+{
+    struct rom_hash_job* job = (struct rom_hash_job*)arg;
+    size_t i;
+
+    for (i = job->first; i < job->chunks; i += ROM_HASH_THREADS)
+    {
+        size_t offset = i * ROM_HASH_CHUNK_SIZE;
+        size_t len = (job->size - offset < ROM_HASH_CHUNK_SIZE) ? job->size - offset : ROM_HASH_CHUNK_SIZE;
+
+        swap_copy_rom(job->dst + offset, job->src + offset, len, job->imagetype);
+        job->digests[i] = XXH3_64bits(job->dst + offset, len);
+    }
+
+    return NULL;
+}
+
+/* Copies a rom image to dst in .z64 format and returns its XXH3 digest,
+ * which is the XXH3 of the digests of its 1MB chunks. */
+static uint64_t swap_copy_hash_rom(void* dst, const void* src, size_t size, unsigned char imagetype)
+{
+    struct rom_hash_job jobs[ROM_HASH_THREADS];
+    pthread_t threads[ROM_HASH_THREADS];
+    int started[ROM_HASH_THREADS];
+    size_t chunks = (size + ROM_HASH_CHUNK_SIZE - 1) / ROM_HASH_CHUNK_SIZE;
+    XXH64_hash_t* digests = malloc(chunks * sizeof(digests[0]));
+    uint64_t digest;
+    size_t i;
+
+    if (digests == NULL)
+    {
+        swap_copy_rom(dst, src, size, imagetype);
+        return XXH3_64bits(dst, size);
+    }
+
+    for (i = 0; i < ROM_HASH_THREADS; ++i)
+    {
+        jobs[i].dst = (uint8_t*)dst;
+        jobs[i].src = (const uint8_t*)src;
+        jobs[i].size = size;
+        jobs[i].imagetype = imagetype;
+        jobs[i].digests = digests;
+        jobs[i].first = i;
+        jobs[i].chunks = chunks;
+
+        /* the calling thread takes the first share, and the share of any
+         * thread that could not be started */
+        started[i] = (i != 0 && i < chunks && pthread_create(&threads[i], NULL, rom_hash_worker, &jobs[i]) == 0);
+    }
+
+    for (i = 0; i < ROM_HASH_THREADS; ++i)
+    {
+        if (!started[i])
+            rom_hash_worker(&jobs[i]);
+    }
+
+    for (i = 0; i < ROM_HASH_THREADS; ++i)
+    {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+
+    digest = XXH3_64bits(digests, chunks * sizeof(digests[0]));
+    free(digests);
+
+    return digest;
+}
+
 m64p_error open_rom(const unsigned char* romimage, unsigned int size)
 {
     md5_state_t state;
@@ -142,6 +279,7 @@ m64p_error open_rom(const unsigned char* romimage, unsigned int size)
     romdatabase_entry* entry;
     char buffer[256];
     unsigned char imagetype;
+    uint64_t xxh3;
     int i;
 
     /* check input requirements */
@@ -155,15 +293,20 @@ m64p_error open_rom(const unsigned char* romimage, unsigned int size)
     g_RomWordsLittleEndian = 0;
     /* allocate new buffer for ROM and copy into this buffer */
     g_rom_size = size;
-    swap_copy_rom((uint8_t*)mem_base_u32(g_mem_base, MM_CART_ROM), romimage, size, &imagetype);
+    imagetype = rom_image_type(romimage);
+    xxh3 = swap_copy_hash_rom((uint8_t*)mem_base_u32(g_mem_base, MM_CART_ROM), romimage, size, imagetype);
     /* ROM is now in N64 native (big endian) byte order */
 
     memcpy(&ROM_HEADER, (uint8_t*)mem_base_u32(g_mem_base, MM_CART_ROM), sizeof(m64p_rom_header));
 
-    /* Calculate MD5 hash  */
-    md5_init(&state);
-    md5_append(&state, (const md5_byte_t*)((uint8_t*)mem_base_u32(g_mem_base, MM_CART_ROM)), g_rom_size);
-    md5_finish(&state, digest);
+    /* Calculate MD5 hash, unless the hash index already knows this ROM */
+    if (!hash_index_search(xxh3, size, digest))
+    {
+        md5_init(&state);
+        md5_append(&state, (const md5_byte_t*)((uint8_t*)mem_base_u32(g_mem_base, MM_CART_ROM)), g_rom_size);
+        md5_finish(&state, digest);
+        hash_index_add(xxh3, size, digest);
+    }
     for ( i = 0; i < 16; ++i )
         sprintf(buffer+i*2, "%02X", digest[i]);
     buffer[32] = '\0';
@@ -442,6 +585,7 @@ static unsigned char rom_homebrew_savetype_to_savetype(uint8_t save_type)
     return m64p_save_type;
 }
 
+#if !defined(ROMDB_PRECOMPILED)
 static size_t romdatabase_resolve_round(void)
 {
     romdatabase_search *entry;
@@ -573,10 +717,122 @@ static void romdatabase_resolve(void)
         last_skipped = skipped;
     } while (skipped > 0);
 }
+#endif
 
 /********************************************************************************************/
 /* INI Rom database functions */
 
+/* Loads the hash index sitting next to the ini file. Each line holds the
+ * XXH3 digest, the size and the MD5 of a rom. */
+static void hash_index_open(const char* ini_path)
+{
+    FILE *fPtr;
+    char buffer[256];
+    const char* name = strrchr(ini_path, '/');
+    const char* bsname = strrchr(ini_path, '\\');
+    size_t dirlen;
+
+    if (bsname != NULL && (name == NULL || bsname > name))
+        name = bsname;
+    dirlen = (name == NULL) ? 0 : (size_t)(name - ini_path + 1);
+
+    g_romdatabase.hash_path = malloc(dirlen + sizeof("mupen64plus.xxh3"));
+    if (g_romdatabase.hash_path == NULL)
+        return;
+    memcpy(g_romdatabase.hash_path, ini_path, dirlen);
+    strcpy(g_romdatabase.hash_path + dirlen, "mupen64plus.xxh3");
+
+    if ((fPtr = fopen(g_romdatabase.hash_path, "rb")) == NULL)
+        return;
+
+    while (fgets(buffer, 255, fPtr) != NULL)
+    {
+        romdatabase_hash* hashes;
+        unsigned long long xxh3;
+        unsigned int size;
+        char md5str[33];
+        md5_byte_t md5[16];
+
+        if (sscanf(buffer, "%16llX %u %32s", &xxh3, &size, md5str) != 3 || !parse_hex(md5str, md5, 16))
+            continue;
+
+        hashes = realloc(g_romdatabase.hashes, (g_romdatabase.hash_count + 1) * sizeof(*hashes));
+        if (hashes == NULL)
+            break;
+
+        g_romdatabase.hashes = hashes;
+        hashes[g_romdatabase.hash_count].xxh3 = xxh3;
+        hashes[g_romdatabase.hash_count].size = size;
+        memcpy(hashes[g_romdatabase.hash_count].md5, md5, 16);
+        ++g_romdatabase.hash_count;
+    }
+
+    fclose(fPtr);
+}
+
+static int hash_index_search(uint64_t xxh3, uint32_t size, md5_byte_t* md5)
+{
+    size_t i;
+
+    for (i = 0; i < g_romdatabase.hash_count; ++i)
+    {
+        if (g_romdatabase.hashes[i].xxh3 == xxh3 && g_romdatabase.hashes[i].size == size)
+        {
+            memcpy(md5, g_romdatabase.hashes[i].md5, 16);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void hash_index_add(uint64_t xxh3, uint32_t size, const md5_byte_t* md5)
+{
+    FILE *fPtr;
+    romdatabase_hash* hashes;
+    int i;
+
+    if (g_romdatabase.hash_path == NULL)
+        return;
+
+    hashes = realloc(g_romdatabase.hashes, (g_romdatabase.hash_count + 1) * sizeof(*hashes));
+    if (hashes != NULL)
+    {
+        g_romdatabase.hashes = hashes;
+        hashes[g_romdatabase.hash_count].xxh3 = xxh3;
+        hashes[g_romdatabase.hash_count].size = size;
+        memcpy(hashes[g_romdatabase.hash_count].md5, md5, 16);
+        ++g_romdatabase.hash_count;
+    }
+
+    if ((fPtr = fopen(g_romdatabase.hash_path, "ab")) == NULL)
+    {
+        DebugMessage(M64MSG_VERBOSE, "Unable to update rom hash index '%s'.", g_romdatabase.hash_path);
+        return;
+    }
+
+    fprintf(fPtr, "%016" PRIX64 " %" PRIu32 " ", xxh3, size);
+    for (i = 0; i < 16; ++i)
+        fprintf(fPtr, "%02X", md5[i]);
+    fprintf(fPtr, "\n");
+    fclose(fPtr);
+}
+
+#if defined(ROMDB_PRECOMPILED)
+void romdatabase_open(void)
+{
+    const char *pathname = ConfigGetSharedDataFilepath("mupen64plus.ini");
+
+    if(g_romdatabase.have_database)
+        return;
+
+    /* entries are already resolved and indexed, there is nothing to parse */
+    g_romdatabase.have_database = 1;
+
+    if (pathname != NULL)
+        hash_index_open(pathname);
+}
+#else
 void romdatabase_open(void)
 {
     FILE *fPtr;
@@ -866,7 +1122,9 @@ void romdatabase_open(void)
 
     fclose(fPtr);
     romdatabase_resolve();
+    hash_index_open(pathname);
 }
+#endif
 
 void romdatabase_close(void)
 {
@@ -885,9 +1143,85 @@ void romdatabase_close(void)
         g_romdatabase.list = search;
         }
 
+    free(g_romdatabase.hashes);
+    g_romdatabase.hashes = NULL;
+    g_romdatabase.hash_count = 0;
+    free(g_romdatabase.hash_path);
+    g_romdatabase.hash_path = NULL;
+
     g_romdatabase.have_database = 0;
 }
 
+#if defined(ROMDB_PRECOMPILED)
+static romdatabase_entry* ini_search_by_md5(md5_byte_t* md5)
+{
+    size_t first, last;
+
+    if(!g_romdatabase.have_database)
+        return NULL;
+
+    /* binary search among the entries sharing the first MD5 byte */
+    first = romdb_md5_buckets[md5[0]];
+    last = romdb_md5_buckets[md5[0] + 1];
+
+    while (first < last)
+    {
+        size_t middle = (first + last) / 2;
+        const romdatabase_entry* entry = &romdb_entries[romdb_md5_index[middle]];
+        int cmp = memcmp(entry->md5, md5, 16);
+
+        if (cmp == 0)
+            return (romdatabase_entry*)entry; /* OK to cast away const qualifier */
+        else if (cmp < 0)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+
+    return NULL;
+}
+
+romdatabase_entry* ini_search_by_crc(unsigned int crc1, unsigned int crc2)
+{
+    size_t first, last;
+    const romdatabase_entry* entry;
+
+    if(!g_romdatabase.have_database)
+        return NULL;
+
+    /* find the first entry of the first CRC byte bucket not lower than crc1/crc2 */
+    first = romdb_crc_buckets[(crc1 >> 24) & 0xff];
+    last = romdb_crc_buckets[((crc1 >> 24) & 0xff) + 1];
+
+    while (first < last)
+    {
+        size_t middle = (first + last) / 2;
+        entry = &romdb_entries[romdb_crc_index[middle]];
+
+        if (entry->crc1 < crc1 || (entry->crc1 == crc1 && entry->crc2 < crc2))
+            first = middle + 1;
+        else
+            last = middle;
+    }
+
+    if (first == romdb_crc_buckets[((crc1 >> 24) & 0xff) + 1])
+        return NULL;
+
+    entry = &romdb_entries[romdb_crc_index[first]];
+    if (entry->crc1 != crc1 || entry->crc2 != crc2)
+        return NULL;
+
+    // because CRCs can be ambiguous (there can be multiple database entries with the same CRC),
+    // we will prefer MD5 hashes instead. If the given CRC matches more than one entry in the
+    // database, we will return no match.
+    if (first + 1 < sizeof(romdb_crc_index) / sizeof(romdb_crc_index[0])
+     && romdb_entries[romdb_crc_index[first + 1]].crc1 == crc1
+     && romdb_entries[romdb_crc_index[first + 1]].crc2 == crc2)
+        return NULL;
+
+    return (romdatabase_entry*)entry; /* OK to cast away const qualifier */
+}
+#else
 static romdatabase_entry* ini_search_by_md5(md5_byte_t* md5)
 {
     romdatabase_search* search;
@@ -932,5 +1266,6 @@ romdatabase_entry* ini_search_by_crc(unsigned int crc1, unsigned int crc2)
 
     return found_entry;
 }
+#endif
 
 
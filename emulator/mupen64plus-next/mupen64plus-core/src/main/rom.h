@@ -144,12 +144,26 @@ typedef struct _romdatabase_search
     struct _romdatabase_search* next_md5;
 } romdatabase_search;
 
+/* The hash index maps the XXH3 digest of a rom, computed in parallel while it
+ * is byte-swapped, to its MD5. This avoids hashing the whole rom twice once it
+ * has been seen. The index is generated next to the ini file.
+ */
+typedef struct
+{
+    uint64_t xxh3;
+    uint32_t size;
+    uint8_t md5[16];
+} romdatabase_hash;
+
 typedef struct
 {
     int have_database;
     romdatabase_search* crc_lists[256];
     romdatabase_search* md5_lists[256];
     romdatabase_search* list;
+    romdatabase_hash* hashes;
+    size_t hash_count;
+    char* hash_path;
 } _romdatabase;
 
 void romdatabase_open(void);
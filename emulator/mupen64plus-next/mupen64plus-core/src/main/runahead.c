@@ -0,0 +1,113 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - runahead.c                                              *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+/* Native run-ahead.
+ *
+ * The real frame runs with its video hidden and its state is saved at the
+ * following VI. The core then runs RunAheadFrames frames further with the
+ * current input, presents the last one and loads the saved state back.
+ * retro_speculative_frame tells the video, audio and OSD paths which work
+ * will be thrown away so that the hidden frames stay cheap.
+ * The state goes through the snapshot job rather than the frontend's
+ * savestate job: the load back to the real frame is still pending when the
+ * last frame is presented, and a retro_serialize in between must neither
+ * replace it nor save the speculative state.
+ * Only the first save is a full image. The later ones are deltas against
+ * it, and each load applies its delta to the base in place, so that the
+ * base stays the last real frame and the next delta only holds what one
+ * frame wrote. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libretro.h>
+#include <mupen64plus-next_common.h>
+
+#include "api/callbacks.h"
+#include "api/m64p_types.h"
+#include "netplay.h"
+#include "runahead.h"
+#include "savestates.h"
+#include "savestates_delta.h"
+
+#define RUNAHEAD_MAX_FRAMES 4
+
+static struct savestate_snapshot l_state;
+static uint32_t l_remaining;
+static int l_ahead;
+
+int runahead_vi(void)
+{
+    if (RunAheadFrames == 0 || netplay_is_init()) {
+        if (l_state.base != NULL)
+            runahead_deinit();
+        return 1;
+    }
+
+    if (l_state.base == NULL) {
+        if ((l_state.base = calloc(1, retro_serialize_size())) == NULL) {
+            DebugMessage(M64MSG_WARNING, "Run-ahead: could not allocate the savestate buffer");
+            RunAheadFrames = 0;
+            return 1;
+        }
+        l_ahead = 0;
+    }
+
+    if (l_ahead) {
+        if (--l_remaining != 0) {
+            retro_speculative_frame = (l_remaining == 1) ? RETRO_SPECULATIVE_AUDIO
+                                    : RETRO_SPECULATIVE_VIDEO | RETRO_SPECULATIVE_AUDIO;
+            return 0;
+        }
+
+        /* present the last speculative frame, then go back to the real one */
+        l_ahead = 0;
+        retro_speculative_frame = RETRO_SPECULATIVE_VIDEO;
+        savestates_set_snapshot_job(savestates_job_load, &l_state, 1);
+        return 1;
+    }
+
+    /* the frontend owns the savestate job this VI, present the real frame */
+    if (savestates_get_job() != savestates_job_nothing) {
+        retro_speculative_frame = 0;
+        return 1;
+    }
+
+    /* the real frame has just been emulated, save it and run ahead */
+    l_remaining = (RunAheadFrames < RUNAHEAD_MAX_FRAMES) ? RunAheadFrames : RUNAHEAD_MAX_FRAMES;
+    l_ahead = 1;
+    retro_speculative_frame = (l_remaining == 1) ? RETRO_SPECULATIVE_AUDIO
+                            : RETRO_SPECULATIVE_VIDEO | RETRO_SPECULATIVE_AUDIO;
+    savestates_set_snapshot_job(savestates_job_save, &l_state, !l_state.valid);
+    return 0;
+}
+
+void runahead_deinit(void)
+{
+    if (l_state.base != NULL)
+        savestates_set_snapshot_job(savestates_job_nothing, NULL, 0);
+    savestates_snapshot_free_base(l_state.base);
+    free(l_state.base);
+    free(l_state.delta);
+    memset(&l_state, 0, sizeof(l_state));
+    l_ahead = 0;
+    retro_speculative_frame = 0;
+}
@@ -45,11 +45,13 @@
 #include "device/device.h"
 #include "main/list.h"
 #include "main/main.h"
+#include "main/profile.h"
 #include "osal/preproc.h"
 #include "osd/osd.h"
 #include "plugin/plugin.h"
 #include "rom.h"
 #include "savestates.h"
+#include "savestates_delta.h"
 #include "util.h"
 #include "workqueue.h"
 
@@ -63,6 +65,8 @@ enum { GB_CART_FINGERPRINT_OFFSET = 0x134 };
 
 enum { DD_DISK_ID_OFFSET = 0x43670 };
 
+enum { M64P_SAVESTATE_SIZE = 16788288 + 1024 + 4 + 4096 };
+
 static const char* savestate_magic = "M64+SAVE";
 static const int savestate_latest_version = 0x00010900;  /* 1.9 */
 static const unsigned char pj64_magic[4] = { 0xC8, 0xA6, 0xD8, 0x23 };
@@ -77,21 +81,31 @@ static char *fname = NULL;
 static unsigned int slot = 0;
 static int autoinc_save_slot = 0;
 
+/* offset of the dram section inside a m64p image */
+static size_t m64p_dram_offset = 0;
+
+#ifdef __LIBRETRO__
+static savestates_job snapshot_job = savestates_job_nothing;
+static struct savestate_snapshot *snapshot = NULL;
+static int snapshot_rebase = 0;
+/* m64p image the snapshot deltas are encoded from and applied to */
+static char *snapshot_image = NULL;
+#endif
+
 #ifdef USE_SDL
 static SDL_mutex *savestates_lock;
 #else
 static pthread_mutex_t savestates_lock;
 #endif
 
+#ifndef __LIBRETRO__
 struct savestate_work {
     char *filepath;
     char *data;
     size_t size;
     struct work_struct work;
-#ifdef __LIBRETRO__
-    void *mempointer;
-#endif
 };
+#endif
 
 /* Returns the malloc'd full path of the currently selected savestate. */
 static char *savestates_generate_path(savestates_type type)
@@ -193,6 +207,30 @@ static void savestates_clear_job(void)
     savestates_set_job(savestates_job_nothing, savestates_type_unknown, NULL);
 }
 
+#ifdef __LIBRETRO__
+savestates_job savestates_get_snapshot_job(void)
+{
+    return snapshot_job;
+}
+
+struct savestate_snapshot *savestates_get_snapshot(void)
+{
+    return snapshot;
+}
+
+void savestates_set_snapshot_job(savestates_job j, struct savestate_snapshot *snap, int rebase)
+{
+    snapshot_job = j;
+    snapshot = snap;
+    snapshot_rebase = rebase;
+}
+
+static void savestates_clear_snapshot_job(void)
+{
+    savestates_set_snapshot_job(savestates_job_nothing, NULL, 0);
+}
+#endif
+
 #define GETARRAY(buff, type, count) \
     (to_little_endian_buffer(buff, sizeof(type),count), \
      buff += count*sizeof(type), \
@@ -208,6 +246,27 @@ static void savestates_clear_job(void)
 #define PUTDATA(buff, type, value) \
     do { type x = value; PUTARRAY(&x, buff, type, 1); } while(0)
 
+/* Copy a dram image into dram, page by page, and mark only the pages it
+ * changes as written: loading a state close to the current one, as
+ * rollback and run-ahead do, then leaves little for the dirty page
+ * clients to rescan. */
+static void savestates_copy_dram(struct rdram* rdram, const uint32_t* src)
+{
+    uint32_t page;
+
+    for (page = 0; page < RDRAM_DIRTY_PAGES_COUNT; ++page)
+    {
+        uint32_t* dst = rdram->dram + page * (RDRAM_DIRTY_PAGE_SIZE / 4);
+        const uint32_t* from = src + page * (RDRAM_DIRTY_PAGE_SIZE / 4);
+
+        if (memcmp(dst, from, RDRAM_DIRTY_PAGE_SIZE) == 0)
+            continue;
+
+        memcpy(dst, from, RDRAM_DIRTY_PAGE_SIZE);
+        rdram_mark_dirty(rdram, page << RDRAM_DIRTY_PAGE_SHIFT, RDRAM_DIRTY_PAGE_SIZE);
+    }
+}
+
 #ifndef __LIBRETRO__
 int savestates_load_m64p(struct device* dev, char *filepath)
 #else
@@ -515,7 +574,8 @@ int savestates_load_m64p(struct device* dev, const void *data)
     dev->dp.dps_regs[DPS_BUFTEST_ADDR_REG] = GETDATA(curr, uint32_t);
     dev->dp.dps_regs[DPS_BUFTEST_DATA_REG] = GETDATA(curr, uint32_t);
 
-    COPYARRAY(dev->rdram.dram, curr, uint32_t, RDRAM_MAX_SIZE/4);
+    m64p_dram_offset = 44 + (curr - savestateData);
+    savestates_copy_dram(&dev->rdram, GETARRAY(curr, uint32_t, RDRAM_MAX_SIZE/4));
     COPYARRAY(dev->sp.mem, curr, uint32_t, SP_MEM_SIZE/4);
     COPYARRAY(dev->pif.ram, curr, uint8_t, PIF_RAM_SIZE);
 
@@ -524,8 +584,13 @@ int savestates_load_m64p(struct device* dev, const void *data)
     /* by default, reset flashram state here and load it later if available */
     poweron_flashram(&dev->cart.flashram);
 
+#ifdef MICRO_TLB
+    /* translations are rebuilt from the entries below */
+    curr += 2 * 0x100000 * sizeof(uint32_t);
+#else
     COPYARRAY(dev->r4300.cp0.tlb.LUT_r, curr, uint32_t, 0x100000);
     COPYARRAY(dev->r4300.cp0.tlb.LUT_w, curr, uint32_t, 0x100000);
+#endif
 
     *r4300_llbit(&dev->r4300) = GETDATA(curr, uint32_t);
     COPYARRAY(r4300_regs(&dev->r4300), curr, int64_t, 32);
@@ -566,6 +631,9 @@ int savestates_load_m64p(struct device* dev, const void *data)
         dev->r4300.cp0.tlb.entries[i].end_odd = GETDATA(curr, uint32_t);
         dev->r4300.cp0.tlb.entries[i].phys_odd = GETDATA(curr, uint32_t);
     }
+#ifdef MICRO_TLB
+    tlb_flush_micro(&dev->r4300.cp0.tlb);
+#endif
 
     savestates_load_set_pc(&dev->r4300, GETDATA(curr, uint32_t));
 
@@ -1044,6 +1112,7 @@ int savestates_load_m64p(struct device* dev, const void *data)
 
     /* reset fb state */
     poweron_fb(&dev->dp.fb);
+    rdp_reset_dram_writes(&dev->dp);
 
     dev->sp.rsp_task_locked = 0;
     dev->r4300.cp0.interrupt_unsafe_state = 0;
@@ -1280,8 +1349,10 @@ static int savestates_load_pj64(struct device* dev,
     dev->si.regs[SI_STATUS_REG]         = GETDATA(curr, uint32_t);
 
     // tlb
+#ifndef MICRO_TLB
     memset(dev->r4300.cp0.tlb.LUT_r, 0, 0x400000);
     memset(dev->r4300.cp0.tlb.LUT_w, 0, 0x400000);
+#endif
     for (i=0; i < 32; i++)
     {
         unsigned int MyPageMask, MyEntryHi, MyEntryLo0, MyEntryLo1;
@@ -1357,6 +1428,10 @@ static int savestates_load_pj64(struct device* dev,
 
     /* extra fb state */
     poweron_fb(&dev->dp.fb);
+    rdp_reset_dram_writes(&dev->dp);
+
+    /* all of dram was replaced */
+    rdram_mark_untracked(&dev->rdram);
 
     /* extra af-rtc state */
     dev->cart.af_rtc.control = 0x200;
@@ -1583,10 +1658,15 @@ int savestates_load(void)
     StateChanged(M64CORE_STATE_LOADCOMPLETE, ret);
 
     savestates_clear_job();
+#ifdef __LIBRETRO__
+    /* the loaded state replaces the one a snapshot would have restored */
+    savestates_clear_snapshot_job();
+#endif
 
     return ret;
 }
 
+#ifndef __LIBRETRO__
 static void savestates_save_m64p_work(struct work_struct *work)
 {
     struct savestate_work *save = container_of(work, struct savestate_work, work);
@@ -1597,7 +1677,6 @@ static void savestates_save_m64p_work(struct work_struct *work)
     pthread_mutex_lock(&savestates_lock);
 #endif
 
-#ifndef __LIBRETRO__
     // Write the state to a GZIP file
     gzFile f;
     int gzres;
@@ -1623,13 +1702,8 @@ static void savestates_save_m64p_work(struct work_struct *work)
 
     gzclose(f);
     main_message(M64MSG_STATUS, OSD_BOTTOM_LEFT, "Saved state to: %s", namefrompath(save->filepath));
-#else
-    memcpy(save->mempointer, save->data, save->size);
-#endif
     free(save->data);
-#ifndef __LIBRETRO__
     free(save->filepath);
-#endif
     free(save);
 
 #ifdef USE_SDL
@@ -1639,57 +1713,25 @@ static void savestates_save_m64p_work(struct work_struct *work)
     pthread_mutex_unlock(&savestates_lock);
 #endif
 }
+#endif // __LIBRETRO__
 
-#ifndef __LIBRETRO__
-int savestates_save_m64p(const struct device* dev, char *filepath)
-#else
-int savestates_save_m64p(const struct device* dev, void *data)
-#endif
+/* Serialize the whole state in m64p format at curr and return the end of it.
+ * Every byte up to the returned pointer is written, so curr doesn't need to
+ * be cleared beforehand. When with_dram is 0 the dram section is skipped
+ * and left untouched. */
+static char *savestates_put_m64p(const struct device* dev, char *curr, int with_dram)
 {
     unsigned char outbuf[4];
     int i;
 
     char queue[1024];
-
-    struct savestate_work *save;
-    char *curr;
+    char *start = curr;
 
     /* OK to cast away const qualifier */
     const uint32_t* cp0_regs = r4300_cp0_regs((struct cp0*)&dev->r4300.cp0);
 
-    save = malloc(sizeof(*save));
-    if (!save) {
-        main_message(M64MSG_STATUS, OSD_BOTTOM_LEFT, "Insufficient memory to save state.");
-        StateChanged(M64CORE_STATE_SAVECOMPLETE, 0);
-        return 0;
-    }
-
-#ifndef __LIBRETRO__
-    save->filepath = strdup(filepath);
-#else
-    save->mempointer = data;
-#endif
-
-    if(autoinc_save_slot)
-        savestates_inc_slot();
-
     save_eventqueue_infos(&dev->r4300.cp0, queue);
 
-    // Allocate memory for the save state data
-    save->size = 16788288 + sizeof(queue) + 4 + 4096;
-    save->data = curr = malloc(save->size);
-    if (save->data == NULL)
-    {
-        free(save->filepath);
-        free(save);
-        main_message(M64MSG_STATUS, OSD_BOTTOM_LEFT, "Insufficient memory to save state.");
-        StateChanged(M64CORE_STATE_SAVECOMPLETE, 0);
-        return 0;
-    }
-
-    memset(save->data, 0, save->size);
-
-    // Write the save state data to memory
     PUTARRAY(savestate_magic, curr, unsigned char, 8);
 
     outbuf[0] = (savestate_latest_version >> 24) & 0xff;
@@ -1840,15 +1882,29 @@ int savestates_save_m64p(const struct device* dev, void *data)
     PUTDATA(curr, uint32_t, dev->dp.dps_regs[DPS_BUFTEST_ADDR_REG]);
     PUTDATA(curr, uint32_t, dev->dp.dps_regs[DPS_BUFTEST_DATA_REG]);
 
-    PUTARRAY(dev->rdram.dram, curr, uint32_t, RDRAM_MAX_SIZE/4);
+    m64p_dram_offset = curr - start;
+    if (with_dram) {
+        PUTARRAY(dev->rdram.dram, curr, uint32_t, RDRAM_MAX_SIZE/4);
+    }
+    else {
+        curr += RDRAM_MAX_SIZE;
+    }
     PUTARRAY(dev->sp.mem, curr, uint32_t, SP_MEM_SIZE/4);
     PUTARRAY(dev->pif.ram, curr, uint8_t, PIF_RAM_SIZE);
 
     PUTDATA(curr, int32_t, dev->cart.use_flashram);
+    memset(curr, 0, 4+8+4+4);
     curr += 4+8+4+4; // Here used to be flashram state
 
+#ifdef MICRO_TLB
+    tlb_build_lut(&dev->r4300.cp0.tlb, (unsigned char*)curr, 0);
+    curr += 0x100000 * sizeof(uint32_t);
+    tlb_build_lut(&dev->r4300.cp0.tlb, (unsigned char*)curr, 1);
+    curr += 0x100000 * sizeof(uint32_t);
+#else
     PUTARRAY(dev->r4300.cp0.tlb.LUT_r, curr, uint32_t, 0x100000);
     PUTARRAY(dev->r4300.cp0.tlb.LUT_w, curr, uint32_t, 0x100000);
+#endif
 
     /* OK to cast away const qualifier */
     PUTDATA(curr, uint32_t, *r4300_llbit((struct r4300_core*)&dev->r4300));
@@ -1984,6 +2040,7 @@ int savestates_save_m64p(const struct device* dev, void *data)
 
     if (disk_id == NULL) {
         PUTDATA(curr, uint32_t, 0);
+        memset(curr, 0, (3+DD_ASIC_REGS_COUNT)*sizeof(uint32_t) + 0x100 + 0x40 + 2*sizeof(int64_t) + 2*sizeof(uint32_t));
         curr += (3+DD_ASIC_REGS_COUNT)*sizeof(uint32_t) + 0x100 + 0x40 + 2*sizeof(int64_t) + 2*sizeof(uint32_t);
     }
     else {
@@ -2046,11 +2103,161 @@ int savestates_save_m64p(const struct device* dev, void *data)
     PUTDATA(curr, uint64_t, *r4300_cp0_latch((struct cp0*)&dev->r4300.cp0));
     PUTDATA(curr, uint64_t, *r4300_cp2_latch((struct cp2*)&dev->r4300.cp2));
 
+    return curr;
+}
+
+#ifndef __LIBRETRO__
+int savestates_save_m64p(const struct device* dev, char *filepath)
+#else
+int savestates_save_m64p(const struct device* dev, void *data)
+#endif
+{
+#ifdef __LIBRETRO__
+    char *end;
+
+    if(autoinc_save_slot)
+        savestates_inc_slot();
+
+    /* Serialize straight into the frontend's buffer: no intermediate
+     * allocation and no extra copy. */
+#ifdef USE_SDL
+    SDL_LockMutex(savestates_lock);
+#else
+    pthread_mutex_lock(&savestates_lock);
+#endif
+#if defined(PROFILE)
+    timed_section_start(TIMED_SECTION_SAVESTATE);
+#endif
+    end = savestates_put_m64p(dev, (char *)data, 1);
+    memset(end, 0, M64P_SAVESTATE_SIZE - (end - (char *)data));
+#if defined(PROFILE)
+    timed_section_end(TIMED_SECTION_SAVESTATE);
+#endif
+#ifdef USE_SDL
+    SDL_UnlockMutex(savestates_lock);
+#else
+    pthread_mutex_unlock(&savestates_lock);
+#endif
+
+    return 1;
+#else
+    struct savestate_work *save;
+
+    save = malloc(sizeof(*save));
+    if (!save) {
+        main_message(M64MSG_STATUS, OSD_BOTTOM_LEFT, "Insufficient memory to save state.");
+        StateChanged(M64CORE_STATE_SAVECOMPLETE, 0);
+        return 0;
+    }
+
+    save->filepath = strdup(filepath);
+
+    if(autoinc_save_slot)
+        savestates_inc_slot();
+
+    // Allocate memory for the save state data
+    save->size = M64P_SAVESTATE_SIZE;
+    save->data = malloc(save->size);
+    if (save->data == NULL)
+    {
+        free(save->filepath);
+        free(save);
+        main_message(M64MSG_STATUS, OSD_BOTTOM_LEFT, "Insufficient memory to save state.");
+        StateChanged(M64CORE_STATE_SAVECOMPLETE, 0);
+        return 0;
+    }
+
+    memset(save->data, 0, save->size);
+
+#if defined(PROFILE)
+    timed_section_start(TIMED_SECTION_SAVESTATE);
+#endif
+    // Write the save state data to memory
+    savestates_put_m64p(dev, save->data, 1);
+#if defined(PROFILE)
+    timed_section_end(TIMED_SECTION_SAVESTATE);
+#endif
+
     init_work(&save->work, savestates_save_m64p_work);
     queue_work(&save->work);
 
+    return 1;
+#endif // __LIBRETRO__
+}
+
+#ifdef __LIBRETRO__
+static int savestates_snapshot_alloc_image(void)
+{
+    if (snapshot_image == NULL && (snapshot_image = calloc(1, M64P_SAVESTATE_SIZE)) == NULL) {
+        DebugMessage(M64MSG_ERROR, "Insufficient memory for savestate snapshots.");
+        return 0;
+    }
+    return 1;
+}
+
+int savestates_snapshot_save(void)
+{
+    struct device* dev = &g_dev;
+    struct savestate_snapshot *snap = snapshot;
+    int rebase = snapshot_rebase;
+    int ret;
+    char *end;
+
+    savestates_clear_snapshot_job();
+
+#if defined(PROFILE)
+    timed_section_start(TIMED_SECTION_SAVESTATE);
+#endif
+
+    if (rebase) {
+        savestates_put_m64p(dev, snap->base, 1);
+        ret = savestates_snapshot_saved(snap, 1, snap->base, M64P_SAVESTATE_SIZE, m64p_dram_offset,
+                                        &dev->rdram);
+    }
+    else if (savestates_snapshot_alloc_image()) {
+        /* dram is encoded straight from the device */
+        end = savestates_put_m64p(dev, snapshot_image, 0);
+        ret = savestates_snapshot_saved(snap, 0, snapshot_image, end - snapshot_image, m64p_dram_offset,
+                                        &dev->rdram);
+        if (!ret)
+            DebugMessage(M64MSG_ERROR, "Insufficient memory for a savestate snapshot.");
+    }
+    else {
+        snap->valid = 0;
+        ret = 0;
+    }
+
+#if defined(PROFILE)
+    timed_section_end(TIMED_SECTION_SAVESTATE);
+#endif
+    return ret;
+}
+
+int savestates_snapshot_load(void)
+{
+    struct device* dev = &g_dev;
+    struct savestate_snapshot *snap = snapshot;
+    int rebase = snapshot_rebase;
+    char *image;
+
+    savestates_clear_snapshot_job();
+
+    if (!rebase && !savestates_snapshot_alloc_image())
+        return 0;
+
+    image = savestates_snapshot_image(snap, rebase, snapshot_image, M64P_SAVESTATE_SIZE);
+    if (image == NULL) {
+        DebugMessage(M64MSG_ERROR, "Invalid savestate snapshot.");
+        return 0;
+    }
+
+    if (!savestates_load_m64p(dev, image))
+        return 0;
+
+    savestates_snapshot_loaded(snap, rebase, &dev->rdram, m64p_dram_offset);
     return 1;
 }
+#endif // __LIBRETRO__
 
 static int savestates_save_pj64(const struct device* dev,
                                 char *filepath, void *handle,
@@ -2362,4 +2569,9 @@ void savestates_deinit(void)
     SDL_DestroyMutex(savestates_lock);
 #endif
     savestates_clear_job();
+#ifdef __LIBRETRO__
+    savestates_clear_snapshot_job();
+    free(snapshot_image);
+    snapshot_image = NULL;
+#endif
 }
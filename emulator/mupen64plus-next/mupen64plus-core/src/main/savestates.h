@@ -25,6 +25,10 @@
 #ifndef __SAVESTAVES_H__
 #define __SAVESTAVES_H__
 
+#include <stddef.h>
+
+struct device;
+
 typedef enum _savestates_job
 {
     savestates_job_nothing,
@@ -61,5 +65,21 @@ int savestates_save_m64p(const struct device* dev, void *data);
 int savestates_load_m64p(struct device* dev, const void *data);
 #endif
 
+#ifdef __LIBRETRO__
+/* Snapshots (see savestates_delta.h) go through their own job, run at the
+ * same points as the frontend's one so that neither overwrites the other.
+ * A save with rebase set serializes the full image into snap->base, which
+ * becomes the base of the following deltas. A load with rebase set applies
+ * the delta to snap->base, which then holds the loaded image. */
+struct savestate_snapshot;
+
+savestates_job savestates_get_snapshot_job(void);
+/* the snapshot of the pending job, NULL when there is none */
+struct savestate_snapshot *savestates_get_snapshot(void);
+void savestates_set_snapshot_job(savestates_job j, struct savestate_snapshot *snap, int rebase);
+int savestates_snapshot_load(void);
+int savestates_snapshot_save(void);
+#endif
+
 #endif /* __SAVESTAVES_H__ */
 
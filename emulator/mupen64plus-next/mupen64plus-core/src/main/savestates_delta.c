@@ -0,0 +1,256 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - savestates_delta.c                                      *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "savestates_delta.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "device/memory/memory.h"
+#include "util.h"
+
+static const char* savestates_delta_magic = "M64+DLTA";
+static const uint32_t savestates_delta_version = 1;
+
+/* base the RDRAM_DIRTY_SAVESTATE pages are relative to */
+static const char *snapshot_base = NULL;
+
+static void delta_put32(char **curr, uint32_t value)
+{
+    store_leu32(value, (unsigned char *)*curr);
+    *curr += 4;
+}
+
+static int delta_put_chunk(char **curr, const char *end, const char *src, uint32_t offset, uint32_t length)
+{
+    if ((size_t)(end - *curr) < 8 + (size_t)length)
+        return 0;
+
+    delta_put32(curr, offset);
+    delta_put32(curr, length);
+    memcpy(*curr, src, length);
+    *curr += length;
+    return 1;
+}
+
+/* chunks of [begin, end) of image which differ from base */
+static int delta_put_range(char **curr, const char *end, const char *image, const char *base,
+                           size_t begin, size_t range_end, uint32_t *chunks)
+{
+    size_t offset, length;
+
+    for (offset = begin; offset < range_end; offset += length)
+    {
+        length = range_end - offset;
+        if (length > SAVESTATES_DELTA_CHUNK_SIZE)
+            length = SAVESTATES_DELTA_CHUNK_SIZE;
+
+        if (memcmp(image + offset, base + offset, length) == 0)
+            continue;
+
+        if (!delta_put_chunk(curr, end, image + offset, (uint32_t)offset, (uint32_t)length))
+            return 0;
+        ++*chunks;
+    }
+
+    return 1;
+}
+
+size_t savestates_delta_encode(const char *image, const char *base, size_t image_size, size_t dram_offset,
+                               const struct rdram *rdram, enum rdram_dirty_client client, int compare_dram,
+                               char *delta, size_t size)
+{
+    char *curr = delta;
+    char *end = delta + size;
+    uint32_t chunks = 0;
+    uint32_t w, page;
+#if defined(M64P_BIG_ENDIAN)
+    char page_le[SAVESTATES_DELTA_CHUNK_SIZE];
+#endif
+
+    if (size < SAVESTATES_DELTA_HEADER_SIZE || dram_offset + RDRAM_MAX_SIZE > image_size)
+        return 0;
+
+    curr += SAVESTATES_DELTA_HEADER_SIZE;
+
+    if (!delta_put_range(&curr, end, image, base, 0, dram_offset, &chunks))
+        return 0;
+
+    for (w = 0; w < RDRAM_DIRTY_PAGES_COUNT / 32; ++w)
+    {
+        uint32_t bits = compare_dram ? UINT32_MAX : rdram->dirty[client][w];
+
+        while (bits != 0)
+        {
+            const char *src;
+            uint32_t offset;
+
+            page = (w << 5) + __builtin_ctz(bits);
+            bits &= bits - 1;
+
+            offset = (uint32_t)dram_offset + (page << RDRAM_DIRTY_PAGE_SHIFT);
+            src = (const char *)rdram->dram + (page << RDRAM_DIRTY_PAGE_SHIFT);
+#if defined(M64P_BIG_ENDIAN)
+            /* images hold dram little endian */
+            memcpy(page_le, src, SAVESTATES_DELTA_CHUNK_SIZE);
+            to_little_endian_buffer(page_le, 4, SAVESTATES_DELTA_CHUNK_SIZE / 4);
+            src = page_le;
+#endif
+
+            /* a written page may still hold what the base has */
+            if (memcmp(src, base + offset, SAVESTATES_DELTA_CHUNK_SIZE) == 0)
+                continue;
+
+            if (!delta_put_chunk(&curr, end, src, offset, SAVESTATES_DELTA_CHUNK_SIZE))
+                return 0;
+            ++chunks;
+        }
+    }
+
+    if (!delta_put_range(&curr, end, image, base, dram_offset + RDRAM_MAX_SIZE, image_size, &chunks))
+        return 0;
+
+    memcpy(delta, savestates_delta_magic, 8);
+    store_leu32(savestates_delta_version, (unsigned char *)delta + 8);
+    store_leu32((uint32_t)image_size, (unsigned char *)delta + 12);
+    store_leu32(chunks, (unsigned char *)delta + 16);
+
+    return curr - delta;
+}
+
+int savestates_delta_apply(char *image, size_t image_size, const char *delta, size_t size)
+{
+    const unsigned char *data = (const unsigned char *)delta;
+    const unsigned char *curr;
+    uint32_t chunks, i, offset, length;
+
+    if (size < SAVESTATES_DELTA_HEADER_SIZE || memcmp(data, savestates_delta_magic, 8) != 0
+     || load_leu32(data + 8) != savestates_delta_version
+     || load_leu32(data + 12) > image_size)
+        return 0;
+
+    chunks = load_leu32(data + 16);
+    curr = data + SAVESTATES_DELTA_HEADER_SIZE;
+    for (i = 0; i < chunks; ++i)
+    {
+        if ((size_t)(data + size - curr) < 8)
+            return 0;
+        offset = load_leu32(curr);
+        length = load_leu32(curr + 4);
+        curr += 8;
+        if (offset > image_size || length > image_size - offset
+         || (size_t)(data + size - curr) < length)
+            return 0;
+        memcpy(image + offset, curr, length);
+        curr += length;
+    }
+
+    return 1;
+}
+
+void savestates_delta_mark_dram(struct rdram *rdram, const char *delta, size_t dram_offset)
+{
+    const unsigned char *curr = (const unsigned char *)delta + SAVESTATES_DELTA_HEADER_SIZE;
+    uint32_t chunks = load_leu32((const unsigned char *)delta + 16);
+    uint32_t i, offset, length;
+
+    for (i = 0; i < chunks; ++i)
+    {
+        offset = load_leu32(curr);
+        length = load_leu32(curr + 4);
+        curr += 8 + length;
+        if (offset >= dram_offset && offset < dram_offset + RDRAM_MAX_SIZE)
+            rdram_mark_dirty(rdram, (uint32_t)(offset - dram_offset), length);
+    }
+}
+
+int savestates_snapshot_saved(struct savestate_snapshot *snap, int rebase,
+                              const char *image, size_t image_size, size_t dram_offset,
+                              struct rdram *rdram)
+{
+    size_t max_size = SAVESTATES_DELTA_MAX_SIZE(image_size);
+    size_t size;
+    int compare_dram;
+
+    if (rebase) {
+        snap->delta_size = 0;
+        snap->valid = 1;
+        snapshot_base = snap->base;
+        rdram_clear_dirty(rdram, RDRAM_DIRTY_SAVESTATE);
+        return 1;
+    }
+
+    /* the written pages are only known relative to snapshot_base */
+    compare_dram = snap->base != snapshot_base || rdram->untracked[RDRAM_DIRTY_SAVESTATE];
+
+    /* grow the delta buffer geometrically, most snapshots stay small */
+    while ((size = savestates_delta_encode(image, snap->base, image_size, dram_offset,
+                                           rdram, RDRAM_DIRTY_SAVESTATE, compare_dram,
+                                           snap->delta, snap->delta_capacity)) == 0
+        && snap->delta_capacity < max_size) {
+        size_t capacity = (snap->delta_capacity < 0x10000) ? 0x10000 : 2 * snap->delta_capacity;
+        char *delta;
+
+        if (capacity > max_size)
+            capacity = max_size;
+        if ((delta = realloc(snap->delta, capacity)) == NULL)
+            break;
+        snap->delta = delta;
+        snap->delta_capacity = capacity;
+    }
+
+    snap->delta_size = size;
+    snap->valid = (size != 0);
+    return snap->valid;
+}
+
+char *savestates_snapshot_image(struct savestate_snapshot *snap, int rebase, char *image, size_t image_size)
+{
+    if (!snap->valid)
+        return NULL;
+
+    if (rebase)
+        image = snap->base;
+    else
+        memcpy(image, snap->base, image_size);
+
+    if (snap->delta_size != 0 && !savestates_delta_apply(image, image_size, snap->delta, snap->delta_size))
+        return NULL;
+
+    return image;
+}
+
+void savestates_snapshot_loaded(struct savestate_snapshot *snap, int rebase,
+                                struct rdram *rdram, size_t dram_offset)
+{
+    rdram_clear_dirty(rdram, RDRAM_DIRTY_SAVESTATE);
+    if (rebase)
+        snap->delta_size = 0;
+    else if (snap->delta_size != 0)
+        savestates_delta_mark_dram(rdram, snap->delta, dram_offset);
+    snapshot_base = snap->base;
+}
+
+void savestates_snapshot_free_base(const char *base)
+{
+    if (snapshot_base == base)
+        snapshot_base = NULL;
+}
@@ -0,0 +1,91 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - savestates_delta.h                                      *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef M64P_MAIN_SAVESTATES_DELTA_H
+#define M64P_MAIN_SAVESTATES_DELTA_H
+
+#include <stddef.h>
+
+#include "device/rdram/rdram.h"
+
+/* Delta savestates: a m64p image stored as the chunks which differ from a
+ * base image. Layout: magic, version, image size, chunk count, then for
+ * each chunk: offset, length, data. */
+enum { SAVESTATES_DELTA_HEADER_SIZE = 8 + 3*4 };
+enum { SAVESTATES_DELTA_CHUNK_SIZE = RDRAM_DIRTY_PAGE_SIZE };
+
+/* largest delta of an image_size bytes image */
+#define SAVESTATES_DELTA_MAX_SIZE(image_size) \
+    (SAVESTATES_DELTA_HEADER_SIZE + (image_size) + 8 * ((image_size) / SAVESTATES_DELTA_CHUNK_SIZE + 2))
+
+/* Encodes the first image_size bytes of image against base. The dram
+ * section at dram_offset is not read from image: its chunks are the pages
+ * of rdram the client saw written since base was taken, and are compared
+ * against base only when compare_dram is set. Returns the size of the
+ * delta, or 0 when it does not fit in size bytes. */
+size_t savestates_delta_encode(const char *image, const char *base, size_t image_size, size_t dram_offset,
+                               const struct rdram *rdram, enum rdram_dirty_client client, int compare_dram,
+                               char *delta, size_t size);
+
+/* Applies a delta to image, which holds its base and is at least as large
+ * as the image the delta was encoded from. Returns 0, leaving image
+ * partially patched, when the delta is invalid. */
+int savestates_delta_apply(char *image, size_t image_size, const char *delta, size_t size);
+
+/* Marks the dram chunks of a valid delta as written in rdram */
+void savestates_delta_mark_dram(struct rdram *rdram, const char *delta, size_t dram_offset);
+
+/* Snapshots are the savestates the core takes of itself (rollback,
+ * run-ahead). They hold the chunks of the m64p image which differ from a
+ * base image, which several snapshots may share. */
+struct savestate_snapshot
+{
+    char *base;             /* zero filled M64P image sized buffer */
+    char *delta;            /* no chunks when delta_size is 0 */
+    size_t delta_size;
+    size_t delta_capacity;
+    int valid;              /* set by a successful save */
+};
+
+/* Finishes a snapshot save. With rebase set, snap->base holds the full
+ * image just serialized and becomes the base of the following deltas.
+ * Otherwise image holds the first image_size bytes of the image serialized
+ * without dram, and its delta against snap->base is encoded. Dram is
+ * compared against the base when the written pages are not known relative
+ * to snap->base. Returns snap->valid. */
+int savestates_snapshot_saved(struct savestate_snapshot *snap, int rebase,
+                              const char *image, size_t image_size, size_t dram_offset,
+                              struct rdram *rdram);
+
+/* The image a snapshot load deserializes: with rebase set, snap->base
+ * after applying the delta to it in place, which invalidates the other
+ * snapshots of that base; otherwise a copy in image, an image_size bytes
+ * buffer. NULL when the snapshot is invalid. */
+char *savestates_snapshot_image(struct savestate_snapshot *snap, int rebase, char *image, size_t image_size);
+
+/* Once the snapshot image is loaded, makes the written dram pages relative
+ * to snap->base again */
+void savestates_snapshot_loaded(struct savestate_snapshot *snap, int rebase,
+                                struct rdram *rdram, size_t dram_offset);
+
+/* To be called before freeing a snapshot base */
+void savestates_snapshot_free_base(const char *base);
+
+#endif
@@ -123,6 +123,10 @@ void dummyvideo_FBGetFrameBufferInfo(void *p)
 {
 }
 
+void dummyvideo_FBWriteRange(unsigned int begin, unsigned int end)
+{
+}
+
 void dummyvideo_ResizeVideoOutput(int width, int height)
 {
 }
@@ -45,6 +45,7 @@ extern void dummyvideo_ResizeVideoOutput(int width, int height);
 extern void dummyvideo_FBRead(unsigned int addr);
 extern void dummyvideo_FBWrite(unsigned int addr, unsigned int size);
 extern void dummyvideo_FBGetFrameBufferInfo(void *p);
+extern void dummyvideo_FBWriteRange(unsigned int begin, unsigned int end);
 
 #endif /* DUMMY_VIDEO_H */
 
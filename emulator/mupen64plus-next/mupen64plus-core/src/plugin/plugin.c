@@ -71,6 +71,7 @@ void ResizeVideoOutput(int width, int height){
     EXPORT void CALL X##FBRead(unsigned int addr); \
     EXPORT void CALL X##FBWrite(unsigned int addr, unsigned int size); \
     EXPORT void CALL X##FBGetFrameBufferInfo(void *p); \
+    EXPORT void CALL X##FBWriteRange(unsigned int begin, unsigned int end); \
     \
     gfx_plugin_functions gfx_##X = { \
         X##PluginGetVersion, \
@@ -90,7 +91,8 @@ void ResizeVideoOutput(int width, int height){
         ResizeVideoOutput, \
         X##FBRead, \
         X##FBWrite, \
-        X##FBGetFrameBufferInfo \
+        X##FBGetFrameBufferInfo, \
+        X##FBWriteRange \
     }
 
 DEFINE_GFX(gln64);
@@ -323,6 +325,13 @@ static m64p_error plugin_start_input(void)
     return M64ERR_SUCCESS;
 }
 
+/* RDP lists started by the RSP plugin bypass write_dpc_regs */
+static void rsp_process_rdp_list(void)
+{
+    rdp_track_dram_writes(&g_dev.dp);
+    gfx.processRDPList();
+}
+
 static m64p_error plugin_start_rsp(void)
 {
     /* fill in the RSP_INFO data structure */
@@ -350,7 +359,7 @@ static m64p_error plugin_start_rsp(void)
     rsp_info.CheckInterrupts = EmptyFunc;
     rsp_info.ProcessDlistList = gfx.processDList;
     rsp_info.ProcessAlistList = audio.processAList;
-    rsp_info.ProcessRdpList = gfx.processRDPList;
+    rsp_info.ProcessRdpList = rsp_process_rdp_list;
     rsp_info.ShowCFB = gfx.showCFB;
 
     /* call the RSP plugin  */
@@ -505,3 +514,8 @@ void plugin_connect_all()
 }
 #endif
 
+
+void plugin_notify_dram_write(uint32_t address, uint32_t length)
+{
+    rdram_mark_dirty(&g_dev.rdram, address, length);
+}
@@ -0,0 +1,372 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - SDL_net.h                                               *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Stand-in for the part of SDL and SDL_net netplay_ws.c uses, over POSIX
+ * sockets and pthreads, so that the regtests can run it against a relay
+ * on the loopback interface without SDL installed. Only what netplay_ws.c
+ * calls is there, with the same return values: one socket per set, one
+ * bound channel per UDP socket and blocking TCP reads. */
+
+#ifndef M64P_REGTESTS_SDL_NET_H
+#define M64P_REGTESTS_SDL_NET_H
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uint8_t Uint8;
+typedef uint16_t Uint16;
+typedef uint32_t Uint32;
+
+/* SDL */
+
+typedef struct SDL_Thread {
+    pthread_t thread;
+    int (*fn)(void*);
+    void* data;
+} SDL_Thread;
+typedef pthread_mutex_t SDL_mutex;
+typedef pthread_cond_t SDL_cond;
+
+#define SDL_MUTEX_TIMEDOUT 1
+
+static uint32_t SDL_GetTicks(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static void SDL_Delay(uint32_t ms)
+{
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+
+    nanosleep(&ts, NULL);
+}
+
+static void* sdl_thread_main(void* opaque)
+{
+    SDL_Thread* thread = (SDL_Thread*)opaque;
+
+    thread->fn(thread->data);
+    return NULL;
+}
+
+static SDL_Thread* SDL_CreateThread(int (*fn)(void*), const char* name, void* data)
+{
+    SDL_Thread* thread = (SDL_Thread*)malloc(sizeof(*thread));
+
+    if (thread == NULL)
+        return NULL;
+    thread->fn = fn;
+    thread->data = data;
+    if (pthread_create(&thread->thread, NULL, sdl_thread_main, thread) != 0) {
+        free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+static void SDL_WaitThread(SDL_Thread* thread, int* status)
+{
+    pthread_join(thread->thread, NULL);
+    free(thread);
+}
+
+static SDL_mutex* SDL_CreateMutex(void)
+{
+    SDL_mutex* mutex = (SDL_mutex*)malloc(sizeof(*mutex));
+
+    if (mutex != NULL)
+        pthread_mutex_init(mutex, NULL);
+    return mutex;
+}
+
+static void SDL_DestroyMutex(SDL_mutex* mutex)
+{
+    if (mutex == NULL)
+        return;
+    pthread_mutex_destroy(mutex);
+    free(mutex);
+}
+
+static int SDL_LockMutex(SDL_mutex* mutex) { return pthread_mutex_lock(mutex); }
+static int SDL_UnlockMutex(SDL_mutex* mutex) { return pthread_mutex_unlock(mutex); }
+
+static SDL_cond* SDL_CreateCond(void)
+{
+    SDL_cond* cond = (SDL_cond*)malloc(sizeof(*cond));
+
+    if (cond != NULL)
+        pthread_cond_init(cond, NULL);
+    return cond;
+}
+
+static void SDL_DestroyCond(SDL_cond* cond)
+{
+    if (cond == NULL)
+        return;
+    pthread_cond_destroy(cond);
+    free(cond);
+}
+
+static int SDL_CondSignal(SDL_cond* cond) { return pthread_cond_signal(cond); }
+
+static int SDL_CondWaitTimeout(SDL_cond* cond, SDL_mutex* mutex, uint32_t ms)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ++ts.tv_sec;
+        ts.tv_nsec -= 1000000000;
+    }
+    return (pthread_cond_timedwait(cond, mutex, &ts) == ETIMEDOUT) ? SDL_MUTEX_TIMEDOUT : 0;
+}
+
+/* SDL_net, addresses in network byte order */
+
+typedef struct {
+    Uint32 host;
+    Uint16 port;
+} IPaddress;
+
+typedef struct {
+    int channel;
+    Uint8* data;
+    int len;
+    int maxlen;
+    int status;
+    IPaddress address;
+} UDPpacket;
+
+typedef struct sdlnet_socket {
+    int fd;
+    int bound;
+    IPaddress peer;     /* the bound channel */
+} *UDPsocket, *TCPsocket;
+
+typedef struct sdlnet_socket_set {
+    int fd;
+} *SDLNet_SocketSet;
+
+#define SDLNet_Read32(buf) \
+    (((Uint32)((const Uint8*)(buf))[0] << 24) | ((Uint32)((const Uint8*)(buf))[1] << 16) \
+   | ((Uint32)((const Uint8*)(buf))[2] << 8) | ((const Uint8*)(buf))[3])
+#define SDLNet_Write32(value, buf) do { \
+        Uint32 sdlnet_value = (Uint32)(value); \
+        ((Uint8*)(buf))[0] = (Uint8)(sdlnet_value >> 24); \
+        ((Uint8*)(buf))[1] = (Uint8)(sdlnet_value >> 16); \
+        ((Uint8*)(buf))[2] = (Uint8)(sdlnet_value >> 8); \
+        ((Uint8*)(buf))[3] = (Uint8)sdlnet_value; \
+    } while (0)
+
+static int SDLNet_Init(void) { return 0; }
+static void SDLNet_Quit(void) {}
+
+static struct sockaddr_in sdlnet_sockaddr(const IPaddress* address)
+{
+    struct sockaddr_in sin;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = address->host;
+    sin.sin_port = address->port;
+    return sin;
+}
+
+static int SDLNet_ResolveHost(IPaddress* address, const char* host, Uint16 port)
+{
+    struct in_addr addr;
+
+    if (host == NULL)
+        addr.s_addr = INADDR_ANY;
+    else if (inet_pton(AF_INET, host, &addr) != 1)
+        return -1;
+    address->host = addr.s_addr;
+    address->port = htons(port);
+    return 0;
+}
+
+static struct sdlnet_socket* sdlnet_socket(int fd)
+{
+    struct sdlnet_socket* sock;
+
+    if (fd < 0)
+        return NULL;
+    if ((sock = (struct sdlnet_socket*)calloc(1, sizeof(*sock))) == NULL) {
+        close(fd);
+        return NULL;
+    }
+    sock->fd = fd;
+    return sock;
+}
+
+static UDPsocket SDLNet_UDP_Open(Uint16 port)
+{
+    IPaddress any = { INADDR_ANY, htons(port) };
+    struct sockaddr_in sin = sdlnet_sockaddr(&any);
+    UDPsocket sock = sdlnet_socket(socket(AF_INET, SOCK_DGRAM, 0));
+
+    if (sock != NULL && bind(sock->fd, (struct sockaddr*)&sin, sizeof(sin)) != 0) {
+        close(sock->fd);
+        free(sock);
+        return NULL;
+    }
+    return sock;
+}
+
+static void SDLNet_UDP_Close(UDPsocket sock)
+{
+    if (sock == NULL)
+        return;
+    close(sock->fd);
+    free(sock);
+}
+
+static int SDLNet_UDP_Bind(UDPsocket sock, int channel, const IPaddress* address)
+{
+    sock->peer = *address;
+    sock->bound = 1;
+    return 0;
+}
+
+static void SDLNet_UDP_Unbind(UDPsocket sock, int channel)
+{
+    sock->bound = 0;
+}
+
+static UDPpacket* SDLNet_AllocPacket(int size)
+{
+    UDPpacket* packet = (UDPpacket*)calloc(1, sizeof(*packet) + size);
+
+    if (packet == NULL)
+        return NULL;
+    packet->data = (Uint8*)(packet + 1);
+    packet->maxlen = size;
+    return packet;
+}
+
+static void SDLNet_FreePacket(UDPpacket* packet)
+{
+    free(packet);
+}
+
+/* channel -1 sends to packet->address */
+static int SDLNet_UDP_Send(UDPsocket sock, int channel, UDPpacket* packet)
+{
+    struct sockaddr_in sin = sdlnet_sockaddr((channel < 0) ? &packet->address : &sock->peer);
+
+    if (channel >= 0 && !sock->bound)
+        return 0;
+    packet->status = (int)sendto(sock->fd, packet->data, packet->len, 0, (struct sockaddr*)&sin, sizeof(sin));
+    return packet->status == packet->len;
+}
+
+static int SDLNet_UDP_Recv(UDPsocket sock, UDPpacket* packet)
+{
+    struct sockaddr_in sin;
+    socklen_t sin_len = sizeof(sin);
+    ssize_t len = recvfrom(sock->fd, packet->data, packet->maxlen, MSG_DONTWAIT, (struct sockaddr*)&sin, &sin_len);
+
+    if (len < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    packet->len = (int)len;
+    packet->channel = -1;
+    packet->address.host = sin.sin_addr.s_addr;
+    packet->address.port = sin.sin_port;
+    return 1;
+}
+
+static TCPsocket SDLNet_TCP_Open(const IPaddress* address)
+{
+    struct sockaddr_in sin = sdlnet_sockaddr(address);
+    TCPsocket sock = sdlnet_socket(socket(AF_INET, SOCK_STREAM, 0));
+
+    if (sock != NULL && connect(sock->fd, (struct sockaddr*)&sin, sizeof(sin)) != 0) {
+        close(sock->fd);
+        free(sock);
+        return NULL;
+    }
+    return sock;
+}
+
+static void SDLNet_TCP_Close(TCPsocket sock)
+{
+    if (sock == NULL)
+        return;
+    close(sock->fd);
+    free(sock);
+}
+
+static int SDLNet_TCP_Send(TCPsocket sock, const void* data, int len)
+{
+    ssize_t sent = send(sock->fd, data, len, MSG_NOSIGNAL);
+
+    return (sent < 0) ? -1 : (int)sent;
+}
+
+static int SDLNet_TCP_Recv(TCPsocket sock, void* data, int maxlen)
+{
+    ssize_t received = recv(sock->fd, data, maxlen, 0);
+
+    return (received < 0) ? -1 : (int)received;
+}
+
+static SDLNet_SocketSet SDLNet_AllocSocketSet(int maxsockets)
+{
+    SDLNet_SocketSet set = (SDLNet_SocketSet)malloc(sizeof(*set));
+
+    if (set != NULL)
+        set->fd = -1;
+    return set;
+}
+
+static void SDLNet_FreeSocketSet(SDLNet_SocketSet set)
+{
+    free(set);
+}
+
+static int SDLNet_UDP_AddSocket(SDLNet_SocketSet set, UDPsocket sock)
+{
+    set->fd = sock->fd;
+    return 1;
+}
+
+static int SDLNet_CheckSockets(SDLNet_SocketSet set, Uint32 timeout)
+{
+    struct pollfd pfd = { set->fd, POLLIN, 0 };
+
+    return poll(&pfd, 1, (int)timeout);
+}
+
+#endif
@@ -0,0 +1,56 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - netplay_ws_stubs.h                                      *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* The parts of the core netplay_ws.c calls into that the regtests including
+ * it have no use for. Each test still provides log_cb, the savestate size,
+ * the savestate and snapshot jobs, and main_core_state_set. */
+
+#ifndef M64P_REGTESTS_NETPLAY_WS_STUBS_H
+#define M64P_REGTESTS_NETPLAY_WS_STUBS_H
+
+CONTROL Controls[4];
+struct device g_dev;
+uint32_t NetplayRollbackFrames;
+uint32_t NetplayInputRedundancy;
+uint32_t NetplayDesyncCheck;
+
+static bool environment(unsigned cmd, void* data)
+{
+    return true;
+}
+
+retro_environment_t environ_cb = environment;
+
+void savestates_set_job(savestates_job j, savestates_type t, const char *fn) {}
+
+uint32_t* r4300_cp0_regs(struct cp0* cp0)
+{
+    static uint32_t regs[CP0_REGS_COUNT];
+    return regs;
+}
+
+int save_eventqueue_infos(const struct cp0* cp0, char *buf)
+{
+    return 0;
+}
+
+void rdram_clear_dirty(struct rdram* rdram, enum rdram_dirty_client client) {}
+
+#endif
@@ -0,0 +1,77 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - regtest.h                                               *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* What every regtest has: a random generator seeded from the command line
+ * or the time, the seed printed first so that a failure can be run again,
+ * a monotonic clock for the timings and the "passed" line at the end. */
+
+#ifndef M64P_REGTESTS_REGTEST_H
+#define M64P_REGTESTS_REGTEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static const char* regtest_name;
+
+/* xorshift32, seeded from the command line to reproduce a failure */
+static uint32_t rng_state;
+
+static inline uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/* seeds rng from argv[1], or the time without one, and prints the seed */
+static inline void regtest_seed(const char* name, int argc, char** argv)
+{
+    regtest_name = name;
+    rng_state = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : (uint32_t)time(NULL);
+    if (rng_state == 0)
+        rng_state = 1;
+    printf("%s: seed %u\n", name, rng_state);
+}
+
+static inline void regtest_passed(void)
+{
+    printf("%s: passed\n", regtest_name);
+}
+
+static inline double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#endif
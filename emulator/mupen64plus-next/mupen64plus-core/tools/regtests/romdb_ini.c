@@ -0,0 +1,44 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - romdb_ini.c                                             *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* The rom database of test_romdb as the other builds have it: rom.c
+ * parsing mupen64plus.ini, with its symbols renamed so that it links
+ * beside the precompiled one. */
+
+#define M64P_ROMDB_INI
+
+#define ROM_HEADER romdb_ini_ROM_HEADER
+#define ROM_PARAMS romdb_ini_ROM_PARAMS
+#define ROM_SETTINGS romdb_ini_ROM_SETTINGS
+#define g_rom_size romdb_ini_g_rom_size
+#define open_rom romdb_ini_open_rom
+#define close_rom romdb_ini_close_rom
+#define open_disk romdb_ini_open_disk
+#define close_disk romdb_ini_close_disk
+#define romdatabase_open romdb_ini_romdatabase_open
+#define romdatabase_close romdb_ini_romdatabase_close
+#define ini_search_by_crc romdb_ini_search_by_crc
+
+#include "main/rom.c"
+
+romdatabase_entry* romdb_ini_search_by_md5(md5_byte_t* md5)
+{
+    return ini_search_by_md5(md5);
+}
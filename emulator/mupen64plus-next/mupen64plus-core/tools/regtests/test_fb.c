@@ -0,0 +1,269 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_fb.c                                               *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Checks that post_framebuffer_write reports the same framebuffer bytes
+ * through fBWriteRange as through one fBWrite per word, and that
+ * pre_framebuffer_read, which only looks at the infos indexed for the page,
+ * calls fBRead exactly where a scan of every info would. Random DMAs and
+ * reads go over random framebuffer infos, some of them overlapping.
+ * Also counts the callbacks and times both write paths on 64 KB DMAs into
+ * a 320x240 16-bit framebuffer, and reads outside the framebuffers with
+ * and without the page index.
+ *
+ * Only fb.c is linked; the plugin and the rest of the device are stubbed
+ * below.
+ *
+ * Build and run with "make core-tests". */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "regtest.h"
+
+#include "api/callbacks.h"
+#include "device/memory/memory.h"
+#include "device/r4300/r4300_core.h"
+#include "device/rcp/rdp/fb.h"
+#include "device/rdram/rdram.h"
+#include "plugin/plugin.h"
+
+#define RDRAM_SIZE 0x800000
+#define ROUNDS 200
+#define WRITES 200             /* DMAs per round */
+#define READS 2000             /* reads per round */
+#define TIMED_DMAS 20000
+#define TIMED_READS 20000000
+
+gfx_plugin_functions gfx;
+
+static struct fb fb;
+static struct r4300_core r4300;
+static FrameBufferInfo infos[FB_INFOS_COUNT];
+static unsigned char written[RDRAM_SIZE];
+static unsigned char dirty[FB_DIRTY_PAGES_COUNT];
+static unsigned int callbacks;
+static unsigned int reads;
+static uint32_t last_read;
+
+/* the parts of the core fb.c calls into */
+void DebugMessage(int level, const char *message, ...) {}
+void apply_mem_mapping(struct memory* mem, const struct mem_mapping* mapping) {}
+void invalidate_r4300_cached_code(struct r4300_core* r4300, uint32_t address, size_t size) {}
+void read_rdram_dram(void* opaque, uint32_t address, uint32_t* value) {}
+void write_rdram_dram(void* opaque, uint32_t address, uint32_t value, uint32_t mask) {}
+
+/* the plugin side, which marks the bytes it is told about */
+static void fb_read(unsigned int addr)
+{
+    ++reads;
+    last_read = addr;
+}
+
+static void fb_write(unsigned int addr, unsigned int size)
+{
+    ++callbacks;
+    memset(&written[addr], 1, size);
+}
+
+static void fb_write_range(unsigned int begin, unsigned int end)
+{
+    ++callbacks;
+    memset(&written[begin], 1, end - begin + 1);
+}
+
+static void fb_get_info(void* p)
+{
+    memcpy(p, infos, sizeof(infos));
+}
+
+/* the timed runs only count */
+static void fb_write_count(unsigned int addr, unsigned int size) { ++callbacks; }
+static void fb_write_range_count(unsigned int begin, unsigned int end) { ++callbacks; }
+
+static uint32_t fb_end(const FrameBufferInfo* info)
+{
+    return info->addr + info->width * info->height * info->size - 1;
+}
+
+/* up to FB_INFOS_COUNT framebuffers, the first one always set */
+static void random_infos(void)
+{
+    size_t count = 1 + rng() % FB_INFOS_COUNT;
+
+    memset(infos, 0, sizeof(infos));
+    for (size_t i = 0; i < count; ++i) {
+        infos[i].size = (rng() & 1) ? 2 : 4;
+        infos[i].width = 2 * (1 + rng() % 320);
+        infos[i].height = 1 + rng() % 240;
+        infos[i].addr = 0x1000 + (rng() % (RDRAM_SIZE - 0x1000 - 640 * 4 * 240)) / 8 * 8;
+    }
+
+    protect_framebuffers(&fb);
+    for (size_t i = 0; i < FB_INFOS_COUNT; ++i) {
+        if (infos[i].addr == 0)
+            continue;
+        for (uint32_t page = infos[i].addr >> 12; page <= fb_end(&infos[i]) >> 12; ++page)
+            dirty[page] = 1;
+    }
+}
+
+/* DMAs are 8 byte aligned, as PI and SP DMAs are in RDRAM */
+static int check_write(uint32_t address, uint32_t length, int round)
+{
+    memset(&written[address], 0, length);
+    post_framebuffer_write(&fb, address, length);
+
+    for (uint32_t j = 0; j < length; ++j) {
+        unsigned char expected = 0;
+
+        for (size_t i = 0; i < FB_INFOS_COUNT; ++i) {
+            if (infos[i].addr != 0 && address + j >= infos[i].addr && address + j <= fb_end(&infos[i]))
+                expected = 1;
+        }
+        if (written[address + j] != expected) {
+            fprintf(stderr, "test_fb: round %d: %u byte write at 0x%x, byte 0x%x %s\n",
+                    round, length, address, address + j, expected ? "not reported" : "reported");
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* what pre_framebuffer_read did before the page index: scan every info */
+static int scan_read(uint32_t address)
+{
+    for (size_t i = 0; i < FB_INFOS_COUNT; ++i) {
+        if (infos[i].addr != 0 && address >= infos[i].addr && address <= fb_end(&infos[i])
+         && dirty[address >> 12]) {
+            dirty[address >> 12] = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_read(uint32_t address, int round)
+{
+    unsigned int before = reads;
+    int expected = scan_read(address);
+
+    pre_framebuffer_read(&fb, address);
+    if ((int)(reads - before) != expected || (expected && last_read != address)) {
+        fprintf(stderr, "test_fb: round %d: read at 0x%x made %u fBRead calls, expected %d\n",
+                round, address, reads - before, expected);
+        return 0;
+    }
+    return 1;
+}
+
+static uint32_t random_address(void)
+{
+    /* mostly next to a framebuffer, to hit its edges */
+    const FrameBufferInfo* info = &infos[rng() % FB_INFOS_COUNT];
+
+    if (info->addr == 0 || (rng() & 3) == 0)
+        return rng() % RDRAM_SIZE;
+    return (info->addr - 0x1000 + rng() % (fb_end(info) - info->addr + 0x2000)) % RDRAM_SIZE;
+}
+
+/* callbacks and seconds for TIMED_DMAS 64 KB DMAs over a 320x240 16-bit framebuffer */
+static double time_writes(unsigned int* count)
+{
+    double t;
+
+    callbacks = 0;
+    t = now();
+    for (unsigned int i = 0; i < TIMED_DMAS; ++i)
+        post_framebuffer_write(&fb, 0x100000 + (i % 3) * 0x10000, 0x10000);
+    t = now() - t;
+    *count = callbacks;
+    return t;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int word_calls, range_calls;
+    double word_time, range_time, indexed, scanned;
+
+    regtest_seed("test_fb", argc, argv);
+
+    r4300.emumode = EMUMODE_PURE_INTERPRETER;
+    init_fb(&fb, NULL, NULL, &r4300);
+    poweron_fb(&fb);
+    gfx.fBRead = fb_read;
+    gfx.fBGetFrameBufferInfo = fb_get_info;
+    gfx.fBWrite = fb_write;
+
+    for (int round = 0; round < ROUNDS; ++round) {
+        random_infos();
+
+        /* the plugins without fBWriteRange get one call per word */
+        gfx.fBWriteRange = (round & 1) ? fb_write_range : NULL;
+        for (int i = 0; i < WRITES; ++i) {
+            uint32_t length = 8 * (1 + rng() % ((rng() & 1) ? 2 : 0x2000));
+            uint32_t address = random_address() / 8 * 8;
+
+            if (address + length > RDRAM_SIZE)
+                address = RDRAM_SIZE - length;
+            if (!check_write(address, length, round))
+                return 1;
+        }
+
+        for (int i = 0; i < READS; ++i) {
+            if (!check_read(random_address() / 4 * 4, round))
+                return 1;
+        }
+    }
+    printf("test_fb: %d rounds of %d DMAs and %d reads, same bytes and fBRead calls as per word and scanning every info\n",
+           ROUNDS, WRITES, READS);
+
+    memset(infos, 0, sizeof(infos));
+    infos[0].addr = 0x100000;
+    infos[0].size = 2;
+    infos[0].width = 320;
+    infos[0].height = 240;
+    protect_framebuffers(&fb);
+
+    gfx.fBWrite = fb_write_count;
+    gfx.fBWriteRange = NULL;
+    word_time = time_writes(&word_calls);
+    gfx.fBWriteRange = fb_write_range_count;
+    range_time = time_writes(&range_calls);
+    printf("test_fb: 64 KB DMA into a framebuffer: %u callbacks, %.2f us per word; %u callback, %.3f us as ranges\n",
+           word_calls / TIMED_DMAS, word_time * 1e6 / TIMED_DMAS,
+           range_calls / TIMED_DMAS, range_time * 1e6 / TIMED_DMAS);
+
+    /* reads away from the framebuffer, as most of them are */
+    indexed = now();
+    for (uint32_t i = 0; i < TIMED_READS; ++i)
+        pre_framebuffer_read(&fb, (i * 4) & 0xfffff);
+    indexed = now() - indexed;
+    scanned = now();
+    for (uint32_t i = 0; i < TIMED_READS; ++i)
+        scan_read((i * 4) & 0xfffff);
+    scanned = now() - scanned;
+    printf("test_fb: read outside the framebuffers: %.2f ns with the page index, %.2f ns scanning every info\n",
+           indexed * 1e9 / TIMED_READS, scanned * 1e9 / TIMED_READS);
+
+    regtest_passed();
+    return 0;
+}
@@ -0,0 +1,324 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_netplay_batch.c                                    *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Loopback test of the batched netplay input messages: a client sends
+ * the input of 2 controllers through a lossy link and a relay standing in
+ * for the server, and a second client decodes it into its input ring.
+ * Checks that every input decoded is the one that was sent, that a
+ * redundancy of R covers any R - 1 lost messages in a row, and that a
+ * truncated message only yields the records it fully holds.
+ *
+ * Also reports, for random loss rates, how many inputs arrive after the
+ * receiver needs them (each one a request round trip) or never, and the
+ * bytes sent per frame against one legacy packet per controller.
+ *
+ * Build and run with "make core-tests". */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "regtest.h"
+
+#include "main/netplay_batch.h"
+#include "main/netplay_input.h"
+
+#define CONTROLLERS 2
+#define VIS 3600               /* a minute of play */
+#define DELAY 2                /* frames of input buffer on the receiver */
+#define LEGACY_SEND_SIZE 11    /* one UDP_SEND_KEY_INFO packet */
+
+static uint32_t trace[CONTROLLERS][VIS];
+static uint8_t received[CONTROLLERS][VIS];
+static struct netplay_batch batch;
+static struct netplay_input_ring ring;
+static uint32_t next_count[4];
+static int errors;
+
+static uint8_t plugin_of(uint8_t player)
+{
+    return (uint8_t)(player + 1);
+}
+
+/* what the server does with a batch: one block of key info per
+ * controller, the newest count first */
+static size_t relay(const uint8_t* in, size_t len, uint8_t* out)
+{
+    size_t curr = 1, out_curr = 1;
+
+    out[0] = in[0];
+    for (uint8_t block = 0; block < in[0]; ++block)
+    {
+        uint32_t count = ((uint32_t)in[curr + 1] << 24) | ((uint32_t)in[curr + 2] << 16)
+                       | ((uint32_t)in[curr + 3] << 8) | in[curr + 4];
+        uint8_t frames = in[curr + 5];
+
+        out[out_curr] = in[curr];
+        out[out_curr + 1] = 0;
+        out[out_curr + 2] = frames;
+        out_curr += 3;
+        curr += 6;
+        for (uint8_t f = 0; f < frames; ++f)
+        {
+            out[out_curr] = (uint8_t)((count - f) >> 24);
+            out[out_curr + 1] = (uint8_t)((count - f) >> 16);
+            out[out_curr + 2] = (uint8_t)((count - f) >> 8);
+            out[out_curr + 3] = (uint8_t)(count - f);
+            memcpy(&out[out_curr + 4], &in[curr], 5);
+            out_curr += 9;
+            curr += 5;
+        }
+    }
+    if (curr != len) {
+        fprintf(stderr, "test_netplay_batch: batch of %u bytes holds %u\n", (unsigned)len, (unsigned)curr);
+        ++errors;
+    }
+    return out_curr;
+}
+
+static void check_record(uint8_t player, uint32_t count, uint32_t keys, uint8_t plugin)
+{
+    if (player >= CONTROLLERS || count >= VIS || keys != trace[player][count] || plugin != plugin_of(player)) {
+        if (errors++ < 10)
+            fprintf(stderr, "test_netplay_batch: bad record player %u count %u keys %08x plugin %u\n",
+                    player, count, keys, plugin);
+    }
+}
+
+static void receive(void* opaque, uint8_t player, uint32_t count, uint32_t keys, uint8_t plugin)
+{
+    check_record(player, count, keys, plugin);
+    if (player < CONTROLLERS && count < VIS) {
+        received[player][count] = 1;
+        netplay_input_put(&ring, player, count, keys, plugin, next_count[player]);
+    }
+}
+
+static void count_records(void* opaque, uint8_t player, uint32_t count, uint32_t keys, uint8_t plugin)
+{
+    check_record(player, count, keys, plugin);
+    ++*(unsigned*)opaque;
+}
+
+struct run {
+    unsigned late;             /* not there when the receiver needed it */
+    unsigned lost;             /* never arrived */
+    unsigned lost_before_end;  /* never arrived, with R later messages sent */
+    size_t bytes;
+};
+
+/* drop(t) tells whether the message of frame t is lost */
+static struct run run_link(uint32_t redundancy, int (*drop)(uint32_t t, uint32_t redundancy, unsigned loss), unsigned loss)
+{
+    uint8_t message[NETPLAY_BATCH_MAX_SIZE], answer[NETPLAY_BATCH_MAX_SIZE * 2];
+    uint8_t lag[4];
+    struct run run = {0};
+    size_t len, answer_len;
+
+    netplay_batch_reset(&batch, redundancy);
+    netplay_input_reset(&ring);
+    memset(received, 0, sizeof(received));
+    memset(next_count, 0, sizeof(next_count));
+
+    for (uint32_t t = 0; t < VIS + DELAY; ++t) {
+        if (t < VIS) {
+            for (uint8_t i = 0; i < CONTROLLERS; ++i)
+                netplay_batch_put(&batch, i, t, trace[i][t], plugin_of(i));
+            len = netplay_batch_encode(&batch, message);
+            run.bytes += 1 + len;
+            if (!drop(t, redundancy, loss)) {
+                answer_len = relay(message, len, answer);
+                netplay_batch_decode(answer, answer + answer_len, lag, receive, NULL);
+            }
+        }
+
+        /* the receiver runs DELAY frames behind */
+        if (t >= DELAY) {
+            uint32_t count = t - DELAY;
+            for (uint8_t i = 0; i < CONTROLLERS; ++i) {
+                const struct netplay_input_slot* slot = netplay_input_get(&ring, i, count);
+                if (slot == NULL)
+                    ++run.late;
+                else if (slot->buttons != trace[i][count]) {
+                    if (errors++ < 10)
+                        fprintf(stderr, "test_netplay_batch: player %u count %u consumed the wrong input\n", i, count);
+                }
+                next_count[i] = count + 1;
+            }
+        }
+    }
+
+    for (uint8_t i = 0; i < CONTROLLERS; ++i) {
+        for (uint32_t count = 0; count < VIS; ++count) {
+            if (!received[i][count]) {
+                ++run.lost;
+                if (count + redundancy < VIS)
+                    ++run.lost_before_end;
+            }
+        }
+    }
+    return run;
+}
+
+static int drop_none(uint32_t t, uint32_t redundancy, unsigned loss)
+{
+    return 0;
+}
+
+/* redundancy - 1 lost in a row, then one through */
+static int drop_covered(uint32_t t, uint32_t redundancy, unsigned loss)
+{
+    return (t % redundancy) != redundancy - 1;
+}
+
+/* redundancy lost in a row, then one through: one count of each
+ * controller is lost per burst */
+static int drop_burst(uint32_t t, uint32_t redundancy, unsigned loss)
+{
+    return (t % (redundancy + 1)) != redundancy;
+}
+
+/* loss in percent, on the way to the server and back */
+static int drop_random(uint32_t t, uint32_t redundancy, unsigned loss)
+{
+    return (rng() % 100) < loss || (rng() % 100) < loss;
+}
+
+static int check_links(void)
+{
+    for (uint32_t r = 1; r <= NETPLAY_BATCH_MAX_FRAMES; ++r) {
+        struct run run = run_link(r, drop_none, 0);
+        if (run.late != 0 || run.lost != 0) {
+            fprintf(stderr, "test_netplay_batch: redundancy %u, no loss: %u late, %u lost\n", r, run.late, run.lost);
+            return 0;
+        }
+
+        run = run_link(r, drop_covered, 0);
+        if (run.lost_before_end != 0) {
+            fprintf(stderr, "test_netplay_batch: redundancy %u, %u lost in a row: %u inputs lost\n",
+                    r, r - 1, run.lost_before_end);
+            return 0;
+        }
+
+        /* the counts which are multiples of r + 1 */
+        run = run_link(r, drop_burst, 0);
+        if (run.lost_before_end != CONTROLLERS * (VIS / (r + 1))) {
+            fprintf(stderr, "test_netplay_batch: redundancy %u, %u lost in a row: %u inputs lost, expected %u\n",
+                    r, r, run.lost_before_end, CONTROLLERS * (VIS / (r + 1)));
+            return 0;
+        }
+    }
+    return errors == 0;
+}
+
+/* every truncation of a message decodes to the records it fully holds */
+static int check_truncated(void)
+{
+    uint8_t message[NETPLAY_BATCH_MAX_SIZE], answer[NETPLAY_BATCH_MAX_SIZE * 2];
+    uint8_t lag[4];
+    size_t len, answer_len;
+
+    netplay_batch_reset(&batch, NETPLAY_BATCH_MAX_FRAMES);
+    for (uint32_t t = 0; t < NETPLAY_BATCH_MAX_FRAMES; ++t) {
+        for (uint8_t i = 0; i < CONTROLLERS; ++i)
+            netplay_batch_put(&batch, i, t, trace[i][t], plugin_of(i));
+    }
+    len = netplay_batch_encode(&batch, message);
+    answer_len = relay(message, len, answer);
+
+    for (size_t cut = 0; cut <= answer_len; ++cut) {
+        /* exactly cut bytes, so that an overread shows under a sanitizer */
+        uint8_t* data = malloc(cut + 1);
+        unsigned records = 0, expected = 0;
+        size_t curr = 1;
+
+        memcpy(data, answer, cut);
+        netplay_batch_decode(data, data + cut, lag, count_records, &records);
+        free(data);
+
+        /* blocks decode whole or not at all */
+        for (uint8_t block = 0; block < answer[0]; ++block) {
+            size_t size = 3 + (size_t)answer[curr + 2] * 9;
+            if (curr + size > cut)
+                break;
+            expected += answer[curr + 2];
+            curr += size;
+        }
+        if (records != expected) {
+            fprintf(stderr, "test_netplay_batch: message cut at %u of %u bytes: %u records, expected %u\n",
+                    (unsigned)cut, (unsigned)answer_len, records, expected);
+            return 0;
+        }
+    }
+
+    /* a gap in the counts starts the redundancy over */
+    netplay_batch_put(&batch, 0, NETPLAY_BATCH_MAX_FRAMES + 4, trace[0][0], plugin_of(0));
+    len = netplay_batch_encode(&batch, message);
+    if (len != 1 + 6 + 5 || message[6] != 1) {
+        fprintf(stderr, "test_netplay_batch: gap in the counts: %u frames resent\n", message[6]);
+        return 0;
+    }
+    if (netplay_batch_encode(&batch, message) != 0) {
+        fprintf(stderr, "test_netplay_batch: message without new input\n");
+        return 0;
+    }
+    return errors == 0;
+}
+
+static void report(void)
+{
+    static const unsigned losses[] = { 1, 5, 20 };
+    static const uint32_t redundancies[] = { 1, 2, 4, 8 };
+
+    for (size_t l = 0; l < sizeof(losses) / sizeof(losses[0]); ++l) {
+        for (size_t r = 0; r < sizeof(redundancies) / sizeof(redundancies[0]); ++r) {
+            struct run run = run_link(redundancies[r], drop_random, losses[l]);
+            printf("test_netplay_batch: %2u%% loss each way, redundancy %u: %5.2f%% late, %5.2f%% lost, "
+                   "%5.1f bytes per frame (legacy %d)\n",
+                   losses[l], redundancies[r], 100.0 * run.late / (CONTROLLERS * VIS),
+                   100.0 * run.lost / (CONTROLLERS * VIS), (double)run.bytes / VIS,
+                   CONTROLLERS * LEGACY_SEND_SIZE);
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    regtest_seed("test_netplay_batch", argc, argv);
+
+    /* held buttons that change every few frames, like real input */
+    for (int i = 0; i < CONTROLLERS; ++i) {
+        uint32_t keys = 0;
+        for (uint32_t count = 0; count < VIS; ++count) {
+            if (rng() % 8 == 0)
+                keys = rng();
+            trace[i][count] = keys;
+        }
+    }
+
+    if (!check_links() || !check_truncated())
+        return 1;
+    report();
+    if (errors != 0)
+        return 1;
+    regtest_passed();
+    return 0;
+}
@@ -0,0 +1,427 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_netplay_log.c                                      *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Record and replay test of the netplay input log. A toy machine, whose
+ * state depends on every input it consumes, runs a session of 4 players
+ * and records it; the stream is then replayed, fed in random pieces, from
+ * the start and from every keyframe, the way a late spectator joins.
+ * Checks that the replayed machine goes through the same states as the
+ * recorded one, VI for VI, and that the settings, save data and
+ * controllers come back as recorded. The session is recorded twice: once
+ * logging each input as it is consumed, the way delay mode does, and once
+ * logging inputs LEAD counts ahead, the way rollback mode logs confirmed
+ * inputs, which the keyframes have to log again.
+ *
+ * Build and run with "make core-tests". */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "regtest.h"
+
+#include "main/netplay_input.h"
+#include "main/netplay_log.h"
+
+#define PLAYERS 4
+#define VIS 3600               /* a minute of play */
+#define KEYFRAME_INTERVAL 300
+#define KEYFRAMES (VIS / KEYFRAME_INTERVAL)
+#define STATE_WORDS 64
+#define MAX_FEED 300           /* bytes the stream may arrive in at once */
+#define STORAGES 3
+#define LEAD 6                 /* counts rollback mode logs ahead */
+
+struct machine {
+    uint64_t state[STATE_WORDS];
+};
+
+static const uint32_t settings[NETPLAY_LOG_SETTINGS_COUNT] = { 2, 1, 0, 900, 2, 1 };
+static const uint8_t controllers[12] = { 1, 2, 0, 1, 1, 0, 1, 2, 0, 0, 0, 0 };
+static const char* storage_extensions[STORAGES] = { ".eep", ".mpk", ".sra" };
+
+static uint32_t trace[PLAYERS][VIS];
+static uint8_t plugins[PLAYERS][VIS];
+static uint64_t expected[VIS];
+static uint8_t storage_data[STORAGES][2048];
+
+static uint8_t* stream;
+static size_t stream_len;
+static size_t stream_cap;
+static size_t header_len;      /* settings, storage and controllers */
+static size_t keyframe_offset[KEYFRAMES];
+
+static int present(int player)
+{
+    return controllers[player * 3] != 0;
+}
+
+static uint32_t storage_size(int i)
+{
+    return sizeof(storage_data[i]) >> i;
+}
+
+static void write32(uint32_t v, uint8_t* b)
+{
+    b[0] = (uint8_t)(v >> 24);
+    b[1] = (uint8_t)(v >> 16);
+    b[2] = (uint8_t)(v >> 8);
+    b[3] = (uint8_t)v;
+}
+
+/* one VI: every word depends on the inputs and on the other words */
+static void machine_vi(struct machine* m, const uint32_t keys[PLAYERS], const uint8_t plugin[PLAYERS])
+{
+    uint64_t carry = 0;
+
+    for (int i = 0; i < STATE_WORDS; ++i) {
+        carry ^= m->state[i] * UINT64_C(6364136223846793005) + keys[i % PLAYERS] + plugin[i % PLAYERS];
+        m->state[i] = carry ^ (carry >> 29);
+    }
+}
+
+static uint64_t machine_hash(const struct machine* m)
+{
+    uint64_t hash = UINT64_C(14695981039346656037);
+
+    for (int i = 0; i < STATE_WORDS; ++i)
+        hash = (hash ^ m->state[i]) * UINT64_C(1099511628211);
+    return hash;
+}
+
+/* what the writer netplay_record_start takes does with each VI */
+static int flush(struct netplay_log* log)
+{
+    if (!netplay_log_reserve(&stream, &stream_cap, stream_len + log->len))
+        return 0;
+    memcpy(&stream[stream_len], log->buf, log->len);
+    stream_len += log->len;
+    log->len = 0;
+    return 1;
+}
+
+static int record_header(struct netplay_log* log)
+{
+    uint8_t* data;
+
+    if ((data = netplay_log_write_record(log, NETPLAY_LOG_SETTINGS, NETPLAY_LOG_SETTINGS_COUNT * 4)) == NULL)
+        return 0;
+    for (int i = 0; i < NETPLAY_LOG_SETTINGS_COUNT; ++i)
+        write32(settings[i], &data[i * 4]);
+
+    for (int i = 0; i < STORAGES; ++i) {
+        size_t ext_len = strlen(storage_extensions[i]);
+        if ((data = netplay_log_write_record(log, NETPLAY_LOG_STORAGE, ext_len + 5 + storage_size(i))) == NULL)
+            return 0;
+        memcpy(data, storage_extensions[i], ext_len + 1);
+        write32(storage_size(i), &data[ext_len + 1]);
+        memcpy(&data[ext_len + 5], storage_data[i], storage_size(i));
+    }
+
+    if ((data = netplay_log_write_record(log, NETPLAY_LOG_CONTROLLERS, 12)) == NULL)
+        return 0;
+    memcpy(data, controllers, 12);
+    return flush(log);
+}
+
+/* logs the inputs of every present player for the counts in [from, to) */
+static int record_inputs(struct netplay_log* log, uint32_t from, uint32_t to)
+{
+    int ok = 1;
+
+    for (uint32_t count = from; count < to && count < VIS; ++count) {
+        for (int i = 0; i < PLAYERS; ++i) {
+            if (present(i))
+                ok &= netplay_log_write_input(log, (uint8_t)i, count, trace[i][count], plugins[i][count]);
+        }
+    }
+    return ok;
+}
+
+/* records the session with the inputs logged lead counts ahead of the VI
+ * consuming them */
+static int record(uint32_t lead)
+{
+    struct netplay_log log = {0};
+    struct machine m = {{0}};
+    uint32_t netplay_count[4];
+    uint32_t keys[PLAYERS] = {0};
+    int ok;
+
+    stream_len = 0;
+    ok = record_header(&log);
+    header_len = stream_len;
+    ok &= record_inputs(&log, 0, lead);
+    for (uint32_t vi = 0; ok && vi < VIS; ++vi) {
+        uint8_t plugin[PLAYERS] = {0};
+
+        ok &= record_inputs(&log, vi + lead, vi + lead + 1);
+        for (int i = 0; i < PLAYERS; ++i) {
+            if (!present(i))
+                continue;
+            keys[i] = trace[i][vi];
+            plugin[i] = plugins[i][vi];
+        }
+        machine_vi(&m, keys, plugin);
+        expected[vi] = machine_hash(&m);
+
+        /* the state after the VI, and the counts the next one consumes;
+         * the inputs already logged past them are logged again */
+        if (vi % KEYFRAME_INTERVAL == 0) {
+            for (int i = 0; i < 4; ++i)
+                netplay_count[i] = vi + 1;
+            ok &= flush(&log);
+            keyframe_offset[vi / KEYFRAME_INTERVAL] = stream_len;
+            ok &= netplay_log_write_keyframe(&log, vi, netplay_count, (const uint8_t*)m.state, sizeof(m.state));
+            ok &= record_inputs(&log, vi + 1, vi + lead + 1);
+        }
+        ok &= netplay_log_write_vi(&log, vi);
+        ok &= flush(&log);
+    }
+
+    netplay_log_free(&log);
+    return ok;
+}
+
+/* the spectator */
+struct replay {
+    struct netplay_log_reader reader;
+    struct netplay_input_ring ring;
+    uint32_t next[4];
+    struct machine m;
+    uint32_t vi;               /* next VI to emulate */
+    int inputs;                /* an input has been parsed */
+    int seeded;
+    int storage_count;
+    int have_settings;
+    int have_controllers;
+    int errors;
+};
+
+static void replay_settings(void* opaque, const uint32_t s[NETPLAY_LOG_SETTINGS_COUNT])
+{
+    struct replay* r = opaque;
+
+    r->have_settings = 1;
+    if (memcmp(s, settings, sizeof(settings)) != 0) {
+        fprintf(stderr, "test_netplay_log: settings differ\n");
+        ++r->errors;
+    }
+}
+
+static int replay_storage(void* opaque, const char* extension, const uint8_t* data, uint32_t size)
+{
+    struct replay* r = opaque;
+    int i = r->storage_count++;
+
+    if (i >= STORAGES || strcmp(extension, storage_extensions[i]) != 0 || size != storage_size(i)
+     || memcmp(data, storage_data[i], size) != 0) {
+        fprintf(stderr, "test_netplay_log: save data %d differs\n", i);
+        ++r->errors;
+    }
+    return 1;
+}
+
+static void replay_controllers(void* opaque, const uint8_t c[12])
+{
+    struct replay* r = opaque;
+
+    r->have_controllers = 1;
+    if (memcmp(c, controllers, 12) != 0) {
+        fprintf(stderr, "test_netplay_log: controllers differ\n");
+        ++r->errors;
+    }
+}
+
+/* same as netplay_ws.c: the inputs too far ahead wait in the stream */
+static int replay_input(void* opaque, uint8_t control_id, uint32_t count, uint32_t keys, uint8_t plugin)
+{
+    struct replay* r = opaque;
+    uint32_t ahead = count - r->next[control_id];
+
+    if (ahead >= NETPLAY_INPUT_AHEAD && ahead < UINT32_MAX / 2)
+        return 0;
+    netplay_input_put(&r->ring, control_id, count, keys, plugin, r->next[control_id]);
+    r->inputs = 1;
+    return 1;
+}
+
+static void replay_vi(void* opaque, uint32_t vi)
+{
+}
+
+/* same as netplay_ws.c: only a stream that starts at a keyframe is
+ * seeded from it */
+static void replay_keyframe(void* opaque, uint32_t vi, const uint32_t netplay_count[4],
+                            const uint8_t* data, uint32_t size)
+{
+    struct replay* r = opaque;
+
+    if (r->inputs || r->seeded)
+        return;
+    if (size != sizeof(r->m.state)) {
+        fprintf(stderr, "test_netplay_log: keyframe of %u bytes\n", size);
+        ++r->errors;
+        return;
+    }
+    memcpy(r->m.state, data, size);
+    memcpy(r->next, netplay_count, sizeof(r->next));
+    netplay_input_reset(&r->ring);
+    r->vi = vi + 1;
+    r->seeded = 1;
+}
+
+/* replays the header followed by the stream from offset; returns the
+ * first VI emulated, or -1 on a mismatch */
+static long replay(size_t offset)
+{
+    static struct replay r;
+    size_t total = header_len + (stream_len - offset);
+    uint8_t* buf = malloc(total);
+    size_t len = 0, pos = 0, used;
+    long first = -1;
+
+    if (buf == NULL) {
+        fprintf(stderr, "test_netplay_log: out of memory\n");
+        return -1;
+    }
+
+    memset(&r, 0, sizeof(r));
+    r.reader.opaque = &r;
+    r.reader.settings = replay_settings;
+    r.reader.storage = replay_storage;
+    r.reader.controllers = replay_controllers;
+    r.reader.input = replay_input;
+    r.reader.vi = replay_vi;
+    r.reader.keyframe = replay_keyframe;
+    netplay_input_reset(&r.ring);
+
+    while (r.vi < VIS && r.errors == 0) {
+        uint32_t keys[PLAYERS] = {0};
+        uint8_t plugin[PLAYERS] = {0};
+        int missing = 0;
+
+        while (pos < len && (used = netplay_log_read_record(&r.reader, &buf[pos], len - pos)) > 0) {
+            if (used == NETPLAY_LOG_INVALID) {
+                fprintf(stderr, "test_netplay_log: invalid record %u at %u\n", buf[pos], (unsigned)pos);
+                free(buf);
+                return -1;
+            }
+            pos += used;
+        }
+
+        for (int i = 0; i < PLAYERS && !missing; ++i) {
+            const struct netplay_input_slot* slot;
+            if (!present(i))
+                continue;
+            if ((slot = netplay_input_get(&r.ring, (uint8_t)i, r.next[i])) == NULL)
+                missing = 1;
+            else {
+                keys[i] = slot->buttons;
+                plugin[i] = slot->plugin;
+            }
+        }
+
+        /* wait for more of the stream, which comes in pieces of random size */
+        if (missing) {
+            size_t piece = 1 + rng() % MAX_FEED;
+            if (len == total) {
+                fprintf(stderr, "test_netplay_log: stream from %u ends before VI %u\n", (unsigned)offset, r.vi);
+                free(buf);
+                return -1;
+            }
+            for (; piece > 0 && len < total; --piece, ++len)
+                buf[len] = (len < header_len) ? stream[len] : stream[offset + len - header_len];
+            continue;
+        }
+
+        if (first < 0)
+            first = r.vi;
+        machine_vi(&r.m, keys, plugin);
+        for (int i = 0; i < PLAYERS; ++i) {
+            if (present(i))
+                ++r.next[i];
+        }
+        if (machine_hash(&r.m) != expected[r.vi]) {
+            fprintf(stderr, "test_netplay_log: replay from %u differs at VI %u\n", (unsigned)offset, r.vi);
+            free(buf);
+            return -1;
+        }
+        ++r.vi;
+    }
+
+    free(buf);
+    if (r.errors != 0 || !r.have_settings || !r.have_controllers || r.storage_count != STORAGES) {
+        fprintf(stderr, "test_netplay_log: replay from %u lost its header\n", (unsigned)offset);
+        return -1;
+    }
+    return first;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned inputs = 0;
+    size_t keyframes_size = KEYFRAMES * (25 + sizeof(((struct machine*)NULL)->state));
+
+    regtest_seed("test_netplay_log", argc, argv);
+
+    /* held buttons that change every few frames, like real input, and a
+     * pak swapped now and then */
+    for (int i = 0; i < PLAYERS; ++i) {
+        uint32_t keys = 0;
+        uint8_t plugin = controllers[i * 3 + 1];
+        for (uint32_t count = 0; count < VIS; ++count) {
+            if (rng() % 8 == 0)
+                keys = rng();
+            if (rng() % 600 == 0)
+                plugin ^= 3;
+            trace[i][count] = keys;
+            plugins[i][count] = plugin;
+        }
+        if (present(i))
+            inputs += VIS;
+    }
+    for (int i = 0; i < STORAGES; ++i) {
+        for (size_t j = 0; j < sizeof(storage_data[i]); ++j)
+            storage_data[i][j] = (uint8_t)rng();
+    }
+
+    for (uint32_t lead = 0; lead <= LEAD; lead += LEAD) {
+        if (!record(lead)) {
+            fprintf(stderr, "test_netplay_log: out of memory\n");
+            return 1;
+        }
+        printf("test_netplay_log: lead %u, %u VIs, %u inputs: %u bytes, %.1f bytes per VI without the header and keyframes\n",
+               lead, VIS, inputs, (unsigned)stream_len, (double)(stream_len - header_len - keyframes_size) / VIS);
+
+        if (replay(header_len) != 0)
+            return 1;
+        for (int k = 0; k < KEYFRAMES; ++k) {
+            if (replay(keyframe_offset[k]) != (long)k * KEYFRAME_INTERVAL + 1)
+                return 1;
+        }
+        printf("test_netplay_log: lead %u, replayed from the start and from %d keyframes, every VI matches\n",
+               lead, KEYFRAMES);
+    }
+    regtest_passed();
+    free(stream);
+    return 0;
+}
@@ -0,0 +1,721 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_netplay_process.c                                  *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Loopback test of netplay_ws.c against a relay standing in for the
+ * server on 127.0.0.1: the core registers player 1 over TCP, sends its
+ * input and reads all 4 controllers through netplay_update_input for a
+ * few thousand VIs, once with one packet per controller and once with
+ * batched input. The relay answers requests and pushes the input of the
+ * 3 other players as it arrives, loses and reorders its answers, goes
+ * quiet now and then, and drops batches no more often in a row than
+ * their redundancy covers. It holds the local input back by INPUT_DELAY
+ * counts, as the server's input buffer does, so that the batches after a
+ * lost one arrive before its input is read.
+ *
+ * Checks that every controller reads the input and pak the relay has for
+ * its count, that the relay gets every local input read back, that
+ * requests carry the registration id, and that a player disconnecting in
+ * the status byte is reported. The save player 1 sends must come back to
+ * the other players, and a save never sent must read as missing.
+ *
+ * The session is recorded with a keyframe every KEYFRAME_INTERVAL VIs
+ * while the frontend serializes every VI, as its own rewind does. The
+ * snapshot job is run after each VI as gen_interrupt does, and some
+ * keyframe saves are cleared by a frontend load. Every keyframe in the
+ * log must hold the state of its VI, and the cleared ones none.
+ *
+ * netplay_ws.c is included to reach its statics; loopback/SDL2/SDL_net.h
+ * stands in for SDL and SDL_net, and netplay_ws_stubs.h for most of the
+ * core.
+ *
+ * Build and run with "make core-tests". */
+
+#include "main/netplay_ws.c"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "regtest.h"
+#include "netplay_ws_stubs.h"
+
+#define VIS 1500
+#define HISTORY (VIS + 16)     /* counts the relay keeps per player */
+#define REMOTE_LEAD 2          /* counts the other players are ahead */
+#define QUIET 32               /* counts between quiet spells, on average */
+#define LOSS 10                /* packets between lost ones, on average */
+#define REORDER 10             /* packets between reordered ones, on average */
+#define REDUNDANCY 4
+#define INPUT_DELAY (REDUNDANCY - 1)
+#define REG_ID 0x4e500001
+#define BUFFER_TARGET 2
+#define STATE_SIZE 256
+#define KEYFRAME_INTERVAL 60
+#define UNSERIALIZES 4         /* keyframes between frontend loads */
+#define SAVE_SIZE 0x800
+
+static uint32_t trace[4][HISTORY];
+static unsigned int disconnects;
+static int stopped;
+
+static savestates_job snapshot_job;
+static struct savestate_snapshot* snapshot;
+static uint8_t* log_buf;
+static size_t log_len;
+static size_t log_cap;
+static unsigned int keyframes;
+static unsigned int bad_keyframes;
+
+struct relay_input {
+    uint32_t keys;
+    uint8_t plugin;
+    uint8_t present;
+};
+
+/* the relay's state, only touched by its threads until they are joined */
+static struct {
+    int udp;
+    int tcp;
+    uint16_t port;
+    struct sockaddr_in client;
+    int have_client;
+    struct relay_input input[4][HISTORY];
+    uint32_t local_next;        /* first local count not received, delayed */
+    uint32_t remote_next;       /* first count the other players have not sent */
+    uint32_t quiet_until;
+    uint8_t status;
+    int batched;
+    uint8_t held[512];          /* answer sent after the next one */
+    size_t held_len;
+    uint32_t held_at;
+    unsigned int dropped_in_row;
+    int quit;
+
+    unsigned int sends, batches, requests, batch_requests, syncs;
+    unsigned int lost, reordered, dropped;
+    unsigned int bad;
+    int registered, disconnected;
+
+    char save_extension[16];
+    uint8_t save[SAVE_SIZE];
+    uint32_t save_size;
+} relay;
+
+static void log_message(enum retro_log_level level, const char* fmt, ...)
+{
+    char line[256];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (strstr(line, "player 2 has disconnected") != NULL)
+        ++disconnects;
+}
+
+retro_log_printf_t log_cb = log_message;
+
+size_t retro_serialize_size(void)
+{
+    return STATE_SIZE;
+}
+
+/* the frontend serializes every VI */
+savestates_job savestates_get_job(void)
+{
+    return savestates_job_save;
+}
+
+savestates_job savestates_get_snapshot_job(void)
+{
+    return snapshot_job;
+}
+
+struct savestate_snapshot *savestates_get_snapshot(void)
+{
+    return snapshot;
+}
+
+void savestates_set_snapshot_job(savestates_job j, struct savestate_snapshot *snap, int rebase)
+{
+    snapshot_job = j;
+    snapshot = snap;
+    if (j != savestates_job_nothing && !rebase) {
+        fprintf(stderr, "test_netplay_process: snapshot job without rebase\n");
+        exit(1);
+    }
+}
+
+m64p_error main_core_state_set(m64p_core_param param, int val)
+{
+    if (param == M64CORE_EMU_STATE && val == M64EMU_STOPPED)
+        stopped = 1;
+    return M64ERR_SUCCESS;
+}
+
+static uint8_t state_of(uint32_t vi)
+{
+    return (uint8_t)(vi * 7 + 1);
+}
+
+/* the end of gen_interrupt: the state of the VI is saved into the base,
+ * unless a retro_unserialize cleared the job */
+static void run_snapshot_job(uint32_t vi)
+{
+    if (snapshot_job == savestates_job_save && (vi / KEYFRAME_INTERVAL) % UNSERIALIZES != 1) {
+        memset(snapshot->base, state_of(vi), STATE_SIZE);
+        snapshot->valid = 1;
+    }
+    savestates_set_snapshot_job(savestates_job_nothing, NULL, 0);
+}
+
+static void write_log(void* opaque, const void* data, size_t size)
+{
+    if (!netplay_log_reserve(&log_buf, &log_cap, log_len + size))
+        exit(1);
+    memcpy(&log_buf[log_len], data, size);
+    log_len += size;
+}
+
+static void read_settings(void* opaque, const uint32_t settings[NETPLAY_LOG_SETTINGS_COUNT]) {}
+static void read_controllers(void* opaque, const uint8_t controllers[12]) {}
+static void read_vi(void* opaque, uint32_t vi) {}
+
+static int read_storage(void* opaque, const char* extension, const uint8_t* data, uint32_t size)
+{
+    return 1;
+}
+
+static int read_input(void* opaque, uint8_t control_id, uint32_t count, uint32_t keys, uint8_t plugin)
+{
+    return 1;
+}
+
+static void read_keyframe(void* opaque, uint32_t vi, const uint32_t netplay_count[4], const uint8_t* data, uint32_t size)
+{
+    int ok = size == STATE_SIZE && vi % KEYFRAME_INTERVAL == 0 && (vi / KEYFRAME_INTERVAL) % UNSERIALIZES != 1;
+
+    for (int i = 0; i < 4; ++i)
+        ok = ok && netplay_count[i] == vi + 1;
+    for (uint32_t i = 0; i < size; ++i)
+        ok = ok && data[i] == state_of(vi);
+    if (!ok) {
+        fprintf(stderr, "test_netplay_process: the keyframe of VI %u does not hold its state\n", vi);
+        ++bad_keyframes;
+    }
+    ++keyframes;
+}
+
+/* every keyframe VI but the cleared ones */
+static int check_log(const char* mode)
+{
+    struct netplay_log_reader reader = { NULL, read_settings, read_storage, read_controllers, read_input, read_vi, read_keyframe };
+    unsigned int expected = 0;
+    size_t pos = 0, used = 0;
+
+    for (uint32_t vi = 0; vi < VIS - 1; vi += KEYFRAME_INTERVAL)
+        expected += (vi / KEYFRAME_INTERVAL) % UNSERIALIZES != 1;
+
+    keyframes = bad_keyframes = 0;
+    while (pos < log_len && (used = netplay_log_read_record(&reader, &log_buf[pos], log_len - pos)) > 0
+        && used != NETPLAY_LOG_INVALID)
+        pos += used;
+
+    if (pos != log_len || bad_keyframes > 0 || keyframes != expected) {
+        fprintf(stderr, "test_netplay_process: %s input, %zu of %zu bytes of log parsed, %u keyframes instead of %u\n",
+                mode, pos, log_len, keyframes, expected);
+        return 0;
+    }
+    return 1;
+}
+
+static uint8_t remote_plugin(uint32_t keys)
+{
+    return (keys & 1) ? PLUGIN_MEMPAK : PLUGIN_NONE;
+}
+
+/* answers are lost, held back behind the next one, or sent */
+static void relay_send(const uint8_t* data, size_t len)
+{
+    if (!relay.have_client)
+        return;
+    if (rng() % LOSS == 0) {
+        ++relay.lost;
+        return;
+    }
+    if (relay.held_len == 0 && rng() % REORDER == 0) {
+        memcpy(relay.held, data, len);
+        relay.held_len = len;
+        relay.held_at = SDL_GetTicks();
+        return;
+    }
+
+    sendto(relay.udp, data, len, 0, (struct sockaddr*)&relay.client, sizeof(relay.client));
+    if (relay.held_len > 0) {
+        sendto(relay.udp, relay.held, relay.held_len, 0, (struct sockaddr*)&relay.client, sizeof(relay.client));
+        relay.held_len = 0;
+        ++relay.reordered;
+    }
+}
+
+/* writes up to max (count, keys, plugin) entries of player from count on */
+static uint8_t relay_entries(uint8_t player, uint32_t count, uint8_t max, uint8_t* out)
+{
+    uint8_t entries = 0;
+
+    for (; entries < max && count < HISTORY && relay.input[player][count].present; ++entries, ++count) {
+        net_write32(count, &out[entries * 9]);
+        net_write32(relay.input[player][count].keys, &out[entries * 9 + 4]);
+        out[entries * 9 + 8] = relay.input[player][count].plugin;
+    }
+    return entries;
+}
+
+/* [type][player][status][lag][entries] then the entries. A batching
+ * client is meant to get its input from the batched answers, so nothing
+ * is pushed to it and a request only gets the count asked for */
+static void relay_key_info(uint8_t type, uint8_t player, uint32_t count)
+{
+    uint8_t out[5 + 8 * 9];
+
+    if (type == UDP_RECEIVE_KEY_INFO_GRATUITOUS && relay.batched)
+        return;
+
+    out[0] = type;
+    out[1] = player;
+    out[2] = relay.status;
+    out[3] = 0;
+    out[4] = relay_entries(player, count, relay.batched ? 1 : 8, &out[5]);
+    if (out[4] > 0)
+        relay_send(out, 5 + out[4] * 9);
+}
+
+static void relay_local_input(uint32_t count, uint32_t keys, uint8_t plugin)
+{
+    if (count >= HISTORY - INPUT_DELAY || (count < VIS && keys != trace[0][count]) || plugin != PLUGIN_MEMPAK) {
+        fprintf(stderr, "test_netplay_process: relay got %08x with pak %u for count %u\n", keys, plugin, count);
+        ++relay.bad;
+        return;
+    }
+    count += INPUT_DELAY;
+    if (relay.input[0][count].present)
+        return;
+
+    relay.input[0][count].keys = keys;
+    relay.input[0][count].plugin = plugin;
+    relay.input[0][count].present = 1;
+    while (relay.local_next < HISTORY && relay.input[0][relay.local_next].present)
+        ++relay.local_next;
+    relay.status = (relay.local_next >= VIS / 2) ? 0x4 : 0;
+    relay_key_info(UDP_RECEIVE_KEY_INFO_GRATUITOUS, 0, count);
+}
+
+/* [blocks] then per block [control_id][newest count][frames] then the
+ * frames newest first */
+static void relay_batch(const uint8_t* data, const uint8_t* end)
+{
+    const uint8_t* block = &data[1];
+
+    if (relay.dropped_in_row < INPUT_DELAY && rng() % LOSS == 0) {
+        ++relay.dropped_in_row;
+        ++relay.dropped;
+        return;
+    }
+    relay.dropped_in_row = 0;
+    ++relay.batches;
+
+    for (uint8_t i = 0; i < data[0]; ++i) {
+        uint32_t newest = net_read32(&block[1]);
+        uint8_t frames = block[5];
+
+        if (block[0] != 0 || frames == 0 || &block[6 + frames * 5] > end) {
+            ++relay.bad;
+            return;
+        }
+        for (uint8_t frame = frames; frame-- > 0;)
+            relay_local_input(newest - frame, net_read32(&block[6 + frame * 5]), block[6 + frame * 5 + 4]);
+        block += 6 + frames * 5;
+    }
+}
+
+/* [reg_id][spectator][blocks] then per block [control_id][count][buffer
+ * size], answered with [status][blocks] then per block [player][lag]
+ * [entries] and the entries */
+static void relay_batch_request(const uint8_t* data, const uint8_t* end)
+{
+    uint8_t out[3 + 4 * (3 + 8 * 9)];
+    size_t len = 3;
+
+    if (net_read32(data) != REG_ID || data[4] != 0 || &data[6 + data[5] * 6] > end) {
+        ++relay.bad;
+        return;
+    }
+    ++relay.batch_requests;
+
+    out[0] = UDP_RECEIVE_KEY_INFO_BATCH;
+    out[1] = relay.status;
+    out[2] = 0;
+    for (uint8_t i = 0; i < data[5]; ++i) {
+        const uint8_t* block = &data[6 + i * 6];
+
+        if (block[0] >= 4) {
+            ++relay.bad;
+            return;
+        }
+        out[len] = block[0];
+        out[len + 1] = 0;
+        if ((out[len + 2] = relay_entries(block[0], net_read32(&block[1]), 8, &out[len + 3])) == 0)
+            continue;
+        len += 3 + out[len + 2] * 9;
+        ++out[2];
+    }
+    if (out[2] > 0)
+        relay_send(out, len);
+}
+
+static void relay_packet(const uint8_t* data, size_t len)
+{
+    const uint8_t* end = data + len;
+
+    switch (data[0]) {
+    case UDP_SEND_KEY_INFO:
+        if (len != 11 || data[1] != 0)
+            break;
+        ++relay.sends;
+        relay_local_input(net_read32(&data[2]), net_read32(&data[6]), data[10]);
+        return;
+    case UDP_REQUEST_KEY_INFO:
+        if (len != 12 || data[1] >= 4 || net_read32(&data[2]) != REG_ID || data[10] != 0)
+            break;
+        ++relay.requests;
+        relay_key_info(UDP_RECEIVE_KEY_INFO, data[1], net_read32(&data[6]));
+        return;
+    case UDP_SEND_KEY_INFO_BATCH:
+        if (len > 1)
+            relay_batch(&data[1], end);
+        return;
+    case UDP_REQUEST_KEY_INFO_BATCH:
+        if (len > 6)
+            relay_batch_request(&data[1], end);
+        return;
+    case UDP_SYNC_DATA:
+        if (len != CP0_REGS_COUNT * 4 + 5 || net_read32(&data[1]) != relay.syncs * 600)
+            break;
+        ++relay.syncs;
+        return;
+    }
+
+    fprintf(stderr, "test_netplay_process: relay got an invalid packet of type %u and %zu bytes\n", data[0], len);
+    ++relay.bad;
+}
+
+/* the other players send their input a little ahead of the local one,
+ * except during quiet spells */
+static void relay_advance(uint32_t now)
+{
+    if (!relay.have_client || (int32_t)(now - relay.quiet_until) < 0)
+        return;
+
+    while (relay.remote_next < relay.local_next + REMOTE_LEAD && relay.remote_next < HISTORY) {
+        for (uint8_t player = 1; player < 4; ++player) {
+            struct relay_input* input = &relay.input[player][relay.remote_next];
+            input->keys = trace[player][relay.remote_next];
+            input->plugin = remote_plugin(input->keys);
+            input->present = 1;
+            relay_key_info(UDP_RECEIVE_KEY_INFO_GRATUITOUS, player, relay.remote_next);
+        }
+        ++relay.remote_next;
+        if (rng() % QUIET == 0) {
+            relay.quiet_until = now + 1 + rng() % 8;
+            break;
+        }
+    }
+}
+
+static void* relay_udp_thread(void* opaque)
+{
+    struct pollfd pfd = { relay.udp, POLLIN, 0 };
+    uint8_t data[1024];
+    struct sockaddr_in from;
+    socklen_t from_len;
+    ssize_t len;
+
+    while (!__atomic_load_n(&relay.quit, __ATOMIC_ACQUIRE)) {
+        poll(&pfd, 1, 1);
+        from_len = sizeof(from);
+        while ((len = recvfrom(relay.udp, data, sizeof(data), MSG_DONTWAIT, (struct sockaddr*)&from, &from_len)) > 0) {
+            relay.client = from;
+            relay.have_client = 1;
+            relay_packet(data, (size_t)len);
+            from_len = sizeof(from);
+        }
+
+        relay_advance(SDL_GetTicks());
+        if (relay.held_len > 0 && SDL_GetTicks() - relay.held_at > 2) {
+            sendto(relay.udp, relay.held, relay.held_len, 0, (struct sockaddr*)&relay.client, sizeof(relay.client));
+            relay.held_len = 0;
+            ++relay.reordered;
+        }
+    }
+    return NULL;
+}
+
+static int relay_recv_extension(int fd, char* extension)
+{
+    for (size_t i = 0; i < sizeof(relay.save_extension); ++i) {
+        if (recv(fd, &extension[i], 1, MSG_WAITALL) != 1)
+            return 0;
+        if (extension[i] == '\0')
+            return 1;
+    }
+    return 0;
+}
+
+/* registration: [player][plugin][rawdata][reg_id] answered with
+ * [accepted][buffer target]; the controllers as 4 [reg_id][plugin]
+ * [rawdata]; the disconnect notice with [reg_id]; a save sent as
+ * [extension][size][data] and requested by [extension], answered with
+ * zeros if it was never sent */
+static void* relay_tcp_thread(void* opaque)
+{
+    int fd = accept(relay.tcp, NULL, NULL);
+    uint8_t request, data[24];
+    char extension[sizeof(relay.save_extension)];
+
+    while (fd >= 0 && recv(fd, &request, 1, MSG_WAITALL) == 1) {
+        switch (request) {
+        case TCP_SEND_SAVE:
+            if (!relay_recv_extension(fd, relay.save_extension) || recv(fd, data, 4, MSG_WAITALL) != 4
+             || (relay.save_size = net_read32(data)) > SAVE_SIZE
+             || recv(fd, relay.save, relay.save_size, MSG_WAITALL) != (ssize_t)relay.save_size)
+                ++relay.bad;
+            break;
+        case TCP_RECEIVE_SAVE:
+            if (!relay_recv_extension(fd, extension)) {
+                ++relay.bad;
+                break;
+            }
+            if (strcmp(extension, relay.save_extension) == 0)
+                send(fd, relay.save, relay.save_size, MSG_NOSIGNAL);
+            else {
+                static const uint8_t none[SAVE_SIZE];
+                send(fd, none, sizeof(none), MSG_NOSIGNAL);
+            }
+            break;
+        case TCP_REGISTER_PLAYER:
+            if (recv(fd, data, 7, MSG_WAITALL) != 7)
+                break;
+            relay.registered = data[0] == 0 && data[1] == PLUGIN_MEMPAK && net_read32(&data[3]) == REG_ID;
+            data[0] = relay.registered;
+            data[1] = BUFFER_TARGET;
+            send(fd, data, 2, MSG_NOSIGNAL);
+            break;
+        case TCP_GET_REGISTRATION:
+            for (int i = 0; i < 4; ++i) {
+                net_write32(REG_ID + i, &data[i * 6]);
+                data[i * 6 + 4] = PLUGIN_MEMPAK;
+                data[i * 6 + 5] = 0;
+            }
+            send(fd, data, 24, MSG_NOSIGNAL);
+            break;
+        case TCP_DISCONNECT_NOTICE:
+            if (recv(fd, data, 4, MSG_WAITALL) == 4)
+                relay.disconnected = net_read32(data) == REG_ID;
+            break;
+        default:
+            ++relay.bad;
+            break;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+    return NULL;
+}
+
+/* player 1 sends its save, which the others then read from the relay */
+static int exchange_saves(const char* mode)
+{
+    static uint8_t save[SAVE_SIZE], received[SAVE_SIZE], none[SAVE_SIZE];
+    file_status_t sent, read, missing;
+    int control = l_netplay_control[0];
+
+    for (size_t i = 0; i < SAVE_SIZE; ++i)
+        save[i] = (uint8_t)rng();
+    sent = netplay_read_storage("game.eep", save, SAVE_SIZE);
+
+    /* as a player without controller 1 */
+    l_netplay_control[0] = -1;
+    read = netplay_read_storage("game.eep", received, SAVE_SIZE);
+    missing = netplay_read_storage("game.sra", none, SAVE_SIZE);
+    l_netplay_control[0] = control;
+
+    if (sent != file_ok || read != file_ok || missing != file_open_error
+     || memcmp(received, save, SAVE_SIZE) != 0 || relay.save_size != SAVE_SIZE) {
+        fprintf(stderr, "test_netplay_process: %s input, saves sent %d, read %d, missing %d, %s\n", mode,
+                sent, read, missing, (memcmp(received, save, SAVE_SIZE) == 0) ? "the same" : "not the same");
+        return 0;
+    }
+    return 1;
+}
+
+/* the TCP and UDP sockets of the relay share a port, as the server's do */
+static int relay_open(int batched)
+{
+    struct sockaddr_in sin;
+    socklen_t sin_len = sizeof(sin);
+
+    memset(&relay, 0, sizeof(relay));
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    relay.tcp = socket(AF_INET, SOCK_STREAM, 0);
+    relay.udp = socket(AF_INET, SOCK_DGRAM, 0);
+    if (relay.tcp < 0 || relay.udp < 0
+     || bind(relay.tcp, (struct sockaddr*)&sin, sizeof(sin)) != 0
+     || listen(relay.tcp, 1) != 0
+     || getsockname(relay.tcp, (struct sockaddr*)&sin, &sin_len) != 0
+     || bind(relay.udp, (struct sockaddr*)&sin, sizeof(sin)) != 0) {
+        perror("test_netplay_process: relay socket");
+        return 0;
+    }
+    relay.port = ntohs(sin.sin_port);
+    relay.batched = batched;
+
+    /* what the local player reads before its first input is through */
+    for (int count = 0; count < INPUT_DELAY; ++count) {
+        relay.input[0][count].plugin = PLUGIN_MEMPAK;
+        relay.input[0][count].present = 1;
+    }
+    return 1;
+}
+
+static int play(uint32_t redundancy)
+{
+    static struct controller_input_compat cin[4];
+    static uint8_t tx[4], tx_buf[4], rx[4];
+    static uint32_t rx_buf[4];
+    static struct pif pif;
+    pthread_t udp_thread, tcp_thread;
+    const char* mode = (redundancy > 0) ? "batched" : "legacy";
+    int ok = 1;
+
+    if (!relay_open(redundancy > 0)
+     || pthread_create(&udp_thread, NULL, relay_udp_thread, NULL) != 0
+     || pthread_create(&tcp_thread, NULL, relay_tcp_thread, NULL) != 0)
+        return 0;
+
+    for (int i = 0; i < 4; ++i) {
+        tx[i] = 1;
+        tx_buf[i] = JCMD_CONTROLLER_READ;
+        pif.channels[i].tx = &tx[i];
+        pif.channels[i].tx_buf = &tx_buf[i];
+        pif.channels[i].rx = &rx[i];
+        pif.channels[i].rx_buf = (uint8_t*)&rx_buf[i];
+    }
+    memset(cin, 0, sizeof(cin));
+    NetplayInputRedundancy = redundancy;
+    disconnects = 0;
+    stopped = 0;
+
+    if (netplay_start("127.0.0.1", relay.port) != M64ERR_SUCCESS
+     || netplay_register_player(0, PLUGIN_MEMPAK, 0, REG_ID) != 1) {
+        fprintf(stderr, "test_netplay_process: %s input, could not join the relay\n", mode);
+        return 0;
+    }
+    log_len = 0;
+    if (netplay_record_start(write_log, NULL, KEYFRAME_INTERVAL) != M64ERR_SUCCESS) {
+        fprintf(stderr, "test_netplay_process: %s input, could not record\n", mode);
+        return 0;
+    }
+    netplay_set_controller(0);
+    netplay_read_registration(cin);
+    if (!exchange_saves(mode))
+        return 0;
+
+    for (uint32_t count = 0; count < VIS && ok; ++count) {
+        rx_buf[0] = trace[0][count];
+        rx_buf[1] = rx_buf[2] = rx_buf[3] = 0;
+        netplay_update_input(&pif);
+        if (stopped) {
+            fprintf(stderr, "test_netplay_process: %s input, lost the relay at count %u\n", mode, count);
+            ok = 0;
+            break;
+        }
+
+        for (int i = 0; i < 4; ++i) {
+            uint32_t keys = (i > 0) ? trace[i][count] : (count < INPUT_DELAY) ? 0 : trace[0][count - INPUT_DELAY];
+            uint8_t plugin = (i > 0) ? remote_plugin(keys) : PLUGIN_MEMPAK;
+            if (rx_buf[i] != keys || Controls[i].Plugin != plugin || cin[i].netplay_count != count + 1) {
+                fprintf(stderr, "test_netplay_process: %s input, controller %d read %08x with pak %d for count %u instead of %08x with pak %u\n",
+                        mode, i + 1, rx_buf[i], Controls[i].Plugin, count, keys, plugin);
+                ok = 0;
+            }
+        }
+        netplay_check_sync(NULL);
+        run_snapshot_job(count);
+    }
+
+    netplay_stop();
+    __atomic_store_n(&relay.quit, 1, __ATOMIC_RELEASE);
+    pthread_join(udp_thread, NULL);
+    pthread_join(tcp_thread, NULL);
+    close(relay.udp);
+    close(relay.tcp);
+    if (!ok || !check_log(mode))
+        return 0;
+
+    if (relay.bad > 0 || !relay.registered || !relay.disconnected || relay.local_next < VIS
+     || relay.syncs != (VIS + 599) / 600 || disconnects == 0 || l_status != 0x4) {
+        fprintf(stderr, "test_netplay_process: %s input, relay saw %u invalid packets and %u local inputs, %u sync packets, "
+                "registration %d, disconnect notice %d, %u disconnects reported\n", mode, relay.bad, relay.local_next,
+                relay.syncs, relay.registered, relay.disconnected, disconnects);
+        return 0;
+    }
+    /* a waiting controller requests its input, which the batched answers
+     * should make rare */
+    if ((redundancy > 0) != (relay.batches > 0 && relay.batch_requests > 0 && relay.sends == 0)
+     || (redundancy > 0 && (relay.dropped == 0 || relay.requests >= 2 * VIS))) {
+        fprintf(stderr, "test_netplay_process: %s input, relay got %u inputs, %u batches (%u dropped), %u requests and %u batch requests\n",
+                mode, relay.sends, relay.batches, relay.dropped, relay.requests, relay.batch_requests);
+        return 0;
+    }
+
+    printf("test_netplay_process: %s input, %u VIs read with %u requests and %u batch requests, "
+           "%u answers lost, %u reordered, %u batches dropped, %u keyframes logged\n",
+           mode, VIS, relay.requests, relay.batch_requests, relay.lost, relay.reordered, relay.dropped, keyframes);
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    regtest_seed("test_netplay_process", argc, argv);
+
+    for (int i = 0; i < 4; ++i) {
+        for (int count = 0; count < HISTORY; ++count)
+            trace[i][count] = rng();
+    }
+
+    if (!play(0) || !play(REDUNDANCY))
+        return 1;
+
+    regtest_passed();
+    return 0;
+}
@@ -0,0 +1,561 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_netplay_ring.c                                     *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+/* Stress test of the netplay input ring: a receiving thread stores the
+ * input of 4 players, each count sent twice and heavily reordered, while
+ * the emulation side consumes it. Checks that every input consumed in
+ * delay mode, and every input confirmed in rollback mode, is the one that
+ * was sent, and that every input consumed from a wrong prediction
+ * schedules a rollback to its VI.
+ *
+ * The last run is paced at 60 VI/s with every input delayed by up to
+ * 100 ms, and reports what the ring costs per VI against the 16.7 ms a VI
+ * lasts.
+ *
+ * Then netplay_wait_input waits for a single player whose input a thread
+ * standing in for the receive thread publishes late, now and then after
+ * the count that follows. Every wake of the waiter must come from the
+ * count it waits for or from the 5 ms deadline, never from another count
+ * and never after its count has arrived, and the stall report must add
+ * up the time every VI waited.
+ *
+ * netplay_ws.c is included to reach its statics; loopback/SDL2/SDL_net.h
+ * stands in for SDL and SDL_net, with the waiter's condition variable
+ * timed by the test, and netplay_ws_stubs.h for most of the core.
+ *
+ * Build and run with "make core-tests". */
+
+#include <SDL2/SDL_net.h>
+
+#define SDL_CondWaitTimeout(cond, mutex, ms) timed_wait(cond, mutex, ms)
+static int timed_wait(SDL_cond* cond, SDL_mutex* mutex, uint32_t ms);
+
+#include "main/netplay_ws.c"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "regtest.h"
+#include "netplay_ws_stubs.h"
+
+#define PLAYERS 4
+#define VIS 3600               /* a minute of play */
+#define PACED_VIS 120
+#define VI_NS 16683333         /* 60 VI/s */
+#define SENDS 2                /* every input is sent twice */
+#define REORDER 48             /* counts an input may arrive late by */
+#define PACED_DELAY 6          /* VIs an input may be delayed by when paced */
+#define STALL_LIMIT_NS 5000000000LL
+#define WAITS (NETPLAY_STALL_REPORT + 1)  /* the first report covers VI 0 */
+#define LATE 4                 /* VIs between late inputs, on average */
+#define LATE_MS 12             /* how late an input may be */
+#define WAIT_MS 5              /* the request deadline of netplay_wait_input */
+#define WAKE_SLACK_NS 1000000  /* a count published this long before a deadline should have woken the waiter */
+
+struct delivery {
+    uint32_t key;              /* VI it is sent in, sorted on */
+    uint32_t count;
+};
+
+static struct netplay_input_ring ring;
+static uint32_t trace[PLAYERS][VIS];
+static struct delivery order[PLAYERS][VIS * SENDS];
+static uint32_t next_count[PLAYERS];   /* netplay_count */
+
+static uint32_t consumed_keys[PLAYERS][VIS];
+static uint32_t consumed_vi[PLAYERS][VIS];
+
+static int l_paced;
+static uint32_t l_vis;
+static int64_t l_start;
+
+/* the waiter and the late publisher */
+static uint32_t late_ms[WAITS];
+static uint8_t early_next[WAITS];      /* the next count is published first */
+static int64_t published[WAITS + 1];   /* 0 until the count is in the ring */
+static uint32_t wanted;                 /* the count the waiter is at */
+static unsigned int wakes, deadlines, bad_wakes;
+
+struct stall_report {
+    unsigned int frames;
+    unsigned int total;
+    unsigned int worst;
+};
+static struct stall_report report;
+static unsigned int reports;
+
+static void log_message(enum retro_log_level level, const char* fmt, ...)
+{
+    char line[256];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    if (sscanf(line, "Netplay: %u of the last %*u frames waited for input, %u ms in total, worst %u ms",
+               &report.frames, &report.total, &report.worst) == 3)
+        ++reports;
+}
+
+retro_log_printf_t log_cb = log_message;
+
+/* linked in with netplay_ws.c, which takes no savestate here */
+size_t retro_serialize_size(void)
+{
+    return 0;
+}
+
+savestates_job savestates_get_job(void)
+{
+    return savestates_job_nothing;
+}
+
+savestates_job savestates_get_snapshot_job(void)
+{
+    return savestates_job_nothing;
+}
+
+struct savestate_snapshot *savestates_get_snapshot(void)
+{
+    return NULL;
+}
+
+void savestates_set_snapshot_job(savestates_job j, struct savestate_snapshot *snap, int rebase) {}
+
+m64p_error main_core_state_set(m64p_core_param param, int val)
+{
+    return M64ERR_SUCCESS;
+}
+
+/* the waiter's sleep in netplay_wait_input, called with l_receive_lock
+ * held: a wake must find the count it waits for, a deadline must not have
+ * missed one published well before it */
+static int timed_wait(SDL_cond* cond, SDL_mutex* mutex, uint32_t ms)
+{
+    int64_t start = now_ns();
+    int ret = (SDL_CondWaitTimeout)(cond, mutex, ms);
+    int64_t end = now_ns();
+    uint32_t count = __atomic_load_n(&l_wait_count, __ATOMIC_SEQ_CST);
+    int64_t at = (count <= WAITS) ? __atomic_load_n(&published[count], __ATOMIC_ACQUIRE) : 0;
+
+    if (ret != SDL_MUTEX_TIMEDOUT) {
+        ++wakes;
+        if (netplay_ring_get(0, count) == NULL) {
+            fprintf(stderr, "waiter: woken before count %u arrived\n", count);
+            ++bad_wakes;
+        }
+    }
+    else {
+        ++deadlines;
+        if (end - start < (int64_t)ms * 1000000 - WAKE_SLACK_NS / 2) {
+            fprintf(stderr, "waiter: deadline after %.2f ms instead of %u\n", (end - start) / 1000000.0, ms);
+            ++bad_wakes;
+        }
+        if (at != 0 && at + WAKE_SLACK_NS < end) {
+            fprintf(stderr, "waiter: count %u arrived %.2f ms before the deadline without a wake\n",
+                    count, (end - at) / 1000000.0);
+            ++bad_wakes;
+        }
+    }
+    return ret;
+}
+
+static void sleep_until(int64_t deadline)
+{
+    int64_t left = deadline - now_ns();
+    struct timespec ts;
+
+    if (left <= 0)
+        return;
+    ts.tv_sec = left / 1000000000;
+    ts.tv_nsec = left % 1000000000;
+    nanosleep(&ts, NULL);
+}
+
+static int compare_delivery(const void* a, const void* b)
+{
+    const struct delivery* x = a;
+    const struct delivery* y = b;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+/* every count sent SENDS times in a shuffled order; paced, the key is the
+ * VI the input reaches the receiving thread in */
+static void make_order(uint32_t vis, uint32_t spread)
+{
+    for (int i = 0; i < PLAYERS; ++i) {
+        for (uint32_t count = 0; count < vis; ++count) {
+            for (int send = 0; send < SENDS; ++send) {
+                struct delivery* d = &order[i][count * SENDS + send];
+                d->count = count;
+                d->key = count + rng() % (spread * (send + 1) + 1);
+            }
+        }
+        qsort(order[i], vis * SENDS, sizeof(order[i][0]), compare_delivery);
+    }
+}
+
+/* the receiving thread, netplay_process */
+static void* receive_thread(void* opaque)
+{
+    uint32_t sent[PLAYERS] = { 0 };
+    uint32_t total = l_vis * SENDS;
+    uint32_t shuffle = *(const uint32_t*)opaque;
+    int done = 0;
+
+    while (!done) {
+        int progress = 0;
+
+        for (int n = 0; n < PLAYERS; ++n) {
+            /* the players' packets interleave in any order */
+            int i;
+            const struct delivery* d;
+            uint32_t ahead;
+
+            shuffle = shuffle * 1664525 + 1013904223;
+            i = (n + (shuffle >> 16)) % PLAYERS;
+            if (sent[i] == total)
+                continue;
+            d = &order[i][sent[i]];
+            if (l_paced && now_ns() < l_start + (int64_t)d->key * VI_NS)
+                continue;
+
+            /* the server holds back what does not fit yet */
+            ahead = d->count - __atomic_load_n(&next_count[i], __ATOMIC_ACQUIRE);
+            if (ahead >= NETPLAY_INPUT_AHEAD && ahead < UINT32_MAX / 2)
+                continue;
+
+            netplay_input_put(&ring, i, d->count, trace[i][d->count], 1, __atomic_load_n(&next_count[i], __ATOMIC_ACQUIRE));
+            ++sent[i];
+            progress = 1;
+        }
+
+        done = 1;
+        for (int i = 0; i < PLAYERS; ++i)
+            done &= sent[i] == total;
+        if (!progress)
+            sched_yield();
+    }
+    return NULL;
+}
+
+static int start_receiving(pthread_t* thread, uint32_t vis, int paced)
+{
+    static uint32_t shuffle;
+
+    shuffle = rng();
+    memset(next_count, 0, sizeof(next_count));
+    memset(consumed_keys, 0, sizeof(consumed_keys));
+    netplay_input_reset(&ring);
+    l_vis = vis;
+    l_paced = paced;
+    make_order(vis, paced ? PACED_DELAY : REORDER);
+    l_start = now_ns();
+    return pthread_create(thread, NULL, receive_thread, &shuffle) == 0;
+}
+
+/* netplay_get_input in delay mode: wait for each input and consume it */
+static int run_delay(void)
+{
+    pthread_t thread;
+    uint64_t stalls = 0;
+
+    if (!start_receiving(&thread, VIS, 0))
+        return 0;
+
+    for (uint32_t vi = 0; vi < VIS; ++vi) {
+        for (uint8_t i = 0; i < PLAYERS; ++i) {
+            uint32_t count = next_count[i];
+            const struct netplay_input_slot* slot;
+            int64_t start = now_ns();
+
+            while ((slot = netplay_input_get(&ring, i, count)) == NULL) {
+                if (now_ns() - start > STALL_LIMIT_NS) {
+                    fprintf(stderr, "delay: player %u count %u never arrived\n", i, count);
+                    return 0;
+                }
+                ++stalls;
+                sched_yield();
+            }
+            if (slot->buttons != trace[i][count]) {
+                fprintf(stderr, "delay: player %u count %u consumed %08x instead of %08x\n",
+                        i, count, slot->buttons, trace[i][count]);
+                return 0;
+            }
+            /* hands the slot back to the receiving side */
+            __atomic_store_n(&next_count[i], count + 1, __ATOMIC_RELEASE);
+        }
+    }
+
+    pthread_join(thread, NULL);
+    printf("test_netplay_ring: delay mode, %u VIs of %u players, %u sends per input: every input consumed in order, %llu polls without input\n",
+           VIS, PLAYERS, SENDS, (unsigned long long)stalls);
+    return 1;
+}
+
+/* confirm what has arrived, as netplay_poll does, and check that every
+ * wrong prediction schedules a rollback */
+static int drain(struct netplay_rollback* rb, uint32_t* mispredicted)
+{
+    const struct netplay_input_slot* slot;
+
+    for (uint8_t i = 0; i < PLAYERS; ++i) {
+        while ((slot = netplay_rollback_confirm(rb, i)) != NULL) {
+            uint32_t count = slot->count;
+
+            if (slot->buttons != trace[i][count]) {
+                fprintf(stderr, "rollback: player %u count %u confirmed as %08x instead of %08x\n",
+                        i, count, slot->buttons, trace[i][count]);
+                return 0;
+            }
+            if (count < next_count[i] && consumed_keys[i][count] != trace[i][count]) {
+                if (!rb->pending || (int32_t)(rb->rollback_vi - consumed_vi[i][count]) > 0) {
+                    fprintf(stderr, "rollback: player %u count %u was mispredicted in VI %u without a rollback\n",
+                            i, count, consumed_vi[i][count]);
+                    return 0;
+                }
+                ++*mispredicted;
+            }
+        }
+    }
+    return 1;
+}
+
+/* netplay_rollback_vi and netplay_predict_input without the snapshots: a
+ * scheduled rollback is only taken off */
+static int run_rollback(uint32_t vis, int paced)
+{
+    static struct netplay_rollback rb;
+    pthread_t thread;
+    uint32_t zero[PLAYERS] = { 0 };
+    uint32_t mispredicted = 0, rollbacks = 0, stalls = 0;
+    int64_t cost, cost_total = 0, cost_worst = 0;
+
+    if (!start_receiving(&thread, vis, paced))
+        return 0;
+    if (!netplay_rollback_init(&rb, &ring, NETPLAY_ROLLBACK_MAX_FRAMES, 16, zero))
+        return 0;
+
+    for (uint32_t vi = 0; vi < vis; ++vi) {
+        int64_t start;
+
+        if (paced)
+            sleep_until(l_start + (int64_t)vi * VI_NS);
+        start = now_ns();
+
+        for (uint8_t i = 0; i < PLAYERS; ++i) {
+            int64_t stall_start = 0;
+
+            while (netplay_rollback_behind(&rb, i, next_count[i], vi)) {
+                if (stall_start == 0) {
+                    stall_start = now_ns();
+                    ++stalls;
+                }
+                if (now_ns() - stall_start > STALL_LIMIT_NS) {
+                    fprintf(stderr, "rollback: player %u stuck at count %u\n", i, rb.confirmed_count[i]);
+                    return 0;
+                }
+                if (!drain(&rb, &mispredicted))
+                    return 0;
+                sched_yield();
+            }
+            /* waiting for the network is not what the ring costs */
+            if (stall_start != 0)
+                start += now_ns() - stall_start;
+        }
+        if (!drain(&rb, &mispredicted))
+            return 0;
+        if (rb.pending) {
+            rb.pending = 0;
+            ++rollbacks;
+        }
+
+        for (uint8_t i = 0; i < PLAYERS; ++i) {
+            uint32_t count = next_count[i];
+            uint8_t plugin = 1;
+
+            consumed_keys[i][count] = netplay_rollback_input(&rb, i, count, vi, &plugin);
+            consumed_vi[i][count] = vi;
+            __atomic_store_n(&next_count[i], count + 1, __ATOMIC_RELEASE);
+        }
+
+        cost = now_ns() - start;
+        cost_total += cost;
+        if (cost > cost_worst)
+            cost_worst = cost;
+    }
+
+    /* everything sent is confirmed in the end */
+    pthread_join(thread, NULL);
+    if (!drain(&rb, &mispredicted))
+        return 0;
+    for (int i = 0; i < PLAYERS; ++i) {
+        if (rb.confirmed_count[i] != vis) {
+            fprintf(stderr, "rollback: player %u confirmed %u of %u inputs\n", i, rb.confirmed_count[i], vis);
+            return 0;
+        }
+    }
+
+    printf("test_netplay_ring: rollback mode%s, %u VIs of %u players: %u wrong predictions, %u rollbacks, %u stalls, %.2f us per VI, worst %.2f us of %.1f ms\n",
+           paced ? " at 60 VI/s" : "", vis, PLAYERS, mispredicted, rollbacks, stalls,
+           cost_total / 1000.0 / vis, cost_worst / 1000.0, VI_NS / 1000000.0);
+    netplay_rollback_free(&rb);
+    return 1;
+}
+
+static void publish(uint32_t count)
+{
+    if (published[count] != 0)
+        return;
+    netplay_ring_put(0, count, trace[0][count], 1);
+    __atomic_store_n(&published[count], now_ns(), __ATOMIC_RELEASE);
+    netplay_receive_wake();
+}
+
+/* the receive thread: publishes each count once the waiter wants it,
+ * late_ms later */
+static int late_thread(void* opaque)
+{
+    for (uint32_t count = 0; count < WAITS; ++count) {
+        while (__atomic_load_n(&wanted, __ATOMIC_ACQUIRE) < count)
+            sched_yield();
+        if (late_ms[count] > 0) {
+            int64_t due = now_ns() + (int64_t)late_ms[count] * 1000000;
+
+            if (early_next[count]) {
+                sleep_until(due - (int64_t)late_ms[count] * 500000);
+                publish(count + 1);
+            }
+            sleep_until(due);
+        }
+        publish(count);
+    }
+    return 0;
+}
+
+/* netplay_ensure_valid of one player over WAITS VIs, each closed by
+ * netplay_check_sync */
+static int run_waiter(void)
+{
+    static struct controller_input_compat cin_compats[4];
+    struct stall_report expected = { 0, 0, 0 };
+    unsigned int late = 0, stalled_ms = 0, stalled_frames = 0;
+
+    /* a count published early is not late */
+    for (uint32_t count = 0; count < WAITS; ++count) {
+        late_ms[count] = (rng() % LATE == 0 && !(count > 0 && early_next[count - 1])) ? 1 + rng() % LATE_MS : 0;
+        early_next[count] = late_ms[count] > 1 && rng() % 2 == 0;
+        late += late_ms[count] > 0;
+    }
+
+    netplay_input_reset(&l_input);
+    l_cin_compats = cin_compats;
+    l_udpSocket = UDP_Open(0);
+    l_udpChannel = 0;          /* unbound: the requests go nowhere */
+    l_netplay_is_init = 1;
+    l_receive_lock = SDL_CreateMutex();
+    l_receive_cond = SDL_CreateCond();
+    if (l_udpSocket == NULL || (l_receive_thread = SDL_CreateThread(late_thread, "late", NULL)) == NULL)
+        return 0;
+
+    for (uint32_t count = 0; count < WAITS; ++count) {
+        uint32_t start = SDL_GetTicks(), waited, stall;
+        const struct netplay_input_slot* slot;
+
+        l_cin_compats[0].netplay_count = count;
+        __atomic_store_n(&wanted, count, __ATOMIC_RELEASE);
+        if (!netplay_ensure_valid(0)) {
+            fprintf(stderr, "waiter: count %u never arrived\n", count);
+            return 0;
+        }
+        waited = SDL_GetTicks() - start;
+        stall = l_stall_frame;
+        if ((slot = netplay_ring_get(0, count)) == NULL || slot->buttons != trace[0][count]) {
+            fprintf(stderr, "waiter: count %u read another input\n", count);
+            return 0;
+        }
+        /* the ticks around the wait, to the ms */
+        if (stall > waited || stall + 2 < waited || stall + 1 < late_ms[count]) {
+            fprintf(stderr, "waiter: count %u late by %u ms stalled %u ms of %u\n", count, late_ms[count], stall, waited);
+            return 0;
+        }
+        if (stall > 0) {
+            ++expected.frames;
+            expected.total += stall;
+            if (stall > expected.worst)
+                expected.worst = stall;
+            ++stalled_frames;
+            stalled_ms += stall;
+        }
+
+        netplay_check_sync(NULL);
+        if (count % NETPLAY_STALL_REPORT == 0 && expected.frames > 0) {
+            if (reports == 0 || report.frames != expected.frames || report.total != expected.total || report.worst != expected.worst) {
+                fprintf(stderr, "waiter: VI %u reported %u frames, %u ms, worst %u instead of %u frames, %u ms, worst %u\n",
+                        count, report.frames, report.total, report.worst, expected.frames, expected.total, expected.worst);
+                return 0;
+            }
+            reports = 0;
+            expected.frames = expected.total = expected.worst = 0;
+        }
+    }
+
+    SDL_WaitThread(l_receive_thread, NULL);
+    l_receive_thread = NULL;
+    SDL_DestroyCond(l_receive_cond);
+    SDL_DestroyMutex(l_receive_lock);
+    UDP_Close(l_udpSocket);
+    l_udpSocket = NULL;
+    l_netplay_is_init = 0;
+
+    if (bad_wakes > 0 || reports > 0 || wakes == 0 || deadlines == 0) {
+        fprintf(stderr, "waiter: %u bad wakes of %u, %u deadlines, %u reports left\n", bad_wakes, wakes, deadlines, reports);
+        return 0;
+    }
+    printf("test_netplay_ring: waiter, %u VIs with %u inputs late by up to %u ms: %u wakes on the count, %u on the %u ms deadline, %u ms stalled in %u frames\n",
+           WAITS, late, LATE_MS, wakes, deadlines, WAIT_MS, stalled_ms, stalled_frames);
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    regtest_seed("test_netplay_ring", argc, argv);
+
+    /* held buttons that change every few frames, like real input */
+    for (int i = 0; i < PLAYERS; ++i) {
+        uint32_t keys = 0;
+        for (uint32_t count = 0; count < VIS; ++count) {
+            if (rng() % 8 == 0)
+                keys = rng();
+            trace[i][count] = keys;
+        }
+    }
+
+    if (!run_delay() || !run_rollback(VIS, 0) || !run_rollback(PACED_VIS, 1) || !run_waiter())
+        return 1;
+    regtest_passed();
+    return 0;
+}
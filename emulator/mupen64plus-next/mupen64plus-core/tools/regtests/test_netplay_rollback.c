@@ -0,0 +1,373 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_netplay_rollback.c                                 *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Headless rollback netplay test: replays a recorded 4 player input trace
+ * through netplay_rollback with the remote input delivered after random
+ * network delays, and checks that the final RDRAM hash matches the one of
+ * a run where every input is there in time.
+ *
+ * The machine is a stand-in for the core: every frame writes dram and
+ * registers as a function of the state and of the frame's input, so any
+ * input consumed wrongly and not rolled back changes the hash. Snapshots
+ * go through the same delta snapshot code as savestates_snapshot_save and
+ * savestates_snapshot_load, and the VI loop below follows
+ * netplay_rollback_vi and netplay_get_input.
+ *
+ * Build and run with "make core-tests". */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "regtest.h"
+
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
+#include "device/memory/memory.h"
+#include "device/rdram/rdram.h"
+#include "main/netplay_input.h"
+#include "main/netplay_rollback.h"
+#include "main/savestates_delta.h"
+
+#define VIS 600
+#define PLAYERS 4
+#define LOCAL_PLAYER 0
+
+/* same layout as a m64p image: registers, dram, more registers, padding */
+#define DRAM_OFFSET 0x1ea4
+#define TAIL_SIZE 0x3b1c
+#define IMAGE_SIZE (DRAM_OFFSET + RDRAM_MAX_SIZE + TAIL_SIZE)
+#define IMAGE_CAPACITY (IMAGE_SIZE + 0x2000)
+
+static struct rdram rdram;
+static uint8_t regs[DRAM_OFFSET + TAIL_SIZE];
+static char* image;
+
+static struct netplay_input_ring ring;
+static uint32_t trace[PLAYERS][VIS];
+static uint32_t arrival[PLAYERS][VIS];  /* VI the input reaches us in */
+
+static size_t delta_bytes;
+static uint32_t snapshot_saves, full_saves;
+static clock_t save_time;
+
+/* same as rdram.c, which would pull in the whole device */
+void rdram_clear_dirty(struct rdram* rdram, enum rdram_dirty_client client)
+{
+    memset(rdram->dirty[client], 0, sizeof(rdram->dirty[client]));
+    rdram->untracked[client] = 0;
+}
+
+static void machine_reset(void)
+{
+    uint32_t seed = 0x9e3779b9;
+
+    for (uint32_t i = 0; i < RDRAM_MAX_SIZE / 4; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        rdram.dram[i] = seed;
+    }
+    memset(regs, 0, sizeof(regs));
+    memset(rdram.dirty, 0, sizeof(rdram.dirty));
+}
+
+/* one frame: its writes depend on the registers and on the input */
+static void machine_frame(const uint32_t input[PLAYERS])
+{
+    uint64_t x = XXH3_64bits_withSeed(regs, sizeof(regs), XXH3_64bits(input, PLAYERS * sizeof(input[0])));
+    uint32_t address, length, i;
+
+    for (i = 0; i < 48; ++i) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        address = (uint32_t)(x >> 33) & (RDRAM_MAX_SIZE - 4);
+        rdram.dram[address / 4] ^= (uint32_t)x | 1;
+        rdram_mark_dirty(&rdram, address, 4);
+    }
+
+    /* a DMA which may straddle pages */
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    address = (uint32_t)(x >> 33) & (RDRAM_MAX_SIZE - 1) & ~UINT32_C(3);
+    length = 4 + ((uint32_t)(x >> 20) & 0x1ffc);
+    if (address + length > RDRAM_MAX_SIZE)
+        length = RDRAM_MAX_SIZE - address;
+    for (i = 0; i < length / 4; ++i)
+        rdram.dram[address / 4 + i] += (uint32_t)x + i;
+    rdram_mark_dirty(&rdram, address, length);
+
+    for (i = 0; i < 8; ++i) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        regs[(x >> 40) % sizeof(regs)] ^= (uint8_t)(x >> 24);
+    }
+}
+
+static uint64_t machine_hash(void)
+{
+    return XXH3_64bits_withSeed(rdram.dram, RDRAM_MAX_SIZE, XXH3_64bits(regs, sizeof(regs)));
+}
+
+/* what savestates_put_m64p does: the image with or without dram */
+static void put_image(char* dst, int with_dram)
+{
+    memcpy(dst, regs, DRAM_OFFSET);
+    if (with_dram)
+        memcpy(dst + DRAM_OFFSET, rdram.dram, RDRAM_MAX_SIZE);
+    memcpy(dst + DRAM_OFFSET + RDRAM_MAX_SIZE, regs + DRAM_OFFSET, TAIL_SIZE);
+}
+
+/* what savestates_load_m64p does, marking the dram pages it changes */
+static void load_image(const char* src)
+{
+    for (uint32_t page = 0; page < RDRAM_DIRTY_PAGES_COUNT; ++page) {
+        const char* s = src + DRAM_OFFSET + (page << RDRAM_DIRTY_PAGE_SHIFT);
+        char* d = (char*)rdram.dram + (page << RDRAM_DIRTY_PAGE_SHIFT);
+        if (memcmp(d, s, RDRAM_DIRTY_PAGE_SIZE) != 0) {
+            memcpy(d, s, RDRAM_DIRTY_PAGE_SIZE);
+            rdram_mark_dirty(&rdram, page << RDRAM_DIRTY_PAGE_SHIFT, RDRAM_DIRTY_PAGE_SIZE);
+        }
+    }
+    memcpy(regs, src, DRAM_OFFSET);
+    memcpy(regs + DRAM_OFFSET, src + DRAM_OFFSET + RDRAM_MAX_SIZE, TAIL_SIZE);
+}
+
+/* savestates_snapshot_save */
+static int snapshot_save(struct savestate_snapshot* snap, int rebase)
+{
+    clock_t start = clock();
+    int ret;
+
+    if (rebase) {
+        put_image(snap->base, 1);
+        ret = savestates_snapshot_saved(snap, 1, snap->base, IMAGE_SIZE, DRAM_OFFSET, &rdram);
+    }
+    else {
+        put_image(image, 0);
+        ret = savestates_snapshot_saved(snap, 0, image, IMAGE_SIZE, DRAM_OFFSET, &rdram);
+    }
+
+    save_time += clock() - start;
+    delta_bytes += snap->delta_size;
+    full_saves += rebase;
+    ++snapshot_saves;
+    return ret;
+}
+
+/* savestates_snapshot_load, without rebase as netplay_rollback_vi does */
+static int snapshot_load(struct savestate_snapshot* snap)
+{
+    const char* loaded = savestates_snapshot_image(snap, 0, image, IMAGE_CAPACITY);
+
+    if (loaded == NULL)
+        return 0;
+    load_image(loaded);
+    savestates_snapshot_loaded(snap, 0, &rdram, DRAM_OFFSET);
+    return 1;
+}
+
+/* the whole trace with no network in between */
+static uint64_t run_reference(void)
+{
+    uint32_t input[PLAYERS];
+
+    machine_reset();
+    for (uint32_t vi = 0; vi < VIS; ++vi) {
+        for (int i = 0; i < PLAYERS; ++i)
+            input[i] = trace[i][vi];
+        machine_frame(input);
+    }
+    return machine_hash();
+}
+
+/* the receiving side stores every remote input which has arrived by
+ * now, then netplay_poll confirms them */
+static void deliver(struct netplay_rollback* rb, const uint32_t netplay_count[PLAYERS], uint32_t now)
+{
+    for (uint8_t i = 0; i < PLAYERS; ++i) {
+        if (i == LOCAL_PLAYER)
+            continue;
+        for (uint32_t count = rb->confirmed_count[i]; count < VIS && count - rb->confirmed_count[i] < 64; ++count) {
+            if (arrival[i][count] <= now)
+                netplay_input_put(&ring, i, count, trace[i][count], 1, netplay_count[i]);
+        }
+        while (netplay_rollback_confirm(rb, i) != NULL)
+            ;
+    }
+}
+
+static int all_confirmed(const struct netplay_rollback* rb)
+{
+    for (int i = 0; i < PLAYERS; ++i) {
+        if (rb->confirmed_count[i] < VIS)
+            return 0;
+    }
+    return 1;
+}
+
+static int run_rollback(uint32_t frames, uint32_t jitter, uint64_t expected)
+{
+    static struct netplay_rollback rb;
+    uint32_t netplay_count[PLAYERS] = { 0 };
+    uint32_t input[PLAYERS];
+    uint32_t vi = 0, now = 0, stalls = 0;
+    struct netplay_snapshot* snap;
+    uint64_t hash;
+    int rebase, ret = 1;
+
+    for (int i = 0; i < PLAYERS; ++i) {
+        for (uint32_t count = 0; count < VIS; ++count)
+            arrival[i][count] = (i == LOCAL_PLAYER) ? count : count + ((jitter != 0) ? rng() % (jitter + 1) : 0);
+    }
+
+    machine_reset();
+    delta_bytes = 0;
+    snapshot_saves = full_saves = 0;
+    save_time = 0;
+    netplay_input_reset(&ring);
+    if (!netplay_rollback_init(&rb, &ring, frames, IMAGE_CAPACITY, netplay_count)) {
+        fprintf(stderr, "could not allocate the rollback snapshots\n");
+        return 0;
+    }
+
+    for (;;) {
+        /* every input has long arrived by then */
+        if (now > 2 * VIS) {
+            fprintf(stderr, "frames %u jitter %u: stuck at VI %u\n", frames, jitter, vi);
+            ret = 0;
+            break;
+        }
+
+        /* netplay_rollback_vi */
+        if (rb.resimulating && vi == rb.resim_target)
+            rb.resimulating = 0;
+
+        if (!rb.resimulating) {
+            for (uint8_t i = 0; i < PLAYERS; ++i) {
+                while (netplay_rollback_behind(&rb, i, netplay_count[i], vi) && now <= 2 * VIS) {
+                    deliver(&rb, netplay_count, ++now);
+                    ++stalls;
+                }
+            }
+            deliver(&rb, netplay_count, now);
+
+            if (rb.pending) {
+                struct netplay_snapshot* target = netplay_rollback_start(&rb, vi);
+                if (target == NULL) {
+                    fprintf(stderr, "frames %u jitter %u: VI %u left the rollback window\n", frames, jitter, rb.rollback_vi);
+                    ret = 0;
+                    break;
+                }
+                vi = target->vi;
+                memcpy(netplay_count, target->netplay_count, sizeof(netplay_count));
+                if (!snapshot_load(&target->state)) {
+                    fprintf(stderr, "frames %u jitter %u: could not load the snapshot of VI %u\n", frames, jitter, vi);
+                    ret = 0;
+                    break;
+                }
+                goto frame;
+            }
+
+            /* the last state is final once every input is confirmed */
+            if (vi == VIS) {
+                if (all_confirmed(&rb))
+                    break;
+                deliver(&rb, netplay_count, ++now);
+                continue;
+            }
+        }
+
+        snap = netplay_rollback_snapshot(&rb, vi, netplay_count, &rebase);
+        if (!snapshot_save(&snap->state, rebase)) {
+            fprintf(stderr, "frames %u jitter %u: could not save the snapshot of VI %u\n", frames, jitter, vi);
+            ret = 0;
+            break;
+        }
+
+    frame:
+        /* netplay_get_input, with the local input confirmed as it is sent */
+        for (uint8_t i = 0; i < PLAYERS; ++i) {
+            uint8_t plugin = 1;
+            if (i == LOCAL_PLAYER && netplay_input_put(&ring, i, netplay_count[i], trace[i][netplay_count[i]], 1, netplay_count[i]))
+                netplay_rollback_confirm(&rb, i);
+            input[i] = netplay_rollback_input(&rb, i, netplay_count[i], vi, &plugin);
+            ++netplay_count[i];
+        }
+        machine_frame(input);
+        ++vi;
+        if (!rb.resimulating)
+            ++now;
+    }
+
+    hash = machine_hash();
+    if (ret && hash != expected) {
+        fprintf(stderr, "frames %u jitter %u: RDRAM hash %016llx differs from %016llx without jitter\n",
+                frames, jitter, (unsigned long long)hash, (unsigned long long)expected);
+        ret = 0;
+    }
+    if (ret && jitter > 0 && rb.total == 0) {
+        fprintf(stderr, "frames %u jitter %u: no input was mispredicted\n", frames, jitter);
+        ret = 0;
+    }
+    if (ret)
+        printf("test_netplay_rollback: %u frames, jitter %2u: %3u rollbacks, %2u stalls, %4u of %4u snapshots full, %6u bytes per delta, %.3f ms per snapshot\n",
+               frames, jitter, rb.total, stalls, full_saves, snapshot_saves,
+               (unsigned)(delta_bytes / (snapshot_saves - full_saves)), save_time * 1000.0 / CLOCKS_PER_SEC / snapshot_saves);
+
+    netplay_rollback_free(&rb);
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    static const uint32_t frames[] = { 2, 4, NETPLAY_ROLLBACK_MAX_FRAMES };
+    static const uint32_t jitter[] = { 0, 2, 6, 12 };
+    uint64_t expected;
+
+    regtest_seed("test_netplay_rollback", argc, argv);
+
+    rdram.dram_size = RDRAM_MAX_SIZE;
+    rdram.dram = malloc(RDRAM_MAX_SIZE);
+    image = calloc(1, IMAGE_CAPACITY);
+    if (rdram.dram == NULL || image == NULL)
+        return 1;
+
+    /* held buttons that change every few frames, like real input */
+    for (int i = 0; i < PLAYERS; ++i) {
+        uint32_t keys = 0;
+        for (uint32_t count = 0; count < VIS; ++count) {
+            if (rng() % 8 == 0)
+                keys = rng();
+            trace[i][count] = keys;
+        }
+    }
+
+    expected = run_reference();
+
+    for (size_t f = 0; f < sizeof(frames) / sizeof(frames[0]); ++f) {
+        for (size_t j = 0; j < sizeof(jitter) / sizeof(jitter[0]); ++j) {
+            if (!run_rollback(frames[f], jitter[j], expected))
+                return 1;
+        }
+    }
+
+    free(image);
+    free(rdram.dram);
+    regtest_passed();
+    return 0;
+}
@@ -0,0 +1,447 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_profiler.c                                         *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Drives the runtime profiler with random PC samples, interrupt handlers,
+ * MMIO hits and block counters over a number of VIs, and checks that each
+ * line of the trace is valid JSON holding what a plain count of the same
+ * events gives: the hottest PC lines, with the samples past the table
+ * size dropped, the handlers run, the hits per device and the counters.
+ * The PCs come with a count that advances by up to a sample period, and
+ * now and then jumps as an idle skip or a loaded state would: one sample
+ * must be taken per period crossed, on a grid that restarts at a jump.
+ * Also times a PC sample and the write of a trace line.
+ *
+ * Only profiler.c is linked; the trace goes to a temporary directory given
+ * as the save directory.
+ *
+ * Build and run with "make core-tests". */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libretro.h>
+#include <mupen64plus-next_common.h>
+
+#include "regtest.h"
+
+#include "api/callbacks.h"
+#include "api/m64p_types.h"
+#include "main/profiler.h"
+
+#define VIS 200
+#define TIMED_SAMPLES 20000000
+
+/* same as profiler.c */
+#define PC_MAX        512
+#define PC_TOP        16
+#define INTERRUPTS    16
+#define MEM_TYPES     (M64P_MEM_BREAKPOINT + 1)
+
+uint32_t EnableProfiler;
+retro_environment_t environ_cb;
+
+static const char* const interrupt_names[INTERRUPTS] = {
+    "vi", "compare", "check", "si", "pi", "special", "ai", "sp",
+    "dp", "hw2", "nmi", "reset", "rsp_dma", "dd_mc", "dd_bm", "dd_dv"
+};
+
+static const char* const mem_type_names[MEM_TYPES] = {
+    "nomem", "nothing", "rdram", "rdram_regs", "rsp_mem", "rsp_regs", "rsp",
+    "dp", "dps", "vi", "ai", "pi", "ri", "si", "dd_regs", "dd_rom",
+    "flashram", "rom", "pif", "mi", "breakpoint"
+};
+
+static const char* const counter_names[PROFILER_COUNTERS] = {
+    "\"compiled\":", "\"invalidated\":", "\"flushed\":", "\"hash_hits\":", "\"hash_misses\":",
+    "\"skips\":", "\"cycles\":"
+};
+
+/* what a VI's trace line must hold */
+struct expected
+{
+    struct { uint32_t line, count; } pcs[PC_MAX];
+    unsigned int pc_used;
+    uint32_t pc_samples;
+    uint32_t pc_dropped;
+    uint32_t interrupts[INTERRUPTS];
+    uint64_t mmio[MEM_TYPES];
+    uint32_t counters[PROFILER_COUNTERS];
+};
+
+static char dir[] = "/tmp/test_profiler.XXXXXX";
+static char trace_path[64];
+static struct expected expected[VIS];
+static int region_type[PROFILER_MMIO_REGIONS];
+static uint32_t count;          /* CP0 count the PCs are ticked with */
+static uint32_t grid;           /* count of the last jump */
+static int jumped;              /* the next tick is away from the grid */
+
+/* the parts of the core profiler.c calls into */
+void DebugMessage(int level, const char *message, ...) {}
+
+static bool environment(unsigned cmd, void* data)
+{
+    if (cmd != RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY)
+        return false;
+    *(const char**)data = dir;
+    return true;
+}
+
+/* the devices of a few regions, the rest stays unmapped */
+static void map_regions(void)
+{
+    static const struct { uint16_t first, last; int type; } map[] = {
+        { 0x0000, 0x007f, M64P_MEM_RDRAM },
+        { 0x03f0, 0x03f0, M64P_MEM_RDRAMREG },
+        { 0x0400, 0x0400, M64P_MEM_RSPMEM },
+        { 0x0404, 0x0404, M64P_MEM_RSPREG },
+        { 0x0410, 0x0410, M64P_MEM_DP },
+        { 0x0430, 0x0430, M64P_MEM_MI },
+        { 0x0440, 0x0440, M64P_MEM_VI },
+        { 0x0450, 0x0450, M64P_MEM_AI },
+        { 0x0460, 0x0460, M64P_MEM_PI },
+        { 0x0480, 0x0480, M64P_MEM_SI },
+        { 0x1000, 0x1fbf, M64P_MEM_ROM },
+        { 0x1fc0, 0x1fc0, M64P_MEM_PIF },
+    };
+
+    for (size_t i = 0; i < sizeof(map) / sizeof(map[0]); ++i) {
+        for (uint32_t region = map[i].first; region <= map[i].last; ++region) {
+            profiler_map_region((uint16_t)region, map[i].type);
+            region_type[region] = map[i].type;
+        }
+    }
+}
+
+/* ticks the PC after the count advanced, a sample if a period was crossed */
+static void sample_pc(struct expected* e, uint32_t pc)
+{
+    uint32_t line = pc & ~UINT32_C(63);
+    uint32_t last = count;
+    unsigned int i;
+
+    if (rng() % 500 == 0) {
+        /* forward or back by more than a period */
+        count += (rng() & 1) ? 2 * PROFILER_SAMPLE_PERIOD + rng() % 0x1000000
+                             : -(2 * PROFILER_SAMPLE_PERIOD + rng() % 0x1000000);
+        jumped = 1;
+    }
+
+    /* the grid restarts at a jump */
+    if (jumped) {
+        jumped = 0;
+        grid = count;
+    }
+    else {
+        count += 1 + rng() % PROFILER_SAMPLE_PERIOD;
+        if ((count - grid) / PROFILER_SAMPLE_PERIOD == (last - grid) / PROFILER_SAMPLE_PERIOD) {
+            profiler_tick(count, pc);
+            return;
+        }
+    }
+
+    profiler_tick(count, pc);
+    ++e->pc_samples;
+    for (i = 0; i < e->pc_used && e->pcs[i].line != line; ++i);
+    if (i < e->pc_used) {
+        ++e->pcs[i].count;
+    }
+    else if (e->pc_used == PC_MAX) {
+        /* the table keeps the lines seen first */
+        ++e->pc_dropped;
+    }
+    else {
+        e->pcs[i].line = line;
+        e->pcs[i].count = 1;
+        ++e->pc_used;
+    }
+}
+
+/* one VI worth of random events */
+static void run_vi(struct expected* e)
+{
+    uint32_t lines = 1 + rng() % 800;
+    uint32_t base = 0x80000000 + (rng() % 0x10000) * 64;
+    unsigned int samples = rng() % 4000;
+    unsigned int handlers = rng() % 64;
+    unsigned int hits = rng() % 10000;
+
+    memset(e, 0, sizeof(*e));
+
+    /* a few hot lines among many cold ones */
+    for (unsigned int i = 0; i < samples; ++i) {
+        uint32_t a = rng() % lines, b = rng() % lines;
+        sample_pc(e, base + (a * b / lines) * 64 + rng() % 64);
+    }
+
+    for (unsigned int i = 0; i < handlers; ++i) {
+        size_t handler = rng() % INTERRUPTS;
+
+        profiler_interrupt_begin(handler);
+        profiler_interrupt_end();
+        ++e->interrupts[handler];
+    }
+
+    for (unsigned int i = 0; i < hits; ++i) {
+        uint32_t address = (rng() & 1) ? rng() & 0x1fffffff : 0x04000000 + (rng() % 0x90) * 0x10000;
+
+        profiler_count_mmio(address);
+        ++e->mmio[region_type[address >> 16]];
+    }
+
+    for (int i = 0; i < PROFILER_COUNTERS; ++i) {
+        uint32_t value = rng() % 1000;
+
+        if (rng() & 1) {
+            profiler_add((enum profiler_counter)i, value);
+            e->counters[i] += value;
+        }
+        else {
+            for (uint32_t j = 0; j < value % 16; ++j)
+                profiler_count((enum profiler_counter)i);
+            e->counters[i] += value % 16;
+        }
+    }
+
+    /* the VI handler itself ends in profiler_vi, which closes its timing */
+    if (rng() & 1) {
+        profiler_interrupt_begin(0);
+        ++e->interrupts[0];
+        profiler_vi();
+        profiler_interrupt_end();
+    }
+    else {
+        profiler_vi();
+    }
+}
+
+/* the end of a JSON value starting at p, or NULL */
+static const char* json_value(const char* p)
+{
+    if (*p == '"') {
+        for (++p; *p != '"'; ++p) {
+            if (*p == '\0' || (*p == '\\' && *++p == '\0'))
+                return NULL;
+        }
+        return p + 1;
+    }
+    if (*p == '{' || *p == '[') {
+        char close = (*p == '{') ? '}' : ']';
+
+        if (*++p == close)
+            return p + 1;
+        for (;;) {
+            if (close == '}') {
+                if (*p != '"' || (p = json_value(p)) == NULL || *p++ != ':')
+                    return NULL;
+            }
+            if ((p = json_value(p)) == NULL)
+                return NULL;
+            if (*p == close)
+                return p + 1;
+            if (*p++ != ',')
+                return NULL;
+        }
+    }
+    if (*p == '-' || (*p >= '0' && *p <= '9')) {
+        char* end;
+
+        strtod(p, &end);
+        return end;
+    }
+    return NULL;
+}
+
+static int by_count(const void* a, const void* b)
+{
+    const uint32_t* pa = (const uint32_t*)a;
+    const uint32_t* pb = (const uint32_t*)b;
+
+    if (pa[1] != pb[1])
+        return (pa[1] < pb[1]) ? 1 : -1;
+    return (pa[0] > pb[0]) - (pa[0] < pb[0]);
+}
+
+/* the value following key inside the section of line starting at section */
+static int find_u64(const char* line, const char* section, const char* key, unsigned long long* value)
+{
+    const char* p = strstr(line, section);
+
+    if (p == NULL || (p = strstr(p, key)) == NULL)
+        return 0;
+    return sscanf(p + strlen(key), "%llu", value) == 1;
+}
+
+static int check_line(const char* line, unsigned int vi, struct expected* e)
+{
+    const char* p;
+    unsigned int i, v, samples, dropped;
+    char key[32];
+    unsigned long long value;
+
+    if ((p = json_value(line)) == NULL || strcmp(p, "\n") != 0) {
+        fprintf(stderr, "test_profiler: VI %u: not a JSON line: %s", vi, line);
+        return 0;
+    }
+    if (sscanf(line, "{\"vi\":%u,\"ns\":%*d,\"pc_samples\":%u,\"pc_dropped\":%u", &v, &samples, &dropped) != 3
+     || v != vi || samples != e->pc_samples || dropped != e->pc_dropped) {
+        fprintf(stderr, "test_profiler: VI %u: expected %u samples, %u dropped: %s", vi, e->pc_samples, e->pc_dropped, line);
+        return 0;
+    }
+
+    qsort(e->pcs, e->pc_used, sizeof(e->pcs[0]), by_count);
+    p = strstr(line, "\"pc\":[") + 6;
+    for (i = 0; i < e->pc_used && i < PC_TOP; ++i) {
+        unsigned int pc, n;
+        int len;
+
+        if (sscanf(p, "%*[,]{\"pc\":\"%8X\",\"n\":%u}%n", &pc, &n, &len) != 2
+         && sscanf(p, "{\"pc\":\"%8X\",\"n\":%u}%n", &pc, &n, &len) != 2) {
+            fprintf(stderr, "test_profiler: VI %u: %u PC lines, expected %u\n", vi, i, e->pc_used < PC_TOP ? e->pc_used : PC_TOP);
+            return 0;
+        }
+        if (pc != e->pcs[i].line || n != e->pcs[i].count) {
+            fprintf(stderr, "test_profiler: VI %u: PC line %u is %08X sampled %u times, expected %08X %u times\n",
+                    vi, i, pc, n, e->pcs[i].line, e->pcs[i].count);
+            return 0;
+        }
+        p += len;
+    }
+    if (*p != ']') {
+        fprintf(stderr, "test_profiler: VI %u: more than %u PC lines\n", vi, i);
+        return 0;
+    }
+
+    for (i = 0; i < INTERRUPTS; ++i) {
+        snprintf(key, sizeof(key), "\"%s\":{\"n\":", interrupt_names[i]);
+        if (!find_u64(line, "\"interrupts\":", key, &value))
+            value = 0;
+        if (value != e->interrupts[i]) {
+            fprintf(stderr, "test_profiler: VI %u: %llu %s handlers, expected %u\n", vi, value, interrupt_names[i], e->interrupts[i]);
+            return 0;
+        }
+    }
+    for (i = 0; i < MEM_TYPES; ++i) {
+        snprintf(key, sizeof(key), "\"%s\":", mem_type_names[i]);
+        if (!find_u64(line, "\"mmio\":", key, &value))
+            value = 0;
+        if (value != e->mmio[i]) {
+            fprintf(stderr, "test_profiler: VI %u: %llu %s hits, expected %llu\n", vi, value, mem_type_names[i],
+                    (unsigned long long)e->mmio[i]);
+            return 0;
+        }
+    }
+    for (i = 0; i < PROFILER_COUNTERS; ++i) {
+        if (!find_u64(line, "\"blocks\":", counter_names[i], &value) || value != e->counters[i]) {
+            fprintf(stderr, "test_profiler: VI %u: %s %llu, expected %u\n", vi, counter_names[i], value, e->counters[i]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int cleanup(int status)
+{
+    remove(trace_path);
+    rmdir(dir);
+    return status;
+}
+
+int main(int argc, char** argv)
+{
+    static char line[1 << 16];
+    double sample_time, write_time;
+    unsigned int vi = 0;
+    FILE* f;
+
+    regtest_seed("test_profiler", argc, argv);
+
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "test_profiler: cannot create %s\n", dir);
+        return 1;
+    }
+    snprintf(trace_path, sizeof(trace_path), "%s/mupen64plus_profile.jsonl", dir);
+    environ_cb = environment;
+    map_regions();
+
+    /* nothing is counted until the option is seen on a VI, and the first
+     * tick is away from the grid the profiler starts with */
+    count = 2 * PROFILER_SAMPLE_PERIOD + rng() % 0x7fffffff;
+    profiler_tick(count, 0x80000000);
+    jumped = 1;
+    EnableProfiler = 1;
+    profiler_vi();
+    if (!g_profiler.enabled) {
+        fprintf(stderr, "test_profiler: not enabled by the option\n");
+        return cleanup(1);
+    }
+
+    for (unsigned int i = 0; i < VIS; ++i)
+        run_vi(&expected[i]);
+
+    EnableProfiler = 0;
+    profiler_vi();
+    if (g_profiler.enabled) {
+        fprintf(stderr, "test_profiler: still enabled without the option\n");
+        return cleanup(1);
+    }
+
+    if ((f = fopen(trace_path, "rb")) == NULL) {
+        fprintf(stderr, "test_profiler: no trace written\n");
+        return cleanup(1);
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (vi == VIS || !check_line(line, vi, &expected[vi])) {
+            fclose(f);
+            return cleanup(1);
+        }
+        ++vi;
+    }
+    fclose(f);
+    if (vi != VIS) {
+        fprintf(stderr, "test_profiler: %u trace lines for %u VIs\n", vi, VIS);
+        return cleanup(1);
+    }
+    printf("test_profiler: %u VIs, every trace line is JSON and matches a plain count\n", VIS);
+
+    /* a PC sample in a frame of 64 hot lines, then writing the frame */
+    EnableProfiler = 1;
+    profiler_vi();
+    sample_time = now();
+    for (uint32_t i = 0; i < TIMED_SAMPLES; ++i)
+        profiler_sample_pc(i * PROFILER_SAMPLE_PERIOD, 0x80000000 + (i * 2654435761u >> 26) * 64);
+    sample_time = now() - sample_time;
+    write_time = now();
+    for (uint32_t i = 0; i < 1000; ++i) {
+        for (uint32_t j = 0; j < PC_MAX; ++j)
+            profiler_sample_pc(j * PROFILER_SAMPLE_PERIOD, 0x80000000 + j * 64);
+        profiler_vi();
+    }
+    write_time = now() - write_time;
+    profiler_deinit();
+    printf("test_profiler: %.2f ns per PC sample, %.1f us per trace line over %u PC lines\n",
+           sample_time * 1e9 / TIMED_SAMPLES, write_time * 1e6 / 1000, PC_MAX);
+
+    regtest_passed();
+    return cleanup(0);
+}
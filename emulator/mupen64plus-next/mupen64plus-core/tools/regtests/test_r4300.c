@@ -0,0 +1,794 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_r4300.c                                            *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Runs a small MIPS program on the r4300 interpreters and checks that the
+ * pure interpreter, the cached interpreter and its superblock mode leave
+ * the same registers and memory behind, and reports the speed of each in
+ * millions of emulated instructions per second. Each interpreter also runs
+ * with RDRAM behind handlers that only forward to the RDRAM ones, which
+ * keeps its loads and stores off the RDRAM fast path. The cached modes
+ * also run with the called function reloaded by a DMA before every call,
+ * once with the same code, which must keep its decoded blocks, and once
+ * with code that changes on every other load, which must be decoded again.
+ *
+ * A loop polling a flag set by the VI handler then runs on each
+ * interpreter, once as an idle loop, which is skipped to the next event,
+ * and once counting its iterations, which keeps it polling. Both must see
+ * the flag set the same number of times.
+ *
+ * The event queue is then driven by random adds, removes, check interrupts
+ * and firings, and compared after each step with a model of the sorted
+ * list it replaced.
+ *
+ * Each interpreter must also sample the profiler PC once every
+ * PROFILER_SAMPLE_PERIOD counts of the run, at the same branches as the
+ * others.
+ *
+ * The r4300 core, its TLB and event queue, the memory map and the RDRAM
+ * handlers are linked, profiler.c is included to count its samples; the
+ * rest of the device is stubbed below. VI events come every VI_DELAY
+ * counts and stop the core after VIS of them.
+ *
+ * Build and run with "make core-tests". */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libretro.h>
+
+#include "regtest.h"
+
+#include "api/callbacks.h"
+#include "device/device.h"
+#include "device/memory/memory.h"
+#include "device/r4300/r4300_core.h"
+#include "device/r4300/interrupt.h"
+#include "device/rdram/rdram.h"
+#include "main/main.h"
+#include "main/profiler.c"
+#include "main/savestates.h"
+
+#define VIS 30
+#define VI_DELAY 1562500       /* 93.75 MHz / 60 */
+#define COUNT_PER_OP 2
+
+#define QUEUE_STEPS 200000
+#define QUEUE_TIMED 2000000
+
+#define PROGRAM_ADDR UINT32_C(0x80001000)
+#define OVERLAY_ADDR UINT32_C(0x80002000)
+#define BUFFER_ADDR UINT32_C(0x80100000)
+#define BUFFER_WORDS 4096
+#define IDLE_FLAG_ADDR UINT32_C(0x80200000)
+#define IDLE_SLACK 256         /* counts run after the last VI, polling or not */
+
+/* registers */
+enum { ZERO = 0, V0 = 2, T0 = 8, T1, T2, T3, T4, T5, T6, T7, S0, S1, S2, S3, S4, T8 = 24, T9, RA = 31 };
+
+struct device g_dev;
+int g_rom_pause;
+int g_gs_vi_counter;
+retro_environment_t environ_cb;
+uint32_t CachedInterpSuperblocks;
+uint32_t EnableProfiler;
+uint32_t IgnoreTLBExceptions;
+
+/* the program reloaded before every call, like an overlay coming from the cart */
+enum { OVERLAY_NONE, OVERLAY_SAME, OVERLAY_CHANGED };
+
+struct mode {
+    const char* name;
+    unsigned int emumode;
+    uint32_t superblocks;
+    int handlers;              /* RDRAM accessed through forwarding handlers */
+    int overlay;
+};
+
+struct result {
+    int64_t regs[32];
+    int64_t hi, lo;
+    uint32_t pc;
+    uint32_t count;
+    uint64_t buffer_hash;
+    uint64_t dirty_hash;
+    unsigned int handler_calls;
+    uint32_t hash_hits;
+    uint32_t hash_misses;
+    uint32_t idle_skips;
+    uint32_t idle_cycles;
+    uint32_t pc_samples;
+    uint64_t pc_hash;
+    double seconds;
+};
+
+static const struct mode modes[] = {
+    { "pure interpreter", EMUMODE_PURE_INTERPRETER, 0, 0, OVERLAY_NONE },
+    { "cached interpreter", EMUMODE_INTERPRETER, 0, 0, OVERLAY_NONE },
+    { "cached, superblocks", EMUMODE_INTERPRETER, 1, 0, OVERLAY_NONE },
+    { "pure, RDRAM handlers", EMUMODE_PURE_INTERPRETER, 0, 1, OVERLAY_NONE },
+    { "superblocks, RDRAM handlers", EMUMODE_INTERPRETER, 1, 1, OVERLAY_NONE },
+    { "cached, overlay reloaded", EMUMODE_INTERPRETER, 0, 0, OVERLAY_SAME },
+    { "superblocks, overlay reloaded", EMUMODE_INTERPRETER, 1, 0, OVERLAY_SAME },
+    { "pure, overlay changed", EMUMODE_PURE_INTERPRETER, 0, 0, OVERLAY_CHANGED },
+    { "cached, overlay changed", EMUMODE_INTERPRETER, 0, 0, OVERLAY_CHANGED },
+    { "superblocks, overlay changed", EMUMODE_INTERPRETER, 1, 0, OVERLAY_CHANGED },
+};
+#define MODES (sizeof(modes) / sizeof(modes[0]))
+
+static const struct mode idle_modes[] = {
+    { "pure, polling", EMUMODE_PURE_INTERPRETER, 0, 0, OVERLAY_NONE },
+    { "cached, polling", EMUMODE_INTERPRETER, 0, 0, OVERLAY_NONE },
+    { "superblocks, polling", EMUMODE_INTERPRETER, 1, 0, OVERLAY_NONE },
+};
+#define IDLE_MODES (sizeof(idle_modes) / sizeof(idle_modes[0]))
+
+static void* mem_base;
+static uint32_t* dram;
+static uint32_t program[(OVERLAY_ADDR - PROGRAM_ADDR) / 4 + 64];
+static size_t program_size;
+static uint32_t func;
+static uint32_t func_changed;
+static const struct mode* current;
+static unsigned int vis;
+static unsigned int unmapped;
+static unsigned int handler_calls;
+static unsigned int overlay_loads;
+
+/* the parts of the core the r4300 calls into */
+void DebugMessage(int level, const char *message, ...) {}
+void dyna_jump(void) {}
+void dyna_stop(struct r4300_core* r4300) {}
+void dynarec_jump_to(struct r4300_core* r4300, uint32_t address) {}
+void pif_bootrom_hle_execute(struct r4300_core* r4300) {}
+void poweron_device(struct device* dev) {}
+void reset_pif(struct pif* pif, unsigned int reset_type) {}
+savestates_job savestates_get_job(void) { return savestates_job_nothing; }
+savestates_job savestates_get_snapshot_job(void) { return savestates_job_nothing; }
+int savestates_load(void) { return 0; }
+int savestates_save(void) { return 0; }
+int savestates_snapshot_load(void) { return 0; }
+int savestates_snapshot_save(void) { return 0; }
+
+static void read_unmapped(void* opaque, uint32_t address, uint32_t* value)
+{
+    ++unmapped;
+    *value = 0;
+}
+
+static void write_unmapped(void* opaque, uint32_t address, uint32_t value, uint32_t mask)
+{
+    ++unmapped;
+}
+
+/* the same RDRAM, but not the handlers the fast path looks for */
+static void read_rdram_forward(void* opaque, uint32_t address, uint32_t* value)
+{
+    ++handler_calls;
+    read_rdram_dram(opaque, address, value);
+}
+
+static void write_rdram_forward(void* opaque, uint32_t address, uint32_t value, uint32_t mask)
+{
+    ++handler_calls;
+    write_rdram_dram(opaque, address, value, mask);
+}
+
+/* the program starts the overlay DMA with a PI write, which copies the
+ * page of func and invalidates both segments like a cart DMA. The changed
+ * overlay counts every other call by 3 instead of 1.
+ *
+ * func has a page to itself: the cached interpreter only checks a page
+ * when jumping into it, so code changed under the running page would
+ * keep its old decoding, on real overlays as well. */
+static void write_overlay_dma(void* opaque, uint32_t address, uint32_t value, uint32_t mask)
+{
+    struct r4300_core* r4300 = (struct r4300_core*)opaque;
+    uint32_t paddr = OVERLAY_ADDR & 0xffffff;
+    size_t size = program_size * 4 - (OVERLAY_ADDR - PROGRAM_ADDR);
+
+    if (current->overlay == OVERLAY_NONE)
+        return;
+
+    memcpy(&dram[paddr / 4], &program[(OVERLAY_ADDR - PROGRAM_ADDR) / 4], size);
+    if (current->overlay == OVERLAY_CHANGED && (overlay_loads & 1) != 0)
+        dram[(func & 0xffffff) / 4] = func_changed;
+    invalidate_r4300_cached_code(r4300, R4300_KSEG0 + paddr, size);
+    invalidate_r4300_cached_code(r4300, R4300_KSEG1 + paddr, size);
+    ++overlay_loads;
+}
+
+static void vi_handler(void* opaque)
+{
+    struct r4300_core* r4300 = (struct r4300_core*)opaque;
+
+    remove_interrupt_event(&r4300->cp0);
+    add_interrupt_event(&r4300->cp0, VI_INT, VI_DELAY);
+    /* what the idle loop program waits for */
+    dram[(IDLE_FLAG_ADDR & 0xffffff) / 4] = 1;
+    if (++vis == VIS)
+        *r4300_stop(r4300) = 1;
+}
+
+static void unexpected_handler(void* opaque)
+{
+    fprintf(stderr, "test_r4300: unexpected interrupt\n");
+    exit(1);
+}
+
+/* instruction encoding */
+static uint32_t op_r(uint32_t funct, int rs, int rt, int rd, int sa)
+{
+    return ((uint32_t)rs << 21) | ((uint32_t)rt << 16) | ((uint32_t)rd << 11) | ((uint32_t)sa << 6) | funct;
+}
+
+static uint32_t op_i(uint32_t op, int rs, int rt, int32_t imm)
+{
+    return (op << 26) | ((uint32_t)rs << 21) | ((uint32_t)rt << 16) | ((uint32_t)imm & 0xffff);
+}
+
+static uint32_t op_j(uint32_t op, uint32_t target)
+{
+    return (op << 26) | ((target >> 2) & 0x3ffffff);
+}
+
+static uint32_t here(void)
+{
+    return PROGRAM_ADDR + 4 * (uint32_t)program_size;
+}
+
+static void emit(uint32_t iw)
+{
+    program[program_size++] = iw;
+}
+
+/* branch offsets are relative to the delay slot */
+static int32_t to(uint32_t target)
+{
+    return (int32_t)(target - here() - 4) >> 2;
+}
+
+/* a checksum over a buffer, rewriting it as it goes: loads, stores of
+ * every size, ALU ops and a multiply, with a call between passes */
+static void build_program(void)
+{
+    uint32_t outer, inner, call;
+
+    program_size = 0;
+    emit(op_i(15, ZERO, S0, BUFFER_ADDR >> 16));        /* lui s0, buffer */
+    emit(op_i(13, ZERO, S1, BUFFER_WORDS));             /* ori s1, zero, words */
+    emit(op_i(15, ZERO, T4, 0x1234));                   /* lui t4, 0x1234 */
+    emit(op_i(13, T4, T4, 0x5678));                     /* ori t4, t4, 0x5678 */
+    emit(op_i(15, ZERO, S4, 0xa460));                   /* lui s4, pi regs */
+    outer = here();
+    emit(op_r(37, S0, ZERO, T0, 0));                    /* or t0, s0, zero */
+    emit(op_r(37, S1, ZERO, T1, 0));                    /* or t1, s1, zero */
+    inner = here();
+    emit(op_i(35, T0, T2, 0));                          /* lw t2, 0(t0) */
+    emit(op_r(0, 0, T4, T3, 5));                        /* sll t3, t4, 5 */
+    emit(op_r(38, T4, T2, T4, 0));                      /* xor t4, t4, t2 */
+    emit(op_r(33, T4, T3, T4, 0));                      /* addu t4, t4, t3 */
+    emit(op_r(2, 0, T4, T5, 7));                        /* srl t5, t4, 7 */
+    emit(op_r(38, T4, T5, T4, 0));                      /* xor t4, t4, t5 */
+    emit(op_r(25, T4, T2, 0, 0));                       /* multu t4, t2 */
+    emit(op_r(18, 0, 0, T6, 0));                        /* mflo t6 */
+    emit(op_r(33, T4, T6, T4, 0));                      /* addu t4, t4, t6 */
+    emit(op_i(43, T0, T4, 0));                          /* sw t4, 0(t0) */
+    emit(op_i(36, T0, T7, 1));                          /* lbu t7, 1(t0) */
+    emit(op_i(12, T4, T8, 0xffff));                     /* andi t8, t4, 0xffff */
+    emit(op_i(41, T0, T8, 2));                          /* sh t8, 2(t0) */
+    emit(op_i(40, T0, T7, 0));                          /* sb t7, 0(t0) */
+    emit(op_r(42, T7, T8, T9, 0));                      /* slt t9, t7, t8 */
+    emit(op_r(33, S3, T9, S3, 0));                      /* addu s3, s3, t9 */
+    emit(op_i(9, T1, T1, -1));                          /* addiu t1, t1, -1 */
+    emit(op_i(5, T1, ZERO, to(inner)));                 /* bne t1, zero, inner */
+    emit(op_i(9, T0, T0, 4));                           /* addiu t0, t0, 4 */
+    emit(op_i(43, S4, ZERO, 0));                        /* sw zero, 0(s4) */
+    call = here();
+    emit(0);                                            /* jal func */
+    emit(0);                                            /* nop */
+    emit(op_j(2, outer));                               /* j outer */
+    emit(0);                                            /* nop */
+    while (here() != OVERLAY_ADDR)
+        emit(0);
+    func = here();
+    emit(op_i(9, S2, S2, 1));                           /* addiu s2, s2, 1 */
+    emit(op_r(8, RA, 0, 0, 0));                         /* jr ra */
+    emit(0);                                            /* nop */
+    program[(call - PROGRAM_ADDR) / 4] = op_j(3, func);
+    func_changed = op_i(9, S2, S2, 3);                  /* addiu s2, s2, 3 */
+}
+
+/* a loop polling a flag the VI handler sets, counting the wakes in s2.
+ * With carried set it also counts its iterations in t9, which is state
+ * carried from one iteration to the next, so it is not an idle loop. */
+static void build_idle_program(int carried)
+{
+    uint32_t poll;
+
+    program_size = 0;
+    emit(op_i(15, ZERO, S0, IDLE_FLAG_ADDR >> 16));     /* lui s0, flag */
+    poll = here();
+    emit(op_i(35, S0, T0, 0));                          /* lw t0, 0(s0) */
+    emit(carried ? op_i(9, T9, T9, 1) : 0);             /* addiu t9, t9, 1 or nop */
+    emit(op_i(4, T0, ZERO, to(poll)));                  /* beq t0, zero, poll */
+    emit(0);                                            /* nop */
+    emit(op_i(43, S0, ZERO, 0));                        /* sw zero, 0(s0) */
+    emit(op_j(2, poll));                                /* j poll */
+    emit(op_i(9, S2, S2, 1));                           /* addiu s2, s2, 1 */
+}
+
+static uint64_t hash_words(const uint32_t* words, size_t count)
+{
+    uint64_t hash = UINT64_C(14695981039346656037);
+
+    while (count-- != 0)
+        hash = (hash ^ *words++) * UINT64_C(1099511628211);
+    return hash;
+}
+
+static void map_memory(int forward)
+{
+    struct mem_mapping mappings[3];
+
+    memset(mappings, 0, sizeof(mappings));
+    mappings[0].begin = 0x00000000;
+    mappings[0].end = 0xffffffff;
+    mappings[0].type = M64P_MEM_NOTHING;
+    mappings[0].handler.read32 = read_unmapped;
+    mappings[0].handler.write32 = write_unmapped;
+    mappings[1].begin = MM_RDRAM_DRAM;
+    mappings[1].end = MM_RDRAM_DRAM + RDRAM_MAX_SIZE - 1;
+    mappings[1].type = M64P_MEM_RDRAM;
+    mappings[1].handler.opaque = &g_dev.rdram;
+    mappings[1].handler.read32 = forward ? read_rdram_forward : read_rdram_dram;
+    mappings[1].handler.write32 = forward ? write_rdram_forward : write_rdram_dram;
+    mappings[2].begin = MM_PI_REGS;
+    mappings[2].end = MM_PI_REGS + 0xffff;
+    mappings[2].type = M64P_MEM_PI;
+    mappings[2].handler.opaque = &g_dev.r4300;
+    mappings[2].handler.read32 = read_unmapped;
+    mappings[2].handler.write32 = write_overlay_dma;
+    init_memory(&g_dev.mem, mappings, 3, mem_base, NULL);
+}
+
+static void setup(const struct mode* mode, uint32_t seed)
+{
+    struct interrupt_handler handlers[CP0_INTERRUPT_HANDLERS_COUNT];
+    struct r4300_core* r4300 = &g_dev.r4300;
+    uint32_t state = rng_state;
+
+    for (int i = 0; i < CP0_INTERRUPT_HANDLERS_COUNT; ++i) {
+        handlers[i].opaque = NULL;
+        handlers[i].callback = unexpected_handler;
+    }
+    handlers[0].opaque = r4300;
+    handlers[0].callback = vi_handler;
+    handlers[1].opaque = r4300;
+    handlers[1].callback = compare_int_handler;
+    handlers[2].opaque = r4300;
+    handlers[2].callback = check_int_handler;
+    handlers[5].opaque = &r4300->cp0;
+    handlers[5].callback = special_int_handler;
+
+    map_memory(mode->handlers);
+    memset(dram, 0, RDRAM_MAX_SIZE);
+    memset(g_dev.rdram.dirty, 0, sizeof(g_dev.rdram.dirty));
+    memcpy(&dram[(PROGRAM_ADDR & 0xffffff) / 4], program, program_size * 4);
+    rng_state = seed;
+    for (size_t i = 0; i < BUFFER_WORDS; ++i)
+        dram[(BUFFER_ADDR & 0xffffff) / 4 + i] = rng();
+    rng_state = state;
+
+    init_r4300(r4300, &g_dev.mem, &g_dev.mi, &g_dev.rdram, handlers,
+               mode->emumode, COUNT_PER_OP, 0, 0, 0, PROGRAM_ADDR);
+    poweron_r4300(r4300);
+    add_interrupt_event(&r4300->cp0, VI_INT, VI_DELAY);
+    vis = 0;
+    handler_calls = 0;
+    overlay_loads = 0;
+    profiler_reset();
+    g_profiler.next_sample = r4300_cp0_regs(&r4300->cp0)[CP0_COUNT_REG];
+}
+
+static void run(const struct mode* mode, uint32_t seed, struct result* result)
+{
+    struct r4300_core* r4300 = &g_dev.r4300;
+    uint32_t count;
+    double t;
+
+    current = mode;
+    CachedInterpSuperblocks = mode->superblocks;
+    setup(mode, seed);
+    count = r4300_cp0_regs(&r4300->cp0)[CP0_COUNT_REG];
+
+    t = now();
+    run_r4300(r4300);
+    result->seconds = now() - t;
+
+    memcpy(result->regs, r4300_regs(r4300), sizeof(result->regs));
+    result->hi = *r4300_mult_hi(r4300);
+    result->lo = *r4300_mult_lo(r4300);
+    result->pc = r4300->cp0.last_addr;
+    result->count = r4300_cp0_regs(&r4300->cp0)[CP0_COUNT_REG] - count;
+    result->buffer_hash = hash_words(&dram[(BUFFER_ADDR & 0xffffff) / 4], BUFFER_WORDS);
+    result->dirty_hash = hash_words(g_dev.rdram.dirty[RDRAM_DIRTY_SAVESTATE], RDRAM_DIRTY_PAGES_COUNT / 32);
+    result->handler_calls = handler_calls;
+    result->hash_hits = g_profiler.counters[PROFILER_BLOCK_HASH_HIT];
+    result->hash_misses = g_profiler.counters[PROFILER_BLOCK_HASH_MISS];
+    result->idle_skips = g_profiler.counters[PROFILER_IDLE_SKIP];
+    result->idle_cycles = g_profiler.counters[PROFILER_IDLE_CYCLES];
+    result->pc_samples = l_pc_samples;
+    result->pc_hash = hash_words((const uint32_t*)l_pcs, l_pc_used * 2);
+}
+
+static int same_result(const char* name, const struct result* a, const struct result* b)
+{
+    for (int i = 0; i < 32; ++i) {
+        if (a->regs[i] != b->regs[i]) {
+            fprintf(stderr, "test_r4300: %s: r%d is %016llx, expected %016llx\n", name, i,
+                    (unsigned long long)b->regs[i], (unsigned long long)a->regs[i]);
+            return 0;
+        }
+    }
+    if (a->hi != b->hi || a->lo != b->lo || a->pc != b->pc || a->count != b->count
+     || a->buffer_hash != b->buffer_hash) {
+        fprintf(stderr, "test_r4300: %s: pc %08x count %u, expected pc %08x count %u, or memory differs\n",
+                name, b->pc, b->count, a->pc, a->count);
+        return 0;
+    }
+    if (a->dirty_hash != b->dirty_hash) {
+        fprintf(stderr, "test_r4300: %s: other RDRAM pages marked dirty\n", name);
+        return 0;
+    }
+    if (a->pc_hash != b->pc_hash) {
+        fprintf(stderr, "test_r4300: %s: other PC lines sampled\n", name);
+        return 0;
+    }
+    return 1;
+}
+
+/* the sorted event list the heap replaced, in firing order */
+struct event_list {
+    struct interrupt_event events[INTERRUPT_NODES_POOL_CAPACITY];
+    size_t size;
+};
+
+static const int event_types[] = {
+    VI_INT, COMPARE_INT, SI_INT, PI_INT, SPECIAL_INT, AI_INT, SP_INT, DP_INT, RSP_DMA_EVT, DD_MC_INT
+};
+#define EVENT_TYPES (sizeof(event_types) / sizeof(event_types[0]))
+
+/* same as queue_base in interrupt.c */
+static uint32_t event_list_base(struct cp0* cp0)
+{
+    uint32_t count = r4300_cp0_regs(cp0)[CP0_COUNT_REG];
+    int cycle_count = *r4300_cp0_cycle_count(cp0);
+
+    return (cycle_count > 0) ? count - cycle_count : count;
+}
+
+/* after the events due no later than it, like the list did */
+static void event_list_add(struct event_list* l, int type, uint32_t count, uint32_t base)
+{
+    size_t i;
+
+    if (l->size >= INTERRUPT_NODES_POOL_CAPACITY)
+        return;
+    for (i = 0; i < l->size && (count - base) >= (l->events[i].count - base); ++i);
+    memmove(&l->events[i + 1], &l->events[i], (l->size - i) * sizeof(l->events[0]));
+    l->events[i].type = type;
+    l->events[i].count = count;
+    ++l->size;
+}
+
+static void event_list_remove_at(struct event_list* l, size_t i)
+{
+    memmove(&l->events[i], &l->events[i + 1], (l->size - i - 1) * sizeof(l->events[0]));
+    --l->size;
+}
+
+static void event_list_remove(struct event_list* l, int type)
+{
+    for (size_t i = 0; i < l->size; ++i) {
+        if (l->events[i].type == type) {
+            event_list_remove_at(l, i);
+            return;
+        }
+    }
+}
+
+static int same_queue(struct cp0* cp0, const struct event_list* l, int synced, unsigned int step)
+{
+    char saved[INTERRUPT_NODES_POOL_CAPACITY * 2 * 8 + 4];
+    uint32_t word;
+    int len = save_eventqueue_infos(cp0, saved);
+    uint32_t next = (l->size != 0) ? l->events[0].count : 0;
+    int cycle_count = (l->size != 0) ? (int)(r4300_cp0_regs(cp0)[CP0_COUNT_REG] - next) : 0;
+
+    /* remove_event leaves the next interrupt alone, as the list did, and
+     * with no event queued the count keeps going */
+    if (len != (int)(l->size * 8 + 4)
+     || (synced && *r4300_cp0_next_interrupt(cp0) != next)
+     || (synced && l->size != 0 && *r4300_cp0_cycle_count(cp0) != cycle_count)) {
+        fprintf(stderr, "test_r4300: step %u: %d events queued, next at %u, expected %u events, next at %u\n",
+                step, (len - 4) / 8, *r4300_cp0_next_interrupt(cp0), (unsigned)l->size, next);
+        return 0;
+    }
+    for (size_t i = 0; i < l->size; ++i) {
+        memcpy(&word, &saved[i * 8], 4);
+        if (word != (uint32_t)l->events[i].type) {
+            fprintf(stderr, "test_r4300: step %u: event %u is of type 0x%x, expected 0x%x\n",
+                    step, (unsigned)i, word, l->events[i].type);
+            return 0;
+        }
+        memcpy(&word, &saved[i * 8 + 4], 4);
+        if (word != l->events[i].count) {
+            fprintf(stderr, "test_r4300: step %u: event %u due at %u, expected %u\n",
+                    step, (unsigned)i, word, l->events[i].count);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int check_event_queue(void)
+{
+    struct r4300_core* r4300 = &g_dev.r4300;
+    struct cp0* cp0 = &r4300->cp0;
+    uint32_t* cp0_regs = r4300_cp0_regs(cp0);
+    char saved[INTERRUPT_NODES_POOL_CAPACITY * 2 * 8 + 4];
+    struct event_list l = {0};
+    unsigned int fired = 0;
+    int synced = 1;
+    double t;
+
+    poweron_cp0(cp0);
+    event_list_add(&l, SPECIAL_INT, 0x80000000, event_list_base(cp0));
+    event_list_add(&l, COMPARE_INT, 0, event_list_base(cp0));
+    cp0_regs[CP0_STATUS_REG] = CP0_STATUS_IE | CP0_STATUS_IM2;
+
+    for (unsigned int step = 0; step < QUEUE_STEPS; ++step) {
+        int type = event_types[rng() % EVENT_TYPES];
+        uint32_t delta;
+
+        switch (rng() % 10) {
+        case 0: case 1: case 2:
+            /* a few duplicated types too, which the queue warns about */
+            if (l.size < INTERRUPT_NODES_POOL_CAPACITY - 2) {
+                uint32_t count = cp0_regs[CP0_COUNT_REG] + rng() % 0x100000;
+                event_list_add(&l, type, count, event_list_base(cp0));
+                add_interrupt_event_count(cp0, type, count);
+                synced = 1;
+            }
+            break;
+        case 3:
+            if (rng() % 4 == 0)
+                type = CHECK_INT;
+            event_list_remove(&l, type);
+            remove_event(&cp0->q, type);
+            synced = 0;
+            break;
+        case 4:
+            if (l.size < INTERRUPT_NODES_POOL_CAPACITY - 2) {
+                memmove(&l.events[1], &l.events[0], l.size * sizeof(l.events[0]));
+                l.events[0].type = CHECK_INT;
+                l.events[0].count = cp0_regs[CP0_COUNT_REG];
+                ++l.size;
+                r4300_check_interrupt(r4300, CP0_CAUSE_IP2, 1);
+                synced = 1;
+            }
+            break;
+        case 5: case 6: case 7:
+            if (l.size == 0)
+                break;
+            if (get_next_event_type(&cp0->q) != l.events[0].type) {
+                fprintf(stderr, "test_r4300: step %u: fired 0x%x, expected 0x%x\n",
+                        step, get_next_event_type(&cp0->q), l.events[0].type);
+                return 0;
+            }
+            /* gen_interrupt runs once the count reaches the event */
+            delta = l.events[0].count - cp0_regs[CP0_COUNT_REG];
+            if (delta < 0x80000000) {
+                cp0_regs[CP0_COUNT_REG] += delta;
+                *r4300_cp0_cycle_count(cp0) += delta;
+            }
+            event_list_remove_at(&l, 0);
+            remove_interrupt_event(cp0);
+            ++fired;
+            synced = 1;
+            break;
+        case 8:
+            /* what cp0_update_count does between events */
+            delta = rng() % 0x1000;
+            if (l.size != 0 && delta > l.events[0].count - cp0_regs[CP0_COUNT_REG])
+                break;
+            cp0_regs[CP0_COUNT_REG] += delta;
+            *r4300_cp0_cycle_count(cp0) += delta;
+            break;
+        case 9:
+            /* a savestate round trip, which puts SPECIAL_INT back */
+            save_eventqueue_infos(cp0, saved);
+            load_eventqueue_infos(cp0, saved);
+            event_list_remove(&l, SPECIAL_INT);
+            event_list_add(&l, SPECIAL_INT, (cp0_regs[CP0_COUNT_REG] & UINT32_C(0x80000000)) ^ UINT32_C(0x80000000),
+                     event_list_base(cp0));
+            synced = 1;
+            break;
+        }
+
+        if (!same_queue(cp0, &l, synced, step))
+            return 0;
+    }
+
+    /* the cost of scheduling an event and firing the earliest one, with
+     * about as many events queued as the device keeps */
+    poweron_cp0(cp0);
+    for (size_t i = 2; i < 8; ++i)
+        add_interrupt_event(cp0, event_types[i], rng() % 0x100000);
+    t = now();
+    for (unsigned int i = 0; i < QUEUE_TIMED; ++i) {
+        int type = get_next_event_type(&cp0->q);
+        cp0_regs[CP0_COUNT_REG] = get_next_event_count(&cp0->q);
+        remove_interrupt_event(cp0);
+        add_interrupt_event(cp0, type, 1 + (rng() & 0xfffff));
+    }
+    t = now() - t;
+
+    printf("test_r4300: event queue matches the sorted list over %u steps, %u events fired; "
+           "%.1f ns per event scheduled and fired\n", QUEUE_STEPS, fired, t * 1e9 / QUEUE_TIMED);
+    return 1;
+}
+
+/* the idle loop must wake as often as the same loop polling */
+static int check_idle_loop(uint32_t seed)
+{
+    struct result polled[IDLE_MODES], skipped[IDLE_MODES];
+    double polling = 0.0, skipping = 0.0;
+
+    for (size_t i = 0; i < IDLE_MODES; ++i) {
+        build_idle_program(1);
+        run(&idle_modes[i], seed, &polled[i]);
+        build_idle_program(0);
+        run(&idle_modes[i], seed, &skipped[i]);
+        polling += polled[i].seconds;
+        skipping += skipped[i].seconds;
+
+        if (polled[i].idle_skips != 0 || skipped[i].idle_skips == 0) {
+            fprintf(stderr, "test_r4300: %s: %u skips polling, %u as an idle loop\n",
+                    idle_modes[i].name, polled[i].idle_skips, skipped[i].idle_skips);
+            return 0;
+        }
+        if (skipped[i].regs[S2] != polled[i].regs[S2] || skipped[i].regs[S2] == 0) {
+            fprintf(stderr, "test_r4300: %s: %lld wakes as an idle loop, %lld polling\n", idle_modes[i].name,
+                    (long long)skipped[i].regs[S2], (long long)polled[i].regs[S2]);
+            return 0;
+        }
+        /* a skip going past the next event would delay the VIs */
+        if ((int32_t)(skipped[i].count - polled[i].count) > IDLE_SLACK) {
+            fprintf(stderr, "test_r4300: %s: stopped at count %u as an idle loop, %u polling\n",
+                    idle_modes[i].name, skipped[i].count, polled[i].count);
+            return 0;
+        }
+        if (i > 0 && (!same_result(idle_modes[i].name, &polled[0], &polled[i])
+                   || !same_result(idle_modes[i].name, &skipped[0], &skipped[i])))
+            return 0;
+    }
+
+    printf("test_r4300: idle loop woken %lld times, %u skips, %u of %u cycles skipped; "
+           "%.3f s polling, %.3f s skipping\n", (long long)skipped[0].regs[S2], skipped[0].idle_skips,
+           skipped[0].idle_cycles, skipped[0].count, polling / IDLE_MODES, skipping / IDLE_MODES);
+    return 1;
+}
+
+static void report(const char* name, const struct result* result)
+{
+    double instructions = (double)result->count / COUNT_PER_OP;
+
+    printf("test_r4300: %-28s %7.1f M instructions in %6.3f s, %7.1f MIPS\n",
+           name, instructions * 1e-6, result->seconds, instructions * 1e-6 / result->seconds);
+}
+
+/* the first mode running the same code */
+static size_t reference(size_t i)
+{
+    size_t j;
+
+    for (j = 0; (modes[j].overlay == OVERLAY_CHANGED) != (modes[i].overlay == OVERLAY_CHANGED); ++j);
+    return j;
+}
+
+int main(int argc, char** argv)
+{
+    struct result results[MODES];
+    uint32_t kept = 0, redecoded = 0;
+    uint32_t seed;
+
+    regtest_seed("test_r4300", argc, argv);
+    seed = rng();
+
+    if ((mem_base = init_mem_base()) == NULL) {
+        fprintf(stderr, "test_r4300: out of memory\n");
+        return 1;
+    }
+    dram = mem_base_u32(mem_base, MM_RDRAM_DRAM);
+    init_rdram(&g_dev.rdram, dram, RDRAM_MAX_SIZE, &g_dev.r4300);
+
+    build_program();
+    /* for the counts of blocks kept and decoded again */
+    g_profiler.enabled = 1;
+    for (size_t i = 0; i < MODES; ++i) {
+        run(&modes[i], seed, &results[i]);
+        report(modes[i].name, &results[i]);
+    }
+
+    for (size_t i = 1; i < MODES; ++i) {
+        if (!same_result(modes[i].name, &results[reference(i)], &results[i]))
+            return 1;
+    }
+    for (size_t i = 0; i < MODES; ++i) {
+        /* one sample at the start and one per period after, the last
+         * period may end past the last branch */
+        if (results[i].pc_samples != results[i].count / PROFILER_SAMPLE_PERIOD + 1
+         && results[i].pc_samples != results[i].count / PROFILER_SAMPLE_PERIOD) {
+            fprintf(stderr, "test_r4300: %s: %u PC samples over %u counts\n",
+                    modes[i].name, results[i].pc_samples, results[i].count);
+            return 1;
+        }
+        /* every load and store of the program goes to the buffer */
+        if (modes[i].handlers && results[i].handler_calls == 0) {
+            fprintf(stderr, "test_r4300: %s: RDRAM handlers not called\n", modes[i].name);
+            return 1;
+        }
+        /* an unchanged overlay keeps its blocks, a changed one gets decoded again */
+        if (modes[i].emumode == EMUMODE_INTERPRETER
+         && ((modes[i].overlay == OVERLAY_SAME && (results[i].hash_hits == 0 || results[i].hash_misses != 0))
+          || (modes[i].overlay == OVERLAY_CHANGED && results[i].hash_misses == 0))) {
+            fprintf(stderr, "test_r4300: %s: %u blocks kept, %u decoded again\n",
+                    modes[i].name, results[i].hash_hits, results[i].hash_misses);
+            return 1;
+        }
+        if (modes[i].overlay == OVERLAY_SAME)
+            kept += results[i].hash_hits;
+        if (modes[i].overlay == OVERLAY_CHANGED)
+            redecoded += results[i].hash_misses;
+    }
+    if (results[reference(MODES - 1)].regs[S2] == results[0].regs[S2]) {
+        fprintf(stderr, "test_r4300: the changed overlay did not change the calls counted\n");
+        return 1;
+    }
+    printf("test_r4300: overlay reloaded before every call, same code: %u blocks kept; changed code: %u blocks decoded again\n",
+           kept, redecoded);
+    printf("test_r4300: %u PC samples over %u counts in every mode\n", results[0].pc_samples, results[0].count);
+    if (unmapped != 0) {
+        fprintf(stderr, "test_r4300: %u accesses outside of RDRAM\n", unmapped);
+        return 1;
+    }
+    if (!check_idle_loop(seed))
+        return 1;
+    if (!check_event_queue())
+        return 1;
+
+    release_mem_base(mem_base);
+    regtest_passed();
+    return 0;
+}
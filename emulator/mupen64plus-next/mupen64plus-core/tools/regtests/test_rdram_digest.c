@@ -0,0 +1,153 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_rdram_digest.c                                     *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Checks the incremental dram digest of netplay desync detection against a
+ * full rehash of dram after random writes marked through rdram_mark_dirty,
+ * and that a write left unmarked is indeed missed.
+ *
+ * Build and run with "make core-tests". */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "regtest.h"
+
+#include "device/rdram/rdram.h"
+#include "main/rdram_digest.h"
+
+#define ROUNDS 2000
+#define REGIONS 32
+
+static struct rdram rdram;
+static struct rdram_digest incremental;
+static struct rdram_digest full;
+static clock_t incremental_time, full_time;
+
+/* same as rdram.c, which would pull in the whole device */
+void rdram_clear_dirty(struct rdram* rdram, enum rdram_dirty_client client)
+{
+    memset(rdram->dirty[client], 0, sizeof(rdram->dirty[client]));
+    rdram->untracked[client] = 0;
+}
+
+/* write random bytes to [address, address+length) of dram, wrapping like
+ * dram accesses do, and report the range unless hidden is set */
+static void random_write(uint32_t address, uint32_t length, int hidden)
+{
+    uint8_t* dram = (uint8_t*)rdram.dram;
+    uint32_t i;
+
+    for (i = 0; i < length; ++i)
+        dram[(address + i) % rdram.dram_size] ^= (uint8_t)(rng() | 1);
+
+    if (!hidden)
+        rdram_mark_dirty(&rdram, address, length);
+}
+
+static int compare(uint32_t round, int report)
+{
+    uint32_t region_pages = RDRAM_DIRTY_PAGES_COUNT / REGIONS;
+    uint32_t i;
+    clock_t start = clock();
+
+    rdram_digest_update(&full, &rdram, RDRAM_DIRTY_DIGEST, 1);
+    full_time += clock() - start;
+
+    for (i = 0; i < REGIONS; ++i) {
+        if (rdram_digest_pages(&incremental, i * region_pages, region_pages)
+         != rdram_digest_pages(&full, i * region_pages, region_pages)) {
+            if (report)
+                fprintf(stderr, "round %u: region %u differs from a full rehash\n", round, i);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t round, writes, i;
+    clock_t start;
+
+    regtest_seed("test_rdram_digest", argc, argv);
+
+    rdram.dram_size = RDRAM_DIRTY_PAGES_COUNT << RDRAM_DIRTY_PAGE_SHIFT;
+    rdram.dram = malloc(rdram.dram_size);
+    if (rdram.dram == NULL)
+        return 1;
+    for (i = 0; i < rdram.dram_size / 4; ++i)
+        rdram.dram[i] = rng();
+
+    /* the first update hashes everything */
+    rdram_digest_reset(&incremental);
+    rdram_digest_update(&incremental, &rdram, RDRAM_DIRTY_DIGEST, 0);
+    rdram_clear_dirty(&rdram, RDRAM_DIRTY_DIGEST);
+    if (!compare(0, 1))
+        return 1;
+
+    for (round = 1; round <= ROUNDS; ++round) {
+        writes = rng() % 16;
+        for (i = 0; i < writes; ++i) {
+            switch (rng() % 4) {
+            case 0: /* word stores */
+                random_write(rng() & ~UINT32_C(3), 4, 0);
+                break;
+            case 1: /* small DMA, may straddle a page */
+                random_write(rng() & ~UINT32_C(7), 8 + (rng() & 0x3f8), 0);
+                break;
+            case 2: /* framebuffer sized runs, wrapping at the end of dram */
+                random_write(rng(), 1 + (rng() % 0x25800), 0);
+                break;
+            default: /* single bytes at page boundaries */
+                random_write(((rng() % RDRAM_DIRTY_PAGES_COUNT) << RDRAM_DIRTY_PAGE_SHIFT) - 1, 2, 0);
+                break;
+            }
+        }
+
+        start = clock();
+        rdram_digest_update(&incremental, &rdram, RDRAM_DIRTY_DIGEST, 0);
+        rdram_clear_dirty(&rdram, RDRAM_DIRTY_DIGEST);
+        incremental_time += clock() - start;
+        if (!compare(round, 1))
+            return 1;
+    }
+
+    /* an unreported write must go unnoticed until dram is rescanned */
+    random_write(rng() % rdram.dram_size, 1, 1);
+    rdram_digest_update(&incremental, &rdram, RDRAM_DIRTY_DIGEST, 0);
+    if (compare(ROUNDS + 1, 0)) {
+        fprintf(stderr, "the incremental digest saw a write missing from the dirty pages\n");
+        return 1;
+    }
+    rdram.untracked[RDRAM_DIRTY_DIGEST] = 1;
+    rdram_digest_update(&incremental, &rdram, RDRAM_DIRTY_DIGEST, 0);
+    rdram_clear_dirty(&rdram, RDRAM_DIRTY_DIGEST);
+    if (!compare(ROUNDS + 2, 1))
+        return 1;
+
+    printf("test_rdram_digest: %u rounds match a full rehash, %.3f ms per update against %.3f ms\n",
+           ROUNDS, incremental_time * 1000.0 / CLOCKS_PER_SEC / ROUNDS, full_time * 1000.0 / CLOCKS_PER_SEC / (ROUNDS + 3));
+    free(rdram.dram);
+    regtest_passed();
+    return 0;
+}
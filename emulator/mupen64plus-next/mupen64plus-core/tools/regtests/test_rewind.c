@@ -0,0 +1,312 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_rewind.c                                           *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Round-trips random image pairs through the rewind delta encoder, both
+ * as tokens and verbatim, then drives rewind_vi over a few hundred VIs of
+ * a small fake savestate that changes a little every VI and completely
+ * now and then. The snapshot job is run after each VI as gen_interrupt
+ * does, and is sometimes dropped as a frontend load would. Holding the
+ * rewind button must then load every captured image back in reverse
+ * order, down to the oldest one the byte budget kept, which the ring must
+ * never exceed.
+ *
+ * rewind.c is included to reach its encoder and its ring.
+ *
+ * Build and run with "make core-tests". */
+
+#include "main/rewind.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "regtest.h"
+
+#define WORDS 16384            /* a 64 KB savestate */
+#define PAIRS 2000
+#define VIS 400
+#define SCENE_CHANGE 8         /* VIs between complete changes, on average */
+#define DROPS 40               /* VIs between dropped captures, on average */
+
+uint32_t RewindBufferSize = 1;
+int RewindButton = 3;
+retro_input_state_t input_cb;
+
+static uint32_t state[WORDS];
+static uint32_t history[VIS][WORDS];    /* every captured image */
+static unsigned int captured;
+static int held;
+static savestates_job frontend_job;
+static savestates_job snapshot_job;
+static struct savestate_snapshot* snapshot;
+
+void DebugMessage(int level, const char *message, ...) {}
+
+size_t retro_serialize_size(void)
+{
+    return sizeof(state);
+}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+    return port == 0 && device == RETRO_DEVICE_JOYPAD && id == (unsigned)RewindButton && held;
+}
+
+savestates_job savestates_get_job(void)
+{
+    return frontend_job;
+}
+
+savestates_job savestates_get_snapshot_job(void)
+{
+    return snapshot_job;
+}
+
+struct savestate_snapshot *savestates_get_snapshot(void)
+{
+    return snapshot;
+}
+
+void savestates_set_snapshot_job(savestates_job j, struct savestate_snapshot *snap, int rebase)
+{
+    snapshot_job = j;
+    snapshot = snap;
+    if (j != savestates_job_nothing && !rebase) {
+        fprintf(stderr, "test_rewind: snapshot job without rebase\n");
+        exit(1);
+    }
+}
+
+void savestates_snapshot_free_base(const char *base) {}
+
+/* the end of gen_interrupt: full images, saved into or loaded from the base */
+static void run_snapshot_job(void)
+{
+    if (snapshot_job == savestates_job_save) {
+        memcpy(snapshot->base, state, sizeof(state));
+        snapshot->valid = 1;
+        memcpy(history[captured++], state, sizeof(state));
+    }
+    else if (snapshot_job == savestates_job_load) {
+        memcpy(state, snapshot->base, sizeof(state));
+    }
+    savestates_set_snapshot_job(savestates_job_nothing, NULL, 0);
+}
+
+static void random_words(uint32_t* image, unsigned int runs)
+{
+    for (unsigned int i = 0; i < runs; ++i) {
+        uint32_t at = rng() % WORDS;
+        uint32_t length = 1 + rng() % 32;
+
+        while (length-- != 0 && at < WORDS)
+            image[at++] = rng();
+    }
+}
+
+/* one VI of emulation */
+static void emulate(void)
+{
+    if (rng() % SCENE_CHANGE == 0)
+        random_words(state, WORDS);
+    else
+        random_words(state, rng() % 8);
+}
+
+static int check_pairs(void)
+{
+    static uint32_t old[WORDS], new[WORDS], image[WORDS];
+    unsigned int tokens = 0, raw = 0;
+
+    for (int pair = 0; pair < PAIRS; ++pair) {
+        struct rewind_delta* delta;
+        uint32_t kind = rng() % 6;
+
+        for (int i = 0; i < WORDS; ++i)
+            old[i] = (kind == 0) ? 0 : rng();
+        memcpy(new, old, sizeof(new));
+
+        switch (kind) {
+        case 0: break;                                      /* identical */
+        case 1: new[0] ^= 1; new[WORDS - 1] ^= 1; break;    /* both ends */
+        case 2: random_words(new, rng() % 64); break;
+        case 3: random_words(new, WORDS / 64); break;
+        case 4: random_words(new, WORDS); break;
+        default:                                            /* every other word */
+            for (int i = 0; i < WORDS; i += 2)
+                new[i] ^= 1 + rng() % 0xffff;
+            break;
+        }
+
+        if ((delta = rewind_compress(old, new)) == NULL) {
+            fprintf(stderr, "test_rewind: out of memory\n");
+            return 0;
+        }
+        if (!delta->raw && delta->words >= WORDS) {
+            fprintf(stderr, "test_rewind: pair %d of kind %u encoded to %zu words\n", pair, kind, delta->words);
+            return 0;
+        }
+        raw += delta->raw;
+        tokens += !delta->raw;
+
+        memcpy(image, new, sizeof(image));
+        rewind_apply(image, delta);
+        if (memcmp(image, old, sizeof(image)) != 0) {
+            fprintf(stderr, "test_rewind: pair %d of kind %u does not step back\n", pair, kind);
+            return 0;
+        }
+        rewind_apply(image, delta);
+        if (memcmp(image, new, sizeof(image)) != 0) {
+            fprintf(stderr, "test_rewind: pair %d of kind %u does not step forward\n", pair, kind);
+            return 0;
+        }
+        free(delta);
+    }
+
+    if (tokens == 0 || raw == 0) {
+        fprintf(stderr, "test_rewind: %u encoded and %u verbatim deltas\n", tokens, raw);
+        return 0;
+    }
+    printf("test_rewind: %d image pairs, %u encoded and %u verbatim deltas step back and forth\n",
+           PAIRS, tokens, raw);
+    return 1;
+}
+
+static int check_budget(void)
+{
+    int ok;
+
+    pthread_mutex_lock(&l_lock);
+    ok = l_used <= l_budget || l_count <= 1;
+    if (!ok)
+        fprintf(stderr, "test_rewind: %zu bytes of history for a budget of %zu\n", l_used, l_budget);
+    pthread_mutex_unlock(&l_lock);
+    return ok;
+}
+
+static int vi(void)
+{
+    emulate();
+    rewind_vi();
+    run_snapshot_job();
+    return check_budget();
+}
+
+/* captures for vis VIs, with frontend savestates and dropped captures in
+ * between */
+static int capture(unsigned int vis, unsigned int* dropped)
+{
+    held = 0;
+    while (vis-- != 0) {
+        emulate();
+        frontend_job = (rng() % DROPS == 0) ? savestates_job_save : savestates_job_nothing;
+        rewind_vi();
+        frontend_job = savestates_job_nothing;
+
+        /* retro_unserialize clears the snapshot job and loads another state */
+        if (snapshot_job == savestates_job_save && rng() % DROPS == 0) {
+            savestates_set_snapshot_job(savestates_job_nothing, NULL, 0);
+            random_words(state, 16);
+            ++*dropped;
+        }
+        run_snapshot_job();
+
+        if (!check_budget())
+            return 0;
+        if (captured == VIS) {
+            fprintf(stderr, "test_rewind: more captures than VIs\n");
+            return 0;
+        }
+    }
+
+    /* the last capture is taken in on the next VI */
+    return vi();
+}
+
+/* holds the button for steps VIs, each must load the previous capture
+ * until the oldest one kept */
+static int step_back(unsigned int steps, unsigned int* kept_out)
+{
+    unsigned int kept = 0, expected = captured - 1;
+
+    held = 1;
+    for (unsigned int step = 0; step < steps; ++step) {
+        if (!vi())
+            return 0;
+        if (step == 0) {
+            rewind_wait_idle();
+            kept = l_count;
+            if (kept == 0 || kept >= captured) {
+                fprintf(stderr, "test_rewind: %u deltas kept of %u captures\n", kept, captured);
+                return 0;
+            }
+        }
+        else if (step <= kept) {
+            --expected;
+        }
+
+        if (memcmp(state, history[expected], sizeof(state)) != 0) {
+            fprintf(stderr, "test_rewind: step %u back loaded another image than capture %u\n", step, expected);
+            return 0;
+        }
+    }
+
+    /* the next captures follow the one rewound to */
+    held = 0;
+    captured = expected + 1;
+    *kept_out = kept;
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int dropped = 0, kept, total;
+
+    regtest_seed("test_rewind", argc, argv);
+
+    l_image_words = WORDS;
+    l_scratch = malloc(sizeof(state));
+    if (!check_pairs())
+        return 1;
+    free(l_scratch);
+    l_scratch = NULL;
+
+    /* rewinds a little, resumes from there, then rewinds past the oldest */
+    input_cb = input_state;
+    if (!capture(VIS / 2, &dropped) || !step_back(VIS / 16, &kept) || !capture(VIS / 4, &dropped))
+        return 1;
+    total = captured;
+    if (!step_back(VIS, &kept))
+        return 1;
+    if (kept + 1 >= total) {
+        fprintf(stderr, "test_rewind: %u MB kept all %u captures\n", RewindBufferSize, total);
+        return 1;
+    }
+    printf("test_rewind: %u captures, %u dropped, %u MB kept the last %u, each loaded back\n",
+           total, dropped, RewindBufferSize, kept + 1);
+
+    rewind_deinit();
+    if (l_used != 0 || l_count != 0) {
+        fprintf(stderr, "test_rewind: %zu bytes left after deinit\n", l_used);
+        return 1;
+    }
+
+    regtest_passed();
+    return 0;
+}
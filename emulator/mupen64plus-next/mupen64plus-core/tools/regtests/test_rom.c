@@ -0,0 +1,289 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_rom.c                                              *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Checks that open_rom copies .z64, .v64 and .n64 images into the cart
+ * ROM in .z64 order, SIMD and tail alike, and identifies them by the MD5
+ * of that copy, whether the MD5 is computed or found in the XXH3 hash
+ * index. The index must get one line per rom whatever its format, with
+ * the digest of its 1 MB chunks, and must still hit once reloaded.
+ * Also times the cold start of a 64 MB .v64 rom: the scalar swap and MD5
+ * open_rom used to do, an index miss, and an index hit.
+ *
+ * rom.c is linked with util.c and the MD5 code; the ini and the index live
+ * in a temporary directory, and the rest of the core is stubbed below.
+ *
+ * Build and run with "make core-tests". */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "regtest.h"
+
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+
+#include "api/callbacks.h"
+#include "api/m64p_config.h"
+#include "backends/file_storage.h"
+#include "device/dd/disk.h"
+#include "device/memory/memory.h"
+#include "main/main.h"
+#include "main/md5.h"
+#include "main/rom.h"
+#include "main/util.h"
+
+#define MAX_ROM_SIZE 0x4000000
+#define CHUNK_SIZE 0x100000    /* same as ROM_HASH_CHUNK_SIZE in rom.c */
+
+void* g_mem_base;
+int g_RomWordsLittleEndian;
+m64p_media_loader g_media_loader;
+
+static char dir[] = "/tmp/test_rom.XXXXXX";
+static char ini_path[64];
+static char index_path[64];
+static uint8_t* cart_rom;
+static uint8_t* z64;
+static uint8_t* image;
+
+/* the parts of the core rom.c calls into */
+void DebugMessage(int level, const char *message, ...) {}
+const char* ConfigGetSharedDataFilepath(const char *filename) { return ini_path; }
+uint32_t* mem_base_u32(void* mem_base, uint32_t address) { return (uint32_t*)cart_rom; }
+int open_rom_file_storage(struct file_storage* storage, const char* filename) { return file_open_error; }
+void close_file_storage(struct file_storage* storage) {}
+uint8_t* scan_and_expand_disk_format(uint8_t* data, size_t size,
+    unsigned int* format, unsigned int* development,
+    size_t* offset_sys, size_t* offset_id, size_t* offset_ram, size_t* size_ram) { return NULL; }
+
+static const char* format_name(int format)
+{
+    return (format == V64IMAGE) ? ".v64" : (format == N64IMAGE) ? ".n64" : ".z64";
+}
+
+/* z64 holds the rom made from seed, image gets it in the given format */
+static void random_rom(size_t size, uint32_t seed)
+{
+    uint32_t state = rng_state;
+
+    rng_state = seed;
+    for (size_t i = 0; i < size; ++i)
+        z64[i] = (uint8_t)rng();
+    rng_state = state;
+    z64[0] = 0x80;
+    z64[1] = 0x37;
+    z64[2] = 0x12;
+    z64[3] = 0x40;
+}
+
+static void make_image(size_t size, int format)
+{
+    for (size_t i = 0; i < size; ++i) {
+        if (format == V64IMAGE)
+            image[i] = z64[i ^ 1];
+        else if (format == N64IMAGE)
+            image[i] = z64[i ^ 3];
+        else
+            image[i] = z64[i];
+    }
+}
+
+/* the MD5 open_rom must report, and the digest the index must hold */
+static void expected_md5(size_t size, char* md5)
+{
+    md5_state_t state;
+    md5_byte_t digest[16];
+
+    md5_init(&state);
+    md5_append(&state, z64, size);
+    md5_finish(&state, digest);
+    for (int i = 0; i < 16; ++i)
+        sprintf(md5 + i * 2, "%02X", digest[i]);
+}
+
+static uint64_t expected_xxh3(size_t size)
+{
+    XXH64_hash_t digests[MAX_ROM_SIZE / CHUNK_SIZE];
+    size_t chunks = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    for (size_t i = 0; i < chunks; ++i)
+        digests[i] = XXH3_64bits(z64 + i * CHUNK_SIZE, (size - i * CHUNK_SIZE < CHUNK_SIZE) ? size - i * CHUNK_SIZE : CHUNK_SIZE);
+    return XXH3_64bits(digests, chunks * sizeof(digests[0]));
+}
+
+/* lines of the index, and whether one holds this digest, size and MD5 */
+static int index_lines(uint64_t xxh3, size_t size, const char* md5, int* found)
+{
+    char line[256], expected[256];
+    int lines = 0;
+    FILE* f = fopen(index_path, "rb");
+
+    snprintf(expected, sizeof(expected), "%016llX %u %s\n", (unsigned long long)xxh3, (unsigned)size, md5);
+    *found = 0;
+    if (f == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        ++lines;
+        if (strcmp(line, expected) == 0)
+            *found = 1;
+    }
+    fclose(f);
+    return lines;
+}
+
+static int check_rom(size_t size, int format, int lines_before, int* lines_after)
+{
+    char md5[33];
+    uint64_t xxh3 = expected_xxh3(size);
+    int found;
+
+    make_image(size, format);
+    memset(cart_rom, 0, size);
+    if (open_rom(image, (unsigned int)size) != M64ERR_SUCCESS) {
+        fprintf(stderr, "test_rom: %u byte %s rom refused\n", (unsigned)size, format_name(format));
+        return 0;
+    }
+    if (memcmp(cart_rom, z64, size) != 0) {
+        fprintf(stderr, "test_rom: %u byte %s rom not copied in .z64 order\n", (unsigned)size, format_name(format));
+        return 0;
+    }
+    expected_md5(size, md5);
+    if (strcmp(ROM_SETTINGS.MD5, md5) != 0) {
+        fprintf(stderr, "test_rom: %u byte %s rom has MD5 %s, expected %s\n",
+                (unsigned)size, format_name(format), ROM_SETTINGS.MD5, md5);
+        return 0;
+    }
+    *lines_after = index_lines(xxh3, size, md5, &found);
+    if (!found || *lines_after > lines_before + 1) {
+        fprintf(stderr, "test_rom: %u byte %s rom: %d index lines after %d, %s\n", (unsigned)size, format_name(format),
+                *lines_after, lines_before, found ? "found" : "its line missing");
+        return 0;
+    }
+    close_rom();
+    return 1;
+}
+
+static double time_open_rom(size_t size)
+{
+    double t = now();
+
+    open_rom(image, (unsigned int)size);
+    t = now() - t;
+    close_rom();
+    return t;
+}
+
+static int cleanup(int status)
+{
+    romdatabase_close();
+    remove(index_path);
+    remove(ini_path);
+    rmdir(dir);
+    return status;
+}
+
+int main(int argc, char** argv)
+{
+    /* below, at and over a SIMD block and a chunk, and a few chunks */
+    static const size_t sizes[] = { 0x1000 + 12, 0x100000, 0x100000 + 4, 0x300000 + 20, 0x800000 };
+    const size_t count = sizeof(sizes) / sizeof(sizes[0]);
+    double old_path, miss, hit;
+    md5_state_t state;
+    md5_byte_t digest[16];
+    uint32_t seeds[sizeof(sizes) / sizeof(sizes[0])];
+    int lines = 0, after, found;
+    FILE* f;
+
+    regtest_seed("test_rom", argc, argv);
+
+    cart_rom = malloc(MAX_ROM_SIZE);
+    z64 = malloc(MAX_ROM_SIZE);
+    image = malloc(MAX_ROM_SIZE);
+    if (cart_rom == NULL || z64 == NULL || image == NULL || mkdtemp(dir) == NULL) {
+        fprintf(stderr, "test_rom: out of memory\n");
+        return 1;
+    }
+    snprintf(ini_path, sizeof(ini_path), "%s/mupen64plus.ini", dir);
+    snprintf(index_path, sizeof(index_path), "%s/mupen64plus.xxh3", dir);
+    if ((f = fopen(ini_path, "wb")) == NULL) {
+        fprintf(stderr, "test_rom: cannot write %s\n", ini_path);
+        return 1;
+    }
+    fclose(f);
+    romdatabase_open();
+
+    /* the first format opened misses and adds a line, the others hit it */
+    for (size_t i = 0; i < count; ++i) {
+        seeds[i] = rng() | 1;
+        random_rom(sizes[i], seeds[i]);
+        for (int format = Z64IMAGE; format <= N64IMAGE; ++format) {
+            if (!check_rom(sizes[i], format, lines, &after))
+                return cleanup(1);
+            lines = after;
+        }
+        if (lines != (int)i + 1) {
+            fprintf(stderr, "test_rom: %d index lines for %u roms\n", lines, (unsigned)i + 1);
+            return cleanup(1);
+        }
+    }
+
+    /* and they all hit after the index is read back */
+    romdatabase_close();
+    romdatabase_open();
+    for (size_t i = count; i-- > 0; ) {
+        random_rom(sizes[i], seeds[i]);
+        if (!check_rom(sizes[i], (int)(rng() % 3), lines, &after))
+            return cleanup(1);
+        if (after != lines) {
+            fprintf(stderr, "test_rom: %u byte rom missed the reloaded index\n", (unsigned)sizes[i]);
+            return cleanup(1);
+        }
+    }
+    printf("test_rom: %u roms in every format, same .z64 copy and MD5 computed and from the index\n", (unsigned)count);
+
+    random_rom(MAX_ROM_SIZE, rng() | 1);
+    make_image(MAX_ROM_SIZE, V64IMAGE);
+
+    /* what open_rom did before: a scalar swap, then MD5 */
+    old_path = now();
+    for (size_t i = 0; i < MAX_ROM_SIZE; i += 2) {
+        cart_rom[i] = image[i + 1];
+        cart_rom[i + 1] = image[i];
+    }
+    md5_init(&state);
+    md5_append(&state, cart_rom, MAX_ROM_SIZE);
+    md5_finish(&state, digest);
+    old_path = now() - old_path;
+
+    miss = time_open_rom(MAX_ROM_SIZE);
+    hit = time_open_rom(MAX_ROM_SIZE);
+    if (index_lines(expected_xxh3(MAX_ROM_SIZE), MAX_ROM_SIZE, ROM_SETTINGS.MD5, &found) != lines + 1 || !found) {
+        fprintf(stderr, "test_rom: 64 MB rom not in the index\n");
+        return cleanup(1);
+    }
+    printf("test_rom: 64 MB .v64 rom: scalar swap and MD5 %.1f ms, index miss %.1f ms, index hit %.1f ms\n",
+           old_path * 1e3, miss * 1e3, hit * 1e3);
+
+    regtest_passed();
+    return cleanup(0);
+}
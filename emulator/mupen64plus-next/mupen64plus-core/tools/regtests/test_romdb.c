@@ -0,0 +1,223 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_romdb.c                                            *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Checks the rom database tables of mupen64plus.romdb.h against the ini
+ * they are generated from: every MD5 and CRC of mupen64plus.ini, a copy
+ * of each with a bit flipped and random ones are looked up both in the
+ * tables and in the database rom.c parses from the ini, which must find
+ * the same entries, with the same fields, or both nothing. A header left
+ * behind by an ini change, or a generator drifting from the parser,
+ * fails here.
+ *
+ * rom.c is included with its tables; romdb_ini.c builds it again parsing
+ * the ini, and the rest of the core is stubbed below.
+ *
+ * Build and run with "make core-tests". */
+
+#include "main/rom.c"
+
+#include <stdio.h>
+#include <time.h>
+
+#include "regtest.h"
+
+#define RANDOM_KEYS 10000
+#define MAX_KEYS 8192
+
+void* g_mem_base;
+int g_RomWordsLittleEndian;
+m64p_media_loader g_media_loader;
+
+static md5_byte_t md5_keys[MAX_KEYS][16];
+static uint32_t crc_keys[MAX_KEYS][2];
+static unsigned int md5_count, crc_count;
+
+/* the database built from the ini, see romdb_ini.c */
+void romdb_ini_romdatabase_open(void);
+void romdb_ini_romdatabase_close(void);
+romdatabase_entry* romdb_ini_search_by_md5(md5_byte_t* md5);
+romdatabase_entry* romdb_ini_search_by_crc(unsigned int crc1, unsigned int crc2);
+
+/* the parts of the core rom.c calls into */
+void DebugMessage(int level, const char *message, ...) {}
+const char* ConfigGetSharedDataFilepath(const char *filename) { return ROMDB_INI; }
+uint32_t* mem_base_u32(void* mem_base, uint32_t address) { return NULL; }
+int open_rom_file_storage(struct file_storage* storage, const char* filename) { return file_open_error; }
+void close_file_storage(struct file_storage* storage) {}
+uint8_t* scan_and_expand_disk_format(uint8_t* data, size_t size,
+    unsigned int* format, unsigned int* development,
+    size_t* offset_sys, size_t* offset_id, size_t* offset_ram, size_t* size_ram) { return NULL; }
+
+/* every section MD5 and CRC of the ini */
+static int read_keys(void)
+{
+    char line[1024];
+    FILE* f = fopen(ROMDB_INI, "rb");
+
+    if (f == NULL) {
+        fprintf(stderr, "test_romdb: cannot read %s\n", ROMDB_INI);
+        return 0;
+    }
+    while (fgets(line, sizeof(line), f) != NULL && md5_count < MAX_KEYS && crc_count < MAX_KEYS) {
+        unsigned int crc1, crc2;
+        char* end = strchr(line, ']');
+
+        if (line[0] == '[' && end != NULL && (*end = '\0', parse_hex(&line[1], md5_keys[md5_count], 16)))
+            ++md5_count;
+        else if (sscanf(line, "CRC=%x %x", &crc1, &crc2) == 2) {
+            crc_keys[crc_count][0] = crc1;
+            crc_keys[crc_count][1] = crc2;
+            ++crc_count;
+        }
+    }
+    fclose(f);
+
+    if (md5_count == 0 || md5_count == MAX_KEYS || crc_count == 0 || crc_count == MAX_KEYS) {
+        fprintf(stderr, "test_romdb: %u MD5 and %u CRC keys read\n", md5_count, crc_count);
+        return 0;
+    }
+    return 1;
+}
+
+static int same_string(const char* a, const char* b)
+{
+    return (a == NULL || b == NULL) ? a == b : strcmp(a, b) == 0;
+}
+
+/* the same entry in both databases, or none in either */
+static int same_entry(const romdatabase_entry* table, const romdatabase_entry* ini)
+{
+    if (table == NULL || ini == NULL)
+        return table == ini;
+
+    return same_string(table->goodname, ini->goodname)
+        && memcmp(table->md5, ini->md5, 16) == 0
+        && (table->refmd5 == NULL) == (ini->refmd5 == NULL)
+        && (table->refmd5 == NULL || memcmp(table->refmd5, ini->refmd5, 16) == 0)
+        && same_string(table->cheats, ini->cheats)
+        && table->crc1 == ini->crc1
+        && table->crc2 == ini->crc2
+        && table->status == ini->status
+        && table->savetype == ini->savetype
+        && table->players == ini->players
+        && table->rumble == ini->rumble
+        && table->countperop == ini->countperop
+        && table->disableextramem == ini->disableextramem
+        && table->transferpak == ini->transferpak
+        && table->mempak == ini->mempak
+        && table->biopak == ini->biopak
+        && table->sidmaduration == ini->sidmaduration
+        && table->aidmamodifier == ini->aidmamodifier
+        && table->set_flags == ini->set_flags;
+}
+
+static int check_md5(md5_byte_t* md5, unsigned int* found)
+{
+    romdatabase_entry* table = ini_search_by_md5(md5);
+    romdatabase_entry* ini = romdb_ini_search_by_md5(md5);
+
+    if (!same_entry(table, ini)) {
+        fprintf(stderr, "test_romdb: MD5 %02X%02X%02X%02X... finds %s in the tables and %s in the ini\n",
+                md5[0], md5[1], md5[2], md5[3],
+                (table == NULL) ? "nothing" : table->goodname, (ini == NULL) ? "nothing" : ini->goodname);
+        return 0;
+    }
+    *found += table != NULL;
+    return 1;
+}
+
+static int check_crc(uint32_t crc1, uint32_t crc2, unsigned int* found)
+{
+    romdatabase_entry* table = ini_search_by_crc(crc1, crc2);
+    romdatabase_entry* ini = romdb_ini_search_by_crc(crc1, crc2);
+
+    if (!same_entry(table, ini)) {
+        fprintf(stderr, "test_romdb: CRC %08X %08X finds %s in the tables and %s in the ini\n", crc1, crc2,
+                (table == NULL) ? "nothing" : table->goodname, (ini == NULL) ? "nothing" : ini->goodname);
+        return 0;
+    }
+    *found += table != NULL;
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int md5_found = 0, crc_found = 0, lookups = 0;
+    double tables, ini;
+
+    regtest_seed("test_romdb", argc, argv);
+
+    if (!read_keys())
+        return 1;
+
+    tables = now();
+    romdatabase_open();
+    tables = now() - tables;
+    ini = now();
+    romdb_ini_romdatabase_open();
+    ini = now() - ini;
+
+    /* every key, then the same with a bit flipped */
+    for (unsigned int i = 0; i < md5_count; ++i) {
+        md5_byte_t md5[16];
+
+        memcpy(md5, md5_keys[i], 16);
+        if (!check_md5(md5, &md5_found))
+            return 1;
+        md5[rng() % 16] ^= 1 << (rng() % 8);
+        if (!check_md5(md5, &md5_found))
+            return 1;
+        lookups += 2;
+    }
+    for (unsigned int i = 0; i < crc_count; ++i) {
+        uint32_t crc1 = crc_keys[i][0], crc2 = crc_keys[i][1];
+
+        if (!check_crc(crc1, crc2, &crc_found)
+         || !check_crc(crc1 ^ (1u << (rng() % 32)), crc2, &crc_found)
+         || !check_crc(crc1, crc2 ^ (1u << (rng() % 32)), &crc_found))
+            return 1;
+        lookups += 3;
+    }
+
+    /* and random ones, which are misses unless the bucket bounds are off */
+    for (unsigned int i = 0; i < RANDOM_KEYS; ++i) {
+        md5_byte_t md5[16];
+
+        for (int j = 0; j < 16; ++j)
+            md5[j] = (md5_byte_t)rng();
+        if (!check_md5(md5, &md5_found) || !check_crc(rng(), rng(), &crc_found))
+            return 1;
+        lookups += 2;
+    }
+
+    /* a CRC shared by several entries matches none */
+    if (md5_found < md5_count || crc_found < crc_count / 4) {
+        fprintf(stderr, "test_romdb: %u of %u MD5 and %u of %u CRC found\n", md5_found, md5_count, crc_found, crc_count);
+        return 1;
+    }
+    printf("test_romdb: %u MD5 and %u CRC in the ini, %u lookups: %u and %u found, the same entries as the ini's\n",
+           md5_count, crc_count, lookups, md5_found, crc_found);
+    printf("test_romdb: romdatabase_open %.3f ms with the tables, %.3f ms parsing the ini\n", tables * 1e3, ini * 1e3);
+
+    romdatabase_close();
+    romdb_ini_romdatabase_close();
+    regtest_passed();
+    return 0;
+}
@@ -0,0 +1,209 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_savestates.c                                       *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Checks that savestates_save_m64p writes every byte of the frontend's
+ * buffer, so that the buffer needs no clearing, and that a load followed by
+ * a save gives back the same image. Also times the direct save against the
+ * scratch image and copy it replaced.
+ *
+ * Only savestates.c is linked; the rest of the core is stubbed below.
+ *
+ * Build and run with "make core-tests". */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "regtest.h"
+
+#include "api/callbacks.h"
+#include "api/m64p_config.h"
+#include "device/device.h"
+#include "main/main.h"
+#include "main/rom.h"
+#include "main/savestates.h"
+#include "plugin/plugin.h"
+
+#define ROUNDS 20
+
+/* same as savestates.c */
+#define SAVESTATE_SIZE (16788288 + 1024 + 4 + 4096)
+
+struct device g_dev;
+m64p_handle g_CoreConfig;
+m64p_rom_settings ROM_SETTINGS;
+CONTROL Controls[4];
+gfx_plugin_functions gfx;
+input_plugin_functions input;
+
+static struct device other;
+static char queue[1024];
+static uint32_t pc[2];
+
+static void random_fill(void* data, size_t size)
+{
+    uint8_t* p = data;
+
+    while (size-- != 0)
+        *p++ = (uint8_t)rng();
+}
+
+/* the parts of the core savestates.c calls into */
+void DebugMessage(int level, const char *message, ...) {}
+void main_message(m64p_msg_level level, unsigned int osd_corner, const char *format, ...) {}
+void StateChanged(m64p_core_param param_type, int new_value) {}
+m64p_error ConfigSetParameter(m64p_handle h, const char *name, m64p_type type, const void *value) { return M64ERR_SUCCESS; }
+
+int64_t* r4300_regs(struct r4300_core* r4300) { return r4300->regs; }
+int64_t* r4300_mult_hi(struct r4300_core* r4300) { return &r4300->hi; }
+int64_t* r4300_mult_lo(struct r4300_core* r4300) { return &r4300->lo; }
+unsigned int* r4300_llbit(struct r4300_core* r4300) { return &r4300->llbit; }
+uint32_t* r4300_pc(struct r4300_core* r4300) { return &pc[r4300 != &g_dev.r4300]; }
+void savestates_load_set_pc(struct r4300_core* r4300, uint32_t addr) { *r4300_pc(r4300) = addr; }
+uint32_t* r4300_cp0_regs(struct cp0* cp0) { return cp0->regs; }
+uint64_t* r4300_cp0_latch(struct cp0* cp0) { return &cp0->latch; }
+uint32_t* r4300_cp0_last_addr(struct cp0* cp0) { return &cp0->last_addr; }
+unsigned int* r4300_cp0_next_interrupt(struct cp0* cp0) { return &cp0->next_interrupt; }
+cp1_reg* r4300_cp1_regs(struct cp1* cp1) { return cp1->regs; }
+uint32_t* r4300_cp1_fcr0(struct cp1* cp1) { return &cp1->fcr0; }
+uint32_t* r4300_cp1_fcr31(struct cp1* cp1) { return &cp1->fcr31; }
+uint64_t* r4300_cp2_latch(struct cp2* cp2) { return &cp2->latch; }
+void set_fpr_pointers(struct cp1* cp1, uint32_t newStatus) {}
+void update_x86_rounding_mode(struct cp1* cp1) {}
+
+/* the event queue is not part of the device, keep one image of it */
+int save_eventqueue_infos(const struct cp0* cp0, char *buf) { memcpy(buf, queue, sizeof(queue)); return sizeof(queue); }
+void load_eventqueue_infos(struct cp0* cp0, const char *buf) { memcpy(queue, buf, sizeof(queue)); }
+
+void poweron_dd(struct dd_controller* dd) {}
+void poweron_fb(struct fb* fb) {}
+void poweron_flashram(struct flashram* flashram) {}
+void poweron_gb_cart(struct gb_cart* gb_cart) {}
+void poweron_rumblepak(struct rumblepak* rpk) {}
+void poweron_transferpak(struct transferpak* tpk) {}
+void set_rumble_reg(struct rumblepak* rpk, uint8_t value) {}
+void rdp_reset_dram_writes(struct rdp_core* dp) {}
+void rdram_clear_dirty(struct rdram* rdram, enum rdram_dirty_client client) {}
+void disable_pif_channel(struct pif_channel* channel) { channel->tx = NULL; }
+size_t setup_pif_channel(struct pif_channel* channel, uint8_t* buf) { channel->tx = buf; return 0; }
+void setup_channels_format(struct pif* pif) {}
+
+static void vi_changed(void) {}
+
+static void alloc_device(struct device* dev)
+{
+    dev->rdram.dram = malloc(RDRAM_MAX_SIZE);
+    dev->sp.mem = malloc(SP_MEM_SIZE);
+    dev->pif.ram = malloc(PIF_RAM_SIZE);
+    if (dev->rdram.dram == NULL || dev->sp.mem == NULL || dev->pif.ram == NULL) {
+        fprintf(stderr, "test_savestates: out of memory\n");
+        exit(1);
+    }
+}
+
+/* random contents for what the image holds, keeping the pointers valid */
+static void random_device(struct device* dev)
+{
+    random_fill(dev->rdram.dram, RDRAM_MAX_SIZE);
+    random_fill(dev->sp.mem, SP_MEM_SIZE);
+    random_fill(dev->pif.ram, PIF_RAM_SIZE);
+    random_fill(dev->rdram.regs, sizeof(dev->rdram.regs));
+    random_fill(dev->mi.regs, sizeof(dev->mi.regs));
+    random_fill(dev->pi.regs, sizeof(dev->pi.regs));
+    random_fill(dev->sp.regs, sizeof(dev->sp.regs));
+    random_fill(dev->sp.regs2, sizeof(dev->sp.regs2));
+    random_fill(dev->si.regs, sizeof(dev->si.regs));
+    random_fill(dev->vi.regs, sizeof(dev->vi.regs));
+    random_fill(dev->ri.regs, sizeof(dev->ri.regs));
+    random_fill(dev->ai.regs, sizeof(dev->ai.regs));
+    random_fill(dev->dp.dpc_regs, sizeof(dev->dp.dpc_regs));
+    random_fill(dev->dp.dps_regs, sizeof(dev->dp.dps_regs));
+    random_fill(dev->r4300.regs, sizeof(dev->r4300.regs));
+    random_fill(dev->r4300.cp0.regs, sizeof(dev->r4300.cp0.regs));
+    random_fill(dev->r4300.cp1.regs, sizeof(dev->r4300.cp1.regs));
+    random_fill(queue, sizeof(queue));
+    pc[0] = rng();
+}
+
+int main(int argc, char** argv)
+{
+    char *image, *reload, *scratch;
+    double direct = 0.0, copied = 0.0, t;
+    int i;
+
+    regtest_seed("test_savestates", argc, argv);
+
+    gfx.viStatusChanged = vi_changed;
+    gfx.viWidthChanged = vi_changed;
+    alloc_device(&g_dev);
+    alloc_device(&other);
+    image = malloc(SAVESTATE_SIZE);
+    reload = malloc(SAVESTATE_SIZE);
+    if (image == NULL || reload == NULL) {
+        fprintf(stderr, "test_savestates: out of memory\n");
+        return 1;
+    }
+
+    for (i = 0; i < ROUNDS; ++i) {
+        random_device(&g_dev);
+
+        /* the frontend's buffer holds whatever it held before */
+        memset(image, 0x00, SAVESTATE_SIZE);
+        memset(reload, 0xff, SAVESTATE_SIZE);
+        t = now();
+        savestates_save_m64p(&g_dev, image);
+        direct += now() - t;
+        savestates_save_m64p(&g_dev, reload);
+        if (memcmp(image, reload, SAVESTATE_SIZE) != 0) {
+            fprintf(stderr, "test_savestates: round %d: image depends on the buffer contents\n", i);
+            return 1;
+        }
+
+        /* what it replaced: a cleared scratch image, then a copy */
+        t = now();
+        scratch = calloc(1, SAVESTATE_SIZE);
+        if (scratch == NULL) {
+            fprintf(stderr, "test_savestates: out of memory\n");
+            return 1;
+        }
+        savestates_save_m64p(&g_dev, scratch);
+        memcpy(reload, scratch, SAVESTATE_SIZE);
+        free(scratch);
+        copied += now() - t;
+
+        if (!savestates_load_m64p(&other, image)) {
+            fprintf(stderr, "test_savestates: round %d: load failed\n", i);
+            return 1;
+        }
+        memset(reload, (int)rng(), SAVESTATE_SIZE);
+        savestates_save_m64p(&other, reload);
+        if (memcmp(image, reload, SAVESTATE_SIZE) != 0) {
+            fprintf(stderr, "test_savestates: round %d: save after load differs\n", i);
+            return 1;
+        }
+    }
+
+    printf("test_savestates: %d rounds, direct save %.2f ms, scratch save and copy %.2f ms\n",
+           ROUNDS, direct * 1e3 / ROUNDS, copied * 1e3 / ROUNDS);
+    regtest_passed();
+    return 0;
+}
@@ -0,0 +1,252 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_savestates_delta.c                                 *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Checks that a delta savestate applied to its base gives back the full
+ * m64p image, over random writes to dram and to the rest of the state, and
+ * across the rebases and loads the savestate snapshots do. Also reports the
+ * size and encoding time of the deltas against serializing full images.
+ *
+ * Build and run with "make core-tests". */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "regtest.h"
+
+#include "device/memory/memory.h"
+#include "device/rdram/rdram.h"
+#include "main/savestates_delta.h"
+#include "main/util.h"
+
+#define ROUNDS 500
+
+/* same layout as a m64p image: registers, dram, more registers, padding */
+#define DRAM_OFFSET 0x1ea4
+#define IMAGE_SIZE (DRAM_OFFSET + RDRAM_MAX_SIZE + 0x3b1c)
+#define IMAGE_CAPACITY (IMAGE_SIZE + 0x2000)
+
+static struct rdram rdram;
+static char state[IMAGE_SIZE];          /* non dram part of the state */
+static char *full, *image, *base, *scratch, *delta;
+static size_t delta_capacity = SAVESTATES_DELTA_MAX_SIZE(IMAGE_SIZE);
+
+/* same as rdram.c, which would pull in the whole device */
+void rdram_clear_dirty(struct rdram* rdram, enum rdram_dirty_client client)
+{
+    memset(rdram->dirty[client], 0, sizeof(rdram->dirty[client]));
+    rdram->untracked[client] = 0;
+}
+
+/* what savestates_put_m64p does: the image with or without dram */
+static void put_image(char *dst, int with_dram)
+{
+    memcpy(dst, state, DRAM_OFFSET);
+    if (with_dram) {
+        memcpy(dst + DRAM_OFFSET, rdram.dram, RDRAM_MAX_SIZE);
+        to_little_endian_buffer(dst + DRAM_OFFSET, 4, RDRAM_MAX_SIZE / 4);
+    }
+    memcpy(dst + DRAM_OFFSET + RDRAM_MAX_SIZE, state + DRAM_OFFSET + RDRAM_MAX_SIZE,
+           IMAGE_SIZE - DRAM_OFFSET - RDRAM_MAX_SIZE);
+}
+
+static void random_state_write(void)
+{
+    uint32_t offset = rng() % (IMAGE_SIZE - RDRAM_MAX_SIZE);
+    uint32_t length = 1 + rng() % 64;
+
+    if (offset >= DRAM_OFFSET)
+        offset += RDRAM_MAX_SIZE;
+    if (offset + length > IMAGE_SIZE)
+        length = IMAGE_SIZE - offset;
+    while (length-- != 0)
+        state[offset++] ^= (char)(rng() | 1);
+}
+
+/* changes [address, address+length) of dram unless same is set, and
+ * reports the range unless hidden is set */
+static void random_dram_write(uint32_t address, uint32_t length, int same, int hidden)
+{
+    uint8_t* dram = (uint8_t*)rdram.dram;
+    uint32_t i;
+
+    if (!same) {
+        for (i = 0; i < length; ++i)
+            dram[(address + i) % RDRAM_MAX_SIZE] ^= (uint8_t)(rng() | 1);
+    }
+
+    if (!hidden)
+        rdram_mark_dirty(&rdram, address, length);
+}
+
+static size_t encode(int compare_dram, char *dst, size_t size)
+{
+    put_image(image, 0);
+    return savestates_delta_encode(image, base, IMAGE_SIZE, DRAM_OFFSET, &rdram,
+                                   RDRAM_DIRTY_SAVESTATE, compare_dram, dst, size);
+}
+
+/* applies a delta to a copy of base and compares it with the full image */
+static int check(const char *what, uint32_t round, size_t size)
+{
+    size_t offset;
+
+    put_image(full, 1);
+    memcpy(scratch, base, IMAGE_CAPACITY);
+    if (size == 0 || !savestates_delta_apply(scratch, IMAGE_CAPACITY, delta, size)) {
+        fprintf(stderr, "round %u: %s: could not encode or apply the delta\n", round, what);
+        return 0;
+    }
+
+    for (offset = 0; offset < IMAGE_CAPACITY; ++offset) {
+        if (scratch[offset] != full[offset]) {
+            fprintf(stderr, "round %u: %s: image differs at offset 0x%x\n", round, what, (unsigned)offset);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t round, writes, i;
+    size_t size, total_size = 0;
+    clock_t start, delta_time = 0, full_time = 0;
+
+    regtest_seed("test_savestates_delta", argc, argv);
+
+    rdram.dram_size = RDRAM_MAX_SIZE;
+    rdram.dram = malloc(RDRAM_MAX_SIZE);
+    /* zero filled past the image, like the snapshot buffers */
+    full = calloc(1, IMAGE_CAPACITY);
+    image = calloc(1, IMAGE_CAPACITY);
+    base = calloc(1, IMAGE_CAPACITY);
+    scratch = calloc(1, IMAGE_CAPACITY);
+    delta = malloc(delta_capacity);
+    if (rdram.dram == NULL || full == NULL || image == NULL || base == NULL
+     || scratch == NULL || delta == NULL)
+        return 1;
+
+    for (i = 0; i < RDRAM_MAX_SIZE / 4; ++i)
+        rdram.dram[i] = rng();
+    for (i = 0; i < IMAGE_SIZE; ++i)
+        state[i] = (char)rng();
+
+    put_image(base, 1);
+    rdram_clear_dirty(&rdram, RDRAM_DIRTY_SAVESTATE);
+
+    for (round = 1; round <= ROUNDS; ++round) {
+        writes = rng() % 24;
+        for (i = 0; i < writes; ++i) {
+            switch (rng() % 5) {
+            case 0:
+                random_state_write();
+                break;
+            case 1: /* word stores */
+                random_dram_write(rng() & ~UINT32_C(3), 4, 0, 0);
+                break;
+            case 2: /* DMA, may straddle pages and wrap */
+                random_dram_write(rng(), 1 + (rng() % 0x25800), 0, 0);
+                break;
+            case 3: /* written back with what it held */
+                random_dram_write(rng() & ~UINT32_C(3), 4, 1, 0);
+                break;
+            default: /* single bytes at page boundaries */
+                random_dram_write(((rng() % RDRAM_DIRTY_PAGES_COUNT) << RDRAM_DIRTY_PAGE_SHIFT) - 1, 2, 0, 0);
+                break;
+            }
+        }
+
+        start = clock();
+        size = encode(0, delta, delta_capacity);
+        delta_time += clock() - start;
+        total_size += size;
+        if (!check("tracked", round, size))
+            return 1;
+
+        start = clock();
+        put_image(full, 1);
+        full_time += clock() - start;
+
+        switch (rng() % 4) {
+        case 0: /* rebase: a full snapshot, or a load applied to the base */
+            put_image(base, 1);
+            rdram_clear_dirty(&rdram, RDRAM_DIRTY_SAVESTATE);
+            break;
+        case 1: /* loading the delta leaves only its own pages dirty */
+            rdram_clear_dirty(&rdram, RDRAM_DIRTY_SAVESTATE);
+            savestates_delta_mark_dram(&rdram, delta, DRAM_OFFSET);
+            break;
+        default: /* keep accumulating against the same base */
+            break;
+        }
+    }
+
+    /* a dram write left unreported is missed unless dram is compared */
+    random_dram_write(rng() % RDRAM_MAX_SIZE, 1, 0, 1);
+    size = encode(0, delta, delta_capacity);
+    put_image(full, 1);
+    memcpy(scratch, base, IMAGE_CAPACITY);
+    if (size == 0 || !savestates_delta_apply(scratch, IMAGE_CAPACITY, delta, size)
+     || memcmp(scratch, full, IMAGE_CAPACITY) == 0) {
+        fprintf(stderr, "the delta saw a dram write missing from the dirty pages\n");
+        return 1;
+    }
+    if (!check("compared", ROUNDS + 1, encode(1, delta, delta_capacity)))
+        return 1;
+
+    /* a delta which does not fit is refused, the largest one fits */
+    if (encode(1, delta, 64) != 0) {
+        fprintf(stderr, "a delta larger than its buffer was encoded\n");
+        return 1;
+    }
+    for (i = 0; i < IMAGE_SIZE; ++i)
+        base[i] = ~full[i];
+    if (!check("everything changed", ROUNDS + 2, encode(1, delta, delta_capacity)))
+        return 1;
+
+    /* invalid deltas are refused */
+    size = encode(1, delta, delta_capacity);
+    if (savestates_delta_apply(scratch, IMAGE_CAPACITY, delta, size - 1)
+     || savestates_delta_apply(scratch, IMAGE_SIZE - 1, delta, size)) {
+        fprintf(stderr, "a truncated delta, or one larger than its image, was applied\n");
+        return 1;
+    }
+    delta[0] ^= 1;
+    if (savestates_delta_apply(scratch, IMAGE_CAPACITY, delta, size)) {
+        fprintf(stderr, "a delta with a bad magic was applied\n");
+        return 1;
+    }
+
+    printf("test_savestates_delta: %u rounds match the full image, %u bytes and %.3f ms per delta against %u bytes and %.3f ms per image\n",
+           ROUNDS, (unsigned)(total_size / ROUNDS), delta_time * 1000.0 / CLOCKS_PER_SEC / ROUNDS,
+           (unsigned)IMAGE_SIZE, full_time * 1000.0 / CLOCKS_PER_SEC / ROUNDS);
+
+    free(delta);
+    free(scratch);
+    free(base);
+    free(image);
+    free(full);
+    free(rdram.dram);
+    regtest_passed();
+    return 0;
+}
@@ -0,0 +1,238 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *   Mupen64plus - test_tlb.c                                              *
+ *   Mupen64Plus homepage: https://mupen64plus.org/                        *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/* Checks tlb_lookup against a plain search of the TLB entries, over every
+ * page for reads and writes, while random entries are written the way
+ * TLBWI does. The same test is built with MICRO_TLB as test_tlb_micro,
+ * where tlb_build_lut must also give the tables the default build holds.
+ * Also times tlb_lookup over 16 consecutive pages, like code and data
+ * mapped together, and over 1024 pages spread over the entries.
+ *
+ * Entries never overlap: the two builds resolve overlaps differently and
+ * the real TLB shuts down on them.
+ *
+ * Build and run with "make core-tests". */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "regtest.h"
+
+#include "device/r4300/r4300_core.h"
+#include "device/r4300/tlb.h"
+
+#ifdef MICRO_TLB
+#define BUILD "micro-TLB"
+#else
+#define BUILD "lookup tables"
+#endif
+
+#define WRITES 200
+#define CHECK_INTERVAL 50      /* writes between checks of every page */
+#define LOOKUPS 5000000
+
+uint32_t IgnoreTLBExceptions;
+
+static struct tlb tlb;
+static uint32_t expected_lut[2][0x100000];
+
+/* virtual_to_physical_address is linked but not called */
+void TLB_refill_exception(struct r4300_core* r4300, uint32_t address, int w) {}
+
+/* the fields TLBWrite computes from EntryHi, EntryLo0/1 and PageMask */
+static void write_entry(size_t idx, uint32_t entryhi, uint32_t entrylo0, uint32_t entrylo1, uint32_t pagemask)
+{
+    struct tlb_entry* e = &tlb.entries[idx];
+
+    tlb_unmap(&tlb, idx);
+
+    e->g = (entrylo0 & entrylo1 & 1);
+    e->pfn_even = (entrylo0 & UINT32_C(0x3FFFFFC0)) >> 6;
+    e->pfn_odd = (entrylo1 & UINT32_C(0x3FFFFFC0)) >> 6;
+    e->c_even = (entrylo0 & UINT32_C(0x38)) >> 3;
+    e->c_odd = (entrylo1 & UINT32_C(0x38)) >> 3;
+    e->d_even = (entrylo0 & UINT32_C(0x4)) >> 2;
+    e->d_odd = (entrylo1 & UINT32_C(0x4)) >> 2;
+    e->v_even = (entrylo0 & UINT32_C(0x2)) >> 1;
+    e->v_odd = (entrylo1 & UINT32_C(0x2)) >> 1;
+    e->asid = (entryhi & UINT32_C(0xFF));
+    e->vpn2 = (entryhi & UINT32_C(0xFFFFE000)) >> 13;
+    e->mask = (pagemask & UINT32_C(0x1FFE000)) >> 13;
+
+    e->start_even = e->vpn2 << 13;
+    e->end_even = e->start_even + (e->mask << 12) + UINT32_C(0xFFF);
+    e->phys_even = e->pfn_even << 12;
+    e->start_odd = e->end_even + 1;
+    e->end_odd = e->start_odd + (e->mask << 12) + UINT32_C(0xFFF);
+    e->phys_odd = e->pfn_odd << 12;
+
+    tlb_map(&tlb, idx);
+}
+
+/* what the tables of the default build hold, from the entries alone */
+static void fill_half(uint32_t* lut, char v, unsigned int start, unsigned int end, unsigned int phys)
+{
+    if (!v || start >= end || (start >= 0x80000000 && end < 0xC0000000) || phys >= 0x20000000)
+        return;
+    for (unsigned int i = start; i < end; i += 0x1000)
+        lut[i >> 12] = UINT32_C(0x80000000) | (phys + (i - start) + 0xFFF);
+}
+
+static void build_expected(void)
+{
+    memset(expected_lut, 0, sizeof(expected_lut));
+    for (size_t i = 0; i < 32; ++i) {
+        const struct tlb_entry* e = &tlb.entries[i];
+        fill_half(expected_lut[0], e->v_even, e->start_even, e->end_even, e->phys_even);
+        fill_half(expected_lut[0], e->v_odd, e->start_odd, e->end_odd, e->phys_odd);
+        if (e->d_even)
+            fill_half(expected_lut[1], e->v_even, e->start_even, e->end_even, e->phys_even);
+        if (e->d_odd)
+            fill_half(expected_lut[1], e->v_odd, e->start_odd, e->end_odd, e->phys_odd);
+    }
+}
+
+static int overlaps(size_t idx, uint32_t start, uint32_t end)
+{
+    for (size_t i = 0; i < 32; ++i) {
+        const struct tlb_entry* e = &tlb.entries[i];
+        if (i != idx && (e->v_even || e->v_odd) && start <= e->end_odd && e->start_even <= end)
+            return 1;
+    }
+    return 0;
+}
+
+static uint32_t random_entrylo(void)
+{
+    /* mostly valid RDRAM pages, some past the physical address space */
+    uint32_t pfn = (rng() % 16 == 0) ? (rng() & 0xFFFFF) : (rng() % 0x800);
+    uint32_t flags = ((rng() % 10 != 0) ? 0x2 : 0) | ((rng() % 10 < 7) ? 0x4 : 0) | (rng() & 0x39);
+
+    return (pfn << 6) | flags;
+}
+
+static void random_write(void)
+{
+    static const uint32_t masks[] = { 0x0000, 0x0003, 0x000F, 0x003F, 0x00FF };
+    size_t idx = rng() % 32;
+    uint32_t mask, size, start;
+
+    do {
+        mask = masks[rng() % (sizeof(masks) / sizeof(masks[0]))];
+        size = (mask + 1) << 13;
+        /* kuseg mostly, kseg2/3 and sometimes the unmapped kseg0/1 */
+        switch (rng() % 8) {
+        case 0: start = 0xC0000000 + rng() % 0x3F000000; break;
+        case 1: start = 0x80000000 + rng() % 0x40000000; break;
+        default: start = rng() % 0x80000000; break;
+        }
+        start &= ~(size - 1);
+    } while (overlaps(idx, start, start + size - 1));
+
+    write_entry(idx, start | (rng() & 0xFF), random_entrylo(), random_entrylo(), mask << 13);
+}
+
+static int check_all_pages(void)
+{
+#ifdef MICRO_TLB
+    static uint32_t lut[0x100000];
+#endif
+
+    build_expected();
+    for (int w = 0; w < 2; ++w) {
+        for (uint32_t page = 0; page < 0x100000; ++page) {
+            uint32_t value = tlb_lookup(&tlb, page << 12, w);
+            if (value != expected_lut[w][page]) {
+                fprintf(stderr, "test_tlb: %s lookup of %08x gave %08x, expected %08x\n",
+                        w ? "write" : "read", page << 12, value, expected_lut[w][page]);
+                return 0;
+            }
+        }
+#ifdef MICRO_TLB
+        tlb_build_lut(&tlb, (unsigned char*)lut, w);
+        for (uint32_t page = 0; page < 0x100000; ++page) {
+            const unsigned char* p = (const unsigned char*)&lut[page];
+            uint32_t value = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+            if (value != expected_lut[w][page]) {
+                fprintf(stderr, "test_tlb: %s table built for %08x holds %08x, expected %08x\n",
+                        w ? "write" : "read", page << 12, value, expected_lut[w][page]);
+                return 0;
+            }
+        }
+#endif
+    }
+    return 1;
+}
+
+/* lookups at random addresses of pages_count mapped pages, consecutive
+ * ones from the first entry or random ones */
+static double time_lookups(size_t pages_count, int consecutive)
+{
+    static uint32_t pages[4096];
+    static uint32_t addresses[4096];
+    uint32_t sum = 0;
+    size_t n = 0;
+    double t;
+
+    while (n < pages_count) {
+        uint32_t page = consecutive ? (tlb.entries[0].start_even >> 12) + (uint32_t)n : rng() % 0x100000;
+        if (expected_lut[0][page] != 0)
+            pages[n++] = page;
+    }
+    for (size_t i = 0; i < sizeof(addresses) / sizeof(addresses[0]); ++i)
+        addresses[i] = (pages[rng() % pages_count] << 12) | (rng() & 0xFFC);
+
+    t = now();
+    for (size_t i = 0; i < LOOKUPS; ++i)
+        sum += tlb_lookup(&tlb, addresses[i & (sizeof(addresses) / sizeof(addresses[0]) - 1)], 0);
+    t = now() - t;
+
+    if (sum == 0)
+        printf("test_tlb: no lookup hit\n");
+    return t * 1e9 / LOOKUPS;
+}
+
+int main(int argc, char** argv)
+{
+    regtest_seed("test_tlb (" BUILD ")", argc, argv);
+
+    poweron_tlb(&tlb);
+    for (int i = 1; i <= WRITES; ++i) {
+        random_write();
+        if (i % CHECK_INTERVAL == 0 && !check_all_pages())
+            return 1;
+    }
+    printf("test_tlb: %d entry writes, every page matches for reads and writes\n", WRITES);
+
+    /* a fully mapped TLB to time, valid RDRAM pages only */
+    poweron_tlb(&tlb);
+    for (size_t i = 0; i < 32; ++i) {
+        uint32_t start = (uint32_t)i << 20;
+        write_entry(i, start, ((rng() % 0x800) << 6) | 0x6, ((rng() % 0x800) << 6) | 0x6, 0x3F << 13);
+    }
+    build_expected();
+    printf("test_tlb: struct tlb is %u bytes, %.2f ns per lookup over 16 consecutive pages, %.2f ns over 1024 pages\n",
+           (unsigned)sizeof(struct tlb), time_lookups(16, 1), time_lookups(1024, 0));
+
+    regtest_passed();
+    return 0;
+}
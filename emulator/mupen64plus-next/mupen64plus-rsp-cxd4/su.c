@@ -21,6 +21,9 @@
  */
 #include "module.h"
 
+/* dram written outside of the core, see mupen64plus-next_common.h */
+extern void plugin_notify_dram_write(uint32_t address, uint32_t length);
+
 u32 inst_word;
 
 u32 SR[32];
@@ -273,6 +276,7 @@ void SP_DMA_WRITE(void)
             *(pi64)(DRAM + offD) = *(pi64)(DMEM + offC);
             i += 0x000008;
         } while (i < length);
+        plugin_notify_dram_write(count*skip + *CR[0x1], length);
     } while (count);
 
     if ((*CR[0x0] & 0x1000) ^ (offC & 0x1000))
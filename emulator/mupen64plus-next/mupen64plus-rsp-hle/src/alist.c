@@ -168,6 +168,7 @@ void alist_save(struct hle_t* hle, uint16_t dmem, uint32_t address, uint16_t cou
     address &= ~7;
     count = align(count, 8);
     memcpy(hle->dram + address, hle->alist_buffer + dmem, count);
+    HleDramWritten(hle->user_defined, address, count);
 }
 
 void alist_move(struct hle_t* hle, uint16_t dmemo, uint16_t dmemi, uint16_t count)
@@ -355,6 +356,7 @@ void alist_envmix_exp(
     *(int32_t *)(save_buffer + 16) = (int32_t)ramps[0].value;    /* 12-13 */
     *(int32_t *)(save_buffer + 18) = (int32_t)ramps[1].value;    /* 14-15 */
     memcpy(hle->dram + address, (uint8_t *)save_buffer, sizeof(save_buffer));
+    HleDramWritten(hle->user_defined, address, sizeof(save_buffer));
 }
 
 void alist_envmix_ge(
@@ -434,6 +436,7 @@ void alist_envmix_ge(
     *(int32_t *)(save_buffer + 16) = (int32_t)ramps[0].value;    /* 12-13 */
     *(int32_t *)(save_buffer + 18) = (int32_t)ramps[1].value;    /* 14-15 */
     memcpy(hle->dram + address, (uint8_t *)save_buffer, 80);
+    HleDramWritten(hle->user_defined, address, 80);
 }
 
 void alist_envmix_lin(
@@ -507,6 +510,7 @@ void alist_envmix_lin(
     *(int32_t *)(save_buffer + 16) = (int32_t)ramps[0].value; /* 16-17 */
     *(int32_t *)(save_buffer + 18) = (int32_t)ramps[1].value; /* 18-19 */
     memcpy(hle->dram + address, (uint8_t *)save_buffer, 80);
+    HleDramWritten(hle->user_defined, address, 80);
 }
 
 void alist_envmix_nead(
@@ -636,6 +640,8 @@ static void alist_resample_save(struct hle_t* hle, uint32_t address, uint16_t po
     *dram_u16(hle, address + 6) = *sample(hle, pos + 3);
 
     *dram_u16(hle, address + 8) = pitch_accu;
+
+    HleDramWritten(hle->user_defined, address, 10);
 }
 
 void alist_resample(
@@ -813,6 +819,8 @@ void alist_filter(
         int32_t v = (lutt5[x] + lutt6[x]) >> 1;
         lutt5[x] = lutt6[x] = v;
     }
+    HleDramWritten(hle->user_defined, lut_address[0], 16);
+    HleDramWritten(hle->user_defined, lut_address[1], 16);
 
     for (x = 0; x < count; x += 16) {
         int32_t v[8];
@@ -903,6 +911,7 @@ void alist_filter(
     }
 
     memcpy(hle->dram + address, in2 - 8, 16);
+    HleDramWritten(hle->user_defined, address, 16);
     memcpy(hle->alist_buffer + dmem, outbuff, count);
 }
 
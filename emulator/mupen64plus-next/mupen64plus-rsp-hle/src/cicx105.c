@@ -23,6 +23,7 @@
 
 #include <string.h>
 
+#include "hle_external.h"
 #include "hle_internal.h"
 
 /**
@@ -50,6 +51,7 @@ void cicx105_ucode(struct hle_t* hle)
         src += 0x8;
 
     }
+    HleDramWritten(hle->user_defined, 0x2fb1f0, 23 * 0xff0 + 8);
 
     rsp_break(hle, 0);
 }
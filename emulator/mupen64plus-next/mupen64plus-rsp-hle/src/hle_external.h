@@ -22,6 +22,8 @@
 #ifndef HLE_EXTERNAL_H
 #define HLE_EXTERNAL_H
 
+#include <stdint.h>
+
 #if defined(__GNUC__)
 #define ATTR_FMT(fmtpos, attrpos) __attribute__ ((format (printf, fmtpos, attrpos)))
 #else
@@ -42,5 +44,8 @@ void HleProcessRdpList(void* user_defined);
 void HleShowCFB(void* user_defined);
 int HleForwardTask(void* user_defined);
 
+/* called after the ucode wrote [address, address+length) of dram */
+void HleDramWritten(void* user_defined, uint32_t address, uint32_t length);
+
 #endif
 
@@ -27,6 +27,7 @@
 #include <stdint.h>
 
 #include "common.h"
+#include "hle_external.h"
 #include "hle_internal.h"
 
 #ifdef M64P_BIG_ENDIAN
@@ -169,16 +170,19 @@ static inline void dram_load_u32(struct hle_t* hle, uint32_t* dst, uint32_t addr
 static inline void dram_store_u8(struct hle_t* hle, const uint8_t* src, uint32_t address, size_t count)
 {
     store_u8(hle->dram, address & 0xffffff, src, count);
+    HleDramWritten(hle->user_defined, address & 0xffffff, count * sizeof(*src));
 }
 
 static inline void dram_store_u16(struct hle_t* hle, const uint16_t* src, uint32_t address, size_t count)
 {
     store_u16(hle->dram, address & 0xffffff, src, count);
+    HleDramWritten(hle->user_defined, address & 0xffffff, count * sizeof(*src));
 }
 
 static inline void dram_store_u32(struct hle_t* hle, const uint32_t* src, uint32_t address, size_t count)
 {
     store_u32(hle->dram, address & 0xffffff, src, count);
+    HleDramWritten(hle->user_defined, address & 0xffffff, count * sizeof(*src));
 }
 
 #endif
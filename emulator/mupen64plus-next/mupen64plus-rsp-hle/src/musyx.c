@@ -355,6 +355,8 @@ static void save_base_vol(struct hle_t* hle, const int32_t *base_vol, uint32_t a
 {
     unsigned k;
 
+    HleDramWritten(hle->user_defined, address, 16);
+
     for (k = 0; k < 4; ++k) {
         *dram_u16(hle, address) = (uint16_t)(base_vol[k] >> 16);
         address += 2;
@@ -934,6 +936,7 @@ static void interleave_stage_v1(struct hle_t* hle, musyx_t *musyx, uint32_t outp
 
         *(dst++) = (l << 16) | r;
     }
+    HleDramWritten(hle->user_defined, output_ptr, SUBFRAME_SIZE * 4);
 }
 
 static void interleave_stage_v2(struct hle_t* hle, musyx_t *musyx,
@@ -982,6 +985,7 @@ static void interleave_stage_v2(struct hle_t* hle, musyx_t *musyx,
         uint16_t r = musyx->right[i];
         *(dst++) = (l << 16) | r;
     }
+    HleDramWritten(hle->user_defined, output_ptr, SUBFRAME_SIZE * 4);
 
     /* writeback subframe @ptr_1c */
     dram_store_u16(hle, (uint16_t*)subframe, ptr_1c, SUBFRAME_SIZE);
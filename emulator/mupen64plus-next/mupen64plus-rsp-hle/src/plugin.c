@@ -37,6 +37,8 @@
 #include "m64p_plugin.h"
 #include "m64p_types.h"
 
+#include <mupen64plus-next_common.h>
+
 #define CONFIG_API_VERSION       0x020100
 #define CONFIG_PARAM_VERSION     1.00
 
@@ -147,6 +149,11 @@ int HleForwardTask(void* user_defined)
     return -1;
 }
 
+void HleDramWritten(void* UNUSED(user_defined), uint32_t address, uint32_t length)
+{
+    plugin_notify_dram_write(address, length);
+}
+
 /* DLL-exported functions */
 EXPORT m64p_error CALL hlePluginStartup(m64p_dynlib_handle CoreLibHandle, void *Context,
                                      void (*DebugCallback)(void *, int, const char *))
@@ -9,6 +9,9 @@ extern RSP_INFO rsp;
 extern short MFC0_count[32];
 extern int SP_STATUS_TIMEOUT;
 } // namespace RSP
+
+// dram written outside of the core, see mupen64plus-next_common.h
+extern "C" void plugin_notify_dram_write(uint32_t address, uint32_t length);
 #endif
 
 using namespace RSP;
@@ -208,6 +211,7 @@ extern "C"
 				j += 4;
 			} while (j < length);
 
+			plugin_notify_dram_write(dest, length);
 			source += length;
 			dest += length + skip;
 		} while (++i <= count);
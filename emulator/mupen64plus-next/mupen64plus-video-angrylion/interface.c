@@ -196,6 +196,19 @@ void angrylion_set_overscan(unsigned value)
     
 }
 
+void angrylion_set_vi_async(unsigned value)
+{
+   if(config.vi.async != (bool)value)
+   {
+      config.vi.async = (bool)value;
+      if (angrylion_init)
+      {
+         n64video_close();
+         n64video_init(&config);
+      }
+   }
+}
+
 void angrylion_set_vi_dedither(unsigned value)
 {
    if(config.vi.vi_dedither != (bool)value)
@@ -362,6 +375,9 @@ int angrylionRomOpen(void)
 
 void angrylionUpdateScreen(void)
 {
+    // no VI filtering for frames that will not be presented
+    if (retro_speculative_frame & RETRO_SPECULATIVE_VIDEO)
+        return;
 #ifdef HAVE_FRAMESKIP
     static int counter;
     if (counter++ < skip)
@@ -388,6 +404,8 @@ void angrylionFBRead(unsigned int addr) { }
 
 void angrylionFBGetFrameBufferInfo(void *pinfo) { }
 
+void angrylionFBWriteRange(unsigned int begin, unsigned int end) { }
+
 m64p_error angrylionPluginGetVersion(m64p_plugin_type *PluginType, int *PluginVersion, int *APIVersion, const char **PluginNamePtr, int *Capabilities)
 {
    /* set version info */
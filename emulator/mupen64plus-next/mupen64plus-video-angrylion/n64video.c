@@ -114,6 +114,7 @@ static STRICTINLINE uint32_t irand(uint32_t* state)
 }
 
 #include "n64video/rdp.c"
+#include "n64video/dump.c"
 #include "n64video/vi.c"
 
 static uint32_t rdp_cmd_buf[CMD_BUFFER_SIZE][CMD_MAX_INTS];
@@ -127,18 +128,167 @@ static uint32_t rdp_cmd_len;
 // multithreaded mode
 static bool rdp_cmd_sync[64];
 
+// commands that only set state read by primitives, so a worker only needs
+// the last one of each before its next primitive
+static const uint32_t rdp_cmd_lazy[] = {
+    CMD_ID_SET_KEY_GB,
+    CMD_ID_SET_KEY_R,
+    CMD_ID_SET_CONVERT,
+    CMD_ID_SET_SCISSOR,
+    CMD_ID_SET_PRIM_DEPTH,
+    CMD_ID_SET_OTHER_MODES,
+    CMD_ID_SET_FILL_COLOR,
+    CMD_ID_SET_FOG_COLOR,
+    CMD_ID_SET_BLEND_COLOR,
+    CMD_ID_SET_PRIM_COLOR,
+    CMD_ID_SET_ENV_COLOR,
+    CMD_ID_SET_COMBINE,
+    CMD_ID_SET_MASK_IMAGE,
+    CMD_ID_SET_COLOR_IMAGE
+};
+
+#define CMD_LAZY_COUNT (sizeof(rdp_cmd_lazy) / sizeof(rdp_cmd_lazy[0]))
+
+// buffered commands to run on each worker, filled by cmd_bin
+static uint16_t rdp_cmd_bin[PARALLEL_MAX_WORKERS][CMD_BUFFER_SIZE];
+static uint32_t rdp_cmd_bin_len[PARALLEL_MAX_WORKERS];
+
+// first buffer position of lazy commands a worker has not received yet
+static uint32_t rdp_cmd_bin_sync[PARALLEL_MAX_WORKERS];
+
+// last buffer position of each lazy command, or -1
+static int32_t rdp_cmd_lazy_pos[CMD_LAZY_COUNT];
+
+// gets the range of scanlines a primitive can draw to, returns false for
+// commands that don't draw
+static bool cmd_prim_lines(const uint32_t* cmd, int32_t* ystart, int32_t* yend)
+{
+    int32_t yh, yl;
+
+    switch (CMD_ID(cmd)) {
+        case CMD_ID_FILL_TRIANGLE:
+        case CMD_ID_FILL_ZBUFFER_TRIANGLE:
+        case CMD_ID_TEXTURE_TRIANGLE:
+        case CMD_ID_TEXTURE_ZBUFFER_TRIANGLE:
+        case CMD_ID_SHADE_TRIANGLE:
+        case CMD_ID_SHADE_ZBUFFER_TRIANGLE:
+        case CMD_ID_SHADE_TEXTURE_TRIANGLE:
+        case CMD_ID_SHADE_TEXTURE_Z_BUFFER_TRIANGLE:
+            yl = SIGN(cmd[0], 14);
+            yh = SIGN(cmd[1], 14);
+            break;
+        case CMD_ID_TEXTURE_RECTANGLE:
+        case CMD_ID_TEXTURE_RECTANGLE_FLIP:
+        case CMD_ID_FILL_RECTANGLE:
+            yl = cmd[0] & 0xfff;
+            yh = cmd[1] & 0xfff;
+            break;
+        default:
+            return false;
+    }
+
+    // the rasterizer only narrows this range with the scissor
+    *ystart = MAX(yh, 0) >> 2;
+    *yend = MIN(yl >> 2, 1023);
+    return true;
+}
+
+// gives a worker the lazy commands it is missing
+static void cmd_bin_sync(uint32_t worker_id, uint32_t pos)
+{
+    uint32_t i;
+    for (i = 0; i < CMD_LAZY_COUNT; i++) {
+        if (rdp_cmd_lazy_pos[i] >= (int32_t)rdp_cmd_bin_sync[worker_id]) {
+            rdp_cmd_bin[worker_id][rdp_cmd_bin_len[worker_id]++] = rdp_cmd_lazy_pos[i];
+        }
+    }
+    rdp_cmd_bin_sync[worker_id] = pos;
+}
+
+static void cmd_bin_add(uint32_t worker_id, uint32_t pos)
+{
+    cmd_bin_sync(worker_id, pos);
+    rdp_cmd_bin[worker_id][rdp_cmd_bin_len[worker_id]++] = pos;
+}
+
+// sorts the buffered commands by worker: each worker only draws every
+// n-th scanline, so primitives are only given to the workers owning some
+// of their lines, and state changes are held back until a worker draws
+static void cmd_bin(void)
+{
+    uint32_t num_workers = parallel_num_workers();
+    uint32_t pos, i, w;
+
+    for (w = 0; w < num_workers; w++) {
+        rdp_cmd_bin_len[w] = 0;
+        rdp_cmd_bin_sync[w] = 0;
+    }
+
+    for (i = 0; i < CMD_LAZY_COUNT; i++) {
+        rdp_cmd_lazy_pos[i] = -1;
+    }
+
+    for (pos = 0; pos < rdp_cmd_buf_pos; pos++) {
+        const uint32_t* cmd = rdp_cmd_buf[pos];
+        uint32_t cmd_id = CMD_ID(cmd);
+        int32_t ystart, yend, y;
+
+        if (cmd_prim_lines(cmd, &ystart, &yend)) {
+            if (yend - ystart + 1 >= (int32_t)num_workers) {
+                for (w = 0; w < num_workers; w++) {
+                    cmd_bin_add(w, pos);
+                }
+            } else {
+                for (y = ystart; y <= yend; y++) {
+                    cmd_bin_add(y % num_workers, pos);
+                }
+            }
+            continue;
+        }
+
+        switch (cmd_id) {
+            case CMD_ID_NO_OP:
+            case CMD_ID_SYNC_LOAD:
+            case CMD_ID_SYNC_PIPE:
+            case CMD_ID_SYNC_TILE:
+                continue;
+        }
+
+        for (i = 0; i < CMD_LAZY_COUNT; i++) {
+            if (rdp_cmd_lazy[i] == cmd_id) {
+                rdp_cmd_lazy_pos[i] = pos;
+                break;
+            }
+        }
+
+        // anything else, like texture loads, runs on every worker in order
+        if (i == CMD_LAZY_COUNT) {
+            for (w = 0; w < num_workers; w++) {
+                rdp_cmd_bin[w][rdp_cmd_bin_len[w]++] = pos;
+            }
+        }
+    }
+
+    // leave all workers in the same state for the next batch
+    for (w = 0; w < num_workers; w++) {
+        cmd_bin_sync(w, rdp_cmd_buf_pos);
+    }
+}
+
 static void cmd_run_buffered(uint32_t worker_id)
 {
-    uint32_t pos;
-    for (pos = 0; pos < rdp_cmd_buf_pos; pos++)
-        rdp_cmd(worker_id, rdp_cmd_buf[pos]);
+    uint32_t i;
+    for (i = 0; i < rdp_cmd_bin_len[worker_id]; i++)
+        rdp_cmd(worker_id, rdp_cmd_buf[rdp_cmd_bin[worker_id][i]]);
 }
 
 static void cmd_flush(void)
 {
     // only run if there's something buffered
     if (rdp_cmd_buf_pos) {
-        // let workers run all buffered commands in parallel
+        // split the commands between workers
+        cmd_bin();
+        // let workers run their share of the buffered commands in parallel
         parallel_run(cmd_run_buffered);
         // reset buffer by starting from the beginning
         rdp_cmd_buf_pos = 0;
@@ -181,6 +331,7 @@ void n64video_init(struct n64video_config* xconfig)
         combiner_init_lut();
         tex_init_lut();
         z_init_lut();
+        span_init_lut();
 
         fb_init(0);
         combiner_init(0);
@@ -206,6 +357,9 @@ void n64video_init(struct n64video_config* xconfig)
     rdram_init();
     vi_init();
     cmd_init();
+    dump_init();
+
+    memset(rdp_stats, 0, sizeof(rdp_stats));
 
     rdp_pipeline_crashed = 0;
     memset(&onetimewarnings, 0, sizeof(onetimewarnings));
@@ -272,6 +426,8 @@ void n64video_process_list(void)
 
         // if there's enough data for the current command...
         if (rdp_cmd_pos == rdp_cmd_len) {
+            dump_command(cmd_buf, rdp_cmd_len);
+
             // check if parallel processing is enabled
             if (config.parallel) {
                 // special case: sync_full always needs to be run in main thread
@@ -312,5 +468,26 @@ void n64video_process_list(void)
 void n64video_close(void)
 {
     vi_close();
+    dump_close();
     parallel_close();
 }
+
+void n64video_get_stats(struct n64video_stats* stats)
+{
+    uint32_t i, j;
+
+    memset(stats, 0, sizeof(*stats));
+
+    for (i = 0; i < PARALLEL_MAX_WORKERS; i++) {
+        for (j = 0; j < 64; j++) {
+            stats->cmd_count[j] += rdp_stats[i].cmd_count[j];
+            stats->cmd_time[j] += rdp_stats[i].cmd_time[j];
+        }
+        stats->pixels += rdp_stats[i].pixels;
+    }
+}
+
+uint8_t* n64video_get_hidden_rdram(void)
+{
+    return rdram_hidden;
+}
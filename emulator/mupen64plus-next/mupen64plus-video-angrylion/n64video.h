@@ -83,17 +83,30 @@ struct n64video_config
         bool exclusive;             // run in exclusive mode when in fullscreen if true
         bool vi_dedither;           // enable dedithering if true
         bool vi_blur;               // enable bilateral blur if true
+        bool async;                 // filter in the background, one frame late, if true
     } vi;
     struct {
         enum dp_compat_profile compat;  // multithreading compatibility mode
+        bool stats;                     // collect n64video_stats if true
+        bool generic_spans;             // skip the specialized span routines if true, to compare
     } dp;
     bool parallel;                  // use multithreaded renderer if true
     bool dithering;                 // enable dithering
     uint32_t num_workers;           // number of rendering workers
 };
 
+// counters collected while config.dp.stats is set, summed over all workers
+struct n64video_stats
+{
+    uint64_t cmd_count[64];         // commands run by ID, once per worker running it
+    uint64_t cmd_time[64];          // time spent in commands by ID, in nanoseconds
+    uint64_t pixels;                // pixels walked by the span renderers
+};
+
 void n64video_config_init(struct n64video_config* config);
 void n64video_init(struct n64video_config* config);
 void n64video_update_screen(void);
 void n64video_process_list(void);
 void n64video_close(void);
+void n64video_get_stats(struct n64video_stats* stats);
+uint8_t* n64video_get_hidden_rdram(void);
@@ -0,0 +1,164 @@
+//
+// dump.c: RDP command stream capture
+//
+// Writes the commands read by n64video_process_list and the RDRAM they work
+// on to the file named by ANGRYLION_RDP_DUMP_PATH, for angrylion-bench to
+// replay. The layout is the RDPDUMP2 format of parallel-rdp's dump writer:
+// RDRAM is sent as changed 4 KiB blocks before the first command of each
+// list and at the end of each frame.
+//
+
+enum dump_cmd
+{
+    DUMP_CMD_INVALID,
+    DUMP_CMD_UPDATE_DRAM,
+    DUMP_CMD_RDP_COMMAND,
+    DUMP_CMD_SET_VI_REGISTER,
+    DUMP_CMD_END_FRAME,
+    DUMP_CMD_SIGNAL_COMPLETE,
+    DUMP_CMD_EOF,
+    DUMP_CMD_UPDATE_DRAM_FLUSH,
+    DUMP_CMD_UPDATE_HIDDEN_DRAM,
+    DUMP_CMD_UPDATE_HIDDEN_DRAM_FLUSH
+};
+
+#define DUMP_BLOCK_SIZE 0x1000
+
+static FILE* dump_file;
+static uint8_t* dump_rdram_cache;
+static uint8_t* dump_hidden_cache;
+static bool dump_in_list;
+
+// defined with the command buffer in n64video.c
+static void cmd_flush(void);
+
+static void dump_write32(uint32_t value)
+{
+    fwrite(&value, sizeof(value), 1, dump_file);
+}
+
+static void dump_close(void)
+{
+    if (!dump_file) {
+        return;
+    }
+
+    dump_write32(DUMP_CMD_EOF);
+    fclose(dump_file);
+    dump_file = NULL;
+
+    free(dump_rdram_cache);
+    free(dump_hidden_cache);
+    dump_rdram_cache = NULL;
+    dump_hidden_cache = NULL;
+}
+
+static void dump_init(void)
+{
+    const char* path = getenv("ANGRYLION_RDP_DUMP_PATH");
+    uint32_t rdram_size = config.gfx.rdram_size;
+    uint32_t hidden_size = rdram_size / 2;
+
+    dump_close();
+    dump_in_list = false;
+
+    if (!path || !*path) {
+        return;
+    }
+
+    // the caches start out zeroed, as RDRAM is assumed to be by the reader
+    dump_rdram_cache = calloc(rdram_size, 1);
+    dump_hidden_cache = calloc(hidden_size, 1);
+    dump_file = fopen(path, "wb");
+
+    if (!dump_rdram_cache || !dump_hidden_cache || !dump_file) {
+        msg_warning("dump_init: could not start RDP dump to %s", path);
+        if (dump_file) {
+            fclose(dump_file);
+            dump_file = NULL;
+        }
+        free(dump_rdram_cache);
+        free(dump_hidden_cache);
+        dump_rdram_cache = NULL;
+        dump_hidden_cache = NULL;
+        return;
+    }
+
+    fwrite("RDPDUMP2", 8, 1, dump_file);
+    dump_write32(rdram_size);
+    dump_write32(hidden_size);
+}
+
+static void dump_flush_mem(const uint8_t* mem, uint8_t* cache, uint32_t size, uint32_t block_cmd, uint32_t flush_cmd)
+{
+    uint32_t offset;
+    for (offset = 0; offset + DUMP_BLOCK_SIZE <= size; offset += DUMP_BLOCK_SIZE) {
+        if (memcmp(mem + offset, cache + offset, DUMP_BLOCK_SIZE)) {
+            dump_write32(block_cmd);
+            dump_write32(offset);
+            dump_write32(DUMP_BLOCK_SIZE);
+            fwrite(mem + offset, 1, DUMP_BLOCK_SIZE, dump_file);
+            memcpy(cache + offset, mem + offset, DUMP_BLOCK_SIZE);
+        }
+    }
+
+    dump_write32(flush_cmd);
+}
+
+static void dump_flush_rdram(void)
+{
+    dump_flush_mem(config.gfx.rdram, dump_rdram_cache, config.gfx.rdram_size,
+        DUMP_CMD_UPDATE_DRAM, DUMP_CMD_UPDATE_DRAM_FLUSH);
+    dump_flush_mem(rdram_hidden, dump_hidden_cache, config.gfx.rdram_size / 2,
+        DUMP_CMD_UPDATE_HIDDEN_DRAM, DUMP_CMD_UPDATE_HIDDEN_DRAM_FLUSH);
+}
+
+// called for each complete command, before it is run or buffered
+static void dump_command(const uint32_t* cmd, uint32_t length)
+{
+    if (!dump_file) {
+        return;
+    }
+
+    // commands of the last list have all run at its sync_full, so RDRAM
+    // is in the state the new list starts from
+    if (!dump_in_list) {
+        dump_flush_rdram();
+        dump_in_list = true;
+    }
+
+    uint32_t cmd_id = CMD_ID(cmd);
+
+    if (cmd_id == CMD_ID_SYNC_FULL) {
+        dump_write32(DUMP_CMD_SIGNAL_COMPLETE);
+        dump_in_list = false;
+        return;
+    }
+
+    dump_write32(DUMP_CMD_RDP_COMMAND);
+    dump_write32(cmd_id);
+    dump_write32(length);
+    fwrite(cmd, sizeof(*cmd), length, dump_file);
+}
+
+static void dump_frame(void)
+{
+    uint32_t i;
+
+    if (!dump_file) {
+        return;
+    }
+
+    // run buffered commands first, the RDRAM sent now must not be missing
+    // their output
+    cmd_flush();
+
+    for (i = 0; i < VI_NUM_REG; i++) {
+        dump_write32(DUMP_CMD_SET_VI_REGISTER);
+        dump_write32(i);
+        dump_write32(*config.gfx.vi_reg[i]);
+    }
+
+    dump_flush_rdram();
+    dump_write32(DUMP_CMD_END_FRAME);
+}
@@ -119,6 +119,7 @@ struct other_modes
         int getditherlevel;
         int textureuselevel0;
         int textureuselevel1;
+        int span_variant;
     } f;
 };
 
@@ -340,6 +341,9 @@ struct rdp_state
 
 struct rdp_state state[PARALLEL_MAX_WORKERS];
 
+// per worker counters, only updated if config.dp.stats is set
+static struct n64video_stats rdp_stats[PARALLEL_MAX_WORKERS];
+
 static int32_t one_color = 0x100;
 static int32_t zero_color = 0x00;
 
@@ -468,6 +472,7 @@ static void deduce_derivatives(uint32_t wid);
 #include "rdp/tmem.c"
 #include "rdp/tcoord.c"
 #include "rdp/tex.c"
+#include "rdp/span.c"
 #include "rdp/rasterizer.c"
 
 static void deduce_derivatives(uint32_t wid)
@@ -490,6 +495,8 @@ static void deduce_derivatives(uint32_t wid)
 
     state[wid].tcdiv_ptr = tcdiv_func[state[wid].other_modes.persp_tex_en];
 
+    state[wid].other_modes.f.span_variant = span_select_variant(wid);
+
 
     int texel1_used_in_cc1 = 0, texel0_used_in_cc1 = 0, texel0_used_in_cc0 = 0, texel1_used_in_cc0 = 0;
     int texels_in_cc0 = 0, texels_in_cc1 = 0;
@@ -650,5 +657,14 @@ void rdp_set_other_modes(uint32_t wid, const uint32_t* args)
 void rdp_cmd(uint32_t wid, const uint32_t* args)
 {
     uint32_t cmd_id = CMD_ID(args);
+
+    if (config.dp.stats) {
+        uint64_t start = parallel_time_ns();
+        rdp_commands[cmd_id].handler(wid, args);
+        rdp_stats[wid].cmd_time[cmd_id] += parallel_time_ns() - start;
+        rdp_stats[wid].cmd_count[cmd_id]++;
+        return;
+    }
+
     rdp_commands[cmd_id].handler(wid, args);
 }
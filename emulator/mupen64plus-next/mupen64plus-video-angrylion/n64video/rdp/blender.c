@@ -67,10 +67,10 @@ static INLINE void set_blender_input(uint32_t wid, int cycle, int which, int32_t
     }
 }
 
-static STRICTINLINE int alpha_compare(uint32_t wid, int32_t comb_alpha)
+static STRICTINLINE int alpha_compare(uint32_t wid, int32_t comb_alpha, int compare_en)
 {
     int32_t threshold;
-    if (!state[wid].other_modes.alpha_compare_en)
+    if (!compare_en)
         return 1;
     else
     {
@@ -185,12 +185,12 @@ static STRICTINLINE void blender_equation_cycle1(uint32_t wid, int* r, int* g, i
     }
 }
 
-static STRICTINLINE int blender_1cycle(uint32_t wid, uint32_t* fr, uint32_t* fg, uint32_t* fb, int dith, uint32_t blend_en, uint32_t prewrap, uint32_t curpixel_cvg, uint32_t curpixel_cvbit)
+static STRICTINLINE int blender_1cycle(uint32_t wid, uint32_t* fr, uint32_t* fg, uint32_t* fb, int dith, uint32_t blend_en, uint32_t prewrap, uint32_t curpixel_cvg, uint32_t curpixel_cvbit, int alpha_compare_en)
 {
     int r, g, b, dontblend;
 
 
-    if (alpha_compare(wid, state[wid].pixel_color.a))
+    if (alpha_compare(wid, state[wid].pixel_color.a, alpha_compare_en))
     {
 
 
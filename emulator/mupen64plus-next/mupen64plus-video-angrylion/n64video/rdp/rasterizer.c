@@ -120,75 +120,85 @@ static void fetch_qword_copy(uint32_t wid, uint32_t* hidword, uint32_t* lowdword
     }
 }
 
-static STRICTINLINE void rgba_correct(uint32_t wid, int offx, int offy, int r, int g, int b, int a, uint32_t cvg)
+// The span routines below are instantiated once per variant, with the
+// modes tested for every pixel turned into constants. SPAN_GENERIC reads
+// them from other_modes and handles every combination.
+enum span_variant
 {
-    int summand_r, summand_b, summand_g, summand_a;
-
-
-
-    if (cvg == 8)
-    {
-        r >>= 2;
-        g >>= 2;
-        b >>= 2;
-        a >>= 2;
-    }
-    else
+    SPAN_GENERIC,
+    SPAN_NO_Z,          // no z compare or update, 2D and fill-like primitives
+    SPAN_OPAQUE,        // z compare and update in opaque mode
+    SPAN_OPAQUE_ACMP,   // same, with alpha compare for cutout textures
+    SPAN_TRANSLUCENT,   // z compare in transparent mode, no update
+    SPAN_NUM_VARIANTS
+};
+
+static STRICTINLINE void span_variant_modes(uint32_t wid, int variant, int* z_compare_en, int* z_update_en, int* z_mode, int* alpha_compare_en)
+{
+    switch (variant)
     {
-        summand_r = offx * state[wid].spans_cdr + offy * state[wid].spans_drdy;
-        summand_g = offx * state[wid].spans_cdg + offy * state[wid].spans_dgdy;
-        summand_b = offx * state[wid].spans_cdb + offy * state[wid].spans_dbdy;
-        summand_a = offx * state[wid].spans_cda + offy * state[wid].spans_dady;
-
-        r = ((r << 2) + summand_r) >> 4;
-        g = ((g << 2) + summand_g) >> 4;
-        b = ((b << 2) + summand_b) >> 4;
-        a = ((a << 2) + summand_a) >> 4;
+        case SPAN_NO_Z:
+            *z_compare_en = 0; *z_update_en = 0; *z_mode = ZMODE_OPAQUE; *alpha_compare_en = 0;
+            break;
+        case SPAN_OPAQUE:
+            *z_compare_en = 1; *z_update_en = 1; *z_mode = ZMODE_OPAQUE; *alpha_compare_en = 0;
+            break;
+        case SPAN_OPAQUE_ACMP:
+            *z_compare_en = 1; *z_update_en = 1; *z_mode = ZMODE_OPAQUE; *alpha_compare_en = 1;
+            break;
+        case SPAN_TRANSLUCENT:
+            *z_compare_en = 1; *z_update_en = 0; *z_mode = ZMODE_TRANSPARENT; *alpha_compare_en = 0;
+            break;
+        default:
+            *z_compare_en = state[wid].other_modes.z_compare_en;
+            *z_update_en = state[wid].other_modes.z_update_en;
+            *z_mode = state[wid].other_modes.z_mode;
+            *alpha_compare_en = state[wid].other_modes.alpha_compare_en;
+            break;
     }
-
-
-    state[wid].shade_color.r = special_9bit_clamptable[r & 0x1ff];
-    state[wid].shade_color.g = special_9bit_clamptable[g & 0x1ff];
-    state[wid].shade_color.b = special_9bit_clamptable[b & 0x1ff];
-    state[wid].shade_color.a = special_9bit_clamptable[a & 0x1ff];
 }
 
-static STRICTINLINE void z_correct(uint32_t wid, int offx, int offy, int* z, uint32_t cvg)
+static int span_select_variant(uint32_t wid)
 {
-    int summand_z;
-    int sz = *z;
-    int zanded;
-
-
-
-    if (cvg == 8)
-        sz = sz >> 3;
-    else
-    {
-        summand_z = offx * state[wid].spans_cdz + offy * state[wid].spans_dzdy;
-
-        sz = ((sz << 2) + summand_z) >> 5;
-    }
-
-
-
-    zanded = (sz & 0x60000) >> 17;
-
+    int z_compare_en = state[wid].other_modes.z_compare_en;
+    int z_update_en = state[wid].other_modes.z_update_en;
+    int z_mode = state[wid].other_modes.z_mode;
+    int alpha_compare_en = state[wid].other_modes.alpha_compare_en;
+
+    if (config.dp.generic_spans)
+        return SPAN_GENERIC;
+    if (!z_compare_en && !z_update_en && !alpha_compare_en)
+        return SPAN_NO_Z;
+    if (z_compare_en && z_update_en && z_mode == ZMODE_OPAQUE)
+        return alpha_compare_en ? SPAN_OPAQUE_ACMP : SPAN_OPAQUE;
+    if (z_compare_en && !z_update_en && z_mode == ZMODE_TRANSPARENT && !alpha_compare_en)
+        return SPAN_TRANSLUCENT;
+    return SPAN_GENERIC;
+}
 
-    switch (zanded)
-    {
-        case 0: *z = sz & 0x3ffff;                      break;
-        case 1: *z = sz & 0x3ffff;                      break;
-        case 2: *z = 0x3ffff;                           break;
-        case 3: *z = 0;                                 break;
+#define SPAN_VARIANT(name, suffix, variant) \
+    static void name##_##suffix(uint32_t wid, int start, int end, int tilenum, int flip) \
+    { \
+        name(wid, start, end, tilenum, flip, variant); \
     }
-}
 
-static void render_spans_1cycle_complete(uint32_t wid, int start, int end, int tilenum, int flip)
+#define SPAN_VARIANTS(name) \
+    SPAN_VARIANT(name, generic, SPAN_GENERIC) \
+    SPAN_VARIANT(name, no_z, SPAN_NO_Z) \
+    SPAN_VARIANT(name, opaque, SPAN_OPAQUE) \
+    SPAN_VARIANT(name, opaque_acmp, SPAN_OPAQUE_ACMP) \
+    SPAN_VARIANT(name, translucent, SPAN_TRANSLUCENT) \
+    static void (*const name##_func[SPAN_NUM_VARIANTS])(uint32_t, int, int, int, int) = \
+    { \
+        name##_generic, name##_no_z, name##_opaque, name##_opaque_acmp, name##_translucent \
+    };
+
+static STRICTINLINE void render_spans_1cycle_complete(uint32_t wid, int start, int end, int tilenum, int flip, int variant)
 {
     int zb = state[wid].zb_address >> 1;
     int zbcur;
-    uint8_t offx, offy;
+    struct span_shade shade;
+    int slot;
     struct spansigs sigs;
     uint32_t blend_en;
     uint32_t prewrap;
@@ -229,6 +239,9 @@ static void render_spans_1cycle_complete(uint32_t wid, int start, int end, int t
         xinc = -1;
     }
 
+    int z_compare_en, z_update_en, z_mode, alpha_compare_en;
+    span_variant_modes(wid, variant, &z_compare_en, &z_update_en, &z_mode, &alpha_compare_en);
+
     int dzpix;
     if (!state[wid].other_modes.z_source_sel)
         dzpix = state[wid].spans_dzpix;
@@ -241,7 +254,7 @@ static void render_spans_1cycle_complete(uint32_t wid, int start, int end, int t
 
     int cdith = 7, adith = 0;
     int r, g, b, a, z, s, t, w;
-    int sr, sg, sb, sa, sz, ss, st, sw;
+    int sz, ss, st, sw;
     int xstart, xend, xendsc;
     int sss = 0, sst = 0;
     int32_t prelodfrac;
@@ -306,22 +319,22 @@ static void render_spans_1cycle_complete(uint32_t wid, int start, int end, int t
         sigs.midspan = (lodlength == 7);
         sigs.onelessthanmid = (lodlength == 6);
 
+        span_shade_begin(&shade, r, g, b, a, z, drinc, dginc, dbinc, dainc, dzinc, x, xinc, length);
+
         for (j = 0; j <= length; j++)
         {
-            sr = r >> 14;
-            sg = g >> 14;
-            sb = b >> 14;
-            sa = a >> 14;
             ss = s >> 16;
             st = t >> 16;
             sw = w >> 16;
-            sz = (z >> 10) & 0x3fffff;
 
 
             sigs.endspan = (j == length);
             sigs.preendspan = (j == (length - 1));
 
-            lookup_cvmask_derivatives(state[wid].cvgbuf[x], &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+            slot = span_shade_slot(wid, &shade, j);
+            sz = shade.z_pix[slot];
+            curpixel_cvg = shade.cvg[slot];
+            curpixel_cvbit = shade.cvbit[slot];
 
 
             get_texel1_1cycle(wid, &news, &newt, s, t, w, dsinc, dtinc, dwinc, i, &sigs);
@@ -358,8 +371,7 @@ static void render_spans_1cycle_complete(uint32_t wid, int start, int end, int t
 
             texture_pipeline_cycle(wid, &state[wid].texel1_color, &state[wid].texel1_color, news, newt, newtile, 0);
 
-            rgba_correct(wid, offx, offy, sr, sg, sb, sa, curpixel_cvg);
-            z_correct(wid, offx, offy, &sz, curpixel_cvg);
+            span_shade_color(wid, &shade, slot);
 
             if (state[wid].other_modes.f.getditherlevel < 2)
                 get_dither_noise(wid, x, i, &cdith, &adith);
@@ -367,12 +379,12 @@ static void render_spans_1cycle_complete(uint32_t wid, int start, int end, int t
             combiner_1cycle(wid, adith, &curpixel_cvg);
 
             state[wid].fbread1_ptr(wid, curpixel, &curpixel_memcvg);
-            if (z_compare(wid, zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg))
+            if (z_compare(wid, zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg, z_compare_en, z_mode))
             {
-                if (blender_1cycle(wid, &fir, &fig, &fib, cdith, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
+                if (blender_1cycle(wid, &fir, &fig, &fib, cdith, blend_en, prewrap, curpixel_cvg, curpixel_cvbit, alpha_compare_en))
                 {
                     state[wid].fbwrite_ptr(wid, curpixel, fir, fig, fib, blend_en, curpixel_cvg, curpixel_memcvg);
-                    if (state[wid].other_modes.z_update_en)
+                    if (z_update_en)
                         z_store(zbcur, sz, dzpixenc);
                 }
             }
@@ -380,11 +392,6 @@ static void render_spans_1cycle_complete(uint32_t wid, int start, int end, int t
 
 
 
-            r += drinc;
-            g += dginc;
-            b += dbinc;
-            a += dainc;
-            z += dzinc;
 
             x += xinc;
             curpixel += xinc;
@@ -394,12 +401,15 @@ static void render_spans_1cycle_complete(uint32_t wid, int start, int end, int t
     }
 }
 
+SPAN_VARIANTS(render_spans_1cycle_complete)
 
-static void render_spans_1cycle_notexel1(uint32_t wid, int start, int end, int tilenum, int flip)
+
+static STRICTINLINE void render_spans_1cycle_notexel1(uint32_t wid, int start, int end, int tilenum, int flip, int variant)
 {
     int zb = state[wid].zb_address >> 1;
     int zbcur;
-    uint8_t offx, offy;
+    struct span_shade shade;
+    int slot;
     struct spansigs sigs;
     uint32_t blend_en;
     uint32_t prewrap;
@@ -437,6 +447,9 @@ static void render_spans_1cycle_notexel1(uint32_t wid, int start, int end, int t
         xinc = -1;
     }
 
+    int z_compare_en, z_update_en, z_mode, alpha_compare_en;
+    span_variant_modes(wid, variant, &z_compare_en, &z_update_en, &z_mode, &alpha_compare_en);
+
     int dzpix;
     if (!state[wid].other_modes.z_source_sel)
         dzpix = state[wid].spans_dzpix;
@@ -449,7 +462,7 @@ static void render_spans_1cycle_notexel1(uint32_t wid, int start, int end, int t
 
     int cdith = 7, adith = 0;
     int r, g, b, a, z, s, t, w;
-    int sr, sg, sb, sa, sz, ss, st, sw;
+    int sz, ss, st, sw;
     int xstart, xend, xendsc;
     int sss = 0, sst = 0;
     int curpixel = 0;
@@ -508,23 +521,23 @@ static void render_spans_1cycle_notexel1(uint32_t wid, int start, int end, int t
         sigs.longspan = (lodlength > 7);
         sigs.midspan = (lodlength == 7);
 
+        span_shade_begin(&shade, r, g, b, a, z, drinc, dginc, dbinc, dainc, dzinc, x, xinc, length);
+
         for (j = 0; j <= length; j++)
         {
-            sr = r >> 14;
-            sg = g >> 14;
-            sb = b >> 14;
-            sa = a >> 14;
             ss = s >> 16;
             st = t >> 16;
             sw = w >> 16;
-            sz = (z >> 10) & 0x3fffff;
 
 
 
             sigs.endspan = (j == length);
             sigs.preendspan = (j == (length - 1));
 
-            lookup_cvmask_derivatives(state[wid].cvgbuf[x], &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+            slot = span_shade_slot(wid, &shade, j);
+            sz = shade.z_pix[slot];
+            curpixel_cvg = shade.cvg[slot];
+            curpixel_cvbit = shade.cvbit[slot];
 
             state[wid].tcdiv_ptr(ss, st, sw, &sss, &sst);
 
@@ -532,8 +545,7 @@ static void render_spans_1cycle_notexel1(uint32_t wid, int start, int end, int t
 
             texture_pipeline_cycle(wid, &state[wid].texel0_color, &state[wid].texel0_color, sss, sst, tile1, 0);
 
-            rgba_correct(wid, offx, offy, sr, sg, sb, sa, curpixel_cvg);
-            z_correct(wid, offx, offy, &sz, curpixel_cvg);
+            span_shade_color(wid, &shade, slot);
 
             if (state[wid].other_modes.f.getditherlevel < 2)
                 get_dither_noise(wid, x, i, &cdith, &adith);
@@ -541,12 +553,12 @@ static void render_spans_1cycle_notexel1(uint32_t wid, int start, int end, int t
             combiner_1cycle(wid, adith, &curpixel_cvg);
 
             state[wid].fbread1_ptr(wid, curpixel, &curpixel_memcvg);
-            if (z_compare(wid, zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg))
+            if (z_compare(wid, zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg, z_compare_en, z_mode))
             {
-                if (blender_1cycle(wid, &fir, &fig, &fib, cdith, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
+                if (blender_1cycle(wid, &fir, &fig, &fib, cdith, blend_en, prewrap, curpixel_cvg, curpixel_cvbit, alpha_compare_en))
                 {
                     state[wid].fbwrite_ptr(wid, curpixel, fir, fig, fib, blend_en, curpixel_cvg, curpixel_memcvg);
-                    if (state[wid].other_modes.z_update_en)
+                    if (z_update_en)
                         z_store(zbcur, sz, dzpixenc);
                 }
             }
@@ -554,11 +566,6 @@ static void render_spans_1cycle_notexel1(uint32_t wid, int start, int end, int t
             s += dsinc;
             t += dtinc;
             w += dwinc;
-            r += drinc;
-            g += dginc;
-            b += dbinc;
-            a += dainc;
-            z += dzinc;
 
             x += xinc;
             curpixel += xinc;
@@ -568,12 +575,15 @@ static void render_spans_1cycle_notexel1(uint32_t wid, int start, int end, int t
     }
 }
 
+SPAN_VARIANTS(render_spans_1cycle_notexel1)
+
 
-static void render_spans_1cycle_notex(uint32_t wid, int start, int end, int tilenum, int flip)
+static STRICTINLINE void render_spans_1cycle_notex(uint32_t wid, int start, int end, int tilenum, int flip, int variant)
 {
     int zb = state[wid].zb_address >> 1;
     int zbcur;
-    uint8_t offx, offy;
+    struct span_shade shade;
+    int slot;
     uint32_t blend_en;
     uint32_t prewrap;
     uint32_t curpixel_cvg, curpixel_cvbit, curpixel_memcvg;
@@ -602,6 +612,9 @@ static void render_spans_1cycle_notex(uint32_t wid, int start, int end, int tile
         xinc = -1;
     }
 
+    int z_compare_en, z_update_en, z_mode, alpha_compare_en;
+    span_variant_modes(wid, variant, &z_compare_en, &z_update_en, &z_mode, &alpha_compare_en);
+
     int dzpix;
     if (!state[wid].other_modes.z_source_sel)
         dzpix = state[wid].spans_dzpix;
@@ -614,7 +627,7 @@ static void render_spans_1cycle_notex(uint32_t wid, int start, int end, int tile
 
     int cdith = 7, adith = 0;
     int r, g, b, a, z;
-    int sr, sg, sb, sa, sz;
+    int sz;
     int xstart, xend, xendsc;
     int curpixel = 0;
     int x, length, scdiff;
@@ -661,18 +674,17 @@ static void render_spans_1cycle_notex(uint32_t wid, int start, int end, int tile
             z += (dzinc * scdiff);
         }
 
+        span_shade_begin(&shade, r, g, b, a, z, drinc, dginc, dbinc, dainc, dzinc, x, xinc, length);
+
         for (j = 0; j <= length; j++)
         {
-            sr = r >> 14;
-            sg = g >> 14;
-            sb = b >> 14;
-            sa = a >> 14;
-            sz = (z >> 10) & 0x3fffff;
 
-            lookup_cvmask_derivatives(state[wid].cvgbuf[x], &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+            slot = span_shade_slot(wid, &shade, j);
+            sz = shade.z_pix[slot];
+            curpixel_cvg = shade.cvg[slot];
+            curpixel_cvbit = shade.cvbit[slot];
 
-            rgba_correct(wid, offx, offy, sr, sg, sb, sa, curpixel_cvg);
-            z_correct(wid, offx, offy, &sz, curpixel_cvg);
+            span_shade_color(wid, &shade, slot);
 
             if (state[wid].other_modes.f.getditherlevel < 2)
                 get_dither_noise(wid, x, i, &cdith, &adith);
@@ -680,20 +692,15 @@ static void render_spans_1cycle_notex(uint32_t wid, int start, int end, int tile
             combiner_1cycle(wid, adith, &curpixel_cvg);
 
             state[wid].fbread1_ptr(wid, curpixel, &curpixel_memcvg);
-            if (z_compare(wid, zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg))
+            if (z_compare(wid, zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg, z_compare_en, z_mode))
             {
-                if (blender_1cycle(wid, &fir, &fig, &fib, cdith, blend_en, prewrap, curpixel_cvg, curpixel_cvbit))
+                if (blender_1cycle(wid, &fir, &fig, &fib, cdith, blend_en, prewrap, curpixel_cvg, curpixel_cvbit, alpha_compare_en))
                 {
                     state[wid].fbwrite_ptr(wid, curpixel, fir, fig, fib, blend_en, curpixel_cvg, curpixel_memcvg);
-                    if (state[wid].other_modes.z_update_en)
+                    if (z_update_en)
                         z_store(zbcur, sz, dzpixenc);
                 }
             }
-            r += drinc;
-            g += dginc;
-            b += dbinc;
-            a += dainc;
-            z += dzinc;
 
             x += xinc;
             curpixel += xinc;
@@ -703,11 +710,15 @@ static void render_spans_1cycle_notex(uint32_t wid, int start, int end, int tile
     }
 }
 
-static void render_spans_2cycle_complete(uint32_t wid, int start, int end, int tilenum, int flip)
+SPAN_VARIANTS(render_spans_1cycle_notex)
+
+
+static STRICTINLINE void render_spans_2cycle_complete(uint32_t wid, int start, int end, int tilenum, int flip, int variant)
 {
     int zb = state[wid].zb_address >> 1;
     int zbcur;
-    uint8_t offx, offy;
+    struct span_shade shade;
+    int slot;
     int32_t prelodfrac;
     struct color nexttexel1_color;
     uint32_t blend_en;
@@ -752,6 +763,9 @@ static void render_spans_2cycle_complete(uint32_t wid, int start, int end, int t
         xinc = -1;
     }
 
+    int z_compare_en, z_update_en, z_mode, alpha_compare_en;
+    span_variant_modes(wid, variant, &z_compare_en, &z_update_en, &z_mode, &alpha_compare_en);
+
     int dzpix;
     if (!state[wid].other_modes.z_source_sel)
         dzpix = state[wid].spans_dzpix;
@@ -765,7 +779,7 @@ static void render_spans_2cycle_complete(uint32_t wid, int start, int end, int t
     int cdith = 7, adith = 0;
 
     int r, g, b, a, z, s, t, w;
-    int sr, sg, sb, sa, sz, ss, st, sw;
+    int sz, ss, st, sw;
     int xstart, xend, xendsc;
     int sss = 0, sst = 0;
     int curpixel = 0;
@@ -830,16 +844,15 @@ static void render_spans_2cycle_complete(uint32_t wid, int start, int end, int t
 
         lodlength = length + scdiff;
 
+        span_shade_begin(&shade, r, g, b, a, z, drinc, dginc, dbinc, dainc, dzinc, x, xinc, length);
+
         for (j = 0; j <= length; j++)
         {
-            sz = (z >> 10) & 0x3fffff;
+            slot = span_shade_slot(wid, &shade, j);
+            sz = shade.z_pix[slot];
 
             if (!j)
             {
-                sr = r >> 14;
-                sg = g >> 14;
-                sb = b >> 14;
-                sa = a >> 14;
                 ss = s >> 16;
                 st = t >> 16;
                 sw = w >> 16;
@@ -851,9 +864,10 @@ static void render_spans_2cycle_complete(uint32_t wid, int start, int end, int t
                 texture_pipeline_cycle(wid, &state[wid].texel0_color, &state[wid].texel0_color, sss, sst, tile1, 0);
                 texture_pipeline_cycle(wid, &state[wid].texel1_color, &state[wid].texel0_color, sss, sst, tile2, 1);
 
-                lookup_cvmask_derivatives(state[wid].cvgbuf[x], &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+                curpixel_cvg = shade.cvg[slot];
+                curpixel_cvbit = shade.cvbit[slot];
 
-                rgba_correct(wid, offx, offy, sr, sg, sb, sa, curpixel_cvg);
+                span_shade_color(wid, &shade, slot);
 
                 if (state[wid].other_modes.f.getditherlevel < 2)
                     get_dither_noise(wid, x, i, &cdith, &adith);
@@ -895,14 +909,13 @@ static void render_spans_2cycle_complete(uint32_t wid, int start, int end, int t
                 texture_pipeline_cycle(wid, &nexttexel1_color, &state[wid].nexttexel_color, sss2, sst2, tile3, 0);
             }
 
-            z_correct(wid, offx, offy, &sz, curpixel_cvg);
 
             combiner_2cycle_cycle1(wid, adith, &curpixel_cvg);
 
             state[wid].fbread2_ptr(wid, curpixel, &curpixel_memcvg);
 
 
-            wen = z_compare(wid, zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+            wen = z_compare(wid, zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg, z_compare_en, z_mode);
 
             if (wen)
                 wen &= blender_2cycle_cycle0(wid, curpixel_cvg, curpixel_cvbit);
@@ -916,22 +929,16 @@ static void render_spans_2cycle_complete(uint32_t wid, int start, int end, int t
 
             x += xinc;
 
-            r += drinc;
-            g += dginc;
-            b += dbinc;
-            a += dainc;
 
-            sr = r >> 14;
-            sg = g >> 14;
-            sb = b >> 14;
-            sa = a >> 14;
 
 
 
 
-            lookup_cvmask_derivatives(j < length ? state[wid].cvgbuf[x] : 0, &offx, &offy, &nextpixel_cvg, &curpixel_cvbit);
+            slot = span_shade_slot(wid, &shade, j + 1);
+            nextpixel_cvg = shade.cvg[slot];
+            curpixel_cvbit = shade.cvbit[slot];
 
-            rgba_correct(wid, offx, offy, sr, sg, sb, sa, nextpixel_cvg);
+            span_shade_color(wid, &shade, slot);
 
             state[wid].lod_frac = prelodfrac;
             state[wid].texel0_color = state[wid].nexttexel_color;
@@ -942,7 +949,7 @@ static void render_spans_2cycle_complete(uint32_t wid, int start, int end, int t
 
             if (wen)
             {
-                wen &= alpha_compare(wid, acalpha);
+                wen &= alpha_compare(wid, acalpha, alpha_compare_en);
 
 
 
@@ -951,7 +958,7 @@ static void render_spans_2cycle_complete(uint32_t wid, int start, int end, int t
                 {
                     blender_2cycle_cycle1(wid, &fir, &fig, &fib, cdith, blend_en, prewrap);
                     state[wid].fbwrite_ptr(wid, curpixel, fir, fig, fib, blend_en, curpixel_cvg, curpixel_memcvg);
-                    if (state[wid].other_modes.z_update_en)
+                    if (z_update_en)
                         z_store(zbcur, sz, dzpixenc);
                 }
             }
@@ -966,7 +973,6 @@ static void render_spans_2cycle_complete(uint32_t wid, int start, int end, int t
 
 
 
-            z += dzinc;
 
             curpixel += xinc;
             zbcur += xinc;
@@ -975,13 +981,15 @@ static void render_spans_2cycle_complete(uint32_t wid, int start, int end, int t
     }
 }
 
+SPAN_VARIANTS(render_spans_2cycle_complete)
 
 
-static void render_spans_2cycle_notexelnext(uint32_t wid, int start, int end, int tilenum, int flip)
+static STRICTINLINE void render_spans_2cycle_notexelnext(uint32_t wid, int start, int end, int tilenum, int flip, int variant)
 {
     int zb = state[wid].zb_address >> 1;
     int zbcur;
-    uint8_t offx, offy;
+    struct span_shade shade;
+    int slot;
     uint32_t blend_en;
     uint32_t prewrap;
     uint32_t curpixel_cvg, curpixel_cvbit, curpixel_memcvg;
@@ -1021,6 +1029,9 @@ static void render_spans_2cycle_notexelnext(uint32_t wid, int start, int end, in
         xinc = -1;
     }
 
+    int z_compare_en, z_update_en, z_mode, alpha_compare_en;
+    span_variant_modes(wid, variant, &z_compare_en, &z_update_en, &z_mode, &alpha_compare_en);
+
     int dzpix;
     if (!state[wid].other_modes.z_source_sel)
         dzpix = state[wid].spans_dzpix;
@@ -1034,7 +1045,7 @@ static void render_spans_2cycle_notexelnext(uint32_t wid, int start, int end, in
     int cdith = 7, adith = 0;
 
     int r, g, b, a, z, s, t, w;
-    int sr, sg, sb, sa, sz, ss, st, sw;
+    int sz, ss, st, sw;
     int xstart, xend, xendsc;
     int sss = 0, sst = 0;
     int curpixel = 0;
@@ -1090,16 +1101,15 @@ static void render_spans_2cycle_notexelnext(uint32_t wid, int start, int end, in
             w += (dwinc * scdiff);
         }
 
+        span_shade_begin(&shade, r, g, b, a, z, drinc, dginc, dbinc, dainc, dzinc, x, xinc, length);
+
         for (j = 0; j <= length; j++)
         {
-            sz = (z >> 10) & 0x3fffff;
+            slot = span_shade_slot(wid, &shade, j);
+            sz = shade.z_pix[slot];
 
             if (!j)
             {
-                sr = r >> 14;
-                sg = g >> 14;
-                sb = b >> 14;
-                sa = a >> 14;
                 ss = s >> 16;
                 st = t >> 16;
                 sw = w >> 16;
@@ -1111,9 +1121,10 @@ static void render_spans_2cycle_notexelnext(uint32_t wid, int start, int end, in
                 texture_pipeline_cycle(wid, &state[wid].texel0_color, &state[wid].texel0_color, sss, sst, tile1, 0);
                 texture_pipeline_cycle(wid, &state[wid].texel1_color, &state[wid].texel0_color, sss, sst, tile2, 1);
 
-                lookup_cvmask_derivatives(state[wid].cvgbuf[x], &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+                curpixel_cvg = shade.cvg[slot];
+                curpixel_cvbit = shade.cvbit[slot];
 
-                rgba_correct(wid, offx, offy, sr, sg, sb, sa, curpixel_cvg);
+                span_shade_color(wid, &shade, slot);
 
                 if (state[wid].other_modes.f.getditherlevel < 2)
                     get_dither_noise(wid, x, i, &cdith, &adith);
@@ -1121,13 +1132,12 @@ static void render_spans_2cycle_notexelnext(uint32_t wid, int start, int end, in
                 combiner_2cycle_cycle0(wid, adith, curpixel_cvg, &acalpha);
             }
 
-            z_correct(wid, offx, offy, &sz, curpixel_cvg);
 
             combiner_2cycle_cycle1(wid, adith, &curpixel_cvg);
 
             state[wid].fbread2_ptr(wid, curpixel, &curpixel_memcvg);
 
-            wen = z_compare(wid, zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+            wen = z_compare(wid, zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg, z_compare_en, z_mode);
 
             if (wen)
                 wen &= blender_2cycle_cycle0(wid, curpixel_cvg, curpixel_cvbit);
@@ -1136,25 +1146,19 @@ static void render_spans_2cycle_notexelnext(uint32_t wid, int start, int end, in
 
             x += xinc;
 
-            r += drinc;
-            g += dginc;
-            b += dbinc;
-            a += dainc;
             s += dsinc;
             t += dtinc;
             w += dwinc;
 
-            sr = r >> 14;
-            sg = g >> 14;
-            sb = b >> 14;
-            sa = a >> 14;
             ss = s >> 16;
             st = t >> 16;
             sw = w >> 16;
 
-            lookup_cvmask_derivatives(j < length ? state[wid].cvgbuf[x] : 0, &offx, &offy, &nextpixel_cvg, &curpixel_cvbit);
+            slot = span_shade_slot(wid, &shade, j + 1);
+            nextpixel_cvg = shade.cvg[slot];
+            curpixel_cvbit = shade.cvbit[slot];
 
-            rgba_correct(wid, offx, offy, sr, sg, sb, sa, nextpixel_cvg);
+            span_shade_color(wid, &shade, slot);
 
             state[wid].tcdiv_ptr(ss, st, sw, &sss, &sst);
 
@@ -1167,13 +1171,13 @@ static void render_spans_2cycle_notexelnext(uint32_t wid, int start, int end, in
 
             if (wen)
             {
-                wen &= alpha_compare(wid, acalpha);
+                wen &= alpha_compare(wid, acalpha, alpha_compare_en);
 
                 if (wen)
                 {
                     blender_2cycle_cycle1(wid, &fir, &fig, &fib, cdith, blend_en, prewrap);
                     state[wid].fbwrite_ptr(wid, curpixel, fir, fig, fib, blend_en, curpixel_cvg, curpixel_memcvg);
-                    if (state[wid].other_modes.z_update_en)
+                    if (z_update_en)
                         z_store(zbcur, sz, dzpixenc);
                 }
             }
@@ -1183,7 +1187,6 @@ static void render_spans_2cycle_notexelnext(uint32_t wid, int start, int end, in
 
             curpixel_cvg = nextpixel_cvg;
 
-            z += dzinc;
 
             curpixel += xinc;
             zbcur += xinc;
@@ -1192,12 +1195,15 @@ static void render_spans_2cycle_notexelnext(uint32_t wid, int start, int end, in
     }
 }
 
+SPAN_VARIANTS(render_spans_2cycle_notexelnext)
 
-static void render_spans_2cycle_notexel1(uint32_t wid, int start, int end, int tilenum, int flip)
+
+static STRICTINLINE void render_spans_2cycle_notexel1(uint32_t wid, int start, int end, int tilenum, int flip, int variant)
 {
     int zb = state[wid].zb_address >> 1;
     int zbcur;
-    uint8_t offx, offy;
+    struct span_shade shade;
+    int slot;
     uint32_t blend_en;
     uint32_t prewrap;
     uint32_t curpixel_cvg, curpixel_cvbit, curpixel_memcvg;
@@ -1236,6 +1242,9 @@ static void render_spans_2cycle_notexel1(uint32_t wid, int start, int end, int t
         xinc = -1;
     }
 
+    int z_compare_en, z_update_en, z_mode, alpha_compare_en;
+    span_variant_modes(wid, variant, &z_compare_en, &z_update_en, &z_mode, &alpha_compare_en);
+
     int dzpix;
     if (!state[wid].other_modes.z_source_sel)
         dzpix = state[wid].spans_dzpix;
@@ -1249,7 +1258,7 @@ static void render_spans_2cycle_notexel1(uint32_t wid, int start, int end, int t
     int cdith = 7, adith = 0;
 
     int r, g, b, a, z, s, t, w;
-    int sr, sg, sb, sa, sz, ss, st, sw;
+    int sz, ss, st, sw;
     int xstart, xend, xendsc;
     int sss = 0, sst = 0;
     int curpixel = 0;
@@ -1305,16 +1314,15 @@ static void render_spans_2cycle_notexel1(uint32_t wid, int start, int end, int t
             w += (dwinc * scdiff);
         }
 
+        span_shade_begin(&shade, r, g, b, a, z, drinc, dginc, dbinc, dainc, dzinc, x, xinc, length);
+
         for (j = 0; j <= length; j++)
         {
-            sz = (z >> 10) & 0x3fffff;
+            slot = span_shade_slot(wid, &shade, j);
+            sz = shade.z_pix[slot];
 
             if (!j)
             {
-                sr = r >> 14;
-                sg = g >> 14;
-                sb = b >> 14;
-                sa = a >> 14;
                 ss = s >> 16;
                 st = t >> 16;
                 sw = w >> 16;
@@ -1325,9 +1333,10 @@ static void render_spans_2cycle_notexel1(uint32_t wid, int start, int end, int t
 
                 texture_pipeline_cycle(wid, &state[wid].texel0_color, &state[wid].texel0_color, sss, sst, tile1, 0);
 
-                lookup_cvmask_derivatives(state[wid].cvgbuf[x], &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+                curpixel_cvg = shade.cvg[slot];
+                curpixel_cvbit = shade.cvbit[slot];
 
-                rgba_correct(wid, offx, offy, sr, sg, sb, sa, curpixel_cvg);
+                span_shade_color(wid, &shade, slot);
 
                 if (state[wid].other_modes.f.getditherlevel < 2)
                     get_dither_noise(wid, x, i, &cdith, &adith);
@@ -1335,13 +1344,12 @@ static void render_spans_2cycle_notexel1(uint32_t wid, int start, int end, int t
                 combiner_2cycle_cycle0(wid, adith, curpixel_cvg, &acalpha);
             }
 
-            z_correct(wid, offx, offy, &sz, curpixel_cvg);
 
             combiner_2cycle_cycle1(wid, adith, &curpixel_cvg);
 
             state[wid].fbread2_ptr(wid, curpixel, &curpixel_memcvg);
 
-            wen = z_compare(wid, zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+            wen = z_compare(wid, zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg, z_compare_en, z_mode);
 
             if (wen)
                 wen &= blender_2cycle_cycle0(wid, curpixel_cvg, curpixel_cvbit);
@@ -1350,25 +1358,19 @@ static void render_spans_2cycle_notexel1(uint32_t wid, int start, int end, int t
 
             x += xinc;
 
-            r += drinc;
-            g += dginc;
-            b += dbinc;
-            a += dainc;
             s += dsinc;
             t += dtinc;
             w += dwinc;
 
-            sr = r >> 14;
-            sg = g >> 14;
-            sb = b >> 14;
-            sa = a >> 14;
             ss = s >> 16;
             st = t >> 16;
             sw = w >> 16;
 
-            lookup_cvmask_derivatives(j < length ? state[wid].cvgbuf[x] : 0, &offx, &offy, &nextpixel_cvg, &curpixel_cvbit);
+            slot = span_shade_slot(wid, &shade, j + 1);
+            nextpixel_cvg = shade.cvg[slot];
+            curpixel_cvbit = shade.cvbit[slot];
 
-            rgba_correct(wid, offx, offy, sr, sg, sb, sa, nextpixel_cvg);
+            span_shade_color(wid, &shade, slot);
 
             state[wid].tcdiv_ptr(ss, st, sw, &sss, &sst);
 
@@ -1380,13 +1382,13 @@ static void render_spans_2cycle_notexel1(uint32_t wid, int start, int end, int t
 
             if (wen)
             {
-                wen &= alpha_compare(wid, acalpha);
+                wen &= alpha_compare(wid, acalpha, alpha_compare_en);
 
                 if (wen)
                 {
                     blender_2cycle_cycle1(wid, &fir, &fig, &fib, cdith, blend_en, prewrap);
                     state[wid].fbwrite_ptr(wid, curpixel, fir, fig, fib, blend_en, curpixel_cvg, curpixel_memcvg);
-                    if (state[wid].other_modes.z_update_en)
+                    if (z_update_en)
                         z_store(zbcur, sz, dzpixenc);
                 }
             }
@@ -1396,7 +1398,6 @@ static void render_spans_2cycle_notexel1(uint32_t wid, int start, int end, int t
 
             curpixel_cvg = nextpixel_cvg;
 
-            z += dzinc;
 
             curpixel += xinc;
             zbcur += xinc;
@@ -1405,12 +1406,15 @@ static void render_spans_2cycle_notexel1(uint32_t wid, int start, int end, int t
     }
 }
 
+SPAN_VARIANTS(render_spans_2cycle_notexel1)
 
-static void render_spans_2cycle_notex(uint32_t wid, int start, int end, int tilenum, int flip)
+
+static STRICTINLINE void render_spans_2cycle_notex(uint32_t wid, int start, int end, int tilenum, int flip, int variant)
 {
     int zb = state[wid].zb_address >> 1;
     int zbcur;
-    uint8_t offx, offy;
+    struct span_shade shade;
+    int slot;
     uint32_t blend_en;
     uint32_t prewrap;
     uint32_t curpixel_cvg, curpixel_cvbit, curpixel_memcvg;
@@ -1440,6 +1444,9 @@ static void render_spans_2cycle_notex(uint32_t wid, int start, int end, int tile
         xinc = -1;
     }
 
+    int z_compare_en, z_update_en, z_mode, alpha_compare_en;
+    span_variant_modes(wid, variant, &z_compare_en, &z_update_en, &z_mode, &alpha_compare_en);
+
     int dzpix;
     if (!state[wid].other_modes.z_source_sel)
         dzpix = state[wid].spans_dzpix;
@@ -1453,7 +1460,7 @@ static void render_spans_2cycle_notex(uint32_t wid, int start, int end, int tile
     int cdith = 7, adith = 0;
 
     int r, g, b, a, z;
-    int sr, sg, sb, sa, sz;
+    int sz;
     int xstart, xend, xendsc;
     int curpixel = 0;
     int wen;
@@ -1502,20 +1509,19 @@ static void render_spans_2cycle_notex(uint32_t wid, int start, int end, int tile
             z += (dzinc * scdiff);
         }
 
+        span_shade_begin(&shade, r, g, b, a, z, drinc, dginc, dbinc, dainc, dzinc, x, xinc, length);
+
         for (j = 0; j <= length; j++)
         {
-            sz = (z >> 10) & 0x3fffff;
+            slot = span_shade_slot(wid, &shade, j);
+            sz = shade.z_pix[slot];
 
             if (!j)
             {
-                sr = r >> 14;
-                sg = g >> 14;
-                sb = b >> 14;
-                sa = a >> 14;
-
-                lookup_cvmask_derivatives(state[wid].cvgbuf[x], &offx, &offy, &curpixel_cvg, &curpixel_cvbit);
+                curpixel_cvg = shade.cvg[slot];
+                curpixel_cvbit = shade.cvbit[slot];
 
-                rgba_correct(wid, offx, offy, sr, sg, sb, sa, curpixel_cvg);
+                span_shade_color(wid, &shade, slot);
 
                 if (state[wid].other_modes.f.getditherlevel < 2)
                     get_dither_noise(wid, x, i, &cdith, &adith);
@@ -1523,13 +1529,12 @@ static void render_spans_2cycle_notex(uint32_t wid, int start, int end, int tile
                 combiner_2cycle_cycle0(wid, adith, curpixel_cvg, &acalpha);
             }
 
-            z_correct(wid, offx, offy, &sz, curpixel_cvg);
 
             combiner_2cycle_cycle1(wid, adith, &curpixel_cvg);
 
             state[wid].fbread2_ptr(wid, curpixel, &curpixel_memcvg);
 
-            wen = z_compare(wid, zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg);
+            wen = z_compare(wid, zbcur, sz, dzpix, dzpixenc, &blend_en, &prewrap, &curpixel_cvg, curpixel_memcvg, z_compare_en, z_mode);
 
             if (wen)
                 wen &= blender_2cycle_cycle0(wid, curpixel_cvg, curpixel_cvbit);
@@ -1538,31 +1543,25 @@ static void render_spans_2cycle_notex(uint32_t wid, int start, int end, int tile
 
             x += xinc;
 
-            r += drinc;
-            g += dginc;
-            b += dbinc;
-            a += dainc;
 
-            sr = r >> 14;
-            sg = g >> 14;
-            sb = b >> 14;
-            sa = a >> 14;
 
-            lookup_cvmask_derivatives(j < length ? state[wid].cvgbuf[x] : 0, &offx, &offy, &nextpixel_cvg, &curpixel_cvbit);
+            slot = span_shade_slot(wid, &shade, j + 1);
+            nextpixel_cvg = shade.cvg[slot];
+            curpixel_cvbit = shade.cvbit[slot];
 
-            rgba_correct(wid, offx, offy, sr, sg, sb, sa, nextpixel_cvg);
+            span_shade_color(wid, &shade, slot);
 
             combiner_2cycle_cycle0(wid, adith, nextpixel_cvg, &acalpha);
 
             if (wen)
             {
-                wen &= alpha_compare(wid, acalpha);
+                wen &= alpha_compare(wid, acalpha, alpha_compare_en);
 
                 if (wen)
                 {
                     blender_2cycle_cycle1(wid, &fir, &fig, &fib, cdith, blend_en, prewrap);
                     state[wid].fbwrite_ptr(wid, curpixel, fir, fig, fib, blend_en, curpixel_cvg, curpixel_memcvg);
-                    if (state[wid].other_modes.z_update_en)
+                    if (z_update_en)
                         z_store(zbcur, sz, dzpixenc);
                 }
             }
@@ -1572,7 +1571,6 @@ static void render_spans_2cycle_notex(uint32_t wid, int start, int end, int tile
 
             curpixel_cvg = nextpixel_cvg;
 
-            z += dzinc;
 
             curpixel += xinc;
             zbcur += xinc;
@@ -1581,6 +1579,8 @@ static void render_spans_2cycle_notex(uint32_t wid, int start, int end, int tile
     }
 }
 
+SPAN_VARIANTS(render_spans_2cycle_notex)
+
 
 static void render_spans_fill(uint32_t wid, int start, int end, int flip)
 {
@@ -1821,6 +1821,19 @@ static void render_spans_copy(uint32_t wid, int start, int end, int tilenum, int
     }
 }
 
+static void span_count_pixels(uint32_t wid, int start, int end, int flip)
+{
+    int i, length;
+    for (i = start; i <= end; i++) {
+        if (state[wid].span[i].validline) {
+            length = flip ? (state[wid].span[i].lx - state[wid].span[i].rx) : (state[wid].span[i].rx - state[wid].span[i].lx);
+            if (length >= 0) {
+                rdp_stats[wid].pixels += length + 1;
+            }
+        }
+    }
+}
+
 static void edgewalker_for_prims(uint32_t wid, int32_t* ewdata)
 {
     int j = 0;
@@ -2277,26 +2290,27 @@ static void edgewalker_for_prims(uint32_t wid, int32_t* ewdata)
     }
     }
 
-
-
+    if (config.dp.stats) {
+        span_count_pixels(wid, yhlimit >> 2, yllimit >> 2, flip);
+    }
 
     switch(state[wid].other_modes.cycle_type)
     {
         case CYCLE_TYPE_1:
             switch (state[wid].other_modes.f.textureuselevel0)
             {
-                case 0: render_spans_1cycle_complete(wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
-                case 1: render_spans_1cycle_notexel1(wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
-                case 2: default: render_spans_1cycle_notex(wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
+                case 0: render_spans_1cycle_complete_func[state[wid].other_modes.f.span_variant](wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
+                case 1: render_spans_1cycle_notexel1_func[state[wid].other_modes.f.span_variant](wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
+                case 2: default: render_spans_1cycle_notex_func[state[wid].other_modes.f.span_variant](wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
             }
             break;
         case CYCLE_TYPE_2:
             switch (state[wid].other_modes.f.textureuselevel1)
             {
-                case 0: render_spans_2cycle_complete(wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
-                case 1: render_spans_2cycle_notexelnext(wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
-                case 2: render_spans_2cycle_notexel1(wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
-                case 3: default: render_spans_2cycle_notex(wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
+                case 0: render_spans_2cycle_complete_func[state[wid].other_modes.f.span_variant](wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
+                case 1: render_spans_2cycle_notexelnext_func[state[wid].other_modes.f.span_variant](wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
+                case 2: render_spans_2cycle_notexel1_func[state[wid].other_modes.f.span_variant](wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
+                case 3: default: render_spans_2cycle_notex_func[state[wid].other_modes.f.span_variant](wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
             }
             break;
         case CYCLE_TYPE_COPY: render_spans_copy(wid, yhlimit >> 2, yllimit >> 2, tilenum, flip); break;
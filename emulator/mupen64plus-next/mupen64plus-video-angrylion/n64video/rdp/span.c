@@ -0,0 +1,333 @@
+// number of pixels whose shade color and depth are computed at once
+#define SPAN_BATCH 8
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define SPAN_SIMD_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define SPAN_TARGET(isa)
+#else
+#define SPAN_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+// Walks the pixels of a span, the attributes that only depend on the
+// position and coverage of a pixel are computed ahead of the pixel pipeline,
+// a batch of SPAN_BATCH pixels at a time.
+struct span_shade
+{
+    // attributes at the first pixel and their per pixel increments
+    int32_t r, g, b, a, z;
+    int32_t dr, dg, db, da, dz;
+
+    int x, xinc, length;
+
+    // index of the first pixel of the batch
+    int base;
+
+    int32_t shade_r[SPAN_BATCH];
+    int32_t shade_g[SPAN_BATCH];
+    int32_t shade_b[SPAN_BATCH];
+    int32_t shade_a[SPAN_BATCH];
+    int32_t z_pix[SPAN_BATCH];
+    uint32_t cvg[SPAN_BATCH];
+    uint32_t cvbit[SPAN_BATCH];
+};
+
+static void (*span_shade_batch)(uint32_t wid, struct span_shade* shade, int32_t* offx, int32_t* offy);
+
+static STRICTINLINE void rgba_correct(uint32_t wid, int offx, int offy, int r, int g, int b, int a, uint32_t cvg, struct color* shade_color)
+{
+    int summand_r, summand_b, summand_g, summand_a;
+
+
+
+    if (cvg == 8)
+    {
+        r >>= 2;
+        g >>= 2;
+        b >>= 2;
+        a >>= 2;
+    }
+    else
+    {
+        summand_r = offx * state[wid].spans_cdr + offy * state[wid].spans_drdy;
+        summand_g = offx * state[wid].spans_cdg + offy * state[wid].spans_dgdy;
+        summand_b = offx * state[wid].spans_cdb + offy * state[wid].spans_dbdy;
+        summand_a = offx * state[wid].spans_cda + offy * state[wid].spans_dady;
+
+        r = ((r << 2) + summand_r) >> 4;
+        g = ((g << 2) + summand_g) >> 4;
+        b = ((b << 2) + summand_b) >> 4;
+        a = ((a << 2) + summand_a) >> 4;
+    }
+
+
+    shade_color->r = special_9bit_clamptable[r & 0x1ff];
+    shade_color->g = special_9bit_clamptable[g & 0x1ff];
+    shade_color->b = special_9bit_clamptable[b & 0x1ff];
+    shade_color->a = special_9bit_clamptable[a & 0x1ff];
+}
+
+static STRICTINLINE void z_correct(uint32_t wid, int offx, int offy, int* z, uint32_t cvg)
+{
+    int summand_z;
+    int sz = *z;
+    int zanded;
+
+
+
+    if (cvg == 8)
+        sz = sz >> 3;
+    else
+    {
+        summand_z = offx * state[wid].spans_cdz + offy * state[wid].spans_dzdy;
+
+        sz = ((sz << 2) + summand_z) >> 5;
+    }
+
+
+
+    zanded = (sz & 0x60000) >> 17;
+
+
+    switch (zanded)
+    {
+        case 0: *z = sz & 0x3ffff;                      break;
+        case 1: *z = sz & 0x3ffff;                      break;
+        case 2: *z = 0x3ffff;                           break;
+        case 3: *z = 0;                                 break;
+    }
+}
+
+static void span_shade_batch_c(uint32_t wid, struct span_shade* shade, int32_t* offx, int32_t* offy)
+{
+    struct color c;
+    int k;
+
+    for (k = 0; k < SPAN_BATCH; k++)
+    {
+        uint32_t p = shade->base + k;
+        int sz = ((int32_t)(shade->z + p * shade->dz) >> 10) & 0x3fffff;
+
+        rgba_correct(wid, offx[k], offy[k],
+                     (int32_t)(shade->r + p * shade->dr) >> 14,
+                     (int32_t)(shade->g + p * shade->dg) >> 14,
+                     (int32_t)(shade->b + p * shade->db) >> 14,
+                     (int32_t)(shade->a + p * shade->da) >> 14,
+                     shade->cvg[k], &c);
+        z_correct(wid, offx[k], offy[k], &sz, shade->cvg[k]);
+
+        shade->shade_r[k] = c.r;
+        shade->shade_g[k] = c.g;
+        shade->shade_b[k] = c.b;
+        shade->shade_a[k] = c.a;
+        shade->z_pix[k] = sz;
+    }
+}
+
+#ifdef SPAN_SIMD_X86
+// same as rgba_correct for one color component of 4 pixels
+SPAN_TARGET("sse4.1")
+static INLINE __m128i rgba_correct_sse41(__m128i c, __m128i full, __m128i offx, __m128i offy, int32_t cd, int32_t dy)
+{
+    __m128i summand = _mm_add_epi32(_mm_mullo_epi32(offx, _mm_set1_epi32(cd)), _mm_mullo_epi32(offy, _mm_set1_epi32(dy)));
+    __m128i partial = _mm_srai_epi32(_mm_add_epi32(_mm_slli_epi32(c, 2), summand), 4);
+    __m128i zero;
+
+    c = _mm_blendv_epi8(partial, _mm_srai_epi32(c, 2), full);
+    c = _mm_and_si128(c, _mm_set1_epi32(0x1ff));
+
+    // 0x100-0x17f clamps to 0xff, 0x180-0x1ff to 0
+    zero = _mm_cmpgt_epi32(c, _mm_set1_epi32(0x17f));
+    c = _mm_blendv_epi8(c, _mm_set1_epi32(0xff), _mm_cmpgt_epi32(c, _mm_set1_epi32(0xff)));
+    return _mm_andnot_si128(zero, c);
+}
+
+SPAN_TARGET("sse4.1")
+static void span_shade_batch_sse41(uint32_t wid, struct span_shade* shade, int32_t* offx, int32_t* offy)
+{
+    int k;
+
+    for (k = 0; k < SPAN_BATCH; k += 4)
+    {
+        __m128i p = _mm_add_epi32(_mm_set1_epi32(shade->base + k), _mm_setr_epi32(0, 1, 2, 3));
+        __m128i ox = _mm_loadu_si128((const __m128i*)&offx[k]);
+        __m128i oy = _mm_loadu_si128((const __m128i*)&offy[k]);
+        __m128i cvg = _mm_loadu_si128((const __m128i*)&shade->cvg[k]);
+        __m128i full = _mm_cmpeq_epi32(cvg, _mm_set1_epi32(8));
+        __m128i c, z, zanded;
+
+#define SPAN_COLOR(comp, cd, dy) \
+        c = _mm_add_epi32(_mm_set1_epi32(shade->comp), _mm_mullo_epi32(p, _mm_set1_epi32(shade->d##comp))); \
+        c = rgba_correct_sse41(_mm_srai_epi32(c, 14), full, ox, oy, state[wid].cd, state[wid].dy); \
+        _mm_storeu_si128((__m128i*)&shade->shade_##comp[k], c);
+
+        SPAN_COLOR(r, spans_cdr, spans_drdy);
+        SPAN_COLOR(g, spans_cdg, spans_dgdy);
+        SPAN_COLOR(b, spans_cdb, spans_dbdy);
+        SPAN_COLOR(a, spans_cda, spans_dady);
+#undef SPAN_COLOR
+
+        // same as z_correct
+        z = _mm_add_epi32(_mm_set1_epi32(shade->z), _mm_mullo_epi32(p, _mm_set1_epi32(shade->dz)));
+        z = _mm_and_si128(_mm_srai_epi32(z, 10), _mm_set1_epi32(0x3fffff));
+        c = _mm_add_epi32(_mm_mullo_epi32(ox, _mm_set1_epi32(state[wid].spans_cdz)), _mm_mullo_epi32(oy, _mm_set1_epi32(state[wid].spans_dzdy)));
+        z = _mm_blendv_epi8(_mm_srai_epi32(_mm_add_epi32(_mm_slli_epi32(z, 2), c), 5), _mm_srai_epi32(z, 3), full);
+
+        zanded = _mm_and_si128(z, _mm_set1_epi32(0x60000));
+        z = _mm_and_si128(z, _mm_set1_epi32(0x3ffff));
+        z = _mm_or_si128(z, _mm_cmpeq_epi32(zanded, _mm_set1_epi32(0x40000)));
+        z = _mm_andnot_si128(_mm_cmpeq_epi32(zanded, _mm_set1_epi32(0x60000)), z);
+        z = _mm_and_si128(z, _mm_set1_epi32(0x3ffff));
+        _mm_storeu_si128((__m128i*)&shade->z_pix[k], z);
+    }
+}
+
+// same as rgba_correct for one color component of 8 pixels
+SPAN_TARGET("avx2")
+static INLINE __m256i rgba_correct_avx2(__m256i c, __m256i full, __m256i offx, __m256i offy, int32_t cd, int32_t dy)
+{
+    __m256i summand = _mm256_add_epi32(_mm256_mullo_epi32(offx, _mm256_set1_epi32(cd)), _mm256_mullo_epi32(offy, _mm256_set1_epi32(dy)));
+    __m256i partial = _mm256_srai_epi32(_mm256_add_epi32(_mm256_slli_epi32(c, 2), summand), 4);
+    __m256i zero;
+
+    c = _mm256_blendv_epi8(partial, _mm256_srai_epi32(c, 2), full);
+    c = _mm256_and_si256(c, _mm256_set1_epi32(0x1ff));
+
+    // 0x100-0x17f clamps to 0xff, 0x180-0x1ff to 0
+    zero = _mm256_cmpgt_epi32(c, _mm256_set1_epi32(0x17f));
+    c = _mm256_blendv_epi8(c, _mm256_set1_epi32(0xff), _mm256_cmpgt_epi32(c, _mm256_set1_epi32(0xff)));
+    return _mm256_andnot_si256(zero, c);
+}
+
+SPAN_TARGET("avx2")
+static void span_shade_batch_avx2(uint32_t wid, struct span_shade* shade, int32_t* offx, int32_t* offy)
+{
+    __m256i p = _mm256_add_epi32(_mm256_set1_epi32(shade->base), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i ox = _mm256_loadu_si256((const __m256i*)offx);
+    __m256i oy = _mm256_loadu_si256((const __m256i*)offy);
+    __m256i cvg = _mm256_loadu_si256((const __m256i*)shade->cvg);
+    __m256i full = _mm256_cmpeq_epi32(cvg, _mm256_set1_epi32(8));
+    __m256i c, z, zanded;
+
+#define SPAN_COLOR(comp, cd, dy) \
+    c = _mm256_add_epi32(_mm256_set1_epi32(shade->comp), _mm256_mullo_epi32(p, _mm256_set1_epi32(shade->d##comp))); \
+    c = rgba_correct_avx2(_mm256_srai_epi32(c, 14), full, ox, oy, state[wid].cd, state[wid].dy); \
+    _mm256_storeu_si256((__m256i*)shade->shade_##comp, c);
+
+    SPAN_COLOR(r, spans_cdr, spans_drdy);
+    SPAN_COLOR(g, spans_cdg, spans_dgdy);
+    SPAN_COLOR(b, spans_cdb, spans_dbdy);
+    SPAN_COLOR(a, spans_cda, spans_dady);
+#undef SPAN_COLOR
+
+    // same as z_correct
+    z = _mm256_add_epi32(_mm256_set1_epi32(shade->z), _mm256_mullo_epi32(p, _mm256_set1_epi32(shade->dz)));
+    z = _mm256_and_si256(_mm256_srai_epi32(z, 10), _mm256_set1_epi32(0x3fffff));
+    c = _mm256_add_epi32(_mm256_mullo_epi32(ox, _mm256_set1_epi32(state[wid].spans_cdz)), _mm256_mullo_epi32(oy, _mm256_set1_epi32(state[wid].spans_dzdy)));
+    z = _mm256_blendv_epi8(_mm256_srai_epi32(_mm256_add_epi32(_mm256_slli_epi32(z, 2), c), 5), _mm256_srai_epi32(z, 3), full);
+
+    zanded = _mm256_and_si256(z, _mm256_set1_epi32(0x60000));
+    z = _mm256_and_si256(z, _mm256_set1_epi32(0x3ffff));
+    z = _mm256_or_si256(z, _mm256_cmpeq_epi32(zanded, _mm256_set1_epi32(0x40000)));
+    z = _mm256_andnot_si256(_mm256_cmpeq_epi32(zanded, _mm256_set1_epi32(0x60000)), z);
+    z = _mm256_and_si256(z, _mm256_set1_epi32(0x3ffff));
+    _mm256_storeu_si256((__m256i*)shade->z_pix, z);
+}
+
+static bool span_cpu_has(bool avx2)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int regs[4];
+
+    __cpuid(regs, 0);
+    if (regs[0] < 7)
+        return false;
+
+    // SSE4.1
+    __cpuid(regs, 1);
+    if (!(regs[2] & (1 << 19)))
+        return false;
+    if (!avx2)
+        return true;
+
+    // OSXSAVE with the OS saving the YMM registers, then AVX2
+    if (!(regs[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(regs, 7, 0);
+    return (regs[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return avx2 ? __builtin_cpu_supports("avx2") : __builtin_cpu_supports("sse4.1");
+#endif
+}
+#endif
+
+static void span_init_lut(void)
+{
+    span_shade_batch = span_shade_batch_c;
+
+#ifdef SPAN_SIMD_X86
+    if (span_cpu_has(true))
+        span_shade_batch = span_shade_batch_avx2;
+    else if (span_cpu_has(false))
+        span_shade_batch = span_shade_batch_sse41;
+#endif
+}
+
+static STRICTINLINE void span_shade_begin(struct span_shade* shade, int r, int g, int b, int a, int z,
+                                          int dr, int dg, int db, int da, int dz, int x, int xinc, int length)
+{
+    shade->r = r;
+    shade->g = g;
+    shade->b = b;
+    shade->a = a;
+    shade->z = z;
+    shade->dr = dr;
+    shade->dg = dg;
+    shade->db = db;
+    shade->da = da;
+    shade->dz = dz;
+    shade->x = x;
+    shade->xinc = xinc;
+    shade->length = length;
+    shade->base = -SPAN_BATCH;
+}
+
+static void span_shade_fill(uint32_t wid, struct span_shade* shade, int j)
+{
+    int32_t offx[SPAN_BATCH], offy[SPAN_BATCH];
+    int k;
+
+    shade->base = j;
+
+    for (k = 0; k < SPAN_BATCH; k++)
+    {
+        uint8_t mask = (j + k <= shade->length) ? state[wid].cvgbuf[shade->x + (j + k) * shade->xinc] : 0;
+        shade->cvg[k] = cvarray[mask].cvg;
+        shade->cvbit[k] = cvarray[mask].cvbit;
+        offx[k] = cvarray[mask].xoff;
+        offy[k] = cvarray[mask].yoff;
+    }
+
+    span_shade_batch(wid, shade, offx, offy);
+}
+
+// returns the slot of pixel j of the span, pixels past the end of the span
+// have no coverage
+static STRICTINLINE int span_shade_slot(uint32_t wid, struct span_shade* shade, int j)
+{
+    if (j - shade->base >= SPAN_BATCH)
+        span_shade_fill(wid, shade, j);
+    return j - shade->base;
+}
+
+static STRICTINLINE void span_shade_color(uint32_t wid, const struct span_shade* shade, int slot)
+{
+    state[wid].shade_color.r = shade->shade_r[slot];
+    state[wid].shade_color.g = shade->shade_g[slot];
+    state[wid].shade_color.b = shade->shade_b[slot];
+    state[wid].shade_color.a = shade->shade_a[slot];
+}
@@ -213,7 +213,7 @@ static STRICTINLINE uint32_t dz_compress(uint32_t value)
     return j;
 }
 
-static STRICTINLINE uint32_t z_compare(uint32_t wid, uint32_t zcurpixel, uint32_t sz, uint16_t dzpix, int dzpixenc, uint32_t* blend_en, uint32_t* prewrap, uint32_t* curpixel_cvg, uint32_t curpixel_memcvg)
+static STRICTINLINE uint32_t z_compare(uint32_t wid, uint32_t zcurpixel, uint32_t sz, uint16_t dzpix, int dzpixenc, uint32_t* blend_en, uint32_t* prewrap, uint32_t* curpixel_cvg, uint32_t curpixel_memcvg, int z_compare_en, int z_mode)
 {
 
 
@@ -225,7 +225,7 @@ static STRICTINLINE uint32_t z_compare(uint32_t wid, uint32_t zcurpixel, uint32_
     uint32_t oz, dzmem;
     int32_t rawdzmem;
 
-    if (state[wid].other_modes.z_compare_en)
+    if (z_compare_en)
     {
         PAIRREAD16(zval, hval, zcurpixel);
         oz = z_decompress(zval);
@@ -299,7 +299,7 @@ static STRICTINLINE uint32_t z_compare(uint32_t wid, uint32_t zcurpixel, uint32_
         int32_t diff;
         uint32_t nearer, max, infront;
 
-        switch(state[wid].other_modes.z_mode)
+        switch(z_mode)
         {
         case ZMODE_OPAQUE:
             infront = sz < oz;
@@ -48,6 +48,45 @@ struct vi_reg_ctrl
 
 typedef void(*vi_fetch_filter_func)(struct rgba*, uint32_t, uint32_t, struct vi_reg_ctrl, uint32_t, uint32_t);
 
+// RDRAM as read by the VI filters, either RDRAM itself or, in async mode, a
+// copy of the rows of the frame being filtered
+static uint16_t* vi_rdram16;
+static uint32_t* vi_rdram32;
+static uint8_t* vi_rdram_hidden;
+
+static STRICTINLINE uint16_t vi_read_idx16(uint32_t in)
+{
+    in &= RDRAM_MASK >> 1;
+    return rdram_valid_idx16(in) ? vi_rdram16[in ^ WORD_ADDR_XOR] : 0;
+}
+
+static STRICTINLINE uint16_t vi_read_idx16_fast(uint32_t in)
+{
+    return vi_rdram16[in ^ WORD_ADDR_XOR];
+}
+
+static STRICTINLINE uint32_t vi_read_idx32(uint32_t in)
+{
+    in &= RDRAM_MASK >> 2;
+    return rdram_valid_idx32(in) ? vi_rdram32[in] : 0;
+}
+
+static STRICTINLINE uint32_t vi_read_idx32_fast(uint32_t in)
+{
+    return vi_rdram32[in];
+}
+
+static STRICTINLINE void vi_read_pair16(uint16_t* rdst, uint8_t* hdst, uint32_t in)
+{
+    in &= RDRAM_MASK >> 1;
+    if (rdram_valid_idx16(in)) {
+        *rdst = vi_rdram16[in ^ WORD_ADDR_XOR];
+        *hdst = vi_rdram_hidden[in];
+    } else {
+        *rdst = *hdst = 0;
+    }
+}
+
 #include "vi/gamma.c"
 #include "vi/lerp.c"
 #include "vi/divot.c"
@@ -94,6 +133,38 @@ static int32_t v_start;
 static int32_t h_start;
 static int32_t v_current_line;
 
+// async mode, the filters run on their own pool and the frame is presented
+// at the next call of n64video_update_screen
+static bool vi_async;
+static bool vi_async_pending;
+static bool vi_async_valid;
+static struct frame_buffer vi_async_fb;
+static uint8_t* vi_snapshot;
+static uint8_t* vi_snapshot_hidden;
+
+// buffer the filters write to, prescale itself unless in async mode
+static struct rgba* vi_buffer;
+
+static void vi_close_async(void)
+{
+    if (vi_async) {
+        // waits for the last job
+        parallel_async_close();
+    }
+
+    if (vi_buffer != prescale) {
+        free(vi_buffer);
+    }
+    free(vi_snapshot);
+    free(vi_snapshot_hidden);
+
+    vi_buffer = prescale;
+    vi_snapshot = NULL;
+    vi_snapshot_hidden = NULL;
+    vi_async = false;
+    vi_async_pending = false;
+}
+
 static void vi_init(void)
 {
     vdac_init(&config);
@@ -111,6 +182,29 @@ static void vi_init(void)
     zb_address = 0;
 
     memset(rseed, 3, sizeof(rseed));
+
+    vi_close_async();
+
+    if (config.vi.async && config.vi.mode == VI_MODE_NORMAL) {
+        vi_buffer = calloc(PRESCALE_WIDTH * PRESCALE_HEIGHT, sizeof(*vi_buffer));
+        vi_snapshot = calloc(config.gfx.rdram_size, 1);
+        vi_snapshot_hidden = calloc(config.gfx.rdram_size / 2, 1);
+
+        if (vi_buffer && vi_snapshot && vi_snapshot_hidden) {
+            parallel_async_init(config.parallel ? config.num_workers : 1);
+            vi_async = true;
+        } else {
+            msg_warning("vi_init: not enough memory for async VI, filtering in sync");
+            if (!vi_buffer) {
+                vi_buffer = prescale;
+            }
+            vi_close_async();
+        }
+    }
+
+    vi_rdram16 = (uint16_t*)(vi_async ? vi_snapshot : config.gfx.rdram);
+    vi_rdram32 = (uint32_t*)(vi_async ? vi_snapshot : config.gfx.rdram);
+    vi_rdram_hidden = vi_async ? vi_snapshot_hidden : rdram_hidden;
 }
 
 static void vi_process_full_parallel(uint32_t worker_id)
@@ -146,7 +240,10 @@ static void vi_process_full_parallel(uint32_t worker_id)
     int32_t y_end = vres;
     int32_t y_inc = 1;
 
-    if (config.parallel) {
+    if (vi_async) {
+        y_begin = worker_id;
+        y_inc = parallel_async_num_workers();
+    } else if (config.parallel) {
         y_begin = worker_id;
         y_inc = parallel_num_workers();
     }
@@ -163,7 +260,7 @@ static void vi_process_full_parallel(uint32_t worker_id)
             divot_cache_marker = divot_cache_next_marker = cache_marker_init;
         }
 
-        struct rgba* pixel_row = &prescale[prescale_ptr + linecount * y];
+        struct rgba* pixel_row = &vi_buffer[prescale_ptr + linecount * y];
 
         yfrac = (curry >> 5) & 0x1f;
         pixels = vi_width_low * prevy;
@@ -309,63 +406,33 @@ static void vi_process_full_parallel(uint32_t worker_id)
     }
 }
 
-static bool vi_process_full(void)
+// clears the borders and runs the filters, in async mode on the thread of
+// the async pool
+static void vi_process_full_frame(void)
 {
     bool isblank = (ctrl.type & 2) == 0;
-    bool validinterlace = !isblank && ctrl.serrate;
-
-    if (validinterlace) {
-        if (prevserrate && emucontrolsvicurrent < 0) {
-            emucontrolsvicurrent = v_current_line != prevvicurrent;
-        }
-
-        if (emucontrolsvicurrent == 1) {
-            lowerfield = v_current_line ^ 1;
-        } else if (!emucontrolsvicurrent) {
-            if (v_start == oldvstart) {
-                lowerfield ^= true;
-            } else {
-                lowerfield = v_start < oldvstart;
-            }
-        }
-
-        prevvicurrent = v_current_line;
-        oldvstart = v_start;
-    }
-
-    prevserrate = validinterlace;
-
     bool validh = hres > 0 && h_start < PRESCALE_WIDTH;
     int32_t h_end = hres + h_start; // note: the result appears to be different to VI_H_END
     int32_t hrightblank = PRESCALE_WIDTH - h_end;
 
-    if (isblank && prevwasblank) {
-        return false;
-    }
-
-    prevwasblank = isblank;
-
-    linecount = PRESCALE_WIDTH << ctrl.serrate;
-    prescale_ptr = v_start * linecount + h_start + (lowerfield ? PRESCALE_WIDTH : 0);
-
     int32_t i;
     if (isblank) {
         // blank signal, clear entire screen buffer
         memset(tvfadeoutstate, 0, PRESCALE_HEIGHT * sizeof(uint32_t));
-        memset(prescale, 0, sizeof(prescale));
+        memset(vi_buffer, 0, PRESCALE_WIDTH * PRESCALE_HEIGHT * sizeof(*vi_buffer));
     } else {
         // clear left border
         int32_t j;
         if (h_start > 0 && h_start < PRESCALE_WIDTH) {
             for (i = 0; i < vactivelines; i++) {
-                memset(&prescale[i * PRESCALE_WIDTH], 0, h_start * sizeof(uint32_t));
+                memset(&vi_buffer[i * PRESCALE_WIDTH], 0, h_start * sizeof(uint32_t));
             }
         }
 
         // clear right border
         if (h_end >= 0 && h_end < PRESCALE_WIDTH) {
             for (i = 0; i < vactivelines; i++) {
-                memset(&prescale[i * PRESCALE_WIDTH + h_end], 0, hrightblank * sizeof(uint32_t));
+                memset(&vi_buffer[i * PRESCALE_WIDTH + h_end], 0, hrightblank * sizeof(uint32_t));
             }
         }
 
@@ -375,9 +442,9 @@ static bool vi_process_full(void)
                 tvfadeoutstate[i]--;
                 if (!tvfadeoutstate[i]) {
                     if (validh) {
-                        memset(&prescale[i * PRESCALE_WIDTH + h_start], 0, hres * sizeof(uint32_t));
+                        memset(&vi_buffer[i * PRESCALE_WIDTH + h_start], 0, hres * sizeof(uint32_t));
                     } else {
-                        memset(&prescale[i * PRESCALE_WIDTH], 0, PRESCALE_WIDTH * sizeof(uint32_t));
+                        memset(&vi_buffer[i * PRESCALE_WIDTH], 0, PRESCALE_WIDTH * sizeof(uint32_t));
                     }
                 }
             }
@@ -390,7 +457,7 @@ static bool vi_process_full(void)
                 } else if (tvfadeoutstate[i]) {
                     tvfadeoutstate[i]--;
                     if (!tvfadeoutstate[i]) {
-                        memset(&prescale[i * PRESCALE_WIDTH], 0, PRESCALE_WIDTH * sizeof(uint32_t));
+                        memset(&vi_buffer[i * PRESCALE_WIDTH], 0, PRESCALE_WIDTH * sizeof(uint32_t));
                     }
                 }
 
@@ -403,7 +470,7 @@ static bool vi_process_full(void)
                 } else if (tvfadeoutstate[i]) {
                     tvfadeoutstate[i]--;
                     if (!tvfadeoutstate[i]) {
-                        memset(&prescale[i * PRESCALE_WIDTH], 0, PRESCALE_WIDTH * sizeof(uint32_t));
+                        memset(&vi_buffer[i * PRESCALE_WIDTH], 0, PRESCALE_WIDTH * sizeof(uint32_t));
                     }
                 }
 
@@ -411,9 +478,9 @@ static bool vi_process_full(void)
                     tvfadeoutstate[i + 1]--;
                     if (!tvfadeoutstate[i + 1]) {
                         if (validh) {
-                            memset(&prescale[(i + 1) * PRESCALE_WIDTH + h_start], 0, hres * sizeof(uint32_t));
+                            memset(&vi_buffer[(i + 1) * PRESCALE_WIDTH + h_start], 0, hres * sizeof(uint32_t));
                         } else {
-                            memset(&prescale[(i + 1) * PRESCALE_WIDTH], 0, PRESCALE_WIDTH * sizeof(uint32_t));
+                            memset(&vi_buffer[(i + 1) * PRESCALE_WIDTH], 0, PRESCALE_WIDTH * sizeof(uint32_t));
                         }
                     }
                 }
@@ -429,28 +496,123 @@ static bool vi_process_full(void)
             }
             if (!tvfadeoutstate[i]) {
                 if (validh) {
-                    memset(&prescale[i * PRESCALE_WIDTH + h_start], 0, hres * sizeof(uint32_t));
+                    memset(&vi_buffer[i * PRESCALE_WIDTH + h_start], 0, hres * sizeof(uint32_t));
                 } else {
-                    memset(&prescale[i * PRESCALE_WIDTH], 0, PRESCALE_WIDTH * sizeof(uint32_t));
+                    memset(&vi_buffer[i * PRESCALE_WIDTH], 0, PRESCALE_WIDTH * sizeof(uint32_t));
                 }
             }
         }
     }
 
     if (!validh) {
-        return false;
+        return;
     }
 
     // run filter update in parallel if enabled
-    if (config.parallel) {
+    if (vi_async) {
+        parallel_async_run(vi_process_full_parallel);
+    } else if (config.parallel) {
         parallel_run(vi_process_full_parallel);
     } else {
         vi_process_full_parallel(0);
     }
+}
 
-    // finish and send buffer to screen
+// copies the rows of RDRAM read by the filters for this frame, with a margin
+// for the neighbours read by the restore and video filters
+static void vi_snapshot_frame(void)
+{
+    uint32_t shift = (ctrl.type & 1) ? 2 : 1;
+    int64_t first_line = (int64_t)(y_start >> 10) - 2;
+    int64_t last_line = (((int64_t)y_start + (int64_t)vres * y_add) >> 10) + 3;
+    int64_t last_x = (((int64_t)x_start + (int64_t)hres * x_add) >> 10) + 4;
+    int64_t origin = frame_buffer >> shift;
+    int64_t begin = (origin + first_line * vi_width_low - 2) << shift;
+    int64_t end = (origin + last_line * vi_width_low + last_x) << shift;
+
+    begin = begin < 0 ? 0 : begin & ~3;
+    end = end > config.gfx.rdram_size ? config.gfx.rdram_size : (end + 3) & ~3;
+
+    if (begin >= end) {
+        return;
+    }
+
+    memcpy(vi_snapshot + begin, config.gfx.rdram + begin, end - begin);
+    memcpy(vi_snapshot_hidden + (begin >> 1), rdram_hidden + (begin >> 1), (end - begin) >> 1);
+}
+
+// waits for the frame submitted at the last call and sends it to the
+// screen, returns false if there is none
+static bool vi_async_finish(void)
+{
+    if (!vi_async_pending) {
+        return false;
+    }
+
+    parallel_async_wait();
+    vi_async_pending = false;
+
+    if (!vi_async_valid) {
+        return false;
+    }
+
+    // the filters keep state in vi_buffer from one frame to the next, so
+    // the frame is copied out instead of swapping buffers
+    struct frame_buffer fb = vi_async_fb;
+    size_t offset = fb.pixels - vi_buffer;
+    size_t size = offset + fb.height * fb.pitch;
+
+    if (size > PRESCALE_WIDTH * PRESCALE_HEIGHT) {
+        size = PRESCALE_WIDTH * PRESCALE_HEIGHT;
+    }
+
+    memcpy(prescale, vi_buffer, size * sizeof(*prescale));
+    fb.pixels = prescale + offset;
+    vdac_write(&fb);
+
+    return true;
+}
+
+static bool vi_process_full(void)
+{
+    bool isblank = (ctrl.type & 2) == 0;
+    bool validinterlace = !isblank && ctrl.serrate;
+
+    if (validinterlace) {
+        if (prevserrate && emucontrolsvicurrent < 0) {
+            emucontrolsvicurrent = v_current_line != prevvicurrent;
+        }
+
+        if (emucontrolsvicurrent == 1) {
+            lowerfield = v_current_line ^ 1;
+        } else if (!emucontrolsvicurrent) {
+            if (v_start == oldvstart) {
+                lowerfield ^= true;
+            } else {
+                lowerfield = v_start < oldvstart;
+            }
+        }
+
+        prevvicurrent = v_current_line;
+        oldvstart = v_start;
+    }
+
+    prevserrate = validinterlace;
+
+    bool validh = hres > 0 && h_start < PRESCALE_WIDTH;
+
+    if (isblank && prevwasblank) {
+        return false;
+    }
+
+    prevwasblank = isblank;
+
+    linecount = PRESCALE_WIDTH << ctrl.serrate;
+    prescale_ptr = v_start * linecount + h_start + (lowerfield ? PRESCALE_WIDTH : 0);
+
+    // frame to send to the screen once filtered
     struct frame_buffer fb;
-    fb.pixels = prescale;
+    fb.pixels = vi_buffer;
     fb.pitch = PRESCALE_WIDTH;
 
     if (config.vi.hide_overscan) {
@@ -473,6 +635,24 @@ static bool vi_process_full(void)
         fb.height_out = fb.height_out * 3 / 4;
     }
 
+    if (vi_async) {
+        if (validh) {
+            vi_snapshot_frame();
+        }
+
+        vi_async_fb = fb;
+        vi_async_valid = validh && fb.width > 0 && fb.height > 0;
+        vi_async_pending = true;
+        parallel_async_submit(vi_process_full_frame);
+        return true;
+    }
+
+    vi_process_full_frame();
+
+    if (!validh) {
+        return false;
+    }
+
     vdac_write(&fb);
 
     return fb.width > 0 && fb.height > 0;
@@ -618,6 +798,11 @@ void vi_set_zbuffer_address(uint32_t address)
 
 void n64video_update_screen(void)
 {
+    dump_frame();
+
+    // in async mode the frame of the last call is the one sent to the screen
+    bool presented = vi_async_finish();
+
     // check for configuration errors
     if (config.vi.mode >= VI_MODE_NUM) {
         msg_error("Invalid VI mode: %d", config.vi.mode);
@@ -649,7 +834,7 @@ void n64video_update_screen(void)
 
     // cancel if the frame buffer contains no valid address
     if (!frame_buffer) {
-        vdac_sync(true);
+        vdac_sync(!presented);
         return;
     }
 
@@ -751,10 +936,11 @@ void n64video_update_screen(void)
     }
 
     // render frame to screen or blank screen if the frame is invalid
-    vdac_sync(!valid);
+    vdac_sync(vi_async ? !presented : !valid);
 }
 
 static void vi_close(void)
 {
+    vi_close_async();
     vdac_close();
 }
@@ -4,6 +4,7 @@
 
 #include <atomic>
 #include <algorithm>
+#include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <functional>
@@ -134,15 +135,94 @@ private:
     Parallel(const Parallel&) = delete;
 };
 
+class AsyncParallel
+{
+public:
+    AsyncParallel(std::uint32_t num_workers) :
+        m_pool(num_workers),
+        m_job(nullptr),
+        m_exit(false)
+    {
+        m_thread = std::thread(&AsyncParallel::do_jobs, this);
+    }
+
+    ~AsyncParallel() {
+        wait();
+
+        {
+            std::unique_lock<std::mutex> ul(m_mutex);
+            m_exit = true;
+            m_signal_job.notify_one();
+        }
+
+        m_thread.join();
+    }
+
+    void submit(void job(void)) {
+        // only one job at a time, jobs are run in order
+        wait();
+
+        std::unique_lock<std::mutex> ul(m_mutex);
+        m_job = job;
+        m_signal_job.notify_one();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> ul(m_mutex);
+        m_signal_done.wait(ul, [this] {
+            return m_job == nullptr;
+        });
+    }
+
+    Parallel& pool() {
+        return m_pool;
+    }
+
+private:
+    Parallel m_pool;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_signal_job;
+    std::condition_variable m_signal_done;
+    void (*m_job)(void);
+    bool m_exit;
+
+    void do_jobs() {
+        std::unique_lock<std::mutex> ul(m_mutex);
+
+        while (true) {
+            m_signal_job.wait(ul, [this] {
+                return m_job != nullptr || m_exit;
+            });
+
+            if (m_job == nullptr) {
+                break;
+            }
+
+            // the job runs unlocked and is worker 0 of the pool
+            ul.unlock();
+            m_job();
+            ul.lock();
+
+            m_job = nullptr;
+            m_signal_done.notify_all();
+        }
+    }
+
+    void operator=(const AsyncParallel&) = delete;
+    AsyncParallel(const AsyncParallel&) = delete;
+};
+
 // C interface for the Parallel class
 static std::unique_ptr<Parallel> parallel;
+static std::unique_ptr<AsyncParallel> parallel_async;
 
 template<typename T, typename... Args>
 std::unique_ptr<T> make_unique(Args&&... args) {
     return std::unique_ptr<T>(new T(std::forward<Args>(args)...));
 }
 
-void parallel_alinit(uint32_t num)
+static uint32_t parallel_auto_workers(uint32_t num)
 {
     // auto-select number of workers based on the number of cores
     if (num == 0) {
@@ -153,7 +233,12 @@ void parallel_alinit(uint32_t num)
             num = std::thread::hardware_concurrency();
     }
 
-    parallel = make_unique<Parallel>(num);
+    return num;
+}
+
+void parallel_alinit(uint32_t num)
+{
+    parallel = make_unique<Parallel>(parallel_auto_workers(num));
 }
 
 void parallel_run(void task(uint32_t))
@@ -170,3 +255,45 @@ void parallel_close(void)
 {
     parallel.reset();
 }
+
+uint64_t parallel_time_ns(void)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void parallel_async_init(uint32_t num)
+{
+    parallel_async = make_unique<AsyncParallel>(parallel_auto_workers(num));
+}
+
+void parallel_async_submit(void job(void))
+{
+    parallel_async->submit(job);
+}
+
+void parallel_async_run(void task(uint32_t))
+{
+    parallel_async->pool().run(task);
+}
+
+void parallel_async_wait(void)
+{
+    parallel_async->wait();
+}
+
+uint32_t parallel_async_num_workers(void)
+{
+    return parallel_async->pool().num_workers();
+}
+
+void parallel_async_close(void)
+{
+    // the running job still goes through parallel_async, which reset()
+    // clears before destroying the pool
+    if (parallel_async) {
+        parallel_async->wait();
+    }
+
+    parallel_async.reset();
+}
@@ -16,6 +16,23 @@ uint32_t parallel_num_workers(void);
 
 void parallel_close(void);
 
+// monotonic clock for timing workers, in nanoseconds
+uint64_t parallel_time_ns(void);
+
+// second pool of workers, driven by its own thread so that the caller can
+// continue while a job runs on it
+void parallel_async_init(uint32_t num);
+
+void parallel_async_submit(void job(void));
+
+void parallel_async_run(void task(uint32_t));
+
+void parallel_async_wait(void);
+
+uint32_t parallel_async_num_workers(void);
+
+void parallel_async_close(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,533 @@
+//
+// angrylion_bench.c: replays RDP dumps through angrylion without a frontend
+//
+// Dumps are written by the plugin when ANGRYLION_RDP_DUMP_PATH is set. Every
+// command goes through n64video_process_list as it would in the emulator,
+// from RSP DMEM, so the buffering and worker binning are part of the timing.
+// RDRAM is hashed each time the RDP signals a full sync, before the dump
+// overwrites it with the next snapshot, so that any rendering difference
+// between two builds changes the final hash. Output can depend on how lines
+// are split between workers, noise dithering for one, so only hashes from
+// the same number of workers are comparable.
+//
+
+#include "n64video.h"
+#include "vdac.h"
+#include "msg.h"
+#include "parallel_al.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum dump_cmd
+{
+    DUMP_CMD_INVALID,
+    DUMP_CMD_UPDATE_DRAM,
+    DUMP_CMD_RDP_COMMAND,
+    DUMP_CMD_SET_VI_REGISTER,
+    DUMP_CMD_END_FRAME,
+    DUMP_CMD_SIGNAL_COMPLETE,
+    DUMP_CMD_EOF,
+    DUMP_CMD_UPDATE_DRAM_FLUSH,
+    DUMP_CMD_UPDATE_HIDDEN_DRAM,
+    DUMP_CMD_UPDATE_HIDDEN_DRAM_FLUSH
+};
+
+#define DMEM_WORDS 0x400
+
+// DP_STATUS bit to read commands from DMEM, as in n64video/rdp.c
+#define DP_STATUS_XBUS_DMA 0x001
+
+static const char* const cmd_names[64] = {
+    [0x00] = "no_op",
+    [0x08] = "tri_fill",
+    [0x09] = "tri_fill_z",
+    [0x0a] = "tri_tex",
+    [0x0b] = "tri_tex_z",
+    [0x0c] = "tri_shade",
+    [0x0d] = "tri_shade_z",
+    [0x0e] = "tri_shade_tex",
+    [0x0f] = "tri_shade_tex_z",
+    [0x24] = "tex_rect",
+    [0x25] = "tex_rect_flip",
+    [0x26] = "sync_load",
+    [0x27] = "sync_pipe",
+    [0x28] = "sync_tile",
+    [0x29] = "sync_full",
+    [0x2a] = "set_key_gb",
+    [0x2b] = "set_key_r",
+    [0x2c] = "set_convert",
+    [0x2d] = "set_scissor",
+    [0x2e] = "set_prim_depth",
+    [0x2f] = "set_other_modes",
+    [0x30] = "load_tlut",
+    [0x32] = "set_tile_size",
+    [0x33] = "load_block",
+    [0x34] = "load_tile",
+    [0x35] = "set_tile",
+    [0x36] = "fill_rect",
+    [0x37] = "set_fill_color",
+    [0x38] = "set_fog_color",
+    [0x39] = "set_blend_color",
+    [0x3a] = "set_prim_color",
+    [0x3b] = "set_env_color",
+    [0x3c] = "set_combine",
+    [0x3d] = "set_texture_image",
+    [0x3e] = "set_mask_image",
+    [0x3f] = "set_color_image",
+};
+
+static struct
+{
+    uint8_t* data;
+    size_t size;
+    size_t pos;
+} dump;
+
+static uint8_t* rdram;
+static uint32_t rdram_size;
+static uint32_t hidden_size;
+
+static uint32_t dmem[DMEM_WORDS];
+static uint32_t dmem_len;
+static bool list_pending;
+
+static uint32_t dp_regs[DP_NUM_REG];
+static uint32_t* dp_reg_ptrs[DP_NUM_REG];
+static uint32_t vi_regs[VI_NUM_REG];
+static uint32_t* vi_reg_ptrs[VI_NUM_REG];
+static uint32_t mi_intr;
+
+static uint64_t hash;
+static uint64_t replay_time;
+static uint64_t cmd_count[64];
+static uint32_t frames;
+
+void msg_error(const char* err, ...)
+{
+    va_list arg;
+    va_start(arg, err);
+    fputs("error: ", stderr);
+    vfprintf(stderr, err, arg);
+    fputc('\n', stderr);
+    va_end(arg);
+}
+
+void msg_warning(const char* err, ...)
+{
+    va_list arg;
+    va_start(arg, err);
+    fputs("warning: ", stderr);
+    vfprintf(stderr, err, arg);
+    fputc('\n', stderr);
+    va_end(arg);
+}
+
+void msg_debug(const char* err, ...)
+{
+}
+
+// nothing is displayed, the VI is not replayed
+void vdac_init(struct n64video_config* config) {}
+void vdac_read(struct frame_buffer* fb, bool alpha) {}
+void vdac_write(struct frame_buffer* fb) {}
+void vdac_sync(bool invalid) {}
+void vdac_close(void) {}
+
+static void mi_intr_cb(void) {}
+
+static bool dump_read32(uint32_t* value)
+{
+    if (dump.size - dump.pos < sizeof(*value)) {
+        return false;
+    }
+
+    memcpy(value, dump.data + dump.pos, sizeof(*value));
+    dump.pos += sizeof(*value);
+    return true;
+}
+
+static const uint8_t* dump_read(size_t size)
+{
+    const uint8_t* data = dump.data + dump.pos;
+
+    if (dump.size - dump.pos < size) {
+        return NULL;
+    }
+
+    dump.pos += size;
+    return data;
+}
+
+static bool dump_load(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    long size;
+
+    if (!fp) {
+        fprintf(stderr, "can't open %s\n", path);
+        return false;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    dump.data = malloc(size > 0 ? size : 1);
+    dump.size = size > 0 ? size : 0;
+
+    if (!dump.data || fread(dump.data, 1, dump.size, fp) != dump.size) {
+        fprintf(stderr, "can't read %s\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    fclose(fp);
+
+    if (dump.size < 16 || memcmp(dump.data, "RDPDUMP2", 8)) {
+        fprintf(stderr, "%s is not an RDPDUMP2 file\n", path);
+        return false;
+    }
+
+    dump.pos = 8;
+    dump_read32(&rdram_size);
+    dump_read32(&hidden_size);
+
+    if (rdram_size == 0 || rdram_size > RDRAM_MAX_SIZE || hidden_size != rdram_size / 2) {
+        fprintf(stderr, "unsupported RDRAM size %u, hidden %u\n", rdram_size, hidden_size);
+        return false;
+    }
+
+    return true;
+}
+
+static void hash_update(const uint8_t* data, size_t size)
+{
+    size_t i;
+    // FNV-1a over 64-bit words, RDRAM sizes are multiples of 8 bytes
+    for (i = 0; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * UINT64_C(0x100000001b3);
+    }
+}
+
+static void submit(void)
+{
+    uint64_t start;
+
+    if (!dmem_len) {
+        return;
+    }
+
+    dp_regs[DP_START] = dp_regs[DP_CURRENT] = 0;
+    dp_regs[DP_END] = dmem_len * sizeof(uint32_t);
+
+    start = parallel_time_ns();
+    n64video_process_list();
+    replay_time += parallel_time_ns() - start;
+
+    dmem_len = 0;
+}
+
+static void push_command(const uint32_t* words, uint32_t length)
+{
+    if (dmem_len + length > DMEM_WORDS) {
+        submit();
+    }
+
+    memcpy(dmem + dmem_len, words, length * sizeof(*words));
+    dmem_len += length;
+}
+
+// ends the current list like the RDP did when the dump was written
+static void sync_full(void)
+{
+    static const uint32_t cmd[2] = { 0x29000000, 0 };
+
+    push_command(cmd, 2);
+    submit();
+    list_pending = false;
+
+    hash_update(rdram, rdram_size);
+    hash_update(n64video_get_hidden_rdram(), hidden_size);
+}
+
+static bool replay(void)
+{
+    uint32_t cmd, offset, size, cmd_id, length, reg, value;
+    const uint8_t* data;
+
+    dump.pos = 16;
+
+    while (dump_read32(&cmd)) {
+        switch (cmd) {
+            case DUMP_CMD_UPDATE_DRAM:
+            case DUMP_CMD_UPDATE_HIDDEN_DRAM: {
+                uint8_t* mem = cmd == DUMP_CMD_UPDATE_DRAM ? rdram : n64video_get_hidden_rdram();
+                uint32_t mem_size = cmd == DUMP_CMD_UPDATE_DRAM ? rdram_size : hidden_size;
+
+                if (!dump_read32(&offset) || !dump_read32(&size) || !(data = dump_read(size))) {
+                    goto truncated;
+                }
+
+                if (offset > mem_size || size > mem_size - offset) {
+                    fprintf(stderr, "RDRAM update out of range at %zu\n", dump.pos);
+                    return false;
+                }
+
+                memcpy(mem + offset, data, size);
+                break;
+            }
+
+            case DUMP_CMD_UPDATE_DRAM_FLUSH:
+            case DUMP_CMD_UPDATE_HIDDEN_DRAM_FLUSH:
+                break;
+
+            case DUMP_CMD_RDP_COMMAND:
+                if (!dump_read32(&cmd_id) || !dump_read32(&length) ||
+                    !(data = dump_read((size_t)length * sizeof(uint32_t)))) {
+                    goto truncated;
+                }
+
+                if (length == 0 || length > DMEM_WORDS) {
+                    fprintf(stderr, "bad command length %u at %zu\n", length, dump.pos);
+                    return false;
+                }
+
+                push_command((const uint32_t*)data, length);
+                cmd_count[cmd_id & 0x3f]++;
+                list_pending = true;
+                break;
+
+            case DUMP_CMD_SIGNAL_COMPLETE:
+                sync_full();
+                cmd_count[0x29]++;
+                break;
+
+            case DUMP_CMD_SET_VI_REGISTER:
+                if (!dump_read32(&reg) || !dump_read32(&value)) {
+                    goto truncated;
+                }
+                if (reg < VI_NUM_REG) {
+                    vi_regs[reg] = value;
+                }
+                break;
+
+            case DUMP_CMD_END_FRAME:
+                // the writer ran all buffered commands before this snapshot
+                if (list_pending) {
+                    sync_full();
+                }
+                frames++;
+                break;
+
+            case DUMP_CMD_EOF:
+                if (list_pending) {
+                    sync_full();
+                }
+                return true;
+
+            default:
+                fprintf(stderr, "unknown dump command %u at %zu\n", cmd, dump.pos);
+                return false;
+        }
+    }
+
+truncated:
+    fprintf(stderr, "dump is truncated at %zu\n", dump.pos);
+    if (list_pending) {
+        sync_full();
+    }
+    return true;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: angrylion-bench [options] <dump>\n"
+        "  -t <n>      worker threads, 0 to run on the main thread only (default: auto)\n"
+        "  -s <level>  sync level: low, medium, high (default: medium)\n"
+        "  -r <n>      number of replays, the fastest one is reported (default: 1)\n"
+        "  -q          no per command statistics (default: collected)\n"
+        "  -g          generic span routines only, to compare (default: specialized)\n");
+}
+
+static double per_sec(uint64_t count, uint64_t ns)
+{
+    return ns ? count * 1e9 / ns : 0;
+}
+
+int main(int argc, char** argv)
+{
+    struct n64video_config config;
+    struct n64video_stats stats;
+    const char* path = NULL;
+    int workers = -1;
+    int runs = 1;
+    int run, i;
+    uint32_t num_workers = 0;
+    bool collect = true;
+    bool generic_spans = false;
+    enum dp_compat_profile compat = DP_COMPAT_MEDIUM;
+    uint64_t best_time = 0, first_hash = 0, triangles = 0, rects = 0, total_time = 0;
+    uint64_t best_cmd_count[64];
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            const char* level = argv[++i];
+            if (!strcmp(level, "low")) {
+                compat = DP_COMPAT_LOW;
+            } else if (!strcmp(level, "medium")) {
+                compat = DP_COMPAT_MEDIUM;
+            } else if (!strcmp(level, "high")) {
+                compat = DP_COMPAT_HIGH;
+            } else {
+                usage();
+                return EXIT_FAILURE;
+            }
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-q")) {
+            collect = false;
+        } else if (!strcmp(argv[i], "-g")) {
+            generic_spans = true;
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!path || runs < 1) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    if (!dump_load(path)) {
+        return EXIT_FAILURE;
+    }
+
+    rdram = malloc(rdram_size);
+    if (!rdram) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < DP_NUM_REG; i++) {
+        dp_reg_ptrs[i] = &dp_regs[i];
+    }
+    for (i = 0; i < VI_NUM_REG; i++) {
+        vi_reg_ptrs[i] = &vi_regs[i];
+    }
+
+    n64video_config_init(&config);
+    config.gfx.rdram = rdram;
+    config.gfx.rdram_size = rdram_size;
+    config.gfx.dmem = (uint8_t*)dmem;
+    config.gfx.dp_reg = dp_reg_ptrs;
+    config.gfx.vi_reg = vi_reg_ptrs;
+    config.gfx.mi_intr_reg = &mi_intr;
+    config.gfx.mi_intr_cb = mi_intr_cb;
+    config.dp.compat = compat;
+    config.dp.stats = collect;
+    config.dp.generic_spans = generic_spans;
+    config.parallel = workers != 0;
+    config.num_workers = workers > 0 ? workers : 0;
+
+    for (run = 0; run < runs; run++) {
+        // RDRAM updates are relative to zeroed RDRAM
+        memset(rdram, 0, rdram_size);
+        memset(dp_regs, 0, sizeof(dp_regs));
+        memset(vi_regs, 0, sizeof(vi_regs));
+        memset(cmd_count, 0, sizeof(cmd_count));
+        dp_regs[DP_STATUS] = DP_STATUS_XBUS_DMA;
+        dmem_len = 0;
+        list_pending = false;
+        hash = UINT64_C(0xcbf29ce484222325);
+        replay_time = 0;
+        frames = 0;
+
+        n64video_init(&config);
+        num_workers = config.parallel ? parallel_num_workers() : 0;
+
+        if (!replay()) {
+            n64video_close();
+            return EXIT_FAILURE;
+        }
+
+        if (run == 0) {
+            first_hash = hash;
+        } else if (hash != first_hash) {
+            fprintf(stderr, "run %d: hash %016llx differs from the first run\n",
+                run + 1, (unsigned long long)hash);
+        }
+
+        total_time += replay_time;
+
+        if (run == 0 || replay_time < best_time) {
+            best_time = replay_time;
+            memcpy(best_cmd_count, cmd_count, sizeof(cmd_count));
+            n64video_get_stats(&stats);
+        }
+
+        n64video_close();
+    }
+
+    for (i = 0x08; i <= 0x0f; i++) {
+        triangles += best_cmd_count[i];
+    }
+    rects = best_cmd_count[0x24] + best_cmd_count[0x25] + best_cmd_count[0x36];
+
+    printf("dump:       %s\n", path);
+    printf("frames:     %u\n", frames);
+    if (num_workers) {
+        printf("workers:    %u\n", num_workers);
+    } else {
+        printf("workers:    none, main thread only\n");
+    }
+    printf("sync level: %s\n", compat == DP_COMPAT_LOW ? "low" : compat == DP_COMPAT_HIGH ? "high" : "medium");
+    printf("time:       %.3f ms (best of %d, average %.3f ms)\n",
+        best_time / 1e6, runs, total_time / 1e6 / runs);
+    printf("frames/s:   %.1f\n", per_sec(frames, best_time));
+    printf("triangles:  %llu (%.0f/s)\n", (unsigned long long)triangles, per_sec(triangles, best_time));
+    printf("rectangles: %llu (%.0f/s)\n", (unsigned long long)rects, per_sec(rects, best_time));
+
+    if (collect) {
+        uint64_t worker_time = 0;
+
+        printf("pixels:     %llu (%.0f/s)\n", (unsigned long long)stats.pixels, per_sec(stats.pixels, best_time));
+
+        for (i = 0; i < 64; i++) {
+            worker_time += stats.cmd_time[i];
+        }
+
+        // the time of a command is summed over the workers that ran it, so
+        // it can be larger than the replay time
+        printf("\n%-20s %10s %10s %12s %7s\n", "command", "count", "runs", "time ms", "share");
+        for (i = 0; i < 64; i++) {
+            if (!best_cmd_count[i] && !stats.cmd_count[i]) {
+                continue;
+            }
+            printf("%-20s %10llu %10llu %12.3f %6.1f%%\n",
+                cmd_names[i] ? cmd_names[i] : "invalid",
+                (unsigned long long)best_cmd_count[i],
+                (unsigned long long)stats.cmd_count[i],
+                stats.cmd_time[i] / 1e6,
+                worker_time ? stats.cmd_time[i] * 100.0 / worker_time : 0.0);
+        }
+        printf("\n");
+    }
+
+    printf("hash:       %016llx\n", (unsigned long long)first_hash);
+
+    free(rdram);
+    free(dump.data);
+
+    return EXIT_SUCCESS;
+}
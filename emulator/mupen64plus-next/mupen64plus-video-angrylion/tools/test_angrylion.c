@@ -0,0 +1,914 @@
+//
+// test_angrylion.c: checks the plugin's optimizations against its plain paths
+//
+// Replays random RDP display lists through the plugin and checks that
+// binning the buffered commands per worker leaves the same RDRAM as every
+// worker running the whole buffer, which is what cmd_flush did before. Also
+// reports the time taken and the commands run by the workers both ways.
+//
+// The SIMD span shade kernels the CPU supports are checked against the C
+// one, on random batches and on the same lists, and timed. So are the span
+// routines specialized for z and alpha compare modes, against the generic
+// ones. Async VI filtering is checked against sync, one frame later, and
+// angrylion-bench has to replay a dump of the lists to the same RDRAM.
+//
+// n64video.c is included, to reach the buffered commands, and parallel_al
+// is linked. Output depends on how lines are split between workers, noise
+// dithering for one, so only runs with the same number of workers are
+// compared.
+//
+// Build and run with "make core-tests".
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "n64video.c"
+
+#define FRAMES 8
+#define FRAME_COMMANDS 600
+#define LIST_WORDS (FRAMES * (FRAME_COMMANDS + 16) * CMD_MAX_INTS)
+#define DMEM_WORDS 0x400
+
+#define WIDTH 320
+#define HEIGHT 240
+#define COLOR_ADDR 0x100000
+#define COLOR_SIZE 0x80000
+#define DEPTH_ADDR 0x200000
+#define TEXTURE_ADDR 0x300000
+#define TEXTURE_SIZE 0x10000
+#define KERNEL_BATCHES 200000
+#define SPAN_RUNS 3
+#define VI_SETUPS 16
+#define VI_FRAMES 8
+
+static uint8_t ram[RDRAM_MAX_SIZE];
+static uint32_t dmem[DMEM_WORDS];
+static uint32_t dmem_len;
+static uint32_t dp_regs[DP_NUM_REG];
+static uint32_t* dp_reg_ptrs[DP_NUM_REG];
+static uint32_t vi_regs[VI_NUM_REG];
+static uint32_t* vi_reg_ptrs[VI_NUM_REG];
+static uint32_t mi_intr;
+
+static uint32_t words[LIST_WORDS];
+static size_t words_len;
+static uint32_t list_cycle_type, list_fb_size;
+static char dir[] = "/tmp/test_angrylion.XXXXXX";
+static uint64_t ram_hash;
+
+/* what each n64video_update_screen call sent to the screen */
+struct vi_frame {
+    uint64_t hash;
+    uint32_t width, height, height_out;
+    bool written, invalid;
+};
+
+static struct vi_frame vi_frames[VI_FRAMES];
+static int vi_frame_count;
+
+/* xorshift32, seeded from the command line to reproduce a failure */
+static uint32_t rng_state;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* the parts of the frontend the plugin calls into */
+void msg_error(const char* err, ...)
+{
+    va_list arg;
+
+    va_start(arg, err);
+    fputs("test_angrylion: ", stderr);
+    vfprintf(stderr, err, arg);
+    fputc('\n', stderr);
+    va_end(arg);
+}
+
+void msg_warning(const char* err, ...) {}
+void msg_debug(const char* err, ...) {}
+
+void vdac_init(struct n64video_config* config) {}
+void vdac_read(struct frame_buffer* fb, bool alpha) {}
+
+void vdac_write(struct frame_buffer* fb)
+{
+    struct vi_frame* frame = &vi_frames[vi_frame_count];
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+    for (uint32_t y = 0; y < fb->height; ++y) {
+        for (uint32_t x = 0; x < fb->width; ++x) {
+            const struct rgba* pixel = &fb->pixels[y * fb->pitch + x];
+            uint32_t word = pixel->r | (pixel->g << 8) | (pixel->b << 16) | ((uint32_t)pixel->a << 24);
+            hash = (hash ^ word) * UINT64_C(0x100000001b3);
+        }
+    }
+    frame->hash = hash;
+    frame->width = fb->width;
+    frame->height = fb->height;
+    frame->height_out = fb->height_out;
+    frame->written = true;
+}
+
+/* every call ends with this one */
+void vdac_sync(bool invalid)
+{
+    vi_frames[vi_frame_count++].invalid = invalid;
+}
+void vdac_close(void) {}
+
+static void mi_intr_cb(void) {}
+
+static void emit(const uint32_t* cmd)
+{
+    uint32_t length = rdp_commands[CMD_ID(cmd)].length / 4;
+
+    memcpy(&words[words_len], cmd, length * sizeof(*cmd));
+    words_len += length;
+}
+
+static void emit2(uint32_t id, uint32_t w0, uint32_t w1)
+{
+    uint32_t cmd[2] = { (id << 24) | (w0 & 0xffffff), w1 };
+
+    emit(cmd);
+}
+
+/* x and y in 10.2 fixed point */
+static uint32_t random_x(void)
+{
+    return rng() % ((WIDTH + 16) * 4);
+}
+
+static uint32_t random_y(void)
+{
+    return rng() % ((HEIGHT + 16) * 4);
+}
+
+static void random_color_image(void)
+{
+    /* RGBA, 16 or 32 bit, copy mode crashes the RDP on 32 bit; one image
+     * per size, as the lines of the other size would overlap other workers' */
+    list_fb_size = (list_cycle_type == CYCLE_TYPE_COPY) ? PIXEL_SIZE_16BIT : PIXEL_SIZE_16BIT + rng() % 2;
+    emit2(CMD_ID_SET_COLOR_IMAGE, (list_fb_size << 19) | (WIDTH - 1),
+          COLOR_ADDR + (list_fb_size - PIXEL_SIZE_16BIT) * COLOR_SIZE);
+}
+
+static void random_scissor(void)
+{
+    /* spans draw the pixel on the right edge too and copy mode writes a
+     * byte left of the span, so keep a column free on both sides: past the
+     * edges are the lines of other workers, and their writes would race */
+    uint32_t xh = 4, yh = 0, xl = (WIDTH - 1) * 4, yl = HEIGHT * 4;
+
+    /* mostly the whole screen, as games do */
+    if (rng() % 4 == 0) {
+        xh = 4 + rng() % (WIDTH * 2 - 8);
+        yh = rng() % (HEIGHT * 2);
+        xl = xh + rng() % (WIDTH * 2 - 8);
+        yl = yh + rng() % (HEIGHT * 2);
+    }
+    emit2(CMD_ID_SET_SCISSOR, (xh << 12) | yh, (rng() & 0x3000000) | (xl << 12) | yl);
+}
+
+static void random_other_modes(void)
+{
+    uint32_t w0 = rng() & 0xcfffff;
+    uint32_t w1 = rng();
+    uint32_t cycle = rng() % 16;
+
+    /* mostly 1 and 2 cycle, some copy and fill */
+    cycle = (cycle < 7) ? CYCLE_TYPE_1 : (cycle < 14) ? CYCLE_TYPE_2 : (cycle == 14) ? CYCLE_TYPE_COPY : CYCLE_TYPE_FILL;
+    if (cycle == CYCLE_TYPE_COPY && list_fb_size == PIXEL_SIZE_32BIT)
+        cycle = CYCLE_TYPE_1;
+    /* fill mode crashes the RDP with image reads or z on */
+    if (cycle == CYCLE_TYPE_FILL)
+        w1 &= ~UINT32_C(0x70);
+    list_cycle_type = cycle;
+    emit2(CMD_ID_SET_OTHER_MODES, w0 | (cycle << 20), w1);
+}
+
+static void random_state(void)
+{
+    switch (rng() % 10) {
+    case 0: case 1:
+        random_other_modes();
+        break;
+    case 2: case 3:
+        emit2(CMD_ID_SET_COMBINE, rng(), rng());
+        break;
+    case 4:
+        emit2(CMD_ID_SET_FILL_COLOR + rng() % 5, 0, rng());
+        break;
+    case 5:
+        emit2(CMD_ID_SET_PRIM_COLOR, rng(), rng());
+        break;
+    case 6:
+        emit2(CMD_ID_SET_PRIM_DEPTH, 0, rng());
+        break;
+    case 7:
+        emit2(CMD_ID_SET_KEY_GB + rng() % 3, rng(), rng());
+        break;
+    case 8:
+        random_scissor();
+        break;
+    case 9:
+        random_color_image();
+        break;
+    }
+}
+
+/* a texture load like the microcodes do, then the tile used to draw */
+static void random_texture(void)
+{
+    uint32_t size = 1 + rng() % 3;     /* 4 bit images crash tile loads */
+    uint32_t width = 1 + rng() % 256;
+    uint32_t tile = rng() % 7;
+    uint32_t sl, tl;
+
+    emit2(CMD_ID_SET_TEXTURE_IMAGE, ((rng() % 5) << 21) | (size << 19) | (width - 1),
+          TEXTURE_ADDR + (rng() % TEXTURE_SIZE & ~7));
+    emit2(CMD_ID_SET_TILE, ((rng() % 5) << 21) | (size << 19) | ((1 + rng() % 16) << 9) | (rng() % 0x200),
+          (7 << 24) | (rng() & 0xfffff));
+    emit2(CMD_ID_SYNC_LOAD, 0, 0);
+    switch (rng() % 3) {
+    case 0:
+        emit2(CMD_ID_LOAD_BLOCK, 0, (7 << 24) | ((rng() % 2048) << 12) | (rng() % 0x800));
+        break;
+    case 1:
+        sl = rng() % 64;
+        tl = rng() % 64;
+        emit2(CMD_ID_LOAD_TILE, (sl << 12) | tl,
+              (7 << 24) | ((sl + rng() % 128) << 12) | (tl + rng() % 128));
+        break;
+    case 2:
+        /* more than one line of palette crashes the RDP */
+        emit2(CMD_ID_LOAD_TLUT, 0, (7 << 24) | ((rng() % 256) << 14));
+        break;
+    }
+    emit2(CMD_ID_SYNC_TILE, 0, 0);
+    emit2(CMD_ID_SET_TILE, rng() & 0xffffff, (tile << 24) | (rng() & 0xffffff));
+    emit2(CMD_ID_SET_TILE_SIZE, ((rng() % 0x100) << 12) | (rng() % 0x100),
+          (tile << 24) | ((rng() % 0x400) << 12) | (rng() % 0x400));
+}
+
+static void random_triangle(void)
+{
+    uint32_t cmd[CMD_MAX_INTS];
+    uint32_t yh = random_y(), ym, yl;
+
+    yl = yh + rng() % 400;
+    ym = yh + rng() % (yl - yh + 1);
+
+    /* flip, level and tile, then y in 11.2 and x in s15.16 */
+    cmd[0] = ((CMD_ID_FILL_TRIANGLE + rng() % 8) << 24) | ((rng() & 0xff) << 16) | (yl & 0x3fff);
+    cmd[1] = ((ym & 0x3fff) << 16) | (yh & 0x3fff);
+    for (int i = 2; i < 8; i += 2) {
+        cmd[i] = (random_x() << 14) - (8 << 16);
+        cmd[i + 1] = (rng() % (8 << 16)) - (4 << 16);
+    }
+    /* shade, texture and z coefficients, as many as the command has */
+    for (int i = 8; i < CMD_MAX_INTS; ++i)
+        cmd[i] = rng();
+    emit(cmd);
+}
+
+static void random_rect(void)
+{
+    uint32_t xh = random_x(), yh = random_y();
+    uint32_t xl = (xh + rng() % 512) & 0xfff, yl = (yh + rng() % 512) & 0xfff;
+    uint32_t cmd[4];
+
+    if (rng() % 2 == 0) {
+        emit2(CMD_ID_FILL_RECTANGLE, (xl << 12) | yl, (xh << 12) | yh);
+        return;
+    }
+    cmd[0] = ((CMD_ID_TEXTURE_RECTANGLE + rng() % 2) << 24) | (xl << 12) | yl;
+    cmd[1] = ((rng() % 8) << 24) | (xh << 12) | yh;
+    cmd[2] = rng();
+    cmd[3] = rng();
+    emit(cmd);
+}
+
+/* a frame: images and scissor set up, a random mix of state changes,
+ * texture loads and primitives, and a full sync at the end */
+static void build_list(void)
+{
+    words_len = 0;
+    list_cycle_type = CYCLE_TYPE_1;
+    for (int frame = 0; frame < FRAMES; ++frame) {
+        random_color_image();
+        emit2(CMD_ID_SET_MASK_IMAGE, 0, DEPTH_ADDR);
+        random_scissor();
+        random_other_modes();
+        for (int i = 0; i < FRAME_COMMANDS; ++i) {
+            uint32_t kind = rng() % 20;
+
+            if (kind < 6)
+                random_state();
+            else if (kind < 8)
+                random_texture();
+            else if (kind < 9)
+                emit2(CMD_ID_SYNC_PIPE, 0, 0);
+            else if (kind < 15)
+                random_triangle();
+            else
+                random_rect();
+        }
+        emit2(CMD_ID_SYNC_FULL, 0, 0);
+    }
+}
+
+static void hash_update(const uint8_t* data, size_t size)
+{
+    /* FNV-1a over 64-bit words, RDRAM sizes are multiples of 8 bytes */
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        ram_hash = (ram_hash ^ word) * UINT64_C(0x100000001b3);
+    }
+}
+
+/* hashed at every full sync, so that a difference in any frame shows */
+static void frame_done(void)
+{
+    hash_update(ram, sizeof(ram));
+    hash_update(rdram_hidden, sizeof(ram) / 2);
+}
+
+/* what cmd_run_buffered did before the commands were binned */
+static void cmd_run_whole(uint32_t worker_id)
+{
+    for (uint32_t pos = 0; pos < rdp_cmd_buf_pos; pos++)
+        rdp_cmd(worker_id, rdp_cmd_buf[pos]);
+}
+
+static void cmd_flush_whole(void)
+{
+    if (rdp_cmd_buf_pos) {
+        parallel_run(cmd_run_whole);
+        rdp_cmd_buf_pos = 0;
+    }
+}
+
+/* the list as n64video_process_list buffers it, run by cmd_flush_whole */
+static void replay_whole(void)
+{
+    for (size_t i = 0; i < words_len; ) {
+        uint32_t id = CMD_ID(&words[i]);
+        uint32_t length = rdp_commands[id].length / 4;
+
+        memcpy(rdp_cmd_buf[rdp_cmd_buf_pos], &words[i], length * sizeof(uint32_t));
+        i += length;
+        if (id == CMD_ID_SYNC_FULL) {
+            cmd_flush_whole();
+            rdp_sync_full(0, NULL);
+            frame_done();
+            continue;
+        }
+        if (++rdp_cmd_buf_pos >= CMD_BUFFER_SIZE || rdp_cmd_sync[id])
+            cmd_flush_whole();
+    }
+}
+
+static void submit(void)
+{
+    dp_regs[DP_START] = dp_regs[DP_CURRENT] = 0;
+    dp_regs[DP_END] = dmem_len * sizeof(uint32_t);
+    n64video_process_list();
+    dmem_len = 0;
+}
+
+/* the list from DMEM through n64video_process_list, as the RSP sends it */
+static void replay_binned(void)
+{
+    for (size_t i = 0; i < words_len; ) {
+        uint32_t id = CMD_ID(&words[i]);
+        uint32_t length = rdp_commands[id].length / 4;
+
+        if (dmem_len + length > DMEM_WORDS)
+            submit();
+        memcpy(&dmem[dmem_len], &words[i], length * sizeof(uint32_t));
+        dmem_len += length;
+        i += length;
+        if (id == CMD_ID_SYNC_FULL) {
+            submit();
+            frame_done();
+        }
+    }
+}
+
+/* n64video_init only sets up the RDP state the first time, and every
+ * run has to start from the same state */
+static void reset_rdp(void)
+{
+    memset(state, 0, sizeof(state));
+    fb_init(0);
+    combiner_init(0);
+    tex_init(0);
+    rasterizer_init(0);
+}
+
+typedef void (*span_kernel)(uint32_t wid, struct span_shade* shade, int32_t* offx, int32_t* offy);
+
+/* the span shade kernels span_init_lut picks from, by CPUID */
+static const struct {
+    const char* name;
+    span_kernel batch;
+    const char* isa;
+} kernels[] = {
+    { "C", span_shade_batch_c, NULL },
+#ifdef SPAN_SIMD_X86
+    { "SSE4.1", span_shade_batch_sse41, "sse4.1" },
+    { "AVX2", span_shade_batch_avx2, "avx2" },
+#endif
+};
+
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
+static bool kernel_supported(size_t k)
+{
+#ifdef SPAN_SIMD_X86
+    if (kernels[k].isa != NULL)
+        return span_cpu_has(strcmp(kernels[k].isa, "avx2") == 0);
+#endif
+    return true;
+}
+
+struct run {
+    uint64_t hash;
+    uint64_t runs;          /* commands run, summed over the workers */
+    uint64_t prim_runs;     /* of which triangles and rectangles */
+    double seconds;
+};
+
+/* kernel NULL keeps the one span_init_lut picked, generic skips the
+ * specialized span routines */
+static void run(uint32_t workers, int whole, span_kernel kernel, bool generic, uint32_t seed, struct run* result)
+{
+    struct n64video_config cfg;
+    struct n64video_stats stats;
+    double t;
+
+    memset(ram, 0, sizeof(ram));
+    rng_state = seed;
+    for (uint32_t i = 0; i < TEXTURE_SIZE; i += 4) {
+        uint32_t word = rng();
+        memcpy(&ram[TEXTURE_ADDR + i], &word, 4);
+    }
+    memset(dp_regs, 0, sizeof(dp_regs));
+    dp_regs[DP_STATUS] = DP_STATUS_XBUS_DMA;
+    dmem_len = 0;
+    ram_hash = UINT64_C(0xcbf29ce484222325);
+
+    n64video_config_init(&cfg);
+    cfg.gfx.rdram = ram;
+    cfg.gfx.rdram_size = sizeof(ram);
+    cfg.gfx.dmem = (uint8_t*)dmem;
+    cfg.gfx.dp_reg = dp_reg_ptrs;
+    cfg.gfx.vi_reg = vi_reg_ptrs;
+    cfg.gfx.mi_intr_reg = &mi_intr;
+    cfg.gfx.mi_intr_cb = mi_intr_cb;
+    cfg.dp.stats = true;
+    cfg.dp.generic_spans = generic;
+    cfg.num_workers = workers;
+    reset_rdp();
+    n64video_init(&cfg);
+    if (kernel != NULL)
+        span_shade_batch = kernel;
+
+    t = now();
+    if (whole)
+        replay_whole();
+    else
+        replay_binned();
+    result->seconds = now() - t;
+
+    n64video_get_stats(&stats);
+    result->hash = ram_hash;
+    result->runs = 0;
+    result->prim_runs = 0;
+    for (int i = 0; i < 64; ++i) {
+        int32_t ystart, yend;
+        uint32_t cmd = (uint32_t)i << 24;
+
+        result->runs += stats.cmd_count[i];
+        if (cmd_prim_lines(&cmd, &ystart, &yend))
+            result->prim_runs += stats.cmd_count[i];
+    }
+    n64video_close();
+    span_init_lut();
+}
+
+static int32_t random_signed(int bits)
+{
+    return SIGN(rng(), bits);
+}
+
+/* every kernel against the C one: on random batches, then on the list */
+static int check_span_kernels(uint32_t seed)
+{
+    static struct span_shade shades[NUM_KERNELS];
+    int32_t offx[SPAN_BATCH], offy[SPAN_BATCH];
+    double seconds[NUM_KERNELS] = { 0 };
+    struct run reference, result;
+
+    for (int i = 0; i < KERNEL_BATCHES; ++i) {
+        struct span_shade shade;
+
+        /* the derivatives as the edgewalker leaves them */
+        state[0].spans_cdr = random_signed(14);
+        state[0].spans_cdg = random_signed(14);
+        state[0].spans_cdb = random_signed(14);
+        state[0].spans_cda = random_signed(14);
+        state[0].spans_cdz = random_signed(22);
+        state[0].spans_drdy = random_signed(14);
+        state[0].spans_dgdy = random_signed(14);
+        state[0].spans_dbdy = random_signed(14);
+        state[0].spans_dady = random_signed(14);
+        state[0].spans_dzdy = random_signed(22);
+
+        memset(&shade, 0, sizeof(shade));
+        shade.r = rng();
+        shade.g = rng();
+        shade.b = rng();
+        shade.a = rng();
+        shade.z = rng();
+        shade.dr = rng() >> (rng() % 32);
+        shade.dg = rng() >> (rng() % 32);
+        shade.db = rng() >> (rng() % 32);
+        shade.da = rng() >> (rng() % 32);
+        shade.dz = rng() >> (rng() % 32);
+        shade.base = rng() % 1024;
+        for (int k = 0; k < SPAN_BATCH; ++k) {
+            /* full coverage takes another path */
+            uint8_t mask = (rng() % 4 == 0) ? 0xff : (uint8_t)rng();
+
+            shade.cvg[k] = cvarray[mask].cvg;
+            offx[k] = cvarray[mask].xoff;
+            offy[k] = cvarray[mask].yoff;
+        }
+
+        for (size_t k = 0; k < NUM_KERNELS; ++k) {
+            if (!kernel_supported(k))
+                continue;
+            shades[k] = shade;
+            kernels[k].batch(0, &shades[k], offx, offy);
+            if (k > 0 && memcmp(&shades[k], &shades[0], sizeof(shade)) != 0) {
+                fprintf(stderr, "test_angrylion: batch %d: %s kernel differs from the C one\n", i, kernels[k].name);
+                return 0;
+            }
+        }
+    }
+
+    /* timed on the last batch, the kernels leave their input as it is */
+    for (size_t k = 0; k < NUM_KERNELS; ++k) {
+        double t = now();
+
+        if (!kernel_supported(k))
+            continue;
+        for (int i = 0; i < KERNEL_BATCHES; ++i)
+            kernels[k].batch(0, &shades[k], offx, offy);
+        seconds[k] = now() - t;
+    }
+
+    run(1, 0, kernels[0].batch, false, seed, &reference);
+    printf("test_angrylion: span kernels match on %d random batches, list with the C kernel %.3f s\n",
+           KERNEL_BATCHES, reference.seconds);
+    for (size_t k = 1; k < NUM_KERNELS; ++k) {
+        if (!kernel_supported(k)) {
+            printf("test_angrylion: no %s on this CPU, skipped\n", kernels[k].name);
+            continue;
+        }
+        run(1, 0, kernels[k].batch, false, seed, &result);
+        if (result.hash != reference.hash) {
+            fprintf(stderr, "test_angrylion: RDRAM hash %016llx with the %s kernel, %016llx with the C one\n",
+                    (unsigned long long)result.hash, kernels[k].name, (unsigned long long)reference.hash);
+            return 0;
+        }
+        printf("test_angrylion: %s kernel: %.2f ns per batch of %d pixels vs %.2f ns in C, list %.3f s\n",
+               kernels[k].name, seconds[k] * 1e9 / KERNEL_BATCHES, SPAN_BATCH,
+               seconds[0] * 1e9 / KERNEL_BATCHES, result.seconds);
+    }
+    return 1;
+}
+
+/* the span routines specialized for z and alpha compare modes against the
+ * generic one, which reads the modes for every pixel */
+static int check_span_variants(uint32_t seed)
+{
+    static const char* const names[SPAN_NUM_VARIANTS] = { "generic", "no z", "opaque", "opaque and alpha compare", "translucent" };
+    struct run generic, specialized;
+    double generic_seconds = 0.0, specialized_seconds = 0.0;
+    uint32_t prims[SPAN_NUM_VARIANTS] = { 0 };
+    uint32_t cycle_type = CYCLE_TYPE_1;
+
+    /* the routines the primitives of the list go to, as deduce_derivatives
+     * picks them */
+    config.dp.generic_spans = false;
+    memset(&state[0].other_modes, 0, sizeof(state[0].other_modes));
+    for (size_t i = 0; i < words_len; i += rdp_commands[CMD_ID(&words[i])].length / 4) {
+        int32_t ystart, yend;
+
+        if (CMD_ID(&words[i]) == CMD_ID_SET_OTHER_MODES) {
+            cycle_type = (words[i] >> 20) & 3;
+            state[0].other_modes.z_mode = (words[i + 1] >> 10) & 3;
+            state[0].other_modes.z_update_en = (words[i + 1] >> 5) & 1;
+            state[0].other_modes.z_compare_en = (words[i + 1] >> 4) & 1;
+            state[0].other_modes.alpha_compare_en = words[i + 1] & 1;
+        } else if (cycle_type <= CYCLE_TYPE_2 && cmd_prim_lines(&words[i], &ystart, &yend)) {
+            ++prims[span_select_variant(0)];
+        }
+    }
+    for (int v = 0; v < SPAN_NUM_VARIANTS; ++v) {
+        if (prims[v] == 0) {
+            fprintf(stderr, "test_angrylion: no primitive in the list for the %s span routines\n", names[v]);
+            return 0;
+        }
+    }
+
+    for (int i = 0; i < SPAN_RUNS; ++i) {
+        run(1, 0, NULL, true, seed, &generic);
+        run(1, 0, NULL, false, seed, &specialized);
+        if (specialized.hash != generic.hash) {
+            fprintf(stderr, "test_angrylion: RDRAM hash %016llx with the specialized span routines, %016llx generic\n",
+                    (unsigned long long)specialized.hash, (unsigned long long)generic.hash);
+            return 0;
+        }
+        generic_seconds += generic.seconds;
+        specialized_seconds += specialized.seconds;
+    }
+
+    printf("test_angrylion: primitives by span routines:");
+    for (int v = 0; v < SPAN_NUM_VARIANTS; ++v)
+        printf("%s %u %s", v ? "," : "", prims[v], names[v]);
+    printf("\n");
+    printf("test_angrylion: specialized span routines match the generic ones, %.3f s vs %.3f s per list\n",
+           specialized_seconds / SPAN_RUNS, generic_seconds / SPAN_RUNS);
+    return 1;
+}
+
+/* VI registers of a random NTSC or PAL mode, with random filters */
+static void random_vi_regs(void)
+{
+    uint32_t type = 2 + rng() % 2;
+    uint32_t pal = rng() % 2;
+
+    vi_regs[VI_STATUS] = type | (rng() & 0x5c) | ((rng() % 4) << 8) | (3 << 12) | ((rng() % 2) << 16);
+    vi_regs[VI_ORIGIN] = COLOR_ADDR + (type & 1) * COLOR_SIZE;
+    vi_regs[VI_WIDTH] = WIDTH;
+    vi_regs[VI_V_SYNC] = pal ? 0x271 : 0x20d;
+    vi_regs[VI_H_START] = 0x006c02ec;
+    vi_regs[VI_V_START] = pal ? 0x005f0239 : 0x002501ff;
+    vi_regs[VI_X_SCALE] = 0x200 + rng() % 0x100;
+    vi_regs[VI_Y_SCALE] = 0x400 - rng() % 0x100;
+}
+
+/* runs VI_FRAMES frames of random pixels, returns the seconds spent in
+ * n64video_update_screen */
+static double run_vi(uint32_t workers, bool async, uint32_t seed)
+{
+    struct n64video_config cfg;
+    double seconds = 0.0;
+
+    n64video_config_init(&cfg);
+    cfg.gfx.rdram = ram;
+    cfg.gfx.rdram_size = sizeof(ram);
+    cfg.gfx.dmem = (uint8_t*)dmem;
+    cfg.gfx.dp_reg = dp_reg_ptrs;
+    cfg.gfx.vi_reg = vi_reg_ptrs;
+    cfg.gfx.mi_intr_reg = &mi_intr;
+    cfg.gfx.mi_intr_cb = mi_intr_cb;
+    cfg.vi.vi_blur = true;
+    cfg.vi.vi_dedither = true;
+    cfg.vi.async = async;
+    cfg.parallel = workers > 0;
+    cfg.num_workers = workers;
+    n64video_init(&cfg);
+
+    rng_state = seed;
+    memset(vi_frames, 0, sizeof(vi_frames));
+    vi_frame_count = 0;
+    for (int f = 0; f < VI_FRAMES; ++f) {
+        /* the frame the RDP drew, both color images and their hidden bits */
+        for (uint32_t i = COLOR_ADDR; i < COLOR_ADDR + 2 * COLOR_SIZE; i += 4) {
+            uint32_t word = rng();
+            memcpy(&ram[i], &word, 4);
+            rdram_hidden[i >> 1] = word & 3;
+            rdram_hidden[(i >> 1) + 1] = (word >> 2) & 3;
+        }
+        vi_regs[VI_V_CURRENT_LINE] = f & 1;
+
+        double t = now();
+        n64video_update_screen();
+        seconds += now() - t;
+    }
+
+    n64video_close();
+    return seconds;
+}
+
+static bool same_frame(const struct vi_frame* a, const struct vi_frame* b)
+{
+    return a->written == b->written && a->invalid == b->invalid &&
+           (!a->written || (a->hash == b->hash && a->width == b->width &&
+                            a->height == b->height && a->height_out == b->height_out));
+}
+
+/* async VI filtering against sync, which presents each frame one call
+ * earlier */
+static int check_vi_async(uint32_t seed)
+{
+    static const uint32_t workers[] = { 0, 1, 3 };
+    struct vi_frame sync_frames[VI_FRAMES];
+    double sync_seconds = 0.0, async_seconds = 0.0;
+    int written = 0;
+
+    rng_state = seed;
+    for (int setup = 0; setup < VI_SETUPS; ++setup) {
+        uint32_t frame_seed = rng();
+
+        random_vi_regs();
+        for (size_t w = 0; w < sizeof(workers) / sizeof(workers[0]); ++w) {
+            sync_seconds += run_vi(workers[w], false, frame_seed);
+            memcpy(sync_frames, vi_frames, sizeof(sync_frames));
+            async_seconds += run_vi(workers[w], true, frame_seed);
+
+            if (vi_frame_count != VI_FRAMES || vi_frames[0].written || !vi_frames[0].invalid) {
+                fprintf(stderr, "test_angrylion: VI setup %d: async mode presented a frame at the first call\n", setup);
+                return 0;
+            }
+            for (int f = 0; f + 1 < VI_FRAMES; ++f) {
+                if (!same_frame(&vi_frames[f + 1], &sync_frames[f])) {
+                    fprintf(stderr, "test_angrylion: VI setup %d, VI_STATUS %08x, %u workers: frame %d differs from sync\n",
+                            setup, vi_regs[VI_STATUS], workers[w], f);
+                    return 0;
+                }
+                written += sync_frames[f].written;
+            }
+        }
+    }
+
+    /* blank and invalid frames would make the check pass on nothing */
+    if (written == 0) {
+        fprintf(stderr, "test_angrylion: no VI frame was sent to the screen\n");
+        return 0;
+    }
+
+    printf("test_angrylion: async VI matches sync one frame later, %d frames; %.2f ms vs %.2f ms per update_screen call\n",
+           written, async_seconds * 1e3 / (VI_SETUPS * 3 * VI_FRAMES),
+           sync_seconds * 1e3 / (VI_SETUPS * 3 * VI_FRAMES));
+    return 1;
+}
+
+static long file_size(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    long size;
+
+    if (f == NULL)
+        return -1;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+/* the list is dumped while it runs, and angrylion-bench replaying the dump
+ * with as many workers has to print the hash of the capture */
+static int check_dump(uint32_t seed)
+{
+    static const uint32_t workers[] = { 1, 3 };
+    char dump_path[64], command[512], line[256];
+    struct run plain, captured;
+    unsigned long long replayed;
+    long size = 0;
+    int ok = 0;
+
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "test_angrylion: cannot create %s\n", dir);
+        return 0;
+    }
+    snprintf(dump_path, sizeof(dump_path), "%s/capture.rdp", dir);
+
+    for (size_t w = 0; w < sizeof(workers) / sizeof(workers[0]); ++w) {
+        FILE* bench;
+
+        setenv("ANGRYLION_RDP_DUMP_PATH", dump_path, 1);
+        run(workers[w], 0, NULL, false, seed, &captured);
+        unsetenv("ANGRYLION_RDP_DUMP_PATH");
+        run(workers[w], 0, NULL, false, seed, &plain);
+
+        /* dumping must not change what is drawn */
+        if (captured.hash != plain.hash) {
+            fprintf(stderr, "test_angrylion: %u workers: RDRAM hash %016llx while dumping, %016llx without\n",
+                    workers[w], (unsigned long long)captured.hash, (unsigned long long)plain.hash);
+            goto done;
+        }
+        size = file_size(dump_path);
+        if (size <= 0) {
+            fprintf(stderr, "test_angrylion: no dump written to %s\n", dump_path);
+            goto done;
+        }
+
+        snprintf(command, sizeof(command), "\"%s\" -t %u -q \"%s\"", ANGRYLION_BENCH, workers[w], dump_path);
+        if ((bench = popen(command, "r")) == NULL) {
+            fprintf(stderr, "test_angrylion: cannot run %s\n", command);
+            goto done;
+        }
+        replayed = 0;
+        while (fgets(line, sizeof(line), bench) != NULL)
+            sscanf(line, "hash: %llx", &replayed);
+        if (pclose(bench) != 0) {
+            fprintf(stderr, "test_angrylion: %s failed\n", command);
+            goto done;
+        }
+        if (replayed != captured.hash) {
+            fprintf(stderr, "test_angrylion: %u workers: angrylion-bench hash %016llx, %016llx when dumped\n",
+                    workers[w], replayed, (unsigned long long)captured.hash);
+            goto done;
+        }
+        printf("test_angrylion: %u workers: angrylion-bench replays the %ld KB dump to the same hash; "
+               "%.3f s dumping vs %.3f s\n", workers[w], size / 1024, captured.seconds, plain.seconds);
+    }
+    ok = 1;
+
+done:
+    remove(dump_path);
+    rmdir(dir);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    static const uint32_t workers[] = { 1, 3, 7, 16 };
+    struct run whole, binned;
+    uint32_t seed;
+
+    rng_state = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : (uint32_t)time(NULL);
+    if (rng_state == 0)
+        rng_state = 1;
+    printf("test_angrylion: seed %u\n", rng_state);
+    seed = rng();
+
+    for (int i = 0; i < DP_NUM_REG; ++i)
+        dp_reg_ptrs[i] = &dp_regs[i];
+    for (int i = 0; i < VI_NUM_REG; ++i)
+        vi_reg_ptrs[i] = &vi_regs[i];
+    build_list();
+
+    for (size_t w = 0; w < sizeof(workers) / sizeof(workers[0]); ++w) {
+        run(workers[w], 1, NULL, false, seed, &whole);
+        run(workers[w], 0, NULL, false, seed, &binned);
+
+        if (rdp_pipeline_crashed) {
+            fprintf(stderr, "test_angrylion: the list crashed the RDP\n");
+            return 1;
+        }
+        if (binned.hash != whole.hash) {
+            fprintf(stderr, "test_angrylion: %u workers: RDRAM hash %016llx binned, %016llx running the whole buffer\n",
+                    workers[w], (unsigned long long)binned.hash, (unsigned long long)whole.hash);
+            return 1;
+        }
+        /* every line belongs to the only worker */
+        if (workers[w] > 1 ? binned.prim_runs >= whole.prim_runs : binned.prim_runs != whole.prim_runs) {
+            fprintf(stderr, "test_angrylion: %u workers: %llu primitives run binned, %llu running the whole buffer\n",
+                    workers[w], (unsigned long long)binned.prim_runs, (unsigned long long)whole.prim_runs);
+            return 1;
+        }
+        printf("test_angrylion: %2u workers: %7llu commands run binned, %7llu whole (primitives %6llu vs %6llu); "
+               "%.3f s vs %.3f s\n", workers[w],
+               (unsigned long long)binned.runs, (unsigned long long)whole.runs,
+               (unsigned long long)binned.prim_runs, (unsigned long long)whole.prim_runs,
+               binned.seconds, whole.seconds);
+    }
+
+    if (!check_span_kernels(seed))
+        return 1;
+    if (!check_span_variants(seed))
+        return 1;
+    if (!check_vi_async(seed))
+        return 1;
+    if (!check_dump(seed))
+        return 1;
+
+    printf("test_angrylion: passed\n");
+    return 0;
+}
@@ -93,6 +93,10 @@ void parallelFBGetFrameBufferInfo(void *pinfo)
 {
 }
 
+void parallelFBWriteRange(unsigned int begin, unsigned int end)
+{
+}
+
 m64p_error parallelPluginGetVersion(m64p_plugin_type *PluginType, int *PluginVersion, int *APIVersion,
 		const char **PluginNamePtr, int *Capabilities)
 {